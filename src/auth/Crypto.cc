@@ -28,6 +28,7 @@
 #include "common/armor.h"
 #include "common/ceph_crypto.h"
 #include "common/config.h"
+#include "common/Mutex.h"
 #include "common/debug.h"
 #include "common/hex.h"
 #include "common/safe_io.h"
@@ -104,24 +105,148 @@ decrypt(const bufferptr& secret, const bufferlist& in,
 // when we say AES, we mean AES-128
 # define AES_KEY_LEN	16
 # define AES_BLOCK_LEN   16
+#else
+# error "No supported crypto implementation found."
+#endif
+
+/*
+ * AES-128-CBC under one secret.  Setting up the key (the key schedule
+ * for crypto++; the slot, key import and IV param for NSS) costs more
+ * than encrypting a small message, so keys keep one of these.
+ */
+class CryptoAESKeyHandler : public CryptoKeyHandler {
+#ifdef USE_CRYPTOPP
+  // newer crypto++ keeps scratch space in the cipher objects
+  mutable Mutex lock;
+  mutable CryptoPP::AES::Encryption enc;
+  mutable CryptoPP::AES::Decryption dec;
+#elif USE_NSS
+  PK11SlotInfo *slot;
+  PK11SymKey *key;
+  SECItem *param;
+
+  void nss_aes_operation(CK_ATTRIBUTE_TYPE op, const bufferlist& in,
+			 bufferlist& out, std::string &error) const;
+#endif
+
+public:
+  CryptoAESKeyHandler();
+  ~CryptoAESKeyHandler();
+  int init(const bufferptr& secret, std::string &error);
+  void encrypt(const bufferlist& in, bufferlist& out, std::string &error) const;
+  void decrypt(const bufferlist& in, bufferlist& out, std::string &error) const;
+};
+
+#ifdef USE_CRYPTOPP
 
-static void nss_aes_operation(CK_ATTRIBUTE_TYPE op, const bufferptr& secret,
-			     const bufferlist& in, bufferlist& out, std::string &error)
+CryptoAESKeyHandler::CryptoAESKeyHandler()
+  : lock("CryptoAESKeyHandler::lock", false, false)
 {
-  const CK_MECHANISM_TYPE mechanism = CKM_AES_CBC_PAD;
+}
 
-  // sample source said this has to be at least size of input + 8,
-  // but i see 15 still fail with SEC_ERROR_OUTPUT_LEN
-  bufferptr out_tmp(in.length()+16);
+CryptoAESKeyHandler::~CryptoAESKeyHandler()
+{
+}
 
-  PK11SlotInfo *slot;
+int CryptoAESKeyHandler::init(const bufferptr& secret, std::string &error)
+{
+  if (secret.length() < AES_KEY_LEN) {
+    error = "key is too short";
+    return -EINVAL;
+  }
+  const unsigned char *key = (const unsigned char *)secret.c_str();
+  enc.SetKey(key, CryptoPP::AES::DEFAULT_KEYLENGTH);
+  dec.SetKey(key, CryptoPP::AES::DEFAULT_KEYLENGTH);
+  return 0;
+}
+
+void CryptoAESKeyHandler::encrypt(const bufferlist& in, bufferlist& out,
+				  std::string &error) const
+{
+  const unsigned char *in_buf;
+
+  string ciphertext;
+  Mutex::Locker l(lock);
+  CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption( enc, (const byte*)CEPH_AES_IV );
+  CryptoPP::StringSink *sink = new CryptoPP::StringSink(ciphertext);
+  CryptoPP::StreamTransformationFilter stfEncryptor(cbcEncryption, sink);
+
+  for (std::list<bufferptr>::const_iterator it = in.buffers().begin();
+       it != in.buffers().end(); it++) {
+    in_buf = (const unsigned char *)it->c_str();
+
+    stfEncryptor.Put(in_buf, it->length());
+  }
+  try {
+    stfEncryptor.MessageEnd();
+  } catch (CryptoPP::Exception& e) {
+    ostringstream oss;
+    oss << "encryptor.MessageEnd::Exception: " << e.GetWhat();
+    error = oss.str();
+    return;
+  }
+  out.append((const char *)ciphertext.c_str(), ciphertext.length());
+}
+
+void CryptoAESKeyHandler::decrypt(const bufferlist& in, bufferlist& out,
+				  std::string &error) const
+{
+  Mutex::Locker l(lock);
+  CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption( dec, (const byte*)CEPH_AES_IV );
+
+  string decryptedtext;
+  CryptoPP::StringSink *sink = new CryptoPP::StringSink(decryptedtext);
+  CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, sink);
+  for (std::list<bufferptr>::const_iterator it = in.buffers().begin(); 
+       it != in.buffers().end(); it++) {
+      const unsigned char *in_buf = (const unsigned char *)it->c_str();
+      stfDecryptor.Put(in_buf, it->length());
+  }
+
+  try {
+    stfDecryptor.MessageEnd();
+  } catch (CryptoPP::Exception& e) {
+    ostringstream oss;
+    oss << "decryptor.MessageEnd::Exception: " << e.GetWhat();
+    error = oss.str();
+    return;
+  }
+
+  out.append((const char *)decryptedtext.c_str(), decryptedtext.length());
+}
+
+#elif USE_NSS
+
+static const CK_MECHANISM_TYPE nss_aes_mechanism = CKM_AES_CBC_PAD;
+
+CryptoAESKeyHandler::CryptoAESKeyHandler()
+  : slot(NULL), key(NULL), param(NULL)
+{
+}
+
+CryptoAESKeyHandler::~CryptoAESKeyHandler()
+{
+  if (param)
+    SECITEM_FreeItem(param, PR_TRUE);
+  if (key)
+    PK11_FreeSymKey(key);
+  if (slot)
+    PK11_FreeSlot(slot);
+}
 
-  slot = PK11_GetBestSlot(mechanism, NULL);
+int CryptoAESKeyHandler::init(const bufferptr& secret, std::string &error)
+{
+  if (secret.length() < AES_KEY_LEN) {
+    error = "key is too short";
+    return -EINVAL;
+  }
+
+  slot = PK11_GetBestSlot(nss_aes_mechanism, NULL);
   if (!slot) {
     ostringstream oss;
     oss << "cannot find NSS slot to use: " << PR_GetError();
     error = oss.str();
-    goto err;
+    return -EINVAL;
   }
 
   SECItem keyItem;
@@ -130,15 +255,13 @@ static void nss_aes_operation(CK_ATTRIBUTE_TYPE op, const bufferptr& secret,
   keyItem.data = (unsigned char*)secret.c_str();
   keyItem.len = secret.length();
 
-  PK11SymKey *key;
-
-  key = PK11_ImportSymKey(slot, mechanism, PK11_OriginUnwrap, CKA_ENCRYPT,
+  key = PK11_ImportSymKey(slot, nss_aes_mechanism, PK11_OriginUnwrap, CKA_ENCRYPT,
 			  &keyItem, NULL);
   if (!key) {
     ostringstream oss;
     oss << "cannot convert AES key for NSS: " << PR_GetError();
     error = oss.str();
-    goto err_slot;
+    return -EINVAL;
   }
 
   SECItem ivItem;
@@ -149,24 +272,31 @@ static void nss_aes_operation(CK_ATTRIBUTE_TYPE op, const bufferptr& secret,
   ivItem.data = (unsigned char*)CEPH_AES_IV;
   ivItem.len = sizeof(CEPH_AES_IV);
 
-  SECItem *param;
-
-  param = PK11_ParamFromIV(mechanism, &ivItem);
+  param = PK11_ParamFromIV(nss_aes_mechanism, &ivItem);
   if (!param) {
     ostringstream oss;
     oss << "cannot set NSS IV param: " << PR_GetError();
     error = oss.str();
-    goto err_key;
+    return -EINVAL;
   }
+  return 0;
+}
+
+void CryptoAESKeyHandler::nss_aes_operation(CK_ATTRIBUTE_TYPE op, const bufferlist& in,
+					    bufferlist& out, std::string &error) const
+{
+  // sample source said this has to be at least size of input + 8,
+  // but i see 15 still fail with SEC_ERROR_OUTPUT_LEN
+  bufferptr out_tmp(in.length()+16);
 
   PK11Context *ctx;
 
-  ctx = PK11_CreateContextBySymKey(mechanism, op, key, param);
+  ctx = PK11_CreateContextBySymKey(nss_aes_mechanism, op, key, param);
   if (!ctx) {
     ostringstream oss;
     oss << "cannot create NSS context: " << PR_GetError();
     error = oss.str();
-    goto err_param;
+    return;
   }
 
   SECStatus ret;
@@ -206,20 +336,21 @@ static void nss_aes_operation(CK_ATTRIBUTE_TYPE op, const bufferptr& secret,
   return;
 
  err_op:
- err_ctx:
   PK11_DestroyContext(ctx, PR_TRUE);
- err_param:
-  SECITEM_FreeItem(param, PR_TRUE);
- err_key:
-  PK11_FreeSymKey(key);
- err_slot:
-  PK11_FreeSlot(slot);
- err:
-  ;
 }
 
-#else
-# error "No supported crypto implementation found."
+void CryptoAESKeyHandler::encrypt(const bufferlist& in, bufferlist& out,
+				  std::string &error) const
+{
+  nss_aes_operation(CKA_ENCRYPT, in, out, error);
+}
+
+void CryptoAESKeyHandler::decrypt(const bufferlist& in, bufferlist& out,
+				  std::string &error) const
+{
+  nss_aes_operation(CKA_DECRYPT, in, out, error);
+}
+
 #endif
 
 class CryptoAES : public CryptoHandler {
@@ -232,6 +363,7 @@ public:
 	       bufferlist& out, std::string &error) const;
   void decrypt(const bufferptr& secret, const bufferlist& in, 
 	      bufferlist& out, std::string &error) const;
+  CryptoKeyHandler *get_key_handler(const bufferptr& secret) const;
 };
 
 int CryptoAES::create(bufferptr& secret)
@@ -257,78 +389,31 @@ void CryptoAES::
 encrypt(const bufferptr& secret, const bufferlist& in, bufferlist& out,
 	std::string &error) const
 {
-  if (secret.length() < AES_KEY_LEN) {
-    error = "key is too short";
+  CryptoAESKeyHandler h;
+  if (h.init(secret, error) < 0)
     return;
-  }
-#ifdef USE_CRYPTOPP
-  {
-    const unsigned char *key = (const unsigned char *)secret.c_str();
-    const unsigned char *in_buf;
-
-    string ciphertext;
-    CryptoPP::AES::Encryption aesEncryption(key, CryptoPP::AES::DEFAULT_KEYLENGTH);
-    CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption( aesEncryption, (const byte*)CEPH_AES_IV );
-    CryptoPP::StringSink *sink = new CryptoPP::StringSink(ciphertext);
-    CryptoPP::StreamTransformationFilter stfEncryptor(cbcEncryption, sink);
-
-    for (std::list<bufferptr>::const_iterator it = in.buffers().begin();
-	 it != in.buffers().end(); it++) {
-      in_buf = (const unsigned char *)it->c_str();
-
-      stfEncryptor.Put(in_buf, it->length());
-    }
-    try {
-      stfEncryptor.MessageEnd();
-    } catch (CryptoPP::Exception& e) {
-      ostringstream oss;
-      oss << "encryptor.MessageEnd::Exception: " << e.GetWhat();
-      error = oss.str();
-      return;
-    }
-    out.append((const char *)ciphertext.c_str(), ciphertext.length());
-  }
-#elif USE_NSS
-  nss_aes_operation(CKA_ENCRYPT, secret, in, out, error);
-#else
-# error "No supported crypto implementation found."
-#endif
+  h.encrypt(in, out, error);
 }
 
 void CryptoAES::
 decrypt(const bufferptr& secret, const bufferlist& in, 
 	bufferlist& out, std::string &error) const
 {
-#ifdef USE_CRYPTOPP
-  const unsigned char *key = (const unsigned char *)secret.c_str();
-
-  CryptoPP::AES::Decryption aesDecryption(key, CryptoPP::AES::DEFAULT_KEYLENGTH);
-  CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption( aesDecryption, (const byte*)CEPH_AES_IV );
-
-  string decryptedtext;
-  CryptoPP::StringSink *sink = new CryptoPP::StringSink(decryptedtext);
-  CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, sink);
-  for (std::list<bufferptr>::const_iterator it = in.buffers().begin(); 
-       it != in.buffers().end(); it++) {
-      const unsigned char *in_buf = (const unsigned char *)it->c_str();
-      stfDecryptor.Put(in_buf, it->length());
-  }
-
-  try {
-    stfDecryptor.MessageEnd();
-  } catch (CryptoPP::Exception& e) {
-    ostringstream oss;
-    oss << "decryptor.MessageEnd::Exception: " << e.GetWhat();
-    error = oss.str();
+  CryptoAESKeyHandler h;
+  if (h.init(secret, error) < 0)
     return;
-  }
+  h.decrypt(in, out, error);
+}
 
-  out.append((const char *)decryptedtext.c_str(), decryptedtext.length());
-#elif USE_NSS
-  nss_aes_operation(CKA_DECRYPT, secret, in, out, error);
-#else
-# error "No supported crypto implementation found."
-#endif
+CryptoKeyHandler *CryptoAES::get_key_handler(const bufferptr& secret) const
+{
+  CryptoAESKeyHandler *h = new CryptoAESKeyHandler;
+  std::string error;
+  if (h->init(secret, error) < 0) {
+    delete h;
+    return NULL;
+  }
+  return h;
 }
 
 
@@ -351,6 +436,15 @@ CryptoHandler *get_crypto_handler(int type)
 
 // ---------------------------------------------------
 
+void CryptoKey::_set_secret(const bufferptr& s)
+{
+  secret = s;
+  ckh.reset();
+  CryptoHandler *h = get_crypto_handler(type);
+  if (h)
+    ckh.reset(h->get_key_handler(secret));
+}
+
 int CryptoKey::set_secret(CephContext *cct, int type, bufferptr& s)
 {
   this->type = type;
@@ -364,7 +458,7 @@ int CryptoKey::set_secret(CephContext *cct, int type, bufferptr& s)
   if (ret < 0)
     return ret;
 
-  secret = s;
+  _set_secret(s);
 
   return 0;
 }
@@ -377,12 +471,21 @@ int CryptoKey::create(CephContext *cct, int t)
   CryptoHandler *h = get_crypto_handler(type);
   if (!h)
     return -EOPNOTSUPP;
-  return h->create(secret);
+  bufferptr s;
+  int r = h->create(s);
+  if (r < 0)
+    return r;
+  _set_secret(s);
+  return 0;
 }
 
 void CryptoKey::
 encrypt(const bufferlist& in, bufferlist& out, std::string &error) const
 {
+  if (ckh) {
+    ckh->encrypt(in, out, error);
+    return;
+  }
   CryptoHandler *h = get_crypto_handler(type);
   if (!h) {
     ostringstream oss;
@@ -395,6 +498,10 @@ encrypt(const bufferlist& in, bufferlist& out, std::string &error) const
 void CryptoKey::
 decrypt(const bufferlist& in, bufferlist& out, std::string &error) const
 {
+  if (ckh) {
+    ckh->decrypt(in, out, error);
+    return;
+  }
   CryptoHandler *h = get_crypto_handler(type);
   if (!h) {
     ostringstream oss;
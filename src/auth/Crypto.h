@@ -18,8 +18,10 @@
 #include "include/utime.h"
 
 #include <string>
+#include <tr1/memory>
 
 class CephContext;
+class CryptoKeyHandler;
 
 /*
  * match encoding of struct ceph_secret
@@ -30,9 +32,16 @@ protected:
   utime_t created;
   bufferptr secret;
 
+  // the cipher state for secret, shared by copies of this key
+  std::tr1::shared_ptr<CryptoKeyHandler> ckh;
+
+  void _set_secret(const bufferptr& s);
+
 public:
   CryptoKey() : type(0) { }
-  CryptoKey(int t, utime_t c, bufferptr& s) : type(t), created(c), secret(s) { }
+  CryptoKey(int t, utime_t c, bufferptr& s) : type(t), created(c) {
+    _set_secret(s);
+  }
 
   void encode(bufferlist& bl) const {
     ::encode(type, bl);
@@ -46,8 +55,10 @@ public:
     ::decode(created, bl);
     __u16 len;
     ::decode(len, bl);
-    bl.copy(len, secret);
-    secret.c_str();   // make sure it's a single buffer!
+    bufferptr s;
+    bl.copy(len, s);
+    s.c_str();   // make sure it's a single buffer!
+    _set_secret(s);
   }
 
   int get_type() const { return type; }
@@ -55,7 +66,6 @@ public:
   void print(std::ostream& out) const;
 
   int set_secret(CephContext *cct, int type, bufferptr& s);
-  bufferptr& get_secret() { return secret; }
   const bufferptr& get_secret() const { return secret; }
 
   void encode_base64(string& s) const {
@@ -91,6 +101,20 @@ static inline ostream& operator<<(ostream& out, const CryptoKey& k)
 }
 
 
+/*
+ * The cipher set up for one secret (the key schedule, or the imported
+ * key), so that it need not be redone for every message.  Used from
+ * several threads at once.
+ */
+class CryptoKeyHandler {
+public:
+  virtual ~CryptoKeyHandler() {}
+  virtual void encrypt(const bufferlist& in, bufferlist& out,
+		       std::string &error) const = 0;
+  virtual void decrypt(const bufferlist& in, bufferlist& out,
+		       std::string &error) const = 0;
+};
+
 /*
  * Driver for a particular algorithm
  *
@@ -106,6 +130,10 @@ public:
 		      bufferlist& out, std::string &error) const = 0;
   virtual void decrypt(const bufferptr& secret, const bufferlist& in,
 		      bufferlist& out, std::string &error) const = 0;
+  /// NULL if secret is unusable, or there's nothing worth keeping
+  virtual CryptoKeyHandler *get_key_handler(const bufferptr& secret) const {
+    return NULL;
+  }
 };
 
 extern CryptoHandler *get_crypto_handler(int type);
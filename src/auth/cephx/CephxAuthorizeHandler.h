@@ -16,10 +16,13 @@
 #define CEPH_CEPHXAUTHORIZEHANDLER_H
 
 #include "../AuthAuthorizeHandler.h"
+#include "CephxProtocol.h"
 
 class CephContext;
 
 struct CephxAuthorizeHandler : public AuthAuthorizeHandler {
+  CephXTicketCache ticket_cache;
+
   bool verify_authorizer(CephContext *cct, KeyStore *keys,
 			 bufferlist& authorizer_data, bufferlist& authorizer_reply,
                          EntityName& entity_name, uint64_t& global_id,
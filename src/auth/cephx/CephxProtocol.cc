@@ -394,9 +394,85 @@ bool cephx_decode_ticket(CephContext *cct, KeyStore *keys, uint32_t service_id,
  *
  * {timestamp + 1}^session_key
  */
+static void bl_to_str(const bufferlist& bl, std::string *s)
+{
+  s->clear();
+  s->reserve(bl.length());
+  for (std::list<bufferptr>::const_iterator p = bl.buffers().begin();
+       p != bl.buffers().end(); ++p)
+    s->append(p->c_str(), p->length());
+}
+
+void CephXTicketCache::make_key(uint32_t service_id, const CephXTicketBlob& ticket,
+				key_t *k)
+{
+  k->id = service_secret_t(service_id, ticket.secret_id);
+  bl_to_str(ticket.blob, &k->blob);
+}
+
+void CephXTicketCache::_remove(std::map<key_t, entry_t>::iterator p)
+{
+  lru.erase(p->second.lru_pos);
+  entries.erase(p);
+}
+
+bool CephXTicketCache::lookup(uint32_t service_id, const CephXTicketBlob& ticket,
+			      const CryptoKey& secret, utime_t now,
+			      CephXServiceTicketInfo& info)
+{
+  key_t k;
+  make_key(service_id, ticket, &k);
+  Mutex::Locker l(lock);
+  std::map<key_t, entry_t>::iterator p = entries.find(k);
+  if (p == entries.end())
+    return false;
+  const bufferptr& s = secret.get_secret();
+  if (p->second.info.ticket.expires <= now ||
+      p->second.secret.size() != s.length() ||
+      memcmp(p->second.secret.data(), s.c_str(), s.length()) != 0) {
+    // expired, or the secret changed under this secret_id
+    _remove(p);
+    return false;
+  }
+  lru.splice(lru.begin(), lru, p->second.lru_pos);
+  info = p->second.info;
+  return true;
+}
+
+void CephXTicketCache::add(CephContext *cct, uint32_t service_id,
+			   const CephXTicketBlob& ticket, const CryptoKey& secret,
+			   const CephXServiceTicketInfo& info)
+{
+  size_t max = cct->_conf->auth_ticket_cache_size;
+  if (!max)
+    return;
+  key_t k;
+  make_key(service_id, ticket, &k);
+  Mutex::Locker l(lock);
+  std::map<key_t, entry_t>::iterator p = entries.find(k);
+  if (p != entries.end())
+    _remove(p);
+  while (entries.size() >= max)
+    _remove(entries.find(lru.back()));
+  entry_t& e = entries[k];
+  const bufferptr& s = secret.get_secret();
+  e.secret.assign(s.c_str(), s.length());
+  e.info = info;
+  lru.push_front(k);
+  e.lru_pos = lru.begin();
+}
+
+void CephXTicketCache::clear()
+{
+  Mutex::Locker l(lock);
+  entries.clear();
+  lru.clear();
+}
+
 bool cephx_verify_authorizer(CephContext *cct, KeyStore *keys,
 			     bufferlist::iterator& indata,
-			     CephXServiceTicketInfo& ticket_info, bufferlist& reply_bl)
+			     CephXServiceTicketInfo& ticket_info, bufferlist& reply_bl,
+			     CephXTicketCache *cache)
 {
   __u8 authorizer_v;
   uint32_t service_id;
@@ -435,11 +511,18 @@ bool cephx_verify_authorizer(CephContext *cct, KeyStore *keys,
     }
   }
   std::string error;
-  decode_decrypt_enc_bl(ticket_info, service_secret, ticket.blob, error);
-  if (!error.empty()) {
-    ldout(cct, 0) << "verify_authorizer could not decrypt ticket info: error: "
-      << error << dendl;
-    return false;
+  if (cache && cache->lookup(service_id, ticket, service_secret,
+			     ceph_clock_now(cct), ticket_info)) {
+    ldout(cct, 20) << "verify_authorizer ticket found in cache" << dendl;
+  } else {
+    decode_decrypt_enc_bl(ticket_info, service_secret, ticket.blob, error);
+    if (!error.empty()) {
+      ldout(cct, 0) << "verify_authorizer could not decrypt ticket info: error: "
+	<< error << dendl;
+      return false;
+    }
+    if (cache && ticket_info.ticket.expires > ceph_clock_now(cct))
+      cache->add(cct, service_id, ticket, service_secret, ticket_info);
   }
 
   if (ticket_info.ticket.global_id != global_id) {
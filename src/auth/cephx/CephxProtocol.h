@@ -85,8 +85,11 @@
 #include "../Auth.h"
 #include "../RotatingKeyRing.h"
 #include "common/debug.h"
+#include "common/Mutex.h"
 
 #include <errno.h>
+#include <list>
+#include <map>
 #include <sstream>
 
 class CephContext;
@@ -408,11 +411,53 @@ bool cephx_decode_ticket(CephContext *cct, KeyStore *keys,
 			 CephXServiceTicketInfo& ticket_info);
 
 /*
- * Verify authorizer and generate reply authorizer
+ * Service tickets we have already decrypted, so that a client
+ * reconnecting with the same ticket (after a network blip, say) costs
+ * us one decrypt of its authorize request rather than two.  Entries are
+ * found by the exact ticket blob and the secret it was sealed with, and
+ * kept until the ticket expires; past auth_ticket_cache_size entries,
+ * the least recently used one goes.
+ */
+class CephXTicketCache {
+  typedef std::pair<uint32_t, uint64_t> service_secret_t;  // service, secret_id
+  struct key_t {
+    service_secret_t id;
+    std::string blob;
+    bool operator<(const key_t& o) const {
+      return id < o.id || (id == o.id && blob < o.blob);
+    }
+  };
+  struct entry_t {
+    std::string secret;
+    CephXServiceTicketInfo info;
+    std::list<key_t>::iterator lru_pos;
+  };
+
+  Mutex lock;
+  std::map<key_t, entry_t> entries;
+  std::list<key_t> lru;   // most recently used first
+
+  static void make_key(uint32_t service_id, const CephXTicketBlob& ticket, key_t *k);
+  void _remove(std::map<key_t, entry_t>::iterator p);
+
+public:
+  CephXTicketCache() : lock("CephXTicketCache::lock") {}
+
+  bool lookup(uint32_t service_id, const CephXTicketBlob& ticket,
+	      const CryptoKey& secret, utime_t now, CephXServiceTicketInfo& info);
+  void add(CephContext *cct, uint32_t service_id, const CephXTicketBlob& ticket,
+	   const CryptoKey& secret, const CephXServiceTicketInfo& info);
+  void clear();
+};
+
+/*
+ * Verify authorizer and generate reply authorizer.  With a cache, skip
+ * decrypting tickets we have seen before.
  */
 extern bool cephx_verify_authorizer(CephContext *cct, KeyStore *keys,
 				    bufferlist::iterator& indata,
-				    CephXServiceTicketInfo& ticket_info, bufferlist& reply_bl);
+				    CephXServiceTicketInfo& ticket_info, bufferlist& reply_bl,
+				    CephXTicketCache *cache = NULL);
 
 
 
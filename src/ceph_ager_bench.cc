@@ -0,0 +1,323 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * FileStore aging benchmark.
+ *
+ *   ceph_ager_bench <store dir> <journal> [options]
+ *
+ * a fresh store is created (mkfs), measured, and then aged with the Ager:
+ * each cycle fills the file system to --fill with objects drawn from the
+ * --sizes distribution and deletes random ones down to --low.  every
+ * --interval cycles we measure again:
+ *
+ *   wr       MB/s writing --probe-mb of new 4MB objects (then synced)
+ *   rd       MB/s reading them back
+ *   aged rd  MB/s reading up to --probe-mb of the aged objects
+ *   extents  physical extents of the aged objects (FIEMAP), their average
+ *            size, per object, and the average seek between consecutive
+ *            extents of an object
+ *
+ * the probe objects are removed again, so leave --probe-mb of room above
+ * --low.  each row also gives throughput relative to the fresh store, so
+ * the output is a degradation curve per backing file system.  with
+ * --drop-caches (root only) the page cache is dropped before reads.
+ *
+ * size distributions (KB per object, written at 1/2 to 1x that):
+ *
+ *   default  the Ager's own: 1, 512, 1024, 2048
+ *   rbd      mostly whole 4MB image objects, some short and sparse ones
+ *   rgw      small heads plus 4MB stripes of larger uploads
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/vfs.h>
+using namespace std;
+
+#include "os/FileStore.h"
+#include "osd/Ager.h"
+#include "include/Distribution.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+
+void usage()
+{
+  cerr << "usage: ceph_ager_bench <store dir> <journal> [options]\n"
+       << "options:\n"
+       << "  --sizes <d>          default, rbd or rgw (default rbd)\n"
+       << "  --fill <pc>          fill to this fraction of the fs (default .9)\n"
+       << "  --low <pc>           then empty to this fraction (default fill - .1)\n"
+       << "  --cycles <n>         fill/empty cycles (default 20)\n"
+       << "  --interval <n>       cycles between measurements (default 1)\n"
+       << "  --probe-mb <n>       MB written and read per measurement (default 256)\n"
+       << "  --seconds <n>        stop aging after this long (default: no limit)\n"
+       << "  --drop-caches        drop the page cache before each read\n";
+  exit(1);
+}
+
+static const unsigned PROBE_OBJ = 4 << 20;
+
+class AgerBench {
+  FileStore *fs;
+  coll_t aged_cid, probe_cid;
+  unsigned probe_mb;
+  bool drop_caches;
+  bufferlist data;
+  double base_wr, base_rd;
+
+  hobject_t probe_obj(unsigned n) {
+    char name[32];
+    snprintf(name, sizeof(name), "probe_%u", n);
+    return hobject_t(sobject_t(object_t(name), CEPH_NOSNAP));
+  }
+
+  void maybe_drop_caches() {
+    if (!drop_caches)
+      return;
+    fs->sync_and_flush();
+    ::sync();
+    FILE *f = fopen("/proc/sys/vm/drop_caches", "w");
+    if (!f) {
+      cerr << "can't drop caches (not root?), continuing without" << std::endl;
+      drop_caches = false;
+      return;
+    }
+    fputs("3\n", f);
+    fclose(f);
+  }
+
+  double write_probe(unsigned n) {
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (unsigned i = 0; i < n; i++) {
+      ObjectStore::Transaction t;
+      t.write(probe_cid, probe_obj(i), 0, data.length(), data);
+      fs->apply_transaction(t);
+    }
+    fs->sync_and_flush();
+    double secs = (double)(ceph_clock_now(g_ceph_context) - start);
+    return (double)n * PROBE_OBJ / secs / (1024*1024);
+  }
+
+  double read_objects(coll_t cid, const vector<hobject_t>& ls) {
+    maybe_drop_caches();
+    uint64_t bytes = 0;
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (vector<hobject_t>::const_iterator p = ls.begin(); p != ls.end(); ++p) {
+      bufferlist bl;
+      int r = fs->read(cid, *p, 0, 0, bl);
+      if (r > 0)
+	bytes += r;
+    }
+    double secs = (double)(ceph_clock_now(g_ceph_context) - start);
+    return secs > 0 ? (double)bytes / secs / (1024*1024) : 0;
+  }
+
+  void remove_probe(unsigned n) {
+    ObjectStore::Transaction t;
+    for (unsigned i = 0; i < n; i++)
+      t.remove(probe_cid, probe_obj(i));
+    fs->apply_transaction(t);
+    fs->sync_and_flush();
+  }
+
+public:
+  AgerBench(FileStore *f, unsigned pmb, bool drop)
+    : fs(f), aged_cid("ager"), probe_cid("ager_probe"),
+      probe_mb(pmb), drop_caches(drop), base_wr(0), base_rd(0) {
+    bufferptr bp(PROBE_OBJ);
+    for (unsigned i = 0; i < PROBE_OBJ; i++)
+      bp.c_str()[i] = rand();
+    data.push_back(bp);
+  }
+
+  coll_t get_aged_cid() { return aged_cid; }
+
+  int setup() {
+    ObjectStore::Transaction t;
+    t.create_collection(aged_cid);
+    t.create_collection(probe_cid);
+    return fs->apply_transaction(t);
+  }
+
+  void header() {
+    cout << "#cycle\tGB aged\tused\twr MB/s\twr %\trd MB/s\trd %\taged rd\t"
+	 << "extents\tavg KB\text/obj\tavg jump KB" << std::endl;
+  }
+
+  void measure(int cycle, uint64_t aged_kb) {
+    unsigned n = probe_mb * (1024*1024) / PROBE_OBJ;
+    if (!n)
+      n = 1;
+
+    double wr = write_probe(n);
+    vector<hobject_t> ls;
+    for (unsigned i = 0; i < n; i++)
+      ls.push_back(probe_obj(i));
+    double rd = read_objects(probe_cid, ls);
+    remove_probe(n);
+
+    // as much of the aged data as we probed, or all of it
+    vector<hobject_t> all, sample;
+    fs->collection_list(aged_cid, all);
+    uint64_t want = (uint64_t)n * PROBE_OBJ, have = 0;
+    for (vector<hobject_t>::iterator p = all.begin(); p != all.end() && have < want; ++p) {
+      struct stat st;
+      if (fs->stat(aged_cid, *p, &st) < 0)
+	continue;
+      sample.push_back(*p);
+      have += st.st_size;
+    }
+    double aged_rd = read_objects(aged_cid, sample);
+
+    ObjectStore::FragmentationStat frag;
+    fs->_get_frag_stat(frag);
+
+    struct statfs sfs;
+    fs->statfs(&sfs);
+    double used = 1.0 - (double)sfs.f_bfree / (double)sfs.f_blocks;
+
+    if (cycle == 0) {
+      base_wr = wr;
+      base_rd = rd;
+    }
+    char line[256];
+    snprintf(line, sizeof(line),
+	     "%d\t%.2f\t%.3f\t%.1f\t%.0f\t%.1f\t%.0f\t%.1f\t%d\t%d\t%.2f\t%d",
+	     cycle, (double)aged_kb / (1024*1024), used,
+	     wr, base_wr > 0 ? wr * 100.0 / base_wr : 0,
+	     rd, base_rd > 0 ? rd * 100.0 / base_rd : 0,
+	     aged_rd, frag.num_extent, frag.avg_extent,
+	     frag.avg_extent_per_object, frag.avg_extent_jump);
+    cout << line << std::endl;
+  }
+};
+
+static bool pick_sizes(const string& name, Distribution *d)
+{
+  if (name == "rbd") {
+    d->add(4096, 90);
+    d->add(1024, 5);
+    d->add(64, 5);
+  } else if (name == "rgw") {
+    d->add(4, 30);
+    d->add(64, 25);
+    d->add(512, 20);
+    d->add(4096, 25);
+  } else {
+    return false;
+  }
+  d->normalize();
+  return true;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  string sizes = "rbd";
+  double fill = .9, low = -1;
+  int cycles = 20, interval = 1, probe_mb = 256, seconds = 0;
+  bool drop_caches = false;
+  vector<const char*> paths;
+  string val;
+  ostringstream err;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+    } else if (ceph_argparse_flag(args, i, "--drop-caches", (char*)NULL)) {
+      drop_caches = true;
+    } else if (ceph_argparse_witharg(args, i, &val, "--sizes", (char*)NULL)) {
+      sizes = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--fill", (char*)NULL)) {
+      fill = atof(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--low", (char*)NULL)) {
+      low = atof(val.c_str());
+    } else if (ceph_argparse_withint(args, i, &cycles, &err, "--cycles", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &interval, &err, "--interval", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &probe_mb, &err, "--probe-mb", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &seconds, &err, "--seconds", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(1);
+      }
+    } else {
+      paths.push_back(*i);
+      ++i;
+    }
+  }
+  if (low < 0)
+    low = fill - .1;
+  if (paths.size() != 2 || fill <= 0 || fill >= 1 || low < 0 || low >= fill ||
+      cycles <= 0 || interval <= 0 || probe_mb <= 0 || seconds < 0)
+    usage();
+
+  Distribution distn;
+  if (sizes != "default" && !pick_sizes(sizes, &distn))
+    usage();
+
+  srand(getpid());
+  FileStore *fs = new FileStore(paths[0], paths[1]);
+  cout << "store " << paths[0] << " journal " << paths[1]
+       << " sizes " << sizes << " fill " << fill << " low " << low << std::endl;
+  if (fs->mkfs() < 0) {
+    cerr << "mkfs failed" << std::endl;
+    return 1;
+  }
+  if (fs->mount() < 0) {
+    cerr << "mount failed" << std::endl;
+    return 1;
+  }
+
+  AgerBench bench(fs, probe_mb, drop_caches);
+  int r = bench.setup();
+  if (r < 0) {
+    cerr << "setup failed: " << r << std::endl;
+    return 1;
+  }
+
+  Ager ager(fs, bench.get_aged_cid());
+  if (sizes != "default")
+    ager.set_size_distribution(distn);
+
+  utime_t until = ceph_clock_now(g_ceph_context);
+  until.sec_ref() += seconds ? seconds : 10 * 365 * 24 * 3600;
+
+  bench.header();
+  bench.measure(0, 0);
+  uint64_t aged_kb = 0;
+  for (int c = 1; c <= cycles; c++) {
+    if (ceph_clock_now(g_ceph_context) > until)
+      break;
+    aged_kb += ager.age_cycle(fill, low, until);
+    fs->sync_and_flush();
+    if (c % interval == 0 || c == cycles)
+      bench.measure(c, aged_kb);
+  }
+
+  fs->umount();
+  delete fs;
+  return 0;
+}
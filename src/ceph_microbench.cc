@@ -0,0 +1,445 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Microbenchmarks of hot primitives: bufferlist operations, encoding
+ * and decoding of the osd's common types and of an OSDMap, crush
+ * mapping, interval_set, crc32c and hobject_t comparison and hashing.
+ *
+ *   ceph_microbench [--filter substr] [--min-time sec] [--repeat n] [--list]
+ *
+ * Each kernel is first calibrated to the number of iterations that
+ * takes at least --min-time, then timed --repeat times at that count.
+ * Results (ns per iteration: median, min and max over the repeats, and
+ * MB/s for kernels that move bytes) are printed as JSON, so runs can be
+ * kept and compared.  Compare medians from the same machine; pin the
+ * process (taskset) and keep the machine otherwise idle.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "common/ceph_argparse.h"
+#include "common/config.h"
+#include "common/Formatter.h"
+#include "global/global_context.h"
+#include "global/global_init.h"
+#include "include/buffer.h"
+#include "include/crc32c.h"
+#include "include/interval_set.h"
+#include "osd/OSDMap.h"
+#include "osd/PG.h"
+#include "osd/osd_types.h"
+
+// results go here, so the compiler can't throw the work away
+static volatile uint64_t sink;
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+struct Bench {
+  const char *name;
+  void (*run)(uint64_t iters);
+  uint64_t bytes;    // moved per iteration, 0 if that doesn't apply
+};
+
+// --- bufferlist ---
+
+static void bl_append_small(uint64_t iters)
+{
+  char buf[32];
+  memset(buf, 1, sizeof(buf));
+  bufferlist bl;
+  for (uint64_t i = 0; i < iters; i++) {
+    bl.append(buf, sizeof(buf));
+    if ((i & 1023) == 1023)
+      bl.clear();
+  }
+  sink += bl.length();
+}
+
+static void bl_append_4k(uint64_t iters)
+{
+  static char buf[4096];
+  bufferlist bl;
+  for (uint64_t i = 0; i < iters; i++) {
+    bl.append(buf, sizeof(buf));
+    if ((i & 255) == 255)
+      bl.clear();
+  }
+  sink += bl.length();
+}
+
+static void bl_rebuild(uint64_t iters)
+{
+  vector<bufferptr> pieces;
+  for (int i = 0; i < 16; i++) {
+    bufferptr p(4096);
+    p.zero();
+    pieces.push_back(p);
+  }
+  for (uint64_t i = 0; i < iters; i++) {
+    bufferlist bl;
+    for (unsigned j = 0; j < pieces.size(); j++)
+      bl.push_back(pieces[j]);
+    bl.rebuild();
+    sink += bl.length();
+  }
+}
+
+static void bl_claim_append(uint64_t iters)
+{
+  bufferptr p(4096);
+  p.zero();
+  bufferlist dst;
+  for (uint64_t i = 0; i < iters; i++) {
+    bufferlist src;
+    for (int j = 0; j < 4; j++)
+      src.push_back(p);
+    dst.claim_append(src);
+    if ((i & 255) == 255)
+      dst.clear();
+  }
+  sink += dst.length();
+}
+
+static void bl_crc32c(uint64_t iters)
+{
+  bufferlist bl;
+  for (int i = 0; i < 16; i++) {
+    bufferptr p(4096);
+    memset(p.c_str(), i, p.length());
+    bl.push_back(p);
+  }
+  for (uint64_t i = 0; i < iters; i++)
+    sink += bl.crc32c(0);
+}
+
+// --- crc ---
+
+static void crc32c_4k(uint64_t iters)
+{
+  static unsigned char buf[4096];
+  memset(buf, 7, sizeof(buf));
+  uint32_t crc = 0;
+  for (uint64_t i = 0; i < iters; i++)
+    crc = ceph_crc32c_le(crc, buf, sizeof(buf));
+  sink += crc;
+}
+
+// --- encoding ---
+
+static PG::Log::Entry make_log_entry()
+{
+  hobject_t soid(object_t("rb.0.1234.000000000042"), "", CEPH_NOSNAP, 0x12345678);
+  PG::Log::Entry e(PG::Log::Entry::MODIFY, soid, eversion_t(12, 3456), eversion_t(12, 3455),
+		   osd_reqid_t(entity_name_t::CLIENT(4123), 1, 98765), utime_t(1300000000, 0));
+  e.dirty_known = true;
+  e.dirty.insert(0, 4096);
+  e.dirty.insert(65536, 8192);
+  return e;
+}
+
+static void encode_log_entry(uint64_t iters)
+{
+  PG::Log::Entry e = make_log_entry();
+  for (uint64_t i = 0; i < iters; i++) {
+    bufferlist bl;
+    e.encode(bl);
+    sink += bl.length();
+  }
+}
+
+static void decode_log_entry(uint64_t iters)
+{
+  bufferlist bl;
+  make_log_entry().encode(bl);
+  for (uint64_t i = 0; i < iters; i++) {
+    PG::Log::Entry e;
+    bufferlist::iterator p = bl.begin();
+    e.decode(p);
+    sink += e.version.version;
+  }
+}
+
+static object_info_t make_object_info()
+{
+  hobject_t soid(object_t("rb.0.1234.000000000042"), "", CEPH_NOSNAP, 0x12345678);
+  object_locator_t oloc(3);
+  object_info_t oi(soid, oloc);
+  oi.version = eversion_t(12, 3456);
+  oi.prior_version = eversion_t(12, 3455);
+  oi.size = 4194304;
+  oi.mtime = utime_t(1300000000, 0);
+  return oi;
+}
+
+static void encode_object_info(uint64_t iters)
+{
+  object_info_t oi = make_object_info();
+  for (uint64_t i = 0; i < iters; i++) {
+    bufferlist bl;
+    oi.encode(bl);
+    sink += bl.length();
+  }
+}
+
+static void decode_object_info(uint64_t iters)
+{
+  bufferlist bl;
+  make_object_info().encode(bl);
+  for (uint64_t i = 0; i < iters; i++) {
+    object_info_t oi(bl);
+    sink += oi.size;
+  }
+}
+
+static OSDMap *bench_osdmap = NULL;
+
+static OSDMap *get_osdmap()
+{
+  if (!bench_osdmap) {
+    bench_osdmap = new OSDMap;
+    ceph_fsid_t fsid;
+    memset(&fsid, 0, sizeof(fsid));
+    // 100 osds in 10 racks, 2^12 pgs per pool
+    bench_osdmap->build_simple(g_ceph_context, 1, fsid, 100, 10, 12, 12, 0);
+    for (int i = 0; i < 100; i++) {
+      bench_osdmap->set_state(i, CEPH_OSD_EXISTS | CEPH_OSD_UP);
+      bench_osdmap->set_weight(i, CEPH_OSD_IN);
+    }
+  }
+  return bench_osdmap;
+}
+
+static void encode_osdmap(uint64_t iters)
+{
+  OSDMap *m = get_osdmap();
+  for (uint64_t i = 0; i < iters; i++) {
+    bufferlist bl;
+    m->encode(bl);
+    sink += bl.length();
+  }
+}
+
+static void decode_osdmap(uint64_t iters)
+{
+  bufferlist bl;
+  get_osdmap()->encode(bl);
+  for (uint64_t i = 0; i < iters; i++) {
+    OSDMap m;
+    m.decode(bl);
+    sink += m.get_epoch();
+  }
+}
+
+// --- crush ---
+
+static void crush_map_pg(uint64_t iters)
+{
+  OSDMap *m = get_osdmap();
+  int64_t pool = m->get_pools().begin()->first;
+  for (uint64_t i = 0; i < iters; i++) {
+    vector<int> osds;
+    m->pg_to_osds(pg_t(i, pool, -1), osds);
+    sink += osds.size();
+  }
+}
+
+// --- interval_set ---
+
+static void interval_set_insert(uint64_t iters)
+{
+  interval_set<uint64_t> s;
+  for (uint64_t i = 0; i < iters; i++) {
+    uint64_t j = i & 1023;
+    s.insert(j * 8192, 4096);
+    if (j == 1023)
+      s.clear();
+  }
+  sink += s.num_intervals();
+}
+
+static void interval_set_union(uint64_t iters)
+{
+  interval_set<uint64_t> a, b;
+  for (int i = 0; i < 64; i++) {
+    a.insert(i * 8192, 4096);
+    b.insert(i * 8192 + 2048, 4096);
+  }
+  for (uint64_t i = 0; i < iters; i++) {
+    interval_set<uint64_t> u;
+    u.union_of(a, b);
+    sink += u.size();
+  }
+}
+
+static void interval_set_contains(uint64_t iters)
+{
+  interval_set<uint64_t> s;
+  for (int i = 0; i < 1024; i++)
+    s.insert(i * 8192, 4096);
+  for (uint64_t i = 0; i < iters; i++)
+    sink += s.contains((i * 4099) & ((1 << 23) - 1));
+}
+
+// --- hobject_t ---
+
+static vector<hobject_t> make_hobjects()
+{
+  vector<hobject_t> v;
+  for (int i = 0; i < 1024; i++) {
+    char n[64];
+    snprintf(n, sizeof(n), "rb.0.1234.%012x", i);
+    v.push_back(hobject_t(object_t(n), "", (i & 1) ? snapid_t(CEPH_NOSNAP) : snapid_t(i), i * 2654435761u));
+  }
+  return v;
+}
+
+static void hobject_compare(uint64_t iters)
+{
+  vector<hobject_t> v = make_hobjects();
+  uint64_t less = 0;
+  for (uint64_t i = 0; i < iters; i++)
+    less += v[i & 1023] < v[(i + 1) & 1023];
+  sink += less;
+}
+
+static void hobject_hash(uint64_t iters)
+{
+  vector<hobject_t> v = make_hobjects();
+  __gnu_cxx::hash<hobject_t> h;
+  for (uint64_t i = 0; i < iters; i++)
+    sink += h(v[i & 1023]);
+}
+
+static Bench benches[] = {
+  { "bufferlist_append_32", bl_append_small, 32 },
+  { "bufferlist_append_4k", bl_append_4k, 4096 },
+  { "bufferlist_rebuild_16x4k", bl_rebuild, 16 * 4096 },
+  { "bufferlist_claim_append_4x4k", bl_claim_append, 0 },
+  { "bufferlist_crc32c_16x4k", bl_crc32c, 16 * 4096 },
+  { "crc32c_4k", crc32c_4k, 4096 },
+  { "encode_pg_log_entry", encode_log_entry, 0 },
+  { "decode_pg_log_entry", decode_log_entry, 0 },
+  { "encode_object_info", encode_object_info, 0 },
+  { "decode_object_info", decode_object_info, 0 },
+  { "encode_osdmap_100", encode_osdmap, 0 },
+  { "decode_osdmap_100", decode_osdmap, 0 },
+  { "crush_pg_to_osds_100", crush_map_pg, 0 },
+  { "interval_set_insert", interval_set_insert, 0 },
+  { "interval_set_union_64", interval_set_union, 0 },
+  { "interval_set_contains_1024", interval_set_contains, 0 },
+  { "hobject_compare", hobject_compare, 0 },
+  { "hobject_hash", hobject_hash, 0 },
+  { NULL, NULL, 0 }
+};
+
+static void usage()
+{
+  cerr << "usage: ceph_microbench [--filter substr] [--min-time sec] [--repeat n] [--list]\n";
+  exit(1);
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY,
+	      CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+
+  string filter;
+  double min_time = 0.2;
+  int repeat = 5;
+  bool list = false;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    string val;
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &val, "--filter", (char*)NULL)) {
+      filter = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--min-time", (char*)NULL)) {
+      min_time = atof(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--repeat", (char*)NULL)) {
+      repeat = atoi(val.c_str());
+    } else if (ceph_argparse_flag(args, i, "--list", (char*)NULL)) {
+      list = true;
+    } else {
+      usage();
+    }
+  }
+  if (repeat < 1 || min_time <= 0)
+    usage();
+
+  JSONFormatter f(true);
+  f.open_array_section("microbench");
+  for (Bench *b = benches; b->name; b++) {
+    if (filter.length() && !strstr(b->name, filter.c_str()))
+      continue;
+    if (list) {
+      cout << b->name << std::endl;
+      continue;
+    }
+
+    // calibrate: double until one run takes min_time
+    b->run(1);   // warm up (and build shared fixtures)
+    uint64_t iters = 1;
+    while (true) {
+      double start = now_sec();
+      b->run(iters);
+      if (now_sec() - start >= min_time || iters >= (1ull << 40))
+	break;
+      iters *= 2;
+    }
+
+    vector<double> ns;
+    for (int r = 0; r < repeat; r++) {
+      double start = now_sec();
+      b->run(iters);
+      ns.push_back((now_sec() - start) * 1000000000.0 / iters);
+    }
+    sort(ns.begin(), ns.end());
+    double median = ns[ns.size() / 2];
+
+    f.open_object_section("bench");
+    f.dump_string("name", b->name);
+    f.dump_unsigned("iterations", iters);
+    f.dump_float("ns_median", median);
+    f.dump_float("ns_min", ns.front());
+    f.dump_float("ns_max", ns.back());
+    if (b->bytes)
+      f.dump_float("mb_per_sec", b->bytes / median * 1000000000.0 / 1048576.0);
+    f.close_section();
+    f.flush(cout);   // as we go; the slow ones take a while
+    cout.flush();
+  }
+  f.close_section();
+  if (!list) {
+    f.flush(cout);
+    cout << std::endl;
+  }
+  return 0;
+}
@@ -39,6 +39,86 @@ using namespace std;
 #include "common/errno.h"
 
 #include "perfglue/heap_profiler.h"
+#include "common/numa.h"
+
+/*
+ * The NUMA node osd_numa_auto should use: the one most of our nics and
+ * disks hang off, ties going to the nics, or -1 if we can't tell.
+ */
+static int detect_numa_node()
+{
+  int votes[CPU_SETSIZE] = { 0 };
+  int best = -1;
+  const entity_addr_t *addrs[] = { &g_conf->cluster_addr, &g_conf->public_addr };
+  for (unsigned i = 0; i < 2; i++) {
+    if (addrs[i]->is_blank_ip())
+      continue;
+    string iface;
+    int node;
+    if (get_addr_iface((const sockaddr*)&addrs[i]->addr, &iface) == 0 &&
+	get_iface_numa_node(iface, &node) == 0 && node < CPU_SETSIZE) {
+      dout(1) << "numa: " << *addrs[i] << " is on " << iface << ", node " << node << dendl;
+      votes[node] += 2;
+      if (best < 0 || votes[node] > votes[best])
+	best = node;
+    }
+  }
+  const string *paths[] = { &g_conf->osd_journal, &g_conf->osd_data };
+  for (unsigned i = 0; i < 2; i++) {
+    int node;
+    if (!paths[i]->empty() &&
+	get_path_numa_node(*paths[i], &node) == 0 && node < CPU_SETSIZE) {
+      dout(1) << "numa: " << *paths[i] << " is on node " << node << dendl;
+      votes[node] += 1;
+      if (best < 0 || votes[node] > votes[best])
+	best = node;
+    }
+  }
+  return best;
+}
+
+/*
+ * Restrict ourselves (and every thread we create from here on) to
+ * osd_cpus, or to the cpus of the osd_numa_node (or detected) node,
+ * preferring that node's memory too.  Per-pool cpu lists
+ * (osd_op_thread_cpus etc.) are applied on top of this as each pool
+ * starts.
+ */
+static void set_osd_placement()
+{
+  cpu_set_t cpus;
+  int node = g_conf->osd_numa_node;
+  if (node < 0 && g_conf->osd_numa_auto && g_conf->osd_cpus.empty())
+    node = detect_numa_node();
+
+  if (!g_conf->osd_cpus.empty()) {
+    if (parse_cpu_set_list(g_conf->osd_cpus, &cpus) < 0) {
+      derr << "ignoring malformed osd_cpus '" << g_conf->osd_cpus << "'" << dendl;
+      return;
+    }
+  } else if (node >= 0) {
+    int r = get_numa_node_cpu_set(node, &cpus);
+    if (r < 0) {
+      derr << "can't find cpus of numa node " << node << ": " << cpp_strerror(r) << dendl;
+      return;
+    }
+    r = set_numa_mempolicy_preferred(node);
+    if (r < 0)
+      derr << "can't prefer memory of numa node " << node << ": " << cpp_strerror(r) << dendl;
+  } else {
+    return;
+  }
+
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+    int r = errno;
+    derr << "can't run on cpus " << cpu_set_to_str_list(&cpus) << ": " << cpp_strerror(r) << dendl;
+    return;
+  }
+  dout(0) << "running on cpus " << cpu_set_to_str_list(&cpus);
+  if (node >= 0)
+    *_dout << " (numa node " << node << ")";
+  *_dout << dendl;
+}
 
 void usage() 
 {
@@ -242,6 +322,8 @@ int main(int argc, const char **argv)
 	 << TEXT_NORMAL << dendl;
   }
 
+  set_osd_placement();
+
   SimpleMessenger *client_messenger = new SimpleMessenger(g_ceph_context);
   SimpleMessenger *cluster_messenger = new SimpleMessenger(g_ceph_context);
   SimpleMessenger *messenger_hbin = new SimpleMessenger(g_ceph_context);
@@ -268,7 +350,9 @@ int main(int argc, const char **argv)
   messenger_hbin->register_entity(entity_name_t::OSD(whoami));
   messenger_hbout->register_entity(entity_name_t::OSD(whoami));
 
-  Throttle client_throttler(g_conf->osd_client_message_size_cap);
+  Throttle client_throttler(g_ceph_context, "osd_client_bytes",
+			    g_conf->osd_client_message_size_cap, NULL,
+			    "osd_client_message_size_cap");
 
   uint64_t supported =
     CEPH_FEATURE_UID | 
@@ -283,9 +367,10 @@ int main(int argc, const char **argv)
                                SimpleMessenger::Policy::client(supported,
                                                                CEPH_FEATURE_UID |
 							       CEPH_FEATURE_PGID64));
-  //try to poison pill any OSD connections on the wrong address
+  // other osds only talk to us here as clients of a cache tier, and we
+  // to them the same way
   client_messenger->set_policy(entity_name_t::TYPE_OSD,
-			       SimpleMessenger::Policy::stateless_server(0,0));
+			       SimpleMessenger::Policy::lossy_client(supported, 0));
 
   cluster_messenger->set_default_policy(SimpleMessenger::Policy::stateless_server(0, 0));
   cluster_messenger->set_policy(entity_name_t::TYPE_MON, SimpleMessenger::Policy::client(0,0));
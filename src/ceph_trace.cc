@@ -0,0 +1,201 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/admin_socket.h"
+#include "common/admin_socket_client.h"
+#include "common/ceph_argparse.h"
+#include "common/errno.h"
+#include "common/config.h"
+#include "global/global_init.h"
+
+using std::string;
+using std::vector;
+
+static void usage()
+{
+  cerr << "usage: ceph-trace [--dump] [--slowest N] <admin socket or saved dump> [...]\n"
+       << "\n"
+       << "Gathers the trace events (see trace_sample_rate) of the given daemons and\n"
+       << "clients, and prints one timeline per traced request, slowest first, with\n"
+       << "the stage that took longest.  An argument that is not a socket is read as\n"
+       << "a dump saved with --dump, e.g. on another host.  Events from different\n"
+       << "hosts are only as comparable as their clocks.\n"
+       << "\n"
+       << "  --dump       print the raw events of the one admin socket given\n"
+       << "  --slowest N  only print the N slowest requests (default 10, 0 for all)\n";
+  exit(1);
+}
+
+struct TraceEvent {
+  double stamp;
+  string entity, point, detail;
+  bool operator<(const TraceEvent& o) const { return stamp < o.stamp; }
+};
+
+static int get_events(const string& path, string *out)
+{
+  struct stat st;
+  if (::stat(path.c_str(), &st) < 0) {
+    int err = errno;
+    cerr << path << ": " << cpp_strerror(err) << std::endl;
+    return -err;
+  }
+  if (S_ISSOCK(st.st_mode)) {
+    AdminSocketClient client(path);
+    string err = client.get_json(out, CEPH_ADMIN_SOCK_TRACES);
+    if (!err.empty()) {
+      cerr << path << ": " << err << std::endl;
+      return -EIO;
+    }
+    return 0;
+  }
+  std::ifstream f(path.c_str());
+  if (!f) {
+    cerr << path << ": can't read" << std::endl;
+    return -EIO;
+  }
+  std::ostringstream ss;
+  ss << f.rdbuf();
+  *out = ss.str();
+  return 0;
+}
+
+static void parse_events(const string& s, std::map<string, vector<TraceEvent> > *traces)
+{
+  std::istringstream in(s);
+  string line, entity;
+  while (std::getline(in, line)) {
+    std::istringstream ls(line);
+    string id;
+    ls >> id;
+    if (id == "entity") {
+      ls >> entity;
+      continue;
+    }
+    TraceEvent e;
+    e.entity = entity;
+    ls >> e.stamp >> e.point;
+    if (!ls)
+      continue;
+    std::getline(ls, e.detail);
+    if (e.detail.length() && e.detail[0] == ' ')
+      e.detail = e.detail.substr(1);
+    (*traces)[id].push_back(e);
+  }
+}
+
+static bool span_longer(const std::pair<double, string>& a, const std::pair<double, string>& b)
+{
+  return a.first > b.first;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY,
+	      CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+
+  bool dump = false;
+  int slowest = 10;
+  vector<string> paths;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    string val;
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "--dump", (char*)NULL)) {
+      dump = true;
+    } else if (ceph_argparse_witharg(args, i, &val, "--slowest", (char*)NULL)) {
+      slowest = atoi(val.c_str());
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+    } else {
+      paths.push_back(*i);
+      ++i;
+    }
+  }
+  if (paths.empty() || (dump && paths.size() != 1))
+    usage();
+
+  if (dump) {
+    string s;
+    if (get_events(paths[0], &s) < 0)
+      return 1;
+    cout << s;
+    return 0;
+  }
+
+  std::map<string, vector<TraceEvent> > traces;
+  for (unsigned i = 0; i < paths.size(); i++) {
+    string s;
+    if (get_events(paths[i], &s) < 0)
+      return 1;
+    parse_events(s, &traces);
+  }
+
+  // slowest first: by time from first to last event
+  vector<std::pair<double, string> > order;
+  for (std::map<string, vector<TraceEvent> >::iterator p = traces.begin();
+       p != traces.end();
+       ++p) {
+    std::sort(p->second.begin(), p->second.end());
+    order.push_back(std::make_pair(p->second.back().stamp - p->second.front().stamp, p->first));
+  }
+  std::sort(order.begin(), order.end(), span_longer);
+  if (slowest > 0 && order.size() > (unsigned)slowest)
+    order.resize(slowest);
+
+  cout << std::fixed << std::setprecision(3);
+  for (unsigned i = 0; i < order.size(); i++) {
+    const vector<TraceEvent>& ev = traces[order[i].second];
+    cout << "trace " << order[i].second << ": " << order[i].first * 1000.0 << " ms, "
+	 << ev.size() << " events\n";
+    double start = ev[0].stamp, longest = -1;
+    unsigned longest_at = 0;
+    for (unsigned j = 0; j < ev.size(); j++) {
+      double delta = j ? ev[j].stamp - ev[j-1].stamp : 0;
+      if (j && delta > longest) {
+	longest = delta;
+	longest_at = j;
+      }
+      cout << "  " << std::setw(10) << (ev[j].stamp - start) * 1000.0
+	   << " " << std::setw(10) << delta * 1000.0
+	   << "  " << ev[j].entity << " " << ev[j].point;
+      if (ev[j].detail.length())
+	cout << " " << ev[j].detail;
+      cout << "\n";
+    }
+    if (longest_at)
+      cout << "  slowest stage: " << ev[longest_at-1].entity << " " << ev[longest_at-1].point
+	   << " -> " << ev[longest_at].entity << " " << ev[longest_at].point
+	   << ", " << longest * 1000.0 << " ms\n";
+    cout << std::endl;
+  }
+  return 0;
+}
@@ -67,6 +67,7 @@ using namespace std;
 #define DOUT_SUBSYS client
 
 #include "include/lru.h"
+#include "include/page.h"
 
 #include "Client.h"
 #include "Inode.h"
@@ -81,6 +82,7 @@ using namespace std;
 #define dout_prefix *_dout << "client." << whoami << " "
 
 #define  tout(cct)       if (!cct->_conf->client_trace.empty()) traceout
+#define  tout_op(cct, op) if (!cct->_conf->client_trace.empty()) traceout.start_op(op)
 
 
 
@@ -113,7 +115,11 @@ Client::Client(Messenger *m, MonClient *mc)
   : Dispatcher(m->cct), cct(m->cct), timer(m->cct, client_lock), 
     ino_invalidate_cb(NULL),
     client_lock("Client::client_lock"),
-  filer_flags(0)
+  filer_flags(0),
+  num_aio(0),
+  aio_finisher(m->cct),
+  aio_tp(m->cct, "Client::aio_tp", m->cct->_conf->client_aio_threads),
+  aio_wq(this, 600, &aio_tp)
 {
   // which client am i?
   whoami = m->get_myname().num();
@@ -146,6 +152,7 @@ Client::Client(Messenger *m, MonClient *mc)
   root = 0;
 
   num_flushing_caps = 0;
+  cache_scale = 1.0;
 
   lru.lru_set_max(cct->_conf->client_cache_size);
   lru.lru_set_midpoint(cct->_conf->client_cache_mid);
@@ -275,6 +282,8 @@ void Client::init()
   timer.init();
 
   objectcacher->start();
+  aio_finisher.start();
+  aio_tp.start();
 
   // ok!
   messenger->add_dispatcher_head(this);
@@ -298,6 +307,11 @@ void Client::init()
     plb.add_fl_avg(l_c_wrlat, "wrlat");
     plb.add_fl_avg(l_c_owrlat, "owrlat");
     plb.add_fl_avg(l_c_ordlat, "ordlat");
+    plb.add_u64(l_c_mem_inode, "mem_inode");
+    plb.add_u64(l_c_mem_dentry, "mem_dentry");
+    plb.add_u64(l_c_mem_dir, "mem_dir");
+    plb.add_u64(l_c_mem_oc, "mem_oc");
+    plb.add_u64(l_c_mem_total, "mem_total");
     
     client_counters = plb.create_perf_counters();
   }
@@ -309,6 +323,8 @@ void Client::shutdown()
   ldout(cct, 1) << "shutdown" << dendl;
 
   objectcacher->stop();  // outside of client_lock! this does a join.
+  aio_tp.stop();
+  aio_finisher.stop();
 
   client_lock.Lock();
   timer.shutdown();
@@ -667,6 +683,36 @@ void Client::update_dir_dist(Inode *in, DirStat *dst)
  *
  * insert a trace from a MDS reply into the cache.
  */
+/*
+ * link up the dentries and inodes the mds traversed on the way to the
+ * one in the trace, starting from the base of the request path.
+ */
+void Client::insert_lookup_trace(MetaRequest *request, int mds, bufferlist::iterator& p,
+				 int features)
+{
+  vinodeno_t base(request->path.get_ino(), CEPH_NOSNAP);
+  if (!inode_map.count(base)) {
+    ldout(cct, 10) << "insert_lookup_trace don't have base " << base << dendl;
+    return;
+  }
+  Inode *diri = inode_map[base];
+
+  __u32 n;
+  ::decode(n, p);
+  ldout(cct, 10) << "insert_lookup_trace " << n << " dentries from " << *diri << dendl;
+  for (unsigned i = 0; i < n; i++) {
+    string dname;
+    LeaseStat dlease;
+    ::decode(dname, p);
+    ::decode(dlease, p);
+    InodeStat ist(p, features);
+
+    Inode *in = add_update_inode(&ist, request->sent_stamp, mds);
+    insert_dentry_inode(diri->open_dir(), dname, &dlease, in, request->sent_stamp, mds, true);
+    diri = in;
+  }
+}
+
 Inode* Client::insert_trace(MetaRequest *request, int mds)
 {
   MClientReply *reply = request->reply;
@@ -763,7 +809,11 @@ Inode* Client::insert_trace(MetaRequest *request, int mds)
 
   // the rest?
   p = reply->get_extra_bl().begin();
-  if (!p.end()) {
+  if (!p.end() &&
+      request->head.op == CEPH_MDS_OP_LOOKUP &&
+      (request->head.flags & CEPH_MDS_FLAG_WANT_TRACE)) {
+    insert_lookup_trace(request, mds, p, features);
+  } else if (!p.end()) {
     // snapdir?
     if (request->head.op == CEPH_MDS_OP_LSSNAP)
       in = open_snapdir(in);
@@ -1919,21 +1969,8 @@ int Client::get_caps(Inode *in, int need, int want, int *got, loff_t endoff)
     } else if (!in->cap_snaps.empty() && in->cap_snaps.rbegin()->second->writing) {
       ldout(cct, 10) << "waiting on cap_snap write to complete" << dendl;
     } else {
-      int implemented;
-      int have = in->caps_issued(&implemented);
-      if ((have & need) == need) {
-	int butnot = want & ~(have & need);
-	int revoking = implemented & ~have;
-	ldout(cct, 10) << "get_caps " << *in << " have " << ccap_string(have)
-		 << " need " << ccap_string(need) << " want " << ccap_string(want)
-		 << " but not " << ccap_string(butnot) << " revoking " << ccap_string(revoking)
-		 << dendl;
-	if ((revoking & butnot) == 0) {
-	  *got = need | (have & want);
-	  in->get_cap_ref(need);
-	  return 0;
-	}
-      }
+      if (get_caps_nowait(in, need, want, got))
+	return 0;
       ldout(cct, 10) << "waiting for caps need " << ccap_string(need) << " want " << ccap_string(want) << dendl;
     }
     
@@ -1941,12 +1978,35 @@ int Client::get_caps(Inode *in, int need, int want, int *got, loff_t endoff)
   }
 }
 
+/*
+ * take refs on need if we hold it (and nothing from want is being
+ * revoked), without waiting.  no max_size handling; readers only.
+ */
+bool Client::get_caps_nowait(Inode *in, int need, int want, int *got)
+{
+  int implemented;
+  int have = in->caps_issued(&implemented);
+  if ((have & need) != need)
+    return false;
+  int butnot = want & ~(have & need);
+  int revoking = implemented & ~have;
+  ldout(cct, 10) << "get_caps " << *in << " have " << ccap_string(have)
+	   << " need " << ccap_string(need) << " want " << ccap_string(want)
+	   << " but not " << ccap_string(butnot) << " revoking " << ccap_string(revoking)
+	   << dendl;
+  if (revoking & butnot)
+    return false;
+  *got = need | (have & want);
+  in->get_cap_ref(need);
+  return true;
+}
+
 
 void Client::cap_delay_requeue(Inode *in)
 {
   ldout(cct, 10) << "cap_delay_requeue on " << *in << dendl;
   in->hold_caps_until = ceph_clock_now(cct);
-  in->hold_caps_until += 5.0;
+  in->hold_caps_until += cct->_conf->client_caps_release_delay;
 
   delayed_caps.push_back(&in->cap_item);
 }
@@ -2480,6 +2540,13 @@ void Client::remove_cap(Cap *cap)
   i.seq = cap->seq;
   i.migrate_seq = cap->mseq;
   session->release->caps.push_back(i);
+
+  // don't make the mds wait for the tick when we're dropping lots
+  if (cct->_conf->client_cap_release_batch > 0 &&
+      session->release->caps.size() >= (unsigned)cct->_conf->client_cap_release_batch) {
+    messenger->send_message(session->release, mdsmap->get_inst(mds));
+    session->release = 0;
+  }
   
   cap->cap_item.remove_myself();
 
@@ -3243,8 +3310,8 @@ int Client::mount(const std::string &mount_root)
 
   // trace?
   if (!cct->_conf->client_trace.empty()) {
-    traceout.open(cct->_conf->client_trace.c_str());
-    if (traceout.is_open()) {
+    if (traceout.open(cct, cct->_conf->client_trace.c_str(),
+		      cct->_conf->client_trace_binary) == 0) {
       ldout(cct, 1) << "opened trace file '" << cct->_conf->client_trace << "'" << dendl;
     } else {
       ldout(cct, 1) << "FAILED to open trace file '" << cct->_conf->client_trace << "'" << dendl;
@@ -3280,6 +3347,11 @@ void Client::unmount()
     mount_cond.Wait(client_lock);
   }
 
+  while (num_aio > 0) {
+    ldout(cct, 10) << "waiting on " << num_aio << " aio ops" << dendl;
+    mount_cond.Wait(client_lock);
+  }
+
   if (tick_event)
     timer.cancel_event(tick_event);
   tick_event = 0;
@@ -3427,11 +3499,10 @@ void Client::tick()
     utime_t el = now - last_cap_renew;
     if (el > mdsmap->get_session_timeout() / 3.0)
       renew_caps();
-
-    flush_cap_releases();
   }
 
-  // delayed caps
+  // delayed caps.  everything that became dirty or unwanted on an
+  // inode while it sat here goes out in this one update.
   xlist<Inode*>::iterator p = delayed_caps.begin();
   while (!p.end()) {
     Inode *in = *p;
@@ -3443,6 +3514,75 @@ void Client::tick()
     check_caps(in, true);
   }
 
+  // and any releases queued since the last tick, one message per mds
+  if (mdsmap->get_epoch())
+    flush_cap_releases();
+
+  check_mem_budget();
+}
+
+/*
+ * Estimate what the metadata cache and the object cacher are holding,
+ * and if that exceeds client_mem_budget, shrink the dentry lru and
+ * object cacher limits (in proportion to the overshoot) and trim.  Once
+ * usage falls comfortably below the budget the limits grow back toward
+ * their configured values.  The metadata figures are per-object size
+ * estimates; names, xattrs and map overhead are only roughly included.
+ */
+void Client::check_mem_budget()
+{
+  uint64_t num_dirs = 0;
+  for (hash_map<vinodeno_t, Inode*>::iterator p = inode_map.begin();
+       p != inode_map.end();
+       ++p)
+    if (p->second->dir)
+      num_dirs++;
+
+  uint64_t dentries = lru.lru_get_size();
+  uint64_t inode_bytes = inode_map.size() * (sizeof(Inode) + 64);
+  uint64_t dentry_bytes = dentries * (sizeof(Dentry) + 64);
+  uint64_t dir_bytes = num_dirs * sizeof(Dir) + dentries * 96;  // two map nodes per dentry
+  uint64_t oc_bytes = 0;
+  if (cct->_conf->client_oc)
+    oc_bytes = objectcacher->get_stat_total();
+  uint64_t total = inode_bytes + dentry_bytes + dir_bytes + oc_bytes;
+
+  if (client_counters) {
+    client_counters->set(l_c_mem_inode, inode_bytes);
+    client_counters->set(l_c_mem_dentry, dentry_bytes);
+    client_counters->set(l_c_mem_dir, dir_bytes);
+    client_counters->set(l_c_mem_oc, oc_bytes);
+    client_counters->set(l_c_mem_total, total);
+  }
+
+  uint64_t budget = cct->_conf->client_mem_budget;
+  if (!budget || unmounting)
+    return;
+
+  double scale = cache_scale;
+  if (total > budget)
+    scale = MAX(.01, scale * budget / total);
+  else if (scale < 1.0 && total < budget * .8)
+    scale = MIN(1.0, scale * 1.25);
+  if (scale == cache_scale)
+    return;
+
+  ldout(cct, 10) << "check_mem_budget using " << total << " of " << budget
+		 << " (inodes " << inode_bytes << " dentries " << dentry_bytes
+		 << " dirs " << dir_bytes << " oc " << oc_bytes << ")"
+		 << ", cache scale " << cache_scale << " -> " << scale << dendl;
+  cache_scale = scale;
+
+  lru.lru_set_max(MAX(64, (int)(cct->_conf->client_cache_size * scale)));
+  trim_cache();
+
+  if (cct->_conf->client_oc) {
+    loff_t max_dirty = cct->_conf->client_oc_max_dirty * scale;
+    objectcacher->set_max_size(cct->_conf->client_oc_size * scale);
+    objectcacher->set_max_dirty(max_dirty);
+    objectcacher->set_target_dirty(MIN(max_dirty / 2, (loff_t)cct->_conf->client_oc_target_dirty));
+    objectcacher->trim_to_max();
+  }
 }
 
 void Client::renew_caps()
@@ -3473,13 +3613,24 @@ void Client::renew_caps(const int mds) {
 // ===============================================================
 // high level (POSIXy) interface
 
-int Client::_do_lookup(Inode *dir, const char *name, Inode **target)
+/*
+ * look up name in dir, and, if more is given, the components after it
+ * as well, in one request.  *target is the last one.
+ */
+int Client::_do_lookup(Inode *dir, const char *name, Inode **target,
+		       const vector<string> *more)
 {
   int op = dir->snapid == CEPH_SNAPDIR ? CEPH_MDS_OP_LOOKUPSNAP : CEPH_MDS_OP_LOOKUP;
   MetaRequest *req = new MetaRequest(op);
   filepath path;
   dir->make_nosnap_relative_path(path);
   path.push_dentry(name);
+  if (more && !more->empty()) {
+    assert(op == CEPH_MDS_OP_LOOKUP);
+    for (vector<string>::const_iterator p = more->begin(); p != more->end(); ++p)
+      path.push_dentry(*p);
+    req->head.flags = req->head.flags | CEPH_MDS_FLAG_WANT_TRACE;
+  }
   req->set_filepath(path);
   req->inode = dir;
   req->head.args.getattr.mask = 0;
@@ -3491,6 +3642,18 @@ int Client::_do_lookup(Inode *dir, const char *name, Inode **target)
 }
 
 int Client::_lookup(Inode *dir, const string& dname, Inode **target)
+{
+  int r = _lookup_cached(dir, dname, target);
+  if (r == -EAGAIN)
+    r = _do_lookup(dir, dname.c_str(), target);
+  return r;
+}
+
+/*
+ * resolve dname from what we have cached, or return -EAGAIN if we have
+ * to ask the mds.
+ */
+int Client::_lookup_cached(Inode *dir, const string& dname, Inode **target)
 {
   int r = 0;
 
@@ -3565,7 +3728,7 @@ int Client::_lookup(Inode *dir, const string& dname, Inode **target)
     }
   }
 
-  r = _do_lookup(dir, dname.c_str(), target);
+  return -EAGAIN;
 
  done:
   if (r < 0)
@@ -3624,7 +3787,22 @@ int Client::path_walk(const filepath& origpath, Inode **final, bool followsym)
     const string &dname = path[i];
     ldout(cct, 10) << " " << i << " " << *cur << " " << dname << dendl;
     Inode *next;
-    int r = _lookup(cur, dname.c_str(), &next);
+    int r = _lookup_cached(cur, dname, &next);
+    if (r == -EAGAIN) {
+      // not cached; ask for the rest of the path in the same request
+      vector<string> more;
+      if (cct->_conf->client_lookup_trace && cur->snapid == CEPH_NOSNAP) {
+	for (unsigned j = i + 1; j < path.depth(); j++) {
+	  if (path[j] == "." || path[j] == ".." || path[j] == cct->_conf->client_snapdir ||
+	      path[j].length() > NAME_MAX)
+	    break;
+	  more.push_back(path[j]);
+	}
+      }
+      r = _do_lookup(cur, dname.c_str(), &next, &more);
+      if (r == 0)
+	i += more.size();
+    }
     if (r < 0)
       return r;
     cur = next;
@@ -3653,7 +3831,7 @@ int Client::path_walk(const filepath& origpath, Inode **final, bool followsym)
 int Client::link(const char *relexisting, const char *relpath) 
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "link" << std::endl;
+  tout_op(cct, "link");
   tout(cct) << relexisting << std::endl;
   tout(cct) << relpath << std::endl;
 
@@ -3682,7 +3860,7 @@ int Client::link(const char *relexisting, const char *relpath)
 int Client::unlink(const char *relpath)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "unlink" << std::endl;
+  tout_op(cct, "unlink");
   tout(cct) << relpath << std::endl;
 
   filepath path(relpath);
@@ -3698,7 +3876,7 @@ int Client::unlink(const char *relpath)
 int Client::rename(const char *relfrom, const char *relto)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "rename" << std::endl;
+  tout_op(cct, "rename");
   tout(cct) << relfrom << std::endl;
   tout(cct) << relto << std::endl;
 
@@ -3733,7 +3911,7 @@ int Client::rename(const char *relfrom, const char *relto)
 int Client::mkdir(const char *relpath, mode_t mode)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "mkdir" << std::endl;
+  tout_op(cct, "mkdir");
   tout(cct) << relpath << std::endl;
   tout(cct) << mode << std::endl;
   ldout(cct, 10) << "mkdir: " << relpath << dendl;
@@ -3753,7 +3931,7 @@ int Client::mkdirs(const char *relpath, mode_t mode)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 10) << "Client::mkdirs " << relpath << dendl;
-  tout(cct) << "mkdirs" << std::endl;
+  tout_op(cct, "mkdirs");
   tout(cct) << relpath << std::endl;
   tout(cct) << mode << std::endl;
 
@@ -3795,7 +3973,7 @@ int Client::mkdirs(const char *relpath, mode_t mode)
 int Client::rmdir(const char *relpath)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "rmdir" << std::endl;
+  tout_op(cct, "rmdir");
   tout(cct) << relpath << std::endl;
   filepath path(relpath);
   string name = path.last_dentry();
@@ -3810,7 +3988,7 @@ int Client::rmdir(const char *relpath)
 int Client::mknod(const char *relpath, mode_t mode, dev_t rdev) 
 { 
   Mutex::Locker lock(client_lock);
-  tout(cct) << "mknod" << std::endl;
+  tout_op(cct, "mknod");
   tout(cct) << relpath << std::endl;
   tout(cct) << mode << std::endl;
   tout(cct) << rdev << std::endl;
@@ -3829,7 +4007,7 @@ int Client::mknod(const char *relpath, mode_t mode, dev_t rdev)
 int Client::symlink(const char *target, const char *relpath)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "symlink" << std::endl;
+  tout_op(cct, "symlink");
   tout(cct) << target << std::endl;
   tout(cct) << relpath << std::endl;
 
@@ -3846,7 +4024,7 @@ int Client::symlink(const char *target, const char *relpath)
 int Client::readlink(const char *relpath, char *buf, loff_t size) 
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "readlink" << std::endl;
+  tout_op(cct, "readlink");
   tout(cct) << relpath << std::endl;
 
   filepath path(relpath);
@@ -3999,7 +4177,7 @@ int Client::_setattr(Inode *in, struct stat *attr, int mask, int uid, int gid)
 int Client::setattr(const char *relpath, struct stat *attr, int mask)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "setattr" << std::endl;
+  tout_op(cct, "setattr");
   tout(cct) << mask  << std::endl;
 
   filepath path(relpath);
@@ -4015,7 +4193,7 @@ int Client::lstat(const char *relpath, struct stat *stbuf,
 {
   ldout(cct, 3) << "lstat enter (relpath" << relpath << " mask " << mask << ")" << dendl;
   Mutex::Locker lock(client_lock);
-  tout(cct) << "lstat" << std::endl;
+  tout_op(cct, "lstat");
   tout(cct) << relpath << std::endl;
   filepath path(relpath);
   Inode *in;
@@ -4082,7 +4260,7 @@ void Client::touch_dn(Dentry *dn)
 int Client::chmod(const char *relpath, mode_t mode)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "chmod" << std::endl;
+  tout_op(cct, "chmod");
   tout(cct) << relpath << std::endl;
   tout(cct) << mode << std::endl;
   filepath path(relpath);
@@ -4098,7 +4276,7 @@ int Client::chmod(const char *relpath, mode_t mode)
 int Client::chown(const char *relpath, uid_t uid, gid_t gid)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "chown" << std::endl;
+  tout_op(cct, "chown");
   tout(cct) << relpath << std::endl;
   tout(cct) << uid << std::endl;
   tout(cct) << gid << std::endl;
@@ -4116,7 +4294,7 @@ int Client::chown(const char *relpath, uid_t uid, gid_t gid)
 int Client::utime(const char *relpath, struct utimbuf *buf)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "utime" << std::endl;
+  tout_op(cct, "utime");
   tout(cct) << relpath << std::endl;
   tout(cct) << buf->modtime << std::endl;
   tout(cct) << buf->actime << std::endl;
@@ -4137,7 +4315,7 @@ int Client::utime(const char *relpath, struct utimbuf *buf)
 int Client::opendir(const char *relpath, dir_result_t **dirpp) 
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "opendir" << std::endl;
+  tout_op(cct, "opendir");
   tout(cct) << relpath << std::endl;
   filepath path(relpath);
   Inode *in;
@@ -4167,7 +4345,7 @@ int Client::_opendir(Inode *in, dir_result_t **dirpp, int uid, int gid)
 int Client::closedir(dir_result_t *dir) 
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "closedir" << std::endl;
+  tout_op(cct, "closedir");
   tout(cct) << (unsigned long)dir << std::endl;
 
   ldout(cct, 3) << "closedir(" << dir << ") = 0" << dendl;
@@ -4306,6 +4484,8 @@ int Client::_readdir_get_frag(dir_result_t *dirp)
   req->set_filepath(path); 
   req->inode = diri;
   req->head.args.readdir.frag = fg;
+  req->head.args.readdir.max_entries = cct->_conf->client_readdir_max_entries;
+  req->head.args.readdir.max_bytes = cct->_conf->client_readdir_max_bytes;
   if (dirp->last_name.length()) {
     req->path2.set_path(dirp->last_name.c_str());
     req->readdir_start = dirp->last_name;
@@ -4710,7 +4890,7 @@ int Client::getdir(const char *relpath, list<string>& contents)
   ldout(cct, 3) << "getdir(" << relpath << ")" << dendl;
   {
     Mutex::Locker lock(client_lock);
-    tout(cct) << "getdir" << std::endl;
+    tout_op(cct, "getdir");
     tout(cct) << relpath << std::endl;
   }
 
@@ -4742,7 +4922,7 @@ int Client::open(const char *relpath, int flags, mode_t mode)
 {
   ldout(cct, 3) << "open enter(" << relpath << ", " << flags << "," << mode << ") = " << dendl;
   Mutex::Locker lock(client_lock);
-  tout(cct) << "open" << std::endl;
+  tout_op(cct, "open");
   tout(cct) << relpath << std::endl;
   tout(cct) << flags << std::endl;
 
@@ -4825,6 +5005,8 @@ Fh *Client::_create_fh(Inode *in, int flags, int cmode)
   f->mode = cmode;
   if (flags & O_APPEND)
     f->append = true;
+  if (flags & O_DIRECT)
+    f->direct = true;
   
   // inode
   assert(in);
@@ -4912,7 +5094,7 @@ int Client::close(int fd)
 {
   ldout(cct, 3) << "close enter(" << fd << ")" << dendl;
   Mutex::Locker lock(client_lock);
-  tout(cct) << "close" << std::endl;
+  tout_op(cct, "close");
   tout(cct) << fd << std::endl;
 
   assert(fd_map.count(fd));
@@ -4930,7 +5112,7 @@ int Client::close(int fd)
 loff_t Client::lseek(int fd, loff_t offset, int whence)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "lseek" << std::endl;
+  tout_op(cct, "lseek");
   tout(cct) << fd << std::endl;
   tout(cct) << offset << std::endl;
   tout(cct) << whence << std::endl;
@@ -5001,17 +5183,22 @@ void Client::unlock_fh_pos(Fh *f)
 
 int Client::read(int fd, char *buf, loff_t size, loff_t offset) 
 {
-  Mutex::Locker lock(client_lock);
-  tout(cct) << "read" << std::endl;
-  tout(cct) << fd << std::endl;
-  tout(cct) << size << std::endl;
-  tout(cct) << offset << std::endl;
-
-  assert(fd_map.count(fd));
-  Fh *f = fd_map[fd];
   bufferlist bl;
-  int r = _read(f, offset, size, &bl);
-  ldout(cct, 3) << "read(" << fd << ", " << (void*)buf << ", " << size << ", " << offset << ") = " << r << dendl;
+  int r;
+  {
+    Mutex::Locker lock(client_lock);
+    tout_op(cct, "read");
+    tout(cct) << fd << std::endl;
+    tout(cct) << size << std::endl;
+    tout(cct) << offset << std::endl;
+
+    assert(fd_map.count(fd));
+    Fh *f = fd_map[fd];
+    r = _read(f, offset, size, &bl);
+    ldout(cct, 3) << "read(" << fd << ", " << (void*)buf << ", " << size << ", " << offset << ") = " << r << dendl;
+  }
+  // bl holds its own refs to the data; copy it out without blocking
+  // other callers.
   if (r >= 0) {
     bl.copy(0, bl.length(), buf);
     r = bl.length();
@@ -5037,7 +5224,7 @@ int Client::_read(Fh *f, int64_t offset, uint64_t size, bufferlist *bl)
     movepos = true;
   }
 
-  if (got & CEPH_CAP_FILE_CACHE)
+  if ((got & CEPH_CAP_FILE_CACHE) && !_read_bypass_cache(f, offset, size))
     r = _read_async(f, offset, size, bl);
   else
     r = _read_sync(f, offset, size, bl);
@@ -5048,112 +5235,104 @@ int Client::_read(Fh *f, int64_t offset, uint64_t size, bufferlist *bl)
     unlock_fh_pos(f);
   }
 
-  // adjust readahead state
-  if (f->last_pos != offset) {
-    f->nr_consec_read = f->consec_read_bytes = 0;
-  } else {
-    f->nr_consec_read++;
-  }
-  f->consec_read_bytes += bl->length();
-  ldout(cct, 10) << "readahead nr_consec_read " << f->nr_consec_read
-	   << " for " << f->consec_read_bytes << " bytes" 
-	   << " .. last_pos " << f->last_pos << " .. offset " << offset
-	   << dendl;
-  f->last_pos = offset+bl->length();
-
   // done!
   put_cap_ref(in, got);
   return r;
 }
 
+/*
+ * big reads (client_read_direct_min) and O_DIRECT reads go straight to
+ * the osds rather than through the object cacher, so streaming a large
+ * file doesn't push everything else out of the cache.  that is only
+ * coherent while we have nothing buffered for the file, and data that
+ * is already cached is cheaper to copy than to read again.
+ */
+bool Client::_read_bypass_cache(Fh *f, uint64_t off, uint64_t len)
+{
+  Inode *in = f->inode;
+  uint64_t min = cct->_conf->client_read_direct_min;
+  if (!f->direct && (!min || len < min))
+    return false;
+  if (in->oset.dirty_or_tx)
+    return false;
+  if (off >= in->size)
+    return false;
+  if (objectcacher->file_is_cached(&in->oset, &in->layout, in->snapid,
+				   off, MIN(len, in->size - off)))
+    return false;
+  ldout(cct, 10) << "_read_bypass_cache " << *in << " " << off << "~" << len << dendl;
+  return true;
+}
+
 int Client::_read_async(Fh *f, uint64_t off, uint64_t len, bufferlist *bl)
+{
+  int rvalue = 0;
+  Mutex flock("Client::_read_async flock");
+  Cond cond;
+  bool done = false;
+  _start_read_async(f, off, len, bl, new C_SafeCond(&flock, &cond, &done, &rvalue));
+  while (!done)
+    cond.Wait(client_lock);
+  return rvalue;
+}
+
+/*
+ * read through the object cacher, completing onfinish (under
+ * client_lock) once bl is filled; right away if it is all cached.
+ */
+void Client::_start_read_async(Fh *f, uint64_t off, uint64_t len, bufferlist *bl,
+			       Context *onfinish)
 {
   const md_config_t *conf = cct->_conf;
   Inode *in = f->inode;
-  bool readahead = true;
 
   ldout(cct, 10) << "_read_async " << *in << " " << off << "~" << len << dendl;
 
   // trim read based on file size?
-  if (off >= in->size)
-    return 0;
-  if (off + len > in->size) {
-    len = in->size - off;    
-    readahead = false;
+  if (off >= in->size || len == 0) {
+    onfinish->complete(0);
+    return;
   }
+  if (off + len > in->size)
+    len = in->size - off;
 
   // we will populate the cache here
   if (in->cap_refs[CEPH_CAP_FILE_CACHE] == 0)
     in->get_cap_ref(CEPH_CAP_FILE_CACHE);
-  
-  ldout(cct, 10) << "readahead=" << readahead << " nr_consec=" << f->nr_consec_read
-	   << " max_byes=" << conf->client_readahead_max_bytes
-	   << " max_periods=" << conf->client_readahead_max_periods << dendl;
 
   // readahead?
-  if (readahead &&
-      f->nr_consec_read &&
-      (conf->client_readahead_max_bytes ||
-       conf->client_readahead_max_periods)) {
-    loff_t l = f->consec_read_bytes * 2;
-    if (conf->client_readahead_min)
-      l = MAX(l, conf->client_readahead_min);
-    if (conf->client_readahead_max_bytes)
-      l = MIN(l, conf->client_readahead_max_bytes);
-    loff_t p = in->layout.fl_stripe_count * in->layout.fl_object_size;
-    if (conf->client_readahead_max_periods)
-      l = MIN(l, conf->client_readahead_max_periods * p);
-
-    if (l >= 2*p)
-      // align large readahead with period
-      l -= (off+l) % p;
-    else {
-      // align readahead with stripe unit if we cross su boundary
-      int su = in->layout.fl_stripe_unit;
-      if ((off+l)/su != off/su) l -= (off+l) % su;
-    }
-    
-    // don't read past end of file
-    if (off+l > in->size)
-      l = in->size - off;
-    
-    loff_t min = MIN((loff_t)len, l/2);
-
-    ldout(cct, 20) << "readahead " << f->nr_consec_read << " reads " 
-	     << f->consec_read_bytes << " bytes ... readahead " << off << "~" << l
-	     << " min " << min
-	     << " (caller wants " << off << "~" << len << ")" << dendl;
-    if (l > (loff_t)len) {
-      if (objectcacher->file_is_cached(&in->oset, &in->layout, in->snapid, off, min))
-	ldout(cct, 20) << "readahead already have min" << dendl;
-      else {
-	objectcacher->file_read(&in->oset, &in->layout, in->snapid, off, l, NULL, 0, 0);
-	ldout(cct, 20) << "readahead initiated" << dendl;
-      }
-    }
-  }
-  
-  // read (and possibly block)
-  int r, rvalue = 0;
-  Mutex flock("Client::_read_async flock");
-  Cond cond;
-  bool done = false;
-  Context *onfinish = new C_SafeCond(&flock, &cond, &done, &rvalue);
-  if (in->snapid == CEPH_NOSNAP)
-    r = objectcacher->file_read(&in->oset, &in->layout, in->snapid,
-				off, len, bl, 0, onfinish);
-  else
-    r = objectcacher->file_read(&in->oset, &in->layout, in->snapid,
-				off, len, bl, 0, onfinish);
-  if (r == 0) {
-    while (!done) 
-      cond.Wait(client_lock);
-    r = rvalue;
-  } else {
-    // it was cached.
-    delete onfinish;
-  }
-  return r;
+  uint64_t p = (uint64_t)in->layout.fl_stripe_count * in->layout.fl_object_size;
+  uint64_t ra_max = 0;
+  if (conf->client_readahead_max_bytes)
+    ra_max = conf->client_readahead_max_bytes;
+  if (conf->client_readahead_max_periods &&
+      (!ra_max || (uint64_t)conf->client_readahead_max_periods * p < ra_max))
+    ra_max = conf->client_readahead_max_periods * p;
+  f->readahead.set_limits(conf->client_readahead_min, ra_max);
+  vector<uint64_t> alignments;
+  alignments.push_back(p);
+  alignments.push_back(in->layout.fl_stripe_unit);
+  f->readahead.set_alignments(alignments);
+
+  Readahead::extent_t ra = f->readahead.update(off, len, in->size);
+  ldout(cct, 20) << "readahead nr_consec " << f->readahead.get_nr_consec()
+		 << " window " << f->readahead.get_window()
+		 << " -> " << ra.first << "~" << ra.second
+		 << " (caller wants " << off << "~" << len << ")" << dendl;
+
+  // read (and possibly wait)
+  int r = objectcacher->file_read(&in->oset, &in->layout, in->snapid,
+				  off, len, bl, 0, onfinish);
+
+  // prefetch behind the demand read, so it goes out first
+  if (ra.second) {
+    objectcacher->file_read(&in->oset, &in->layout, in->snapid,
+			    ra.first, ra.second, NULL, 0, 0);
+    ldout(cct, 20) << "readahead initiated" << dendl;
+  }
+
+  if (r != 0)
+    onfinish->complete(r);  // it was cached.
 }
 
 int Client::_read_sync(Fh *f, uint64_t off, uint64_t len, bufferlist *bl)
@@ -5223,12 +5402,15 @@ int Client::_read_sync(Fh *f, uint64_t off, uint64_t len, bufferlist *bl)
 class C_Client_SyncCommit : public Context {
   Client *cl;
   Inode *in;
+  Context *fin;
 public:
-  C_Client_SyncCommit(Client *c, Inode *i) : cl(c), in(i) {
+  C_Client_SyncCommit(Client *c, Inode *i, Context *f=0) : cl(c), in(i), fin(f) {
     in->get();
   }
-  void finish(int) {
+  void finish(int r) {
     cl->sync_write_commit(in);
+    if (fin)
+      fin->complete(r);
   }
 };
 
@@ -5251,20 +5433,46 @@ void Client::sync_write_commit(Inode *in)
 int Client::write(int fd, const char *buf, loff_t size, loff_t offset) 
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "write" << std::endl;
+  tout_op(cct, "write");
   tout(cct) << fd << std::endl;
   tout(cct) << size << std::endl;
   tout(cct) << offset << std::endl;
 
   assert(fd_map.count(fd));
   Fh *fh = fd_map[fd];
-  int r = _write(fh, offset, size, buf);
+
+  bufferlist bl;
+  if (_write_is_direct(fh, offset, size)) {
+    // _write waits for the commit, so the osds can have the caller's
+    // buffer as is.
+    bl.push_back(buffer::create_static(size, (char*)buf));
+  } else if (size > 0) {
+    // copy into a fresh buffer (since our write may be resub, async),
+    // without holding client_lock
+    client_lock.Unlock();
+    bl.push_back(buffer::copy(buf, size));
+    client_lock.Lock();
+  }
+
+  int r = _write(fh, offset, size, bl);
   ldout(cct, 3) << "write(" << fd << ", \"...\", " << size << ", " << offset << ") = " << r << dendl;
   return r;
 }
 
 
-int Client::_write(Fh *f, int64_t offset, uint64_t size, const char *buf)
+/*
+ * O_DIRECT writes that are page aligned skip the object cacher and go
+ * straight to the osds, and don't return until the osds have
+ * committed them.  anything else on an O_DIRECT fd is written as
+ * usual.
+ */
+bool Client::_write_is_direct(Fh *f, int64_t offset, uint64_t size)
+{
+  return f->direct && offset >= 0 && size > 0 &&
+    (offset & ~PAGE_MASK) == 0 && (size & ~PAGE_MASK) == 0;
+}
+
+int Client::_write(Fh *f, int64_t offset, uint64_t size, bufferlist& bl)
 {
   if ((uint64_t)(offset+size) > mdsmap->get_max_filesize()) //too large!
     return -EFBIG;
@@ -5292,18 +5500,13 @@ int Client::_write(Fh *f, int64_t offset, uint64_t size, const char *buf)
   }
 
   //bool lazy = f->mode == CEPH_FILE_MODE_LAZY;
+  bool direct = _write_is_direct(f, offset, size);
 
-  ldout(cct, 10) << "cur file size is " << in->size << dendl;
+  ldout(cct, 10) << "cur file size is " << in->size << (direct ? ", direct" : "") << dendl;
 
   // time it.
   utime_t start = ceph_clock_now(cct);
     
-  // copy into fresh buffer (since our write may be resub, async)
-  bufferptr bp;
-  if (size > 0) bp = buffer::copy(buf, size);
-  bufferlist bl;
-  bl.push_back( bp );
-
   uint64_t endoff = offset + size;
   int got;
   int r = get_caps(in, CEPH_CAP_FILE_WR, CEPH_CAP_FILE_BUFFER, &got, endoff);
@@ -5312,7 +5515,7 @@ int Client::_write(Fh *f, int64_t offset, uint64_t size, const char *buf)
 
   ldout(cct, 10) << " snaprealm " << *in->snaprealm << dendl;
 
-  if (cct->_conf->client_oc && (got & CEPH_CAP_FILE_BUFFER)) {
+  if (cct->_conf->client_oc && (got & CEPH_CAP_FILE_BUFFER) && !direct) {
     // do buffered write
     if (!in->oset.dirty_or_tx)
       get_cap_ref(in, CEPH_CAP_FILE_BUFFER);
@@ -5333,12 +5536,27 @@ int Client::_write(Fh *f, int64_t offset, uint64_t size, const char *buf)
       objectcacher->file_atomic_sync_write(in->ino, &in->layout, in->snaprealm->get_snap_context(),
 					   offset, size, bl, ceph_clock_now(cct), 0, client_lock);
     */
+    if (direct && cct->_conf->client_oc) {
+      // nothing buffered may land on top of this later, and nothing
+      // cached may hide it.
+      if (in->oset.dirty_or_tx) {
+	_flush(in);
+	while (in->oset.dirty_or_tx) {
+	  ldout(cct, 10) << "direct write waiting for buffered data to flush" << dendl;
+	  wait_on_list(in->waitfor_commit);
+	}
+      }
+      _invalidate_inode_cache(in, offset, size);
+    }
+
     // simple, non-atomic sync write
     Mutex flock("Client::_write flock");
     Cond cond;
     bool done = false;
+    bool committed = !direct;   // direct writes wait for the commit too
     Context *onfinish = new C_SafeCond(&flock, &cond, &done);
-    Context *onsafe = new C_Client_SyncCommit(this, in);
+    Context *onsafe = new C_Client_SyncCommit(this, in,
+					      direct ? new C_SafeCond(&flock, &cond, &committed) : 0);
 
     unsafe_sync_write++;
     get_cap_ref(in, CEPH_CAP_FILE_BUFFER);  // released by onsafe callback
@@ -5348,7 +5566,7 @@ int Client::_write(Fh *f, int64_t offset, uint64_t size, const char *buf)
 		       in->truncate_size, in->truncate_seq,
 		       onfinish, onsafe);
     
-    while (!done)
+    while (!done || !committed)
       cond.Wait(client_lock);
   }
 
@@ -5400,7 +5618,7 @@ int Client::truncate(const char *relpath, loff_t length)
 int Client::ftruncate(int fd, loff_t length) 
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "ftruncate" << std::endl;
+  tout_op(cct, "ftruncate");
   tout(cct) << fd << std::endl;
   tout(cct) << length << std::endl;
 
@@ -5414,7 +5632,7 @@ int Client::ftruncate(int fd, loff_t length)
 int Client::fsync(int fd, bool syncdataonly) 
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "fsync" << std::endl;
+  tout_op(cct, "fsync");
   tout(cct) << fd << std::endl;
   tout(cct) << syncdataonly << std::endl;
 
@@ -5463,10 +5681,144 @@ int Client::_fsync(Fh *f, bool syncdataonly)
   return r;
 }
 
+// ===============================
+// async io
+
+class C_Client_AioRead : public Context {
+  Client *client;
+  Inode *in;
+  int got;
+  Context *onfinish;
+public:
+  C_Client_AioRead(Client *c, Inode *i, int g, Context *fin)
+    : client(c), in(i), got(g), onfinish(fin) {
+    in->get();
+  }
+  void finish(int r) {
+    client->aio_read_finish(in, got, onfinish, r);
+  }
+};
+
+void Client::aio_read_finish(Inode *in, int got, Context *onfinish, int r)
+{
+  ldout(cct, 10) << "aio_read_finish " << *in << " r = " << r << dendl;
+  put_cap_ref(in, got);
+  put_inode(in);
+  aio_finish(onfinish, r);
+}
+
+void Client::aio_finish(Context *onfinish, int r)
+{
+  assert(num_aio > 0);
+  num_aio--;
+  if (num_aio == 0 && unmounting)
+    mount_cond.Signal();
+  aio_finisher.queue(onfinish, r);
+}
+
+int Client::aio_read(int fd, bufferlist *bl, loff_t size, loff_t offset, Context *onfinish)
+{
+  Mutex::Locker lock(client_lock);
+  tout_op(cct, "aio_read");
+  tout(cct) << fd << std::endl;
+  tout(cct) << size << std::endl;
+  tout(cct) << offset << std::endl;
+
+  if (offset < 0 || size < 0)
+    return -EINVAL;
+  if (fd_map.count(fd) == 0)
+    return -EBADF;
+  Fh *f = fd_map[fd];
+  Inode *in = f->inode;
+  ldout(cct, 3) << "aio_read(" << fd << ", " << size << ", " << offset << ")" << dendl;
+
+  num_aio++;
+
+  // cached reads never need to block a thread
+  int got;
+  if (get_caps_nowait(in, CEPH_CAP_FILE_RD, CEPH_CAP_FILE_CACHE, &got)) {
+    if ((got & CEPH_CAP_FILE_CACHE) && !_read_bypass_cache(f, offset, size)) {
+      _start_read_async(f, offset, size, bl, new C_Client_AioRead(this, in, got, onfinish));
+      return 0;
+    }
+    put_cap_ref(in, got);
+  }
+
+  AioOp *op = new AioOp(AioOp::READ, f, offset, onfinish);
+  op->len = size;
+  op->bl = bl;
+  aio_wq.queue(op);
+  return 0;
+}
+
+int Client::aio_write(int fd, bufferlist& bl, loff_t offset, Context *onfinish)
+{
+  Mutex::Locker lock(client_lock);
+  tout_op(cct, "aio_write");
+  tout(cct) << fd << std::endl;
+  tout(cct) << bl.length() << std::endl;
+  tout(cct) << offset << std::endl;
+
+  if (offset < 0)
+    return -EINVAL;
+  if (fd_map.count(fd) == 0)
+    return -EBADF;
+  ldout(cct, 3) << "aio_write(" << fd << ", " << bl.length() << ", " << offset << ")" << dendl;
+
+  num_aio++;
+  AioOp *op = new AioOp(AioOp::WRITE, fd_map[fd], offset, onfinish);
+  op->data.claim(bl);
+  aio_wq.queue(op);
+  return 0;
+}
+
+int Client::aio_fsync(int fd, bool syncdataonly, Context *onfinish)
+{
+  Mutex::Locker lock(client_lock);
+  tout_op(cct, "aio_fsync");
+  tout(cct) << fd << std::endl;
+  tout(cct) << syncdataonly << std::endl;
+
+  if (fd_map.count(fd) == 0)
+    return -EBADF;
+  ldout(cct, 3) << "aio_fsync(" << fd << ", " << syncdataonly << ")" << dendl;
+
+  num_aio++;
+  AioOp *op = new AioOp(AioOp::FSYNC, fd_map[fd], 0, onfinish);
+  op->syncdataonly = syncdataonly;
+  aio_wq.queue(op);
+  return 0;
+}
+
+void Client::_aio_process(AioOp *op)
+{
+  Mutex::Locker lock(client_lock);
+  int r;
+  switch (op->op) {
+  case AioOp::READ:
+    r = _read(op->fh, op->offset, op->len, op->bl);
+    if (r >= 0)
+      r = op->bl->length();
+    break;
+  case AioOp::WRITE:
+    r = _write(op->fh, op->offset, op->data.length(), op->data);
+    break;
+  case AioOp::FSYNC:
+    r = _fsync(op->fh, op->syncdataonly);
+    break;
+  default:
+    assert(0);
+  }
+  ldout(cct, 10) << "_aio_process op " << op->op << " on " << *op->fh->inode
+		 << " r = " << r << dendl;
+  aio_finish(op->onfinish, r);
+  delete op;
+}
+
 int Client::fstat(int fd, struct stat *stbuf) 
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "fstat" << std::endl;
+  tout_op(cct, "fstat");
   tout(cct) << fd << std::endl;
 
   assert(fd_map.count(fd));
@@ -5485,7 +5837,7 @@ int Client::fstat(int fd, struct stat *stbuf)
 int Client::chdir(const char *relpath)
 {
   Mutex::Locker lock(client_lock);
-  tout(cct) << "chdir" << std::endl;
+  tout_op(cct, "chdir");
   tout(cct) << relpath << std::endl;
   filepath path(relpath);
   Inode *in;
@@ -5536,7 +5888,7 @@ void Client::getcwd(string& dir)
 int Client::statfs(const char *path, struct statvfs *stbuf)
 {
   Mutex::Locker l(client_lock);
-  tout(cct) << "statfs" << std::endl;
+  tout_op(cct, "statfs");
 
   ceph_statfs stats;
 
@@ -5578,7 +5930,7 @@ int Client::statfs(const char *path, struct statvfs *stbuf)
 
 int Client::ll_statfs(vinodeno_t vino, struct statvfs *stbuf)
 {
-  tout(cct) << "ll_statfs" << std::endl;
+  tout_op(cct, "ll_statfs");
   return statfs(0, stbuf);
 }
 
@@ -5716,7 +6068,7 @@ int Client::ll_lookup(vinodeno_t parent, const char *name, struct stat *attr, in
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_lookup " << parent << " " << name << dendl;
-  tout(cct) << "ll_lookup" << std::endl;
+  tout_op(cct, "ll_lookup");
   tout(cct) << parent.ino.val << std::endl;
   tout(cct) << name << std::endl;
 
@@ -5795,7 +6147,7 @@ bool Client::ll_forget(vinodeno_t vino, int num)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_forget " << vino << " " << num << dendl;
-  tout(cct) << "ll_forget" << std::endl;
+  tout_op(cct, "ll_forget");
   tout(cct) << vino.ino.val << std::endl;
   tout(cct) << num << std::endl;
 
@@ -5831,7 +6183,7 @@ int Client::ll_getattr(vinodeno_t vino, struct stat *attr, int uid, int gid)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_getattr " << vino << dendl;
-  tout(cct) << "ll_getattr" << std::endl;
+  tout_op(cct, "ll_getattr");
   tout(cct) << vino.ino.val << std::endl;
 
   Inode *in = _ll_get_inode(vino);
@@ -5850,7 +6202,7 @@ int Client::ll_setattr(vinodeno_t vino, struct stat *attr, int mask, int uid, in
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_setattr " << vino << " mask " << hex << mask << dec << dendl;
-  tout(cct) << "ll_setattr" << std::endl;
+  tout_op(cct, "ll_setattr");
   tout(cct) << vino.ino.val << std::endl;
   tout(cct) << attr->st_mode << std::endl;
   tout(cct) << attr->st_uid << std::endl;
@@ -5962,7 +6314,7 @@ int Client::ll_getxattr(vinodeno_t vino, const char *name, void *value, size_t s
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_getxattr " << vino << " " << name << " size " << size << dendl;
-  tout(cct) << "ll_getxattr" << std::endl;
+  tout_op(cct, "ll_getxattr");
   tout(cct) << vino.ino.val << std::endl;
   tout(cct) << name << std::endl;
 
@@ -6001,7 +6353,7 @@ int Client::ll_listxattr(vinodeno_t vino, char *names, size_t size, int uid, int
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_listxattr " << vino << " size " << size << dendl;
-  tout(cct) << "ll_listxattr" << std::endl;
+  tout_op(cct, "ll_listxattr");
   tout(cct) << vino.ino.val << std::endl;
   tout(cct) << size << std::endl;
 
@@ -6040,7 +6392,7 @@ int Client::ll_setxattr(vinodeno_t vino, const char *name, const void *value, si
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_setxattr " << vino << " " << name << " size " << size << dendl;
-  tout(cct) << "ll_setxattr" << std::endl;
+  tout_op(cct, "ll_setxattr");
   tout(cct) << vino.ino.val << std::endl;
   tout(cct) << name << std::endl;
 
@@ -6077,7 +6429,7 @@ int Client::ll_removexattr(vinodeno_t vino, const char *name, int uid, int gid)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_removexattr " << vino << " " << name << dendl;
-  tout(cct) << "ll_removexattr" << std::endl;
+  tout_op(cct, "ll_removexattr");
   tout(cct) << vino.ino.val << std::endl;
   tout(cct) << name << std::endl;
 
@@ -6094,7 +6446,7 @@ int Client::ll_readlink(vinodeno_t vino, const char **value, int uid, int gid)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_readlink " << vino << dendl;
-  tout(cct) << "ll_readlink" << std::endl;
+  tout_op(cct, "ll_readlink");
   tout(cct) << vino.ino.val << std::endl;
 
   Inode *in = _ll_get_inode(vino);
@@ -6159,7 +6511,7 @@ int Client::ll_mknod(vinodeno_t parent, const char *name, mode_t mode, dev_t rde
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_mknod " << parent << " " << name << dendl;
-  tout(cct) << "ll_mknod" << std::endl;
+  tout_op(cct, "ll_mknod");
   tout(cct) << parent.ino.val << std::endl;
   tout(cct) << name << std::endl;
   tout(cct) << mode << std::endl;
@@ -6287,7 +6639,7 @@ int Client::ll_mkdir(vinodeno_t parent, const char *name, mode_t mode, struct st
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_mkdir " << parent << " " << name << dendl;
-  tout(cct) << "ll_mkdir" << std::endl;
+  tout_op(cct, "ll_mkdir");
   tout(cct) << parent.ino.val << std::endl;
   tout(cct) << name << std::endl;
   tout(cct) << mode << std::endl;
@@ -6350,7 +6702,7 @@ int Client::ll_symlink(vinodeno_t parent, const char *name, const char *value, s
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_symlink " << parent << " " << name << " -> " << value << dendl;
-  tout(cct) << "ll_symlink" << std::endl;
+  tout_op(cct, "ll_symlink");
   tout(cct) << parent.ino.val << std::endl;
   tout(cct) << name << std::endl;
   tout(cct) << value << std::endl;
@@ -6417,7 +6769,7 @@ int Client::ll_unlink(vinodeno_t vino, const char *name, int uid, int gid)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_unlink " << vino << " " << name << dendl;
-  tout(cct) << "ll_unlink" << std::endl;
+  tout_op(cct, "ll_unlink");
   tout(cct) << vino.ino.val << std::endl;
   tout(cct) << name << std::endl;
 
@@ -6473,7 +6825,7 @@ int Client::ll_rmdir(vinodeno_t vino, const char *name, int uid, int gid)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_rmdir " << vino << " " << name << dendl;
-  tout(cct) << "ll_rmdir" << std::endl;
+  tout_op(cct, "ll_rmdir");
   tout(cct) << vino.ino.val << std::endl;
   tout(cct) << name << std::endl;
 
@@ -6544,7 +6896,7 @@ int Client::ll_rename(vinodeno_t parent, const char *name, vinodeno_t newparent,
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_rename " << parent << " " << name << " to "
 	  << newparent << " " << newname << dendl;
-  tout(cct) << "ll_rename" << std::endl;
+  tout_op(cct, "ll_rename");
   tout(cct) << parent.ino.val << std::endl;
   tout(cct) << name << std::endl;
   tout(cct) << newparent.ino.val << std::endl;
@@ -6598,7 +6950,7 @@ int Client::ll_link(vinodeno_t vino, vinodeno_t newparent, const char *newname,
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_link " << vino << " to " << newparent << " " << newname << dendl;
-  tout(cct) << "ll_link" << std::endl;
+  tout_op(cct, "ll_link");
   tout(cct) << vino.ino.val << std::endl;
   tout(cct) << newparent << std::endl;
   tout(cct) << newname << std::endl;
@@ -6619,7 +6971,7 @@ int Client::ll_opendir(vinodeno_t vino, void **dirpp, int uid, int gid)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_opendir " << vino << dendl;
-  tout(cct) << "ll_opendir" << std::endl;
+  tout_op(cct, "ll_opendir");
   tout(cct) << vino.ino.val << std::endl;
   
   Inode *diri = inode_map[vino];
@@ -6642,7 +6994,7 @@ void Client::ll_releasedir(void *dirp)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_releasedir " << dirp << dendl;
-  tout(cct) << "ll_releasedir" << std::endl;
+  tout_op(cct, "ll_releasedir");
   tout(cct) << (unsigned long)dirp << std::endl;
   _closedir((dir_result_t*)dirp);
 }
@@ -6651,7 +7003,7 @@ int Client::ll_open(vinodeno_t vino, int flags, Fh **fhp, int uid, int gid)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_open " << vino << " " << flags << dendl;
-  tout(cct) << "ll_open" << std::endl;
+  tout_op(cct, "ll_open");
   tout(cct) << vino.ino.val << std::endl;
   tout(cct) << flags << std::endl;
 
@@ -6668,7 +7020,7 @@ int Client::ll_create(vinodeno_t parent, const char *name, mode_t mode, int flag
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_create " << parent << " " << name << " 0" << oct << mode << dec << " " << flags << ", uid " << uid << ", gid " << gid << dendl;
-  tout(cct) << "ll_create" << std::endl;
+  tout_op(cct, "ll_create");
   tout(cct) << parent.ino.val << std::endl;
   tout(cct) << name << std::endl;
   tout(cct) << mode << std::endl;
@@ -6700,7 +7052,7 @@ int Client::ll_read(Fh *fh, loff_t off, loff_t len, bufferlist *bl)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_read " << fh << " " << fh->inode->ino << " " << " " << off << "~" << len << dendl;
-  tout(cct) << "ll_read" << std::endl;
+  tout_op(cct, "ll_read");
   tout(cct) << (unsigned long)fh << std::endl;
   tout(cct) << off << std::endl;
   tout(cct) << len << std::endl;
@@ -6710,14 +7062,18 @@ int Client::ll_read(Fh *fh, loff_t off, loff_t len, bufferlist *bl)
 
 int Client::ll_write(Fh *fh, loff_t off, loff_t len, const char *data)
 {
+  bufferlist bl;
+  if (len > 0)
+    bl.push_back(buffer::copy(data, len));
+
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_write " << fh << " " << fh->inode->ino << " " << off << "~" << len << dendl;
-  tout(cct) << "ll_write" << std::endl;
+  tout_op(cct, "ll_write");
   tout(cct) << (unsigned long)fh << std::endl;
   tout(cct) << off << std::endl;
   tout(cct) << len << std::endl;
 
-  int r = _write(fh, off, len, data);
+  int r = _write(fh, off, len, bl);
   ldout(cct, 3) << "ll_write " << fh << " " << off << "~" << len << " = " << r << dendl;
   return r;
 }
@@ -6726,7 +7082,7 @@ int Client::ll_flush(Fh *fh)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_flush " << fh << " " << fh->inode->ino << " " << dendl;
-  tout(cct) << "ll_flush" << std::endl;
+  tout_op(cct, "ll_flush");
   tout(cct) << (unsigned long)fh << std::endl;
 
   return _flush(fh);
@@ -6736,7 +7092,7 @@ int Client::ll_fsync(Fh *fh, bool syncdataonly)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_fsync " << fh << " " << fh->inode->ino << " " << dendl;
-  tout(cct) << "ll_fsync" << std::endl;
+  tout_op(cct, "ll_fsync");
   tout(cct) << (unsigned long)fh << std::endl;
 
   return _fsync(fh, syncdataonly);
@@ -6747,7 +7103,7 @@ int Client::ll_release(Fh *fh)
 {
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_release " << fh << " " << fh->inode->ino << " " << dendl;
-  tout(cct) << "ll_release" << std::endl;
+  tout_op(cct, "ll_release");
   tout(cct) << (unsigned long)fh << std::endl;
 
   _release_fh(fh);
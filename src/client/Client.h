@@ -40,11 +40,15 @@ using namespace __gnu_cxx;
 #include "msg/Dispatcher.h"
 #include "msg/Messenger.h"
 
+#include "common/Finisher.h"
 #include "common/Mutex.h"
 #include "common/Timer.h"
+#include "common/WorkQueue.h"
 
 #include "osdc/ObjectCacher.h"
 
+#include "TraceWriter.h"
+
 class MDSMap;
 class OSDMap;
 class MonClient;
@@ -76,6 +80,11 @@ enum {
   l_c_owrlat,
   l_c_ordlat,
   l_c_wrlat,
+  l_c_mem_inode,
+  l_c_mem_dentry,
+  l_c_mem_dir,
+  l_c_mem_oc,
+  l_c_mem_total,
   l_c_last,
 };
 
@@ -199,6 +208,11 @@ class Client : public Dispatcher {
   void renew_caps();
   void renew_caps(int s);
   void flush_cap_releases();
+
+  // estimated cache memory use, and the fraction of the configured
+  // cache sizes we currently allow under client_mem_budget
+  double cache_scale;
+  void check_mem_budget();
 public:
   void tick();
 
@@ -302,6 +316,63 @@ protected:
 
   int filer_flags;
 
+  // asynchronous io.  reads we can serve through the object cacher
+  // with caps already in hand are issued directly; anything that may
+  // block (cap waits, sync reads, writes, fsync) runs on aio_tp.
+  // completions are delivered by aio_finisher, outside client_lock.
+  struct AioOp {
+    enum { READ, WRITE, FSYNC };
+    int op;
+    Fh *fh;
+    loff_t offset;
+    loff_t len;
+    bufferlist *bl;      // read result
+    bufferlist data;     // write data
+    bool syncdataonly;
+    Context *onfinish;
+    AioOp(int o, Fh *f, loff_t off, Context *fin)
+      : op(o), fh(f), offset(off), len(0), bl(NULL), syncdataonly(false),
+	onfinish(fin) {}
+  };
+  list<AioOp*> aio_queue;
+  int num_aio;   // submitted and not yet handed to aio_finisher
+  Finisher aio_finisher;
+  ThreadPool aio_tp;
+  struct AioWQ : public ThreadPool::WorkQueue<AioOp> {
+    Client *client;
+    AioWQ(Client *c, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<AioOp>("Client::AioWQ", ti, 0, tp), client(c) {}
+
+    bool _empty() {
+      return client->aio_queue.empty();
+    }
+    bool _enqueue(AioOp *op) {
+      client->aio_queue.push_back(op);
+      return true;
+    }
+    void _dequeue(AioOp *op) {
+      assert(0);
+    }
+    AioOp *_dequeue() {
+      if (client->aio_queue.empty())
+	return NULL;
+      AioOp *op = client->aio_queue.front();
+      client->aio_queue.pop_front();
+      return op;
+    }
+    void _process(AioOp *op) {
+      client->_aio_process(op);
+    }
+    void _clear() {
+      assert(client->aio_queue.empty());
+    }
+  } aio_wq;
+
+  void _aio_process(AioOp *op);
+  void aio_read_finish(Inode *in, int got, Context *onfinish, int r);
+  void aio_finish(Context *onfinish, int r);
+  friend class C_Client_AioRead; // calls aio_read_finish()
+
   // helpers
   void wake_inode_waiters(int mds);
   void wait_on_list(list<Cond*>& ls);
@@ -341,7 +412,7 @@ protected:
   void dump_cache();  // debug
   
   // trace generation
-  ofstream traceout;
+  TraceWriter traceout;
 
 
   Cond mount_cond, sync_cond;
@@ -393,6 +464,7 @@ protected:
   void flush_caps(Inode *in, int mds);
   void kick_flushing_caps(int mds);
   int get_caps(Inode *in, int need, int want, int *got, loff_t endoff);
+  bool get_caps_nowait(Inode *in, int need, int want, int *got);
 
   void maybe_update_snaprealm(SnapRealm *realm, snapid_t snap_created, snapid_t snap_highwater, 
 			      vector<snapid_t>& snaps);
@@ -471,12 +543,18 @@ private:
   int _release_fh(Fh *fh);
 
   int _read_sync(Fh *f, uint64_t off, uint64_t len, bufferlist *bl);
+  bool _read_bypass_cache(Fh *f, uint64_t off, uint64_t len);
   int _read_async(Fh *f, uint64_t off, uint64_t len, bufferlist *bl);
+  void _start_read_async(Fh *f, uint64_t off, uint64_t len, bufferlist *bl,
+			 Context *onfinish);
 
   // internal interface
   //   call these with client_lock held!
-  int _do_lookup(Inode *dir, const char *name, Inode **target);
+  int _do_lookup(Inode *dir, const char *name, Inode **target,
+		 const vector<string> *more = NULL);
+  int _lookup_cached(Inode *dir, const string& dname, Inode **target);
   int _lookup(Inode *dir, const string& dname, Inode **target);
+  void insert_lookup_trace(MetaRequest *request, int mds, bufferlist::iterator& p, int features);
 
   int _link(Inode *in, Inode *dir, const char *name, int uid=-1, int gid=-1);
   int _unlink(Inode *dir, const char *name, int uid=-1, int gid=-1);
@@ -495,7 +573,8 @@ private:
   int _create(Inode *in, const char *name, int flags, mode_t mode, Inode **inp, Fh **fhp, int uid=-1, int gid=-1);
   loff_t _lseek(Fh *fh, loff_t offset, int whence);
   int _read(Fh *fh, int64_t offset, uint64_t size, bufferlist *bl);
-  int _write(Fh *fh, int64_t offset, uint64_t size, const char *buf);
+  int _write(Fh *fh, int64_t offset, uint64_t size, bufferlist& bl);
+  bool _write_is_direct(Fh *fh, int64_t offset, uint64_t size);
   int _flush(Fh *fh);
   int _fsync(Fh *fh, bool syncdataonly);
   int _sync_fs();
@@ -575,6 +654,15 @@ public:
   int fsync(int fd, bool syncdataonly);
   int fstat(int fd, struct stat *stbuf);
 
+  // async io.  onfinish is completed, without client_lock, with the
+  // result of the sync equivalent; a read fills *bl, which must stay
+  // valid until then, as must the fd.  offsets must be explicit, and
+  // nothing orders concurrent ops against each other.  on an error
+  // return onfinish is not used.
+  int aio_read(int fd, bufferlist *bl, loff_t size, loff_t offset, Context *onfinish);
+  int aio_write(int fd, bufferlist& bl, loff_t offset, Context *onfinish);
+  int aio_fsync(int fd, bool syncdataonly, Context *onfinish);
+
   // full path xattr ops
   int getxattr(const char *path, const char *name, void *value, size_t size);
   int lgetxattr(const char *path, const char *name, void *value, size_t size);
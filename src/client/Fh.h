@@ -2,6 +2,7 @@
 #define CEPH_CLIENT_FH_H
 
 #include "include/types.h"
+#include "osdc/Readahead.h"
 
 class Inode;
 class Cond;
@@ -17,16 +18,13 @@ struct Fh {
   bool is_lazy() { return mode & O_LAZY; }
 
   bool append;
+  bool direct;               // O_DIRECT: reads skip the object cacher
   bool pos_locked;           // pos is currently in use
   list<Cond*> pos_waiters;   // waiters for pos
 
-  // readahead state
-  loff_t last_pos;
-  loff_t consec_read_bytes;
-  int nr_consec_read;
+  Readahead readahead;
 
-  Fh() : inode(0), pos(0), mds(0), mode(0), append(false), pos_locked(false),
-	 last_pos(0), consec_read_bytes(0), nr_consec_read(0) {}
+  Fh() : inode(0), pos(0), mds(0), mode(0), append(false), direct(false), pos_locked(false) {}
 };
 
 
@@ -154,6 +154,13 @@ void parse_syn_options(vector<const char*>& args)
       } else if (strcmp(args[i],"createshared") == 0) {
         syn_modes.push_back( SYNCLIENT_MODE_CREATESHARED );
         syn_iargs.push_back( atoi(args[++i]) );
+      } else if (strcmp(args[i],"mdtest") == 0) {
+        syn_modes.push_back( SYNCLIENT_MODE_MDTEST );
+	syn_sargs.push_back( args[++i] );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
       } else if (strcmp(args[i],"openshared") == 0) {
         syn_modes.push_back( SYNCLIENT_MODE_OPENSHARED );
         syn_iargs.push_back( atoi(args[++i]) );
@@ -190,6 +197,9 @@ void parse_syn_options(vector<const char*>& args)
         syn_sargs.push_back( args[++i] );
         syn_iargs.push_back( atoi(args[++i]) );
 	syn_iargs.push_back(0);// no data
+      } else if (strcmp(args[i],"replay") == 0) {
+        syn_modes.push_back( SYNCLIENT_MODE_REPLAY );
+        syn_sargs.push_back( args[++i] );
       } else if (strcmp(args[i],"thrashlinks") == 0) {
         syn_modes.push_back( SYNCLIENT_MODE_THRASHLINKS );
         syn_iargs.push_back( atoi(args[++i]) );
@@ -589,6 +599,21 @@ int SyntheticClient::run()
 	did_run_me();
       }
       break;
+    case SYNCLIENT_MODE_MDTEST:
+      {
+        string dir = get_sarg(0);
+        int files = iargs.front();  iargs.pop_front();
+        int threads = iargs.front();  iargs.pop_front();
+        int fanout = iargs.front();  iargs.pop_front();
+        int shared = iargs.front();  iargs.pop_front();
+        if (run_me()) {
+          dout(2) << "mdtest " << dir << " " << files << " " << threads
+		  << " " << fanout << " " << shared << dendl;
+          mdtest(dir, files, threads, fanout, shared);
+        }
+	did_run_me();
+      }
+      break;
     case SYNCLIENT_MODE_OPENSHARED:
       {
         string sarg1 = get_sarg(0);
@@ -816,6 +841,22 @@ int SyntheticClient::run()
       }
       break;
 
+    case SYNCLIENT_MODE_REPLAY:
+      {
+        string tfile = get_sarg(0);
+        sargs.push_front(string("~"));
+        string prefix = get_sarg(0);
+	char realtfile[100];
+	snprintf(realtfile, sizeof(realtfile), tfile.c_str(), (int)client->get_nodeid().v);
+
+        if (run_me()) {
+          dout(0) << "replay " << tfile << " prefix=" << prefix << dendl;
+	  replay_trace(realtfile, prefix);
+        }
+	did_run_me();
+      }
+      break;
+
 
     case SYNCLIENT_MODE_OPENTEST:
       {
@@ -998,7 +1039,76 @@ void SyntheticClient::up()
 }
 
 
+void trace_stats_t::add(const string& op, utime_t lat)
+{
+  uint64_t us = (uint64_t)lat.sec() * 1000000ull + lat.usec();
+  unsigned b = 0;
+  while (b < 40 && (1ull << b) <= us)
+    b++;   // bucket b holds [2^(b-1), 2^b) us
+
+  Mutex::Locker l(lock);
+  op_stats_t& s = ops[op];
+  s.count++;
+  s.total += (double)lat;
+  if (s.buckets.size() <= b)
+    s.buckets.resize(b + 1);
+  s.buckets[b]++;
+}
+
+void trace_stats_t::dump(ostream& out)
+{
+  Mutex::Locker l(lock);
+  for (map<string, op_stats_t>::iterator p = ops.begin(); p != ops.end(); ++p) {
+    op_stats_t& s = p->second;
+    // percentiles, to the bucket
+    uint64_t p50 = 0, p99 = 0, seen = 0;
+    for (unsigned b = 0; b < s.buckets.size(); b++) {
+      seen += s.buckets[b];
+      if (!p50 && seen * 2 >= s.count)
+	p50 = 1ull << b;
+      if (!p99 && seen * 100 >= s.count * 99)
+	p99 = 1ull << b;
+    }
+    out << p->first << " count " << s.count
+	<< " avg " << (s.total / s.count * 1000000.0) << "us"
+	<< " p50 <" << p50 << "us p99 <" << p99 << "us\n";
+    for (unsigned b = 0; b < s.buckets.size(); b++)
+      if (s.buckets[b])
+	out << "  <" << (1ull << b) << "us\t" << s.buckets[b] << "\n";
+  }
+}
+
+static void init_trace_state(Client *client, trace_state_t& state, string& prefix)
+{
+  state.ll_inos[1] = 1; // root inode is known.
+
+  // prefix?
+  if (prefix.length()) {
+    client->mkdir(prefix.c_str(), 0755);
+    struct stat attr;
+    if (client->ll_lookup(vinodeno_t(1, CEPH_NOSNAP), prefix.c_str(), &attr) == 0) {
+      state.ll_inos[1] = attr.st_ino;
+      generic_dout(5) << "'root' ino is " << inodeno_t(attr.st_ino) << dendl;
+    } else {
+      generic_dout(0) << "warning: play_trace coudln't lookup up my per-client directory" << dendl;
+    }
+  }
+}
+
 int SyntheticClient::play_trace(Trace& t, string& prefix, bool metadata_only)
+{
+  trace_state_t state;
+  init_trace_state(client, state, prefix);
+  int r = play_trace(t, prefix, metadata_only, state, NULL);
+  close_trace_state(state);
+  return r;
+}
+
+/*
+ * play t against the shared state; with stats, time each op.
+ */
+int SyntheticClient::play_trace(Trace& t, string& prefix, bool metadata_only,
+				trace_state_t& state, trace_stats_t *stats)
 {
   dout(4) << "play trace prefix '" << prefix << "'" << dendl;
   t.start();
@@ -1008,27 +1118,14 @@ int SyntheticClient::play_trace(Trace& t, string& prefix, bool metadata_only)
 
   utime_t start = ceph_clock_now(g_ceph_context);
 
-  hash_map<int64_t, int64_t> open_files;
-  hash_map<int64_t, dir_result_t*>    open_dirs;
-
-  hash_map<int64_t, Fh*> ll_files;
-  hash_map<int64_t, void*> ll_dirs;
-  hash_map<uint64_t, int64_t> ll_inos;
+  trace_map<int64_t, int64_t>& open_files = state.open_files;
+  trace_map<int64_t, dir_result_t*>& open_dirs = state.open_dirs;
 
-  ll_inos[1] = 1; // root inode is known.
+  trace_map<int64_t, Fh*>& ll_files = state.ll_files;
+  trace_map<int64_t, void*>& ll_dirs = state.ll_dirs;
+  trace_map<uint64_t, int64_t>& ll_inos = state.ll_inos;
 
-  // prefix?
   const char *p = prefix.c_str();
-  if (prefix.length()) {
-    client->mkdir(prefix.c_str(), 0755);
-    struct stat attr;
-    if (client->ll_lookup(vinodeno_t(1, CEPH_NOSNAP), prefix.c_str(), &attr) == 0) {
-      ll_inos[1] = attr.st_ino;
-      dout(5) << "'root' ino is " << inodeno_t(attr.st_ino) << dendl;
-    } else {
-      dout(0) << "warning: play_trace coudln't lookup up my per-client directory" << dendl;
-    }
-  }
 
 
   utime_t last_status = start;
@@ -1061,11 +1158,22 @@ int SyntheticClient::play_trace(Trace& t, string& prefix, bool metadata_only)
     dout(4) << (t.get_line()-1) << ": trace op " << op << dendl;
     
     if (op[0] == '@') {
-      // timestamp... ignore it!
-      t.get_int(); // sec
-      t.get_int(); // usec
+      // timestamp... wait for it if we're pacing
+      int64_t sec = t.get_int();
+      int64_t usec = t.get_int();
+      if (state.paced) {
+	utime_t when = state.replay_start;
+	when += utime_t(sec, usec) - state.trace_start;
+	utime_t now = ceph_clock_now(g_ceph_context);
+	if (when > now) {
+	  utime_t wait = when - now;
+	  usleep(wait.sec() * 1000000 + wait.usec());
+	}
+      }
       op = t.get_string(buf, 0);
     }
+    string opname = op;   // buf gets reused for args
+    utime_t op_start = ceph_clock_now(g_ceph_context);
 
     // high level ops ---------------------
     if (strcmp(op, "link") == 0) {
@@ -1459,6 +1567,9 @@ int SyntheticClient::play_trace(Trace& t, string& prefix, bool metadata_only)
       dout(0) << (t.get_line()-1) << ": *** trace hit unrecognized symbol '" << op << "' " << dendl;
       assert(0);
     }
+
+    if (stats)
+      stats->add(opname, ceph_clock_now(g_ceph_context) - op_start);
   }
 
   dout(10) << "trace finished on line " << t.get_line() << dendl;
@@ -1472,33 +1583,139 @@ int SyntheticClient::play_trace(Trace& t, string& prefix, bool metadata_only)
     cond.Wait(lock);
   }
   lock.Unlock();
+  return 0;
+}
+
+void SyntheticClient::close_trace_state(trace_state_t& state)
+{
+  trace_map<int64_t, int64_t>& open_files = state.open_files;
+  trace_map<int64_t, dir_result_t*>& open_dirs = state.open_dirs;
+  trace_map<int64_t, Fh*>& ll_files = state.ll_files;
+  trace_map<int64_t, void*>& ll_dirs = state.ll_dirs;
 
   // close open files
-  for (hash_map<int64_t, int64_t>::iterator fi = open_files.begin();
+  for (trace_map<int64_t, int64_t>::iterator fi = open_files.begin();
        fi != open_files.end();
        fi++) {
     dout(1) << "leftover close " << fi->second << dendl;
     if (fi->second > 0) client->close(fi->second);
   }
-  for (hash_map<int64_t, dir_result_t*>::iterator fi = open_dirs.begin();
+  for (trace_map<int64_t, dir_result_t*>::iterator fi = open_dirs.begin();
        fi != open_dirs.end();
        fi++) {
     dout(1) << "leftover closedir " << fi->second << dendl;
     if (fi->second != 0) client->closedir(fi->second);
   }
-  for (hash_map<int64_t,Fh*>::iterator fi = ll_files.begin();
+  for (trace_map<int64_t,Fh*>::iterator fi = ll_files.begin();
        fi != ll_files.end();
        fi++) {
     dout(1) << "leftover ll_release " << fi->second << dendl;
     if (fi->second > 0) client->ll_release(fi->second);
   }
-  for (hash_map<int64_t,void*>::iterator fi = ll_dirs.begin();
+  for (trace_map<int64_t,void*>::iterator fi = ll_dirs.begin();
        fi != ll_dirs.end();
        fi++) {
     dout(1) << "leftover ll_releasedir " << fi->second << dendl;
     if (fi->second > 0) client->ll_releasedir(fi->second);
   }
-  
+}
+
+/*
+ * replay a client_trace_binary trace: one thread per thread in the
+ * trace, each issuing its ops at the same offset from the start as in
+ * the original, then report per-op latencies.
+ */
+class C_TracePlayer : public Thread {
+  SyntheticClient *syn;
+  Trace t;
+  string prefix;
+  trace_state_t& state;
+  trace_stats_t& stats;
+public:
+  C_TracePlayer(SyntheticClient *s, const list<string>& tokens, string& p,
+		trace_state_t& st, trace_stats_t& sts)
+    : syn(s), t(tokens), prefix(p), state(st), stats(sts) {}
+  void *entry() {
+    syn->play_trace(t, prefix, false, state, &stats);
+    return 0;
+  }
+};
+
+static bool trace_record_before(const trace_record_t& a, const trace_record_t& b)
+{
+  return a.stamp < b.stamp;
+}
+
+int SyntheticClient::replay_trace(const char *fn, string& prefix)
+{
+  bufferlist bl;
+  string err;
+  int r = bl.read_file(fn, &err);
+  if (r < 0) {
+    dout(0) << "replay: " << err << dendl;
+    return r;
+  }
+
+  // records are written as ops complete; sort each thread's by start
+  map<uint64_t, list<trace_record_t> > threads;
+  utime_t first;
+  unsigned num_ops = 0;
+  bufferlist::iterator p = bl.begin();
+  try {
+    while (!p.end()) {
+      trace_record_t rec;
+      ::decode(rec, p);
+      if (first.is_zero() || rec.stamp < first)
+	first = rec.stamp;
+      threads[rec.thread].push_back(rec);
+      num_ops++;
+    }
+  } catch (buffer::error& e) {
+    dout(0) << "replay: " << fn << " is truncated after " << num_ops << " ops" << dendl;
+  }
+
+  trace_state_t state;
+  init_trace_state(client, state, prefix);
+  trace_stats_t stats;
+  state.paced = true;
+  state.trace_start = first;
+
+  list<C_TracePlayer*> players;
+  for (map<uint64_t, list<trace_record_t> >::iterator q = threads.begin();
+       q != threads.end();
+       ++q) {
+    q->second.sort(trace_record_before);
+    list<string> tokens;
+    for (list<trace_record_t>::iterator rec = q->second.begin();
+	 rec != q->second.end();
+	 ++rec) {
+      char s[30];
+      tokens.push_back("@");
+      snprintf(s, sizeof(s), "%d", (int)rec->stamp.sec());
+      tokens.push_back(s);
+      snprintf(s, sizeof(s), "%d", (int)rec->stamp.usec());
+      tokens.push_back(s);
+      tokens.splice(tokens.end(), rec->tokens);
+    }
+    players.push_back(new C_TracePlayer(this, tokens, prefix, state, stats));
+  }
+
+  dout(0) << "replay: " << num_ops << " ops in " << players.size() << " threads" << dendl;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  state.replay_start = start;
+  for (list<C_TracePlayer*>::iterator q = players.begin(); q != players.end(); ++q)
+    (*q)->create();
+  for (list<C_TracePlayer*>::iterator q = players.begin(); q != players.end(); ++q) {
+    (*q)->join();
+    delete *q;
+  }
+  close_trace_state(state);
+
+  utime_t lat = ceph_clock_now(g_ceph_context);
+  lat -= start;
+  ostringstream ss;
+  stats.dump(ss);
+  dout(0) << "replay: done in " << lat << " seconds, per-op latency:\n" << ss.str() << dendl;
   return 0;
 }
 
@@ -1885,6 +2102,136 @@ int SyntheticClient::create_shared(int num)
   return 0;
 }
 
+/*
+ * mdtest-style metadata benchmark.  threads threads each create files
+ * files spread over fanout subdirectories, then stat them, list the
+ * subdirectories, rename and unlink them, one phase at a time.  with
+ * shared the subdirectories are common to every client (basedir/d.N),
+ * otherwise each client gets its own (basedir/client.C/d.N); start the
+ * clients together with sleepuntil to load the mds from many of them.
+ * reports ops/s and per-op latency for each phase.
+ */
+static const char *mdtest_phases[] = { "create", "stat", "readdir", "rename", "unlink" };
+
+class C_MDTestWorker : public Thread {
+  SyntheticClient *syn;
+  string dir;
+  int phase, thread, threads, files, fanout;
+  trace_stats_t& stats;
+public:
+  C_MDTestWorker(SyntheticClient *s, const string& d, int p, int t, int nt,
+		 int f, int fo, trace_stats_t& sts)
+    : syn(s), dir(d), phase(p), thread(t), threads(nt), files(f), fanout(fo),
+      stats(sts) {}
+  void *entry() {
+    syn->mdtest_phase(dir, phase, thread, threads, files, fanout, stats);
+    return 0;
+  }
+};
+
+void SyntheticClient::mdtest_phase(const string& dir, int phase, int thread, int threads,
+				   int files, int fanout, trace_stats_t& stats)
+{
+  const string op = mdtest_phases[phase];
+  char name[255], to[255];
+  if (phase == 2) {
+    // each thread lists its share of the subdirectories
+    for (int d = thread; d < fanout; d += threads) {
+      snprintf(name, sizeof(name), "%s/d.%d", dir.c_str(), d);
+      list<string> contents;
+      utime_t start = ceph_clock_now(g_ceph_context);
+      int r = client->getdir(name, contents);
+      utime_t lat = ceph_clock_now(g_ceph_context);
+      lat -= start;
+      if (r < 0)
+	dout(1) << "mdtest: readdir " << name << " got " << r << dendl;
+      stats.add(op, lat);
+    }
+    return;
+  }
+
+  for (int i = 0; i < files; i++) {
+    if (time_to_stop())
+      break;
+    snprintf(name, sizeof(name), "%s/d.%d/f.%lld.%d.%d", dir.c_str(), i % fanout,
+	     (long long)client->get_nodeid().v, thread, i);
+    snprintf(to, sizeof(to), "%s.r", name);
+    utime_t start = ceph_clock_now(g_ceph_context);
+    int r;
+    switch (phase) {
+    case 0:
+      r = client->open(name, O_CREAT|O_WRONLY, 0644);
+      if (r >= 0)
+	client->close(r);
+      break;
+    case 1:
+      {
+	struct stat st;
+	r = client->lstat(name, &st);
+      }
+      break;
+    case 3:
+      r = client->rename(name, to);
+      break;
+    default:
+      r = client->unlink(to);
+      break;
+    }
+    utime_t lat = ceph_clock_now(g_ceph_context);
+    lat -= start;
+    if (r < 0)
+      dout(1) << "mdtest: " << op << " " << name << " got " << r << dendl;
+    stats.add(op, lat);
+  }
+}
+
+int SyntheticClient::mdtest(const string& basedir, int files, int threads, int fanout,
+			    bool shared)
+{
+  if (files <= 0 || threads <= 0 || fanout <= 0)
+    return -EINVAL;
+
+  string dir = basedir;
+  client->mkdir(dir.c_str(), 0755);
+  if (!shared) {
+    char s[40];
+    snprintf(s, sizeof(s), "/client.%lld", (long long)client->get_nodeid().v);
+    dir += s;
+    client->mkdir(dir.c_str(), 0755);
+  }
+  char d[255];
+  for (int i = 0; i < fanout; i++) {
+    snprintf(d, sizeof(d), "%s/d.%d", dir.c_str(), i);
+    client->mkdir(d, 0755);  // others may have made it already
+  }
+
+  ostringstream ss;
+  for (int phase = 0; phase < 5; phase++) {
+    trace_stats_t stats;
+    list<C_MDTestWorker*> workers;
+    for (int t = 0; t < threads; t++)
+      workers.push_back(new C_MDTestWorker(this, dir, phase, t, threads, files,
+					   fanout, stats));
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (list<C_MDTestWorker*>::iterator p = workers.begin(); p != workers.end(); ++p)
+      (*p)->create();
+    for (list<C_MDTestWorker*>::iterator p = workers.begin(); p != workers.end(); ++p) {
+      (*p)->join();
+      delete *p;
+    }
+    double secs = (double)(ceph_clock_now(g_ceph_context) - start);
+
+    uint64_t ops = stats.ops[mdtest_phases[phase]].count;
+    ss << mdtest_phases[phase] << " " << ops << " ops in " << secs << " s, "
+       << (secs > 0 ? ops / secs : 0) << " ops/s\n";
+    stats.dump(ss);
+  }
+  dout(0) << "mdtest " << dir << " files " << files << " threads " << threads
+	  << " fanout " << fanout << (shared ? " shared" : " private") << ":\n"
+	  << ss.str() << dendl;
+  return 0;
+}
+
 int SyntheticClient::open_shared(int num, int count)
 {
   // files
@@ -36,6 +36,7 @@
 #define SYNCLIENT_MODE_MAKEFILES2   12     // num count private
 #define SYNCLIENT_MODE_CREATESHARED 13     // num
 #define SYNCLIENT_MODE_OPENSHARED   14     // num count
+#define SYNCLIENT_MODE_MDTEST       15     // dir files threads fanout shared
 
 #define SYNCLIENT_MODE_RMFILE      19
 #define SYNCLIENT_MODE_WRITEFILE   20
@@ -53,6 +54,7 @@
 #define SYNCLIENT_MODE_DROPCACHE   29
 
 #define SYNCLIENT_MODE_TRACE       30
+#define SYNCLIENT_MODE_REPLAY      31
 
 #define SYNCLIENT_MODE_CREATEOBJECTS 35
 #define SYNCLIENT_MODE_OBJECTRW 36
@@ -94,6 +96,66 @@
 
 void parse_syn_options(vector<const char*>& args);
 
+/*
+ * a map that trace players in different threads can share.  it is a
+ * std::map so references stay valid as other keys come and go.
+ */
+template<class K, class V>
+class trace_map {
+  Mutex lock;
+  map<K,V> m;
+public:
+  typedef typename map<K,V>::iterator iterator;
+
+  trace_map() : lock("trace_map::lock") {}
+  size_t count(const K& k) {
+    Mutex::Locker l(lock);
+    return m.count(k);
+  }
+  V& operator[](const K& k) {
+    Mutex::Locker l(lock);
+    return m[k];
+  }
+  void erase(const K& k) {
+    Mutex::Locker l(lock);
+    m.erase(k);
+  }
+  // only once the players are done
+  iterator begin() { return m.begin(); }
+  iterator end() { return m.end(); }
+};
+
+// what a trace has opened and looked up, by the ids in the trace
+struct trace_state_t {
+  trace_map<int64_t, int64_t> open_files;
+  trace_map<int64_t, dir_result_t*> open_dirs;
+  trace_map<int64_t, Fh*> ll_files;
+  trace_map<int64_t, void*> ll_dirs;
+  trace_map<uint64_t, int64_t> ll_inos;
+
+  // when replaying, ops wait until their time in the trace ('@' stamps)
+  bool paced;
+  utime_t trace_start, replay_start;
+
+  trace_state_t() : paced(false) {}
+};
+
+// per-op latency, in power-of-two buckets of microseconds
+struct trace_stats_t {
+  struct op_stats_t {
+    uint64_t count;
+    double total;
+    vector<uint64_t> buckets;
+    op_stats_t() : count(0), total(0) {}
+  };
+  Mutex lock;
+  map<string, op_stats_t> ops;
+
+  trace_stats_t() : lock("trace_stats_t::lock") {}
+  void add(const string& op, utime_t lat);
+  void dump(ostream& out);
+};
+
 class SyntheticClient {
   Client *client;
   int whoami;
@@ -235,6 +297,10 @@ class SyntheticClient {
   int create_shared(int num);
   int open_shared(int num, int count);
 
+  int mdtest(const string& basedir, int files, int threads, int fanout, bool shared);
+  void mdtest_phase(const string& dir, int phase, int thread, int threads,
+		    int files, int fanout, trace_stats_t& stats);
+
   int rm_file(string& fn);
   int write_file(string& fn, int mb, loff_t chunk);
   int write_fd(int fd, int size, int wrsize);
@@ -255,6 +321,10 @@ class SyntheticClient {
   int clean_dir(string& basedir);
 
   int play_trace(Trace& t, string& prefix, bool metadata_only=false);
+  int play_trace(Trace& t, string& prefix, bool metadata_only,
+		 trace_state_t& state, trace_stats_t *stats);
+  void close_trace_state(trace_state_t& state);
+  int replay_trace(const char *fn, string& prefix);
 
   void make_dir_mess(const char *basedir, int n);
   void foo();
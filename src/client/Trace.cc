@@ -37,6 +37,15 @@ using namespace __gnu_cxx;
 void Trace::start()
 {
   //cout << "start" << std::endl;
+  if (!filename) {
+    next = tokens.begin();
+    done = (next == tokens.end());
+    if (!done)
+      line = *next++;
+    _line = 1;
+    return;
+  }
+
   delete fs;
 
   fs = new ifstream();
@@ -76,7 +85,14 @@ const char *Trace::get_string(char *buf, const char *prefix)
   //cout << "buf is " << buf << std::endl;
   // read next line (and detect eof early)
   _line++;
-  getline(*fs, line);
+  if (!filename) {
+    if (next == tokens.end())
+      done = true;
+    else
+      line = *next++;
+  } else {
+    getline(*fs, line);
+  }
   //cout << "next line is " << line << std::endl;
 
   return buf;
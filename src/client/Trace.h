@@ -25,6 +25,38 @@ using std::list;
 using std::string;
 using std::ifstream;
 
+#include "include/types.h"
+#include "include/utime.h"
+
+/*
+ * one op in a binary trace (client_trace_binary): the tokens the text
+ * trace would have had for it, the thread that issued it and when it
+ * started.  the file is just a string of these.
+ */
+struct trace_record_t {
+  uint64_t thread;
+  utime_t stamp;
+  list<string> tokens;
+
+  trace_record_t() : thread(0) {}
+
+  void encode(bufferlist& bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(thread, bl);
+    ::encode(stamp, bl);
+    ::encode(tokens, bl);
+  }
+  void decode(bufferlist::iterator& bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(thread, bl);
+    ::decode(stamp, bl);
+    ::decode(tokens, bl);
+  }
+};
+WRITE_CLASS_ENCODER(trace_record_t)
+
 /*
 
  this class is more like an iterator over a constant tokenlist (which 
@@ -38,8 +70,14 @@ class Trace {
   ifstream *fs;
   string line;
 
+  // or, without a file, the tokens themselves
+  list<string> tokens;
+  list<string>::iterator next;
+  bool done;
+
  public:
-  Trace(const char* f) : filename(f), fs(0) {}
+  Trace(const char* f) : filename(f), fs(0), done(false) {}
+  Trace(const list<string>& t) : filename(0), fs(0), tokens(t), done(false) {}
   ~Trace() { 
     delete fs; 
   }
@@ -59,6 +97,8 @@ class Trace {
     return atoll(get_string(buf, 0));
   }
   bool end() {
+    if (!filename)
+      return done;
     return !fs || fs->eof();
     //return _cur == _end;
   }
@@ -0,0 +1,105 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "TraceWriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common/Clock.h"
+#include "common/debug.h"
+#include "common/errno.h"
+
+#define DOUT_SUBSYS client
+
+// write out encoded records once this many bytes pile up
+#define TRACE_FLUSH_BYTES (1 << 20)
+
+int TraceWriter::open(CephContext *c, const char *fn, bool bin)
+{
+  cct = c;
+  binary = bin;
+  if (!binary) {
+    out.open(fn);
+    return out.is_open() ? 0 : -EIO;
+  }
+  fd = ::open(fn, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0)
+    return -errno;
+  return 0;
+}
+
+void TraceWriter::close()
+{
+  if (out.is_open())
+    out.close();
+  if (fd >= 0) {
+    flush(true);
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+trace_record_t& TraceWriter::get_cur()
+{
+  pthread_t me = pthread_self();
+  map<pthread_t, trace_record_t>::iterator p = cur.find(me);
+  if (p == cur.end()) {
+    p = cur.insert(make_pair(me, trace_record_t())).first;
+    p->second.thread = (uint64_t)me;
+    p->second.stamp = ceph_clock_now(cct);
+  }
+  return p->second;
+}
+
+void TraceWriter::start_op(const char *op)
+{
+  if (!binary) {
+    out << op << std::endl;
+    return;
+  }
+  if (fd < 0)
+    return;
+
+  // whatever this thread did before is complete now
+  map<pthread_t, trace_record_t>::iterator p = cur.find(pthread_self());
+  if (p != cur.end()) {
+    ::encode(p->second, pending);
+    cur.erase(p);
+  }
+  get_cur().tokens.push_back(op);
+  if (pending.length() >= TRACE_FLUSH_BYTES)
+    flush(false);
+}
+
+void TraceWriter::finish_token()
+{
+  if (fd >= 0)
+    get_cur().tokens.push_back(token.str());
+  token.str("");
+}
+
+void TraceWriter::flush(bool all)
+{
+  if (all) {
+    for (map<pthread_t, trace_record_t>::iterator p = cur.begin(); p != cur.end(); ++p)
+      ::encode(p->second, pending);
+    cur.clear();
+  }
+  int r = pending.write_fd(fd);
+  if (r < 0)
+    lderr(cct) << "trace write failed: " << cpp_strerror(r) << dendl;
+  pending.clear();
+}
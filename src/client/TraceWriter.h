@@ -0,0 +1,83 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_CLIENT_TRACEWRITER_H
+#define CEPH_CLIENT_TRACEWRITER_H
+
+#include <pthread.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "Trace.h"
+
+class CephContext;
+
+/*
+ * Writes the client op trace (client_trace).  Ops begin with
+ * start_op(); their arguments, and any results they report, follow as
+ * std::endl-terminated tokens.
+ *
+ * The text format is one token per line, as Trace reads it back.  The
+ * binary format (client_trace_binary) collects each op's tokens per
+ * thread into a trace_record_t stamped with the thread and start time,
+ * so ops that run concurrently don't interleave and can be replayed
+ * with their original concurrency and timing.
+ *
+ * Callers serialize (client_lock).
+ */
+class TraceWriter {
+  CephContext *cct;
+  bool binary;
+  std::ofstream out;
+
+  int fd;
+  bufferlist pending;                               // encoded records
+  map<pthread_t, trace_record_t> cur;              // op in progress, per thread
+  std::ostringstream token;
+
+  trace_record_t& get_cur();
+  void finish_token();
+  void flush(bool all);
+
+public:
+  TraceWriter() : cct(NULL), binary(false), fd(-1) {}
+  ~TraceWriter() {
+    close();
+  }
+
+  int open(CephContext *c, const char *fn, bool bin);
+  void close();
+
+  void start_op(const char *op);
+
+  template<class T>
+  TraceWriter& operator<<(const T& v) {
+    if (binary)
+      token << v;
+    else
+      out << v;
+    return *this;
+  }
+  TraceWriter& operator<<(std::ostream& (*f)(std::ostream&)) {
+    if (binary)
+      finish_token();
+    else
+      out << f;
+    return *this;
+  }
+};
+
+#endif
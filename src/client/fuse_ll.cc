@@ -22,6 +22,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
 
 // ceph
 #include "common/errno.h"
@@ -337,10 +339,27 @@ static void ceph_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
   Fh *fh = (Fh*)fi->fh;
   bufferlist bl;
   int r = client->ll_read(fh, off, size, &bl);
-  if (r >= 0)
-    fuse_reply_buf(req, bl.c_str(), bl.length());
-  else
+  if (r < 0) {
     fuse_reply_err(req, -r);
+    return;
+  }
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(2, 7)
+  // hand the cached buffers to the kernel as they are; c_str() would
+  // first copy them into one contiguous buffer.
+  if (bl.buffers().size() > 1 && bl.buffers().size() <= IOV_MAX) {
+    vector<struct iovec> iov(bl.buffers().size());
+    int i = 0;
+    for (list<bufferptr>::const_iterator p = bl.buffers().begin();
+	 p != bl.buffers().end();
+	 ++p, ++i) {
+      iov[i].iov_base = (void*)p->c_str();
+      iov[i].iov_len = p->length();
+    }
+    fuse_reply_iov(req, &iov[0], iov.size());
+    return;
+  }
+#endif
+  fuse_reply_buf(req, bl.c_str(), bl.length());
 }
 
 static void ceph_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
@@ -782,6 +782,52 @@ JNIEXPORT jstring JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1hosts
   return j_addr;
 }
 
+/*
+ * Class:     org_apache_hadoop_fs_ceph_CephTalker
+ * Method:    ceph_hosts_batch
+ * Signature: (IJJI)[Ljava/lang/String;
+ * Find the primary OSD addresses for count offsets of a file, stride
+ * bytes apart, in one call.
+ * Inputs:
+ *  jint j_fh: The filehandle for the file.
+ *  jlong j_offset: The first offset to get the location of.
+ *  jlong j_stride: The distance between offsets.
+ *  jint j_count: The number of offsets.
+ * Returns: a String[] of the locations as IP, with NULL entries for
+ *  offsets that failed, or NULL if the array can't be allocated.
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1hosts_1batch
+(JNIEnv *env, jobject obj, jint j_fh, jlong j_offset, jlong j_stride, jint j_count)
+{
+  struct ceph_mount_info *cmount = get_ceph_mount_t(env, obj);
+  jclass string_cls = env->FindClass("java/lang/String");
+  if (string_cls == NULL) return NULL;
+  jobjectArray hosts = env->NewObjectArray(j_count, string_cls, NULL);
+  if (hosts == NULL) return NULL;
+
+  int size = 24;  // grown on -ERANGE, like ceph_hosts
+  char *address = new char[size];
+  for (jint i = 0; i < j_count; ++i) {
+    jlong offset = j_offset + i * j_stride;
+    int r = ceph_get_file_stripe_address(cmount, j_fh, offset, address, size);
+    if (r == -ERANGE) {
+      delete [] address;
+      size = ceph_get_file_stripe_address(cmount, j_fh, offset, NULL, 0);
+      address = new char[size];
+      r = ceph_get_file_stripe_address(cmount, j_fh, offset, address, size);
+    }
+    if (r < 0)
+      continue;  // leave it NULL
+    jstring j_addr = env->NewStringUTF(address);
+    if (j_addr == NULL)
+      break;
+    env->SetObjectArrayElement(hosts, i, j_addr);
+    env->DeleteLocalRef(j_addr);
+  }
+  delete [] address;
+  return hosts;
+}
+
 /*
  * Class:     org_apache_hadoop_fs_ceph_CephTalker
  * Method:    ceph_setTimes
@@ -858,6 +904,36 @@ JNIEXPORT jint JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1read
   return result;
 }
 
+/*
+ * Class:     org_apache_hadoop_fs_ceph_CephTalker
+ * Method:    ceph_read_direct
+ * Signature: (ILjava/nio/ByteBuffer;II)I
+ * Reads into the given direct ByteBuffer from the current position.
+ * Unlike ceph_read there is no Java array to pin or copy back.
+ * Inputs:
+ *  jint fh: the filehandle to read from
+ *  jobject j_buffer: the direct ByteBuffer to read into
+ *  jint buffer_offset: where in the buffer to start writing
+ *  jint length: how much to read.
+ * Returns: the number of bytes read on success (as jint), -EINVAL
+ *  if the buffer isn't direct or is too short, or an error code.
+ */
+JNIEXPORT jint JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1read_1direct
+  (JNIEnv *env, jobject obj, jint fh, jobject j_buffer, jint buffer_offset, jint length)
+{
+  struct ceph_mount_info *cmount = get_ceph_mount_t(env, obj);
+  CephContext *cct = ceph_get_mount_context(cmount);
+  ldout(cct, 10) << "In read_direct" << dendl;
+
+  char *c_buffer = (char*) env->GetDirectBufferAddress(j_buffer);
+  jlong capacity = env->GetDirectBufferCapacity(j_buffer);
+  if (c_buffer == NULL || buffer_offset < 0 || length < 0 ||
+      (jlong)buffer_offset + length > capacity)
+    return -EINVAL;
+
+  return ceph_read(cmount, (int)fh, c_buffer + buffer_offset, length, -1);
+}
+
 /*
  * Class:     org_apache_hadoop_fs_ceph_CephTalker
  * Method:    ceph_seek_from_start
@@ -934,8 +1010,38 @@ JNIEXPORT jint JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1write
   // Step 3: do the write
   result = ceph_write(cmount, (int)fh, c_buffer, length, -1);
 
-  // Step 4: release the pointer to the buffer
-  env->ReleaseByteArrayElements(j_buffer, j_buffer_ptr, 0);
+  // Step 4: release the pointer to the buffer; nothing to copy back
+  env->ReleaseByteArrayElements(j_buffer, j_buffer_ptr, JNI_ABORT);
 
   return result;
 }
+
+/*
+ * Class:     org_apache_hadoop_fs_ceph_CephTalker
+ * Method:    ceph_write_direct
+ * Signature: (ILjava/nio/ByteBuffer;II)I
+ * Write the given direct ByteBuffer contents to the given filehandle.
+ * Unlike ceph_write there is no Java array to pin.
+ * Inputs:
+ *  jint fh: The filehandle to write to.
+ *  jobject j_buffer: The direct ByteBuffer to write from
+ *  jint buffer_offset: The position in the buffer to write from
+ *  jint length: The number of (sequential) bytes to write.
+ * Returns: jint, on success the number of bytes written, -EINVAL if
+ *  the buffer isn't direct or is too short, or a negative error code.
+ */
+JNIEXPORT jint JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1write_1direct
+  (JNIEnv *env, jobject obj, jint fh, jobject j_buffer, jint buffer_offset, jint length)
+{
+  struct ceph_mount_info *cmount = get_ceph_mount_t(env, obj);
+  CephContext *cct = ceph_get_mount_context(cmount);
+  ldout(cct, 10) << "In write_direct" << dendl;
+
+  char *c_buffer = (char*) env->GetDirectBufferAddress(j_buffer);
+  jlong capacity = env->GetDirectBufferCapacity(j_buffer);
+  if (c_buffer == NULL || buffer_offset < 0 || length < 0 ||
+      (jlong)buffer_offset + length > capacity)
+    return -EINVAL;
+
+  return ceph_write(cmount, (int)fh, c_buffer + buffer_offset, length, -1);
+}
@@ -23,6 +23,8 @@
 package org.apache.hadoop.fs.ceph;
 
 
+import java.nio.ByteBuffer;
+
 import org.apache.hadoop.conf.Configuration;
 import org.apache.commons.logging.Log;
 
@@ -216,6 +218,18 @@ abstract class CephFS {
    */
   abstract protected String ceph_hosts(int fh, long offset);
 
+  /*
+   * Find the primary OSD addresses for count blocks of a file, in one go.
+   * Inputs:
+   *  int fh: The filehandle for the file.
+   *  long offset: The offset of the first block.
+   *  long stride: The distance between blocks.
+   *  int count: The number of blocks.
+   * Returns: a String[] of count locations (an entry is NULL where there
+   *  was an error), or NULL if the whole lookup failed.
+   */
+  abstract protected String[] ceph_hosts_batch(int fh, long offset, long stride, int count);
+
   /*
    * Set the mtime and atime for a given path.
    * Inputs:
@@ -258,6 +272,22 @@ abstract class CephFS {
    *  or an error code otherwise.	 */
   abstract protected int ceph_read(int fh, byte[] buffer, int buffer_offset, int length);
 
+  /*
+   * Like ceph_write, but from a direct ByteBuffer, without copying it
+   * out of the JVM.  The buffer's position and limit are ignored.
+   * Returns: the number of bytes written, or a negative error code
+   *  (-EINVAL if the buffer isn't direct or is too short).
+   */
+  abstract protected int ceph_write_direct(int fh, ByteBuffer buffer, int buffer_offset, int length);
+
+  /*
+   * Like ceph_read, but into a direct ByteBuffer, without a copy back
+   * into the JVM.  The buffer's position and limit are ignored.
+   * Returns: the number of bytes read, or a negative error code
+   *  (-EINVAL if the buffer isn't direct or is too short).
+   */
+  abstract protected int ceph_read_direct(int fh, ByteBuffer buffer, int buffer_offset, int length);
+
   /*
    * Seeks to the given position in the given file.
    * Inputs:
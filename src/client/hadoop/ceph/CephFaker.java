@@ -23,6 +23,7 @@ package org.apache.hadoop.fs.ceph;
 
 
 import java.net.URI;
+import java.nio.ByteBuffer;
 import java.util.Hashtable;
 import java.io.Closeable;
 import java.io.FileNotFoundException;
@@ -362,6 +363,15 @@ class CephFaker extends CephFS {
     return ret;
   }
 
+  protected String[] ceph_hosts_batch(int fh, long offset, long stride, int count) {
+    String[] ret = new String[count];
+
+    for (int i = 0; i < count; ++i) {
+      ret[i] = ceph_hosts(fh, offset + i * stride);
+    }
+    return ret;
+  }
+
   protected int ceph_setTimes(String pth, long mtime, long atime) {
     pth = prepare_path(pth);
     Path path = new Path(pth);
@@ -427,6 +437,41 @@ class CephFaker extends CephFS {
     return (int) ret;
   }
 
+  // no native memory here; go through a heap array
+  protected int ceph_write_direct(int fh, ByteBuffer buffer,
+      int buffer_offset, int length) {
+    if (!buffer.isDirect() || buffer_offset < 0 || length < 0
+        || buffer_offset + length > buffer.capacity()) {
+      return -22; // EINVAL
+    }
+    byte[] b = new byte[length];
+    ByteBuffer src = buffer.duplicate();
+
+    src.clear();
+    src.position(buffer_offset);
+    src.get(b, 0, length);
+    return ceph_write(fh, b, 0, length);
+  }
+
+  protected int ceph_read_direct(int fh, ByteBuffer buffer,
+      int buffer_offset, int length) {
+    if (!buffer.isDirect() || buffer_offset < 0 || length < 0
+        || buffer_offset + length > buffer.capacity()) {
+      return -22; // EINVAL
+    }
+    byte[] b = new byte[length];
+    int ret = ceph_read(fh, b, 0, length);
+
+    if (ret > 0) {
+      ByteBuffer dst = buffer.duplicate();
+
+      dst.clear();
+      dst.position(buffer_offset);
+      dst.put(b, 0, ret);
+    }
+    return ret;
+  }
+
   protected long ceph_seek_from_start(int fh, long pos) {
     debug("ceph_seek_from_start(fh " + fh + ", pos " + pos + ")", INFO);
     long ret = -1; // generic fail
@@ -754,23 +754,20 @@ public class CephFileSystem extends FileSystem {
 
     ceph.debug("getFileBlockLocations:return from ceph_getblocksize", ceph.TRACE);
     BlockLocation[] locations = new BlockLocation[(int) Math.ceil(len / (float) blockSize)];
-    long offset;
 
-    for (int i = 0; i < locations.length; ++i) {
-      offset = start + i * blockSize;
-      ceph.debug(
-          "getFileBlockLocations:call ceph_hosts from Java on fh " + fh
-          + " and offset " + offset,
-          ceph.TRACE);
-      String host = ceph.ceph_hosts(fh, offset);
+    // one trip through JNI for all of them
+    ceph.debug(
+        "getFileBlockLocations:call ceph_hosts_batch from Java on fh " + fh
+        + " for " + locations.length + " blocks from offset " + start,
+        ceph.TRACE);
+    String[] hosts = ceph.ceph_hosts_batch(fh, start, blockSize, locations.length);
 
-      ceph.debug(
-          "getFileBlockLocations:return from ceph_hosts to Java with host "
-              + host,
-              ceph.TRACE);
+    ceph.debug("getFileBlockLocations:return from ceph_hosts_batch to Java",
+        ceph.TRACE);
+    for (int i = 0; i < locations.length; ++i) {
       String[] hostArray = new String[1];
 
-      hostArray[0] = host;
+      hostArray[0] = (hosts == null) ? null : hosts[i];
       locations[i] = new BlockLocation(hostArray, hostArray,
           start + i * blockSize - (start % blockSize), blockSize);
     }
@@ -22,6 +22,7 @@ package org.apache.hadoop.fs.ceph;
 
 
 import java.io.IOException;
+import java.nio.ByteBuffer;
 
 import org.apache.hadoop.conf.Configuration;
 import org.apache.hadoop.fs.FSInputStream;
@@ -42,7 +43,8 @@ public class CephInputStream extends FSInputStream {
 
   private CephFS ceph;
 
-  private byte[] buffer;
+  // direct, so that Ceph reads straight into it
+  private ByteBuffer buffer;
   private int bufPos = 0;
   private int bufValid = 0;
   private long cephPos = 0;
@@ -62,7 +64,7 @@ public class CephInputStream extends FSInputStream {
     fileHandle = fh;
     closed = false;
     ceph = cephfs;
-    buffer = new byte[bufferSize];
+    buffer = ByteBuffer.allocateDirect(bufferSize);
     ceph.debug(
         "CephInputStream constructor: initializing stream with fh " + fh
         + " and file length " + flength,
@@ -84,7 +86,7 @@ public class CephInputStream extends FSInputStream {
   }
 
   private synchronized boolean fillBuffer() throws IOException {
-    bufValid = ceph.ceph_read(fileHandle, buffer, 0, buffer.length);
+    bufValid = ceph.ceph_read_direct(fileHandle, buffer, 0, buffer.capacity());
     bufPos = 0;
     if (bufValid < 0) {
       int err = bufValid;
@@ -209,16 +211,13 @@ public class CephInputStream extends FSInputStream {
     do {
       read = Math.min(len, bufValid - bufPos);
       try {
-        System.arraycopy(buffer, bufPos, buf, off, read);
+        buffer.position(bufPos);
+        buffer.get(buf, off, read);
       } catch (IndexOutOfBoundsException ie) {
         throw new IOException(
             "CephInputStream.read: Indices out of bounds:" + "read length is "
             + len + ", buffer offset is " + off + ", and buffer size is "
             + buf.length);
-      } catch (ArrayStoreException ae) {
-        throw new IOException(
-            "Uh-oh, CephInputStream failed to do an array"
-                + "copy due to type mismatch...");
       } catch (NullPointerException ne) {
         throw new IOException(
             "CephInputStream.read: cannot read " + len + "bytes from fd:"
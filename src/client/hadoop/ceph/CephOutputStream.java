@@ -24,6 +24,7 @@ package org.apache.hadoop.fs.ceph;
 
 import java.io.IOException;
 import java.io.OutputStream;
+import java.nio.ByteBuffer;
 
 import org.apache.hadoop.conf.Configuration;
 import org.apache.hadoop.util.Progressable;
@@ -42,7 +43,8 @@ public class CephOutputStream extends OutputStream {
 
   private int fileHandle;
 
-  private byte[] buffer;
+  // direct, so that Ceph writes straight from it
+  private ByteBuffer buffer;
   private int bufUsed = 0;
 
   /**
@@ -55,7 +57,7 @@ public class CephOutputStream extends OutputStream {
     ceph = cephfs;
     fileHandle = fh;
     closed = false;
-    buffer = new byte[bufferSize];
+    buffer = ByteBuffer.allocateDirect(bufferSize);
   }
 
   /** Ceph likes things to be closed before it shuts down,
@@ -129,18 +131,15 @@ public class CephOutputStream extends OutputStream {
     int write;
 
     while (len > 0) {
-      write = Math.min(len, buffer.length - bufUsed);
+      write = Math.min(len, buffer.capacity() - bufUsed);
       try {
-        System.arraycopy(buf, off, buffer, bufUsed, write);
+        buffer.position(bufUsed);
+        buffer.put(buf, off, write);
       } catch (IndexOutOfBoundsException ie) {
         throw new IOException(
             "CephOutputStream.write: Indices out of bounds: "
                 + "write length is " + len + ", buffer offset is " + off
                 + ", and buffer size is " + buf.length);
-      } catch (ArrayStoreException ae) {
-        throw new IOException(
-            "Uh-oh, CephOutputStream failed to do an array"
-                + " copy due to type mismatch...");
       } catch (NullPointerException ne) {
         throw new IOException(
             "CephOutputStream.write: cannot write " + len + "bytes to fd "
@@ -149,8 +148,8 @@ public class CephOutputStream extends OutputStream {
       bufUsed += write;
       len -= write;
       off += write;
-      if (bufUsed == buffer.length) {
-        result = ceph.ceph_write(fileHandle, buffer, 0, bufUsed);
+      if (bufUsed == buffer.capacity()) {
+        result = ceph.ceph_write_direct(fileHandle, buffer, 0, bufUsed);
         if (result < 0) {
           throw new IOException(
               "CephOutputStream.write: Buffered write of " + bufUsed
@@ -179,7 +178,7 @@ public class CephOutputStream extends OutputStream {
       if (bufUsed == 0) {
         return;
       }
-      int result = ceph.ceph_write(fileHandle, buffer, 0, bufUsed);
+      int result = ceph.ceph_write_direct(fileHandle, buffer, 0, bufUsed);
 
       if (result < 0) {
         throw new IOException(
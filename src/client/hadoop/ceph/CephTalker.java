@@ -21,6 +21,8 @@
 package org.apache.hadoop.fs.ceph;
 
 
+import java.nio.ByteBuffer;
+
 import org.apache.hadoop.conf.Configuration;
 import org.apache.commons.logging.Log;
 
@@ -80,6 +82,8 @@ class CephTalker extends CephFS {
 
   protected native String ceph_hosts(int fh, long offset);
 
+  protected native String[] ceph_hosts_batch(int fh, long offset, long stride, int count);
+
   protected native int ceph_setTimes(String path, long mtime, long atime);
 
   protected native long ceph_getpos(int fh);
@@ -88,5 +92,9 @@ class CephTalker extends CephFS {
 
   protected native int ceph_read(int fh, byte[] buffer, int buffer_offset, int length);
 
+  protected native int ceph_write_direct(int fh, ByteBuffer buffer, int buffer_offset, int length);
+
+  protected native int ceph_read_direct(int fh, ByteBuffer buffer, int buffer_offset, int length);
+
   protected native long ceph_seek_from_start(int fh, long pos);
 }
@@ -191,6 +191,30 @@ JNIEXPORT jstring JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1hosts
 JNIEXPORT jint JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1setTimes
   (JNIEnv *, jobject, jstring, jlong, jlong);
 
+/*
+ * Class:     org_apache_hadoop_fs_ceph_CephTalker
+ * Method:    ceph_hosts_batch
+ * Signature: (IJJI)[Ljava/lang/String;
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1hosts_1batch
+  (JNIEnv *, jobject, jint, jlong, jlong, jint);
+
+/*
+ * Class:     org_apache_hadoop_fs_ceph_CephTalker
+ * Method:    ceph_read_direct
+ * Signature: (ILjava/nio/ByteBuffer;II)I
+ */
+JNIEXPORT jint JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1read_1direct
+  (JNIEnv *, jobject, jint, jobject, jint, jint);
+
+/*
+ * Class:     org_apache_hadoop_fs_ceph_CephTalker
+ * Method:    ceph_write_direct
+ * Signature: (ILjava/nio/ByteBuffer;II)I
+ */
+JNIEXPORT jint JNICALL Java_org_apache_hadoop_fs_ceph_CephTalker_ceph_1write_1direct
+  (JNIEnv *, jobject, jint, jobject, jint, jint);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,7 +11,7 @@
 
 #include "include/rbd_types.h"
 
-CLS_VER(1,3)
+CLS_VER(1,5)
 CLS_NAME(rbd)
 
 cls_handle_t h_class;
@@ -20,6 +20,16 @@ cls_method_handle_t h_snapshot_add;
 cls_method_handle_t h_snapshot_remove;
 cls_method_handle_t h_snapshot_revert;
 cls_method_handle_t h_assign_bid;
+cls_method_handle_t h_get_parent;
+cls_method_handle_t h_set_parent;
+cls_method_handle_t h_remove_parent;
+cls_method_handle_t h_get_stripe;
+cls_method_handle_t h_set_stripe;
+cls_method_handle_t h_object_map_update;
+cls_method_handle_t h_dir_add_image;
+cls_method_handle_t h_dir_remove_image;
+cls_method_handle_t h_dir_rename_image;
+cls_method_handle_t h_dir_list;
 cls_method_handle_t h_test_exec;
 
 static int snap_read_header(cls_method_context_t hctx, bufferlist& bl)
@@ -64,6 +74,23 @@ int snapshots_list(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
     return rc;
 
   header = (struct rbd_obj_header_ondisk *)bl.c_str();
+
+  // clients that don't say otherwise would map a striped image unstriped
+  if (memcmp(header->text, RBD_HEADER_TEXT_STRIPED, sizeof(RBD_HEADER_TEXT_STRIPED)) == 0) {
+    __u8 flags = 0;
+    try {
+      bufferlist::iterator iter = in->begin();
+      if (!iter.end())
+	::decode(flags, iter);
+    } catch (const buffer::error &err) {
+      return -EINVAL;
+    }
+    if (!(flags & RBD_SNAP_LIST_STRIPING)) {
+      CLS_LOG("snapshots_list: striped image, client can't handle it");
+      return -ENXIO;
+    }
+  }
+
   bufferptr p(header->snap_names_len);
   char *buf = (char *)header;
   char *name = buf + sizeof(*header) + header->snap_count * sizeof(struct rbd_obj_snap_ondisk);
@@ -367,6 +394,289 @@ int rbd_assign_bid(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
   return out->length();
 }
 
+/*
+ * The parent of a layered image, stored on the header as an opaque
+ * (client-encoded) xattr.  An empty value means no parent.
+ */
+#define RBD_PARENT_ATTR "rbd.parent"
+
+int get_parent(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  char *data = NULL;
+  int len = 0;
+  int rc = cls_getxattr(hctx, RBD_PARENT_ATTR, &data, &len);
+  if (rc >= 0 && len > 0)
+    out->append(data, len);
+  free(data);
+  if (rc == -ENODATA || (rc >= 0 && len <= 0))
+    return -ENOENT;
+  if (rc < 0)
+    return rc;
+  return out->length();
+}
+
+int set_parent(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t size;
+  int rc = cls_cxx_stat(hctx, &size, NULL);
+  if (rc < 0)
+    return rc;
+  if (!in->length())
+    return -EINVAL;
+  return cls_setxattr(hctx, RBD_PARENT_ATTR, in->c_str(), in->length());
+}
+
+int remove_parent(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t size;
+  int rc = cls_cxx_stat(hctx, &size, NULL);
+  if (rc < 0)
+    return rc;
+  return cls_setxattr(hctx, RBD_PARENT_ATTR, "", 0);
+}
+
+/*
+ * How the image is striped over its data objects (RBD_STRIPE_ATTR),
+ * also client-encoded.  Unstriped images don't have it.  It is written
+ * with the header, and never changes.
+ */
+
+int get_stripe(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  char *data = NULL;
+  int len = 0;
+  int rc = cls_getxattr(hctx, RBD_STRIPE_ATTR, &data, &len);
+  if (rc >= 0 && len > 0)
+    out->append(data, len);
+  free(data);
+  if (rc == -ENODATA || (rc >= 0 && len <= 0))
+    return -ENOENT;
+  if (rc < 0)
+    return rc;
+  return out->length();
+}
+
+int set_stripe(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t size;
+  int rc = cls_cxx_stat(hctx, &size, NULL);
+  if (rc < 0)
+    return rc;
+  if (!in->length())
+    return -EINVAL;
+  return cls_setxattr(hctx, RBD_STRIPE_ATTR, in->c_str(), in->length());
+}
+
+/**
+ * Set or clear one object's bit in an image's object map (the
+ * <header>.objmap object), so that clients updating neighbouring bits
+ * don't overwrite each other's byte.  A byte past the end of the map
+ * is taken to be all set (may exist), as librbd reads it.
+ *
+ * Input:
+ * @param objno (uint64_t)
+ * @param exists (bool)
+ *
+ * Output:
+ * @param byte the updated byte of the map (__u8)
+ * @returns 0 on success, negative error code on failure
+ */
+int object_map_update(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t objno;
+  bool exists;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(objno, iter);
+    ::decode(exists, iter);
+  } catch (const buffer::error &err) {
+    return -EINVAL;
+  }
+
+  uint64_t size = 0;
+  int rc = cls_cxx_stat(hctx, &size, NULL);
+  if (rc < 0 && rc != -ENOENT)
+    return rc;
+  uint64_t off = objno / 8;
+  __u8 mask = 1 << (objno % 8);
+  __u8 byte = 0xff;
+  if (off < size) {
+    bufferlist bl;
+    rc = cls_cxx_read(hctx, off, 1, &bl);
+    if (rc < 0)
+      return rc;
+    if (bl.length())
+      byte = bl[0];
+  }
+  __u8 nbyte = exists ? (byte | mask) : (byte & ~mask);
+  if (off < size && nbyte == byte) {
+    ::encode(byte, *out);
+    return 0;
+  }
+
+  // fill any gap with set bits too
+  uint64_t start = off < size ? off : size;
+  bufferptr bp(off - start + 1);
+  memset(bp.c_str(), 0xff, bp.length() - 1);
+  bp[bp.length() - 1] = nbyte;
+  bufferlist bl;
+  bl.append(bp);
+  rc = cls_cxx_write(hctx, start, bl.length(), &bl);
+  if (rc < 0)
+    return rc;
+  ::encode(nbyte, *out);
+  return 0;
+}
+
+/*
+ * The image directory, kept in the omap of the rbd_directory object
+ * with one key per image, so adding or removing an image touches only
+ * its own key.  Older images may still be listed in the object's tmap
+ * data; librbd reads both.
+ */
+#define RBD_DIR_NAME_KEY_PREFIX "name_"
+
+static string dir_key_for_name(const string& name)
+{
+  return RBD_DIR_NAME_KEY_PREFIX + name;
+}
+
+/**
+ * Input:
+ * @param name the image name (string)
+ *
+ * @returns -EEXIST if the image is already listed
+ */
+int dir_add_image(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  string name;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(name, iter);
+  } catch (buffer::error& e) {
+    return -EINVAL;
+  }
+  if (name.empty())
+    return -EINVAL;
+
+  bufferlist bl;
+  int rc = cls_cxx_omap_get_val(hctx, dir_key_for_name(name), &bl);
+  if (rc == 0)
+    return -EEXIST;
+  if (rc < 0 && rc != -ENOENT)
+    return rc;
+
+  bufferlist empty;
+  return cls_cxx_omap_set_val(hctx, dir_key_for_name(name), &empty);
+}
+
+/**
+ * Input:
+ * @param name the image name (string)
+ *
+ * @returns -ENOENT if the image is not listed
+ */
+int dir_remove_image(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  string name;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(name, iter);
+  } catch (buffer::error& e) {
+    return -EINVAL;
+  }
+
+  bufferlist bl;
+  int rc = cls_cxx_omap_get_val(hctx, dir_key_for_name(name), &bl);
+  if (rc < 0)
+    return rc;
+  return cls_cxx_omap_remove_key(hctx, dir_key_for_name(name));
+}
+
+/**
+ * Input:
+ * @param src the current image name (string)
+ * @param dst the new name (string)
+ *
+ * @returns -ENOENT if src is not listed, -EEXIST if dst is
+ */
+int dir_rename_image(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  string src, dst;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(src, iter);
+    ::decode(dst, iter);
+  } catch (buffer::error& e) {
+    return -EINVAL;
+  }
+  if (dst.empty())
+    return -EINVAL;
+
+  bufferlist bl;
+  int rc = cls_cxx_omap_get_val(hctx, dir_key_for_name(src), &bl);
+  if (rc < 0)
+    return rc;
+  rc = cls_cxx_omap_get_val(hctx, dir_key_for_name(dst), &bl);
+  if (rc == 0)
+    return -EEXIST;
+  if (rc != -ENOENT)
+    return rc;
+
+  rc = cls_cxx_omap_set_val(hctx, dir_key_for_name(dst), &bl);
+  if (rc < 0)
+    return rc;
+  return cls_cxx_omap_remove_key(hctx, dir_key_for_name(src));
+}
+
+/**
+ * Input:
+ * @param start_after list names sorting after this one (string)
+ * @param max_return the most names to return (uint64_t)
+ *
+ * Output:
+ * @param names the next names in order (vector<string>); fewer than
+ * max_return means there are no more
+ */
+int dir_list(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  string start_after;
+  uint64_t max_return;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(start_after, iter);
+    ::decode(max_return, iter);
+  } catch (buffer::error& e) {
+    return -EINVAL;
+  }
+
+  vector<string> names;
+  string last_key = dir_key_for_name(start_after);
+  const string prefix = RBD_DIR_NAME_KEY_PREFIX;
+  while (names.size() < max_return) {
+    map<string, bufferlist> vals;
+    int rc = cls_cxx_omap_get_vals(hctx, last_key, max_return - names.size(), &vals);
+    if (rc == -ENOENT)
+      break;
+    if (rc < 0)
+      return rc;
+    if (vals.empty())
+      break;
+    map<string, bufferlist>::iterator p;
+    for (p = vals.begin(); p != vals.end(); ++p) {
+      if (p->first.compare(0, prefix.length(), prefix) != 0)
+	break;
+      names.push_back(p->first.substr(prefix.length()));
+    }
+    if (p != vals.end())
+      break;   // past the name keys
+    last_key = vals.rbegin()->first;
+  }
+
+  ::encode(names, *out);
+  return 0;
+}
+
 /* Used for testing rados_exec */
 static int test_exec(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 {
@@ -389,6 +699,20 @@ void __cls_init()
   /* assign a unique block id for rbd blocks */
   cls_register_cxx_method(h_class, "assign_bid", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, rbd_assign_bid, &h_assign_bid);
 
+  /* layering */
+  cls_register_cxx_method(h_class, "get_parent", CLS_METHOD_RD | CLS_METHOD_PUBLIC, get_parent, &h_get_parent);
+  cls_register_cxx_method(h_class, "set_parent", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, set_parent, &h_set_parent);
+  cls_register_cxx_method(h_class, "remove_parent", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, remove_parent, &h_remove_parent);
+  cls_register_cxx_method(h_class, "get_stripe", CLS_METHOD_RD | CLS_METHOD_PUBLIC, get_stripe, &h_get_stripe);
+  cls_register_cxx_method(h_class, "set_stripe", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, set_stripe, &h_set_stripe);
+  cls_register_cxx_method(h_class, "object_map_update", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, object_map_update, &h_object_map_update);
+
+  /* image directory */
+  cls_register_cxx_method(h_class, "dir_add_image", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, dir_add_image, &h_dir_add_image);
+  cls_register_cxx_method(h_class, "dir_remove_image", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, dir_remove_image, &h_dir_remove_image);
+  cls_register_cxx_method(h_class, "dir_rename_image", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, dir_rename_image, &h_dir_rename_image);
+  cls_register_cxx_method(h_class, "dir_list", CLS_METHOD_RD | CLS_METHOD_PUBLIC, dir_list, &h_dir_list);
+
   cls_register_cxx_method(h_class, "test_exec", CLS_METHOD_RD | CLS_METHOD_PUBLIC, test_exec, &h_test_exec);
 
   return;
@@ -12,7 +12,7 @@
 
 #include "global/global_context.h"
 
-CLS_VER(1,0)
+CLS_VER(1,2)
 CLS_NAME(rgw)
 
 cls_handle_t h_class;
@@ -21,6 +21,9 @@ cls_method_handle_t h_rgw_bucket_list;
 cls_method_handle_t h_rgw_bucket_prepare_op;
 cls_method_handle_t h_rgw_bucket_complete_op;
 cls_method_handle_t h_rgw_dir_suggest_changes;
+cls_method_handle_t h_rgw_gc_set_entry;
+cls_method_handle_t h_rgw_gc_list;
+cls_method_handle_t h_rgw_gc_remove;
 
 
 #define ROUND_BLOCK_SIZE 4096
@@ -30,6 +33,124 @@ static uint64_t get_rounded_size(uint64_t size)
   return (size + ROUND_BLOCK_SIZE - 1) & ~(ROUND_BLOCK_SIZE - 1);
 }
 
+/*
+ * A bucket index is kept in one of two formats.  Indexes created on an
+ * OSD with omap support keep each entry as an omap key, named by the
+ * object name, and the header in an xattr, so that an update touches
+ * only the header and the entries involved.  Older indexes (and those
+ * on OSDs without omap) are a tmap: a header and every entry, encoded
+ * together in the object data, decoded and rewritten as a whole.
+ */
+#define RGW_DIR_HEADER_ATTR "rgw.dir_header"
+
+struct dir_ctx {
+  bool omap;
+  struct rgw_bucket_dir_header header;
+  dir_ctx() : omap(false) {}
+};
+
+static int read_dir_header(cls_method_context_t hctx, dir_ctx& d)
+{
+  char *data = NULL;
+  int len = 0;
+  bufferlist header_bl;
+  int rc = cls_getxattr(hctx, RGW_DIR_HEADER_ATTR, &data, &len);
+  if (rc >= 0) {
+    d.omap = true;
+    header_bl.append(data, len);
+  }
+  free(data);
+  if (rc == -ENODATA) {
+    d.omap = false;
+    rc = cls_cxx_map_read_header(hctx, &header_bl);
+  }
+  if (rc < 0)
+    return rc;
+
+  try {
+    bufferlist::iterator header_iter = header_bl.begin();
+    ::decode(d.header, header_iter);
+  } catch (buffer::error& err) {
+    CLS_LOG("ERROR: read_dir_header(): failed to decode header\n");
+    return -EIO;
+  }
+  return 0;
+}
+
+static int read_dir_entry(cls_method_context_t hctx, const dir_ctx& d, const string& name,
+			  struct rgw_bucket_dir_entry *entry)
+{
+  bufferlist bl;
+  int rc;
+  if (d.omap)
+    rc = cls_cxx_omap_get_val(hctx, name, &bl);
+  else
+    rc = cls_cxx_map_read_key(hctx, name, &bl);
+  if (rc < 0)
+    return rc;
+
+  try {
+    bufferlist::iterator iter = bl.begin();
+    ::decode(*entry, iter);
+  } catch (buffer::error& err) {
+    CLS_LOG("ERROR: read_dir_entry(): failed to decode entry %s\n", name.c_str());
+    return -EIO;
+  }
+  return 0;
+}
+
+/*
+ * write out changed entries, and the header if header_changed.  a tmap
+ * update must name its keys in order, hence the merge.
+ */
+static int write_dir_update(cls_method_context_t hctx, const dir_ctx& d, bool header_changed,
+			    const map<string, bufferlist>& set_keys, const set<string>& rm_keys)
+{
+  bufferlist header_bl;
+  if (header_changed)
+    ::encode(d.header, header_bl);
+
+  if (d.omap) {
+    int rc;
+    if (!rm_keys.empty()) {
+      rc = cls_cxx_omap_remove_keys(hctx, rm_keys);
+      if (rc < 0)
+	return rc;
+    }
+    if (!set_keys.empty()) {
+      rc = cls_cxx_omap_set_vals(hctx, &set_keys);
+      if (rc < 0)
+	return rc;
+    }
+    if (header_changed)
+      return cls_setxattr(hctx, RGW_DIR_HEADER_ATTR, header_bl.c_str(), header_bl.length());
+    return 0;
+  }
+
+  bufferlist update_bl;
+  if (header_changed) {
+    update_bl.append(CEPH_OSD_TMAP_HDR);
+    ::encode(header_bl, update_bl);
+  }
+  map<string, bufferlist>::const_iterator s = set_keys.begin();
+  set<string>::const_iterator r = rm_keys.begin();
+  while (s != set_keys.end() || r != rm_keys.end()) {
+    if (r == rm_keys.end() || (s != set_keys.end() && s->first < *r)) {
+      update_bl.append(CEPH_OSD_TMAP_SET);
+      ::encode(s->first, update_bl);
+      ::encode(s->second, update_bl);
+      ++s;
+    } else {
+      update_bl.append(CEPH_OSD_TMAP_RM);
+      ::encode(*r, update_bl);
+      ++r;
+    }
+  }
+  if (!update_bl.length())
+    return 0;
+  return cls_cxx_map_update(hctx, &update_bl);
+}
+
 static int read_bucket_dir(cls_method_context_t hctx, struct rgw_bucket_dir& dir)
 {
   bufferlist bl;
@@ -68,14 +189,52 @@ static int read_bucket_dir(cls_method_context_t hctx, struct rgw_bucket_dir& dir
   return 0;
 }
 
-int rgw_bucket_list(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+/*
+ * up to max entries sorting after 'after', from the omap or, for a
+ * tmap index, from the already loaded dir
+ */
+static int list_dir_entries(cls_method_context_t hctx, const dir_ctx& d,
+			    struct rgw_bucket_dir& tmap_dir, const string& after, uint32_t max,
+			    std::map<string, struct rgw_bucket_dir_entry>& out)
 {
-  bufferlist bl;
-  struct rgw_bucket_dir dir;
-  int rc = read_bucket_dir(hctx, dir);
+  if (!d.omap) {
+    std::map<string, struct rgw_bucket_dir_entry>::iterator miter = tmap_dir.m.upper_bound(after);
+    for (uint32_t i = 0; i != max && miter != tmap_dir.m.end(); ++i, ++miter)
+      out[miter->first] = miter->second;
+    return 0;
+  }
+
+  map<string, bufferlist> vals;
+  int rc = cls_cxx_omap_get_vals(hctx, after, max, &vals);
   if (rc < 0)
     return rc;
+  for (map<string, bufferlist>::iterator viter = vals.begin(); viter != vals.end(); ++viter) {
+    try {
+      bufferlist::iterator eiter = viter->second.begin();
+      ::decode(out[viter->first], eiter);
+    } catch (buffer::error& err) {
+      CLS_LOG("ERROR: rgw_bucket_list(): failed to decode entry %s\n", viter->first.c_str());
+      return -EIO;
+    }
+  }
+  return 0;
+}
 
+/*
+ * a marker just before every key starting with prefix.  index keys
+ * are utf-8, so they never contain 0xff.
+ */
+static string marker_before(const string& prefix)
+{
+  string marker = prefix.substr(0, prefix.size() - 1);
+  char last = prefix[prefix.size() - 1];
+  if (last)
+    marker += string(1, last - 1) + "\xff";
+  return marker;
+}
+
+int rgw_bucket_list(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
   bufferlist::iterator iter = in->begin();
 
   struct rgw_cls_list_op op;
@@ -87,17 +246,81 @@ int rgw_bucket_list(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
     return -EINVAL;
   }
 
+  dir_ctx d;
+  int rc = read_dir_header(hctx, d);
+  if (rc < 0)
+    return rc;
+
   struct rgw_cls_list_ret ret;
   struct rgw_bucket_dir& new_dir = ret.dir;
-  new_dir.header = dir.header;
+  new_dir.header = d.header;
   std::map<string, struct rgw_bucket_dir_entry>& m = new_dir.m;
-  std::map<string, struct rgw_bucket_dir_entry>::iterator miter = dir.m.upper_bound(op.start_obj);
-  uint32_t i;
-  for (i = 0; i != op.num_entries && miter != dir.m.end(); ++i, ++miter) {
-    m[miter->first] = miter->second;
+
+  struct rgw_bucket_dir tmap_dir;
+  if (!d.omap) {
+    rc = read_bucket_dir(hctx, tmap_dir);
+    if (rc < 0)
+      return rc;
   }
 
-  ret.is_truncated = (miter != dir.m.end());
+  const string& prefix = op.prefix;
+  const string& delim = op.delimiter;
+
+  // start at the prefix, and past the common prefix the marker is in
+  string marker = op.start_obj;
+  if (!prefix.empty() && marker < prefix)
+    marker = marker_before(prefix);
+  if (!delim.empty() && marker.compare(0, prefix.size(), prefix) == 0) {
+    size_t pos = marker.find(delim, prefix.size());
+    if (pos != string::npos)
+      marker = marker.substr(0, pos + delim.size()) + "\xff";
+  }
+
+  uint32_t count = 0;
+  bool done = false;
+  while (count < op.num_entries && !done) {
+    std::map<string, struct rgw_bucket_dir_entry> batch;
+    uint32_t want = op.num_entries - count;
+    rc = list_dir_entries(hctx, d, tmap_dir, marker, want, batch);
+    if (rc < 0)
+      return rc;
+    if (batch.size() < want)
+      done = true;
+
+    std::map<string, struct rgw_bucket_dir_entry>::iterator biter;
+    for (biter = batch.begin(); biter != batch.end() && count < op.num_entries; ++biter) {
+      const string& key = biter->first;
+      if (key <= marker)
+	continue;  // inside a common prefix we already returned
+      if (key.compare(0, prefix.size(), prefix) != 0) {
+	done = true;  // past every key with the prefix
+	break;
+      }
+      marker = key;
+      if (!delim.empty()) {
+	size_t pos = key.find(delim, prefix.size());
+	if (pos != string::npos) {
+	  string cp = key.substr(0, pos + delim.size());
+	  ret.common_prefixes.insert(cp);
+	  marker = cp + "\xff";
+	  ++count;
+	  continue;
+	}
+      }
+      m[key] = biter->second;
+      ++count;
+    }
+  }
+
+  // is there anything left that would have matched?
+  if (!done) {
+    std::map<string, struct rgw_bucket_dir_entry> next;
+    rc = list_dir_entries(hctx, d, tmap_dir, marker, 1, next);
+    if (rc < 0)
+      return rc;
+    ret.is_truncated = !next.empty() &&
+      next.begin()->first.compare(0, prefix.size(), prefix) == 0;
+  }
 
   ::encode(ret, *out);
 
@@ -106,27 +329,33 @@ int rgw_bucket_list(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 
 int rgw_bucket_init_index(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 {
-  bufferlist bl;
-  bufferlist::iterator iter;
-
   uint64_t size;
   int rc = cls_cxx_stat(hctx, &size, NULL);
   if (rc < 0)
     return rc;
-  if (size != 0) {
+  dir_ctx d;
+  if (size != 0 || read_dir_header(hctx, d) == 0) {
     CLS_LOG("ERROR: index already initialized\n");
     return -EINVAL;
   }
 
   rgw_bucket_dir dir;
-  bufferlist map_bl;
   bufferlist header_bl;
   ::encode(dir.header, header_bl);
+
+  // an empty omap update tells us whether the OSD has omap at all
+  map<string, bufferlist> none;
+  rc = cls_cxx_omap_set_vals(hctx, &none);
+  if (rc == 0)
+    return cls_setxattr(hctx, RGW_DIR_HEADER_ATTR, header_bl.c_str(), header_bl.length());
+  if (rc != -EOPNOTSUPP)
+    return rc;
+
+  bufferlist map_bl;
   ::encode(header_bl, map_bl);
   __u32 num_keys = 0;
   ::encode(num_keys, map_bl);
-  rc = cls_cxx_map_write_full(hctx, &map_bl);
-  return rc;
+  return cls_cxx_map_write_full(hctx, &map_bl);
 }
 
 int rgw_bucket_prepare_op(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
@@ -148,17 +377,18 @@ int rgw_bucket_prepare_op(cls_method_context_t hctx, bufferlist *in, bufferlist
 
   CLS_LOG("rgw_bucket_prepare_op(): request: op=%d name=%s tag=%s\n", op.op, op.name.c_str(), op.tag.c_str());
 
+  dir_ctx d;
+  int rc = read_dir_header(hctx, d);
+  if (rc < 0)
+    return rc;
+
   // get on-disk state
-  bufferlist cur_value;
-  int rc = cls_cxx_map_read_key(hctx, op.name, &cur_value);
+  struct rgw_bucket_dir_entry entry;
+  rc = read_dir_entry(hctx, d, op.name, &entry);
   if (rc < 0 && rc != -ENOENT)
     return rc;
 
-  struct rgw_bucket_dir_entry entry;
-  if (rc != -ENOENT) {
-    bufferlist::iterator biter = cur_value.begin();
-    ::decode(entry, biter);
-  } else { // no entry, initialize fields
+  if (rc == -ENOENT) { // no entry, initialize fields
     entry.name = op.name;
     entry.epoch = 0;
     entry.exists = false;
@@ -172,10 +402,9 @@ int rgw_bucket_prepare_op(cls_method_context_t hctx, bufferlist *in, bufferlist
   info.op = op.op;
 
   // write out new key to disk
-  bufferlist info_bl;
-  ::encode(entry, info_bl);
-  cls_cxx_map_write_key(hctx, op.name, &info_bl);
-  return rc;
+  map<string, bufferlist> set_keys;
+  ::encode(entry, set_keys[op.name]);
+  return write_dir_update(hctx, d, false, set_keys, set<string>());
 }
 
 int rgw_bucket_complete_op(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
@@ -191,18 +420,15 @@ int rgw_bucket_complete_op(cls_method_context_t hctx, bufferlist *in, bufferlist
   }
   CLS_LOG("rgw_bucket_complete_op(): request: op=%d name=%s epoch=%lld tag=%s\n", op.op, op.name.c_str(), op.epoch, op.tag.c_str());
 
-  bufferlist header_bl;
-  struct rgw_bucket_dir_header header;
-  int rc = cls_cxx_map_read_header(hctx, &header_bl);
+  dir_ctx d;
+  int rc = read_dir_header(hctx, d);
   if (rc < 0)
     return rc;
-  bufferlist::iterator header_iter = header_bl.begin();
-  ::decode(header, header_iter);
+  struct rgw_bucket_dir_header& header = d.header;
 
-  bufferlist current_entry;
   struct rgw_bucket_dir_entry entry;
   bool ondisk = true;
-  rc = cls_cxx_map_read_key(hctx, op.name, &current_entry);
+  rc = read_dir_entry(hctx, d, op.name, &entry);
   if (rc < 0) {
     if (rc != -ENOENT) {
       return rc;
@@ -214,8 +440,6 @@ int rgw_bucket_complete_op(cls_method_context_t hctx, bufferlist *in, bufferlist
       ondisk = false;
     }
   } else {
-    bufferlist::iterator cur_iter = current_entry.begin();
-    ::decode(entry, cur_iter);
     CLS_LOG("rgw_bucket_complete_op(): existing entry: epoch=%lld\n", entry.epoch);
   }
 
@@ -240,16 +464,18 @@ int rgw_bucket_complete_op(cls_method_context_t hctx, bufferlist *in, bufferlist
     stats.total_size_rounded -= get_rounded_size(entry.meta.size);
   }
 
-  bufferlist op_bl;
+  map<string, bufferlist> set_keys;
+  set<string> rm_keys;
 
   switch (op.op) {
   case CLS_RGW_OP_DEL:
     if (ondisk) {
       if (!entry.pending_map.size()) {
-        op_bl.append(CEPH_OSD_TMAP_RM);
-        ::encode(op.name, op_bl);
-      } else
+	rm_keys.insert(op.name);
+      } else {
         entry.exists = false;
+	::encode(entry, set_keys[op.name]);
+      }
     } else {
       return -ENOENT;
     }
@@ -265,43 +491,30 @@ int rgw_bucket_complete_op(cls_method_context_t hctx, bufferlist *in, bufferlist
       stats.num_entries++;
       stats.total_size += meta.size;
       stats.total_size_rounded += get_rounded_size(meta.size);
-      bufferlist new_key_bl;
-      ::encode(entry, new_key_bl);
-      op_bl.append(CEPH_OSD_TMAP_SET);
-      ::encode(op.name, op_bl);
-      ::encode(new_key_bl, op_bl);
+      ::encode(entry, set_keys[op.name]);
     }
     break;
   }
 
-  bufferlist update_bl;
-  bufferlist new_header_bl;
-  ::encode(header, new_header_bl);
-  update_bl.append(CEPH_OSD_TMAP_HDR);
-  ::encode(new_header_bl, update_bl);
-  update_bl.claim_append(op_bl);
-  return cls_cxx_map_update(hctx, &update_bl);
+  return write_dir_update(hctx, d, true, set_keys, rm_keys);
 }
 
 int rgw_dir_suggest_changes(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 {
   CLS_LOG("rgw_dir_suggest_changes()");
 
-  bufferlist header_bl;
-  struct rgw_bucket_dir_header header;
+  dir_ctx d;
   bool header_changed = false;
-  int rc = cls_cxx_map_read_header(hctx, &header_bl);
+  int rc = read_dir_header(hctx, d);
   if (rc < 0)
     return rc;
-  bufferlist::iterator header_iter = header_bl.begin();
-  ::decode(header, header_iter);
+  struct rgw_bucket_dir_header& header = d.header;
 
   bufferlist::iterator in_iter = in->begin();
   __u8 op;
   rgw_bucket_dir_entry cur_change;
-  rgw_bucket_dir_entry cur_disk;
-  bufferlist cur_disk_bl;
-  bufferlist op_bl;
+  map<string, bufferlist> set_keys;
+  set<string> rm_keys;
 
   while (!in_iter.end()) {
     try {
@@ -312,9 +525,12 @@ int rgw_dir_suggest_changes(cls_method_context_t hctx, bufferlist *in, bufferlis
       return -EINVAL;
     }
 
-    cls_cxx_map_read_key(hctx, cur_change.name, &cur_disk_bl);
-    bufferlist::iterator cur_disk_iter = cur_disk_bl.begin();
-    ::decode(cur_disk, cur_disk_iter);
+    rgw_bucket_dir_entry cur_disk;
+    rc = read_dir_entry(hctx, d, cur_change.name, &cur_disk);
+    if (rc == -ENOENT)
+      continue;
+    if (rc < 0)
+      return rc;
 
     utime_t cur_time = ceph_clock_now(g_ceph_context);
     map<string, struct rgw_bucket_pending_info>::iterator iter =
@@ -337,31 +553,106 @@ int rgw_dir_suggest_changes(cls_method_context_t hctx, bufferlist *in, bufferlis
       }
       switch(op) {
       case CEPH_RGW_REMOVE:
-        op_bl.append(CEPH_OSD_TMAP_RM);
-        ::encode(cur_change.name, op_bl);
+	set_keys.erase(cur_change.name);
+	rm_keys.insert(cur_change.name);
         break;
       case CEPH_RGW_UPDATE:
         stats.num_entries++;
         stats.total_size += cur_change.meta.size;
         stats.total_size_rounded += get_rounded_size(cur_change.meta.size);
-        bufferlist cur_state_bl;
-        ::encode(cur_change, cur_state_bl);
-        op_bl.append(CEPH_OSD_TMAP_SET);
-        ::encode(cur_state_bl, op_bl);
+	header_changed = true;
+	rm_keys.erase(cur_change.name);
+	set_keys[cur_change.name].clear();
+	::encode(cur_change, set_keys[cur_change.name]);
         break;
       }
     }
   }
 
-  bufferlist update_bl;
-  if (header_changed) {
-    bufferlist new_header_bl;
-    ::encode(header, new_header_bl);
-    update_bl.append(CEPH_OSD_TMAP_HDR);
-    ::encode(new_header_bl, update_bl);
+  return write_dir_update(hctx, d, header_changed, set_keys, rm_keys);
+}
+
+/*
+ * gc queue objects keep one omap key per entry, named by its due time
+ * and tag so that due entries sort first.
+ */
+static string gc_key(const utime_t& t, const string& tag)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%010lld.%06d_", (long long)t.sec(), (int)t.usec());
+  return string(buf) + tag;
+}
+
+int rgw_gc_set_entry(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  bufferlist::iterator in_iter = in->begin();
+  cls_rgw_gc_set_entry_op op;
+  try {
+    ::decode(op, in_iter);
+  } catch (buffer::error& err) {
+    CLS_LOG("ERROR: rgw_gc_set_entry(): failed to decode request\n");
+    return -EINVAL;
   }
-  update_bl.claim_append(op_bl);
-  return cls_cxx_map_update(hctx, &update_bl);
+
+  op.info.time = ceph_clock_now(g_ceph_context);
+  op.info.time += op.expiration_secs;
+
+  bufferlist bl;
+  ::encode(op.info, bl);
+  return cls_cxx_omap_set_val(hctx, gc_key(op.info.time, op.info.tag), &bl);
+}
+
+int rgw_gc_list(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  bufferlist::iterator in_iter = in->begin();
+  cls_rgw_gc_list_op op;
+  try {
+    ::decode(op, in_iter);
+  } catch (buffer::error& err) {
+    CLS_LOG("ERROR: rgw_gc_list(): failed to decode request\n");
+    return -EINVAL;
+  }
+
+  // one more than asked for, to tell whether there are more due
+  map<string, bufferlist> vals;
+  int rc = cls_cxx_omap_get_vals(hctx, op.marker, op.max + 1, &vals);
+  if (rc < 0)
+    return rc;
+
+  string now = gc_key(ceph_clock_now(g_ceph_context), string());
+  cls_rgw_gc_list_ret ret;
+  for (map<string, bufferlist>::iterator iter = vals.begin(); iter != vals.end(); ++iter) {
+    if (iter->first > now)
+      break;   // the rest aren't due yet
+    if (ret.entries.size() == op.max) {
+      ret.truncated = true;
+      break;
+    }
+    try {
+      bufferlist::iterator eiter = iter->second.begin();
+      ::decode(ret.entries[iter->first], eiter);
+    } catch (buffer::error& err) {
+      CLS_LOG("ERROR: rgw_gc_list(): failed to decode entry %s\n", iter->first.c_str());
+      return -EIO;
+    }
+  }
+
+  ::encode(ret, *out);
+  return 0;
+}
+
+int rgw_gc_remove(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  bufferlist::iterator in_iter = in->begin();
+  cls_rgw_gc_remove_op op;
+  try {
+    ::decode(op, in_iter);
+  } catch (buffer::error& err) {
+    CLS_LOG("ERROR: rgw_gc_remove(): failed to decode request\n");
+    return -EINVAL;
+  }
+
+  return cls_cxx_omap_remove_keys(hctx, op.keys);
 }
 
 void __cls_init()
@@ -374,6 +665,9 @@ void __cls_init()
   cls_register_cxx_method(h_class, "bucket_prepare_op", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, rgw_bucket_prepare_op, &h_rgw_bucket_prepare_op);
   cls_register_cxx_method(h_class, "bucket_complete_op", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, rgw_bucket_complete_op, &h_rgw_bucket_complete_op);
   cls_register_cxx_method(h_class, "dir_suggest_changes", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, rgw_dir_suggest_changes, &h_rgw_dir_suggest_changes);
+  cls_register_cxx_method(h_class, "gc_set_entry", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, rgw_gc_set_entry, &h_rgw_gc_set_entry);
+  cls_register_cxx_method(h_class, "gc_list", CLS_METHOD_RD | CLS_METHOD_PUBLIC, rgw_gc_list, &h_rgw_gc_list);
+  cls_register_cxx_method(h_class, "gc_remove", CLS_METHOD_RD | CLS_METHOD_WR | CLS_METHOD_PUBLIC, rgw_gc_remove, &h_rgw_gc_remove);
 
   return;
 }
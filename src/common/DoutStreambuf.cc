@@ -155,7 +155,10 @@ static int create_symlink(string oldpath, const string &newpath)
 ///////////////////////////// DoutStreambuf /////////////////////////////
 template <typename charT, typename traits>
 DoutStreambuf<charT, traits>::DoutStreambuf()
-  : flags(0), ofd(-1)
+  : flags(0), failed_flags(0), ofd(-1),
+    queue_bytes(0), max_queue_bytes(32 << 20),
+    writer_running(false), writer_stop(false), writer_busy(false),
+    max_recent(0), gather_only(false)
 {
   // Initialize get pointer to zero so that underflow is called on the first read.
   this->setg(0, 0, 0);
@@ -172,6 +175,10 @@ DoutStreambuf<charT, traits>::DoutStreambuf()
   assert(ret == 0);
   ret = pthread_mutexattr_destroy(&attr);
   assert(ret == 0);
+  pthread_mutex_init(&write_lock, NULL);
+  pthread_mutex_init(&queue_lock, NULL);
+  pthread_cond_init(&queue_cond, NULL);
+  pthread_cond_init(&queue_space_cond, NULL);
 
   simple_spin_lock(&dout_emergency_lock);
   for (size_t i = 0; i < NUM_DOUT_EMERG_STREAMS; ++i) {
@@ -194,10 +201,17 @@ DoutStreambuf<charT, traits>::~DoutStreambuf()
     }
   }
   simple_spin_unlock(&dout_emergency_lock);
+  pthread_mutex_lock(&lock);
+  _stop_writer();
+  pthread_mutex_unlock(&lock);
   if (ofd != -1) {
     TEMP_FAILURE_RETRY(::close(ofd));
     ofd = -1;
   }
+  pthread_cond_destroy(&queue_space_cond);
+  pthread_cond_destroy(&queue_cond);
+  pthread_mutex_destroy(&queue_lock);
+  pthread_mutex_destroy(&write_lock);
   pthread_mutex_destroy(&lock);
 }
 
@@ -237,37 +251,189 @@ DoutStreambuf<charT, traits>::overflow(DoutStreambuf<charT, traits>::int_type c)
   // Now 'obuf' points to a NULL-terminated string, which we want to
   // output with priority 'prio'
   int len = strlen(obuf);
-  if (flags & DOUTSB_FLAG_SYSLOG) {
+  _drop_failed_sinks();
+  if (max_recent) {
+    recent.push_back(std::string(obuf, len));
+    while (recent.size() > max_recent)
+      recent.pop_front();
+  }
+  if (gather_only) {
+    ;
+  } else if (writer_running) {
+    pthread_mutex_lock(&queue_lock);
+    while (queue_bytes >= max_queue_bytes && !writer_stop)
+      pthread_cond_wait(&queue_space_cond, &queue_lock);
+    queue.push_back(queued_line_t());
+    queue.back().prio = prio;
+    queue.back().line.assign(obuf, len);
+    queue_bytes += len;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+  } else {
+    pthread_mutex_lock(&write_lock);
+    _write_line(prio, obuf, len);
+    pthread_mutex_unlock(&write_lock);
+  }
+
+  _clear_output_buffer();
+
+  // A value different than EOF (or traits::eof() for other traits) signals success.
+  // If the function fails, either EOF (or traits::eof() for other traits) is returned or an
+  // exception is thrown.
+  return traits_ty::not_eof(c);
+}
+
+// Called with write_lock held.
+template <typename charT, typename traits>
+void DoutStreambuf<charT, traits>::
+_write_line(signed int prio, const char *buf, int len)
+{
+  int failed = failed_flags.read();
+  int out = flags & ~failed;
+  if (out & DOUTSB_FLAG_SYSLOG) {
     syslog(LOG_USER | dout_prio_to_syslog_prio(prio), "%s",
-	   obuf + TIME_FMT_SZ + 1);
+	   buf + TIME_FMT_SZ + 1);
   }
-  if ((prio == -1 && (flags & DOUTSB_FLAG_STDERR_ERR)) ||
-      (prio != -1 && (flags & DOUTSB_FLAG_STDERR_LOG))) {
+  if ((prio == -1 && (out & DOUTSB_FLAG_STDERR_ERR)) ||
+      (prio != -1 && (out & DOUTSB_FLAG_STDERR_LOG))) {
     // Just write directly out to the stderr fileno. There's no point in
     // using something like fputs to write to a temporary buffer,
     // because we would just have to flush that temporary buffer
     // immediately.
-    if (safe_write(STDERR_FILENO, obuf, len))
-      flags &= ~DOUTSB_FLAG_STDERR;
+    if (safe_write(STDERR_FILENO, buf, len))
+      failed |= DOUTSB_FLAG_STDERR;
   }
-  if (flags & DOUTSB_FLAG_OFILE) {
-    if (safe_write(ofd, obuf, len))
-      flags &= ~DOUTSB_FLAG_OFILE;
+  if (out & DOUTSB_FLAG_OFILE) {
+    if (safe_write(ofd, buf, len))
+      failed |= DOUTSB_FLAG_OFILE;
   }
+  if (failed != (int)failed_flags.read())
+    failed_flags.set(failed);
+}
 
-  _clear_output_buffer();
+// Called with lock held.
+template <typename charT, typename traits>
+void DoutStreambuf<charT, traits>::_drop_failed_sinks()
+{
+  if (!failed_flags.read())
+    return;
+  pthread_mutex_lock(&write_lock);
+  flags &= ~failed_flags.read();
+  failed_flags.set(0);
+  pthread_mutex_unlock(&write_lock);
+}
 
-  // A value different than EOF (or traits::eof() for other traits) signals success.
-  // If the function fails, either EOF (or traits::eof() for other traits) is returned or an
-  // exception is thrown.
-  return traits_ty::not_eof(c);
+// Called with lock held.
+template <typename charT, typename traits>
+void DoutStreambuf<charT, traits>::_start_writer()
+{
+  if (writer_running)
+    return;
+  writer_stop = false;
+  if (pthread_create(&writer_thread, NULL, _writer_entry, this) == 0)
+    writer_running = true;
+}
+
+// Called with lock held.  Anything still queued is written first.
+template <typename charT, typename traits>
+void DoutStreambuf<charT, traits>::_stop_writer()
+{
+  if (!writer_running)
+    return;
+  pthread_mutex_lock(&queue_lock);
+  writer_stop = true;
+  pthread_cond_signal(&queue_cond);
+  pthread_cond_broadcast(&queue_space_cond);
+  pthread_mutex_unlock(&queue_lock);
+  pthread_join(writer_thread, NULL);
+  writer_running = false;
+}
+
+template <typename charT, typename traits>
+void *DoutStreambuf<charT, traits>::_writer_entry(void *arg)
+{
+  ((DoutStreambuf<charT, traits> *)arg)->_writer();
+  return NULL;
+}
+
+template <typename charT, typename traits>
+void DoutStreambuf<charT, traits>::_writer()
+{
+  pthread_mutex_lock(&queue_lock);
+  while (true) {
+    while (queue.empty() && !writer_stop)
+      pthread_cond_wait(&queue_cond, &queue_lock);
+    if (queue.empty())
+      break;
+    std::deque<queued_line_t> lines;
+    lines.swap(queue);
+    queue_bytes = 0;
+    writer_busy = true;
+    pthread_cond_broadcast(&queue_space_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    pthread_mutex_lock(&write_lock);
+    for (typename std::deque<queued_line_t>::iterator p = lines.begin();
+	 p != lines.end();
+	 ++p)
+      _write_line(p->prio, p->line.data(), p->line.length());
+    pthread_mutex_unlock(&write_lock);
+
+    pthread_mutex_lock(&queue_lock);
+    writer_busy = false;
+    pthread_cond_broadcast(&queue_space_cond);
+  }
+  pthread_mutex_unlock(&queue_lock);
+}
+
+template <typename charT, typename traits>
+void DoutStreambuf<charT, traits>::flush_queue(int timeout_ms)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  struct timespec until;
+  until.tv_sec = tv.tv_sec + timeout_ms / 1000;
+  until.tv_nsec = tv.tv_usec * 1000 + (timeout_ms % 1000) * 1000000;
+  if (until.tv_nsec >= 1000000000) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&queue_lock);
+  while (writer_running && (!queue.empty() || writer_busy)) {
+    if (pthread_cond_timedwait(&queue_space_cond, &queue_lock, &until) == ETIMEDOUT)
+      break;
+  }
+  pthread_mutex_unlock(&queue_lock);
+}
+
+template <typename charT, typename traits>
+void DoutStreambuf<charT, traits>::get_recent(std::vector<std::string> &out)
+{
+  DoutLocker _dout_locker(&lock);
+  out.assign(recent.begin(), recent.end());
+}
+
+template <typename charT, typename traits>
+void DoutStreambuf<charT, traits>::dump_recent() const
+{
+  if (recent.empty())
+    return;
+  dout_emergency("--- begin dump of recent log lines ---\n");
+  for (std::deque<std::string>::const_iterator p = recent.begin();
+       p != recent.end();
+       ++p)
+    dout_emergency(p->c_str());
+  dout_emergency("--- end dump of recent log lines ---\n");
 }
 
 template <typename charT, typename traits>
 void DoutStreambuf<charT, traits>::handle_stderr_shutdown()
 {
   DoutLocker _dout_locker(&lock);
+  pthread_mutex_lock(&write_lock);
   flags &= ~DOUTSB_FLAG_STDERR;
+  pthread_mutex_unlock(&write_lock);
 }
 
 template <typename charT, typename traits>
@@ -277,7 +443,9 @@ get_tracked_conf_keys() const
   static const char *KEYS[] =
 	{ "log_file", "log_sym_dir",
 	  "log_sym_history", "log_to_stderr", "err_to_stderr",
-	 "log_to_syslog", "log_per_instance", NULL };
+	 "log_to_syslog", "log_per_instance",
+	  "log_async", "log_max_queue", "log_max_recent",
+	  "internal_safe_to_start_threads", NULL };
   return KEYS;
 }
 
@@ -288,7 +456,38 @@ handle_conf_change(const md_config_t *conf, const std::set <std::string> &change
   DoutLocker _dout_locker(&lock);
   type_name = conf->name.get_type_name();
 
+  max_recent = conf->log_max_recent > 0 ? conf->log_max_recent : 0;
+  while (recent.size() > max_recent)
+    recent.pop_front();
+
+  pthread_mutex_lock(&queue_lock);
+  max_queue_bytes = conf->log_max_queue > 0 ? conf->log_max_queue : 1;
+  pthread_cond_broadcast(&queue_space_cond);
+  pthread_mutex_unlock(&queue_lock);
+
+  if (changed.count("log_async") || changed.count("internal_safe_to_start_threads")) {
+    if (conf->log_async && conf->internal_safe_to_start_threads)
+      _start_writer();
+    else if (!conf->log_async)
+      _stop_writer();
+  }
+
+  // the rest (re)opens the sinks
+  static const char *SINK_KEYS[] =
+	{ "log_file", "log_sym_dir", "log_sym_history", "log_to_stderr",
+	  "err_to_stderr", "log_to_syslog", "log_per_instance", NULL };
+  bool reopen = false;
+  for (const char **k = SINK_KEYS; *k; ++k)
+    if (changed.count(*k))
+      reopen = true;
+  if (!reopen)
+    return;
+
+  // the writer thread leaves flags and ofd alone while we hold this
+  pthread_mutex_lock(&write_lock);
+
   flags = 0;
+  failed_flags.set(0);
 
   if (ofd != -1) {
     TEMP_FAILURE_RETRY(::close(ofd));
@@ -319,6 +518,7 @@ handle_conf_change(const md_config_t *conf, const std::set <std::string> &change
   if (_read_ofile_config(conf) == 0) {
     flags |= DOUTSB_FLAG_OFILE;
   }
+  pthread_mutex_unlock(&write_lock);
 }
 
 template <typename charT, typename traits>
@@ -337,6 +537,7 @@ int DoutStreambuf<charT, traits>::
 handle_pid_change(const md_config_t *conf)
 {
   DoutLocker _dout_locker(&lock);
+  _drop_failed_sinks();
   if (!(flags & DOUTSB_FLAG_OFILE))
     return 0;
 
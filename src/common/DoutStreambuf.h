@@ -21,10 +21,13 @@
 #define CEPH_DOUT_STREAMBUF_H
 
 #include "common/config_obs.h"
+#include "include/atomic.h"
 
+#include <deque>
 #include <iosfwd>
 #include <pthread.h>
 #include <string>
+#include <vector>
 
 class md_config_t;
 class CephContext;
@@ -73,6 +76,23 @@ public:
   // Set the priority of the messages being put into the stream
   void set_prio(int prio);
 
+  // The line about to be formatted is only kept in the recent lines,
+  // not written out.  Call with the dout lock held.
+  void set_gather_only(bool g) {
+    gather_only = g;
+  }
+
+  // Wait up to timeout_ms for the writer thread to write out what is
+  // queued.
+  void flush_queue(int timeout_ms);
+
+  // Copy out the recent lines, oldest first.
+  void get_recent(std::vector<std::string> &out);
+
+  // Write the recent lines out with dout_emergency.  For crashes: takes
+  // no locks.
+  void dump_recent() const;
+
   // Call after calling daemon()
   // A change in the process ID sometimes requires us to change our output
   // path name.
@@ -102,6 +122,12 @@ private:
   friend void dout_emergency(const std::string &str);
 
   void _clear_output_buffer();
+  void _write_line(signed int prio, const char *buf, int len);
+  void _drop_failed_sinks();
+  void _start_writer();
+  void _stop_writer();
+  void _writer();
+  static void *_writer_entry(void *arg);
   std::string _calculate_opath(const md_config_t *conf) const;
   std::string _get_symlink_dir(const md_config_t *conf) const;
   int _read_ofile_config(const md_config_t *conf);
@@ -112,9 +138,14 @@ private:
   // Output buffer
   charT obuf[OBUF_SZ];
 
-  // Output flags
+  // Output flags.  Changed only with both lock and write_lock held.
   int flags;
 
+  // Sinks that failed a write, set under write_lock.  The writer thread
+  // can't take lock (loggers hold it while they wait on the queue), so
+  // the next holder of lock clears these out of flags.
+  ceph::atomic_t failed_flags;
+
   // ofile stuff
   int ofd;
   std::string opath;
@@ -124,6 +155,33 @@ private:
   // Mutex that protects this output stream
   pthread_mutex_t lock;
 
+  // Held while writing a line out, and while changing flags or ofd.
+  // Taken after lock, never before it.
+  pthread_mutex_t write_lock;
+
+  /*
+   * Finished lines waiting for the writer thread, which keeps slow
+   * disks and syslog out of the threads that log.  Lines go straight
+   * out when there is no writer (log_async off, or before it is safe to
+   * start threads).  A full queue makes loggers wait.
+   */
+  struct queued_line_t {
+    signed int prio;
+    std::string line;
+  };
+  std::deque<queued_line_t> queue;
+  size_t queue_bytes, max_queue_bytes;
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;        // a line was queued
+  pthread_cond_t queue_space_cond;  // the writer took the queue (or went idle)
+  pthread_t writer_thread;
+  bool writer_running, writer_stop, writer_busy;
+
+  // The last max_recent lines, written or gathered.  Under lock.
+  std::deque<std::string> recent;
+  size_t max_recent;
+  bool gather_only;
+
   friend class CephContext;
 };
 
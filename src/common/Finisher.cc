@@ -7,45 +7,86 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "finisher(" << this << ") "
 
+Finisher::Finisher(CephContext *cct_, int num_threads)
+  : cct(cct_), empty_lock("Finisher::empty_lock")
+{
+  if (num_threads < 1)
+    num_threads = 1;
+  for (int i = 0; i < num_threads; i++)
+    finisher_threads.push_back(new FinisherThread(this));
+}
+
+Finisher::~Finisher()
+{
+  for (vector<FinisherThread*>::iterator p = finisher_threads.begin();
+       p != finisher_threads.end();
+       ++p)
+    delete *p;
+}
+
 void Finisher::start()
 {
-  finisher_thread.create();
+  for (vector<FinisherThread*>::iterator p = finisher_threads.begin();
+       p != finisher_threads.end();
+       ++p)
+    (*p)->create("finisher");
 }
 
 void Finisher::stop()
 {
-  finisher_lock.Lock();
-  finisher_stop = true;
-  finisher_cond.Signal();
-  finisher_lock.Unlock();
-  finisher_thread.join();
+  for (vector<FinisherThread*>::iterator p = finisher_threads.begin();
+       p != finisher_threads.end();
+       ++p) {
+    FinisherThread *t = *p;
+    t->finisher_lock.Lock();
+    t->finisher_stop = true;
+    t->finisher_cond.Signal();
+    t->finisher_lock.Unlock();
+  }
+  for (vector<FinisherThread*>::iterator p = finisher_threads.begin();
+       p != finisher_threads.end();
+       ++p)
+    (*p)->join();
 }
 
+/*
+ * A running completion may queue more work on any thread; it is counted
+ * before the completion that queued it is done, so outstanding only
+ * drops to zero once every thread is idle.
+ */
 void Finisher::wait_for_empty()
 {
-  finisher_lock.Lock();
-  while (!finisher_queue.empty() || finisher_running) {
+  empty_lock.Lock();
+  while (outstanding.read()) {
     ldout(cct, 10) << "wait_for_empty waiting" << dendl;
-    finisher_empty_cond.Wait(finisher_lock);
+    empty_cond.Wait(empty_lock);
   }
   ldout(cct, 10) << "wait_for_empty empty" << dendl;
-  finisher_lock.Unlock();
+  empty_lock.Unlock();
+}
+
+void Finisher::_finished_one()
+{
+  if (outstanding.dec() == 0) {
+    empty_lock.Lock();
+    empty_cond.Signal();
+    empty_lock.Unlock();
+  }
 }
 
-void *Finisher::finisher_thread_entry()
+void *Finisher::finisher_thread_entry(FinisherThread *t)
 {
-  finisher_lock.Lock();
-  ldout(cct, 10) << "finisher_thread start" << dendl;
+  t->finisher_lock.Lock();
+  ldout(cct, 10) << "finisher_thread " << t << " start" << dendl;
 
-  while (!finisher_stop) {
-    while (!finisher_queue.empty()) {
+  while (!t->finisher_stop) {
+    while (!t->finisher_queue.empty()) {
       vector<Context*> ls;
       list<pair<Context*,int> > ls_rval;
-      ls.swap(finisher_queue);
-      ls_rval.swap(finisher_queue_rval);
-      finisher_running = true;
-      finisher_lock.Unlock();
-      ldout(cct, 10) << "finisher_thread doing " << ls << dendl;
+      ls.swap(t->finisher_queue);
+      ls_rval.swap(t->finisher_queue_rval);
+      t->finisher_lock.Unlock();
+      ldout(cct, 10) << "finisher_thread " << t << " doing " << ls << dendl;
 
       for (vector<Context*>::iterator p = ls.begin();
 	   p != ls.end();
@@ -60,25 +101,22 @@ void *Finisher::finisher_thread_entry()
 	  delete c;
 	  ls_rval.pop_front();
 	}
+	_finished_one();
       }
-      ldout(cct, 10) << "finisher_thread done with " << ls << dendl;
+      ldout(cct, 10) << "finisher_thread " << t << " done with " << ls << dendl;
       ls.clear();
 
-      finisher_lock.Lock();
-      finisher_running = false;
+      t->finisher_lock.Lock();
     }
-    ldout(cct, 10) << "finisher_thread empty" << dendl;
-    finisher_empty_cond.Signal();
-    if (finisher_stop)
+    ldout(cct, 10) << "finisher_thread " << t << " empty" << dendl;
+    if (t->finisher_stop)
       break;
     
-    ldout(cct, 10) << "finisher_thread sleeping" << dendl;
-    finisher_cond.Wait(finisher_lock);
+    ldout(cct, 10) << "finisher_thread " << t << " sleeping" << dendl;
+    t->finisher_cond.Wait(t->finisher_lock);
   }
-  finisher_empty_cond.Signal();
 
-  ldout(cct, 10) << "finisher_thread stop" << dendl;
-  finisher_lock.Unlock();
+  ldout(cct, 10) << "finisher_thread " << t << " stop" << dendl;
+  t->finisher_lock.Unlock();
   return 0;
 }
-
@@ -16,70 +16,114 @@
 #define CEPH_FINISHER_H
 
 #include "include/atomic.h"
+#include "include/hash.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
 #include "common/Thread.h"
 
 class CephContext;
 
+/*
+ * Runs completions on one or more threads of its own.  Each thread
+ * has its own queue and runs it in order.  Contexts queued with an
+ * ordering key (a PG, object, session...) always go to the same thread,
+ * so they run in the order they were queued relative to others with the
+ * same key; there is no ordering between keys.  Contexts queued without
+ * a key all go to the first thread and keep their order among
+ * themselves, as with a single-threaded finisher.
+ */
 class Finisher {
   CephContext *cct;
-  Mutex          finisher_lock;
-  Cond           finisher_cond, finisher_empty_cond;
-  bool           finisher_stop, finisher_running;
-  vector<Context*> finisher_queue;
-  list<pair<Context*,int> > finisher_queue_rval;
-  
-  void *finisher_thread_entry();
 
   struct FinisherThread : public Thread {
-    Finisher *fin;    
-    FinisherThread(Finisher *f) : fin(f) {}
-    void* entry() { return (void*)fin->finisher_thread_entry(); }
-  } finisher_thread;
+    Finisher *fin;
+    Mutex          finisher_lock;
+    Cond           finisher_cond;
+    bool           finisher_stop;
+    vector<Context*> finisher_queue;
+    list<pair<Context*,int> > finisher_queue_rval;
+
+    FinisherThread(Finisher *f)
+      : fin(f), finisher_lock("Finisher::finisher_lock"),
+	finisher_stop(false) {}
+    void* entry() { return (void*)fin->finisher_thread_entry(this); }
+
+    void queue(Context *c, int r) {
+      fin->outstanding.inc();
+      finisher_lock.Lock();
+      if (r) {
+	finisher_queue_rval.push_back(pair<Context*, int>(c, r));
+	finisher_queue.push_back(NULL);
+      } else
+	finisher_queue.push_back(c);
+      finisher_cond.Signal();
+      finisher_lock.Unlock();
+    }
+  };
+  vector<FinisherThread*> finisher_threads;
+
+  // contexts queued or running on any thread
+  atomic_t outstanding;
+  Mutex empty_lock;
+  Cond empty_cond;
+
+  void *finisher_thread_entry(FinisherThread *t);
+  void _finished_one();
+
+  FinisherThread *thread_for(uint64_t key) {
+    return finisher_threads[rjhash64(key) % finisher_threads.size()];
+  }
 
  public:
   void queue(Context *c, int r = 0) {
-    finisher_lock.Lock();
-    if (r) {
-      finisher_queue_rval.push_back(pair<Context*, int>(c, r));
-      finisher_queue.push_back(NULL);
-    } else
-      finisher_queue.push_back(c);
-    finisher_cond.Signal();
-    finisher_lock.Unlock();
+    finisher_threads[0]->queue(c, r);
   }
   void queue(vector<Context*>& ls) {
-    finisher_lock.Lock();
-    finisher_queue.insert(finisher_queue.end(), ls.begin(), ls.end());
-    finisher_cond.Signal();
-    finisher_lock.Unlock();
+    FinisherThread *t = finisher_threads[0];
+    outstanding.add(ls.size());
+    t->finisher_lock.Lock();
+    t->finisher_queue.insert(t->finisher_queue.end(), ls.begin(), ls.end());
+    t->finisher_cond.Signal();
+    t->finisher_lock.Unlock();
     ls.clear();
   }
   void queue(deque<Context*>& ls) {
-    finisher_lock.Lock();
-    finisher_queue.insert(finisher_queue.end(), ls.begin(), ls.end());
-    finisher_cond.Signal();
-    finisher_lock.Unlock();
+    FinisherThread *t = finisher_threads[0];
+    outstanding.add(ls.size());
+    t->finisher_lock.Lock();
+    t->finisher_queue.insert(t->finisher_queue.end(), ls.begin(), ls.end());
+    t->finisher_cond.Signal();
+    t->finisher_lock.Unlock();
     ls.clear();
   }
+  /// run c after everything queued earlier under the same key
+  void queue_ordered(uint64_t key, Context *c, int r = 0) {
+    thread_for(key)->queue(c, r);
+  }
   
   void start();
   void stop();
 
   void wait_for_empty();
 
-  Finisher(CephContext *cct_) : cct(cct_), finisher_lock("Finisher::finisher_lock"),
-	       finisher_stop(false), finisher_running(false), finisher_thread(this) {}
+  Finisher(CephContext *cct_, int num_threads = 1);
+  ~Finisher();
 };
 
 class C_OnFinisher : public Context {
   Context *con;
   Finisher *fin;
+  bool ordered;
+  uint64_t key;
 public:
-  C_OnFinisher(Context *c, Finisher *f) : con(c), fin(f) {}
+  C_OnFinisher(Context *c, Finisher *f) : con(c), fin(f), ordered(false), key(0) {}
+  C_OnFinisher(Context *c, Finisher *f, uint64_t k)
+    : con(c), fin(f), ordered(true), key(k) {}
   void finish(int r) {
-    fin->queue(con, r);
+    if (ordered)
+      fin->queue_ordered(key, con, r);
+    else
+      fin->queue(con, r);
   }
 };
 
@@ -214,7 +214,8 @@ void JSONFormatter::dump_format(const char *name, const char *fmt, ...)
 
 int JSONFormatter::get_len() const
 {
-  return m_ss.str().size();
+  // where the next write goes, without copying the buffer out
+  return m_ss.rdbuf()->pubseekoff(0, std::ios_base::cur, std::ios_base::out);
 }
 
 void JSONFormatter::write_raw_data(const char *data)
@@ -339,7 +340,8 @@ void XMLFormatter::dump_format(const char *name, const char *fmt, ...)
 
 int XMLFormatter::get_len() const
 {
-  return m_ss.str().size();
+  // where the next write goes, without copying the buffer out
+  return m_ss.rdbuf()->pubseekoff(0, std::ios_base::cur, std::ios_base::out);
 }
 
 void XMLFormatter::write_raw_data(const char *data)
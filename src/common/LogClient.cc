@@ -64,7 +64,9 @@ LogClient::LogClient(CephContext *cct, Messenger *m, MonMap *mm,
 		     MonClient *mc, enum logclient_flag_t flags) :
     Dispatcher(cct),
     messenger(m), monmap(mm), monc(mc), is_mon(flags & FLAG_MON),
-    log_lock("LogClient::log_lock"), last_log_sent(0), last_log(0)
+    log_lock("LogClient::log_lock"), last_log_sent(0), last_log(0),
+    tokens(cct->_conf->clog_burst), num_dropped(0),
+    last_type(CLOG_DEBUG), num_repeated(0)
 {
 }
 
@@ -95,13 +97,80 @@ void LogClient::do_log(clog_type type, std::stringstream& ss)
   }
 }
 
+/*
+ * A daemon in trouble can say the same thing many times a second.
+ * Identical messages within clog_repeat_window of the first are
+ * folded into a count, and what's left is held to clog_rate (with
+ * bursts of clog_burst); the counts go out with the next message
+ * that gets through.
+ * Everything still goes to the local debug log.
+ */
 void LogClient::do_log(clog_type type, const std::string& s)
 {
   Mutex::Locker l(log_lock);
   ldout(cct,0) << "log " << type << " : " << s << dendl;
+  utime_t now = ceph_clock_now(cct);
+
+  double window = cct->_conf->clog_repeat_window;
+  if (window > 0 && type == last_type && s == last_msg &&
+      (double)(now - last_stamp) < window) {
+    num_repeated++;
+    return;
+  }
+  if (num_repeated) {
+    ostringstream ss;
+    ss << "last message repeated " << num_repeated << " times";
+    num_repeated = 0;
+    _log(last_type, ss.str(), now);
+  }
+  last_msg = s;
+  last_type = type;
+  last_stamp = now;
+  _log(type, s, now);
+}
+
+bool LogClient::_get_token(utime_t now)
+{
+  double rate = cct->_conf->clog_rate;
+  if (rate <= 0)
+    return true;
+  double burst = cct->_conf->clog_burst;
+  if (last_refill != utime_t())
+    tokens += rate * (double)(now - last_refill);
+  last_refill = now;
+  if (tokens > burst)
+    tokens = burst;
+  if (tokens < 1)
+    return false;
+  tokens -= 1;
+  return true;
+}
+
+void LogClient::_log(clog_type type, const std::string& s, utime_t now)
+{
+  if (!_get_token(now)) {
+    num_dropped++;
+    return;
+  }
+  if (num_dropped) {
+    // the token we just got pays for the notice; s needs another
+    ostringstream ss;
+    ss << "dropped " << num_dropped << " messages over clog_rate " << cct->_conf->clog_rate << "/sec";
+    num_dropped = 0;
+    _queue(CLOG_WARN, ss.str(), now);
+    if (!_get_token(now)) {
+      num_dropped++;
+      return;
+    }
+  }
+  _queue(type, s, now);
+}
+
+void LogClient::_queue(clog_type type, const std::string& s, utime_t now)
+{
   LogEntry e;
   e.who = messenger->get_myinst();
-  e.stamp = ceph_clock_now(cct);
+  e.stamp = now;
   e.seq = ++last_log;
   e.type = type;
   e.msg = s;
@@ -117,6 +186,8 @@ void LogClient::do_log(clog_type type, const std::string& s)
   // log to monitor?
   if (cct->_conf->clog_to_monitors) {
     log_queue.push_back(e);
+    while (log_queue.size() > (unsigned)cct->_conf->clog_max_queue)
+      log_queue.pop_front();
 
     // if we are a monitor, queue for ourselves, synchronously
     if (is_mon) {
@@ -153,6 +224,8 @@ Message *LogClient::_get_mon_log_message()
     return NULL;
 
   unsigned i = last_log - last_log_sent;
+  if (i > log_queue.size())
+    i = log_queue.size();  // the rest fell off the front of a full queue
   ldout(cct,10) << " log_queue is " << log_queue.size() << " last_log " << last_log << " sent " << last_log_sent
 	   << " i " << i << dendl;
   std::deque<LogEntry> o(i);
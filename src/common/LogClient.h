@@ -98,6 +98,9 @@ public:
 private:
   void do_log(clog_type type, std::stringstream& ss);
   void do_log(clog_type type, const std::string& s);
+  void _log(clog_type type, const std::string& s, utime_t now);
+  bool _get_token(utime_t now);
+  void _queue(clog_type type, const std::string& s, utime_t now);
   bool ms_dispatch(Message *m);
   Message *_get_mon_log_message();
   void ms_handle_connect(Connection *con) {}
@@ -113,6 +116,17 @@ private:
   version_t last_log;
   std::deque<LogEntry> log_queue;
 
+  // rate limiting
+  double tokens;
+  utime_t last_refill;
+  unsigned num_dropped;
+
+  // folding of repeated messages
+  std::string last_msg;
+  clog_type last_type;
+  utime_t last_stamp;
+  unsigned num_repeated;
+
   friend class LogClientTemp;
 };
 
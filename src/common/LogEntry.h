@@ -92,9 +92,9 @@ struct LogSummary {
 
   LogSummary() : version(0) {}
 
-  void add(const LogEntry& e) {
+  void add(const LogEntry& e, unsigned max = 50) {
     tail.push_back(e);
-    while (tail.size() > 50)
+    while (tail.size() > max)
       tail.pop_front();
   }
   bool contains(LogEntryKey k) const {
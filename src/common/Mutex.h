@@ -17,6 +17,7 @@
 
 #include "include/assert.h"
 #include "lockdep.h"
+#include "lockstat.h"
 
 #include <pthread.h>
 
@@ -33,6 +34,9 @@ private:
   pthread_mutex_t _m;
   int nlock;
 
+  int stat_id;         // lockstat slot
+  uint64_t locked_at;  // when lockstat saw us taken, or 0
+
   // don't allow copying.
   void operator=(Mutex &M) {}
   Mutex( const Mutex &M ) {}
@@ -50,9 +54,21 @@ private:
     id = lockdep_will_unlock(name, id);
   }
 
+  void _stat_locked() {     // just took the outermost lock
+    if (g_lockstat)
+      locked_at = lockstat_now();
+  }
+  void _stat_unlocking() {  // about to drop the outermost lock
+    if (locked_at) {
+      lockstat_released(stat_id, lockstat_now() - locked_at);
+      locked_at = 0;
+    }
+  }
+
 public:
   Mutex(const char *n, bool r = false, bool ld=true, bool bt=false) :
-    name(n), id(-1), recursive(r), lockdep(ld), backtrace(bt), nlock(0) {
+    name(n), id(-1), recursive(r), lockdep(ld), backtrace(bt), nlock(0),
+    stat_id(-1), locked_at(0) {
     if (recursive) {
       // Mutexes of type PTHREAD_MUTEX_RECURSIVE do all the same checks as
       // mutexes of type PTHREAD_MUTEX_ERRORCHECK.
@@ -98,19 +114,26 @@ public:
     int r = pthread_mutex_trylock(&_m);
     if (r == 0) {
       if (lockdep && g_lockdep) _locked();
-      nlock++;
+      if (g_lockstat) lockstat_trylocked(name, &stat_id);
+      if (nlock++ == 0)
+	_stat_locked();
     }
     return r == 0;
   }
 
   void Lock(bool no_lockdep=false) {
     if (lockdep && g_lockdep && !no_lockdep) _will_lock();
-    int r = pthread_mutex_lock(&_m);
+    int r;
+    if (g_lockstat)
+      r = lockstat_mutex_lock(&_m, name, &stat_id);
+    else
+      r = pthread_mutex_lock(&_m);
     if (lockdep && g_lockdep) _locked();
     assert(r == 0);
     if (!recursive)
       assert(nlock == 0);
-    nlock++;
+    if (nlock++ == 0)
+      _stat_locked();
   }
 
   void Unlock() {
@@ -118,6 +141,8 @@ public:
     --nlock;
     if (!recursive)
       assert(nlock == 0);
+    if (nlock == 0)
+      _stat_unlocking();
     if (lockdep && g_lockdep) _will_unlock();
     int r = pthread_mutex_unlock(&_m);
     assert(r == 0);
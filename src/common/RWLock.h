@@ -19,18 +19,20 @@
 
 #include <pthread.h>
 #include "lockdep.h"
+#include "lockstat.h"
 
 class RWLock
 {
   mutable pthread_rwlock_t L;
   const char *name;
   int id;
+  int stat_id;    // lockstat slot; we only count waits, not hold times
 
 public:
   RWLock(const RWLock& other);
   const RWLock& operator=(const RWLock& other);
 
-  RWLock(const char *n) : name(n), id(-1) {
+  RWLock(const char *n) : name(n), id(-1), stat_id(-1) {
     pthread_rwlock_init(&L, NULL);
     if (g_lockdep) id = lockdep_register(name);
   }
@@ -48,7 +50,10 @@ public:
   // read
   void get_read() {
     if (g_lockdep) id = lockdep_will_lock(name, id);
-    pthread_rwlock_rdlock(&L);    
+    if (g_lockstat)
+      lockstat_rwlock_lock(&L, false, name, &stat_id);
+    else
+      pthread_rwlock_rdlock(&L);
     if (g_lockdep) id = lockdep_locked(name, id);
   }
   bool try_get_read() {
@@ -65,7 +70,10 @@ public:
   // write
   void get_write() {
     if (g_lockdep) id = lockdep_will_lock(name, id);
-    pthread_rwlock_wrlock(&L);
+    if (g_lockstat)
+      lockstat_rwlock_lock(&L, true, name, &stat_id);
+    else
+      pthread_rwlock_wrlock(&L);
     if (g_lockdep) id = lockdep_locked(name, id);
   }
   bool try_get_write() {
@@ -25,13 +25,16 @@
 #include <sstream>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/prctl.h>
 #include <sys/types.h>
 #include <sys/user.h> // for PAGE_MASK
 
 
 Thread::Thread()
-  : thread_id(0)
+  : thread_id(0), have_cpu_set(false)
 {
+  CPU_ZERO(&cpu_set);
+  thread_name[0] = 0;
 }
 
 Thread::~Thread()
@@ -39,7 +42,14 @@ Thread::~Thread()
 }
 
 void *Thread::_entry_func(void *arg) {
-  void *r = ((Thread*)arg)->entry();
+  Thread *t = (Thread*)arg;
+  if (t->have_cpu_set) {
+    // best effort: the cpus may have gone offline since they were chosen
+    pthread_setaffinity_np(pthread_self(), sizeof(t->cpu_set), &t->cpu_set);
+  }
+  if (t->thread_name[0])
+    prctl(PR_SET_NAME, t->thread_name, 0, 0, 0);
+  void *r = t->entry();
   return r;
 }
 
@@ -142,6 +152,13 @@ void Thread::create(size_t stacksize)
   }
 }
 
+void Thread::create(const char *name, size_t stacksize)
+{
+  strncpy(thread_name, name, sizeof(thread_name) - 1);
+  thread_name[sizeof(thread_name) - 1] = 0;
+  create(stacksize);
+}
+
 int Thread::join(void **prval)
 {
   if (thread_id == 0) {
@@ -159,3 +176,13 @@ int Thread::detach()
 {
   return pthread_detach(thread_id);
 }
+
+void Thread::set_affinity(const cpu_set_t *s)
+{
+  if (s) {
+    cpu_set = *s;
+    have_cpu_set = true;
+  } else {
+    have_cpu_set = false;
+  }
+}
@@ -17,10 +17,14 @@
 #define CEPH_THREAD_H
 
 #include <pthread.h>
+#include <sched.h>
 
 class Thread {
  private:
   pthread_t thread_id;
+  bool have_cpu_set;
+  cpu_set_t cpu_set;
+  char thread_name[16];   // what the kernel keeps (and shows in top -H)
 
  public:
   Thread(const Thread& other);
@@ -43,8 +47,12 @@ class Thread {
   int kill(int signal);
   int try_create(size_t stacksize);
   void create(size_t stacksize = 0);
+  /// create, naming the thread (truncated to 15 chars) so samples, top and gdb can tell it apart
+  void create(const char *name, size_t stacksize = 0);
   int join(void **prval = 0);
   int detach();
+  /// run only on the cpus in s (NULL for any); applies from the next create()
+  void set_affinity(const cpu_set_t *s);
 };
 
 #endif
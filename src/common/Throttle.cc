@@ -0,0 +1,271 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <stdlib.h>
+
+#include "common/Throttle.h"
+#include "common/ceph_context.h"
+#include "common/Clock.h"
+#include "common/config.h"
+#include "common/dout.h"
+#include "common/perf_counters.h"
+
+#define DOUT_SUBSYS throttle
+#undef dout_prefix
+#define dout_prefix *_dout << "throttle(" << name << " " << (void*)this << ") "
+
+enum {
+  l_throttle_first = 532430,
+  l_throttle_val,
+  l_throttle_max,
+  l_throttle_get,
+  l_throttle_get_sum,
+  l_throttle_get_or_fail_fail,
+  l_throttle_get_or_fail_success,
+  l_throttle_take,
+  l_throttle_take_sum,
+  l_throttle_put,
+  l_throttle_put_sum,
+  l_throttle_wait,
+  l_throttle_last,
+};
+
+Throttle::Throttle(int64_t m)
+  : cct(NULL), logger(NULL), parent(NULL), count(0), max(m),
+    lock("Throttle::lock")
+{
+  assert(m >= 0);
+  conf_keys[0] = conf_keys[1] = NULL;
+}
+
+Throttle::Throttle(CephContext *cct_, const std::string& n, int64_t m,
+		   Throttle *parent_, const char *option)
+  : cct(cct_), name(n), logger(NULL), parent(parent_), count(0), max(m),
+    lock("Throttle::lock")
+{
+  assert(m >= 0);
+  conf_keys[0] = option;
+  conf_keys[1] = NULL;
+  _init_logger();
+  if (option) {
+    assert(cct);
+    cct->_conf->add_observer(this);
+  }
+}
+
+Throttle::~Throttle()
+{
+  if (conf_keys[0])
+    cct->_conf->remove_observer(this);
+  {
+    Mutex::Locker l(lock);
+    assert(cond.empty());
+  }
+  if (logger) {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+  }
+}
+
+void Throttle::_init_logger()
+{
+  if (!cct || name.empty())
+    return;
+  PerfCountersBuilder b(cct, std::string("throttle-") + name,
+			l_throttle_first, l_throttle_last);
+  b.add_u64(l_throttle_val, "val");
+  b.add_u64(l_throttle_max, "max");
+  b.add_u64_counter(l_throttle_get, "get");
+  b.add_u64_counter(l_throttle_get_sum, "get_sum");
+  b.add_u64_counter(l_throttle_get_or_fail_fail, "get_or_fail_fail");
+  b.add_u64_counter(l_throttle_get_or_fail_success, "get_or_fail_success");
+  b.add_u64_counter(l_throttle_take, "take");
+  b.add_u64_counter(l_throttle_take_sum, "take_sum");
+  b.add_u64_counter(l_throttle_put, "put");
+  b.add_u64_counter(l_throttle_put_sum, "put_sum");
+  b.add_u64_hist(l_throttle_wait, "wait_usec");
+  logger = b.create_perf_counters();
+  // each process may have several throttles for the same purpose
+  // (one per messenger, say); only the first reports
+  if (!cct->get_perfcounters_collection()->try_add(logger)) {
+    ldout(cct, 10) << "another throttle already reports as " << name << dendl;
+    delete logger;
+    logger = NULL;
+    return;
+  }
+  logger->set(l_throttle_max, max);
+}
+
+void Throttle::_reset_max(int64_t m)
+{
+  if (m == max)
+    return;
+  if (!cond.empty())
+    cond.front()->SignalOne();
+  max = m;
+  if (logger)
+    logger->set(l_throttle_max, m);
+}
+
+void Throttle::reset_max(int64_t m)
+{
+  assert(m >= 0);
+  Mutex::Locker l(lock);
+  if (cct && m != max)
+    ldout(cct, 1) << "reset_max " << max << " -> " << m << dendl;
+  _reset_max(m);
+}
+
+void Throttle::handle_conf_change(const struct md_config_t *conf,
+				  const std::set <std::string> &changed)
+{
+  if (!changed.count(conf_keys[0]))
+    return;
+  char buf[32];
+  char *val = buf;
+  if (conf->get_val(conf_keys[0], &val, sizeof(buf)) < 0)
+    return;
+  long long m = strtoll(buf, NULL, 10);
+  if (m < 0) {
+    lderr(cct) << conf_keys[0] << " = " << m << " is not a valid max; ignoring" << dendl;
+    return;
+  }
+  reset_max(m);
+}
+
+bool Throttle::_wait(int64_t c)
+{
+  if (!_should_wait(c) && cond.empty())
+    return false;
+
+  // wait our turn, then for room
+  utime_t start;
+  if (logger)
+    start = ceph_clock_now(cct);
+  Cond *cv = new Cond;
+  cond.push_back(cv);
+  do {
+    if (cct)
+      ldout(cct, 2) << "_wait waiting for " << c << ", " << count << "/" << max
+		    << " taken" << dendl;
+    cv->Wait(lock);
+  } while (_should_wait(c) || cv != cond.front());
+  delete cv;
+  cond.pop_front();
+
+  // wake up the next guy
+  if (!cond.empty())
+    cond.front()->SignalOne();
+
+  if (logger) {
+    utime_t dur = ceph_clock_now(cct) - start;
+    logger->hinc(l_throttle_wait, dur.sec() * 1000000ull + dur.usec());
+  }
+  return true;
+}
+
+bool Throttle::wait(int64_t m)
+{
+  bool waited;
+  {
+    Mutex::Locker l(lock);
+    if (m) {
+      assert(m > 0);
+      _reset_max(m);
+    }
+    waited = _wait(0);
+  }
+  if (parent && parent->wait())
+    waited = true;
+  return waited;
+}
+
+int64_t Throttle::take(int64_t c)
+{
+  assert(c >= 0);
+  int64_t r;
+  {
+    Mutex::Locker l(lock);
+    count += c;
+    r = count;
+    if (logger) {
+      logger->inc(l_throttle_take);
+      logger->inc(l_throttle_take_sum, c);
+      logger->set(l_throttle_val, count);
+    }
+  }
+  if (parent)
+    parent->take(c);
+  return r;
+}
+
+void Throttle::get(int64_t c, int64_t m)
+{
+  assert(c >= 0);
+  {
+    Mutex::Locker l(lock);
+    if (m) {
+      assert(m > 0);
+      _reset_max(m);
+    }
+    _wait(c);
+    count += c;
+    if (logger) {
+      logger->inc(l_throttle_get);
+      logger->inc(l_throttle_get_sum, c);
+      logger->set(l_throttle_val, count);
+    }
+  }
+  if (parent)
+    parent->get(c);
+}
+
+bool Throttle::get_or_fail(int64_t c)
+{
+  assert(c >= 0);
+  {
+    Mutex::Locker l(lock);
+    // don't jump the line
+    if (_should_wait(c) || !cond.empty()) {
+      if (logger)
+	logger->inc(l_throttle_get_or_fail_fail);
+      return false;
+    }
+    count += c;
+    if (logger) {
+      logger->inc(l_throttle_get_or_fail_success);
+      logger->set(l_throttle_val, count);
+    }
+  }
+  if (parent && !parent->get_or_fail(c)) {
+    _put(c);
+    return false;
+  }
+  return true;
+}
+
+int64_t Throttle::_put(int64_t c)
+{
+  Mutex::Locker l(lock);
+  if (c) {
+    if (!cond.empty())
+      cond.front()->SignalOne();
+    count -= c;
+    assert(count >= 0); //if count goes negative, we failed somewhere!
+    if (logger) {
+      logger->inc(l_throttle_put);
+      logger->inc(l_throttle_put_sum, c);
+      logger->set(l_throttle_val, count);
+    }
+  }
+  return count;
+}
+
+int64_t Throttle::put(int64_t c)
+{
+  assert(c >= 0);
+  int64_t r = _put(c);
+  if (parent)
+    parent->put(c);
+  return r;
+}
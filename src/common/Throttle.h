@@ -3,48 +3,64 @@
 
 #include "Mutex.h"
 #include "Cond.h"
+#include "common/config_obs.h"
 
-class Throttle {
-  int64_t count, max, waiting;
+#include <list>
+#include <string>
+
+class CephContext;
+class PerfCounters;
+
+/*
+ * Limits how much of something (bytes, ops) is outstanding.  Callers
+ * get() before and put() after; get() blocks while that would take us
+ * over max.  Blocked callers go through in the order they arrived, so a
+ * large request isn't starved by a stream of small ones.
+ *
+ * A throttle may have a parent, e.g. a per-client limit inside a
+ * global one: what is taken from the child is taken from the parent
+ * too, child first.
+ *
+ * Named throttles report usage and blocked time as perf counters,
+ * "throttle-<name>".  Given the name of an integer option, a throttle
+ * takes its max from it, and follows it when it changes.
+ */
+class Throttle : public md_config_obs_t {
+  CephContext *cct;
+  std::string name;
+  PerfCounters *logger;
+  Throttle *parent;
+  int64_t count, max;
   Mutex lock;
-  Cond cond;
-  
-public:
-  Throttle(int64_t m = 0) : count(0), max(m), waiting(0),
-			  lock("Throttle::lock") {
-    assert(m >= 0);
-  }
+  std::list<Cond*> cond;   // blocked callers, first in line first
+  const char *conf_keys[2];   // the max option, if any
 
-private:
-  void _reset_max(int64_t m) {
-    if (m < max)
-      cond.SignalOne();
-    max = m;
-  }
+  void _init_logger();
+  void _reset_max(int64_t m);
   bool _should_wait(int64_t c) {
     return
       max &&
       ((c < max && count + c > max) ||   // normally stay under max
        (c >= max && count > max));       // except for large c
   }
-  bool _wait(int64_t c) {
-    bool waited = false;
-    if (_should_wait(c)) {
-      waiting += c;
-      do {
-	waited = true;
-	cond.Wait(lock);
-      } while (_should_wait(c));
-      waiting -= c;
+  bool _wait(int64_t c);
+  int64_t _put(int64_t c);   // ours only, not the parent's
+
+public:
+  Throttle(int64_t m = 0);
+  Throttle(CephContext *cct_, const std::string& n, int64_t m = 0,
+	   Throttle *parent_ = NULL, const char *option = NULL);
+  ~Throttle();
 
-      // wake up the next guy
-      if (waiting)
-	cond.SignalOne();
-    }
-    return waited;
+  const char **get_tracked_conf_keys() const {
+    return (const char **)conf_keys;
   }
+  void handle_conf_change(const struct md_config_t *conf,
+			  const std::set <std::string> &changed);
+
+  /// change max; waiters are let through if it went up
+  void reset_max(int64_t m);
 
-public:
   int64_t get_current() {
     Mutex::Locker l(lock);
     return count;
@@ -52,54 +68,20 @@ public:
 
   int64_t get_max() { return max; }
 
-  bool wait(int64_t m = 0) {
-    Mutex::Locker l(lock);
-    if (m) {
-      assert(m > 0);
-      _reset_max(m);
-    }
-    return _wait(0);
-  }
-
-  int64_t take(int64_t c = 1) {
-    assert(c >= 0);
-    Mutex::Locker l(lock);
-    count += c;
-    return count;
-  }
-
-  void get(int64_t c = 1, int64_t m = 0) {
-    assert(c >= 0);
-    Mutex::Locker l(lock);
-    if (m) {
-      assert(m > 0);
-      _reset_max(m);
-    }
-    _wait(c);
-    count += c;
-  }
+  /// wait until we are under max (first setting max to m, if m)
+  bool wait(int64_t m = 0);
+  /// take c without waiting; return the new count
+  int64_t take(int64_t c = 1);
+  /// take c, waiting until there is room (first setting max to m, if m)
+  void get(int64_t c = 1, int64_t m = 0);
 
   /* Returns true if it successfully got the requested amount,
    * or false if it would block.
    */
-  bool get_or_fail(int64_t c = 1) {
-    assert (c >= 0);
-    Mutex::Locker l(lock);
-    if (_should_wait(c)) return false;
-    count += c;
-    return true;
-  }
+  bool get_or_fail(int64_t c = 1);
 
-  int64_t put(int64_t c = 1) {
-    assert(c >= 0);
-    Mutex::Locker l(lock);
-    if (c) {
-      cond.SignalOne();
-      count -= c;
-      assert(count >= 0); //if count goes negative, we failed somewhere!
-    }
-    return count;
-  }
+  /// return c; return the new count
+  int64_t put(int64_t c = 1);
 };
 
 
@@ -42,14 +42,14 @@ public:
 
 
 
-typedef std::multimap < utime_t, Context *> scheduled_map_t;
-typedef std::map < Context*, scheduled_map_t::iterator > event_lookup_map_t;
-
 SafeTimer::SafeTimer(CephContext *cct_, Mutex &l)
   : cct(cct_), lock(l),
     thread(NULL),
+    cur_tick(0), wake_tick(0),
     stopping(false) 
 {
+  for (int i = 0; i < WHEEL_LEVELS; i++)
+    level_count[i] = 0;
 }
 
 SafeTimer::~SafeTimer()
@@ -61,7 +61,7 @@ void SafeTimer::init()
 {
   ldout(cct,10) << "init" << dendl;
   thread = new SafeTimerThread(this);
-  thread->create();
+  thread->create("safe_timer");
 }
 
 void SafeTimer::shutdown()
@@ -80,23 +80,141 @@ void SafeTimer::shutdown()
   }
 }
 
+uint64_t SafeTimer::to_tick(utime_t t, bool round_up)
+{
+  uint64_t ms = (uint64_t)t.sec() * 1000ull;
+  if (round_up)
+    return ms + (t.usec() + 999) / 1000;
+  return ms + t.usec() / 1000;
+}
+
+utime_t SafeTimer::from_tick(uint64_t tick)
+{
+  return utime_t(tick / 1000, (tick % 1000) * 1000);
+}
+
+/*
+ * Move p from whatever list it is on to the slot its tick belongs in,
+ * relative to cur_tick, or to due if that has passed.
+ */
+void SafeTimer::_place(slot_t::iterator p)
+{
+  slot_t *from = p->slot;
+  if (p->level >= 0)
+    level_count[p->level]--;
+
+  slot_t *to;
+  int level = -1;
+  if (p->tick < cur_tick) {
+    to = &due;
+  } else {
+    uint64_t tick = p->tick;
+    if (tick - cur_tick >= (1ull << (WHEEL_BITS * WHEEL_LEVELS)))
+      tick = cur_tick + (1ull << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+	   tick - cur_tick >= (1ull << (WHEEL_BITS * (level + 1))))
+      level++;
+    to = &wheel[level][(tick >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)];
+    level_count[level]++;
+  }
+  to->splice(to->end(), *from, p);
+  p->slot = to;
+  p->level = level;
+}
+
+void SafeTimer::_cascade(int level, unsigned idx)
+{
+  slot_t tmp;
+  tmp.swap(wheel[level][idx]);
+  for (slot_t::iterator p = tmp.begin(); p != tmp.end(); ++p)
+    p->slot = &tmp;
+  while (!tmp.empty())
+    _place(tmp.begin());
+}
+
+/*
+ * The first tick at or after cur_tick at which the wheel has anything
+ * to do: run a level 0 slot or cascade a slot from above.
+ */
+uint64_t SafeTimer::_next_tick() const
+{
+  uint64_t next = (uint64_t)-1;
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    if (!level_count[level])
+      continue;
+    int shift = WHEEL_BITS * level;
+    uint64_t block = (cur_tick + (1ull << shift) - 1) >> shift;
+    for (unsigned k = 0; k < WHEEL_SIZE; k++) {
+      uint64_t t = (block + k) << shift;
+      if (t >= next)
+	break;
+      if (!wheel[level][(block + k) & (WHEEL_SIZE - 1)].empty()) {
+	next = t;
+	break;
+      }
+    }
+  }
+  return next;
+}
+
+/*
+ * Turn the wheel through tick 'to', moving everything due by then onto
+ * due.  Stretches with nothing to do are skipped in one step.
+ */
+void SafeTimer::_advance(uint64_t to)
+{
+  while (cur_tick <= to) {
+    uint64_t next = _next_tick();
+    if (next > to) {
+      cur_tick = to + 1;
+      break;
+    }
+    cur_tick = next;
+    for (int level = 1;
+	 level < WHEEL_LEVELS &&
+	   (cur_tick & ((1ull << (WHEEL_BITS * level)) - 1)) == 0;
+	 level++)
+      _cascade(level, (cur_tick >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1));
+
+    slot_t &s = wheel[0][cur_tick & (WHEEL_SIZE - 1)];
+    for (slot_t::iterator p = s.begin(); p != s.end(); ++p) {
+      p->slot = &due;
+      p->level = -1;
+      level_count[0]--;
+    }
+    due.splice(due.end(), s);
+    cur_tick++;
+  }
+}
+
+void SafeTimer::_remove(slot_t::iterator p)
+{
+  if (p->level >= 0)
+    level_count[p->level]--;
+  events.erase(p->callback);
+  p->slot->erase(p);
+}
+
+bool SafeTimer::_event_before(const event_t& a, const event_t& b)
+{
+  return a.when < b.when;
+}
+
 void SafeTimer::timer_thread()
 {
   lock.Lock();
   ldout(cct,10) << "timer_thread starting" << dendl;
   while (!stopping) {
     utime_t now = ceph_clock_now(cct);
-    
-    while (!schedule.empty()) {
-      scheduled_map_t::iterator p = schedule.begin();
+    _advance(to_tick(now, false));
 
-      // is the future now?
-      if (p->first > now)
-	break;
-
-      Context *callback = p->second;
-      events.erase(callback);
-      schedule.erase(p);
+    // a tick's worth of events may have arrived out of order
+    due.sort(_event_before);
+    while (!due.empty()) {
+      slot_t::iterator p = due.begin();
+      Context *callback = p->callback;
+      _remove(p);
       ldout(cct,10) << "timer_thread executing " << callback << dendl;
       
       callback->finish(0);
@@ -104,10 +222,11 @@ void SafeTimer::timer_thread()
     }
 
     ldout(cct,20) << "timer_thread going to sleep" << dendl;
-    if (schedule.empty())
+    wake_tick = _next_tick();
+    if (wake_tick == (uint64_t)-1)
       cond.Wait(lock);
     else
-      cond.WaitUntil(lock, schedule.begin()->first);
+      cond.WaitUntil(lock, from_tick(wake_tick));
     ldout(cct,20) << "timer_thread awake" << dendl;
   }
   ldout(cct,10) << "timer_thread exiting" << dendl;
@@ -128,37 +247,41 @@ void SafeTimer::add_event_at(utime_t when, Context *callback)
   assert(lock.is_locked());
   ldout(cct,10) << "add_event_at " << when << " -> " << callback << dendl;
 
-  scheduled_map_t::value_type s_val(when, callback);
-  scheduled_map_t::iterator i = schedule.insert(s_val);
+  due.push_back(event_t(when, to_tick(when, true), callback));
+  slot_t::iterator i = due.end();
+  --i;
+  i->slot = &due;
 
-  event_lookup_map_t::value_type e_val(callback, i);
-  pair < event_lookup_map_t::iterator, bool > rval(events.insert(e_val));
+  pair<__gnu_cxx::hash_map<Context*, slot_t::iterator, context_hash>::iterator, bool>
+    rval(events.insert(make_pair(callback, i)));
 
   /* If you hit this, you tried to insert the same Context* twice. */
   assert(rval.second);
 
-  /* If the event we have just inserted comes before everything else, we need to
-   * adjust our timeout. */
-  if (i == schedule.begin())
-    cond.Signal();
+  if (events.size() == 1)
+    cur_tick = to_tick(ceph_clock_now(cct), false);   // nothing to catch up on
+  _place(i);
 
+  /* If the event we have just inserted is due before the timer thread
+   * planned to look again, it needs to recompute its timeout. */
+  if (i->tick < wake_tick)
+    cond.Signal();
 }
 
 bool SafeTimer::cancel_event(Context *callback)
 {
   assert(lock.is_locked());
   
-  std::map<Context*, std::multimap<utime_t, Context*>::iterator>::iterator p = events.find(callback);
+  __gnu_cxx::hash_map<Context*, slot_t::iterator, context_hash>::iterator p =
+    events.find(callback);
   if (p == events.end()) {
     ldout(cct,10) << "cancel_event " << callback << " not found" << dendl;
     return false;
   }
 
-  ldout(cct,10) << "cancel_event " << p->second->first << " -> " << callback << dendl;
+  ldout(cct,10) << "cancel_event " << p->second->when << " -> " << callback << dendl;
   delete p->first;
-
-  schedule.erase(p->second);
-  events.erase(p);
+  _remove(p->second);
   return true;
 }
 
@@ -168,11 +291,10 @@ void SafeTimer::cancel_all_events()
   assert(lock.is_locked());
   
   while (!events.empty()) {
-    std::map<Context*, std::multimap<utime_t, Context*>::iterator>::iterator p = events.begin();
-    ldout(cct,10) << " cancelled " << p->second->first << " -> " << p->first << dendl;
-    delete p->first;
-    schedule.erase(p->second);
-    events.erase(p);
+    slot_t::iterator p = events.begin()->second;
+    ldout(cct,10) << " cancelled " << p->when << " -> " << p->callback << dendl;
+    delete p->callback;
+    _remove(p);
   }
 }
 
@@ -182,8 +304,9 @@ void SafeTimer::dump(const char *caller) const
     caller = "";
   ldout(cct,10) << "dump " << caller << dendl;
 
-  for (scheduled_map_t::const_iterator s = schedule.begin();
-       s != schedule.end();
-       ++s)
-    ldout(cct,10) << " " << s->first << "->" << s->second << dendl;
+  for (__gnu_cxx::hash_map<Context*, slot_t::iterator, context_hash>::const_iterator p =
+	 events.begin();
+       p != events.end();
+       ++p)
+    ldout(cct,10) << " " << p->second->when << "->" << p->first << dendl;
 }
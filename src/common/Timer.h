@@ -18,7 +18,9 @@
 #include "Cond.h"
 #include "Mutex.h"
 
-#include <map>
+#include <list>
+#include <ext/hash_map>
+#include <stdint.h>
 
 class CephContext;
 class Context;
@@ -40,10 +42,56 @@ class SafeTimer
   void timer_thread();
   void _shutdown();
 
-  std::multimap<utime_t, Context*> schedule;
-  std::map<Context*, std::multimap<utime_t, Context*>::iterator> events;
+  /*
+   * Pending events sit on a hierarchical timing wheel of 1ms ticks.
+   * Level 0 has a slot per tick for the next WHEEL_SIZE ticks; each
+   * slot at level n covers a whole turn of level n-1.  Whenever the
+   * wheel reaches the start of a slot at level n > 0, that slot's events
+   * cascade down to the level that now fits them, so every event ends up
+   * in level 0 by its tick.  Adding and cancelling are O(1).  Events due
+   * beyond the top level's reach wait in its furthest slot and are
+   * placed again when it cascades.
+   */
+  enum {
+    WHEEL_BITS = 6,
+    WHEEL_SIZE = 1 << WHEEL_BITS,
+    WHEEL_LEVELS = 6,
+  };
+
+  struct event_t;
+  typedef std::list<event_t> slot_t;
+  struct event_t {
+    utime_t when;
+    uint64_t tick;
+    Context *callback;
+    slot_t *slot;    // the list we are on
+    int level;       // wheel level, or -1 when on due
+    event_t(utime_t w, uint64_t t, Context *c)
+      : when(w), tick(t), callback(c), slot(NULL), level(-1) {}
+  };
+  struct context_hash {
+    size_t operator()(const Context *c) const {
+      return (size_t)c;
+    }
+  };
+
+  slot_t wheel[WHEEL_LEVELS][WHEEL_SIZE];
+  unsigned level_count[WHEEL_LEVELS];
+  slot_t due;            // ready to run, in the order they will run
+  uint64_t cur_tick;     // next tick the wheel will reach
+  uint64_t wake_tick;    // when the timer thread next looks at the wheel
+  __gnu_cxx::hash_map<Context*, slot_t::iterator, context_hash> events;
   bool stopping;
 
+  static uint64_t to_tick(utime_t t, bool round_up);
+  static utime_t from_tick(uint64_t tick);
+  void _place(slot_t::iterator p);
+  void _cascade(int level, unsigned idx);
+  uint64_t _next_tick() const;
+  void _advance(uint64_t to);
+  void _remove(slot_t::iterator p);
+  static bool _event_before(const event_t& a, const event_t& b);
+
   void dump(const char *caller = 0) const;
 
 public:
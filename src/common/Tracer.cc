@@ -0,0 +1,96 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/Tracer.h"
+#include "common/Clock.h"
+#include "common/ceph_context.h"
+#include "common/config.h"
+#include "common/safe_io.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <iomanip>
+#include <sstream>
+
+Tracer::Tracer(CephContext *cct_)
+  : cct(cct_), lock("Tracer::lock"), next(0), last_id(0)
+{
+  // ids from different processes must not collide, so start somewhere random
+  int fd = ::open("/dev/urandom", O_RDONLY);
+  if (fd >= 0) {
+    safe_read_exact(fd, &last_id, sizeof(last_id));
+    ::close(fd);
+  }
+  if (!last_id) {
+    utime_t now = ceph_clock_now(cct);
+    last_id = ((uint64_t)getpid() << 40) ^ ((uint64_t)now.sec() << 20) ^ now.usec();
+  }
+}
+
+uint64_t Tracer::sample()
+{
+  int rate = cct->_conf->trace_sample_rate;
+  if (rate <= 0 || ops.inc() % rate)
+    return 0;
+  Mutex::Locker l(lock);
+  if (!++last_id)
+    ++last_id;
+  return last_id;
+}
+
+void Tracer::_record(uint64_t id, const char *point, const std::string& detail)
+{
+  utime_t now = ceph_clock_now(cct);
+  unsigned max = cct->_conf->trace_max_events;
+  Mutex::Locker l(lock);
+  if (events.size() > max || (next && events.size() < max)) {
+    // trace_max_events changed
+    events.clear();
+    next = 0;
+  }
+  if (!max)
+    return;
+  Event *e;
+  if (events.size() < max) {
+    events.resize(events.size() + 1);
+    e = &events.back();
+  } else {
+    e = &events[next];
+    next = (next + 1) % max;
+  }
+  e->trace_id = id;
+  e->stamp = now;
+  e->point = point;
+  e->detail = detail;
+}
+
+void Tracer::call(std::vector<char> &out)
+{
+  std::ostringstream ss;
+  ss << "entity " << cct->_conf->name << "\n";
+  {
+    Mutex::Locker l(lock);
+    for (unsigned i = 0; i < events.size(); i++) {
+      const Event& e = events[(next + i) % events.size()];
+      ss << std::hex << e.trace_id << std::dec << " " << e.stamp.sec() << "."
+	 << std::setw(6) << std::setfill('0') << e.stamp.usec() << std::setfill(' ')
+	 << " " << e.point;
+      if (e.detail.length())
+	ss << " " << e.detail;
+      ss << "\n";
+    }
+  }
+  std::string s = ss.str();
+  out.assign(s.begin(), s.end());
+}
@@ -0,0 +1,75 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_TRACER_H
+#define CEPH_TRACER_H
+
+#include "include/atomic.h"
+#include "include/utime.h"
+#include "common/admin_socket.h"
+#include "common/Mutex.h"
+
+#include <string>
+#include <vector>
+
+class CephContext;
+
+/*
+ * Sampled end-to-end request tracing.  One in trace_sample_rate client
+ * osd ops gets a trace id, which every Message it gives rise to carries
+ * (on the wire for osd ops, sub ops and their replies).  Each component
+ * the request passes through records an event (trace id, time, where)
+ * in its CephContext's ring of the newest trace_max_events events.
+ * ceph-trace pulls the rings off the daemons' admin sockets
+ * (CEPH_ADMIN_SOCK_TRACES) and stitches them into one timeline per
+ * request.
+ *
+ * Untraced requests (id 0) cost a compare per event point.
+ */
+class Tracer : public AdminSocketHook {
+  struct Event {
+    uint64_t trace_id;
+    utime_t stamp;
+    const char *point;    // a string constant
+    std::string detail;
+  };
+
+  CephContext *cct;
+  Mutex lock;
+  std::vector<Event> events;
+  unsigned next;          // oldest slot, once events is full
+  uint64_t last_id;
+  atomic_t ops;
+
+  void _record(uint64_t id, const char *point, const std::string& detail);
+
+public:
+  Tracer(CephContext *cct_);
+
+  /// a new trace id for 1 in trace_sample_rate calls, 0 otherwise
+  uint64_t sample();
+
+  void record(uint64_t id, const char *point, const std::string& detail = std::string()) {
+    if (id)
+      _record(id, point, detail);
+  }
+
+  /**
+   * The events, oldest first, after an "entity <name>" line, one per
+   * line: "<trace id in hex> <sec.usec> <point> <detail>"
+   */
+  void call(std::vector<char> &out);
+};
+
+#endif
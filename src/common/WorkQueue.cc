@@ -13,6 +13,7 @@
  */
 
 #include <sstream>
+#include <stdlib.h>
 
 #include "include/types.h"
 #include "include/utime.h"
@@ -26,7 +27,39 @@
 #define dout_prefix *_dout << name << " "
 
 
-void ThreadPool::worker()
+/*
+ * Dequeue from the best queue with work and a free thread, or return
+ * NULL.  Call with _lock held.
+ */
+ThreadPool::WorkQueue_ *ThreadPool::_pick(void **item)
+{
+  int n = work_queues.size();
+  vector<bool> tried(n);
+  while (true) {
+    int best = -1;
+    for (int i = 1; i <= n; i++) {
+      int q = (last_work_queue + i) % n;
+      WorkQueue_ *wq = work_queues[q];
+      if (tried[q] ||
+	  (wq->max_threads && wq->processing >= wq->max_threads) ||
+	  (best >= 0 && wq->priority <= work_queues[best]->priority) ||
+	  wq->_empty())
+	continue;
+      best = q;
+    }
+    if (best < 0)
+      return NULL;
+    WorkQueue_ *wq = work_queues[best];
+    *item = wq->_void_dequeue();
+    if (*item) {
+      last_work_queue = best;
+      return wq;
+    }
+    tried[best] = true;   // not empty, but nothing it will hand out now
+  }
+}
+
+void ThreadPool::worker(WorkThread *wt)
 {
   _lock.Lock();
   ldout(cct,10) << "worker start" << dendl;
@@ -36,39 +69,39 @@ void ThreadPool::worker()
   heartbeat_handle_d *hb = cct->get_heartbeat_map()->add_worker(ss.str());
 
   while (!_stop) {
+    if (_threads.size() > _num_threads) {
+      ldout(cct,1) << "worker retiring, pool shrunk to " << _num_threads << dendl;
+      _threads.erase(wt);
+      _old_threads.push_back(wt);
+      break;
+    }
+
     if (!_pause && work_queues.size()) {
-      WorkQueue_* wq;
-      int tries = work_queues.size();
-      bool did = false;
-      while (tries--) {
-	last_work_queue++;
-	last_work_queue %= work_queues.size();
-	wq = work_queues[last_work_queue];
-	
-	void *item = wq->_void_dequeue();
-	if (item) {
-	  processing++;
-	  ldout(cct,12) << "worker wq " << wq->name << " start processing " << item << dendl;
-	  _lock.Unlock();
-	  cct->get_heartbeat_map()->reset_timeout(hb, wq->timeout_interval, wq->suicide_interval);
-	  wq->_void_process(item);
-	  _lock.Lock();
-	  wq->_void_process_finish(item);
-	  ldout(cct,15) << "worker wq " << wq->name << " done processing " << item << dendl;
-	  processing--;
-	  if (_pause || _draining)
-	    _wait_cond.Signal();
-	  did = true;
-	  break;
-	}
-      }
-      if (did)
+      void *item;
+      WorkQueue_ *wq = _pick(&item);
+      if (wq) {
+	processing++;
+	wq->processing++;
+	ldout(cct,12) << "worker wq " << wq->name << " start processing " << item << dendl;
+	_lock.Unlock();
+	cct->get_heartbeat_map()->reset_timeout(hb, wq->timeout_interval, wq->suicide_interval);
+	wq->_void_process(item);
+	_lock.Lock();
+	wq->_void_process_finish(item);
+	ldout(cct,15) << "worker wq " << wq->name << " done processing " << item << dendl;
+	wq->processing--;
+	processing--;
+	if (_pause || _draining)
+	  _wait_cond.Signal();
 	continue;
+      }
     }
 
     ldout(cct,15) << "worker waiting" << dendl;
     cct->get_heartbeat_map()->reset_timeout(hb, 4, 0);
+    _idle++;
     _cond.WaitInterval(cct, _lock, utime_t(2, 0));
+    _idle--;
   }
   ldout(cct,1) << "worker finish" << dendl;
 
@@ -77,22 +110,96 @@ void ThreadPool::worker()
   _lock.Unlock();
 }
 
+void ThreadPool::set_affinity(const cpu_set_t *s)
+{
+  Mutex::Locker l(_lock);
+  _have_cpus = (s != NULL);
+  if (s)
+    _cpus = *s;
+}
+
+/*
+ * Bring the pool up to _num_threads.  Call with _lock held; a pool
+ * above _num_threads shrinks as its workers notice.
+ */
+void ThreadPool::_start_threads()
+{
+  assert(_lock.is_locked());
+  while (_threads.size() < _num_threads) {
+    WorkThread *wt = new WorkThread(this);
+    ldout(cct,10) << "start_threads creating and starting " << wt << dendl;
+    _threads.insert(wt);
+    if (_have_cpus)
+      wt->set_affinity(&_cpus);
+    wt->create(name.c_str());
+  }
+}
+
+void ThreadPool::_join_old_threads()
+{
+  assert(_lock.is_locked());
+  while (!_old_threads.empty()) {
+    WorkThread *wt = _old_threads.front();
+    _old_threads.pop_front();
+    _lock.Unlock();
+    wt->join();
+    delete wt;
+    _lock.Lock();
+  }
+}
+
+void ThreadPool::set_num_threads(unsigned n)
+{
+  Mutex::Locker l(_lock);
+  ldout(cct,1) << "set_num_threads " << _num_threads << " -> " << n << dendl;
+  _num_threads = n;
+  if (!_started || _stop)
+    return;
+  _start_threads();
+  _cond.SignalAll();   // let the excess notice
+  _join_old_threads();
+}
+
+void ThreadPool::handle_conf_change(const struct md_config_t *conf,
+				    const std::set <std::string> &changed)
+{
+  if (!_conf_keys[0] || !changed.count(_conf_keys[0]))
+    return;
+  char buf[32];
+  char *val = buf;
+  if (conf->get_val(_conf_keys[0], &val, sizeof(buf)) < 0)
+    return;
+  int n = atoi(buf);
+  if (n < 1) {
+    lderr(cct) << _conf_keys[0] << " = " << n << " would stop " << name
+	       << "; ignoring" << dendl;
+    return;
+  }
+  set_num_threads(n);
+}
+
 void ThreadPool::start()
 {
   ldout(cct,10) << "start" << dendl;
-  for (set<WorkThread*>::iterator p = _threads.begin();
-       p != _threads.end();
-       p++)
-    (*p)->create();
+  _lock.Lock();
+  _started = true;
+  _start_threads();
+  _lock.Unlock();
+  if (_conf_keys[0])
+    cct->_conf->add_observer(this);
   ldout(cct,15) << "started" << dendl;
 }
 void ThreadPool::stop(bool clear_after)
 {
   ldout(cct,10) << "stop" << dendl;
+  if (_conf_keys[0] && _started)
+    cct->_conf->remove_observer(this);   // waits out a running handle_conf_change
   _lock.Lock();
   _stop = true;
   _cond.Signal();
+  _join_old_threads();
   _lock.Unlock();
+  // no worker touches _threads once it has seen _stop
   for (set<WorkThread*>::iterator p = _threads.begin();
        p != _threads.end();
        p++)
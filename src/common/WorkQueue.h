@@ -18,10 +18,16 @@
 #include "Mutex.h"
 #include "Cond.h"
 #include "Thread.h"
+#include "common/config_obs.h"
 
 class CephContext;
 
-class ThreadPool {
+/*
+ * Workers serving a set of work queues.  Given the name of an integer
+ * option, the pool follows it: changing the option at runtime adds
+ * threads or retires idle ones.
+ */
+class ThreadPool : public md_config_obs_t {
   CephContext *cct;
   string name;
   string lockname;
@@ -30,12 +36,17 @@ class ThreadPool {
   bool _stop, _pause;
   int _draining;
   Cond _wait_cond;
+  int _idle;     // workers waiting on _cond
 
   struct WorkQueue_ {
     string name;
     time_t timeout_interval, suicide_interval;
+    int priority;      // queues with higher priority are served first
+    int max_threads;   // at most this many workers on it at once, 0 for any
+    int processing;
     WorkQueue_(string n, time_t ti, time_t sti)
-      : name(n), timeout_interval(ti), suicide_interval(sti)
+      : name(n), timeout_interval(ti), suicide_interval(sti),
+	priority(0), max_threads(0), processing(0)
     { }
     virtual ~WorkQueue_() {}
     virtual void _clear() = 0;
@@ -77,8 +88,12 @@ public:
     bool queue(T *item) {
       pool->_lock.Lock();
       bool r = _enqueue(item);
-      pool->_cond.SignalOne();
+      // an idle worker is already waiting on _cond, so wake it after we
+      // unlock, when it can take the lock right away
+      bool wake = pool->_idle > 0;
       pool->_lock.Unlock();
+      if (wake)
+	pool->_cond.SignalOne();
       return r;
     }
     void dequeue(T *item) {
@@ -105,6 +120,24 @@ public:
       pool->drain(this);
     }
 
+    /*
+     * Among queues with work, workers take from the highest priority
+     * one, round-robin between equals.  A queue limited to n threads
+     * never has more than n items processing, so slow work on it can
+     * leave the rest of the pool free.
+     */
+    void set_priority(int p) {
+      pool->_lock.Lock();
+      priority = p;
+      pool->_lock.Unlock();
+    }
+    void set_max_threads(int n) {
+      pool->_lock.Lock();
+      max_threads = n;
+      pool->_cond.Signal();
+      pool->_lock.Unlock();
+    }
+
   };
 
 private:
@@ -117,27 +150,42 @@ private:
     ThreadPool *pool;
     WorkThread(ThreadPool *p) : pool(p) {}
     void *entry() {
-      pool->worker();
+      pool->worker(this);
       return 0;
     }
   };
   
   set<WorkThread*> _threads;
+  list<WorkThread*> _old_threads;   // retired, to be joined
+  unsigned _num_threads;
+  bool _started;
   int processing;
+  bool _have_cpus;
+  cpu_set_t _cpus;
 
-  void worker();
+  const char *_conf_keys[2];   // the thread count option, if any
+
+  WorkQueue_ *_pick(void **item);
+  void worker(WorkThread *wt);
+  void _start_threads();
+  void _join_old_threads();
 
 public:
-  ThreadPool(CephContext *cct_, string nm, int n=1) :
+  ThreadPool(CephContext *cct_, string nm, int n=1, const char *option=NULL) :
     cct(cct_), name(nm),
     lockname(nm + "::lock"),
     _lock(lockname.c_str()),  // this should be safe due to declaration order
     _stop(false),
     _pause(false),
     _draining(0),
+    _idle(0),
     last_work_queue(0),
-    processing(0) {
-    set_num_threads(n);
+    _num_threads(n),
+    _started(false),
+    processing(0),
+    _have_cpus(false) {
+    _conf_keys[0] = option;
+    _conf_keys[1] = NULL;
   }
   ~ThreadPool() {
     for (set<WorkThread*>::iterator p = _threads.begin();
@@ -145,6 +193,12 @@ public:
 	 p++)
       delete *p;
   }
+
+  const char **get_tracked_conf_keys() const {
+    return (const char **)_conf_keys;
+  }
+  void handle_conf_change(const struct md_config_t *conf,
+			  const std::set <std::string> &changed);
   
   void add_work_queue(WorkQueue_* wq) {
     work_queues.push_back(wq);
@@ -159,11 +213,11 @@ public:
     work_queues.resize(i-1);
   }
 
-  void set_num_threads(unsigned n) {
-    while (_threads.size() < n) {
-      WorkThread *t = new WorkThread(this);
-      _threads.insert(t);
-    }
+  /// grow or shrink the pool, now if it is running
+  void set_num_threads(unsigned n);
+  unsigned get_num_threads() {
+    Mutex::Locker l(_lock);
+    return _num_threads;
   }
 
   void kick() {
@@ -179,6 +233,9 @@ public:
     c.Wait(_lock);
   }
 
+  /// run the workers only on the cpus in s (NULL for any); call before start()
+  void set_affinity(const cpu_set_t *s);
+
   void start();
   void stop(bool clear_after=true);
   void pause();
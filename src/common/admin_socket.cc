@@ -18,6 +18,7 @@
 #include "common/config_obs.h"
 #include "common/dout.h"
 #include "common/errno.h"
+#include "common/Formatter.h"
 #include "common/perf_counters.h"
 #include "common/pipe.h"
 #include "common/safe_io.h"
@@ -271,10 +272,11 @@ private:
 	/* schema request */
 	ret = handle_json_request(connection_fd, true);
 	break;
+      case CEPH_ADMIN_SOCK_COMMAND:
+	ret = handle_command_request(connection_fd);
+	break;
       default:
-	lderr(m_parent->m_cct) << "AdminSocket: unknown request "
-	    << "code " << request << dendl;
-	ret = false;
+	ret = handle_hook_request(connection_fd, request);
 	break;
     }
     TEMP_FAILURE_RETRY(close(connection_fd));
@@ -302,7 +304,89 @@ private:
     if (coll) {
       coll->write_json_to_buf(buffer, schema);
     }
+    return send_buffer(connection_fd, buffer);
+  }
+
+  bool handle_hook_request(int connection_fd, uint32_t request)
+  {
+    std::vector<char> buffer;
+    {
+      Mutex::Locker l(m_parent->m_hook_lock);
+      std::map<uint32_t, AdminSocketHook*>::iterator p = m_parent->m_hooks.find(request);
+      if (p == m_parent->m_hooks.end()) {
+	lderr(m_parent->m_cct) << "AdminSocket: unknown request "
+	    << "code " << request << dendl;
+	return false;
+      }
+      p->second->call(buffer);
+    }
+    return send_buffer(connection_fd, buffer);
+  }
+
+  bool handle_command_request(int connection_fd)
+  {
+    uint32_t len_raw;
+    int ret = safe_read_exact(connection_fd, &len_raw, sizeof(len_raw));
+    if (ret < 0) {
+      lderr(m_parent->m_cct) << "AdminSocket: error reading command length: "
+	  << cpp_strerror(ret) << dendl;
+      return false;
+    }
+    uint32_t len = ntohl(len_raw);
+    if (len > 4096) {
+      lderr(m_parent->m_cct) << "AdminSocket: command length " << len
+	  << " is too long" << dendl;
+      return false;
+    }
+    std::string command(len, '\0');
+    if (len) {
+      ret = safe_read_exact(connection_fd, &command[0], len);
+      if (ret < 0) {
+	lderr(m_parent->m_cct) << "AdminSocket: error reading command: "
+	    << cpp_strerror(ret) << dendl;
+	return false;
+      }
+    }
+
+    JSONFormatter f(true);
+    {
+      Mutex::Locker l(m_parent->m_hook_lock);
+      std::map<std::string, std::pair<AdminSocketCommand*, std::string> >::iterator p =
+	m_parent->m_commands.find(command);
+      if (p != m_parent->m_commands.end()) {
+	ldout(m_parent->m_cct, 10) << "AdminSocket: command " << command << dendl;
+	// run it unlocked, so that it may take locks its subsystem holds
+	// while registering other commands
+	AdminSocketCommand *hook = p->second.first;
+	m_parent->m_running_command = command;
+	m_parent->m_hook_lock.Unlock();
+	hook->dump_command(command, &f);
+	m_parent->m_hook_lock.Lock();
+	m_parent->m_running_command.clear();
+	m_parent->m_hook_cond.Signal();
+      } else {
+	if (command != "help")
+	  ldout(m_parent->m_cct, 1) << "AdminSocket: unknown command '"
+	      << command << "'" << dendl;
+	f.open_object_section("help");
+	if (command != "help")
+	  f.dump_string("error", "unknown command '" + command + "'");
+	f.open_object_section("commands");
+	for (p = m_parent->m_commands.begin(); p != m_parent->m_commands.end(); ++p)
+	  f.dump_string(p->first.c_str(), p->second.second);
+	f.close_section();
+	f.close_section();
+      }
+    }
+    ostringstream ss;
+    f.flush(ss);
+    std::string s = ss.str();
+    std::vector<char> buffer(s.begin(), s.end());
+    return send_buffer(connection_fd, buffer);
+  }
 
+  bool send_buffer(int connection_fd, std::vector<char> &buffer)
+  {
     uint32_t len = htonl(buffer.size());
     int ret = safe_write(connection_fd, &len, sizeof(len));
     if (ret < 0) {
@@ -316,7 +400,7 @@ private:
 	  << cpp_strerror(ret) << dendl;
       return false;
     }
-    ldout(m_parent->m_cct, 30) << "AdminSocket: handle_json_request succeeded."
+    ldout(m_parent->m_cct, 30) << "AdminSocket: request succeeded."
 	 << dendl;
     return true;
   }
@@ -338,7 +422,8 @@ AdminSocketConfigObs::
 AdminSocketConfigObs(CephContext *cct)
   : m_cct(cct),
     m_thread(NULL),
-    m_shutdown_fd(-1)
+    m_shutdown_fd(-1),
+    m_hook_lock("AdminSocketConfigObs::m_hook_lock")
 {
 }
 
@@ -437,3 +522,45 @@ shutdown()
   remove_cleanup_file(m_path.c_str());
   m_path.clear();
 }
+
+int AdminSocketConfigObs::
+register_hook(uint32_t request, AdminSocketHook *hook)
+{
+  if (request < CEPH_ADMIN_SOCK_FIRST_HOOK || request == CEPH_ADMIN_SOCK_COMMAND)
+    return -EINVAL;
+  Mutex::Locker l(m_hook_lock);
+  if (m_hooks.count(request))
+    return -EEXIST;
+  m_hooks[request] = hook;
+  return 0;
+}
+
+void AdminSocketConfigObs::
+unregister_hook(uint32_t request)
+{
+  Mutex::Locker l(m_hook_lock);
+  m_hooks.erase(request);
+}
+
+int AdminSocketConfigObs::
+register_command(const std::string &command, const std::string &help,
+		 AdminSocketCommand *hook)
+{
+  if (command.empty() || command == "help")
+    return -EINVAL;
+  Mutex::Locker l(m_hook_lock);
+  if (m_commands.count(command))
+    return -EEXIST;
+  m_commands[command] = std::make_pair(hook, help);
+  ldout(m_cct, 5) << "register_command " << command << dendl;
+  return 0;
+}
+
+void AdminSocketConfigObs::
+unregister_command(const std::string &command)
+{
+  Mutex::Locker l(m_hook_lock);
+  m_commands.erase(command);
+  while (m_running_command == command)
+    m_hook_cond.Wait(m_hook_lock);
+}
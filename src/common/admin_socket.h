@@ -12,15 +12,69 @@
  * 
  */
 
+#ifndef CEPH_COMMON_ADMIN_SOCKET_H
+#define CEPH_COMMON_ADMIN_SOCKET_H
+
+#include "common/Cond.h"
 #include "common/config_obs.h"
+#include "common/Mutex.h"
 
+#include <map>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 class AdminSocket;
 class CephContext;
 
 #define CEPH_ADMIN_SOCK_VERSION 1U
 
+/* request codes below this are built in (version, perf counters, schema) */
+#define CEPH_ADMIN_SOCK_FIRST_HOOK 3U
+
+/*
+ * hooks every CephContext registers: recent log lines, lock contention,
+ * the cpu sampler's profile (in pprof's binary format, not JSON) and
+ * trace events (text, see Tracer)
+ */
+#define CEPH_ADMIN_SOCK_RECENT_LOG 4U
+#define CEPH_ADMIN_SOCK_LOCKSTAT 5U
+#define CEPH_ADMIN_SOCK_CPU_SAMPLES 6U
+#define CEPH_ADMIN_SOCK_TRACES 7U
+
+/*
+ * a named command: the request code is followed by the command's length
+ * (a 32-bit big-endian int) and name.  "help" lists the commands.
+ */
+#define CEPH_ADMIN_SOCK_COMMAND 0xffffffffU
+
+namespace ceph {
+  class Formatter;
+}
+
+/*
+ * Answers one admin socket request code with a JSON document.  call()
+ * runs in the admin socket thread.
+ */
+class AdminSocketHook {
+public:
+  virtual void call(std::vector<char> &out) = 0;
+  virtual ~AdminSocketHook() {}
+};
+
+/*
+ * Answers one or more named admin socket commands by describing some
+ * piece of live state.  The reply is f's output, as JSON.  dump_command()
+ * runs in the admin socket thread, and may take the subsystem's locks;
+ * unregistering a command waits for it to finish, so never do that
+ * while holding one of them.
+ */
+class AdminSocketCommand {
+public:
+  virtual void dump_command(const std::string &command, ceph::Formatter *f) = 0;
+  virtual ~AdminSocketCommand() {}
+};
+
 class AdminSocketConfigObs : public md_config_obs_t
 {
 public:
@@ -29,6 +83,17 @@ public:
   virtual const char** get_tracked_conf_keys() const;
   virtual void handle_conf_change(const md_config_t *conf,
 			  const std::set <std::string> &changed);
+
+  /// answer request code 'request' with hook; -EEXIST if it is taken
+  int register_hook(uint32_t request, AdminSocketHook *hook);
+  /// once this returns the hook is no longer running and may be freed
+  void unregister_hook(uint32_t request);
+
+  /// answer command with hook; -EEXIST if it is taken
+  int register_command(const std::string &command, const std::string &help,
+		       AdminSocketCommand *hook);
+  /// once this returns the hook is no longer running and may be freed
+  void unregister_command(const std::string &command);
 private:
   AdminSocketConfigObs(const AdminSocketConfigObs& rhs);
   AdminSocketConfigObs& operator=(const AdminSocketConfigObs &rhs);
@@ -40,6 +105,14 @@ private:
   std::string m_path;
   int m_shutdown_fd;
 
+  Mutex m_hook_lock;     // held while a hook runs
+  Cond m_hook_cond;
+  std::map<uint32_t, AdminSocketHook*> m_hooks;
+  std::map<std::string, std::pair<AdminSocketCommand*, std::string> > m_commands;
+  std::string m_running_command;   // commands run without m_hook_lock
+
   friend class AdminSocket;
   friend class AdminSocketTest;
 };
+
+#endif
@@ -107,7 +107,8 @@ static std::string asok_connect(const std::string &path, int *fd)
   return "";
 }
 
-static std::string asok_request(int socket_fd, uint32_t request_id)
+static std::string asok_request(int socket_fd, uint32_t request_id,
+				const std::string *command = NULL)
 {
   uint32_t request_id_raw = htonl(request_id);
   ssize_t res = safe_write(socket_fd, &request_id_raw, sizeof(request_id_raw));
@@ -118,6 +119,19 @@ static std::string asok_request(int socket_fd, uint32_t request_id)
 	<< cpp_strerror(err);
     return oss.str();
   }
+  if (command) {
+    uint32_t len_raw = htonl(command->size());
+    res = safe_write(socket_fd, &len_raw, sizeof(len_raw));
+    if (res >= 0)
+      res = safe_write(socket_fd, command->data(), command->size());
+    if (res < 0) {
+      int err = res;
+      ostringstream oss;
+      oss << "safe_write(" << socket_fd << ") failed to write command: "
+	  << cpp_strerror(err);
+      return oss.str();
+    }
+  }
   return "";
 }
 
@@ -170,17 +184,29 @@ get_message(std::string *message)
 
 std::string AdminSocketClient::
 get_json(std::string *message, uint32_t request_code)
+{
+  return get_reply(message, request_code, NULL);
+}
+
+std::string AdminSocketClient::
+do_command(const std::string &command, std::string *message)
+{
+  return get_reply(message, CEPH_ADMIN_SOCK_COMMAND, &command);
+}
+
+std::string AdminSocketClient::
+get_reply(std::string *message, uint32_t request_code,
+	  const std::string *command)
 {
   int socket_fd, res;
-  std::vector<uint8_t> vec(65536, 0);
-  uint8_t *buffer = &vec[0];
+  std::vector<char> buffer;
   uint32_t message_size_raw, message_size;
 
   std::string err = asok_connect(m_path, &socket_fd);
   if (!err.empty()) {
     goto done;
   }
-  err = asok_request(socket_fd, request_code);
+  err = asok_request(socket_fd, request_code, command);
   if (!err.empty()) {
     goto done;
   }
@@ -195,7 +221,8 @@ get_json(std::string *message, uint32_t request_code)
     goto done;
   }
   message_size = ntohl(message_size_raw);
-  res = safe_read_exact(socket_fd, buffer, message_size);
+  buffer.resize(message_size);
+  res = message_size ? safe_read_exact(socket_fd, &buffer[0], message_size) : 0;
   if (res < 0) {
     int e = res;
     ostringstream oss;
@@ -204,7 +231,7 @@ get_json(std::string *message, uint32_t request_code)
     goto done;
   }
   //printf("MESSAGE FROM SERVER: %s\n", buffer);
-  message->assign((const char*)buffer);
+  message->assign(buffer.begin(), buffer.end());
 done:
   close(socket_fd);
   return err;
@@ -29,7 +29,11 @@ public:
   std::string get_schema(std::string *message);
   std::string get_message(std::string *message);
   std::string get_json(std::string *message, uint32_t request_code);
+  /// run a named command (CEPH_ADMIN_SOCK_COMMAND)
+  std::string do_command(const std::string &command, std::string *message);
 private:
+  std::string get_reply(std::string *message, uint32_t request_code,
+			const std::string *command);
   std::string m_path;
 };
 
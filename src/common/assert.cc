@@ -13,6 +13,7 @@
  */
 
 #include "BackTrace.h"
+#include "common/DoutStreambuf.h"
 #include "common/ceph_context.h"
 #include "common/config.h"
 #include "common/debug.h"
@@ -47,6 +48,8 @@ namespace ceph {
     DoutLocker dout_locker;
     if (g_assert_context) {
       g_assert_context->dout_trylock(&dout_locker);
+      // get what was logged before this out ahead of it
+      g_assert_context->_doss->flush_queue(1000);
     }
 
     char buf[8096];
@@ -67,6 +70,9 @@ namespace ceph {
 	     "is needed to interpret this.\n");
     dout_emergency(oss.str());
 
+    if (g_assert_context)
+      g_assert_context->_doss->dump_recent();
+
     throw FailedAssertion(bt);
   }
 
@@ -15,6 +15,7 @@
 
 #include "armor.h"
 #include "common/environment.h"
+#include "common/mempool.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
 #include "common/simple_spin.h"
@@ -26,6 +27,8 @@
 #include <sstream>
 #include <sys/uio.h>
 #include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
 
 namespace ceph {
 
@@ -53,17 +56,51 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     return buffer_total_alloc.read();
   }
 
+  /*
+   * size classes for small raw buffers: 64 bytes << class
+   */
+#define SMALL_CLASSES   6
+#define SMALL_MIN_SHIFT 6
+#define SMALL_MAX       (1u << (SMALL_MIN_SHIFT + SMALL_CLASSES - 1))
+
+atomic_t buffer_small_alloc[SMALL_CLASSES];
+bool buffer_no_pool = get_env_bool("CEPH_BUFFER_NO_POOL");
+
+  int buffer::get_small_pool_alloc(unsigned cls) {
+    if (cls >= SMALL_CLASSES)
+      return 0;
+    return buffer_small_alloc[cls].read();
+  }
+
   class buffer::raw {
   public:
     char *data;
     unsigned len;
     atomic_t nref;
+    int pool;   // the mempool len is accounted to, or -1
+
+    raw(unsigned l, int p = mempool::buffer_anon) : len(l), nref(0), pool(p) {
+      if (pool >= 0)
+	mempool::inc(pool, len, 1);
+    }
+    raw(char *c, unsigned l, int p = mempool::buffer_anon) : data(c), len(l), nref(0), pool(p) {
+      if (pool >= 0)
+	mempool::inc(pool, len, 1);
+    }
+    virtual ~raw() {
+      if (pool >= 0)
+	mempool::dec(pool, len, 1);
+    }
 
-    raw(unsigned l) : len(l), nref(0)
-    { }
-    raw(char *c, unsigned l) : data(c), len(l), nref(0)
-    { }
-    virtual ~raw() {};
+    void reassign_to_mempool(int p) {
+      if (p == pool)
+	return;
+      if (pool >= 0)
+	mempool::dec(pool, len, 1);
+      pool = p;
+      if (pool >= 0)
+	mempool::inc(pool, len, 1);
+    }
 
     // no copying.
     raw(const raw &other);
@@ -72,12 +109,24 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     virtual raw* clone_empty() = 0;
     raw *clone() {
       raw *c = clone_empty();
-      memcpy(c->data, data, len);
+      memcpy(c->data, get_data(), len);
       return c;
     }
 
+    // lazily filled raws (raw_fd) leave data NULL until it is needed
+    virtual void materialize() {}
+    char *get_data() {
+      if (!data)
+	materialize();
+      return data;
+    }
+    /// the file range backing this raw, while it has not been read in yet
+    virtual bool get_fd(int *fd, uint64_t *off) {
+      return false;
+    }
+
     bool is_page_aligned() {
-      return ((long)data & ~PAGE_MASK) == 0;
+      return ((long)get_data() & ~PAGE_MASK) == 0;
     }
     bool is_n_page_sized() {
       return (len & ~PAGE_MASK) == 0;
@@ -209,21 +258,190 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     }
   };
 
+  /*
+   * a small buffer whose header and data share one chunk.  Freed
+   * chunks are kept on the freeing thread's list for their size class
+   * and handed back to whoever allocates in that class next on the
+   * same thread, up to a small bound; the rest go back to malloc, as do
+   * a thread's cached chunks when it exits.
+   */
+  struct small_cache_t {
+    void *head[SMALL_CLASSES];
+    unsigned count[SMALL_CLASSES];
+  };
+  static __thread small_cache_t *small_cache = NULL;
+  static pthread_key_t small_cache_key;
+  static pthread_once_t small_cache_once = PTHREAD_ONCE_INIT;
+
+  static void small_cache_destroy(void *p)
+  {
+    small_cache_t *c = (small_cache_t *)p;
+    for (int i = 0; i < SMALL_CLASSES; i++) {
+      while (c->head[i]) {
+	void *n = *(void **)c->head[i];
+	::free(c->head[i]);
+	c->head[i] = n;
+      }
+    }
+    ::free(c);
+    small_cache = NULL;
+  }
+  static void small_cache_init_key()
+  {
+    pthread_key_create(&small_cache_key, small_cache_destroy);
+  }
+  static small_cache_t *get_small_cache()
+  {
+    if (!small_cache) {
+      pthread_once(&small_cache_once, small_cache_init_key);
+      small_cache = (small_cache_t *)calloc(1, sizeof(small_cache_t));
+      pthread_setspecific(small_cache_key, small_cache);
+    }
+    return small_cache;
+  }
+  static unsigned small_cache_max(int cls)
+  {
+    return MAX(8, 16384 >> (SMALL_MIN_SHIFT + cls));   // ~16KB per class
+  }
+
+  class buffer::raw_small : public buffer::raw {
+    /*
+     * each chunk starts with its class (the free list link while
+     * cached), then the raw_small, then the data
+     */
+    union chunk_head_t {
+      void *next;
+      int cls;
+      uint64_t align;
+    };
+    int cls;
+  public:
+    static int get_class(unsigned len) {
+      int cls = 0;
+      while ((1u << (SMALL_MIN_SHIFT + cls)) < len)
+	cls++;
+      return cls;
+    }
+    static size_t chunk_size(int cls) {
+      return sizeof(chunk_head_t) + sizeof(raw_small) + (1u << (SMALL_MIN_SHIFT + cls));
+    }
+
+    static void *operator new(size_t s, int cls) {
+      small_cache_t *c = get_small_cache();
+      chunk_head_t *h = (chunk_head_t *)c->head[cls];
+      if (h) {
+	c->head[cls] = h->next;
+	c->count[cls]--;
+      } else {
+	h = (chunk_head_t *)::malloc(chunk_size(cls));
+	if (!h)
+	  throw std::bad_alloc();
+      }
+      h->cls = cls;
+      return h + 1;
+    }
+    static void operator delete(void *p) {
+      chunk_head_t *h = (chunk_head_t *)p - 1;
+      int cls = h->cls;
+      small_cache_t *c = get_small_cache();
+      if (c->count[cls] >= small_cache_max(cls)) {
+	::free(h);
+	return;
+      }
+      h->next = c->head[cls];
+      c->head[cls] = h;
+      c->count[cls]++;
+    }
+    static void operator delete(void *p, int cls) {   // if a ctor throws
+      ::free((chunk_head_t *)p - 1);
+    }
+
+    raw_small(unsigned l, int c) : raw((char *)(this + 1), l), cls(c) {
+      inc_total_alloc(len);
+      if (buffer_track_alloc)
+	buffer_small_alloc[cls].add(len);
+      bdout << "raw_small " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
+    }
+    ~raw_small() {
+      dec_total_alloc(len);
+      if (buffer_track_alloc)
+	buffer_small_alloc[cls].sub(len);
+      bdout << "raw_small " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
+    }
+    raw* clone_empty() {
+      return create(len);
+    }
+  };
+
   class buffer::raw_static : public buffer::raw {
   public:
-    raw_static(const char *d, unsigned l) : raw((char*)d, l) { }
+    raw_static(const char *d, unsigned l) : raw((char*)d, l, -1) { }   // not ours
     ~raw_static() {}
     raw* clone_empty() {
       return new buffer::raw_char(len);
     }
   };
 
+  /*
+   * a range of a file that is only read into memory if someone looks at
+   * it; the messenger sends it straight from the file otherwise.
+   */
+  class buffer::raw_fd : public buffer::raw {
+    int fd;
+    uint64_t file_off;
+    simple_spinlock_t lock;
+  public:
+    raw_fd(int f, uint64_t o, unsigned l)
+      : raw(l), fd(::dup(f)), file_off(o), lock(SIMPLE_SPINLOCK_INITIALIZER) {
+      data = 0;
+      bdout << "raw_fd " << this << " fd " << fd << " " << o << "~" << l << bendl;
+    }
+    ~raw_fd() {
+      if (fd >= 0)
+	::close(fd);
+      if (data) {
+	free(data);
+	dec_total_alloc(len);
+      }
+      bdout << "raw_fd " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
+    }
+    void materialize() {
+      simple_spin_lock(&lock);
+      if (!data && len) {
+	char *d = (char *)malloc(len);
+	ssize_t r = fd >= 0 ? safe_pread(fd, d, len, file_off) : -EBADF;
+	if (r < 0)
+	  r = 0;
+	if ((unsigned)r < len)   // the file shrank underneath us
+	  memset(d + r, 0, len - r);
+	inc_total_alloc(len);
+	data = d;
+	bdout << "raw_fd " << this << " read " << (void *)data << " " << r << "/" << len << bendl;
+      }
+      simple_spin_unlock(&lock);
+    }
+    bool get_fd(int *f, uint64_t *o) {
+      if (data || fd < 0)
+	return false;
+      *f = fd;
+      *o = file_off;
+      return true;
+    }
+    raw* clone_empty() {
+      return new raw_malloc(len);
+    }
+  };
+
   buffer::raw* buffer::copy(const char *c, unsigned len) {
-    raw* r = new raw_char(len);
+    raw* r = create(len);
     memcpy(r->data, c, len);
     return r;
   }
   buffer::raw* buffer::create(unsigned len) {
+    if (len && len <= SMALL_MAX && !buffer_no_pool) {
+      int cls = raw_small::get_class(len);
+      return new(cls) raw_small(len, cls);
+    }
     return new raw_char(len);
   }
   buffer::raw* buffer::claim_char(unsigned len, char *buf) {
@@ -246,6 +464,9 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     return new raw_hack_aligned(len);
 #endif
   }
+  buffer::raw* buffer::create_fd(int fd, uint64_t off, unsigned len) {
+    return new raw_fd(fd, off, len);
+  }
 
   buffer::ptr::ptr(raw *r) : _raw(r), _off(0), _len(r->len)   // no lock needed; this is an unref raw.
   {
@@ -329,8 +550,16 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
 
   bool buffer::ptr::at_buffer_tail() const { return _off + _len == _raw->len; }
 
-  const char *buffer::ptr::c_str() const { assert(_raw); return _raw->data + _off; }
-  char *buffer::ptr::c_str() { assert(_raw); return _raw->data + _off; }
+  const char *buffer::ptr::c_str() const { assert(_raw); return _raw->get_data() + _off; }
+  char *buffer::ptr::c_str() { assert(_raw); return _raw->get_data() + _off; }
+
+  bool buffer::ptr::get_fd(int *fd, uint64_t *off) const
+  {
+    if (!_raw || !_raw->get_fd(fd, off))
+      return false;
+    *off += _off;
+    return true;
+  }
 
   unsigned buffer::ptr::unused_tail_length() const
   {
@@ -343,16 +572,16 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   {
     assert(_raw);
     assert(n < _len);
-    return _raw->data[_off + n];
+    return _raw->get_data()[_off + n];
   }
   char& buffer::ptr::operator[](unsigned n)
   {
     assert(_raw);
     assert(n < _len);
-    return _raw->data[_off + n];
+    return _raw->get_data()[_off + n];
   }
 
-  const char *buffer::ptr::raw_c_str() const { assert(_raw); return _raw->data; }
+  const char *buffer::ptr::raw_c_str() const { assert(_raw); return _raw->get_data(); }
   unsigned buffer::ptr::raw_length() const { assert(_raw); return _raw->len; }
   int buffer::ptr::raw_nref() const { assert(_raw); return _raw->nref.read(); }
 
@@ -401,6 +630,12 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     memcpy(c_str()+o, src, l);
   }
 
+  void buffer::ptr::reassign_to_mempool(int pool)
+  {
+    if (_raw)
+      _raw->reassign_to_mempool(pool);
+  }
+
   void buffer::ptr::zero()
   {
     memset(c_str(), 0, _len);
@@ -481,6 +716,14 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   
   void buffer::list::iterator::copy(unsigned len, char *dest)
   {
+    // fast path: it comes from the current segment, which we don't leave
+    if (p != ls->end() && p_off + len < p->length()) {
+      memcpy(dest, p->c_str() + p_off, len);
+      p_off += len;
+      off += len;
+      return;
+    }
+
     if (p == ls->end()) seek(off);
     while (len > 0) {
       if (p == ls->end())
@@ -630,6 +873,14 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     return true;
   }
 
+  void buffer::list::reassign_to_mempool(int pool)
+  {
+    for (std::list<ptr>::iterator it = _buffers.begin();
+	 it != _buffers.end();
+	 it++)
+      it->reassign_to_mempool(pool);
+  }
+
   void buffer::list::zero()
   {
     for (std::list<ptr>::iterator it = _buffers.begin();
@@ -795,6 +1046,18 @@ void buffer::list::rebuild_page_aligned()
   
   void buffer::list::append(const char *data, unsigned len)
   {
+    // fast path: it fits in append_buffer, right after the last segment
+    if (len <= append_buffer.unused_tail_length() && !_buffers.empty()) {
+      ptr &l = _buffers.back();
+      if (l.get_raw() == append_buffer.get_raw() &&
+	  l.end() == append_buffer.end()) {
+	append_buffer.append(data, len);
+	l.set_length(l.length() + len);
+	_len += len;
+	return;
+      }
+    }
+
     while (len > 0) {
       // put what we can into the existing append_buffer.
       unsigned gap = append_buffer.unused_tail_length();
@@ -816,6 +1079,15 @@ void buffer::list::rebuild_page_aligned()
     }
   }
 
+  void buffer::list::reserve(unsigned len)
+  {
+    if (append_buffer.unused_tail_length() >= len)
+      return;
+    unsigned alen = PAGE_SIZE * (((len-1) / PAGE_SIZE) + 1);
+    append_buffer = create_page_aligned(alen);
+    append_buffer.set_length(0);   // unused, so far.
+  }
+
   void buffer::list::append(const ptr& bp)
   {
     if (bp.length())
@@ -16,12 +16,17 @@
 
 #include "common/admin_socket.h"
 #include "common/DoutStreambuf.h"
+#include "common/Formatter.h"
 #include "common/perf_counters.h"
 #include "common/Thread.h"
 #include "common/ceph_context.h"
 #include "common/config.h"
 #include "common/debug.h"
 #include "common/HeartbeatMap.h"
+#include "common/lockstat.h"
+#include "common/mempool.h"
+#include "common/Tracer.h"
+#include "perfglue/cpu_sampler.h"
 
 #include <iostream>
 #include <pthread.h>
@@ -29,6 +34,50 @@
 
 using ceph::HeartbeatMap;
 
+enum {
+  l_mempool_first = 61000,
+  // bytes then items for each pool
+  l_mempool_last = l_mempool_first + 1 + 2 * mempool::num_pools,
+};
+
+/*
+ * Memory accounting by pool: as perf counters, as of the last service
+ * thread wakeup, and current as a named command.
+ */
+class MempoolHook : public AdminSocketCommand {
+  CephContext *cct;
+  std::vector<std::string> names;   // the counters point into these
+  PerfCounters *logger;
+public:
+  MempoolHook(CephContext *c) : cct(c) {
+    for (int ix = 0; ix < mempool::num_pools; ix++) {
+      names.push_back(std::string(mempool::get_pool_name(ix)) + "_bytes");
+      names.push_back(std::string(mempool::get_pool_name(ix)) + "_items");
+    }
+    PerfCountersBuilder b(cct, "mempool", l_mempool_first, l_mempool_last);
+    for (unsigned i = 0; i < names.size(); i++)
+      b.add_u64(l_mempool_first + 1 + i, names[i].c_str());
+    logger = b.create_perf_counters();
+    cct->get_perfcounters_collection()->add(logger);
+    update();
+  }
+  ~MempoolHook() {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+  }
+  void update() {
+    for (int ix = 0; ix < mempool::num_pools; ix++) {
+      int64_t bytes, items;
+      mempool::get_stats(ix, &bytes, &items);
+      logger->set(l_mempool_first + 1 + 2 * ix, bytes);
+      logger->set(l_mempool_first + 2 + 2 * ix, items);
+    }
+  }
+  void dump_command(const std::string &command, ceph::Formatter *f) {
+    mempool::dump(f);
+  }
+};
+
 class CephContextServiceThread : public Thread
 {
 public:
@@ -62,6 +111,7 @@ public:
 	_reopen_logs = false;
       }
       _cct->_heartbeat_map->check_touch_file();
+      _cct->_mempool_hook->update();
     }
     return NULL;
   }
@@ -85,6 +135,83 @@ private:
   CephContext *_cct;
 };
 
+/*
+ * The recent log lines (log_max_recent of them, including those
+ * gathered at log_recent_level but not written), oldest first.
+ */
+class RecentLogHook : public AdminSocketHook {
+  CephContext *cct;
+public:
+  RecentLogHook(CephContext *c) : cct(c) {}
+  void call(std::vector<char> &out) {
+    std::vector<std::string> lines;
+    cct->_doss->get_recent(lines);
+    JSONFormatter f(true);
+    f.open_array_section("recent");
+    for (unsigned i = 0; i < lines.size(); i++)
+      f.dump_string("line", lines[i]);
+    f.close_section();
+    std::ostringstream ss;
+    f.flush(ss);
+    std::string s = ss.str();
+    out.assign(s.begin(), s.end());
+  }
+};
+
+/*
+ * Turns lock contention accounting on and off with the lockstat option,
+ * and dumps what it has gathered.
+ */
+class LockstatHook : public AdminSocketHook, public md_config_obs_t {
+public:
+  const char** get_tracked_conf_keys() const {
+    static const char *KEYS[] = { "lockstat", "lockstat_sample", NULL };
+    return KEYS;
+  }
+  void handle_conf_change(const md_config_t *conf,
+			  const std::set <std::string> &changed) {
+    g_lockstat_sample = conf->lockstat_sample;
+    if (conf->lockstat && !g_lockstat)
+      lockstat_reset();
+    g_lockstat = conf->lockstat;
+  }
+  void call(std::vector<char> &out) {
+    JSONFormatter f(true);
+    lockstat_dump(&f);
+    std::ostringstream ss;
+    f.flush(ss);
+    std::string s = ss.str();
+    out.assign(s.begin(), s.end());
+  }
+};
+
+/*
+ * Runs the cpu sampler at cpu_sample_hz, and hands out what it has
+ * gathered: the raw profile (for pprof, so not JSON) on its request
+ * code, a per-thread summary as a named command.
+ */
+class CpuSamplerHook : public AdminSocketHook, public AdminSocketCommand,
+		       public md_config_obs_t {
+public:
+  const char** get_tracked_conf_keys() const {
+    static const char *KEYS[] = { "cpu_sample_hz", "cpu_sample_max", NULL };
+    return KEYS;
+  }
+  void handle_conf_change(const md_config_t *conf,
+			  const std::set <std::string> &changed) {
+    if (conf->cpu_sample_hz > 0)
+      cpu_sampler_start(conf->cpu_sample_hz, conf->cpu_sample_max);
+    else if (cpu_sampler_running())
+      cpu_sampler_stop();
+  }
+  void call(std::vector<char> &out) {
+    cpu_sampler_dump_pprof(out);
+  }
+  void dump_command(const std::string &command, ceph::Formatter *f) {
+    cpu_sampler_dump_threads(f);
+  }
+};
+
 CephContext::CephContext(uint32_t module_type_)
   : _conf(new md_config_t()),
     _doss(new DoutStreambuf <char, std::basic_string<char>::traits_type>()),
@@ -93,7 +220,12 @@ CephContext::CephContext(uint32_t module_type_)
     _service_thread(NULL),
     _admin_socket_config_obs(NULL),
     _perf_counters_collection(NULL),
-    _heartbeat_map(NULL)
+    _heartbeat_map(NULL),
+    _recent_log_hook(NULL),
+    _lockstat_hook(NULL),
+    _cpu_sampler_hook(NULL),
+    _mempool_hook(NULL),
+    _tracer(NULL)
 {
   pthread_spin_init(&_service_thread_lock, PTHREAD_PROCESS_SHARED);
   _perf_counters_collection = new PerfCountersCollection(this);
@@ -101,6 +233,23 @@ CephContext::CephContext(uint32_t module_type_)
   _admin_socket_config_obs = new AdminSocketConfigObs(this);
   _conf->add_observer(_admin_socket_config_obs);
   _heartbeat_map = new HeartbeatMap(this);
+  _recent_log_hook = new RecentLogHook(this);
+  _admin_socket_config_obs->register_hook(CEPH_ADMIN_SOCK_RECENT_LOG, _recent_log_hook);
+  _lockstat_hook = new LockstatHook;
+  _conf->add_observer(_lockstat_hook);
+  _admin_socket_config_obs->register_hook(CEPH_ADMIN_SOCK_LOCKSTAT, _lockstat_hook);
+  _cpu_sampler_hook = new CpuSamplerHook;
+  _conf->add_observer(_cpu_sampler_hook);
+  _admin_socket_config_obs->register_hook(CEPH_ADMIN_SOCK_CPU_SAMPLES, _cpu_sampler_hook);
+  _admin_socket_config_obs->register_command("dump_cpu_samples",
+					     "cpu samples per thread name, with their hottest functions",
+					     _cpu_sampler_hook);
+  _mempool_hook = new MempoolHook(this);
+  _admin_socket_config_obs->register_command("dump_mempools",
+					     "bytes and items allocated to each memory pool",
+					     _mempool_hook);
+  _tracer = new Tracer(this);
+  _admin_socket_config_obs->register_hook(CEPH_ADMIN_SOCK_TRACES, _tracer);
 }
 
 CephContext::~CephContext()
@@ -109,6 +258,20 @@ CephContext::~CephContext()
 
   delete _heartbeat_map;
 
+  _admin_socket_config_obs->unregister_hook(CEPH_ADMIN_SOCK_RECENT_LOG);
+  delete _recent_log_hook;
+  _admin_socket_config_obs->unregister_hook(CEPH_ADMIN_SOCK_LOCKSTAT);
+  _conf->remove_observer(_lockstat_hook);
+  delete _lockstat_hook;
+  _admin_socket_config_obs->unregister_hook(CEPH_ADMIN_SOCK_CPU_SAMPLES);
+  _admin_socket_config_obs->unregister_command("dump_cpu_samples");
+  _conf->remove_observer(_cpu_sampler_hook);
+  delete _cpu_sampler_hook;
+  _admin_socket_config_obs->unregister_command("dump_mempools");
+  delete _mempool_hook;
+  _admin_socket_config_obs->unregister_hook(CEPH_ADMIN_SOCK_TRACES);
+  delete _tracer;
+
   _conf->remove_observer(_admin_socket_config_obs);
   _conf->remove_observer(_doss);
 
@@ -23,8 +23,13 @@ template <typename T, typename U>
 class DoutStreambuf;
 
 class AdminSocketConfigObs;
+class AdminSocketHook;
 class CephContextServiceThread;
 class DoutLocker;
+class CpuSamplerHook;
+class LockstatHook;
+class MempoolHook;
+class Tracer;
 class PerfCountersCollection;
 class md_config_obs_t;
 class md_config_t;
@@ -66,10 +71,20 @@ public:
   /* Get the PerfCountersCollection of this CephContext */
   PerfCountersCollection *get_perfcounters_collection();
 
+  /* Get the sampled request tracer */
+  Tracer *get_tracer() {
+    return _tracer;
+  }
+
   ceph::HeartbeatMap *get_heartbeat_map() {
     return _heartbeat_map;
   }
 
+  /* Get the admin socket, to register request hooks with */
+  AdminSocketConfigObs *get_admin_socket() {
+    return _admin_socket_config_obs;
+  }
+
 private:
   CephContext(const CephContext &rhs);
   CephContext &operator=(const CephContext &rhs);
@@ -96,6 +111,21 @@ private:
   md_config_obs_t *_perf_counters_conf_obs;
 
   ceph::HeartbeatMap *_heartbeat_map;
+
+  /* admin socket dump of the recent log lines */
+  AdminSocketHook *_recent_log_hook;
+
+  /* lockstat switch and admin socket dump */
+  LockstatHook *_lockstat_hook;
+
+  /* cpu sampler switch and admin socket dumps */
+  CpuSamplerHook *_cpu_sampler_hook;
+
+  /* mempool perf counters (refreshed by the service thread) and dump */
+  MempoolHook *_mempool_hook;
+
+  /* sampled request tracing, dumped on the admin socket */
+  Tracer *_tracer;
 };
 
 #endif
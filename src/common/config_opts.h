@@ -28,8 +28,16 @@ OPTION(log_to_stderr, OPT_BOOL, true)
 OPTION(err_to_stderr, OPT_BOOL, true)
 OPTION(log_to_syslog, OPT_BOOL, false)
 OPTION(log_per_instance, OPT_BOOL, false)
+OPTION(log_async, OPT_BOOL, true)          // write log lines from a separate thread
+OPTION(log_max_queue, OPT_INT, 32<<20)     // bytes of lines waiting to be written before loggers wait
+OPTION(log_max_recent, OPT_INT, 1000)      // recent lines kept in memory, dumped on crash
+OPTION(log_recent_level, OPT_INT, 0)       // also gather lines up to this debug level into the recent lines, even if not written
 OPTION(clog_to_monitors, OPT_BOOL, true)
 OPTION(clog_to_syslog, OPT_BOOL, false)
+OPTION(clog_rate, OPT_DOUBLE, 10)        // cluster log messages/sec a daemon may send; 0 for no limit
+OPTION(clog_burst, OPT_INT, 100)         // ... with bursts of up to this many
+OPTION(clog_repeat_window, OPT_DOUBLE, 60) // fold identical messages this close together; 0 to disable
+OPTION(clog_max_queue, OPT_INT, 1000)    // unacked messages kept for the monitors
 OPTION(pid_file, OPT_STR, "")
 OPTION(chdir, OPT_STR, "/")
 OPTION(max_open_files, OPT_LONGLONG, 0)
@@ -62,29 +70,49 @@ OPTION(debug_paxos, OPT_INT, 0)
 OPTION(debug_tp, OPT_INT, 0)
 OPTION(debug_auth, OPT_INT, 1)
 OPTION(debug_finisher, OPT_INT, 1)
+OPTION(debug_throttle, OPT_INT, 1)
 OPTION(debug_heartbeatmap, OPT_INT, 1)
 OPTION(debug_perfcounter, OPT_INT, 1)
 OPTION(key, OPT_STR, "")
 OPTION(keyfile, OPT_STR, "")
 OPTION(keyring, OPT_STR, "/etc/ceph/keyring,/etc/ceph/keyring.bin")
+OPTION(lockstat, OPT_BOOL, false)     // gather lock contention stats (resets them when turned on)
+OPTION(lockstat_sample, OPT_INT, 64)  // backtrace 1 in this many contended acquisitions; 0 = never
+OPTION(cpu_sample_hz, OPT_INT, 0)     // sample stacks this often per cpu second (e.g. 19) into a rolling profile; 0 = off
+OPTION(cpu_sample_max, OPT_INT, 8192)  // samples kept, newest first (about 300 bytes each)
+OPTION(trace_sample_rate, OPT_INT, 0)  // trace 1 in this many client osd ops end to end; 0 = none
+OPTION(trace_max_events, OPT_INT, 10000)  // trace events kept, the newest
 OPTION(heartbeat_interval, OPT_INT, 5)
 OPTION(heartbeat_file, OPT_STR, "")
 OPTION(ms_tcp_nodelay, OPT_BOOL, true)
+OPTION(ms_tcp_rcvbuf, OPT_INT, 0)   // SO_RCVBUF for messenger sockets; 0 = kernel autotuning
+OPTION(ms_tcp_sndbuf, OPT_INT, 0)   // SO_SNDBUF for messenger sockets; 0 = kernel autotuning
 OPTION(ms_initial_backoff, OPT_DOUBLE, .2)
 OPTION(ms_max_backoff, OPT_DOUBLE, 15.0)
 OPTION(ms_nocrc, OPT_BOOL, false)
 OPTION(ms_die_on_bad_msg, OPT_BOOL, false)
 OPTION(ms_dispatch_throttle_bytes, OPT_U64, 100 << 20)
+OPTION(ms_dispatch_threads, OPT_INT, 1)  // >1 delivers from different connections in parallel
+OPTION(ms_thread_cpus, OPT_STR, "")   // cpu list (e.g. 0-3,8) for pipe and dispatch threads; empty for any
+OPTION(ms_dispatch_quantum, OPT_U64, 64 << 10)  // DRR quantum (bytes) for pipes at the same priority; 0 = one message per turn
 OPTION(ms_bind_ipv6, OPT_BOOL, false)
 OPTION(ms_rwthread_stack_bytes, OPT_U64, 1024 << 10)
+OPTION(ms_rx_buffer_pool, OPT_INT, 4)   // page-aligned rx data buffers cached per pipe
+OPTION(ms_rx_buffer_pool_max_bytes, OPT_U64, 4 << 20)  // don't pool rx buffers bigger than this
+OPTION(ms_write_batch_max, OPT_INT, 16)  // max queued messages gathered into one sendmsg()
+OPTION(ms_write_coalesce_usec, OPT_U64, 0)  // wait this long for small control messages to batch up
+OPTION(ms_event_workers, OPT_INT, 0)    // if >0, idle pipes are read by this many epoll threads instead of a reader thread each
 OPTION(ms_tcp_read_timeout, OPT_U64, 900)
 OPTION(ms_inject_socket_failures, OPT_U64, 0)
 OPTION(mon_data, OPT_STR, "")
 OPTION(mon_sync_fs_threshold, OPT_INT, 5)   // sync() when writing this many objects; 0 to disable.
+OPTION(mon_store_kv, OPT_BOOL, false)   // keep mon state in an embedded db (mon_data/store.db); converts existing stores
 OPTION(mon_tick_interval, OPT_INT, 5)
 OPTION(mon_subscribe_interval, OPT_DOUBLE, 300)
 OPTION(mon_osd_auto_mark_in, OPT_BOOL, true)    // automatically mark new osds 'in'
 OPTION(mon_osd_down_out_interval, OPT_INT, 300) // seconds
+OPTION(mon_osd_cache_size, OPT_INT, 20)  // recent encoded osdmap epochs kept in memory for subscribers
+OPTION(mon_osd_map_seed, OPT_INT, 3)   // push each new osdmap epoch to this many random osds
 OPTION(mon_lease, OPT_FLOAT, 5)       // lease interval
 OPTION(mon_lease_renew_interval, OPT_FLOAT, 3) // on leader, to renew the lease
 OPTION(mon_lease_ack_timeout, OPT_FLOAT, 10.0) // on leader, if lease isn't acked by all peons
@@ -96,28 +124,47 @@ OPTION(mon_osd_full_ratio, OPT_INT, 95) // what % full makes an OSD "full"
 OPTION(mon_osd_nearfull_ratio, OPT_INT, 85) // what % full makes an OSD near full
 OPTION(mon_globalid_prealloc, OPT_INT, 100)   // how many globalids to prealloc
 OPTION(mon_osd_report_timeout, OPT_INT, 900)    // grace period before declaring unresponsive OSDs dead
+OPTION(mon_osd_down_subtree_type, OPT_STR, "host")   // crush bucket type whose osds tend to fail together
+OPTION(mon_osd_down_subtree_ratio, OPT_DOUBLE, .5)   // once this fraction of such a bucket is down, take its reported osds down too; 0 to disable
 OPTION(mon_force_standby_active, OPT_BOOL, true) // should mons force standby-replay mds to be active
 OPTION(mon_min_osdmap_epochs, OPT_INT, 500)
 OPTION(mon_max_pgmap_epochs, OPT_INT, 500)
+OPTION(mon_pg_stash_interval, OPT_INT, 50)   // write a full pgmap every this many versions
 OPTION(mon_max_log_epochs, OPT_INT, 500)
+OPTION(mon_log_propose_interval, OPT_DOUBLE, 5.0)  // gather log entries this long before proposing
+OPTION(mon_log_max_pending, OPT_INT, 2000)   // log entries per proposal; the rest are dropped and counted
+OPTION(mon_log_summary_max, OPT_INT, 50)     // recent entries kept in the log summary
 OPTION(paxos_propose_interval, OPT_DOUBLE, 1.0)  // gather updates for this long before proposing a map update
 OPTION(paxos_min_wait, OPT_DOUBLE, 0.05)  // min time to gather updates for after period of inactivity
+OPTION(paxos_propose_batch, OPT_BOOL, true)  // when one service proposes, propose others waiting on their timers too
+OPTION(paxos_pipeline, OPT_BOOL, true)  // finish a round on majority accept; don't wait for the whole quorum
 OPTION(paxos_observer_timeout, OPT_DOUBLE, 5*60) // gather updates for this long before proposing a map update
 OPTION(clock_offset, OPT_DOUBLE, 0) // how much to offset the system clock in Clock.cc
 OPTION(auth_supported, OPT_STR, "none")
 OPTION(auth_mon_ticket_ttl, OPT_DOUBLE, 60*60*12)
 OPTION(auth_service_ticket_ttl, OPT_DOUBLE, 60*60)
+OPTION(auth_ticket_cache_size, OPT_INT, 4096)  // verified service tickets kept, for reconnects
 OPTION(mon_client_hunt_interval, OPT_DOUBLE, 3.0)   // try new mon every N seconds until we connect
 OPTION(mon_client_ping_interval, OPT_DOUBLE, 10.0)  // ping every N seconds
+OPTION(mon_client_hunt_parallel, OPT_INT, 3)   // monitors to try at once while hunting; the first to answer wins
+OPTION(mon_client_hint_file, OPT_STR, "")   // remember the last monitor we had a session with here, and try it first
 OPTION(client_cache_size, OPT_INT, 16384)
 OPTION(client_cache_mid, OPT_FLOAT, .75)
 OPTION(client_cache_stat_ttl, OPT_INT, 0) // seconds until cached stat results become invalid
 OPTION(client_cache_readdir_ttl, OPT_INT, 1)  // 1 second only
+OPTION(client_readdir_max_entries, OPT_INT, 0)  // per readdir reply; 0 for no limit
+OPTION(client_readdir_max_bytes, OPT_INT, 0)    // per readdir reply; 0 for the mds limit
+OPTION(client_lookup_trace, OPT_BOOL, true)  // look up all uncached components of a path in one request
 OPTION(client_use_random_mds, OPT_BOOL, false)
 OPTION(client_mount_timeout, OPT_DOUBLE, 30.0)
 OPTION(client_unmount_timeout, OPT_DOUBLE, 10.0)
 OPTION(client_tick_interval, OPT_DOUBLE, 1.0)
+OPTION(client_caps_release_delay, OPT_DOUBLE, 5.0)  // seconds to hold unwanted or dirty caps before updating the mds
+OPTION(client_cap_release_batch, OPT_INT, 1000)  // send queued cap releases once this many pile up (0 = only on tick)
+OPTION(client_aio_threads, OPT_INT, 8)  // threads for async io ops that may block; cached reads don't use one
 OPTION(client_trace, OPT_STR, "")
+OPTION(client_trace_binary, OPT_BOOL, false)  // write client_trace as per-thread records with timestamps, for replay
+OPTION(client_read_direct_min, OPT_U64, 4*1024*1024)  // reads at least this big skip the object cacher (0 = never)
 OPTION(client_readahead_min, OPT_LONGLONG, 128*1024)  // readahead at _least_ this much.
 OPTION(client_readahead_max_bytes, OPT_LONGLONG, 0)  //8 * 1024*1024
 OPTION(client_readahead_max_periods, OPT_LONGLONG, 4)  // as multiple of file layout period (object size * num stripes)
@@ -129,20 +176,33 @@ OPTION(client_oc_size, OPT_INT, 1024*1024* 200)    // MB * n
 OPTION(client_oc_max_dirty, OPT_INT, 1024*1024* 100)    // MB * n  (dirty OR tx.. bigish)
 OPTION(client_oc_target_dirty, OPT_INT, 1024*1024* 8) // target dirty (keep this smallish)
 // note: the max amount of "in flight" dirty data is roughly (max - target)
+OPTION(client_mem_budget, OPT_U64, 0)  // shrink the metadata and object caches to keep their estimated size below this (0 = no limit)
 OPTION(client_oc_max_sync_write, OPT_U64, 128*1024)   // sync writes >= this use wrlock
 OPTION(fuse_use_invalidate_cb, OPT_BOOL, false) // use fuse 2.8+ invalidate callback to keep page cache consistent
 OPTION(objecter_tick_interval, OPT_DOUBLE, 5.0)
 OPTION(objecter_mon_retry_interval, OPT_DOUBLE, 5.0)
 OPTION(objecter_timeout, OPT_DOUBLE, 10.0)    // before we ask for a map
 OPTION(objecter_inflight_op_bytes, OPT_U64, 1024*1024*100) //max in-flight data (both directions)
+OPTION(objecter_sg_max_ops_per_osd, OPT_INT, 4)  // in-flight pieces of one striped read per osd; 0 = no limit
+OPTION(rados_cache_max_objects, OPT_INT, 1024)  // objects in the read cache of IoCtxs with set_read_cache()
+OPTION(rados_cache_max_object_size, OPT_U64, 64 << 10)  // bigger objects are not cached
+OPTION(rados_cache_ttl, OPT_DOUBLE, 1.0)  // seconds to serve a cached object before checking its version with the osd
+OPTION(rados_completion_threads, OPT_INT, 2)  // threads running librados aio callbacks; 0 = run them in the dispatch thread, under the client lock
+OPTION(filer_max_op_size, OPT_U64, 4<<20)  // split striped i/o into object ops of at most this many bytes; 0 = one op per object
+OPTION(filer_max_probe_ops, OPT_INT, 16)   // objects stat'ed at once when probing for a file's size
+OPTION(filer_max_purge_ops, OPT_INT, 32)   // objects removed at once when purging a file range
 OPTION(journaler_allow_split_entries, OPT_BOOL, true)
 OPTION(journaler_write_head_interval, OPT_INT, 15)
 OPTION(journaler_prefetch_periods, OPT_INT, 10)   // * journal object size
 OPTION(journaler_prezero_periods, OPT_INT, 5)     // * journal object size
 OPTION(journaler_batch_interval, OPT_DOUBLE, .001)   // seconds.. max add'l latency we artificially incur
 OPTION(journaler_batch_max, OPT_U64, 0)  // max bytes we'll delay flushing; disable, for now....
+OPTION(journaler_group_commit, OPT_BOOL, true)  // hold flushes while an earlier flush is in flight
+OPTION(journaler_group_commit_max, OPT_U64, 4<<20)  // but never hold more than this many bytes
 OPTION(mds_max_file_size, OPT_U64, 1ULL << 40)
 OPTION(mds_cache_size, OPT_INT, 100000)
+OPTION(mds_recall_state_max_caps, OPT_INT, 30000)  // most caps we ask a client to release at once
+OPTION(mds_recall_state_timeout, OPT_FLOAT, 60)    // before we ask again, and warn
 OPTION(mds_cache_mid, OPT_FLOAT, .7)
 OPTION(mds_mem_max, OPT_INT, 1048576)        // KB
 OPTION(mds_dir_commit_ratio, OPT_FLOAT, .5)
@@ -158,15 +218,23 @@ OPTION(mds_reconnect_timeout, OPT_FLOAT, 45)  // seconds to wait for clients dur
 OPTION(mds_tick_interval, OPT_FLOAT, 5)
 OPTION(mds_dirstat_min_interval, OPT_FLOAT, 1)    // try to avoid propagating more often than this
 OPTION(mds_scatter_nudge_interval, OPT_FLOAT, 5)  // how quickly dirstat changes propagate up the hierarchy
+OPTION(mds_max_purge_files, OPT_INT, 64)      // strays purged in parallel
+OPTION(mds_max_purge_ops_per_sec, OPT_INT, 0)  // object removals started per second by stray purging, 0 = no limit
+OPTION(mds_rstat_lazy, OPT_BOOL, true)  // leave rstat-only deltas in the dirfrag; propagate on nudge or dir getattr
 OPTION(mds_client_prealloc_inos, OPT_INT, 1000)
 OPTION(mds_early_reply, OPT_BOOL, true)
 OPTION(mds_use_tmap, OPT_BOOL, true)        // use trivialmap for dir updates
+OPTION(mds_readdir_max_bytes, OPT_INT, 1 << 20)  // largest readdir reply we'll build
+OPTION(mds_use_omap, OPT_BOOL, false)       // convert dirs (and the session table) to object map keys; needs omap-capable osds
+OPTION(mds_sessionmap_keys_per_op, OPT_INT, 1024)  // sessions read per op when loading
 OPTION(mds_default_dir_hash, OPT_INT, CEPH_STR_HASH_RJENKINS)
 OPTION(mds_log, OPT_BOOL, true)
 OPTION(mds_log_skip_corrupt_events, OPT_BOOL, false)
 OPTION(mds_log_max_events, OPT_INT, -1)
 OPTION(mds_log_max_segments, OPT_INT, 30)  // segment size defined by FileLayout, above
 OPTION(mds_log_max_expiring, OPT_INT, 20)
+OPTION(mds_log_max_replay_bytes, OPT_U64, 1<<30)  // expire segments further than this from the head (0 = no limit)
+OPTION(mds_replay_batch_events, OPT_INT, 64)   // events read and decoded per pass during replay
 OPTION(mds_log_eopen_size, OPT_INT, 100)   // # open inodes per log entry
 OPTION(mds_bal_sample_interval, OPT_FLOAT, 3.0)  // every 5 seconds
 OPTION(mds_bal_replicate_threshold, OPT_FLOAT, 8000)
@@ -191,6 +259,10 @@ OPTION(mds_bal_need_min, OPT_FLOAT, .8)       // take within this range of what
 OPTION(mds_bal_need_max, OPT_FLOAT, 1.2)
 OPTION(mds_bal_midchunk, OPT_FLOAT, .3)       // any sub bigger than this taken in full
 OPTION(mds_bal_minchunk, OPT_FLOAT, .001)     // never take anything smaller than this
+OPTION(mds_bal_export_max_items, OPT_INT, 1000000) // subtree items we may migrate away per rebalance (0 = no limit)
+OPTION(mds_bal_import_hold_epochs, OPT_INT, 3) // don't rebalance away an import for this many epochs
+OPTION(mds_export_max_items, OPT_INT, 50000)  // export bigger cached subtrees in pieces (0 = never split)
+OPTION(mds_export_max_concurrent, OPT_INT, 5)  // exports in flight at once from the export queue
 OPTION(mds_bal_target_removal_min, OPT_INT, 5) // min balance iterations before old target is removed
 OPTION(mds_bal_target_removal_max, OPT_INT, 10) // max balance iterations before old target is removed
 OPTION(mds_replay_interval, OPT_FLOAT, 1.0) // time to wait before starting replay again
@@ -231,6 +303,7 @@ OPTION(osd_pg_bits, OPT_INT, 6)  // bits per osd
 OPTION(osd_pgp_bits, OPT_INT, 6)  // bits per osd
 OPTION(osd_lpg_bits, OPT_INT, 2)  // bits per osd
 OPTION(osd_pg_layout, OPT_INT, CEPH_PG_LAYOUT_CRUSH)
+OPTION(osd_pg_split_max_per_tick, OPT_INT, 8)  // parent pgs split at once; the rest wait for the next tick (0 = no limit)
 OPTION(osd_min_rep, OPT_INT, 1)
 OPTION(osd_max_rep, OPT_INT, 10)
 OPTION(osd_min_raid_width, OPT_INT, 3)
@@ -241,13 +314,24 @@ OPTION(osd_pool_default_pg_num, OPT_INT, 8)
 OPTION(osd_pool_default_pgp_num, OPT_INT, 8)
 OPTION(osd_map_cache_max, OPT_INT, 250)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
+OPTION(osd_map_gossip_fanout, OPT_INT, 2)  // forward each new map to this many random peers
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
+OPTION(osd_op_num_shards, OPT_INT, 1)  // op queues, each with osd_op_threads threads; pgs are hashed onto them
+OPTION(osd_op_thread_cpus, OPT_STR, "")   // cpu list for the op threads; empty for any
+OPTION(osd_cpus, OPT_STR, "")         // cpu list for the whole daemon; overrides osd_numa_node
+OPTION(osd_numa_node, OPT_INT, -1)    // run on this node's cpus and prefer its memory; -1 for no placement
+OPTION(osd_numa_auto, OPT_BOOL, false)  // with osd_numa_node -1, use the node of our nics and disks
 OPTION(osd_max_opq, OPT_INT, 10)
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_recovery_threads, OPT_INT, 1)
+OPTION(osd_peering_threads, OPT_INT, 2)  // peering runs here, under the pg lock only
+OPTION(osd_peering_wq_batch_size, OPT_INT, 20)  // pgs per peering pass; their messages are batched per peer
+OPTION(osd_load_pgs_threads, OPT_INT, 4)  // read pg state in parallel at startup
+OPTION(osd_snap_trim_threads, OPT_INT, 2)  // pgs trimming snaps at once
 OPTION(osd_op_thread_timeout, OPT_INT, 30)
 OPTION(osd_backlog_thread_timeout, OPT_INT, 60*60*1)
 OPTION(osd_recovery_thread_timeout, OPT_INT, 30)
+OPTION(osd_peering_thread_timeout, OPT_INT, 30)
 OPTION(osd_snap_trim_thread_timeout, OPT_INT, 60*60*1)
 OPTION(osd_scrub_thread_timeout, OPT_INT, 60)
 OPTION(osd_scrub_finalize_thread_timeout, OPT_INT, 60*10)
@@ -260,19 +344,46 @@ OPTION(osd_mon_heartbeat_interval, OPT_INT, 30)  // if no peers, ping monitor
 OPTION(osd_heartbeat_grace, OPT_INT, 20)
 OPTION(osd_mon_report_interval_max, OPT_INT, 120)
 OPTION(osd_mon_report_interval_min, OPT_INT, 5)  // pg stats, failures, up_thru, boot.
+OPTION(osd_pg_stat_resend_interval, OPT_INT, 30)  // resend unacked, unchanged pg stats this often
 OPTION(osd_min_down_reporters, OPT_INT, 1)   // number of OSDs who need to report a down OSD for it to count
 OPTION(osd_min_down_reports, OPT_INT, 3)     // number of times a down OSD must be reported for it to count
 OPTION(osd_default_data_pool_replay_window, OPT_INT, 45)
 OPTION(osd_preserve_trimmed_log, OPT_BOOL, true)
+OPTION(osd_pg_log_keyed, OPT_BOOL, true)  // keep pg logs as omap entries, one per log entry, when the store supports omap
 OPTION(osd_auto_mark_unfound_lost, OPT_BOOL, false)
 OPTION(osd_recovery_delay_start, OPT_FLOAT, 15)
 OPTION(osd_recovery_max_active, OPT_INT, 5)
 OPTION(osd_recovery_max_chunk, OPT_U64, 1<<20)  // max size of push chunk
+OPTION(osd_backfill, OPT_BOOL, false)  // refill far-behind replicas by walking the collection instead of building a backlog; needs hash-ordered (HashIndex) collections
+OPTION(osd_backfill_scan_max, OPT_INT, 64)  // objects queued per backfill scan
+OPTION(osd_recovery_push_dirty_extents, OPT_BOOL, true)  // push replicas only what changed since the version they have, if the log says
+OPTION(osd_sparse_clones, OPT_BOOL, true)  // where clone copies data, copy only what the head overwrites
 OPTION(osd_recovery_forget_lost_objects, OPT_BOOL, false)   // off for now
+OPTION(osd_sched_op_cost, OPT_U64, 4096)   // cost of one op, in bytes, for background pacing
+OPTION(osd_op_history_size, OPT_U32, 20)   // slowest recent client ops kept for the admin socket; 0 = none
+OPTION(osd_op_history_duration, OPT_U32, 600)   // seconds an op stays in that history
+OPTION(osd_client_op_rate_limit, OPT_U64, 0)   // ops/sec each client may have admitted; 0 = no limit
+OPTION(osd_client_byte_rate_limit, OPT_U64, 0)   // bytes/sec each client may have admitted; 0 = no limit
+OPTION(osd_sched_client_lat_target, OPT_DOUBLE, 0)   // throttle background work while avg client op latency (sec) exceeds this; 0 = never
+OPTION(osd_sched_recovery_res, OPT_U64, 4<<20)   // cost/sec recovery may always use
+OPTION(osd_sched_recovery_lim, OPT_U64, 0)       // cost/sec recovery may never exceed; 0 = no limit
+OPTION(osd_sched_recovery_wgt, OPT_INT, 4)       // share of the background budget when throttled
+OPTION(osd_sched_scrub_res, OPT_U64, 1<<20)
+OPTION(osd_sched_scrub_lim, OPT_U64, 0)
+OPTION(osd_sched_scrub_wgt, OPT_INT, 1)
+OPTION(osd_sched_snaptrim_res, OPT_U64, 1<<20)
+OPTION(osd_sched_snaptrim_lim, OPT_U64, 0)
+OPTION(osd_sched_snaptrim_wgt, OPT_INT, 2)
+OPTION(osd_snap_trim_batch, OPT_INT, 16)   // objects trimmed per pass over a pg
+OPTION(osd_snap_trim_max_in_flight, OPT_INT, 64)   // trim updates a pg may have outstanding
 OPTION(osd_max_scrubs, OPT_INT, 1)
 OPTION(osd_scrub_load_threshold, OPT_FLOAT, 0.5)
 OPTION(osd_scrub_min_interval, OPT_FLOAT, 300)
 OPTION(osd_scrub_max_interval, OPT_FLOAT, 60*60*24)   // once a day
+OPTION(osd_scrub_chunk_max, OPT_INT, 25)   // objects per scrub chunk; writes wait only for their own chunk.  0 scrubs the whole pg at once
+OPTION(osd_deep_scrub, OPT_BOOL, false)    // also read and crc32c object data while scrubbing
+OPTION(osd_deep_scrub_stride, OPT_INT, 524288)
+OPTION(osd_deep_scrub_bytes_per_sec, OPT_U64, 0)   // cap on deep scrub reads per pg, 0 for none
 OPTION(osd_auto_weight, OPT_BOOL, false)
 OPTION(osd_class_error_timeout, OPT_DOUBLE, 60.0)  // seconds
 OPTION(osd_class_timeout, OPT_DOUBLE, 60*60.0) // seconds
@@ -281,20 +392,39 @@ OPTION(osd_check_for_log_corruption, OPT_BOOL, false)
 OPTION(osd_use_stale_snap, OPT_BOOL, false)
 OPTION(osd_rollback_to_cluster_snap, OPT_STR, "")
 OPTION(osd_max_notify_timeout, OPT_U32, 30) // max notify timeout in seconds
+// send reads of clones at least this big straight from the object file (0 =
+// never).  the data goes out as the file is at send time, so heads, which are
+// overwritten in place, are always copied.  needs ms_nocrc, or the crc reads
+// it in
+OPTION(osd_read_zero_copy_min, OPT_U32, 0)
+OPTION(osd_checksum_chunk, OPT_U64, 4<<20)  // read size when computing a CHECKSUM op
+OPTION(osd_background_read_dontneed, OPT_BOOL, true) // keep scrub/recovery io out of the page cache
+OPTION(osd_object_context_cache_max, OPT_INT, 64)  // unreferenced object contexts kept per pg, on the primary
+OPTION(osd_fast_read, OPT_BOOL, false)  // do plain reads without holding the pg lock (see ReplicatedPG::do_fast_read)
+OPTION(osd_coalesce_max_ops, OPT_INT, 16)  // merge up to this many queued writes from one client to one object (0/1 = off)
+OPTION(osd_coalesce_max_bytes, OPT_U64, 1<<20)  // ...as long as their data adds up to no more than this
+OPTION(osd_agent_max_ops, OPT_INT, 4)     // cache tier flushes a pg may have outstanding
+OPTION(osd_agent_scan_max, OPT_INT, 64)   // cache tier objects the agent looks at per pass over a pg
 OPTION(filestore, OPT_BOOL, false)
 OPTION(filestore_max_sync_interval, OPT_DOUBLE, 5)    // seconds
 OPTION(filestore_min_sync_interval, OPT_DOUBLE, .01)  // seconds
 OPTION(filestore_fake_attrs, OPT_BOOL, false)
+OPTION(filestore_attr_cache_size, OPT_INT, 1024)  // objects whose xattrs we keep in memory; 0 = off
+OPTION(filestore_extent_cache_size, OPT_INT, 1024)  // objects whose FIEMAP extents we keep in memory; 0 = off
 OPTION(filestore_fake_collections, OPT_BOOL, false)
 OPTION(filestore_dev, OPT_STR, "")
 OPTION(filestore_btrfs_trans, OPT_BOOL, false)
 OPTION(filestore_btrfs_snap, OPT_BOOL, true)
 OPTION(filestore_btrfs_clone_range, OPT_BOOL, true)
+OPTION(filestore_btrfs_snap_pipeline, OPT_BOOL, false)  // wait for async snaps off the sync thread
 OPTION(filestore_fsync_flushes_journal_data, OPT_BOOL, false)
 OPTION(filestore_fiemap, OPT_BOOL, true)     // (try to) use fiemap
 OPTION(filestore_flusher, OPT_BOOL, true)
 OPTION(filestore_flusher_max_fds, OPT_INT, 512)
+OPTION(filestore_flusher_coalesce_max_age, OPT_DOUBLE, 0)  // hold dirty ranges this long (sec) to merge them; 0 = flush asap
+OPTION(filestore_flusher_coalesce_max_bytes, OPT_U64, 4 << 20)  // ...unless this much of the object is dirty
 OPTION(filestore_sync_flush, OPT_BOOL, false)
+OPTION(filestore_odirect_min_size, OPT_U64, 0)  // write page-aligned writes at least this big with O_DIRECT; 0 = never
 OPTION(filestore_journal_parallel, OPT_BOOL, false)
 OPTION(filestore_journal_writeahead, OPT_BOOL, false)
 OPTION(filestore_journal_trailing, OPT_BOOL, false)
@@ -303,21 +433,34 @@ OPTION(filestore_queue_max_bytes, OPT_INT, 100 << 20)
 OPTION(filestore_queue_committing_max_ops, OPT_INT, 500)        // this is ON TOP of filestore_queue_max_*
 OPTION(filestore_queue_committing_max_bytes, OPT_INT, 100 << 20) //  "
 OPTION(filestore_op_threads, OPT_INT, 2)
+OPTION(filestore_op_thread_cpus, OPT_STR, "")   // cpu list for the apply threads; empty for any
 OPTION(filestore_op_thread_timeout, OPT_INT, 60)
 OPTION(filestore_op_thread_suicide_timeout, OPT_INT, 180)
+OPTION(filestore_op_finisher_threads, OPT_INT, 2)      // onreadable callbacks, ordered per sequencer
+OPTION(filestore_ondisk_finisher_threads, OPT_INT, 2)  // ondisk callbacks, ordered per sequencer
 OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
+OPTION(filestore_alloc_hint_extsize, OPT_BOOL, true)     // on xfs, use alloc hints as extent size hints
+OPTION(filestore_alloc_hint_fallocate, OPT_BOOL, false)  // preallocate the expected object size (space is used up front)
+OPTION(filestore_alloc_hint_max_size, OPT_U64, 64 << 20) // ignore hints beyond this
 OPTION(filestore_merge_threshold, OPT_INT, 10)
 OPTION(filestore_split_multiple, OPT_INT, 2)
 OPTION(filestore_update_collections, OPT_BOOL, false)
+OPTION(filestore_split_background, OPT_BOOL, false)  // split/merge index dirs off the write path
+OPTION(filestore_list_cache_collections, OPT_INT, 32)  // collections whose sorted listing we cache
 OPTION(journal_dio, OPT_BOOL, true)
+OPTION(journal_write_thread_cpus, OPT_STR, "")   // cpu list for the journal writer; empty for any
+OPTION(journal_aio, OPT_BOOL, false)   // keep several writes in flight (block devices only)
 OPTION(journal_block_align, OPT_BOOL, true)
 OPTION(journal_max_write_bytes, OPT_INT, 10 << 20)
 OPTION(journal_max_write_entries, OPT_INT, 100)
 OPTION(journal_queue_max_ops, OPT_INT, 500)
 OPTION(journal_queue_max_bytes, OPT_INT, 100 << 20)
 OPTION(journal_align_min_size, OPT_INT, 64 << 10)  // align data payloads >= this.
+OPTION(journal_zero_extent_min, OPT_INT, 0)  // elide zero pages from entries with >= this many zero bytes (0 = off)
 OPTION(journal_replay_from, OPT_INT, 0)
+OPTION(journal_replay_readahead, OPT_INT, 16 << 20)  // read the journal this much at a time during replay (0 = per piece)
+OPTION(journal_replay_queue_max_bytes, OPT_U64, 256 << 20)  // entries read and decoded ahead of the replay
 OPTION(bdev_lock, OPT_BOOL, true)
 OPTION(bdev_iothreads, OPT_INT, 1)         // number of ios to queue with kernel
 OPTION(bdev_idle_kick_after_ms, OPT_INT, 100)  // ms
@@ -331,24 +474,60 @@ OPTION(bdev_fake_max_mb, OPT_INT, 0)
 OPTION(debug_rgw, OPT_INT, 20)                 // log level for the Rados gateway
 OPTION(rgw_cache_enabled, OPT_BOOL, false)   // rgw cache enabled
 OPTION(rgw_cache_lru_size, OPT_INT, 10000)   // num of entries in rgw cache
+OPTION(rgw_cache_shards, OPT_INT, 16)   // independently locked parts of the rgw cache
+OPTION(rgw_acl_cache_size, OPT_INT, 1000)   // distinct decoded acl policies remembered; 0 = decode every time
+OPTION(rgw_cache_negative_ttl, OPT_DOUBLE, 10)   // seconds to remember that an object doesn't exist
+OPTION(rgw_cache_notify_batch, OPT_BOOL, true)   // coalesce concurrent invalidations; older gateways ignore batches
 OPTION(rgw_socket_path, OPT_STR, "")   // path to unix domain socket, if not specified, rgw will not run as external fcgi
+OPTION(rgw_frontend_port, OPT_INT, 0)   // serve http on this port ourselves instead of fastcgi; 0 = fastcgi
+OPTION(rgw_frontend_addr, OPT_STR, "")   // address to serve http on, default any
+OPTION(rgw_frontend_timeout, OPT_INT, 30)   // seconds an http connection may sit idle or stall
 OPTION(rgw_dns_name, OPT_STR, "")
 OPTION(rgw_swift_url, OPT_STR, "")              // 
 OPTION(rgw_swift_url_prefix, OPT_STR, "swift")  // 
+OPTION(rgw_swift_token_cache_size, OPT_INT, 10000)  // validated swift tokens remembered until they expire; 0 = none
+OPTION(rgw_swift_token_refresh_window, OPT_DOUBLE, 60)  // revalidate a cached token in the background this long before it expires
 OPTION(rgw_print_continue, OPT_BOOL, true)  // enable if 100-Continue works
+OPTION(rgw_formatter_chunk_size, OPT_INT, 32*1024)  // listings are sent in pieces this big as they're formatted; 0 = whole
 OPTION(rgw_remote_addr_param, OPT_STR, "REMOTE_ADDR")  // e.g. X-Forwarded-For, if you have a reverse proxy
 OPTION(rgw_op_thread_timeout, OPT_INT, 10*60)
 OPTION(rgw_op_thread_suicide_timeout, OPT_INT, 0)
 OPTION(rgw_thread_pool_size, OPT_INT, 100)
+OPTION(rgw_bucket_index_shards, OPT_INT, 0)  // index objects per new bucket (0 = one, unsharded)
+OPTION(rgw_get_obj_window, OPT_INT, 8)  // chunk reads kept in flight ahead of the client by a GET
+OPTION(rgw_put_obj_chunk_size, OPT_INT, 512*1024)  // PUT data is read from the client and written in chunks this big
+OPTION(rgw_put_obj_window, OPT_INT, 16)  // max chunk writes in flight per PUT
+OPTION(rgw_put_obj_window_bytes, OPT_U64, 64<<20)  // max bytes of chunk writes in flight per PUT (0 = no limit)
 OPTION(rgw_maintenance_tick_interval, OPT_DOUBLE, 10.0)
 OPTION(rgw_pools_preallocate_max, OPT_INT, 100)
 OPTION(rgw_pools_preallocate_threshold, OPT_INT, 70)
 OPTION(rgw_log_nonexistent_bucket, OPT_BOOL, false)
 OPTION(rgw_log_object_name, OPT_STR, "%Y-%m-%d-%H-%i-%n")      // man date to see codes (a subset are supported)
 OPTION(rgw_log_object_name_utc, OPT_BOOL, false)
+OPTION(rgw_log_object_shards, OPT_INT, 1)   // range of %s in rgw_log_object_name, picked by object name
+OPTION(rgw_log_flush_interval, OPT_DOUBLE, 1.0)   // seconds log entries are buffered before appending; 0 = append each
+OPTION(rgw_log_flush_bytes, OPT_INT, 1<<20)   // flush sooner once this much is buffered
 OPTION(rgw_intent_log_object_name, OPT_STR, "%Y-%m-%d-%i-%n")  // man date to see codes (a subset are supported)
 OPTION(rgw_intent_log_object_name_utc, OPT_BOOL, false)
+OPTION(rgw_enable_gc, OPT_BOOL, true)   // defer removal of shadow objects and parts to the gc queues
+OPTION(rgw_enable_gc_threads, OPT_BOOL, true)   // process the gc queues in this gateway
+OPTION(rgw_gc_max_objs, OPT_INT, 32)   // gc queue objects; entries are spread over them by tag
+OPTION(rgw_gc_obj_min_wait, OPT_INT, 2 * 60 * 60)   // seconds before a queued object may be removed
+OPTION(rgw_gc_processor_period, OPT_INT, 60 * 60)   // seconds between gc passes
+OPTION(rgw_gc_processor_max_time, OPT_INT, 60 * 60)   // max seconds a gc pass may run
+OPTION(rgw_gc_threads, OPT_INT, 2)   // gc workers per gateway, each with its share of the queues
+OPTION(rgw_gc_max_removes_per_sec, OPT_DOUBLE, 0)   // limit on gc removals per gateway; 0 = none
 OPTION(rbd_writeback_window, OPT_INT, 0 /*8 << 20*/) // rbd writeback window size, bytes
+OPTION(rbd_concurrent_management_ops, OPT_INT, 10) // objects removed in parallel on remove/shrink
+OPTION(rbd_object_map, OPT_BOOL, false) // create new images with a map of which objects exist
+OPTION(rbd_alloc_hint, OPT_BOOL, true) // tell the osds that data objects grow to the object size
+OPTION(rbd_default_stripe_unit, OPT_U64, 0) // stripe unit of new images, bytes; 0 = the object size
+OPTION(rbd_default_stripe_count, OPT_U64, 1) // objects a new image stripes over; 1 = unstriped
+OPTION(rbd_cache, OPT_BOOL, false) // whether to cache image data with an ObjectCacher (write-back)
+OPTION(rbd_cache_size, OPT_LONGLONG, 32<<20)         // cache size in bytes
+OPTION(rbd_cache_max_dirty, OPT_LONGLONG, 24<<20)    // writes block while dirty+writing bytes reach this
+OPTION(rbd_cache_target_dirty, OPT_LONGLONG, 16<<20) // start writeback above this many dirty bytes
+OPTION(rbd_cache_max_dirty_age, OPT_DOUBLE, 1.0)     // seconds dirty data may sit before writeback
 
 // This will be set to true when it is safe to start threads.
 // Once it is true, it will never change.
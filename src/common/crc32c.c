@@ -0,0 +1,51 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * pick the fastest crc32c implementation the cpu supports, once, on
+ * first use.
+ */
+
+#include <stdint.h>
+
+#include "include/crc32c.h"
+#include "common/crc32c_intel_fast.h"
+
+typedef uint32_t (*ceph_crc32c_func_t)(uint32_t crc, unsigned char const *data, unsigned length);
+
+static uint32_t crc32c_choose(uint32_t crc, unsigned char const *data, unsigned length);
+
+static ceph_crc32c_func_t crc32c_func = crc32c_choose;
+
+static ceph_crc32c_func_t ceph_choose_crc32(void)
+{
+	if (ceph_crc32c_intel_fast_exists())
+		return ceph_crc32c_intel_fast;
+	return ceph_crc32c_sctp;
+}
+
+/*
+ * the first caller(s) land here.  racing callers will all store the
+ * same value, so no locking is needed.
+ */
+static uint32_t crc32c_choose(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	crc32c_func = ceph_choose_crc32();
+	return crc32c_func(crc, data, length);
+}
+
+uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	return crc32c_func(crc, data, length);
+}
@@ -0,0 +1,103 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * crc32c using the SSE4.2 crc32 instruction.
+ *
+ * The instruction is emitted with inline asm so that the rest of the
+ * tree does not need to be built with -msse4.2; callers must check
+ * ceph_crc32c_intel_fast_exists() before using it.
+ */
+
+#include "common/crc32c_intel_fast.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+
+#define CPUID_ECX_SSE42 (1 << 20)
+
+int ceph_crc32c_intel_fast_exists(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (ecx & CPUID_ECX_SSE42) != 0;
+}
+
+static inline uint32_t crc32c_u8(uint32_t crc, uint8_t v)
+{
+	__asm__("crc32b %1, %0" : "+r" (crc) : "rm" (v));
+	return crc;
+}
+
+static inline uint32_t crc32c_u32(uint32_t crc, uint32_t v)
+{
+	__asm__("crc32l %1, %0" : "+r" (crc) : "rm" (v));
+	return crc;
+}
+
+#ifdef __x86_64__
+static inline uint64_t crc32c_u64(uint64_t crc, uint64_t v)
+{
+	__asm__("crc32q %1, %0" : "+r" (crc) : "rm" (v));
+	return crc;
+}
+#endif
+
+uint32_t ceph_crc32c_intel_fast(uint32_t crc, unsigned char const *buffer, unsigned len)
+{
+	/* get to a word boundary first */
+	while (len && ((uintptr_t)buffer & 7)) {
+		crc = crc32c_u8(crc, *buffer++);
+		len--;
+	}
+
+#ifdef __x86_64__
+	{
+		uint64_t crc64 = crc;
+		while (len >= 8) {
+			crc64 = crc32c_u64(crc64, *(const uint64_t *)buffer);
+			buffer += 8;
+			len -= 8;
+		}
+		crc = (uint32_t)crc64;
+	}
+#endif
+	while (len >= 4) {
+		crc = crc32c_u32(crc, *(const uint32_t *)buffer);
+		buffer += 4;
+		len -= 4;
+	}
+	while (len) {
+		crc = crc32c_u8(crc, *buffer++);
+		len--;
+	}
+	return crc;
+}
+
+#else
+
+int ceph_crc32c_intel_fast_exists(void)
+{
+	return 0;
+}
+
+uint32_t ceph_crc32c_intel_fast(uint32_t crc, unsigned char const *buffer, unsigned len)
+{
+	return ceph_crc32c_sctp(crc, buffer, len);
+}
+
+#endif
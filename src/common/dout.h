@@ -49,7 +49,10 @@ public:
   pthread_mutex_t *lock;
 };
 
-static inline void _dout_begin_line(CephContext *cct, signed int prio) {
+static inline void _dout_begin_line(CephContext *cct, signed int prio,
+				    bool write) {
+  cct->_doss->set_gather_only(!write);
+
   // Put priority information into dout
   cct->_doss->sputc(prio + 12);
 
@@ -71,26 +74,28 @@ inline std::ostream& operator<<(std::ostream& out, _bad_endl_use_dendl_t) {
 #define DOUT_CONDVAR(cct, x) cct->_conf->debug_ ## x
 #define XDOUT_CONDVAR(cct, x) DOUT_CONDVAR(cct, x)
 #define DOUT_COND(cct, l) l <= XDOUT_CONDVAR(cct, DOUT_SUBSYS)
+// lines that aren't written may still be kept in the recent lines
+#define DOUT_GATHER(cct, l) l <= cct->_conf->log_recent_level
 
 // The array declaration will trigger a compiler error if 'l' is
 // out of range
-#define dout_impl(cct, v) \
+#define dout_impl(cct, v, w) \
   if (0) {\
     char __array[((v >= -1) && (v <= 200)) ? 0 : -1] __attribute__((unused)); \
   }\
   DoutLocker __dout_locker; \
   cct->dout_lock(&__dout_locker); \
-  _dout_begin_line(cct, v); \
+  _dout_begin_line(cct, v, w); \
 
 #define ldout(cct, v) \
-  do { if (DOUT_COND(cct, v)) {\
-    dout_impl(cct, v) \
+  do { if ((DOUT_COND(cct, v)) || (DOUT_GATHER(cct, v))) {\
+    dout_impl(cct, v, (DOUT_COND(cct, v))) \
     std::ostream* _dout = &(cct->_dout); \
     dout_prefix
 
 #define lpdout(cct, v, p) \
   do { if ((v) <= (p)) {\
-    dout_impl(cct, v) \
+    dout_impl(cct, v, true) \
     std::ostream* _dout = &(cct->_dout); \
     *_dout
 
@@ -24,6 +24,8 @@
 #define DOUT_SUBSYS lockdep
 #undef DOUT_COND
 #define DOUT_COND(cct, l) cct && l <= XDOUT_CONDVAR(cct, DOUT_SUBSYS)
+#undef DOUT_GATHER
+#define DOUT_GATHER(cct, l) cct && l <= cct->_conf->log_recent_level
 #define lockdep_dout(v) ldout(g_lockdep_ceph_ctx, v)
 #define MAX_LOCKS  100   // increase me as needed
 #define BACKTRACE_SKIP 3
@@ -0,0 +1,263 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+#include "BackTrace.h"
+#include "common/Formatter.h"
+#include "common/environment.h"
+#include "lockstat.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+/******* Constants **********/
+#define MAX_LOCKSTAT  1024   // lock names
+#define BACKTRACE_SKIP 3
+
+/******* Globals **********/
+int g_lockstat = get_env_int("CEPH_LOCKSTAT");
+int g_lockstat_sample = 64;
+
+struct lockstat_stopper_t {
+  // stop accounting when this module destructs.
+  ~lockstat_stopper_t() {
+    g_lockstat = 0;
+  }
+};
+static lockstat_stopper_t lockstat_stopper;
+
+struct lockstat_sample_t {
+  uint64_t wait_ns;
+  ceph::BackTrace bt;
+  lockstat_sample_t() : wait_ns(0), bt(BACKTRACE_SKIP) {}
+};
+
+// plain old data, so it is usable from static constructors and destructors
+struct lockstat_entry_t {
+  char *name;
+  uint64_t acquired, contended;
+  uint64_t wait_ns, max_wait_ns;
+  uint64_t released, hold_ns, max_hold_ns;
+  uint64_t sample_count;
+  lockstat_sample_t *worst;   // longest sampled wait
+};
+
+static pthread_mutex_t lockstat_lock = PTHREAD_MUTEX_INITIALIZER;
+static lockstat_entry_t entries[MAX_LOCKSTAT];
+static int num_entries = 0;
+
+static std::map<std::string, int>& lockstat_ids()
+{
+  static std::map<std::string, int> *ids = new std::map<std::string, int>;
+  return *ids;
+}
+
+/******* Functions **********/
+uint64_t lockstat_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int lockstat_register(const char *name)
+{
+  int id = -1;
+  pthread_mutex_lock(&lockstat_lock);
+  std::map<std::string, int>& ids = lockstat_ids();
+  std::map<std::string, int>::iterator p = ids.find(name);
+  if (p != ids.end()) {
+    id = p->second;
+  } else if (num_entries < MAX_LOCKSTAT) {
+    id = num_entries;
+    entries[id].name = strdup(name);
+    ids[name] = id;
+    __sync_synchronize();
+    num_entries++;
+  }
+  pthread_mutex_unlock(&lockstat_lock);
+  return id;
+}
+
+// -1: not looked up yet, -2: no room for it
+static inline int lockstat_get_id(const char *name, int *id)
+{
+  if (*id == -1) {
+    *id = lockstat_register(name);
+    if (*id < 0)
+      *id = -2;
+  }
+  return *id;
+}
+
+static void update_max(uint64_t *m, uint64_t v)
+{
+  uint64_t old;
+  while ((old = *m) < v && !__sync_bool_compare_and_swap(m, old, v))
+    ;
+}
+
+static lockstat_sample_t *maybe_sample(lockstat_entry_t& e)
+{
+  int every = g_lockstat_sample;
+  if (every <= 0 ||
+      __sync_add_and_fetch(&e.sample_count, 1) % every)
+    return NULL;
+  return new lockstat_sample_t;
+}
+
+static void acquired(lockstat_entry_t& e, bool contended, uint64_t wait,
+		     lockstat_sample_t *sample)
+{
+  __sync_add_and_fetch(&e.acquired, 1);
+  if (!contended)
+    return;
+  __sync_add_and_fetch(&e.contended, 1);
+  __sync_add_and_fetch(&e.wait_ns, wait);
+  update_max(&e.max_wait_ns, wait);
+  if (sample) {
+    sample->wait_ns = wait;
+    pthread_mutex_lock(&lockstat_lock);
+    if (!e.worst || e.worst->wait_ns < wait)
+      std::swap(e.worst, sample);
+    pthread_mutex_unlock(&lockstat_lock);
+    delete sample;
+  }
+}
+
+int lockstat_mutex_lock(pthread_mutex_t *m, const char *name, int *id)
+{
+  if (lockstat_get_id(name, id) < 0)
+    return pthread_mutex_lock(m);
+  lockstat_entry_t& e = entries[*id];
+
+  int r = pthread_mutex_trylock(m);
+  if (r == 0) {
+    acquired(e, false, 0, NULL);
+    return 0;
+  }
+  if (r != EBUSY)
+    return r;
+
+  // we will wait; any backtrace is taken while the holder runs
+  lockstat_sample_t *sample = maybe_sample(e);
+  uint64_t start = lockstat_now();
+  r = pthread_mutex_lock(m);
+  acquired(e, true, lockstat_now() - start, sample);
+  return r;
+}
+
+int lockstat_rwlock_lock(pthread_rwlock_t *l, bool write,
+			 const char *name, int *id)
+{
+  if (lockstat_get_id(name, id) < 0)
+    return write ? pthread_rwlock_wrlock(l) : pthread_rwlock_rdlock(l);
+  lockstat_entry_t& e = entries[*id];
+
+  int r = write ? pthread_rwlock_trywrlock(l) : pthread_rwlock_tryrdlock(l);
+  if (r == 0) {
+    acquired(e, false, 0, NULL);
+    return 0;
+  }
+  if (r != EBUSY)
+    return r;
+
+  lockstat_sample_t *sample = maybe_sample(e);
+  uint64_t start = lockstat_now();
+  r = write ? pthread_rwlock_wrlock(l) : pthread_rwlock_rdlock(l);
+  acquired(e, true, lockstat_now() - start, sample);
+  return r;
+}
+
+void lockstat_trylocked(const char *name, int *id)
+{
+  if (lockstat_get_id(name, id) >= 0)
+    acquired(entries[*id], false, 0, NULL);
+}
+
+void lockstat_released(int id, uint64_t hold_ns)
+{
+  if (id < 0)
+    return;
+  lockstat_entry_t& e = entries[id];
+  __sync_add_and_fetch(&e.released, 1);
+  __sync_add_and_fetch(&e.hold_ns, hold_ns);
+  update_max(&e.max_hold_ns, hold_ns);
+}
+
+static bool more_wait(int a, int b)
+{
+  return entries[a].wait_ns > entries[b].wait_ns;
+}
+
+/*
+ * Every lock name we have seen, most total wait first.  Times are in
+ * seconds.
+ */
+void lockstat_dump(ceph::Formatter *f)
+{
+  pthread_mutex_lock(&lockstat_lock);
+  std::vector<int> ids;
+  for (int i = 0; i < num_entries; i++)
+    ids.push_back(i);
+  std::sort(ids.begin(), ids.end(), more_wait);
+
+  f->open_object_section("lockstat");
+  f->dump_int("enabled", g_lockstat);
+  f->dump_int("sample", g_lockstat_sample);
+  f->open_array_section("locks");
+  for (std::vector<int>::iterator p = ids.begin(); p != ids.end(); ++p) {
+    lockstat_entry_t& e = entries[*p];
+    f->open_object_section("lock");
+    f->dump_string("name", e.name);
+    f->dump_unsigned("acquired", e.acquired);
+    f->dump_unsigned("contended", e.contended);
+    f->dump_float("wait", (double)e.wait_ns / 1000000000.0);
+    f->dump_float("max_wait", (double)e.max_wait_ns / 1000000000.0);
+    f->dump_unsigned("released", e.released);
+    f->dump_float("hold", (double)e.hold_ns / 1000000000.0);
+    f->dump_float("max_hold", (double)e.max_hold_ns / 1000000000.0);
+    if (e.worst) {
+      f->open_object_section("worst_sampled_wait");
+      f->dump_float("wait", (double)e.worst->wait_ns / 1000000000.0);
+      f->open_array_section("backtrace");
+      ceph::BackTrace& bt = e.worst->bt;
+      for (size_t i = bt.skip; i < bt.size; i++)
+	f->dump_string("frame", bt.strings[i]);
+      f->close_section();
+      f->close_section();
+    }
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+  pthread_mutex_unlock(&lockstat_lock);
+}
+
+void lockstat_reset()
+{
+  pthread_mutex_lock(&lockstat_lock);
+  for (int i = 0; i < num_entries; i++) {
+    lockstat_entry_t& e = entries[i];
+    e.acquired = e.contended = 0;
+    e.wait_ns = e.max_wait_ns = 0;
+    e.released = e.hold_ns = e.max_hold_ns = 0;
+    delete e.worst;
+    e.worst = NULL;
+  }
+  pthread_mutex_unlock(&lockstat_lock);
+}
@@ -0,0 +1,55 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_LOCKSTAT_H
+#define CEPH_LOCKSTAT_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+namespace ceph {
+  class Formatter;
+}
+
+/*
+ * Lock contention statistics, kept per lock name (so e.g. all PG locks
+ * add up together).  Mutex and RWLock report to us while g_lockstat is
+ * set, which is the case with CEPH_LOCKSTAT in the environment or the
+ * lockstat option set.  For each name we count acquisitions and
+ * contended acquisitions, and sum wait and (Mutex only) hold times; 1 in
+ * lockstat_sample contended acquisitions also takes a backtrace, and we
+ * keep the one that waited longest.
+ */
+extern int g_lockstat;
+extern int g_lockstat_sample;
+
+/// monotonic clock, in nanoseconds
+extern uint64_t lockstat_now();
+
+/*
+ * Take the lock, accounting to name.  *id caches the name's slot; start
+ * it at -1.  Returns what pthread_*_lock() did.
+ */
+extern int lockstat_mutex_lock(pthread_mutex_t *m, const char *name, int *id);
+extern int lockstat_rwlock_lock(pthread_rwlock_t *l, bool write,
+				const char *name, int *id);
+/// account a successful trylock
+extern void lockstat_trylocked(const char *name, int *id);
+/// the lock was held for hold_ns
+extern void lockstat_released(int id, uint64_t hold_ns);
+
+extern void lockstat_dump(ceph::Formatter *f);
+extern void lockstat_reset();
+
+#endif
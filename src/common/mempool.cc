@@ -0,0 +1,107 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <pthread.h>
+
+#include "common/mempool.h"
+#include "common/Formatter.h"
+
+namespace mempool {
+
+#define NUM_SHARDS 32   // power of 2
+
+/*
+ * plain words, not atomic_t: they are zero before any constructor runs,
+ * and static buffers and containers elsewhere may be set up first.
+ */
+struct shard_t {
+  size_t bytes;
+  size_t items;
+  char pad[128 - 2 * sizeof(size_t)];
+};
+
+static shard_t shards[num_pools][NUM_SHARDS];
+
+static const char *names[num_pools] = {
+  "buffer_anon",
+  "buffer_msg",
+  "osd_pglog",
+  "osd_missing",
+  "osdmap",
+  "osd_obc",
+};
+
+const char *get_pool_name(int ix)
+{
+  if (ix < 0 || ix >= num_pools)
+    return "???";
+  return names[ix];
+}
+
+static inline shard_t *pick_shard(int ix)
+{
+  // pthread_t is the thread's control block address; skip its alignment
+  size_t t = (size_t)pthread_self() >> 12;
+  return &shards[ix][t & (NUM_SHARDS - 1)];
+}
+
+void inc(int ix, size_t bytes, size_t items)
+{
+  shard_t *s = pick_shard(ix);
+  __sync_fetch_and_add(&s->bytes, bytes);
+  __sync_fetch_and_add(&s->items, items);
+}
+
+void dec(int ix, size_t bytes, size_t items)
+{
+  // a thread may free what another allocated; shards go "negative"
+  // separately, but the sum comes out right
+  shard_t *s = pick_shard(ix);
+  __sync_fetch_and_sub(&s->bytes, bytes);
+  __sync_fetch_and_sub(&s->items, items);
+}
+
+void get_stats(int ix, int64_t *bytes, int64_t *items)
+{
+  size_t b = 0, i = 0;
+  for (int n = 0; n < NUM_SHARDS; n++) {
+    b += *(volatile size_t *)&shards[ix][n].bytes;
+    i += *(volatile size_t *)&shards[ix][n].items;
+  }
+  *bytes = (int64_t)b;
+  *items = (int64_t)i;
+}
+
+void dump(ceph::Formatter *f)
+{
+  int64_t total_bytes = 0, total_items = 0;
+  f->open_object_section("mempools");
+  for (int ix = 0; ix < num_pools; ix++) {
+    int64_t bytes, items;
+    get_stats(ix, &bytes, &items);
+    f->open_object_section(names[ix]);
+    f->dump_int("bytes", bytes);
+    f->dump_int("items", items);
+    f->close_section();
+    total_bytes += bytes;
+    total_items += items;
+  }
+  f->open_object_section("total");
+  f->dump_int("bytes", total_bytes);
+  f->dump_int("items", total_items);
+  f->close_section();
+  f->close_section();
+}
+
+}
@@ -0,0 +1,131 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MEMPOOL_H
+#define CEPH_MEMPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+
+namespace ceph {
+  class Formatter;
+}
+
+/*
+ * Memory accounting by what it is used for.  Each pool counts the bytes
+ * and the number of items (container nodes, objects, buffers) allocated
+ * to it.  Containers join a pool by using pool_allocator, classes with
+ * MEMPOOL_CLASS_HELPERS, and buffers start out in buffer_anon and may be
+ * moved to another pool with reassign_to_mempool().
+ *
+ * Only what is allocated through these is counted: a container's
+ * elements' own allocations (the strings in an hobject_t, say) land in
+ * whatever pool their type uses, usually none.
+ *
+ * The counters are sharded by thread so the accounting doesn't bounce
+ * one cache line between cpus; a pool's total is summed on read.
+ */
+namespace mempool {
+
+enum {
+  buffer_anon,    // buffers nobody claimed
+  buffer_msg,     // message payloads read by the messenger
+  osd_pglog,      // pg log entries
+  osd_missing,    // pg missing sets
+  osdmap,         // OSDMap objects and the encoded map cache
+  osd_obc,        // ReplicatedPG object contexts
+  num_pools
+};
+
+const char *get_pool_name(int ix);
+
+extern void inc(int ix, size_t bytes, size_t items);
+extern void dec(int ix, size_t bytes, size_t items);
+
+/// current totals of pool ix
+extern void get_stats(int ix, int64_t *bytes, int64_t *items);
+extern void dump(ceph::Formatter *f);
+
+/*
+ * An STL allocator accounting to pool_ix, e.g.
+ *
+ *   std::list<Entry, mempool::pool_allocator<mempool::osd_pglog, Entry> >
+ */
+template<int pool_ix, typename T>
+class pool_allocator {
+public:
+  typedef T value_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template<typename U> struct rebind {
+    typedef pool_allocator<pool_ix, U> other;
+  };
+
+  pool_allocator() {}
+  pool_allocator(const pool_allocator&) {}
+  template<typename U>
+  pool_allocator(const pool_allocator<pool_ix, U>&) {}
+
+  pointer address(reference r) const { return &r; }
+  const_pointer address(const_reference r) const { return &r; }
+  size_type max_size() const { return size_t(-1) / sizeof(T); }
+
+  pointer allocate(size_type n, const void * = 0) {
+    pointer p = static_cast<pointer>(::operator new(n * sizeof(T)));
+    inc(pool_ix, n * sizeof(T), n);
+    return p;
+  }
+  void deallocate(pointer p, size_type n) {
+    dec(pool_ix, n * sizeof(T), n);
+    ::operator delete(p);
+  }
+  void construct(pointer p, const T& v) { new ((void *)p) T(v); }
+  void destroy(pointer p) { p->~T(); }
+};
+
+template<int pool_ix, typename T, typename U>
+inline bool operator==(const pool_allocator<pool_ix, T>&, const pool_allocator<pool_ix, U>&)
+{
+  return true;
+}
+template<int pool_ix, typename T, typename U>
+inline bool operator!=(const pool_allocator<pool_ix, T>&, const pool_allocator<pool_ix, U>&)
+{
+  return false;
+}
+
+}
+
+/*
+ * Put in a class body to account its heap instances to pool ix.  Only
+ * the object itself is counted, not what its members allocate.
+ */
+#define MEMPOOL_CLASS_HELPERS(ix)					\
+  void *operator new(size_t size) {					\
+    void *p = ::operator new(size);					\
+    mempool::inc(ix, size, 1);						\
+    return p;								\
+  }									\
+  void operator delete(void *p, size_t size) {				\
+    mempool::dec(ix, size, 1);						\
+    ::operator delete(p);						\
+  }
+
+#endif
@@ -0,0 +1,200 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/numa.h"
+#include "common/safe_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#endif
+
+#include <sstream>
+
+int parse_cpu_set_list(const std::string& s, cpu_set_t *cpu_set)
+{
+  CPU_ZERO(cpu_set);
+  const char *p = s.c_str();
+  bool any = false;
+  while (*p) {
+    char *end;
+    long a = strtol(p, &end, 10);
+    if (end == p || a < 0 || a >= CPU_SETSIZE)
+      return -EINVAL;
+    long b = a;
+    p = end;
+    if (*p == '-') {
+      p++;
+      b = strtol(p, &end, 10);
+      if (end == p || b < a || b >= CPU_SETSIZE)
+	return -EINVAL;
+      p = end;
+    }
+    for (long i = a; i <= b; i++)
+      CPU_SET(i, cpu_set);
+    any = true;
+    if (*p == ',')
+      p++;
+    else if (*p && *p != '\n')
+      return -EINVAL;
+    else
+      break;
+  }
+  return any ? 0 : -EINVAL;
+}
+
+std::string cpu_set_to_str_list(const cpu_set_t *cpu_set)
+{
+  std::ostringstream oss;
+  bool first = true;
+  for (int i = 0; i < CPU_SETSIZE; i++) {
+    if (!CPU_ISSET(i, cpu_set))
+      continue;
+    int j = i;
+    while (j + 1 < CPU_SETSIZE && CPU_ISSET(j + 1, cpu_set))
+      j++;
+    if (!first)
+      oss << ',';
+    first = false;
+    oss << i;
+    if (j > i)
+      oss << '-' << j;
+    i = j;
+  }
+  return oss.str();
+}
+
+/// read a (short) sysfs file, without the trailing newline
+static int read_sysfs(const std::string& fn, std::string *out)
+{
+  int fd = ::open(fn.c_str(), O_RDONLY);
+  if (fd < 0)
+    return -errno;
+  char buf[4096];
+  ssize_t r = safe_read(fd, buf, sizeof(buf) - 1);
+  ::close(fd);
+  if (r < 0)
+    return r;
+  while (r > 0 && (buf[r-1] == '\n' || buf[r-1] == ' '))
+    r--;
+  out->assign(buf, r);
+  return 0;
+}
+
+static int read_numa_node(const std::string& fn, int *node)
+{
+  std::string s;
+  int r = read_sysfs(fn, &s);
+  if (r < 0)
+    return r;
+  char *end;
+  long n = strtol(s.c_str(), &end, 10);
+  if (end == s.c_str() || *end)
+    return -EINVAL;
+  if (n < 0)
+    return -ENOENT;   // the kernel doesn't know, or there is only one node
+  *node = n;
+  return 0;
+}
+
+int get_numa_node_cpu_set(int node, cpu_set_t *cpu_set)
+{
+  std::ostringstream fn;
+  fn << "/sys/devices/system/node/node" << node << "/cpulist";
+  std::string s;
+  int r = read_sysfs(fn.str(), &s);
+  if (r < 0)
+    return r;
+  return parse_cpu_set_list(s, cpu_set);
+}
+
+int get_iface_numa_node(const std::string& iface, int *node)
+{
+  return read_numa_node("/sys/class/net/" + iface + "/device/numa_node", node);
+}
+
+int get_addr_iface(const sockaddr *addr, std::string *iface)
+{
+  struct ifaddrs *ifa;
+  if (getifaddrs(&ifa) < 0)
+    return -errno;
+  int r = -ENOENT;
+  for (struct ifaddrs *p = ifa; p; p = p->ifa_next) {
+    if (!p->ifa_addr || p->ifa_addr->sa_family != addr->sa_family)
+      continue;
+    bool match = false;
+    if (addr->sa_family == AF_INET) {
+      match = ((const sockaddr_in*)addr)->sin_addr.s_addr ==
+	((const sockaddr_in*)p->ifa_addr)->sin_addr.s_addr;
+    } else if (addr->sa_family == AF_INET6) {
+      match = memcmp(&((const sockaddr_in6*)addr)->sin6_addr,
+		     &((const sockaddr_in6*)p->ifa_addr)->sin6_addr,
+		     sizeof(struct in6_addr)) == 0;
+    }
+    if (match) {
+      *iface = p->ifa_name;
+      r = 0;
+      break;
+    }
+  }
+  freeifaddrs(ifa);
+  return r;
+}
+
+int get_path_numa_node(const std::string& path, int *node)
+{
+  struct stat st;
+  if (::stat(path.c_str(), &st) < 0)
+    return -errno;
+  dev_t dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+
+  std::ostringstream fn;
+  fn << "/sys/dev/block/" << major(dev) << ":" << minor(dev);
+  char real[PATH_MAX];
+  if (!realpath(fn.str().c_str(), real))
+    return -errno;
+  std::string dir(real);
+
+  // a partition's device is its parent disk's
+  struct stat pst;
+  if (::stat((dir + "/partition").c_str(), &pst) == 0)
+    dir = dir.substr(0, dir.rfind('/'));
+  return read_numa_node(dir + "/device/numa_node", node);
+}
+
+int set_numa_mempolicy_preferred(int node)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+  if (node < 0 || node >= (int)(sizeof(unsigned long) * 8))
+    return -EINVAL;
+  unsigned long mask = 1ul << node;
+  if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) < 0)
+    return -errno;
+  return 0;
+#else
+  return -EOPNOTSUPP;
+#endif
+}
@@ -0,0 +1,57 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_NUMA_H
+#define CEPH_COMMON_NUMA_H
+
+#include <sched.h>
+#include <sys/socket.h>
+#include <string>
+
+/*
+ * CPU and NUMA node placement helpers.  Node and device locality come
+ * from sysfs; on machines (or kernels) without that information the
+ * lookups return -ENOENT and callers should carry on unplaced.
+ */
+
+/**
+ * Parse a cpu list like "0-3,8,10-11" (the format of cpulist files in
+ * sysfs and of taskset -c).
+ *
+ * @return 0 on success, -EINVAL if s is malformed or empty
+ */
+int parse_cpu_set_list(const std::string& s, cpu_set_t *cpu_set);
+std::string cpu_set_to_str_list(const cpu_set_t *cpu_set);
+
+/// the cpus of NUMA node node
+int get_numa_node_cpu_set(int node, cpu_set_t *cpu_set);
+
+/// NUMA node the network interface iface hangs off
+int get_iface_numa_node(const std::string& iface, int *node);
+/// name of the interface that has the (IPv4 or IPv6) address addr
+int get_addr_iface(const sockaddr *addr, std::string *iface);
+/**
+ * NUMA node of the disk behind path: path's own device if it is a
+ * block device (a raw journal), else the device of the file system
+ * holding it.
+ */
+int get_path_numa_node(const std::string& path, int *node);
+
+/**
+ * Make node the preferred node for memory allocated by this thread and
+ * the threads it creates from now on.
+ */
+int set_numa_mempolicy_preferred(int node);
+
+#endif
@@ -45,6 +45,12 @@ void PerfCountersCollection::add(class PerfCounters *l)
   m_loggers.insert(l);
 }
 
+bool PerfCountersCollection::try_add(class PerfCounters *l)
+{
+  Mutex::Locker lck(m_lock);
+  return m_loggers.insert(l).second;
+}
+
 void PerfCountersCollection::remove(class PerfCounters *l)
 {
   Mutex::Locker lck(m_lock);
@@ -87,78 +93,168 @@ PerfCounters::~PerfCounters()
 {
 }
 
+/*
+ * Where 64-bit atomics are native, updates are atomic operations on the
+ * element and take no lock; elsewhere they fall back to m_lock.
+ */
+#ifdef PERFCOUNTERS_LOCKFREE
+
+#define PERFCOUNTERS_LOCK()
+
+static inline void pc_add(uint64_t *p, uint64_t v)
+{
+  __sync_fetch_and_add(p, v);
+}
+
+static inline uint64_t pc_read_u64(const uint64_t *p)
+{
+  return __sync_add_and_fetch((uint64_t *)p, 0);
+}
+
+static inline void pc_set_u64(uint64_t *p, uint64_t v)
+{
+  uint64_t o;
+  do {
+    o = *(volatile uint64_t *)p;
+  } while (!__sync_bool_compare_and_swap(p, o, v));
+}
+
+// doubles share the u64's storage (see perf_counter_data_any_d::u)
+static inline void pc_add_double(uint64_t *p, double v)
+{
+  union { double d; uint64_t u; } o, n;
+  do {
+    o.u = *(volatile uint64_t *)p;
+    n.d = o.d + v;
+  } while (!__sync_bool_compare_and_swap(p, o.u, n.u));
+}
+
+#else
+
+#define PERFCOUNTERS_LOCK() Mutex::Locker lck(m_lock)
+
+static inline void pc_add(uint64_t *p, uint64_t v)
+{
+  *p += v;
+}
+
+static inline uint64_t pc_read_u64(const uint64_t *p)
+{
+  return *p;
+}
+
+static inline void pc_set_u64(uint64_t *p, uint64_t v)
+{
+  *p = v;
+}
+
+static inline void pc_add_double(uint64_t *p, double v)
+{
+  union { double d; uint64_t u; } o;
+  o.u = *p;
+  o.d += v;
+  *p = o.u;
+}
+
+#endif
+
+static inline double pc_read_double(const uint64_t *p)
+{
+  union { double d; uint64_t u; } o;
+  o.u = pc_read_u64(p);
+  return o.d;
+}
+
 void PerfCounters::inc(int idx, uint64_t amt)
 {
-  Mutex::Locker lck(m_lock);
+  PERFCOUNTERS_LOCK();
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  data.u.u64 += amt;
+  pc_add(&data.u.u64, amt);
   if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+    pc_add(&data.avgcount, 1);
 }
 
 void PerfCounters::set(int idx, uint64_t amt)
 {
-  Mutex::Locker lck(m_lock);
+  PERFCOUNTERS_LOCK();
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  data.u.u64 = amt;
+  pc_set_u64(&data.u.u64, amt);
   if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+    pc_add(&data.avgcount, 1);
 }
 
 uint64_t PerfCounters::get(int idx) const
 {
-  Mutex::Locker lck(m_lock);
+  PERFCOUNTERS_LOCK();
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return 0;
-  return data.u.u64;
+  return pc_read_u64(&data.u.u64);
 }
 
 void PerfCounters::finc(int idx, double amt)
 {
-  Mutex::Locker lck(m_lock);
+  PERFCOUNTERS_LOCK();
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_FLOAT))
     return;
-  data.u.dbl += amt;
+  pc_add_double(&data.u.u64, amt);
   if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+    pc_add(&data.avgcount, 1);
 }
 
 void PerfCounters::fset(int idx, double amt)
 {
-  Mutex::Locker lck(m_lock);
+  PERFCOUNTERS_LOCK();
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_FLOAT))
     return;
-  data.u.dbl = amt;
+  union { double d; uint64_t u; } n;
+  n.d = amt;
+  pc_set_u64(&data.u.u64, n.u);
   if (data.type & PERFCOUNTER_LONGRUNAVG)
-    data.avgcount++;
+    pc_add(&data.avgcount, 1);
 }
 
 double PerfCounters::fget(int idx) const
 {
-  Mutex::Locker lck(m_lock);
+  PERFCOUNTERS_LOCK();
   assert(idx > m_lower_bound);
   assert(idx < m_upper_bound);
   const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_FLOAT))
     return 0.0;
-  return data.u.dbl;
+  return pc_read_double(&data.u.u64);
+}
+
+void PerfCounters::hinc(int idx, uint64_t v)
+{
+  PERFCOUNTERS_LOCK();
+  assert(idx > m_lower_bound);
+  assert(idx < m_upper_bound);
+  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  if (!(data.type & PERFCOUNTER_HISTOGRAM))
+    return;
+  int b = 0;
+  for (uint64_t t = v >> 1; t && b < PERFCOUNTER_HIST_BUCKETS - 1; t >>= 1)
+    b++;
+  pc_add(&data.buckets[b], 1);
+  pc_add(&data.u.u64, v);
+  pc_add(&data.avgcount, 1);
 }
 
 static inline void append_to_vector(std::vector <char> &buffer, char *buf)
@@ -171,8 +267,8 @@ static inline void append_to_vector(std::vector <char> &buffer, char *buf)
 
 void PerfCounters::write_json_to_buf(std::vector <char> &buffer, bool schema)
 {
-  char buf[512];
-  Mutex::Locker lck(m_lock);
+  char buf[1024];   // room for a full histogram
+  PERFCOUNTERS_LOCK();
 
   snprintf(buf, sizeof(buf), "\"%s\":{", m_name.c_str());
   append_to_vector(buffer, buf);
@@ -209,9 +305,11 @@ PerfCounters::PerfCounters(CephContext *cct, const std::string &name,
   : m_cct(cct),
     m_lower_bound(lower_bound),
     m_upper_bound(upper_bound),
-    m_name(name.c_str()),
-    m_lock_name(std::string("PerfCounters::") + name.c_str()),
+    m_name(name.c_str())
+#ifndef PERFCOUNTERS_LOCKFREE
+    , m_lock_name(std::string("PerfCounters::") + name.c_str()),
     m_lock(m_lock_name.c_str())
+#endif
 {
   m_data.resize(upper_bound - lower_bound - 1);
 }
@@ -231,16 +329,36 @@ void  PerfCounters::perf_counter_data_any_d::write_schema_json(char *buf, size_t
 
 void  PerfCounters::perf_counter_data_any_d::write_json(char *buf, size_t buf_sz) const
 {
+  uint64_t count = pc_read_u64(&avgcount);
+  uint64_t u64 = pc_read_u64(&u.u64);
+  double dbl = pc_read_double(&u.u64);
+  if (type & PERFCOUNTER_HISTOGRAM) {
+    uint64_t b[PERFCOUNTER_HIST_BUCKETS];
+    int n = buckets.size();
+    for (int i = 0; i < n; i++)
+      b[i] = pc_read_u64(&buckets[i]);
+    // buckets past the last nonempty one are left out
+    while (n > 0 && b[n - 1] == 0)
+      n--;
+    size_t len = snprintf(buf, buf_sz, "\"%s\":{\"avgcount\":%" PRId64 ","
+			  "\"sum\":%" PRId64 ",\"buckets\":[",
+			  name, count, u64);
+    for (int i = 0; i < n && len < buf_sz; i++)
+      len += snprintf(buf + len, buf_sz - len, "%s%" PRId64, i ? "," : "", b[i]);
+    if (len < buf_sz)
+      snprintf(buf + len, buf_sz - len, "]}");
+    return;
+  }
   if (type & PERFCOUNTER_LONGRUNAVG) {
     if (type & PERFCOUNTER_U64) {
       snprintf(buf, buf_sz, "\"%s\":{\"avgcount\":%" PRId64 ","
 	      "\"sum\":%" PRId64 "}", 
-	      name, avgcount, u.u64);
+	      name, count, u64);
     }
     else if (type & PERFCOUNTER_FLOAT) {
       snprintf(buf, buf_sz, "\"%s\":{\"avgcount\":%" PRId64 ","
 	      "\"sum\":%g}",
-	      name, avgcount, u.dbl);
+	      name, count, dbl);
     }
     else {
       assert(0);
@@ -249,10 +367,10 @@ void  PerfCounters::perf_counter_data_any_d::write_json(char *buf, size_t buf_sz
   else {
     if (type & PERFCOUNTER_U64) {
       snprintf(buf, buf_sz, "\"%s\":%" PRId64,
-	       name, u.u64);
+	       name, u64);
     }
     else if (type & PERFCOUNTER_FLOAT) {
-      snprintf(buf, buf_sz, "\"%s\":%g", name, u.dbl);
+      snprintf(buf, buf_sz, "\"%s\":%g", name, dbl);
     }
     else {
       assert(0);
@@ -293,6 +411,11 @@ void PerfCountersBuilder::add_fl_avg(int idx, const char *name)
   add_impl(idx, name, PERFCOUNTER_FLOAT | PERFCOUNTER_LONGRUNAVG);
 }
 
+void PerfCountersBuilder::add_u64_hist(int idx, const char *name)
+{
+  add_impl(idx, name, PERFCOUNTER_U64 | PERFCOUNTER_HISTOGRAM);
+}
+
 void PerfCountersBuilder::add_impl(int idx, const char *name, int ty)
 {
   assert(idx > m_perf_counters->m_lower_bound);
@@ -303,6 +426,8 @@ void PerfCountersBuilder::add_impl(int idx, const char *name, int ty)
   assert(data.type == PERFCOUNTER_NONE);
   data.name = name;
   data.type = (enum perfcounter_type_d)ty;
+  if (ty & PERFCOUNTER_HISTOGRAM)
+    data.buckets.resize(PERFCOUNTER_HIST_BUCKETS);
 }
 
 PerfCounters *PerfCountersBuilder::create_perf_counters()
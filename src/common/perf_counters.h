@@ -19,6 +19,10 @@
 #include "common/config_obs.h"
 #include "common/Mutex.h"
 
+#ifdef __CEPH__
+# include "acconfig.h"
+#endif
+
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -34,15 +38,28 @@ enum perfcounter_type_d
   PERFCOUNTER_U64 = 0x2,
   PERFCOUNTER_LONGRUNAVG = 0x4,
   PERFCOUNTER_COUNTER = 0x8,
+  PERFCOUNTER_HISTOGRAM = 0x10,
 };
 
+/* lock-free updates need native 64-bit atomics */
+#if !defined(NO_ATOMIC_OPS) && defined(__LP64__)
+# define PERFCOUNTERS_LOCKFREE
+#endif
+
+/* a histogram counter has one bucket per power of two: bucket i counts
+ * values in [2^i, 2^(i+1)), with 0 going to bucket 0 */
+#define PERFCOUNTER_HIST_BUCKETS 32
+
 /*
  * A PerfCounters object is usually associated with a single subsystem.
  * It contains counters which we modify to track performance and throughput
  * over time. 
  *
- * This object is thread-safe. However, it is better to avoid sharing
- * a PerfCounters object between multiple threads to avoid cacheline ping-pong.
+ * This object is thread-safe.  With PERFCOUNTERS_LOCKFREE, updates take
+ * no lock: each one is an atomic operation on the element, so any thread
+ * may instrument a hot path with it, and a reader may see an average's
+ * sum and count from slightly different moments.  Otherwise everything
+ * goes through m_lock.
  */
 class PerfCounters
 {
@@ -57,6 +74,9 @@ public:
   void finc(int idx, double v);
   double fget(int idx) const;
 
+  /// add a sample to a histogram
+  void hinc(int idx, uint64_t v);
+
   void write_json_to_buf(std::vector <char> &buffer, bool schema);
 
   const std::string& get_name() const;
@@ -80,6 +100,7 @@ private:
       double dbl;
     } u;
     uint64_t avgcount;
+    std::vector<uint64_t> buckets;  // histograms only
   };
   typedef std::vector<perf_counter_data_any_d> perf_counter_data_vec_t;
 
@@ -87,11 +108,14 @@ private:
   int m_lower_bound;
   int m_upper_bound;
   const std::string m_name;
+#ifndef PERFCOUNTERS_LOCKFREE
   const std::string m_lock_name;
 
   /** Protects m_data */
   mutable Mutex m_lock;
+#endif
 
+  /** Laid out by PerfCountersBuilder; only the values change after that */
   perf_counter_data_vec_t m_data;
 
   friend class PerfCountersBuilder;
@@ -115,6 +139,8 @@ public:
   PerfCountersCollection(CephContext *cct);
   ~PerfCountersCollection();
   void add(class PerfCounters *l);
+  /// add l, unless one of the same name is already here
+  bool try_add(class PerfCounters *l);
   void remove(class PerfCounters *l);
   void clear();
   void write_json_to_buf(std::vector <char> &buffer, bool schema);
@@ -151,6 +177,7 @@ public:
   void add_u64_counter(int key, const char *name);
   void add_fl(int key, const char *name);
   void add_fl_avg(int key, const char *name);
+  void add_u64_hist(int key, const char *name);
   PerfCounters* create_perf_counters();
 private:
   PerfCountersBuilder(const PerfCountersBuilder &rhs);
@@ -397,6 +397,22 @@ public:
     for (int i=0; i<numrep; i++)
       out[i] = rawout[i];
   }
+  /// map each of xs through rule, without a forcefed device
+  void do_rule_batch(int rule, const vector<int>& xs, vector<vector<int> >& out,
+		     int maxout, vector<__u32>& weight) {
+    unsigned n = xs.size();
+    out.clear();
+    out.resize(n);
+    if (!n || maxout <= 0)
+      return;
+    vector<int> rawout(n * maxout);
+    vector<int> lens(n);
+    crush_do_rule_batch(crush, rule, &xs[0], n, &rawout[0], &lens[0], maxout,
+			&weight[0]);
+    for (unsigned i=0; i<n; i++)
+      out[i].assign(rawout.begin() + i * maxout,
+		    rawout.begin() + i * maxout + lens[i]);
+  }
 
   int read_from_file(const char *fn) {
     bufferlist bl;
@@ -463,6 +479,11 @@ public:
 	  ::encode(((crush_bucket_straw*)crush->buckets[i])->straws[j], bl);
 	}
 	break;
+
+      case CRUSH_BUCKET_STRAW2:
+	for (unsigned j=0; j<crush->buckets[i]->size; j++)
+	  ::encode(((crush_bucket_straw2*)crush->buckets[i])->item_weights[j], bl);
+	break;
       default:
 	assert(0);
 	break;
@@ -563,6 +584,9 @@ public:
       case CRUSH_BUCKET_STRAW:
 	size = sizeof(crush_bucket_straw);
 	break;
+      case CRUSH_BUCKET_STRAW2:
+	size = sizeof(crush_bucket_straw2);
+	break;
       default: {
 	char str[128];
 	snprintf(str, sizeof(str), "unsupported bucket algorithm: %d", alg);
@@ -626,6 +650,14 @@ public:
 	break;
       }
 
+      case CRUSH_BUCKET_STRAW2: {
+	crush_bucket_straw2* cbs = (crush_bucket_straw2*)bucket;
+	cbs->item_weights = (__u32*)calloc(1, bucket->size * sizeof(__u32));
+	for (unsigned j = 0; j < bucket->size; ++j)
+	  ::decode(cbs->item_weights[j], blp);
+	break;
+      }
+
       default:
 	// We should have handled this case in the first switch statement
 	assert(0);
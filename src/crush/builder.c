@@ -414,6 +414,39 @@ crush_make_straw_bucket(int hash,
 	return bucket;
 }
 
+/* straw2 bucket: nothing derived from the weights to recompute */
+
+struct crush_bucket_straw2 *
+crush_make_straw2_bucket(int hash,
+			 int type,
+			 int size,
+			 int *items,
+			 int *weights)
+{
+	struct crush_bucket_straw2 *bucket;
+	int i;
+
+	bucket = malloc(sizeof(*bucket));
+	memset(bucket, 0, sizeof(*bucket));
+	bucket->h.alg = CRUSH_BUCKET_STRAW2;
+	bucket->h.hash = hash;
+	bucket->h.type = type;
+	bucket->h.size = size;
+
+	bucket->h.items = malloc(sizeof(__u32)*size);
+	bucket->h.perm = malloc(sizeof(__u32)*size);
+	bucket->item_weights = malloc(sizeof(__u32)*size);
+
+	bucket->h.weight = 0;
+	for (i=0; i<size; i++) {
+		bucket->h.items[i] = items[i];
+		bucket->h.weight += weights[i];
+		bucket->item_weights[i] = weights[i];
+	}
+
+	return bucket;
+}
+
 
 
 struct crush_bucket*
@@ -439,6 +472,9 @@ crush_make_bucket(int alg, int hash, int type, int size,
 
 	case CRUSH_BUCKET_STRAW:
 		return (struct crush_bucket *)crush_make_straw_bucket(hash, type, size, items, weights);
+
+	case CRUSH_BUCKET_STRAW2:
+		return (struct crush_bucket *)crush_make_straw2_bucket(hash, type, size, items, weights);
 	}
 	return 0;
 }
@@ -525,6 +561,23 @@ int crush_add_straw_bucket_item(struct crush_bucket_straw *bucket, int item, int
 	return crush_calc_straw(bucket);
 }
 
+int crush_add_straw2_bucket_item(struct crush_bucket_straw2 *bucket, int item, int weight)
+{
+	int newsize = bucket->h.size + 1;
+
+	bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
+	bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
+	bucket->item_weights = realloc(bucket->item_weights, sizeof(__u32)*newsize);
+
+	bucket->h.items[newsize-1] = item;
+	bucket->item_weights[newsize-1] = weight;
+
+	bucket->h.weight += weight;
+	bucket->h.size++;
+
+	return 0;
+}
+
 int crush_bucket_add_item(struct crush_bucket *b, int item, int weight)
 {
 	/* invalidate perm cache */
@@ -539,6 +592,8 @@ int crush_bucket_add_item(struct crush_bucket *b, int item, int weight)
 		return crush_add_tree_bucket_item((struct crush_bucket_tree *)b, item, weight);
 	case CRUSH_BUCKET_STRAW:
 		return crush_add_straw_bucket_item((struct crush_bucket_straw *)b, item, weight);
+	case CRUSH_BUCKET_STRAW2:
+		return crush_add_straw2_bucket_item((struct crush_bucket_straw2 *)b, item, weight);
 	default:
 		return -1;
 	}
@@ -679,6 +734,25 @@ int crush_remove_straw_bucket_item(struct crush_bucket_straw *bucket, int item)
 	return crush_calc_straw(bucket);
 }
 
+int crush_remove_straw2_bucket_item(struct crush_bucket_straw2 *bucket, int item)
+{
+	unsigned i, j;
+
+	for (i = 0; i < bucket->h.size; i++)
+		if (bucket->h.items[i] == item)
+			break;
+	if (i == bucket->h.size)
+		return -ENOENT;
+
+	bucket->h.weight -= bucket->item_weights[i];
+	bucket->h.size--;
+	for (j = i; j < bucket->h.size; j++) {
+		bucket->h.items[j] = bucket->h.items[j+1];
+		bucket->item_weights[j] = bucket->item_weights[j+1];
+	}
+	return 0;
+}
+
 int crush_bucket_remove_item(struct crush_bucket *b, int item)
 {
 	/* invalidate perm cache */
@@ -693,6 +767,8 @@ int crush_bucket_remove_item(struct crush_bucket *b, int item)
 		return crush_remove_tree_bucket_item((struct crush_bucket_tree *)b, item);
 	case CRUSH_BUCKET_STRAW:
 		return crush_remove_straw_bucket_item((struct crush_bucket_straw *)b, item);
+	case CRUSH_BUCKET_STRAW2:
+		return crush_remove_straw2_bucket_item((struct crush_bucket_straw2 *)b, item);
 	default:
 		return -1;
 	}
@@ -781,6 +857,24 @@ int crush_adjust_straw_bucket_item_weight(struct crush_bucket_straw *bucket, int
 	return diff;
 }
 
+int crush_adjust_straw2_bucket_item_weight(struct crush_bucket_straw2 *bucket, int item, int weight)
+{
+	unsigned idx;
+	int diff;
+
+	for (idx = 0; idx < bucket->h.size; idx++)
+		if (bucket->h.items[idx] == item)
+			break;
+	if (idx == bucket->h.size)
+		return 0;
+
+	diff = weight - bucket->item_weights[idx];
+	bucket->item_weights[idx] = weight;
+	bucket->h.weight += diff;
+
+	return diff;
+}
+
 int crush_bucket_adjust_item_weight(struct crush_bucket *b, int item, int weight)
 {
 	switch (b->alg) {
@@ -796,6 +890,9 @@ int crush_bucket_adjust_item_weight(struct crush_bucket *b, int item, int weight
 	case CRUSH_BUCKET_STRAW:
 		return crush_adjust_straw_bucket_item_weight((struct crush_bucket_straw *)b,
 							     item, weight);
+	case CRUSH_BUCKET_STRAW2:
+		return crush_adjust_straw2_bucket_item_weight((struct crush_bucket_straw2 *)b,
+							      item, weight);
 	default:
 		return -1;
 	}
@@ -880,6 +977,23 @@ int crush_reweight_straw_bucket(struct crush_map *crush, struct crush_bucket_str
 	return 0;
 }
 
+int crush_reweight_straw2_bucket(struct crush_map *crush, struct crush_bucket_straw2 *bucket)
+{
+	unsigned i;
+
+	bucket->h.weight = 0;
+	for (i = 0; i < bucket->h.size; i++) {
+		int id = bucket->h.items[i];
+		if (id < 0) {
+			struct crush_bucket *c = crush->buckets[-1-id];
+			crush_reweight_bucket(crush, c);
+			bucket->item_weights[i] = c->weight;
+		}
+		bucket->h.weight += bucket->item_weights[i];
+	}
+	return 0;
+}
+
 int crush_reweight_bucket(struct crush_map *crush, struct crush_bucket *b)
 {
 	switch (b->alg) {
@@ -891,6 +1005,8 @@ int crush_reweight_bucket(struct crush_map *crush, struct crush_bucket *b)
 		return crush_reweight_tree_bucket(crush, (struct crush_bucket_tree *)b);
 	case CRUSH_BUCKET_STRAW:
 		return crush_reweight_straw_bucket(crush, (struct crush_bucket_straw *)b);
+	case CRUSH_BUCKET_STRAW2:
+		return crush_reweight_straw2_bucket(crush, (struct crush_bucket_straw2 *)b);
 	default:
 		return -1;
 	}
@@ -0,0 +1,221 @@
+#ifndef CEPH_CRUSH_LN_TABLE_H
+#define CEPH_CRUSH_LN_TABLE_H
+
+/*
+ * Tables for crush_ln() in mapper.c, which straw2 buckets use to
+ * compute 2^44 * log2(x) for 16-bit x in integer arithmetic (the
+ * kernel client does the same mapping and has no floating point).
+ *
+ * For a mantissa m in [1,2) whose top 7 fraction bits are k,
+ * m * __RH_tbl[k] / 2^24 lands in [1, 1 + 1/128); __LH_tbl[k] is
+ * -log2(__RH_tbl[k] / 2^24) and __LL_tbl[j] is log2(1 + j/2^16), both
+ * scaled by 2^44.  Generated with exact decimal arithmetic; the
+ * result is within 2^-15 of log2 for every input.
+ */
+
+/* ceil(2^24 / (1 + k/128)) */
+static const __u32 __RH_tbl[128] = {
+	0x1000000, 0xfe03f9, 0xfc0fc1, 0xfa232d,
+	0xf83e10, 0xf6603e, 0xf4898e, 0xf2b9d7,
+	0xf0f0f1, 0xef2eb8, 0xed7304, 0xebbdb3,
+	0xea0ea1, 0xe865ad, 0xe6c2b5, 0xe52599,
+	0xe38e39, 0xe1fc79, 0xe07039, 0xdee95d,
+	0xdd67c9, 0xdbeb62, 0xda740e, 0xd901b3,
+	0xd79436, 0xd62b81, 0xd4c77c, 0xd3680e,
+	0xd20d21, 0xd0b6a0, 0xcf6475, 0xce168b,
+	0xcccccd, 0xcb8728, 0xca4588, 0xc907db,
+	0xc7ce0d, 0xc6980d, 0xc565c9, 0xc43730,
+	0xc30c31, 0xc1e4bc, 0xc0c0c1, 0xbfa030,
+	0xbe82fb, 0xbd6911, 0xbc5265, 0xbb3ee8,
+	0xba2e8c, 0xb92144, 0xb81703, 0xb70fbc,
+	0xb60b61, 0xb509e7, 0xb40b41, 0xb30f64,
+	0xb21643, 0xb11fd4, 0xb02c0c, 0xaf3ade,
+	0xae4c42, 0xad602c, 0xac7692, 0xab8f6a,
+	0xaaaaab, 0xa9c84b, 0xa8e840, 0xa80a81,
+	0xa72f06, 0xa655c5, 0xa57eb6, 0xa4a9d0,
+	0xa3d70b, 0xa3065f, 0xa237c4, 0xa16b32,
+	0xa0a0a1, 0x9fd80a, 0x9f1166, 0x9e4cae,
+	0x9d89d9, 0x9cc8e2, 0x9c09c1, 0x9b4c70,
+	0x9a90e8, 0x99d723, 0x991f1b, 0x9868c9,
+	0x97b426, 0x97012f, 0x964fdb, 0x95a026,
+	0x94f20a, 0x944581, 0x939a86, 0x92f114,
+	0x924925, 0x91a2b4, 0x90fdbd, 0x905a39,
+	0x8fb824, 0x8f177a, 0x8e7836, 0x8dda53,
+	0x8d3dcc, 0x8ca29d, 0x8c08c1, 0x8b7035,
+	0x8ad8f3, 0x8a42f9, 0x89ae41, 0x891ac8,
+	0x888889, 0x87f781, 0x8767ac, 0x86d906,
+	0x864b8b, 0x85bf38, 0x853409, 0x84a9fa,
+	0x842109, 0x839931, 0x83126f, 0x828cc0,
+	0x820821, 0x81848e, 0x810205, 0x808081,
+};
+
+/* 2^44 * -log2(__RH_tbl[k] / 2^24) */
+static const __u64 __LH_tbl[128] = {
+	0x0ull, 0x2dfc8b9bc1ull, 0x5b9e59bab6ull, 0x88e68d6570ull,
+	0xb5d69021d4ull, 0xe26fcc0b5bull, 0x10eb37ad433ull, 0x13aa2ec545full,
+	0x1663f6e3b3dull, 0x1918a014070ull, 0x1bc841cd434ull, 0x1e72eb841d5ull,
+	0x2118b0f7151ull, 0x23b9a25c083ull, 0x2655d29ea21ull, 0x28ed529bab7ull,
+	0x2b803445cd2ull, 0x2e0e841e91aull, 0x30985629444ull, 0x331db8e5cafull,
+	0x359ebbc55f9ull, 0x381b6d7ed80ull, 0x3a93dc025a6ull, 0x3d081620b08ull,
+	0x3f782d43da4ull, 0x41e42b269e4ull, 0x444c1db4b7eull, 0x46b0156a434ull,
+	0x49101e5b6daull, 0x4b6c4394e15ull, 0x4dc4929ec39ull, 0x501917f72a0ull,
+	0x5269e0d2df5ull, 0x54b6f77dc7full, 0x570068b9c4dull, 0x59463e4b916ull,
+	0x5b88864414cull, 0x5dc749d219full, 0x6002949433bull, 0x623a70e4ae0ull,
+	0x646ee9b111full, 0x66a00893ae1ull, 0x68cdd7b0cddull, 0x6af861b7d1full,
+	0x6d1fae03addull, 0x6f43ca3ef1cull, 0x7164bcd5abeull, 0x73829092551ull,
+	0x759d4ec8217ull, 0x77b4ff457e3ull, 0x79c9aa4822dull, 0x7bdb587def0ull,
+	0x7dea150d21dull, 0x7ff5e57a934ull, 0x81fed3c0ed3ull, 0x8404e62e31bull,
+	0x86082793477ull, 0x88089cf493full, 0x8a064dc225cull, 0x8c014602650ull,
+	0x8df9879a6f5ull, 0x8fef1d32aa3ull, 0x91e20d97c49ull, 0x93d25fecb3eull,
+	0x95c0198151aull, 0x97ab421e484ull, 0x9993e1e4507ull, 0x9b79ff1a1a5ull,
+	0x9d5d9e1e6ccull, 0x9f3ec803849ull, 0xa11d81bf3a0ull, 0xa2f9d2c93c2ull,
+	0xa4d3c0a7d49ull, 0xa6ab5125ecdull, 0xa8808a53867ull, 0xaa537286309ull,
+	0xac2410597acull, 0xadf2685fe35ull, 0xafbe7f673b2ull, 0xb1885a79101ull,
+	0xb350038b678ull, 0xb5157b7bb6bull, 0xb6d8ca6716bull, 0xb899f3f1d6aull,
+	0xba58fe561b2ull, 0xbc15eda57acull, 0xbdd0c62463cull, 0xbf898eb6cfeull,
+	0xc1404e7fc8full, 0xc2f50319380ull, 0xc4a7b8eca86ull, 0xc6587063401ull,
+	0xc8072ef96bdull, 0xc9b3fa60ae0ull, 0xcb5ed5ff5b6ull, 0xcd07c565e7cull,
+	0xceaeced5813ull, 0xd053f63c564ull, 0xd1f73d276cfull, 0xd398acf0675ull,
+	0xd538477dd61ull, 0xd6d60ed673dull, 0xd87207b9073ull, 0xda0c371086full,
+	0xdba4a1f455dull, 0xdd3b4b08313ull, 0xded037b45a0ull, 0xe063684206cull,
+	0xe1f4e50b826ull, 0xe384abf4cd5ull, 0xe512c5a7e50ull, 0xe69f32f36aeull,
+	0xe829fa26066ull, 0xe9b31c4ded0ull, 0xeb3a9d4b030ull, 0xecc0812051cull,
+	0xee44cbf435eull, 0xefc77f4da13ull, 0xf1489f91768ull, 0xf2c83148717ull,
+	0xf446338829full, 0xf5c2addeb2cull, 0xf73da2674e0ull, 0xf8b71356317ull,
+	0xfa2f02f8ae6ull, 0xfba5768f58cull, 0xfd1a6dc5efcull, 0xfe8df0f5879ull,
+};
+
+/* 2^44 * log2(1 + j/2^16) */
+static const __u64 __LL_tbl[514] = {
+	0x0ull, 0x17153bdbull, 0x2e2a60a0ull, 0x453f6e51ull,
+	0x5c5464ecull, 0x73694474ull, 0x8a7e0ce6ull, 0xa192be45ull,
+	0xb8a75890ull, 0xcfbbdbc7ull, 0xe6d047eaull, 0xfde49cf9ull,
+	0x114f8daf6ull, 0x12c0d01dfull, 0x1432111b6ull, 0x15a350a79ull,
+	0x17148ec2aull, 0x1885cb6c9ull, 0x19f706a55ull, 0x1b68406d0ull,
+	0x1cd978c38ull, 0x1e4aafa8full, 0x1fbbe51d4ull, 0x212d19208ull,
+	0x229e4bb2bull, 0x240f7cd3dull, 0x2580ac83eull, 0x26f1dac2full,
+	0x28630790full, 0x29d432edfull, 0x2b455cd9full, 0x2cb68554full,
+	0x2e27ac5efull, 0x2f98d1f80ull, 0x3109f6201ull, 0x327b18d74ull,
+	0x33ec3a1d7ull, 0x355d59f2cull, 0x36ce78572ull, 0x383f954a9ull,
+	0x39b0b0cd2ull, 0x3b21cadeeull, 0x3c92e37fbull, 0x3e03faafaull,
+	0x3f75106edull, 0x40e624bd1ull, 0x4257379a9ull, 0x43c849073ull,
+	0x453959031ull, 0x46aa678e2ull, 0x481b74a87ull, 0x498c8051full,
+	0x4afd8a8abull, 0x4c6e9352cull, 0x4ddf9aaa0ull, 0x4f50a0909ull,
+	0x50c1a5067ull, 0x5232a80baull, 0x53a3a9a01ull, 0x5514a9c3eull,
+	0x5685a8770ull, 0x57f6a5b97ull, 0x5967a18b5ull, 0x5ad89bec8ull,
+	0x5c4994dd1ull, 0x5dba8c5d0ull, 0x5f2b826c6ull, 0x609c770b3ull,
+	0x620d6a396ull, 0x637e5bf70ull, 0x64ef4c442ull, 0x66603b20aull,
+	0x67d1288cbull, 0x694214882ull, 0x6ab2ff132ull, 0x6c23e82daull,
+	0x6d94cfd7aull, 0x6f05b6112ull, 0x70769ada3ull, 0x71e77e32dull,
+	0x7358601b0ull, 0x74c94092cull, 0x763a1f9a1ull, 0x77aafd30full,
+	0x791bd9578ull, 0x7a8cb40daull, 0x7bfd8d536ull, 0x7d6e6528cull,
+	0x7edf3b8ddull, 0x805010828ull, 0x81c0e406eull, 0x8331b61afull,
+	0x84a286bebull, 0x861355f22ull, 0x878423b55ull, 0x88f4f0084ull,
+	0x8a65baeaeull, 0x8bd6845d4ull, 0x8d474c5f6ull, 0x8eb812f15ull,
+	0x9028d8130ull, 0x91999bc48ull, 0x930a5e05dull, 0x947b1ed6full,
+	0x95ebde37eull, 0x975c9c28bull, 0x98cd58a95ull, 0x9a3e13b9dull,
+	0x9baecd5a3ull, 0x9d1f858a7ull, 0x9e903c4aaull, 0xa000f19abull,
+	0xa171a57abull, 0xa2e257ea9ull, 0xa45308ea7ull, 0xa5c3b87a3ull,
+	0xa734669a0ull, 0xa8a51349bull, 0xaa15be897ull, 0xab8668593ull,
+	0xacf710b8eull, 0xae67b7a8aull, 0xafd85d287ull, 0xb14901384ull,
+	0xb2b9a3d82ull, 0xb42a45081ull, 0xb59ae4c81ull, 0xb70b83182ull,
+	0xb87c1ff85ull, 0xb9ecbb68aull, 0xbb5d55691ull, 0xbccdedf9aull,
+	0xbe3e851a5ull, 0xbfaf1acb2ull, 0xc11faf0c2ull, 0xc29041dd5ull,
+	0xc400d33ebull, 0xc57163305ull, 0xc6e1f1b21ull, 0xc8527ec41ull,
+	0xc9c30a665ull, 0xcb339498cull, 0xcca41d5b8ull, 0xce14a4ae8ull,
+	0xcf852a91dull, 0xd0f5af055ull, 0xd26632093ull, 0xd3d6b39d6ull,
+	0xd54733c1eull, 0xd6b7b276bull, 0xd8282fbbeull, 0xd998ab916ull,
+	0xdb0925f74ull, 0xdc799eed9ull, 0xddea16743ull, 0xdf5a8c8b4ull,
+	0xe0cb0132bull, 0xe23b746aaull, 0xe3abe632full, 0xe51c568bbull,
+	0xe68cc574eull, 0xe7fd32ee9ull, 0xe96d9ef8cull, 0xeade09937ull,
+	0xec4e72be9ull, 0xedbeda7a4ull, 0xef2f40c67ull, 0xf09fa5a32ull,
+	0xf21009107ull, 0xf3806b0e4ull, 0xf4f0cb9caull, 0xf6612abbaull,
+	0xf7d1886b3ull, 0xf941e4ab5ull, 0xfab23f7c2ull, 0xfc2298dd8ull,
+	0xfd92f0cf9ull, 0xff0347523ull, 0x100739c659ull, 0x101e3f0099ull,
+	0x10354423e4ull, 0x104c49303aull, 0x10634e259bull, 0x107a530408ull,
+	0x109157cb80ull, 0x10a85c7c04ull, 0x10bf611594ull, 0x10d6659830ull,
+	0x10ed6a03d8ull, 0x11046e588dull, 0x111b72964eull, 0x113276bd1dull,
+	0x11497accf8ull, 0x11607ec5e0ull, 0x117782a7d6ull, 0x118e8672daull,
+	0x11a58a26ebull, 0x11bc8dc40aull, 0x11d3914a37ull, 0x11ea94b973ull,
+	0x12019811bcull, 0x12189b5315ull, 0x122f9e7d7cull, 0x1246a190f2ull,
+	0x125da48d78ull, 0x1274a7730dull, 0x128baa41b1ull, 0x12a2acf965ull,
+	0x12b9af9a29ull, 0x12d0b223fdull, 0x12e7b496e1ull, 0x12feb6f2d6ull,
+	0x1315b937dbull, 0x132cbb65f1ull, 0x1343bd7d17ull, 0x135abf7d4full,
+	0x1371c16699ull, 0x1388c338f4ull, 0x139fc4f460ull, 0x13b6c698deull,
+	0x13cdc8266full, 0x13e4c99d11ull, 0x13fbcafcc6ull, 0x1412cc458dull,
+	0x1429cd7768ull, 0x1440ce9255ull, 0x1457cf9655ull, 0x146ed08368ull,
+	0x1485d1598full, 0x149cd218caull, 0x14b3d2c118ull, 0x14cad3527aull,
+	0x14e1d3ccf1ull, 0x14f8d4307bull, 0x150fd47d1bull, 0x1526d4b2cfull,
+	0x153dd4d197ull, 0x1554d4d975ull, 0x156bd4ca68ull, 0x1582d4a471ull,
+	0x1599d4678full, 0x15b0d413c3ull, 0x15c7d3a90dull, 0x15ded3276dull,
+	0x15f5d28ee3ull, 0x160cd1df70ull, 0x1623d11913ull, 0x163ad03bceull,
+	0x1651cf479full, 0x1668ce3c87ull, 0x167fcd1a87ull, 0x1696cbe19eull,
+	0x16adca91cdull, 0x16c4c92b14ull, 0x16dbc7ad74ull, 0x16f2c618ebull,
+	0x1709c46d7bull, 0x1720c2ab23ull, 0x1737c0d1e4ull, 0x174ebee1beull,
+	0x1765bcdab2ull, 0x177cbabcbeull, 0x1793b887e5ull, 0x17aab63c24ull,
+	0x17c1b3d97eull, 0x17d8b15ff2ull, 0x17efaecf80ull, 0x1806ac2828ull,
+	0x181da969ebull, 0x1834a694c9ull, 0x184ba3a8c2ull, 0x1862a0a5d5ull,
+	0x18799d8c04ull, 0x18909a5b4full, 0x18a79713b5ull, 0x18be93b537ull,
+	0x18d5903fd5ull, 0x18ec8cb38full, 0x1903891066ull, 0x191a855659ull,
+	0x1931818569ull, 0x19487d9d95ull, 0x195f799edfull, 0x1976758946ull,
+	0x198d715ccbull, 0x19a46d196dull, 0x19bb68bf2dull, 0x19d2644e0aull,
+	0x19e95fc606ull, 0x1a005b2720ull, 0x1a17567159ull, 0x1a2e51a4b1ull,
+	0x1a454cc127ull, 0x1a5c47c6bcull, 0x1a7342b571ull, 0x1a8a3d8d45ull,
+	0x1aa1384e38ull, 0x1ab832f84bull, 0x1acf2d8b7eull, 0x1ae62807d2ull,
+	0x1afd226d45ull, 0x1b141cbbd9ull, 0x1b2b16f38eull, 0x1b42111463ull,
+	0x1b590b1e59ull, 0x1b70051171ull, 0x1b86feedaaull, 0x1b9df8b304ull,
+	0x1bb4f26180ull, 0x1bcbebf91eull, 0x1be2e579deull, 0x1bf9dee3c0ull,
+	0x1c10d836c5ull, 0x1c27d172ecull, 0x1c3eca9836ull, 0x1c55c3a6a3ull,
+	0x1c6cbc9e33ull, 0x1c83b57ee7ull, 0x1c9aae48beull, 0x1cb1a6fbb8ull,
+	0x1cc89f97d6ull, 0x1cdf981d19ull, 0x1cf6908b7full, 0x1d0d88e30aull,
+	0x1d248123baull, 0x1d3b794d8eull, 0x1d52716087ull, 0x1d69695ca5ull,
+	0x1d806141e8ull, 0x1d97591051ull, 0x1dae50c7e0ull, 0x1dc5486894ull,
+	0x1ddc3ff26eull, 0x1df337656eull, 0x1e0a2ec195ull, 0x1e212606e2ull,
+	0x1e381d3556ull, 0x1e4f144cf1ull, 0x1e660b4db2ull, 0x1e7d02379bull,
+	0x1e93f90aabull, 0x1eaaefc6e3ull, 0x1ec1e66c43ull, 0x1ed8dcfacaull,
+	0x1eefd3727aull, 0x1f06c9d352ull, 0x1f1dc01d52ull, 0x1f34b6507bull,
+	0x1f4bac6ccdull, 0x1f62a27247ull, 0x1f799860ebull, 0x1f908e38b8ull,
+	0x1fa783f9afull, 0x1fbe79a3d0ull, 0x1fd56f371aull, 0x1fec64b38eull,
+	0x20035a192dull, 0x201a4f67f6ull, 0x2031449fe9ull, 0x204839c108ull,
+	0x205f2ecb51ull, 0x207623bec5ull, 0x208d189b65ull, 0x20a40d6130ull,
+	0x20bb021027ull, 0x20d1f6a849ull, 0x20e8eb2998ull, 0x20ffdf9413ull,
+	0x2116d3e7baull, 0x212dc8248dull, 0x2144bc4a8eull, 0x215bb059bbull,
+	0x2172a45215ull, 0x218998339dull, 0x21a08bfe51ull, 0x21b77fb234ull,
+	0x21ce734f44ull, 0x21e566d583ull, 0x21fc5a44efull, 0x22134d9d8aull,
+	0x222a40df53ull, 0x2241340a4bull, 0x2258271e71ull, 0x226f1a1bc7ull,
+	0x22860d024cull, 0x229cffd200ull, 0x22b3f28ae4ull, 0x22cae52cf7ull,
+	0x22e1d7b83bull, 0x22f8ca2caeull, 0x230fbc8a52ull, 0x2326aed126ull,
+	0x233da1012bull, 0x2354931a60ull, 0x236b851cc7ull, 0x238277085eull,
+	0x239968dd27ull, 0x23b05a9b22ull, 0x23c74c424eull, 0x23de3dd2acull,
+	0x23f52f4c3cull, 0x240c20aefeull, 0x242311faf2ull, 0x243a033019ull,
+	0x2450f44e73ull, 0x2467e55600ull, 0x247ed646c0ull, 0x2495c720b3ull,
+	0x24acb7e3daull, 0x24c3a89034ull, 0x24da9925c2ull, 0x24f189a484ull,
+	0x25087a0c7aull, 0x251f6a5da4ull, 0x25365a9803ull, 0x254d4abb96ull,
+	0x25643ac85full, 0x257b2abe5cull, 0x25921a9d8full, 0x25a90a65f7ull,
+	0x25bffa1795ull, 0x25d6e9b268ull, 0x25edd93671ull, 0x2604c8a3b1ull,
+	0x261bb7fa26ull, 0x2632a739d3ull, 0x26499662b5ull, 0x26608574cfull,
+	0x267774701full, 0x268e6354a7ull, 0x26a5522266ull, 0x26bc40d95cull,
+	0x26d32f798bull, 0x26ea1e02f1ull, 0x27010c758full, 0x2717fad165ull,
+	0x272ee91674ull, 0x2745d744bbull, 0x275cc55c3bull, 0x2773b35cf4ull,
+	0x278aa146e6ull, 0x27a18f1a11ull, 0x27b87cd676ull, 0x27cf6a7c14ull,
+	0x27e6580aedull, 0x27fd4582ffull, 0x281432e44bull, 0x282b202ed2ull,
+	0x28420d6293ull, 0x2858fa7f8full, 0x286fe785c6ull, 0x2886d47538ull,
+	0x289dc14de5ull, 0x28b4ae0fcdull, 0x28cb9abaf1ull, 0x28e2874f51ull,
+	0x28f973ccedull, 0x29106033c4ull, 0x29274c83d8ull, 0x293e38bd29ull,
+	0x295524dfb6ull, 0x296c10eb80ull, 0x2982fce087ull, 0x2999e8becbull,
+	0x29b0d4864dull, 0x29c7c0370cull, 0x29deabd108ull, 0x29f5975443ull,
+	0x2a0c82c0bbull, 0x2a236e1672ull, 0x2a3a595567ull, 0x2a51447d9bull,
+	0x2a682f8f0eull, 0x2a7f1a89bfull, 0x2a96056db0ull, 0x2aacf03ae0ull,
+	0x2ac3daf14full, 0x2adac590feull, 0x2af1b019edull, 0x2b089a8c1bull,
+	0x2b1f84e78aull, 0x2b366f2c3aull, 0x2b4d595a29ull, 0x2b6443715aull,
+	0x2b7b2d71cbull, 0x2b92175b7eull, 0x2ba9012e71ull, 0x2bbfeaeaa6ull,
+	0x2bd6d4901dull, 0x2bedbe1ed5ull, 0x2c04a796cfull, 0x2c1b90f80cull,
+	0x2c327a428aull, 0x2c4963764cull, 0x2c604c934full, 0x2c77359996ull,
+	0x2c8e1e891full, 0x2ca50761ecull, 0x2cbbf023fcull, 0x2cd2d8cf50ull,
+	0x2ce9c163e7ull, 0x2d00a9e1c2ull, 0x2d179248e1ull, 0x2d2e7a9945ull,
+	0x2d4562d2ecull, 0x2d5c4af5d9ull, 0x2d7333020aull, 0x2d8a1af780ull,
+	0x2da102d63bull, 0x2db7ea9e3bull, 0x2dced24f81ull, 0x2de5b9ea0dull,
+	0x2dfca16ddeull, 0x2e1388daf5ull,
+};
+
+#endif
@@ -4,6 +4,7 @@
 # include <linux/slab.h>
 # include <linux/bug.h>
 # include <linux/kernel.h>
+# include <linux/math64.h>
 # ifndef dprintk
 #  define dprintk(args...)
 # endif
@@ -16,10 +17,12 @@
 # define dprintk(args...) /* printf(args) */
 # define kmalloc(x, f) malloc(x)
 # define kfree(x) free(x)
+# define div64_s64(a, b) ((a) / (b))
 #endif
 
 #include "crush.h"
 #include "hash.h"
+#include "crush_ln_table.h"
 
 /*
  * Implement the core CRUSH mapping algorithm.
@@ -236,6 +239,73 @@ static int bucket_straw_choose(struct crush_bucket_straw *bucket,
 	return bucket->h.items[high];
 }
 
+
+/* straw2 */
+
+/*
+ * crush_ln - 2^44 * log2(xin + 1), for 0 <= xin <= 0xffff
+ *
+ * Normalize x to a 17-bit mantissa m in [2^16, 2^17), use its top
+ * bits to pick a reciprocal that brings it within 1/128 of 2^16, and
+ * look up the log of the small remainder.  Integer only, so the
+ * result is the same everywhere the map is evaluated.
+ */
+static __u64 crush_ln(unsigned int xin)
+{
+	unsigned int x = xin + 1;
+	int iexpon = 16;
+	__u64 m, index1, index2;
+	__u64 result;
+
+	/* find the position of the top bit; x is at most 2^16 */
+	while (!(x & 0x10000)) {
+		x <<= 1;
+		iexpon--;
+	}
+	m = x;
+
+	index1 = (m >> 9) & 0x7f;
+	m = (m * __RH_tbl[index1]) >> 24;
+	index2 = m - 0x10000;
+
+	result = (__u64)iexpon << 44;
+	result += __LH_tbl[index1] + __LL_tbl[index2];
+	return result;
+}
+
+/*
+ * Each item draws ln(u) / weight for a uniform u in (0, 1]: the
+ * largest draw wins with probability proportional to weight, and an
+ * item's draws depend on nothing but its own id and weight.
+ */
+static int bucket_straw2_choose(struct crush_bucket_straw2 *bucket,
+				int x, int r)
+{
+	__u32 i;
+	int high = 0;
+	__s64 high_draw = 0;
+	__s64 draw;
+	__u64 u;
+
+	for (i = 0; i < bucket->h.size; i++) {
+		if (bucket->item_weights[i]) {
+			u = crush_hash32_3(bucket->h.hash, x,
+					   bucket->h.items[i], r);
+			u &= 0xffff;
+			/* ln(u / 2^16) in Q44, in [-2^48, 0] */
+			draw = (__s64)crush_ln(u) - 0x1000000000000ll;
+			draw = div64_s64(draw, bucket->item_weights[i]);
+		} else {
+			draw = -0x7fffffffffffffffll - 1;
+		}
+		if (i == 0 || draw > high_draw) {
+			high = i;
+			high_draw = draw;
+		}
+	}
+	return bucket->h.items[high];
+}
+
 static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
 {
 	dprintk(" crush_bucket_choose %d x=%d r=%d\n", in->id, x, r);
@@ -252,6 +322,9 @@ static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
 	case CRUSH_BUCKET_STRAW:
 		return bucket_straw_choose((struct crush_bucket_straw *)in,
 					   x, r);
+	case CRUSH_BUCKET_STRAW2:
+		return bucket_straw2_choose((struct crush_bucket_straw2 *)in,
+					    x, r);
 	default:
 		BUG_ON(1);
 		return in->items[0];
@@ -611,3 +684,34 @@ out:
 }
 
 
+
+/**
+ * crush_do_rule_batch - map many inputs through one rule
+ * @map: the crush_map
+ * @ruleno: the rule id
+ * @xs: the inputs
+ * @n: number of inputs
+ * @results: n rows of @result_max slots; row i gets the mapping of xs[i]
+ * @result_lens: number of items mapped for each input (0 on failure)
+ * @result_max: maximum result size per input
+ * @weight: weight vector (for map leaves)
+ *
+ * Equivalent to calling crush_do_rule without a forcefed device once
+ * per input, minus the per-call overhead in the callers.
+ */
+void crush_do_rule_batch(struct crush_map *map,
+			 int ruleno, const int *xs, int n,
+			 int *results, int *result_lens, int result_max,
+			 __u32 *weight)
+{
+	int i, len;
+
+	BUG_ON((__u32)ruleno >= map->max_rules);
+
+	for (i = 0; i < n; i++) {
+		len = crush_do_rule(map, ruleno, xs[i],
+				    results + i * result_max, result_max,
+				    -1, weight);
+		result_lens[i] = len < 0 ? 0 : len;
+	}
+}
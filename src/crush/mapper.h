@@ -16,5 +16,9 @@ extern int crush_do_rule(struct crush_map *map,
 			 int x, int *result, int result_max,
 			 int forcefeed,    /* -1 for none */
 			 __u32 *weights);
+extern void crush_do_rule_batch(struct crush_map *map,
+				int ruleno, const int *xs, int n,
+				int *results, int *result_lens, int result_max,
+				__u32 *weights);
 
 #endif
@@ -0,0 +1,360 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * FileStore transaction benchmark.
+ *
+ *   filestore_bench <store dir> <journal> [--workload W] [options]
+ *
+ * a fresh store is created (mkfs) and --depth transactions are kept in
+ * flight for --seconds.  workloads:
+ *
+ *   rbd     random --size writes within --objects objects of --object-size
+ *   append  sequential appends (plus a small xattr), moving on to a new
+ *           object every --object-size bytes, like rgw
+ *   xattr   set 4 --size xattrs on a random object
+ *   clone   clone_range --size from a random prefilled object to its clone
+ *   split   create new --size objects, driving collection index splits
+ *
+ * the journal mode, flusher and so on are taken from the usual config
+ * options (e.g. --filestore-journal-parallel, --filestore-flusher false),
+ * and the backing filesystem from wherever the store dir lives.
+ * throughput and apply/commit latency percentiles are reported at the end.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+using namespace std;
+
+#include "os/FileStore.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "global/global_init.h"
+
+void usage()
+{
+  cerr << "usage: filestore_bench <store dir> <journal> [options]\n"
+       << "options:\n"
+       << "  --workload <w>       rbd, append, xattr, clone or split (default rbd)\n"
+       << "  --size <bytes>       bytes per op (default 4096)\n"
+       << "  --depth <n>          transactions in flight (default 16)\n"
+       << "  --seconds <n>        how long to run (default 30)\n"
+       << "  --objects <n>        objects to spread ops over (default 64)\n"
+       << "  --object-size <b>    object size for rbd/append/clone (default 4194304)\n"
+       << "  --collections <n>    collections (each with its own sequencer) (default 1)\n";
+  exit(1);
+}
+
+static void print_lat(const char *what, vector<double>& lat)
+{
+  if (lat.empty())
+    return;
+  sort(lat.begin(), lat.end());
+  double sum = 0;
+  for (vector<double>::iterator p = lat.begin(); p != lat.end(); ++p)
+    sum += *p;
+  cout << what << " latency (ms): avg " << sum / lat.size() * 1000.0
+       << " min " << lat.front() * 1000.0
+       << " p50 " << lat[lat.size() * 50 / 100] * 1000.0
+       << " p90 " << lat[lat.size() * 90 / 100] * 1000.0
+       << " p99 " << lat[lat.size() * 99 / 100] * 1000.0
+       << " max " << lat.back() * 1000.0 << std::endl;
+}
+
+class Bench {
+  struct Coll {
+    coll_t cid;
+    ObjectStore::Sequencer osr;
+    Coll(const coll_t& c) : cid(c) {}
+  };
+
+  /// one transaction, done once it is both readable and committed
+  struct Op {
+    Bench *bench;
+    ObjectStore::Transaction t;
+    utime_t start;
+    uint64_t bytes;
+    int pending;
+    Op(Bench *b, uint64_t by) : bench(b), bytes(by), pending(2) {}
+  };
+  struct C_Applied : public Context {
+    Op *op;
+    C_Applied(Op *o) : op(o) {}
+    void finish(int r) {
+      op->bench->applied(op);
+    }
+  };
+  struct C_Committed : public Context {
+    Op *op;
+    C_Committed(Op *o) : op(o) {}
+    void finish(int r) {
+      op->bench->committed(op);
+    }
+  };
+
+  ObjectStore *fs;
+  string workload;
+  bufferlist data;
+  unsigned depth, num_objects;
+  uint64_t object_size;
+  vector<Coll*> colls;
+
+  Mutex lock;
+  Cond cond;
+  unsigned in_flight;
+  uint64_t done, done_bytes;
+  vector<double> apply_lat, commit_lat;
+
+  // workload state
+  uint64_t seq;
+  uint64_t append_obj, append_off;
+
+  void _finish(Op *op) {
+    if (--op->pending)
+      return;
+    in_flight--;
+    done++;
+    done_bytes += op->bytes;
+    delete op;
+    cond.Signal();
+  }
+
+  hobject_t obj(const char *prefix, uint64_t n) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s_%llu", prefix, (unsigned long long)n);
+    return hobject_t(sobject_t(object_t(name), CEPH_NOSNAP));
+  }
+
+  Coll *coll_for(uint64_t n) {
+    return colls[n % colls.size()];
+  }
+
+  uint64_t rand_off() {
+    uint64_t blocks = object_size / data.length();
+    return blocks ? (rand() % blocks) * data.length() : 0;
+  }
+
+  /// fill in the next transaction for the workload
+  Coll *build(Op *op) {
+    ObjectStore::Transaction& t = op->t;
+    if (workload == "append") {
+      if (append_off + data.length() > object_size) {
+	append_obj++;
+	append_off = 0;
+      }
+      Coll *c = coll_for(append_obj);
+      hobject_t o = obj("append", append_obj);
+      t.write(c->cid, o, append_off, data.length(), data);
+      bufferlist attr;
+      ::encode(append_off + data.length(), attr);
+      t.setattr(c->cid, o, "size", attr);
+      append_off += data.length();
+      return c;
+    }
+    uint64_t n = rand() % num_objects;
+    Coll *c = coll_for(n);
+    if (workload == "xattr") {
+      hobject_t o = obj("xattr", n);
+      t.touch(c->cid, o);
+      for (int i = 0; i < 4; i++) {
+	char name[10];
+	snprintf(name, sizeof(name), "attr%d", i);
+	t.setattr(c->cid, o, name, data);
+      }
+    } else if (workload == "clone") {
+      uint64_t off = rand_off();
+      t.clone_range(c->cid, obj("clone_src", n), obj("clone_dst", n), off, data.length(), off);
+    } else if (workload == "split") {
+      uint64_t m = seq++;
+      c = coll_for(m);
+      t.write(c->cid, obj("split", m), 0, data.length(), data);
+    } else {
+      t.write(c->cid, obj("rbd", n), rand_off(), data.length(), data);
+    }
+    return c;
+  }
+
+public:
+  Bench(ObjectStore *f, const string& w, unsigned size, unsigned d,
+	unsigned nobj, uint64_t osize, unsigned ncoll)
+    : fs(f), workload(w), depth(d), num_objects(nobj), object_size(osize),
+      lock("Bench::lock"), in_flight(0), done(0), done_bytes(0),
+      seq(0), append_obj(0), append_off(0) {
+    bufferptr bp(size);
+    for (unsigned i = 0; i < size; i++)
+      bp.c_str()[i] = rand();
+    data.push_back(bp);
+    for (unsigned i = 0; i < ncoll; i++) {
+      char name[20];
+      snprintf(name, sizeof(name), "bench_%u", i);
+      colls.push_back(new Coll(coll_t(name)));
+    }
+  }
+  ~Bench() {
+    for (vector<Coll*>::iterator p = colls.begin(); p != colls.end(); ++p)
+      delete *p;
+  }
+
+  bool valid() {
+    return workload == "rbd" || workload == "append" || workload == "xattr" ||
+      workload == "clone" || workload == "split";
+  }
+
+  int setup() {
+    ObjectStore::Transaction t;
+    for (vector<Coll*>::iterator p = colls.begin(); p != colls.end(); ++p)
+      t.create_collection((*p)->cid);
+    int r = fs->apply_transaction(t);
+    if (r < 0)
+      return r;
+    if (workload == "clone") {
+      cout << "prefilling " << num_objects << " objects of " << object_size << " bytes" << std::endl;
+      bufferptr bp(object_size);
+      bp.zero();
+      bufferlist bl;
+      bl.push_back(bp);
+      for (unsigned n = 0; n < num_objects; n++) {
+	ObjectStore::Transaction ft;
+	ft.write(coll_for(n)->cid, obj("clone_src", n), 0, bl.length(), bl);
+	r = fs->apply_transaction(ft);
+	if (r < 0)
+	  return r;
+      }
+      fs->sync_and_flush();
+    }
+    return 0;
+  }
+
+  void applied(Op *op) {
+    utime_t now = ceph_clock_now(g_ceph_context);
+    Mutex::Locker l(lock);
+    apply_lat.push_back((double)(now - op->start));
+    _finish(op);
+  }
+  void committed(Op *op) {
+    utime_t now = ceph_clock_now(g_ceph_context);
+    Mutex::Locker l(lock);
+    commit_lat.push_back((double)(now - op->start));
+    _finish(op);
+  }
+
+  void run(int seconds) {
+    utime_t start = ceph_clock_now(g_ceph_context);
+    utime_t end = start;
+    end += utime_t(seconds, 0);
+    lock.Lock();
+    while (ceph_clock_now(g_ceph_context) < end) {
+      while (in_flight >= depth)
+	cond.Wait(lock);
+      Op *op = new Op(this, data.length());
+      Coll *c = build(op);
+      in_flight++;
+      lock.Unlock();
+      op->start = ceph_clock_now(g_ceph_context);
+      fs->queue_transaction(&c->osr, &op->t, new C_Applied(op), new C_Committed(op));
+      lock.Lock();
+    }
+    while (in_flight > 0)
+      cond.Wait(lock);
+    utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+
+    double secs = (double)elapsed;
+    cout << "workload " << workload
+	 << " size " << data.length()
+	 << " depth " << depth
+	 << " collections " << colls.size() << std::endl;
+    cout << "ops " << done << " in " << secs << " sec: "
+	 << (double)done / secs << " ops/s, "
+	 << (double)done_bytes / secs / (1024*1024) << " MB/s" << std::endl;
+    print_lat("apply", apply_lat);
+    print_lat("commit", commit_lat);
+    lock.Unlock();
+  }
+};
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  string workload = "rbd";
+  int size = 4096, depth = 16, seconds = 30, objects = 64, collections = 1;
+  int object_size = 4 << 20;
+  vector<const char*> paths;
+  string val;
+  ostringstream err;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+    } else if (ceph_argparse_witharg(args, i, &val, "--workload", (char*)NULL)) {
+      workload = val;
+    } else if (ceph_argparse_withint(args, i, &size, &err, "--size", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &depth, &err, "--depth", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &seconds, &err, "--seconds", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &objects, &err, "--objects", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &object_size, &err, "--object-size", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &collections, &err, "--collections", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(1);
+      }
+    } else {
+      paths.push_back(*i);
+      ++i;
+    }
+  }
+  if (paths.size() != 2 || size <= 0 || depth <= 0 || seconds <= 0 ||
+      objects <= 0 || object_size < size || collections <= 0)
+    usage();
+
+  srand(getpid());
+  FileStore *fs = new FileStore(paths[0], paths[1]);
+  Bench bench(fs, workload, size, depth, objects, object_size, collections);
+  if (!bench.valid())
+    usage();
+
+  cout << "store " << paths[0] << " journal " << paths[1]
+       << (g_conf->filestore_journal_parallel ? " parallel" :
+	   (g_conf->filestore_journal_writeahead ? " writeahead" : ""))
+       << " flusher " << (g_conf->filestore_flusher ? "on" : "off") << std::endl;
+
+  if (fs->mkfs() < 0) {
+    cerr << "mkfs failed" << std::endl;
+    return 1;
+  }
+  if (fs->mount() < 0) {
+    cerr << "mount failed" << std::endl;
+    return 1;
+  }
+  int r = bench.setup();
+  if (r < 0) {
+    cerr << "setup failed: " << r << std::endl;
+    return 1;
+  }
+  bench.run(seconds);
+  fs->umount();
+  delete fs;
+  return 0;
+}
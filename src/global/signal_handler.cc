@@ -103,6 +103,9 @@ static void handle_fatal_signal(int signum)
   bt.print(oss);
   dout_emergency(oss.str());
 
+  if (g_ceph_context)
+    g_ceph_context->_doss->dump_recent();
+
   reraise_fatal(signum);
 }
 
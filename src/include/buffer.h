@@ -97,6 +97,8 @@ public:
 
 
   static int get_total_alloc();
+  /// bytes in use in small buffer size class cls (64 << cls bytes each)
+  static int get_small_pool_alloc(unsigned cls);
 
 private:
  
@@ -114,6 +116,8 @@ private:
   class raw_posix_aligned;
   class raw_hack_aligned;
   class raw_char;
+  class raw_small;
+  class raw_fd;
 
   friend std::ostream& operator<<(std::ostream& out, const raw &r);
 
@@ -129,6 +133,8 @@ public:
   static raw* claim_malloc(unsigned len, char *buf);
   static raw* create_static(unsigned len, char *buf);
   static raw* create_page_aligned(unsigned len);
+  /// len bytes of fd (which is dup()ed) at off, read in when first accessed
+  static raw* create_fd(int fd, uint64_t off, unsigned len);
   
   
   /*
@@ -176,6 +182,8 @@ public:
     char& operator[](unsigned n);
 
     const char *raw_c_str() const;
+    /// the file range behind this ptr, if it has not been read into memory
+    bool get_fd(int *fd, uint64_t *off) const;
     unsigned raw_length() const;
     int raw_nref() const;
 
@@ -200,6 +208,8 @@ public:
     void zero();
     void zero(unsigned o, unsigned l);
 
+    /// account the underlying raw to mempool pool (see common/mempool.h)
+    void reassign_to_mempool(int pool);
   };
 
   friend std::ostream& operator<<(std::ostream& out, const buffer::ptr& bp);
@@ -346,6 +356,9 @@ public:
     void zero();
     void zero(unsigned o, unsigned l);
 
+    /// account all our raws to mempool pool
+    void reassign_to_mempool(int pool);
+
     bool is_contiguous();
     void rebuild();
     void rebuild_page_aligned();
@@ -371,6 +384,8 @@ public:
 
     void append(char c);
     void append(const char *data, unsigned len);
+    /// make room so the next len bytes of small appends go into one buffer
+    void reserve(unsigned len);
     void append(const std::string& s) {
       append(s.data(), s.length());
     }
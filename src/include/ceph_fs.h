@@ -51,6 +51,12 @@
 #define CEPH_FEATURE_PGID64         (1<<9)
 #define CEPH_FEATURE_INCSUBOSDMAP   (1<<10)
 #define CEPH_FEATURE_PGPOOL3        (1<<11)
+#define CEPH_FEATURE_POOLRATELIMIT  (1<<12)
+#define CEPH_FEATURE_OSDMAPCOMPACT  (1<<13)
+#define CEPH_FEATURE_CRUSH_STRAW2   (1<<14)
+#define CEPH_FEATURE_OSD_CACHEPOOL  (1<<15)
+#define CEPH_FEATURE_OSD_ALLOCHINT  (1<<16)
+#define CEPH_FEATURE_OSD_PUSH_DIRTY (1<<17)
 
 /*
  * ceph_file_layout - describe data layout for a file/inode
@@ -418,6 +424,7 @@ union ceph_mds_request_args {
 
 #define CEPH_MDS_FLAG_REPLAY        1  /* this is a replayed op */
 #define CEPH_MDS_FLAG_WANT_DENTRY   2  /* want dentry in reply */
+#define CEPH_MDS_FLAG_WANT_TRACE    4  /* lookup: want every dentry on the path */
 
 struct ceph_mds_request_head {
 	__le64 oldest_client_tid;
@@ -25,6 +25,13 @@ const char *ceph_osd_op_name(int op)
 	case CEPH_OSD_OP_NOTIFY: return "notify";
 	case CEPH_OSD_OP_NOTIFY_ACK: return "notify-ack";
 	case CEPH_OSD_OP_ASSERT_VER: return "assert-version";
+	case CEPH_OSD_OP_LIST_SNAPS: return "list-snaps";
+	case CEPH_OSD_OP_OMAPGETVALS: return "omap-get-vals";
+	case CEPH_OSD_OP_OMAPGETVALSBYKEYS: return "omap-get-vals-by-keys";
+	case CEPH_OSD_OP_OMAPSETVALS: return "omap-set-vals";
+	case CEPH_OSD_OP_OMAPRMKEYS: return "omap-rm-keys";
+	case CEPH_OSD_OP_CHECKSUM: return "checksum";
+	case CEPH_OSD_OP_COPY_GET: return "copy-get";
 
 	case CEPH_OSD_OP_MASKTRUNC: return "masktrunc";
 
@@ -40,6 +47,7 @@ const char *ceph_osd_op_name(int op)
 	case CEPH_OSD_OP_STARTSYNC: return "startsync";
 	case CEPH_OSD_OP_SETTRUNC: return "settrunc";
 	case CEPH_OSD_OP_TRIMTRUNC: return "trimtrunc";
+	case CEPH_OSD_OP_SETALLOCHINT: return "set-alloc-hint";
 
 	case CEPH_OSD_OP_TMAPUP: return "tmapup";
 	case CEPH_OSD_OP_TMAPGET: return "tmapget";
@@ -49,6 +57,7 @@ const char *ceph_osd_op_name(int op)
 	case CEPH_OSD_OP_CLONERANGE: return "clonerange";
 	case CEPH_OSD_OP_ASSERT_SRC_VERSION: return "assert-src-version";
 	case CEPH_OSD_OP_SRC_CMPXATTR: return "src-cmpxattr";
+	case CEPH_OSD_OP_COPY_FROM: return "copy-from";
 
 	case CEPH_OSD_OP_GETXATTR: return "getxattr";
 	case CEPH_OSD_OP_GETXATTRS: return "getxattrs";
@@ -67,6 +76,7 @@ const char *ceph_osd_op_name(int op)
 	case CEPH_OSD_OP_SCRUB_UNRESERVE: return "scrub-unreserve";
 	case CEPH_OSD_OP_SCRUB_STOP: return "scrub-stop";
 	case CEPH_OSD_OP_SCRUB_MAP: return "scrub-map";
+	case CEPH_OSD_OP_BACKFILL_PROGRESS: return "backfill-progress";
 
 	case CEPH_OSD_OP_WRLOCK: return "wrlock";
 	case CEPH_OSD_OP_WRUNLOCK: return "wrunlock";
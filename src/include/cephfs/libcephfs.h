@@ -18,6 +18,7 @@
 #include <utime.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -121,6 +122,29 @@ int ceph_ftruncate(struct ceph_mount_info *cmount, int fd, loff_t size);
 int ceph_fsync(struct ceph_mount_info *cmount, int fd, int syncdataonly);
 int ceph_fstat(struct ceph_mount_info *cmount, int fd, struct stat *stbuf);
 
+/* async file ops
+ *
+ * These return 0 once the op is queued, or a negative error code, in
+ * which case cb is never called.  cb is called from a library thread
+ * when the op completes, with the byte count (reads and writes), 0
+ * (fsync) or a negative error code, and may itself issue more calls.
+ * Buffers and the fd must stay valid until then.  Offsets must be
+ * explicit, and concurrent ops are not ordered against each other: an
+ * fsync covers the writes that completed before it was issued.
+ */
+typedef void (*ceph_aio_callback_t)(void *arg, int r);
+
+int ceph_aio_read(struct ceph_mount_info *cmount, int fd, char *buf, loff_t size,
+		  loff_t offset, ceph_aio_callback_t cb, void *arg);
+int ceph_aio_readv(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+		   int iovcnt, loff_t offset, ceph_aio_callback_t cb, void *arg);
+int ceph_aio_write(struct ceph_mount_info *cmount, int fd, const char *buf, loff_t size,
+		   loff_t offset, ceph_aio_callback_t cb, void *arg);
+int ceph_aio_writev(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+		    int iovcnt, loff_t offset, ceph_aio_callback_t cb, void *arg);
+int ceph_aio_fsync(struct ceph_mount_info *cmount, int fd, int syncdataonly,
+		   ceph_aio_callback_t cb, void *arg);
+
 int ceph_sync_fs(struct ceph_mount_info *cmount);
 
 /* xattr support */
@@ -286,15 +286,15 @@ inline void decode(triple<A,B,C> &t, bufferlist::iterator &p)
 
 
 // list
-template<class T>
-inline void encode(const std::list<T>& ls, bufferlist& bl)
+template<class T, class Alloc>
+inline void encode(const std::list<T, Alloc>& ls, bufferlist& bl)
 {
   // should i pre- or post- count?
   if (!ls.empty()) {
     unsigned pos = bl.length();
     unsigned n = 0;
     encode(n, bl);
-    for (typename std::list<T>::const_iterator p = ls.begin(); p != ls.end(); ++p) {
+    for (typename std::list<T, Alloc>::const_iterator p = ls.begin(); p != ls.end(); ++p) {
       n++;
       encode(*p, bl);
     }
@@ -304,12 +304,12 @@ inline void encode(const std::list<T>& ls, bufferlist& bl)
   } else {
     __u32 n = ls.size();    // FIXME: this is slow on a list.
     encode(n, bl);
-    for (typename std::list<T>::const_iterator p = ls.begin(); p != ls.end(); ++p)
+    for (typename std::list<T, Alloc>::const_iterator p = ls.begin(); p != ls.end(); ++p)
       encode(*p, bl);
   }
 }
-template<class T>
-inline void decode(std::list<T>& ls, bufferlist::iterator& p)
+template<class T, class Alloc>
+inline void decode(std::list<T, Alloc>& ls, bufferlist::iterator& p)
 {
   __u32 n;
   decode(n, p);
@@ -456,28 +456,28 @@ inline void decode(std::map<T,U*>& m, bufferlist::iterator& p)
   }*/
 
 // map
-template<class T, class U>
-inline void encode(const std::map<T,U>& m, bufferlist& bl)
+template<class T, class U, class Comp, class Alloc>
+inline void encode(const std::map<T,U,Comp,Alloc>& m, bufferlist& bl)
 {
   __u32 n = m.size();
   encode(n, bl);
-  for (typename std::map<T,U>::const_iterator p = m.begin(); p != m.end(); ++p) {
+  for (typename std::map<T,U,Comp,Alloc>::const_iterator p = m.begin(); p != m.end(); ++p) {
     encode(p->first, bl);
     encode(p->second, bl);
   }
 }
-template<class T, class U>
-inline void encode(const std::map<T,U>& m, bufferlist& bl, uint64_t features)
+template<class T, class U, class Comp, class Alloc>
+inline void encode(const std::map<T,U,Comp,Alloc>& m, bufferlist& bl, uint64_t features)
 {
   __u32 n = m.size();
   encode(n, bl);
-  for (typename std::map<T,U>::const_iterator p = m.begin(); p != m.end(); ++p) {
+  for (typename std::map<T,U,Comp,Alloc>::const_iterator p = m.begin(); p != m.end(); ++p) {
     encode(p->first, bl, features);
     encode(p->second, bl, features);
   }
 }
-template<class T, class U>
-inline void decode(std::map<T,U>& m, bufferlist::iterator& p)
+template<class T, class U, class Comp, class Alloc>
+inline void decode(std::map<T,U,Comp,Alloc>& m, bufferlist::iterator& p)
 {
   __u32 n;
   decode(n, p);
@@ -303,6 +303,21 @@ public:
     return sobject_t(oid, snap);
   }
 
+  static uint32_t _reverse_nibbles(uint32_t h) {
+    h = ((h & 0x0f0f0f0f) << 4) | ((h & 0xf0f0f0f0) >> 4);
+    h = ((h & 0x00ff00ff) << 8) | ((h & 0xff00ff00) >> 8);
+    return (h << 16) | (h >> 16);
+  }
+
+  /*
+   * The hash, least significant nibble first: the order HashIndex lays
+   * objects out in directories and lists them, and backfill walks them.
+   * hobject_ts sort by this before anything else.
+   */
+  uint32_t get_filestore_key() const {
+    return _reverse_nibbles(hash);
+  }
+
   void encode(bufferlist& bl) const {
     __u8 version = 1;
     ::encode(version, bl);
@@ -322,6 +337,35 @@ public:
   }
 };
 WRITE_CLASS_ENCODER(hobject_t)
+
+inline bool operator==(const hobject_t &l, const hobject_t &r) {
+  return l.hash == r.hash && l.snap == r.snap && l.oid == r.oid &&
+    l.get_key() == r.get_key();
+}
+inline bool operator!=(const hobject_t &l, const hobject_t &r) {
+  return !(l == r);
+}
+inline bool operator<(const hobject_t &l, const hobject_t &r) {
+  if (l.hash != r.hash)
+    return l.get_filestore_key() < r.get_filestore_key();
+  int c = l.oid.name.compare(r.oid.name);
+  if (c)
+    return c < 0;
+  c = l.get_key().compare(r.get_key());
+  if (c)
+    return c < 0;
+  return l.snap < r.snap;
+}
+inline bool operator>(const hobject_t &l, const hobject_t &r) {
+  return r < l;
+}
+inline bool operator<=(const hobject_t &l, const hobject_t &r) {
+  return !(r < l);
+}
+inline bool operator>=(const hobject_t &l, const hobject_t &r) {
+  return !(l < r);
+}
+
 namespace __gnu_cxx {
   template<> struct hash<hobject_t> {
     size_t operator()(const sobject_t &r) const {
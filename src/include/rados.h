@@ -171,6 +171,9 @@ enum {
 	/* versioning */
 	CEPH_OSD_OP_ASSERT_VER = CEPH_OSD_OP_MODE_RD | CEPH_OSD_OP_TYPE_DATA | 8,
 
+	/* clones and their overlaps; sent to CEPH_SNAPDIR */
+	CEPH_OSD_OP_LIST_SNAPS = CEPH_OSD_OP_MODE_RD | CEPH_OSD_OP_TYPE_DATA | 9,
+
 	/* write */
 	CEPH_OSD_OP_WRITE     = CEPH_OSD_OP_MODE_WR | CEPH_OSD_OP_TYPE_DATA | 1,
 	CEPH_OSD_OP_WRITEFULL = CEPH_OSD_OP_MODE_WR | CEPH_OSD_OP_TYPE_DATA | 2,
@@ -193,10 +196,26 @@ enum {
 
 	CEPH_OSD_OP_WATCH   = CEPH_OSD_OP_MODE_WR | CEPH_OSD_OP_TYPE_DATA | 15,
 
+	/* per-object key/value map (omap) */
+	CEPH_OSD_OP_OMAPGETVALS       = CEPH_OSD_OP_MODE_RD | CEPH_OSD_OP_TYPE_DATA | 16,
+	CEPH_OSD_OP_OMAPGETVALSBYKEYS = CEPH_OSD_OP_MODE_RD | CEPH_OSD_OP_TYPE_DATA | 17,
+	CEPH_OSD_OP_OMAPSETVALS       = CEPH_OSD_OP_MODE_WR | CEPH_OSD_OP_TYPE_DATA | 18,
+	CEPH_OSD_OP_OMAPRMKEYS        = CEPH_OSD_OP_MODE_WR | CEPH_OSD_OP_TYPE_DATA | 19,
+
+	/* crc32c of an extent, computed on the osd */
+	CEPH_OSD_OP_CHECKSUM = CEPH_OSD_OP_MODE_RD | CEPH_OSD_OP_TYPE_DATA | 20,
+
+	/* expected object and write sizes, for the filesystem allocator */
+	CEPH_OSD_OP_SETALLOCHINT = CEPH_OSD_OP_MODE_WR | CEPH_OSD_OP_TYPE_DATA | 21,
+
+	/* whole object (data, user xattrs, omap) in one reply; cache promote */
+	CEPH_OSD_OP_COPY_GET = CEPH_OSD_OP_MODE_RD | CEPH_OSD_OP_TYPE_DATA | 22,
+
 	/** multi **/
 	CEPH_OSD_OP_CLONERANGE = CEPH_OSD_OP_MODE_WR | CEPH_OSD_OP_TYPE_MULTI | 1,
 	CEPH_OSD_OP_ASSERT_SRC_VERSION = CEPH_OSD_OP_MODE_RD | CEPH_OSD_OP_TYPE_MULTI | 2,
 	CEPH_OSD_OP_SRC_CMPXATTR = CEPH_OSD_OP_MODE_RD | CEPH_OSD_OP_TYPE_MULTI | 3,
+	CEPH_OSD_OP_COPY_FROM = CEPH_OSD_OP_MODE_WR | CEPH_OSD_OP_TYPE_MULTI | 4,
 
 	/** attrs **/
 	/* read */
@@ -220,6 +239,7 @@ enum {
 	CEPH_OSD_OP_SCRUB_UNRESERVE = CEPH_OSD_OP_MODE_SUB | 7,
 	CEPH_OSD_OP_SCRUB_STOP      = CEPH_OSD_OP_MODE_SUB | 8,
 	CEPH_OSD_OP_SCRUB_MAP     = CEPH_OSD_OP_MODE_SUB | 9,
+	CEPH_OSD_OP_BACKFILL_PROGRESS = CEPH_OSD_OP_MODE_SUB | 10,
 
 	/** lock **/
 	CEPH_OSD_OP_WRLOCK    = CEPH_OSD_OP_MODE_WR | CEPH_OSD_OP_TYPE_LOCK | 1,
@@ -308,13 +328,24 @@ enum {
 	CEPH_OSD_FLAG_EXEC_PUBLIC =    0x1000,  /* op may exec (public) */
 	CEPH_OSD_FLAG_LOCALIZE_READS = 0x2000,  /* read from nearby replica, if any */
 	CEPH_OSD_FLAG_RWORDERED =      0x4000,  /* order wrt concurrent reads */
+	CEPH_OSD_FLAG_IGNORE_OVERLAY = 0x8000,  /* ignore pool overlay (cache tier) */
 };
 
 enum {
 	CEPH_OSD_OP_FLAG_EXCL = 1,      /* EXCL object create */
 	CEPH_OSD_OP_FLAG_FAILOK = 2,    /* continue despite failure */
+	/* page cache hints for the data touched by a read/write */
+	CEPH_OSD_OP_FLAG_FADVISE_RANDOM =     0x4,
+	CEPH_OSD_OP_FLAG_FADVISE_SEQUENTIAL = 0x8,
+	CEPH_OSD_OP_FLAG_FADVISE_WILLNEED =   0x10,
+	CEPH_OSD_OP_FLAG_FADVISE_DONTNEED =   0x20,
 };
 
+#define CEPH_OSD_OP_FLAG_FADVISE_MASK (CEPH_OSD_OP_FLAG_FADVISE_RANDOM |     \
+				       CEPH_OSD_OP_FLAG_FADVISE_SEQUENTIAL | \
+				       CEPH_OSD_OP_FLAG_FADVISE_WILLNEED |   \
+				       CEPH_OSD_OP_FLAG_FADVISE_DONTNEED)
+
 #define EOLDSNAPC    ERESTART  /* ORDERSNAP flag set; writer has old snapc*/
 #define EBLACKLISTED ESHUTDOWN /* blacklisted */
 
@@ -375,6 +406,10 @@ struct ceph_osd_op {
 			__le64 offset, length;
 			__le64 src_offset;
 		} __attribute__ ((packed)) clonerange;
+		struct {
+			__le64 expected_object_size;
+			__le64 expected_write_size;
+		} __attribute__ ((packed)) alloc_hint;
 	};
 	__le32 payload_len;
 } __attribute__ ((packed));
@@ -138,6 +138,8 @@ int rados_ioctx_pool_set_auid(rados_ioctx_t io, uint64_t auid);
 int rados_ioctx_pool_get_auid(rados_ioctx_t io, uint64_t *auid);
 
 void rados_ioctx_locator_set_key(rados_ioctx_t io, const char *key);
+/* cache small objects read through io; see IoCtx::set_read_cache() */
+void rados_ioctx_set_read_cache(rados_ioctx_t io, int on);
 int rados_ioctx_get_id(rados_ioctx_t io);
 
 /* objects */
@@ -145,6 +147,15 @@ int rados_objects_list_open(rados_ioctx_t io, rados_list_ctx_t *ctx);
 int rados_objects_list_next(rados_list_ctx_t ctx, const char **entry);
 void rados_objects_list_close(rados_list_ctx_t ctx);
 
+/*
+ * List just placement group pg, 0 <= pg < pg_num.  Lists of different
+ * pgs are independent, so a pool can be listed in parallel.  Returns
+ * -ERESTART from rados_objects_list_next if the pool's pgs change
+ * meanwhile.
+ */
+int rados_ioctx_get_pg_num(rados_ioctx_t io, uint32_t *pg_num);
+int rados_objects_list_open_pg(rados_ioctx_t io, uint32_t pg, rados_list_ctx_t *ctx);
+
 /* snapshots */
 int rados_ioctx_snap_create(rados_ioctx_t io, const char *snapname);
 int rados_ioctx_snap_remove(rados_ioctx_t io, const char *snapname);
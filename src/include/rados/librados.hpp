@@ -56,6 +56,21 @@ namespace librados
     std::vector<snap_t> snaps;
   };
 
+  const snap_t SNAP_HEAD = (snap_t)-2;
+
+  // one clone of an object, or its head (cloneid SNAP_HEAD)
+  struct clone_info_t {
+    snap_t cloneid;
+    std::vector<snap_t> snaps;   // ascending
+    std::vector< std::pair<uint64_t,uint64_t> > overlap;   // with the next newer clone or head
+    uint64_t size;
+  };
+
+  struct snap_set_t {
+    std::vector<clone_info_t> clones;   // ascending, head last if it exists
+    snap_t seq;
+  };
+
   class ObjectIterator : public std::iterator <std::forward_iterator_tag, std::string> {
   public:
     static const ObjectIterator __EndObjectIterator;
@@ -109,6 +124,18 @@ namespace librados
     OP_FAILOK = 2,
   };
 
+  /*
+   * Where an IoCtx sends its reads.  A balanced read goes to a random
+   * replica, a localized one to a replica on this host if there is one.
+   * A replica that is recovering the object, or has writes to it that
+   * are not yet committed everywhere, sends the read on to the primary.
+   */
+  enum ReadMode {
+    READ_PRIMARY =   0,
+    READ_BALANCED =  1,
+    READ_LOCALIZED = 2,
+  };
+
   /*
    * ObjectOperation : compount object operation
    * Batch multiple object operations into a single request, to be applied
@@ -163,12 +190,26 @@ namespace librados
     void remove();
     void truncate(uint64_t off);
     void zero(uint64_t off, uint64_t len);
+    /**
+     * the object will grow to expected_object_size, written
+     * expected_write_size at a time; the osd may lay it out for that.
+     * only has an effect if the object doesn't exist yet, and creates
+     * it.
+     */
+    void set_alloc_hint(uint64_t expected_object_size, uint64_t expected_write_size);
     void rmxattr(const char *name);
     void setxattr(const char *name, const bufferlist& bl);
     void tmap_update(const bufferlist& cmdbl);
     void clone_range(uint64_t dst_off,
                      const std::string& src_oid, uint64_t src_off,
                      size_t len);
+    /**
+     * replace this object's data and xattrs with those of src_oid (at
+     * snapshot src_snap, if given), which must be stored with the same
+     * locator key; the data does not pass through the client.
+     */
+    void copy_from(const std::string& src_oid);
+    void copy_from(const std::string& src_oid, snap_t src_snap);
 
     friend class IoCtx;
   };
@@ -246,11 +287,16 @@ namespace librados
     int setxattr(const std::string& oid, const char *name, bufferlist& bl);
     int rmxattr(const std::string& oid, const char *name);
     int stat(const std::string& oid, uint64_t *psize, time_t *pmtime);
+    /// crc32c (seeded with -1) of off~len (len 0 for to the end),
+    /// computed by the osd; returns the number of bytes covered
+    int checksum(const std::string& oid, uint64_t off, uint64_t len, uint32_t *crc);
     int exec(const std::string& oid, const char *cls, const char *method,
 	     bufferlist& inbl, bufferlist& outbl);
     int tmap_update(const std::string& oid, bufferlist& cmdbl);
     int tmap_put(const std::string& oid, bufferlist& bl);
     int tmap_get(const std::string& oid, bufferlist& bl);
+    /// clones of oid and how they overlap, without reading any data
+    int list_snaps(const std::string& oid, snap_set_t *out);
 
     void snap_set_read(snap_t seq);
     int selfmanaged_snap_set_write_ctx(snap_t seq, std::vector<snap_t>& snaps);
@@ -282,8 +328,15 @@ namespace librados
     int selfmanaged_snap_rollback(const std::string& oid, uint64_t snapid);
 
     ObjectIterator objects_begin();
+    // list only objects the osd-side filter (as for PGLS_FILTER) passes
+    ObjectIterator objects_begin(const bufferlist& filter);
     const ObjectIterator& objects_end() const;
 
+    // per-pg listing, for listing a pool in parallel; see
+    // rados_objects_list_open_pg
+    int get_pg_num(uint32_t *pg_num);
+    ObjectIterator pg_objects_begin(uint32_t pg, const bufferlist& filter = bufferlist());
+
     uint64_t get_last_version();
 
     int aio_read(const std::string& oid, AioCompletion *c,
@@ -306,6 +359,16 @@ namespace librados
     int operate(const std::string& oid, ObjectWriteOperation *op);
     int operate(const std::string& oid, ObjectReadOperation *op, bufferlist *pbl);
     int aio_operate(const std::string& oid, AioCompletion *c, ObjectOperation *op);
+    int aio_operate(const std::string& oid, AioCompletion *c, ObjectReadOperation *op,
+		    bufferlist *pbl);
+    /**
+     * submit ops[i] against oids[i], completing cs[i], for each i, all
+     * under one client lock acquisition.  The ops are independent; each
+     * completion reports its own op's result.
+     */
+    int aio_operate_batch(const std::vector<std::string>& oids,
+			  const std::vector<AioCompletion*>& cs,
+			  const std::vector<ObjectWriteOperation*>& ops);
 
     // watch/notify
     int watch(const std::string& o, uint64_t ver, uint64_t *handle,
@@ -322,6 +385,17 @@ namespace librados
 
     void locator_set_key(const std::string& key);
 
+    // read from the primary (default) or spread reads over the replicas
+    void set_read_mode(ReadMode mode);
+
+    /*
+     * Serve read, getxattr(s) and stat of objects up to
+     * rados_cache_max_object_size from a cache.  Writes from this
+     * client and notifies on watched objects invalidate; other writers
+     * are noticed within rados_cache_ttl seconds.
+     */
+    void set_read_cache(bool on);
+
     int get_id();
 
     CephContext *cct();
@@ -63,6 +63,11 @@ void rbd_version(int *major, int *minor, int *extra);
 /* images */
 int rbd_list(rados_ioctx_t io, char *names, size_t *size);
 int rbd_create(rados_ioctx_t io, const char *name, uint64_t size, int *order);
+/* striped over stripe_count objects in stripe_unit pieces; 0 for the defaults */
+int rbd_create2(rados_ioctx_t io, const char *name, uint64_t size, int *order,
+		uint64_t stripe_unit, uint64_t stripe_count);
+int rbd_clone(rados_ioctx_t p_ioctx, const char *p_name, const char *p_snapname,
+	      rados_ioctx_t c_ioctx, const char *c_name, int *c_order);
 int rbd_remove(rados_ioctx_t io, const char *name);
 int rbd_remove_with_progress(rados_ioctx_t io, const char *name,
 			     librbd_progress_fn_t cb, void *cbdata);
@@ -74,9 +79,13 @@ int rbd_resize(rbd_image_t image, uint64_t size);
 int rbd_resize_with_progress(rbd_image_t image, uint64_t size,
 			     librbd_progress_fn_t cb, void *cbdata);
 int rbd_stat(rbd_image_t image, rbd_image_info_t *info, size_t infosize);
+int rbd_get_stripe_unit(rbd_image_t image, uint64_t *stripe_unit);
+int rbd_get_stripe_count(rbd_image_t image, uint64_t *stripe_count);
 int rbd_copy(rbd_image_t image, rados_ioctx_t dest_io_ctx, const char *destname);
 int rbd_copy_with_progress(rbd_image_t image, rados_ioctx_t dest_p, const char *destname,
 			   librbd_progress_fn_t cb, void *cbdata);
+int rbd_flatten(rbd_image_t image);
+int rbd_flatten_with_progress(rbd_image_t image, librbd_progress_fn_t cb, void *cbdata);
 
 /* snapshots */
 int rbd_snap_list(rbd_image_t image, rbd_snap_info_t *snaps, int *max_snaps);
@@ -94,8 +103,15 @@ typedef void (*rbd_callback_t)(rbd_completion_t cb, void *arg);
 ssize_t rbd_read(rbd_image_t image, uint64_t ofs, size_t len, char *buf);
 int64_t rbd_read_iterate(rbd_image_t image, uint64_t ofs, size_t len,
 			 int (*cb)(uint64_t, size_t, const char *, void *), void *arg);
+/* extents changed since fromsnapname (NULL for all data); cb gets (ofs, len, exists, arg) */
+int rbd_diff_iterate(rbd_image_t image, const char *fromsnapname,
+		     uint64_t ofs, uint64_t len,
+		     int (*cb)(uint64_t, size_t, int, void *), void *arg);
 ssize_t rbd_write(rbd_image_t image, uint64_t ofs, size_t len, const char *buf);
 int rbd_aio_write(rbd_image_t image, uint64_t off, size_t len, const char *buf, rbd_completion_t c);
+/* free ofs~len; it reads as zeros afterwards */
+ssize_t rbd_discard(rbd_image_t image, uint64_t ofs, uint64_t len);
+int rbd_aio_discard(rbd_image_t image, uint64_t off, uint64_t len, rbd_completion_t c);
 int rbd_aio_read(rbd_image_t image, uint64_t off, size_t len, char *buf, rbd_completion_t c);
 int rbd_aio_create_completion(void *cb_arg, rbd_callback_t complete_cb, rbd_completion_t *c);
 int rbd_aio_wait_for_complete(rbd_completion_t c);
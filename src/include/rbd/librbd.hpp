@@ -68,6 +68,12 @@ public:
   int open(IoCtx& io_ctx, Image& image, const char *name, const char *snapname);
   int list(IoCtx& io_ctx, std::vector<std::string>& names);
   int create(IoCtx& io_ctx, const char *name, uint64_t size, int *order);
+  /* striped over stripe_count objects in stripe_unit pieces; 0 for the defaults */
+  int create2(IoCtx& io_ctx, const char *name, uint64_t size, int *order,
+	      uint64_t stripe_unit, uint64_t stripe_count);
+  /* a copy-on-write child of p_name@p_snapname; same pool only, for now */
+  int clone(IoCtx& p_ioctx, const char *p_name, const char *p_snapname,
+	    IoCtx& c_ioctx, const char *c_name, int *c_order);
   int remove(IoCtx& io_ctx, const char *name);
   int remove_with_progress(IoCtx& io_ctx, const char *name, ProgressContext& pctx);
   int rename(IoCtx& src_io_ctx, const char *srcname, const char *destname);
@@ -87,9 +93,14 @@ public:
   int resize(uint64_t size);
   int resize_with_progress(uint64_t size, ProgressContext& pctx);
   int stat(image_info_t &info, size_t infosize);
+  int get_stripe_unit(uint64_t *stripe_unit);
+  int get_stripe_count(uint64_t *stripe_count);
   int copy(IoCtx& dest_io_ctx, const char *destname);
   int copy_with_progress(IoCtx& dest_io_ctx, const char *destname,
 			 ProgressContext &prog_ctx);
+  /* copy up everything still read from the parent, and detach from it */
+  int flatten();
+  int flatten_with_progress(ProgressContext &prog_ctx);
 
   /* snapshots */
   int snap_list(std::vector<snap_info_t>& snaps);
@@ -103,9 +114,20 @@ public:
   ssize_t read(uint64_t ofs, size_t len, ceph::bufferlist& bl);
   int64_t read_iterate(uint64_t ofs, size_t len,
 		       int (*cb)(uint64_t, size_t, const char *, void *), void *arg);
+  /**
+   * report the extents changed between fromsnapname (NULL for the
+   * beginning of time) and the snap being read, or head; cb gets
+   * (offset, length, exists) for each. Uses object clone information
+   * only, no data is read.
+   */
+  int diff_iterate(const char *fromsnapname, uint64_t ofs, uint64_t len,
+		   int (*cb)(uint64_t, size_t, int, void *), void *arg);
   ssize_t write(uint64_t ofs, size_t len, ceph::bufferlist& bl);
+  /* free ofs~len without writing zeros; it reads as zeros afterwards */
+  ssize_t discard(uint64_t ofs, uint64_t len);
 
   int aio_write(uint64_t off, size_t len, ceph::bufferlist& bl, RBD::AioCompletion *c);
+  int aio_discard(uint64_t off, uint64_t len, RBD::AioCompletion *c);
   int aio_read(uint64_t off, size_t len, ceph::bufferlist& bl, RBD::AioCompletion *c);
 
   int flush();
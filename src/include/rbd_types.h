@@ -36,6 +36,15 @@
 #define RBD_CRYPT_NONE		0
 
 #define RBD_HEADER_TEXT		"<<< Rados Block Device Image >>>\n"
+/*
+ * Striped images: the striping is in the RBD_STRIPE_ATTR xattr on the
+ * header object, so the header says so, and clients that would map
+ * the image unstriped refuse it.  Through cls_rbd snap_list, userspace
+ * clients say they understand it with RBD_SNAP_LIST_STRIPING.
+ */
+#define RBD_HEADER_TEXT_STRIPED	"<<< Striped Rados Block Device >>>\n"
+#define RBD_STRIPE_ATTR		"rbd.stripe"
+#define RBD_SNAP_LIST_STRIPING	1
 #define RBD_HEADER_SIGNATURE	"RBD"
 #define RBD_HEADER_VERSION	"001.005"
 
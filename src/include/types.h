@@ -136,9 +136,9 @@ inline ostream& operator<<(ostream& out, const deque<A>& v) {
   return out;
 }
 
-template<class A>
-inline ostream& operator<<(ostream& out, const list<A>& ilist) {
-  for (typename list<A>::const_iterator it = ilist.begin();
+template<class A, class Alloc>
+inline ostream& operator<<(ostream& out, const list<A, Alloc>& ilist) {
+  for (typename list<A, Alloc>::const_iterator it = ilist.begin();
        it != ilist.end();
        it++) {
     if (it != ilist.begin()) out << ",";
@@ -169,11 +169,11 @@ inline ostream& operator<<(ostream& out, const multiset<A>& iset) {
   return out;
 }
 
-template<class A,class B>
-inline ostream& operator<<(ostream& out, const map<A,B>& m) 
+template<class A,class B,class Comp,class Alloc>
+inline ostream& operator<<(ostream& out, const map<A,B,Comp,Alloc>& m)
 {
   out << "{";
-  for (typename map<A,B>::const_iterator it = m.begin();
+  for (typename map<A,B,Comp,Alloc>::const_iterator it = m.begin();
        it != m.end();
        it++) {
     if (it != m.begin()) out << ",";
@@ -516,6 +516,97 @@ extern "C" int ceph_fstat(struct ceph_mount_info *cmount, int fd, struct stat *s
   return cmount->get_client()->fstat(fd, stbuf);
 }
 
+/*
+ * completes an async op for the caller: scatters read data into its
+ * buffers, then calls back.
+ */
+class C_AioCallback : public Context {
+  ceph_aio_callback_t cb;
+  void *arg;
+public:
+  bufferlist bl;
+  std::vector<struct iovec> iov;   // where read data goes
+
+  C_AioCallback(ceph_aio_callback_t c, void *a) : cb(c), arg(a) {}
+  void finish(int r) {
+    if (r >= 0 && !iov.empty()) {
+      unsigned off = 0;
+      for (std::vector<struct iovec>::iterator p = iov.begin();
+	   p != iov.end() && off < bl.length();
+	   ++p) {
+	unsigned len = MIN(p->iov_len, bl.length() - off);
+	bl.copy(off, len, (char*)p->iov_base);
+	off += len;
+      }
+      r = bl.length();
+    }
+    cb(arg, r);
+  }
+};
+
+extern "C" int ceph_aio_readv(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+			      int iovcnt, loff_t offset, ceph_aio_callback_t cb, void *arg)
+{
+  if (iovcnt < 0 || !cb)
+    return -EINVAL;
+  C_AioCallback *c = new C_AioCallback(cb, arg);
+  loff_t size = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    c->iov.push_back(iov[i]);
+    size += iov[i].iov_len;
+  }
+  int r = cmount->get_client()->aio_read(fd, &c->bl, size, offset, c);
+  if (r < 0)
+    delete c;
+  return r;
+}
+
+extern "C" int ceph_aio_read(struct ceph_mount_info *cmount, int fd, char *buf, loff_t size,
+			     loff_t offset, ceph_aio_callback_t cb, void *arg)
+{
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = size;
+  return ceph_aio_readv(cmount, fd, &iov, 1, offset, cb, arg);
+}
+
+extern "C" int ceph_aio_writev(struct ceph_mount_info *cmount, int fd, const struct iovec *iov,
+			       int iovcnt, loff_t offset, ceph_aio_callback_t cb, void *arg)
+{
+  if (iovcnt < 0 || !cb)
+    return -EINVAL;
+  // copy now, like ceph_write
+  bufferlist bl;
+  for (int i = 0; i < iovcnt; i++)
+    bl.append((const char*)iov[i].iov_base, iov[i].iov_len);
+  C_AioCallback *c = new C_AioCallback(cb, arg);
+  int r = cmount->get_client()->aio_write(fd, bl, offset, c);
+  if (r < 0)
+    delete c;
+  return r;
+}
+
+extern "C" int ceph_aio_write(struct ceph_mount_info *cmount, int fd, const char *buf,
+			      loff_t size, loff_t offset, ceph_aio_callback_t cb, void *arg)
+{
+  struct iovec iov;
+  iov.iov_base = (void*)buf;
+  iov.iov_len = size;
+  return ceph_aio_writev(cmount, fd, &iov, 1, offset, cb, arg);
+}
+
+extern "C" int ceph_aio_fsync(struct ceph_mount_info *cmount, int fd, int syncdataonly,
+			      ceph_aio_callback_t cb, void *arg)
+{
+  if (!cb)
+    return -EINVAL;
+  C_AioCallback *c = new C_AioCallback(cb, arg);
+  int r = cmount->get_client()->aio_fsync(fd, syncdataonly, c);
+  if (r < 0)
+    delete c;
+  return r;
+}
+
 extern "C" int ceph_sync_fs(struct ceph_mount_info *cmount)
 {
   return cmount->get_client()->sync_fs();
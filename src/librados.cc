@@ -35,11 +35,13 @@ using namespace std;
 
 #include "common/ceph_argparse.h"
 #include "common/Timer.h"
+#include "common/Finisher.h"
 #include "common/common_init.h"
 
 #include "mon/MonClient.h"
 
 #include "osdc/Objecter.h"
+#include "osdc/SmallObjectCache.h"
 
 #include "include/rados/librados.h"
 #include "include/rados/librados.hpp"
@@ -89,6 +91,8 @@ struct librados::IoCtxImpl {
   eversion_t last_objver;
   uint32_t notify_timeout;
   object_locator_t oloc;
+  int read_flags;   // CEPH_OSD_FLAG_{BALANCE,LOCALIZE}_READS, per read mode
+  bool read_cache;  // serve small objects from the client's cache
 
   Mutex aio_write_list_lock;
   tid_t aio_write_seq;
@@ -110,6 +114,8 @@ struct librados::IoCtxImpl {
     last_objver = rhs.last_objver;
     notify_timeout = rhs.notify_timeout;
     oloc = rhs.oloc;
+    read_flags = rhs.read_flags;
+    read_cache = rhs.read_cache;
   }
 
   void set_snap_read(snapid_t s);
@@ -258,6 +264,13 @@ void librados::ObjectWriteOperation::zero(uint64_t off, uint64_t len)
   o->zero(off, len);
 }
 
+void librados::ObjectWriteOperation::set_alloc_hint(uint64_t expected_object_size,
+						    uint64_t expected_write_size)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)impl;
+  o->set_alloc_hint(expected_object_size, expected_write_size);
+}
+
 void librados::ObjectWriteOperation::rmxattr(const char *name)
 {
   ::ObjectOperation *o = (::ObjectOperation *)impl;
@@ -285,6 +298,17 @@ void librados::ObjectWriteOperation::clone_range(uint64_t dst_off,
   o->clone_range(src_oid, src_off, len, dst_off);
 }
 
+void librados::ObjectWriteOperation::copy_from(const std::string& src_oid)
+{
+  copy_from(src_oid, CEPH_NOSNAP);
+}
+
+void librados::ObjectWriteOperation::copy_from(const std::string& src_oid, snap_t src_snap)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)impl;
+  o->copy_from(src_oid, src_snap);
+}
+
 librados::WatchCtx::
 ~WatchCtx()
 {
@@ -539,12 +563,46 @@ private:
   Cond cond;
   SafeTimer timer;
 
+  /*
+   * aio callbacks run here rather than in the dispatch thread, so that
+   * user code runs without our lock and does not hold up replies for
+   * other ops.  Callbacks are ordered by completion, so each one's ack
+   * and safe callbacks stay in order.
+   */
+  Finisher *finisher;
+
+  /*
+   * Small objects read through IoCtxs with read_cache set.  Every write
+   * from this client invalidates, whatever its IoCtx; so does a notify
+   * on a watch of the object.  Other clients' writes are seen by asking
+   * the osd for the version once an entry is rados_cache_ttl old.
+   */
+  SmallObjectCache obj_cache;
+
+  SmallObjectCache::key_t cache_key(IoCtxImpl& io, const object_t& oid) {
+    return SmallObjectCache::key_t(make_pair(io.poolid, io.oloc.key),
+				   sobject_t(oid, io.snap_seq));
+  }
+  bool use_cache(IoCtxImpl& io) {
+    // assertions have to be checked by the osd
+    return io.read_cache && obj_cache.enabled() &&
+      !io.assert_ver && io.assert_src_version.empty();
+  }
+  /// writes go to the head
+  void cache_invalidate(IoCtxImpl& io, const object_t& oid) {
+    obj_cache.invalidate(SmallObjectCache::key_t(make_pair(io.poolid, io.oloc.key),
+						 sobject_t(oid, CEPH_NOSNAP)));
+  }
+  int cache_get(IoCtxImpl& io, const object_t& oid, SmallObjectCache::Object *o);
+
 public:
   RadosClient(CephContext *cct_) : Dispatcher(cct_),
 		  cct(cct_), conf(cct_->_conf),
 		  state(DISCONNECTED), monclient(cct_),
 		  messenger(NULL), objecter(NULL),
-		  lock("radosclient"), timer(cct, lock), max_watch_cookie(0)
+		  lock("radosclient"), timer(cct, lock), finisher(NULL),
+		  obj_cache(cct_->_conf->rados_cache_max_objects),
+		  max_watch_cookie(0)
   {
   }
 
@@ -552,6 +610,13 @@ public:
   int connect();
   void shutdown();
 
+  /// route an aio completion's callback through the finisher, if we have one
+  Context *aio_context(AioCompletionImpl *c, Context *ctx) {
+    if (!finisher)
+      return ctx;
+    return new C_OnFinisher(ctx, finisher, (uintptr_t)c);
+  }
+
   int64_t lookup_pool(const char *name) {
     int64_t ret = osdmap.lookup_pg_pool_name(name);
     if (ret < 0)
@@ -599,6 +664,8 @@ public:
   int tmap_update(IoCtxImpl& io, const object_t& oid, bufferlist& cmdbl);
   int tmap_put(IoCtxImpl& io, const object_t& oid, bufferlist& bl);
   int tmap_get(IoCtxImpl& io, const object_t& oid, bufferlist& bl);
+  int list_snaps(IoCtxImpl& io, const object_t& oid, snap_set_t *out);
+  int checksum(IoCtxImpl& io, const object_t& oid, uint64_t off, uint64_t len, uint32_t *crc);
 
   int exec(IoCtxImpl& io, const object_t& oid, const char *cls, const char *method, bufferlist& inbl, bufferlist& outbl);
 
@@ -617,6 +684,7 @@ public:
   int pool_delete(const char *name);
   int pool_change_auid(rados_ioctx_t io, unsigned long long auid);
   int pool_get_auid(rados_ioctx_t io, unsigned long long *auid);
+  int pool_get_pg_num(rados_ioctx_t io, uint32_t *pg_num);
 
   int pool_delete_async(const char *name, PoolAsyncCompletionImpl *c);
   int pool_change_auid_async(rados_ioctx_t io, unsigned long long auid, PoolAsyncCompletionImpl *c);
@@ -626,6 +694,11 @@ public:
   int operate(IoCtxImpl& io, const object_t& oid, ::ObjectOperation *o, time_t *pmtime);
   int operate_read(IoCtxImpl& io, const object_t& oid, ::ObjectOperation *o, bufferlist *pbl);
   int aio_operate(IoCtxImpl& io, const object_t& oid, ::ObjectOperation *o, AioCompletionImpl *c);
+  int aio_operate_read(IoCtxImpl& io, const object_t& oid, ::ObjectOperation *o,
+		       AioCompletionImpl *c, bufferlist *pbl);
+  int aio_operate_batch(IoCtxImpl& io, const vector<object_t>& oids,
+			const vector< ::ObjectOperation*>& ops,
+			const vector<AioCompletionImpl*>& cs);
 
   struct C_aio_Ack : public Context {
     AioCompletionImpl *c;
@@ -636,8 +709,18 @@ public:
       c->cond.Signal();
 
       if (c->buf && c->bl.length() > 0) {
+	// the messenger normally read the data straight into buf (see
+	// aio_read); only copy the pieces that landed somewhere else
 	unsigned l = MIN(c->bl.length(), c->maxlen);
-	c->bl.copy(0, l, c->buf);
+	unsigned off = 0;
+	for (std::list<bufferptr>::const_iterator p = c->bl.buffers().begin();
+	     p != c->bl.buffers().end() && off < l;
+	     ++p) {
+	  unsigned n = MIN(p->length(), l - off);
+	  if (p->c_str() != c->buf + off)
+	    memcpy(c->buf + off, p->c_str(), n);
+	  off += n;
+	}
 	c->rval = c->bl.length();
       }
       if (c->pbl) {
@@ -799,6 +882,8 @@ public:
       io_ctx_impl->put();
     }
     void notify(RadosClient *client, MWatchNotify *m) {
+      // whoever notified has likely changed the object
+      client->cache_invalidate(*io_ctx_impl, oid);
       ctx->notify(m->opcode, m->ver, m->bl);
       if (m->opcode != WATCH_NOTIFY_COMPLETE) {
         client->_notify_ack(*io_ctx_impl, oid, m->notify_id, m->ver);
@@ -873,7 +958,8 @@ public:
 };
 
 librados::IoCtxImpl::IoCtxImpl()
-  : aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock")
+  : read_flags(0), read_cache(false),
+    aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock")
 {
 }
 
@@ -881,6 +967,7 @@ librados::IoCtxImpl::IoCtxImpl(RadosClient *c, int pid, const char *pool_name_,
   : ref_cnt(0), client(c), poolid(pid),
   pool_name(pool_name_), snap_seq(s), assert_ver(0),
   notify_timeout(c->cct->_conf->client_notify_timeout), oloc(pid),
+  read_flags(0), read_cache(false),
   aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock"), aio_write_seq(0)
 {
 }
@@ -939,9 +1026,15 @@ int librados::RadosClient::connect()
   if (!objecter)
     goto out;
   objecter->set_balanced_budget();
+  obj_cache.set_max(conf->rados_cache_max_objects);
 
   monclient.set_messenger(messenger);
 
+  if (conf->rados_completion_threads > 0) {
+    finisher = new Finisher(cct, conf->rados_completion_threads);
+    finisher->start();
+  }
+
   messenger->add_dispatcher_head(this);
 
   nonce = getpid() + (1000000 * (uint64_t)rados_instance.inc());
@@ -1003,6 +1096,13 @@ void librados::RadosClient::shutdown()
     messenger->shutdown();
     messenger->wait();
   }
+  // no more replies can arrive; run what they queued
+  if (finisher) {
+    finisher->wait_for_empty();
+    finisher->stop();
+    delete finisher;
+    finisher = NULL;
+  }
   ldout(cct, 1) << "shutdown" << dendl;
 }
 
@@ -1206,6 +1306,8 @@ int librados::RadosClient::selfmanaged_snap_rollback_object(rados_ioctx_t io,
   bool done;
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &reply);
 
+  cache_invalidate(*ctx, oid);
+
   lock.Lock();
   objecter->rollback_object(oid, ctx->oloc, snapc, snapid,
 		     ceph_clock_now(cct), onack, NULL);
@@ -1374,6 +1476,17 @@ int librados::RadosClient::pool_get_auid(rados_ioctx_t io, unsigned long long *a
   return 0;
 }
 
+int librados::RadosClient::pool_get_pg_num(rados_ioctx_t io, uint32_t *pg_num)
+{
+  Mutex::Locker l(lock);
+  int64_t pool_id = ((IoCtxImpl *)io)->poolid;
+  const pg_pool_t *pg = osdmap.get_pg_pool(pool_id);
+  if (!pg)
+    return -ENOENT;
+  *pg_num = pg->get_pg_num();
+  return 0;
+}
+
 int librados::RadosClient::snap_list(IoCtxImpl *io, vector<uint64_t> *snaps)
 {
   Mutex::Locker l(lock);
@@ -1458,6 +1571,8 @@ int librados::RadosClient::create(IoCtxImpl& io, const object_t& oid, bool exclu
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::create::mylock");
   Cond cond;
   bool done;
@@ -1491,6 +1606,8 @@ int librados::RadosClient::create(IoCtxImpl& io, const object_t& oid, bool exclu
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::create::mylock");
   Cond cond;
   bool done;
@@ -1552,6 +1669,8 @@ int librados::RadosClient::write(IoCtxImpl& io, const object_t& oid, bufferlist&
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::write::mylock");
   Cond cond;
   bool done;
@@ -1591,6 +1710,8 @@ int librados::RadosClient::append(IoCtxImpl& io, const object_t& oid, bufferlist
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::append::mylock");
   Cond cond;
   bool done;
@@ -1629,6 +1750,8 @@ int librados::RadosClient::write_full(IoCtxImpl& io, const object_t& oid, buffer
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::write_full::mylock");
   Cond cond;
   bool done;
@@ -1668,6 +1791,8 @@ int librados::RadosClient::clone_range(IoCtxImpl& io,
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, dst_oid);
+
   Mutex mylock("RadosClient::clone_range::mylock");
   Cond cond;
   bool done;
@@ -1708,6 +1833,8 @@ int librados::RadosClient::operate(IoCtxImpl& io, const object_t& oid,
   if (io.snap_seq != CEPH_NOSNAP)
     return -EINVAL;
 
+  cache_invalidate(io, oid);
+
   if (!o->size())
     return 0;
 
@@ -1755,7 +1882,7 @@ int librados::RadosClient::operate_read(IoCtxImpl& io, const object_t& oid,
 
   lock.Lock();
   objecter->read(oid, io.oloc,
-	           *o, io.snap_seq, pbl, 0,
+	           *o, io.snap_seq, pbl, io.read_flags,
 	           onack, &ver);
   lock.Unlock();
 
@@ -1777,27 +1904,73 @@ int librados::RadosClient::aio_operate(IoCtxImpl& io, const object_t& oid,
   if (io.snap_seq != CEPH_NOSNAP)
     return -EINVAL;
 
-  Context *onack = new C_aio_Ack(c);
-  Context *oncommit = new C_aio_Safe(c);
+  cache_invalidate(io, oid);
+
+  Context *onack = aio_context(c, new C_aio_Ack(c));
+  Context *oncommit = aio_context(c, new C_aio_Safe(c));
 
   io.queue_aio_write(c);
+  Mutex::Locker l(lock);
   objecter->mutate(oid, io.oloc, *o, io.snapc, ut, 0, onack, oncommit, &c->objver);
 
   return 0;
 }
 
+int librados::RadosClient::aio_operate_read(IoCtxImpl& io, const object_t& oid,
+					    ::ObjectOperation *o, AioCompletionImpl *c,
+					    bufferlist *pbl)
+{
+  Context *onack = aio_context(c, new C_aio_Ack(c));
+
+  c->pbl = pbl;
+
+  Mutex::Locker l(lock);
+  objecter->read(oid, io.oloc,
+		 *o, io.snap_seq, &c->bl, io.read_flags,
+		 onack, &c->objver);
+  return 0;
+}
+
+int librados::RadosClient::aio_operate_batch(IoCtxImpl& io, const vector<object_t>& oids,
+					     const vector< ::ObjectOperation*>& ops,
+					     const vector<AioCompletionImpl*>& cs)
+{
+  utime_t ut = ceph_clock_now(cct);
+  if (io.snap_seq != CEPH_NOSNAP)
+    return -EINVAL;
+  if (oids.size() != ops.size() || oids.size() != cs.size())
+    return -EINVAL;
+
+  vector<Context*> onack(cs.size()), oncommit(cs.size());
+  for (unsigned i = 0; i < cs.size(); i++) {
+    onack[i] = aio_context(cs[i], new C_aio_Ack(cs[i]));
+    oncommit[i] = aio_context(cs[i], new C_aio_Safe(cs[i]));
+    io.queue_aio_write(cs[i]);
+    cache_invalidate(io, oids[i]);
+  }
+
+  // the messenger writes back-to-back messages for the same osd with a
+  // single sendmsg, so submitting them together is all the batching we need
+  Mutex::Locker l(lock);
+  for (unsigned i = 0; i < cs.size(); i++)
+    objecter->mutate(oids[i], io.oloc, *ops[i], io.snapc, ut, 0,
+		     onack[i], oncommit[i], &cs[i]->objver);
+  ldout(cct, 20) << "aio_operate_batch submitted " << cs.size() << " ops" << dendl;
+  return 0;
+}
+
 int librados::RadosClient::aio_read(IoCtxImpl& io, const object_t oid, AioCompletionImpl *c,
 				    bufferlist *pbl, size_t len, uint64_t off)
 {
 
-  Context *onack = new C_aio_Ack(c);
+  Context *onack = aio_context(c, new C_aio_Ack(c));
   eversion_t ver;
 
   c->pbl = pbl;
 
   Mutex::Locker l(lock);
   objecter->read(oid, io.oloc,
-		 off, len, io.snap_seq, &c->bl, 0,
+		 off, len, io.snap_seq, &c->bl, io.read_flags,
 		 onack, &c->objver);
   return 0;
 }
@@ -1805,14 +1978,18 @@ int librados::RadosClient::aio_read(IoCtxImpl& io, const object_t oid, AioComple
 int librados::RadosClient::aio_read(IoCtxImpl& io, const object_t oid, AioCompletionImpl *c,
 				    char *buf, size_t len, uint64_t off)
 {
-  Context *onack = new C_aio_Ack(c);
+  Context *onack = aio_context(c, new C_aio_Ack(c));
 
   c->buf = buf;
   c->maxlen = len;
+  // offer the caller's buffer to the messenger as the rx buffer for
+  // the reply, so the data is received in place
+  c->bl.clear();
+  c->bl.push_back(buffer::create_static(len, buf));
 
   Mutex::Locker l(lock);
   objecter->read(oid, io.oloc,
-		 off, len, io.snap_seq, &c->bl, 0,
+		 off, len, io.snap_seq, &c->bl, io.read_flags,
 		 onack, &c->objver);
 
   return 0;
@@ -1823,16 +2000,17 @@ int librados::RadosClient::aio_sparse_read(IoCtxImpl& io, const object_t oid,
 					   bufferlist *data_bl, size_t len, uint64_t off)
 {
 
-  C_aio_sparse_read_Ack *onack = new C_aio_sparse_read_Ack(c);
-  onack->m = m;
-  onack->data_bl = data_bl;
+  C_aio_sparse_read_Ack *ack = new C_aio_sparse_read_Ack(c);
+  ack->m = m;
+  ack->data_bl = data_bl;
+  Context *onack = aio_context(c, ack);
   eversion_t ver;
 
   c->pbl = NULL;
 
   Mutex::Locker l(lock);
   objecter->sparse_read(oid, io.oloc,
-		 off, len, io.snap_seq, &c->bl, 0,
+		 off, len, io.snap_seq, &c->bl, io.read_flags,
 		 onack);
   return 0;
 }
@@ -1846,10 +2024,12 @@ int librados::RadosClient::aio_write(IoCtxImpl& io, const object_t &oid, AioComp
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   io.queue_aio_write(c);
 
-  Context *onack = new C_aio_Ack(c);
-  Context *onsafe = new C_aio_Safe(c);
+  Context *onack = aio_context(c, new C_aio_Ack(c));
+  Context *onsafe = aio_context(c, new C_aio_Safe(c));
 
   Mutex::Locker l(lock);
   objecter->write(oid, io.oloc,
@@ -1868,10 +2048,12 @@ int librados::RadosClient::aio_append(IoCtxImpl& io, const object_t &oid, AioCom
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   io.queue_aio_write(c);
 
-  Context *onack = new C_aio_Ack(c);
-  Context *onsafe = new C_aio_Safe(c);
+  Context *onack = aio_context(c, new C_aio_Ack(c));
+  Context *onsafe = aio_context(c, new C_aio_Safe(c));
 
   Mutex::Locker l(lock);
   objecter->append(oid, io.oloc,
@@ -1890,10 +2072,12 @@ int librados::RadosClient::aio_write_full(IoCtxImpl& io, const object_t &oid,
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   io.queue_aio_write(c);
 
-  Context *onack = new C_aio_Ack(c);
-  Context *onsafe = new C_aio_Safe(c);
+  Context *onack = aio_context(c, new C_aio_Ack(c));
+  Context *onsafe = aio_context(c, new C_aio_Safe(c));
 
   Mutex::Locker l(lock);
   objecter->write_full(oid, io.oloc,
@@ -1911,6 +2095,8 @@ int librados::RadosClient::remove(IoCtxImpl& io, const object_t& oid)
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::remove::mylock");
   Cond cond;
   bool done;
@@ -1945,6 +2131,8 @@ int librados::RadosClient::trunc(IoCtxImpl& io, const object_t& oid, uint64_t si
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::write_full::mylock");
   Cond cond;
   bool done;
@@ -1981,6 +2169,8 @@ int librados::RadosClient::tmap_update(IoCtxImpl& io, const object_t& oid, buffe
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::tmap_update::mylock");
   Cond cond;
   bool done;
@@ -2015,6 +2205,8 @@ int librados::RadosClient::tmap_put(IoCtxImpl& io, const object_t& oid, bufferli
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::tmap_put::mylock");
   Cond cond;
   bool done;
@@ -2060,7 +2252,7 @@ int librados::RadosClient::tmap_get(IoCtxImpl& io, const object_t& oid, bufferli
   ::ObjectOperation rd;
   prepare_assert_ops(&io, &rd);
   rd.tmap_get();
-  objecter->read(oid, io.oloc, rd, io.snap_seq, &bl, 0, onack, &ver);
+  objecter->read(oid, io.oloc, rd, io.snap_seq, &bl, io.read_flags, onack, &ver);
   lock.Unlock();
 
   mylock.Lock();
@@ -2073,6 +2265,51 @@ int librados::RadosClient::tmap_get(IoCtxImpl& io, const object_t& oid, bufferli
   return r;
 }
 
+int librados::RadosClient::list_snaps(IoCtxImpl& io, const object_t& oid, snap_set_t *out)
+{
+  Mutex mylock("RadosClient::list_snaps::mylock");
+  Cond cond;
+  bool done;
+  int r;
+  Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
+  eversion_t ver;
+  bufferlist bl;
+
+  lock.Lock();
+  ::ObjectOperation rd;
+  prepare_assert_ops(&io, &rd);
+  rd.list_snaps();
+  objecter->read(oid, io.oloc, rd, CEPH_SNAPDIR, &bl, 0, onack, &ver);
+  lock.Unlock();
+
+  mylock.Lock();
+  while (!done)
+    cond.Wait(mylock);
+  mylock.Unlock();
+
+  set_sync_op_version(io, ver);
+  if (r < 0)
+    return r;
+
+  obj_list_snap_response_t resp;
+  try {
+    bufferlist::iterator p = bl.begin();
+    ::decode(resp, p);
+  } catch (buffer::error& e) {
+    return -EIO;
+  }
+  out->seq = resp.seq;
+  out->clones.clear();
+  for (vector<clone_info>::iterator p = resp.clones.begin(); p != resp.clones.end(); ++p) {
+    clone_info_t ci;
+    ci.cloneid = p->cloneid;
+    ci.snaps.assign(p->snaps.begin(), p->snaps.end());
+    ci.overlap = p->overlap;
+    ci.size = p->size;
+    out->clones.push_back(ci);
+  }
+  return 0;
+}
 
 int librados::RadosClient::exec(IoCtxImpl& io, const object_t& oid,
 				const char *cls, const char *method,
@@ -2085,6 +2322,8 @@ int librados::RadosClient::exec(IoCtxImpl& io, const object_t& oid,
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
   eversion_t ver;
 
+  // the method may write
+  cache_invalidate(io, oid);
 
   lock.Lock();
   ::ObjectOperation rd;
@@ -2107,7 +2346,10 @@ int librados::RadosClient::aio_exec(IoCtxImpl& io, const object_t& oid, AioCompl
 				const char *cls, const char *method,
 				bufferlist& inbl, bufferlist *outbl)
 {
-  Context *onack = new C_aio_Ack(c);
+  // the method may write
+  cache_invalidate(io, oid);
+
+  Context *onack = aio_context(c, new C_aio_Ack(c));
 
   Mutex::Locker l(lock);
   ::ObjectOperation rd;
@@ -2118,10 +2360,124 @@ int librados::RadosClient::aio_exec(IoCtxImpl& io, const object_t& oid, AioCompl
   return 0;
 }
 
+/*
+ * Fill *o from the cache, revalidating it if it is old, or from the osd
+ * with a single stat+read+getxattrs.  Returns 1 if *o can answer the
+ * read (which includes -ENOENT), 0 if the object is too big to cache,
+ * or an error.
+ */
+int librados::RadosClient::cache_get(IoCtxImpl& io, const object_t& oid,
+				     SmallObjectCache::Object *o)
+{
+  SmallObjectCache::key_t k = cache_key(io, oid);
+  Mutex mylock("RadosClient::cache_get::mylock");
+  Cond cond;
+  bool done;
+  int r;
+  eversion_t ver;
+
+  if (obj_cache.lookup(k, o)) {
+    utime_t now = ceph_clock_now(cct);
+    // snapshots don't change
+    if (io.snap_seq != CEPH_NOSNAP ||
+	(double)(now - o->stamp) < conf->rados_cache_ttl)
+      return o->too_big ? 0 : 1;
+
+    uint64_t size;
+    utime_t mtime;
+    Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
+    lock.Lock();
+    objecter->stat(oid, io.oloc, io.snap_seq, &size, &mtime, io.read_flags,
+		   onack, &ver);
+    lock.Unlock();
+    mylock.Lock();
+    while (!done)
+      cond.Wait(mylock);
+    mylock.Unlock();
+
+    if ((r == -ENOENT && o->r == -ENOENT) ||
+	(r == 0 && o->r == 0 && ver == o->ver)) {
+      ldout(cct, 20) << "cache_get " << oid << " still at " << o->ver << dendl;
+      obj_cache.revalidated(k, o->ver, now);
+      return o->too_big ? 0 : 1;
+    }
+    if (r < 0 && r != -ENOENT)
+      return r;
+    ldout(cct, 10) << "cache_get " << oid << " changed, was " << o->ver
+		   << " r=" << o->r << dendl;
+    obj_cache.invalidate(k);
+  }
+
+  uint64_t max = conf->rados_cache_max_object_size;
+  uint64_t gen = obj_cache.begin_fill(k);
+  bufferlist bl;
+  ::ObjectOperation rd;
+  rd.add_op(CEPH_OSD_OP_STAT);
+  rd.read(0, max + 1);
+  rd.getxattrs();
+  Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
+  lock.Lock();
+  objecter->read(oid, io.oloc, rd, io.snap_seq, &bl, io.read_flags, onack, &ver);
+  lock.Unlock();
+  mylock.Lock();
+  while (!done)
+    cond.Wait(mylock);
+  mylock.Unlock();
+
+  *o = SmallObjectCache::Object();
+  o->stamp = ceph_clock_now(cct);
+  o->ver = ver;
+  if (r < 0 && r != -ENOENT) {
+    obj_cache.invalidate(k);
+    return r;
+  }
+  o->r = r;
+  if (r == 0) {
+    try {
+      bufferlist::iterator p = bl.begin();
+      ::decode(o->size, p);
+      ::decode(o->mtime, p);
+      if (o->size > max) {
+	o->too_big = true;
+	p.advance(MIN(o->size, max + 1));
+      } else {
+	p.copy(o->size, o->data);
+      }
+      ::decode(o->attrs, p);
+    } catch (buffer::error& e) {
+      obj_cache.invalidate(k);
+      return -EIO;
+    }
+  }
+  ldout(cct, 20) << "cache_get " << oid << " filled r=" << o->r << " size " << o->size
+		 << (o->too_big ? " (too big)" : "") << " " << ver << dendl;
+  obj_cache.fill(k, *o, gen);
+  return o->too_big ? 0 : 1;
+}
+
 int librados::RadosClient::read(IoCtxImpl& io, const object_t& oid,
 				bufferlist& bl, size_t len, uint64_t off)
 {
   CephContext *cct = io.client->cct;
+
+  if (use_cache(io)) {
+    SmallObjectCache::Object o;
+    int r = cache_get(io, oid, &o);
+    if (r < 0)
+      return r;
+    if (r > 0) {
+      if (o.r < 0)
+	return o.r;
+      if (off < o.data.length()) {
+	uint64_t left = o.data.length() - off;
+	bufferlist t;
+	t.substr_of(o.data, off, len ? MIN((uint64_t)len, left) : left);
+	bl.claim_append(t);
+      }
+      return bl.length();
+    }
+  }
+
   Mutex mylock("RadosClient::read::mylock");
   Cond cond;
   bool done;
@@ -2134,7 +2490,7 @@ int librados::RadosClient::read(IoCtxImpl& io, const object_t& oid,
 
   lock.Lock();
   objecter->read(oid, io.oloc,
-	      off, len, io.snap_seq, &bl, 0,
+	      off, len, io.snap_seq, &bl, io.read_flags,
               onack, &ver, pop);
   lock.Unlock();
 
@@ -2205,7 +2561,7 @@ int librados::RadosClient::sparse_read(IoCtxImpl& io, const object_t& oid,
 
   lock.Lock();
   objecter->sparse_read(oid, io.oloc,
-	      off, len, io.snap_seq, &bl, 0,
+	      off, len, io.snap_seq, &bl, io.read_flags,
               onack);
   lock.Unlock();
 
@@ -2228,6 +2584,22 @@ int librados::RadosClient::sparse_read(IoCtxImpl& io, const object_t& oid,
 int librados::RadosClient::stat(IoCtxImpl& io, const object_t& oid, uint64_t *psize, time_t *pmtime)
 {
   CephContext *cct = io.client->cct;
+
+  if (use_cache(io)) {
+    // objects too big to cache still have their size cached
+    SmallObjectCache::Object o;
+    int r = cache_get(io, oid, &o);
+    if (r < 0)
+      return r;
+    if (o.r < 0)
+      return o.r;
+    if (psize)
+      *psize = o.size;
+    if (pmtime)
+      *pmtime = o.mtime.sec();
+    return 0;
+  }
+
   Mutex mylock("RadosClient::stat::mylock");
   Cond cond;
   bool done;
@@ -2245,7 +2617,7 @@ int librados::RadosClient::stat(IoCtxImpl& io, const object_t& oid, uint64_t *ps
 
   lock.Lock();
   objecter->stat(oid, io.oloc,
-	      io.snap_seq, psize, &mtime, 0,
+	      io.snap_seq, psize, &mtime, io.read_flags,
               onack, &ver, pop);
   lock.Unlock();
 
@@ -2264,10 +2636,68 @@ int librados::RadosClient::stat(IoCtxImpl& io, const object_t& oid, uint64_t *ps
   return r;
 }
 
+int librados::RadosClient::checksum(IoCtxImpl& io, const object_t& oid,
+				    uint64_t off, uint64_t len, uint32_t *crc)
+{
+  Mutex mylock("RadosClient::checksum::mylock");
+  Cond cond;
+  bool done;
+  int r;
+  Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
+  eversion_t ver;
+  bufferlist bl;
+
+  lock.Lock();
+  ::ObjectOperation rd;
+  prepare_assert_ops(&io, &rd);
+  rd.checksum(off, len);
+  objecter->read(oid, io.oloc, rd, io.snap_seq, &bl, io.read_flags, onack, &ver);
+  lock.Unlock();
+
+  mylock.Lock();
+  while (!done)
+    cond.Wait(mylock);
+  mylock.Unlock();
+
+  set_sync_op_version(io, ver);
+  if (r < 0)
+    return r;
+
+  __u32 c;
+  uint64_t covered;
+  try {
+    bufferlist::iterator p = bl.begin();
+    ::decode(c, p);
+    ::decode(covered, p);
+  } catch (buffer::error& e) {
+    return -EIO;
+  }
+  if (crc)
+    *crc = c;
+  return covered;
+}
+
 int librados::RadosClient::getxattr(IoCtxImpl& io, const object_t& oid,
 				    const char *name, bufferlist& bl)
 {
   CephContext *cct = io.client->cct;
+
+  if (use_cache(io)) {
+    SmallObjectCache::Object o;
+    int r = cache_get(io, oid, &o);
+    if (r < 0)
+      return r;
+    if (r > 0) {
+      if (o.r < 0)
+	return o.r;
+      map<string, bufferlist>::iterator p = o.attrs.find(name);
+      if (p == o.attrs.end())
+	return -ENODATA;
+      bl = p->second;
+      return bl.length();
+    }
+  }
+
   Mutex mylock("RadosClient::getxattr::mylock");
   Cond cond;
   bool done;
@@ -2280,7 +2710,7 @@ int librados::RadosClient::getxattr(IoCtxImpl& io, const object_t& oid,
 
   lock.Lock();
   objecter->getxattr(oid, io.oloc,
-	      name, io.snap_seq, &bl, 0,
+	      name, io.snap_seq, &bl, io.read_flags,
               onack, &ver, pop);
   lock.Unlock();
 
@@ -2306,6 +2736,8 @@ int librados::RadosClient::rmxattr(IoCtxImpl& io, const object_t& oid, const cha
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::rmxattr::mylock");
   Cond cond;
   bool done;
@@ -2345,6 +2777,8 @@ int librados::RadosClient::setxattr(IoCtxImpl& io, const object_t& oid,
   if (io.snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  cache_invalidate(io, oid);
+
   Mutex mylock("RadosClient::setxattr::mylock");
   Cond cond;
   bool done;
@@ -2379,6 +2813,20 @@ int librados::RadosClient::getxattrs(IoCtxImpl& io, const object_t& oid,
 				     map<std::string, bufferlist>& attrset)
 {
   CephContext *cct = io.client->cct;
+
+  if (use_cache(io)) {
+    SmallObjectCache::Object o;
+    int r = cache_get(io, oid, &o);
+    if (r < 0)
+      return r;
+    if (r > 0) {
+      if (o.r < 0)
+	return o.r;
+      attrset.swap(o.attrs);
+      return 0;
+    }
+  }
+
   Mutex mylock("RadosClient::getexattrs::mylock");
   Cond cond;
   bool done;
@@ -2394,7 +2842,7 @@ int librados::RadosClient::getxattrs(IoCtxImpl& io, const object_t& oid,
   map<string, bufferlist> aset;
   objecter->getxattrs(oid, io.oloc, io.snap_seq,
 		      aset,
-		      0, onack, &ver, pop);
+		      io.read_flags, onack, &ver, pop);
   lock.Unlock();
 
   attrset.clear();
@@ -2879,6 +3327,13 @@ int librados::IoCtx::stat(const std::string& oid, uint64_t *psize, time_t *pmtim
   return io_ctx_impl->client->stat(*io_ctx_impl, oid, psize, pmtime);
 }
 
+int librados::IoCtx::checksum(const std::string& oid, uint64_t off, uint64_t len,
+			      uint32_t *crc)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->checksum(*io_ctx_impl, obj, off, len, crc);
+}
+
 int librados::IoCtx::exec(const std::string& oid, const char *cls, const char *method,
 			  bufferlist& inbl, bufferlist& outbl)
 {
@@ -2904,6 +3359,12 @@ int librados::IoCtx::tmap_get(const std::string& oid, bufferlist& bl)
   return io_ctx_impl->client->tmap_get(*io_ctx_impl, obj, bl);
 }
 
+int librados::IoCtx::list_snaps(const std::string& oid, snap_set_t *out)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->list_snaps(*io_ctx_impl, obj, out);
+}
+
 int librados::IoCtx::operate(const std::string& oid, librados::ObjectWriteOperation *o)
 {
   object_t obj(oid);
@@ -2922,6 +3383,28 @@ int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c, libra
   return io_ctx_impl->client->aio_operate(*io_ctx_impl, obj, (::ObjectOperation*)o->impl, c->pc);
 }
 
+int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c,
+				 librados::ObjectReadOperation *o, bufferlist *pbl)
+{
+  object_t obj(oid);
+  return io_ctx_impl->client->aio_operate_read(*io_ctx_impl, obj, (::ObjectOperation*)o->impl,
+					       c->pc, pbl);
+}
+
+int librados::IoCtx::aio_operate_batch(const std::vector<std::string>& oids,
+				       const std::vector<AioCompletion*>& cs,
+				       const std::vector<librados::ObjectWriteOperation*>& ops)
+{
+  vector<object_t> objs(oids.begin(), oids.end());
+  vector< ::ObjectOperation*> o(ops.size());
+  for (unsigned i = 0; i < ops.size(); i++)
+    o[i] = (::ObjectOperation*)ops[i]->impl;
+  vector<AioCompletionImpl*> c(cs.size());
+  for (unsigned i = 0; i < cs.size(); i++)
+    c[i] = cs[i]->pc;
+  return io_ctx_impl->client->aio_operate_batch(*io_ctx_impl, objs, o, c);
+}
+
 
 void librados::IoCtx::snap_set_read(snap_t seq)
 {
@@ -2999,6 +3482,31 @@ librados::ObjectIterator librados::IoCtx::objects_begin()
   return iter;
 }
 
+librados::ObjectIterator librados::IoCtx::objects_begin(const bufferlist& filter)
+{
+  rados_list_ctx_t listh;
+  rados_objects_list_open(io_ctx_impl, &listh);
+  ((ObjListCtx*)listh)->lc->filter = filter;
+  ObjectIterator iter((ObjListCtx*)listh);
+  iter.get_next();
+  return iter;
+}
+
+librados::ObjectIterator librados::IoCtx::pg_objects_begin(uint32_t pg, const bufferlist& filter)
+{
+  rados_list_ctx_t listh;
+  rados_objects_list_open_pg(io_ctx_impl, pg, &listh);
+  ((ObjListCtx*)listh)->lc->filter = filter;
+  ObjectIterator iter((ObjListCtx*)listh);
+  iter.get_next();
+  return iter;
+}
+
+int librados::IoCtx::get_pg_num(uint32_t *pg_num)
+{
+  return io_ctx_impl->client->pool_get_pg_num(io_ctx_impl, pg_num);
+}
+
 const librados::ObjectIterator& librados::IoCtx::objects_end() const
 {
   return ObjectIterator::__EndObjectIterator;
@@ -3102,6 +3610,25 @@ void librados::IoCtx::locator_set_key(const string& key)
   io_ctx_impl->oloc.key = key;
 }
 
+void librados::IoCtx::set_read_mode(ReadMode mode)
+{
+  switch (mode) {
+  case READ_BALANCED:
+    io_ctx_impl->read_flags = CEPH_OSD_FLAG_BALANCE_READS;
+    break;
+  case READ_LOCALIZED:
+    io_ctx_impl->read_flags = CEPH_OSD_FLAG_LOCALIZE_READS;
+    break;
+  default:
+    io_ctx_impl->read_flags = 0;
+  }
+}
+
+void librados::IoCtx::set_read_cache(bool on)
+{
+  io_ctx_impl->read_cache = on;
+}
+
 int librados::IoCtx::get_id()
 {
   return io_ctx_impl->get_id();
@@ -3713,6 +4240,12 @@ extern "C" int rados_ioctx_pool_get_auid(rados_ioctx_t io, uint64_t *auid)
   return ctx->client->pool_get_auid(ctx, (unsigned long long *)auid);
 }
 
+extern "C" void rados_ioctx_set_read_cache(rados_ioctx_t io, int on)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  ctx->read_cache = on;
+}
+
 extern "C" void rados_ioctx_locator_set_key(rados_ioctx_t io, const char *key)
 {
   librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
@@ -3987,6 +4520,25 @@ extern "C" int rados_objects_list_open(rados_ioctx_t io, rados_list_ctx_t *listh
   return 0;
 }
 
+extern "C" int rados_objects_list_open_pg(rados_ioctx_t io, uint32_t pg,
+					  rados_list_ctx_t *listh)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  Objecter::ListContext *h = new Objecter::ListContext;
+  h->pool_id = ctx->poolid;
+  h->pool_snap_seq = ctx->snap_seq;
+  h->current_pg = h->start_pg = pg;
+  h->end_pg = pg + 1;
+  *listh = (void *)new librados::ObjListCtx(ctx, h);
+  return 0;
+}
+
+extern "C" int rados_ioctx_get_pg_num(rados_ioctx_t io, uint32_t *pg_num)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  return ctx->client->pool_get_pg_num(ctx, pg_num);
+}
+
 extern "C" void rados_objects_list_close(rados_list_ctx_t h)
 {
   librados::ObjListCtx *lh = (librados::ObjListCtx *)h;
@@ -4006,6 +4558,8 @@ extern "C" int rados_objects_list_next(rados_list_ctx_t listctx, const char **en
 
   if (h->list.empty()) {
     ret = lh->ctx->client->list(lh->lc, RADOS_LIST_MAX_ENTRIES);
+    if (ret < 0)
+      return ret;
     if (h->list.empty())
       return -ENOENT;
   }
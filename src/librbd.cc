@@ -12,10 +12,14 @@
  *
  */
 
+#include "common/Clock.h"
 #include "common/Cond.h"
+#include "common/Finisher.h"
 #include "common/dout.h"
 #include "common/errno.h"
+#include "include/interval_set.h"
 #include "include/rbd/librbd.hpp"
+#include "osdc/ObjectCacher.h"
 
 #include <errno.h>
 #include <inttypes.h>
@@ -35,6 +39,8 @@ namespace librbd {
   void rados_cb(rados_completion_t cb, void *arg);
   void rados_buffered_cb(rados_completion_t cb, void *arg);
   void rados_aio_sparse_read_cb(rados_completion_t cb, void *arg);
+  void rados_layered_read_cb(rados_completion_t cb, void *arg);
+  void rados_discard_cb(rados_completion_t cb, void *arg);
 
   class WatchCtx;
 
@@ -44,6 +50,106 @@ namespace librbd {
     SnapInfo(snap_t _id, uint64_t _size) : id(_id), size(_size) {};
   };
 
+  // where a layered (cloned) image reads through to, from cls_rbd
+  struct parent_info {
+    int64_t pool;
+    std::string name, snap_name;
+    uint64_t overlap;   // bytes of the child that fall through to the parent
+
+    parent_info() : pool(-1), overlap(0) {}
+    void encode(bufferlist& bl) const {
+      __u8 struct_v = 1;
+      ::encode(struct_v, bl);
+      ::encode(pool, bl);
+      ::encode(name, bl);
+      ::encode(snap_name, bl);
+      ::encode(overlap, bl);
+    }
+    void decode(bufferlist::iterator& p) {
+      __u8 struct_v;
+      ::decode(struct_v, p);
+      ::decode(pool, p);
+      ::decode(name, p);
+      ::decode(snap_name, p);
+      ::decode(overlap, p);
+    }
+  };
+
+  // how an image is striped over its objects, from cls_rbd (see map_image_offset)
+  struct stripe_info {
+    uint64_t unit;    // bytes, dividing the object size
+    uint64_t count;   // objects in an object set
+
+    stripe_info() : unit(0), count(1) {}
+    void encode(bufferlist& bl) const {
+      __u8 struct_v = 1;
+      ::encode(struct_v, bl);
+      ::encode(unit, bl);
+      ::encode(count, bl);
+    }
+    void decode(bufferlist::iterator& p) {
+      __u8 struct_v;
+      ::decode(struct_v, p);
+      ::decode(unit, p);
+      ::decode(count, p);
+    }
+  };
+
+  /*
+   * Sent with header change notifications, so that watchers can update
+   * their cached header and snap context without re-reading them.  It
+   * applies only on top of prev_ver; anything else (or an empty
+   * notification) means a full refresh.
+   */
+  struct header_update_t {
+    enum {
+      OP_NONE,
+      OP_SNAP_ADD,
+      OP_SNAP_REMOVE,
+      OP_OBJECT_MAP_MARK,     // objno now may exist; the header is unchanged
+    };
+    uint64_t prev_ver, ver;   // header object versions before and after
+    bufferlist header;        // the fixed part of the header, after
+    __u8 op;
+    std::string snap_name;
+    uint64_t snap_id, snap_size;
+    bool has_parent;
+    parent_info parent;
+    uint64_t objno;
+
+    header_update_t() : prev_ver(0), ver(0), op(OP_NONE), snap_id(0), snap_size(0),
+			has_parent(false), objno(0) {}
+    void encode(bufferlist& bl) const {
+      __u8 struct_v = 2;
+      ::encode(struct_v, bl);
+      ::encode(prev_ver, bl);
+      ::encode(ver, bl);
+      ::encode(header, bl);
+      ::encode(op, bl);
+      ::encode(snap_name, bl);
+      ::encode(snap_id, bl);
+      ::encode(snap_size, bl);
+      ::encode(has_parent, bl);
+      parent.encode(bl);
+      ::encode(objno, bl);
+    }
+    void decode(bufferlist::iterator& p) {
+      __u8 struct_v;
+      ::decode(struct_v, p);
+      ::decode(prev_ver, p);
+      ::decode(ver, p);
+      ::decode(header, p);
+      ::decode(op, p);
+      ::decode(snap_name, p);
+      ::decode(snap_id, p);
+      ::decode(snap_size, p);
+      ::decode(has_parent, p);
+      parent.decode(p);
+      if (struct_v >= 2)
+	::decode(objno, p);
+    }
+  };
+
   struct AioCompletion;
 
   struct AioBlockCompletion {
@@ -64,6 +170,33 @@ namespace librbd {
 
   struct ImageCtx;
 
+  /*
+   * Cache writeback through librados.  Writes are stamped with the
+   * image's current snap context by data_ctx, not with the one the
+   * ObjectCacher passes.
+   */
+  class LibrbdWriteback : public WritebackHandler {
+    IoCtx& data_ctx;
+    tid_t last_tid;
+    uint64_t alloc_hint;  // object size, or 0 for no hints
+  public:
+    Mutex& lock;     // the cache lock
+    int write_rval;  // first writeback error since the last flush
+
+    LibrbdWriteback(IoCtx& ctx, Mutex& l, uint64_t hint)
+      : data_ctx(ctx), last_tid(0), alloc_hint(hint), lock(l), write_rval(0) {}
+
+    void read(const object_t& oid, const object_locator_t& oloc,
+	      uint64_t off, uint64_t len, snapid_t snapid,
+	      bufferlist *pbl, uint64_t trunc_size, __u32 trunc_seq,
+	      Context *onfinish);
+    tid_t write(const object_t& oid, const object_locator_t& oloc,
+		uint64_t off, uint64_t len, const SnapContext& snapc,
+		const bufferlist& bl, utime_t mtime,
+		uint64_t trunc_size, __u32 trunc_seq,
+		Context *oncommit);
+  };
+
   struct AioBufferedCompletion {
     ImageCtx *ictx;
     AioBlockCompletion *block_completion;
@@ -77,6 +210,7 @@ namespace librbd {
   struct ImageCtx {
     CephContext *cct;
     struct rbd_obj_header_ondisk header;
+    stripe_info stripe;   // fixed at creation
     ::SnapContext snapc;
     vector<snap_t> snaps;
     std::map<std::string, struct SnapInfo> snaps_by_name;
@@ -87,6 +221,8 @@ namespace librbd {
     WatchCtx *wctx;
     bool needs_refresh;
     Mutex refresh_lock;
+    std::list<header_update_t> pending_updates;  // from notifications; refresh_lock
+    uint64_t header_ver;   // header object version the cached state is from
     Mutex lock; // protects access to snapshot and header information
 
     list<AioBufferedCompletion*> tx_queue;
@@ -94,14 +230,38 @@ namespace librbd {
     uint64_t tx_unsafe_bytes, tx_pending_bytes, tx_window;
     int tx_rval;
 
+    // write-back cache, if rbd_cache is set
+    Mutex cache_lock; // protects object_cacher and object_set; taken after lock
+    ObjectCacher *object_cacher;
+    LibrbdWriteback *writeback_handler;
+    ObjectCacher::ObjectSet *object_set;
+    Finisher *cache_finisher;  // completes reads that missed, outside cache_lock
+
+    // which data objects may exist, if the image has an object map
+    // (protected by lock).  a clear bit means never written.
+    bool has_object_map;
+    std::vector<uint8_t> object_map;
+
+    // layering (protected by lock)
+    bool has_parent;
+    parent_info parent;
+    ImageCtx *parent_ictx;        // open at parent.snap_name
+    std::vector<bool> copied_up;  // objects known to exist in the child
+    Finisher *parent_finisher;    // reads that fall through to the parent
+
     ImageCtx(std::string imgname, IoCtx& p)
       : cct(p.cct()), snapid(CEPH_NOSNAP),
 	name(imgname),
 	needs_refresh(true),
 	refresh_lock("librbd::ImageCtx::refresh_lock"),
+	header_ver(0),
 	lock("librbd::ImageCtx::lock"),
 	tx_next(tx_queue.end()),
-	tx_unsafe_bytes(0), tx_pending_bytes(0), tx_window(0), tx_rval(0)
+	tx_unsafe_bytes(0), tx_pending_bytes(0), tx_window(0), tx_rval(0),
+	cache_lock("librbd::ImageCtx::cache_lock"),
+	object_cacher(NULL), writeback_handler(NULL), object_set(NULL),
+	cache_finisher(NULL), has_object_map(false),
+	has_parent(false), parent_ictx(NULL), parent_finisher(NULL)
     {
       md_ctx.dup(p);
       data_ctx.dup(p);
@@ -109,6 +269,8 @@ namespace librbd {
 
     ~ImageCtx() {
       assert(tx_queue.empty());
+      assert(!object_cacher);
+      assert(!parent_ictx);
     }
 
     int snap_set(std::string snap_name)
@@ -337,9 +499,12 @@ namespace librbd {
 
   int snap_set(ImageCtx *ictx, const char *snap_name);
   int list(IoCtx& io_ctx, std::vector<string>& names);
-  int create(IoCtx& io_ctx, const char *imgname, uint64_t size, int *order);
+  int create(IoCtx& io_ctx, const char *imgname, uint64_t size, int *order,
+	     uint64_t stripe_unit = 0, uint64_t stripe_count = 0);
   int rename(IoCtx& io_ctx, const char *srcname, const char *dstname);
   int info(ImageCtx *ictx, image_info_t& info, size_t image_size);
+  int get_stripe_unit(ImageCtx *ictx, uint64_t *stripe_unit);
+  int get_stripe_count(ImageCtx *ictx, uint64_t *stripe_count);
   int remove(IoCtx& io_ctx, const char *imgname, ProgressContext& prog_ctx);
   int resize(ImageCtx *ictx, uint64_t size, ProgressContext& prog_ctx);
   int resize_helper(ImageCtx *ictx, uint64_t size, ProgressContext& prog_ctx);
@@ -347,35 +512,67 @@ namespace librbd {
   int snap_list(ImageCtx *ictx, std::vector<snap_info_t>& snaps);
   int snap_rollback(ImageCtx *ictx, const char *snap_name, ProgressContext& prog_ctx);
   int snap_remove(ImageCtx *ictx, const char *snap_name);
-  int add_snap(ImageCtx *ictx, const char *snap_name);
-  int rm_snap(ImageCtx *ictx, const char *snap_name);
+  int add_snap(ImageCtx *ictx, const char *snap_name, header_update_t *u);
+  int rm_snap(ImageCtx *ictx, const char *snap_name, header_update_t *u);
   int ictx_check(ImageCtx *ictx);
   int ictx_refresh(ImageCtx *ictx, const char *snap_name);
   int copy(ImageCtx& srci, IoCtx& dest_md_ctx, const char *destname);
+  int clone(IoCtx& p_ioctx, const char *p_name, const char *p_snap_name,
+	    IoCtx& c_ioctx, const char *c_name, int *c_order);
+  int flatten(ImageCtx *ictx, ProgressContext& prog_ctx);
+  int read_parent(IoCtx& md_ctx, const string& md_oid, parent_info *parent);
+  int write_parent(IoCtx& md_ctx, const string& md_oid, const parent_info& parent);
+  int read_stripe(IoCtx& md_ctx, const string& md_oid,
+		  const rbd_obj_header_ondisk &header, stripe_info *stripe);
+  int open_parent(ImageCtx *ictx);
+  void close_parent(ImageCtx *ictx);
+  int copyup_object(ImageCtx *ictx, uint64_t objno);
 
   int open_image(IoCtx& io_ctx, ImageCtx *ictx, const char *name, const char *snap_name);
   void close_image(ImageCtx *ictx);
 
-  void trim_image(IoCtx& io_ctx, const rbd_obj_header_ondisk &header, uint64_t newsize,
-		  ProgressContext& prog_ctx);
+  void trim_image(IoCtx& io_ctx, const rbd_obj_header_ondisk &header,
+		  const stripe_info& stripe, uint64_t newsize,
+		  ProgressContext& prog_ctx, const std::vector<uint8_t> *object_map = NULL);
+  string object_map_oid(const string& md_oid);
+  int object_map_load(IoCtx& io_ctx, const string& md_oid, uint64_t num_objs,
+		      std::vector<uint8_t> *object_map);
+  int object_map_save(IoCtx& io_ctx, const string& md_oid,
+		      const std::vector<uint8_t>& object_map);
+  void object_map_resize(std::vector<uint8_t> *object_map, uint64_t num_objs);
+  bool object_may_exist(ImageCtx *ictx, uint64_t objno);
+  int object_map_mark(ImageCtx *ictx, uint64_t objno);
+  void object_map_marked(ImageCtx *ictx, uint64_t objno);
+  int object_map_clear(ImageCtx *ictx, uint64_t objno);
   int read_rbd_info(IoCtx& io_ctx, const string& info_oid, struct rbd_info *info);
 
   int touch_rbd_info(IoCtx& io_ctx, const string& info_oid);
   int rbd_assign_bid(IoCtx& io_ctx, const string& info_oid, uint64_t *id);
   int read_header_bl(IoCtx& io_ctx, const string& md_oid, bufferlist& header, uint64_t *ver);
   int notify_change(IoCtx& io_ctx, const string& oid, uint64_t *pver, ImageCtx *ictx);
+  int notify_update(ImageCtx *ictx, header_update_t& u);
+  bool apply_header_update(ImageCtx *ictx, const header_update_t& u);
   int read_header(IoCtx& io_ctx, const string& md_oid, struct rbd_obj_header_ondisk *header, uint64_t *ver);
   int write_header(IoCtx& io_ctx, const string& md_oid, bufferlist& header);
   int tmap_set(IoCtx& io_ctx, const string& imgname);
   int tmap_rm(IoCtx& io_ctx, const string& imgname);
+  int dir_add_image(IoCtx& io_ctx, const string& imgname);
+  int dir_remove_image(IoCtx& io_ctx, const string& imgname);
+  int dir_rename_image(IoCtx& io_ctx, const string& src, const string& dst);
   int rollback_image(ImageCtx *ictx, uint64_t snapid, ProgressContext& prog_ctx);
   void image_info(const ImageCtx& ictx, image_info_t& info, size_t info_size);
   string get_block_oid(const rbd_obj_header_ondisk &header, uint64_t num);
   uint64_t get_max_block(uint64_t size, int obj_order);
-  uint64_t get_max_block(const rbd_obj_header_ondisk &header);
   uint64_t get_block_size(const rbd_obj_header_ondisk &header);
-  uint64_t get_block_num(const rbd_obj_header_ondisk &header, uint64_t ofs);
-  uint64_t get_block_ofs(const rbd_obj_header_ondisk &header, uint64_t ofs);
+  uint64_t get_num_objects(const rbd_obj_header_ondisk &header, const stripe_info& stripe,
+			   uint64_t size);
+  uint64_t map_image_offset(const rbd_obj_header_ondisk &header, const stripe_info& stripe,
+			    uint64_t ofs, uint64_t *objno, uint64_t *obj_ofs);
+  uint64_t get_object_length(const rbd_obj_header_ondisk &header, const stripe_info& stripe,
+			     uint64_t objno, uint64_t size);
+  uint64_t get_alloc_hint(ImageCtx *ictx);
+  void prepare_write(uint64_t alloc_hint, uint64_t off, const bufferlist& bl,
+		     librados::ObjectWriteOperation *op);
   int check_io(ImageCtx *ictx, uint64_t off, uint64_t len);
   int init_rbd_info(struct rbd_info *info);
   void init_rbd_header(struct rbd_obj_header_ondisk& ondisk,
@@ -384,14 +581,26 @@ namespace librbd {
   int64_t read_iterate(ImageCtx *ictx, uint64_t off, size_t len,
 		       int (*cb)(uint64_t, size_t, const char *, void *),
 		       void *arg);
+  int diff_iterate(ImageCtx *ictx, const char *fromsnapname,
+		   uint64_t off, uint64_t len,
+		   int (*cb)(uint64_t, size_t, int, void *),
+		   void *arg);
   ssize_t read(ImageCtx *ictx, uint64_t off, size_t len, char *buf);
   ssize_t write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf);
+  ssize_t discard(ImageCtx *ictx, uint64_t off, uint64_t len);
+  int aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len, AioCompletion *c);
   int aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
                 AioCompletion *c);
   int aio_read(ImageCtx *ictx, uint64_t off, size_t len,
                char *buf, AioCompletion *c);
   int flush(ImageCtx *ictx);
 
+  void init_cache(ImageCtx *ictx);
+  void shutdown_cache(ImageCtx *ictx);
+  int flush_cache(ImageCtx *ictx);
+  void flush_cache_for_snapc(ImageCtx *ictx);
+  void invalidate_cache(ImageCtx *ictx);
+
   ssize_t handle_sparse_read(CephContext *cct,
 			     bufferlist data_bl,
 			     uint64_t block_ofs,
@@ -422,8 +631,19 @@ void WatchCtx::notify(uint8_t opcode, uint64_t ver, bufferlist& bl)
   Mutex::Locker l(lock);
   ldout(ictx->cct, 1) <<  " got notification opcode=" << (int)opcode << " ver=" << ver << " cookie=" << cookie << dendl;
   if (valid) {
+    // ictx->lock may be held by whoever is notifying, so only queue it
     Mutex::Locker lictx(ictx->refresh_lock);
-    ictx->needs_refresh = true;
+    header_update_t u;
+    try {
+      bufferlist::iterator p = bl.begin();
+      u.decode(p);
+    } catch (const buffer::error &err) {
+      ictx->needs_refresh = true;
+      ictx->pending_updates.clear();
+      return;
+    }
+    if (!ictx->needs_refresh)
+      ictx->pending_updates.push_back(u);
   }
 }
 
@@ -463,6 +683,10 @@ void image_info(const ImageCtx& ictx, image_info_t& info, size_t infosize)
   memcpy(&info.block_name_prefix, &ictx.header.block_name, RBD_MAX_BLOCK_NAME_SIZE);
   info.parent_pool = -1;
   bzero(&info.parent_name, RBD_MAX_IMAGE_NAME_SIZE);
+  if (ictx.has_parent) {
+    info.parent_pool = ictx.parent.pool;
+    strncpy(info.parent_name, ictx.parent.name.c_str(), RBD_MAX_IMAGE_NAME_SIZE - 1);
+  }
 }
 
 string get_block_oid(const rbd_obj_header_ondisk &header, uint64_t num)
@@ -480,29 +704,79 @@ uint64_t get_max_block(uint64_t size, int obj_order)
   return numseg;
 }
 
-uint64_t get_max_block(const rbd_obj_header_ondisk &header)
+uint64_t get_block_size(const rbd_obj_header_ondisk &header)
 {
-  return get_max_block(header.image_size, header.options.order);
+  return 1 << header.options.order;
 }
 
-uint64_t get_block_ofs(const rbd_obj_header_ondisk &header, uint64_t ofs)
+/// the alloc hint for data objects: they grow to the object size
+uint64_t get_alloc_hint(ImageCtx *ictx)
 {
-  int obj_order = header.options.order;
-  uint64_t block_size = 1 << obj_order;
-  return ofs & (block_size - 1);
+  assert(ictx->lock.is_locked());
+  if (!ictx->cct->_conf->rbd_alloc_hint)
+    return 0;
+  return get_block_size(ictx->header);
 }
 
-uint64_t get_block_size(const rbd_obj_header_ondisk &header)
+/// write bl at off in a data object, telling the osd what the object will be
+void prepare_write(uint64_t alloc_hint, uint64_t off, const bufferlist& bl,
+		   librados::ObjectWriteOperation *op)
 {
-  return 1 << header.options.order;
+  if (alloc_hint)
+    op->set_alloc_hint(alloc_hint, alloc_hint);
+  op->write(off, bl);
+}
+
+/*
+ * Striping, as with ceph_file_layout in Filer::file_to_extents: the
+ * image is cut into stripe units, dealt round robin to stripe_count
+ * objects (an object set), one stripe after the other until those are
+ * full; then the next object set takes over.  Sequential i/o so keeps
+ * stripe_count objects busy at once.  An unstriped image has a stripe
+ * unit of the object size and a count of 1, so block n is object n.
+ */
+uint64_t get_num_objects(const rbd_obj_header_ondisk &header, const stripe_info& stripe,
+			 uint64_t size)
+{
+  uint64_t set_size = get_block_size(header) * stripe.count;
+  return (size + set_size - 1) / set_size * stripe.count;
 }
 
-uint64_t get_block_num(const rbd_obj_header_ondisk &header, uint64_t ofs)
+/// the object and object offset that image offset ofs maps to; returns
+/// the bytes from there to the end of the stripe unit, all in that object
+uint64_t map_image_offset(const rbd_obj_header_ondisk &header, const stripe_info& stripe,
+			  uint64_t ofs, uint64_t *objno, uint64_t *obj_ofs)
 {
-  int obj_order = header.options.order;
-  uint64_t num = ofs >> obj_order;
+  uint64_t su = stripe.unit;
+  uint64_t stripes_per_object = get_block_size(header) / su;
+  uint64_t blockno = ofs / su;
+  uint64_t stripeno = blockno / stripe.count;
+  uint64_t stripepos = blockno % stripe.count;
+  uint64_t objectsetno = stripeno / stripes_per_object;
+  *objno = objectsetno * stripe.count + stripepos;
+  *obj_ofs = (stripeno % stripes_per_object) * su + ofs % su;
+  return su - ofs % su;
+}
 
-  return num;
+/// how much of object objno an image of size bytes uses
+uint64_t get_object_length(const rbd_obj_header_ondisk &header, const stripe_info& stripe,
+			   uint64_t objno, uint64_t size)
+{
+  uint64_t object_size = get_block_size(header);
+  uint64_t set_size = object_size * stripe.count;
+  uint64_t set_start = objno / stripe.count * set_size;
+  if (size <= set_start)
+    return 0;
+  if (size >= set_start + set_size)
+    return object_size;
+  // whole stripes, then maybe part of our unit of the last one
+  uint64_t stripe_size = stripe.unit * stripe.count;
+  uint64_t len = (size - set_start) / stripe_size * stripe.unit;
+  uint64_t rem = (size - set_start) % stripe_size;
+  uint64_t pos = (objno % stripe.count) * stripe.unit;
+  if (rem > pos)
+    len += MIN(stripe.unit, rem - pos);
+  return len;
 }
 
 int init_rbd_info(struct rbd_info *info)
@@ -511,19 +785,191 @@ int init_rbd_info(struct rbd_info *info)
   return 0;
 }
 
-void trim_image(IoCtx& io_ctx, const rbd_obj_header_ondisk &header, uint64_t newsize,
-		ProgressContext& prog_ctx)
+static bool object_map_test(const std::vector<uint8_t>& object_map, uint64_t objno)
+{
+  if (objno / 8 >= object_map.size())
+    return true;
+  return object_map[objno / 8] & (1 << (objno % 8));
+}
+
+void trim_image(IoCtx& io_ctx, const rbd_obj_header_ondisk &header,
+		const stripe_info& stripe, uint64_t newsize,
+		ProgressContext& prog_ctx, const std::vector<uint8_t> *object_map)
 {
   CephContext *cct = io_ctx.cct();
   uint64_t bsize = get_block_size(header);
-  uint64_t numseg = get_max_block(header);
-  uint64_t start = get_block_num(header, newsize);
+  uint64_t numseg = get_num_objects(header, stripe, header.image_size);
+  // from the object set newsize falls in: its objects keep what lies below
+  uint64_t start = newsize / (bsize * stripe.count) * stripe.count;
   ldout(cct, 2) << "trimming image data from " << numseg << " to " << start << " objects..." << dendl;
-  for (uint64_t i=start; i<numseg; i++) {
-    string oid = get_block_oid(header, i);
-    io_ctx.remove(oid);
-    prog_ctx.update_progress(i * bsize, (numseg - start) * bsize);
+
+  // keep up to rbd_concurrent_management_ops removes in flight
+  unsigned max_ops = MAX(cct->_conf->rbd_concurrent_management_ops, 1);
+  std::list<librados::AioCompletion*> in_flight;
+  uint64_t done = 0;
+  for (uint64_t i=start; i<numseg || !in_flight.empty(); ) {
+    if (i < numseg && object_map && !object_map_test(*object_map, i)) {
+      ++i;  // never written
+      prog_ctx.update_progress(++done * bsize, (numseg - start) * bsize);
+      continue;
+    }
+    if (i < numseg && in_flight.size() < max_ops) {
+      uint64_t keep = get_object_length(header, stripe, i, newsize);
+      string oid = get_block_oid(header, i++);
+      librados::ObjectWriteOperation op;
+      if (keep)
+	op.truncate(keep);
+      else
+	op.remove();
+      librados::AioCompletion *c = Rados::aio_create_completion();
+      io_ctx.aio_operate(oid, c, &op);
+      in_flight.push_back(c);
+      continue;
+    }
+    // objects may not exist; that is fine
+    librados::AioCompletion *c = in_flight.front();
+    in_flight.pop_front();
+    c->wait_for_complete();
+    c->release();
+    prog_ctx.update_progress(++done * bsize, (numseg - start) * bsize);
+  }
+}
+
+string object_map_oid(const string& md_oid)
+{
+  return md_oid + ".objmap";
+}
+
+/// -ENOENT if the image has no object map
+int object_map_load(IoCtx& io_ctx, const string& md_oid, uint64_t num_objs,
+		    std::vector<uint8_t> *object_map)
+{
+  bufferlist bl;
+  uint64_t size;
+  string oid = object_map_oid(md_oid);
+  int r = io_ctx.stat(oid, &size, NULL);
+  if (r < 0)
+    return r;
+  if (size) {
+    r = io_ctx.read(oid, bl, size, 0);
+    if (r < 0)
+      return r;
+  }
+  // anything the map doesn't cover may exist
+  object_map->assign((num_objs + 7) / 8, 0xff);
+  if (object_map->size())
+    bl.copy(0, MIN(bl.length(), object_map->size()), (char *)&(*object_map)[0]);
+  return 0;
+}
+
+int object_map_save(IoCtx& io_ctx, const string& md_oid,
+		    const std::vector<uint8_t>& object_map)
+{
+  bufferlist bl;
+  if (object_map.size())
+    bl.append((const char *)&object_map[0], object_map.size());
+  return io_ctx.write_full(object_map_oid(md_oid), bl);
+}
+
+/// new objects haven't been written; trimmed ones are gone
+void object_map_resize(std::vector<uint8_t> *object_map, uint64_t num_objs)
+{
+  object_map->resize((num_objs + 7) / 8, 0);
+  if (num_objs % 8)
+    object_map->back() &= (1 << (num_objs % 8)) - 1;
+}
+
+bool object_may_exist(ImageCtx *ictx, uint64_t objno)
+{
+  assert(ictx->lock.is_locked());
+  // snapshots may still have objects the head has lost
+  if (!ictx->has_object_map || ictx->snapid != CEPH_NOSNAP)
+    return true;
+  // an unwritten child object still has the parent's data
+  if (ictx->has_parent && objno * get_block_size(ictx->header) < ictx->parent.overlap)
+    return true;
+  return object_map_test(ictx->object_map, objno);
+}
+
+/*
+ * Set or clear objno's bit in the map on disk, and take the byte it is
+ * in from there: other clients may have changed its other bits.  OSDs
+ * without cls_rbd object_map_update get the whole byte written.
+ */
+static int object_map_update(ImageCtx *ictx, uint64_t objno, bool exists)
+{
+  uint64_t byte = objno / 8;
+  __u8 mask = 1 << (objno % 8);
+  bufferlist inbl, outbl;
+  ::encode(objno, inbl);
+  ::encode(exists, inbl);
+  int r = ictx->md_ctx.exec(object_map_oid(ictx->md_oid()), "rbd", "object_map_update",
+			    inbl, outbl);
+  if (r == -EOPNOTSUPP) {
+    __u8 b = exists ? (ictx->object_map[byte] | mask) : (ictx->object_map[byte] & ~mask);
+    bufferlist bl;
+    bl.append((const char *)&b, 1);
+    r = ictx->md_ctx.write(object_map_oid(ictx->md_oid()), bl, 1, byte);
+    if (r >= 0)
+      ictx->object_map[byte] = b;
+  } else if (r >= 0) {
+    try {
+      bufferlist::iterator p = outbl.begin();
+      ::decode(ictx->object_map[byte], p);
+    } catch (const buffer::error &err) {
+      r = -EIO;
+    }
   }
+  if (r < 0) {
+    lderr(ictx->cct) << "error updating object map: " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  return 0;
+}
+
+/*
+ * record that objno is about to be written, before writing it.  other
+ * clients with the image open have the map cached, and would take the
+ * object for absent: tell them, and wait for them to hear it.
+ */
+int object_map_mark(ImageCtx *ictx, uint64_t objno)
+{
+  assert(ictx->lock.is_locked());
+  if (!ictx->has_object_map || object_map_test(ictx->object_map, objno))
+    return 0;
+  int r = object_map_update(ictx, objno, true);
+  if (r < 0)
+    return r;
+
+  header_update_t u;
+  u.op = header_update_t::OP_OBJECT_MAP_MARK;
+  u.objno = objno;
+  bufferlist bl;
+  u.encode(bl);
+  ictx->md_ctx.notify(ictx->md_oid(), ictx->header_ver, bl);
+  return 0;
+}
+
+/// a mark another client made: the object may exist now
+void object_map_marked(ImageCtx *ictx, uint64_t objno)
+{
+  assert(ictx->lock.is_locked());
+  uint64_t byte = objno / 8;
+  if (ictx->has_object_map && byte < ictx->object_map.size())
+    ictx->object_map[byte] |= 1 << (objno % 8);
+}
+
+/// record that objno is about to be removed.  should the remove fail,
+/// the object is left behind unaccounted for, never the other way round
+int object_map_clear(ImageCtx *ictx, uint64_t objno)
+{
+  assert(ictx->lock.is_locked());
+  uint64_t byte = objno / 8;
+  if (!ictx->has_object_map || byte >= ictx->object_map.size() ||
+      !object_map_test(ictx->object_map, objno))
+    return 0;
+  // others' cached maps may still say it exists; that is safe
+  return object_map_update(ictx, objno, false);
 }
 
 int read_rbd_info(IoCtx& io_ctx, const string& info_oid, struct rbd_info *info)
@@ -611,6 +1057,75 @@ int notify_change(IoCtx& io_ctx, const string& oid, uint64_t *pver, ImageCtx *ic
   return 0;
 }
 
+/*
+ * Tell watchers about a change to the header that u describes (ver,
+ * header and the snap change filled in), and apply it locally too.
+ */
+int notify_update(ImageCtx *ictx, header_update_t& u)
+{
+  assert(ictx->lock.is_locked());
+  u.prev_ver = ictx->header_ver;
+  u.has_parent = ictx->has_parent;
+  u.parent = ictx->parent;
+  if (!apply_header_update(ictx, u)) {
+    Mutex::Locker l(ictx->refresh_lock);
+    ictx->needs_refresh = true;
+  }
+
+  bufferlist bl;
+  u.encode(bl);
+  ictx->md_ctx.notify(ictx->md_oid(), u.ver, bl);
+  return 0;
+}
+
+bool apply_header_update(ImageCtx *ictx, const header_update_t& u)
+{
+  CephContext *cct = ictx->cct;
+  assert(ictx->lock.is_locked());
+  if (u.prev_ver != ictx->header_ver || u.header.length() != sizeof(ictx->header)) {
+    ldout(cct, 10) << "header update " << u.prev_ver << " -> " << u.ver
+		   << " doesn't apply to " << ictx->header_ver << dendl;
+    return false;
+  }
+
+  uint64_t old_objs = get_num_objects(ictx->header, ictx->stripe, ictx->header.image_size);
+  if (u.op == header_update_t::OP_SNAP_ADD || u.op == header_update_t::OP_SNAP_REMOVE)
+    flush_cache_for_snapc(ictx);
+  u.header.copy(0, sizeof(ictx->header), (char *)&ictx->header);
+
+  if (u.op == header_update_t::OP_SNAP_ADD) {
+    if (ictx->snaps_by_name.count(u.snap_name))
+      return false;
+    // the newest snap goes first, as in the header
+    ictx->snaps.insert(ictx->snaps.begin(), u.snap_id);
+    ictx->snapc.snaps.insert(ictx->snapc.snaps.begin(), u.snap_id);
+    ictx->snaps_by_name.insert(std::pair<std::string, struct SnapInfo>(u.snap_name,
+								      SnapInfo(u.snap_id, u.snap_size)));
+  } else if (u.op == header_update_t::OP_SNAP_REMOVE) {
+    std::map<std::string, struct SnapInfo>::iterator p = ictx->snaps_by_name.find(u.snap_name);
+    if (p == ictx->snaps_by_name.end() || ictx->snapname == u.snap_name)
+      return false;   // reading from it: let the refresh report that
+    snap_t id = p->second.id;
+    ictx->snaps_by_name.erase(p);
+    ictx->snaps.erase(std::find(ictx->snaps.begin(), ictx->snaps.end(), id));
+    ictx->snapc.snaps.erase(std::find(ictx->snapc.snaps.begin(), ictx->snapc.snaps.end(), id));
+  }
+  ictx->snapc.seq = (uint64_t)ictx->header.snap_seq;
+  if (!ictx->snapc.is_valid())
+    return false;
+
+  ictx->has_parent = u.has_parent;
+  ictx->parent = u.parent;
+  uint64_t num_objs = get_num_objects(ictx->header, ictx->stripe, ictx->header.image_size);
+  if (ictx->has_object_map && num_objs != old_objs)
+    object_map_resize(&ictx->object_map, num_objs);
+
+  ictx->data_ctx.selfmanaged_snap_set_write_ctx(ictx->snapc.seq, ictx->snaps);
+  ictx->header_ver = u.ver;
+  ldout(cct, 10) << "applied header update to " << u.ver << dendl;
+  return true;
+}
+
 int read_header(IoCtx& io_ctx, const string& md_oid, struct rbd_obj_header_ondisk *header, uint64_t *ver)
 {
   bufferlist header_bl;
@@ -653,10 +1168,56 @@ int tmap_rm(IoCtx& io_ctx, const string& imgname)
   return io_ctx.tmap_update(RBD_DIRECTORY, cmdbl);
 }
 
+/*
+ * Directory entries live in the omap of RBD_DIRECTORY, one key per
+ * image, maintained by cls_rbd.  OSDs without omap support answer
+ * -EOPNOTSUPP; there (and for entries written before the omap
+ * directory existed) we use the tmap.
+ */
+int dir_add_image(IoCtx& io_ctx, const string& imgname)
+{
+  bufferlist in, out;
+  ::encode(imgname, in);
+  int r = io_ctx.exec(RBD_DIRECTORY, "rbd", "dir_add_image", in, out);
+  if (r == -EOPNOTSUPP)
+    r = tmap_set(io_ctx, imgname);
+  return r;
+}
+
+int dir_remove_image(IoCtx& io_ctx, const string& imgname)
+{
+  bufferlist in, out;
+  ::encode(imgname, in);
+  int r = io_ctx.exec(RBD_DIRECTORY, "rbd", "dir_remove_image", in, out);
+  if (r == -ENOENT || r == -EOPNOTSUPP)
+    r = tmap_rm(io_ctx, imgname);
+  return r;
+}
+
+int dir_rename_image(IoCtx& io_ctx, const string& src, const string& dst)
+{
+  bufferlist in, out;
+  ::encode(src, in);
+  ::encode(dst, in);
+  int r = io_ctx.exec(RBD_DIRECTORY, "rbd", "dir_rename_image", in, out);
+  if (r != -ENOENT && r != -EOPNOTSUPP)
+    return r;
+
+  // a tmap entry; move it into the omap directory if we can
+  r = dir_add_image(io_ctx, dst);
+  if (r < 0)
+    return r;
+  r = tmap_rm(io_ctx, src);
+  if (r < 0)
+    lderr(io_ctx.cct()) << "warning: couldn't remove old entry from directory ("
+			<< src << ")" << dendl;
+  return 0;
+}
+
 int rollback_image(ImageCtx *ictx, uint64_t snapid, ProgressContext& prog_ctx)
 {
   assert(ictx->lock.is_locked());
-  uint64_t numseg = get_max_block(ictx->header);
+  uint64_t numseg = get_num_objects(ictx->header, ictx->stripe, ictx->header.image_size);
   uint64_t bsize = get_block_size(ictx->header);
 
   for (uint64_t i = 0; i < numseg; i++) {
@@ -676,18 +1237,46 @@ int list(IoCtx& io_ctx, std::vector<std::string>& names)
   CephContext *cct = io_ctx.cct();
   ldout(cct, 20) << "list " << &io_ctx << dendl;
 
+  // entries from before the omap directory, if any
   bufferlist bl;
   int r = io_ctx.read(RBD_DIRECTORY, bl, 0, 0);
   if (r < 0)
     return r;
 
-  bufferlist::iterator p = bl.begin();
-  bufferlist header;
-  map<string,bufferlist> m;
-  ::decode(header, p);
-  ::decode(m, p);
-  for (map<string,bufferlist>::iterator q = m.begin(); q != m.end(); q++)
-    names.push_back(q->first);
+  if (bl.length()) {
+    bufferlist::iterator p = bl.begin();
+    bufferlist header;
+    map<string,bufferlist> m;
+    ::decode(header, p);
+    ::decode(m, p);
+    for (map<string,bufferlist>::iterator q = m.begin(); q != m.end(); q++)
+      names.push_back(q->first);
+  }
+
+  const uint64_t max_per_call = 1024;
+  string last_read;
+  while (true) {
+    bufferlist in, out;
+    ::encode(last_read, in);
+    ::encode(max_per_call, in);
+    r = io_ctx.exec(RBD_DIRECTORY, "rbd", "dir_list", in, out);
+    if (r == -EOPNOTSUPP)
+      break;
+    if (r < 0)
+      return r;
+
+    vector<string> page;
+    try {
+      bufferlist::iterator p = out.begin();
+      ::decode(page, p);
+    } catch (buffer::error& e) {
+      return -EIO;
+    }
+    names.insert(names.end(), page.begin(), page.end());
+    if (page.size() < max_per_call)
+      break;
+    last_read = page.back();
+  }
   return 0;
 }
 
@@ -700,12 +1289,19 @@ int snap_create(ImageCtx *ictx, const char *snap_name)
     return r;
 
   Mutex::Locker l(ictx->lock);
-  r = add_snap(ictx, snap_name);
+  // what was written before the snapshot belongs in it
+  if (ictx->object_cacher) {
+    r = flush_cache(ictx);
+    if (r < 0)
+      return r;
+  }
+  header_update_t u;
+  r = add_snap(ictx, snap_name, &u);
 
   if (r < 0)
     return r;
 
-  notify_change(ictx->md_ctx, ictx->md_oid(), NULL, ictx);
+  notify_update(ictx, u);
 
   return 0;
 }
@@ -723,28 +1319,55 @@ int snap_remove(ImageCtx *ictx, const char *snap_name)
   if (snapid == CEPH_NOSNAP)
     return -ENOENT;
 
-  r = rm_snap(ictx, snap_name);
+  header_update_t u;
+  r = rm_snap(ictx, snap_name, &u);
   if (r < 0)
     return r;
 
   r = ictx->data_ctx.selfmanaged_snap_remove(snapid);
 
+  // the header has changed either way
+  notify_update(ictx, u);
+
   if (r < 0)
     return r;
 
-  notify_change(ictx->md_ctx, ictx->md_oid(), NULL, ictx);
-
   return 0;
 }
 
-int create(IoCtx& io_ctx, const char *imgname, uint64_t size, int *order)
+/*
+ * A zero stripe_unit or stripe_count means the rbd_default_stripe_*
+ * one.  The stripe unit must divide the object size.
+ */
+int create(IoCtx& io_ctx, const char *imgname, uint64_t size, int *order,
+	   uint64_t stripe_unit, uint64_t stripe_count)
 {
   CephContext *cct = io_ctx.cct();
-  ldout(cct, 20) << "create " << &io_ctx << " name = " << imgname << " size = " << size << dendl;
+  ldout(cct, 20) << "create " << &io_ctx << " name = " << imgname << " size = " << size
+		 << " stripe " << stripe_unit << "x" << stripe_count << dendl;
 
   string md_oid = imgname;
   md_oid += RBD_SUFFIX;
 
+  if (!*order)
+    *order = RBD_DEFAULT_OBJ_ORDER;
+  uint64_t object_size = 1ull << *order;
+  stripe_info stripe;
+  stripe.unit = stripe_unit ? stripe_unit : cct->_conf->rbd_default_stripe_unit;
+  stripe.count = stripe_count ? stripe_count : cct->_conf->rbd_default_stripe_count;
+  if (!stripe.unit)
+    stripe.unit = object_size;
+  if (!stripe.count)
+    stripe.count = 1;
+  if (object_size % stripe.unit) {
+    lderr(cct) << "stripe unit " << stripe.unit << " does not divide the object size "
+	       << object_size << dendl;
+    return -EINVAL;
+  }
+  if (stripe.count == 1)
+    stripe.unit = object_size;  // the same thing
+  bool striped = stripe.unit != object_size;
+
   // make sure it doesn't already exist
   int r = io_ctx.stat(md_oid, NULL, NULL);
   if (r == 0) {
@@ -762,19 +1385,40 @@ int create(IoCtx& io_ctx, const char *imgname, uint64_t size, int *order)
 
   struct rbd_obj_header_ondisk header;
   init_rbd_header(header, size, order, bid);
+  if (striped)
+    memcpy(&header.text, RBD_HEADER_TEXT_STRIPED, sizeof(RBD_HEADER_TEXT_STRIPED));
 
   bufferlist bl;
   bl.append((const char *)&header, sizeof(header));
 
   ldout(cct, 2) << "adding rbd image to directory..." << dendl;
-  r = tmap_set(io_ctx, imgname);
+  r = dir_add_image(io_ctx, imgname);
   if (r < 0) {
     lderr(cct) << "error adding img to directory: " << cpp_strerror(-r)<< dendl;
     return r;
   }
 
+  if (cct->_conf->rbd_object_map) {
+    // before the header, so an image never lacks the map it is created with
+    ldout(cct, 2) << "creating object map..." << dendl;
+    std::vector<uint8_t> object_map((get_num_objects(header, stripe, size) + 7) / 8, 0);
+    r = object_map_save(io_ctx, md_oid, object_map);
+    if (r < 0) {
+      lderr(cct) << "error writing object map: " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+  }
+
+  // the striping goes with the header, so nobody sees one without the other
   ldout(cct, 2) << "creating rbd image..." << dendl;
-  r = io_ctx.write(md_oid, bl, bl.length(), 0);
+  librados::ObjectWriteOperation op;
+  op.write(0, bl);
+  if (striped) {
+    bufferlist stripe_bl;
+    stripe.encode(stripe_bl);
+    op.setxattr(RBD_STRIPE_ATTR, stripe_bl);
+  }
+  r = io_ctx.operate(md_oid, &op);
   if (r < 0) {
     lderr(cct) << "error writing header: " << cpp_strerror(-r) << dendl;
     return r;
@@ -807,24 +1451,45 @@ int rename(IoCtx& io_ctx, const char *srcname, const char *dstname)
     lderr(cct) << "rbd image header " << dst_md_oid << " already exists" << dendl;
     return -EEXIST;
   }
-  r = write_header(io_ctx, dst_md_oid, header);
+  bufferlist object_map;
+  uint64_t map_size;
+  bool has_object_map = io_ctx.stat(object_map_oid(md_oid), &map_size, NULL) == 0;
+  if (has_object_map) {
+    r = io_ctx.read(object_map_oid(md_oid), object_map, map_size, 0);
+    if (r >= 0)
+      r = io_ctx.write_full(object_map_oid(dst_md_oid), object_map);
+    if (r < 0) {
+      lderr(cct) << "error copying object map: " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+  }
+  bufferlist stripe_bl, inbl;
+  r = io_ctx.exec(md_oid, "rbd", "get_stripe", inbl, stripe_bl);
+  if (r < 0 && r != -ENOENT && r != -EOPNOTSUPP) {
+    lderr(cct) << "error reading striping: " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  librados::ObjectWriteOperation op;
+  op.write(0, header);
+  if (stripe_bl.length())
+    op.setxattr(RBD_STRIPE_ATTR, stripe_bl);
+  r = io_ctx.operate(dst_md_oid, &op);
   if (r < 0) {
     lderr(cct) << "error writing header: " << dst_md_oid << ": " << cpp_strerror(-r) << dendl;
     return r;
   }
-  r = tmap_set(io_ctx, dstname_str);
+  r = dir_rename_image(io_ctx, imgname_str, dstname_str);
   if (r < 0) {
     io_ctx.remove(dst_md_oid);
     lderr(cct) << "can't add " << dst_md_oid << " to directory" << dendl;
     return r;
   }
-  r = tmap_rm(io_ctx, imgname_str);
-  if (r < 0)
-    lderr(cct) << "warning: couldn't remove old entry from directory (" << imgname_str << ")" << dendl;
 
   r = io_ctx.remove(md_oid);
   if (r < 0 && r != -ENOENT)
     lderr(cct) << "warning: couldn't remove old metadata" << dendl;
+  if (has_object_map)
+    io_ctx.remove(object_map_oid(md_oid));
   notify_change(io_ctx, md_oid, NULL, NULL);
 
   return 0;
@@ -844,6 +1509,28 @@ int info(ImageCtx *ictx, image_info_t& info, size_t infosize)
   return 0;
 }
 
+int get_stripe_unit(ImageCtx *ictx, uint64_t *stripe_unit)
+{
+  int r = ictx_check(ictx);
+  if (r < 0)
+    return r;
+
+  Mutex::Locker l(ictx->lock);
+  *stripe_unit = ictx->stripe.unit;
+  return 0;
+}
+
+int get_stripe_count(ImageCtx *ictx, uint64_t *stripe_count)
+{
+  int r = ictx_check(ictx);
+  if (r < 0)
+    return r;
+
+  Mutex::Locker l(ictx->lock);
+  *stripe_count = ictx->stripe.count;
+  return 0;
+}
+
 int remove(IoCtx& io_ctx, const char *imgname, ProgressContext& prog_ctx)
 {
   CephContext *cct(io_ctx.cct());
@@ -853,18 +1540,30 @@ int remove(IoCtx& io_ctx, const char *imgname, ProgressContext& prog_ctx)
   md_oid += RBD_SUFFIX;
 
   struct rbd_obj_header_ondisk header;
+  stripe_info stripe;
   int r = read_header(io_ctx, md_oid, &header, NULL);
   if (r < 0) {
     ldout(cct, 2) << "error reading header: " << cpp_strerror(-r) << dendl;
   }
   if (r >= 0) {
-    trim_image(io_ctx, header, 0, prog_ctx);
+    r = read_stripe(io_ctx, md_oid, header, &stripe);
+    if (r < 0)
+      lderr(cct) << "error reading striping: " << cpp_strerror(-r) << dendl;
+  }
+  if (r >= 0) {
+    std::vector<uint8_t> object_map;
+    bool has_object_map =
+      object_map_load(io_ctx, md_oid, get_num_objects(header, stripe, header.image_size),
+		      &object_map) == 0;
+    trim_image(io_ctx, header, stripe, 0, prog_ctx, has_object_map ? &object_map : NULL);
     ldout(cct, 2) << "removing header..." << dendl;
     io_ctx.remove(md_oid);
+    if (has_object_map)
+      io_ctx.remove(object_map_oid(md_oid));
   }
 
   ldout(cct, 2) << "removing rbd image from directory..." << dendl;
-  r = tmap_rm(io_ctx, imgname);
+  r = dir_remove_image(io_ctx, imgname);
   if (r < 0) {
     lderr(cct) << "error removing img from directory: " << cpp_strerror(-r) << dendl;
     return r;
@@ -887,14 +1586,35 @@ int resize_helper(ImageCtx *ictx, uint64_t size, ProgressContext& prog_ctx)
     ictx->header.image_size = size;
   } else {
     ldout(cct, 2) << "shrinking image " << size << " -> " << ictx->header.image_size << " objects" << dendl;
-    trim_image(ictx->data_ctx, ictx->header, size, prog_ctx);
+    trim_image(ictx->data_ctx, ictx->header, ictx->stripe, size, prog_ctx,
+	       ictx->has_object_map ? &ictx->object_map : NULL);
     ictx->header.image_size = size;
   }
 
+  if (ictx->has_parent && size < ictx->parent.overlap) {
+    // growing again later must not expose the parent's data
+    ictx->parent.overlap = size;
+    int r = write_parent(ictx->md_ctx, ictx->md_oid(), ictx->parent);
+    if (r < 0) {
+      lderr(cct) << "error updating parent overlap: " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+  }
+
+  if (ictx->has_object_map) {
+    object_map_resize(&ictx->object_map,
+		      get_num_objects(ictx->header, ictx->stripe, ictx->header.image_size));
+    int r = object_map_save(ictx->md_ctx, ictx->md_oid(), ictx->object_map);
+    if (r < 0) {
+      lderr(cct) << "error writing object map: " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+  }
+
   // rewrite header
-  bufferlist bl;
-  bl.append((const char *)&(ictx->header), sizeof(ictx->header));
-  int r = ictx->md_ctx.write(ictx->md_oid(), bl, bl.length(), 0);
+  header_update_t u;
+  u.header.append((const char *)&(ictx->header), sizeof(ictx->header));
+  int r = ictx->md_ctx.write(ictx->md_oid(), u.header, u.header.length(), 0);
 
   if (r == -ERANGE)
     lderr(cct) << "operation might have conflicted with another client!" << dendl;
@@ -902,7 +1622,8 @@ int resize_helper(ImageCtx *ictx, uint64_t size, ProgressContext& prog_ctx)
     lderr(cct) << "error writing header: " << cpp_strerror(-r) << dendl;
     return r;
   } else {
-    notify_change(ictx->md_ctx, ictx->md_oid(), NULL, ictx);
+    u.ver = ictx->md_ctx.get_last_version();
+    notify_update(ictx, u);
   }
 
   return 0;
@@ -918,6 +1639,8 @@ int resize(ImageCtx *ictx, uint64_t size, ProgressContext& prog_ctx)
     return r;
 
   Mutex::Locker l(ictx->lock);
+  if (ictx->object_cacher)
+    invalidate_cache(ictx);  // a shrink removes objects behind the cache's back
   resize_helper(ictx, size, prog_ctx);
 
   ldout(cct, 2) << "done." << dendl;
@@ -947,7 +1670,24 @@ int snap_list(ImageCtx *ictx, std::vector<snap_info_t>& snaps)
   return 0;
 }
 
-int add_snap(ImageCtx *ictx, const char *snap_name)
+/*
+ * The fixed part of the header as it is now, and its version.  The
+ * change is already made, so a failure here only means no one can
+ * apply the update and everyone refreshes.
+ */
+static int read_header_update(ImageCtx *ictx, header_update_t *u)
+{
+  int r = ictx->md_ctx.read(ictx->md_oid(), u->header, sizeof(ictx->header), 0);
+  if (r < 0) {
+    lderr(ictx->cct) << "error re-reading header: " << cpp_strerror(-r) << dendl;
+    u->header.clear();
+    return 0;
+  }
+  u->ver = ictx->md_ctx.get_last_version();
+  return 0;
+}
+
+int add_snap(ImageCtx *ictx, const char *snap_name, header_update_t *u)
 {
   assert(ictx->lock.is_locked());
 
@@ -968,12 +1708,15 @@ int add_snap(ImageCtx *ictx, const char *snap_name)
     lderr(ictx->cct) << "rbd.snap_add execution failed failed: " << cpp_strerror(-r) << dendl;
     return r;
   }
-  notify_change(ictx->md_ctx, ictx->md_oid(), NULL, ictx);
 
-  return 0;
+  u->op = header_update_t::OP_SNAP_ADD;
+  u->snap_name = snap_name;
+  u->snap_id = snap_id;
+  u->snap_size = ictx->header.image_size;
+  return read_header_update(ictx, u);
 }
 
-int rm_snap(ImageCtx *ictx, const char *snap_name)
+int rm_snap(ImageCtx *ictx, const char *snap_name, header_update_t *u)
 {
   assert(ictx->lock.is_locked());
 
@@ -986,7 +1729,9 @@ int rm_snap(ImageCtx *ictx, const char *snap_name)
     return r;
   }
 
-  return 0;
+  u->op = header_update_t::OP_SNAP_REMOVE;
+  u->snap_name = snap_name;
+  return read_header_update(ictx, u);
 }
 
 int ictx_check(ImageCtx *ictx)
@@ -995,8 +1740,26 @@ int ictx_check(ImageCtx *ictx)
   ldout(cct, 20) << "ictx_check " << ictx << dendl;
   ictx->refresh_lock.Lock();
   bool needs_refresh = ictx->needs_refresh;
+  std::list<header_update_t> updates;
+  updates.swap(ictx->pending_updates);
   ictx->refresh_lock.Unlock();
 
+  if (!needs_refresh && !updates.empty()) {
+    Mutex::Locker l(ictx->lock);
+    for (std::list<header_update_t>::iterator p = updates.begin(); p != updates.end(); ++p) {
+      if (p->op == header_update_t::OP_OBJECT_MAP_MARK) {
+	object_map_marked(ictx, p->objno);
+	continue;
+      }
+      if (p->ver <= ictx->header_ver)
+	continue;   // our own, or already covered by a refresh
+      if (!apply_header_update(ictx, *p)) {
+	needs_refresh = true;
+	break;
+      }
+    }
+  }
+
   if (needs_refresh) {
     Mutex::Locker l(ictx->lock);
     const char *snap = NULL;
@@ -1030,11 +1793,46 @@ int ictx_refresh(ImageCtx *ictx, const char *snap_name)
     ldout(cct, 20) << "ictx_refresh " << ictx << " no snap" << dendl;
   }
 
-  int r = read_header(ictx->md_ctx, ictx->md_oid(), &(ictx->header), NULL);
+  // updates queued so far are covered by what we read now
+  ictx->refresh_lock.Lock();
+  ictx->pending_updates.clear();
+  ictx->refresh_lock.Unlock();
+
+  ::SnapContext old_snapc = ictx->snapc;
+  int r = read_header(ictx->md_ctx, ictx->md_oid(), &(ictx->header), &ictx->header_ver);
   if (r < 0) {
     lderr(cct) << "Error reading header: " << cpp_strerror(-r) << dendl;
     return r;
   }
+  r = read_stripe(ictx->md_ctx, ictx->md_oid(), ictx->header, &ictx->stripe);
+  if (r < 0) {
+    lderr(cct) << "Error reading striping: " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  r = object_map_load(ictx->md_ctx, ictx->md_oid(),
+		      get_num_objects(ictx->header, ictx->stripe, ictx->header.image_size),
+		      &ictx->object_map);
+  if (r < 0 && r != -ENOENT) {
+    lderr(cct) << "Error reading object map: " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  ictx->has_object_map = (r == 0);
+
+  parent_info parent;
+  r = read_parent(ictx->md_ctx, ictx->md_oid(), &parent);
+  if (r < 0 && r != -ENOENT) {
+    lderr(cct) << "Error reading parent: " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  // once flattened, stay flattened; an open parent is just unused
+  if (r == 0) {
+    ictx->has_parent = true;
+    ictx->parent = parent;
+  } else {
+    ictx->has_parent = false;
+  }
+  __u8 snap_list_flags = RBD_SNAP_LIST_STRIPING;
+  ::encode(snap_list_flags, bl);
   r = ictx->md_ctx.exec(ictx->md_oid(), "rbd", "snap_list", bl, bl2);
   if (r < 0) {
     lderr(cct) << "Error listing snapshots: " << cpp_strerror(-r) << dendl;
@@ -1072,6 +1870,8 @@ int ictx_refresh(ImageCtx *ictx, const char *snap_name)
     ictx->data_ctx.snap_set_read(ictx->snapid);
   }
 
+  if (ictx->snapc.seq != old_snapc.seq || ictx->snapc.snaps != old_snapc.snaps)
+    flush_cache_for_snapc(ictx);
   ictx->data_ctx.selfmanaged_snap_set_write_ctx(ictx->snapc.seq, ictx->snaps);
 
   ictx->refresh_lock.Lock();
@@ -1129,6 +1929,10 @@ int snap_rollback(ImageCtx *ictx, const char *snap_name, ProgressContext& prog_c
     return -ENOENT;
   }
 
+  // the rollback rewrites the objects underneath the cache
+  if (ictx->object_cacher)
+    invalidate_cache(ictx);
+
   uint64_t new_size = ictx->get_image_size();
   ictx->get_snap_size(snap_name, &new_size);
   ldout(cct, 2) << "resizing to snapshot size..." << dendl;
@@ -1146,6 +1950,16 @@ int snap_rollback(ImageCtx *ictx, const char *snap_name, ProgressContext& prog_c
     return r;
   }
 
+  if (ictx->has_object_map) {
+    // anything the snapshot had is back
+    ictx->object_map.assign(ictx->object_map.size(), 0xff);
+    r = object_map_save(ictx->md_ctx, ictx->md_oid(), ictx->object_map);
+    if (r < 0) {
+      lderr(cct) << "error writing object map: " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+  }
+
   // refresh without setting the snapid we read from
   ictx_refresh(ictx, NULL);
   snap_t new_snapid = ictx->get_snapid(snap_name);
@@ -1156,58 +1970,352 @@ int snap_rollback(ImageCtx *ictx, const char *snap_name, ProgressContext& prog_c
   return r;
 }
 
-struct CopyProgressCtx {
-  CopyProgressCtx(ProgressContext &p)
-	: prog_ctx(p)
-  {
+int read_parent(IoCtx& md_ctx, const string& md_oid, parent_info *parent)
+{
+  bufferlist inbl, outbl;
+  int r = md_ctx.exec(md_oid, "rbd", "get_parent", inbl, outbl);
+  if (r == -EOPNOTSUPP)
+    return -ENOENT;  // an older class: nothing can be layered
+  if (r < 0)
+    return r;
+  try {
+    bufferlist::iterator p = outbl.begin();
+    parent->decode(p);
+  } catch (const buffer::error &err) {
+    return -EIO;
   }
-  ImageCtx *destictx;
-  uint64_t src_size;
-  ProgressContext &prog_ctx;
-};
+  return 0;
+}
 
-int do_copy_extent(uint64_t offset, size_t len, const char *buf, void *data)
+int write_parent(IoCtx& md_ctx, const string& md_oid, const parent_info& parent)
 {
-  CopyProgressCtx *cp = reinterpret_cast<CopyProgressCtx*>(data);
-  cp->prog_ctx.update_progress(offset, cp->src_size);
-  int ret = 0;
-  if (buf) {
-    ret = write(cp->destictx, offset, len, buf);
-  }
-  return ret;
+  bufferlist inbl, outbl;
+  parent.encode(inbl);
+  return md_ctx.exec(md_oid, "rbd", "set_parent", inbl, outbl);
 }
 
-int copy(ImageCtx& ictx, IoCtx& dest_md_ctx, const char *destname,
-	 ProgressContext &prog_ctx)
+/// unstriped images have none stored: block n is object n
+int read_stripe(IoCtx& md_ctx, const string& md_oid,
+		const rbd_obj_header_ondisk &header, stripe_info *stripe)
+{
+  uint64_t object_size = get_block_size(header);
+  bufferlist inbl, outbl;
+  int r = md_ctx.exec(md_oid, "rbd", "get_stripe", inbl, outbl);
+  if (r == -ENOENT || r == -EOPNOTSUPP) {
+    stripe->unit = object_size;
+    stripe->count = 1;
+    return 0;
+  }
+  if (r < 0)
+    return r;
+  try {
+    bufferlist::iterator p = outbl.begin();
+    stripe->decode(p);
+  } catch (const buffer::error &err) {
+    return -EIO;
+  }
+  if (!stripe->unit || !stripe->count || object_size % stripe->unit)
+    return -EIO;
+  return 0;
+}
+
+int open_parent(ImageCtx *ictx)
+{
+  CephContext *cct = ictx->cct;
+  ldout(cct, 10) << "open_parent " << ictx->parent.name << "@" << ictx->parent.snap_name
+		 << " overlap " << ictx->parent.overlap << dendl;
+  if (ictx->parent.pool != ictx->md_ctx.get_id()) {
+    lderr(cct) << "parent is in pool " << ictx->parent.pool
+	       << "; only parents in the same pool are supported" << dendl;
+    return -EXDEV;
+  }
+  ImageCtx *p = new ImageCtx(ictx->parent.name, ictx->md_ctx);
+  int r = open_image(ictx->md_ctx, p, ictx->parent.name.c_str(),
+		     ictx->parent.snap_name.c_str());
+  if (r < 0) {
+    lderr(cct) << "error opening parent " << ictx->parent.name << "@"
+	       << ictx->parent.snap_name << ": " << cpp_strerror(-r) << dendl;
+    delete p;
+    return r;
+  }
+  Mutex::Locker l(ictx->lock);
+  ictx->parent_ictx = p;
+  ictx->copied_up.assign(get_max_block(ictx->parent.overlap, ictx->header.options.order), false);
+  ictx->parent_finisher = new Finisher(cct);
+  ictx->parent_finisher->start();
+  return 0;
+}
+
+void close_parent(ImageCtx *ictx)
+{
+  ictx->lock.Lock();
+  ImageCtx *p = ictx->parent_ictx;
+  Finisher *f = ictx->parent_finisher;
+  ictx->parent_ictx = NULL;
+  ictx->parent_finisher = NULL;
+  ictx->lock.Unlock();
+  if (f) {
+    f->stop();
+    delete f;
+  }
+  if (p)
+    close_image(p);
+}
+
+/*
+ * Before the first write to a child object that the parent covers,
+ * copy the parent's data for the whole object into it, so the object
+ * never holds only part of its contents.
+ */
+int copyup_object(ImageCtx *ictx, uint64_t objno)
+{
+  ictx->lock.Lock();
+  ImageCtx *parent = ictx->has_parent ? ictx->parent_ictx : NULL;
+  uint64_t bsize = get_block_size(ictx->header);
+  uint64_t start = objno * bsize;
+  uint64_t overlap = ictx->parent.overlap;
+  bool done = objno >= ictx->copied_up.size() || ictx->copied_up[objno];
+  string oid = get_block_oid(ictx->header, objno);
+  ictx->lock.Unlock();
+  if (!parent || start >= overlap || done)
+    return 0;
+
+  int r = ictx->data_ctx.stat(oid, NULL, NULL);
+  if (r == -ENOENT) {
+    uint64_t len = MIN(bsize, overlap - start);
+    ldout(ictx->cct, 10) << "copyup " << oid << " from parent " << start << "~" << len << dendl;
+    bufferptr bp(len);
+    r = read(parent, start, len, bp.c_str());
+    if (r >= 0) {
+      bufferlist bl;
+      bl.push_back(bp);
+      librados::ObjectWriteOperation op;
+      op.create(true);  // if someone beat us to it, theirs is newer
+      op.write(0, bl);
+      r = ictx->data_ctx.operate(oid, &op);
+      if (r == -EEXIST)
+	r = 0;
+    }
+  }
+  if (r < 0) {
+    lderr(ictx->cct) << "copyup " << oid << " failed: " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+
+  Mutex::Locker l(ictx->lock);
+  if (objno < ictx->copied_up.size())
+    ictx->copied_up[objno] = true;
+  return 0;
+}
+
+int clone(IoCtx& p_ioctx, const char *p_name, const char *p_snap_name,
+	  IoCtx& c_ioctx, const char *c_name, int *c_order)
+{
+  CephContext *cct = p_ioctx.cct();
+  if (!p_snap_name || !*p_snap_name) {
+    lderr(cct) << "a clone needs a parent snapshot" << dendl;
+    return -EINVAL;
+  }
+  ldout(cct, 20) << "clone " << p_name << "@" << p_snap_name << " -> " << c_name << dendl;
+  if (p_ioctx.get_id() != c_ioctx.get_id()) {
+    lderr(cct) << "parent and child must be in the same pool" << dendl;
+    return -EXDEV;
+  }
+
+  ImageCtx *p = new ImageCtx(p_name, p_ioctx);
+  int r = open_image(p_ioctx, p, p_name, p_snap_name);
+  if (r < 0) {
+    lderr(cct) << "error opening parent image: " << cpp_strerror(-r) << dendl;
+    delete p;
+    return r;
+  }
+
+  parent_info parent;
+  parent.pool = p_ioctx.get_id();
+  parent.name = p_name;
+  parent.snap_name = p_snap_name;
+  p->lock.Lock();
+  parent.overlap = p->get_image_size();
+  int order = p->header.options.order;  // objects map one to one
+  bool striped = p->stripe.count > 1;
+  p->lock.Unlock();
+  close_image(p);
+  // copyup and the copied_up map work on whole unstriped blocks
+  if (striped) {
+    lderr(cct) << "cloning striped images is not supported" << dendl;
+    return -EINVAL;
+  }
+
+  r = create(c_ioctx, c_name, parent.overlap, &order, 1ull << order, 1);
+  if (r < 0)
+    return r;
+  if (c_order)
+    *c_order = order;
+
+  string c_md_oid = c_name;
+  c_md_oid += RBD_SUFFIX;
+  r = write_parent(c_ioctx, c_md_oid, parent);
+  if (r < 0) {
+    lderr(cct) << "error setting parent: " << cpp_strerror(-r) << dendl;
+    NoOpProgressContext no_op;
+    remove(c_ioctx, c_name, no_op);
+    return r;
+  }
+  ldout(cct, 2) << "done." << dendl;
+  return 0;
+}
+
+int flatten(ImageCtx *ictx, ProgressContext& prog_ctx)
+{
+  CephContext *cct = ictx->cct;
+  ldout(cct, 20) << "flatten " << ictx << dendl;
+
+  int r = ictx_check(ictx);
+  if (r < 0)
+    return r;
+
+  ictx->lock.Lock();
+  if (ictx->snapid != CEPH_NOSNAP) {
+    ictx->lock.Unlock();
+    return -EROFS;
+  }
+  if (!ictx->has_parent || !ictx->parent_ictx) {
+    ictx->lock.Unlock();
+    return -EINVAL;
+  }
+  uint64_t bsize = get_block_size(ictx->header);
+  uint64_t overlap = ictx->parent.overlap;
+  uint64_t num_objs = get_max_block(overlap, ictx->header.options.order);
+  ictx->lock.Unlock();
+
+  for (uint64_t i = 0; i < num_objs; i++) {
+    ictx->lock.Lock();
+    r = object_map_mark(ictx, i);
+    ictx->lock.Unlock();
+    if (r >= 0)
+      r = copyup_object(ictx, i);
+    if (r < 0)
+      return r;
+    prog_ctx.update_progress(i * bsize, overlap);
+  }
+
+  bufferlist inbl, outbl;
+  r = ictx->md_ctx.exec(ictx->md_oid(), "rbd", "remove_parent", inbl, outbl);
+  if (r < 0) {
+    lderr(cct) << "error removing parent: " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  ictx->lock.Lock();
+  ictx->has_parent = false;
+  ictx->lock.Unlock();
+  close_parent(ictx);
+  notify_change(ictx->md_ctx, ictx->md_oid(), NULL, ictx);
+  ldout(cct, 2) << "done." << dendl;
+  return 0;
+}
+
+static bool buf_is_zero(const char *buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    if (buf[i])
+      return false;
+  return true;
+}
+
+// one object-sized piece of an image copy: read, then (unless zero) write
+struct CopyOp {
+  uint64_t ofs;
+  size_t len;
+  bufferptr buf;
+  AioCompletion *read, *write;
+  CopyOp(uint64_t o, size_t l) : ofs(o), len(l), buf(l), read(NULL), write(NULL) {}
+};
+
+int copy(ImageCtx& ictx, IoCtx& dest_md_ctx, const char *destname,
+	 ProgressContext &prog_ctx)
 {
   CephContext *cct = dest_md_ctx.cct();
-  CopyProgressCtx cp(prog_ctx);
+  ictx.lock.Lock();
   uint64_t src_size = ictx.get_image_size();
-  int64_t r;
-
+  uint64_t period = get_block_size(ictx.header);
   int order = ictx.header.options.order;
-  r = create(dest_md_ctx, destname, src_size, &order);
+  stripe_info stripe = ictx.stripe;
+  ictx.lock.Unlock();
+  int r;
+
+  r = create(dest_md_ctx, destname, src_size, &order, stripe.unit, stripe.count);
   if (r < 0) {
     lderr(cct) << "header creation failed" << dendl;
     return r;
   }
 
-  cp.destictx = new librbd::ImageCtx(destname, dest_md_ctx);
-  cp.src_size = src_size;
-  r = open_image(dest_md_ctx, cp.destictx, destname, NULL);
+  ImageCtx *dest = new librbd::ImageCtx(destname, dest_md_ctx);
+  r = open_image(dest_md_ctx, dest, destname, NULL);
   if (r < 0) {
     lderr(cct) << "failed to read newly created header" << dendl;
+    delete dest;
     return r;
   }
 
-  r = read_iterate(&ictx, 0, src_size, do_copy_extent, &cp);
+  // pipeline object-sized reads and writes, rbd_concurrent_management_ops
+  // at a time; the destination is new, so zeroed objects are not written
+  unsigned max_ops = MAX(cct->_conf->rbd_concurrent_management_ops, 1);
+  std::list<CopyOp*> in_flight;
+  uint64_t ofs = 0, done = 0;
+  while ((r == 0 && ofs < src_size) || !in_flight.empty()) {
+    if (r == 0 && ofs < src_size && in_flight.size() < max_ops) {
+      CopyOp *op = new CopyOp(ofs, MIN(period - ofs % period, src_size - ofs));
+      op->read = aio_create_completion();
+      int rr = aio_read(&ictx, op->ofs, op->len, op->buf.c_str(), op->read);
+      if (rr < 0) {
+	op->read->release();
+	delete op;
+	r = rr;
+	continue;
+      }
+      ofs += op->len;
+      in_flight.push_back(op);
+      continue;
+    }
 
-  if (r >= 0) {
-    // don't return total bytes read, which may not fit in an int
-    r = 0;
-    prog_ctx.update_progress(cp.src_size, cp.src_size);
+    CopyOp *op = in_flight.front();
+    in_flight.pop_front();
+    if (op->read) {
+      op->read->wait_for_complete();
+      ssize_t rr = op->read->get_return_value();
+      op->read->release();
+      op->read = NULL;
+      if (rr < 0 && r == 0)
+	r = rr;
+      if (r == 0 && !buf_is_zero(op->buf.c_str(), op->len)) {
+	op->write = aio_create_completion();
+	rr = aio_write(dest, op->ofs, op->len, op->buf.c_str(), op->write);
+	if (rr < 0) {
+	  op->write->release();
+	  op->write = NULL;
+	  r = rr;
+	} else {
+	  in_flight.push_back(op);  // finish it once the write is done
+	  continue;
+	}
+      }
+    } else {
+      op->write->wait_for_complete();
+      ssize_t rr = op->write->get_return_value();
+      op->write->release();
+      if (rr < 0 && r == 0)
+	r = rr;
+    }
+    done += op->len;
+    prog_ctx.update_progress(done, src_size);
+    delete op;
   }
-  close_image(cp.destictx);
+
+  if (r == 0)
+    r = flush(dest);
+  if (r < 0)
+    lderr(cct) << "copy failed: " << cpp_strerror(-r) << dendl;
+  close_image(dest);
   return r;
 }
 
@@ -1219,6 +2327,10 @@ int snap_set(ImageCtx *ictx, const char *snap_name)
   if (r < 0)
     return r;
 
+  // cached data belongs to the snap we were reading
+  if (ictx->object_cacher)
+    invalidate_cache(ictx);
+
   Mutex::Locker l(ictx->lock);
   if (snap_name) {
     r = ictx->snap_set(snap_name);
@@ -1251,6 +2363,16 @@ int open_image(IoCtx& io_ctx, ImageCtx *ictx, const char *name, const char *snap
   if (r < 0)
     return r;
 
+  if (ictx->has_parent) {
+    r = open_parent(ictx);
+    if (r < 0)
+      return r;
+  }
+
+  // the cache would read unwritten child objects as zeros
+  if (cct->_conf->rbd_cache && !ictx->has_parent)
+    init_cache(ictx);
+
   WatchCtx *wctx = new WatchCtx(ictx);
   if (!wctx)
     return -ENOMEM;
@@ -1264,14 +2386,179 @@ void close_image(ImageCtx *ictx)
 {
   ldout(ictx->cct, 20) << "close_image " << ictx << dendl;
   flush(ictx);
+  if (ictx->object_cacher)
+    shutdown_cache(ictx);
   ictx->lock.Lock();
   ictx->wctx->invalidate();
   ictx->md_ctx.unwatch(ictx->md_oid(), ictx->wctx->cookie);
   delete ictx->wctx;
   ictx->lock.Unlock();
+  close_parent(ictx);
   delete ictx;
 }
 
+// which entry of ss holds the object as of snap s, or -1 if it didn't exist then
+static int snap_set_find(const librados::snap_set_t& ss, snap_t s)
+{
+  for (unsigned i = 0; i < ss.clones.size(); i++) {
+    const librados::clone_info_t& c = ss.clones[i];
+    snap_t first, last;
+    if (c.cloneid == librados::SNAP_HEAD) {
+      first = ss.seq + 1;   // the head has seen no snap after seq
+      last = librados::SNAP_HEAD;
+    } else {
+      first = c.snaps.empty() ? c.cloneid : c.snaps.front();
+      last = c.cloneid;
+    }
+    if (s >= first && s <= last)
+      return i;
+  }
+  return -1;
+}
+
+/*
+ * The parts of an object that may differ between snaps from (0 for
+ * the beginning of time) and to, from the clone overlaps alone.
+ */
+static void calc_snap_set_diff(const librados::snap_set_t& ss, snap_t from, snap_t to,
+			       interval_set<uint64_t> *diff, bool *end_exists)
+{
+  diff->clear();
+  int i = from ? snap_set_find(ss, from) : -1;
+  int j = snap_set_find(ss, to);
+  *end_exists = (j >= 0);
+  if (i < 0 || j < 0) {
+    // created or removed in between: all of it
+    int k = (j >= 0) ? j : i;
+    if (k >= 0 && ss.clones[k].size)
+      diff->insert(0, ss.clones[k].size);
+    return;
+  }
+  for (int k = i; k < j; k++) {
+    const librados::clone_info_t& c = ss.clones[k];
+    uint64_t size = MAX(c.size, ss.clones[k + 1].size);
+    if (!size)
+      continue;
+    interval_set<uint64_t> changed, same;
+    changed.insert(0, size);
+    for (vector< pair<uint64_t,uint64_t> >::const_iterator p = c.overlap.begin();
+	 p != c.overlap.end();
+	 ++p)
+      same.insert(p->first, p->second);
+    same.intersection_of(changed);
+    changed.subtract(same);
+    diff->union_of(changed);
+  }
+}
+
+// what changed in one object, for diff_iterate
+struct object_diff {
+  int r;   // of list_snaps
+  bool exists;
+  interval_set<uint64_t> diff;
+  object_diff() : r(0), exists(false) {}
+};
+
+int diff_iterate(ImageCtx *ictx, const char *fromsnapname,
+		 uint64_t off, uint64_t len,
+		 int (*cb)(uint64_t, size_t, int, void *),
+		 void *arg)
+{
+  CephContext *cct = ictx->cct;
+  ldout(cct, 20) << "diff_iterate " << ictx << " from " << (fromsnapname ? fromsnapname : "NULL")
+		 << " off = " << off << " len = " << len << dendl;
+
+  int r = ictx_check(ictx);
+  if (r < 0)
+    return r;
+
+  r = check_io(ictx, off, len);
+  if (r < 0)
+    return r;
+
+  // the diff comes from the osds, so written data must be there
+  if (ictx->object_cacher) {
+    r = flush_cache(ictx);
+    if (r < 0)
+      return r;
+  }
+
+  ictx->lock.Lock();
+  snap_t from = 0, to = ictx->snapid;
+  if (fromsnapname) {
+    std::map<std::string, struct SnapInfo>::iterator p = ictx->snaps_by_name.find(fromsnapname);
+    if (p == ictx->snaps_by_name.end()) {
+      ictx->lock.Unlock();
+      return -ENOENT;
+    }
+    from = p->second.id;
+  }
+  if (from >= to) {
+    ictx->lock.Unlock();
+    return -EINVAL;   // from must be older
+  }
+  rbd_obj_header_ondisk header = ictx->header;
+  stripe_info stripe = ictx->stripe;
+  uint64_t parent_overlap = ictx->has_parent ? ictx->parent.overlap : 0;
+  ictx->lock.Unlock();
+
+  // stripe unit by stripe unit; each object's diff is worked out once
+  std::map<uint64_t, object_diff> diffs;   // of the current object set
+  uint64_t pos = off, end = off + len;
+  while (pos < end) {
+    uint64_t objno, obj_ofs;
+    uint64_t piece = MIN(map_image_offset(header, stripe, pos, &objno, &obj_ofs), end - pos);
+    uint64_t ofs = pos;
+    pos += piece;
+
+    std::map<uint64_t, object_diff>::iterator d = diffs.find(objno);
+    if (d == diffs.end()) {
+      if (diffs.size() >= stripe.count)
+	diffs.clear();
+      d = diffs.insert(std::make_pair(objno, object_diff())).first;
+      string oid = get_block_oid(header, objno);
+      librados::snap_set_t ss;
+      d->second.r = ictx->data_ctx.list_snaps(oid, &ss);
+      if (d->second.r < 0 && d->second.r != -ENOENT) {
+	lderr(cct) << "list_snaps " << oid << " failed: " << cpp_strerror(-d->second.r) << dendl;
+	return d->second.r;
+      }
+      if (d->second.r == 0) {
+	calc_snap_set_diff(ss, from, to, &d->second.diff, &d->second.exists);
+	ldout(cct, 20) << "diff_iterate " << oid << " diff " << d->second.diff
+		       << " exists " << d->second.exists << dendl;
+      }
+    }
+    const object_diff& od = d->second;
+
+    if (od.r == -ENOENT) {
+      // a clone reads through to its parent until an object is copied up
+      if (!from && ofs < parent_overlap) {
+	r = cb(ofs, MIN(ofs + piece, parent_overlap) - ofs, 1, arg);
+	if (r < 0)
+	  return r;
+      }
+      continue;
+    }
+    if (!od.exists && !od.diff.empty()) {
+      // gone: the whole object reads as zeros now
+      r = cb(ofs, piece, 0, arg);
+      if (r < 0)
+	return r;
+      continue;
+    }
+    interval_set<uint64_t> want, diff;
+    want.insert(obj_ofs, piece);
+    diff.intersection_of(od.diff, want);
+    for (interval_set<uint64_t>::iterator p = diff.begin(); p != diff.end(); ++p) {
+      r = cb(ofs + p.get_start() - obj_ofs, p.get_len(), 1, arg);
+      if (r < 0)
+	return r;
+    }
+  }
+  return 0;
+}
+
 int64_t read_iterate(ImageCtx *ictx, uint64_t off, size_t len,
 		     int (*cb)(uint64_t, size_t, const char *, void *),
 		     void *arg)
@@ -1286,27 +2573,60 @@ int64_t read_iterate(ImageCtx *ictx, uint64_t off, size_t len,
   if (r < 0)
     return r;
 
+  // this reads the objects directly, so make sure they are current
+  if (ictx->object_cacher) {
+    r = flush_cache(ictx);
+    if (r < 0)
+      return r;
+  }
+
   int64_t ret;
   int64_t total_read = 0;
-  ictx->lock.Lock();
-  uint64_t start_block = get_block_num(ictx->header, off);
-  uint64_t end_block = get_block_num(ictx->header, off + len - 1);
-  uint64_t block_size = get_block_size(ictx->header);
-  ictx->lock.Unlock();
   uint64_t left = len;
 
-  for (uint64_t i = start_block; i <= end_block; i++) {
+  while (left > 0) {
     bufferlist bl;
+    uint64_t objno, block_ofs;
     ictx->lock.Lock();
-    string oid = get_block_oid(ictx->header, i);
-    uint64_t block_ofs = get_block_ofs(ictx->header, off + total_read);
+    uint64_t read_len = min(map_image_offset(ictx->header, ictx->stripe, off + total_read,
+					     &objno, &block_ofs), left);
+    string oid = get_block_oid(ictx->header, objno);
+    bool may_exist = object_may_exist(ictx, objno);
     ictx->lock.Unlock();
-    uint64_t read_len = min(block_size - block_ofs, left);
+    if (!may_exist) {
+      r = cb(total_read, read_len, NULL, arg);
+      if (r < 0)
+	return r;
+      total_read += read_len;
+      left -= read_len;
+      continue;
+    }
 
     map<uint64_t, uint64_t> m;
     r = ictx->data_ctx.sparse_read(oid, m, bl, read_len, block_ofs);
-    if (r < 0 && r == -ENOENT)
+    if (r == -ENOENT) {
+      uint64_t image_ofs = off + total_read;
+      ictx->lock.Lock();
+      ImageCtx *parent = ictx->has_parent ? ictx->parent_ictx : NULL;
+      uint64_t overlap = ictx->parent.overlap;
+      ictx->lock.Unlock();
+      if (parent && image_ofs < overlap) {
+	// never written in the child: the parent has it
+	uint64_t parent_len = MIN(read_len, overlap - image_ofs);
+	bufferptr bp(read_len);
+	bp.zero();
+	r = read(parent, image_ofs, parent_len, bp.c_str());
+	if (r < 0)
+	  return r;
+	r = cb(total_read, read_len, bp.c_str(), arg);
+	if (r < 0)
+	  return r;
+	total_read += read_len;
+	left -= read_len;
+	continue;
+      }
       r = 0;
+    }
     if (r < 0) {
       return r;
     }
@@ -1336,8 +2656,23 @@ static int simple_read_cb(uint64_t ofs, size_t len, const char *buf, void *arg)
 }
 
 
+// a synchronous i/o through the cache
+static ssize_t wait_for_aio(int r, AioCompletion *c)
+{
+  if (r >= 0) {
+    c->wait_for_complete();
+    r = c->get_return_value();
+  }
+  c->release();
+  return r;
+}
+
 ssize_t read(ImageCtx *ictx, uint64_t ofs, size_t len, char *buf)
 {
+  if (ictx->object_cacher) {
+    AioCompletion *c = aio_create_completion();
+    return wait_for_aio(aio_read(ictx, ofs, len, buf, c), c);
+  }
   return read_iterate(ictx, ofs, len, simple_read_cb, buf);
 }
 
@@ -1356,27 +2691,37 @@ ssize_t write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf)
   if (r < 0)
     return r;
 
+  if (ictx->object_cacher) {
+    AioCompletion *c = aio_create_completion();
+    r = wait_for_aio(aio_write(ictx, off, len, buf, c), c);
+    return r < 0 ? r : len;
+  }
+
   size_t total_write = 0;
   ictx->lock.Lock();
-  uint64_t start_block = get_block_num(ictx->header, off);
-  uint64_t end_block = get_block_num(ictx->header, off + len - 1);
-  uint64_t block_size = get_block_size(ictx->header);
+  uint64_t alloc_hint = get_alloc_hint(ictx);
   ictx->lock.Unlock();
   uint64_t left = len;
 
-  for (uint64_t i = start_block; i <= end_block; i++) {
+  while (left > 0) {
     bufferlist bl;
+    uint64_t objno, block_ofs;
     ictx->lock.Lock();
-    string oid = get_block_oid(ictx->header, i);
-    uint64_t block_ofs = get_block_ofs(ictx->header, off + total_write);
+    uint64_t write_len = min(map_image_offset(ictx->header, ictx->stripe, off + total_write,
+					      &objno, &block_ofs), left);
+    string oid = get_block_oid(ictx->header, objno);
+    r = object_map_mark(ictx, objno);
     ictx->lock.Unlock();
-    uint64_t write_len = min(block_size - block_ofs, left);
+    if (r >= 0)
+      r = copyup_object(ictx, objno);
+    if (r < 0)
+      return r;
     bl.append(buf + total_write, write_len);
-    r = ictx->data_ctx.write(oid, bl, write_len, block_ofs);
+    librados::ObjectWriteOperation op;
+    prepare_write(alloc_hint, block_ofs, bl, &op);
+    r = ictx->data_ctx.operate(oid, &op);
     if (r < 0)
       return r;
-    if ((uint64_t)r != write_len)
-      return -EIO;
     total_write += write_len;
     left -= write_len;
   }
@@ -1490,6 +2835,209 @@ void rados_buffered_cb(rados_completion_t c, void *arg)
   delete bc;
 }
 
+// completes a cache context under the cache lock, as ObjectCacher expects
+struct C_CacheRequest : public Context {
+  LibrbdWriteback *wb;
+  Context *ctx;
+  bool is_write;
+  C_CacheRequest(LibrbdWriteback *w, Context *c, bool wr) : wb(w), ctx(c), is_write(wr) {}
+  void finish(int r) {
+    wb->lock.Lock();
+    if (is_write && r < 0 && wb->write_rval == 0)
+      wb->write_rval = r;  // ObjectCacher drops write errors; flush() reports them
+    ctx->complete(r);
+    wb->lock.Unlock();
+  }
+};
+
+void rados_cache_cb(rados_completion_t c, void *arg)
+{
+  Context *ctx = (Context *)arg;
+  ctx->complete(rados_aio_get_return_value(c));
+}
+
+void LibrbdWriteback::read(const object_t& oid, const object_locator_t& oloc,
+			   uint64_t off, uint64_t len, snapid_t snapid,
+			   bufferlist *pbl, uint64_t trunc_size, __u32 trunc_seq,
+			   Context *onfinish)
+{
+  librados::AioCompletion *rados_completion =
+    Rados::aio_create_completion(new C_CacheRequest(this, onfinish, false),
+				 rados_cache_cb, NULL);
+  data_ctx.aio_read(oid.name, rados_completion, pbl, len, off);
+  rados_completion->release();
+}
+
+tid_t LibrbdWriteback::write(const object_t& oid, const object_locator_t& oloc,
+			     uint64_t off, uint64_t len, const SnapContext& snapc,
+			     const bufferlist& bl, utime_t mtime,
+			     uint64_t trunc_size, __u32 trunc_seq,
+			     Context *oncommit)
+{
+  librados::AioCompletion *rados_completion =
+    Rados::aio_create_completion(new C_CacheRequest(this, oncommit, true),
+				 NULL, rados_cache_cb);
+  librados::ObjectWriteOperation op;
+  prepare_write(alloc_hint, off, bl, &op);
+  data_ctx.aio_operate(oid.name, rados_completion, &op);
+  rados_completion->release();
+  return ++last_tid;
+}
+
+void init_cache(ImageCtx *ictx)
+{
+  CephContext *cct = ictx->cct;
+  const md_config_t *conf = cct->_conf;
+  ldout(cct, 20) << "init_cache " << ictx << " size " << conf->rbd_cache_size
+		 << " max_dirty " << conf->rbd_cache_max_dirty << dendl;
+
+  ictx->lock.Lock();
+  uint64_t alloc_hint = get_alloc_hint(ictx);
+  ictx->lock.Unlock();
+  ictx->writeback_handler = new LibrbdWriteback(ictx->data_ctx, ictx->cache_lock,
+						alloc_hint);
+  ictx->object_cacher = new ObjectCacher(cct, "librbd", *ictx->writeback_handler,
+					 ictx->cache_lock, NULL, NULL);
+  ictx->object_cacher->set_max_size(conf->rbd_cache_size);
+  ictx->object_cacher->set_max_dirty(conf->rbd_cache_max_dirty);
+  ictx->object_cacher->set_target_dirty(conf->rbd_cache_target_dirty);
+  utime_t age;
+  age.set_from_double(conf->rbd_cache_max_dirty_age);
+  ictx->object_cacher->set_max_dirty_age(age);
+  ictx->object_set = new ObjectCacher::ObjectSet(NULL, ictx->data_ctx.get_id(), 0);
+  ictx->object_cacher->start();
+
+  ictx->cache_finisher = new Finisher(cct);
+  ictx->cache_finisher->start();
+}
+
+void shutdown_cache(ImageCtx *ictx)
+{
+  ldout(ictx->cct, 20) << "shutdown_cache " << ictx << dendl;
+  invalidate_cache(ictx);
+  ictx->object_cacher->stop();
+  ictx->cache_finisher->stop();
+
+  delete ictx->cache_finisher;
+  ictx->cache_finisher = NULL;
+  delete ictx->object_cacher;
+  ictx->object_cacher = NULL;
+  delete ictx->object_set;
+  ictx->object_set = NULL;
+  delete ictx->writeback_handler;
+  ictx->writeback_handler = NULL;
+}
+
+/// write back everything dirty and wait for it; returns any writeback error
+int flush_cache(ImageCtx *ictx)
+{
+  Mutex mylock("librbd::flush_cache");
+  Cond cond;
+  bool done = false;
+  Context *onfinish = new C_SafeCond(&mylock, &cond, &done);
+
+  ictx->cache_lock.Lock();
+  bool clean = ictx->object_cacher->flush_set(ictx->object_set, onfinish);
+  ictx->cache_lock.Unlock();
+  if (clean) {
+    delete onfinish;
+  } else {
+    mylock.Lock();
+    while (!done)
+      cond.Wait(mylock);
+    mylock.Unlock();
+  }
+
+  Mutex::Locker l(ictx->cache_lock);
+  int r = ictx->writeback_handler->write_rval;
+  ictx->writeback_handler->write_rval = 0;
+  return r;
+}
+
+/*
+ * The cache writes back with data_ctx's snap context, not the one a
+ * write was made under.  Before that changes, write back everything
+ * dirty, so it doesn't end up on the wrong side of a snapshot.
+ */
+void flush_cache_for_snapc(ImageCtx *ictx)
+{
+  assert(ictx->lock.is_locked());
+  if (!ictx->object_cacher)
+    return;
+  int r = flush_cache(ictx);
+  if (r < 0)
+    lderr(ictx->cct) << "flush_cache_for_snapc: writeback failed: " << cpp_strerror(-r) << dendl;
+}
+
+/// drop all cached data, e.g. because the objects changed underneath us
+void invalidate_cache(ImageCtx *ictx)
+{
+  int r = flush_cache(ictx);
+  if (r < 0)
+    lderr(ictx->cct) << "invalidate_cache: writeback failed: " << cpp_strerror(-r) << dendl;
+  Mutex::Locker l(ictx->cache_lock);
+  loff_t unclean = ictx->object_cacher->release_set(ictx->object_set);
+  assert(!unclean);
+}
+
+// map an image extent onto the objects it touches, one extent per
+// object where its pieces are contiguous, as Filer::file_to_extents does
+static void map_to_extents(ImageCtx *ictx, uint64_t off, size_t len,
+			   vector<ObjectExtent>& extents)
+{
+  Mutex::Locker l(ictx->lock);
+  object_locator_t oloc(ictx->data_ctx.get_id());
+  map<uint64_t, size_t> last;   // objno -> its latest extent
+  uint64_t done = 0;
+  while (done < len) {
+    uint64_t objno, obj_ofs;
+    uint64_t l = min(map_image_offset(ictx->header, ictx->stripe, off + done,
+				      &objno, &obj_ofs), len - done);
+    map<uint64_t, size_t>::iterator p = last.find(objno);
+    if (p != last.end() &&
+	extents[p->second].offset + extents[p->second].length == obj_ofs) {
+      extents[p->second].length += l;
+    } else {
+      ObjectExtent ex(object_t(get_block_oid(ictx->header, objno)), obj_ofs, l);
+      ex.oloc = oloc;
+      last[objno] = extents.size();
+      extents.push_back(ex);
+      p = last.find(objno);
+    }
+    extents[p->second].buffer_extents[done] = l;
+    done += l;
+  }
+}
+
+struct C_AioBlockComplete : public Context {
+  AioBlockCompletion *block_completion;
+  C_AioBlockComplete(AioBlockCompletion *bc) : block_completion(bc) {}
+  void finish(int r) {
+    block_completion->complete(r);
+    delete block_completion;
+  }
+};
+
+// a read through the cache: copy the result out to the caller's buffer
+struct C_CacheRead : public Context {
+  ImageCtx *ictx;
+  AioBlockCompletion *block_completion;
+  char *buf;
+  size_t len;
+  bufferlist bl;
+  C_CacheRead(ImageCtx *i, AioBlockCompletion *bc, char *b, size_t l)
+    : ictx(i), block_completion(bc), buf(b), len(l) {}
+  int copy_out() {
+    assert(bl.length() == len);
+    bl.copy(0, len, buf);
+    return len;
+  }
+  void finish(int r) {
+    // called under cache_lock, so finish on the finisher
+    ictx->cache_finisher->queue(new C_AioBlockComplete(block_completion), copy_out());
+  }
+};
+
 int check_io(ImageCtx *ictx, uint64_t off, uint64_t len)
 {
   ictx->lock.Lock();
@@ -1510,8 +3058,13 @@ int flush(ImageCtx *ictx)
   if (r < 0)
     return r;
 
-  // flush any outstanding writes
+  // write back the cache, then flush any outstanding writes
+  int cache_r = 0;
+  if (ictx->object_cacher)
+    cache_r = flush_cache(ictx);
   r = ictx->data_ctx.aio_flush();
+  if (cache_r < 0)
+    r = cache_r;
 
   // collect any errors from buffered writes
   if (ictx->tx_rval < 0) {
@@ -1540,9 +3093,7 @@ int aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
 
   size_t total_write = 0;
   ictx->lock.Lock();
-  uint64_t start_block = get_block_num(ictx->header, off);
-  uint64_t end_block = get_block_num(ictx->header, off + len - 1);
-  uint64_t block_size = get_block_size(ictx->header);
+  uint64_t alloc_hint = get_alloc_hint(ictx);
   ictx->lock.Unlock();
   uint64_t left = len;
 
@@ -1550,21 +3101,61 @@ int aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
   if (r < 0)
     return r;
 
+  if (ictx->object_cacher) {
+    // write-back: the write is done once it is in the cache
+    ictx->lock.Lock();
+    ::SnapContext snapc = ictx->snapc;
+    for (uint64_t done = 0; done < len; ) {
+      uint64_t objno, obj_ofs;
+      done += map_image_offset(ictx->header, ictx->stripe, off + done, &objno, &obj_ofs);
+      r = object_map_mark(ictx, objno);
+      if (r < 0) {
+	ictx->lock.Unlock();
+	return r;
+      }
+    }
+    ictx->lock.Unlock();
+    bufferlist bl;
+    bl.append(buf, len);
+    ObjectCacher::OSDWrite *wr =
+      ictx->object_cacher->prepare_write(snapc, bl, ceph_clock_now(cct), 0);
+    map_to_extents(ictx, off, len, wr->extents);
+
+    c->get();
+    ictx->cache_lock.Lock();
+    ictx->object_cacher->wait_for_write(len, ictx->cache_lock);
+    ictx->object_cacher->writex(wr, ictx->object_set);
+    ictx->cache_lock.Unlock();
+    c->finish_adding_completions();
+    c->put();
+    return 0;
+  }
+
   c->get();
-  for (uint64_t i = start_block; i <= end_block; i++) {
+  while (left > 0) {
+    uint64_t objno, block_ofs;
+    ictx->lock.Lock();
+    uint64_t write_len = min(map_image_offset(ictx->header, ictx->stripe, off + total_write,
+					      &objno, &block_ofs), left);
+    r = object_map_mark(ictx, objno);
+    ictx->lock.Unlock();
+    if (r >= 0)
+      r = copyup_object(ictx, objno);  // synchronous, on the first write only
+    if (r < 0)
+      goto done;
+    ictx->lock.Lock();
     AioBlockCompletion *block_completion = new AioBlockCompletion(cct, c, off, len, NULL);
     c->add_block_completion(block_completion);
 
-    ictx->lock.Lock();
-    string oid = get_block_oid(ictx->header, i);
-    uint64_t block_ofs = get_block_ofs(ictx->header, off + total_write);
+    string oid = get_block_oid(ictx->header, objno);
     librados::AioCompletion *rados_completion = ictx->get_buffered_tx_completion(len, block_completion);
     ictx->lock.Unlock();
 
-    uint64_t write_len = min(block_size - block_ofs, left);
     bufferlist bl;
     bl.append(buf + total_write, write_len);
-    r = ictx->data_ctx.aio_write(oid, rados_completion, bl, write_len, block_ofs);
+    librados::ObjectWriteOperation op;
+    prepare_write(alloc_hint, block_ofs, bl, &op);
+    r = ictx->data_ctx.aio_operate(oid, rados_completion, &op);
     rados_completion->release();
     if (r < 0)
       goto done;
@@ -1584,6 +3175,128 @@ done:
   return r;
 }
 
+void rados_discard_cb(rados_completion_t c, void *arg)
+{
+  AioBlockCompletion *block_completion = (AioBlockCompletion *)arg;
+  int r = rados_aio_get_return_value(c);
+  if (r == -ENOENT)
+    r = 0;  // nothing there to discard
+  block_completion->complete(r);
+  delete block_completion;
+}
+
+/*
+ * Discard off~len without sending any data: objects the range covers
+ * (as far as the image uses them) are removed, the tail of an object is
+ * truncated, and anything else zeroed, which the FileStore turns into
+ * a hole.  Objects a parent still covers have to exist to hide it, so
+ * they are emptied rather than removed, or copied up first.
+ */
+int aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len, AioCompletion *c)
+{
+  CephContext *cct = ictx->cct;
+  ldout(cct, 20) << "aio_discard " << ictx << " off = " << off << " len = " << len << dendl;
+
+  int r = ictx_check(ictx);
+  if (r < 0)
+    return r;
+
+  r = check_io(ictx, off, len);
+  if (r < 0)
+    return r;
+
+  // else dirty cached data would be written back over the hole, and
+  // clean data would hide it from reads
+  if (ictx->object_cacher) {
+    vector<ObjectExtent> extents;
+    map_to_extents(ictx, off, len, extents);
+    Mutex::Locker l(ictx->cache_lock);
+    ictx->object_cacher->discard_set(ictx->object_set, extents);
+  }
+
+  // a contiguous range touches one run of each of its objects
+  std::map<uint64_t, std::pair<uint64_t, uint64_t> > objects;  // objno -> ofs, len
+  ictx->lock.Lock();
+  for (uint64_t done = 0; done < len; ) {
+    uint64_t objno, obj_ofs;
+    uint64_t l = MIN(map_image_offset(ictx->header, ictx->stripe, off + done, &objno, &obj_ofs),
+		     len - done);
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> >::iterator p = objects.find(objno);
+    if (p == objects.end())
+      objects[objno] = std::make_pair(obj_ofs, l);
+    else
+      p->second.second += l;
+    done += l;
+  }
+  uint64_t image_size = ictx->get_image_size();
+  ictx->lock.Unlock();
+
+  c->get();
+  for (std::map<uint64_t, std::pair<uint64_t, uint64_t> >::iterator p = objects.begin();
+       p != objects.end();
+       ++p) {
+    uint64_t objno = p->first, obj_ofs = p->second.first, obj_len = p->second.second;
+    ictx->lock.Lock();
+    uint64_t used = get_object_length(ictx->header, ictx->stripe, objno, image_size);
+    bool to_end = obj_ofs + obj_len >= used;
+    bool under_parent = ictx->has_parent &&
+      objno * get_block_size(ictx->header) < ictx->parent.overlap;
+    bool may_exist = object_may_exist(ictx, objno);
+    string oid = get_block_oid(ictx->header, objno);
+    ictx->lock.Unlock();
+    if (!may_exist)
+      continue;  // never written
+
+    librados::ObjectWriteOperation op;
+    if (obj_ofs == 0 && to_end) {
+      ictx->lock.Lock();
+      r = under_parent ? object_map_mark(ictx, objno) : object_map_clear(ictx, objno);
+      ictx->lock.Unlock();
+      if (r < 0)
+	break;
+      if (under_parent) {
+	op.create(false);
+	op.truncate(0);
+      } else {
+	op.remove();
+      }
+    } else {
+      if (under_parent) {
+	ictx->lock.Lock();
+	r = object_map_mark(ictx, objno);
+	ictx->lock.Unlock();
+	if (r >= 0)
+	  r = copyup_object(ictx, objno);
+	if (r < 0)
+	  break;
+      }
+      if (to_end)
+	op.truncate(obj_ofs);
+      else
+	op.zero(obj_ofs, obj_len);
+    }
+
+    AioBlockCompletion *block_completion = new AioBlockCompletion(cct, c, off, len, NULL);
+    c->add_block_completion(block_completion);
+    librados::AioCompletion *rados_completion =
+      Rados::aio_create_completion(block_completion, NULL, rados_discard_cb);
+    r = ictx->data_ctx.aio_operate(oid, rados_completion, &op);
+    rados_completion->release();
+    if (r < 0)
+      break;
+  }
+  c->finish_adding_completions();
+  c->put();
+  return r < 0 ? r : 0;
+}
+
+ssize_t discard(ImageCtx *ictx, uint64_t off, uint64_t len)
+{
+  AioCompletion *c = aio_create_completion();
+  int r = wait_for_aio(aio_discard(ictx, off, len, c), c);
+  return r < 0 ? r : len;
+}
+
 void rados_aio_sparse_read_cb(rados_completion_t c, void *arg)
 {
   AioBlockCompletion *block_completion = (AioBlockCompletion *)arg;
@@ -1591,6 +3304,39 @@ void rados_aio_sparse_read_cb(rados_completion_t c, void *arg)
   delete block_completion;
 }
 
+// read the parent for a child object that doesn't exist
+struct C_ParentRead : public Context {
+  ImageCtx *ictx;
+  AioBlockCompletion *block_completion;
+  uint64_t image_ofs, parent_len;
+  C_ParentRead(ImageCtx *i, AioBlockCompletion *bc, uint64_t o, uint64_t l)
+    : ictx(i), block_completion(bc), image_ofs(o), parent_len(l) {}
+  void finish(int r) {
+    char *buf = block_completion->buf;
+    ssize_t ret = read(ictx->parent_ictx, image_ofs, parent_len, buf);
+    if (ret >= 0) {
+      memset(buf + parent_len, 0, block_completion->len - parent_len);
+      ret = block_completion->len;
+    }
+    block_completion->completion->complete_block(block_completion, ret);
+    delete block_completion;
+  }
+};
+
+void rados_layered_read_cb(rados_completion_t c, void *arg)
+{
+  C_ParentRead *req = (C_ParentRead *)arg;
+  int r = rados_aio_get_return_value(c);
+  if (r == -ENOENT) {
+    // librados callbacks mustn't block on more librados i/o
+    req->ictx->parent_finisher->queue(req);
+    return;
+  }
+  req->block_completion->complete(r);
+  delete req->block_completion;
+  delete req;
+}
+
 int aio_read(ImageCtx *ictx, uint64_t off, size_t len,
 				char *buf,
                                 AioCompletion *c)
@@ -1605,23 +3351,44 @@ int aio_read(ImageCtx *ictx, uint64_t off, size_t len,
   if (r < 0)
     return r;
 
+  if (ictx->object_cacher && len) {
+    AioBlockCompletion *block_completion =
+      new AioBlockCompletion(ictx->cct, c, off, len, NULL);
+    c->get();
+    c->add_block_completion(block_completion);
+    C_CacheRead *onfinish = new C_CacheRead(ictx, block_completion, buf, len);
+    ObjectCacher::OSDRead *rd =
+      ictx->object_cacher->prepare_read(ictx->snapid, &onfinish->bl, 0);
+    map_to_extents(ictx, off, len, rd->extents);
+
+    ictx->cache_lock.Lock();
+    r = ictx->object_cacher->readx(rd, ictx->object_set, onfinish);
+    ictx->cache_lock.Unlock();
+    if (r > 0) {
+      // all cached
+      block_completion->complete(onfinish->copy_out());
+      delete block_completion;
+      delete onfinish;
+    }
+    c->finish_adding_completions();
+    c->put();
+    return len;
+  }
+
   int64_t ret;
   int total_read = 0;
-  ictx->lock.Lock();
-  uint64_t start_block = get_block_num(ictx->header, off);
-  uint64_t end_block = get_block_num(ictx->header, off + len - 1);
-  uint64_t block_size = get_block_size(ictx->header);
-  ictx->lock.Unlock();
   uint64_t left = len;
 
   c->get();
-  for (uint64_t i = start_block; i <= end_block; i++) {
+  while (left > 0) {
     bufferlist bl;
+    uint64_t objno, block_ofs;
     ictx->lock.Lock();
-    string oid = get_block_oid(ictx->header, i);
-    uint64_t block_ofs = get_block_ofs(ictx->header, off + total_read);
+    uint64_t read_len = min(map_image_offset(ictx->header, ictx->stripe, off + total_read,
+					     &objno, &block_ofs), left);
+    string oid = get_block_oid(ictx->header, objno);
+    bool may_exist = object_may_exist(ictx, objno);
     ictx->lock.Unlock();
-    uint64_t read_len = min(block_size - block_ofs, left);
 
     map<uint64_t,uint64_t> m;
     map<uint64_t,uint64_t>::iterator iter;
@@ -1630,8 +3397,26 @@ int aio_read(ImageCtx *ictx, uint64_t off, size_t len,
 	new AioBlockCompletion(ictx->cct, c, block_ofs, read_len, buf + total_read);
     c->add_block_completion(block_completion);
 
-    librados::AioCompletion *rados_completion =
-      Rados::aio_create_completion(block_completion, rados_aio_sparse_read_cb, NULL);
+    if (!may_exist) {
+      // never written: zeros, without asking the osd
+      block_completion->complete(0);
+      delete block_completion;
+      total_read += read_len;
+      left -= read_len;
+      continue;
+    }
+
+    librados::AioCompletion *rados_completion;
+    ictx->lock.Lock();
+    if (ictx->has_parent && ictx->parent_ictx && off + total_read < ictx->parent.overlap) {
+      // an -ENOENT here means read the parent instead
+      C_ParentRead *req = new C_ParentRead(ictx, block_completion, off + total_read,
+					   MIN(read_len, ictx->parent.overlap - (off + total_read)));
+      rados_completion = Rados::aio_create_completion(req, rados_layered_read_cb, NULL);
+    } else {
+      rados_completion = Rados::aio_create_completion(block_completion, rados_aio_sparse_read_cb, NULL);
+    }
+    ictx->lock.Unlock();
     r = ictx->data_ctx.aio_sparse_read(oid, rados_completion,
 				       &block_completion->m, &block_completion->data_bl,
 				       read_len, block_ofs);
@@ -1693,6 +3478,18 @@ int RBD::create(IoCtx& io_ctx, const char *name, uint64_t size, int *order)
   return r;
 }
 
+int RBD::create2(IoCtx& io_ctx, const char *name, uint64_t size, int *order,
+		 uint64_t stripe_unit, uint64_t stripe_count)
+{
+  return librbd::create(io_ctx, name, size, order, stripe_unit, stripe_count);
+}
+
+int RBD::clone(IoCtx& p_ioctx, const char *p_name, const char *p_snapname,
+	       IoCtx& c_ioctx, const char *c_name, int *c_order)
+{
+  return librbd::clone(p_ioctx, p_name, p_snapname, c_ioctx, c_name, c_order);
+}
+
 int RBD::remove(IoCtx& io_ctx, const char *name)
 {
   librbd::NoOpProgressContext prog_ctx;
@@ -1782,6 +3579,18 @@ int Image::stat(image_info_t& info, size_t infosize)
   return r;
 }
 
+int Image::get_stripe_unit(uint64_t *stripe_unit)
+{
+  ImageCtx *ictx = (ImageCtx *)ctx;
+  return librbd::get_stripe_unit(ictx, stripe_unit);
+}
+
+int Image::get_stripe_count(uint64_t *stripe_count)
+{
+  ImageCtx *ictx = (ImageCtx *)ctx;
+  return librbd::get_stripe_count(ictx, stripe_count);
+}
+
 int Image::copy(IoCtx& dest_io_ctx, const char *destname)
 {
   ImageCtx *ictx = (ImageCtx *)ctx;
@@ -1798,6 +3607,19 @@ int Image::copy_with_progress(IoCtx& dest_io_ctx, const char *destname,
   return r;
 }
 
+int Image::flatten()
+{
+  ImageCtx *ictx = (ImageCtx *)ctx;
+  librbd::NoOpProgressContext prog_ctx;
+  return librbd::flatten(ictx, prog_ctx);
+}
+
+int Image::flatten_with_progress(librbd::ProgressContext& prog_ctx)
+{
+  ImageCtx *ictx = (ImageCtx *)ctx;
+  return librbd::flatten(ictx, prog_ctx);
+}
+
 int Image::snap_create(const char *snap_name)
 {
   ImageCtx *ictx = (ImageCtx *)ctx;
@@ -1854,6 +3676,13 @@ int64_t Image::read_iterate(uint64_t ofs, size_t len,
   return librbd::read_iterate(ictx, ofs, len, cb, arg);
 }
 
+int Image::diff_iterate(const char *fromsnapname, uint64_t ofs, uint64_t len,
+			int (*cb)(uint64_t, size_t, int, void *), void *arg)
+{
+  ImageCtx *ictx = (ImageCtx *)ctx;
+  return librbd::diff_iterate(ictx, fromsnapname, ofs, len, cb, arg);
+}
+
 ssize_t Image::write(uint64_t ofs, size_t len, bufferlist& bl)
 {
   ImageCtx *ictx = (ImageCtx *)ctx;
@@ -1862,6 +3691,18 @@ ssize_t Image::write(uint64_t ofs, size_t len, bufferlist& bl)
   return librbd::write(ictx, ofs, len, bl.c_str());
 }
 
+ssize_t Image::discard(uint64_t ofs, uint64_t len)
+{
+  ImageCtx *ictx = (ImageCtx *)ctx;
+  return librbd::discard(ictx, ofs, len);
+}
+
+int Image::aio_discard(uint64_t off, uint64_t len, RBD::AioCompletion *c)
+{
+  ImageCtx *ictx = (ImageCtx *)ctx;
+  return librbd::aio_discard(ictx, off, len, (librbd::AioCompletion *)c->pc);
+}
+
 int Image::aio_write(uint64_t off, size_t len, bufferlist& bl, RBD::AioCompletion *c)
 {
   ImageCtx *ictx = (ImageCtx *)ctx;
@@ -1934,6 +3775,23 @@ extern "C" int rbd_create(rados_ioctx_t p, const char *name, uint64_t size, int
   return librbd::create(io_ctx, name, size, order);
 }
 
+extern "C" int rbd_create2(rados_ioctx_t p, const char *name, uint64_t size, int *order,
+			   uint64_t stripe_unit, uint64_t stripe_count)
+{
+  librados::IoCtx io_ctx;
+  librados::IoCtx::from_rados_ioctx_t(p, io_ctx);
+  return librbd::create(io_ctx, name, size, order, stripe_unit, stripe_count);
+}
+
+extern "C" int rbd_clone(rados_ioctx_t p_ioctx, const char *p_name, const char *p_snapname,
+			 rados_ioctx_t c_ioctx, const char *c_name, int *c_order)
+{
+  librados::IoCtx p_ioc, c_ioc;
+  librados::IoCtx::from_rados_ioctx_t(p_ioctx, p_ioc);
+  librados::IoCtx::from_rados_ioctx_t(c_ioctx, c_ioc);
+  return librbd::clone(p_ioc, p_name, p_snapname, c_ioc, c_name, c_order);
+}
+
 extern "C" int rbd_remove(rados_ioctx_t p, const char *name)
 {
   librados::IoCtx io_ctx;
@@ -1971,6 +3829,21 @@ extern "C" int rbd_copy_with_progress(rbd_image_t image, rados_ioctx_t dest_p,
   return ret;
 }
 
+extern "C" int rbd_flatten(rbd_image_t image)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  librbd::NoOpProgressContext prog_ctx;
+  return librbd::flatten(ictx, prog_ctx);
+}
+
+extern "C" int rbd_flatten_with_progress(rbd_image_t image,
+					 librbd_progress_fn_t cb, void *cbdata)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  librbd::CProgressContext prog_ctx(cb, cbdata);
+  return librbd::flatten(ictx, prog_ctx);
+}
+
 extern "C" int rbd_rename(rados_ioctx_t src_p, const char *srcname, const char *destname)
 {
   librados::IoCtx src_io_ctx;
@@ -2018,6 +3891,18 @@ extern "C" int rbd_stat(rbd_image_t image, rbd_image_info_t *info, size_t infosi
   return librbd::info(ictx, *info, infosize);
 }
 
+extern "C" int rbd_get_stripe_unit(rbd_image_t image, uint64_t *stripe_unit)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::get_stripe_unit(ictx, stripe_unit);
+}
+
+extern "C" int rbd_get_stripe_count(rbd_image_t image, uint64_t *stripe_count)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::get_stripe_count(ictx, stripe_count);
+}
+
 /* snapshots */
 extern "C" int rbd_snap_create(rbd_image_t image, const char *snap_name)
 {
@@ -2109,6 +3994,14 @@ extern "C" int64_t rbd_read_iterate(rbd_image_t image, uint64_t ofs, size_t len,
   return librbd::read_iterate(ictx, ofs, len, cb, arg);
 }
 
+extern "C" int rbd_diff_iterate(rbd_image_t image, const char *fromsnapname,
+				uint64_t ofs, uint64_t len,
+				int (*cb)(uint64_t, size_t, int, void *), void *arg)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::diff_iterate(ictx, fromsnapname, ofs, len, cb, arg);
+}
+
 extern "C" ssize_t rbd_write(rbd_image_t image, uint64_t ofs, size_t len, const char *buf)
 {
   librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
@@ -2129,6 +4022,19 @@ extern "C" int rbd_aio_write(rbd_image_t image, uint64_t off, size_t len, const
   return librbd::aio_write(ictx, off, len, buf, (librbd::AioCompletion *)comp->pc);
 }
 
+extern "C" ssize_t rbd_discard(rbd_image_t image, uint64_t ofs, uint64_t len)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::discard(ictx, ofs, len);
+}
+
+extern "C" int rbd_aio_discard(rbd_image_t image, uint64_t off, uint64_t len, rbd_completion_t c)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  librbd::RBD::AioCompletion *comp = (librbd::RBD::AioCompletion *)c;
+  return librbd::aio_discard(ictx, off, len, (librbd::AioCompletion *)comp->pc);
+}
+
 extern "C" int rbd_aio_read(rbd_image_t image, uint64_t off, size_t len, char *buf, rbd_completion_t c)
 {
   librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
@@ -246,7 +246,13 @@ void AnchorServer::handle_query(MMDSTableRequest *req)
   vector<Anchor> trace;
   inodeno_t curino = ino;
   while (true) {
-    assert(anchor_map.count(curino) == 1);
+    if (anchor_map.count(curino) == 0) {
+      // not anchored (inodes are found by their backtrace now); say so
+      // with an empty trace.
+      dout(7) << "handle_lookup  no anchor for " << curino << dendl;
+      trace.clear();
+      break;
+    }
     Anchor &anchor = anchor_map[curino];
     
     dout(10) << "handle_lookup  adding " << anchor << dendl;
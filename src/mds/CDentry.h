@@ -320,7 +320,7 @@ public:
     ::encode(version, bl);
     ::encode(projected_version, bl);
     ::encode(lock, bl);
-    ::encode(replica_map, bl);
+    encode_replicas(bl);
     get(PIN_TEMPEXPORTING);
   }
   void finish_export() {
@@ -342,15 +342,13 @@ public:
     ::decode(version, blp);
     ::decode(projected_version, blp);
     ::decode(lock, blp);
-    ::decode(replica_map, blp);
+    decode_replicas(blp);
 
     // twiddle
     state = 0;
     state_set(CDentry::STATE_AUTH);
     if (nstate & STATE_DIRTY)
       _mark_dirty(ls);
-    if (!replica_map.empty())
-      get(PIN_REPLICATED);
   }
 
   // -- locking --
@@ -665,6 +665,31 @@ bool CDir::try_trim_snap_dentry(CDentry *dn, const set<snapid_t>& snaps)
 }
 
 
+/*
+ * A frag splits once it holds too many dentries or sees too much load,
+ * and merges back only when it is both small and quiet; the merge
+ * thresholds sit well below the split ones, so a frag split for load
+ * isn't merged right back.
+ */
+bool CDir::should_split(utime_t now)
+{
+  if (g_conf->mds_bal_split_size <= 0)
+    return false;
+  if ((int)get_num_head_items() > g_conf->mds_bal_split_size)
+    return true;
+  return pop_me.get(META_POP_IRD).get(now, cache->decayrate) > g_conf->mds_bal_split_rd ||
+    pop_me.get(META_POP_IWR).get(now, cache->decayrate) > g_conf->mds_bal_split_wr;
+}
+
+bool CDir::should_merge(utime_t now)
+{
+  if (get_frag() == frag_t() ||
+      (int)get_num_head_items() >= g_conf->mds_bal_merge_size)
+    return false;
+  return pop_me.get(META_POP_IRD).get(now, cache->decayrate) < g_conf->mds_bal_merge_rd &&
+    pop_me.get(META_POP_IWR).get(now, cache->decayrate) < g_conf->mds_bal_merge_wr;
+}
+
 void CDir::purge_stale_snap_data(const set<snapid_t>& snaps)
 {
   dout(10) << "purge_stale_snap_data " << snaps << dendl;
@@ -805,7 +830,7 @@ void CDir::finish_old_fragment(list<Context*>& waiters, bool replay)
 
 void CDir::init_fragment_pins()
 {
-  if (!replica_map.empty())
+  if (is_replicated())
     get(PIN_REPLICATED);
   if (state_test(STATE_DIRTY))
     get(PIN_DIRTY);
@@ -845,7 +870,8 @@ void CDir::split(int bits, list<CDir*>& subs, list<Context*>& waiters, bool repl
   for (list<frag_t>::iterator p = frags.begin(); p != frags.end(); ++p) {
     CDir *f = new CDir(inode, *p, cache, is_auth());
     f->state_set(state & MASK_STATE_FRAGMENT_KEPT);
-    f->replica_map = replica_map;
+    if (is_replicated())
+      f->more()->replica_map = get_replicas();
     f->dir_auth = dir_auth;
     f->init_fragment_pins();
     f->set_version(get_version());
@@ -928,12 +954,12 @@ void CDir::merge(list<CDir*>& subs, list<Context*>& waiters, bool replay)
       steal_dentry(dir->items.begin()->second);
     
     // merge replica map
-    for (map<int,int>::iterator p = dir->replica_map.begin();
-	 p != dir->replica_map.end();
+    for (map<int,int>::iterator p = dir->replicas_begin();
+	 p != dir->replicas_end();
 	 ++p) {
-      int cur = replica_map[p->first];
+      int cur = more()->replica_map[p->first];
       if (p->second > cur)
-	replica_map[p->first] = p->second;
+	more()->replica_map[p->first] = p->second;
     }
 
     // merge version
@@ -1352,6 +1378,7 @@ void CDir::fetch(Context *c, const string& want_dn, bool ignore_authpinnability)
   object_locator_t oloc(cache->mds->mdsmap->get_metadata_pg_pool());
   ObjectOperation rd;
   rd.tmap_get();
+  rd.omap_get_vals("", 0);   // whatever mds_use_omap says, the dir may have been converted
   cache->mds->objecter->read(oid, oloc, rd, CEPH_NOSNAP, &fin->bl, 0, fin);
 }
 
@@ -1433,26 +1460,40 @@ void CDir::_fetched(bufferlist &bl, const string& want_dn)
   bool purged_any = false;
 
 
-  //int num_new_inodes_loaded = 0;
-  loff_t baseoff = p.get_off();
+  // dentries still in the tmap, then those in the omap, which are newer
+  map<string, bufferlist> dentries;
   for (unsigned i=0; i<n; i++) {
-    loff_t dn_offset = p.get_off() - baseoff;
+    string key;
+    ::decode(key, p);
+    ::decode(dentries[key], p);
+  }
+  {
+    map<string, bufferlist> omap;
+    ::decode(omap, p);
+    dout(10) << "_fetched " << omap.size() << " omap keys" << dendl;
+    for (map<string, bufferlist>::iterator it = omap.begin(); it != omap.end(); ++it)
+      dentries[it->first].claim(it->second);
+  }
+  if (got_fnode.dentries_in_omap && !fnode.dentries_in_omap)
+    mark_dentries_in_omap();
 
+  //int num_new_inodes_loaded = 0;
+  for (map<string, bufferlist>::iterator it = dentries.begin();
+       it != dentries.end();
+       ++it) {
     // dname
     string dname;
     snapid_t first, last;
-    dentry_key_t::decode_helper(p, dname, last);
+    dentry_key_t::decode_helper(it->first, dname, last);
     
-    bufferlist dndata;
-    ::decode(dndata, p);
-    bufferlist::iterator q = dndata.begin();
+    bufferlist::iterator q = it->second.begin();
     ::decode(first, q);
 
     // marker
     char type;
     ::decode(type, q);
 
-    dout(24) << "_fetched pos " << dn_offset << " marker '" << type << "' dname '" << dname
+    dout(24) << "_fetched marker '" << type << "' dname '" << dname
 	     << " [" << first << "," << last << "]"
 	     << dendl;
 
@@ -1463,6 +1504,8 @@ void CDir::_fetched(bufferlist &bl, const string& want_dn)
 	dout(10) << " skipping stale dentry on [" << first << "," << last << "]" << dendl;
 	stale = true;
 	purged_any = true;
+	if (commit_to_omap())
+	  stale_omap_keys.insert(it->first);
       }
     }
     
@@ -1583,7 +1626,7 @@ void CDir::_fetched(bufferlist &bl, const string& want_dn)
       }
     } else {
       dout(1) << "corrupt directory, i got tag char '" << type << "' val " << (int)(type)
-	      << " at offset " << p.get_off() << dendl;
+	      << " for dentry '" << it->first << "'" << dendl;
       assert(0);
     }
     
@@ -1816,14 +1859,18 @@ CDir::map_t::iterator CDir::_commit_partial(ObjectOperation& m,
 void CDir::_encode_dentry(CDentry *dn, bufferlist& bl,
 			  const set<snapid_t> *snaps)
 {
-  // clear dentry NEW flag, if any.  we can no longer silently drop it.
-  dn->clear_new();
-
   dn->key().encode(bl);
 
-  ceph_le32 plen = init_le32(0);
-  unsigned plen_off = bl.length();
-  ::encode(plen, bl);
+  bufferlist value;
+  _encode_dentry_value(dn, value, snaps);
+  ::encode(value, bl);
+}
+
+void CDir::_encode_dentry_value(CDentry *dn, bufferlist& bl,
+				const set<snapid_t> *snaps)
+{
+  // clear dentry NEW flag, if any.  we can no longer silently drop it.
+  dn->clear_new();
 
   ::encode(dn->first, bl);
 
@@ -1864,12 +1911,119 @@ void CDir::_encode_dentry(CDentry *dn, bufferlist& bl,
       in->purge_stale_snap_data(*snaps);
     ::encode(in->old_inodes, bl);
   }
-  
-  plen = bl.length() - plen_off - sizeof(__u32);
+}
 
-  ceph_le32 eplen;
-  eplen = plen;
-  bl.copy_in(plen_off, sizeof(eplen), (char*)&eplen);
+/*
+ * Commit dentries as omap keys if we're set to, or if the dir has
+ * already been converted; a tmap commit then would be hidden behind
+ * the omap keys.
+ */
+bool CDir::commit_to_omap()
+{
+  return cache->use_omap || fnode.dentries_in_omap;
+}
+
+/*
+ * The dir is (about to be) converted: say so in the fnode and any
+ * projected ones, so that popping a projection doesn't forget it.
+ */
+void CDir::mark_dentries_in_omap()
+{
+  dout(10) << "mark_dentries_in_omap" << dendl;
+  fnode.dentries_in_omap = true;
+  for (list<fnode_t*>::iterator p = projected_fnode.begin();
+       p != projected_fnode.end();
+       ++p)
+    (*p)->dentries_in_omap = true;
+}
+
+/**
+ * Flush out the dentries in this dir as omap keys, the way
+ * _commit_partial does for the tmap: stop once max_write_size is
+ * reached and return where to resume, and put the header only in the
+ * first changeset, which the caller must send last.
+ *
+ * Keys to remove are added to rm rather than to m; the caller puts
+ * them all in the first changeset, after the header write that
+ * creates the object if it doesn't exist yet.
+ *
+ * If the fnode doesn't say the dir is in the omap yet, this is the
+ * conversion commit (the dir must be complete): every dentry is written
+ * to the omap and the tmap is reset to just the header, which then
+ * records the new format.
+ */
+CDir::map_t::iterator CDir::_commit_omap(ObjectOperation& m,
+					 const set<snapid_t> *snaps,
+					 unsigned max_write_size,
+					 set<string>& rm,
+					 map_t::iterator last_committed_dn)
+{
+  bool convert = !fnode.dentries_in_omap;
+  dout(10) << "_commit_omap" << (convert ? " converting from tmap" : "") << dendl;
+
+  map<string, bufferlist> to_set;
+  unsigned write_size = 0;
+
+  // header
+  if (last_committed_dn == map_t::iterator()) {
+    assert(!convert || is_complete());
+    if (convert)
+      mark_dentries_in_omap();
+    bufferlist header;
+    ::encode(fnode, header);
+    bufferlist finalbl;
+    if (convert) {
+      ::encode(header, finalbl);
+      __u32 n = 0;
+      ::encode(n, finalbl);
+      m.tmap_put(finalbl);
+    } else {
+      finalbl.append(CEPH_OSD_TMAP_HDR);
+      ::encode(header, finalbl);
+      m.tmap_update(finalbl);
+    }
+    write_size += finalbl.length();
+
+    rm.insert(stale_omap_keys.begin(), stale_omap_keys.end());
+    stale_omap_keys.clear();
+  }
+
+  map_t::iterator p = items.begin();
+  if (last_committed_dn != map_t::iterator())
+    p = last_committed_dn;
+
+  while (p != items.end() && write_size < max_write_size) {
+    CDentry *dn = p->second;
+    ++p;
+
+    string key;
+    dn->key().encode(key);
+
+    if (snaps && dn->last != CEPH_NOSNAP &&
+	try_trim_snap_dentry(dn, *snaps)) {
+      rm.insert(key);
+      continue;
+    }
+
+    if (!convert && !dn->is_dirty())
+      continue;  // skip clean dentries
+
+    if (dn->get_linkage()->is_null()) {
+      if (dn->is_dirty()) {
+	dout(10) << " rm " << key << " " << *dn << dendl;
+	rm.insert(key);
+      }
+    } else {
+      dout(10) << " set " << key << " " << *dn << dendl;
+      bufferlist& value = to_set[key];
+      _encode_dentry_value(dn, value, snaps);
+      write_size += key.length() + value.length();
+    }
+  }
+
+  if (!to_set.empty())
+    m.omap_set(to_set);
+  return p;
 }
 
 
@@ -1902,8 +2056,10 @@ void CDir::_commit(version_t want)
     return;
   }
   
-  // complete first?  (only if we're not using TMAPUP osd op)
-  if (!g_conf->mds_use_tmap && !is_complete()) {
+  // complete first?  (only if we're not using TMAPUP osd op, or if the
+  // dentries still in the tmap have to be moved to the omap)
+  if ((!g_conf->mds_use_tmap || (cache->use_omap && !fnode.dentries_in_omap)) &&
+      !is_complete()) {
     dout(7) << "commit not complete, fetching first" << dendl;
     if (cache->mds->logger) cache->mds->logger->inc(l_mds_dir_ffc);
     fetch(new C_Dir_RetryCommit(this, want));
@@ -1943,7 +2099,14 @@ void CDir::_commit(version_t want)
   //        in that case!!
   max_write_size -= inode->encode_parent_mutation(m);
 
-  if (is_complete() &&
+  set<string> omap_rm;
+  bool to_omap = commit_to_omap();
+  if (to_omap) {
+    // every dentry is visited, so snapped ones are trimmed as in a full commit
+    if (is_complete())
+      fnode.snap_purged_thru = realm->get_last_destroyed();
+    committed_dn = _commit_omap(m, snaps, max_write_size, omap_rm);
+  } else if (is_complete() &&
       (num_dirty > (num_head_items*g_conf->mds_dir_commit_ratio))) {
     fnode.snap_purged_thru = realm->get_last_destroyed();
     committed_dn = _commit_full(m, snaps, max_write_size);
@@ -1957,17 +2120,22 @@ void CDir::_commit(version_t want)
 
   m.priority = CEPH_MSG_PRIO_LOW;  // set priority lower than journal!
 
-  if (committed_dn == items.end())
+  if (committed_dn == items.end()) {
+    if (!omap_rm.empty())
+      m.omap_rm_keys(omap_rm);
     cache->mds->objecter->mutate(oid, oloc, m, snapc, ceph_clock_now(g_ceph_context), 0, NULL,
                                  new C_Dir_Committed(this, get_version(),
                                        inode->inode.last_renamed_version));
-  else { // send in a different Context
+  } else { // send in a different Context
     C_GatherBuilder gather(g_ceph_context, 
 	    new C_Dir_Committed(this, get_version(),
 		      inode->inode.last_renamed_version));
     while (committed_dn != items.end()) {
       ObjectOperation n = ObjectOperation();
-      committed_dn = _commit_partial(n, snaps, max_write_size, committed_dn);
+      if (to_omap)
+	committed_dn = _commit_omap(n, snaps, max_write_size, omap_rm, committed_dn);
+      else
+	committed_dn = _commit_partial(n, snaps, max_write_size, committed_dn);
       cache->mds->objecter->mutate(oid, oloc, n, snapc, ceph_clock_now(g_ceph_context), 0, NULL,
                                   gather.new_sub());
     }
@@ -1981,6 +2149,8 @@ void CDir::_commit(version_t want)
      * we simply send the message containing the header off last, we cannot
      * get our header into an incorrect state.
      */
+    if (!omap_rm.empty())
+      m.omap_rm_keys(omap_rm);
     cache->mds->objecter->mutate(oid, oloc, m, snapc, ceph_clock_now(g_ceph_context), 0, NULL,
                                 gather.new_sub());
     gather.activate();
@@ -2111,7 +2281,7 @@ void CDir::encode_export(bufferlist& bl)
   ::encode(pop_auth_subtree, bl);
 
   ::encode(dir_rep_by, bl);  
-  ::encode(replica_map, bl);
+  encode_replicas(bl);
 
   get(PIN_TEMPEXPORTING);
 }
@@ -2147,8 +2317,7 @@ void CDir::decode_import(bufferlist::iterator& blp, utime_t now)
   pop_auth_subtree_nested.add(now, cache->decayrate, pop_auth_subtree);
 
   ::decode(dir_rep_by, blp);
-  ::decode(replica_map, blp);
-  if (!replica_map.empty()) get(PIN_REPLICATED);
+  decode_replicas(blp);
 
   replica_nonce = 0;  // no longer defined
 
@@ -237,6 +237,8 @@ protected:
   version_t committing_version;
   version_t committed_version;
 
+  set<string> stale_omap_keys;   // purged snap dentries seen by _fetched
+
 
   // lock nesting, freeze
   int auth_pins;
@@ -301,6 +303,7 @@ protected:
 
   map_t::iterator begin() { return items.begin(); }
   map_t::iterator end() { return items.end(); }
+  map_t::iterator upper_bound(const dentry_key_t& k) { return items.upper_bound(k); }
 
   unsigned get_num_head_items() { return num_head_items; }
   unsigned get_num_head_null() { return num_head_null; }
@@ -362,12 +365,8 @@ public:
   void split(int bits, list<CDir*>& subs, list<Context*>& waiters, bool replay);
   void merge(list<CDir*>& subs, list<Context*>& waiters, bool replay);
 
-  bool should_split() {
-    return (int)get_num_head_items() > g_conf->mds_bal_split_size;
-  }
-  bool should_merge() {
-    return (int)get_num_head_items() < g_conf->mds_bal_merge_size;
-  }
+  bool should_split(utime_t now);
+  bool should_merge(utime_t now);
 
 private:
   void prepare_new_fragment(bool replay);
@@ -486,7 +485,13 @@ private:
   map_t::iterator _commit_partial(ObjectOperation& m, const set<snapid_t> *snaps,
                        unsigned max_write_size=-1,
                        map_t::iterator last_committed_dn=map_t::iterator());
+  map_t::iterator _commit_omap(ObjectOperation& m, const set<snapid_t> *snaps,
+                               unsigned max_write_size, set<string>& rm,
+                               map_t::iterator last_committed_dn=map_t::iterator());
   void _encode_dentry(CDentry *dn, bufferlist& bl, const set<snapid_t> *snaps);
+  void _encode_dentry_value(CDentry *dn, bufferlist& bl, const set<snapid_t> *snaps);
+  bool commit_to_omap();
+  void mark_dentries_in_omap();
   void _committed(version_t v, version_t last_renamed_version);
   void wait_for_commit(Context *c, version_t v=0);
 
@@ -50,6 +50,8 @@
 boost::pool<> CInode::pool(sizeof(CInode));
 boost::pool<> Capability::pool(sizeof(Capability));
 
+ceph_lock_state_t CInode::empty_file_lock_state;
+
 LockType CInode::versionlock_type(CEPH_LOCK_IVERSION);
 LockType CInode::authlock_type(CEPH_LOCK_IAUTH);
 LockType CInode::linklock_type(CEPH_LOCK_ILINK);
@@ -1042,6 +1044,7 @@ void CInode::_stored_parent(version_t v, Context *fin)
       item_renamed_file.remove_myself();
       state_clear(STATE_DIRTYPARENT);
       put(PIN_DIRTYPARENT);
+      mdcache->maybe_eval_stray(this);  // the pin may have held up a purge
     } else {
       dout(10) << "stored_parent committed v" << v << " < " << inode.last_renamed_version
 	       << ", renamed again, not removing from list" << dendl;
@@ -1055,6 +1058,21 @@ void CInode::_stored_parent(version_t v, Context *fin)
   }
 }
 
+/*
+ * Our backtrace changed (or we need one, to be found by ino): write it
+ * when ls expires.  Until then the pin keeps us in cache, so nobody has
+ * to look for us on disk.  The caller set inode.last_renamed_version.
+ */
+void CInode::mark_dirty_parent(LogSegment *ls)
+{
+  if (!state_test(STATE_DIRTYPARENT)) {
+    dout(10) << "mark_dirty_parent" << dendl;
+    state_set(STATE_DIRTYPARENT);
+    get(PIN_DIRTYPARENT);
+  }
+  ls->renamed_files.push_back(&item_renamed_file);
+}
+
 
 // ------------------
 // locking
@@ -1188,8 +1206,7 @@ void CInode::encode_lock_state(int type, bufferlist& bl)
     break;
 
   case CEPH_LOCK_IFLOCK:
-    ::encode(fcntl_locks, bl);
-    ::encode(flock_locks, bl);
+    encode_file_locks(bl);
     break;
 
   case CEPH_LOCK_IPOLICY:
@@ -1431,8 +1448,7 @@ void CInode::decode_lock_state(int type, bufferlist& bl)
     break;
 
   case CEPH_LOCK_IFLOCK:
-    ::decode(fcntl_locks, p);
-    ::decode(flock_locks, p);
+    decode_file_locks(p);
     break;
 
   case CEPH_LOCK_IPOLICY:
@@ -2327,8 +2343,9 @@ void CInode::remove_client_cap(client_t client)
   mdcache->num_caps--;
 
   //clean up advisory locks
-  bool fcntl_removed = fcntl_locks.remove_all_from(client);
-  bool flock_removed = flock_locks.remove_all_from(client);
+  bool fcntl_removed = fcntl_locks && fcntl_locks->remove_all_from(client);
+  bool flock_removed = flock_locks && flock_locks->remove_all_from(client);
+  try_clear_file_lock_state();
   if (fcntl_removed || flock_removed) {
     list<Context*> waiters;
     take_waiting(CInode::WAIT_FLOCK, waiters);
@@ -2951,7 +2968,7 @@ void CInode::encode_export(bufferlist& bl)
 
   ::encode(pop, bl);
 
-  ::encode(replica_map, bl);
+  encode_replicas(bl);
 
   // include scatterlock info for any bounding CDirs
   bufferlist bounding;
@@ -3002,9 +3019,7 @@ void CInode::decode_import(bufferlist::iterator& p,
 
   ::decode(pop, ceph_clock_now(g_ceph_context), p);
 
-  ::decode(replica_map, p);
-  if (!replica_map.empty())
-    get(PIN_REPLICATED);
+  decode_replicas(p);
 
   if (struct_v >= 2) {
     // decode fragstat info on bounding cdirs
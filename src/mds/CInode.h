@@ -419,8 +419,40 @@ public:
 
 protected:
 
-  ceph_lock_state_t fcntl_locks;
-  ceph_lock_state_t flock_locks;
+  // advisory file locks, allocated once a client first takes one
+  ceph_lock_state_t *fcntl_locks;
+  ceph_lock_state_t *flock_locks;
+  static ceph_lock_state_t empty_file_lock_state;
+
+  ceph_lock_state_t *get_fcntl_lock_state() {
+    if (!fcntl_locks)
+      fcntl_locks = new ceph_lock_state_t;
+    return fcntl_locks;
+  }
+  ceph_lock_state_t *get_flock_lock_state() {
+    if (!flock_locks)
+      flock_locks = new ceph_lock_state_t;
+    return flock_locks;
+  }
+  void try_clear_file_lock_state() {
+    if (fcntl_locks && fcntl_locks->empty()) {
+      delete fcntl_locks;
+      fcntl_locks = NULL;
+    }
+    if (flock_locks && flock_locks->empty()) {
+      delete flock_locks;
+      flock_locks = NULL;
+    }
+  }
+  void encode_file_locks(bufferlist& bl) const {
+    ::encode(fcntl_locks ? *fcntl_locks : empty_file_lock_state, bl);
+    ::encode(flock_locks ? *flock_locks : empty_file_lock_state, bl);
+  }
+  void decode_file_locks(bufferlist::iterator& p) {
+    ::decode(*get_fcntl_lock_state(), p);
+    ::decode(*get_flock_lock_state(), p);
+    try_clear_file_lock_state();
+  }
 
   // LogSegment dlists i (may) belong to
 public:
@@ -469,6 +501,7 @@ private:
     parent(0),
     inode_auth(CDIR_AUTH_DEFAULT),
     replica_caps_wanted(0),
+    fcntl_locks(NULL), flock_locks(NULL),
     item_dirty(this), item_caps(this), item_open_file(this), item_renamed_file(this), 
     item_dirty_dirfrag_dir(this), 
     item_dirty_dirfrag_nest(this), 
@@ -498,6 +531,8 @@ private:
     g_num_inos++;
     close_dirfrags();
     close_snaprealm();
+    delete fcntl_locks;
+    delete flock_locks;
   }
   
 
@@ -569,6 +604,7 @@ private:
 
   void store_parent(Context *fin);
   void _stored_parent(version_t v, Context *fin);
+  void mark_dirty_parent(LogSegment *ls);
 
   void build_backtrace(inode_backtrace_t& bt);
   unsigned encode_parent_mutation(ObjectOperation& m);
@@ -350,6 +350,10 @@ void MDBalancer::do_fragmenting()
     return;
   }
 
+  // the queues were filled as the frags were hit; only act on the
+  // frags that still qualify
+  utime_t now = ceph_clock_now(g_ceph_context);
+
   if (!split_queue.empty()) {
     dout(0) << "do_fragmenting " << split_queue.size() << " dirs marked for possible splitting" << dendl;
 
@@ -361,7 +365,8 @@ void MDBalancer::do_fragmenting()
 	 i++) {
       CDir *dir = mds->mdcache->get_dirfrag(*i);
       if (!dir ||
-	  !dir->is_auth())
+	  !dir->is_auth() ||
+	  !dir->should_split(now))
 	continue;
 
       dout(0) << "do_fragmenting splitting " << *dir << dendl;
@@ -381,7 +386,8 @@ void MDBalancer::do_fragmenting()
       CDir *dir = mds->mdcache->get_dirfrag(*i);
       if (!dir ||
 	  !dir->is_auth() ||
-	  dir->get_frag() == frag_t())  // ok who's the joker?
+	  dir->get_frag() == frag_t() ||  // ok who's the joker?
+	  !dir->should_merge(now))
 	continue;
 
       dout(0) << "do_fragmenting merging " << *dir << dendl;
@@ -400,7 +406,7 @@ void MDBalancer::do_fragmenting()
 	bool all = true;
 	for (list<CDir*>::iterator p = sibs.begin(); p != sibs.end(); p++) {
 	  CDir *sib = *p;
-	  if (!sib->is_auth() || !sib->should_merge()) {
+	  if (!sib->is_auth() || !sib->should_merge(now)) {
 	    all = false;
 	    break;
 	  }
@@ -444,6 +450,14 @@ void MDBalancer::prep_rebalance(int beat)
     imported.clear();
     exported.clear();
 
+    map<dirfrag_t,int>::iterator p = recent_imports.begin();
+    while (p != recent_imports.end()) {
+      if (beat_epoch - p->second >= g_conf->mds_bal_import_hold_epochs)
+	recent_imports.erase(p++);
+      else
+	++p;
+    }
+
     dout(5) << " prep_rebalance: cluster loads are" << dendl;
 
     mds->mdcache->migrator->clear_export_queue();
@@ -647,6 +661,11 @@ void MDBalancer::try_rebalance()
   double total_sent = 0;
   double total_goal = 0;
 
+  if (g_conf->mds_bal_export_max_items > 0)
+    export_budget = g_conf->mds_bal_export_max_items;
+  else
+    export_budget = -1;
+
   for (map<int,double>::iterator it = my_targets.begin();
        it != my_targets.end();
        it++) {
@@ -691,10 +710,19 @@ void MDBalancer::try_rebalance()
 	    dir->inode->is_stray())
 	  continue;
 	if (dir->is_freezing() || dir->is_frozen()) continue;  // export pbly already in progress
+	if (recently_imported(dir)) continue;
 	double pop = dir->pop_auth_subtree.meta_load(rebalance_time, mds->mdcache->decayrate);
 	assert(dir->inode->authority().first == target);  // cuz that's how i put it in the map, dummy
 
 	if (pop <= amount-have) {
+	  double cost = export_cost(dir);
+	  if (export_budget >= 0 && cost > export_budget) {
+	    dout(5) << "can't reexport " << *dir << ", cost " << cost
+		    << " over budget " << export_budget << dendl;
+	    continue;
+	  }
+	  if (export_budget >= 0)
+	    export_budget -= cost;
 	  dout(0) << "reexporting " << *dir
 		  << " pop " << pop
 		  << " back to mds." << target << dendl;
@@ -847,7 +875,9 @@ void MDBalancer::find_exports(CDir *dir,
   double minchunk = need * g_conf->mds_bal_minchunk;
 
   list<CDir*> bigger_rep, bigger_unrep;
-  multimap<double, CDir*> smaller;
+  multimap<double, pair<double, CDir*> > smaller;  // pop per unit cost -> (pop, dir)
+  CDir *lucky = 0;
+  double lucky_pop = 0, lucky_cost = 0;
 
   double dir_pop = dir->pop_auth_subtree.meta_load(rebalance_time, mds->mdcache->decayrate);
   dout(7) << " find_exports in " << dir_pop << " " << *dir << " need " << need << " (" << needmin << " - " << needmax << ")" << dendl;
@@ -870,20 +900,26 @@ void MDBalancer::find_exports(CDir *dir,
       if (already_exporting.count(subdir)) continue;
 
       if (subdir->is_frozen()) continue;  // can't export this right now!
+      if (recently_imported(subdir)) continue;  // don't bounce it straight back out
 
       // how popular?
       double pop = subdir->pop_auth_subtree.meta_load(rebalance_time, mds->mdcache->decayrate);
+      double cost = export_cost(subdir);
       subdir_sum += pop;
-      dout(15) << "   subdir pop " << pop << " " << *subdir << dendl;
+      dout(15) << "   subdir pop " << pop << " cost " << cost << " " << *subdir << dendl;
 
       if (pop < minchunk) continue;
 
-      // lucky find?
+      // lucky find?  take the cheapest one.
       if (pop > needmin && pop < needmax) {
-	exports.push_back(subdir);
-	already_exporting.insert(subdir);
-	have += pop;
-	return;
+	if (export_budget >= 0 && cost > export_budget)
+	  continue;
+	if (!lucky || cost < lucky_cost) {
+	  lucky = subdir;
+	  lucky_pop = pop;
+	  lucky_cost = cost;
+	}
+	continue;
       }
 
       if (pop > need) {
@@ -892,26 +928,27 @@ void MDBalancer::find_exports(CDir *dir,
 	else
 	  bigger_unrep.push_back(subdir);
       } else
-	smaller.insert(pair<double,CDir*>(pop, subdir));
+	smaller.insert(make_pair(pop / cost, make_pair(pop, subdir)));
     }
   }
   dout(15) << "   sum " << subdir_sum << " / " << dir_pop << dendl;
 
-  // grab some sufficiently big small items
-  multimap<double,CDir*>::reverse_iterator it;
+  if (lucky &&
+      take_export(lucky, lucky_pop, exports, have, already_exporting))
+    return;
+
+  // grab some sufficiently big small items, hottest per unit cost first
+  multimap<double, pair<double, CDir*> >::reverse_iterator it;
   for (it = smaller.rbegin();
        it != smaller.rend();
        it++) {
 
-    if ((*it).first < midchunk)
-      break;  // try later
-
-    dout(7) << "   taking smaller " << *(*it).second << dendl;
+    if (it->second.first < midchunk)
+      continue;  // try later
 
-    exports.push_back((*it).second);
-    already_exporting.insert((*it).second);
-    have += (*it).first;
-    if (have > needmin)
+    dout(7) << "   taking smaller " << *it->second.second << dendl;
+    if (take_export(it->second.second, it->second.first, exports, have, already_exporting) &&
+	have > needmin)
       return;
   }
 
@@ -926,15 +963,15 @@ void MDBalancer::find_exports(CDir *dir,
   }
 
   // ok fine, use smaller bits
-  for (;
+  for (it = smaller.rbegin();
        it != smaller.rend();
        it++) {
-    dout(7) << "   taking (much) smaller " << it->first << " " << *(*it).second << dendl;
+    if (it->second.first >= midchunk)
+      continue;  // already taken (or unaffordable)
 
-    exports.push_back((*it).second);
-    already_exporting.insert((*it).second);
-    have += (*it).first;
-    if (have > needmin)
+    dout(7) << "   taking (much) smaller " << it->second.first << " " << *it->second.second << dendl;
+    if (take_export(it->second.second, it->second.first, exports, have, already_exporting) &&
+	have > needmin)
       return;
   }
 
@@ -950,6 +987,43 @@ void MDBalancer::find_exports(CDir *dir,
 
 }
 
+/*
+ * Rough cost of migrating dir: the exporter freezes and encodes the
+ * whole subtree and the importer journals it, so it scales with the
+ * number of items below it, and dirty items cost a bit more.  rstat
+ * counts items whether or not they're cached, so this overestimates
+ * cold subtrees; that's fine, we'd rather not move those anyway.
+ */
+double MDBalancer::export_cost(CDir *dir)
+{
+  return 1.0 + dir->fnode.rstat.rsize() + dir->get_num_dirty();
+}
+
+bool MDBalancer::recently_imported(CDir *dir)
+{
+  map<dirfrag_t,int>::iterator p = recent_imports.find(dir->dirfrag());
+  return p != recent_imports.end() &&
+    beat_epoch - p->second < g_conf->mds_bal_import_hold_epochs;
+}
+
+bool MDBalancer::take_export(CDir *dir, double pop, list<CDir*>& exports, double& have,
+			     set<CDir*>& already_exporting)
+{
+  double cost = export_cost(dir);
+  if (export_budget >= 0) {
+    if (cost > export_budget) {
+      dout(7) << "   cost " << cost << " over remaining budget " << export_budget
+	      << ", skipping " << *dir << dendl;
+      return false;
+    }
+    export_budget -= cost;
+  }
+  exports.push_back(dir);
+  already_exporting.insert(dir);
+  have += pop;
+  return true;
+}
+
 void MDBalancer::hit_inode(utime_t now, CInode *in, int type, int who)
 {
   // hit inode
@@ -1004,19 +1078,15 @@ void MDBalancer::hit_dir(utime_t now, CDir *dir, int type, int who, double amoun
 	     << " size " << dir->get_num_head_items() << dendl;
 
     // split
-    if (g_conf->mds_bal_split_size > 0 &&
-	((dir->get_num_head_items() > (unsigned)g_conf->mds_bal_split_size) ||
-	 (v > g_conf->mds_bal_split_rd && type == META_POP_IRD) ||
-	 (v > g_conf->mds_bal_split_wr && type == META_POP_IWR)) &&
-	split_queue.count(dir->dirfrag()) == 0) {
+    if (split_queue.count(dir->dirfrag()) == 0 &&
+	dir->should_split(now)) {
       dout(1) << "hit_dir " << type << " pop is " << v << ", putting in split_queue: " << *dir << dendl;
       split_queue.insert(dir->dirfrag());
     }
 
     // merge?
-    if (dir->get_frag() != frag_t() &&
-	(dir->get_num_head_items() < (unsigned)g_conf->mds_bal_merge_size) &&
-	merge_queue.count(dir->dirfrag()) == 0) {
+    if (merge_queue.count(dir->dirfrag()) == 0 &&
+	dir->should_merge(now)) {
       dout(1) << "hit_dir " << type << " pop is " << v << ", putting in merge_queue: " << *dir << dendl;
       merge_queue.insert(dir->dirfrag());
     }
@@ -1130,6 +1200,7 @@ void MDBalancer::subtract_export(CDir *dir, utime_t now)
 void MDBalancer::add_import(CDir *dir, utime_t now)
 {
   dirfrag_load_vec_t subload = dir->pop_auth_subtree;
+  recent_imports[dir->dirfrag()] = beat_epoch;
 
   while (true) {
     dir = dir->inode->get_parent_dir();
@@ -1150,6 +1221,25 @@ void MDBalancer::show_imports(bool external)
   mds->mdcache->show_subtrees();
 }
 
+void MDBalancer::dump_subtree_load(ostream& out)
+{
+  utime_t now = ceph_clock_now(g_ceph_context);
+  set<CDir*> subtrees;
+  mds->mdcache->get_auth_subtrees(subtrees);
+  for (set<CDir*>::iterator p = subtrees.begin(); p != subtrees.end(); ++p) {
+    CDir *dir = *p;
+    string path;
+    dir->get_inode()->make_path_string(path);
+    out << dir->dirfrag() << " " << (path.empty() ? "/" : path)
+	<< " load " << dir->pop_auth_subtree.meta_load(now, mds->mdcache->decayrate)
+	<< " nested " << dir->pop_auth_subtree_nested.meta_load(now, mds->mdcache->decayrate)
+	<< " cost " << export_cost(dir);
+    if (recently_imported(dir))
+      out << " (recently imported)";
+    out << "\n";
+  }
+}
+
 
 void MDBalancer::dump_pop_map()
 {
@@ -64,6 +64,15 @@ class MDBalancer {
   map<int32_t, int> old_prev_targets;  // # iterations they _haven't_ been targets
   bool check_targets();
 
+  // migration cost model
+  map<dirfrag_t, int> recent_imports;  // dirfrag -> beat_epoch we imported it
+  double export_budget;                // cost we may still export this epoch, < 0 for no limit
+
+  double export_cost(CDir *dir);
+  bool recently_imported(CDir *dir);
+  bool take_export(CDir *dir, double pop, list<CDir*>& exports, double& have,
+		   set<CDir*>& already_exporting);
+
   double try_match(int ex, double& maxex,
                    int im, double& maxim);
   double get_maxim(int im) {
@@ -77,7 +86,8 @@ public:
   MDBalancer(MDS *m) : 
     mds(m),
     beat_epoch(0),
-    last_epoch_under(0), last_epoch_over(0) { }
+    last_epoch_under(0), last_epoch_over(0),
+    export_budget(-1) { }
   
   mds_load_t get_load(utime_t);
 
@@ -108,6 +118,8 @@ public:
   void subtract_export(class CDir *ex, utime_t now);
   void add_import(class CDir *im, utime_t now);
 
+  void dump_subtree_load(ostream& out);
+
   void hit_inode(utime_t now, class CInode *in, int type, int who=-1);
   void hit_dir(utime_t now, class CDir *dir, int type, int who=-1, double amount=1.0);
   void hit_recursive(utime_t now, class CDir *dir, int type, double amount, double rd_adj);
@@ -84,6 +84,7 @@
 
 #include "InoTable.h"
 
+#include "common/Formatter.h"
 #include "common/Timer.h"
 
 #include <errno.h>
@@ -121,6 +122,7 @@ long g_num_dns = 0;
 long g_num_caps = 0;
 
 set<int> SimpleLock::empty_gather_set;
+map<int,int> MDSCacheObject::empty_replica_map;
 
 
 MDCache::MDCache(MDS *m)
@@ -141,6 +143,7 @@ MDCache::MDCache(MDS *m)
   max_dir_commit_size = g_conf->mds_dir_max_commit_size ?
                         (g_conf->mds_dir_max_commit_size << 20) :
                         (0.9 *(g_conf->osd_max_write_size << 20));
+  use_omap = g_conf->mds_use_omap;
 
   discover_last_tid = 0;
   find_ino_peer_last_tid = 0;
@@ -158,6 +161,11 @@ MDCache::MDCache(MDS *m)
   decayrate.set_halflife(g_conf->mds_decay_halflife);
 
   did_shutdown_log_cap = false;
+
+  purges_in_flight = 0;
+  purge_window_ops = 0;
+  purge_timer = NULL;
+  purge_advancing = false;
 }
 
 MDCache::~MDCache() 
@@ -1956,6 +1964,15 @@ void MDCache::predirty_journal_parents(Mutation *mut, EMetaBlob *blob,
       stop = true;
     }
 
+    // nothing but rstat changed?  then the dirfrag can carry the delta
+    // until the nestlock is nudged (or someone stats the dir), instead of
+    // every writer projecting and journaling the whole ancestry.
+    if (!stop && !do_parent_mtime && !linkunlink &&
+	g_conf->mds_rstat_lazy) {
+      dout(10) << "predirty_journal_parents rstat only, leaving it in " << *parent << dendl;
+      stop = true;
+    }
+
     // delay propagating until later?
     if (!stop && !first &&
 	g_conf->mds_dirstat_min_interval > 0) {
@@ -5946,7 +5963,7 @@ void MDCache::handle_cache_expire(MCacheExpire *m)
       if (nonce == dir->get_replica_nonce(from)) {
 	// remove from our cached_by
 	dout(7) << " dir expire on " << *dir << " from mds." << from
-		<< " replicas was " << dir->replica_map << dendl;
+		<< " replicas was " << dir->get_replicas() << dendl;
 	dir->remove_replica(from);
       } 
       else {
@@ -6983,7 +7000,45 @@ public:
   C_MDC_RetryOpenRemoteIno(MDCache *mdc, inodeno_t i, Context *c) :
     mdcache(mdc), ino(i), onfinish(c) {}
   void finish(int r) {
-    mdcache->open_remote_ino(ino, onfinish);
+    if (r < 0) {
+      onfinish->finish(r);
+      delete onfinish;
+    } else
+      mdcache->open_remote_ino(ino, onfinish);
+  }
+};
+
+class C_MDC_OpenRemoteInoBacktrace : public Context {
+  MDCache *mdcache;
+  inodeno_t ino;
+  inodeno_t hadino;
+  version_t hadv;
+  Context *onfinish;
+public:
+  bufferlist bl;
+
+  C_MDC_OpenRemoteInoBacktrace(MDCache *mdc, inodeno_t i, inodeno_t hi, version_t hv, Context *c) :
+    mdcache(mdc), ino(i), hadino(hi), hadv(hv), onfinish(c) {}
+  void finish(int r) {
+    if (r < 0)
+      bl.clear();  // no backtrace; try the anchor table
+    mdcache->_open_remote_ino_backtrace(ino, bl, hadino, hadv, onfinish);
+  }
+};
+
+class C_MDC_OpenRemoteInoBt : public Context {
+  MDCache *mdcache;
+  inodeno_t ino;
+  inode_backtrace_t bt;
+  inodeno_t hadino;
+  version_t hadv;
+  Context *onfinish;
+public:
+  C_MDC_OpenRemoteInoBt(MDCache *mdc, inodeno_t i, inode_backtrace_t& b,
+			inodeno_t hi, version_t hv, Context *c) :
+    mdcache(mdc), ino(i), bt(b), hadino(hi), hadv(hv), onfinish(c) {}
+  void finish(int r) {
+    mdcache->open_remote_ino_bt(ino, bt, hadino, hadv, onfinish);
   }
 };
 
@@ -7004,7 +7059,10 @@ public:
 
   void finish(int r) {
     assert(r == 0);
-    if (r == 0)
+    if (r == 0 && anchortrace.empty()) {
+      onfinish->finish(-ENOENT);  // not anchored either
+      delete onfinish;
+    } else if (r == 0)
       mdcache->open_remote_ino_2(ino, anchortrace, hadino, hadv, onfinish);
     else {
       onfinish->finish(r);
@@ -7013,9 +7071,139 @@ public:
   }
 };
 
+/*
+ * Find an inode by number.  Its backtrace (the "parent" xattr on its
+ * first object in the metadata pool) names the dentries that lead to
+ * it, so we open the deepest ancestor we have and walk down.  Inodes
+ * from before backtraces were kept for files are still in the anchor
+ * table.
+ */
 void MDCache::open_remote_ino(inodeno_t ino, Context *onfinish, inodeno_t hadino, version_t hadv)
 {
   dout(7) << "open_remote_ino on " << ino << dendl;
+
+  object_t oid = CInode::get_object_name(ino, frag_t(), "");
+  object_locator_t oloc(mds->mdsmap->get_metadata_pg_pool());
+  C_MDC_OpenRemoteInoBacktrace *c = new C_MDC_OpenRemoteInoBacktrace(this, ino, hadino, hadv, onfinish);
+  mds->objecter->getxattr(oid, oloc, "parent", CEPH_NOSNAP, &c->bl, 0, c);
+}
+
+void MDCache::_open_remote_ino_backtrace(inodeno_t ino, bufferlist& bl,
+					 inodeno_t hadino, version_t hadv, Context *onfinish)
+{
+  inode_backtrace_t bt;
+  if (bl.length()) {
+    try {
+      bufferlist::iterator p = bl.begin();
+      ::decode(bt, p);
+    } catch (buffer::error& e) {
+      dout(0) << "open_remote_ino " << ino << " corrupt backtrace: " << e.what() << dendl;
+      bt.ancestors.clear();
+    }
+  }
+  if (bt.ino != ino || bt.ancestors.empty()) {
+    dout(10) << "open_remote_ino " << ino << " has no backtrace, asking the anchortable" << dendl;
+    open_remote_ino_anchor(ino, onfinish);
+    return;
+  }
+  open_remote_ino_bt(ino, bt, hadino, hadv, onfinish);
+}
+
+void MDCache::open_remote_ino_bt(inodeno_t ino, inode_backtrace_t& bt,
+				 inodeno_t hadino, version_t hadv, Context *onfinish)
+{
+  dout(7) << "open_remote_ino_bt on " << ino << ", backtrace " << bt << dendl;
+
+  if (get_inode(ino)) {
+    dout(10) << "open_remote_ino_bt have " << *get_inode(ino) << dendl;
+    onfinish->finish(0);
+    delete onfinish;
+    return;
+  }
+
+  // find the deepest cached ancestor
+  unsigned i;
+  CInode *in = 0;
+  for (i = 0; i < bt.ancestors.size(); i++) {
+    in = get_inode(bt.ancestors[i].dirino);
+    if (in)
+      break;
+  }
+  if (!in) {
+    inodeno_t top = bt.ancestors.back().dirino;
+    if (MDS_INO_IS_MDSDIR(top)) {
+      dout(10) << "open_remote_ino_bt opening foreign mdsdir " << top << dendl;
+      open_foreign_mdsdir(top, new C_MDC_RetryOpenRemoteIno(this, ino, onfinish));
+    } else {
+      dout(0) << "open_remote_ino_bt don't have base inode " << top << dendl;
+      onfinish->finish(-ENOENT);
+      delete onfinish;
+    }
+    return;
+  }
+
+  inodeno_t want = i ? bt.ancestors[i-1].dirino : ino;
+  const string& dname = bt.ancestors[i].dname;
+  dout(10) << "deepest cached ancestor is " << *in << ", want " << dname << " -> " << want << dendl;
+
+  if (!in->is_dir()) {
+    dout(0) << "open_remote_ino_bt ancestor " << *in << " is not a dir" << dendl;
+    onfinish->finish(-ENOENT);
+    delete onfinish;
+    return;
+  }
+
+  frag_t frag = in->pick_dirfrag(dname);
+  CDir *dir = in->get_dirfrag(frag);
+
+  if (!dir && !in->is_auth()) {
+    dout(10) << "opening remote dirfrag " << frag << " under " << *in << dendl;
+    open_remote_dirfrag(in, frag,
+			new C_MDC_OpenRemoteInoBt(this, ino, bt, hadino, hadv, onfinish));
+    return;
+  }
+
+  if (!dir && in->is_auth()) {
+    if (in->is_frozen_dir()) {
+      dout(7) << "traverse: " << *in << " is frozen_dir, waiting" << dendl;
+      in->parent->dir->add_waiter(CDir::WAIT_UNFREEZE,
+				  new C_MDC_OpenRemoteInoBt(this, ino, bt, hadino, hadv, onfinish));
+      return;
+    }
+    dir = in->get_or_open_dirfrag(this, frag);
+  }
+  assert(dir);
+
+  if (dir->is_auth()) {
+    if (!dir->is_complete()) {
+      dout(10) << "need " << dname << ", fetching incomplete dir " << *dir << dendl;
+      dir->fetch(new C_MDC_OpenRemoteInoBt(this, ino, bt, hadino, hadv, onfinish));
+    } else if (want != ino) {
+      // an intermediate dir moved since the backtrace was written; find
+      // it by its own backtrace, then come back.
+      dout(10) << "expected dir " << want << " in complete dir " << *dir
+	       << ", looking it up" << dendl;
+      open_remote_ino(want, new C_MDC_RetryOpenRemoteIno(this, ino, onfinish));
+    } else if (hadv && hadino == bt.ancestors[0].dirino && hadv == bt.ancestors[0].version) {
+      dout(10) << "expected ino " << ino << " in complete dir " << *dir
+	       << ", got the same backtrace 2x in a row, asking the anchortable" << dendl;
+      open_remote_ino_anchor(ino, onfinish);
+    } else {
+      // the backtrace is written lazily; re-read it.
+      dout(10) << "expected ino " << ino << " in complete dir " << *dir
+	       << ", rereading backtrace" << dendl;
+      open_remote_ino(ino, onfinish, bt.ancestors[0].dirino, bt.ancestors[0].version);
+    }
+  } else {
+    dout(10) << "have remote dirfrag " << *dir << ", discovering " << want << dendl;
+    discover_ino(dir, want,
+		 new C_MDC_OpenRemoteInoBt(this, ino, bt, hadino, hadv, onfinish));
+  }
+}
+
+void MDCache::open_remote_ino_anchor(inodeno_t ino, Context *onfinish, inodeno_t hadino, version_t hadv)
+{
+  dout(7) << "open_remote_ino_anchor on " << ino << dendl;
   
   C_MDC_OpenRemoteIno *c = new C_MDC_OpenRemoteIno(this, ino, hadino, hadv, onfinish);
   mds->anchorclient->lookup(ino, c->anchortrace, c);
@@ -7067,7 +7255,7 @@ void MDCache::open_remote_ino_2(inodeno_t ino,
 
   if (!in->dirfragtree.contains(frag)) {
     dout(10) << "frag " << frag << " not valid, requerying anchortable" << dendl;
-    open_remote_ino(ino, onfinish);
+    open_remote_ino_anchor(ino, onfinish);
     return;
   }
 
@@ -7106,7 +7294,7 @@ void MDCache::open_remote_ino_2(inodeno_t ino,
 		 << " in complete dir " << *dir
 		 << ", requerying anchortable"
 		 << dendl;
-	open_remote_ino(ino, onfinish, anchortrace[i].ino, anchortrace[i].updated);
+	open_remote_ino_anchor(ino, onfinish, anchortrace[i].ino, anchortrace[i].updated);
       }
     } else {
       dout(10) << "need ino " << anchortrace[i].ino
@@ -7585,69 +7773,6 @@ public:
   }
 };
 
-void MDCache::anchor_create_prep_locks(MDRequest *mdr, CInode *in,
-				       set<SimpleLock*>& rdlocks, set<SimpleLock*>& xlocks)
-{
-  dout(10) << "anchor_create_prep_locks " << *in << dendl;
-
-  if (in->is_anchored()) {
-    // caller may have already xlocked it.. if so, that will suffice!
-    if (xlocks.count(&in->linklock) == 0)
-      rdlocks.insert(&in->linklock);
-  } else {
-    xlocks.insert(&in->linklock);
-
-    // path components too!
-    CDentry *dn = in->get_projected_parent_dn();
-    while (dn) {
-      rdlocks.insert(&dn->lock);
-      dn = dn->get_dir()->get_inode()->get_parent_dn();
-    }
-  }
-}
-
-void MDCache::anchor_create(MDRequest *mdr, CInode *in, Context *onfinish)
-{
-  assert(in->is_auth());
-  dout(10) << "anchor_create " << *in << dendl;
-
-  // auth pin
-  if (!in->can_auth_pin() &&
-      !mdr->is_auth_pinned(in)) {
-    dout(7) << "anchor_create not authpinnable, waiting on " << *in << dendl;
-    in->add_waiter(CInode::WAIT_UNFREEZE, onfinish);
-    return;
-  }
-
-  // wait
-  in->add_waiter(CInode::WAIT_ANCHORED, onfinish);
-
-  // already anchoring?
-  if (in->state_test(CInode::STATE_ANCHORING)) {
-    dout(7) << "anchor_create already anchoring " << *in << dendl;
-    return;
-  }
-
-  dout(7) << "anchor_create " << *in << dendl;
-
-  // auth: do it
-  in->state_set(CInode::STATE_ANCHORING);
-  in->get(CInode::PIN_ANCHORING);
-  in->auth_pin(this);
-  
-  // make trace
-  vector<Anchor> trace;
-  in->make_anchor_trace(trace);
-  if (!trace.size()) {
-    assert(MDS_INO_IS_BASE(in->ino()));
-    trace.push_back(Anchor(in->ino(), in->ino(), 0, 0, 0));
-  }
-  
-  // do it
-  C_MDC_AnchorPrepared *fin = new C_MDC_AnchorPrepared(this, in, true);
-  mds->anchorclient->prepare_create(in->ino(), trace, &fin->atid, fin);
-}
-
 void MDCache::anchor_destroy(CInode *in, Context *onfinish)
 {
   assert(in->is_auth());
@@ -7779,11 +7904,6 @@ void MDCache::snaprealm_create(MDRequest *mdr, CInode *in)
   dout(10) << "snaprealm_create " << *in << dendl;
   assert(!in->snaprealm);
 
-  if (!in->inode.anchored) {
-    mds->mdcache->anchor_create(mdr, in, new C_MDS_RetryRequest(mds->mdcache, mdr));
-    return;
-  }
-
   // allocate an id..
   if (!mdr->more()->stid) {
     mds->snapclient->prepare_create_realm(in->ino(), &mdr->more()->stid, &mdr->more()->snapidbl,
@@ -8083,11 +8203,92 @@ void MDCache::purge_stray(CDentry *dn)
   dn->get(CDentry::PIN_PURGING);
   in->state_set(CInode::STATE_PURGING);
 
-  
   // CHEAT.  there's no real need to journal our intent to purge, since
   // that is implicit in the dentry's presence and non-use in the stray
   // dir.  on recovery, we'll need to re-eval all strays anyway.
-  
+  purge_queue.push_back(dn);
+  dout(10) << "purge_stray queued, " << purge_queue.size() << " waiting, "
+	   << purges_in_flight << " in flight" << dendl;
+  _advance_purge_queue();
+}
+
+class C_MDC_AdvancePurgeQueue : public Context {
+  MDCache *cache;
+public:
+  C_MDC_AdvancePurgeQueue(MDCache *c) : cache(c) {}
+  void finish(int r) {
+    cache->purge_timer = NULL;
+    cache->_advance_purge_queue();
+  }
+};
+
+/// object removals purging this stray will take
+uint64_t MDCache::_purge_stray_ops(CInode *in)
+{
+  uint64_t ops = in->inode.last_renamed_version ? 1 : 0;  // the backtrace
+  if (in->is_file()) {
+    uint64_t period = in->inode.layout.fl_object_size * in->inode.layout.fl_stripe_count;
+    uint64_t to = MAX(in->inode.size, in->inode.get_max_size());
+    if (to && period)
+      ops += (to + period - 1) / period;
+  }
+  return ops;
+}
+
+/*
+ * start queued purges, up to mds_max_purge_files at once and, if
+ * mds_max_purge_ops_per_sec is set, no more object removals per second
+ * than that.  a single stray bigger than a whole second's worth still
+ * goes, alone, so that it can't get stuck.
+ */
+void MDCache::_advance_purge_queue()
+{
+  if (purge_advancing)
+    return;  // a purge finished synchronously under us; the loop below continues
+  purge_advancing = true;
+
+  int max_files = MAX(g_conf->mds_max_purge_files, 1);
+  uint64_t max_ops = g_conf->mds_max_purge_ops_per_sec > 0 ? g_conf->mds_max_purge_ops_per_sec : 0;
+  utime_t now = ceph_clock_now(g_ceph_context);
+
+  while (!purge_queue.empty() && purges_in_flight < max_files) {
+    CDentry *dn = purge_queue.front();
+    uint64_t ops = _purge_stray_ops(dn->get_projected_linkage()->get_inode());
+
+    if (max_ops) {
+      if (now - purge_window_start >= utime_t(1, 0)) {
+	purge_window_start = now;
+	purge_window_ops = 0;
+      }
+      if (purge_window_ops && purge_window_ops + ops > max_ops) {
+	if (!purge_timer) {
+	  utime_t wait = purge_window_start;
+	  wait += 1.0;
+	  wait -= now;
+	  dout(10) << "_advance_purge_queue " << purge_window_ops << " ops this second, waiting "
+		   << wait << dendl;
+	  purge_timer = new C_MDC_AdvancePurgeQueue(this);
+	  mds->timer.add_event_after((double)wait, purge_timer);
+	}
+	break;
+      }
+      purge_window_ops += ops;
+    }
+
+    purge_queue.pop_front();
+    purges_in_flight++;
+    _purge_stray_start(dn);
+  }
+
+  purge_advancing = false;
+}
+
+void MDCache::_purge_stray_start(CDentry *dn)
+{
+  CDentry::linkage_t *dnl = dn->get_projected_linkage();
+  CInode *in = dnl->get_inode();
+  dout(10) << "_purge_stray_start " << *dn << " " << *in << dendl;
+
   SnapRealm *realm = in->find_snaprealm();
   SnapContext nullsnap;
   const SnapContext *snapc;
@@ -8103,7 +8304,12 @@ void MDCache::purge_stray(CDentry *dn)
   if (in->is_dir()) {
     dout(10) << "purge_stray dir ... implement me!" << dendl;  // FIXME XXX
     _purge_stray_purged(dn);
-  } else if (in->is_file()) {
+    return;
+  }
+
+  C_GatherBuilder gather(g_ceph_context, new C_MDC_PurgeStrayPurged(this, dn));
+
+  if (in->is_file()) {
     uint64_t period = in->inode.layout.fl_object_size * in->inode.layout.fl_stripe_count;
     uint64_t cur_max_size = in->inode.get_max_size();
     uint64_t to = MAX(in->inode.size, cur_max_size);
@@ -8112,15 +8318,26 @@ void MDCache::purge_stray(CDentry *dn)
       dout(10) << "purge_stray 0~" << to << " objects 0~" << num << " snapc " << snapc << " on " << *in << dendl;
       mds->filer->purge_range(in->inode.ino, &in->inode.layout, *snapc,
 			      0, num, ceph_clock_now(g_ceph_context), 0,
-			      new C_MDC_PurgeStrayPurged(this, dn));
+			      gather.new_sub());
     } else {
       dout(10) << "purge_stray 0 objects snapc " << snapc << " on " << *in << dendl;
-      _purge_stray_purged(dn);
     }
-  } else {
-    // not a dir or file; purged!
-    _purge_stray_purged(dn);
   }
+
+  // and the backtrace, from the metadata pool.  snapped dentries are
+  // gone by now, so nothing needs to find it any more.
+  if (in->inode.last_renamed_version) {
+    object_t oid = CInode::get_object_name(in->ino(), frag_t(), "");
+    object_locator_t oloc(mds->mdsmap->get_metadata_pg_pool());
+    dout(10) << "purge_stray removing backtrace " << oid << dendl;
+    mds->objecter->remove(oid, oloc, nullsnap, ceph_clock_now(g_ceph_context), 0,
+			  NULL, gather.new_sub());
+  }
+
+  if (gather.has_subs())
+    gather.activate();
+  else
+    _purge_stray_purged(dn);
 }
 
 class C_MDC_PurgeStrayLogged : public Context {
@@ -8153,6 +8370,11 @@ void MDCache::_purge_stray_purged(CDentry *dn, int r)
   CInode *in = dn->get_projected_linkage()->get_inode();
   dout(10) << "_purge_stray_purged " << *dn << " " << *in << dendl;
 
+  // the objects are gone; let the next one start
+  assert(purges_in_flight > 0);
+  purges_in_flight--;
+  _advance_purge_queue();
+
   if (in->get_num_ref() == (int)in->is_dirty() &&
       dn->get_num_ref() == (int)dn->is_dirty() + !!in->get_num_ref() + 1/*PIN_PURGING*/) {
     // kill dentry.
@@ -9621,8 +9843,8 @@ void MDCache::merge_dir(CInode *diri, frag_t frag)
   if (!can_fragment(diri, dirs))
     return;
   if (!can_fragment_lock(diri)) {
-    //dout(10) << " requeuing dir " << dir->dirfrag() << dendl;
-    //mds->mdbalancer->split_queue.insert(dir->dirfrag());
+    dout(10) << " requeuing dir " << dirs.front()->dirfrag() << dendl;
+    mds->balancer->queue_merge(dirs.front());
     return;
   }
 
@@ -9839,8 +10061,8 @@ void MDCache::fragment_logged_and_stored(Mutation *mut, list<CDir*>& resultfrags
 
   // tell peers
   CDir *first = *resultfrags.begin();
-  for (map<int,int>::iterator p = first->replica_map.begin();
-       p != first->replica_map.end();
+  for (map<int,int>::iterator p = first->replicas_begin();
+       p != first->replicas_end();
        p++) {
     if (mds->mdsmap->get_state(p->first) <= MDSMap::STATE_REJOIN)
       continue;
@@ -10169,6 +10391,24 @@ void MDCache::dump_cache(const char *fn)
 }
 
 
+void MDCache::dump_cache(ceph::Formatter *f)
+{
+  f->open_object_section("mds_cache");
+  f->dump_int("inodes", inode_map.size());
+  f->dump_int("inodes_with_caps", num_inodes_with_caps);
+  f->dump_int("subtrees", subtrees.size());
+  f->dump_int("active_requests", active_requests.size());
+  f->open_object_section("lru");
+  f->dump_unsigned("dentries", lru.lru_get_size());
+  f->dump_unsigned("max", lru.lru_get_max());
+  f->dump_unsigned("top", lru.lru_get_top());
+  f->dump_unsigned("bot", lru.lru_get_bot());
+  f->dump_unsigned("pintail", lru.lru_get_pintail());
+  f->dump_unsigned("pinned", lru.lru_get_num_pinned());
+  f->close_section();
+  f->close_section();
+}
+
 
 C_MDS_RetryRequest::C_MDS_RetryRequest(MDCache *c, MDRequest *r)
   : cache(c), mdr(r)
@@ -29,6 +29,10 @@
 #include "messages/MClientRequest.h"
 #include "messages/MMDSSlaveRequest.h"
 
+namespace ceph {
+  class Formatter;
+}
+
 class PerfCounters;
 
 class MDS;
@@ -105,6 +109,7 @@ public:
   int num_caps;
 
   unsigned max_dir_commit_size;
+  bool use_omap;   // dentries live in dirfrag object maps (mds_use_omap)
 
   ceph_file_layout default_file_layout;
   ceph_file_layout default_log_layout;
@@ -699,6 +704,11 @@ public:
   void open_remote_dirfrag(CInode *diri, frag_t fg, Context *fin);
   CInode *get_dentry_inode(CDentry *dn, MDRequest *mdr, bool projected=false);
   void open_remote_ino(inodeno_t ino, Context *fin, inodeno_t hadino=0, version_t hadv=0);
+  void _open_remote_ino_backtrace(inodeno_t ino, bufferlist& bl,
+				  inodeno_t hadino, version_t hadv, Context *onfinish);
+  void open_remote_ino_bt(inodeno_t ino, inode_backtrace_t& bt,
+			  inodeno_t hadino, version_t hadv, Context *onfinish);
+  void open_remote_ino_anchor(inodeno_t ino, Context *fin, inodeno_t hadino=0, version_t hadv=0);
   void open_remote_ino_2(inodeno_t ino,
                          vector<Anchor>& anchortrace,
 			 inodeno_t hadino, version_t hadv,
@@ -744,10 +754,9 @@ public:
   void _find_ino_dir(inodeno_t ino, Context *c, bufferlist& bl, int r);
 
   // -- anchors --
+  // only legacy (pre-backtrace) anchors are left to destroy; nothing
+  // creates them anymore.
 public:
-  void anchor_create_prep_locks(MDRequest *mdr, CInode *in, set<SimpleLock*>& rdlocks,
-				set<SimpleLock*>& xlocks);
-  void anchor_create(MDRequest *mdr, CInode *in, Context *onfinish);
   void anchor_destroy(CInode *in, Context *onfinish);
 protected:
   void _anchor_prepared(CInode *in, version_t atid, bool add);
@@ -776,7 +785,24 @@ public:
       eval_stray(dn);
   }
 protected:
+  /*
+   * strays waiting to be purged, oldest first.  each is pinned and
+   * marked PURGING, so eval_stray leaves it alone; the stray dentry
+   * itself is what persists the work (scan_stray_dir finds it again
+   * after a restart).
+   */
+  list<CDentry*> purge_queue;
+  int purges_in_flight;
+  utime_t purge_window_start;
+  uint64_t purge_window_ops;   // object removals started since purge_window_start
+  Context *purge_timer;
+  bool purge_advancing;
+
   void purge_stray(CDentry *dn);
+  void _advance_purge_queue();
+  uint64_t _purge_stray_ops(CInode *in);
+  void _purge_stray_start(CDentry *dn);
+  friend class C_MDC_AdvancePurgeQueue;
   void _purge_stray_purged(CDentry *dn, int r=0);
   void _purge_stray_logged(CDentry *dn, version_t pdv, LogSegment *ls);
   void _purge_stray_logged_truncate(CDentry *dn, LogSegment *ls);
@@ -891,6 +917,7 @@ private:
  public:
   void show_cache();
   void dump_cache(const char *fn=0);
+  void dump_cache(ceph::Formatter *f);
   void show_subtrees(int dbl=10);
 
   CInode *hack_pick_random_inode() {
@@ -281,6 +281,7 @@ void MDLog::trim(int m)
 {
   int max_segments = g_conf->mds_log_max_segments;
   int max_events = g_conf->mds_log_max_events;
+  uint64_t max_bytes = g_conf->mds_log_max_replay_bytes;
   if (m >= 0)
     max_events = m;
 
@@ -304,7 +305,10 @@ void MDLog::trim(int m)
 	 ((max_events >= 0 &&
 	   num_events - expiring_events - expired_events > max_events) ||
 	  (max_segments >= 0 &&
-	   segments.size() - expiring_segments.size() - expired_segments.size() > (unsigned)max_segments))) {
+	   segments.size() - expiring_segments.size() - expired_segments.size() > (unsigned)max_segments) ||
+	  (max_bytes > 0 &&                 // bound what a takeover has to replay
+	   p->second != get_current_segment() &&
+	   journaler->get_write_pos() - p->first > max_bytes))) {
     
     if (stop < ceph_clock_now(g_ceph_context))
       break;
@@ -521,56 +525,71 @@ void MDLog::_replay_thread()
     
     assert(journaler->is_readable());
     
-    // read it
-    uint64_t pos = journaler->get_read_pos();
-    bufferlist bl;
-    bool r = journaler->try_read_entry(bl);
-    if (!r && journaler->get_error())
+    // read whatever has already been prefetched, up to a batch
+    vector<replay_entry_t> batch;
+    while ((batch.empty() ||
+	    batch.size() < (unsigned)g_conf->mds_replay_batch_events) &&
+	   journaler->is_readable()) {
+      batch.push_back(replay_entry_t(journaler->get_read_pos()));
+      if (!journaler->try_read_entry(batch.back().bl)) {
+	assert(journaler->get_error());
+	batch.pop_back();
+	break;
+      }
+      batch.back().end = journaler->get_read_pos();
+    }
+    if (batch.empty())
       continue;
-    assert(r);
     
-    // unpack event
-    LogEvent *le = LogEvent::decode(bl);
-    if (!le) {
-      dout(0) << "_replay " << pos << "~" << bl.length() << " / " << journaler->get_write_pos() 
-	      << " -- unable to decode event" << dendl;
-      dout(0) << "dump of unknown or corrupt event:\n";
-      bl.hexdump(*_dout);
-      *_dout << dendl;
-
-      assert(!!"corrupt log event" == g_conf->mds_log_skip_corrupt_events);
-      continue;
-    }
-    le->set_start_off(pos);
+    // unpack events.  decoding needs nothing from the cache, so let
+    // requests and other events go while we do it; the journaler keeps
+    // prefetching meanwhile.
+    mds->mds_lock.Unlock();
+    for (vector<replay_entry_t>::iterator p = batch.begin(); p != batch.end(); ++p)
+      p->le = LogEvent::decode(p->bl);
+    mds->mds_lock.Lock();
 
-    // new segment?
-    if (le->get_type() == EVENT_SUBTREEMAP ||
-	le->get_type() == EVENT_RESETJOURNAL) {
-      segments[pos] = new LogSegment(pos);
-      logger->set(l_mdl_seg, segments.size());
-    }
+    for (vector<replay_entry_t>::iterator p = batch.begin(); p != batch.end(); ++p) {
+      uint64_t pos = p->pos;
+      bufferlist& bl = p->bl;
+      LogEvent *le = p->le;
+      if (!le) {
+	dout(0) << "_replay " << pos << "~" << bl.length() << " / " << journaler->get_write_pos() 
+		<< " -- unable to decode event" << dendl;
+	dout(0) << "dump of unknown or corrupt event:\n";
+	bl.hexdump(*_dout);
+	*_dout << dendl;
+
+	assert(!!"corrupt log event" == g_conf->mds_log_skip_corrupt_events);
+	continue;
+      }
+      le->set_start_off(pos);
 
-    // have we seen an import map yet?
-    if (segments.empty()) {
-      dout(10) << "_replay " << pos << "~" << bl.length() << " / " << journaler->get_write_pos() 
-	       << " " << le->get_stamp() << " -- waiting for subtree_map.  (skipping " << *le << ")" << dendl;
-    } else {
-      dout(10) << "_replay " << pos << "~" << bl.length() << " / " << journaler->get_write_pos() 
-	       << " " << le->get_stamp() << ": " << *le << dendl;
-      le->_segment = get_current_segment();    // replay may need this
-      le->_segment->num_events++;
-      le->_segment->end = journaler->get_read_pos();
-      num_events++;
-
-      le->replay(mds);
-    }
-    delete le;
+      // new segment?
+      if (le->get_type() == EVENT_SUBTREEMAP ||
+	  le->get_type() == EVENT_RESETJOURNAL) {
+	segments[pos] = new LogSegment(pos);
+	logger->set(l_mdl_seg, segments.size());
+      }
 
-    logger->set(l_mdl_rdpos, pos);
+      // have we seen an import map yet?
+      if (segments.empty()) {
+	dout(10) << "_replay " << pos << "~" << bl.length() << " / " << journaler->get_write_pos() 
+		 << " " << le->get_stamp() << " -- waiting for subtree_map.  (skipping " << *le << ")" << dendl;
+      } else {
+	dout(10) << "_replay " << pos << "~" << bl.length() << " / " << journaler->get_write_pos() 
+		 << " " << le->get_stamp() << ": " << *le << dendl;
+	le->_segment = get_current_segment();    // replay may need this
+	le->_segment->num_events++;
+	le->_segment->end = p->end;
+	num_events++;
+
+	le->replay(mds);
+      }
+      delete le;
 
-    // drop lock for a second, so other events/messages (e.g. beacon timer!) can go off
-    mds->mds_lock.Unlock();
-    mds->mds_lock.Lock();
+      logger->set(l_mdl_rdpos, pos);
+    }
   }
 
   // done!
@@ -78,6 +78,13 @@ protected:
   // -- replay --
   Cond replay_cond;
 
+  struct replay_entry_t {
+    uint64_t pos, end;
+    bufferlist bl;
+    LogEvent *le;
+    replay_entry_t(uint64_t p) : pos(p), end(0), le(0) {}
+  };
+
   class ReplayThread : public Thread {
     MDLog *log;
   public:
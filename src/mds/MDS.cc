@@ -14,11 +14,14 @@
 
 
 
+#include <unistd.h>
+
 #include "include/types.h"
 #include "common/entity_name.h"
 #include "common/Clock.h"
 #include "common/signal.h"
 #include "common/ceph_argparse.h"
+#include "common/Formatter.h"
 
 #include "msg/Messenger.h"
 #include "mon/MonClient.h"
@@ -103,6 +106,7 @@ MDS::MDS(const std::string &n, Messenger *m, MonClient *mc) :
   messenger(m),
   monc(mc),
   clog(m->cct, messenger, &mc->monmap, mc, LogClient::NO_FLAGS),
+  admin_command(this), admin_command_registered(false),
   sessionmap(this) {
 
   orig_argc = 0;
@@ -156,6 +160,8 @@ MDS::MDS(const std::string &n, Messenger *m, MonClient *mc) :
 MDS::~MDS() {
   Mutex::Locker lock(mds_lock);
 
+  unregister_admin_command();
+
   delete authorize_handler_registry;
 
   if (mdcache) { delete mdcache; mdcache = NULL; }
@@ -502,6 +508,10 @@ int MDS::init(int wanted_state)
 
   objecter->init();
 
+  admin_command_registered =
+    g_ceph_context->get_admin_socket()->register_command("dump_mds_cache",
+      "mds cache and lru sizes", &admin_command) == 0;
+
   monc->sub_want("mdsmap", 0, 0);
   monc->renew_subs();
 
@@ -729,6 +739,11 @@ void MDS::handle_command(MMonCommand *m)
     else
       mdcache->dump_cache();
   }
+  else if (m->cmd[0] == "subtree_load") {
+    stringstream ss;
+    balancer->dump_subtree_load(ss);
+    clog.info() << "subtree load:\n" << ss.str();
+  }
   else if (m->cmd[0] == "exit") {
     suicide();
   }
@@ -1550,9 +1565,37 @@ void MDS::stopping_done()
 
   
 
+void MDS::AdminCommand::dump_command(const std::string &command,
+				     ceph::Formatter *f)
+{
+  // suicide() holds mds_lock while it unregisters us
+  while (!mds->mds_lock.TryLock()) {
+    if (stopping.read()) {
+      f->open_object_section("mds_cache");
+      f->dump_string("error", "shutting down");
+      f->close_section();
+      return;
+    }
+    usleep(1000);
+  }
+  mds->mdcache->dump_cache(f);
+  mds->mds_lock.Unlock();
+}
+
+void MDS::unregister_admin_command()
+{
+  if (!admin_command_registered)
+    return;
+  admin_command.stopping.set(1);
+  g_ceph_context->get_admin_socket()->unregister_command("dump_mds_cache");
+  admin_command_registered = false;
+}
+
 void MDS::suicide()
 {
   assert(mds_lock.is_locked());
+  unregister_admin_command();
+
   if (want_state == MDSMap::STATE_STOPPED)
     state = want_state;
   else
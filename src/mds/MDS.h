@@ -23,6 +23,7 @@
 #include "include/CompatSet.h"
 #include "include/types.h"
 #include "include/Context.h"
+#include "common/admin_socket.h"
 #include "common/DecayCounter.h"
 #include "common/perf_counters.h"
 #include "common/Mutex.h"
@@ -163,6 +164,17 @@ class MDS : public Dispatcher {
   Filer        *filer;       // for reading/writing to/from osds
   LogClient    clog;
 
+  /// dump_mds_cache, for the admin socket
+  class AdminCommand : public AdminSocketCommand {
+    MDS *mds;
+  public:
+    atomic_t stopping;
+    AdminCommand(MDS *m) : mds(m) {}
+    void dump_command(const std::string &command, ceph::Formatter *f);
+  } admin_command;
+  bool admin_command_registered;
+  void unregister_admin_command();
+
   // sub systems
   Server       *server;
   MDCache      *mdcache;
@@ -560,25 +560,135 @@ void Migrator::export_dir_nicely(CDir *dir, int dest)
 
 void Migrator::maybe_do_queued_export()
 {
-  while (!export_queue.empty() &&
-	 export_state.size() <= 4) {
-    dirfrag_t df = export_queue.front().first;
-    int dest = export_queue.front().second;
-    export_queue.pop_front();
+  if (export_queue_running)
+    return;
+  export_queue_running = true;
+
+  list< pair<dirfrag_t,int> >::iterator p = export_queue.begin();
+  while (p != export_queue.end() &&
+	 (int)export_state.size() < g_conf->mds_export_max_concurrent) {
+    dirfrag_t df = p->first;
+    int dest = p->second;
     
     CDir *dir = mds->mdcache->get_dirfrag(df);
-    if (!dir) continue;
+    if (dir && dir->is_auth() && export_split.count(df) &&
+	export_pieces_in_flight(dir)) {
+      ++p;   // wait for its pieces to get there first
+      continue;
+    }
+    export_queue.erase(p++);
+
+    if (!dir) {
+      export_split.erase(df);
+      continue;
+    }
     if (!dir->is_auth()) continue;
 
     dout(0) << "nicely exporting to mds." << dest << " " << *dir << dendl;
 
     export_dir(dir, dest);
   }
+
+  export_queue_running = false;
+}
+
+bool Migrator::export_pieces_in_flight(CDir *dir)
+{
+  for (map<CDir*,int>::iterator p = export_state.begin(); p != export_state.end(); ++p)
+    if (p->first != dir && dir->contains(p->first))
+      return true;
+  return false;
 }
 
 
 
 
+/*
+ * count the cached dentries an export of dir would carry, giving up
+ * once we pass max.
+ */
+int Migrator::count_export_items(CDir *dir, int max)
+{
+  int n = 0;
+  list<CDir*> q;
+  q.push_back(dir);
+  while (!q.empty() && n <= max) {
+    CDir *d = q.front();
+    q.pop_front();
+    for (CDir::map_t::iterator p = d->begin(); p != d->end(); ++p) {
+      n++;
+      CDentry::linkage_t *dnl = p->second->get_linkage();
+      if (!dnl->is_primary() || !dnl->get_inode()->is_dir())
+	continue;
+      list<CDir*> ls;
+      dnl->get_inode()->get_dirfrags(ls);
+      for (list<CDir*>::iterator q2 = ls.begin(); q2 != ls.end(); ++q2)
+	if (!(*q2)->is_subtree_root())
+	  q.push_back(*q2);
+    }
+  }
+  return n;
+}
+
+/*
+ * The whole subtree stays frozen from export_frozen until the importer
+ * acks, and most of that time goes to encoding, sending and decoding
+ * it, so a big export stalls clients for a long time.  Instead, queue
+ * the big subdirs as exports of their own (they get split in turn),
+ * followed by whatever is left of dir.  Each piece freezes only itself
+ * and the pieces overlap in the queue, bounded by
+ * mds_export_max_concurrent; the rest of dir waits in the queue until
+ * they've gone.  Once everything has arrived the importer merges the
+ * pieces back into one subtree.
+ *
+ * returns true if dir was split and queued.
+ */
+bool Migrator::maybe_split_export(CDir *dir, int dest)
+{
+  int max = g_conf->mds_export_max_items;
+  if (max <= 0)
+    return false;
+  if (export_split.count(dir->dirfrag())) {
+    export_split.erase(dir->dirfrag());
+    return false;   // the rest of an export we already split
+  }
+  int n = count_export_items(dir, max);
+  if (n <= max)
+    return false;
+
+  list<CDir*> pieces;
+  for (CDir::map_t::iterator p = dir->begin(); p != dir->end(); ++p) {
+    CDentry::linkage_t *dnl = p->second->get_linkage();
+    if (!dnl->is_primary() || !dnl->get_inode()->is_dir())
+      continue;
+    list<CDir*> ls;
+    dnl->get_inode()->get_dirfrags(ls);
+    for (list<CDir*>::iterator q = ls.begin(); q != ls.end(); ++q) {
+      CDir *sub = *q;
+      if (!sub->is_auth() || sub->is_subtree_root() ||
+	  sub->is_frozen() || sub->is_freezing() ||
+	  sub->state_test(CDir::STATE_EXPORTING))
+	continue;
+      if (count_export_items(sub, max / 8) > max / 8)
+	pieces.push_back(sub);
+    }
+  }
+  if (pieces.empty()) {
+    dout(7) << "export of " << *dir << " is " << n << "+ items but has no big subdirs,"
+	    << " exporting it whole" << dendl;
+    return false;
+  }
+
+  dout(7) << "export of " << *dir << " is " << n << "+ items, splitting off "
+	  << pieces.size() << " subdirs first" << dendl;
+  for (list<CDir*>::iterator p = pieces.begin(); p != pieces.end(); ++p)
+    export_queue.push_back(pair<dirfrag_t,int>((*p)->dirfrag(), dest));
+  export_queue.push_back(pair<dirfrag_t,int>(dir->dirfrag(), dest));
+  export_split.insert(dir->dirfrag());
+  return true;
+}
+
+
 class C_MDC_ExportFreeze : public Context {
   Migrator *mig;
   CDir *ex;   // dir i'm exporting
@@ -654,6 +764,11 @@ void Migrator::export_dir(CDir *dir, int dest)
     dout(7) << "already exporting" << dendl;
     return;
   }
+
+  if (maybe_split_export(dir, dest)) {
+    maybe_do_queued_export();
+    return;
+  }
   
   // locks?
   set<SimpleLock*> locks;
@@ -90,6 +90,13 @@ protected:
   map<CDir*,list<Context*> >   export_finish_waiters;
   
   list< pair<dirfrag_t,int> >  export_queue;
+  set<dirfrag_t>               export_split;  // already split into pieces; export the rest whole
+
+  bool export_queue_running;
+
+  int count_export_items(CDir *dir, int max);
+  bool maybe_split_export(CDir *dir, int dest);
+  bool export_pieces_in_flight(CDir *dir);
 
   // -- imports --
 public:
@@ -124,7 +131,7 @@ protected:
 
 public:
   // -- cons --
-  Migrator(MDS *m, MDCache *c) : mds(m), cache(c) {}
+  Migrator(MDS *m, MDCache *c) : mds(m), cache(c), export_queue_running(false) {}
 
   void dispatch(Message*);
 
@@ -193,6 +200,7 @@ public:
   void maybe_do_queued_export();
   void clear_export_queue() {
     export_queue.clear();
+    export_split.clear();
   }
   
   void get_export_lock_set(CDir *dir, set<SimpleLock*>& locks);
@@ -194,8 +194,6 @@ struct MDRequest : public Mutation {
     
     // for rename
     set<int> extra_witnesses; // replica list from srcdn auth (rename)
-    version_t src_reanchor_atid;  // src->dst
-    version_t dst_reanchor_atid;  // dst->stray
     bufferlist inode_import;
     version_t inode_import_v;
     CInode* destdn_was_remote_inode;
@@ -208,6 +206,9 @@ struct MDRequest : public Mutation {
     // for lock/flock
     bool flock_was_waiting;
 
+    // for getattr: already flushed lazy rstats once
+    bool flushed_rstat;
+
     // for snaps
     version_t stid;
     bufferlist snapidbl;
@@ -217,9 +218,10 @@ struct MDRequest : public Mutation {
     bufferlist rollback_bl;
 
     More() : 
-      src_reanchor_atid(0), dst_reanchor_atid(0), inode_import_v(0),
+      inode_import_v(0),
       destdn_was_remote_inode(0), was_link_merge(false),
       flock_was_waiting(false),
+      flushed_rstat(false),
       stid(0),
       slave_commit(0) { }
   } *_more;
@@ -191,8 +191,19 @@ void Server::handle_client_session(MClientSession *m)
     sseq = mds->sessionmap.set_state(session, Session::STATE_OPENING);
     mds->sessionmap.touch_session(session);
     pv = ++mds->sessionmap.projected;
-    mdlog->start_submit_entry(new ESession(m->get_source_inst(), true, pv),
-			      new C_MDS_session_finish(mds, session, sseq, true, pv));
+    {
+      // preallocate inos with the open, so that even the first creates
+      // on the session can take one and get an early reply.
+      interval_set<inodeno_t> inos;
+      version_t piv = 0;
+      if (g_conf->mds_client_prealloc_inos > 0) {
+	mds->inotable->project_alloc_ids(inos, g_conf->mds_client_prealloc_inos);
+	session->pending_prealloc_inos.insert(inos);
+	piv = mds->inotable->get_projected_version();
+      }
+      mdlog->start_submit_entry(new ESession(m->get_source_inst(), true, pv, inos, piv),
+				new C_MDS_session_finish(mds, session, sseq, true, pv, inos, piv));
+    }
     mdlog->flush();
     break;
 
@@ -255,6 +266,15 @@ void Server::_session_logged(Session *session, uint64_t state_seq, bool open, ve
   dout(10) << "_session_logged " << session->inst << " state_seq " << state_seq << " " << (open ? "open":"close")
 	   << " " << pv << dendl;
 
+  if (open && piv) {
+    // the inos were allocated whatever has become of the session since;
+    // a close journals their release along with the rest.
+    mds->inotable->apply_alloc_ids(inos);
+    assert(mds->inotable->get_version() == piv);
+    session->pending_prealloc_inos.subtract(inos);
+    session->prealloc_inos.insert(inos);
+  }
+
   // apply
   if (session->get_state_seq() != state_seq) {
     dout(10) << " journaled state_seq " << state_seq << " != current " << session->get_state_seq()
@@ -673,17 +693,17 @@ void Server::recover_filelocks(CInode *in, bufferlist locks, int64_t client)
   for (int i = 0; i < numlocks; ++i) {
     ::decode(lock, p);
     lock.client = client;
-    in->fcntl_locks.held_locks.insert(pair<uint64_t, ceph_filelock>
-				      (lock.start, lock));
-    ++in->fcntl_locks.client_held_lock_counts[client];
+    in->get_fcntl_lock_state()->held_locks.insert(pair<uint64_t, ceph_filelock>
+						  (lock.start, lock));
+    ++in->get_fcntl_lock_state()->client_held_lock_counts[client];
   }
   ::decode(numlocks, p);
   for (int i = 0; i < numlocks; ++i) {
     ::decode(lock, p);
     lock.client = client;
-    in->flock_locks.held_locks.insert(pair<uint64_t, ceph_filelock>
-				      (lock.start, lock));
-    ++in->flock_locks.client_held_lock_counts[client];
+    in->get_flock_lock_state()->held_locks.insert(pair<uint64_t, ceph_filelock>
+						  (lock.start, lock));
+    ++in->get_flock_lock_state()->client_held_lock_counts[client];
   }
 }
 
@@ -696,6 +716,7 @@ void Server::recall_client_state(float ratio)
 	   << ", caps per client " << min_caps_per_client << "-" << max_caps_per_client
 	   << dendl;
 
+  utime_t now = ceph_clock_now(g_ceph_context);
   set<Session*> sessions;
   mds->sessionmap.get_client_session_set(sessions);
   for (set<Session*>::const_iterator p = sessions.begin();
@@ -711,13 +732,45 @@ void Server::recall_client_state(float ratio)
 	     << ", leases " << session->leases.size()
 	     << dendl;
 
-    if (session->caps.size() > min_caps_per_client) {	
-      int newlim = (int)(session->caps.size() * ratio);
+    int num_caps = session->caps.size();
+    if (session->recall_target >= 0) {
+      if (num_caps <= session->recall_target) {
+	session->recall_target = -1;   // done with the last one
+	session->recall_warned = false;
+      } else if (now - session->last_recall < g_conf->mds_recall_state_timeout) {
+	// still working through the last one; asking again only makes
+	// it start over.
+	dout(10) << " still recalling to " << session->recall_target << " since "
+		 << session->last_recall << dendl;
+	continue;
+      } else if (!session->recall_warned) {
+	mds->clog.warn() << "client." << session->get_client()
+	  << " failing to respond to cache pressure: has " << num_caps
+	  << " caps, asked for " << session->recall_target
+	  << " at " << session->last_recall << "\n";
+	session->recall_warned = true;
+      }
+    }
+
+    if (num_caps > min_caps_per_client) {	
+      int newlim = (int)(num_caps * ratio);
       if (newlim > max_caps_per_client)
 	newlim = max_caps_per_client;
+      // recall in bounded steps, so a client holding millions of caps
+      // gets pressure it can act on within the timeout
+      if (g_conf->mds_recall_state_max_caps > 0 &&
+	  num_caps - newlim > g_conf->mds_recall_state_max_caps)
+	newlim = num_caps - g_conf->mds_recall_state_max_caps;
+      if (newlim < min_caps_per_client)
+	newlim = min_caps_per_client;
+      if (newlim >= num_caps)
+	continue;
+      dout(10) << " recalling to " << newlim << " caps" << dendl;
       MClientSession *m = new MClientSession(CEPH_SESSION_RECALL_STATE);
       m->head.max_caps = newlim;
       mds->send_message_client(m, session);
+      session->recall_target = newlim;
+      session->last_recall = now;
     }
   }
  
@@ -1703,8 +1756,10 @@ CInode* Server::prepare_new_inode(MDRequest *mdr, CDir *dir, inodeno_t useino, u
     //assert(0); // just for now.
   }
     
+  // top up the session's inos in batches, so most creates don't touch
+  // the inotable at all; the session open preallocated the first batch.
   int got = g_conf->mds_client_prealloc_inos - mdr->session->get_num_projected_prealloc_inos();
-  if (got > 0) {
+  if (got > 0 && got >= g_conf->mds_client_prealloc_inos / 2) {
     mds->inotable->project_alloc_ids(mdr->prealloc_inos, got);
     assert(mdr->prealloc_inos.size());  // or else fix projected increment semantics
     mdr->session->pending_prealloc_inos.insert(mdr->prealloc_inos);
@@ -1873,7 +1928,7 @@ CInode* Server::rdlock_path_pin_ref(MDRequest *mdr, int n,
   if (r > 0) return false; // delayed
   if (r < 0) {  // error
     if (r == -ENOENT && n == 0 && mdr->dn[n].size()) {
-      reply_request(mdr, r, NULL, mdr->dn[n][mdr->dn[n].size()-1]);
+      reply_request(mdr, new_lookup_reply(mdr, r), NULL, mdr->dn[n][mdr->dn[n].size()-1]);
     } else if (r == -ESTALE) {
       dout(10) << "FAIL on ESTALE but attempting recovery" << dendl;
       Context *c = new C_MDS_TryFindInode(this, mdr);
@@ -2092,6 +2147,17 @@ void Server::handle_client_stat(MDRequest *mdr)
   CInode *ref = rdlock_path_pin_ref(mdr, 0, rdlocks, false);
   if (!ref) return;
 
+  // lazy rstats may still sit in our dirfrags; fold them in first so
+  // that rbytes and friends are current.  only once per request, so a
+  // busy dir doesn't starve us.
+  if (ref->is_dir() && ref->is_auth() && ref->nestlock.is_dirty() &&
+      g_conf->mds_rstat_lazy && !mdr->more()->flushed_rstat) {
+    dout(10) << "handle_client_stat flushing dirty rstat on " << *ref << dendl;
+    mdr->more()->flushed_rstat = true;
+    mds->locker->scatter_nudge(&ref->nestlock, new C_MDS_RetryRequest(mdcache, mdr));
+    return;
+  }
+
   /*
    * if client currently holds the EXCL cap on a field, do not rdlock
    * it; client's stat() will result in valid info if _either_ EXCL
@@ -2121,10 +2187,48 @@ void Server::handle_client_stat(MDRequest *mdr)
 
   // reply
   dout(10) << "reply to stat on " << *req << dendl;
-  reply_request(mdr, 0, ref,
+  reply_request(mdr, new_lookup_reply(mdr, 0), ref,
 		req->get_op() == CEPH_MDS_OP_LOOKUP ? mdr->dn[0].back() : 0);
 }
 
+/*
+ * a client walking a path it doesn't have cached asks for all of it at
+ * once; give it every dentry and inode we traversed on the way to the
+ * one in the trace, so it needn't come back for each of them.
+ */
+MClientReply *Server::new_lookup_reply(MDRequest *mdr, int r)
+{
+  MClientRequest *req = mdr->client_request;
+  MClientReply *reply = new MClientReply(req, r);
+  if (req->get_op() != CEPH_MDS_OP_LOOKUP ||
+      !(req->get_flags() & CEPH_MDS_FLAG_WANT_TRACE) ||
+      mdr->dn[0].size() < 2)
+    return reply;
+
+  Session *session = mdr->session;
+  client_t client = session->get_client();
+  utime_t now = ceph_clock_now(g_ceph_context);
+
+  bufferlist items;
+  __u32 n = 0;
+  for (unsigned i = 0; i + 1 < mdr->dn[0].size(); i++) {
+    CDentry *dn = mdr->dn[0][i];
+    CInode *in = dn->get_linkage()->get_inode();
+    if (!in)
+      break;
+    ::encode(dn->get_name(), items);
+    mds->locker->issue_client_lease(dn, client, items, now, session);
+    in->encode_inodestat(items, session, NULL, mdr->snapid);
+    n++;
+  }
+  dout(20) << "new_lookup_reply with " << n << " traversed dentries" << dendl;
+  bufferlist bl;
+  ::encode(n, bl);
+  bl.claim_append(items);
+  reply->set_extra_bl(bl);
+  return reply;
+}
+
 /* This function will clean up the passed mdr*/
 void Server::handle_client_lookup_parent(MDRequest *mdr)
 {
@@ -2339,8 +2443,8 @@ void Server::_lookup_ino_2(MDRequest *mdr, int r)
     return;
   }
 
-  // okay fine, maybe it's a directory though...
-  mdcache->find_ino_dir(ino, new C_MDS_LookupIno3(this, mdr));
+  // okay fine, follow its backtrace
+  mdcache->open_remote_ino(ino, new C_MDS_LookupIno3(this, mdr));
 }
 
 void Server::_lookup_ino_3(MDRequest *mdr, int r)
@@ -2520,6 +2624,9 @@ public:
     newi->inode.version--;   // a bit hacky, see C_MDS_mknod_finish
     newi->mark_dirty(newi->inode.version+1, mdr->ls);
 
+    // so it can be found by ino
+    newi->mark_dirty_parent(mdr->ls);
+
     mdr->apply();
 
     mds->locker->share_inode_max_size(newi);
@@ -2614,6 +2721,7 @@ void Server::handle_client_openc(MDRequest *mdr)
   dn->push_projected_linkage(in);
 
   in->inode.version = dn->pre_dirty();
+  in->inode.last_renamed_version = in->inode.version;  // journal it dirty_parent
   if (cmode & CEPH_FILE_MODE_WR) {
     in->inode.client_ranges[client].range.first = 0;
     in->inode.client_ranges[client].range.last = in->inode.get_layout_size_increment();
@@ -2725,14 +2833,19 @@ void Server::handle_client_readdir(MDRequest *mdr)
   // build dir contents
   bufferlist dnbl;
 
+  // resume right after the last name the client got, rather than
+  // walking past everything before it: that made listing a big dir
+  // quadratic in the number of pages.
   CDir::map_t::iterator it = dir->begin(); 
+  if (offset)
+    it = dir->upper_bound(dentry_key_t(CEPH_NOSNAP, offset));
 
   unsigned max = req->head.args.readdir.max_entries;
   if (!max)
     max = dir->get_num_any();  // whatever, something big.
   unsigned max_bytes = req->head.args.readdir.max_bytes;
-  if (!max_bytes)
-    max_bytes = 512 << 10;  // 512 KB?
+  if (!max_bytes || max_bytes > (unsigned)g_conf->mds_readdir_max_bytes)
+    max_bytes = g_conf->mds_readdir_max_bytes;
 
   // start final blob
   bufferlist dirbl;
@@ -2765,9 +2878,6 @@ void Server::handle_client_readdir(MDRequest *mdr)
       continue;
     }
 
-    if (offset && strcmp(dn->get_name().c_str(), offset) <= 0)
-      continue;
-
     CInode *in = dnl->get_inode();
 
     if (in && in->ino() == CEPH_INO_CEPH)
@@ -2932,11 +3042,11 @@ void Server::handle_client_file_setlock(MDRequest *mdr)
   // get the appropriate lock state
   switch (req->head.args.filelock_change.rule) {
   case CEPH_LOCK_FLOCK:
-    lock_state = &cur->flock_locks;
+    lock_state = cur->get_flock_lock_state();
     break;
 
   case CEPH_LOCK_FCNTL:
-    lock_state = &cur->fcntl_locks;
+    lock_state = cur->get_fcntl_lock_state();
     break;
 
   default:
@@ -2985,6 +3095,7 @@ void Server::handle_client_file_setlock(MDRequest *mdr)
       reply_request(mdr, 0);
   }
   dout(10) << " state after lock change: " << *lock_state << dendl;
+  cur->try_clear_file_lock_state();
 }
 
 void Server::handle_client_file_readlock(MDRequest *mdr)
@@ -3018,11 +3129,11 @@ void Server::handle_client_file_readlock(MDRequest *mdr)
   ceph_lock_state_t *lock_state = NULL;
   switch (req->head.args.filelock_change.rule) {
   case CEPH_LOCK_FLOCK:
-    lock_state = &cur->flock_locks;
+    lock_state = cur->get_flock_lock_state();
     break;
 
   case CEPH_LOCK_FCNTL:
-    lock_state = &cur->fcntl_locks;
+    lock_state = cur->get_fcntl_lock_state();
     break;
 
   default:
@@ -3031,6 +3142,7 @@ void Server::handle_client_file_readlock(MDRequest *mdr)
     return;
   }
   lock_state->look_for_lock(checking_lock);
+  cur->try_clear_file_lock_state();
 
   bufferlist lock_bl;
   ::encode(checking_lock, lock_bl);
@@ -3506,6 +3618,9 @@ public:
       assert(dir);
       dir->mark_dirty(1, mdr->ls);
       dir->mark_new(mdr->ls);
+    } else {
+      // so it can be found by ino (dirs store theirs with the dirfrag)
+      newi->mark_dirty_parent(mdr->ls);
     }
 
     mdr->apply();
@@ -3571,6 +3686,7 @@ void Server::handle_client_mknod(MDRequest *mdr)
   if ((newi->inode.mode & S_IFMT) == 0)
     newi->inode.mode |= S_IFREG;
   newi->inode.version = dn->pre_dirty();
+  newi->inode.last_renamed_version = newi->inode.version;  // journal it dirty_parent
   newi->inode.rstat.rfiles = 1;
 
   // if the client created a _regular_ file via MKNOD, it's highly likely they'll
@@ -3728,6 +3844,7 @@ void Server::handle_client_symlink(MDRequest *mdr)
   newi->inode.rstat.rbytes = newi->inode.size;
   newi->inode.rstat.rfiles = 1;
   newi->inode.version = dn->pre_dirty();
+  newi->inode.last_renamed_version = newi->inode.version;  // journal it dirty_parent
 
   if (follows >= dn->first)
     dn->first = follows + 1;
@@ -3781,15 +3898,6 @@ void Server::handle_client_link(MDRequest *mdr)
   
   xlocks.insert(&targeti->linklock);
 
-  // take any locks needed for anchor creation/verification
-  // NOTE: we do this on the master even if the anchor/link update may happen
-  // on the slave.  That means we may have out of date anchor state on our
-  // end.  That's fine:  either, we xlock when we don't need to (slow but
-  // not a problem), or we rdlock when we need to xlock, but then discover we
-  // need to xlock and on our next pass through we adjust the locks (this works
-  // as long as the linklock rdlock isn't the very last lock we take).
-  mds->mdcache->anchor_create_prep_locks(mdr, targeti, rdlocks, xlocks);
-
   if (!mds->locker->acquire_locks(mdr, rdlocks, wrlocks, xlocks))
     return;
 
@@ -3797,19 +3905,8 @@ void Server::handle_client_link(MDRequest *mdr)
   if (mdr->now == utime_t())
     mdr->now = ceph_clock_now(g_ceph_context);
 
-  // does the target need an anchor?
-  if (targeti->is_auth()) {
-    if (targeti->is_anchored()) {
-      dout(7) << "target anchored already (nlink=" << targeti->inode.nlink << "), sweet" << dendl;
-    } 
-    else {
-      dout(7) << "target needs anchor, nlink=" << targeti->inode.nlink << ", creating anchor" << dendl;
-      
-      mdcache->anchor_create(mdr, targeti,
-			     new C_MDS_RetryRequest(mdcache, mdr));
-      return;
-    }
-  }
+  // no anchor: the target's auth writes its backtrace, so that the new
+  // remote dentry can find it by ino.
 
   // go!
   assert(g_conf->mds_kill_link_at != 1);
@@ -3856,6 +3953,7 @@ void Server::_link_local(MDRequest *mdr, CDentry *dn, CInode *targeti)
   pi->nlink++;
   pi->ctime = mdr->now;
   pi->version = tipv;
+  pi->last_renamed_version = tipv;
 
   snapid_t follows = dn->get_dir()->inode->find_snaprealm()->get_newest_seq();
   if (follows >= dn->first)
@@ -3888,6 +3986,9 @@ void Server::_link_local_finish(MDRequest *mdr, CDentry *dn, CInode *targeti,
   // target inode
   targeti->pop_and_dirty_projected_inode(mdr->ls);
 
+  // make sure the backtrace the remote dentry relies on is current
+  targeti->mark_dirty_parent(mdr->ls);
+
   mdr->apply();
   
   mds->mdcache->send_dentry_link(dn);
@@ -3974,9 +4075,6 @@ void Server::_link_remote(MDRequest *mdr, bool inc, CDentry *dn, CInode *targeti
     le->metablob.add_null_dentry(dn, true);
   }
 
-  if (mdr->more()->dst_reanchor_atid)
-    le->metablob.add_table_transaction(TABLE_ANCHOR, mdr->more()->dst_reanchor_atid);
-
   // mark committing (needed for proper recovery)
   mdr->committing = true;
 
@@ -4010,10 +4108,6 @@ void Server::_link_remote_finish(MDRequest *mdr, bool inc,
   else
     mds->mdcache->send_dentry_unlink(dn, NULL, NULL);
   
-  // commit anchor update?
-  if (mdr->more()->dst_reanchor_atid) 
-    mds->anchorclient->commit(mdr->more()->dst_reanchor_atid, mdr->ls);
-
   // bump target popularity
   mds->balancer->hit_inode(mdr->now, targeti, META_POP_IWR);
   mds->balancer->hit_dir(mdr->now, dn->get_dir(), META_POP_IWR);
@@ -4065,22 +4159,6 @@ void Server::handle_slave_link_prep(MDRequest *mdr)
 
   //assert(0);  // test hack: make sure master can handle a slave that fails to prepare...
 
-  // anchor?
-  if (mdr->slave_request->get_op() == MMDSSlaveRequest::OP_LINKPREP) {
-    
-    // NOTE: the master took any locks needed for anchor creation/verification.
-
-    if (targeti->is_anchored()) {
-      dout(7) << "target anchored already (nlink=" << targeti->inode.nlink << "), sweet" << dendl;
-    } 
-    else {
-      dout(7) << "target needs anchor, nlink=" << targeti->inode.nlink << ", creating anchor" << dendl;
-      mdcache->anchor_create(mdr, targeti,
-			     new C_MDS_RetryRequest(mdcache, mdr));
-      return;
-    }
-  }
-
   assert(g_conf->mds_kill_link_at != 5);
 
   // journal it
@@ -4114,6 +4192,8 @@ void Server::handle_slave_link_prep(MDRequest *mdr)
 
   pi->ctime = mdr->now;
   pi->version = targeti->pre_dirty();
+  if (inc)
+    pi->last_renamed_version = pi->version;
 
   dout(10) << " projected inode " << pi << " v " << pi->version << dendl;
 
@@ -4145,7 +4225,10 @@ void Server::_logged_slave_link(MDRequest *mdr, CInode *targeti)
   assert(g_conf->mds_kill_link_at != 6);
 
   // update the target
+  bool inc = targeti->get_projected_inode()->nlink > targeti->inode.nlink;
   targeti->pop_and_dirty_projected_inode(mdr->ls);
+  if (inc)
+    targeti->mark_dirty_parent(mdr->ls);  // for the master's new remote dentry
   mdr->apply();
 
   // hit pop
@@ -4423,18 +4506,6 @@ void Server::handle_client_unlink(MDRequest *mdr)
     rdlocks.insert(&in->filelock);   // to verify it's empty
   mds->locker->include_snap_rdlocks(rdlocks, dnl->get_inode());
 
-  // if we unlink a snapped multiversion inode and are creating a
-  // remote link to it, it must be anchored.  this mirrors the logic
-  // in MDCache::journal_cow_dentry().
-  bool need_snap_dentry = 
-    dnl->is_primary() &&
-    in->is_multiversion() &&
-    in->find_snaprealm()->get_newest_seq() + 1 > dn->first;
-  if (need_snap_dentry) {
-    dout(10) << " i need to be anchored because i am multiversion and will get a remote cow dentry" << dendl;
-    mds->mdcache->anchor_create_prep_locks(mdr, in, rdlocks, xlocks);
-  }
-
   if (!mds->locker->acquire_locks(mdr, rdlocks, wrlocks, xlocks))
     return;
 
@@ -4448,26 +4519,6 @@ void Server::handle_client_unlink(MDRequest *mdr)
   if (mdr->now == utime_t())
     mdr->now = ceph_clock_now(g_ceph_context);
 
-  // NOTE: this is non-optimal.  we create an anchor at the old
-  // location, and then change it.  we can do better, but it's more
-  // complicated.  this is fine for now.
-  if (need_snap_dentry && !in->is_anchored()) {
-    mdcache->anchor_create(mdr, in, new C_MDS_RetryRequest(mdcache, mdr));
-    return;
-  }
-
-  // get stray dn ready?
-  if (dnl->is_primary()) {
-    if (!mdr->more()->dst_reanchor_atid && in->is_anchored()) {
-      dout(10) << "reanchoring to stray " << *dnl->get_inode() << dendl;
-      vector<Anchor> trace;
-      straydn->make_anchor_trace(trace, dnl->get_inode());
-      mds->anchorclient->prepare_update(dnl->get_inode()->ino(), trace, &mdr->more()->dst_reanchor_atid, 
-					new C_MDS_RetryRequest(mdcache, mdr));
-      return;
-    }
-  }
-
   if (in->is_dir() && in->has_subtree_root_dirfrag()) {
     // subtree root auths need to be witnesses
     set<int> witnesses;
@@ -4567,6 +4618,7 @@ void Server::_unlink_local(MDRequest *mdr, CDentry *dn, CDentry *straydn)
     // project snaprealm, too
     in->project_past_snaprealm_parent(straydn->get_dir()->inode->find_snaprealm());
 
+    pi->last_renamed_version = pi->version;
     le->metablob.add_primary_dentry(straydn, true, in);
   } else {
     // remote link.  update remote inode.
@@ -4583,9 +4635,6 @@ void Server::_unlink_local(MDRequest *mdr, CDentry *dn, CDentry *straydn)
     le->metablob.renamed_dirino = in->ino();
   }
 
-  if (mdr->more()->dst_reanchor_atid)
-    le->metablob.add_table_transaction(TABLE_ANCHOR, mdr->more()->dst_reanchor_atid);
-
   dn->push_projected_linkage();
 
   if (in->is_dir())
@@ -4619,6 +4668,13 @@ void Server::_unlink_local_finish(MDRequest *mdr,
   dn->mark_dirty(dnpv, mdr->ls);
   mdr->apply();
 
+  // remote links or snapshots still find it by ino, now in the stray dir
+  if (straydn) {
+    CInode *in = straydnl->get_inode();
+    if (in->inode.nlink > 0 || in->is_multiversion() || in->is_anchored())
+      in->mark_dirty_parent(mdr->ls);
+  }
+
   if (snap_is_new) //only new if straydnl exists
     mdcache->do_realm_invalidate_and_update_notify(straydnl->get_inode(), CEPH_SNAP_OP_SPLIT, true);
   
@@ -4628,10 +4684,6 @@ void Server::_unlink_local_finish(MDRequest *mdr,
   if (straydn && straydnl->get_inode()->is_dir()) 
     mdcache->adjust_subtree_after_rename(straydnl->get_inode(), dn->get_dir(), true);
 
-  // commit anchor update?
-  if (mdr->more()->dst_reanchor_atid) 
-    mds->anchorclient->commit(mdr->more()->dst_reanchor_atid, mdr->ls);
-
   // bump pop
   mds->balancer->hit_dir(mdr->now, dn->get_dir(), META_POP_IWR);
 
@@ -5219,9 +5271,6 @@ void Server::handle_client_rename(MDRequest *mdr)
   else
     rdlocks.insert(&srci->snaplock);
 
-  // take any locks needed for anchor creation/verification
-  mds->mdcache->anchor_create_prep_locks(mdr, srci, rdlocks, xlocks);
-
   if (!mds->locker->acquire_locks(mdr, rdlocks, wrlocks, xlocks, &remote_wrlocks))
     return;
 
@@ -5305,44 +5354,10 @@ void Server::handle_client_rename(MDRequest *mdr)
   if (!mdr->more()->slaves.empty() && srci->is_dir())
     assert(g_conf->mds_kill_rename_at != 3);    
   
-  // -- prepare anchor updates -- 
-  if (!linkmerge || srcdnl->is_primary()) {
-    C_GatherBuilder anchorgather(g_ceph_context);
-
-    if (srcdnl->is_primary() &&
-	(srcdnl->get_inode()->is_anchored() || 
-	 (srcdnl->get_inode()->is_dir() && (srcdnl->get_inode()->inode.rstat.ranchors ||
-					    srcdnl->get_inode()->nested_anchors ||
-					    !mdcache->is_leaf_subtree(mdcache->get_projected_subtree_root(srcdn->get_dir()))))) &&
-	!mdr->more()->src_reanchor_atid) {
-      dout(10) << "reanchoring src->dst " << *srcdnl->get_inode() << dendl;
-      vector<Anchor> trace;
-      destdn->make_anchor_trace(trace, srcdnl->get_inode());
-      mds->anchorclient->prepare_update(srcdnl->get_inode()->ino(),
-					trace, &mdr->more()->src_reanchor_atid,
-					anchorgather.new_sub());
-    }
-    if (destdnl->is_primary() &&
-	destdnl->get_inode()->is_anchored() &&
-	!mdr->more()->dst_reanchor_atid) {
-      dout(10) << "reanchoring dst->stray " << *destdnl->get_inode() << dendl;
-
-      assert(straydn);
-      vector<Anchor> trace;
-      straydn->make_anchor_trace(trace, destdnl->get_inode());
-      
-      mds->anchorclient->prepare_update(destdnl->get_inode()->ino(), trace,
-		  &mdr->more()->dst_reanchor_atid, anchorgather.new_sub());
-    }
-
-    if (anchorgather.has_subs())  {
-      anchorgather.set_finisher(new C_MDS_RetryRequest(mdcache, mdr));
-      anchorgather.activate();
-      return;  // waiting for anchor prepares
-    }
-
+  // no anchor updates: _rename_apply marks the backtraces of whatever
+  // moved, and they are written when the segment expires.
+  if (!linkmerge || srcdnl->is_primary())
     assert(g_conf->mds_kill_rename_at != 4);
-  }
 
   // -- prepare journal entry --
   mdr->ls = mdlog->get_current_segment();
@@ -5381,11 +5396,6 @@ void Server::_rename_finish(MDRequest *mdr, CDentry *srcdn, CDentry *destdn, CDe
   if (!mdr->more()->slaves.empty() && destdnl->get_inode()->is_dir())
     assert(g_conf->mds_kill_rename_at != 6);
   
-  // commit anchor updates?
-  if (mdr->more()->src_reanchor_atid) 
-    mds->anchorclient->commit(mdr->more()->src_reanchor_atid, mdr->ls);
-  if (mdr->more()->dst_reanchor_atid) 
-    mds->anchorclient->commit(mdr->more()->dst_reanchor_atid, mdr->ls);
 
   // bump popularity
   mds->balancer->hit_dir(mdr->now, srcdn->get_dir(), META_POP_IWR);
@@ -5538,6 +5548,7 @@ void Server::_rename_prepare(MDRequest *mdr,
       if (destdn->is_auth()) {
 	tpi = oldin->project_inode(); //project_snaprealm
 	tpi->version = straydn->pre_dirty(tpi->version);
+	tpi->last_renamed_version = tpi->version;
       }
       if (straydn->is_auth())
 	straydn->push_projected_linkage(oldin);
@@ -5735,12 +5746,6 @@ void Server::_rename_prepare(MDRequest *mdr,
     }
   }
 
-  // anchor updates?
-  if (mdr->more()->src_reanchor_atid)
-    metablob->add_table_transaction(TABLE_ANCHOR, mdr->more()->src_reanchor_atid);
-  if (mdr->more()->dst_reanchor_atid)
-    metablob->add_table_transaction(TABLE_ANCHOR, mdr->more()->dst_reanchor_atid);
-
   if (srci->is_dir())
     mdcache->project_subtree_rename(srci, srcdn->get_dir(), destdn->get_dir());
 }
@@ -5782,6 +5787,9 @@ void Server::_rename_apply(MDRequest *mdr, CDentry *srcdn, CDentry *destdn, CDen
 	oldin->pop_and_dirty_projected_inode(mdr->ls);
 	if (oldin->snaprealm && !hadrealm)
 	  mdcache->do_realm_invalidate_and_update_notify(oldin, CEPH_SNAP_OP_SPLIT);
+	// remote links or snapshots find it in the stray dir now
+	if (oldin->inode.nlink > 0 || oldin->is_multiversion() || oldin->is_anchored())
+	  oldin->mark_dirty_parent(mdr->ls);
       } else {
 	// FIXME this snaprealm is not filled out correctly
 	//oldin->open_snaprealm();  might be sufficient..	
@@ -5856,16 +5864,8 @@ void Server::_rename_apply(MDRequest *mdr, CDentry *srcdn, CDentry *destdn, CDen
     if (destdn->is_auth()) {
       in->pop_and_dirty_projected_inode(mdr->ls);
 
-      if (in->is_dir()) {
-	mdr->ls->renamed_files.push_back(&in->item_renamed_file);
-	if (!in->state_test(CInode::STATE_DIRTYPARENT)) {
-	  in->state_set(CInode::STATE_DIRTYPARENT);
-	  in->get(CInode::PIN_DIRTYPARENT);
-	  dout(10) << "added dir to logsegment renamed_files list " << *in << dendl;
-	} else {
-	  dout(10) << "re-added dir to logsegment renamed_files list " << *in << dendl;
-	}
-      }
+      // lookup-by-ino follows the backtrace; rewrite it when we expire
+      in->mark_dirty_parent(mdr->ls);
     } else {
       // FIXME: fix up snaprealm!
     }
@@ -6576,9 +6576,6 @@ void Server::handle_client_mksnap(MDRequest *mdr)
   rdlocks.erase(&diri->snaplock);
   xlocks.insert(&diri->snaplock);
 
-  // we need to anchor... get these locks up front!
-  mds->mdcache->anchor_create_prep_locks(mdr, diri, rdlocks, xlocks);
-
   if (!mds->locker->acquire_locks(mdr, rdlocks, wrlocks, xlocks))
     return;
 
@@ -6597,11 +6594,8 @@ void Server::handle_client_mksnap(MDRequest *mdr)
   if (mdr->now == utime_t())
     mdr->now = ceph_clock_now(g_ceph_context);
 
-  // anchor
-  if (!diri->is_anchored()) {
-    mdcache->anchor_create(mdr, diri, new C_MDS_RetryRequest(mdcache, mdr));
-    return;
-  }
+  // no anchor: the dir's backtrace is kept up to date with its first
+  // dirfrag, and that is how past snap parents are found by ino.
 
   // allocate a snapid
   if (!mdr->more()->stid) {
@@ -136,6 +136,7 @@ public:
 
   // requests on existing inodes.
   void handle_client_stat(MDRequest *mdr);
+  MClientReply *new_lookup_reply(MDRequest *mdr, int r);
   void handle_client_lookup_parent(MDRequest *mdr);
   void handle_client_lookup_hash(MDRequest *mdr);
   void _lookup_hash_2(MDRequest *mdr, int r);
@@ -16,6 +16,7 @@
 #include "MDCache.h"
 #include "SessionMap.h"
 #include "osdc/Filer.h"
+#include "osdc/Objecter.h"
 
 #include "common/config.h"
 
@@ -81,7 +82,60 @@ void SessionMap::_load_finish(int r, bufferlist &bl)
   dout(10) << "_load_finish v " << version 
 	   << ", " << session_map.size() << " sessions, "
 	   << bl.length() << " bytes"
+	   << (use_omap ? ", sessions in omap" : "")
 	   << dendl;
+  if (use_omap) {
+    _load_omap(string());
+    return;
+  }
+  if (g_conf->mds_use_omap)
+    use_omap = true;   // convert on the next save
+  _load_done();
+}
+
+class C_SM_LoadOmap : public Context {
+  SessionMap *sessionmap;
+public:
+  bufferlist bl;
+  C_SM_LoadOmap(SessionMap *cm) : sessionmap(cm) {}
+  void finish(int r) {
+    sessionmap->_load_omap_finish(r, bl);
+  }
+};
+
+void SessionMap::_load_omap(const string& after)
+{
+  dout(10) << "_load_omap after '" << after << "'" << dendl;
+  C_SM_LoadOmap *c = new C_SM_LoadOmap(this);
+  object_t oid = get_object_name();
+  object_locator_t oloc(mds->mdsmap->get_metadata_pg_pool());
+  ObjectOperation rd;
+  rd.omap_get_vals(after, g_conf->mds_sessionmap_keys_per_op);
+  mds->objecter->read(oid, oloc, rd, CEPH_NOSNAP, &c->bl, 0, c);
+}
+
+void SessionMap::_load_omap_finish(int r, bufferlist &bl)
+{
+  assert(r >= 0);
+  map<string, bufferlist> kv;
+  bufferlist::iterator blp = bl.begin();
+  ::decode(kv, blp);
+  for (map<string, bufferlist>::iterator p = kv.begin(); p != kv.end(); ++p) {
+    bufferlist::iterator q = p->second.begin();
+    Session *s = decode_session(q);
+    stored_crc[s->inst.name] = p->second.crc32c(0);
+  }
+  dout(10) << "_load_omap_finish got " << kv.size() << " sessions, now have "
+	   << session_map.size() << dendl;
+
+  if (kv.size() == (unsigned)g_conf->mds_sessionmap_keys_per_op)
+    _load_omap(kv.rbegin()->first);
+  else
+    _load_done();
+}
+
+void SessionMap::_load_done()
+{
   projected = committing = committed = version;
   dump();
   finish_contexts(g_ceph_context, waiting_for_load);
@@ -113,20 +167,79 @@ void SessionMap::save(Context *onsave, version_t needv)
 
   commit_waiters[version].push_back(onsave);
   
-  bufferlist bl;
-  
-  encode(bl);
   committing = version;
   SnapContext snapc;
   object_t oid = get_object_name();
   object_locator_t oloc(mds->mdsmap->get_metadata_pg_pool());
 
+  if (use_omap) {
+    ObjectOperation op;
+    _save_omap(op);
+    mds->objecter->mutate(oid, oloc, op, snapc, ceph_clock_now(g_ceph_context), 0,
+			  NULL, new C_SM_Save(this, version));
+    return;
+  }
+
+  bufferlist bl;
+  encode(bl);
   mds->objecter->write_full(oid, oloc,
 			    snapc,
 			    bl, ceph_clock_now(g_ceph_context), 0,
 			    NULL, new C_SM_Save(this, version));
 }
 
+static string get_session_key(const entity_name_t& n)
+{
+  ostringstream ss;
+  ss << n;
+  return ss.str();
+}
+
+/*
+ * write the header, the sessions whose encoding differs from what we
+ * last stored, and remove the keys of sessions we no longer store.
+ */
+void SessionMap::_save_omap(ObjectOperation& op)
+{
+  bufferlist header;
+  encode_header(header);
+  op.write_full(header);
+
+  map<string, bufferlist> to_set;
+  set<string> to_rm;
+  for (hash_map<entity_name_t,Session*>::iterator p = session_map.begin(); 
+       p != session_map.end(); 
+       ++p) {
+    if (!should_store(p->second))
+      continue;
+    bufferlist bl;
+    ::encode(p->first, bl);
+    p->second->encode(bl);
+    uint32_t crc = bl.crc32c(0);
+    hash_map<entity_name_t,uint32_t>::iterator q = stored_crc.find(p->first);
+    if (q != stored_crc.end() && q->second == crc)
+      continue;
+    stored_crc[p->first] = crc;
+    to_set[get_session_key(p->first)].claim(bl);
+  }
+  hash_map<entity_name_t,uint32_t>::iterator q = stored_crc.begin();
+  while (q != stored_crc.end()) {
+    hash_map<entity_name_t,Session*>::iterator p = session_map.find(q->first);
+    if (p == session_map.end() || !should_store(p->second)) {
+      to_rm.insert(get_session_key(q->first));
+      stored_crc.erase(q++);
+    } else
+      ++q;
+  }
+  dout(10) << "_save_omap v " << version << ": " << to_set.size() << " sessions changed, "
+	   << to_rm.size() << " removed" << dendl;
+
+  if (!to_set.empty())
+    op.omap_set(to_set);
+  if (!to_rm.empty())
+    op.omap_rm_keys(to_rm);
+}
+
 void SessionMap::_save_finish(version_t v)
 {
   dout(10) << "_save_finish v" << v << dendl;
@@ -152,15 +265,33 @@ void SessionMap::encode(bufferlist& bl)
   for (hash_map<entity_name_t,Session*>::iterator p = session_map.begin(); 
        p != session_map.end(); 
        ++p) 
-    if (p->second->is_open() ||
-	p->second->is_closing() ||
-	p->second->is_stale() ||
-	p->second->is_killing()) {
+    if (should_store(p->second)) {
       ::encode(p->first, bl);
       p->second->encode(bl);
     }
 }
 
+// v3: sessions are in the object map
+void SessionMap::encode_header(bufferlist& bl)
+{
+  uint64_t pre = -1;
+  ::encode(pre, bl);
+  __u8 struct_v = 3;
+  ::encode(struct_v, bl);
+  ::encode(version, bl);
+}
+
+Session *SessionMap::decode_session(bufferlist::iterator& p)
+{
+  entity_inst_t inst;
+  ::decode(inst.name, p);
+  Session *s = get_or_add_session(inst);
+  if (s->is_closed())
+    set_state(s, Session::STATE_OPEN);
+  s->decode(p);
+  return s;
+}
+
 void SessionMap::decode(bufferlist::iterator& p)
 {
   utime_t now = ceph_clock_now(g_ceph_context);
@@ -169,18 +300,14 @@ void SessionMap::decode(bufferlist::iterator& p)
   if (pre == (uint64_t)-1) {
     __u8 struct_v;
     ::decode(struct_v, p);
-    assert(struct_v == 2);
+    assert(struct_v == 2 || struct_v == 3);
 
     ::decode(version, p);
 
-    while (!p.end()) {
-      entity_inst_t inst;
-      ::decode(inst.name, p);
-      Session *s = get_or_add_session(inst);
-      if (s->is_closed())
-	set_state(s, Session::STATE_OPEN);
-      s->decode(p);
-    }
+    if (struct_v >= 3)
+      use_omap = true;
+    while (!p.end())
+      decode_session(p);
 
   } else {
     // --- old format ----
@@ -160,6 +160,11 @@ public:
   // -- leases --
   uint32_t lease_seq;
 
+  // -- cache pressure --
+  utime_t last_recall;     // when we last asked for caps back
+  int recall_target;       // cap count we asked the client to get down to, or -1
+  bool recall_warned;
+
   // -- completed requests --
 private:
   set<tid_t> completed_requests;
@@ -184,7 +189,8 @@ public:
     connection(NULL), item_session_list(this),
     requests(0),  // member_offset passed to front() manually
     cap_push_seq(0),
-    lease_seq(0) { }
+    lease_seq(0),
+    recall_target(-1), recall_warned(false) { }
   ~Session() {
     assert(!item_session_list.is_on_list());
   }
@@ -196,6 +202,8 @@ public:
 
     cap_push_seq = 0;
     last_cap_renew = utime_t();
+    recall_target = -1;
+    recall_warned = false;
 
     completed_requests.clear();
   }
@@ -226,6 +234,7 @@ WRITE_CLASS_ENCODER(Session)
  */
 
 class MDS;
+struct ObjectOperation;
 
 class SessionMap {
 private:
@@ -238,9 +247,16 @@ public:  // i am lazy
   version_t version, projected, committing, committed;
   map<version_t, list<Context*> > commit_waiters;
 
+private:
+  // with the object map format, the object data holds just the version
+  // and each session is its own omap key, written only when it changes.
+  bool use_omap;
+  hash_map<entity_name_t, uint32_t> stored_crc;  // crc of what's in each session's key
+
 public:
   SessionMap(MDS *m) : mds(m), 
-		       version(0), projected(0), committing(0), committed(0) 
+		       version(0), projected(0), committing(0), committed(0),
+		       use_omap(false)
   { }
     
   // sessions
@@ -388,8 +404,19 @@ public:
 
   void load(Context *onload);
   void _load_finish(int r, bufferlist &bl);
+  void _load_omap(const string& after);
+  void _load_omap_finish(int r, bufferlist &bl);
+  void _load_done();
   void save(Context *onsave, version_t needv=0);
   void _save_finish(version_t v);
+
+private:
+  bool should_store(Session *s) {
+    return s->is_open() || s->is_closing() || s->is_stale() || s->is_killing();
+  }
+  Session *decode_session(bufferlist::iterator& p);
+  void encode_header(bufferlist& bl);
+  void _save_omap(ObjectOperation& op);
  
 };
 
@@ -67,6 +67,7 @@ public:
     string symlink;
     bufferlist snapbl;
     bool dirty;
+    bool dirty_parent;  // backtrace needs rewriting (see CInode::mark_dirty_parent)
     struct default_file_layout *dir_layout;
 
     bufferlist _enc;
@@ -77,7 +78,7 @@ public:
     fullbit(const string& d, snapid_t df, snapid_t dl, 
 	    version_t v, inode_t& i, fragtree_t &dft, 
 	    map<string,bufferptr> &xa, const string& sym,
-	    bufferlist &sbl, bool dr, default_file_layout *defl = NULL) :
+	    bufferlist &sbl, bool dr, bool dp, default_file_layout *defl = NULL) :
       //dn(d), dnfirst(df), dnlast(dl), dnv(v), 
       //inode(i), dirfragtree(dft), xattrs(xa), symlink(sym), snapbl(sbl), dirty(dr) 
       dir_layout(NULL), _enc(1024)
@@ -98,15 +99,16 @@ public:
 	  ::encode(*defl, _enc);
       }
       ::encode(dr, _enc);      
+      ::encode(dp, _enc);
     }
-    fullbit(bufferlist::iterator &p) : dir_layout(NULL) { decode(p); }
-    fullbit() : dir_layout(NULL) {}
+    fullbit(bufferlist::iterator &p) : dirty_parent(false), dir_layout(NULL) { decode(p); }
+    fullbit() : dirty_parent(false), dir_layout(NULL) {}
     ~fullbit() {
       delete dir_layout;
     }
 
     void encode(bufferlist& bl) const {
-      __u8 struct_v = 2;
+      __u8 struct_v = 3;
       ::encode(struct_v, bl);
       assert(_enc.length());
       bl.append(_enc); 
@@ -135,6 +137,8 @@ public:
 	}
       }
       ::decode(dirty, bl);
+      if (struct_v >= 3)
+	::decode(dirty_parent, bl);
     }
 
     void update_inode(MDS *mds, CInode *in);
@@ -142,7 +146,10 @@ public:
     void print(ostream& out) {
       out << " fullbit dn " << dn << " [" << dnfirst << "," << dnlast << "] dnv " << dnv
 	  << " inode " << inode.ino
-	  << " dirty=" << dirty << std::endl;
+	  << " dirty=" << dirty;
+      if (dirty_parent)
+	out << " dirty_parent";
+      out << std::endl;
     }
   };
   WRITE_CLASS_ENCODER(fullbit)
@@ -555,6 +562,11 @@ private:
     if (sr)
       sr->encode(snapbl);
 
+    // an update that moves (or creates) the inode sets last_renamed_version;
+    // replay marks it dirty_parent again from this.
+    bool dirty_parent = pi->last_renamed_version &&
+      pi->last_renamed_version == pi->version;
+
     lump.nfull++;
     lump.get_dfull().push_back(std::tr1::shared_ptr<fullbit>(new fullbit(dn->get_name(), 
 									 dn->first, dn->last,
@@ -562,7 +574,8 @@ private:
 									 *pi, in->dirfragtree,
 									 *in->get_projected_xattrs(),
 									 in->symlink, snapbl,
-									 dirty, default_layout)));
+									 dirty, dirty_parent,
+									 default_layout)));
     if (pi)
       lump.get_dfull().back()->inode = *pi;
     return &lump.get_dfull().back()->inode;
@@ -614,7 +627,7 @@ private:
 		       0,
 		       *pi, *pdft, *px,
 		       in->symlink, snapbl,
-		       dirty, default_layout);
+		       dirty, false, default_layout);
     return &root->inode;
   }
   
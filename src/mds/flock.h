@@ -34,6 +34,10 @@ public:
   map<client_t, int> client_held_lock_counts;
   map<client_t, int> client_waiting_lock_counts;
 
+  bool empty() const {
+    return held_locks.empty() && waiting_locks.empty();
+  }
+
   /**
    * Check if a lock is on the waiting_locks list.
    *
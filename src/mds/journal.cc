@@ -548,6 +548,7 @@ void EMetaBlob::replay(MDS *mds, LogSegment *logseg)
 	unlinked.erase(in);
 	dir->link_primary_inode(dn, in);
 	if (p->dirty) in->_mark_dirty(logseg);
+	if (p->dirty_parent) in->mark_dirty_parent(logseg);
 	dout(10) << "EMetaBlob.replay added " << *in << dendl;
       } else {
 	if (dn->get_linkage()->get_inode() != in && in->get_parent_dn()) {
@@ -560,6 +561,7 @@ void EMetaBlob::replay(MDS *mds, LogSegment *logseg)
 	  in->get_parent_dn()->adjust_nested_anchors( (int)p->inode.anchored - (int)in->inode.anchored );
 	p->update_inode(mds, in);
 	if (p->dirty) in->_mark_dirty(logseg);
+	if (p->dirty_parent) in->mark_dirty_parent(logseg);
 	if (dn->get_linkage()->get_inode() != in) {
 	  if (!dn->get_linkage()->is_null())  // note: might be remote.  as with stray reintegration.
 	    dir->unlink_inode(dn);
@@ -821,6 +823,7 @@ void ESession::replay(MDS *mds)
     if (open) {
       session = mds->sessionmap.get_or_add_session(client_inst);
       mds->sessionmap.set_state(session, Session::STATE_OPEN);
+      session->prealloc_inos.insert(inos);
       dout(10) << " opened session " << session->inst << dendl;
     } else {
       session = mds->sessionmap.get_session(client_inst.name);
@@ -841,8 +844,10 @@ void ESession::replay(MDS *mds)
     } else {
       dout(10) << "ESession.replay inotable " << mds->inotable->get_version()
 	       << " < " << inotablev << " " << (open ? "add":"remove") << dendl;
-      assert(!open);  // for now
-      mds->inotable->replay_release_ids(inos);
+      if (open)
+	mds->inotable->replay_alloc_ids(inos);
+      else
+	mds->inotable->replay_release_ids(inos);
       assert(mds->inotable->get_version() == inotablev);
     }
   }
@@ -591,9 +591,12 @@ struct fnode_t {
   snapid_t snap_purged_thru;   // the max_last_destroy snapid we've been purged thru
   frag_info_t fragstat, accounted_fragstat;
   nest_info_t rstat, accounted_rstat;
+  bool dentries_in_omap;   // the tmap holds just this header; dentries are omap keys
+
+  fnode_t() : version(0), dentries_in_omap(false) {}
 
   void encode(bufferlist &bl) const {
-    __u8 v = 1;
+    __u8 v = 2;
     ::encode(v, bl);
     ::encode(version, bl);
     ::encode(snap_purged_thru, bl);
@@ -601,6 +604,7 @@ struct fnode_t {
     ::encode(accounted_fragstat, bl);
     ::encode(rstat, bl);
     ::encode(accounted_rstat, bl);
+    ::encode(dentries_in_omap, bl);
   }
   void decode(bufferlist::iterator &bl) {
     __u8 v;
@@ -611,6 +615,10 @@ struct fnode_t {
     ::decode(accounted_fragstat, bl);
     ::decode(rstat, bl);
     ::decode(accounted_rstat, bl);
+    if (v >= 2)
+      ::decode(dentries_in_omap, bl);
+    else
+      dentries_in_omap = false;
   }
 };
 WRITE_CLASS_ENCODER(fnode_t)
@@ -655,25 +663,29 @@ struct dentry_key_t {
   // encode into something that can be decoded as a string.
   // name_ (head) or name_%x (!head)
   void encode(bufferlist& bl) const {
-    __u32 l = strlen(name) + 1;
+    string key;
+    encode(key);
+    ::encode(key, bl);
+  }
+  // the same, unencoded, for use as an object map key
+  void encode(string& key) const {
     char b[20];
     if (snapid != CEPH_NOSNAP) {
       uint64_t val(snapid);
       snprintf(b, sizeof(b), "%" PRIx64, val);
-      l += strlen(b);
     } else {
       snprintf(b, sizeof(b), "%s", "head");
-      l += 4;
     }
-    ::encode(l, bl);
-    bl.append(name, strlen(name));
-    bl.append("_", 1);
-    bl.append(b);
+    key = name;
+    key += "_";
+    key += b;
   }
   static void decode_helper(bufferlist::iterator& bl, string& nm, snapid_t& sn) {
     string foo;
     ::decode(foo, bl);
-
+    decode_helper(foo, nm, sn);
+  }
+  static void decode_helper(const string& foo, string& nm, snapid_t& sn) {
     int i = foo.length()-1;
     while (foo[i] != '_' && i)
       i--;
@@ -1291,8 +1303,11 @@ class MDSCacheObject {
   MDSCacheObject() :
     state(0), 
     ref(0),
+    _more(NULL),
     replica_nonce(0) {}
-  virtual ~MDSCacheObject() {}
+  virtual ~MDSCacheObject() {
+    delete _more;
+  }
 
   // printing
   virtual void print(ostream& out) = 0;
@@ -1417,17 +1432,45 @@ protected:
   }
 
 
+  // --------------------------------------------
+  // rarely used state
+  //  most cache objects are never replicated or waited on, so these
+  //  live on the side, allocated on first use.
+ protected:
+  struct more_bits_t {
+    map<int,int> replica_map;              // [auth] mds -> nonce
+    multimap<uint64_t, Context*> waiting;
+    bool empty() const {
+      return replica_map.empty() && waiting.empty();
+    }
+  };
+  more_bits_t *_more;
+
+  more_bits_t *more() {
+    if (!_more)
+      _more = new more_bits_t;
+    return _more;
+  }
+  void try_clear_more() {
+    if (_more && _more->empty()) {
+      delete _more;
+      _more = NULL;
+    }
+  }
+
+
   // --------------------------------------------
   // replication (across mds cluster)
  protected:
   __s16        replica_nonce; // [replica] defined on replica
-  map<int,int> replica_map;   // [auth] mds -> nonce
+  static map<int,int> empty_replica_map;
 
  public:
-  bool is_replicated() { return !replica_map.empty(); }
-  bool is_replica(int mds) { return replica_map.count(mds); }
-  int num_replicas() { return replica_map.size(); }
+  bool is_replicated() { return _more && !_more->replica_map.empty(); }
+  bool is_replica(int mds) { return _more && _more->replica_map.count(mds); }
+  int num_replicas() { return _more ? _more->replica_map.size() : 0; }
   int add_replica(int mds) {
+    map<int,int>& replica_map = more()->replica_map;
     if (replica_map.count(mds)) 
       return ++replica_map[mds];  // inc nonce
     if (replica_map.empty()) 
@@ -1435,34 +1478,53 @@ protected:
     return replica_map[mds] = 1;
   }
   void add_replica(int mds, int nonce) {
+    map<int,int>& replica_map = more()->replica_map;
     if (replica_map.empty()) 
       get(PIN_REPLICATED);
     replica_map[mds] = nonce;
   }
   int get_replica_nonce(int mds) {
-    assert(replica_map.count(mds));
-    return replica_map[mds];
+    assert(is_replica(mds));
+    return _more->replica_map[mds];
   }
   void remove_replica(int mds) {
-    assert(replica_map.count(mds));
-    replica_map.erase(mds);
-    if (replica_map.empty())
+    assert(is_replica(mds));
+    _more->replica_map.erase(mds);
+    if (_more->replica_map.empty()) {
       put(PIN_REPLICATED);
+      try_clear_more();
+    }
   }
   void clear_replica_map() {
-    if (!replica_map.empty())
-      put(PIN_REPLICATED);
-    replica_map.clear();
+    if (!is_replicated())
+      return;
+    put(PIN_REPLICATED);
+    _more->replica_map.clear();
+    try_clear_more();
+  }
+  map<int,int>::iterator replicas_begin() { return get_replicas().begin(); }
+  map<int,int>::iterator replicas_end() { return get_replicas().end(); }
+  map<int,int>& get_replicas() {
+    return _more ? _more->replica_map : empty_replica_map;
   }
-  map<int,int>::iterator replicas_begin() { return replica_map.begin(); }
-  map<int,int>::iterator replicas_end() { return replica_map.end(); }
-  const map<int,int>& get_replicas() { return replica_map; }
   void list_replicas(set<int>& ls) {
-    for (map<int,int>::const_iterator p = replica_map.begin();
-	 p != replica_map.end();
+    for (map<int,int>::const_iterator p = replicas_begin();
+	 p != replicas_end();
 	 ++p) 
       ls.insert(p->first);
   }
+  void encode_replicas(bufferlist& bl) {
+    ::encode(get_replicas(), bl);
+  }
+  void decode_replicas(bufferlist::iterator& p) {
+    bool was = is_replicated();
+    ::decode(more()->replica_map, p);
+    if (!was && is_replicated())
+      get(PIN_REPLICATED);
+    else if (was && !is_replicated())
+      put(PIN_REPLICATED);
+    try_clear_more();
+  }
 
   int get_replica_nonce() { return replica_nonce;}
   void set_replica_nonce(int n) { replica_nonce = n; }
@@ -1470,18 +1532,17 @@ protected:
 
   // ---------------------------------------------
   // waiting
- protected:
-  multimap<uint64_t, Context*>  waiting;
-
  public:
   bool is_waiter_for(uint64_t mask, uint64_t min=0) {
+    if (!_more)
+      return false;
     if (!min) {
       min = mask;
       while (min & (min-1))  // if more than one bit is set
 	min &= min-1;        //  clear LSB
     }
-    for (multimap<uint64_t,Context*>::iterator p = waiting.lower_bound(min);
-	 p != waiting.end();
+    for (multimap<uint64_t,Context*>::iterator p = _more->waiting.lower_bound(min);
+	 p != _more->waiting.end();
 	 ++p) {
       if (p->first & mask) return true;
       if (p->first > mask) return false;
@@ -1489,6 +1550,7 @@ protected:
     return false;
   }
   virtual void add_waiter(uint64_t mask, Context *c) {
+    multimap<uint64_t, Context*>& waiting = more()->waiting;
     if (waiting.empty())
       get(PIN_WAITER);
     waiting.insert(pair<uint64_t,Context*>(mask, c));
@@ -1499,7 +1561,8 @@ protected:
     
   }
   virtual void take_waiting(uint64_t mask, list<Context*>& ls) {
-    if (waiting.empty()) return;
+    if (!_more || _more->waiting.empty()) return;
+    multimap<uint64_t, Context*>& waiting = _more->waiting;
     multimap<uint64_t,Context*>::iterator it = waiting.begin();
     while (it != waiting.end()) {
       if (it->first & mask) {
@@ -1518,8 +1581,10 @@ protected:
 	it++;
       }
     }
-    if (waiting.empty())
+    if (waiting.empty()) {
       put(PIN_WAITER);
+      try_clear_more();
+    }
   }
   void finish_waiting(uint64_t mask, int result = 0) {
     list<Context*> finished;
@@ -80,7 +80,9 @@ public:
     ::encode(fsid, payload);
     header.version = 2;
     if (connection && (!connection->has_feature(CEPH_FEATURE_PGID64) ||
-		       !connection->has_feature(CEPH_FEATURE_PGPOOL3))) {
+		       !connection->has_feature(CEPH_FEATURE_PGPOOL3) ||
+		       !connection->has_feature(CEPH_FEATURE_POOLRATELIMIT) ||
+		       !connection->has_feature(CEPH_FEATURE_OSDMAPCOMPACT))) {
       // reencode maps using old format
       //
       // FIXME: this can probably be done more efficiently higher up
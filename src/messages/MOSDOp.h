@@ -18,6 +18,7 @@
 
 #include "msg/Message.h"
 #include "osd/osd_types.h"
+#include "include/xlist.h"
 
 /*
  * OSD op
@@ -28,6 +29,20 @@
  */
 
 class OSD;
+class MOSDOp;
+
+/*
+ * OSD-local: the client ops an OSD has received and not yet let go of.
+ * An op takes itself off when it is destroyed, so anything found here
+ * under lock is still alive.
+ */
+struct MOSDOpsInFlight {
+  Mutex lock;
+  xlist<MOSDOp*> ops;
+  MOSDOpsInFlight() : lock("MOSDOpsInFlight::lock") {}
+  ~MOSDOpsInFlight();
+  void add(MOSDOp *op);
+};
 
 class MOSDOp : public Message {
 private:
@@ -52,6 +67,15 @@ private:
 public:
   int rmw_flags;
 
+  // OSD-local, not encoded: when we reached each OSD_OP_STAGE_*
+  utime_t stage_stamp[OSD_OP_STAGE_MAX];
+  void mark_stage(int s, utime_t now) { stage_stamp[s] = now; }
+  bool reached_stage(int s) const { return stage_stamp[s] != utime_t(); }
+
+  // OSD-local: our place on the OSD's ops in flight
+  MOSDOpsInFlight *in_flight;
+  xlist<MOSDOp*>::item in_flight_item;
+
   friend class MOSDOpReply;
 
   // read
@@ -104,12 +128,17 @@ public:
     client_inc(inc),
     osdmap_epoch(_osdmap_epoch), flags(_flags),
     oid(_oid), oloc(_oloc), pgid(_pgid),
-    rmw_flags(flags) {
+    rmw_flags(flags), in_flight(NULL), in_flight_item(this) {
     set_tid(tid);
   }
-  MOSDOp() : rmw_flags(0) {}
+  MOSDOp() : rmw_flags(0), in_flight(NULL), in_flight_item(this) {}
 private:
-  ~MOSDOp() {}
+  ~MOSDOp() {
+    if (in_flight) {
+      Mutex::Locker l(in_flight->lock);
+      in_flight_item.remove_myself();
+    }
+  }
 
 public:
   void set_version(eversion_t v) { reassert_version = v; }
@@ -235,7 +264,7 @@ struct ceph_osd_request_head {
       if (flags & CEPH_OSD_FLAG_PEERSTAT)
 	::encode(peer_stat, payload);
     } else {
-      header.version = 3;
+      header.version = trace_id ? 4 : 3;
       ::encode(client_inc, payload);
       ::encode(osdmap_epoch, payload);
       ::encode(flags, payload);
@@ -257,6 +286,8 @@ struct ceph_osd_request_head {
 
       if (flags & CEPH_OSD_FLAG_PEERSTAT)
 	::encode(peer_stat, payload);
+      if (trace_id)
+	::encode(trace_id, payload);
     }
   }
 
@@ -337,6 +368,8 @@ struct ceph_osd_request_head {
 
       if (flags & CEPH_OSD_FLAG_PEERSTAT)
 	::decode(peer_stat, p);
+      if (header.version >= 4)
+	::decode(trace_id, p);
     }
 
     bufferlist::iterator datap = data.begin();
@@ -389,4 +422,21 @@ struct ceph_osd_request_head {
 };
 
 
+inline void MOSDOpsInFlight::add(MOSDOp *op)
+{
+  Mutex::Locker l(lock);
+  op->in_flight = this;
+  ops.push_back(&op->in_flight_item);
+}
+
+inline MOSDOpsInFlight::~MOSDOpsInFlight()
+{
+  Mutex::Locker l(lock);
+  while (!ops.empty()) {
+    MOSDOp *op = ops.front();
+    op->in_flight = NULL;
+    op->in_flight_item.remove_myself();
+  }
+}
+
 #endif
@@ -69,7 +69,11 @@ public:
   MOSDOpReply(MOSDOp *req, int r, epoch_t e, int acktype) :
     Message(CEPH_MSG_OSD_OPREPLY) {
     set_tid(req->get_tid());
-    ops = req->ops;
+    // only the op headers go back; copying req->ops whole would drag
+    // along (and allocate for) the request's in data and source oids
+    ops.resize(req->ops.size());
+    for (unsigned i = 0; i < ops.size(); i++)
+      ops[i].op = req->ops[i].op;
     result = r;
     flags =
       (req->flags & ~(CEPH_OSD_FLAG_ONDISK|CEPH_OSD_FLAG_ONNVRAM|CEPH_OSD_FLAG_ACK)) | acktype;
@@ -77,6 +81,7 @@ public:
     pgid = req->pgid;
     osdmap_epoch = e;
     reassert_version = req->reassert_version;
+    trace_id = req->get_trace_id();
   }
   MOSDOpReply() {}
 private:
@@ -99,7 +104,7 @@ public:
       }
       ::encode_nohead(oid.name, payload);
     } else {
-      header.version = 2;
+      header.version = trace_id ? 3 : 2;
       ::encode(oid, payload);
       ::encode(pgid, payload);
       ::encode(flags, payload);
@@ -111,6 +116,8 @@ public:
       ::encode(num_ops, payload);
       for (unsigned i = 0; i < num_ops; i++)
 	::encode(ops[i].op, payload);
+      if (trace_id)
+	::encode(trace_id, payload);
     }
   }
   virtual void decode_payload(CephContext *cct) {
@@ -141,6 +148,8 @@ public:
       ops.resize(num_ops);
       for (unsigned i = 0; i < num_ops; i++)
 	::decode(ops[i].op, p);
+      if (header.version >= 3)
+	::decode(trace_id, p);
     }
   }
 
@@ -26,13 +26,17 @@ struct MOSDRepScrub : public Message {
   pg_t pgid;             // PG to scrub
   eversion_t scrub_from; // only scrub log entries after scrub_from
   epoch_t map_epoch;
+  uint64_t start, end;   // objects to scrub, by PG::backfill_key
+  bool deep;             // read and checksum the data too
 
-  MOSDRepScrub() {}
-  MOSDRepScrub(pg_t pgid, eversion_t scrub_from, epoch_t map_epoch) :
+  MOSDRepScrub() : start(0), end(1ull << 32), deep(false) {}
+  MOSDRepScrub(pg_t pgid, eversion_t scrub_from, epoch_t map_epoch,
+	       uint64_t start, uint64_t end, bool deep) :
     Message(MSG_OSD_REP_SCRUB),
     pgid(pgid),
     scrub_from(scrub_from),
-    map_epoch(map_epoch) {}
+    map_epoch(map_epoch),
+    start(start), end(end), deep(deep) {}
   
 private:
   ~MOSDRepScrub() {}
@@ -43,19 +47,31 @@ public:
     out << "replica scrub(pg: ";
     out << pgid << ",from:" << scrub_from << "epoch:" 
         << map_epoch;
+    out << ",range:" << std::hex << start << "-" << end << std::dec;
+    if (deep)
+      out << ",deep";
     out << ")";
   }
 
   void encode_payload(CephContext *cct) {
+    header.version = 2;
     ::encode(pgid, payload);
     ::encode(scrub_from, payload);
     ::encode(map_epoch, payload);
+    ::encode(start, payload);
+    ::encode(end, payload);
+    ::encode(deep, payload);
   }
   void decode_payload(CephContext *cct) {
     bufferlist::iterator p = payload.begin();
     ::decode(pgid, p);
     ::decode(scrub_from, p);
     ::decode(map_epoch, p);
+    if (header.version >= 2) {
+      ::decode(start, p);
+      ::decode(end, p);
+      ::decode(deep, p);
+    }
   }
 };
 
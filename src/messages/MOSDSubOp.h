@@ -58,9 +58,11 @@ public:
 
   // piggybacked osd/og state
   eversion_t pg_trim_to;   // primary->replica: trim to here
+  eversion_t min_last_complete_ondisk;  // primary->replica: committed everywhere
   osd_peer_stat_t peer_stat;
 
   map<string,bufferptr> attrset;
+  map<string,bufferlist> omap_entries;   // push: the object's whole omap
 
   interval_set<uint64_t> data_subset;
   map<hobject_t, interval_set<uint64_t> > clone_subsets;
@@ -106,10 +108,16 @@ public:
     }
     if (header.version >= 3)
       ::decode(oloc, p);
+    if (header.version >= 4)
+      ::decode(omap_entries, p);
+    if (header.version >= 5)
+      ::decode(trace_id, p);
+    if (header.version >= 6)
+      ::decode(min_last_complete_ondisk, p);
   }
 
   virtual void encode_payload(CephContext *cct) {
-    header.version = 3;
+    header.version = 6;
 
     ::encode(map_epoch, payload);
     ::encode(reqid, payload);
@@ -146,6 +154,9 @@ public:
     ::encode(first, payload);
     ::encode(complete, payload);
     ::encode(oloc, payload);
+    ::encode(omap_entries, payload);
+    ::encode(trace_id, payload);
+    ::encode(min_last_complete_ondisk, payload);
   }
 
 
@@ -68,8 +68,11 @@ public:
     ::decode(last_complete_ondisk, p);
     ::decode(peer_stat, p);
     ::decode(attrset, p);
+    if (header.version >= 2)
+      ::decode(trace_id, p);
   }
   virtual void encode_payload(CephContext *cct) {
+    header.version = trace_id ? 2 : 1;
     ::encode(map_epoch, payload);
     ::encode(reqid, payload);
     ::encode(pgid, payload);
@@ -84,6 +87,8 @@ public:
     ::encode(last_complete_ondisk, payload);
     ::encode(peer_stat, payload);
     ::encode(attrset, payload);
+    if (trace_id)
+      ::encode(trace_id, payload);
   }
 
   epoch_t get_map_epoch() { return map_epoch; }
@@ -118,6 +123,7 @@ public:
     result(result_) {
     memset(&peer_stat, 0, sizeof(peer_stat));
     set_tid(req->get_tid());
+    trace_id = req->get_trace_id();
   }
   MOSDSubOpReply() {}
 private:
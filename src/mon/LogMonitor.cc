@@ -146,7 +146,7 @@ bool LogMonitor::update_from_paxos()
       if (le.type >= CLOG_ERROR)
 	blogerr.append(s);
 
-      summary.add(le);
+      summary.add(le, g_conf->mon_log_summary_max);
     }
 
     summary.version++;
@@ -181,6 +181,7 @@ bool LogMonitor::update_from_paxos()
 void LogMonitor::create_pending()
 {
   pending_log.clear();
+  pending_dropped = 0;
   pending_summary = summary;
   dout(10) << "create_pending v " << (paxos->get_version() + 1) << dendl;
 }
@@ -188,6 +189,19 @@ void LogMonitor::create_pending()
 void LogMonitor::encode_pending(bufferlist &bl)
 {
   dout(10) << "encode_pending v " << (paxos->get_version() + 1) << dendl;
+  if (pending_dropped) {
+    LogEntry e;
+    e.who = mon->messenger->get_myinst();
+    e.stamp = ceph_clock_now(g_ceph_context);
+    e.seq = 0;
+    e.type = CLOG_WARN;
+    std::stringstream ss;
+    ss << "dropped " << pending_dropped << " log entries over mon_log_max_pending "
+       << g_conf->mon_log_max_pending;
+    e.msg = ss.str();
+    pending_log.insert(pair<utime_t,LogEntry>(e.stamp, e));
+    pending_dropped = 0;
+  }
   __u8 v = 1;
   ::encode(v, bl);
   for (multimap<utime_t,LogEntry>::iterator p = pending_log.begin();
@@ -228,6 +242,25 @@ bool LogMonitor::prepare_update(PaxosServiceMessage *m)
   }
 }
 
+/*
+ * Log entries are never urgent.  Gather them for at least
+ * mon_log_propose_interval so a log storm becomes a few big proposals
+ * rather than a stream of small ones.
+ */
+bool LogMonitor::should_propose(double& delay)
+{
+  if (!PaxosService::should_propose(delay))
+    return false;
+  if (paxos->get_version() > 1) {
+    utime_t now = ceph_clock_now(g_ceph_context);
+    double left = g_conf->mon_log_propose_interval -
+      (double)(now - paxos->get_last_commit_time());
+    if (left > delay)
+      delay = left;
+  }
+  return true;
+}
+
 void LogMonitor::committed()
 {
 
@@ -280,8 +313,12 @@ bool LogMonitor::prepare_log(MLog *m)
        p++) {
     dout(10) << " logging " << *p << dendl;
     if (!pending_summary.contains(p->key())) {
-      pending_summary.add(*p);
-      pending_log.insert(pair<utime_t,LogEntry>(p->stamp, *p));
+      pending_summary.add(*p, g_conf->mon_log_summary_max);
+      // still acked, so the sender won't retry it
+      if (pending_log.size() >= (unsigned)g_conf->mon_log_max_pending)
+	pending_dropped++;
+      else
+	pending_log.insert(pair<utime_t,LogEntry>(p->stamp, *p));
     }
   }
 
@@ -31,6 +31,7 @@ class MLog;
 class LogMonitor : public PaxosService {
 private:
   multimap<utime_t,LogEntry> pending_log;
+  unsigned pending_dropped;  // entries over mon_log_max_pending
   LogSummary pending_summary, summary;
 
   void create_initial(bufferlist& bl);
@@ -42,6 +43,7 @@ private:
 
   bool preprocess_query(PaxosServiceMessage *m);  // true if processed.
   bool prepare_update(PaxosServiceMessage *m);
+  bool should_propose(double& delay);
 
   bool preprocess_log(MLog *m);
   bool prepare_log(MLog *m);
@@ -60,7 +62,7 @@ private:
   bool prepare_command(MMonCommand *m);
 
  public:
-  LogMonitor(Monitor *mn, Paxos *p) : PaxosService(mn, p) { }
+  LogMonitor(Monitor *mn, Paxos *p) : PaxosService(mn, p), pending_dropped(0) { }
   
   void tick();  // check state, take actions
 };
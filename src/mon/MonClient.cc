@@ -38,6 +38,9 @@
 
 #include "common/config.h"
 
+#include <fstream>
+#include <stdio.h>
+
 
 #define DOUT_SUBSYS monc
 #undef dout_prefix
@@ -49,6 +52,7 @@ MonClient::MonClient(CephContext *cct_) :
   state(MC_STATE_NONE),
   messenger(NULL),
   cur_con(NULL),
+  hint_loaded(false),
   monc_lock("MonClient::monc_lock"),
   timer(cct_, monc_lock), finisher(cct_),
   initialized(false),
@@ -226,10 +230,14 @@ int MonClient::get_monmap_privately()
   ldout(cct, 10) << "have " << monmap.epoch << dendl;
   
   while (monmap.epoch == 0) {
-    cur_mon = monmap.pick_random_mon();
+    if (attempt < 10 || !_get_hint_mon(&cur_mon))
+      cur_mon = monmap.pick_random_mon();
     cur_con = messenger->get_connection(monmap.get_inst(cur_mon));
     ldout(cct, 10) << "querying mon." << cur_mon << " " << cur_con->get_peer_addr() << dendl;
     messenger->send_message(new MMonGetMap, cur_con);
+    _open_hunt_cons();
+    for (map<string, Connection*>::iterator p = hunt_cons.begin(); p != hunt_cons.end(); ++p)
+      messenger->send_message(new MMonGetMap, p->second);
     
     if (--attempt == 0)
       break;
@@ -240,8 +248,11 @@ int MonClient::get_monmap_privately()
     if (monmap.epoch == 0) {
       messenger->mark_down(cur_con);  // nope, clean that connection up
       cur_con->put();
+      cur_con = NULL;
+      _clear_hunt_cons();
     }
   }
+  _clear_hunt_cons();
 
   if (temp_msgr) {
     monc_lock.Unlock();
@@ -285,11 +296,23 @@ bool MonClient::ms_dispatch(Message *m)
 
   Mutex::Locker lock(monc_lock);
 
-  // ignore any messages outside our current session
+  // ignore any messages outside our current session, unless they are
+  // the first answer to a parallel hunt
   if (m->get_connection() != cur_con) {
-    ldout(cct, 10) << "discarding stray monitor message " << *m << dendl;
-    m->put();
-    return true;
+    bool hunted = false;
+    if (m->get_type() == CEPH_MSG_MON_MAP || m->get_type() == CEPH_MSG_AUTH_REPLY) {
+      for (map<string, Connection*>::iterator p = hunt_cons.begin(); p != hunt_cons.end(); ++p)
+	if (p->second == m->get_connection())
+	  hunted = true;
+    }
+    if (!hunted) {
+      ldout(cct, 10) << "discarding stray monitor message " << *m << dendl;
+      m->put();
+      return true;
+    }
+    _hunt_won(m->get_connection());
+  } else if (!hunt_cons.empty()) {
+    _hunt_won(cur_con);
   }
 
   switch (m->get_type()) {
@@ -389,6 +412,7 @@ void MonClient::shutdown()
   }
   monc_lock.Lock();
   timer.shutdown();
+  _clear_hunt_cons();
   if (cur_con) {
     cur_con->put();
     cur_con = NULL;
@@ -475,6 +499,7 @@ void MonClient::handle_auth(MAuthReply *m)
   if (ret == 0) {
     if (state != MC_STATE_HAVE_SESSION) {
       state = MC_STATE_HAVE_SESSION;
+      _save_hint();
       while (!waiting_for_session.empty()) {
 	_send_mon_message(waiting_for_session.front());
 	waiting_for_session.pop_front();
@@ -514,7 +539,11 @@ void MonClient::_pick_new_mon()
 {
   assert(monc_lock.is_locked());
 
-  if (!cur_mon.empty() && monmap.size() > 1) {
+  string hint;
+  if (cur_mon.empty() && _get_hint_mon(&hint)) {
+    // the one we had a session with last time is likely still up
+    cur_mon = hint;
+  } else if (!cur_mon.empty() && monmap.size() > 1) {
     // pick a _different_ mon
     cur_mon = monmap.pick_random_mon_not(cur_mon);
   } else {
@@ -533,11 +562,110 @@ void MonClient::_pick_new_mon()
 }
 
 
+/*
+ * Open connections to up to mon_client_hunt_parallel - 1 monitors other
+ * than cur_mon, so one that is down costs us nothing but a connection.
+ */
+void MonClient::_open_hunt_cons()
+{
+  assert(monc_lock.is_locked());
+  unsigned n = cct->_conf->mon_client_hunt_parallel;
+  if (n <= 1 || monmap.size() <= 1)
+    return;
+  unsigned start = rand() % monmap.size();
+  for (unsigned i = 0; i < monmap.size() && hunt_cons.size() + 1 < n; i++) {
+    const string& name = monmap.rank_name[(start + i) % monmap.size()];
+    if (name == cur_mon || hunt_cons.count(name))
+      continue;
+    Connection *con = messenger->get_connection(monmap.get_inst(name));
+    ldout(cct, 10) << "_open_hunt_cons also trying mon." << name
+		   << " addr " << con->get_peer_addr() << dendl;
+    hunt_cons[name] = con;
+  }
+}
+
+/// con answered first: make it our session, and drop the others
+void MonClient::_hunt_won(Connection *con)
+{
+  assert(monc_lock.is_locked());
+  if (con != cur_con) {
+    map<string, Connection*>::iterator p = hunt_cons.begin();
+    while (p->second != con)
+      ++p;
+    ldout(cct, 10) << "_hunt_won mon." << p->first << " answered first" << dendl;
+    if (cur_con) {
+      messenger->mark_down(cur_con);
+      cur_con->put();
+    }
+    cur_mon = p->first;
+    cur_con = con;
+    hunt_cons.erase(p);
+  }
+  _clear_hunt_cons();
+}
+
+void MonClient::_clear_hunt_cons()
+{
+  assert(monc_lock.is_locked());
+  for (map<string, Connection*>::iterator p = hunt_cons.begin(); p != hunt_cons.end(); ++p) {
+    messenger->mark_down(p->second);
+    p->second->put();
+  }
+  hunt_cons.clear();
+}
+
+/// the monitor in mon_client_hint_file, if it is in our monmap
+bool MonClient::_get_hint_mon(string *name)
+{
+  if (!hint_loaded) {
+    hint_loaded = true;
+    const string& fn = cct->_conf->mon_client_hint_file;
+    if (!fn.empty()) {
+      std::ifstream in(fn.c_str());
+      string s;
+      if (in >> s && !hint_addr.parse(s.c_str()))
+	hint_addr = entity_addr_t();
+      ldout(cct, 10) << "_get_hint_mon " << fn << " has " << hint_addr << dendl;
+    }
+  }
+  if (hint_addr == entity_addr_t())
+    return false;
+  return monmap.get_addr_name(hint_addr, *name);
+}
+
+void MonClient::_save_hint()
+{
+  const string& fn = cct->_conf->mon_client_hint_file;
+  if (fn.empty() || cur_con->get_peer_addr() == hint_addr)
+    return;
+  hint_addr = cur_con->get_peer_addr();
+  string tmp = fn + ".tmp";
+  std::ofstream out(tmp.c_str());
+  out << hint_addr << std::endl;
+  out.close();
+  if (!out || ::rename(tmp.c_str(), fn.c_str()) < 0)
+    ldout(cct, 1) << "_save_hint failed to write " << fn << dendl;
+}
+
+static MAuth *new_auth_negotiation(const set<__u32>& supported, const EntityName& name,
+				   uint64_t global_id)
+{
+  MAuth *m = new MAuth;
+  m->protocol = 0;
+  __u8 struct_v = 1;
+  ::encode(struct_v, m->auth_payload);
+  ::encode(supported, m->auth_payload);
+  ::encode(name, m->auth_payload);
+  ::encode(global_id, m->auth_payload);
+  return m;
+}
+
 void MonClient::_reopen_session()
 {
   assert(monc_lock.is_locked());
   ldout(cct, 10) << "_reopen_session" << dendl;
 
+  _clear_hunt_cons();
   _pick_new_mon();
 
   // throw out old queued messages
@@ -555,14 +683,14 @@ void MonClient::_reopen_session()
   // restart authentication handshake
   state = MC_STATE_NEGOTIATING;
 
-  MAuth *m = new MAuth;
-  m->protocol = 0;
-  __u8 struct_v = 1;
-  ::encode(struct_v, m->auth_payload);
-  ::encode(auth_supported, m->auth_payload);
-  ::encode(entity_name, m->auth_payload);
-  ::encode(global_id, m->auth_payload);
-  _send_mon_message(m, true);
+  _send_mon_message(new_auth_negotiation(auth_supported, entity_name, global_id), true);
+  if (hunting) {
+    // whichever answers first gets the rest of the handshake
+    _open_hunt_cons();
+    for (map<string, Connection*>::iterator p = hunt_cons.begin(); p != hunt_cons.end(); ++p)
+      messenger->send_message(new_auth_negotiation(auth_supported, entity_name, global_id),
+			      p->second);
+  }
 
   if (!sub_have.empty())
     _renew_subs();
@@ -57,6 +57,17 @@ private:
   string cur_mon;
   Connection *cur_con;
 
+  /*
+   * While hunting we ask a few monitors at once; these are the ones
+   * besides cur_con.  Whichever answers first becomes cur_con and the
+   * rest are dropped.
+   */
+  map<string, Connection*> hunt_cons;
+
+  // the monitor we last had a session with, from mon_client_hint_file
+  bool hint_loaded;
+  entity_addr_t hint_addr;
+
   EntityName entity_name;
 
   entity_addr_t my_addr;
@@ -112,6 +123,11 @@ private:
   void _finish_hunting();
   void _reopen_session();
   void _pick_new_mon();
+  void _open_hunt_cons();
+  void _hunt_won(Connection *con);
+  void _clear_hunt_cons();
+  bool _get_hint_mon(string *name);
+  void _save_hint();
   void _send_mon_message(Message *m, bool force=false);
 
 public:
@@ -39,6 +39,320 @@ static ostream& _prefix(std::ostream *_dout, const string& dir) {
 #include <sstream>
 #include <sys/file.h>
 
+#ifdef HAVE_SQLITE3
+# include <sqlite3.h>
+#endif
+
+MonitorStore::~MonitorStore()
+{
+  _kv_close();
+}
+
+#ifdef HAVE_SQLITE3
+
+/*
+ * a is the prefix (the directory, in file mode) and b the key within
+ * it, "" for none.  Numeric keys (the paxos versions) are bound as
+ * integers so that they sort, and range deletes, numerically.
+ */
+static void bind_key(sqlite3_stmt *stmt, int i, const char *a, const char *b)
+{
+  sqlite3_bind_text(stmt, i, a, -1, SQLITE_TRANSIENT);
+  if (!b || !*b) {
+    sqlite3_bind_text(stmt, i + 1, "", 0, SQLITE_STATIC);
+    return;
+  }
+  const char *p = b;
+  while (*p >= '0' && *p <= '9')
+    p++;
+  if (*p == 0 && p - b < 20)
+    sqlite3_bind_int64(stmt, i + 1, (sqlite3_int64)strtoull(b, NULL, 10));
+  else
+    sqlite3_bind_text(stmt, i + 1, b, -1, SQLITE_TRANSIENT);
+}
+
+int MonitorStore::_kv_exec(const char *sql)
+{
+  char *err = NULL;
+  if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+    derr << "MonitorStore: '" << sql << "' failed: " << (err ? err : "?") << dendl;
+    sqlite3_free(err);
+    return -EIO;
+  }
+  return 0;
+}
+
+int MonitorStore::_kv_open(const std::string& path)
+{
+  assert(!db);
+  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+    derr << "MonitorStore: unable to open " << path << ": "
+	 << (db ? sqlite3_errmsg(db) : "out of memory") << dendl;
+    sqlite3_close(db);
+    db = NULL;
+    return -EIO;
+  }
+
+  struct {
+    const char *sql;
+    sqlite3_stmt **stmt;
+  } stmts[] = {
+    { "SELECT val FROM kv WHERE prefix = ?1 AND key = ?2", &get_stmt },
+    { "INSERT OR REPLACE INTO kv (prefix, key, val) VALUES (?1, ?2, ?3)", &put_stmt },
+    { "DELETE FROM kv WHERE prefix = ?1 AND key = ?2", &rm_stmt },
+    { "DELETE FROM kv WHERE prefix = ?1 AND key >= ?2 AND key <= ?3", &rm_range_stmt },
+  };
+  int r;
+  if ((r = _kv_exec("PRAGMA journal_mode = WAL")) < 0 ||
+      (r = _kv_exec("PRAGMA synchronous = FULL")) < 0 ||
+      (r = _kv_exec("CREATE TABLE IF NOT EXISTS kv ("
+		    " prefix TEXT NOT NULL, key NOT NULL, val BLOB NOT NULL,"
+		    " PRIMARY KEY (prefix, key))")) < 0) {
+    _kv_close();
+    return r;
+  }
+  for (unsigned i = 0; i < sizeof(stmts) / sizeof(stmts[0]); i++) {
+    if (sqlite3_prepare_v2(db, stmts[i].sql, -1, stmts[i].stmt, NULL) != SQLITE_OK) {
+      derr << "MonitorStore: unable to prepare '" << stmts[i].sql << "': "
+	   << sqlite3_errmsg(db) << dendl;
+      _kv_close();
+      return -EIO;
+    }
+  }
+  dout(10) << "opened " << path << dendl;
+  return 0;
+}
+
+void MonitorStore::_kv_close()
+{
+  if (!db)
+    return;
+  assert(txn_depth == 0);
+  sqlite3_stmt **stmts[] = { &get_stmt, &put_stmt, &rm_stmt, &rm_range_stmt };
+  for (unsigned i = 0; i < sizeof(stmts) / sizeof(stmts[0]); i++) {
+    sqlite3_finalize(*stmts[i]);
+    *stmts[i] = NULL;
+  }
+  sqlite3_close(db);
+  db = NULL;
+  use_db = false;
+}
+
+/// run a statement that returns no rows, and reset it for reuse
+static int step_done(sqlite3 *db, sqlite3_stmt *stmt)
+{
+  int r = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  if (r != SQLITE_DONE) {
+    generic_derr << "MonitorStore: " << sqlite3_errmsg(db) << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
+int MonitorStore::_kv_get(const char *a, const char *b, bufferlist *bl)
+{
+  bind_key(get_stmt, 1, a, b);
+  int r = sqlite3_step(get_stmt);
+  if (r == SQLITE_ROW) {
+    if (bl) {
+      bl->clear();
+      bl->append((const char *)sqlite3_column_blob(get_stmt, 0),
+		 sqlite3_column_bytes(get_stmt, 0));
+    }
+    r = sqlite3_column_bytes(get_stmt, 0);
+  } else if (r == SQLITE_DONE) {
+    r = -ENOENT;
+  } else {
+    derr << "MonitorStore: get " << a << "/" << (b ? b : "") << ": "
+	 << sqlite3_errmsg(db) << dendl;
+    r = -EIO;
+  }
+  sqlite3_reset(get_stmt);
+  sqlite3_clear_bindings(get_stmt);
+  return r;
+}
+
+int MonitorStore::_kv_put(const char *a, const char *b, bufferlist& bl)
+{
+  bind_key(put_stmt, 1, a, b);
+  sqlite3_bind_blob(put_stmt, 3, bl.length() ? bl.c_str() : "", bl.length(),
+		    SQLITE_TRANSIENT);
+  return step_done(db, put_stmt);
+}
+
+int MonitorStore::_kv_erase(const char *a, const char *b)
+{
+  bind_key(rm_stmt, 1, a, b);
+  int r = step_done(db, rm_stmt);
+  if (r == 0 && sqlite3_changes(db) == 0)
+    r = -ENOENT;
+  return r;
+}
+
+int MonitorStore::_kv_erase_range(const char *a, version_t first, version_t last)
+{
+  sqlite3_bind_text(rm_range_stmt, 1, a, -1, SQLITE_TRANSIENT);
+  sqlite3_bind_int64(rm_range_stmt, 2, first);
+  sqlite3_bind_int64(rm_range_stmt, 3, last);
+  return step_done(db, rm_range_stmt);
+}
+
+#else  // HAVE_SQLITE3
+
+int MonitorStore::_kv_exec(const char *sql)
+{
+  return -EOPNOTSUPP;
+}
+
+int MonitorStore::_kv_open(const std::string& path)
+{
+  derr << "MonitorStore: built without sqlite3, can't open " << path << dendl;
+  return -EOPNOTSUPP;
+}
+
+void MonitorStore::_kv_close()
+{
+}
+
+int MonitorStore::_kv_get(const char *a, const char *b, bufferlist *bl)
+{
+  return -EOPNOTSUPP;
+}
+
+int MonitorStore::_kv_put(const char *a, const char *b, bufferlist& bl)
+{
+  return -EOPNOTSUPP;
+}
+
+int MonitorStore::_kv_erase(const char *a, const char *b)
+{
+  return -EOPNOTSUPP;
+}
+
+int MonitorStore::_kv_erase_range(const char *a, version_t first, version_t last)
+{
+  return -EOPNOTSUPP;
+}
+
+#endif  // HAVE_SQLITE3
+
+/*
+ * Copy every file-per-key value into a new database at path, in one
+ * transaction.  The files are left in place, but are no longer used.
+ */
+int MonitorStore::_kv_import(const std::string& path)
+{
+  ::unlink(path.c_str());
+  int r = _kv_open(path);
+  if (r < 0)
+    return r;
+  r = _kv_exec("BEGIN");
+
+  int keys = 0;
+  DIR *d = ::opendir(dir.c_str());
+  if (!d)
+    r = -errno;
+  struct dirent *de;
+  while (r == 0 && d && (de = ::readdir(d)) != NULL) {
+    string name = de->d_name;
+    if (name == "." || name == ".." || name == "lock" ||
+	name.compare(0, 8, "store.db") == 0 ||
+	(name.length() > 4 && name.compare(name.length() - 4, 4, ".new") == 0))
+      continue;
+
+    string fn = dir + "/" + name;
+    struct stat st;
+    if (::stat(fn.c_str(), &st) < 0)
+      continue;
+    if (!S_ISDIR(st.st_mode)) {
+      if (name == "log" || name.compare(0, 4, "log.") == 0)
+	continue;   // appended to, stays a file
+      bufferlist bl;
+      if (get_bl_ss(bl, name.c_str(), 0) >= 0) {
+	r = _kv_put(name.c_str(), 0, bl);
+	keys++;
+      }
+      continue;
+    }
+
+    DIR *sd = ::opendir(fn.c_str());
+    if (!sd) {
+      r = -errno;
+      break;
+    }
+    struct dirent *sde;
+    while (r == 0 && (sde = ::readdir(sd)) != NULL) {
+      string key = sde->d_name;
+      if (key == "." || key == ".." ||
+	  (key.length() > 4 && key.compare(key.length() - 4, 4, ".new") == 0))
+	continue;
+      bufferlist bl;
+      if (get_bl_ss(bl, name.c_str(), key.c_str()) >= 0) {
+	r = _kv_put(name.c_str(), key.c_str(), bl);
+	keys++;
+      }
+    }
+    ::closedir(sd);
+  }
+  if (d)
+    ::closedir(d);
+
+  if (r == 0)
+    r = _kv_exec("COMMIT");
+  else
+    _kv_exec("ROLLBACK");
+  _kv_close();
+  dout(0) << "imported " << keys << " keys into " << path << " r=" << r << dendl;
+  return r;
+}
+
+/// open dir/store.db, creating it from the files if mon_store_kv is set
+int MonitorStore::_kv_mount()
+{
+  string fn = dir + "/store.db";
+  struct stat st;
+  if (::stat(fn.c_str(), &st) < 0) {
+    if (!g_conf->mon_store_kv)
+      return 0;
+    // build it aside, so a crash never leaves a partial store.db
+    string tmp = fn + ".tmp";
+    int r = _kv_import(tmp);
+    if (r < 0)
+      return r;
+    if (::rename(tmp.c_str(), fn.c_str()) < 0)
+      return -errno;
+    int dirfd = ::open(dir.c_str(), O_RDONLY);
+    ::fsync(dirfd);
+    ::close(dirfd);
+  }
+  int r = _kv_open(fn);
+  if (r < 0)
+    return r;
+  use_db = true;
+  return 0;
+}
+
+void MonitorStore::start_transaction()
+{
+  if (use_db && txn_depth == 0) {
+    int r = _kv_exec("BEGIN");
+    assert(r == 0);
+  }
+  txn_depth++;
+}
+
+void MonitorStore::commit_transaction()
+{
+  assert(txn_depth > 0);
+  if (--txn_depth == 0 && use_db) {
+    dout(15) << "commit_transaction" << dendl;
+    int r = _kv_exec("COMMIT");
+    assert(r == 0);
+  }
+}
+
 int MonitorStore::mount()
 {
   char t[1024];
@@ -78,11 +392,12 @@ int MonitorStore::mount()
     dir += "/";
     dir += old;
   }
-  return 0;
+  return _kv_mount();
 }
 
 int MonitorStore::umount()
 {
+  _kv_close();
   ::close(lock_fd);
   return 0;
 }
@@ -103,6 +418,11 @@ int MonitorStore::mkfs()
     return -EIO;
   }
 
+  _kv_close();
+  int r = _kv_mount();
+  if (r < 0)
+    return r;
+
   dout(0) << "created monfs at " << dir.c_str() << " for "
 	  << g_conf->name.get_id() << dendl;
   return 0;
@@ -110,6 +430,21 @@ int MonitorStore::mkfs()
 
 version_t MonitorStore::get_int(const char *a, const char *b)
 {
+  if (use_db) {
+    bufferlist bl;
+    int r = _kv_get(a, b, &bl);
+    if (r < 0) {
+      if (r != -ENOENT)
+	derr << "MonitorStore::get_int: failed to get " << a << "/" << (b ? b : "")
+	     << ": " << cpp_strerror(r) << dendl;
+      return 0;
+    }
+    bl.append('\0');
+    version_t val = strtoull(bl.c_str(), NULL, 10);
+    dout(15) << "get_int " << a << "/" << (b ? b : "") << " = " << val << dendl;
+    return val;
+  }
+
   char fn[1024];
   if (b)
     snprintf(fn, sizeof(fn), "%s/%s/%s", dir.c_str(), a, b);
@@ -152,6 +487,21 @@ version_t MonitorStore::get_int(const char *a, const char *b)
 
 void MonitorStore::put_int(version_t val, const char *a, const char *b)
 {
+  if (use_db) {
+    char vs[30];
+    snprintf(vs, sizeof(vs), "%llu\n", (unsigned long long)val);
+    bufferlist bl;
+    bl.append(vs);
+    dout(15) << "set_int " << a << "/" << (b ? b : "") << " = " << val << dendl;
+    int r = _kv_put(a, b, bl);
+    if (r < 0) {
+      derr << "MonitorStore::put_int: failed to put " << a << "/" << (b ? b : "")
+	   << ": " << cpp_strerror(r) << dendl;
+      ceph_abort();
+    }
+    return;
+  }
+
   char fn[1024];
   snprintf(fn, sizeof(fn), "%s/%s", dir.c_str(), a);
   if (b) {
@@ -201,6 +551,11 @@ void MonitorStore::put_int(version_t val, const char *a, const char *b)
 
 bool MonitorStore::exists_bl_ss(const char *a, const char *b)
 {
+  if (use_db) {
+    dout(15) << "exists_bl " << a << "/" << (b ? b : "") << dendl;
+    return _kv_get(a, b, NULL) >= 0;
+  }
+
   char fn[1024];
   if (b) {
     dout(15) << "exists_bl " << a << "/" << b << dendl;
@@ -219,6 +574,11 @@ bool MonitorStore::exists_bl_ss(const char *a, const char *b)
 
 int MonitorStore::erase_ss(const char *a, const char *b)
 {
+  if (use_db) {
+    dout(15) << "erase_ss " << a << "/" << (b ? b : "") << dendl;
+    return _kv_erase(a, b);
+  }
+
   char fn[1024];
   if (b) {
     dout(15) << "erase_ss " << a << "/" << b << dendl;
@@ -230,8 +590,24 @@ int MonitorStore::erase_ss(const char *a, const char *b)
   return ::unlink(fn);
 }
 
+int MonitorStore::erase_sn_range(const char *a, version_t first, version_t last)
+{
+  dout(15) << "erase_sn_range " << a << "/[" << first << ".." << last << "]" << dendl;
+  if (use_db)
+    return _kv_erase_range(a, first, last);
+  for (version_t v = first; v <= last; v++)
+    erase_sn(a, v);
+  return 0;
+}
+
 int MonitorStore::get_bl_ss(bufferlist& bl, const char *a, const char *b)
 {
+  if (use_db) {
+    int r = _kv_get(a, b, &bl);
+    dout(15) << "get_bl " << a << "/" << (b ? b : "") << " = " << r << dendl;
+    return r;
+  }
+
   char fn[1024];
   if (b) {
     snprintf(fn, sizeof(fn), "%s/%s/%s", dir.c_str(), a, b);
@@ -329,7 +705,13 @@ int MonitorStore::write_bl_ss_impl(bufferlist& bl, const char *a, const char *b,
 
 int MonitorStore::write_bl_ss(bufferlist& bl, const char *a, const char *b, bool append)
 {
-  int err = write_bl_ss_impl(bl, a, b, append);
+  int err;
+  if (use_db && !append) {
+    dout(15) << "put_bl " << a << "/" << (b ? b : "") << " = " << bl.length() << " bytes" << dendl;
+    err = _kv_put(a, b, bl);
+  } else {
+    err = write_bl_ss_impl(bl, a, b, append);
+  }
   if (err)
     derr << "write_bl_ss " << a << "/" << b << " got error " << cpp_strerror(err) << dendl;
   assert(!err);  // for now
@@ -346,6 +728,15 @@ int MonitorStore::put_bl_sn_map(const char *a,
   version_t last = lastp->first;
   dout(15) <<  "put_bl_sn_map " << a << "/[" << first << ".." << last << "]" << dendl;
 
+  if (use_db) {
+    // one transaction, one sync
+    start_transaction();
+    for (map<version_t,bufferlist>::iterator p = start; p != end; ++p)
+      put_bl_sn(p->second, a, p->first);
+    commit_transaction();
+    return 0;
+  }
+
   // only do a big sync if there are several values, or if the feature is disabled.
   if (g_conf->mon_sync_fs_threshold <= 0 ||
       last - first < (unsigned)g_conf->mon_sync_fs_threshold) {
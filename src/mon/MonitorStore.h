@@ -21,17 +21,46 @@
 #include <iosfwd>
 #include <string.h>
 
+struct sqlite3;
+struct sqlite3_stmt;
+
+/*
+ * The monitor's persistent state: a file per key under dir, or, once
+ * dir/store.db exists (mon_store_kv creates it, importing the files),
+ * rows in an embedded database.  The database lets a paxos commit
+ * write all of its keys in one atomic, singly-synced transaction (see
+ * start_transaction) and trim old versions with one range delete.
+ * The append-only log files stay plain files either way.
+ */
 class MonitorStore {
   string dir;
   int lock_fd;
 
+  sqlite3 *db;
+  sqlite3_stmt *get_stmt, *put_stmt, *rm_stmt, *rm_range_stmt;
+  bool use_db;     // false while importing the files into db
+  int txn_depth;
+
   int write_bl_ss_impl(bufferlist& bl, const char *a, const char *b,
 		       bool append);
   int write_bl_ss(bufferlist& bl, const char *a, const char *b,
 		  bool append);
+
+  int _kv_exec(const char *sql);
+  int _kv_open(const std::string& path);
+  void _kv_close();
+  int _kv_get(const char *a, const char *b, bufferlist *bl);
+  int _kv_put(const char *a, const char *b, bufferlist& bl);
+  int _kv_erase(const char *a, const char *b);
+  int _kv_erase_range(const char *a, version_t first, version_t last);
+  int _kv_import(const std::string& path);
+  int _kv_mount();
+
 public:
-  MonitorStore(const std::string &d) : dir(d) { }
-  ~MonitorStore() { }
+  MonitorStore(const std::string &d)
+    : dir(d), lock_fd(-1), db(NULL), get_stmt(NULL), put_stmt(NULL),
+      rm_stmt(NULL), rm_range_stmt(NULL), use_db(false), txn_depth(0) { }
+  ~MonitorStore();
 
   int mkfs();  // wipe
   int mount();
@@ -83,6 +112,17 @@ public:
     snprintf(bs, sizeof(bs), "%llu", (unsigned long long)b);
     return erase_ss(a, bs);
   }
+  /// erase a/first through a/last
+  int erase_sn_range(const char *a, version_t first, version_t last);
+
+  /**
+   * Group the writes that follow, up to the matching
+   * commit_transaction(), into one atomic update.  Transactions nest;
+   * only the outermost commit reaches disk.  Without a database the
+   * writes are applied one by one, as always.
+   */
+  void start_transaction();
+  void commit_transaction();
 
   /*
   version_t get_incarnation() { return get_int("incarnation"); }
@@ -54,7 +54,8 @@ static ostream& _prefix(std::ostream *_dout, Monitor *mon, OSDMap& osdmap) {
 
 /************ MAPS ****************/
 OSDMonitor::OSDMonitor(Monitor *mn, Paxos *p)
-  : PaxosService(mn, p)
+  : PaxosService(mn, p),
+    crush_parent_epoch(0)
 {
   // we need to trim this too
   p->add_extra_state_dir("osdmap_full");
@@ -95,6 +96,7 @@ bool OSDMonitor::update_from_paxos()
   } 
   
   // walk through incrementals
+  epoch_t prev = osdmap.epoch;
   bufferlist bl;
   while (paxosv > osdmap.epoch) {
     bool success = paxos->read(osdmap.epoch+1, bl);
@@ -103,11 +105,13 @@ bool OSDMonitor::update_from_paxos()
     dout(7) << "update_from_paxos  applying incremental " << osdmap.epoch+1 << dendl;
     OSDMap::Incremental inc(bl);
     osdmap.apply_incremental(inc);
+    cache_map_bl(inc_cache, osdmap.epoch, bl);
 
     // write out the full map for all past epochs
     bl.clear();
     osdmap.encode(bl);
     mon->store->put_bl_sn(bl, "osdmap_full", osdmap.epoch);
+    cache_map_bl(full_cache, osdmap.epoch, bl);
 
     // share
     dout(1) << osdmap << dendl;
@@ -131,6 +135,8 @@ bool OSDMonitor::update_from_paxos()
 
   send_to_waiting();
   check_subs();
+  if (prev)
+    seed_osds(prev + 1);
    
   return true;
 }
@@ -139,8 +145,8 @@ void OSDMonitor::remove_redundant_pg_temp()
 {
   dout(10) << "remove_redundant_pg_temp" << dendl;
 
-  for (map<pg_t,vector<int> >::iterator p = osdmap.pg_temp.begin();
-       p != osdmap.pg_temp.end();
+  for (map<pg_t,vector<int> >::iterator p = osdmap.pg_temp->begin();
+       p != osdmap.pg_temp->end();
        p++) {
     if (pending_inc.new_pg_temp.count(p->first) == 0) {
       vector<int> raw_up;
@@ -471,57 +477,133 @@ bool OSDMonitor::prepare_failure(MOSDFailure *m)
   assert(osdmap.get_addr(target_osd) == m->get_target().addr);
   
   if (m->if_osd_failed()) {
-    int reports = 0;
-    int reporters = 0;
-
-    if (failed_notes.count(target_osd)) {
-      multimap<int, pair<int, int> >::iterator i = failed_notes.lower_bound(target_osd);
-      while ((i != failed_notes.end()) && (i->first == target_osd)) {
-        if (i->second.first == reporter) {
-          ++i->second.second;
-          dout(10) << "adding new failure report from osd." << reporter
-                   << " on osd." << target_osd << dendl;
-          reporter = -1;
-        }
-        ++reporters;
-        reports += i->second.second;
-        ++i;
-      }
-    }
-    if (reporter != -1) { //didn't get counted yet
-      failed_notes.insert(pair<int, pair<int, int> >
-                          (target_osd, pair<int, int>(reporter, 1)));
-      ++reporters;
-      ++reports;
-      dout(10) << "osd." << reporter
-               << " is adding failure report on osd." << target_osd << dendl;
+    if (is_pending_down(target_osd)) {
+      dout(10) << "osd." << target_osd << " is already going down" << dendl;
+      paxos->wait_for_commit(new C_Reported(this, m));
+      return true;
     }
 
-    if ((reporters >= g_conf->osd_min_down_reporters) &&
-        (reports >= g_conf->osd_min_down_reports)) {
+    failure_info_t& fi = failure_info[target_osd];
+    if (fi.reporters.count(reporter) == 0)
+      dout(10) << "osd." << reporter << " is adding failure report on osd." << target_osd << dendl;
+    else
+      dout(10) << "adding new failure report from osd." << reporter << " on osd." << target_osd << dendl;
+    fi.reporters[reporter]++;
+    fi.num_reports++;
+
+    if ((int)fi.reporters.size() >= g_conf->osd_min_down_reporters &&
+        fi.num_reports >= g_conf->osd_min_down_reports) {
       dout(1) << "have enough reports/reporters to mark osd." << target_osd
               << " as down" << dendl;
-      pending_inc.new_state[target_osd] = CEPH_OSD_UP;
+      mark_failed(target_osd);
+      mark_failed_subtree(target_osd);
       paxos->wait_for_commit(new C_Reported(this, m));
-      //clear out failure reports
-      failed_notes.erase(failed_notes.lower_bound(target_osd),
-                         failed_notes.upper_bound(target_osd));
       return true;
     }
   } else { //remove the report
-    multimap<int, pair<int, int> >::iterator i = failed_notes.lower_bound(target_osd);
-    while ((i != failed_notes.end()) && (i->first == target_osd)
-                                && (i->second.first != reporter))
-      ++i;
-    if ((i == failed_notes.end()) || (i->second.first != reporter))
+    map<int, failure_info_t>::iterator p = failure_info.find(target_osd);
+    map<int, int>::iterator q;
+    if (p == failure_info.end() ||
+	(q = p->second.reporters.find(reporter)) == p->second.reporters.end()) {
       dout(0) << "got an OSD not-failed report from osd." << reporter
               << " that hasn't reported failure! (or in previous epoch?)" << dendl;
-    else failed_notes.erase(i);
+    } else {
+      p->second.num_reports -= q->second;
+      p->second.reporters.erase(q);
+      if (p->second.reporters.empty())
+	failure_info.erase(p);
+    }
   }
-  
+
+  m->put();
   return false;
 }
 
+bool OSDMonitor::is_pending_down(int osd)
+{
+  map<int32_t,uint8_t>::iterator p = pending_inc.new_state.find(osd);
+  return p != pending_inc.new_state.end() && (p->second & CEPH_OSD_UP);
+}
+
+void OSDMonitor::mark_failed(int osd)
+{
+  pending_inc.new_state[osd] = CEPH_OSD_UP;
+  failure_info.erase(osd);
+}
+
+void OSDMonitor::_crush_leaves(int item, vector<int>& leaves)
+{
+  if (item >= 0) {
+    leaves.push_back(item);
+    return;
+  }
+  int n = osdmap.crush->get_bucket_size(item);
+  for (int i = 0; i < n; i++)
+    _crush_leaves(osdmap.crush->get_bucket_item(item, i), leaves);
+}
+
+/*
+ * When a host (or whatever mon_osd_down_subtree_type names) loses
+ * power, its osds are reported one by one as each peer's heartbeat
+ * grace runs out.  Once enough of the bucket is down, take down the
+ * rest of its osds that anyone has reported, so the whole bucket goes
+ * down in the same epoch and everyone peers once.
+ */
+void OSDMonitor::mark_failed_subtree(int osd)
+{
+  double ratio = g_conf->mon_osd_down_subtree_ratio;
+  if (ratio <= 0)
+    return;
+  CrushWrapper *crush = osdmap.crush.get();
+  int type = crush->get_type_id(g_conf->mon_osd_down_subtree_type.c_str());
+  if (type <= 0)
+    return;
+
+  if (crush_parent_epoch != osdmap.get_epoch()) {
+    crush_parent.clear();
+    int max = crush->get_max_buckets();
+    for (int i = 0; i < max; i++) {
+      int id = -1 - i;
+      if (!crush->bucket_exists(id))
+	continue;
+      int n = crush->get_bucket_size(id);
+      for (int j = 0; j < n; j++)
+	crush_parent[crush->get_bucket_item(id, j)] = id;
+    }
+    crush_parent_epoch = osdmap.get_epoch();
+  }
+
+  int b = osd;
+  do {
+    map<int, int>::iterator p = crush_parent.find(b);
+    if (p == crush_parent.end())
+      return;
+    b = p->second;
+  } while (crush->get_bucket_type(b) != type);
+
+  vector<int> leaves;
+  _crush_leaves(b, leaves);
+  unsigned up = 0, down = 0;
+  for (unsigned i = 0; i < leaves.size(); i++) {
+    if (!osdmap.is_up(leaves[i]))
+      continue;
+    up++;
+    if (is_pending_down(leaves[i]))
+      down++;
+  }
+  if (down == up || down < ratio * up)
+    return;
+
+  for (unsigned i = 0; i < leaves.size(); i++) {
+    int o = leaves[i];
+    if (osdmap.is_up(o) && !is_pending_down(o) && failure_info.count(o)) {
+      dout(1) << "marking osd." << o << " down with the rest of bucket "
+	      << b << " (" << down << "/" << up << " down)" << dendl;
+      mark_failed(o);
+    }
+  }
+}
+
 void OSDMonitor::_reported_failure(MOSDFailure *m)
 {
   dout(7) << "_reported_failure on " << m->get_target() << ", telling " << m->get_orig_source_inst() << dendl;
@@ -610,6 +692,7 @@ bool OSDMonitor::prepare_boot(MOSDBoot *m)
     // mark new guy up.
     if (g_conf->mon_osd_auto_mark_in)
       down_pending_out.erase(from);  // if any
+    failure_info.erase(from);
 
     pending_inc.new_up_client[from] = m->get_orig_source_addr();
     if (!m->cluster_addr.is_blank_ip())
@@ -745,14 +828,14 @@ bool OSDMonitor::preprocess_pgtemp(MOSDPGTemp *m)
 
   for (map<pg_t,vector<int> >::iterator p = m->pg_temp.begin(); p != m->pg_temp.end(); p++) {
     dout(20) << " " << p->first
-	     << (osdmap.pg_temp.count(p->first) ? osdmap.pg_temp[p->first] : empty)
+	     << (osdmap.pg_temp->count(p->first) ? (*osdmap.pg_temp)[p->first] : empty)
 	     << " -> " << p->second << dendl;
     // removal?
-    if (p->second.empty() && osdmap.pg_temp.count(p->first))
+    if (p->second.empty() && osdmap.pg_temp->count(p->first))
       return false;
     // change?
-    if (p->second.size() && (osdmap.pg_temp.count(p->first) == 0 ||
-			     osdmap.pg_temp[p->first] != p->second))
+    if (p->second.size() && (osdmap.pg_temp->count(p->first) == 0 ||
+			     (*osdmap.pg_temp)[p->first] != p->second))
       return false;
   }
 
@@ -902,9 +985,38 @@ void OSDMonitor::send_latest(PaxosServiceMessage *m, epoch_t start)
 }
 
 
+bool OSDMonitor::get_map_bl(map<epoch_t,bufferlist>& cache, const char *a, epoch_t e,
+			    bufferlist& bl)
+{
+  map<epoch_t,bufferlist>::iterator p = cache.find(e);
+  if (p != cache.end()) {
+    bl = p->second;
+    return true;
+  }
+  if (mon->store->get_bl_sn(bl, a, e) <= 0)
+    return false;
+  cache_map_bl(cache, e, bl);
+  return true;
+}
+
+void OSDMonitor::cache_map_bl(map<epoch_t,bufferlist>& cache, epoch_t e, const bufferlist& bl)
+{
+  unsigned max = g_conf->mon_osd_cache_size;
+  if (!max)
+    return;
+  cache[e] = bl;
+  while (cache.size() > max)
+    cache.erase(cache.begin());
+}
+
 MOSDMap *OSDMonitor::build_latest_full()
 {
-  MOSDMap *r = new MOSDMap(mon->monmap->fsid, &osdmap);
+  MOSDMap *r = new MOSDMap(mon->monmap->fsid);
+  epoch_t e = osdmap.get_epoch();
+  if (!get_map_bl(full_cache, "osdmap_full", e, r->maps[e])) {
+    r->maps[e].clear();
+    osdmap.encode(r->maps[e]);
+  }
   r->oldest_map = paxos->get_first_committed();
   r->newest_map = osdmap.get_epoch();
   return r;
@@ -921,11 +1033,11 @@ MOSDMap *OSDMonitor::build_incremental(epoch_t from, epoch_t to)
        e >= from && e > 0;
        e--) {
     bufferlist bl;
-    if (mon->store->get_bl_sn(bl, "osdmap", e) > 0) {
+    if (get_map_bl(inc_cache, "osdmap", e, bl)) {
       dout(20) << "build_incremental    inc " << e << " " << bl.length() << " bytes" << dendl;
       m->incremental_maps[e] = bl;
     } 
-    else if (mon->store->get_bl_sn(bl, "osdmap_full", e) > 0) {
+    else if (get_map_bl(full_cache, "osdmap_full", e, bl)) {
       dout(20) << "build_incremental   full " << e << " " << bl.length() << " bytes" << dendl;
       m->maps[e] = bl;
     }
@@ -949,7 +1061,7 @@ void OSDMonitor::send_incremental(PaxosServiceMessage *req, epoch_t first)
   if (first < paxos->get_first_committed()) {
     first = paxos->get_first_committed();
     bufferlist bl;
-    mon->store->get_bl_sn(bl, "osdmap_full", first);
+    get_map_bl(full_cache, "osdmap_full", first, bl);
     dout(20) << "send_incremental starting with base full " << first << " " << bl.length() << " bytes" << dendl;
     MOSDMap *m = new MOSDMap(osdmap.get_fsid());
     m->oldest_map = paxos->get_first_committed();
@@ -972,7 +1084,7 @@ void OSDMonitor::send_incremental(epoch_t first, entity_inst_t& dest, bool oneti
   if (first < paxos->get_first_committed()) {
     first = paxos->get_first_committed();
     bufferlist bl;
-    mon->store->get_bl_sn(bl, "osdmap_full", first);
+    get_map_bl(full_cache, "osdmap_full", first, bl);
     dout(20) << "send_incremental starting with base full " << first << " " << bl.length() << " bytes" << dendl;
     MOSDMap *m = new MOSDMap(osdmap.get_fsid());
     m->oldest_map = paxos->get_first_committed();
@@ -1031,6 +1143,34 @@ void OSDMonitor::check_sub(Subscription *sub)
   }
 }
 
+/*
+ * Push new epochs to a few random up osds among those with a session
+ * to us; they gossip them on to the rest (OSD::gossip_map), so we
+ * don't pay for every osd fetching each epoch from us.  Osds that miss
+ * out still catch up from peers or, on their next pg stats report,
+ * from us.
+ */
+void OSDMonitor::seed_osds(epoch_t first)
+{
+  int n = g_conf->mon_osd_map_seed;
+  if (n <= 0 || first > osdmap.get_epoch())
+    return;
+
+  vector<MonSession*> up;
+  for (multimap<int,MonSession*>::iterator p = mon->session_map.by_osd.begin();
+       p != mon->session_map.by_osd.end();
+       ++p)
+    if (osdmap.is_up(p->first))
+      up.push_back(p->second);
+  for (int i = 0; i < n && i < (int)up.size(); i++) {
+    int j = i + rand() % (up.size() - i);
+    swap(up[i], up[j]);
+    dout(10) << "seed_osds [" << first << ".." << osdmap.get_epoch() << "] to "
+	     << up[i]->inst << dendl;
+    send_incremental(first, up[i]->inst, false);
+  }
+}
+
 // TICK
 
 
@@ -1284,7 +1424,7 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
 	  ss << "got osdmap epoch " << p->get_epoch();
 	  r = 0;
 	} else if (cmd == "getcrushmap") {
-	  p->crush.encode(rdata);
+	  p->crush->encode(rdata);
 	  ss << "got crush map from osdmap epoch " << p->get_epoch();
 	  r = 0;
 	}
@@ -1385,6 +1525,34 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
       ss << "listed " << osdmap.blacklist.size() << " entries";
       r = 0;
     }
+    else if (m->cmd.size() >= 3 && m->cmd[1] == "pool" && m->cmd[2] == "get") {
+      if (m->cmd.size() != 5) {
+	r = -EINVAL;
+	ss << "usage: osd pool get <poolname> <field>";
+	goto out;
+      }
+      int64_t pool = osdmap.lookup_pg_pool_name(m->cmd[3].c_str());
+      if (pool < 0) {
+	ss << "unrecognized pool '" << m->cmd[3] << "'";
+	r = -ENOENT;
+	goto out;
+      }
+
+      const pg_pool_t *p = osdmap.get_pg_pool(pool);
+      r = 0;
+      if (m->cmd[4] == "pg_num") {
+	ss << "PG_NUM: " << p->get_pg_num();
+      } else if (m->cmd[4] == "pgp_num") {
+	ss << "PGP_NUM: " << p->get_pgp_num();
+      } else if (m->cmd[4] == "lpg_num") {
+	ss << "LPG_NUM: " << p->get_lpg_num();
+      } else if (m->cmd[4] == "lpgp_num") {
+	ss << "LPPG_NUM: " << p->get_lpgp_num();
+      } else {
+	ss << "don't know how to get pool field " << m->cmd[4];
+	r = -EINVAL;
+      }
+    }
   }
  out:
   if (r != -1) {
@@ -1497,7 +1665,7 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	if (pending_inc.crush.length())
 	  bl = pending_inc.crush;
 	else
-	  osdmap.crush.encode(bl);
+	  osdmap.crush->encode(bl);
 
 	CrushWrapper newcrush;
 	bufferlist::iterator p = bl.begin();
@@ -1530,7 +1698,7 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	if (pending_inc.crush.length())
 	  bl = pending_inc.crush;
 	else
-	  osdmap.crush.encode(bl);
+	  osdmap.crush->encode(bl);
 
 	CrushWrapper newcrush;
 	bufferlist::iterator p = bl.begin();
@@ -1559,7 +1727,7 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	if (pending_inc.crush.length())
 	  bl = pending_inc.crush;
 	else
-	  osdmap.crush.encode(bl);
+	  osdmap.crush->encode(bl);
 
 	CrushWrapper newcrush;
 	bufferlist::iterator p = bl.begin();
@@ -1586,10 +1754,10 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
     }
     else if (m->cmd[1] == "setmaxosd" && m->cmd.size() > 2) {
       int newmax = atoi(m->cmd[2].c_str());
-      if (newmax < osdmap.crush.get_max_devices()) {
+      if (newmax < osdmap.crush->get_max_devices()) {
 	err = -ERANGE;
 	ss << "cannot set max_osd to " << newmax << " which is < crush max_devices "
-	   << osdmap.crush.get_max_devices();
+	   << osdmap.crush->get_max_devices();
 	goto out;
       }
 
@@ -1913,6 +2081,8 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	  int ret = _prepare_remove_pool(pool);
 	  if (ret == 0)
 	    ss << "pool '" << m->cmd[3] << "' deleted";
+	  else if (ret == -EBUSY)
+	    ss << "pool '" << m->cmd[3] << "' has tiers or is a tier; remove them first";
 	  getline(ss, rs);
 	  paxos->wait_for_commit(new Monitor::C_Command(mon, m, ret, rs, paxos->get_version()));
 	  return true;
@@ -1931,7 +2101,8 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	  const pg_pool_t *p = osdmap.get_pg_pool(pool);
 	  const char *start = m->cmd[5].c_str();
 	  char *end = (char *)start;
-	  unsigned n = strtol(start, &end, 10);
+	  uint64_t n64 = strtoull(start, &end, 10);
+	  unsigned n = n64;
 	  if (*end == '\0') {
 	    if (m->cmd[4] == "size") {
 	      if (pending_inc.new_pools.count(pool) == 0)
@@ -1950,6 +2121,51 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	      getline(ss, rs);
 	      paxos->wait_for_commit(new Monitor::C_Command(mon, m, 0, rs, paxos->get_version()));
 	      return true;
+	    } else if (m->cmd[4] == "op_rate_limit" || m->cmd[4] == "byte_rate_limit") {
+	      if (pending_inc.new_pools.count(pool) == 0)
+		pending_inc.new_pools[pool] = *p;
+	      if (m->cmd[4] == "op_rate_limit")
+		pending_inc.new_pools[pool].op_rate_limit = n;
+	      else
+		pending_inc.new_pools[pool].byte_rate_limit = n;
+	      ss << "set pool " << pool << " " << m->cmd[4] << " to " << n;
+	      getline(ss, rs);
+	      paxos->wait_for_commit(new Monitor::C_Command(mon, m, 0, rs, paxos->get_version()));
+	      return true;
+	    } else if (m->cmd[4] == "nojournal") {
+	      if (pending_inc.new_pools.count(pool) == 0)
+		pending_inc.new_pools[pool] = *p;
+	      if (n)
+		pending_inc.new_pools[pool].flags |= pg_pool_t::FLAG_NOJOURNAL;
+	      else
+		pending_inc.new_pools[pool].flags &= ~(uint64_t)pg_pool_t::FLAG_NOJOURNAL;
+	      ss << "set pool " << pool << " nojournal to " << (n ? 1 : 0);
+	      getline(ss, rs);
+	      paxos->wait_for_commit(new Monitor::C_Command(mon, m, 0, rs, paxos->get_version()));
+	      return true;
+	    } else if (m->cmd[4] == "target_max_bytes" ||
+		       m->cmd[4] == "target_max_objects" ||
+		       m->cmd[4] == "cache_min_flush_age" ||
+		       m->cmd[4] == "hit_set_period" ||
+		       m->cmd[4] == "hit_set_count") {
+	      if (pending_inc.new_pools.count(pool) == 0)
+		pending_inc.new_pools[pool] = *p;
+	      pg_pool_t& np = pending_inc.new_pools[pool];
+	      if (m->cmd[4] == "target_max_bytes")
+		np.target_max_bytes = n64;
+	      else if (m->cmd[4] == "target_max_objects")
+		np.target_max_objects = n64;
+	      else if (m->cmd[4] == "cache_min_flush_age")
+		np.cache_min_flush_age = n;
+	      else if (m->cmd[4] == "hit_set_period")
+		np.hit_set_period = n;
+	      else
+		np.hit_set_count = n;
+	      np.last_change = pending_inc.epoch;
+	      ss << "set pool " << pool << " " << m->cmd[4] << " to " << n64;
+	      getline(ss, rs);
+	      paxos->wait_for_commit(new Monitor::C_Command(mon, m, 0, rs, paxos->get_version()));
+	      return true;
 	    } else if (m->cmd[4] == "pg_num") {
 	      if (n <= p->get_pg_num()) {
 		ss << "specified pg_num " << n << " <= current " << p->get_pg_num();
@@ -1985,7 +2201,7 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 		return true;
 	      }
 	    } else if (m->cmd[4] == "crush_ruleset") {
-	      if (osdmap.crush.rule_exists(n)) {
+	      if (osdmap.crush->rule_exists(n)) {
 		if (pending_inc.new_pools.count(pool) == 0)
 		  pending_inc.new_pools[pool] = *p;
 		pending_inc.new_pools[pool].crush_ruleset = n;
@@ -2004,42 +2220,13 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	  }
 	}
       }
-      else if (m->cmd[2] == "get") {
-	if (m->cmd.size() != 5) {
-	  err = -EINVAL;
-	  ss << "usage: osd pool get <poolname> <field>";
-	  goto out;
-	}
-	int64_t pool = osdmap.lookup_pg_pool_name(m->cmd[3].c_str());
-	if (pool < 0) {
-	  ss << "unrecognized pool '" << m->cmd[3] << "'";
-	  err = -ENOENT;
-	  goto out;
-	}
-
-	const pg_pool_t *p = osdmap.get_pg_pool(pool);
-	if (m->cmd[4] == "pg_num") {
-	  ss << "PG_NUM: " << p->get_pg_num();
-	  err = 0;
-	  goto out;
-	}
-	if (m->cmd[4] == "pgp_num") {
-	  ss << "PGP_NUM: " << p->get_pgp_num();
-	  err = 0;
-	  goto out;
-	}
-	if (m->cmd[4] == "lpg_num") {
-	  ss << "LPG_NUM: " << p->get_lpg_num();
-	  err = 0;
-	  goto out;
-	}
-	if (m->cmd[4] == "lpgp_num") {
-	  ss << "LPPG_NUM: " << p->get_lpgp_num();
-	  err = 0;
-	  goto out;
-	}
-	ss << "don't know how to get pool field " << m->cmd[4];
-	goto out;
+    }
+    else if (m->cmd[1] == "tier" && m->cmd.size() >= 4) {
+      err = prepare_command_tier(m->cmd, ss);
+      if (err == 0) {
+	getline(ss, rs);
+	paxos->wait_for_commit(new Monitor::C_Command(mon, m, 0, rs, paxos->get_version()));
+	return true;
       }
     }
     else if ((m->cmd.size() > 1) &&
@@ -2071,6 +2258,131 @@ out:
   return false;
 }
 
+pg_pool_t *OSDMonitor::get_pending_pool(int64_t pool)
+{
+  if (pending_inc.new_pools.count(pool) == 0)
+    pending_inc.new_pools[pool] = *osdmap.get_pg_pool(pool);
+  pending_inc.new_pools[pool].last_change = pending_inc.epoch;
+  return &pending_inc.new_pools[pool];
+}
+
+/*
+ * osd tier add <pool> <tierpool>
+ * osd tier remove <pool> <tierpool>
+ * osd tier cache-mode <tierpool> <none|writeback>
+ * osd tier set-overlay <pool> <tierpool>
+ * osd tier remove-overlay <pool>
+ *
+ * Only one level: a tier can't have tiers of its own.  Returns 0 with
+ * the change in pending_inc, or an error.
+ */
+int OSDMonitor::prepare_command_tier(const vector<string>& cmd, stringstream& ss)
+{
+  const string& op = cmd[2];
+  int64_t pool = osdmap.lookup_pg_pool_name(cmd[3].c_str());
+  if (pool < 0 || pending_inc.old_pools.count(pool)) {
+    ss << "unrecognized pool '" << cmd[3] << "'";
+    return -ENOENT;
+  }
+  const pg_pool_t *p = osdmap.get_pg_pool(pool);
+  if (pending_inc.new_pools.count(pool))
+    p = &pending_inc.new_pools[pool];
+
+  if (op == "cache-mode") {
+    if (cmd.size() != 5) {
+      ss << "usage: osd tier cache-mode <tierpool> <none|writeback>";
+      return -EINVAL;
+    }
+    int mode = pg_pool_t::get_cache_mode_from_str(cmd[4]);
+    if (mode < 0) {
+      ss << "unrecognized cache mode '" << cmd[4] << "'";
+      return -EINVAL;
+    }
+    if (!p->is_tier()) {
+      ss << "pool '" << cmd[3] << "' is not a tier";
+      return -EINVAL;
+    }
+    get_pending_pool(pool)->cache_mode = (pg_pool_t::cache_mode_t)mode;
+    ss << "set cache-mode for pool '" << cmd[3] << "' to " << cmd[4];
+    return 0;
+  }
+
+  if (op == "remove-overlay") {
+    if (!p->has_read_tier() && !p->has_write_tier()) {
+      ss << "there is no overlay for pool '" << cmd[3] << "'";
+      return -ENOENT;
+    }
+    pg_pool_t *np = get_pending_pool(pool);
+    np->clear_read_tier();
+    np->clear_write_tier();
+    ss << "there is now (or already was) no overlay for '" << cmd[3] << "'";
+    return 0;
+  }
+
+  if (cmd.size() != 5 || (op != "add" && op != "remove" && op != "set-overlay")) {
+    ss << "usage: osd tier <add|remove|set-overlay> <pool> <tierpool>";
+    return -EINVAL;
+  }
+  int64_t tierpool = osdmap.lookup_pg_pool_name(cmd[4].c_str());
+  if (tierpool < 0 || pending_inc.old_pools.count(tierpool)) {
+    ss << "unrecognized pool '" << cmd[4] << "'";
+    return -ENOENT;
+  }
+  const pg_pool_t *tp = osdmap.get_pg_pool(tierpool);
+  if (pending_inc.new_pools.count(tierpool))
+    tp = &pending_inc.new_pools[tierpool];
+
+  if (op == "add") {
+    if (tierpool == pool) {
+      ss << "a pool can't be a tier of itself";
+      return -EINVAL;
+    }
+    if (p->tiers.count(tierpool)) {
+      ss << "pool '" << cmd[4] << "' is now (or already was) a tier of '" << cmd[3] << "'";
+      return -EEXIST;
+    }
+    if (tp->is_tier()) {
+      ss << "pool '" << cmd[4] << "' is already a tier of another pool";
+      return -EINVAL;
+    }
+    if (p->is_tier() || tp->has_tiers()) {
+      ss << "tiers can't be nested";
+      return -EINVAL;
+    }
+    if (!tp->snaps.empty() || !tp->removed_snaps.empty()) {
+      ss << "pool '" << cmd[4] << "' has snapshots; a cache tier can't";
+      return -EINVAL;
+    }
+    get_pending_pool(pool)->tiers.insert(tierpool);
+    get_pending_pool(tierpool)->tier_of = pool;
+    ss << "pool '" << cmd[4] << "' is now a tier of '" << cmd[3] << "'";
+    return 0;
+  }
+
+  if (!p->tiers.count(tierpool) || tp->tier_of != pool) {
+    ss << "pool '" << cmd[4] << "' is not a tier of '" << cmd[3] << "'";
+    return -ENOENT;
+  }
+
+  if (op == "remove") {
+    if (p->read_tier == tierpool || p->write_tier == tierpool) {
+      ss << "pool '" << cmd[4] << "' is the overlay for '" << cmd[3]
+	 << "'; remove-overlay first";
+      return -EBUSY;
+    }
+    get_pending_pool(pool)->tiers.erase(tierpool);
+    get_pending_pool(tierpool)->clear_tier();
+    ss << "pool '" << cmd[4] << "' is now (or already was) not a tier of '" << cmd[3] << "'";
+    return 0;
+  }
+
+  // set-overlay
+  pg_pool_t *np = get_pending_pool(pool);
+  np->read_tier = np->write_tier = tierpool;
+  ss << "overlay for '" << cmd[3] << "' is now (or already was) '" << cmd[4] << "'";
+  return 0;
+}
+
 bool OSDMonitor::preprocess_pool_op(MPoolOp *m) 
 {
   if (m->op == POOL_OP_CREATE)
@@ -2247,11 +2559,18 @@ int OSDMonitor::_prepare_remove_pool(uint64_t pool)
     dout(10) << "_prepare_remove_pool " << pool << " pending removal" << dendl;    
     return -ENOENT;  // already removed
   }
+  const pg_pool_t *p = osdmap.get_pg_pool(pool);
+  if (pending_inc.new_pools.count(pool))
+    p = &pending_inc.new_pools[pool];
+  if (p && (p->is_tier() || p->has_tiers())) {
+    dout(10) << "_prepare_remove_pool " << pool << " is tiered" << dendl;
+    return -EBUSY;
+  }
   pending_inc.old_pools.insert(pool);
 
   // remove any pg_temp mappings for this pool too
-  for (map<pg_t,vector<int32_t> >::iterator p = osdmap.pg_temp.begin();
-       p != osdmap.pg_temp.end();
+  for (map<pg_t,vector<int32_t> >::iterator p = osdmap.pg_temp->begin();
+       p != osdmap.pg_temp->end();
        ++p)
     if (p->first.pool() == pool) {
       dout(10) << "_prepare_remove_pool " << pool << " removing obsolete pg_temp "
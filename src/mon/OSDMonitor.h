@@ -45,10 +45,25 @@ private:
 
   // [leader]
   OSDMap::Incremental pending_inc;
-  multimap<int, pair<int, int> > failed_notes; // <failed_osd, <reporter, #reports> >
+  struct failure_info_t {
+    map<int, int> reporters;  // reporter -> #reports
+    int num_reports;
+    failure_info_t() : num_reports(0) {}
+  };
+  map<int, failure_info_t> failure_info;  // failed osd -> who says so
+  epoch_t crush_parent_epoch;
+  map<int, int> crush_parent;             // crush item -> containing bucket
   map<int,utime_t>    down_pending_out;  // osd down -> out
 
   map<int,double> osd_weight;
+
+  /*
+   * Encoded maps for recent epochs.  Every message that carries one
+   * shares these buffers instead of reading (or copying) its own.
+   */
+  map<epoch_t,bufferlist> inc_cache, full_cache;
+  bool get_map_bl(map<epoch_t,bufferlist>& cache, const char *a, epoch_t e, bufferlist& bl);
+  void cache_map_bl(map<epoch_t,bufferlist>& cache, epoch_t e, const bufferlist& bl);
   // svc
 public:  
   void create_initial(bufferlist& bl);
@@ -78,6 +93,10 @@ private:
   bool preprocess_failure(class MOSDFailure *m);
   bool prepare_failure(class MOSDFailure *m);
   void _reported_failure(MOSDFailure *m);
+  bool is_pending_down(int osd);
+  void mark_failed(int osd);
+  void mark_failed_subtree(int osd);
+  void _crush_leaves(int item, vector<int>& leaves);
 
   bool preprocess_boot(class MOSDBoot *m);
   bool prepare_boot(class MOSDBoot *m);
@@ -162,6 +181,8 @@ private:
   enum health_status_t get_health(std::ostream &ss) const;
   bool preprocess_command(MMonCommand *m);
   bool prepare_command(MMonCommand *m);
+  int prepare_command_tier(const vector<string>& cmd, stringstream& ss);
+  pg_pool_t *get_pending_pool(int64_t pool);
 
   void handle_osd_timeouts(const utime_t &now,
 			   const std::map<int,utime_t> &last_osd_report);
@@ -176,6 +197,7 @@ private:
 
   void check_subs();
   void check_sub(Subscription *sub);
+  void seed_osds(epoch_t first);
 
   void add_flag(int flag) {
     if (!(osdmap.flags & flag)) {
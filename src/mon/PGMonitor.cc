@@ -117,8 +117,9 @@ bool PGMonitor::update_from_paxos()
   if (paxosv == pg_map.version) return true;
   assert(paxosv >= pg_map.version);
 
-  if (pg_map.version == 0 && paxosv > 1) {
-    // starting up: load latest
+  if ((pg_map.version == 0 && paxosv > 1) ||
+      pg_map.version + 1 < paxos->get_first_committed()) {
+    // starting up, or our incrementals were trimmed: load latest
     bufferlist latest;
     version_t v = paxos->get_latest(latest);
     if (v) {
@@ -166,10 +167,17 @@ bool PGMonitor::update_from_paxos()
 
   assert(paxosv == pg_map.version);
 
-  // save latest
-  bufferlist bl;
-  pg_map.encode(bl);
-  paxos->stash_latest(paxosv, bl);
+  // save latest.  a full map of many pgs is costly to encode and
+  // write, so only every mon_pg_stash_interval versions; the
+  // incrementals since then are kept (trim_to stops at the stash) and
+  // startup replays them.
+  version_t stashed = paxos->get_stashed_version();
+  if (!stashed || stashed > paxosv ||
+      paxosv - stashed >= (unsigned)MAX(1, g_conf->mon_pg_stash_interval)) {
+    bufferlist bl;
+    pg_map.encode(bl);
+    paxos->stash_latest(paxosv, bl);
+  }
 
   // dump pgmap summaries?  (useful for debugging)
   if (0) {
@@ -453,19 +461,21 @@ bool PGMonitor::prepare_pg_stats(MPGStats *stats)
     pg_t pgid = p->first;
     ack->pg_stat[pgid] = p->second.reported;
 
-    if ((pg_map.pg_stat.count(pgid) && 
-	 pg_map.pg_stat[pgid].reported > p->second.reported)) {
-      dout(15) << " had " << pgid << " from " << pg_map.pg_stat[pgid].reported << dendl;
+    hash_map<pg_t,pg_stat_t>::iterator cur = pg_map.pg_stat.find(pgid);
+    if (cur != pg_map.pg_stat.end() &&
+	cur->second.reported > p->second.reported) {
+      dout(15) << " had " << pgid << " from " << cur->second.reported << dendl;
       continue;
     }
-    if (pending_inc.pg_stat_updates.count(pgid) && 
-	pending_inc.pg_stat_updates[pgid].reported > p->second.reported) {
-      dout(15) << " had " << pgid << " from " << pending_inc.pg_stat_updates[pgid].reported
+    map<pg_t,pg_stat_t>::iterator pend = pending_inc.pg_stat_updates.find(pgid);
+    if (pend != pending_inc.pg_stat_updates.end() &&
+	pend->second.reported > p->second.reported) {
+      dout(15) << " had " << pgid << " from " << pend->second.reported
 	       << " (pending)" << dendl;
       continue;
     }
 
-    if (pg_map.pg_stat.count(pgid) == 0) {
+    if (cur == pg_map.pg_stat.end()) {
       dout(15) << " got " << pgid << " reported at " << p->second.reported
 	       << " state " << pg_state_string(p->second.state)
 	       << " but DNE in pg_map; pool was probably deleted."
@@ -475,7 +485,7 @@ bool PGMonitor::prepare_pg_stats(MPGStats *stats)
       
     dout(15) << " got " << pgid
 	     << " reported at " << p->second.reported
-	     << " state " << pg_state_string(pg_map.pg_stat[pgid].state)
+	     << " state " << pg_state_string(cur->second.state)
 	     << " -> " << pg_state_string(p->second.state)
 	     << dendl;
     pending_inc.pg_stat_updates[pgid] = p->second;
@@ -625,7 +635,7 @@ bool PGMonitor::register_new_pgs()
     int64_t poolid = p->first;
     pg_pool_t &pool = p->second;
     int ruleno = pool.get_crush_ruleset();
-    if (!osdmap->crush.rule_exists(ruleno)) 
+    if (!osdmap->crush->rule_exists(ruleno)) 
       continue;
 
     if (pool.get_last_change() <= pg_map.last_pg_scan ||
@@ -661,7 +671,7 @@ bool PGMonitor::register_new_pgs()
     }
   }
 
-  int max = MIN(osdmap->get_max_osd(), osdmap->crush.get_max_devices());
+  int max = MIN(osdmap->get_max_osd(), osdmap->crush->get_max_devices());
   int removed = 0;
   for (set<pg_t>::iterator p = pg_map.creating_pgs.begin();
        p != pg_map.creating_pgs.end();
@@ -706,7 +716,7 @@ void PGMonitor::send_pg_creates()
   utime_t now = ceph_clock_now(g_ceph_context);
   
   OSDMap *osdmap = &mon->osdmon()->osdmap;
-  int max = MIN(osdmap->get_max_osd(), osdmap->crush.get_max_devices());
+  int max = MIN(osdmap->get_max_osd(), osdmap->crush->get_max_devices());
 
   for (set<pg_t>::iterator p = pg_map.creating_pgs.begin();
        p != pg_map.creating_pgs.end();
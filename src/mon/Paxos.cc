@@ -193,18 +193,20 @@ void Paxos::store_state(MMonPaxos *m)
   // stash?
   if (m->latest_version && m->latest_version > last_committed) {
     dout(10) << "store_state got stash version " << m->latest_version << ", zapping old states" << dendl;
+    mon->store->start_transaction();
     stash_latest(m->latest_version, m->latest_value);
 
-    while (first_committed <= last_committed) {
-      dout(10) << "store_state trim " << first_committed << dendl;
-      mon->store->erase_sn(machine_name, first_committed);
-      first_committed++;
+    if (first_committed <= last_committed) {
+      dout(10) << "store_state trim [" << first_committed << ".." << last_committed << "]" << dendl;
+      mon->store->erase_sn_range(machine_name, first_committed, last_committed);
     }
     last_committed = m->latest_version;
     first_committed = last_committed;
     mon->store->put_int(first_committed, machine_name, "first_committed");
     mon->store->put_int(last_committed, machine_name, "last_committed");
-    return;
+    mon->store->commit_transaction();
+    // the stash may be older than the newest version; store the
+    // incrementals that follow it, too.
   }
 
   // build map of values to store
@@ -236,9 +238,11 @@ void Paxos::store_state(MMonPaxos *m)
     dout(10) << "store_state nothing to commit" << dendl;
   } else {
     dout(10) << "store_state [" << start->first << ".." << last_committed << "]" << dendl;
+    mon->store->start_transaction();
     mon->store->put_bl_sn_map(machine_name, start, end);
     mon->store->put_int(last_committed, machine_name, "last_committed");
     mon->store->put_int(first_committed, machine_name, "first_committed");
+    mon->store->commit_transaction();
   }
 }
 
@@ -357,6 +361,7 @@ void Paxos::begin(bufferlist& v)
   // accept it ourselves
   accepted.clear();
   accepted.insert(mon->rank);
+  accepting_v = last_committed+1;
   new_value = v;
   mon->store->put_bl_sn(new_value, machine_name, last_committed+1);
 
@@ -436,8 +441,8 @@ void Paxos::handle_accept(MMonPaxos *accept)
     accept->put();
     return;
   }
-  if (last_committed > 0 &&
-      accept->last_committed < last_committed-1) {
+  if (!is_updating() || accept->last_committed+1 != accepting_v) {
+    // with paxos_pipeline, stragglers answer rounds we have finished
     dout(10) << " this is from an old round, ignoring" << dendl;
     accept->put();
     return;
@@ -445,13 +450,13 @@ void Paxos::handle_accept(MMonPaxos *accept)
   assert(accept->last_committed == last_committed ||   // not committed
 	 accept->last_committed == last_committed-1);  // committed
 
-  assert(state == STATE_UPDATING);
   assert(accepted.count(from) == 0);
   accepted.insert(from);
   dout(10) << " now " << accepted << " have accepted" << dendl;
 
   // new majority?
-  if (accepted.size() == (unsigned)mon->monmap->size()/2+1) {
+  bool majority = (accepted.size() == (unsigned)mon->monmap->size()/2+1);
+  if (majority) {
     // yay, commit!
     // note: this may happen before the lease is reextended (below)
     dout(10) << " got majority, committing" << dendl;
@@ -459,8 +464,13 @@ void Paxos::handle_accept(MMonPaxos *accept)
   }
 
   // done?
-  if (accepted == mon->get_quorum()) {
-    dout(10) << " got quorum, done with update" << dendl;
+  //  once a majority has it the value is safe, so with paxos_pipeline
+  //  we start the next round without waiting for the rest.  they get
+  //  the commit, and then the lease, ahead of the next begin.
+  if (accepted == mon->get_quorum() ||
+      (majority && g_conf->paxos_pipeline)) {
+    dout(10) << " got " << (accepted == mon->get_quorum() ? "quorum" : "majority")
+	     << ", done with update" << dendl;
     // cancel timeout event
     mon->timer.cancel_event(accept_timeout_event);
     accept_timeout_event = 0;
@@ -499,11 +509,13 @@ void Paxos::commit()
   // commit locally
   last_committed++;
   last_commit_time = ceph_clock_now(g_ceph_context);
+  mon->store->start_transaction();
   mon->store->put_int(last_committed, machine_name, "last_committed");
   if (!first_committed) {
     first_committed = last_committed;
     mon->store->put_int(last_committed, machine_name, "first_committed");
   }
+  mon->store->commit_transaction();
 
   // tell everyone
   for (set<int>::const_iterator p = mon->get_quorum().begin();
@@ -724,17 +736,20 @@ void Paxos::trim_to(version_t first)
   if (first_committed >= first)
     return;
 
-  while (first_committed < first &&
-	 first_committed < last_consumed) {
-    dout(10) << "trim " << first_committed << dendl;
-    mon->store->erase_sn(machine_name, first_committed);
-    for (list<string>::iterator p = extra_state_dirs.begin();
-	 p != extra_state_dirs.end();
-	 ++p)
-      mon->store->erase_sn(p->c_str(), first_committed);
-    first_committed++;
-  }
+  version_t to = MIN(first, last_consumed);
+  if (first_committed >= to)
+    return;
+
+  dout(10) << "trim [" << first_committed << ".." << to << ")" << dendl;
+  mon->store->start_transaction();
+  mon->store->erase_sn_range(machine_name, first_committed, to - 1);
+  for (list<string>::iterator p = extra_state_dirs.begin();
+       p != extra_state_dirs.end();
+       ++p)
+    mon->store->erase_sn_range(p->c_str(), first_committed, to - 1);
+  first_committed = to;
   mon->store->put_int(first_committed, machine_name, "first_committed");
+  mon->store->commit_transaction();
 }
 
 /*
@@ -1029,8 +1044,10 @@ void Paxos::stash_latest(version_t v, bufferlist& bl)
   ::encode(bl, final);
   
   dout(10) << "stash_latest v" << v << " len " << bl.length() << dendl;
+  mon->store->start_transaction();
   mon->store->put_bl_ss(final, machine_name, "latest");
   mon->store->put_int(v, machine_name, "last_consumed");
+  mon->store->commit_transaction();
 
   latest_stashed = v;
 }
@@ -137,6 +137,7 @@ private:
 
   // updating (paxos phase 2)
   bufferlist new_value;
+  version_t  accepting_v;   // version the current round proposes
   set<int>   accepted;
 
   Context    *accept_timeout_event;
@@ -240,6 +241,7 @@ public:
 		   lease_renew_event(0),
 		   lease_ack_timeout_event(0),
 		   lease_timeout_event(0),
+		   accepting_v(0),
 		   accept_timeout_event(0),
 		   clock_drift_warned(0) { }
 
@@ -271,6 +273,7 @@ public:
   
   // read
   version_t get_version() { return last_committed; }
+  utime_t get_last_commit_time() { return last_commit_time; }
   bool is_readable(version_t seen=0);
   bool read(version_t v, bufferlist &bl);
   version_t read_current(bufferlist &bl);
@@ -301,6 +304,7 @@ public:
   version_t get_latest(bufferlist& bl);
 
   version_t get_first_committed() { return first_committed; }
+  version_t get_stashed_version() { return latest_stashed; }
 
   void register_observer(entity_inst_t inst, version_t v);
   void update_observers();
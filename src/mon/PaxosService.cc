@@ -15,6 +15,7 @@
 #include "PaxosService.h"
 #include "common/Clock.h"
 #include "Monitor.h"
+#include "MonitorStore.h"
 
 
 
@@ -141,6 +142,39 @@ void PaxosService::propose_pending()
   paxos->propose_new_value(bl);
 }
 
+/*
+ * Our proposal timer went off.  Services that are only waiting out
+ * their own timers go now too (paxos_propose_batch), so that under a
+ * storm of updates the rounds run side by side and their store writes
+ * share one commit, instead of each paying its own sync in turn.
+ *
+ * Sharing the commit is safe because the leader's own accept only
+ * counts once we handle the peons' replies, after it is on disk.  A
+ * lone monitor commits, and may reply to clients, at once; there we
+ * leave each write to sync itself.
+ */
+void PaxosService::propose_batch()
+{
+  bool txn = mon->get_quorum().size() > 1;
+  if (txn)
+    mon->store->start_transaction();
+  propose_pending();
+  if (g_conf->paxos_propose_batch) {
+    for (vector<PaxosService*>::iterator p = mon->paxos_service.begin();
+	 p != mon->paxos_service.end();
+	 ++p) {
+      PaxosService *svc = *p;
+      if (svc == this || !svc->proposal_timer || !svc->have_pending ||
+	  !svc->paxos->is_active())
+	continue;
+      dout(10) << "propose_batch also proposing " << svc->get_machine_name() << dendl;
+      svc->propose_pending();
+    }
+  }
+  if (txn)
+    mon->store->commit_transaction();
+}
+
 
 
 void PaxosService::election_starting()
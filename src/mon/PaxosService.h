@@ -62,7 +62,7 @@ protected:
     C_Propose(PaxosService *p) : ps(p) { }
     void finish(int r) { 
       ps->proposal_timer = 0;
-      ps->propose_pending(); 
+      ps->propose_batch();
     }
   };	
   friend class C_Propose;
@@ -92,6 +92,7 @@ private:
 public:
   // i implement and you use
   void propose_pending();     // propose current pending as new paxos state
+  void propose_batch();       // ...along with other services' timed proposals
   bool dispatch(PaxosServiceMessage *m);
 
   // you implement
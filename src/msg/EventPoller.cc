@@ -0,0 +1,154 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "EventPoller.h"
+#include "common/config.h"
+#include "common/debug.h"
+#include "common/errno.h"
+
+#define DOUT_SUBSYS ms
+#undef dout_prefix
+#define dout_prefix *_dout << "eventpoller(" << this << ") "
+
+#define EVENTPOLLER_MAX_EVENTS 64
+
+int EventPoller::start(int nworkers, size_t stack_bytes)
+{
+  assert(workers.empty());
+  assert(nworkers > 0);
+
+  if (::pipe(stop_fds) < 0) {
+    int r = -errno;
+    lderr(cct) << "start failed to create stop pipe: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+
+  for (int i = 0; i < nworkers; i++) {
+    Worker *w = new Worker(this);
+    w->epfd = ::epoll_create(EVENTPOLLER_MAX_EVENTS);
+    if (w->epfd < 0) {
+      int r = -errno;
+      lderr(cct) << "start epoll_create failed: " << cpp_strerror(r) << dendl;
+      delete w;
+      stop();
+      return r;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;  // the stop pipe
+    if (::epoll_ctl(w->epfd, EPOLL_CTL_ADD, stop_fds[0], &ev) < 0) {
+      int r = -errno;
+      lderr(cct) << "start failed to watch stop pipe: " << cpp_strerror(r) << dendl;
+      ::close(w->epfd);
+      delete w;
+      stop();
+      return r;
+    }
+    workers.push_back(w);
+    w->create(stack_bytes);
+  }
+  ldout(cct, 10) << "start " << nworkers << " workers" << dendl;
+  return 0;
+}
+
+void EventPoller::stop()
+{
+  if (stop_fds[1] >= 0) {
+    ldout(cct, 10) << "stop" << dendl;
+    char c = 0;
+    int r = ::write(stop_fds[1], &c, 1);
+    r++; // placate gcc
+  }
+  for (std::vector<Worker*>::iterator p = workers.begin(); p != workers.end(); ++p) {
+    (*p)->join();
+    ::close((*p)->epfd);
+    delete *p;
+  }
+  workers.clear();
+  for (int i = 0; i < 2; i++) {
+    if (stop_fds[i] >= 0) {
+      ::close(stop_fds[i]);
+      stop_fds[i] = -1;
+    }
+  }
+}
+
+int EventPoller::add(int fd, Handler *h)
+{
+  assert(is_started());
+  int w = next_worker.inc() % workers.size();
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  ev.data.ptr = h;
+  if (::epoll_ctl(workers[w]->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    int r = -errno;
+    ldout(cct, 1) << "add fd " << fd << " failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ldout(cct, 20) << "add fd " << fd << " on worker " << w << dendl;
+  return w;
+}
+
+int EventPoller::rearm(int fd, int w, Handler *h)
+{
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  ev.data.ptr = h;
+  if (::epoll_ctl(workers[w]->epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+    int r = -errno;
+    ldout(cct, 1) << "rearm fd " << fd << " failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  return 0;
+}
+
+void EventPoller::remove(int fd, int w)
+{
+  ldout(cct, 20) << "remove fd " << fd << " from worker " << w << dendl;
+  struct epoll_event ev;  // ignored, but must be non-NULL on older kernels
+  ::epoll_ctl(workers[w]->epfd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+void *EventPoller::Worker::entry()
+{
+  CephContext *cct = poller->cct;
+  struct epoll_event events[EVENTPOLLER_MAX_EVENTS];
+  ldout(cct, 10) << "worker " << epfd << " start" << dendl;
+  while (true) {
+    int n = ::epoll_wait(epfd, events, EVENTPOLLER_MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+      lderr(cct) << "worker epoll_wait failed: " << cpp_strerror(errno) << dendl;
+      break;
+    }
+    bool stop = false;
+    for (int i = 0; i < n; i++) {
+      Handler *h = (Handler *)events[i].data.ptr;
+      if (!h) {
+	stop = true;
+	continue;
+      }
+      h->handle_event();
+    }
+    if (stop)
+      break;
+  }
+  ldout(cct, 10) << "worker " << epfd << " done" << dendl;
+  return 0;
+}
@@ -0,0 +1,77 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_EVENTPOLLER_H
+#define CEPH_MSG_EVENTPOLLER_H
+
+#include <vector>
+
+#include "common/Thread.h"
+#include "include/atomic.h"
+
+class CephContext;
+
+/*
+ * A small, fixed pool of epoll threads that watch sockets for input.
+ *
+ * Each fd is registered one-shot: when it becomes readable (or hangs
+ * up) its Handler is called on the worker thread that owns it, and the
+ * fd stays quiet until the handler rearm()s it.  A handler is therefore
+ * never run concurrently with itself, and it may remove() its own fd
+ * from inside handle_event().
+ */
+class EventPoller {
+public:
+  class Handler {
+  public:
+    virtual ~Handler() {}
+    virtual void handle_event() = 0;
+  };
+
+private:
+  class Worker : public Thread {
+  public:
+    EventPoller *poller;
+    int epfd;
+    Worker(EventPoller *p) : poller(p), epfd(-1) {}
+    void *entry();
+  };
+
+  CephContext *cct;
+  std::vector<Worker*> workers;
+  atomic_t next_worker;
+  int stop_fds[2];  // readable once stop() is called
+
+public:
+  EventPoller(CephContext *c) : cct(c), next_worker(0) {
+    stop_fds[0] = stop_fds[1] = -1;
+  }
+  ~EventPoller() {
+    stop();
+  }
+
+  int start(int nworkers, size_t stack_bytes);
+  void stop();
+  bool is_started() const { return !workers.empty(); }
+
+  /**
+   * start watching fd.  returns the worker id, which must be passed to
+   * rearm() and remove(), or negative error code.
+   */
+  int add(int fd, Handler *h);
+  int rearm(int fd, int worker, Handler *h);
+  void remove(int fd, int worker);
+};
+
+#endif
@@ -282,15 +282,19 @@ protected:
   // currently throttled.
   uint64_t dispatch_throttle_size;
 
+  // the request this message is part of, if it is being traced (see
+  // Tracer); messages that carry it on the wire set it when decoded
+  uint64_t trace_id;
+
   friend class Messenger;
 
 public:
-  Message() : connection(NULL), dispatch_throttle_size(0) {
+  Message() : connection(NULL), dispatch_throttle_size(0), trace_id(0) {
     memset(&header, 0, sizeof(header));
     memset(&footer, 0, sizeof(footer));
     throttler = NULL;
   };
-  Message(int t) : connection(NULL), dispatch_throttle_size(0) {
+  Message(int t) : connection(NULL), dispatch_throttle_size(0), trace_id(0) {
     memset(&header, 0, sizeof(header));
     header.type = t;
     header.version = 1;
@@ -322,6 +326,9 @@ public:
   void set_throttler(Throttle *t) { throttler = t; }
   Throttle *get_throttler() { return throttler; }
  
+  uint64_t get_trace_id() const { return trace_id; }
+  void set_trace_id(uint64_t t) { trace_id = t; }
+
   void set_dispatch_throttle_size(uint64_t s) { dispatch_throttle_size = s; }
   uint64_t get_dispatch_throttle_size() { return dispatch_throttle_size; }
 
@@ -23,8 +23,12 @@
 #include <sys/uio.h>
 #include <limits.h>
 #include <sys/user.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
 #include "common/config.h"
+#include "common/mempool.h"
 #include "global/global_init.h"
 
 #include "messages/MGenericMessage.h"
@@ -37,6 +41,8 @@
 #include "common/Timer.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
+#include "common/numa.h"
+#include "common/Tracer.h"
 #include "include/page.h"
 
 #define DOUT_SUBSYS ms
@@ -53,6 +59,27 @@ static ostream& _prefix(std::ostream *_dout, SimpleMessenger *msgr) {
  * Accepter
  */
 
+/*
+ * Fixed socket buffer sizes, for links (IPoIB, 10GbE) whose
+ * bandwidth-delay product is beyond what autotuning grows to quickly.
+ * They have to be set before listen() or connect() for the window
+ * scale to be negotiated accordingly; accepted sockets inherit them.
+ */
+static void set_socket_buffers(SimpleMessenger *msgr, int sd)
+{
+  char buf[80];
+  int size = msgr->cct->_conf->ms_tcp_rcvbuf;
+  if (size > 0 &&
+      ::setsockopt(sd, SOL_SOCKET, SO_RCVBUF, (void*)&size, sizeof(size)) < 0)
+    ldout(msgr->cct,0) << "couldn't set SO_RCVBUF to " << size << ": "
+		       << strerror_r(errno, buf, sizeof(buf)) << dendl;
+  size = msgr->cct->_conf->ms_tcp_sndbuf;
+  if (size > 0 &&
+      ::setsockopt(sd, SOL_SOCKET, SO_SNDBUF, (void*)&size, sizeof(size)) < 0)
+    ldout(msgr->cct,0) << "couldn't set SO_SNDBUF to " << size << ": "
+		       << strerror_r(errno, buf, sizeof(buf)) << dendl;
+}
+
 int SimpleMessenger::Accepter::bind(uint64_t nonce, entity_addr_t &bind_addr, int avoid_port1, int avoid_port2)
 {
   const md_config_t *conf = msgr->cct->_conf;
@@ -77,6 +104,7 @@ int SimpleMessenger::Accepter::bind(uint64_t nonce, entity_addr_t &bind_addr, in
 	 << strerror_r(errno, buf, sizeof(buf)) << std::endl;
     return -errno;
   }
+  set_socket_buffers(msgr, listen_sd);
 
   // use whatever user specified (if anything)
   entity_addr_t listen_addr = bind_addr;
@@ -276,97 +304,158 @@ void SimpleMessenger::Accepter::stop()
 //**********************************
 
 /*
- * This function delivers incoming messages to the Messenger.
- * Pipes with messages are kept in queues; when beginning a message
- * delivery the highest-priority queue is selected, the pipe from the
- * front of the queue is removed, and its message read. If the pipe
- * has remaining messages at that priority level, it is re-placed on to the
- * end of the queue. If the queue is empty; it's removed.
- * The message is then delivered and the process starts again.
+ * Pick the next message to deliver.  Pipes with messages are kept in
+ * per-priority queues; the highest-priority queue is always served
+ * first.  Within a priority, pipes are served deficit-round-robin by
+ * message size: each time a pipe comes up it may deliver messages until
+ * it has used up its deficit, after which it earns another
+ * ms_dispatch_quantum bytes and goes to the back of the line.  Thus one
+ * connection streaming large writes cannot starve its neighbors at the
+ * same priority.  Pipes that another dispatch thread is already
+ * delivering from are skipped, so per-connection ordering is kept.
+ *
+ * Must hold dispatch_queue.lock.  On success the pipe is marked as
+ * dispatching and must be released with _dispatch_done().
  */
-void SimpleMessenger::dispatch_entry()
+SimpleMessenger::Pipe *SimpleMessenger::_dispatch_next(Message **pm)
 {
-  dispatch_queue.lock.Lock();
-  while (!dispatch_queue.stop) {
-    while (!dispatch_queue.queued_pipes.empty() && !dispatch_queue.stop) {
-      //get highest-priority pipe
-      map<int, xlist<Pipe *>* >::reverse_iterator high_iter =
-	dispatch_queue.queued_pipes.rbegin();
-      int priority = high_iter->first;
-      xlist<Pipe *> *pipe_list = high_iter->second;
-
+  assert(dispatch_queue.lock.is_locked());
+  uint64_t quantum = cct->_conf->ms_dispatch_quantum;
+
+  for (map<int, xlist<Pipe *>* >::reverse_iterator high_iter =
+	 dispatch_queue.queued_pipes.rbegin();
+       high_iter != dispatch_queue.queued_pipes.rend();
+       ++high_iter) {
+    int priority = high_iter->first;
+    xlist<Pipe *> *pipe_list = high_iter->second;
+
+    int busy = 0;
+    while (busy < pipe_list->size()) {
       Pipe *pipe = pipe_list->front();
-      //move pipe to back of line -- or just take off if no more messages
+      if (pipe->dispatching) {
+	pipe_list->push_back(pipe->queue_items[priority]);  // not our turn
+	busy++;
+	continue;
+      }
+
       pipe->pipe_lock.Lock();
       list<Message *>& m_queue = pipe->in_q[priority];
       Message *m = m_queue.front();
-      m_queue.pop_front();
+      uint64_t cost = 1;
+      if ((unsigned long)m > 10)
+	cost = MAX(m->get_dispatch_throttle_size(), 1);
+      uint64_t& deficit = pipe->dispatch_deficit[priority];
+      if (quantum && cost > deficit) {
+	// used up this turn; earn more and go to the back of the line
+	deficit += quantum;
+	pipe->pipe_lock.Unlock();
+	pipe_list->push_back(pipe->queue_items[priority]);
+	busy = 0;
+	continue;
+      }
+      if (quantum)
+	deficit -= cost;
 
+      m_queue.pop_front();
       if (m_queue.empty()) {
+	deficit = 0;
 	pipe_list->pop_front();  // pipe is done
 	if (pipe_list->empty()) {
 	  delete pipe_list;
 	  dispatch_queue.queued_pipes.erase(priority);
 	}
-      } else {
+      } else if (!quantum) {
 	pipe_list->push_back(pipe->queue_items[priority]);  // move to end of list
       }
-      ldout(cct,20) << "dispatch_entry pipe " << pipe << " dequeued " << m << dendl;
-      dispatch_queue.lock.Unlock(); //done with the pipe queue for a while
-
+      ldout(cct,20) << "dispatch_entry pipe " << pipe << " dequeued " << m
+		    << " cost " << cost << " deficit " << deficit << dendl;
+      pipe->dispatching = true;
+      pipe->get();
       pipe->in_qlen--;
       dispatch_queue.qlen.dec();
+      pipe->pipe_lock.Unlock();
+      *pm = m;
+      return pipe;
+    }
+  }
+  return NULL;
+}
 
-      pipe->pipe_lock.Unlock(); // done with the pipe's message queue now
-       {
-	if ((long)m == DispatchQueue::D_BAD_REMOTE_RESET) {
-	  dispatch_queue.lock.Lock();
-	  Connection *con = dispatch_queue.remote_reset_q.front();
-	  dispatch_queue.remote_reset_q.pop_front();
-	  dispatch_queue.lock.Unlock();
+void SimpleMessenger::_dispatch_done(Pipe *pipe)
+{
+  assert(dispatch_queue.lock.is_locked());
+  pipe->dispatching = false;
+  pipe->put();
+  if (!dispatch_queue.queued_pipes.empty())
+    dispatch_queue.cond.Signal();  // another thread may want this pipe
+}
+
+/*
+ * This function delivers incoming messages to the Messenger; see
+ * _dispatch_next() for the order in which they are chosen.  There are
+ * ms_dispatch_threads of these.
+ */
+void SimpleMessenger::dispatch_entry()
+{
+  dispatch_queue.lock.Lock();
+  dispatch_queue.running++;
+  while (!dispatch_queue.stop) {
+    Message *m = NULL;
+    Pipe *pipe = _dispatch_next(&m);
+    if (!pipe) {
+      dispatch_queue.cond.Wait(dispatch_queue.lock); //wait for something to be put on queue
+      continue;
+    }
+    dispatch_queue.lock.Unlock(); //done with the pipe queue for a while
+
+    {
+      if ((unsigned long)m <= 10) {
+	// a connection event for this pipe (see Pipe::queue_event)
+	pipe->pipe_lock.Lock();
+	assert(!pipe->event_q.empty());
+	Connection *con = pipe->event_q.front();
+	pipe->event_q.pop_front();
+	pipe->pipe_lock.Unlock();
+	if ((long)m == DispatchQueue::D_BAD_REMOTE_RESET)
 	  ms_deliver_handle_remote_reset(con);
-	  con->put();
-	} else if ((long)m == DispatchQueue::D_CONNECT) {
-	  dispatch_queue.lock.Lock();
-	  Connection *con = dispatch_queue.connect_q.front();
-	  dispatch_queue.connect_q.pop_front();
-	  dispatch_queue.lock.Unlock();
+	else if ((long)m == DispatchQueue::D_CONNECT)
 	  ms_deliver_handle_connect(con);
-	  con->put();
-	} else if ((long)m == DispatchQueue::D_BAD_RESET) {
-	  dispatch_queue.lock.Lock();
-	  Connection *con = dispatch_queue.reset_q.front();
-	  dispatch_queue.reset_q.pop_front();
-	  dispatch_queue.lock.Unlock();
+	else if ((long)m == DispatchQueue::D_BAD_RESET)
 	  ms_deliver_handle_reset(con);
-	  con->put();
-	} else {
-	  uint64_t msize = m->get_dispatch_throttle_size();
-	  m->set_dispatch_throttle_size(0);  // clear it out, in case we requeue this message.
-
-	  ldout(cct,1) << "<== " << m->get_source_inst()
-		  << " " << m->get_seq()
-		  << " ==== " << *m
-		  << " ==== " << m->get_payload().length() << "+" << m->get_middle().length()
-		  << "+" << m->get_data().length()
-		  << " (" << m->get_footer().front_crc << " " << m->get_footer().middle_crc
-		  << " " << m->get_footer().data_crc << ")"
-		  << " " << m << " con " << m->get_connection()
-		  << dendl;
-	  ms_deliver_dispatch(m);
-
-	  dispatch_throttle_release(msize);
-
-	  ldout(cct,20) << "done calling dispatch on " << m << dendl;
-	}
+	con->put();
+	pipe->put();  // the event's ref; _dispatch_next's is still held
+      } else {
+	uint64_t msize = m->get_dispatch_throttle_size();
+	m->set_dispatch_throttle_size(0);  // clear it out, in case we requeue this message.
+
+	ldout(cct,1) << "<== " << m->get_source_inst()
+		<< " " << m->get_seq()
+		<< " ==== " << *m
+		<< " ==== " << m->get_payload().length() << "+" << m->get_middle().length()
+		<< "+" << m->get_data().length()
+		<< " (" << m->get_footer().front_crc << " " << m->get_footer().middle_crc
+		<< " " << m->get_footer().data_crc << ")"
+		<< " " << m << " con " << m->get_connection()
+		<< dendl;
+	if (m->get_trace_id())
+	  cct->get_tracer()->record(m->get_trace_id(), "ms_dispatch", m->get_type_name());
+	ms_deliver_dispatch(m);
+
+	dispatch_throttle_release(msize);
+
+	ldout(cct,20) << "done calling dispatch on " << m << dendl;
       }
-      dispatch_queue.lock.Lock();
     }
-    if (!dispatch_queue.stop)
-      dispatch_queue.cond.Wait(dispatch_queue.lock); //wait for something to be put on queue
+    dispatch_queue.lock.Lock();
+    _dispatch_done(pipe);
   }
+  bool last = (--dispatch_queue.running == 0);
+  dispatch_queue.cond.Signal();  // pass the stop along
   dispatch_queue.lock.Unlock();
 
+  if (!last)
+    return;
+
   //tell everything else it's time to stop
   lock.Lock();
   destination_stopped = true;
@@ -374,11 +463,30 @@ void SimpleMessenger::dispatch_entry()
   lock.Unlock();
 }
 
+void SimpleMessenger::init_thread_cpus()
+{
+  const string& cpus = cct->_conf->ms_thread_cpus;
+  if (cpus.empty())
+    return;
+  if (parse_cpu_set_list(cpus, &thread_cpus) < 0) {
+    lderr(cct) << "ignoring malformed ms_thread_cpus '" << cpus << "'" << dendl;
+    return;
+  }
+  have_thread_cpus = true;
+}
+
 void SimpleMessenger::ready()
 {
   ldout(cct,10) << "ready " << get_myaddr() << dendl;
   assert(!dispatch_thread.is_started());
-  dispatch_thread.create();
+  dispatch_thread.set_affinity(get_thread_cpus());
+  dispatch_thread.create("ms_dispatch");
+  for (int i = 1; i < cct->_conf->ms_dispatch_threads; i++) {
+    DispatchThread *t = new DispatchThread(this);
+    t->set_affinity(get_thread_cpus());
+    t->create("ms_dispatch");
+    extra_dispatch_threads.push_back(t);
+  }
 }
 
 
@@ -387,14 +495,20 @@ int SimpleMessenger::shutdown()
   ldout(cct,10) << "shutdown " << get_myaddr() << dendl;
 
   // stop my dispatch thread
-  if (dispatch_thread.am_self()) {
+  bool am_dispatch = dispatch_thread.am_self();
+  for (list<DispatchThread*>::iterator p = extra_dispatch_threads.begin();
+       p != extra_dispatch_threads.end();
+       ++p)
+    if ((*p)->am_self())
+      am_dispatch = true;
+  if (am_dispatch) {
     ldout(cct,10) << "shutdown i am dispatch, setting stop flag" << dendl;
     dispatch_queue.stop = true;
   } else {
     ldout(cct,10) << "shutdown i am not dispatch, setting stop flag and joining thread." << dendl;
     dispatch_queue.lock.Lock();
     dispatch_queue.stop = true;
-    dispatch_queue.cond.Signal();
+    dispatch_queue.cond.SignalAll();
     dispatch_queue.lock.Unlock();
   }
   return 0;
@@ -542,13 +656,29 @@ static int get_proto_version(int my_type, int peer_type, bool connect)
   return 0;
 }
 
+/*
+ * connect and reset events go through the connection's own in_q, so
+ * that they are dispatched in order with its messages (a pipe is only
+ * ever dispatched by one thread at a time).  unlike messages, they are
+ * queued even after discard_queue(): that is when resets happen.  each
+ * holds a pipe ref until it is delivered.
+ */
+void SimpleMessenger::Pipe::queue_event(int type)
+{
+  assert(pipe_lock.is_locked());
+  event_q.push_back(connection_state->get());
+  get();
+  queue_received((Message*)(uintptr_t)type, CEPH_MSG_PRIO_HIGHEST);
+}
+
 void SimpleMessenger::Pipe::queue_received(Message *m, int priority)
 {
   assert(pipe_lock.is_locked());
   
   list<Message *>& queue = in_q[priority];
+  bool event = ((unsigned long)m <= 10);
   
-  if (halt_delivery)
+  if (halt_delivery && !event)
     goto halt;
   
   if (queue.empty()) {
@@ -557,7 +687,7 @@ void SimpleMessenger::Pipe::queue_received(Message *m, int priority)
     msgr->dispatch_queue.lock.Lock();
     pipe_lock.Lock();
 
-    if (halt_delivery) {
+    if (halt_delivery && !event) {
       msgr->dispatch_queue.lock.Unlock();
       goto halt;
     }
@@ -566,8 +696,7 @@ void SimpleMessenger::Pipe::queue_received(Message *m, int priority)
       ldout(msgr->cct,20) << "queue_received queuing pipe" << dendl;
       if (!queue_items.count(priority)) 
 	queue_items[priority] = new xlist<Pipe *>::item(this);
-      if (msgr->dispatch_queue.queued_pipes.empty())
-	msgr->dispatch_queue.cond.Signal();
+      msgr->dispatch_queue.cond.Signal();
 
       map<int, xlist<Pipe*>*>::iterator p = msgr->dispatch_queue.queued_pipes.find(priority);
       xlist<Pipe*> *pipe_list;
@@ -1032,6 +1161,7 @@ int SimpleMessenger::Pipe::connect()
     assert(0);
     goto fail;
   }
+  set_socket_buffers(msgr, sd);
 
   char buf[80];
 
@@ -1291,12 +1421,8 @@ int SimpleMessenger::Pipe::connect()
       ldout(msgr->cct,10) << "connect success " << connect_seq << ", lossy = " << policy.lossy
 	       << ", features " << connection_state->get_features() << dendl;
       
-      if (!msgr->destination_stopped) {
-	Connection * cstate = connection_state->get();
-	pipe_lock.Unlock();
-	msgr->dispatch_queue.queue_connect(cstate);
-	pipe_lock.Lock();
-      }
+      if (!msgr->destination_stopped)
+	queue_event(DispatchQueue::D_CONNECT);
       
       if (!reader_running) {
 	ldout(msgr->cct,20) << "connect starting reader" << dendl;
@@ -1374,14 +1500,23 @@ void SimpleMessenger::Pipe::discard_queue()
 
   halt_delivery = true;
 
-  // dequeue pipe
+  // dequeue pipe.  pending connection events stay queued (at
+  // CEPH_MSG_PRIO_HIGHEST, see queue_event), and so does the pipe for them.
   DispatchQueue& q = msgr->dispatch_queue;
   pipe_lock.Unlock();
   q.lock.Lock();
   pipe_lock.Lock();
-  for (map<int, xlist<Pipe *>::item* >::iterator i = queue_items.begin();
-       i != queue_items.end();
-       ++i) {
+  list<Message*> events;
+  for (map<int,list<Message*> >::iterator p = in_q.begin(); p != in_q.end(); p++)
+    for (list<Message*>::iterator r = p->second.begin(); r != p->second.end(); r++)
+      if ((unsigned long)*r <= 10)
+	events.push_back(*r);
+  map<int, xlist<Pipe *>::item* >::iterator i = queue_items.begin();
+  while (i != queue_items.end()) {
+    if (i->first == CEPH_MSG_PRIO_HIGHEST && !events.empty()) {
+      ++i;
+      continue;
+    }
     xlist<Pipe *>* list_on;
     if ((list_on = i->second->get_list())) { //if in round-robin
       i->second->remove_myself(); //take off
@@ -1390,12 +1525,8 @@ void SimpleMessenger::Pipe::discard_queue()
 	q.queued_pipes.erase(i->first); //remove from map
       }
     }
-  }
-
-  // clear queue_items
-  while (!queue_items.empty()) {
-    delete queue_items.begin()->second;
-    queue_items.erase(queue_items.begin());
+    delete i->second;
+    queue_items.erase(i++);
   }
 
   q.lock.Unlock();
@@ -1403,7 +1534,7 @@ void SimpleMessenger::Pipe::discard_queue()
   ldout(msgr->cct,20) << " dequeued pipe " << dendl;
 
   // adjust qlen
-  q.qlen.sub(in_qlen);
+  q.qlen.sub(in_qlen - events.size());
 
   for (list<Message*>::iterator p = sent.begin(); p != sent.end(); p++) {
     ldout(msgr->cct,20) << "  discard " << *p << dendl;
@@ -1418,12 +1549,16 @@ void SimpleMessenger::Pipe::discard_queue()
   out_q.clear();
   for (map<int,list<Message*> >::iterator p = in_q.begin(); p != in_q.end(); p++)
     for (list<Message*>::iterator r = p->second.begin(); r != p->second.end(); r++) {
+      if ((unsigned long)*r <= 10)
+	continue;
       msgr->dispatch_throttle_release((*r)->get_dispatch_throttle_size());
       ldout(msgr->cct,20) << "  discard " << *r << dendl;
       (*r)->put();
     }
   in_q.clear();
-  in_qlen = 0;
+  in_qlen = events.size();
+  if (!events.empty())
+    in_q[CEPH_MSG_PRIO_HIGHEST].swap(events);
 }
 
 
@@ -1500,12 +1635,8 @@ void SimpleMessenger::Pipe::fail()
 
   discard_queue();
   
-  if (!msgr->destination_stopped) {
-    Connection * cstate = connection_state->get();
-    pipe_lock.Unlock();
-    msgr->dispatch_queue.queue_reset(cstate);
-    pipe_lock.Lock();
-  }
+  if (!msgr->destination_stopped)
+    queue_event(DispatchQueue::D_BAD_RESET);
 }
 
 void SimpleMessenger::Pipe::was_session_reset()
@@ -1515,12 +1646,8 @@ void SimpleMessenger::Pipe::was_session_reset()
   ldout(msgr->cct,10) << "was_session_reset" << dendl;
   discard_queue();
 
-  if (!msgr->destination_stopped) {
-    Connection * cstate = connection_state->get();
-    pipe_lock.Unlock();
-    msgr->dispatch_queue.queue_remote_reset(cstate);
-    pipe_lock.Lock();
-  }
+  if (!msgr->destination_stopped)
+    queue_event(DispatchQueue::D_BAD_REMOTE_RESET);
 
   out_seq = 0;
   in_seq = 0;
@@ -1547,6 +1674,16 @@ void SimpleMessenger::Pipe::reader()
 
   pipe_lock.Lock();
 
+  // hand the socket off to the event workers?
+  if (msgr->poller.is_started() &&
+      state != STATE_CLOSED &&
+      state != STATE_CONNECTING &&
+      reader_poll_start()) {
+    pipe_lock.Unlock();
+    ldout(msgr->cct,10) << "reader handed off to poller" << dendl;
+    return;
+  }
+
   // loop.
   while (state != STATE_CLOSED &&
 	 state != STATE_CONNECTING) {
@@ -1559,109 +1696,176 @@ void SimpleMessenger::Pipe::reader()
       continue;
     }
 
-    pipe_lock.Unlock();
+    if (!reader_process())
+      break;
+  }
 
-    char buf[80];
-    char tag = -1;
-    ldout(msgr->cct,20) << "reader reading tag..." << dendl;
-    int rc = tcp_read(msgr->cct, sd, (char*)&tag, 1, msgr->timeout);
+ 
+  // reap?
+  reader_running = false;
+  unlock_maybe_reap();
+  ldout(msgr->cct,10) << "reader done" << dendl;
+}
+
+/*
+ * read and handle one tag (and whatever follows it) from the socket.
+ * called and returns with pipe_lock held.  returns false if the peer
+ * closed the session and the reader should stop.
+ */
+bool SimpleMessenger::Pipe::reader_process()
+{
+  pipe_lock.Unlock();
+
+  char buf[80];
+  char tag = -1;
+  ldout(msgr->cct,20) << "reader reading tag..." << dendl;
+  int rc = tcp_read(msgr->cct, sd, (char*)&tag, 1, msgr->timeout);
+  if (rc < 0) {
+    pipe_lock.Lock();
+    ldout(msgr->cct,2) << "reader couldn't read tag, " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+    fault(false, true);
+    return true;
+  }
+
+  if (tag == CEPH_MSGR_TAG_KEEPALIVE) {
+    ldout(msgr->cct,20) << "reader got KEEPALIVE" << dendl;
+    pipe_lock.Lock();
+    return true;
+  }
+
+  // open ...
+  if (tag == CEPH_MSGR_TAG_ACK) {
+    ldout(msgr->cct,20) << "reader got ACK" << dendl;
+    ceph_le64 seq;
+    int rc = tcp_read(msgr->cct,  sd, (char*)&seq, sizeof(seq), msgr->timeout);
+    pipe_lock.Lock();
     if (rc < 0) {
-      pipe_lock.Lock();
-      ldout(msgr->cct,2) << "reader couldn't read tag, " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+      ldout(msgr->cct,2) << "reader couldn't read ack seq, " << strerror_r(errno, buf, sizeof(buf)) << dendl;
       fault(false, true);
-      continue;
+    } else if (state != STATE_CLOSED) {
+      handle_ack(seq);
     }
+    return true;
+  }
 
-    if (tag == CEPH_MSGR_TAG_KEEPALIVE) {
-      ldout(msgr->cct,20) << "reader got KEEPALIVE" << dendl;
-      pipe_lock.Lock();
-      continue;
-    }
+  else if (tag == CEPH_MSGR_TAG_MSG) {
+    ldout(msgr->cct,20) << "reader got MSG" << dendl;
+    Message *m = 0;
+    int r = read_message(&m);
 
-    // open ...
-    if (tag == CEPH_MSGR_TAG_ACK) {
-      ldout(msgr->cct,20) << "reader got ACK" << dendl;
-      ceph_le64 seq;
-      int rc = tcp_read(msgr->cct,  sd, (char*)&seq, sizeof(seq), msgr->timeout);
-      pipe_lock.Lock();
-      if (rc < 0) {
-	ldout(msgr->cct,2) << "reader couldn't read ack seq, " << strerror_r(errno, buf, sizeof(buf)) << dendl;
-	fault(false, true);
-      } else if (state != STATE_CLOSED) {
-        handle_ack(seq);
-      }
-      continue;
+    if (m && m->get_trace_id()) {
+      ostringstream ss;
+      ss << m->get_type_name() << " from " << m->get_source();
+      msgr->cct->get_tracer()->record(m->get_trace_id(), "ms_recv", ss.str());
     }
 
-    else if (tag == CEPH_MSGR_TAG_MSG) {
-      ldout(msgr->cct,20) << "reader got MSG" << dendl;
-      Message *m = 0;
-      int r = read_message(&m);
+    pipe_lock.Lock();
+    
+    if (!m) {
+      if (r < 0)
+        fault(false, true);
+      return true;
+    }
 
-      pipe_lock.Lock();
-      
-      if (!m) {
-	if (r < 0)
-	  fault(false, true);
-	continue;
-      }
+    if (state == STATE_CLOSED ||
+        state == STATE_CONNECTING) {
+      msgr->dispatch_throttle_release(m->get_dispatch_throttle_size());
+      m->put();
+      return true;
+    }
+
+    // check received seq#.  if it is old, drop the message.  
+    // note that incoming messages may skip ahead.  this is convenient for the client
+    // side queueing because messages can't be renumbered, but the (kernel) client will
+    // occasionally pull a message out of the sent queue to send elsewhere.  in that case
+    // it doesn't matter if we "got" it or not.
+    if (m->get_seq() <= in_seq) {
+      ldout(msgr->cct,0) << "reader got old message "
+      	<< m->get_seq() << " <= " << in_seq << " " << m << " " << *m
+      	<< ", discarding" << dendl;
+      msgr->dispatch_throttle_release(m->get_dispatch_throttle_size());
+      m->put();
+      return true;
+    }
 
-      if (state == STATE_CLOSED ||
-	  state == STATE_CONNECTING) {
-	msgr->dispatch_throttle_release(m->get_dispatch_throttle_size());
-	m->put();
-	continue;
-      }
+    m->set_connection(connection_state->get());
 
-      // check received seq#.  if it is old, drop the message.  
-      // note that incoming messages may skip ahead.  this is convenient for the client
-      // side queueing because messages can't be renumbered, but the (kernel) client will
-      // occasionally pull a message out of the sent queue to send elsewhere.  in that case
-      // it doesn't matter if we "got" it or not.
-      if (m->get_seq() <= in_seq) {
-	ldout(msgr->cct,0) << "reader got old message "
-		<< m->get_seq() << " <= " << in_seq << " " << m << " " << *m
-		<< ", discarding" << dendl;
-	msgr->dispatch_throttle_release(m->get_dispatch_throttle_size());
-	m->put();
-	continue;
-      }
+    // note last received message.
+    in_seq = m->get_seq();
 
-      m->set_connection(connection_state->get());
+    cond.Signal();  // wake up writer, to ack this
+    
+    ldout(msgr->cct,10) << "reader got message "
+             << m->get_seq() << " " << m << " " << *m
+             << dendl;
+    queue_received(m);
+  } 
+  
+  else if (tag == CEPH_MSGR_TAG_CLOSE) {
+    ldout(msgr->cct,20) << "reader got CLOSE" << dendl;
+    pipe_lock.Lock();
+    if (state == STATE_CLOSING)
+      state = STATE_CLOSED;
+    else
+      state = STATE_CLOSING;
+    cond.Signal();
+    return false;
+  }
+  else {
+    ldout(msgr->cct,0) << "reader bad tag " << (int)tag << dendl;
+    pipe_lock.Lock();
+    fault(false, true);
+  }
+  return true;
+}
 
-      // note last received message.
-      in_seq = m->get_seq();
+/*
+ * register our socket with the event poller.  from here on, the reader
+ * role is played by reader_event() on a poller worker thread, which
+ * holds a pipe ref until it retires.
+ */
+bool SimpleMessenger::Pipe::reader_poll_start()
+{
+  assert(pipe_lock.is_locked());
+  assert(reader_running);
+  int w = msgr->poller.add(sd, &read_handler);
+  if (w < 0) {
+    ldout(msgr->cct,1) << "reader_poll_start failed, falling back to reader thread" << dendl;
+    return false;
+  }
+  get();
+  reader_polled = true;
+  poll_worker = w;
+  return true;
+}
 
-      cond.Signal();  // wake up writer, to ack this
-      
-      ldout(msgr->cct,10) << "reader got message "
-	       << m->get_seq() << " " << m << " " << *m
-	       << dendl;
-      queue_received(m);
-    } 
-    
-    else if (tag == CEPH_MSGR_TAG_CLOSE) {
-      ldout(msgr->cct,20) << "reader got CLOSE" << dendl;
-      pipe_lock.Lock();
-      if (state == STATE_CLOSING)
-	state = STATE_CLOSED;
-      else
-	state = STATE_CLOSING;
-      cond.Signal();
-      break;
-    }
-    else {
-      ldout(msgr->cct,0) << "reader bad tag " << (int)tag << dendl;
-      pipe_lock.Lock();
-      fault(false, true);
-    }
+void SimpleMessenger::Pipe::reader_event()
+{
+  pipe_lock.Lock();
+  bool more = (state != STATE_CLOSED &&
+	       state != STATE_CONNECTING &&
+	       state != STATE_STANDBY);
+  if (more)
+    more = reader_process();
+  if (more &&
+      state != STATE_CLOSED &&
+      state != STATE_CONNECTING &&
+      state != STATE_STANDBY &&
+      msgr->poller.rearm(sd, poll_worker, &read_handler) == 0) {
+    pipe_lock.Unlock();
+    return;
   }
 
- 
-  // reap?
+  // retire.  a standby pipe's socket is already shut down; we will be
+  // re-registered by start_reader() if it reconnects.
+  msgr->poller.remove(sd, poll_worker);
+  reader_polled = false;
+  poll_worker = -1;
   reader_running = false;
+  cond.Signal();
   unlock_maybe_reap();
   ldout(msgr->cct,10) << "reader done" << dendl;
+  put();
 }
 
 /* write msgs to socket.
@@ -1709,6 +1913,16 @@ void SimpleMessenger::Pipe::writer()
     if (state != STATE_CONNECTING && state != STATE_WAIT && state != STATE_STANDBY &&
 	(is_queued() || in_seq > in_seq_acked)) {
 
+      // give small control messages a moment to pile up?
+      if (!coalesced) {
+	coalesced = true;
+	if (writer_coalesce())
+	  continue;  // state may have changed while we waited
+      }
+      // whatever is written below (keepalive, ack or messages, even if
+      // it faults), the next batch gets its own wait
+      coalesced = false;
+
       // keepalive?
       if (keepalive) {
 	pipe_lock.Unlock();
@@ -1736,35 +1950,57 @@ void SimpleMessenger::Pipe::writer()
 	in_seq_acked = send_seq;
       }
 
-      // grab outgoing message
-      Message *m = _get_next_outgoing();
-      if (m) {
+      // grab outgoing messages
+      list<Message*> batch;
+      int max_batch = msgr->cct->_conf->ms_write_batch_max;
+      while ((int)batch.size() < max_batch || batch.empty()) {
+	Message *m = _get_next_outgoing();
+	if (!m)
+	  break;
 	m->set_seq(++out_seq);
 	if (!policy.lossy || close_on_empty) {
 	  // put on sent list
 	  sent.push_back(m); 
 	  m->get();
 	}
+	batch.push_back(m);
+      }
+      if (!batch.empty()) {
 	pipe_lock.Unlock();
 
-        ldout(msgr->cct,20) << "writer encoding " << m->get_seq() << " " << m << " " << *m << dendl;
+	for (list<Message*>::iterator p = batch.begin(); p != batch.end(); ++p) {
+	  Message *m = *p;
+	  ldout(msgr->cct,20) << "writer encoding " << m->get_seq() << " " << m << " " << *m << dendl;
 
-	// associate message with Connection (for benefit of encode_payload)
-	m->set_connection(connection_state->get());
+	  // associate message with Connection (for benefit of encode_payload)
+	  m->set_connection(connection_state->get());
 
-	// encode and copy out of *m
-	m->encode(msgr->cct);
+	  // encode and copy out of *m
+	  m->encode(msgr->cct);
+	}
 
-        ldout(msgr->cct,20) << "writer sending " << m->get_seq() << " " << m << dendl;
-	int rc = write_message(m);
+        ldout(msgr->cct,20) << "writer sending " << batch.size() << " messages through "
+			    << batch.back()->get_seq() << dendl;
+	int rc = write_messages(batch);
+
+	if (rc >= 0) {
+	  for (list<Message*>::iterator p = batch.begin(); p != batch.end(); ++p) {
+	    if (!(*p)->get_trace_id())
+	      continue;
+	    ostringstream ss;
+	    ss << (*p)->get_type_name() << " to " << peer_addr;
+	    msgr->cct->get_tracer()->record((*p)->get_trace_id(), "ms_sent", ss.str());
+	  }
+	}
 
 	pipe_lock.Lock();
 	if (rc < 0) {
-          ldout(msgr->cct,1) << "writer error sending " << m << ", "
+          ldout(msgr->cct,1) << "writer error sending " << batch.size() << " messages, "
 		  << errno << ": " << strerror_r(errno, buf, sizeof(buf)) << dendl;
 	  fault();
         }
-	m->put();
+	for (list<Message*>::iterator p = batch.begin(); p != batch.end(); ++p)
+	  (*p)->put();
       }
       continue;
     }
@@ -1790,6 +2026,42 @@ void SimpleMessenger::Pipe::writer()
   ldout(msgr->cct,10) << "writer done" << dendl;
 }
 
+/*
+ * Nagle-style coalescing.  if everything queued is a small control
+ * message (no data payload, below high priority), wait up to
+ * ms_write_coalesce_usec for more to arrive so that they can share one
+ * sendmsg().  called with pipe_lock held; returns true if we waited.
+ */
+bool SimpleMessenger::Pipe::writer_coalesce()
+{
+  const md_config_t *conf = msgr->cct->_conf;
+  if (!conf->ms_write_coalesce_usec || state != STATE_OPEN)
+    return false;
+
+  utime_t until = ceph_clock_now(msgr->cct);
+  until += utime_t(0, conf->ms_write_coalesce_usec * 1000);
+  bool waited = false;
+  while (state == STATE_OPEN && !keepalive) {
+    int n = 0;
+    for (map<int, list<Message*> >::iterator p = out_q.begin(); p != out_q.end(); ++p) {
+      if (p->first >= CEPH_MSG_PRIO_HIGH)
+	return waited;
+      for (list<Message*>::iterator q = p->second.begin(); q != p->second.end(); ++q) {
+	if ((*q)->get_data().length())
+	  return waited;
+	n++;
+      }
+    }
+    if (n == 0 || n >= conf->ms_write_batch_max ||
+	ceph_clock_now(msgr->cct) >= until)
+      break;
+    ldout(msgr->cct,20) << "writer coalescing " << n << " small messages" << dendl;
+    cond.WaitUntil(pipe_lock, until);
+    waited = true;
+  }
+  return waited;
+}
+
 void SimpleMessenger::Pipe::unlock_maybe_reap()
 {
   if (!reader_running && !writer_running) {
@@ -1801,7 +2073,37 @@ void SimpleMessenger::Pipe::unlock_maybe_reap()
   }
 }
 
-static void alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
+/*
+ * get a page-aligned buffer of at least len bytes for incoming message
+ * data.  we keep a handful of recently used buffers around per pipe and
+ * hand one back out as soon as the last message referencing it has gone
+ * away, to avoid a fresh posix_memalign for every write we receive.
+ */
+bufferptr SimpleMessenger::Pipe::get_rx_pages(unsigned len)
+{
+  const md_config_t *conf = msgr->cct->_conf;
+  if (len > conf->ms_rx_buffer_pool_max_bytes || conf->ms_rx_buffer_pool <= 0)
+    return buffer::create_page_aligned(len);
+
+  for (list<bufferptr>::iterator p = rx_pool.begin(); p != rx_pool.end(); ++p) {
+    if (p->raw_nref() == 1 && p->raw_length() >= len) {
+      ldout(msgr->cct,20) << "get_rx_pages reusing " << (void*)p->raw_c_str()
+			  << " len " << p->raw_length() << " for " << len << dendl;
+      bufferptr bp(*p, 0, len);
+      rx_pool.splice(rx_pool.end(), rx_pool, p);  // keep LRU order
+      return bp;
+    }
+  }
+
+  // none free.  replace the oldest if we are at the limit.
+  if ((int)rx_pool.size() >= conf->ms_rx_buffer_pool)
+    rx_pool.pop_front();
+  bufferptr pooled = buffer::create_page_aligned(len);
+  rx_pool.push_back(pooled);
+  return bufferptr(pooled, 0, len);
+}
+
+void SimpleMessenger::Pipe::alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
 {
   // create a buffer to read into that matches the data alignment
   unsigned left = len;
@@ -1815,7 +2117,7 @@ static void alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
   }
   unsigned middle = left & PAGE_MASK;
   if (middle > 0) {
-    bufferptr bp = buffer::create_page_aligned(middle);
+    bufferptr bp = get_rx_pages(middle);
     data.push_back(bp);
     left -= middle;
   }
@@ -1982,6 +2284,9 @@ int SimpleMessenger::Pipe::read_message(Message **pm)
 
   ldout(msgr->cct,20) << "reader got " << front.length() << " + " << middle.length() << " + " << data.length()
 	   << " byte message" << dendl;
+  front.reassign_to_mempool(mempool::buffer_msg);
+  middle.reassign_to_mempool(mempool::buffer_msg);
+  data.reassign_to_mempool(mempool::buffer_msg);
   message = decode_message(msgr->cct, header, footer, front, middle, data);
   if (!message) {
     ret = -EINVAL;
@@ -2139,11 +2444,124 @@ int SimpleMessenger::Pipe::write_keepalive()
 }
 
 
-int SimpleMessenger::Pipe::write_message(Message *m)
+/*
+ * helper to gather the iovecs for one or more messages so that they can
+ * go out in as few sendmsg() calls as possible.  we point straight at
+ * the message bufferptrs; nothing is copied.
+ */
+struct SimpleMessenger::Pipe::OutVec {
+  struct msghdr msg;
+  struct iovec vec[IOV_MAX];
+  int len;
+  list<ceph_msg_header_old> oldheaders;  // storage for headers we rewrite
+
+  OutVec() : len(0) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vec;
+  }
+  bool full(unsigned need = 1) {
+    return msg.msg_iovlen + need > IOV_MAX;
+  }
+  void append(void *base, int l) {
+    assert(!full());
+    vec[msg.msg_iovlen].iov_base = base;
+    vec[msg.msg_iovlen].iov_len = l;
+    msg.msg_iovlen++;
+    len += l;
+  }
+  void reset() {
+    msg.msg_iov = vec;
+    msg.msg_iovlen = 0;
+    len = 0;
+  }
+};
+
+int SimpleMessenger::Pipe::flush_outvec(OutVec &ov, bool more)
+{
+  if (!ov.len)
+    return 0;
+  int r = do_sendmsg(sd, &ov.msg, ov.len, more);
+  ov.reset();
+  return r;
+}
+
+int SimpleMessenger::Pipe::append_bufferlist(OutVec &ov, const bufferlist& bl)
+{
+  for (list<bufferptr>::const_iterator pb = bl.buffers().begin();
+       pb != bl.buffers().end();
+       ++pb) {
+    if (!pb->length())
+      continue;
+#if defined(__linux__)
+    int fd;
+    uint64_t off;
+    if (pb->get_fd(&fd, &off)) {
+      // still backed by a file (see buffer::create_fd): send it from there
+      if (flush_outvec(ov, true) < 0 ||
+	  do_sendfile(sd, fd, off, pb->length()) < 0)
+	return -1;
+      continue;
+    }
+#endif
+    if (ov.full(2)) {   // leave a slot for the footer
+      if (flush_outvec(ov, true) < 0)
+	return -1;
+    }
+    ov.append((void*)pb->c_str(), pb->length());
+  }
+  return 0;
+}
+
+#if defined(__linux__)
+int SimpleMessenger::Pipe::do_sendfile(int sd, int fd, uint64_t off, unsigned len)
+{
+  char buf[80];
+  off_t o = off;
+
+  while (len > 0) {
+    ssize_t r = ::sendfile(sd, fd, &o, len);
+    if (r < 0) {
+      if (errno == EINTR)
+	continue;
+      ldout(msgr->cct,1) << "do_sendfile error " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+      return -1;
+    }
+    if (r == 0) {
+      // the file shrank since the message was built.  pad it out, or the
+      // peer would take the next message for the rest of this one.
+      ldout(msgr->cct,1) << "do_sendfile hit eof with " << len << " bytes left, padding" << dendl;
+      static char zeros[4096];
+      while (len > 0) {
+	unsigned l = MIN(len, sizeof(zeros));
+	struct iovec iov;
+	iov.iov_base = zeros;
+	iov.iov_len = l;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (do_sendmsg(sd, &msg, l, true) < 0)
+	  return -1;
+	len -= l;
+      }
+      return 0;
+    }
+    if (state == STATE_CLOSED) {
+      ldout(msgr->cct,10) << "do_sendfile oh look, state == CLOSED, giving up" << dendl;
+      errno = EINTR;
+      return -1;
+    }
+    len -= r;
+  }
+  return 0;
+}
+#endif
+
+int SimpleMessenger::Pipe::prepare_message(OutVec &ov, Message *m)
 {
+  static char tag = CEPH_MSGR_TAG_MSG;
   ceph_msg_header& header = m->get_header();
   ceph_msg_footer& footer = m->get_footer();
-  int ret;
 
   // get envelope, buffers
   header.front_len = m->get_payload().length();
@@ -2152,34 +2570,17 @@ int SimpleMessenger::Pipe::write_message(Message *m)
   footer.flags = CEPH_MSG_FOOTER_COMPLETE;
   m->calc_header_crc();
 
-  bufferlist blist = m->get_payload();
-  blist.append(m->get_middle());
-  blist.append(m->get_data());
-  
   ldout(msgr->cct,20)  << "write_message " << m << dendl;
-  
-  // set up msghdr and iovecs
-  struct msghdr msg;
-  memset(&msg, 0, sizeof(msg));
-  struct iovec *msgvec = new iovec[3 + blist.buffers().size()];  // conservative upper bound
-  msg.msg_iov = msgvec;
-  int msglen = 0;
-  
-  // send tag
-  char tag = CEPH_MSGR_TAG_MSG;
-  msgvec[msg.msg_iovlen].iov_base = &tag;
-  msgvec[msg.msg_iovlen].iov_len = 1;
-  msglen++;
-  msg.msg_iovlen++;
-
-  // send envelope
-  ceph_msg_header_old oldheader;
+
+  // tag and envelope
+  if (ov.full(3) && flush_outvec(ov, true) < 0)
+    return -1;
+  ov.append(&tag, 1);
   if (connection_state->has_feature(CEPH_FEATURE_NOSRCADDR)) {
-    msgvec[msg.msg_iovlen].iov_base = (char*)&header;
-    msgvec[msg.msg_iovlen].iov_len = sizeof(header);
-    msglen += sizeof(header);
-    msg.msg_iovlen++;
+    ov.append((char*)&header, sizeof(header));
   } else {
+    ov.oldheaders.push_back(ceph_msg_header_old());
+    ceph_msg_header_old& oldheader = ov.oldheaders.back();
     memcpy(&oldheader, &header, sizeof(header));
     oldheader.src.name = header.src;
     oldheader.src.addr = connection_state->get_peer_addr();
@@ -2187,78 +2588,38 @@ int SimpleMessenger::Pipe::write_message(Message *m)
     oldheader.reserved = header.reserved;
     oldheader.crc = ceph_crc32c_le(0, (unsigned char*)&oldheader,
 			      sizeof(oldheader) - sizeof(oldheader.crc));
-    msgvec[msg.msg_iovlen].iov_base = (char*)&oldheader;
-    msgvec[msg.msg_iovlen].iov_len = sizeof(oldheader);
-    msglen += sizeof(oldheader);
-    msg.msg_iovlen++;
+    ov.append((char*)&oldheader, sizeof(oldheader));
   }
 
-  // payload (front+data)
-  list<bufferptr>::const_iterator pb = blist.buffers().begin();
-  int b_off = 0;  // carry-over buffer offset, if any
-  int bl_pos = 0; // blist pos
-  int left = blist.length();
+  // payload (front+middle+data)
+  if (append_bufferlist(ov, m->get_payload()) < 0 ||
+      append_bufferlist(ov, m->get_middle()) < 0 ||
+      append_bufferlist(ov, m->get_data()) < 0)
+    return -1;
 
-  while (left > 0) {
-    int donow = MIN(left, (int)pb->length()-b_off);
-    if (donow == 0) {
-      ldout(msgr->cct,0) << "donow = " << donow << " left " << left << " pb->length " << pb->length()
-	      << " b_off " << b_off << dendl;
-    }
-    assert(donow > 0);
-    ldout(msgr->cct,30) << " bl_pos " << bl_pos << " b_off " << b_off
-	     << " leftinchunk " << left
-	     << " buffer len " << pb->length()
-	     << " writing " << donow 
-	     << dendl;
-    
-    if (msg.msg_iovlen >= IOV_MAX-2) {
-      if (do_sendmsg(sd, &msg, msglen, true)) 
-	goto fail;
-      
-      // and restart the iov
-      msg.msg_iov = msgvec;
-      msg.msg_iovlen = 0;
-      msglen = 0;
-    }
-    
-    msgvec[msg.msg_iovlen].iov_base = (void*)(pb->c_str()+b_off);
-    msgvec[msg.msg_iovlen].iov_len = donow;
-    msglen += donow;
-    msg.msg_iovlen++;
-    
-    left -= donow;
-    assert(left >= 0);
-    b_off += donow;
-    bl_pos += donow;
-    if (left == 0)
+  // footer
+  ov.append((void*)&footer, sizeof(footer));
+  return 0;
+}
+
+/*
+ * write a batch of already-encoded messages.  the iovecs for all of
+ * them are gathered into a single sendmsg() whenever they fit.
+ */
+int SimpleMessenger::Pipe::write_messages(list<Message*>& ls)
+{
+  OutVec *ov = new OutVec;
+  int ret = 0;
+  for (list<Message*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    if (prepare_message(*ov, *p) < 0) {
+      ret = -1;
       break;
-    while (b_off == (int)pb->length()) {
-      pb++;
-      b_off = 0;
     }
   }
-  assert(left == 0);
-
-  // send footer
-  msgvec[msg.msg_iovlen].iov_base = (void*)&footer;
-  msgvec[msg.msg_iovlen].iov_len = sizeof(footer);
-  msglen += sizeof(footer);
-  msg.msg_iovlen++;
-
-  // send
-  if (do_sendmsg(sd, &msg, msglen)) 
-    goto fail;
-
-  ret = 0;
-
- out:
-  delete[] msgvec;
+  if (ret == 0 && flush_outvec(*ov, false) < 0)
+    ret = -1;
+  delete ov;
   return ret;
-
- fail:
-  ret = -1;
-  goto out;
 }
 
 
@@ -2372,6 +2733,14 @@ int SimpleMessenger::start_with_nonce(uint64_t nonce)
   if (did_bind)
     accepter.start();
 
+  if (cct->_conf->ms_event_workers > 0 && !poller.is_started()) {
+    int r = poller.start(cct->_conf->ms_event_workers,
+			 cct->_conf->ms_rwthread_stack_bytes);
+    if (r < 0)
+      lderr(cct) << "failed to start event poller, using a reader thread per pipe: "
+		 << cpp_strerror(r) << dendl;
+  }
+
   reaper_started = true;
   reaper_thread.create();
   return 0;
@@ -2680,6 +3049,9 @@ void SimpleMessenger::wait()
   }
   lock.Unlock();
 
+  // all pipes are gone, so nothing is registered with the poller
+  poller.stop();
+
   ldout(cct,10) << "wait: done." << dendl;
   ldout(cct,1) << "shutdown complete." << dendl;
   started = false;
@@ -33,6 +33,7 @@ using namespace __gnu_cxx;
 
 #include "Messenger.h"
 #include "Message.h"
+#include "EventPoller.h"
 #include "tcp.h"
 
 
@@ -62,7 +63,13 @@ using namespace __gnu_cxx;
   CEPH_FEATURE_OBJECTLOCATOR |	 \
   CEPH_FEATURE_PGID64 |		 \
   CEPH_FEATURE_INCSUBOSDMAP |	 \
-  CEPH_FEATURE_PGPOOL3
+  CEPH_FEATURE_PGPOOL3 |	 \
+  CEPH_FEATURE_POOLRATELIMIT |	 \
+  CEPH_FEATURE_OSDMAPCOMPACT |	 \
+  CEPH_FEATURE_CRUSH_STRAW2 |	 \
+  CEPH_FEATURE_OSD_CACHEPOOL |	 \
+  CEPH_FEATURE_OSD_ALLOCHINT |	 \
+  CEPH_FEATURE_OSD_PUSH_DIRTY
 
 class SimpleMessenger : public Messenger {
 public:
@@ -87,6 +94,7 @@ public:
     static Policy stateless_server(uint64_t sup, uint64_t req) { return Policy(true, true, sup, req); }
     static Policy lossless_peer(uint64_t sup, uint64_t req) { return Policy(false, false, sup, req); }
     static Policy client(uint64_t sup, uint64_t req) { return Policy(false, false, sup, req); }
+    static Policy lossy_client(uint64_t sup, uint64_t req) { return Policy(true, false, sup, req); }
   };
 
 
@@ -145,16 +153,21 @@ private:
     utime_t backoff;         // backoff time
 
     bool reader_running, reader_joining;
+    bool reader_polled;  // reader is driven by msgr->poller, not reader_thread
+    int poll_worker;
     bool writer_running;
 
     map<int, list<Message*> > out_q;  // priority queue for outbound msgs
     map<int, list<Message*> > in_q; // and inbound ones
     int in_qlen;
+    list<Connection*> event_q;  // one per D_* event in in_q, oldest first
     map<int, xlist<Pipe *>::item* > queue_items; // protected by pipe_lock AND q.lock
     list<Message*> sent;
     Cond cond;
     bool keepalive;
     bool halt_delivery; //if a pipe's queue is destroyed, stop adding to it
+    bool dispatching;   // a dispatch thread is delivering from in_q; protected by dispatch_queue.lock
+    map<int, uint64_t> dispatch_deficit;  // DRR byte credit per priority; protected by dispatch_queue.lock
     bool close_on_empty;
     bool disposable;
     
@@ -165,12 +178,27 @@ private:
     int accept();   // server handshake
     int connect();  // client handshake
     void reader();
+    bool reader_process();
+    void reader_event();
+    bool reader_poll_start();
     void writer();
+    bool coalesced;  // writer already waited for this batch to fill
+    bool writer_coalesce();
     void unlock_maybe_reap();
 
+    list<bufferptr> rx_pool;  // page-aligned data buffers; reader only
+    bufferptr get_rx_pages(unsigned len);
+    void alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off);
     int read_message(Message **pm);
-    int write_message(Message *m);
+    struct OutVec;
+    int flush_outvec(OutVec &ov, bool more);
+    int append_bufferlist(OutVec &ov, const bufferlist& bl);
+    int prepare_message(OutVec &ov, Message *m);
+    int write_messages(list<Message*>& ls);
     int do_sendmsg(int sd, struct msghdr *msg, int len, bool more=false);
+#if defined(__linux__)
+    int do_sendfile(int sd, int fd, uint64_t off, unsigned len);
+#endif
     int write_ack(uint64_t s);
     int write_keepalive();
 
@@ -216,6 +244,14 @@ private:
       void *entry() { pipe->writer(); return 0; }
     } writer_thread;
     friend class Writer;
+
+    class ReadHandler : public EventPoller::Handler {
+      Pipe *pipe;
+    public:
+      ReadHandler(Pipe *p) : pipe(p) {}
+      void handle_event() { pipe->reader_event(); }
+    } read_handler;
+    friend class ReadHandler;
     
   public:
     Pipe(const Pipe& other);
@@ -228,12 +264,14 @@ private:
       pipe_lock("SimpleMessenger::Pipe::pipe_lock"),
       state(st), 
       connection_state(new Connection),
-      reader_running(false), reader_joining(false), writer_running(false),
-      in_qlen(0), keepalive(false), halt_delivery(false), 
+      reader_running(false), reader_joining(false),
+      reader_polled(false), poll_worker(-1), writer_running(false),
+      in_qlen(0), keepalive(false), halt_delivery(false), dispatching(false),
       close_on_empty(false), disposable(false),
       connect_seq(0), peer_global_seq(0),
       out_seq(0), in_seq(0), in_seq_acked(0),
-      reader_thread(this), writer_thread(this) {
+      coalesced(false),
+      reader_thread(this), writer_thread(this), read_handler(this) {
       connection_state->pipe = get();
       msgr->timeout = msgr->cct->_conf->ms_tcp_read_timeout * 1000; //convert to ms
       if (msgr->timeout == 0)
@@ -257,17 +295,29 @@ private:
       assert(pipe_lock.is_locked());
       assert(!reader_running);
       reader_running = true;
-      reader_thread.create(msgr->cct->_conf->ms_rwthread_stack_bytes);
+      if (state != STATE_ACCEPTING && msgr->poller.is_started() &&
+	  reader_poll_start())
+	return;
+      reader_thread.set_affinity(msgr->get_thread_cpus());
+      reader_thread.create("ms_pipe_read", msgr->cct->_conf->ms_rwthread_stack_bytes);
     }
     void start_writer() {
       assert(pipe_lock.is_locked());
       assert(!writer_running);
       writer_running = true;
-      writer_thread.create(msgr->cct->_conf->ms_rwthread_stack_bytes);
+      writer_thread.set_affinity(msgr->get_thread_cpus());
+      writer_thread.create("ms_pipe_write", msgr->cct->_conf->ms_rwthread_stack_bytes);
     }
     void join_reader() {
       if (!reader_running)
 	return;
+      if (reader_polled) {
+	// the poller will notice the shutdown and retire the reader
+	shutdown_socket();
+	while (reader_running)
+	  cond.Wait(pipe_lock);
+	return;
+      }
       assert(!reader_joining);
       reader_joining = true;
       cond.Signal();
@@ -285,6 +335,7 @@ private:
     //we have two queue_received's to allow local signal delivery
     // via Message * (that doesn't actually point to a Message)
     void queue_received(Message *m, int priority);
+    void queue_event(int type);
     
     void queue_received(Message *m) {
       m->set_recv_stamp(ceph_clock_now(msgr->cct));
@@ -371,15 +422,14 @@ private:
     Mutex lock;
     Cond cond;
     bool stop;
+    int running;  // dispatch threads
 
     map<int, xlist<Pipe *>* > queued_pipes;
     map<int, xlist<Pipe *>::iterator> queued_pipe_iters;
     atomic_t qlen;
     
+    // connection events, queued on their own pipe (Pipe::queue_event)
     enum { D_CONNECT, D_BAD_REMOTE_RESET, D_BAD_RESET };
-    list<Connection*> connect_q;
-    list<Connection*> remote_reset_q;
-    list<Connection*> reset_q;
 
     Pipe *local_pipe;
     void local_delivery(Message *m, int priority) {
@@ -394,28 +444,10 @@ private:
       return qlen.read();
     }
     
-    void queue_connect(Connection *con) {
-      lock.Lock();
-      connect_q.push_back(con);
-      lock.Unlock();
-      local_delivery((Message*)D_CONNECT, CEPH_MSG_PRIO_HIGHEST);
-    }
-    void queue_remote_reset(Connection *con) {
-      lock.Lock();
-      remote_reset_q.push_back(con);
-      lock.Unlock();
-      local_delivery((Message*)D_BAD_REMOTE_RESET, CEPH_MSG_PRIO_HIGHEST);
-    }
-    void queue_reset(Connection *con) {
-      lock.Lock();
-      reset_q.push_back(con);
-      lock.Unlock();
-      local_delivery((Message*)D_BAD_RESET, CEPH_MSG_PRIO_HIGHEST);
-    }
-    
     DispatchQueue() :
       lock("SimpleMessenger::DispatchQeueu::lock"), 
       stop(false),
+      running(0),
       qlen(0),
       local_pipe(NULL)
     {}
@@ -433,6 +465,7 @@ private:
 
   // SimpleMessenger stuff
  public:
+  EventPoller poller;  // ms_event_workers threads reading idle pipes
   Mutex lock;
   Cond  wait_cond;  // for wait()
   bool started;
@@ -515,6 +548,11 @@ private:
   void destroy() {
     if (dispatch_thread.is_started())
       dispatch_thread.join();
+    while (!extra_dispatch_threads.empty()) {
+      extra_dispatch_threads.front()->join();
+      delete extra_dispatch_threads.front();
+      extra_dispatch_threads.pop_front();
+    }
     Messenger::destroy();
   }
 
@@ -551,8 +589,15 @@ private:
       return 0;
     }
   } dispatch_thread;
+  list<DispatchThread*> extra_dispatch_threads;  // if ms_dispatch_threads > 1
+
+  bool have_thread_cpus;
+  cpu_set_t thread_cpus;   // ms_thread_cpus
+  void init_thread_cpus();
 
   void dispatch_entry();
+  Pipe *_dispatch_next(Message **pm);
+  void _dispatch_done(Pipe *pipe);
 
   SimpleMessenger *msgr; //hack to make dout macro work, will fix
   int timeout;
@@ -561,14 +606,18 @@ public:
   SimpleMessenger(CephContext *cct) :
     Messenger(cct, entity_name_t()),
     accepter(this),
+    poller(cct),
     lock("SimpleMessenger::lock"), started(false), did_bind(false),
-    dispatch_throttler(cct->_conf->ms_dispatch_throttle_bytes), need_addr(true),
+    dispatch_throttler(cct, "msgr_dispatch_throttler", cct->_conf->ms_dispatch_throttle_bytes,
+		       NULL, "ms_dispatch_throttle_bytes"),
+    need_addr(true),
     destination_stopped(true), my_type(-1),
     global_seq_lock("SimpleMessenger::global_seq_lock"), global_seq(0),
     reaper_thread(this), reaper_started(false), reaper_stop(false), 
-    dispatch_thread(this), msgr(this) {
+    dispatch_thread(this), have_thread_cpus(false), msgr(this) {
     // for local dmsg delivery
     dispatch_queue.local_pipe = new Pipe(this, Pipe::STATE_OPEN);
+    init_thread_cpus();
   }
   ~SimpleMessenger() {
     delete dispatch_queue.local_pipe;
@@ -580,6 +629,11 @@ public:
   int bind(uint64_t nonce) {
     return bind(cct->_conf->public_addr, nonce);
   }
+  /// where pipe and dispatch threads may run, or NULL for anywhere
+  const cpu_set_t *get_thread_cpus() {
+    return have_thread_cpus ? &thread_cpus : NULL;
+  }
+
   int start_with_nonce(uint64_t nonce);  // if we didn't bind
   int start() {                 // if we did
     assert(did_bind);
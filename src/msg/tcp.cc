@@ -23,13 +23,23 @@ int tcp_read(CephContext *cct, int sd, char *buf, int len, int timeout)
       }
     }
 
-    if (tcp_read_wait(sd, timeout) < 0)
+    // only poll once the socket is drained: on a fast link the data is
+    // usually already there, and the poll would double the syscalls
+    int got = ::recv(sd, buf, len, MSG_DONTWAIT);
+    if (got < 0 && (errno == EAGAIN || errno == EINTR)) {
+      if (errno == EAGAIN && tcp_read_wait(sd, timeout) < 0)
+	return -1;
+      continue;
+    }
+    if (got == 0) {
+      lgeneric_dout(cct, 10) << "tcp_read socket " << sd << " closed by peer" << dendl;
       return -1;
-
-    int got = tcp_read_nonblocking(cct, sd, buf, len);
-
-    if (got < 0)
+    }
+    if (got < 0) {
+      lgeneric_dout(cct, 10) << "tcp_read socket " << sd << " returned "
+			     << got << " errno " << errno << " " << cpp_strerror(errno) << dendl;
       return -1;
+    }
 
     len -= got;
     buf += got;
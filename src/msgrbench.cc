@@ -0,0 +1,268 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * messenger throughput/latency benchmark.
+ *
+ *   msgrbench --server <addr>
+ *   msgrbench --client <addr> [--size B] [--depth N] [--seconds S] [--sessions N]
+ *
+ * the client keeps --depth pings with a --size byte data payload in
+ * flight on each of --sessions connections, and the server sends back an
+ * empty ping with the same tid for each.  throughput and round-trip
+ * latency percentiles are reported at the end.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "global/global_init.h"
+#include "msg/SimpleMessenger.h"
+#include "messages/MPing.h"
+
+#define dout_prefix *_dout
+
+void usage()
+{
+  cerr << "usage: msgrbench --server <addr>\n"
+       << "       msgrbench --client <addr> [options]\n"
+       << "options:\n"
+       << "  --size <bytes>      data payload per message (default 4096)\n"
+       << "  --depth <n>         messages in flight per session (default 16)\n"
+       << "  --sessions <n>      concurrent connections (default 1)\n"
+       << "  --seconds <n>       how long to run (default 10)\n";
+  exit(1);
+}
+
+class BenchServer : public Dispatcher {
+  Messenger *msgr;
+public:
+  BenchServer(Messenger *m) : Dispatcher(g_ceph_context), msgr(m) {}
+
+  bool ms_dispatch(Message *m) {
+    if (m->get_type() != CEPH_MSG_PING)
+      return false;
+    MPing *reply = new MPing;
+    reply->set_tid(m->get_tid());
+    msgr->send_message(reply, m->get_connection());
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+};
+
+class BenchClient : public Dispatcher {
+  struct Session {
+    SimpleMessenger *msgr;
+    entity_inst_t dest;
+    map<tid_t, utime_t> in_flight;
+  };
+
+  Mutex lock;
+  Cond cond;
+  vector<Session*> sessions;
+  bufferlist payload;
+  unsigned depth;
+  bool stopping;
+  tid_t last_tid;
+  uint64_t done, done_bytes;
+  vector<double> lat;
+
+  void _send(Session *s) {
+    MPing *m = new MPing;
+    m->set_tid(++last_tid);
+    m->set_data(payload);
+    s->in_flight[last_tid] = ceph_clock_now(g_ceph_context);
+    s->msgr->send_message(m, s->dest);
+  }
+
+public:
+  BenchClient(unsigned size, unsigned d)
+    : Dispatcher(g_ceph_context), lock("BenchClient::lock"),
+      depth(d), stopping(false), last_tid(0), done(0), done_bytes(0) {
+    bufferptr bp(size);
+    memset(bp.c_str(), 0x5a, size);
+    payload.push_back(bp);
+  }
+
+  int add_session(const entity_addr_t& addr, int n) {
+    Session *s = new Session;
+    s->msgr = new SimpleMessenger(g_ceph_context);
+    s->msgr->register_entity(entity_name_t::CLIENT(-1));
+    s->msgr->set_default_policy(SimpleMessenger::Policy::client(0, 0));
+    s->msgr->add_dispatcher_head(this);
+    int r = s->msgr->start_with_nonce(getpid() + n * 1000000);
+    if (r < 0)
+      return r;
+    s->dest.name = entity_name_t::OSD(0);
+    s->dest.addr = addr;
+    sessions.push_back(s);
+    return 0;
+  }
+
+  void run(int seconds) {
+    utime_t start = ceph_clock_now(g_ceph_context);
+    lock.Lock();
+    for (vector<Session*>::iterator p = sessions.begin(); p != sessions.end(); ++p)
+      for (unsigned i = 0; i < depth; i++)
+	_send(*p);
+    utime_t end = start;
+    end += utime_t(seconds, 0);
+    while (ceph_clock_now(g_ceph_context) < end)
+      cond.WaitUntil(lock, end);
+    stopping = true;
+    lock.Unlock();
+    utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+
+    lock.Lock();
+    double secs = (double)elapsed;
+    cout << "sessions " << sessions.size()
+	 << " depth " << depth
+	 << " size " << payload.length() << std::endl;
+    cout << "messages " << done << " in " << secs << " sec: "
+	 << (double)done / secs << " msg/s, "
+	 << (double)done_bytes / secs / (1024*1024) << " MB/s" << std::endl;
+    if (!lat.empty()) {
+      sort(lat.begin(), lat.end());
+      double sum = 0;
+      for (vector<double>::iterator p = lat.begin(); p != lat.end(); ++p)
+	sum += *p;
+      cout << "latency (ms): avg " << sum / lat.size() * 1000.0
+	   << " min " << lat.front() * 1000.0
+	   << " p50 " << lat[lat.size() * 50 / 100] * 1000.0
+	   << " p90 " << lat[lat.size() * 90 / 100] * 1000.0
+	   << " p99 " << lat[lat.size() * 99 / 100] * 1000.0
+	   << " max " << lat.back() * 1000.0 << std::endl;
+    }
+    lock.Unlock();
+
+    for (vector<Session*>::iterator p = sessions.begin(); p != sessions.end(); ++p) {
+      (*p)->msgr->shutdown();
+      (*p)->msgr->wait();
+      (*p)->msgr->destroy();
+      delete *p;
+    }
+    sessions.clear();
+  }
+
+  bool ms_dispatch(Message *m) {
+    if (m->get_type() != CEPH_MSG_PING)
+      return false;
+    utime_t now = ceph_clock_now(g_ceph_context);
+    Mutex::Locker l(lock);
+    for (vector<Session*>::iterator p = sessions.begin(); p != sessions.end(); ++p) {
+      map<tid_t, utime_t>::iterator q = (*p)->in_flight.find(m->get_tid());
+      if (q == (*p)->in_flight.end())
+	continue;
+      lat.push_back((double)(now - q->second));
+      (*p)->in_flight.erase(q);
+      done++;
+      done_bytes += payload.length();
+      if (!stopping)
+	_send(*p);
+      break;
+    }
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+};
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  string server_addr, client_addr;
+  int size = 4096, depth = 16, sessions = 1, seconds = 10;
+  string val;
+  ostringstream err;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+    } else if (ceph_argparse_witharg(args, i, &val, "--server", (char*)NULL)) {
+      server_addr = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--client", (char*)NULL)) {
+      client_addr = val;
+    } else if (ceph_argparse_withint(args, i, &size, &err, "--size", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &depth, &err, "--depth", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &sessions, &err, "--sessions", (char*)NULL) ||
+	       ceph_argparse_withint(args, i, &seconds, &err, "--seconds", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(1);
+      }
+    } else {
+      cerr << "unrecognized argument " << *i << std::endl;
+      usage();
+    }
+  }
+  if (server_addr.empty() == client_addr.empty())
+    usage();
+
+  if (!server_addr.empty()) {
+    entity_addr_t addr;
+    if (!addr.parse(server_addr.c_str())) {
+      cerr << "unable to parse address " << server_addr << std::endl;
+      return 1;
+    }
+    SimpleMessenger *msgr = new SimpleMessenger(g_ceph_context);
+    msgr->register_entity(entity_name_t::OSD(0));
+    msgr->set_default_policy(SimpleMessenger::Policy::stateless_server(0, 0));
+    int r = msgr->bind(addr, getpid());
+    if (r < 0) {
+      cerr << "unable to bind to " << addr << std::endl;
+      return 1;
+    }
+    BenchServer server(msgr);
+    msgr->add_dispatcher_head(&server);
+    msgr->start();
+    cout << "listening on " << msgr->get_myaddr() << std::endl;
+    msgr->wait();
+    msgr->destroy();
+    return 0;
+  }
+
+  entity_addr_t addr;
+  if (!addr.parse(client_addr.c_str())) {
+    cerr << "unable to parse address " << client_addr << std::endl;
+    return 1;
+  }
+  if (size < 0 || depth <= 0 || sessions <= 0 || seconds <= 0)
+    usage();
+  BenchClient client(size, depth);
+  for (int n = 0; n < sessions; n++) {
+    if (client.add_session(addr, n) < 0) {
+      cerr << "unable to start messenger" << std::endl;
+      return 1;
+    }
+  }
+  client.run(seconds);
+  return 0;
+}
@@ -363,3 +363,90 @@ int cls_cxx_map_update(cls_method_context_t hctx, bufferlist* inbl)
   bufferlist outbl;
   return (*pctx)->pg->do_osd_ops(*pctx, ops, outbl);
 }
+
+int cls_cxx_omap_get_vals(cls_method_context_t hctx, const string& start_after,
+			  uint64_t max_to_get, map<string, bufferlist> *vals)
+{
+  ReplicatedPG::OpContext **pctx = (ReplicatedPG::OpContext **)hctx;
+  vector<OSDOp> ops(1);
+  ops[0].op.op = CEPH_OSD_OP_OMAPGETVALS;
+  __u32 max = max_to_get;
+  ::encode(start_after, ops[0].data);
+  ::encode(max, ops[0].data);
+  bufferlist outbl;
+  int ret = (*pctx)->pg->do_osd_ops(*pctx, ops, outbl);
+  if (ret < 0)
+    return ret;
+
+  bufferlist::iterator iter = outbl.begin();
+  try {
+    ::decode(*vals, iter);
+  } catch (buffer::error& e) {
+    return -EIO;
+  }
+  return vals->size();
+}
+
+int cls_cxx_omap_get_val(cls_method_context_t hctx, const string& key,
+			 bufferlist *outbl)
+{
+  ReplicatedPG::OpContext **pctx = (ReplicatedPG::OpContext **)hctx;
+  vector<OSDOp> ops(1);
+  ops[0].op.op = CEPH_OSD_OP_OMAPGETVALSBYKEYS;
+  set<string> keys;
+  keys.insert(key);
+  ::encode(keys, ops[0].data);
+  bufferlist bl;
+  int ret = (*pctx)->pg->do_osd_ops(*pctx, ops, bl);
+  if (ret < 0)
+    return ret;
+
+  map<string, bufferlist> vals;
+  bufferlist::iterator iter = bl.begin();
+  try {
+    ::decode(vals, iter);
+  } catch (buffer::error& e) {
+    return -EIO;
+  }
+  map<string, bufferlist>::iterator p = vals.find(key);
+  if (p == vals.end())
+    return -ENOENT;
+  outbl->claim(p->second);
+  return 0;
+}
+
+int cls_cxx_omap_set_vals(cls_method_context_t hctx,
+			  const map<string, bufferlist> *vals)
+{
+  ReplicatedPG::OpContext **pctx = (ReplicatedPG::OpContext **)hctx;
+  vector<OSDOp> ops(1);
+  ops[0].op.op = CEPH_OSD_OP_OMAPSETVALS;
+  ::encode(*vals, ops[0].data);
+  bufferlist outbl;
+  return (*pctx)->pg->do_osd_ops(*pctx, ops, outbl);
+}
+
+int cls_cxx_omap_set_val(cls_method_context_t hctx, const string& key,
+			 bufferlist *inbl)
+{
+  map<string, bufferlist> vals;
+  vals[key] = *inbl;
+  return cls_cxx_omap_set_vals(hctx, &vals);
+}
+
+int cls_cxx_omap_remove_keys(cls_method_context_t hctx, const set<string>& keys)
+{
+  ReplicatedPG::OpContext **pctx = (ReplicatedPG::OpContext **)hctx;
+  vector<OSDOp> ops(1);
+  ops[0].op.op = CEPH_OSD_OP_OMAPRMKEYS;
+  ::encode(keys, ops[0].data);
+  bufferlist outbl;
+  return (*pctx)->pg->do_osd_ops(*pctx, ops, outbl);
+}
+
+int cls_cxx_omap_remove_key(cls_method_context_t hctx, const string& key)
+{
+  set<string> keys;
+  keys.insert(key);
+  return cls_cxx_omap_remove_keys(hctx, keys);
+}
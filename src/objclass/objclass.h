@@ -102,6 +102,19 @@ extern int cls_cxx_map_write_header(cls_method_context_t hctx, bufferlist *inbl)
 extern int cls_cxx_map_remove_key(cls_method_context_t hctx, string key);
 extern int cls_cxx_map_update(cls_method_context_t hctx, bufferlist* inbl);
 
+/* the object's key/value map (omap); unlike the tmap calls above, these
+ * touch only the keys involved */
+extern int cls_cxx_omap_get_vals(cls_method_context_t hctx, const string& start_after,
+				 uint64_t max_to_get, map<string, bufferlist> *vals);
+extern int cls_cxx_omap_get_val(cls_method_context_t hctx, const string& key,
+				bufferlist *outbl);
+extern int cls_cxx_omap_set_val(cls_method_context_t hctx, const string& key,
+				bufferlist *inbl);
+extern int cls_cxx_omap_set_vals(cls_method_context_t hctx,
+				 const map<string, bufferlist> *vals);
+extern int cls_cxx_omap_remove_key(cls_method_context_t hctx, const string& key);
+extern int cls_cxx_omap_remove_keys(cls_method_context_t hctx, const set<string>& keys);
+
 /* These are also defined in rados.h and librados.h. Keep them in sync! */
 #define CEPH_OSD_TMAP_HDR 'h'
 #define CEPH_OSD_TMAP_SET 's'
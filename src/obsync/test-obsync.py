@@ -411,6 +411,11 @@ compare_directories("%s/dir1" % tdir, "%s/dir2" % tdir)
 if (opts.verbose):
     print "successfully created dir2 from dir1"
 
+if (opts.verbose):
+    print "test a parallel copy between local directories"
+obsync_check("file://%s/dir1" % tdir, "file://%s/dir2p" % tdir, ["-c", "-j", "4"])
+compare_directories("%s/dir1" % tdir, "%s/dir2p" % tdir)
+
 if (opts.verbose):
     print "test a dry run between local directories"
 os.mkdir("%s/dir1b" % tdir)
@@ -0,0 +1,143 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_ATTRCACHE_H
+#define CEPH_OS_ATTRCACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "include/buffer.h"
+#include "include/object.h"
+#include "osd/osd_types.h"
+#include "common/Mutex.h"
+
+/*
+ * A bounded LRU of xattr values, so that the attrs the OSD reads on
+ * nearly every op don't cost a path lookup and a getxattr each time.
+ *
+ * Entries are per object name (sobject_t).  Hard links
+ * (collection_add) share xattrs across collections, so invalidation
+ * always drops everything cached for a name, in every collection.
+ *
+ * A reader that misses takes a generation with begin_fill() before it
+ * goes to the filesystem, and its fill() is dropped if the object was
+ * invalidated (or evicted) in the meantime.  Writers must invalidate
+ * _after_ they modify the filesystem.
+ */
+class AttrCache {
+  struct Entry {
+    uint64_t gen;
+    std::list<sobject_t>::iterator lru_pos;
+    std::map<std::pair<coll_t, std::string>,            // (cid, locator key)
+	     std::map<std::string, bufferptr> > attrs;   // attr name -> value
+  };
+
+  Mutex lock;
+  unsigned max_objects;
+  uint64_t last_gen;
+  std::map<sobject_t, Entry> objects;
+  std::list<sobject_t> lru;   // most recently used at the front
+
+  void _touch(Entry& e, const sobject_t& soid) {
+    lru.erase(e.lru_pos);
+    lru.push_front(soid);
+    e.lru_pos = lru.begin();
+  }
+
+  void _trim() {
+    while (objects.size() > max_objects) {
+      objects.erase(lru.back());
+      lru.pop_back();
+    }
+  }
+
+public:
+  AttrCache(unsigned max)
+    : lock("AttrCache::lock"), max_objects(max), last_gen(0) {}
+
+  bool enabled() const {
+    return max_objects > 0;
+  }
+
+  void set_max(unsigned max) {
+    Mutex::Locker l(lock);
+    max_objects = max;
+    _trim();
+  }
+
+  /// look up a cached value; returns false on a miss
+  bool lookup(coll_t cid, const hobject_t& oid, const char *name, bufferptr& bp) {
+    Mutex::Locker l(lock);
+    sobject_t soid(oid);
+    std::map<sobject_t, Entry>::iterator p = objects.find(soid);
+    if (p == objects.end())
+      return false;
+    std::map<std::pair<coll_t, std::string>, std::map<std::string, bufferptr> >::iterator q =
+      p->second.attrs.find(std::make_pair(cid, oid.get_key()));
+    if (q == p->second.attrs.end())
+      return false;
+    std::map<std::string, bufferptr>::iterator a = q->second.find(name);
+    if (a == q->second.end())
+      return false;
+    bp = a->second;
+    _touch(p->second, soid);
+    return true;
+  }
+
+  /// call before reading from the filesystem; pass the result to fill()
+  uint64_t begin_fill(const hobject_t& oid) {
+    Mutex::Locker l(lock);
+    sobject_t soid(oid);
+    std::map<sobject_t, Entry>::iterator p = objects.find(soid);
+    if (p != objects.end()) {
+      _touch(p->second, soid);
+      return p->second.gen;
+    }
+    Entry& e = objects[soid];
+    e.gen = ++last_gen;
+    lru.push_front(soid);
+    e.lru_pos = lru.begin();
+    _trim();
+    return e.gen;
+  }
+
+  void fill(coll_t cid, const hobject_t& oid, const char *name, const bufferptr& bp,
+	    uint64_t gen) {
+    Mutex::Locker l(lock);
+    std::map<sobject_t, Entry>::iterator p = objects.find(sobject_t(oid));
+    if (p == objects.end() || p->second.gen != gen)
+      return;  // raced with an invalidate or eviction
+    p->second.attrs[std::make_pair(cid, oid.get_key())][name] = bp;
+  }
+
+  /// forget everything about an object, in all collections
+  void invalidate(const hobject_t& oid) {
+    Mutex::Locker l(lock);
+    std::map<sobject_t, Entry>::iterator p = objects.find(sobject_t(oid));
+    if (p == objects.end())
+      return;
+    lru.erase(p->second.lru_pos);
+    objects.erase(p);
+  }
+
+  void clear() {
+    Mutex::Locker l(lock);
+    objects.clear();
+    lru.clear();
+  }
+};
+
+#endif
@@ -15,6 +15,7 @@
 #ifndef OS_COLLECTIONINDEX_H
 #define OS_COLLECTIONINDEX_H
 
+#include <set>
 #include <string>
 #include <vector>
 #include <tr1/memory>
@@ -147,6 +148,39 @@ protected:
     vector<hobject_t> *ls ///< [out] Listed Objects
     ) = 0;
 
+  /**
+   * Hand over subdirectories whose reorganization was deferred
+   *
+   * An index may postpone expensive work (e.g. directory splits) off the
+   * write path.  IndexManager collects the affected subdirectories when
+   * the index is released and later passes them back, one at a time, to
+   * do_deferred from a background thread.
+   */
+  virtual void take_deferred(
+    set<vector<string> > *dirs ///< [out] Subdirectories needing work
+    ) {}
+
+  /// Perform the deferred work for dir, if it is still needed
+  virtual int do_deferred(
+    const vector<string> &dir ///< [in] Subdirectory from take_deferred
+    ) { return 0; }
+
+  /**
+   * Move the objects whose hash has match in its low bits bits into dest
+   *
+   * For collections that are split by hash (pg splits), an index may do
+   * this by moving whole subdirectories instead of individual objects.
+   * dest must be an empty collection using the same kind of index.
+   *
+   * @return Error code, -EOPNOTSUPP if the caller must move the objects
+   * one at a time itself.
+   */
+  virtual int split(
+    uint32_t match,                            ///< [in] Hash bits to match
+    uint32_t bits,                             ///< [in] Number of bits matched
+    std::tr1::shared_ptr<CollectionIndex> dest ///< [in] Destination index
+    ) { return -EOPNOTSUPP; }
+
   /// Virtual destructor
   virtual ~CollectionIndex() {}
 };
@@ -0,0 +1,154 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_EXTENTCACHE_H
+#define CEPH_OS_EXTENTCACHE_H
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+
+#include "include/object.h"
+#include "osd/osd_types.h"
+#include "common/Mutex.h"
+
+/*
+ * A bounded LRU of whole-file extent maps (from FIEMAP, adjacent extents
+ * merged), so that sparse reads of the same object don't fsync it and
+ * ask the filesystem over and over.  rbd reads every block that way.
+ *
+ * Like AttrCache: entries are per object name, since collection_add
+ * hard links share data across collections; readers take a generation
+ * with begin_fill() before going to the filesystem; and writers must
+ * invalidate _after_ they change the file.
+ */
+class ExtentCache {
+  struct Entry {
+    uint64_t gen;
+    std::list<sobject_t>::iterator lru_pos;
+    std::map<std::pair<coll_t, std::string>,         // (cid, locator key)
+	     std::map<uint64_t, uint64_t> > extents;  // offset -> length
+  };
+
+  Mutex lock;
+  unsigned max_objects;
+  uint64_t last_gen;
+  std::map<sobject_t, Entry> objects;
+  std::list<sobject_t> lru;   // most recently used at the front
+
+  void _touch(Entry& e, const sobject_t& soid) {
+    lru.erase(e.lru_pos);
+    lru.push_front(soid);
+    e.lru_pos = lru.begin();
+  }
+
+  void _trim() {
+    while (objects.size() > max_objects) {
+      objects.erase(lru.back());
+      lru.pop_back();
+    }
+  }
+
+public:
+  ExtentCache(unsigned max)
+    : lock("ExtentCache::lock"), max_objects(max), last_gen(0) {}
+
+  bool enabled() const {
+    return max_objects > 0;
+  }
+
+  void set_max(unsigned max) {
+    Mutex::Locker l(lock);
+    max_objects = max;
+    _trim();
+  }
+
+  /// the extents overlapping off~len, clipped to it; false on a miss
+  bool lookup(coll_t cid, const hobject_t& oid, uint64_t off, uint64_t len,
+	      std::map<uint64_t, uint64_t>& m) {
+    Mutex::Locker l(lock);
+    sobject_t soid(oid);
+    std::map<sobject_t, Entry>::iterator p = objects.find(soid);
+    if (p == objects.end())
+      return false;
+    std::map<std::pair<coll_t, std::string>, std::map<uint64_t, uint64_t> >::iterator q =
+      p->second.extents.find(std::make_pair(cid, oid.get_key()));
+    if (q == p->second.extents.end())
+      return false;
+    clip(q->second, off, len, m);
+    _touch(p->second, soid);
+    return true;
+  }
+
+  /// call before asking the filesystem; pass the result to fill()
+  uint64_t begin_fill(const hobject_t& oid) {
+    Mutex::Locker l(lock);
+    sobject_t soid(oid);
+    std::map<sobject_t, Entry>::iterator p = objects.find(soid);
+    if (p != objects.end()) {
+      _touch(p->second, soid);
+      return p->second.gen;
+    }
+    Entry& e = objects[soid];
+    e.gen = ++last_gen;
+    lru.push_front(soid);
+    e.lru_pos = lru.begin();
+    _trim();
+    return e.gen;
+  }
+
+  /// the extents of the whole file
+  void fill(coll_t cid, const hobject_t& oid, const std::map<uint64_t, uint64_t>& m,
+	    uint64_t gen) {
+    Mutex::Locker l(lock);
+    std::map<sobject_t, Entry>::iterator p = objects.find(sobject_t(oid));
+    if (p == objects.end() || p->second.gen != gen)
+      return;  // raced with an invalidate or eviction
+    p->second.extents[std::make_pair(cid, oid.get_key())] = m;
+  }
+
+  /// forget an object, in all collections
+  void invalidate(const hobject_t& oid) {
+    Mutex::Locker l(lock);
+    std::map<sobject_t, Entry>::iterator p = objects.find(sobject_t(oid));
+    if (p == objects.end())
+      return;
+    lru.erase(p->second.lru_pos);
+    objects.erase(p);
+  }
+
+  void clear() {
+    Mutex::Locker l(lock);
+    objects.clear();
+    lru.clear();
+  }
+
+  /// the part of extent map all that overlaps off~len
+  static void clip(const std::map<uint64_t, uint64_t>& all, uint64_t off, uint64_t len,
+		   std::map<uint64_t, uint64_t>& m) {
+    uint64_t end = off + len;
+    std::map<uint64_t, uint64_t>::const_iterator p = all.upper_bound(off);
+    if (p != all.begin())
+      --p;
+    for (; p != all.end() && p->first < end; ++p) {
+      uint64_t s = std::max(p->first, off);
+      uint64_t e = std::min(p->first + p->second, end);
+      if (s < e)
+	m[s] = e - s;
+    }
+  }
+};
+
+#endif
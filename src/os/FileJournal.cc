@@ -15,12 +15,15 @@
 #include "common/debug.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
+#include "common/numa.h"
 #include "FileJournal.h"
 #include "include/color.h"
 #include "common/perf_counters.h"
 #include "os/ObjectStore.h"
+#include "include/interval_set.h"
 
 #include <fcntl.h>
+#include <limits.h>
 #include <sstream>
 #include <stdio.h>
 #include <sys/types.h>
@@ -80,6 +83,31 @@ int FileJournal::_open(bool forwrite, bool create)
   if (ret)
     return ret;
 
+  if (forwrite) {
+    aio = false;
+    if (g_conf->journal_aio) {
+#ifdef HAVE_LIBAIO
+      if (directio && is_bdev) {
+	if (!aio_ctx) {
+	  ret = io_setup(aio_max_inflight, &aio_ctx);
+	  if (ret < 0) {
+	    derr << "FileJournal::_open: unable to set up aio context: "
+		 << cpp_strerror(ret) << ", falling back to sync writes" << dendl;
+	    aio_ctx = 0;
+	  }
+	}
+	aio = (aio_ctx != 0);
+      } else {
+	dout(0) << "_open journal_aio requires a block device and journal_dio, "
+		<< "using sync writes" << dendl;
+      }
+#else
+      dout(0) << "_open journal_aio requested, but not built with libaio, "
+	      << "using sync writes" << dendl;
+#endif
+    }
+  }
+
   /* We really want max_size to be a multiple of block_size. */
   max_size -= max_size % block_size;
 
@@ -91,7 +119,7 @@ int FileJournal::_open(bool forwrite, bool create)
   dout(1) << "_open " << fn << " fd " << fd
 	  << ": " << max_size 
 	  << " bytes, block size " << block_size
-	  << " bytes, directio = " << directio << dendl;
+	  << " bytes, directio = " << directio << ", aio = " << aio << dendl;
   return 0;
 }
 
@@ -325,6 +353,7 @@ int FileJournal::create()
   else
     header.alignment = 16;  // at least stay word aligned on 64bit machines...
   header.start = get_top();
+  header.flags = header_t::FLAG_ENTRY_FLAGS;
   print_header();
 
   bp = prepare_header();
@@ -467,15 +496,31 @@ void FileJournal::close()
 
   // close
   assert(writeq.empty());
+  assert(submitq == NULL);
   assert(fd >= 0);
   TEMP_FAILURE_RETRY(::close(fd));
   fd = -1;
+  readahead = bufferptr();
 }
 
 void FileJournal::start_writer()
 {
   write_stop = false;
-  write_thread.create();
+#ifdef HAVE_LIBAIO
+  if (aio) {
+    aio_stop = false;
+    write_finish_thread.create();
+  }
+#endif
+  if (!g_conf->journal_write_thread_cpus.empty()) {
+    cpu_set_t cpus;
+    if (parse_cpu_set_list(g_conf->journal_write_thread_cpus, &cpus) == 0)
+      write_thread.set_affinity(&cpus);
+    else
+      derr << "ignoring malformed journal_write_thread_cpus '"
+	   << g_conf->journal_write_thread_cpus << "'" << dendl;
+  }
+  write_thread.create("journal_write");
 }
 
 void FileJournal::stop_writer()
@@ -487,6 +532,17 @@ void FileJournal::stop_writer()
   } 
   write_lock.Unlock();
   write_thread.join();
+
+#ifdef HAVE_LIBAIO
+  if (aio) {
+    // the writer is done; let the finisher reap what is still in flight
+    write_lock.Lock();
+    aio_stop = true;
+    aio_cond.Signal();
+    write_lock.Unlock();
+    write_finish_thread.join();
+  }
+#endif
 }
 
 
@@ -672,15 +728,114 @@ void FileJournal::queue_completions_thru(uint64_t seq)
   }
 }
 
+static bool page_is_zero(const char *p)
+{
+  const uint64_t *w = (const uint64_t *)p;
+  for (unsigned i = 0; i < PAGE_SIZE / sizeof(*w); i++)
+    if (w[i])
+      return false;
+  return true;
+}
+
+/*
+ * encode bl into out, leaving out its zero-filled pages:
+ *
+ *   __u32 length, interval_set<uint64_t> zero extents, non-zero data
+ *
+ * bl itself is left alone.  returns false (with out untouched) if there
+ * aren't enough zeros to bother.
+ */
+bool FileJournal::encode_zero_extents(bufferlist& bl, bufferlist& out)
+{
+  interval_set<uint64_t> zeros;
+  char page[PAGE_SIZE];
+  bufferlist::iterator p = bl.begin();
+  uint64_t end = bl.length() & PAGE_MASK;
+  for (uint64_t off = 0; off < end; off += PAGE_SIZE) {
+    p.copy(PAGE_SIZE, page);
+    if (page_is_zero(page))
+      zeros.insert(off, PAGE_SIZE);
+  }
+  if (zeros.empty() ||
+      zeros.size() < g_conf->journal_zero_extent_min)
+    return false;
+
+  __u32 len = bl.length();
+  ::encode(len, out);
+  ::encode(zeros, out);
+  uint64_t pos = 0;
+  for (interval_set<uint64_t>::iterator q = zeros.begin(); q != zeros.end(); ++q) {
+    if (q.get_start() > pos) {
+      bufferlist t;
+      t.substr_of(bl, pos, q.get_start() - pos);
+      out.claim_append(t);
+    }
+    pos = q.get_start() + q.get_len();
+  }
+  if (pos < bl.length()) {
+    bufferlist t;
+    t.substr_of(bl, pos, bl.length() - pos);
+    out.claim_append(t);
+  }
+  dout(20) << "encode_zero_extents " << len << " bytes -> " << out.length()
+	   << ", zeros " << zeros << dendl;
+  return true;
+}
+
+bool FileJournal::decode_zero_extents(bufferlist& bl)
+{
+  bufferlist out;
+  try {
+    bufferlist::iterator p = bl.begin();
+    __u32 len;
+    interval_set<uint64_t> zeros;
+    ::decode(len, p);
+    ::decode(zeros, p);
+    uint64_t pos = 0;
+    for (interval_set<uint64_t>::iterator q = zeros.begin(); q != zeros.end(); ++q) {
+      if (q.get_start() < pos || q.get_start() + q.get_len() > len)
+	return false;
+      if (q.get_start() > pos)
+	p.copy(q.get_start() - pos, out);
+      out.append_zero(q.get_len());
+      pos = q.get_start() + q.get_len();
+    }
+    if (pos < len)
+      p.copy(len - pos, out);
+    if (!p.end() || out.length() != len)
+      return false;
+  }
+  catch (buffer::error& e) {
+    return false;
+  }
+  bl.claim(out);
+  return true;
+}
+
 int FileJournal::prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64_t& orig_ops, uint64_t& orig_bytes)
 {
   // grab next item
   uint64_t seq = writeq.front().seq;
   bufferlist &ebl = writeq.front().bl;
+  unsigned orig_len = ebl.length();
+  int alignment = writeq.front().alignment; // we want to start ebl with this alignment
+
+  // encode on the side: if the entry doesn't fit yet, it stays queued
+  // as it was, and its length still matches what was throttled
+  uint32_t eflags = 0;
+  bufferlist zbl;
+  if ((header.flags & header_t::FLAG_ENTRY_FLAGS) &&
+      g_conf->journal_zero_extent_min > 0 &&
+      ebl.length() >= (unsigned)g_conf->journal_zero_extent_min &&
+      encode_zero_extents(ebl, zbl)) {
+    eflags |= entry_header_t::FLAG_ZEROS;
+    alignment = -1;  // the data no longer sits where the payload wanted it
+  }
+  bufferlist &pbl = (eflags & entry_header_t::FLAG_ZEROS) ? zbl : ebl;
+
   unsigned head_size = sizeof(entry_header_t);
-  off64_t base_size = 2*head_size + ebl.length();
+  off64_t base_size = 2*head_size + pbl.length();
 
-  int alignment = writeq.front().alignment; // we want to start ebl with this alignment
   unsigned pre_pad = 0;
   if (alignment >= 0)
     pre_pad = (alignment - head_size) & ~PAGE_MASK;
@@ -691,22 +846,23 @@ int FileJournal::prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64
   if (r < 0)
     return r;   // ENOSPC or EAGAIN
 
-  orig_bytes += ebl.length();
+  orig_bytes += orig_len;
   orig_ops++;
 
   // add to write buffer
   dout(15) << "prepare_single_write " << orig_ops << " will write " << queue_pos << " : seq " << seq
-	   << " len " << ebl.length() << " -> " << size
+	   << " len " << pbl.length() << " -> " << size
 	   << " (head " << head_size << " pre_pad " << pre_pad
-	   << " ebl " << ebl.length() << " post_pad " << post_pad << " tail " << head_size << ")"
+	   << " ebl " << pbl.length() << " post_pad " << post_pad << " tail " << head_size << ")"
 	   << " (ebl alignment " << alignment << ")"
 	   << dendl;
     
   // add it this entry
   entry_header_t h;
   h.seq = seq;
+  h.flags = eflags;
   h.pre_pad = pre_pad;
-  h.len = ebl.length();
+  h.len = pbl.length();
   h.post_pad = post_pad;
   h.make_magic(queue_pos, header.fsid);
 
@@ -715,7 +871,7 @@ int FileJournal::prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64
     bufferptr bp = buffer::create_static(pre_pad, zero_buf);
     bl.push_back(bp);
   }
-  bl.claim_append(ebl);
+  bl.claim_append(pbl);
   if (h.post_pad) {
     bufferptr bp = buffer::create_static(post_pad, zero_buf);
     bl.push_back(bp);
@@ -866,7 +1022,11 @@ void FileJournal::do_write(bufferlist& bl)
   assert(write_pos % header.alignment == 0);
 
   journaled_seq = writing_seq;
+  queue_journaled_completions();
+}
 
+void FileJournal::queue_journaled_completions()
+{
   // kick finisher?  
   //  only if we haven't filled up recently!
   if (full_state != FULL_NOTFULL) {
@@ -883,10 +1043,236 @@ void FileJournal::do_write(bufferlist& bl)
   }
 }
 
+#ifdef HAVE_LIBAIO
+/*
+ * the throttle for ops/bytes is returned when the last aio of the
+ * write completes (check_aio_completion), not on submission.
+ */
+void FileJournal::do_aio_write(bufferlist& bl, uint64_t ops, uint64_t bytes)
+{
+  // nothing to do?
+  if (bl.length() == 0 && !must_write_header) {
+    put_throttle(ops, bytes);
+    return;
+  }
+
+  if (must_write_header) {
+    // the new header may trim entries that are still in flight; let
+    // everything before it land first.
+    while (aio_num > 0) {
+      dout(20) << "do_aio_write waiting for " << aio_num << " aios before writing header" << dendl;
+      aio_cond.Wait(write_lock);
+    }
+    must_write_header = false;
+    buffer::ptr hbp = prepare_header();
+    if (TEMP_FAILURE_RETRY(::pwrite(fd, hbp.c_str(), hbp.length(), 0)) < 0) {
+      int err = errno;
+      derr << "FileJournal::do_aio_write: pwrite(fd=" << fd
+	   << ", hbp.length=" << hbp.length() << ") failed :"
+	   << cpp_strerror(err) << dendl;
+      ceph_abort();
+    }
+  }
+
+  dout(15) << "do_aio_write writing " << write_pos << "~" << bl.length() << dendl;
+  bool entries = bl.length() > 0;
+
+  // entry
+  off64_t pos = write_pos;
+
+  // split?
+  if (pos + bl.length() > header.max_size) {
+    bufferlist first, second;
+    off64_t split = header.max_size - pos;
+    first.substr_of(bl, 0, split);
+    second.substr_of(bl, split, bl.length() - split);
+    dout(10) << "do_aio_write wrapping, first bit at " << pos << " len " << first.length()
+	     << " second bit len " << second.length() << " (orig len " << bl.length() << ")" << dendl;
+
+    if (write_aio_bl(pos, first, 0)) {
+      derr << "FileJournal::do_aio_write: write_aio_bl(pos=" << pos
+	   << ") failed" << dendl;
+      ceph_abort();
+    }
+    assert(pos == header.max_size);
+    pos = get_top();
+    if (write_aio_bl(pos, second, writing_seq)) {
+      derr << "FileJournal::do_aio_write: write_aio_bl(pos=" << pos
+	   << ") failed" << dendl;
+      ceph_abort();
+    }
+  } else {
+    if (write_aio_bl(pos, bl, writing_seq)) {
+      derr << "FileJournal::do_aio_write: write_aio_bl(pos=" << pos
+	   << ") failed" << dendl;
+      ceph_abort();
+    }
+  }
+
+  if (entries) {
+    aio_queue.back().throttle_ops += ops;
+    aio_queue.back().throttle_bytes += bytes;
+  } else {
+    put_throttle(ops, bytes);   // header only
+  }
+
+  // wrap if we hit the end of the journal
+  if (pos == header.max_size)
+    pos = get_top();
+  write_pos = pos;
+  assert(write_pos % header.alignment == 0);
+}
+
+/*
+ * queue bl for writing at pos.  seq, if non-zero, is journaled once
+ * this write and all those submitted before it complete.
+ */
+int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
+{
+  assert(write_lock.is_locked());
+
+  // make sure list segments are page aligned
+  if (!bl.is_page_aligned() || !bl.is_n_page_sized()) {
+    bl.rebuild_page_aligned();
+    if ((bl.length() & ~PAGE_MASK) != 0 ||
+	(pos & ~PAGE_MASK) != 0)
+      dout(0) << "rebuild_page_aligned failed, " << bl << dendl;
+    assert((bl.length() & ~PAGE_MASK) == 0);
+    assert((pos & ~PAGE_MASK) == 0);
+  }
+
+  while (bl.length() > 0) {
+    while (aio_num >= aio_max_inflight) {
+      dout(20) << "write_aio_bl " << aio_num << " aios in flight, waiting" << dendl;
+      aio_cond.Wait(write_lock);
+    }
+
+    // at most IOV_MAX segments per aio
+    bufferlist tbl;
+    if (bl.buffers().size() > IOV_MAX) {
+      unsigned len = 0;
+      int n = 0;
+      for (list<bufferptr>::const_iterator p = bl.buffers().begin();
+	   n < IOV_MAX; ++p, ++n)
+	len += p->length();
+      bl.splice(0, len, &tbl);
+    } else {
+      tbl.claim(bl);
+    }
+
+    aio_queue.push_back(aio_info(tbl, pos, bl.length() ? 0 : seq));
+    aio_info& ai = aio_queue.back();
+    ai.iov = new iovec[ai.bl.buffers().size()];
+    int n = 0;
+    for (list<bufferptr>::const_iterator p = ai.bl.buffers().begin();
+	 p != ai.bl.buffers().end();
+	 ++p, ++n) {
+      ai.iov[n].iov_base = (void *)p->c_str();
+      ai.iov[n].iov_len = p->length();
+    }
+    io_prep_pwritev(&ai.iocb, fd, ai.iov, n, pos);
+    ai.iocb.data = (void *)&ai;
+
+    dout(20) << "write_aio_bl " << pos << "~" << ai.len << " seq " << ai.seq << dendl;
+
+    int attempts = 10;
+    while (true) {
+      iocb *piocb = &ai.iocb;
+      int r = io_submit(aio_ctx, 1, &piocb);
+      if (r == 1)
+	break;
+      if (r == -EAGAIN && attempts-- > 0) {
+	dout(1) << "write_aio_bl io_submit got EAGAIN, retrying" << dendl;
+	aio_cond.WaitInterval(g_ceph_context, write_lock, utime_t(0, 1000000));
+	continue;
+      }
+      derr << "FileJournal::write_aio_bl: io_submit got " << cpp_strerror(r) << dendl;
+      aio_queue.pop_back();
+      return r < 0 ? r : -EIO;
+    }
+    aio_num++;
+    aio_bytes += ai.len;
+    pos += ai.len;
+    aio_cond.Signal();  // wake the finisher
+  }
+  return 0;
+}
+
+void FileJournal::write_finish_thread_entry()
+{
+  dout(10) << "write_finish_thread_entry enter" << dendl;
+  while (true) {
+    {
+      Mutex::Locker locker(write_lock);
+      if (aio_num == 0) {
+	if (aio_stop)
+	  break;
+	dout(20) << "write_finish_thread_entry sleeping" << dendl;
+	aio_cond.Wait(write_lock);
+	continue;
+      }
+    }
+
+    io_event event[16];
+    int r = io_getevents(aio_ctx, 1, 16, event, NULL);
+    if (r < 0) {
+      if (r == -EINTR)
+	continue;
+      derr << "FileJournal::write_finish_thread_entry: io_getevents got "
+	   << cpp_strerror(r) << dendl;
+      assert(0 == "got unexpected error from io_getevents");
+    }
+
+    Mutex::Locker locker(write_lock);
+    for (int i = 0; i < r; i++) {
+      aio_info *ai = (aio_info *)event[i].data;
+      if (event[i].res != ai->len) {
+	derr << "FileJournal::write_finish_thread_entry: aio to " << ai->off << "~" << ai->len
+	     << " got " << cpp_strerror((int)event[i].res) << dendl;
+	assert(0 == "unexpected aio error");
+      }
+      dout(10) << "write_finish_thread_entry aio " << ai->off << "~" << ai->len
+	       << " done" << dendl;
+      ai->done = true;
+    }
+    check_aio_completion();
+  }
+  dout(10) << "write_finish_thread_entry exit" << dendl;
+}
+
+/*
+ * retire finished aios from the front of the queue, so that
+ * journaled_seq only moves forward over writes that have all landed.
+ */
+void FileJournal::check_aio_completion()
+{
+  assert(write_lock.is_locked());
+  uint64_t new_journaled_seq = 0;
+  while (!aio_queue.empty() && aio_queue.front().done) {
+    aio_info& ai = aio_queue.front();
+    if (ai.seq)
+      new_journaled_seq = ai.seq;
+    if (ai.throttle_ops || ai.throttle_bytes)
+      put_throttle(ai.throttle_ops, ai.throttle_bytes);
+    aio_num--;
+    aio_bytes -= ai.len;
+    aio_queue.pop_front();
+  }
+  if (new_journaled_seq) {
+    dout(20) << "check_aio_completion journaled_seq " << journaled_seq
+	     << " -> " << new_journaled_seq << dendl;
+    journaled_seq = new_journaled_seq;
+    queue_journaled_completions();
+  }
+  aio_cond.Signal();
+  write_empty_cond.Signal();
+}
+#endif
+
 void FileJournal::flush()
 {
   write_lock.Lock();
-  while ((!writeq.empty() || writing) && !write_stop) {
+  while ((!writeq.empty() || submitq || writing || aio_pending()) && !write_stop) {
     dout(5) << "flush waiting for writeq to empty and writes to complete" << dendl;
     write_empty_cond.Wait(write_lock);
   }
@@ -902,8 +1288,10 @@ void FileJournal::write_thread_entry()
   dout(10) << "write_thread_entry start" << dendl;
   write_lock.Lock();
   
-  while (!write_stop || 
-	 !writeq.empty()) {  // ensure we fully flush the writeq before stopping
+  while (true) {
+    drain_submitq();
+    if (write_stop && writeq.empty())
+      break;  // ensure we fully flush the writeq before stopping
     if (writeq.empty()) {
       // sleep
       dout(20) << "write_thread_entry going to sleep" << dendl;
@@ -925,6 +1313,12 @@ void FileJournal::write_thread_entry()
       continue;
     }
     assert(r == 0);
+#ifdef HAVE_LIBAIO
+    if (aio) {
+      do_aio_write(bl, orig_ops, orig_bytes);
+      continue;
+    }
+#endif
     do_write(bl);
     
     put_throttle(orig_ops, orig_bytes);
@@ -934,36 +1328,85 @@ void FileJournal::write_thread_entry()
   dout(10) << "write_thread_entry finish" << dendl;
 }
 
+/*
+ * push onto the submit queue.  returns true if the queue was empty,
+ * in which case the caller is responsible for waking the writer.
+ */
+bool FileJournal::push_submitq(submit_item *i)
+{
+  while (true) {
+    submit_item *head = submitq;
+    i->next = head;
+    if (__sync_bool_compare_and_swap(&submitq, head, i))
+      return head == NULL;
+  }
+}
 
-void FileJournal::submit_entry(uint64_t seq, bufferlist& e, int alignment, Context *oncommit)
+/*
+ * move everything submitted so far onto writeq, oldest first.
+ */
+void FileJournal::drain_submitq()
 {
-  Mutex::Locker locker(write_lock);  // ** lock **
+  assert(write_lock.is_locked());
+  submit_item *list;
+  do {
+    list = submitq;
+    if (!list)
+      return;
+  } while (!__sync_bool_compare_and_swap(&submitq, list, (submit_item *)NULL));
+
+  // the queue is LIFO; reverse it back into submission order
+  submit_item *prev = NULL;
+  while (list) {
+    submit_item *next = list->next;
+    list->next = prev;
+    prev = list;
+    list = next;
+  }
 
+  int n = 0;
+  while (prev) {
+    submit_item *i = prev;
+    prev = i->next;
+    completions.push_back(completion_item(i->seq, i->finish, i->start));
+    if (full_state == FULL_NOTFULL) {
+      // only what is queued for writing counts against the throttle;
+      // the writer (or committed_thru) returns it
+      throttle_ops.take(1);
+      throttle_bytes.take(i->bl.length());
+      writeq.push_back(write_item(i->seq, i->bl, i->alignment));
+    } else {
+      // not journaling this.  restart writing no sooner than seq + 1.
+      dout(10) << "drain_submitq journal is/was full, dropping seq " << i->seq << dendl;
+    }
+    delete i;
+    n++;
+  }
+  dout(20) << "drain_submitq moved " << n << " items" << dendl;
+
+  if (logger) {
+    logger->set(l_os_jq_max_ops, throttle_ops.get_max());
+    logger->set(l_os_jq_max_bytes, throttle_bytes.get_max());
+    logger->set(l_os_jq_ops, throttle_ops.get_current());
+    logger->set(l_os_jq_bytes, throttle_bytes.get_current());
+  }
+}
+
+void FileJournal::submit_entry(uint64_t seq, bufferlist& e, int alignment, Context *oncommit)
+{
   // dump on queue
   dout(5) << "submit_entry seq " << seq
 	   << " len " << e.length()
 	   << " (" << oncommit << ")" << dendl;
 
-  completions.push_back(completion_item(seq, oncommit, ceph_clock_now(g_ceph_context)));
-
-  if (full_state == FULL_NOTFULL) {
-    // queue and kick writer thread
-    dout(30) << "XXX throttle take " << e.length() << dendl;
-    throttle_ops.take(1);
-    throttle_bytes.take(e.length());
-
-    if (logger) {
-      logger->set(l_os_jq_max_ops, throttle_ops.get_max());
-      logger->set(l_os_jq_max_bytes, throttle_bytes.get_max());
-      logger->set(l_os_jq_ops, throttle_ops.get_current());
-      logger->set(l_os_jq_bytes, throttle_bytes.get_current());
-    }
-
-    writeq.push_back(write_item(seq, e, alignment));
+  // callers submit in seq order (under journal_lock), so the push order
+  // is the journal order.
+  submit_item *i = new submit_item(seq, e, alignment, oncommit,
+				   ceph_clock_now(g_ceph_context));
+  if (push_submitq(i)) {
+    // first one in; kick the writer thread
+    Mutex::Locker locker(write_lock);
     write_cond.Signal();
-  } else {
-    // not journaling this.  restart writing no sooner than seq + 1.
-    dout(10) << " journal is/was full" << dendl;
   }
 }
 
@@ -1006,6 +1449,10 @@ void FileJournal::committed_thru(uint64_t seq)
   dout(5) << "committed_thru " << seq << " (last_committed_seq " << last_committed_seq << ")" << dendl;
   last_committed_seq = seq;
 
+  // pick up anything the writer hasn't seen yet, so its completions and
+  // committed-but-unwritten entries are handled below.
+  drain_submitq();
+
   // adjust start pointer
   while (!journalq.empty() && journalq.front().first <= seq) {
     journalq.pop_front();
@@ -1069,6 +1516,7 @@ void FileJournal::make_writeable()
   else
     write_pos = get_top();
   read_pos = 0;
+  readahead = bufferptr();
 
   must_write_header = true;
   start_writer();
@@ -1085,6 +1533,29 @@ void FileJournal::wrap_read_bl(off64_t& pos, int64_t olen, bufferlist& bl)
       len = header.max_size - pos;        // partial
     else
       len = olen;                         // rest
+
+    // replay reads the journal front to back, an entry's header, data
+    // and footer at a time; serve those from one big sequential read.
+    int64_t ra = g_conf->journal_replay_readahead;
+    if (ra > len) {
+      if (!readahead.length() || pos < readahead_pos ||
+	  pos + len > readahead_pos + (off64_t)readahead.length()) {
+	int64_t rlen = std::min<int64_t>(ra, header.max_size - pos);
+	readahead = buffer::create_page_aligned(rlen);
+	readahead_pos = pos;
+	int r = safe_pread_exact(fd, readahead.c_str(), rlen, pos);
+	if (r) {
+	  derr << "FileJournal::wrap_read_bl: safe_pread_exact " << pos << "~" << rlen
+	       << " returned " << r << dendl;
+	  ceph_abort();
+	}
+	dout(20) << "wrap_read_bl read ahead " << pos << "~" << rlen << dendl;
+      }
+      bl.push_back(bufferptr(readahead, pos - readahead_pos, len));
+      pos += len;
+      olen -= len;
+      continue;
+    }
     
 #ifdef DARWIN
     ::lseek(fd, pos, SEEK_SET);
@@ -1143,9 +1614,19 @@ bool FileJournal::read_entry(bufferlist& bl, uint64_t& seq)
     return false;
   }
 
+  if ((header.flags & header_t::FLAG_ENTRY_FLAGS) &&
+      (h->flags & entry_header_t::FLAG_ZEROS)) {
+    if (!decode_zero_extents(bl)) {
+      dout(0) << "read_entry " << read_pos << " : seq " << h->seq
+	      << " bad zero extent encoding, end of journal" << dendl;
+      return false;
+    }
+  }
+
   // yay!
   dout(1) << "read_entry " << read_pos << " : seq " << h->seq
 	  << " " << h->len << " bytes"
+	  << (bl.length() != h->len ? " (expanded)" : "")
 	  << dendl;
 
   if (seq && h->seq < seq) {
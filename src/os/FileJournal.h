@@ -25,6 +25,10 @@ using std::deque;
 #include "common/Thread.h"
 #include "common/Throttle.h"
 
+#ifdef HAVE_LIBAIO
+# include <libaio.h>
+#endif
+
 class FileJournal : public Journal {
 public:
   /*
@@ -39,6 +43,10 @@ public:
     int64_t max_size;   // max size of journal ring buffer
     int64_t start;      // offset of first entry
 
+    enum {
+      FLAG_ENTRY_FLAGS = 1,  // entry_header_t::flags are meaningful
+    };
+
     header_t() : version(1), flags(0), fsid(0), block_size(0), alignment(0), max_size(0), start(0) {}
 
     void clear() {
@@ -47,6 +55,10 @@ public:
   } header __attribute__((__packed__, aligned(4)));
 
   struct entry_header_t {
+    enum {
+      FLAG_ZEROS = 1,  // payload is zero extents + remaining data; see encode_zero_extents()
+    };
+
     uint64_t seq;  // fs op seq #
     uint32_t flags;
     uint32_t len;
@@ -74,10 +86,15 @@ private:
   size_t block_size;
   bool is_bdev;
   bool directio;
+  bool aio;
   bool writing, must_write_header;
   off64_t write_pos;      // byte where the next entry to be written will go
   off64_t read_pos;       // 
 
+  // replay reads journal_replay_readahead at a time; this is the window
+  bufferptr readahead;
+  off64_t readahead_pos;
+
   uint64_t last_committed_seq;
 
   /*
@@ -121,8 +138,32 @@ private:
       bl.claim(b);
     }
   };
-  deque<write_item> writeq;
-  
+  deque<write_item> writeq;  // owned by the writer; protected by write_lock
+
+  /*
+   * submitted but not yet seen by the writer.  submitters push onto
+   * this lock-free LIFO without taking write_lock; the writer grabs the
+   * whole list at once and moves it onto writeq (and completions) in
+   * submission order, so a burst of small entries costs one wakeup and
+   * goes out in a single write.
+   */
+  struct submit_item {
+    uint64_t seq;
+    bufferlist bl;
+    int alignment;
+    Context *finish;
+    utime_t start;
+    submit_item *next;
+    submit_item(uint64_t s, bufferlist& b, int al, Context *c, utime_t st) :
+      seq(s), alignment(al), finish(c), start(st), next(NULL) {
+      bl.claim(b);
+    }
+  };
+  submit_item *submitq;
+
+  bool push_submitq(submit_item *i);
+  void drain_submitq();
+
   // throttle
   Throttle throttle_ops, throttle_bytes;
 
@@ -135,6 +176,59 @@ private:
 
   Cond commit_cond;
 
+#ifdef HAVE_LIBAIO
+  /*
+   * aio mode: the writer keeps up to aio_max_inflight writes
+   * outstanding, and the write finisher thread reaps them and moves
+   * journaled_seq forward in submission order.  protected by write_lock.
+   */
+  struct aio_info {
+    struct iocb iocb;
+    bufferlist bl;
+    struct iovec *iov;
+    bool done;
+    uint64_t off, len;
+    uint64_t seq;    // journaled once this (and everything before it) lands; 0 if none
+    uint64_t throttle_ops, throttle_bytes;  // returned once this lands
+
+    aio_info(bufferlist& b, uint64_t o, uint64_t s)
+      : iov(NULL), done(false), off(o), len(b.length()), seq(s),
+	throttle_ops(0), throttle_bytes(0) {
+      bl.claim(b);
+      memset((void*)&iocb, 0, sizeof(iocb));
+    }
+    ~aio_info() {
+      delete[] iov;
+    }
+  };
+  enum { aio_max_inflight = 128 };
+  io_context_t aio_ctx;
+  list<aio_info> aio_queue;
+  int aio_num;
+  uint64_t aio_bytes;
+  Cond aio_cond;
+  bool aio_stop;
+
+  void do_aio_write(bufferlist& bl, uint64_t ops, uint64_t bytes);
+  int write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq);
+  void write_finish_thread_entry();
+  void check_aio_completion();
+
+  class WriteFinisher : public Thread {
+    FileJournal *journal;
+  public:
+    WriteFinisher(FileJournal *fj) : journal(fj) {}
+    void *entry() {
+      journal->write_finish_thread_entry();
+      return 0;
+    }
+  } write_finish_thread;
+
+  bool aio_pending() const { return aio_num > 0; }
+#else
+  bool aio_pending() const { return false; }
+#endif
+
   int _open(bool wr, bool create=false);
   int _open_block_device();
   void _check_disk_write_cache() const;
@@ -149,9 +243,12 @@ private:
   void queue_completions_thru(uint64_t seq);
 
   int check_for_full(uint64_t seq, off64_t pos, off64_t size);
+  bool encode_zero_extents(bufferlist& bl, bufferlist& out);
+  bool decode_zero_extents(bufferlist& bl);
   int prepare_multi_write(bufferlist& bl, uint64_t& orig_ops, uint64_t& orig_bytee);
   int prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64_t& orig_ops, uint64_t& orig_bytes);
   void do_write(bufferlist& bl);
+  void queue_journaled_completions();
 
   int write_bl(off64_t& pos, bufferlist& bl);
   void wrap_read_bl(off64_t& pos, int64_t len, bufferlist& bl);
@@ -175,19 +272,28 @@ private:
     Journal(fsid, fin, sync_cond), fn(f),
     zero_buf(NULL),
     max_size(0), block_size(0),
-    is_bdev(false),directio(dio),
+    is_bdev(false),directio(dio), aio(false),
     writing(false), must_write_header(false),
-    write_pos(0), read_pos(0),
+    write_pos(0), read_pos(0), readahead_pos(0),
     last_committed_seq(0), 
     full_state(FULL_NOTFULL),
     fd(-1),
     writing_seq(0), journaled_seq(0),
     plug_journal_completions(false),
+    submitq(NULL),
     write_lock("FileJournal::write_lock"),
     write_stop(false),
+#ifdef HAVE_LIBAIO
+    aio_ctx(0), aio_num(0), aio_bytes(0), aio_stop(false),
+    write_finish_thread(this),
+#endif
     write_thread(this) { }
   ~FileJournal() {
     delete[] zero_buf;
+#ifdef HAVE_LIBAIO
+    if (aio_ctx)
+      io_destroy(aio_ctx);
+#endif
   }
 
   int create();
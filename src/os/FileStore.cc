@@ -53,7 +53,9 @@
 #include "common/Timer.h"
 #include "common/debug.h"
 #include "common/errno.h"
+#include "common/Formatter.h"
 #include "common/run_cmd.h"
+#include "common/numa.h"
 #include "common/safe_io.h"
 #include "common/perf_counters.h"
 #include "common/sync_filesystem.h"
@@ -614,25 +616,30 @@ FileStore::FileStore(const std::string &base, const std::string &jdev) :
   btrfs_snap_destroy(false),
   btrfs_snap_create_v2(false),
   btrfs_wait_sync(false),
-  ioctl_fiemap(false),
+  ioctl_fiemap(false), ioctl_extsize(false), punch_hole(true),
   fsid_fd(-1), op_fd(-1),
   basedir_fd(-1), current_fd(-1),
   attrs(this), fake_attrs(false),
+  attr_cache(g_conf->filestore_attr_cache_size),
+  extent_cache(g_conf->filestore_extent_cache_size),
   collections(this), fake_collections(false),
-  ondisk_finisher(g_ceph_context),
+  ondisk_finisher(g_ceph_context, g_conf->filestore_ondisk_finisher_threads),
   lock("FileStore::lock"),
   force_sync(false), sync_epoch(0),
   sync_entry_timeo_lock("sync_entry_timeo_lock"),
   timer(g_ceph_context, sync_entry_timeo_lock),
-  stop(false), sync_thread(this),
-  op_queue_len(0), op_queue_bytes(0), op_finisher(g_ceph_context), next_finish(0),
-  op_tp(g_ceph_context, "FileStore::op_tp", g_conf->filestore_op_threads),
+  stop(false), sync_thread(this), commit_wait_thread(this),
+  op_queue_len(0), op_queue_bytes(0), op_finisher(g_ceph_context, g_conf->filestore_op_finisher_threads),
+  op_tp(g_ceph_context, "FileStore::op_tp", g_conf->filestore_op_threads, "filestore_op_threads"),
   op_wq(this, g_conf->filestore_op_thread_timeout,
 	g_conf->filestore_op_thread_suicide_timeout, &op_tp),
   flusher_queue_len(0), flusher_thread(this),
+  split_thread(this),
   logger(NULL),
+  admin_command(this), admin_command_registered(false),
   m_filestore_btrfs_clone_range(g_conf->filestore_btrfs_clone_range),
   m_filestore_btrfs_snap (g_conf->filestore_btrfs_snap ),
+  m_filestore_btrfs_snap_pipeline(g_conf->filestore_btrfs_snap_pipeline),
   m_filestore_btrfs_trans(g_conf->filestore_btrfs_trans),
   m_filestore_fake_attrs(g_conf->filestore_fake_attrs),
   m_filestore_fake_collections(g_conf->filestore_fake_collections),
@@ -645,8 +652,14 @@ FileStore::FileStore(const std::string &base, const std::string &jdev) :
   m_filestore_journal_writeahead(g_conf->filestore_journal_writeahead),
   m_filestore_dev(g_conf->filestore_dev),
   m_filestore_fiemap_threshold(g_conf->filestore_fiemap_threshold),
+  m_filestore_alloc_hint_extsize(g_conf->filestore_alloc_hint_extsize),
+  m_filestore_alloc_hint_fallocate(g_conf->filestore_alloc_hint_fallocate),
+  m_filestore_alloc_hint_max_size(g_conf->filestore_alloc_hint_max_size),
   m_filestore_sync_flush(g_conf->filestore_sync_flush),
+  m_filestore_odirect_min_size(g_conf->filestore_odirect_min_size),
   m_filestore_flusher_max_fds(g_conf->filestore_flusher_max_fds),
+  m_filestore_flusher_coalesce_max_age(g_conf->filestore_flusher_coalesce_max_age),
+  m_filestore_flusher_coalesce_max_bytes(g_conf->filestore_flusher_coalesce_max_bytes),
   m_filestore_max_sync_interval(g_conf->filestore_max_sync_interval),
   m_filestore_min_sync_interval(g_conf->filestore_min_sync_interval),
   m_filestore_update_collections(g_conf->filestore_update_collections),
@@ -691,10 +704,13 @@ FileStore::FileStore(const std::string &base, const std::string &jdev) :
   plb.add_u64_counter(l_os_j_full, "journal_full");
 
   logger = plb.create_perf_counters();
+
+  g_conf->add_observer(this);
 }
 
 FileStore::~FileStore()
 {
+  g_conf->remove_observer(this);
   if (journal)
     journal->logger = NULL;
   delete logger;
@@ -1133,6 +1149,22 @@ int FileStore::_detect_fs()
     return -errno;
   blk_size = st.f_bsize;
 
+  // extent size hints?
+  ioctl_extsize = false;
+  static const __SWORD_TYPE XFS_F_TYPE(0x58465342);
+  if (st.f_type == XFS_F_TYPE) {
+#ifdef FS_IOC_FSSETXATTR
+    if (m_filestore_alloc_hint_extsize) {
+      dout(0) << "mount xfs extent size hints are supported" << dendl;
+      ioctl_extsize = true;
+    } else {
+      dout(0) << "mount xfs extent size hints are DISABLED via 'filestore alloc hint extsize' option" << dendl;
+    }
+#else
+    dout(0) << "mount xfs extent size hints are NOT supported (no FS_IOC_FSSETXATTR)" << dendl;
+#endif
+  }
+
   static const __SWORD_TYPE BTRFS_F_TYPE(0x9123683E);
   if (st.f_type == BTRFS_F_TYPE) {
     dout(0) << "mount detected btrfs" << dendl;      
@@ -1627,6 +1659,16 @@ int FileStore::mount()
 
   dout(5) << "mount op_seq is " << initial_op_seq << dendl;
 
+  // object maps live in current/, so they are snapshotted and synced with it.
+  // they are not optional: a replica without them could not apply the
+  // OMAP_* ops its primary sends.
+  ret = object_map.open(current_fn + "/omap.db");
+  if (ret < 0) {
+    derr << "FileStore::mount: unable to open object maps (omap): "
+	 << cpp_strerror(ret) << dendl;
+    goto close_current_fd;
+  }
+
   // journal
   open_journal();
 
@@ -1702,9 +1744,20 @@ int FileStore::mount()
 
   journal_start();
 
-  sync_thread.create();
+  sync_thread.create("filestore_sync");
+  commit_wait_thread.create("filestore_commit");
+  if (!g_conf->filestore_op_thread_cpus.empty()) {
+    cpu_set_t cpus;
+    if (parse_cpu_set_list(g_conf->filestore_op_thread_cpus, &cpus) == 0)
+      op_tp.set_affinity(&cpus);
+    else
+      derr << "ignoring malformed filestore_op_thread_cpus '"
+	   << g_conf->filestore_op_thread_cpus << "'" << dendl;
+  }
   op_tp.start();
   flusher_thread.create();
+  index_manager.start_deferred();
+  split_thread.create();
   op_finisher.start();
   ondisk_finisher.start();
 
@@ -1712,10 +1765,15 @@ int FileStore::mount()
 
   g_ceph_context->get_perfcounters_collection()->add(logger);
 
+  admin_command_registered =
+    g_ceph_context->get_admin_socket()->register_command("dump_filestore_queue",
+      "filestore op queue and flusher state", &admin_command) == 0;
+
   // all okay.
   return 0;
 
 close_current_fd:
+  object_map.close();
   TEMP_FAILURE_RETRY(::close(current_fd));
   current_fd = -1;
 close_basedir_fd:
@@ -1732,6 +1790,11 @@ done:
 int FileStore::umount() 
 {
   dout(5) << "umount " << basedir << dendl;
+
+  if (admin_command_registered) {
+    g_ceph_context->get_admin_socket()->unregister_command("dump_filestore_queue");
+    admin_command_registered = false;
+  }
   
   start_sync();
 
@@ -1741,10 +1804,19 @@ int FileStore::umount()
   flusher_cond.Signal();
   lock.Unlock();
   sync_thread.join();
+  lock.Lock();
+  pending_commit_cond.Signal();
+  lock.Unlock();
+  commit_wait_thread.join();
   op_tp.stop();
   flusher_thread.join();
+  index_manager.stop_deferred();
+  split_thread.join();
 
   journal_stop();
+  attr_cache.clear();
+  extent_cache.clear();
+  object_map.close();
 
   g_ceph_context->get_perfcounters_collection()->remove(logger);
 
@@ -1828,9 +1900,6 @@ FileStore::Op *FileStore::build_op(list<Transaction*>& tls,
 void FileStore::queue_op(OpSequencer *osr, Op *o)
 {
   assert(journal_lock.is_locked());
-  // initialize next_finish on first op
-  if (next_finish == 0)
-    next_finish = op_seq;
 
   // mark apply start _now_, because we need to drain the entire apply
   // queue during commit in order to put the store in a consistent
@@ -1860,6 +1929,33 @@ void FileStore::op_queue_reserve_throttle(Op *o)
   op_tp.unlock();
 }
 
+void FileStore::AdminCommand::dump_command(const std::string &command,
+					   ceph::Formatter *f)
+{
+  uint64_t max_ops = store->m_filestore_queue_max_ops;
+  uint64_t max_bytes = store->m_filestore_queue_max_bytes;
+  bool committing = store->is_committing();
+  if (committing) {
+    max_ops += store->m_filestore_queue_committing_max_ops;
+    max_bytes += store->m_filestore_queue_committing_max_bytes;
+  }
+
+  f->open_object_section("filestore_queue");
+  f->dump_int("committing", committing);
+  store->op_tp.lock();
+  f->dump_unsigned("op_queue_ops", store->op_queue_len);
+  f->dump_unsigned("op_queue_bytes", store->op_queue_bytes);
+  f->dump_unsigned("op_queue_sequencers", store->op_queue.size());
+  store->op_tp.unlock();
+  f->dump_unsigned("op_queue_max_ops", max_ops);
+  f->dump_unsigned("op_queue_max_bytes", max_bytes);
+  store->lock.Lock();
+  f->dump_int("flusher_queue_len", store->flusher_queue_len);
+  store->lock.Unlock();
+  f->dump_int("flusher_max_fds", store->m_filestore_flusher_max_fds);
+  f->close_section();
+}
+
 void FileStore::_op_queue_reserve_throttle(Op *o, const char *caller)
 {
   // Do not call while holding the journal lock!
@@ -1919,40 +2015,22 @@ void FileStore::_finish_op(OpSequencer *osr)
   osr->apply_lock.Unlock();  // locked in _do_op
 
   // called with tp lock held
+  osr->applying = false;  // free for the next worker
   _op_queue_release_throttle(o);
 
   utime_t lat = ceph_clock_now(g_ceph_context);
   lat -= o->start;
   logger->finc(l_os_apply_lat, lat);
 
-  if (next_finish == o->op) {
-    dout(10) << "_finish_op " << o->op << " next_finish " << next_finish
-	     << " queueing " << o->onreadable << " doing " << o->onreadable_sync << dendl;
-    next_finish++;
-    if (o->onreadable_sync) {
-      o->onreadable_sync->finish(0);
-      delete o->onreadable_sync;
-    }
-    op_finisher.queue(o->onreadable);
-
-    while (finish_queue.begin()->first == next_finish) {
-      Context *c = finish_queue.begin()->second.first;
-      Context *s = finish_queue.begin()->second.second;
-      finish_queue.erase(finish_queue.begin());
-      dout(10) << "_finish_op " << o->op << " next_finish " << next_finish
-	       << " queueing delayed " << c << " doing " << s << dendl;
-      if (s) {
-	s->finish(0);
-	delete s;
-      }
-      op_finisher.queue(c);
-      next_finish++;
-    }
-  } else {
-    dout(10) << "_finish_op " << o->op << " next_finish " << next_finish
-	     << ", delaying " << o->onreadable << dendl;
-    finish_queue[o->op] = pair<Context*,Context*>(o->onreadable, o->onreadable_sync);
+  // ops on a sequencer are applied one at a time, so they finish in
+  // order; there is no ordering between sequencers.
+  dout(10) << "_finish_op " << o->op << " queueing " << o->onreadable
+	   << " doing " << o->onreadable_sync << dendl;
+  if (o->onreadable_sync) {
+    o->onreadable_sync->finish(0);
+    delete o->onreadable_sync;
   }
+  op_finisher.queue_ordered((uintptr_t)osr, o->onreadable);
 
   delete o;
 }
@@ -1997,14 +2075,33 @@ int FileStore::queue_transactions(Sequencer *posr, list<Transaction*> &tls,
   }
 
   if (journal && journal->is_writeable() && !m_filestore_journal_trailing) {
+    // an op with a nojournal transaction is left out of the journal
+    // altogether: we journal an empty entry, so that replay still sees
+    // every seq, and it is on disk only once a commit of the fs itself
+    // covers it.  journaling part of it (say, the pg log) would replay
+    // that without the rest.
+    bool nojournal = false;
+    for (list<Transaction*>::iterator p = tls.begin(); p != tls.end(); ++p)
+      if ((*p)->is_nojournal())
+	nojournal = true;
+    list<Transaction*> none;
+
     Op *o = build_op(tls, onreadable, onreadable_sync);
     op_queue_reserve_throttle(o);
     journal->throttle();
     o->op = op_submit_start();
+    list<Transaction*>& jtls = nojournal ? none : o->tls;
+    if (nojournal) {
+      dout(5) << "queue_transactions (nojournal) " << o->op << dendl;
+      if (ondisk)
+	_op_commit_waiter(o->op, ondisk);
+      ondisk = NULL;
+    }
+
     if (m_filestore_journal_parallel) {
       dout(5) << "queue_transactions (parallel) " << o->op << " " << o->tls << dendl;
       
-      _op_journal_transactions(o->tls, o->op, ondisk);
+      _op_journal_transactions(jtls, o->op, ondisk);
       
       // queue inside journal lock, to preserve ordering
       queue_op(osr, o);
@@ -2013,7 +2110,7 @@ int FileStore::queue_transactions(Sequencer *posr, list<Transaction*> &tls,
       
       osr->queue_journal(o->op);
 
-      _op_journal_transactions(o->tls, o->op, new C_JournaledAhead(this, osr, o, ondisk));
+      _op_journal_transactions(jtls, o->op, new C_JournaledAhead(this, osr, o, ondisk));
     } else {
       assert(0);
     }
@@ -2039,7 +2136,7 @@ int FileStore::queue_transactions(Sequencer *posr, list<Transaction*> &tls,
     onreadable_sync->finish(r);
     delete onreadable_sync;
   }
-  op_finisher.queue(onreadable, r);
+  op_finisher.queue_ordered((uintptr_t)osr, onreadable, r);
 
   op_submit_finish(op);
   op_apply_finish(op);
@@ -2051,19 +2148,21 @@ void FileStore::_journaled_ahead(OpSequencer *osr, Op *o, Context *ondisk)
 {
   dout(5) << "_journaled_ahead " << o->op << " " << o->tls << dendl;
 
+  // do ondisk completions async, to prevent any onreadable_sync completions
+  // getting blocked behind an ondisk completion.  queue them first: the
+  // entry is durable now, and queue_op may block while a commit drains
+  // the apply queue.
+  if (ondisk) {
+    dout(10) << " queueing ondisk " << ondisk << dendl;
+    ondisk_finisher.queue_ordered((uintptr_t)osr, ondisk);
+  }
+
   // this should queue in order because the journal does it's completions in order.
   journal_lock.Lock();
   queue_op(osr, o);
   journal_lock.Unlock();
 
   osr->dequeue_journal();
-
-  // do ondisk completions async, to prevent any onreadable_sync completions
-  // getting blocked behind an ondisk completion.
-  if (ondisk) {
-    dout(10) << " queueing ondisk " << ondisk << dendl;
-    ondisk_finisher.queue(ondisk);
-  }
 }
 
 int FileStore::do_transactions(list<Transaction*> &tls, uint64_t op_seq)
@@ -2220,6 +2319,27 @@ unsigned FileStore::_do_transaction(Transaction& t)
       }
       break;
       
+    case Transaction::OP_FADVISE:
+      {
+	coll_t cid = t.get_cid();
+	hobject_t oid = t.get_oid();
+	uint64_t off = t.get_length();
+	uint64_t len = t.get_length();
+	uint32_t hints = t.get_u32();
+	_fadvise(cid, oid, off, len, hints);
+      }
+      break;
+
+    case Transaction::OP_SETALLOCHINT:
+      {
+	coll_t cid = t.get_cid();
+	hobject_t oid = t.get_oid();
+	uint64_t object_size = t.get_length();
+	uint64_t write_size = t.get_length();
+	_set_alloc_hint(cid, oid, object_size, write_size);
+      }
+      break;
+
     case Transaction::OP_TRIMCACHE:
       {
 	coll_t cid = t.get_cid();
@@ -2290,6 +2410,34 @@ unsigned FileStore::_do_transaction(Transaction& t)
       }
       break;
       
+    case Transaction::OP_OMAP_SETKEYS:
+      {
+	coll_t cid = t.get_cid();
+	hobject_t oid = t.get_oid();
+	map<string, bufferlist> kv;
+	t.get_omap_keyvals(kv);
+	r = _omap_setkeys(cid, oid, kv);
+      }
+      break;
+
+    case Transaction::OP_OMAP_RMKEYS:
+      {
+	coll_t cid = t.get_cid();
+	hobject_t oid = t.get_oid();
+	set<string> keys;
+	t.get_omap_keys(keys);
+	r = _omap_rmkeys(cid, oid, keys);
+      }
+      break;
+
+    case Transaction::OP_OMAP_CLEAR:
+      {
+	coll_t cid = t.get_cid();
+	hobject_t oid = t.get_oid();
+	r = _omap_clear(cid, oid);
+      }
+      break;
+
     case Transaction::OP_CLONE:
       {
 	coll_t cid = t.get_cid();
@@ -2383,6 +2531,16 @@ unsigned FileStore::_do_transaction(Transaction& t)
       }
       break;
 
+    case Transaction::OP_SPLIT_COLLECTION:
+      {
+	coll_t cid(t.get_cid());
+	uint32_t bits(t.get_u32());
+	uint32_t rem(t.get_u32());
+	coll_t dest(t.get_cid());
+	r = _split_collection(cid, bits, rem, dest);
+      }
+      break;
+
     default:
       cerr << "bad op " << op << std::endl;
       assert(0);
@@ -2452,8 +2610,27 @@ int FileStore::stat(coll_t cid, const hobject_t& oid, struct stat *st)
   return r;
 }
 
+/*
+ * Pass CEPH_OSD_OP_FLAG_FADVISE_* hints on to the page cache.  These
+ * are only hints: failures are ignored.
+ */
+static void fadvise_fd(int fd, uint64_t offset, uint64_t len, uint32_t hints)
+{
+#ifndef DARWIN
+  if (hints & CEPH_OSD_OP_FLAG_FADVISE_RANDOM)
+    ::posix_fadvise(fd, offset, len, POSIX_FADV_RANDOM);
+  if (hints & CEPH_OSD_OP_FLAG_FADVISE_SEQUENTIAL)
+    ::posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+  if (hints & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED)
+    ::posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+  if (hints & CEPH_OSD_OP_FLAG_FADVISE_DONTNEED)
+    ::posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+#endif
+}
+
 int FileStore::read(coll_t cid, const hobject_t& oid, 
-                    uint64_t offset, size_t len, bufferlist& bl)
+                    uint64_t offset, size_t len, bufferlist& bl,
+		    uint32_t op_flags)
 {
   int got;
 
@@ -2474,8 +2651,14 @@ int FileStore::read(coll_t cid, const hobject_t& oid,
     len = st.st_size;
   }
 
+  // access pattern hints go before the read, DONTNEED after it
+  fadvise_fd(fd, offset, len, op_flags & CEPH_OSD_OP_FLAG_FADVISE_MASK &
+	     ~CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+
   bufferptr bptr(len);  // prealloc space for entire read
   got = safe_pread(fd, bptr.c_str(), len, offset);
+  if (got > 0)
+    fadvise_fd(fd, offset, got, op_flags & CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
   if (got < 0) {
     dout(10) << "FileStore::read(" << cid << "/" << oid << "): pread error "
 	     << cpp_strerror(got) << dendl;
@@ -2491,6 +2674,103 @@ int FileStore::read(coll_t cid, const hobject_t& oid,
   return got;
 }
 
+/*
+ * The returned buffer holds a dup of the object's fd and is only read
+ * into memory if someone looks at it; otherwise the messenger sends it
+ * with sendfile().  The data is whatever is in the file at that point,
+ * not at the time of this call, so callers use it only for objects
+ * that aren't written in place.
+ */
+int FileStore::read_zero_copy(coll_t cid, const hobject_t& oid,
+			      uint64_t offset, size_t len, bufferlist& bl,
+			      uint32_t op_flags)
+{
+  dout(15) << "read_zero_copy " << cid << "/" << oid << " " << offset << "~" << len << dendl;
+
+  int fd = lfn_open(cid, oid, O_RDONLY);
+  if (fd < 0) {
+    int err = errno;
+    dout(10) << "FileStore::read_zero_copy(" << cid << "/" << oid << "): open error "
+	     << cpp_strerror(err) << dendl;
+    return -err;
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) < 0) {
+    int err = errno;
+    TEMP_FAILURE_RETRY(::close(fd));
+    return -err;
+  }
+  uint64_t size = st.st_size;
+  if (offset >= size)
+    len = 0;
+  else if (len == 0 || offset + len > size)
+    len = size - offset;
+
+  // the data is read (or sent) later, so DONTNEED would only be undone
+  fadvise_fd(fd, offset, len, op_flags & CEPH_OSD_OP_FLAG_FADVISE_MASK &
+	     ~CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+  if (len)
+    bl.push_back(bufferptr(buffer::create_fd(fd, offset, len)));
+  TEMP_FAILURE_RETRY(::close(fd));
+
+  dout(10) << "FileStore::read_zero_copy " << cid << "/" << oid << " " << offset << "~"
+	   << len << dendl;
+  return len;
+}
+
+/*
+ * The extents of offset~len in fd, adjacent ones merged.  We map and
+ * cache the whole file, so the next sparse read of the object needs
+ * neither the fsync do_fiemap does nor the ioctl.
+ */
+int FileStore::_fiemap_fd(int fd, coll_t cid, const hobject_t& oid,
+			  uint64_t offset, size_t len,
+			  map<uint64_t, uint64_t>& m)
+{
+  if (extent_cache.enabled() && extent_cache.lookup(cid, oid, offset, len, m)) {
+    dout(15) << "fiemap " << cid << "/" << oid << " " << offset << "~" << len
+	     << " (cached)" << dendl;
+    return 0;
+  }
+  uint64_t gen = 0;
+  if (extent_cache.enabled())
+    gen = extent_cache.begin_fill(oid);
+
+  struct fiemap *fiemap = NULL;
+  int r;
+  if (gen)
+    r = do_fiemap(fd, 0, (size_t)FIEMAP_MAX_OFFSET, &fiemap);
+  else
+    r = do_fiemap(fd, offset, len, &fiemap);
+  if (r < 0)
+    return r;
+
+  map<uint64_t, uint64_t> all;
+  struct fiemap_extent *extent = &fiemap->fm_extents[0];
+  for (unsigned i = 0; i < fiemap->fm_mapped_extents; i++, extent++) {
+    dout(20) << "fiemap fe_logical=" << extent->fe_logical
+	     << " fe_length=" << extent->fe_length << dendl;
+    if (extent->fe_flags & FIEMAP_EXTENT_UNWRITTEN)
+      continue;  // preallocated; reads back as zeros
+    if (!all.empty()) {
+      map<uint64_t, uint64_t>::iterator last = all.end();
+      --last;
+      if (last->first + last->second == extent->fe_logical) {
+	last->second += extent->fe_length;
+	continue;
+      }
+    }
+    all[extent->fe_logical] = extent->fe_length;
+  }
+  free(fiemap);
+
+  if (gen)
+    extent_cache.fill(cid, oid, all, gen);
+  ExtentCache::clip(all, offset, len, m);
+  return 0;
+}
+
 int FileStore::fiemap(coll_t cid, const hobject_t& oid,
                     uint64_t offset, size_t len,
                     bufferlist& bl)
@@ -2502,8 +2782,6 @@ int FileStore::fiemap(coll_t cid, const hobject_t& oid,
     return 0;
   }
 
-
-  struct fiemap *fiemap = NULL;
   map<uint64_t, uint64_t> extmap;
 
   dout(15) << "fiemap " << cid << "/" << oid << " " << offset << "~" << len << dendl;
@@ -2515,65 +2793,183 @@ int FileStore::fiemap(coll_t cid, const hobject_t& oid,
     dout(10) << "read couldn't open " << cid << "/" << oid << " errno " << errno << " " << strerror_r(errno, buf, sizeof(buf)) << dendl;
     r = -errno;
   } else {
-    uint64_t i;
+    r = _fiemap_fd(fd, cid, oid, offset, len, extmap);
+    TEMP_FAILURE_RETRY(::close(fd));
+  }
+  if (r >= 0)
+    ::encode(extmap, bl);
 
-    r = do_fiemap(fd, offset, len, &fiemap);
-    if (r < 0)
-      goto done;
+  dout(10) << "fiemap " << cid << "/" << oid << " " << offset << "~" << len << " = " << r << " num extents=" << extmap.size() << dendl;
+  return r;
+}
 
-    if (fiemap->fm_mapped_extents == 0)
-      goto done;
+/*
+ * One open, the (cached) extent map, and a single pread spanning all
+ * the extents; reading the holes in between costs no disk io, and the
+ * extents are sliced out of the one buffer.
+ */
+int FileStore::sparse_read(coll_t cid, const hobject_t& oid,
+			   uint64_t offset, size_t len,
+			   map<uint64_t, uint64_t>& m, bufferlist& bl,
+			   uint32_t op_flags)
+{
+  dout(15) << "sparse_read " << cid << "/" << oid << " " << offset << "~" << len << dendl;
 
-    struct fiemap_extent *extent = &fiemap->fm_extents[0];
+  int fd = lfn_open(cid, oid, O_RDONLY);
+  if (fd < 0) {
+    int err = errno;
+    dout(10) << "sparse_read " << cid << "/" << oid << ": open error "
+	     << cpp_strerror(err) << dendl;
+    return -err;
+  }
 
-    /* start where we were asked to start */
-    if (extent->fe_logical < offset) {
-      extent->fe_length -= offset - extent->fe_logical;
-      extent->fe_logical = offset;
-    }
+  if (len == 0) {
+    struct stat st;
+    memset(&st, 0, sizeof(struct stat));
+    ::fstat(fd, &st);
+    len = (uint64_t)st.st_size > offset ? st.st_size - offset : 0;
+  }
+
+  int r = 0;
+  if (!ioctl_fiemap || len <= (size_t)m_filestore_fiemap_threshold) {
+    if (len)
+      m[offset] = len;
+  } else {
+    r = _fiemap_fd(fd, cid, oid, offset, len, m);
+  }
+  if (r < 0 || m.empty()) {
+    TEMP_FAILURE_RETRY(::close(fd));
+    return r;
+  }
 
-    i = 0;
+  map<uint64_t, uint64_t>::iterator last = m.end();
+  --last;
+  uint64_t start = m.begin()->first;
+  uint64_t span = last->first + last->second - start;
 
-    while (i < fiemap->fm_mapped_extents) {
-      struct fiemap_extent *next = extent + 1;
+  fadvise_fd(fd, start, span, op_flags & CEPH_OSD_OP_FLAG_FADVISE_MASK &
+	     ~CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+  bufferptr bptr(span);
+  int got = safe_pread(fd, bptr.c_str(), span, start);
+  if (got > 0)
+    fadvise_fd(fd, start, got, op_flags & CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+  TEMP_FAILURE_RETRY(::close(fd));
+  if (got < 0) {
+    dout(10) << "sparse_read " << cid << "/" << oid << ": pread error "
+	     << cpp_strerror(got) << dendl;
+    m.clear();
+    return got;
+  }
+  bptr.set_length(got);
+  bufferlist all;
+  all.push_back(bptr);
+
+  // the file may end before the extents do
+  uint64_t end = start + got;
+  int total = 0;
+  map<uint64_t, uint64_t>::iterator p = m.begin();
+  while (p != m.end()) {
+    if (p->first >= end) {
+      m.erase(p++);
+      continue;
+    }
+    if (p->first + p->second > end)
+      p->second = end - p->first;
+    bufferlist t;
+    t.substr_of(all, p->first - start, p->second);
+    bl.claim_append(t);
+    total += p->second;
+    ++p;
+  }
 
-      dout(10) << "FileStore::fiemap() fm_mapped_extents=" << fiemap->fm_mapped_extents
-	       << " fe_logical=" << extent->fe_logical << " fe_length=" << extent->fe_length << dendl;
+  dout(10) << "sparse_read " << cid << "/" << oid << " " << offset << "~" << len
+	   << " = " << total << " in " << m.size() << " extents" << dendl;
+  return total;
+}
 
-      /* try to merge extents */
-      while ((i < fiemap->fm_mapped_extents - 1) &&
-             (extent->fe_logical + extent->fe_length == next->fe_logical)) {
-          next->fe_length += extent->fe_length;
-          next->fe_logical = extent->fe_logical;
-          extent = next;
-          next = extent + 1;
-          i++;
+/*
+ * Physical layout of every object, from FIEMAP; unlike fiemap() above we
+ * only merge extents that are contiguous on disk.  Sizes are in KB, and
+ * free space comes from statfs since its extents aren't visible to us.
+ */
+void FileStore::_get_frag_stat(FragmentationStat& st)
+{
+  st.total = st.num_extent = st.avg_extent = st.avg_extent_jump = 0;
+  st.avg_extent_per_object = 0;
+  st.total_free = st.num_free_extent = st.avg_free_extent = 0;
+  st.extent_dist.clear();
+  st.extent_dist_sum.clear();
+  st.free_extent_dist.clear();
+  st.free_extent_dist_sum.clear();
+
+  uint64_t total = 0, jumps = 0, njumps = 0, nobjects = 0;
+  vector<coll_t> cls;
+  list_collections(cls);
+  for (vector<coll_t>::iterator c = cls.begin(); c != cls.end(); ++c) {
+    vector<hobject_t> ls;
+    collection_list(*c, ls);
+    for (vector<hobject_t>::iterator o = ls.begin(); o != ls.end(); ++o) {
+      int fd = lfn_open(*c, *o, O_RDONLY);
+      if (fd < 0)
+	continue;
+      struct fiemap *fm = NULL;
+      int r = do_fiemap(fd, 0, ~0ULL >> 1, &fm);
+      TEMP_FAILURE_RETRY(::close(fd));
+      if (r < 0)
+	continue;
+      nobjects++;
+      uint64_t start = 0, len = 0;
+      for (unsigned i = 0; i <= fm->fm_mapped_extents; i++) {
+	struct fiemap_extent *e = &fm->fm_extents[i];
+	if (i < fm->fm_mapped_extents && len && e->fe_physical == start + len) {
+	  len += e->fe_length;
+	  continue;
+	}
+	if (len) {
+	  uint64_t kb = (len + 1023) / 1024;
+	  int b = 1;
+	  while (b < 63 && kb >= (1ULL << b))
+	    b++;
+	  st.extent_dist[b]++;
+	  st.extent_dist_sum[b] += kb;
+	  st.num_extent++;
+	  total += kb;
+	  if (i < fm->fm_mapped_extents) {
+	    uint64_t end = start + len;
+	    jumps += (e->fe_physical > end ? e->fe_physical - end : end - e->fe_physical) / 1024;
+	    njumps++;
+	  }
+	}
+	if (i < fm->fm_mapped_extents) {
+	  start = e->fe_physical;
+	  len = e->fe_length;
+	}
       }
-
-      if (extent->fe_logical + extent->fe_length > offset + len)
-        extent->fe_length = offset + len - extent->fe_logical;
-      extmap[extent->fe_logical] = extent->fe_length;
-      i++;
-      extent++;
+      free(fm);
     }
   }
 
-done:
-  if (fd >= 0)
-    TEMP_FAILURE_RETRY(::close(fd));
-  if (r >= 0)
-    ::encode(extmap, bl);
+  st.total = total;
+  if (st.num_extent)
+    st.avg_extent = total / st.num_extent;
+  if (nobjects)
+    st.avg_extent_per_object = (float)st.num_extent / (float)nobjects;
+  if (njumps)
+    st.avg_extent_jump = jumps / njumps;
 
-  dout(10) << "fiemap " << cid << "/" << oid << " " << offset << "~" << len << " = " << r << " num extents=" << extmap.size() << dendl;
-  free(fiemap);
-  return r;
+  struct statfs sfs;
+  if (statfs(&sfs) == 0)
+    st.total_free = (uint64_t)sfs.f_bfree * sfs.f_bsize / 1024;
 }
 
 
 int FileStore::_remove(coll_t cid, const hobject_t& oid) 
 {
   dout(15) << "remove " << cid << "/" << oid << dendl;
+  _omap_remove_link(cid, oid);
   int r = lfn_unlink(cid, oid);
+  attr_cache.invalidate(oid);
+  extent_cache.invalidate(oid);
   dout(10) << "remove " << cid << "/" << oid << " = " << r << dendl;
   return r;
 }
@@ -2582,6 +2978,7 @@ int FileStore::_truncate(coll_t cid, const hobject_t& oid, uint64_t size)
 {
   dout(15) << "truncate " << cid << "/" << oid << " size " << size << dendl;
   int r = lfn_truncate(cid, oid, size);
+  extent_cache.invalidate(oid);
   dout(10) << "truncate " << cid << "/" << oid << " size " << size << " = " << r << dendl;
   return r;
 }
@@ -2614,7 +3011,17 @@ int FileStore::_write(coll_t cid, const hobject_t& oid,
 
   char buf[80];
   int flags = O_WRONLY|O_CREAT;
-  int fd = lfn_open(cid, oid, flags, 0644);
+  int fd;
+
+  if (m_filestore_odirect_min_size && len >= m_filestore_odirect_min_size &&
+      bl.length() == len && (offset & ~PAGE_MASK) == 0 && (len & ~PAGE_MASK) == 0) {
+    r = _write_direct(cid, oid, offset, bl);
+    if (r != -EINVAL)
+      goto out;
+    dout(10) << "write " << cid << "/" << oid << " can't do O_DIRECT, buffering it" << dendl;
+  }
+
+  fd = lfn_open(cid, oid, flags, 0644);
   if (fd < 0) {
     dout(0) << "write couldn't open " << cid << "/" << oid << " flags " << flags << " errno " << errno << " " << strerror_r(errno, buf, sizeof(buf)) << dendl;
     r = -errno;
@@ -2652,14 +3059,180 @@ int FileStore::_write(coll_t cid, const hobject_t& oid,
 #endif
 
  out:
+  extent_cache.invalidate(oid);  // _zero too
   dout(10) << "write " << cid << "/" << oid << " " << offset << "~" << len << " = " << r << dendl;
   return r;
 }
 
+/*
+ * Large aligned writes (rgw stripes, whole rbd objects) skip the page
+ * cache: no copy into it, and no pile of dirty pages for sync_entry to
+ * write back at once.  When write() returns the data has only been
+ * handed to the device, which may still hold it in a volatile cache,
+ * and the new size and allocation are not written at all.  So the
+ * write goes through the flusher like any other, and is durable only
+ * once the next sync commits.  -EINVAL if the file system can't do
+ * O_DIRECT, for the caller to buffer it instead.
+ */
+int FileStore::_write_direct(coll_t cid, const hobject_t& oid, uint64_t offset,
+			     const bufferlist& bl)
+{
+  char buf[80];
+  int fd = lfn_open(cid, oid, O_WRONLY|O_CREAT|O_DIRECT, 0644);
+  if (fd < 0) {
+    int r = -errno;
+    if (r != -EINVAL)
+      dout(0) << "write_direct couldn't open " << cid << "/" << oid << " errno " << errno
+	      << " " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+    return r;
+  }
+
+  // page-aligned segments copy only what isn't already
+  bufferlist abl(bl);
+  if (!abl.is_page_aligned() || !abl.is_n_page_sized())
+    abl.rebuild_page_aligned();
+
+  int r;
+  int64_t actual = ::lseek64(fd, offset, SEEK_SET);
+  if (actual != (int64_t)offset) {
+    r = actual < 0 ? -errno : -EIO;
+    dout(0) << "write_direct lseek64 to " << offset << " gave " << actual << dendl;
+  } else {
+    r = abl.write_fd(fd);
+    if (r == 0)
+      r = abl.length();
+  }
+
+  // the kernel wrote back and invalidated cached pages in the range first;
+  // drop any a racing reader brought back in, so they can't go stale
+  if (r < 0) {
+    TEMP_FAILURE_RETRY(::close(fd));
+    return r;
+  }
+  posix_fadvise(fd, offset, abl.length(), POSIX_FADV_DONTNEED);
+
+  // flush?
+#ifdef HAVE_SYNC_FILE_RANGE
+  if (!m_filestore_flusher ||
+      !queue_flusher(fd, offset, abl.length())) {
+    if (m_filestore_sync_flush)
+      ::sync_file_range(fd, offset, abl.length(), SYNC_FILE_RANGE_WRITE);
+    ::close(fd);
+  }
+#else
+  ::close(fd);
+#endif
+  return r;
+}
+
+int FileStore::_fadvise(coll_t cid, const hobject_t& oid, uint64_t offset, uint64_t len,
+			uint32_t hints)
+{
+  dout(15) << "fadvise " << cid << "/" << oid << " " << offset << "~" << len
+	   << " hints " << hex << hints << dec << dendl;
+  int fd = lfn_open(cid, oid, O_RDONLY);
+  if (fd < 0)
+    return 0;  // just a hint
+  fadvise_fd(fd, offset, len, hints);
+  TEMP_FAILURE_RETRY(::close(fd));
+  return 0;
+}
+
+/*
+ * The object will grow to object_size, write_size at a time (rbd: to
+ * the image object size, at random offsets).  On xfs we make the write
+ * size the file's extent size hint, so such writes still land in large
+ * extents; that only takes while the file has none, which is when the
+ * OSD passes the hint on.  With filestore_alloc_hint_fallocate we also
+ * preallocate the whole object, keeping its size, at the cost of using
+ * the space up front.  Unwritten space reads back as a hole.
+ */
+int FileStore::_set_alloc_hint(coll_t cid, const hobject_t& oid,
+			       uint64_t object_size, uint64_t write_size)
+{
+  dout(15) << "set_alloc_hint " << cid << "/" << oid << " object_size " << object_size
+	   << " write_size " << write_size << dendl;
+  if (!ioctl_extsize && !m_filestore_alloc_hint_fallocate)
+    return 0;
+  int fd = lfn_open(cid, oid, O_RDWR);
+  if (fd < 0)
+    return 0;  // just a hint
+
+#ifdef FS_IOC_FSSETXATTR
+  uint64_t extsize = MIN(write_size, m_filestore_alloc_hint_max_size);
+  if (blk_size)
+    extsize -= extsize % blk_size;
+  struct fsxattr fsx;
+  if (ioctl_extsize && extsize &&
+      ::ioctl(fd, FS_IOC_FSGETXATTR, &fsx) == 0 && fsx.fsx_nextents == 0) {
+    fsx.fsx_xflags |= FS_XFLAG_EXTSIZE;
+    fsx.fsx_extsize = extsize;
+    if (::ioctl(fd, FS_IOC_FSSETXATTR, &fsx) < 0) {
+      int err = errno;
+      dout(10) << "set_alloc_hint " << cid << "/" << oid << " extsize " << extsize
+	       << " failed: " << cpp_strerror(err) << dendl;
+    }
+  }
+#endif
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+  struct stat st;
+  if (m_filestore_alloc_hint_fallocate && object_size &&
+      object_size <= m_filestore_alloc_hint_max_size &&
+      ::fstat(fd, &st) == 0 && (uint64_t)st.st_blocks * 512 < object_size) {
+    if (::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, object_size) < 0) {
+      int err = errno;
+      dout(10) << "set_alloc_hint " << cid << "/" << oid << " fallocate " << object_size
+	       << " failed: " << cpp_strerror(err) << dendl;
+      if (err == EOPNOTSUPP) {
+	dout(0) << "set_alloc_hint fallocate is NOT supported, no longer preallocating" << dendl;
+	m_filestore_alloc_hint_fallocate = false;
+      }
+    }
+    extent_cache.invalidate(oid);
+  }
+#endif
+
+  TEMP_FAILURE_RETRY(::close(fd));
+  return 0;
+}
+
+/*
+ * Where the file system can, punch a hole: nothing is written and the
+ * space is freed (rbd discards come here).  Like a write, zeroing past
+ * the end extends the file.
+ */
 int FileStore::_zero(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len)
 {
+  dout(15) << "zero " << cid << "/" << oid << " " << offset << "~" << len << dendl;
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+  int fd = punch_hole ? lfn_open(cid, oid, O_RDWR) : -1;
+  if (fd >= 0) {
+    int r = 0;
+    struct stat st;
+    if (::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) < 0)
+      r = -errno;
+    else if (::fstat(fd, &st) < 0)
+      r = -errno;
+    else if ((uint64_t)st.st_size < offset + len && ::ftruncate(fd, offset + len) < 0)
+      r = -errno;
+    TEMP_FAILURE_RETRY(::close(fd));
+    extent_cache.invalidate(oid);
+    if (r == 0) {
+      dout(10) << "zero " << cid << "/" << oid << " " << offset << "~" << len << " punched" << dendl;
+      return 0;
+    }
+    dout(10) << "zero " << cid << "/" << oid << " punch hole failed: " << cpp_strerror(r) << dendl;
+    if (r == -EOPNOTSUPP) {
+      dout(0) << "zero hole punching is NOT supported, writing zeros" << dendl;
+      punch_hole = false;
+    }
+  }
+#endif
+
   // write zeros.. yuck!
   bufferptr bp(len);
+  bp.zero();
   bufferlist bl;
   bl.push_back(bp);
   return _write(cid, oid, offset, len, bl);
@@ -2699,8 +3272,12 @@ int FileStore::_clone(coll_t cid, const hobject_t& oldoid, const hobject_t& newo
  out:
   ::close(o);
  out2:
+  attr_cache.invalidate(newoid);
+  extent_cache.invalidate(newoid);
+  if (r >= 0)
+    r = object_map.clone(cid, oldoid, cid, newoid);
   dout(10) << "clone " << cid << "/" << oldoid << " -> " << cid << "/" << newoid << " = " << r << dendl;
-  return 0;
+  return r;
 }
 
 int FileStore::_do_clone_range(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff)
@@ -2855,6 +3432,7 @@ int FileStore::_clone_range(coll_t cid, const hobject_t& oldoid, const hobject_t
  out:
   ::close(o);
  out2:
+  extent_cache.invalidate(newoid);
   dout(10) << "clone_range " << cid << "/" << oldoid << " -> " << cid << "/" << newoid << " "
 	   << srcoff << "~" << len << " to " << dstoff << " = " << r << dendl;
   return r;
@@ -2863,16 +3441,45 @@ int FileStore::_clone_range(coll_t cid, const hobject_t& oldoid, const hobject_t
 
 bool FileStore::queue_flusher(int fd, uint64_t off, uint64_t len)
 {
+  struct stat st;
+  if (::fstat(fd, &st) < 0)
+    return false;
+
   bool queued;
   lock.Lock();
-  if (flusher_queue_len < m_filestore_flusher_max_fds) {
-    flusher_queue.push_back(sync_epoch);
-    flusher_queue.push_back(fd);
-    flusher_queue.push_back(off);
-    flusher_queue.push_back(len);
+  map<ino_t, FlushItem>::iterator p = flusher_objects.find(st.st_ino);
+  if (p != flusher_objects.end()) {
+    // merge with what is already queued for this inode, and keep that fd
+    FlushItem& i = p->second;
+    if (i.epoch != sync_epoch) {
+      // a sync has written out what was dirty before
+      i.epoch = sync_epoch;
+      i.dirty.clear();
+    }
+    if (len) {
+      interval_set<uint64_t> n;
+      n.insert(off, len);
+      i.dirty.union_of(n);
+    }
+    dout(10) << "queue_flusher ep " << sync_epoch << " fd " << fd << " " << off << "~" << len
+	     << " merged into fd " << i.fd << " ino " << st.st_ino << " dirty " << i.dirty
+	     << dendl;
+    if (flusher_ready(i, ceph_clock_now(g_ceph_context)))
+      flusher_cond.Signal();
+    ::close(fd);
+    queued = true;
+  } else if (flusher_queue_len < m_filestore_flusher_max_fds) {
+    FlushItem& i = flusher_objects[st.st_ino];
+    i.fd = fd;
+    i.epoch = sync_epoch;
+    i.queued = ceph_clock_now(g_ceph_context);
+    if (len)
+      i.dirty.insert(off, len);
+    flusher_queue.push_back(st.st_ino);
     flusher_queue_len++;
     flusher_cond.Signal();
     dout(10) << "queue_flusher ep " << sync_epoch << " fd " << fd << " " << off << "~" << len
+	     << " ino " << st.st_ino
 	     << " qlen " << flusher_queue_len
 	     << dendl;
     queued = true;
@@ -2887,6 +3494,40 @@ bool FileStore::queue_flusher(int fd, uint64_t off, uint64_t len)
   return queued;
 }
 
+bool FileStore::flusher_ready(const FlushItem& i, utime_t now)
+{
+  assert(lock.is_locked());
+  if (stop || i.epoch != sync_epoch)
+    return true;   // just close it
+  if (m_filestore_flusher_coalesce_max_age <= 0)
+    return true;
+  if (m_filestore_flusher_coalesce_max_bytes &&
+      (uint64_t)i.dirty.size() >= m_filestore_flusher_coalesce_max_bytes)
+    return true;
+  return (double)(now - i.queued) >= m_filestore_flusher_coalesce_max_age;
+}
+
+/*
+ * one directory per pass, so ops on the collection wait for at most
+ * a single split while we hold its index.
+ */
+void FileStore::split_entry()
+{
+  dout(20) << "split_entry start" << dendl;
+  coll_t c;
+  vector<string> dir;
+  while (index_manager.get_deferred(&c, &dir)) {
+    dout(15) << "split_entry " << c << " " << dir << dendl;
+    Index index;
+    int r = get_index(c, &index);
+    if (r == 0)
+      r = index->do_deferred(dir);
+    if (r < 0)
+      dout(0) << "split_entry " << c << " " << dir << " failed: " << cpp_strerror(r) << dendl;
+  }
+  dout(20) << "split_entry finish" << dendl;
+}
+
 void FileStore::flusher_entry()
 {
   lock.Lock();
@@ -2894,28 +3535,47 @@ void FileStore::flusher_entry()
   while (true) {
     if (!flusher_queue.empty()) {
 #ifdef HAVE_SYNC_FILE_RANGE
-      list<uint64_t> q;
-      q.swap(flusher_queue);
+      utime_t now = ceph_clock_now(g_ceph_context);
+      list<FlushItem> q;
+      for (list<ino_t>::iterator p = flusher_queue.begin();
+	   p != flusher_queue.end(); ) {
+	map<ino_t, FlushItem>::iterator i = flusher_objects.find(*p);
+	assert(i != flusher_objects.end());
+	if (!flusher_ready(i->second, now)) {
+	  ++p;
+	  continue;
+	}
+	q.push_back(i->second);
+	flusher_objects.erase(i);
+	flusher_queue.erase(p++);
+      }
 
-      int num = flusher_queue_len;  // see how many we're taking, here
+      if (q.empty()) {
+	// wait for the oldest to age
+	utime_t wait;
+	wait.set_from_double(m_filestore_flusher_coalesce_max_age);
+	wait -= now - flusher_objects[flusher_queue.front()].queued;
+	dout(20) << "flusher_entry waiting " << wait << " for " << flusher_queue.size()
+		 << " objects to age" << dendl;
+	flusher_cond.WaitInterval(g_ceph_context, lock, wait);
+	continue;
+      }
+
+      int num = q.size();  // see how many we're taking, here
 
       lock.Unlock();
       while (!q.empty()) {
-	uint64_t ep = q.front();
-	q.pop_front();
-	int fd = q.front();
-	q.pop_front();
-	uint64_t off = q.front();
-	q.pop_front();
-	uint64_t len = q.front();
-	q.pop_front();
-	if (!stop && ep == sync_epoch) {
-	  dout(10) << "flusher_entry flushing+closing " << fd << " ep " << ep << dendl;
-	  ::sync_file_range(fd, off, len, SYNC_FILE_RANGE_WRITE);
+	FlushItem& i = q.front();
+	if (!stop && i.epoch == sync_epoch) {
+	  dout(10) << "flusher_entry flushing+closing " << i.fd << " ep " << i.epoch
+		   << " " << i.dirty << dendl;
+	  for (interval_set<uint64_t>::iterator p = i.dirty.begin(); p != i.dirty.end(); ++p)
+	    ::sync_file_range(i.fd, p.get_start(), p.get_len(), SYNC_FILE_RANGE_WRITE);
 	} else 
-	  dout(10) << "flusher_entry JUST closing " << fd << " (stop=" << stop << ", ep=" << ep
+	  dout(10) << "flusher_entry JUST closing " << i.fd << " (stop=" << stop << ", ep=" << i.epoch
 		   << ", sync_epoch=" << sync_epoch << ")" << dendl;
-	::close(fd);
+	::close(i.fd);
+	q.pop_front();
       }
       lock.Lock();
       flusher_queue_len -= num;   // they're definitely closed, forget
@@ -2988,6 +3648,10 @@ void FileStore::sync_entry()
 
     list<Context*> fin;
   again:
+    while (!pending_commits.empty()) {
+      dout(20) << "sync_entry waiting for previous commit to reach disk" << dendl;
+      pending_commit_cond.Wait(lock);
+    }
     fin.swap(sync_waiters);
     lock.Unlock();
     
@@ -3007,6 +3671,14 @@ void FileStore::sync_entry()
       sync_epoch++;
 
       dout(15) << "sync_entry committing " << cp << " sync_epoch " << sync_epoch << dendl;
+
+      // the object maps don't ride along with the fs sync (or an ext3
+      // op_seq fsync); get them to disk before cp is
+      if (object_map.sync() < 0) {
+	derr << "Error: unable to sync object maps" << dendl;
+	assert(0);
+      }
+
       if (write_op_seq(op_fd, cp) < 0) {
 	derr << "Error: " << cpp_strerror(errno) 
 	     << " during write_op_seq" << dendl;
@@ -3036,6 +3708,22 @@ void FileStore::sync_entry()
 
 	  commit_started();
 
+	  if (m_filestore_btrfs_snap_pipeline) {
+	    // let commit_wait_entry wait for the transid and finish up
+	    dout(20) << " queueing wait for transid " << async_args.transid << dendl;
+	    PendingCommit pc;
+	    pc.seq = cp;
+	    pc.transid = async_args.transid;
+	    pc.start = start;
+	    pc.startwait = startwait;
+	    pc.timeo = sync_entry_timeo;
+	    lock.Lock();
+	    pending_commits.push_back(pc);
+	    pending_commits.back().waiters.swap(fin);
+	    pending_commit_cond.Signal();
+	    goto next;
+	  }
+
 	  // wait for commit
 	  dout(20) << " waiting for transid " << async_args.transid << " to complete" << dendl;
 	  ::ioctl(op_fd, BTRFS_IOC_WAIT_SYNC, &async_args.transid);
@@ -3079,46 +3767,11 @@ void FileStore::sync_entry()
 	}
       }
       
-      utime_t done = ceph_clock_now(g_ceph_context);
-      utime_t lat = done - start;
-      utime_t dur = done - startwait;
-      dout(10) << "sync_entry commit took " << lat << ", interval was " << dur << dendl;
-
-      logger->inc(l_os_commit);
-      logger->finc(l_os_commit_lat, lat);
-      logger->finc(l_os_commit_len, dur);
-
-      commit_finish();
-
-      logger->set(l_os_committing, 0);
-
-      // remove old snaps?
-      if (do_snap) {
-	while (snaps.size() > 2) {
-	  btrfs_ioctl_vol_args vol_args;
-	  vol_args.fd = 0;
-	  snprintf(vol_args.name, sizeof(vol_args.name), COMMIT_SNAP_ITEM,
-		   (long long unsigned)snaps.front());
-
-	  snaps.pop_front();
-	  dout(10) << "removing snap '" << vol_args.name << "'" << dendl;
-	  int r = ::ioctl(basedir_fd, BTRFS_IOC_SNAP_DESTROY, &vol_args);
-	  if (r) {
-	    char buf[100];
-	    dout(20) << "unable to destroy snap '" << vol_args.name << "' got " << r
-		     << " " << strerror_r(r < 0 ? errno : 0, buf, sizeof(buf)) << dendl;
-	  }
-	}
-      }
-
-      dout(15) << "sync_entry committed to op_seq " << cp << dendl;
-
-      sync_entry_timeo_lock.Lock();
-      timer.cancel_event(sync_entry_timeo);
-      sync_entry_timeo_lock.Unlock();
+      sync_entry_finish(cp, do_snap, start, startwait, sync_entry_timeo);
     }
     
     lock.Lock();
+  next:
     finish_contexts(g_ceph_context, fin, 0);
     fin.clear();
     if (!sync_waiters.empty()) {
@@ -3130,6 +3783,82 @@ void FileStore::sync_entry()
       goto again;
     }
   }
+  while (!pending_commits.empty())
+    pending_commit_cond.Wait(lock);
+  lock.Unlock();
+}
+
+/*
+ * everything after the commit is on disk: account for it, trim the
+ * journal and drop old snaps.
+ */
+void FileStore::sync_entry_finish(uint64_t cp, bool do_snap, utime_t start, utime_t startwait,
+				  Context *timeo)
+{
+  utime_t done = ceph_clock_now(g_ceph_context);
+  utime_t lat = done - start;
+  utime_t dur = done - startwait;
+  dout(10) << "sync_entry commit took " << lat << ", interval was " << dur << dendl;
+
+  logger->inc(l_os_commit);
+  logger->finc(l_os_commit_lat, lat);
+  logger->finc(l_os_commit_len, dur);
+
+  commit_finish();
+
+  logger->set(l_os_committing, 0);
+
+  // remove old snaps?
+  if (do_snap) {
+    while (snaps.size() > 2) {
+      btrfs_ioctl_vol_args vol_args;
+      vol_args.fd = 0;
+      snprintf(vol_args.name, sizeof(vol_args.name), COMMIT_SNAP_ITEM,
+	       (long long unsigned)snaps.front());
+
+      snaps.pop_front();
+      dout(10) << "removing snap '" << vol_args.name << "'" << dendl;
+      int r = ::ioctl(basedir_fd, BTRFS_IOC_SNAP_DESTROY, &vol_args);
+      if (r) {
+	char buf[100];
+	dout(20) << "unable to destroy snap '" << vol_args.name << "' got " << r
+		 << " " << strerror_r(r < 0 ? errno : 0, buf, sizeof(buf)) << dendl;
+      }
+    }
+  }
+
+  dout(15) << "sync_entry committed to op_seq " << cp << dendl;
+
+  sync_entry_timeo_lock.Lock();
+  timer.cancel_event(timeo);
+  sync_entry_timeo_lock.Unlock();
+}
+
+void FileStore::commit_wait_entry()
+{
+  lock.Lock();
+  dout(20) << "commit_wait_entry start" << dendl;
+  while (true) {
+    if (!pending_commits.empty()) {
+      PendingCommit& pc = pending_commits.front();
+      lock.Unlock();
+
+      dout(20) << "commit_wait_entry waiting for transid " << pc.transid << " to complete" << dendl;
+      ::ioctl(op_fd, BTRFS_IOC_WAIT_SYNC, &pc.transid);
+      dout(20) << "commit_wait_entry done waiting for transid " << pc.transid << dendl;
+      sync_entry_finish(pc.seq, true, pc.start, pc.startwait, pc.timeo);
+
+      lock.Lock();
+      finish_contexts(g_ceph_context, pc.waiters, 0);
+      pending_commits.pop_front();
+      pending_commit_cond.Signal();
+    } else {
+      if (stop)
+	break;
+      pending_commit_cond.Wait(lock);
+    }
+  }
+  dout(20) << "commit_wait_entry finish" << dendl;
   lock.Unlock();
 }
 
@@ -3395,6 +4124,19 @@ int FileStore::getattr(coll_t cid, const hobject_t& oid, const char *name,
   if (fake_attrs) return attrs.getattr(cid, oid, name, value, size);
 
   dout(15) << "getattr " << cid << "/" << oid << " '" << name << "' len " << size << dendl;
+  bufferptr bp;
+  if (attr_cache.enabled() && attr_cache.lookup(cid, oid, name, bp)) {
+    int r = bp.length();
+    if (size) {
+      if (size < bp.length())
+	r = -ERANGE;
+      else
+	memcpy(value, bp.c_str(), bp.length());
+    }
+    dout(10) << "getattr " << cid << "/" << oid << " '" << name << "' len " << size << " = " << r
+	     << " (cached)" << dendl;
+    return r;
+  }
   char n[ATTR_MAX_NAME_LEN];
   get_attrname(name, n, ATTR_MAX_NAME_LEN);
   int r = lfn_getxattr(cid, oid, n, value, size);
@@ -3407,9 +4149,19 @@ int FileStore::getattr(coll_t cid, const hobject_t& oid, const char *name, buffe
   if (fake_attrs) return attrs.getattr(cid, oid, name, bp);
 
   dout(15) << "getattr " << cid << "/" << oid << " '" << name << "'" << dendl;
+  if (attr_cache.enabled() && attr_cache.lookup(cid, oid, name, bp)) {
+    dout(10) << "getattr " << cid << "/" << oid << " '" << name << "' = " << bp.length()
+	     << " (cached)" << dendl;
+    return bp.length();
+  }
+  uint64_t gen = 0;
+  if (attr_cache.enabled())
+    gen = attr_cache.begin_fill(oid);
   char n[ATTR_MAX_NAME_LEN];
   get_attrname(name, n, ATTR_MAX_NAME_LEN);
   int r = _getattr(cid, oid, n, bp);
+  if (r >= 0 && gen)
+    attr_cache.fill(cid, oid, name, bp, gen);
   dout(10) << "getattr " << cid << "/" << oid << " '" << name << "' = " << r << dendl;
   return r;
 }
@@ -3433,6 +4185,7 @@ int FileStore::_setattr(coll_t cid, const hobject_t& oid, const char *name,
   char n[ATTR_MAX_NAME_LEN];
   get_attrname(name, n, ATTR_MAX_NAME_LEN);
   int r = lfn_setxattr(cid, oid, n, value, size);
+  attr_cache.invalidate(oid);
   dout(10) << "setattr " << cid << "/" << oid << " '" << name << "' len " << size << " = " << r << dendl;
   return r;
 }
@@ -3460,6 +4213,7 @@ int FileStore::_setattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>
       break;
     }
   }
+  attr_cache.invalidate(oid);
   dout(10) << "setattrs " << cid << "/" << oid << " = " << r << dendl;
   return r;
 }
@@ -3473,6 +4227,7 @@ int FileStore::_rmattr(coll_t cid, const hobject_t& oid, const char *name)
   char n[ATTR_MAX_NAME_LEN];
   get_attrname(name, n, ATTR_MAX_NAME_LEN);
   int r = lfn_removexattr(cid, oid, n);
+  attr_cache.invalidate(oid);
   dout(10) << "rmattr " << cid << "/" << oid << " '" << name << "' = " << r << dendl;
   return r;
 }
@@ -3494,12 +4249,85 @@ int FileStore::_rmattrs(coll_t cid, const hobject_t& oid)
 	break;
     }
   }
+  attr_cache.invalidate(oid);
   dout(10) << "rmattrs " << cid << "/" << oid << " = " << r << dendl;
   return r;
 }
 
 
 
+// object key/value maps
+
+int FileStore::omap_get_range(coll_t cid, const hobject_t& oid, const string& after, unsigned max,
+			      map<string,bufferlist> *out)
+{
+  dout(15) << "omap_get_range " << cid << "/" << oid << " after '" << after << "' max " << max << dendl;
+  struct stat st;
+  int r = lfn_stat(cid, oid, &st);
+  if (r == 0)
+    r = object_map.get_range(cid, oid, after, max, out);
+  dout(10) << "omap_get_range " << cid << "/" << oid << " = " << r << dendl;
+  return r;
+}
+
+int FileStore::omap_get_values(coll_t cid, const hobject_t& oid, const set<string>& keys,
+			       map<string,bufferlist> *out)
+{
+  dout(15) << "omap_get_values " << cid << "/" << oid << " " << keys.size() << " keys" << dendl;
+  struct stat st;
+  int r = lfn_stat(cid, oid, &st);
+  if (r == 0)
+    r = object_map.get_values(cid, oid, keys, out);
+  dout(10) << "omap_get_values " << cid << "/" << oid << " = " << r << dendl;
+  return r;
+}
+
+int FileStore::_omap_setkeys(coll_t cid, const hobject_t& oid, const map<string,bufferlist>& kv)
+{
+  dout(15) << "omap_setkeys " << cid << "/" << oid << " " << kv.size() << " keys" << dendl;
+  struct stat st;
+  int r = lfn_stat(cid, oid, &st);
+  if (r == 0)
+    r = object_map.set_keys(cid, oid, kv);
+  dout(10) << "omap_setkeys " << cid << "/" << oid << " = " << r << dendl;
+  return r;
+}
+
+int FileStore::_omap_rmkeys(coll_t cid, const hobject_t& oid, const set<string>& keys)
+{
+  dout(15) << "omap_rmkeys " << cid << "/" << oid << " " << keys.size() << " keys" << dendl;
+  struct stat st;
+  int r = lfn_stat(cid, oid, &st);
+  if (r == 0)
+    r = object_map.rm_keys(cid, oid, keys);
+  dout(10) << "omap_rmkeys " << cid << "/" << oid << " = " << r << dendl;
+  return r;
+}
+
+int FileStore::_omap_clear(coll_t cid, const hobject_t& oid)
+{
+  dout(15) << "omap_clear " << cid << "/" << oid << dendl;
+  struct stat st;
+  int r = lfn_stat(cid, oid, &st);
+  if (r == 0)
+    r = object_map.clear(cid, oid);
+  dout(10) << "omap_clear " << cid << "/" << oid << " = " << r << dendl;
+  return r;
+}
+
+/*
+ * each collection's link has its own map (collection_add copies it),
+ * so unlinking drops exactly this collection's copy, whatever the link
+ * count.  do it before the unlink: if we crash in between, replay
+ * repeats both.
+ */
+void FileStore::_omap_remove_link(coll_t cid, const hobject_t& oid)
+{
+  object_map.clear(cid, oid);
+}
+
+
+
 // collections
 
 int FileStore::collection_getattr(coll_t c, const char *name,
@@ -3605,12 +4433,61 @@ int FileStore::_collection_rename(const coll_t &cid, const coll_t &ncid)
   int ret = 0;
   if (::rename(old_coll, new_coll)) {
     ret = errno;
+  } else {
+    ret = object_map.rename_collection(cid, ncid);
   }
+  attr_cache.clear();
+  extent_cache.clear();
+  index_manager.drop_list_cache(cid);
+  index_manager.drop_list_cache(ncid);
   dout(10) << "collection_rename '" << cid << "' to '" << ncid << "'"
 	   << ": ret = " << ret << dendl;
   return ret;
 }
 
+int FileStore::_split_collection(coll_t cid, uint32_t bits, uint32_t rem, coll_t dest)
+{
+  dout(15) << "split_collection " << cid << " bits " << bits << " rem " << rem
+	   << " -> " << dest << dendl;
+  int r = -EOPNOTSUPP;
+  if (!fake_collections) {
+    Index from, to;
+    // same order as lfn_link
+    if (cid < dest) {
+      r = get_index(dest, &to);
+      if (r == 0)
+	r = get_index(cid, &from);
+    } else {
+      r = get_index(cid, &from);
+      if (r == 0)
+	r = get_index(dest, &to);
+    }
+    if (r == 0)
+      r = from->split(rem, bits, to);
+  }
+  if (r == -EOPNOTSUPP) {
+    // no help from the index; move the objects one at a time
+    uint32_t mask = bits < 32 ? (1 << bits) - 1 : ~0u;
+    vector<hobject_t> ls;
+    r = collection_list(cid, ls);
+    for (vector<hobject_t>::iterator p = ls.begin(); r >= 0 && p != ls.end(); ++p) {
+      if ((p->hash & mask) != (rem & mask))
+	continue;
+      r = _collection_add(dest, cid, *p);
+      if (r == -EEXIST)
+	r = 0;
+      if (r == 0)
+	r = _collection_remove(cid, *p);
+    }
+  }
+  extent_cache.clear();
+  index_manager.drop_list_cache(cid);
+  index_manager.drop_list_cache(dest);
+  dout(10) << "split_collection " << cid << " bits " << bits << " rem " << rem
+	   << " -> " << dest << " = " << r << dendl;
+  return r;
+}
+
 // --------------------------
 // collections
 
@@ -3769,6 +4646,10 @@ int FileStore::_destroy_collection(coll_t c)
   dout(15) << "_destroy_collection " << fn << dendl;
   int r = ::rmdir(fn);
   if (r < 0) r = -errno;
+  else object_map.clear_collection(c);
+  attr_cache.clear();
+  extent_cache.clear();
+  index_manager.drop_list_cache(c);
   dout(10) << "_destroy_collection " << fn << " = " << r << dendl;
   return r;
 }
@@ -3780,6 +4661,10 @@ int FileStore::_collection_add(coll_t c, coll_t cid, const hobject_t& o)
 
   dout(15) << "collection_add " << c << "/" << o << " " << cid << "/" << o << dendl;
   int r = lfn_link(cid, c, o);
+  // only copy the map along with a fresh link: on replay (EEXIST) the
+  // source's map may already be gone
+  if (r == 0)
+    r = object_map.clone(cid, o, c, o);
   dout(10) << "collection_add " << c << "/" << o << " " << cid << "/" << o << " = " << r << dendl;
   return r;
 }
@@ -3789,7 +4674,10 @@ int FileStore::_collection_remove(coll_t c, const hobject_t& o)
   if (fake_collections) return collections.collection_remove(c, o);
 
   dout(15) << "collection_remove " << c << "/" << o << dendl;
+  _omap_remove_link(c, o);
   int r = lfn_unlink(c, o);
+  attr_cache.invalidate(o);
+  extent_cache.invalidate(o);
   dout(10) << "collection_remove " << c << "/" << o << " = " << r << dendl;
   return r;
 }
@@ -3800,7 +4688,15 @@ const char** FileStore::get_tracked_conf_keys() const
     "filestore_min_sync_interval",
     "filestore_max_sync_interval",
     "filestore_flusher_max_fds",
+    "filestore_flusher_coalesce_max_age",
+    "filestore_flusher_coalesce_max_bytes",
     "filestore_commit_timeout",
+    "filestore_attr_cache_size",
+    "filestore_extent_cache_size",
+    "filestore_queue_max_ops",
+    "filestore_queue_max_bytes",
+    "filestore_queue_committing_max_ops",
+    "filestore_queue_committing_max_bytes",
     NULL
   };
   return KEYS;
@@ -3811,11 +4707,34 @@ void FileStore::handle_conf_change(const struct md_config_t *conf,
 {
   if (changed.count("filestore_min_sync_interval") ||
      changed.count("filestore_max_sync_interval") ||
-     changed.count("filestore_flusher_max_fds")) {
+     changed.count("filestore_flusher_max_fds") ||
+     changed.count("filestore_flusher_coalesce_max_age") ||
+     changed.count("filestore_flusher_coalesce_max_bytes")) {
     Mutex::Locker l(lock);
     m_filestore_min_sync_interval = conf->filestore_min_sync_interval;
     m_filestore_max_sync_interval = conf->filestore_max_sync_interval;
     m_filestore_flusher_max_fds = conf->filestore_flusher_max_fds;
+    m_filestore_flusher_coalesce_max_age = conf->filestore_flusher_coalesce_max_age;
+    m_filestore_flusher_coalesce_max_bytes = conf->filestore_flusher_coalesce_max_bytes;
+    flusher_cond.Signal();
+  }
+  if (changed.count("filestore_queue_max_ops") ||
+      changed.count("filestore_queue_max_bytes") ||
+      changed.count("filestore_queue_committing_max_ops") ||
+      changed.count("filestore_queue_committing_max_bytes")) {
+    op_tp.lock();
+    m_filestore_queue_max_ops = conf->filestore_queue_max_ops;
+    m_filestore_queue_max_bytes = conf->filestore_queue_max_bytes;
+    m_filestore_queue_committing_max_ops = conf->filestore_queue_committing_max_ops;
+    m_filestore_queue_committing_max_bytes = conf->filestore_queue_committing_max_bytes;
+    op_throttle_cond.Signal();   // a raised limit may let waiters in
+    op_tp.unlock();
+  }
+  if (changed.count("filestore_attr_cache_size")) {
+    attr_cache.set_max(conf->filestore_attr_cache_size);
+  }
+  if (changed.count("filestore_extent_cache_size")) {
+    extent_cache.set_max(conf->filestore_extent_cache_size);
   }
   if (changed.count("filestore_commit_timeout")) {
     Mutex::Locker l(sync_entry_timeo_lock);
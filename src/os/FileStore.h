@@ -19,14 +19,19 @@
 #include "ObjectStore.h"
 #include "JournalingObjectStore.h"
 
+#include "common/admin_socket.h"
 #include "common/Timer.h"
 #include "common/WorkQueue.h"
 
 #include "common/Mutex.h"
+#include "include/interval_set.h"
 #include "HashIndex.h"
 #include "IndexManager.h"
 
 #include "Fake.h"
+#include "AttrCache.h"
+#include "ExtentCache.h"
+#include "ObjectMap.h"
 
 #include <map>
 #include <deque>
@@ -56,6 +61,8 @@ class FileStore : public JournalingObjectStore,
   bool btrfs_snap_create_v2;
   bool btrfs_wait_sync;
   bool ioctl_fiemap;
+  bool ioctl_extsize;
+  bool punch_hole;  // until fallocate says otherwise
   int fsid_fd, op_fd;
 
   int basedir_fd, current_fd;
@@ -64,6 +71,9 @@ class FileStore : public JournalingObjectStore,
   // fake attrs?
   FakeAttrs attrs;
   bool fake_attrs;
+  AttrCache attr_cache;
+  ExtentCache extent_cache;
+  ObjectMap object_map;
 
   // fake collections?
   FakeCollections collections;
@@ -102,6 +112,31 @@ class FileStore : public JournalingObjectStore,
     }
   } sync_thread;
 
+  // async btrfs snapshots taken but not yet on disk.  sync_entry
+  // queues them and moves on to its next interval; commit_wait_entry
+  // waits for each transid and then finishes the commit (trimming the
+  // journal).  only one is outstanding: the next commit_start waits.
+  struct PendingCommit {
+    uint64_t seq;
+    uint64_t transid;
+    utime_t start, startwait;
+    list<Context*> waiters;
+    Context *timeo;
+  };
+  list<PendingCommit> pending_commits;
+  Cond pending_commit_cond;
+  void commit_wait_entry();
+  struct CommitWaitThread : public Thread {
+    FileStore *fs;
+    CommitWaitThread(FileStore *f) : fs(f) {}
+    void *entry() {
+      fs->commit_wait_entry();
+      return 0;
+    }
+  } commit_wait_thread;
+  void sync_entry_finish(uint64_t cp, bool do_snap, utime_t start, utime_t startwait,
+			 Context *timeo);
+
   void sync_fs(); // actuall sync underlying fs
 
   // -- op workqueue --
@@ -120,6 +155,7 @@ class FileStore : public JournalingObjectStore,
   public:
     Sequencer *parent;
     Mutex apply_lock;  // for apply mutual exclusion
+    bool applying;     // a worker owns this sequencer; protected by op_tp lock
     
     void queue_journal(uint64_t s) {
       Mutex::Locker l(qlock);
@@ -165,7 +201,8 @@ class FileStore : public JournalingObjectStore,
     }
 
     OpSequencer() : qlock("FileStore::OpSequencer::qlock", false, false),
-		    apply_lock("FileStore::OpSequencer::apply_lock", false, false) {}
+		    apply_lock("FileStore::OpSequencer::apply_lock", false, false),
+		    applying(false) {}
     ~OpSequencer() {
       assert(q.empty());
     }
@@ -175,8 +212,6 @@ class FileStore : public JournalingObjectStore,
   uint64_t op_queue_len, op_queue_bytes;
   Cond op_throttle_cond;
   Finisher op_finisher;
-  uint64_t next_finish;
-  map<uint64_t, pair<Context*,Context*> > finish_queue;
 
   ThreadPool op_tp;
   struct OpWQ : public ThreadPool::WorkQueue<OpSequencer> {
@@ -195,11 +230,20 @@ class FileStore : public JournalingObjectStore,
       return store->op_queue.empty();
     }
     OpSequencer *_dequeue() {
-      if (store->op_queue.empty())
-	return NULL;
-      OpSequencer *osr = store->op_queue.front();
-      store->op_queue.pop_front();
-      return osr;
+      // skip sequencers another worker is already applying; their
+      // next op will be picked up by that worker when it finishes,
+      // and meanwhile we can work on someone else's.
+      for (deque<OpSequencer*>::iterator p = store->op_queue.begin();
+	   p != store->op_queue.end();
+	   ++p) {
+	OpSequencer *osr = *p;
+	if (osr->applying)
+	  continue;
+	store->op_queue.erase(p);
+	osr->applying = true;
+	return osr;
+      }
+      return NULL;
     }
     void _process(OpSequencer *osr) {
       store->_do_op(osr);
@@ -224,9 +268,20 @@ class FileStore : public JournalingObjectStore,
   friend class C_JournaledAhead;
 
   // flusher thread
+  //  dirty ranges are merged per inode, and each merged extent is
+  //  flushed with one sync_file_range once the object has aged or
+  //  enough of it is dirty.  we hold one fd open per queued inode.
+  struct FlushItem {
+    int fd;
+    uint64_t epoch;
+    utime_t queued;
+    interval_set<uint64_t> dirty;
+  };
   Cond flusher_cond;
-  list<uint64_t> flusher_queue;
+  map<ino_t, FlushItem> flusher_objects;
+  list<ino_t> flusher_queue;   // oldest first
   int flusher_queue_len;
+  bool flusher_ready(const FlushItem& i, utime_t now);
   void flusher_entry();
   struct FlusherThread : public Thread {
     FileStore *fs;
@@ -238,11 +293,31 @@ class FileStore : public JournalingObjectStore,
   } flusher_thread;
   bool queue_flusher(int fd, uint64_t off, uint64_t len);
 
+  // background index splits/merges, @see IndexManager::get_deferred
+  void split_entry();
+  struct SplitThread : public Thread {
+    FileStore *fs;
+    SplitThread(FileStore *f) : fs(f) {}
+    void *entry() {
+      fs->split_entry();
+      return 0;
+    }
+  } split_thread;
+
   int open_journal();
 
 
   PerfCounters *logger;
 
+  /// dump_filestore_queue, for the admin socket
+  class AdminCommand : public AdminSocketCommand {
+    FileStore *store;
+  public:
+    AdminCommand(FileStore *fs) : store(fs) {}
+    void dump_command(const std::string &command, ceph::Formatter *f);
+  } admin_command;
+  bool admin_command_registered;
+
 public:
   int lfn_find(coll_t cid, const hobject_t& oid, IndexedPath *path);
   int lfn_getxattr(coll_t cid, const hobject_t& oid, const char *name, void *val, size_t size);
@@ -277,6 +352,7 @@ public:
   int mkjournal();
 
   int statfs(struct statfs *buf);
+  bool clone_is_cheap() { return btrfs; }
 
   int do_transactions(list<Transaction*> &tls, uint64_t op_seq);
   unsigned apply_transaction(Transaction& t, Context *ondisk=0);
@@ -296,11 +372,22 @@ public:
   }
   bool exists(coll_t cid, const hobject_t& oid);
   int stat(coll_t cid, const hobject_t& oid, struct stat *st);
-  int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
+  int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl,
+	   uint32_t op_flags = 0);
+  int read_zero_copy(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl,
+		     uint32_t op_flags = 0);
   int fiemap(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
+  int sparse_read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len,
+		  map<uint64_t, uint64_t>& m, bufferlist& bl, uint32_t op_flags = 0);
+  int _fiemap_fd(int fd, coll_t cid, const hobject_t& oid, uint64_t offset, size_t len,
+		 map<uint64_t, uint64_t>& m);
+  void _get_frag_stat(FragmentationStat& st);
 
   int _touch(coll_t cid, const hobject_t& oid);
   int _write(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, const bufferlist& bl);
+  int _write_direct(coll_t cid, const hobject_t& oid, uint64_t offset, const bufferlist& bl);
+  int _fadvise(coll_t cid, const hobject_t& oid, uint64_t offset, uint64_t len, uint32_t hints);
+  int _set_alloc_hint(coll_t cid, const hobject_t& oid, uint64_t object_size, uint64_t write_size);
   int _zero(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len);
   int _truncate(coll_t cid, const hobject_t& oid, uint64_t size);
   int _clone(coll_t cid, const hobject_t& oldoid, const hobject_t& newoid);
@@ -335,6 +422,16 @@ public:
   int _rmattr(coll_t cid, const hobject_t& oid, const char *name);
   int _rmattrs(coll_t cid, const hobject_t& oid);
 
+  // object key/value maps
+  int omap_get_range(coll_t cid, const hobject_t& oid, const string& after, unsigned max,
+		     map<string,bufferlist> *out);
+  int omap_get_values(coll_t cid, const hobject_t& oid, const set<string>& keys,
+		      map<string,bufferlist> *out);
+  int _omap_setkeys(coll_t cid, const hobject_t& oid, const map<string,bufferlist>& kv);
+  int _omap_rmkeys(coll_t cid, const hobject_t& oid, const set<string>& keys);
+  int _omap_clear(coll_t cid, const hobject_t& oid);
+  void _omap_remove_link(coll_t cid, const hobject_t& oid);
+
   int collection_getattr(coll_t c, const char *name, void *value, size_t size);
   int collection_getattr(coll_t c, const char *name, bufferlist& bl);
   int collection_getattrs(coll_t cid, map<string,bufferptr> &aset);
@@ -343,6 +440,7 @@ public:
   int _collection_rmattr(coll_t c, const char *name);
   int _collection_setattrs(coll_t cid, map<string,bufferptr> &aset);
   int _collection_rename(const coll_t &cid, const coll_t &ncid);
+  int _split_collection(coll_t cid, uint32_t bits, uint32_t rem, coll_t dest);
 
   // collections
   int list_collections(vector<coll_t>& ls);
@@ -367,6 +465,7 @@ public:
 private:
   bool m_filestore_btrfs_clone_range;
   bool m_filestore_btrfs_snap;
+  bool m_filestore_btrfs_snap_pipeline;
   bool m_filestore_btrfs_trans;
   bool m_filestore_fake_attrs;
   bool m_filestore_fake_collections;
@@ -379,8 +478,14 @@ private:
   bool m_filestore_journal_writeahead;
   std::string m_filestore_dev;
   int m_filestore_fiemap_threshold;
+  bool m_filestore_alloc_hint_extsize;
+  bool m_filestore_alloc_hint_fallocate;
+  uint64_t m_filestore_alloc_hint_max_size;
   bool m_filestore_sync_flush;
+  uint64_t m_filestore_odirect_min_size;
   int m_filestore_flusher_max_fds;
+  double m_filestore_flusher_coalesce_max_age;
+  uint64_t m_filestore_flusher_coalesce_max_bytes;
   double m_filestore_max_sync_interval;
   double m_filestore_min_sync_interval;
   bool m_filestore_update_collections;
@@ -42,6 +42,191 @@ int HashIndex::cleanup() {
     return -EINVAL;
 }
 
+void HashIndex::take_deferred(set<vector<string> > *dirs) {
+  dirs->insert(deferred.begin(), deferred.end());
+  deferred.clear();
+}
+
+int HashIndex::do_deferred(const vector<string> &dir) {
+  subdir_info_s info;
+  int r = get_info(dir, &info);
+  if (r < 0) {
+    // merged away, or the collection is gone
+    return (r == -ENOENT || r == -ENODATA) ? 0 : r;
+  }
+  if (must_split(info)) {
+    r = initiate_split(dir, info);
+    if (r < 0)
+      return r;
+    return complete_split(dir, info);
+  }
+  if (must_merge(info)) {
+    r = initiate_merge(dir, info);
+    if (r < 0)
+      return r;
+    return complete_merge(dir, info);
+  }
+  return 0;
+}
+
+int HashIndex::split(uint32_t match, uint32_t bits,
+		     std::tr1::shared_ptr<CollectionIndex> dest) {
+  HashIndex *to = dynamic_cast<HashIndex*>(dest.get());
+  if (!to || to->collection_version() != collection_version())
+    return -EOPNOTSUPP;
+  if (bits < 32)
+    match &= (1 << bits) - 1;
+  if (list_cache)
+    list_cache->complete = false;
+  if (to->list_cache)
+    to->list_cache->complete = false;
+  bool moved_any;
+  return split_dir(vector<string>(), match, bits, to, &moved_any);
+}
+
+/*
+ * Everything in a subdir at level n shares the low 4n bits of its hash,
+ * so once those cover bits the whole subdir is renamed into dest in one
+ * go; only the loose objects of the levels above are moved one by one.
+ * Each step tolerates having been done already, so replaying a partly
+ * applied split finishes it.
+ */
+int HashIndex::split_dir(const vector<string> &path, uint32_t match,
+			 uint32_t bits, HashIndex *dest, bool *moved_any) {
+  unsigned shift = 4 * path.size();
+  uint32_t mask = bits < 32 ? (1 << bits) - 1 : ~0u;
+  int r;
+  *moved_any = false;
+
+  map<string, hobject_t> objects, moved;
+  r = list_objects(path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  for (map<string, hobject_t>::iterator i = objects.begin();
+       i != objects.end();
+       ++i) {
+    if ((i->second.hash & mask) == match)
+      moved.insert(*i);
+  }
+  for (map<string, hobject_t>::iterator i = moved.begin(); i != moved.end(); ++i)
+    objects.erase(i->first);
+  if (!moved.empty()) {
+    r = dest->make_path(path);
+    if (r < 0)
+      return r;
+    for (map<string, hobject_t>::iterator i = moved.begin();
+	 i != moved.end();
+	 ++i) {
+      r = link_object_into(path, dest, path, i->second, i->first);
+      if (r < 0)
+	return r;
+    }
+    r = dest->fsync_dir(path);
+    if (r < 0)
+      return r;
+    *moved_any = true;
+  }
+
+  set<string> subdirs;
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  vector<string> sub = path;
+  sub.push_back("");
+  for (set<string>::iterator i = subdirs.begin(); i != subdirs.end(); ++i) {
+    unsigned left = bits > shift ? bits - shift : 0;
+    uint32_t nmask = left >= 4 ? 0xf : (1 << left) - 1;
+    uint32_t nibble = strtoul(i->c_str(), NULL, 16);
+    if ((nibble & nmask) != ((match >> shift) & nmask))
+      continue;
+    sub.back() = *i;
+    if (left <= 4) {
+      r = dest->make_path(path);
+      if (r < 0)
+	return r;
+      r = move_subdir(dest, sub);
+      if (r == -ENOTEMPTY || r == -EEXIST) {
+	// dest already has this subdir (an earlier split into it): merge
+	bool sub_moved;
+	r = split_dir(sub, match, bits, dest, &sub_moved);
+	if (r == 0)
+	  r = remove_path(sub);
+      }
+      if (r < 0)
+	return r;
+      *moved_any = true;
+    } else {
+      bool sub_moved;
+      r = split_dir(sub, match, bits, dest, &sub_moved);
+      if (r < 0)
+	return r;
+      if (sub_moved)
+	*moved_any = true;
+    }
+  }
+
+  if (*moved_any) {
+    r = dest->recount_info(path);
+    if (r < 0)
+      return r;
+    r = dest->fsync_dir(path);
+    if (r < 0)
+      return r;
+  }
+  if (!moved.empty()) {
+    r = remove_objects(path, moved, &objects);
+    if (r < 0)
+      return r;
+  }
+  if (*moved_any) {
+    r = recount_info(path);
+    if (r < 0)
+      return r;
+    r = fsync_dir(path);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+int HashIndex::recount_info(const vector<string> &path) {
+  map<string, hobject_t> objects;
+  int r = list_objects(path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  set<string> subdirs;
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  subdir_info_s info;
+  info.objs = objects.size();
+  info.subdirs = subdirs.size();
+  info.hash_level = path.size();
+  return set_info(path, info);
+}
+
+int HashIndex::make_path(const vector<string> &path) {
+  vector<string> cur;
+  for (vector<string>::const_iterator i = path.begin(); i != path.end(); ++i) {
+    cur.push_back(*i);
+    int exists;
+    int r = path_exists(cur, &exists);
+    if (r < 0)
+      return r;
+    if (exists)
+      continue;
+    r = create_path(cur);
+    if (r < 0 && r != -EEXIST)
+      return r;
+    subdir_info_s info;
+    info.hash_level = cur.size();
+    r = set_info(cur, info);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
 int HashIndex::_init() {
   subdir_info_s info;
   vector<string> path;
@@ -61,8 +246,13 @@ int HashIndex::_created(const vector<string> &path,
   r = set_info(path, info);
   if (r < 0)
     return r;
+  cache_insert(hoid, mangled_name);
 
   if (must_split(info)) {
+    if (defer && !must_split_now(info)) {
+      deferred.insert(path);
+      return 0;
+    }
     int r = initiate_split(path, info);
     if (r < 0)
       return r;
@@ -79,6 +269,7 @@ int HashIndex::_remove(const vector<string> &path,
   r = remove_object(path, hoid);
   if (r < 0)
     return r;
+  cache_erase(hoid, mangled_name);
   subdir_info_s info;
   r = get_info(path, &info);
   if (r < 0)
@@ -88,6 +279,10 @@ int HashIndex::_remove(const vector<string> &path,
   if (r < 0)
     return r;
   if (must_merge(info)) {
+    if (defer) {
+      deferred.insert(path);
+      return 0;
+    }
     r = initiate_merge(path, info);
     if (r < 0)
       return r;
@@ -138,6 +333,11 @@ static collection_list_handle_t form_handle(uint32_t hash, uint32_t index) {
 int HashIndex::_collection_list_partial(snapid_t seq, int max_count,
 					vector<hobject_t> *ls, 
 					collection_list_handle_t *last) {
+  if (load_list_cache()) {
+    cached_list(&seq, max_count, ls, last);
+    return 0;
+  }
+
   vector<string> path;
   uint32_t index, hash;
   string lower_bound;
@@ -159,6 +359,10 @@ int HashIndex::_collection_list_partial(snapid_t seq, int max_count,
 }
 
 int HashIndex::_collection_list(vector<hobject_t> *ls) {
+  if (load_list_cache()) {
+    cached_list(NULL, 0, ls, NULL);
+    return 0;
+  }
   vector<string> path;
   return list(path, NULL, NULL, NULL, NULL, ls);
 }
@@ -211,6 +415,11 @@ bool HashIndex::must_split(const subdir_info_s &info) {
 			    
 }
 
+bool HashIndex::must_split_now(const subdir_info_s &info) {
+  return (info.hash_level < (unsigned)MAX_HASH_LEVEL &&
+	  info.objs > ((unsigned)merge_threshold * 64));
+}
+
 int HashIndex::initiate_merge(const vector<string> &path, subdir_info_s info) {
   return start_merge(path);
 }
@@ -368,26 +577,114 @@ int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
   return end_split_or_merge(path);
 }
 
+static const char hex_digits[] = "0123456789ABCDEF";
+
 void HashIndex::get_path_components(const hobject_t &hoid,
 				    vector<string> *path) {
-  char buf[MAX_HASH_LEVEL + 1];
-  snprintf(buf, sizeof(buf), "%.*X", MAX_HASH_LEVEL, hoid.hash);
-
   // Path components are the hex characters of hoid.hash in, least
   // significant first
-  for (int i = 0; i < MAX_HASH_LEVEL; ++i) {
-    path->push_back(string(&buf[MAX_HASH_LEVEL - 1 - i], 1));
+  path->reserve(path->size() + MAX_HASH_LEVEL);
+  uint32_t hash = hoid.hash;
+  for (int i = 0; i < MAX_HASH_LEVEL; ++i, hash >>= 4) {
+    path->push_back(string(1, hex_digits[hash & 0xf]));
   }
 }
 
 string HashIndex::get_hash_str(uint32_t hash) {
-  char buf[MAX_HASH_LEVEL + 1];
-  snprintf(buf, sizeof(buf), "%.*X", MAX_HASH_LEVEL, hash);
-  string retval;
-  for (int i = 0; i < MAX_HASH_LEVEL; ++i) {
-    retval.push_back(buf[MAX_HASH_LEVEL - 1 - i]);
+  char buf[MAX_HASH_LEVEL];
+  for (int i = 0; i < MAX_HASH_LEVEL; ++i, hash >>= 4) {
+    buf[i] = hex_digits[hash & 0xf];
   }
-  return retval;
+  return string(buf, MAX_HASH_LEVEL);
+}
+
+uint32_t HashIndex::hash_sort_key(uint32_t hash) {
+  return hobject_t::_reverse_nibbles(hash);
+}
+
+void HashIndex::cache_insert(const hobject_t &hoid, const string &mangled_name) {
+  if (!list_cache || !list_cache->complete)
+    return;
+  list_cache->objects[make_pair(hash_sort_key(hoid.hash), mangled_name)] = hoid;
+}
+
+void HashIndex::cache_erase(const hobject_t &hoid, const string &mangled_name) {
+  if (!list_cache || !list_cache->complete)
+    return;
+  list_cache->objects.erase(make_pair(hash_sort_key(hoid.hash), mangled_name));
+}
+
+int HashIndex::fill_list_cache(const vector<string> &path) {
+  map<string, hobject_t> objects;
+  int r = list_objects(path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  for (map<string, hobject_t>::iterator i = objects.begin();
+       i != objects.end();
+       ++i) {
+    list_cache->objects[make_pair(hash_sort_key(i->second.hash), i->first)] = i->second;
+  }
+  set<string> subdirs;
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  vector<string> next_path = path;
+  next_path.push_back("");
+  for (set<string>::iterator i = subdirs.begin();
+       i != subdirs.end();
+       ++i) {
+    *(next_path.rbegin()) = *i;
+    r = fill_list_cache(next_path);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+bool HashIndex::load_list_cache() {
+  if (!list_cache)
+    return false;
+  if (list_cache->complete)
+    return true;
+  list_cache->objects.clear();
+  int r = fill_list_cache(vector<string>());
+  if (r < 0) {
+    list_cache->objects.clear();
+    return false;
+  }
+  list_cache->complete = true;
+  return true;
+}
+
+void HashIndex::cached_list(const snapid_t *seq, int max_count,
+			    vector<hobject_t> *ls,
+			    collection_list_handle_t *last) {
+  map<pair<uint32_t, string>, hobject_t>::iterator p = list_cache->objects.begin();
+  uint32_t start_key = 0;
+  if (last) {
+    start_key = hash_sort_key(last->hash);
+    p = list_cache->objects.lower_bound(make_pair(start_key, string()));
+  }
+  // like list(), index counts the listable objects of a hash already returned
+  uint32_t cur_key = 0, counter = 0, index = 0;
+  int max = max_count;
+  for (; p != list_cache->objects.end() && (!max_count || max > 0); ++p) {
+    if (seq && p->second.snap < *seq)
+      continue;
+    if (counter == 0 || p->first.first != cur_key) {
+      cur_key = p->first.first;
+      counter = 0;
+    }
+    counter++;
+    if (last && cur_key == start_key && counter <= last->index)
+      continue;
+    ls->push_back(p->second);
+    index = counter;
+    if (max_count)
+      max--;
+  }
+  if (last && ls->size())
+    *last = form_handle(ls->rbegin()->hash, index);
 }
 
 string HashIndex::get_path_str(const hobject_t &hoid) {
@@ -15,6 +15,8 @@
 #ifndef CEPH_HASHINDEX_H
 #define CEPH_HASHINDEX_H
 
+#include <tr1/memory>
+
 #include "include/buffer.h"
 #include "include/encoding.h"
 #include "LFNIndex.h"
@@ -43,6 +45,23 @@
  * is encoded as subdir_info_s in an xattr on the directory.
  */
 class HashIndex : public LFNIndex {
+public:
+  /**
+   * Cached listing of a collection in hash order.
+   *
+   * Owned by IndexManager, so it outlives each HashIndex instance, and
+   * only touched by the holder of the collection's index.  Filled by a
+   * full walk on the first listing, then kept current by _created and
+   * _remove.  Objects are keyed the way list() orders them: by hash
+   * string, then by file name, so list handles mean the same thing
+   * whether or not the cache is used.
+   */
+  struct ListCache {
+    bool complete;
+    map<pair<uint32_t, string>, hobject_t> objects; ///< (hash_sort_key, name)
+    ListCache() : complete(false) {}
+  };
+
 private:
   /// Attribute name for storing subdir info @see subdir_info_s
   static const string SUBDIR_ATTR;
@@ -61,6 +80,14 @@ private:
   int merge_threshold;
   int split_threshold;
 
+  /// Leave splits and merges to do_deferred unless a split is overdue
+  bool defer;
+  /// Subdirectories waiting for a deferred split or merge
+  set<vector<string> > deferred;
+
+  /// Listing cache for this collection, may be NULL
+  std::tr1::shared_ptr<ListCache> list_cache;
+
   /// Encodes current subdir state for determining when to split/merge.
   struct subdir_info_s {
     uint64_t objs;       ///< Objects in subdir.
@@ -129,15 +156,31 @@ public:
     const char *base_path, ///< [in] Path to the index root.
     int merge_at,          ///< [in] Merge threshhold.
     int split_at,	   ///< [in] Split threshhold.
-    uint32_t index_version)///< [in] Index version
+    uint32_t index_version,///< [in] Index version
+    bool defer_splits = false, ///< [in] Leave splits to do_deferred
+    std::tr1::shared_ptr<ListCache> cache =
+      std::tr1::shared_ptr<ListCache>()) ///< [in] Listing cache
     : LFNIndex(base_path, index_version), merge_threshold(merge_at),
-      split_threshold(split_at) {}
+      split_threshold(split_at), defer(defer_splits), list_cache(cache) {}
 
   /// @see CollectionIndex
   uint32_t collection_version() { return index_version; }
 
   /// @see CollectionIndex
   int cleanup();
+
+  /// @see CollectionIndex
+  void take_deferred(set<vector<string> > *dirs);
+
+  /// @see CollectionIndex
+  int do_deferred(const vector<string> &dir);
+
+  /// @see CollectionIndex
+  int split(
+    uint32_t match,
+    uint32_t bits,
+    std::tr1::shared_ptr<CollectionIndex> dest
+    );
 	
 protected:
   int _init();
@@ -192,6 +235,25 @@ private:
     const subdir_info_s &info  	///< [in] Value to set
     ); /// @return Error Code, 0 on success
 
+  /// Rewrites the info on path to match its contents
+  int recount_info(
+    const vector<string> &path ///< [in] Path to recount.
+    ); /// @return Error Code, 0 on success
+
+  /// Creates the subdirs along path that don't exist yet
+  int make_path(
+    const vector<string> &path ///< [in] Path to create.
+    ); /// @return Error Code, 0 on success
+
+  /// Moves the part of path matching match/bits into the same place in dest
+  int split_dir(
+    const vector<string> &path, ///< [in] Subdir to split.
+    uint32_t match,             ///< [in] Hash bits to match.
+    uint32_t bits,              ///< [in] Number of bits matched.
+    HashIndex *dest,            ///< [in] Destination index.
+    bool *moved_any             ///< [out] True if anything was moved.
+    ); /// @return Error Code, 0 on success
+
   /// Encapsulates logic for when to split.
   bool must_merge(
     const subdir_info_s &info ///< [in] Info to check
@@ -202,6 +264,11 @@ private:
     const subdir_info_s &info ///< [in] Info to check
     ); /// @return True if info must be split, False otherwise
 
+  /// Too far past the split point to wait for a deferred split.
+  bool must_split_now(
+    const subdir_info_s &info ///< [in] Info to check
+    ); /// @return True if info must be split synchronously
+
   /// Initiates merge
   int initiate_merge(
     const vector<string> &path, ///< [in] Subdir to merge
@@ -246,6 +313,39 @@ private:
     uint32_t hash ///< [in] Hash to convert to a string.
     ); ///< @return String representation of hash
 
+  /// Integer ordered the same way as get_hash_str (nibbles reversed)
+  static uint32_t hash_sort_key(
+    uint32_t hash ///< [in] Hash to convert
+    ); ///< @return Sort key for hash
+
+  /// Record a created object in the listing cache, if filled
+  void cache_insert(
+    const hobject_t &hoid,     ///< [in] Created object
+    const string &mangled_name ///< [in] Its file name
+    );
+
+  /// Drop a removed object from the listing cache, if filled
+  void cache_erase(
+    const hobject_t &hoid,     ///< [in] Removed object
+    const string &mangled_name ///< [in] Its file name
+    );
+
+  /// Fill the listing cache with the objects under path
+  int fill_list_cache(
+    const vector<string> &path ///< [in] Path to walk
+    ); ///< @return Error Code, 0 on success
+
+  /// Make sure the listing cache is filled
+  bool load_list_cache(); ///< @return True if the cache may be used
+
+  /// As list(), from the listing cache
+  void cached_list(
+    const snapid_t *seq,	    ///< [in] Snap to list (NULL if not needed)
+    int max_count,		    ///< [in] Max number to list (0 for no limit)
+    vector<hobject_t> *ls,	    ///< [out] Listed objects
+    collection_list_handle_t *last  ///< [in,out] List handle, or NULL
+    );
+
   /** 
    * Recursively lists all objects in path.
    *
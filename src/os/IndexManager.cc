@@ -57,15 +57,82 @@ static int get_version(const char *path, uint32_t *version) {
   return 0;
 }
 
-void IndexManager::put_index(coll_t c) {
+void IndexManager::put_index(coll_t c, CollectionIndex *index) {
   Mutex::Locker l(lock);
   assert(col_indices.count(c));
   col_indices.erase(c);
   cond.Signal();
+
+  if (!deferred_stop) {
+    set<vector<string> > dirs;
+    index->take_deferred(&dirs);
+    if (!dirs.empty()) {
+      deferred[c].insert(dirs.begin(), dirs.end());
+      deferred_cond.Signal();
+    }
+  }
+}
+
+bool IndexManager::get_deferred(coll_t *c, vector<string> *dir) {
+  Mutex::Locker l(lock);
+  while (!deferred_stop && deferred.empty())
+    deferred_cond.Wait(lock);
+  if (deferred_stop)
+    return false;
+  map<coll_t, set<vector<string> > >::iterator p = deferred.begin();
+  *c = p->first;
+  *dir = *p->second.begin();
+  p->second.erase(p->second.begin());
+  if (p->second.empty())
+    deferred.erase(p);
+  return true;
+}
+
+void IndexManager::start_deferred() {
+  Mutex::Locker l(lock);
+  deferred_stop = false;
+}
+
+void IndexManager::stop_deferred() {
+  Mutex::Locker l(lock);
+  deferred_stop = true;
+  deferred.clear();
+  deferred_cond.Signal();
+}
+
+std::tr1::shared_ptr<HashIndex::ListCache> IndexManager::_get_list_cache(coll_t c) {
+  map<coll_t, std::tr1::shared_ptr<HashIndex::ListCache> >::iterator p = list_caches.find(c);
+  if (p != list_caches.end()) {
+    list_cache_lru.remove(c);
+    list_cache_lru.push_front(c);
+    return p->second;
+  }
+  std::tr1::shared_ptr<HashIndex::ListCache> cache;
+  if (g_conf->filestore_list_cache_collections <= 0)
+    return cache;
+  cache.reset(new HashIndex::ListCache);
+  list_caches[c] = cache;
+  list_cache_lru.push_front(c);
+  while (list_cache_lru.size() > (unsigned)g_conf->filestore_list_cache_collections) {
+    list_caches.erase(list_cache_lru.back());
+    list_cache_lru.pop_back();
+  }
+  return cache;
+}
+
+void IndexManager::_drop_list_cache(coll_t c) {
+  if (list_caches.erase(c))
+    list_cache_lru.remove(c);
+}
+
+void IndexManager::drop_list_cache(coll_t c) {
+  Mutex::Locker l(lock);
+  _drop_list_cache(c);
 }
 
 int IndexManager::init_index(coll_t c, const char *path, uint32_t version) {
   Mutex::Locker l(lock);
+  _drop_list_cache(c);
   int r = set_version(path, version);
   if (r < 0)
     return r;
@@ -94,7 +161,9 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
     case CollectionIndex::HASH_INDEX_TAG_2: {
       // Must be a HashIndex
       *index = Index(new HashIndex(path, g_conf->filestore_merge_threshold,
-				   g_conf->filestore_split_multiple, version), 
+				   g_conf->filestore_split_multiple, version,
+				   g_conf->filestore_split_background,
+				   _get_list_cache(c)),
 		     RemoveOnDelete(c, this));
       return 0;
     }
@@ -105,7 +174,9 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
     // No need to check
     *index = Index(new HashIndex(path, g_conf->filestore_merge_threshold,
 				 g_conf->filestore_split_multiple,
-				 CollectionIndex::HASH_INDEX_TAG_2), 
+				 CollectionIndex::HASH_INDEX_TAG_2,
+				 g_conf->filestore_split_background,
+				 _get_list_cache(c)),
 		   RemoveOnDelete(c, this));
     return 0;
   }
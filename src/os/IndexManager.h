@@ -15,6 +15,7 @@
 #define OS_INDEXMANAGER_H
 
 #include <tr1/memory>
+#include <list>
 #include <map>
 
 #include "common/Mutex.h"
@@ -51,9 +52,25 @@ class IndexManager {
   /// Currently in use CollectionIndices
   map<coll_t,std::tr1::weak_ptr<CollectionIndex> > col_indices;
 
+  /// Subdirectories with deferred work, @see CollectionIndex::take_deferred
+  map<coll_t, set<vector<string> > > deferred;
+  Cond deferred_cond; ///< Signalled when deferred grows or on stop
+  bool deferred_stop;
+
+  /// Listing caches, for the most recently used collections
+  map<coll_t, std::tr1::shared_ptr<HashIndex::ListCache> > list_caches;
+  list<coll_t> list_cache_lru; ///< Most recently used first
+
+  /// Listing cache for c, creating it if need be (NULL if disabled)
+  std::tr1::shared_ptr<HashIndex::ListCache> _get_list_cache(coll_t c);
+
+  /// Forget the listing cache for c
+  void _drop_list_cache(coll_t c);
+
   /// Cleans up state for c @see RemoveOnDelete
   void put_index(
-    coll_t c ///< Put the index for c
+    coll_t c,              ///< Put the index for c
+    CollectionIndex *index ///< The index being released
     );
 
   /// Callback for shared_ptr release @see get_index
@@ -65,7 +82,7 @@ class IndexManager {
       c(c), manager(manager) {}
 
     void operator()(CollectionIndex *index) {
-      manager->put_index(c);
+      manager->put_index(c, index);
       delete index;
     }
   };
@@ -84,7 +101,7 @@ class IndexManager {
   int build_index(coll_t c, const char *path, Index *index);
 public:
   /// Constructor
-  IndexManager() : lock("IndexManager lock") {}
+  IndexManager() : lock("IndexManager lock"), deferred_stop(false) {}
 
   /**
    * Reserve and return index for c
@@ -105,6 +122,26 @@ public:
    * @return error code
    */
   int init_index(coll_t c, const char *path, uint32_t filestore_version);
+
+  /**
+   * Wait for a subdirectory with deferred work
+   *
+   * The caller should get_index(c) and call do_deferred(dir) on it.
+   *
+   * @param [out] c Collection containing dir
+   * @param [out] dir Subdirectory with deferred work
+   * @return false once stop_deferred has been called
+   */
+  bool get_deferred(coll_t *c, vector<string> *dir);
+
+  /// Allow get_deferred to block again after stop_deferred
+  void start_deferred();
+
+  /// Wake get_deferred callers and discard outstanding work
+  void stop_deferred();
+
+  /// Call when collection c is created, renamed or removed
+  void drop_list_cache(coll_t c);
 };
 
 #endif
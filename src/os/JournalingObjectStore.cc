@@ -2,11 +2,94 @@
 #include "JournalingObjectStore.h"
 
 #include "common/debug.h"
+#include "common/Cond.h"
+#include "common/Thread.h"
 
 #define DOUT_SUBSYS journal
 #undef dout_prefix
 #define dout_prefix *_dout << "journal "
 
+/*
+ * Reads journal entries and decodes their transactions ahead of
+ * journal_replay, which applies them: up to max_bytes of entries
+ * wait in q, so reading the journal overlaps applying it.
+ */
+struct ReplayReader : public Thread {
+  struct Entry {
+    uint64_t seq;
+    uint64_t bytes;
+    list<ObjectStore::Transaction*> tls;
+    ~Entry() {
+      while (!tls.empty()) {
+	delete tls.front();
+	tls.pop_front();
+      }
+    }
+  };
+
+  Journal *journal;
+  uint64_t next_seq;
+  uint64_t max_bytes;
+
+  Mutex lock;
+  Cond cond;
+  list<Entry*> q;
+  uint64_t q_bytes;
+  bool done;
+
+  ReplayReader(Journal *j, uint64_t seq, uint64_t max)
+    : journal(j), next_seq(seq), max_bytes(max),
+      lock("ReplayReader::lock"), q_bytes(0), done(false) {}
+  ~ReplayReader() {
+    while (!q.empty()) {
+      delete q.front();
+      q.pop_front();
+    }
+  }
+
+  void *entry() {
+    while (1) {
+      bufferlist bl;
+      uint64_t seq = next_seq;
+      if (!journal->read_entry(bl, seq))
+	break;
+      Entry *e = new Entry;
+      e->seq = seq;
+      e->bytes = bl.length();
+      bufferlist::iterator p = bl.begin();
+      while (!p.end())
+	e->tls.push_back(new ObjectStore::Transaction(p));
+      if (seq >= next_seq)
+	next_seq = seq + 1;
+
+      Mutex::Locker l(lock);
+      while (q_bytes && q_bytes + e->bytes > max_bytes)
+	cond.Wait(lock);
+      q.push_back(e);
+      q_bytes += e->bytes;
+      cond.Signal();
+    }
+    Mutex::Locker l(lock);
+    done = true;
+    cond.Signal();
+    return 0;
+  }
+
+  /// the next entry, or NULL at the end of the journal
+  Entry *get() {
+    Mutex::Locker l(lock);
+    while (q.empty() && !done)
+      cond.Wait(lock);
+    if (q.empty())
+      return NULL;
+    Entry *e = q.front();
+    q.pop_front();
+    q_bytes -= e->bytes;
+    cond.Signal();
+    return e;
+  }
+};
+
 
 
 void JournalingObjectStore::journal_start()
@@ -58,38 +141,32 @@ int JournalingObjectStore::journal_replay(uint64_t fs_op_seq)
   replaying = true;
 
   int count = 0;
+  ReplayReader reader(journal, op_seq + 1, g_conf->journal_replay_queue_max_bytes);
+  reader.create();
   while (1) {
-    bufferlist bl;
-    uint64_t seq = op_seq + 1;
-    if (!journal->read_entry(bl, seq)) {
+    ReplayReader::Entry *e = reader.get();
+    if (!e) {
       dout(3) << "journal_replay: end of journal, done." << dendl;
       break;
     }
+    uint64_t seq = e->seq;
 
     if (seq <= op_seq) {
       dout(3) << "journal_replay: skipping old op seq " << seq << " <= " << op_seq << dendl;
+      delete e;
       continue;
     }
     assert(op_seq == seq-1);
     
     dout(3) << "journal_replay: applying op seq " << seq << " (op_seq " << op_seq << ")" << dendl;
-    bufferlist::iterator p = bl.begin();
-    list<Transaction*> tls;
-    while (!p.end()) {
-      Transaction *t = new Transaction(p);
-      tls.push_back(t);
-    }
-    int r = do_transactions(tls, op_seq);
+    int r = do_transactions(e->tls, op_seq);
     op_seq++;
-    while (!tls.empty()) {
-      delete tls.front(); 
-      tls.pop_front();
-    }
+    delete e;
 
     dout(3) << "journal_replay: r = " << r << ", op now seq " << op_seq << dendl;
     assert(op_seq == seq);
-    seq++;  // we expect the next op
   }
+  reader.join();
 
   replaying = false;
 
@@ -194,7 +271,9 @@ bool JournalingObjectStore::commit_start()
     blocked = false;
     if (!ops_apply_blocked.empty())
       ops_apply_blocked.front()->Signal();
-    assert(commit_waiters.empty());
+    // only waiters for ops not applied yet
+    assert(commit_waiters.empty() ||
+	   commit_waiters.begin()->first > committed_seq);
     goto out;
   }
 
@@ -273,3 +352,10 @@ void JournalingObjectStore::_op_journal_transactions(list<ObjectStore::Transacti
   } else if (onjournal)
     commit_waiters[op].push_back(onjournal);
 }
+
+/// complete oncommit once op is in a filestore commit, journal or not
+void JournalingObjectStore::_op_commit_waiter(uint64_t op, Context *oncommit)
+{
+  assert(journal_lock.is_locked());
+  commit_waiters[op].push_back(oncommit);
+}
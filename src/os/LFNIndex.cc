@@ -88,22 +88,11 @@ int LFNIndex::lookup(const hobject_t &hoid,
   vector<string> path;
   string short_name;
   int r;
+  // _lookup already stat()ed (or read the lfn xattr of) the file
   r = _lookup(hoid, &path, &short_name, exist);
   if (r < 0)
     return r;
-  string full_path = get_full_path(path, short_name);
-  struct stat buf;
-  r = ::stat(full_path.c_str(), &buf);
-  if (r < 0) {
-    if (errno == ENOENT) {
-      *exist = 0;
-    } else {
-      return -errno;
-    }
-  } else {
-    *exist = 1;
-  }
-  *out_path = IndexedPath(new Path(full_path, self_ref));
+  *out_path = IndexedPath(new Path(get_full_path(path, short_name), self_ref));
   return 0;
 }
 
@@ -148,6 +137,32 @@ int LFNIndex::link_object(const vector<string> &from,
     return 0;
 }
 
+int LFNIndex::link_object_into(const vector<string> &from,
+			       LFNIndex *dest,
+			       const vector<string> &to,
+			       const hobject_t &hoid,
+			       const string &from_short_name) {
+  int r;
+  string from_path = get_full_path(from, from_short_name);
+  string to_path, to_name;
+  r = dest->lfn_get_name(to, hoid, &to_name, &to_path, 0);
+  if (r < 0)
+    return r;
+  r = ::link(from_path.c_str(), to_path.c_str());
+  if (r < 0 && errno != EEXIST)
+    return -errno;
+  return dest->lfn_created(to, hoid, to_name);
+}
+
+int LFNIndex::move_subdir(LFNIndex *dest, const vector<string> &path) {
+  string from_path = get_full_path_subdir(path);
+  string to_path = dest->get_full_path_subdir(path);
+  int r = ::rename(from_path.c_str(), to_path.c_str());
+  if (r < 0)
+    return -errno;
+  return 0;
+}
+
 int LFNIndex::remove_objects(const vector<string> &dir,
 			     const map<string, hobject_t> &to_remove,
 			     map<string, hobject_t> *remaining) {
@@ -534,7 +549,7 @@ int LFNIndex::lfn_get_name(const vector<string> &path,
       *out_path = get_full_path(path, full_name);
     if (exists) {
       struct stat buf;
-      string full_path = get_full_path(path, full_name);
+      string full_path = out_path ? *out_path : get_full_path(path, full_name);
       r = ::stat(full_path.c_str(), &buf);
       if (r < 0) {
 	if (errno == ENOENT)
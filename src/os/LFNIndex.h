@@ -204,6 +204,21 @@ protected:
     const string &from_short_name ///< [in] Mangled filename of hoid.
     ); ///< @return Error Code, 0 on success
 
+  /// Link an object from from into to in dest, another index
+  int link_object_into(
+    const vector<string> &from,   ///< [in] Source subdirectory.
+    LFNIndex *dest,               ///< [in] Dest index.
+    const vector<string> &to,     ///< [in] Dest subdirectory in dest.
+    const hobject_t &hoid,        ///< [in] Object to move.
+    const string &from_short_name ///< [in] Mangled filename of hoid.
+    ); ///< @return Error Code, 0 on success
+
+  /// Rename subdirectory path, with its contents, to the same place in dest
+  int move_subdir(
+    LFNIndex *dest,             ///< [in] Dest index.
+    const vector<string> &path  ///< [in] Subdirectory to move.
+    ); ///< @return Error Code, 0 on success
+
   /**
    * Efficiently remove objects from a subdirectory
    *
@@ -0,0 +1,405 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+
+#include "ObjectMap.h"
+#include "common/debug.h"
+#include "common/config.h"
+
+#ifdef HAVE_SQLITE3
+# include <sqlite3.h>
+#endif
+
+#define DOUT_SUBSYS filestore
+#undef dout_prefix
+#define dout_prefix *_dout << "objectmap "
+
+ObjectMap::ObjectMap()
+  : lock("ObjectMap::lock"), db(NULL),
+    set_stmt(NULL), rm_stmt(NULL), clear_stmt(NULL), get_stmt(NULL),
+    range_stmt(NULL), copy_stmt(NULL), rmcoll_stmt(NULL), renamecoll_stmt(NULL)
+{
+}
+
+ObjectMap::~ObjectMap()
+{
+  close();
+}
+
+#ifdef HAVE_SQLITE3
+
+static bufferlist object_key(const hobject_t& oid)
+{
+  bufferlist bl;
+  ::encode(oid, bl);
+  return bl;
+}
+
+static void bind_bl(sqlite3_stmt *stmt, int i, bufferlist& bl)
+{
+  sqlite3_bind_blob(stmt, i, bl.length() ? bl.c_str() : "", bl.length(), SQLITE_TRANSIENT);
+}
+
+static void bind_str(sqlite3_stmt *stmt, int i, const std::string& s)
+{
+  sqlite3_bind_blob(stmt, i, s.data(), s.length(), SQLITE_TRANSIENT);
+}
+
+static std::string column_str(sqlite3_stmt *stmt, int i)
+{
+  return std::string((const char *)sqlite3_column_blob(stmt, i),
+		     sqlite3_column_bytes(stmt, i));
+}
+
+static void column_bl(sqlite3_stmt *stmt, int i, bufferlist& bl)
+{
+  bl.clear();
+  bl.append((const char *)sqlite3_column_blob(stmt, i), sqlite3_column_bytes(stmt, i));
+}
+
+/// run a statement that returns no rows, and reset it for reuse
+static int step_done(sqlite3 *db, sqlite3_stmt *stmt)
+{
+  int r = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  if (r != SQLITE_DONE) {
+    derr << "ObjectMap: " << sqlite3_errmsg(db) << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
+int ObjectMap::_exec(const char *sql)
+{
+  char *err = NULL;
+  if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+    derr << "ObjectMap: '" << sql << "' failed: " << (err ? err : "?") << dendl;
+    sqlite3_free(err);
+    return -EIO;
+  }
+  return 0;
+}
+
+int ObjectMap::_prepare(const char *sql, sqlite3_stmt **stmt)
+{
+  if (sqlite3_prepare_v2(db, sql, -1, stmt, NULL) != SQLITE_OK) {
+    derr << "ObjectMap: unable to prepare '" << sql << "': " << sqlite3_errmsg(db) << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
+int ObjectMap::open(const std::string& path)
+{
+  Mutex::Locker l(lock);
+  assert(!db);
+  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+    derr << "ObjectMap: unable to open " << path << ": "
+	 << (db ? sqlite3_errmsg(db) : "out of memory") << dendl;
+    sqlite3_close(db);
+    db = NULL;
+    return -EIO;
+  }
+
+  int r;
+  if ((r = _exec("PRAGMA journal_mode = WAL")) < 0 ||
+      (r = _exec("PRAGMA synchronous = NORMAL")) < 0 ||   // sync() on FileStore commit
+      (r = _exec("CREATE TABLE IF NOT EXISTS omap ("
+		 " coll BLOB NOT NULL, obj BLOB NOT NULL, key BLOB NOT NULL, val BLOB NOT NULL,"
+		 " PRIMARY KEY (coll, obj, key))")) < 0 ||
+      (r = _prepare("INSERT OR REPLACE INTO omap (coll, obj, key, val) VALUES (?1, ?2, ?3, ?4)",
+		    &set_stmt)) < 0 ||
+      (r = _prepare("DELETE FROM omap WHERE coll = ?1 AND obj = ?2 AND key = ?3", &rm_stmt)) < 0 ||
+      (r = _prepare("DELETE FROM omap WHERE coll = ?1 AND obj = ?2", &clear_stmt)) < 0 ||
+      (r = _prepare("SELECT val FROM omap WHERE coll = ?1 AND obj = ?2 AND key = ?3",
+		    &get_stmt)) < 0 ||
+      (r = _prepare("SELECT key, val FROM omap WHERE coll = ?1 AND obj = ?2 AND key > ?3"
+		    " ORDER BY key LIMIT ?4", &range_stmt)) < 0 ||
+      (r = _prepare("INSERT INTO omap (coll, obj, key, val)"
+		    " SELECT ?3, ?4, key, val FROM omap WHERE coll = ?1 AND obj = ?2",
+		    &copy_stmt)) < 0 ||
+      (r = _prepare("DELETE FROM omap WHERE coll = ?1", &rmcoll_stmt)) < 0 ||
+      (r = _prepare("UPDATE omap SET coll = ?2 WHERE coll = ?1", &renamecoll_stmt)) < 0) {
+    _close();
+    return r;
+  }
+  dout(10) << "open " << path << dendl;
+  return 0;
+}
+
+void ObjectMap::close()
+{
+  Mutex::Locker l(lock);
+  _close();
+}
+
+int ObjectMap::sync()
+{
+  Mutex::Locker l(lock);
+  if (!db)
+    return 0;
+  // in synchronous=NORMAL mode a checkpoint syncs the log before it is
+  // copied back, and the database after
+  return _exec("PRAGMA wal_checkpoint");
+}
+
+void ObjectMap::_close()
+{
+  if (!db)
+    return;
+  sqlite3_stmt **stmts[] = { &set_stmt, &rm_stmt, &clear_stmt, &get_stmt, &range_stmt, &copy_stmt,
+			     &rmcoll_stmt, &renamecoll_stmt };
+  for (unsigned i = 0; i < sizeof(stmts) / sizeof(stmts[0]); i++) {
+    sqlite3_finalize(*stmts[i]);
+    *stmts[i] = NULL;
+  }
+  sqlite3_close(db);
+  db = NULL;
+}
+
+int ObjectMap::_begin()
+{
+  return _exec("BEGIN");
+}
+
+int ObjectMap::_commit(int r)
+{
+  if (r < 0) {
+    _exec("ROLLBACK");
+    return r;
+  }
+  return _exec("COMMIT");
+}
+
+int ObjectMap::set_keys(coll_t cid, const hobject_t& oid, const std::map<std::string, bufferlist>& kv)
+{
+  Mutex::Locker l(lock);
+  if (!db)
+    return -EOPNOTSUPP;
+  bufferlist obj = object_key(oid);
+  int r = _begin();
+  if (r < 0)
+    return r;
+  for (std::map<std::string, bufferlist>::const_iterator p = kv.begin();
+       p != kv.end() && r == 0;
+       ++p) {
+    bufferlist val = p->second;
+    bind_str(set_stmt, 1, cid.to_str());
+    bind_bl(set_stmt, 2, obj);
+    bind_str(set_stmt, 3, p->first);
+    bind_bl(set_stmt, 4, val);
+    r = step_done(db, set_stmt);
+  }
+  dout(20) << "set_keys " << cid << "/" << oid << " " << kv.size() << " keys = " << r << dendl;
+  return _commit(r);
+}
+
+int ObjectMap::rm_keys(coll_t cid, const hobject_t& oid, const std::set<std::string>& keys)
+{
+  Mutex::Locker l(lock);
+  if (!db)
+    return -EOPNOTSUPP;
+  bufferlist obj = object_key(oid);
+  int r = _begin();
+  if (r < 0)
+    return r;
+  for (std::set<std::string>::const_iterator p = keys.begin();
+       p != keys.end() && r == 0;
+       ++p) {
+    bind_str(rm_stmt, 1, cid.to_str());
+    bind_bl(rm_stmt, 2, obj);
+    bind_str(rm_stmt, 3, *p);
+    r = step_done(db, rm_stmt);
+  }
+  dout(20) << "rm_keys " << cid << "/" << oid << " " << keys.size() << " keys = " << r << dendl;
+  return _commit(r);
+}
+
+int ObjectMap::_clear(const std::string& coll, const bufferlist& o)
+{
+  bufferlist obj = o;
+  bind_str(clear_stmt, 1, coll);
+  bind_bl(clear_stmt, 2, obj);
+  return step_done(db, clear_stmt);
+}
+
+int ObjectMap::clear(coll_t cid, const hobject_t& oid)
+{
+  Mutex::Locker l(lock);
+  if (!db)
+    return -EOPNOTSUPP;
+  int r = _clear(cid.to_str(), object_key(oid));
+  dout(20) << "clear " << cid << "/" << oid << " = " << r << dendl;
+  return r;
+}
+
+int ObjectMap::clone(coll_t cid, const hobject_t& src, coll_t dcid, const hobject_t& dest)
+{
+  Mutex::Locker l(lock);
+  if (!db)
+    return -EOPNOTSUPP;
+  bufferlist sobj = object_key(src);
+  bufferlist dobj = object_key(dest);
+  int r = _begin();
+  if (r < 0)
+    return r;
+  r = _clear(dcid.to_str(), dobj);
+  if (r == 0) {
+    bind_str(copy_stmt, 1, cid.to_str());
+    bind_bl(copy_stmt, 2, sobj);
+    bind_str(copy_stmt, 3, dcid.to_str());
+    bind_bl(copy_stmt, 4, dobj);
+    r = step_done(db, copy_stmt);
+  }
+  dout(20) << "clone " << cid << "/" << src << " -> " << dcid << "/" << dest
+	   << " = " << r << dendl;
+  return _commit(r);
+}
+
+int ObjectMap::clear_collection(coll_t cid)
+{
+  Mutex::Locker l(lock);
+  if (!db)
+    return -EOPNOTSUPP;
+  bind_str(rmcoll_stmt, 1, cid.to_str());
+  int r = step_done(db, rmcoll_stmt);
+  dout(20) << "clear_collection " << cid << " = " << r << dendl;
+  return r;
+}
+
+int ObjectMap::rename_collection(coll_t cid, coll_t ncid)
+{
+  Mutex::Locker l(lock);
+  if (!db)
+    return -EOPNOTSUPP;
+  bind_str(renamecoll_stmt, 1, cid.to_str());
+  bind_str(renamecoll_stmt, 2, ncid.to_str());
+  int r = step_done(db, renamecoll_stmt);
+  dout(20) << "rename_collection " << cid << " -> " << ncid << " = " << r << dendl;
+  return r;
+}
+
+int ObjectMap::get_values(coll_t cid, const hobject_t& oid, const std::set<std::string>& keys,
+			  std::map<std::string, bufferlist> *out)
+{
+  Mutex::Locker l(lock);
+  if (!db)
+    return -EOPNOTSUPP;
+  bufferlist obj = object_key(oid);
+  for (std::set<std::string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
+    bind_str(get_stmt, 1, cid.to_str());
+    bind_bl(get_stmt, 2, obj);
+    bind_str(get_stmt, 3, *p);
+    int r = sqlite3_step(get_stmt);
+    if (r == SQLITE_ROW)
+      column_bl(get_stmt, 0, (*out)[*p]);
+    sqlite3_reset(get_stmt);
+    sqlite3_clear_bindings(get_stmt);
+    if (r != SQLITE_ROW && r != SQLITE_DONE) {
+      derr << "ObjectMap: get_values " << cid << "/" << oid << ": " << sqlite3_errmsg(db) << dendl;
+      return -EIO;
+    }
+  }
+  return 0;
+}
+
+int ObjectMap::get_range(coll_t cid, const hobject_t& oid, const std::string& after, unsigned max,
+			 std::map<std::string, bufferlist> *out)
+{
+  Mutex::Locker l(lock);
+  if (!db)
+    return -EOPNOTSUPP;
+  bufferlist obj = object_key(oid);
+  bind_str(range_stmt, 1, cid.to_str());
+  bind_bl(range_stmt, 2, obj);
+  bind_str(range_stmt, 3, after);
+  sqlite3_bind_int64(range_stmt, 4, max ? (sqlite3_int64)max : -1);
+  int r;
+  while ((r = sqlite3_step(range_stmt)) == SQLITE_ROW)
+    column_bl(range_stmt, 1, (*out)[column_str(range_stmt, 0)]);
+  sqlite3_reset(range_stmt);
+  sqlite3_clear_bindings(range_stmt);
+  if (r != SQLITE_DONE) {
+    derr << "ObjectMap: get_range " << cid << "/" << oid << ": " << sqlite3_errmsg(db) << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
+#else  // HAVE_SQLITE3
+
+int ObjectMap::open(const std::string& path)
+{
+  dout(0) << "open: built without sqlite3, object maps are not supported" << dendl;
+  return -EOPNOTSUPP;
+}
+
+void ObjectMap::close()
+{
+}
+
+int ObjectMap::sync()
+{
+  return 0;
+}
+
+void ObjectMap::_close()
+{
+}
+
+int ObjectMap::set_keys(coll_t cid, const hobject_t& oid, const std::map<std::string, bufferlist>& kv)
+{
+  return -EOPNOTSUPP;
+}
+
+int ObjectMap::rm_keys(coll_t cid, const hobject_t& oid, const std::set<std::string>& keys)
+{
+  return -EOPNOTSUPP;
+}
+
+int ObjectMap::clear(coll_t cid, const hobject_t& oid)
+{
+  return -EOPNOTSUPP;
+}
+
+int ObjectMap::clone(coll_t cid, const hobject_t& src, coll_t dcid, const hobject_t& dest)
+{
+  return -EOPNOTSUPP;
+}
+
+int ObjectMap::clear_collection(coll_t cid)
+{
+  return -EOPNOTSUPP;
+}
+
+int ObjectMap::rename_collection(coll_t cid, coll_t ncid)
+{
+  return -EOPNOTSUPP;
+}
+
+int ObjectMap::get_values(coll_t cid, const hobject_t& oid, const std::set<std::string>& keys,
+			  std::map<std::string, bufferlist> *out)
+{
+  return -EOPNOTSUPP;
+}
+
+int ObjectMap::get_range(coll_t cid, const hobject_t& oid, const std::string& after, unsigned max,
+			 std::map<std::string, bufferlist> *out)
+{
+  return -EOPNOTSUPP;
+}
+
+#endif  // HAVE_SQLITE3
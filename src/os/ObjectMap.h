@@ -0,0 +1,86 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_OBJECTMAP_H
+#define CEPH_OS_OBJECTMAP_H
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "include/types.h"
+#include "include/object.h"
+#include "common/Mutex.h"
+#include "osd/osd_types.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+/*
+ * Per-object ordered key/value maps (omap), kept in an embedded
+ * database next to the object files, so that updating a few keys costs
+ * O(keys changed) instead of rewriting the whole object.
+ *
+ * Maps are keyed by collection and full object identity (name,
+ * locator key, snap and hash), so two collections holding objects of
+ * the same name never share or clobber a map.  Linking an object into
+ * another collection copies its map.  Every update is idempotent, so
+ * replaying the FileStore journal over it is safe.  Updates go to a
+ * write-ahead log that is not synced on every change; FileStore calls
+ * sync() as part of each commit, before the commit seq is recorded.
+ */
+class ObjectMap {
+  Mutex lock;
+  sqlite3 *db;
+  sqlite3_stmt *set_stmt, *rm_stmt, *clear_stmt, *get_stmt, *range_stmt, *copy_stmt;
+  sqlite3_stmt *rmcoll_stmt, *renamecoll_stmt;
+
+  int _exec(const char *sql);
+  int _prepare(const char *sql, sqlite3_stmt **stmt);
+  int _begin();
+  int _commit(int r);
+  int _clear(const std::string& coll, const bufferlist& obj);
+  void _close();
+
+public:
+  ObjectMap();
+  ~ObjectMap();
+
+  /// open (creating if need be) the database at path; -EOPNOTSUPP if not built in
+  int open(const std::string& path);
+  void close();
+  /// checkpoint everything written so far into the database, and sync it
+  int sync();
+  bool is_open() const {
+    return db != NULL;
+  }
+
+  int set_keys(coll_t cid, const hobject_t& oid, const std::map<std::string, bufferlist>& kv);
+  int rm_keys(coll_t cid, const hobject_t& oid, const std::set<std::string>& keys);
+  int clear(coll_t cid, const hobject_t& oid);
+  /// replace dcid/dest's map with a copy of cid/src's
+  int clone(coll_t cid, const hobject_t& src, coll_t dcid, const hobject_t& dest);
+  /// drop the maps of every object in cid
+  int clear_collection(coll_t cid);
+  /// move the maps of every object in cid over to ncid
+  int rename_collection(coll_t cid, coll_t ncid);
+
+  int get_values(coll_t cid, const hobject_t& oid, const std::set<std::string>& keys,
+		 std::map<std::string, bufferlist> *out);
+  /// up to max (0 for no limit) keys sorting after 'after', in order
+  int get_range(coll_t cid, const hobject_t& oid, const std::string& after, unsigned max,
+		std::map<std::string, bufferlist> *out);
+};
+
+#endif
@@ -143,6 +143,14 @@ public:
     static const int OP_RMATTRS =      28;  // cid, oid
     static const int OP_COLL_RENAME =       29;  // cid, newcid
 
+    static const int OP_OMAP_SETKEYS = 31;  // cid, oid, map<string,bufferlist>
+    static const int OP_OMAP_RMKEYS =  32;  // cid, oid, set<string>
+    static const int OP_OMAP_CLEAR =   33;  // cid, oid
+
+    static const int OP_FADVISE =      34;  // cid, oid, offset, len, CEPH_OSD_OP_FLAG_FADVISE_*
+    static const int OP_SPLIT_COLLECTION = 35;  // cid, bits, rem, destination
+    static const int OP_SETALLOCHINT = 36;  // cid, oid, object_size, write_size
+
   private:
     uint64_t ops;
     uint64_t pad_unused_bytes;
@@ -150,6 +158,7 @@ public:
     bufferlist tbl;
     bufferlist::iterator p;
     bool sobject_encoding;
+    bool nojournal;  // local only, not encoded
 
   public:
 
@@ -207,6 +216,20 @@ public:
       return !ops;
     }
 
+    /*
+     * Leave this transaction, and the rest of its op with it, out of
+     * the journal: the op is applied directly, and counts as on disk
+     * only once the next sync of the store covers it.  A crash before
+     * then may lose (or tear) it.  A no-op for stores without a write
+     * ahead journal.
+     */
+    void set_nojournal() {
+      nojournal = true;
+    }
+    bool is_nojournal() const {
+      return nojournal;
+    }
+
     bool have_op() {
       if (p.get_off() == 0)
 	p = tbl.begin();
@@ -267,6 +290,23 @@ public:
 	p = tbl.begin();
       ::decode(aset, p);
     }
+    void get_omap_keyvals(map<string,bufferlist>& kv) {
+      if (p.get_off() == 0)
+	p = tbl.begin();
+      ::decode(kv, p);
+    }
+    void get_omap_keys(set<string>& keys) {
+      if (p.get_off() == 0)
+	p = tbl.begin();
+      ::decode(keys, p);
+    }
+    uint32_t get_u32() {
+      if (p.get_off() == 0)
+	p = tbl.begin();
+      uint32_t v;
+      ::decode(v, p);
+      return v;
+    }
 
     // -----------------------------
 
@@ -303,6 +343,30 @@ public:
       ::encode(data, tbl);
       ops++;
     }
+    /// a page cache hint for this store only: older OSDs don't know the
+    /// op, so keep it out of transactions that are sent to replicas
+    void fadvise(coll_t cid, const hobject_t& oid, uint64_t off, uint64_t len, uint32_t op_flags) {
+      __u32 op = OP_FADVISE;
+      ::encode(op, tbl);
+      ::encode(cid, tbl);
+      ::encode(oid, tbl);
+      ::encode(off, tbl);
+      ::encode(len, tbl);
+      uint32_t hints = op_flags & CEPH_OSD_OP_FLAG_FADVISE_MASK;
+      ::encode(hints, tbl);
+      ops++;
+    }
+    /// the object is expected to grow to object_size, write_size at a time
+    void set_alloc_hint(coll_t cid, const hobject_t& oid,
+			uint64_t object_size, uint64_t write_size) {
+      __u32 op = OP_SETALLOCHINT;
+      ::encode(op, tbl);
+      ::encode(cid, tbl);
+      ::encode(oid, tbl);
+      ::encode(object_size, tbl);
+      ::encode(write_size, tbl);
+      ops++;
+    }
     void zero(coll_t cid, const hobject_t& oid, uint64_t off, uint64_t len) {
       __u32 op = OP_ZERO;
       ::encode(op, tbl);
@@ -472,20 +536,55 @@ public:
       ::encode(ncid, tbl);
       ops++;
     }
+    /// move the objects of cid whose hash has rem in its low bits bits into dest
+    void split_collection(coll_t cid, uint32_t bits, uint32_t rem, coll_t dest) {
+      __u32 op = OP_SPLIT_COLLECTION;
+      ::encode(op, tbl);
+      ::encode(cid, tbl);
+      ::encode(bits, tbl);
+      ::encode(rem, tbl);
+      ::encode(dest, tbl);
+      ops++;
+    }
+
+    /// set keys in the object's key/value map, replacing existing values
+    void omap_setkeys(coll_t cid, const hobject_t& oid, const map<string,bufferlist>& kv) {
+      __u32 op = OP_OMAP_SETKEYS;
+      ::encode(op, tbl);
+      ::encode(cid, tbl);
+      ::encode(oid, tbl);
+      ::encode(kv, tbl);
+      ops++;
+    }
+    void omap_rmkeys(coll_t cid, const hobject_t& oid, const set<string>& keys) {
+      __u32 op = OP_OMAP_RMKEYS;
+      ::encode(op, tbl);
+      ::encode(cid, tbl);
+      ::encode(oid, tbl);
+      ::encode(keys, tbl);
+      ops++;
+    }
+    void omap_clear(coll_t cid, const hobject_t& oid) {
+      __u32 op = OP_OMAP_CLEAR;
+      ::encode(op, tbl);
+      ::encode(cid, tbl);
+      ::encode(oid, tbl);
+      ops++;
+    }
 
 
     // etc.
     Transaction() :
       ops(0), pad_unused_bytes(0), largest_data_len(0), largest_data_off(0), largest_data_off_in_tbl(0),
-      sobject_encoding(false) {}
+      sobject_encoding(false), nojournal(false) {}
     Transaction(bufferlist::iterator &dp) :
       ops(0), pad_unused_bytes(0), largest_data_len(0), largest_data_off(0), largest_data_off_in_tbl(0),
-      sobject_encoding(false) {
+      sobject_encoding(false), nojournal(false) {
       decode(dp);
     }
     Transaction(bufferlist &nbl) :
       ops(0), pad_unused_bytes(0), largest_data_len(0), largest_data_off(0), largest_data_off_in_tbl(0),
-      sobject_encoding(false) {
+      sobject_encoding(false), nojournal(false) {
       bufferlist::iterator dp = nbl.begin();
       decode(dp); 
     }
@@ -563,11 +662,55 @@ public:
 
   virtual int statfs(struct statfs *buf) = 0;
 
+  /// does CLONE share data (reflink) rather than copy it?
+  virtual bool clone_is_cheap() { return false; }
+
   // objects
   virtual bool exists(coll_t cid, const hobject_t& oid) = 0;                   // useful?
   virtual int stat(coll_t cid, const hobject_t& oid, struct stat *st) = 0;     // struct stat?
-  virtual int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl) = 0;
+  /// op_flags may carry CEPH_OSD_OP_FLAG_FADVISE_* hints for the range read
+  virtual int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl,
+		   uint32_t op_flags = 0) = 0;
+  /// like read(), but the result may reference the object's file rather than a copy of it
+  virtual int read_zero_copy(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl,
+			     uint32_t op_flags = 0) {
+    return read(cid, oid, offset, len, bl, op_flags);
+  }
   virtual int fiemap(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl) = 0;
+  /**
+   * The allocated extents of offset~len, as fiemap() finds them, and
+   * their data, back to back.  Extents the object ends in are shortened
+   * (or dropped) to match.
+   *
+   * @return bytes read, or -errno
+   */
+  virtual int sparse_read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len,
+			  map<uint64_t, uint64_t>& m, bufferlist& bl, uint32_t op_flags = 0) {
+    bufferlist mbl;
+    int r = fiemap(cid, oid, offset, len, mbl);
+    if (r < 0)
+      return r;
+    bufferlist::iterator p = mbl.begin();
+    ::decode(m, p);
+    int total = 0;
+    map<uint64_t, uint64_t>::iterator q = m.begin();
+    while (q != m.end()) {
+      bufferlist t;
+      r = read(cid, oid, q->first, q->second, t, op_flags);
+      if (r < 0)
+	return r;
+      if (r == 0) {
+	m.erase(q++);
+	continue;
+      }
+      if (r < (int)q->second)
+	q->second = r;
+      total += r;
+      bl.claim_append(t);
+      ++q;
+    }
+    return total;
+  }
 
   /*
   virtual int _remove(coll_t cid, hobject_t oid) = 0;
@@ -596,6 +739,17 @@ public:
   }
   virtual int getattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>& aset, bool user_only = false) {return 0;};
 
+  // object key/value map
+  /// get up to max keys (0 for all) that sort after 'after'
+  virtual int omap_get_range(coll_t cid, const hobject_t& oid, const string& after, unsigned max,
+			     map<string,bufferlist> *out) {
+    return -EOPNOTSUPP;
+  }
+  virtual int omap_get_values(coll_t cid, const hobject_t& oid, const set<string>& keys,
+			      map<string,bufferlist> *out) {
+    return -EOPNOTSUPP;
+  }
+
   /*
   virtual int _setattr(coll_t cid, hobject_t oid, const char *name, const void *value, size_t size) = 0;
   virtual int _setattr(coll_t cid, hobject_t oid, const char *name, const bufferptr &bp) {
@@ -54,7 +54,8 @@ bool start_debug = false;
 uint64_t Ager::age_fill(float pc, utime_t until) {
   int max = 1024*1024;
   bufferptr bp(max);
-  bp.zero();
+  for (int i = 0; i < max; i++)  // not zeros, in case the fs compresses
+    bp.c_str()[i] = rand();
   bufferlist bl;
   bl.push_back(bp);
   uint64_t wrote = 0;
@@ -116,7 +117,7 @@ uint64_t Ager::age_fill(float pc, utime_t until) {
       sbl.substr_of(bl, 0, t);
       ObjectStore::Transaction tr;
       hobject_t oid(sobject_t(poid, 0));
-      tr.write(coll_t(), oid, off, t, sbl);
+      tr.write(cid, oid, off, t, sbl);
       store->apply_transaction(tr);
       off += t;
       s -= t;
@@ -158,7 +159,7 @@ void Ager::age_empty(float pc) {
     
     ObjectStore::Transaction t;
     hobject_t oid(sobject_t(poid, 0));
-    t.remove(coll_t(), oid);
+    t.remove(cid, oid);
     store->apply_transaction(t);
     age_free_oids.push_back(poid);
   }
@@ -209,8 +210,8 @@ void Ager::age(int time,
   utime_t nextfl = start;
   nextfl.sec_ref() += freelist_inc;
 
-  while (age_objects.size() < 10) age_objects.push_back( list<file_object_t>() );
-  
+  age_init();
+
   if (fake_size_mb) {
     int fake_bl = fake_size_mb * 256;
     struct statfs st;
@@ -222,24 +223,6 @@ void Ager::age(int time,
     generic_dout(2) << "fake " << fake_bl << " / " << st.f_blocks << " is " << f << ", high " << high_water << " low " << low_water << " final " << final_water << dendl;
   }
   
-  // init size distn (once)
-  if (!did_distn) {
-    did_distn = true;
-    age_cur_oid = file_object_t(888, 0);
-    file_size_distn.add(1, 19.0758125+0.65434375);
-    file_size_distn.add(512, 35.6566);
-    file_size_distn.add(1024, 27.7271875);
-    file_size_distn.add(2*1024, 16.63503125);
-    //file_size_distn.add(4*1024, 106.82384375);
-    //file_size_distn.add(8*1024, 81.493375);
-    //file_size_distn.add(16*1024, 14.13553125);
-    //file_size_distn.add(32*1024, 2.176);
-    //file_size_distn.add(256*1024, 0.655938);
-    //file_size_distn.add(512*1024, 0.1480625);
-    //file_size_distn.add(1*1024*1024, 0.020125); // actually 2, but 32bit
-    file_size_distn.normalize();
-  }
-  
   // clear
   for (int i=0; i<10; i++)
     age_objects[i].clear();
@@ -297,3 +280,38 @@ void Ager::age(int time,
   store->sync();
   generic_dout(1) << "age finished" << dendl;
 }  
+
+void Ager::age_init()
+{
+  while (age_objects.size() < 10) age_objects.push_back( list<file_object_t>() );
+
+  if (age_cur_oid.ino == 0)
+    age_cur_oid = file_object_t(888, 0);
+
+  // init size distn (once)
+  if (!did_distn) {
+    did_distn = true;
+    file_size_distn.add(1, 19.0758125+0.65434375);
+    file_size_distn.add(512, 35.6566);
+    file_size_distn.add(1024, 27.7271875);
+    file_size_distn.add(2*1024, 16.63503125);
+    //file_size_distn.add(4*1024, 106.82384375);
+    //file_size_distn.add(8*1024, 81.493375);
+    //file_size_distn.add(16*1024, 14.13553125);
+    //file_size_distn.add(32*1024, 2.176);
+    //file_size_distn.add(256*1024, 0.655938);
+    //file_size_distn.add(512*1024, 0.1480625);
+    //file_size_distn.add(1*1024*1024, 0.020125); // actually 2, but 32bit
+    file_size_distn.normalize();
+  }
+}
+
+uint64_t Ager::age_cycle(float high_water, float low_water, utime_t until)
+{
+  age_init();
+  generic_dout(1) << "age_cycle filling to " << high_water << dendl;
+  uint64_t wrote = age_fill(high_water, until);
+  generic_dout(1) << "age_cycle emptying to " << low_water << dendl;
+  age_empty(low_water);
+  return wrote;
+}
@@ -14,6 +14,7 @@ using namespace std;
 
 class Ager {
   ObjectStore *store;
+  coll_t cid;
 
  private:
   list<file_object_t>           age_free_oids;
@@ -26,9 +27,19 @@ class Ager {
   uint64_t age_fill(float pc, utime_t until);
   ssize_t age_pick_size();
   file_object_t age_get_oid();
+  void age_init();
 
  public:
-  Ager(ObjectStore *s) : store(s), did_distn(false) {} 
+  Ager(ObjectStore *s, coll_t c = coll_t()) : store(s), cid(c), did_distn(false) {}
+
+  /// object sizes to age with, in KB (max of each draw; we write half to all of it)
+  void set_size_distribution(const Distribution& d) {
+    file_size_distn = d;
+    did_distn = true;
+  }
+
+  /// fill to high_water, then delete random objects down to low_water; KB written
+  uint64_t age_cycle(float high_water, float low_water, utime_t until);
 
   void age(int time,
            float high_water,    // fill to this %
@@ -33,6 +33,7 @@
 #include "msg/Message.h"
 
 #include "mon/MonClient.h"
+#include "osdc/Objecter.h"
 
 #include "messages/MLog.h"
 
@@ -77,6 +78,8 @@
 #include "common/LogClient.h"
 #include "common/safe_io.h"
 #include "common/HeartbeatMap.h"
+#include "common/numa.h"
+#include "common/Tracer.h"
 
 #include "include/color.h"
 #include "perfglue/cpu_profiler.h"
@@ -521,7 +524,7 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   client_messenger(external_messenger),
   monc(mc),
   logger(NULL),
-  store(NULL),
+  store(NULL), store_has_omap(false),
   map_in_progress(false),
   clog(external_messenger->cct, client_messenger, &mc->monmap, mc, LogClient::NO_FLAGS),
   whoami(id),
@@ -529,9 +532,14 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   dispatch_running(false),
   osd_compat(get_osd_compat_set()),
   state(STATE_BOOTING), boot_epoch(0), up_epoch(0), bind_epoch(0),
-  op_tp(external_messenger->cct, "OSD::op_tp", g_conf->osd_op_threads),
-  recovery_tp(external_messenger->cct, "OSD::recovery_tp", g_conf->osd_recovery_threads),
-  disk_tp(external_messenger->cct, "OSD::disk_tp", g_conf->osd_disk_threads),
+  op_tp(external_messenger->cct, "OSD::op_tp", g_conf->osd_op_threads, "osd_op_threads"),
+  recovery_tp(external_messenger->cct, "OSD::recovery_tp", g_conf->osd_recovery_threads,
+	      "osd_recovery_threads"),
+  disk_tp(external_messenger->cct, "OSD::disk_tp", g_conf->osd_disk_threads, "osd_disk_threads"),
+  peering_tp(external_messenger->cct, "OSD::peering_tp", g_conf->osd_peering_threads,
+	     "osd_peering_threads"),
+  snap_trim_tp(external_messenger->cct, "OSD::snap_trim_tp", g_conf->osd_snap_trim_threads,
+	       "osd_snap_trim_threads"),
   command_tp(external_messenger->cct, "OSD::command_tp", 1),
   heartbeat_lock("OSD::heartbeat_lock"),
   heartbeat_stop(false), heartbeat_epoch(0),
@@ -541,24 +549,28 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   heartbeat_dispatcher(this),
   stat_lock("OSD::stat_lock"),
   finished_lock("OSD::finished_lock"),
-  op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
+  pending_ops_lock("OSD::pending_ops_lock"),
   osdmap(NULL),
   map_lock("OSD::map_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
   map_cache_lock("OSD::map_cache_lock"),
+  mon_report_lock("OSD::mon_report_lock"),
   up_thru_wanted(0), up_thru_pending(0),
   pg_stat_queue_lock("OSD::pg_stat_queue_lock"),
   osd_stat_updated(false),
   pg_stat_tid(0), pg_stat_tid_flushed(0),
   last_tid(0),
   tid_lock("OSD::tid_lock"),
+  peering_wq(this, g_conf->osd_peering_thread_timeout, &peering_tp),
   backlog_wq(this, g_conf->osd_backlog_thread_timeout, &disk_tp),
   command_wq(this, g_conf->osd_command_thread_timeout, &command_tp),
+  throttle_retry_event(NULL),
   recovery_ops_active(0),
   recovery_wq(this, g_conf->osd_recovery_thread_timeout, &recovery_tp),
   remove_list_lock("OSD::remove_list_lock"),
   replay_queue_lock("OSD::replay_queue_lock"),
-  snap_trim_wq(this, g_conf->osd_snap_trim_thread_timeout, &disk_tp),
+  snap_trim_wq(this, g_conf->osd_snap_trim_thread_timeout, &snap_trim_tp),
+  agent_wq(this, g_conf->osd_snap_trim_thread_timeout, &snap_trim_tp),
   sched_scrub_lock("OSD::sched_scrub_lock"),
   scrubs_pending(0),
   scrubs_active(0),
@@ -567,7 +579,13 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   rep_scrub_wq(this, g_conf->osd_scrub_thread_timeout, &disk_tp),
   remove_wq(this, g_conf->osd_remove_thread_timeout, &disk_tp),
   watch_lock("OSD::watch_lock"),
-  watch_timer(external_messenger->cct, watch_lock)
+  watch_timer(external_messenger->cct, watch_lock),
+  objecter_lock("OSD::objecter_lock"),
+  objecter_timer(external_messenger->cct, objecter_lock),
+  objecter_osdmap(new OSDMap),
+  objecter(new Objecter(external_messenger->cct, external_messenger, mc,
+			objecter_osdmap, objecter_lock, objecter_timer)),
+  objecter_finisher(external_messenger->cct)
 {
   monc->set_messenger(client_messenger);
 
@@ -577,6 +595,27 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
 
   pending_ops = 0;
   waiting_for_no_ops = false;
+
+  // a primary is waiting on replica scrub maps; removals and backlogs
+  // can take a long time and shouldn't hold every disk thread
+  rep_scrub_wq.set_priority(1);
+  remove_wq.set_max_threads(1);
+  backlog_wq.set_max_threads(1);
+
+  int shards = MAX(1, g_conf->osd_op_num_shards);
+  for (int i = 0; i < shards; i++) {
+    ThreadPool *tp = &op_tp;
+    string name = "OSD::OpWQ";
+    if (i) {
+      char s[20];
+      snprintf(s, sizeof(s), ".%d", i);
+      tp = new ThreadPool(external_messenger->cct, string("OSD::op_tp") + s,
+			  g_conf->osd_op_threads, "osd_op_threads");
+      name += s;
+    }
+    op_shard_tp.push_back(tp);
+    op_shard_wq.push_back(new OpWQ(this, name, g_conf->osd_op_thread_timeout, tp));
+  }
 }
 
 OSD::~OSD()
@@ -587,6 +626,13 @@ OSD::~OSD()
   g_ceph_context->get_perfcounters_collection()->remove(logger);
   delete logger;
   delete store;
+  delete objecter;
+  delete objecter_osdmap;
+  for (unsigned i = 0; i < op_shard_wq.size(); i++) {
+    delete op_shard_wq[i];
+    if (i)
+      delete op_shard_tp[i];
+  }
 }
 
 bool got_sigterm = false;
@@ -633,7 +679,7 @@ int OSD::init()
 
   timer.init();
   watch_timer.init();
-  watch = new Watch();
+  watch = new Watch(this);
 
   // mount.
   dout(2) << "mounting " << dev_path << " "
@@ -657,6 +703,14 @@ int OSD::init()
     return -1;
   }
 
+  {
+    map<string,bufferlist> out;
+    store_has_omap = (store->omap_get_values(coll_t::META_COLL, OSD_SUPERBLOCK_POBJECT,
+					     set<string>(), &out) == 0);
+    dout(2) << "object store " << (store_has_omap ? "supports" : "does not support")
+	    << " omap" << dendl;
+  }
+
   class_handler = new ClassHandler();
   if (!class_handler)
     return -ENOMEM;
@@ -714,15 +768,44 @@ int OSD::init()
   monc->authenticate();
   monc->wait_auth_rotating(30.0);
 
+  objecter_lock.Lock();
+  objecter_timer.init();
+  objecter->set_client_incarnation(ceph_clock_now(g_ceph_context).sec());
+  objecter->init();
+  objecter_lock.Unlock();
+  objecter_finisher.start();
+
   osd_lock.Lock();
 
-  op_tp.start();
+  objecter_update_map();
+
+  if (!g_conf->osd_op_thread_cpus.empty()) {
+    cpu_set_t cpus;
+    if (parse_cpu_set_list(g_conf->osd_op_thread_cpus, &cpus) == 0) {
+      for (unsigned i = 0; i < op_shard_tp.size(); i++)
+	op_shard_tp[i]->set_affinity(&cpus);
+    } else {
+      derr << "ignoring malformed osd_op_thread_cpus '" << g_conf->osd_op_thread_cpus
+	   << "'" << dendl;
+    }
+  }
+  for (unsigned i = 0; i < op_shard_tp.size(); i++)
+    op_shard_tp[i]->start();
   recovery_tp.start();
   disk_tp.start();
+  peering_tp.start();
+  snap_trim_tp.start();
   command_tp.start();
 
   // start the heartbeat
-  heartbeat_thread.create();
+  heartbeat_thread.create("osd_heartbeat");
+
+  g_ceph_context->get_admin_socket()->register_hook(OSD_ADMIN_SOCK_HISTORIC_OPS, &op_history);
+  g_ceph_context->get_admin_socket()->register_command("dump_ops_in_flight",
+      "ops received and not yet completed, with the stages they reached",
+      &op_history);
+  g_ceph_context->get_admin_socket()->register_command("dump_historic_ops",
+      "the slowest recent ops", &op_history);
 
   // tick
   timer.add_event_after(g_conf->osd_heartbeat_interval, new C_Tick(this));
@@ -769,6 +852,19 @@ void OSD::create_logger()
   osd_plb.add_fl_avg(l_osd_op_rw_rlat,"op_rw_rlat");  // client rmw readable/applied latency
   osd_plb.add_fl_avg(l_osd_op_rw_lat, "op_rw_latency");   // client rmw latency
 
+  osd_plb.add_u64_hist(l_osd_op_lat_hist,    "op_latency_hist");    // the above, as usec histograms
+  osd_plb.add_u64_hist(l_osd_op_r_lat_hist,  "op_r_latency_hist");
+  osd_plb.add_u64_hist(l_osd_op_w_lat_hist,  "op_w_latency_hist");
+  osd_plb.add_u64_hist(l_osd_op_rw_lat_hist, "op_rw_latency_hist");
+  osd_plb.add_u64_hist(l_osd_op_wait_hist,   "op_wait_hist");       // received until started, usec
+  osd_plb.add_u64_hist(l_osd_op_prepare_hist, "op_prepare_hist");   // started until submitted
+  osd_plb.add_u64_hist(l_osd_op_commit_hist, "op_commit_hist");     // submitted until locally committed
+  osd_plb.add_u64_hist(l_osd_op_apply_hist,  "op_apply_hist");      // submitted until locally applied
+  osd_plb.add_u64_hist(l_osd_op_repl_hist,   "op_repl_hist");       // submitted until replicas committed
+
+  osd_plb.add_u64_counter(l_osd_op_throttled, "op_throttled");   // times a client op was held back by a rate limit
+  osd_plb.add_u64(l_osd_op_throttled_q, "op_throttled_q");       // client ops held back now
+
   osd_plb.add_u64_counter(l_osd_sop,       "subop");         // subops
   osd_plb.add_u64_counter(l_osd_sop_inb,   "subop_in_bytes");     // subop in bytes
   osd_plb.add_fl_avg(l_osd_sop_lat,   "subop_latency");     // subop latency
@@ -785,6 +881,7 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_pull,      "pull");       // pull requests sent
   osd_plb.add_u64_counter(l_osd_push,      "push");       // push messages
   osd_plb.add_u64_counter(l_osd_push_outb, "push_out_bytes");  // pushed bytes
+  osd_plb.add_u64_counter(l_osd_push_dirty, "push_dirty");  // pushes of only the changed extents
 
   osd_plb.add_u64_counter(l_osd_rop, "recovery_ops");       // recovery ops (started)
 
@@ -817,12 +914,22 @@ int OSD::shutdown()
 
   state = STATE_STOPPING;
 
+  g_ceph_context->get_admin_socket()->unregister_hook(OSD_ADMIN_SOCK_HISTORIC_OPS);
+  g_ceph_context->get_admin_socket()->unregister_command("dump_ops_in_flight");
+  g_ceph_context->get_admin_socket()->unregister_command("dump_historic_ops");
+
   timer.shutdown();
 
   watch_lock.Lock();
   watch_timer.shutdown();
   watch_lock.Unlock();
 
+  objecter_lock.Lock();
+  objecter->shutdown();
+  objecter_timer.shutdown();
+  objecter_lock.Unlock();
+  objecter_finisher.stop();
+
   heartbeat_lock.Lock();
   heartbeat_stop = true;
   heartbeat_cond.Signal();
@@ -831,13 +938,27 @@ int OSD::shutdown()
 
   command_tp.stop();
 
+  // the timer is gone, so nothing will retry these
+  while (!throttled_ops.empty()) {
+    MOSDOp *op = throttled_ops.front().first;
+    op_limiter.release(op->get_pg().pool(), op->get_source(),
+		       throttled_ops.front().second);
+    op->put();
+    throttled_ops.pop_front();
+  }
+
   // finish ops
   wait_for_no_ops();
   dout(10) << "no ops" << dendl;
 
   recovery_tp.stop();
   dout(10) << "recovery tp stopped" << dendl;
-  op_tp.stop();
+  peering_tp.stop();
+  dout(10) << "peering tp stopped" << dendl;
+  snap_trim_tp.stop();
+  dout(10) << "snap trim tp stopped" << dendl;
+  for (unsigned i = 0; i < op_shard_tp.size(); i++)
+    op_shard_tp[i]->stop();
   dout(10) << "op tp stopped" << dendl;
 
   // pause _new_ disk work first (to avoid racing with thread pool),
@@ -1156,6 +1277,45 @@ PG *OSD::lookup_lock_raw_pg(pg_t pgid)
 }
 
 
+/*
+ * Reading pg state (info, past intervals, log, and for some logs the
+ * object attrs to rebuild missing) is almost all i/o, and each pg is
+ * independent, so load_pgs spreads it over a short-lived thread pool.
+ * Nothing else can touch the pgs yet: we hold osd_lock and every pg
+ * lock throughout.
+ */
+struct LoadPGsWQ : public ThreadPool::WorkQueue<PG> {
+  ObjectStore *store;
+  list<PG*> pgs;
+  LoadPGsWQ(ObjectStore *s, ThreadPool *tp)
+    : ThreadPool::WorkQueue<PG>("OSD::LoadPGsWQ", g_conf->osd_op_thread_timeout, 0, tp),
+      store(s) {}
+
+  bool _empty() {
+    return pgs.empty();
+  }
+  bool _enqueue(PG *pg) {
+    pgs.push_back(pg);
+    return true;
+  }
+  void _dequeue(PG *pg) {
+    assert(0);
+  }
+  PG *_dequeue() {
+    if (pgs.empty())
+      return NULL;
+    PG *pg = pgs.front();
+    pgs.pop_front();
+    return pg;
+  }
+  void _process(PG *pg) {
+    pg->read_state(store);
+  }
+  void _clear() {
+    pgs.clear();
+  }
+};
+
 void OSD::load_pgs()
 {
   assert(osd_lock.is_locked());
@@ -1168,6 +1328,7 @@ void OSD::load_pgs()
     derr << "failed to list pgs: " << cpp_strerror(-r) << dendl;
   }
 
+  vector<PG*> pgs;
   for (vector<coll_t>::iterator it = ls.begin();
        it != ls.end();
        it++) {
@@ -1189,10 +1350,28 @@ void OSD::load_pgs()
       continue;
     }
 
-    PG *pg = _open_lock_pg(pgid);
+    pgs.push_back(_open_lock_pg(pgid));
+  }
 
-    // read pg state, log
-    pg->read_state(store);
+  // read pg state, log
+  int threads = g_conf->osd_load_pgs_threads;
+  if (threads > 1 && pgs.size() > 1) {
+    dout(10) << "load_pgs reading " << pgs.size() << " pgs with " << threads << " threads" << dendl;
+    ThreadPool tp(g_ceph_context, "OSD::load_pgs_tp", threads);
+    LoadPGsWQ wq(store, &tp);
+    for (vector<PG*>::iterator p = pgs.begin(); p != pgs.end(); ++p)
+      wq.queue(*p);
+    tp.start();
+    tp.drain(&wq);
+    tp.stop();
+  } else {
+    for (vector<PG*>::iterator p = pgs.begin(); p != pgs.end(); ++p)
+      (*p)->read_state(store);
+  }
+
+  for (vector<PG*>::iterator p = pgs.begin(); p != pgs.end(); ++p) {
+    PG *pg = *p;
+    pg_t pgid = pg->info.pgid;
 
     reg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
 
@@ -1399,12 +1578,9 @@ void OSD::project_pg_history(pg_t pgid, PG::Info::History& h, epoch_t from,
 
 // -------------------------------------
 
-void OSD::update_osd_stat()
+void OSD::update_osd_stat(const struct statfs& stbuf)
 {
   // fill in osd stats too
-  struct statfs stbuf;
-  store->statfs(&stbuf);
-
   osd_stat.kb = stbuf.f_blocks * stbuf.f_bsize / 1024;
   osd_stat.kb_used = (stbuf.f_blocks - stbuf.f_bfree) * stbuf.f_bsize / 1024;
   osd_stat.kb_avail = stbuf.f_bavail * stbuf.f_bsize / 1024;
@@ -1668,6 +1844,8 @@ void OSD::heartbeat_entry()
     double wait = .5 + ((float)(rand() % 10)/10.0) * (float)g_conf->osd_heartbeat_interval;
     utime_t w;
     w.set_from_double(wait);
+    heartbeat_wake_at = ceph_clock_now(g_ceph_context);
+    heartbeat_wake_at += w;
     dout(30) << "heartbeat_entry sleeping for " << wait << dendl;
     heartbeat_cond.WaitInterval(g_ceph_context, heartbeat_lock, w);
     dout(30) << "heartbeat_entry woke up" << dendl;
@@ -1711,20 +1889,23 @@ void OSD::heartbeat()
     return;
   }
 
-  // get CPU load avg
-  double loadavgs[1];
-  if (getloadavg(loadavgs, 1) == 1)
-    logger->fset(l_osd_loadavg, loadavgs[0]);
-
-  dout(30) << "heartbeat checking stats" << dendl;
-
-  // refresh stats?
-  {
-    Mutex::Locker lock(stat_lock);
-    update_osd_stat();
+  // if this thread was starved (cpu, swap, ...) for a good part of the
+  // grace period, peers' pings may be sitting unprocessed: don't count
+  // the time we weren't looking against them.  Only the time overslept
+  // since the last tick is added, so no stall is counted twice.
+  if (heartbeat_wake_at != utime_t() && now > heartbeat_wake_at) {
+    utime_t stall = now;
+    stall -= heartbeat_wake_at;
+    if ((double)stall > (double)g_conf->osd_heartbeat_grace / 2) {
+      dout(0) << "heartbeat: heartbeat thread stalled for " << stall
+	      << "s, extending peer deadlines" << dendl;
+      for (map<int, utime_t>::iterator p = heartbeat_from_stamp.begin();
+	   p != heartbeat_from_stamp.end();
+	   ++p)
+	p->second += stall;
+    }
   }
-
-  dout(5) << "heartbeat: " << osd_stat << dendl;
+  heartbeat_wake_at = utime_t();
 
   bool map_locked = map_lock.try_get_read();
   dout(30) << "heartbeat map_locked=" << map_locked << dendl;
@@ -1770,6 +1951,26 @@ void OSD::heartbeat()
     dout(30) << "heartbeat put map_lock" << dendl;
     map_lock.put_read();
   }
+
+  // get CPU load avg
+  double loadavgs[1];
+  if (getloadavg(loadavgs, 1) == 1)
+    logger->fset(l_osd_loadavg, loadavgs[0]);
+
+  dout(30) << "heartbeat checking stats" << dendl;
+
+  // refresh stats.  statfs can block behind a busy disk, so do it
+  // after the pings are out, and without holding up ping processing.
+  heartbeat_lock.Unlock();
+  struct statfs stbuf;
+  store->statfs(&stbuf);
+  heartbeat_lock.Lock();
+  {
+    Mutex::Locker lock(stat_lock);
+    update_osd_stat(stbuf);
+  }
+
+  dout(5) << "heartbeat: " << osd_stat << dendl;
   dout(30) << "heartbeat done" << dendl;
 }
 
@@ -1805,14 +2006,29 @@ void OSD::tick()
 
   check_replay_queue();
 
+  if (!pg_split_ready.empty())
+    kick_pg_split_queue();
+
+  // cache tier agents; each decides for itself whether there is work
+  for (hash_map<pg_t, PG*>::iterator p = pg_map.begin(); p != pg_map.end(); ++p) {
+    const pg_pool_t *pi = osdmap->get_pg_pool(p->first.pool());
+    if (pi && pi->is_cache())
+      agent_wq.queue(p->second);
+  }
+
   // mon report?
   utime_t now = ceph_clock_now(g_ceph_context);
+  op_limiter.trim(now);
   if (now - last_pg_stats_sent > g_conf->osd_mon_report_interval_max) {
     osd_stat_updated = true;
     do_mon_report();
   }
-  else if (now - last_mon_report > g_conf->osd_mon_report_interval_min) {
-    do_mon_report();
+  else {
+    mon_report_lock.Lock();
+    bool due = now - last_mon_report > g_conf->osd_mon_report_interval_min;
+    mon_report_lock.Unlock();
+    if (due)
+      do_mon_report();
   }
 
   // remove stray pgs?
@@ -1853,7 +2069,9 @@ void OSD::do_mon_report()
   dout(7) << "do_mon_report" << dendl;
 
   utime_t now(ceph_clock_now(g_ceph_context));
+  mon_report_lock.Lock();
   last_mon_report = now;
+  mon_report_lock.Unlock();
 
   // do any pending reports
   send_alive();
@@ -1894,14 +2112,13 @@ void OSD::complete_notify(void *_notif, void *_obc)
 {
   ReplicatedPG::ObjectContext *obc = (ReplicatedPG::ObjectContext *)_obc;
   Watch::Notification *notif = (Watch::Notification *)_notif;
-  dout(0) << "got the last reply from pending watchers, can send response now" << dendl;
+  dout(10) << "complete_notify " << notif->id << ", sending reply" << dendl;
   MWatchNotify *reply = notif->reply;
   client_messenger->send_message(reply, notif->session->con);
   notif->session->put();
   notif->session->con->put();
+  watch->cancel_timeout(notif);
   watch->remove_notification(notif);
-  if (notif->timeout)
-    watch_timer.cancel_event(notif->timeout);
   map<Watch::Notification *, bool>::iterator iter = obc->notifs.find(notif);
   if (iter != obc->notifs.end())
     obc->notifs.erase(iter);
@@ -1943,7 +2160,7 @@ void OSD::disconnect_session_watches(Session *session)
 
   for (map<ReplicatedPG::ObjectContext *, pg_t>::iterator oiter = obcs.begin(); oiter != obcs.end(); ++oiter) {
     ReplicatedPG::ObjectContext *obc = (ReplicatedPG::ObjectContext *)oiter->first;
-    dout(0) << "obc=" << (void *)obc << dendl;
+    dout(20) << "obc=" << (void *)obc << dendl;
 
     ReplicatedPG *pg = static_cast<ReplicatedPG *>(lookup_lock_raw_pg(oiter->second));
     assert(pg);
@@ -1955,7 +2172,7 @@ void OSD::disconnect_session_watches(Session *session)
     map<entity_name_t, Session *>::iterator witer = obc->watchers.begin();
     while (1) {
       while (witer != obc->watchers.end() && witer->second == session) {
-        dout(0) << "removing watching session entity_name=" << session->entity_name
+        dout(10) << "removing watching session entity_name=" << session->entity_name
 		<< " from " << obc->obs.oi << dendl;
 	entity_name_t entity = witer->first;
 	watch_info_t& w = obc->obs.oi.watchers[entity];
@@ -1981,11 +2198,15 @@ void OSD::disconnect_session_watches(Session *session)
 
 bool OSD::ms_handle_reset(Connection *con)
 {
-  dout(0) << "OSD::ms_handle_reset()" << dendl;
+  dout(10) << "OSD::ms_handle_reset()" << dendl;
+  if (con->get_peer_type() == CEPH_ENTITY_TYPE_OSD) {
+    Mutex::Locker l(objecter_lock);
+    objecter->ms_handle_reset(con);
+  }
   OSD::Session *session = (OSD::Session *)con->get_priv();
   if (!session)
     return false;
-  dout(0) << "OSD::ms_handle_reset() s=" << (void *)session << dendl;
+  dout(10) << "OSD::ms_handle_reset() s=" << (void *)session << dendl;
   disconnect_session_watches(session);
   session->put();
   return true;
@@ -1995,7 +2216,7 @@ void OSD::handle_notify_timeout(void *_notif)
 {
   assert(watch_lock.is_locked());
   Watch::Notification *notif = (Watch::Notification *)_notif;
-  dout(0) << "OSD::handle_notify_timeout notif " << notif->id << dendl;
+  dout(10) << "handle_notify_timeout notif " << notif->id << dendl;
 
   ReplicatedPG::ObjectContext *obc = (ReplicatedPG::ObjectContext *)notif->obc;
 
@@ -2073,6 +2294,7 @@ void OSD::send_boot()
 
 void OSD::queue_want_up_thru(epoch_t want)
 {
+  Mutex::Locker l(mon_report_lock);
   epoch_t cur = osdmap->get_up_thru(whoami);
   if (want > up_thru_wanted) {
     dout(10) << "queue_want_up_thru now " << want << " (was " << up_thru_wanted << ")" 
@@ -2082,7 +2304,7 @@ void OSD::queue_want_up_thru(epoch_t want)
 
     // expedite, a bit.  WARNING this will somewhat delay other mon queries.
     last_mon_report = ceph_clock_now(g_ceph_context);
-    send_alive();
+    _send_alive();
   } else {
     dout(10) << "queue_want_up_thru want " << want << " <= queued " << up_thru_wanted 
 	     << ", currently " << cur
@@ -2092,6 +2314,13 @@ void OSD::queue_want_up_thru(epoch_t want)
 
 void OSD::send_alive()
 {
+  Mutex::Locker l(mon_report_lock);
+  _send_alive();
+}
+
+void OSD::_send_alive()
+{
+  assert(mon_report_lock.is_locked());
   if (!osdmap->exists(whoami))
     return;
   epoch_t up_thru = osdmap->get_up_thru(whoami);
@@ -2105,11 +2334,19 @@ void OSD::send_alive()
 
 void OSD::queue_want_pg_temp(pg_t pgid, vector<int>& want)
 {
+  Mutex::Locker l(mon_report_lock);
   pg_temp_wanted[pgid] = want;
 }
 
+void OSD::remove_want_pg_temp(pg_t pgid)
+{
+  Mutex::Locker l(mon_report_lock);
+  pg_temp_wanted.erase(pgid);
+}
+
 void OSD::send_pg_temp()
 {
+  Mutex::Locker l(mon_report_lock);
   if (pg_temp_wanted.empty())
     return;
   dout(10) << "send_pg_temp " << pg_temp_wanted << dendl;
@@ -2142,7 +2379,13 @@ void OSD::send_still_alive(entity_inst_t i)
   monc->send_mon_message(m);
 }
 
-void OSD::send_pg_stats(const utime_t &now)
+/*
+ * Queued pgs stay queued until the mon acks them.  We send only those
+ * whose stats changed since we last sent them, and every unacked one
+ * only each osd_pg_stat_resend_interval (or on resend), in case a
+ * report was lost.
+ */
+void OSD::send_pg_stats(const utime_t &now, bool resend)
 {
   assert(osd_lock.is_locked());
 
@@ -2154,17 +2397,14 @@ void OSD::send_pg_stats(const utime_t &now)
    
   pg_stat_queue_lock.Lock();
 
-  if (osd_stat_updated || !pg_stat_queue.empty()) {
-    last_pg_stats_sent = now;
-    osd_stat_updated = false;
-
-    dout(10) << "send_pg_stats - " << pg_stat_queue.size() << " pgs updated" << dendl;
+  if (now - last_pg_stats_resent > g_conf->osd_pg_stat_resend_interval)
+    resend = true;
 
+  if (osd_stat_updated || !pg_stat_queue.empty()) {
     utime_t had_for(now);
     had_for -= had_map_since;
 
     MPGStats *m = new MPGStats(osdmap->get_fsid(), osdmap->get_epoch(), had_for);
-    m->set_tid(++pg_stat_tid);
     m->osd_stat = cur_stat;
 
     xlist<PG*>::iterator p = pg_stat_queue.begin();
@@ -2177,16 +2417,30 @@ void OSD::send_pg_stats(const utime_t &now)
 	continue;
       }
       pg->pg_stats_lock.Lock();
-      if (pg->pg_stats_valid) {
+      if (!pg->pg_stats_valid) {
+	dout(25) << " NOT sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported << ", not valid" << dendl;
+      } else if (!resend && pg->pg_stats_sent == pg->pg_stats_stable.reported) {
+	dout(30) << " already sent " << pg->info.pgid << " " << pg->pg_stats_stable.reported << dendl;
+      } else {
 	m->pg_stat[pg->info.pgid] = pg->pg_stats_stable;
+	pg->pg_stats_sent = pg->pg_stats_stable.reported;
 	dout(25) << " sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported << dendl;
-      } else {
-	dout(25) << " NOT sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported << ", not valid" << dendl;
       }
       pg->pg_stats_lock.Unlock();
     }
-    
-    monc->send_mon_message(m);
+
+    if (osd_stat_updated || !m->pg_stat.empty()) {
+      dout(10) << "send_pg_stats - " << m->pg_stat.size() << " of " << pg_stat_queue.size()
+	       << " queued pgs" << (resend ? " (resend)" : "") << dendl;
+      last_pg_stats_sent = now;
+      if (resend)
+	last_pg_stats_resent = now;
+      osd_stat_updated = false;
+      m->set_tid(++pg_stat_tid);
+      monc->send_mon_message(m);
+    } else {
+      m->put();
+    }
   }
 
   pg_stat_queue_lock.Unlock();
@@ -2238,7 +2492,7 @@ void OSD::flush_pg_stats()
 {
   dout(10) << "flush_pg_stats" << dendl;
   utime_t now = ceph_clock_now(cct);
-  send_pg_stats(now);
+  send_pg_stats(now, true);
 
   osd_lock.Unlock();
 
@@ -2444,8 +2698,8 @@ void OSD::do_command(Connection *con, tid_t tid, vector<string>& cmd, bufferlist
 	pg->lock();
 
 	fout << *pg << std::endl;
-	std::map<hobject_t, PG::Missing::item>::iterator mend = pg->missing.missing.end();
-	std::map<hobject_t, PG::Missing::item>::iterator mi = pg->missing.missing.begin();
+	PG::Missing::item_map::iterator mend = pg->missing.missing.end();
+	PG::Missing::item_map::iterator mi = pg->missing.missing.begin();
 	for (; mi != mend; ++mi) {
 	  fout << mi->first << " -> " << mi->second << std::endl;
 	  map<hobject_t, set<int> >::const_iterator mli =
@@ -2640,6 +2894,35 @@ void OSD::_share_map_outgoing(const entity_inst_t& inst)
 }
 
 
+/*
+ * Pass the epochs after since, which we just learned, on to a few
+ * random up peers that aren't known to have them.  Every osd does this
+ * once per new epoch (repeats are dropped in handle_osd_map), so a map
+ * the monitor seeds on a few osds reaches all of them in O(log n) hops.
+ */
+void OSD::gossip_map(epoch_t since)
+{
+  int fanout = g_conf->osd_map_gossip_fanout;
+  if (fanout <= 0)
+    return;
+
+  vector<int> peers;
+  for (int o = 0; o < osdmap->get_max_osd(); o++)
+    if (o != whoami && osdmap->is_up(o) && get_peer_epoch(o) < osdmap->get_epoch())
+      peers.push_back(o);
+
+  for (int i = 0; i < fanout && i < (int)peers.size(); i++) {
+    int j = i + rand() % (peers.size() - i);
+    swap(peers[i], peers[j]);
+    int peer = peers[i];
+    epoch_t pe = get_peer_epoch(peer);
+    dout(15) << "gossip_map e" << osdmap->get_epoch() << " to osd." << peer
+	     << " (has " << pe << ")" << dendl;
+    send_incremental_map(pe ? pe : since, osdmap->get_cluster_inst(peer));
+    note_peer_epoch(peer, osdmap->get_epoch());
+  }
+}
+
 bool OSD::heartbeat_dispatch(Message *m)
 {
   dout(30) << "heartbeat_dispatch " << m << dendl;
@@ -2664,6 +2947,13 @@ bool OSD::heartbeat_dispatch(Message *m)
 
 bool OSD::ms_dispatch(Message *m)
 {
+  // replies to our own objecter don't need the osd_lock
+  if (m->get_type() == CEPH_MSG_OSD_OPREPLY) {
+    Mutex::Locker l(objecter_lock);
+    objecter->handle_osd_op_reply((MOSDOpReply*)m);
+    return true;
+  }
+
   // lock!
   osd_lock.Lock();
   while (dispatch_running) {
@@ -3182,33 +3472,48 @@ void OSD::handle_osd_map(MOSDMap *m)
 
   osd_lock.Unlock();
 
-  op_tp.pause();
+  for (unsigned i = 0; i < op_shard_tp.size(); i++)
+    op_shard_tp[i]->pause();
 
   // requeue under osd_lock to preserve ordering of _dispatch() wrt incoming messages
   osd_lock.Lock();  
 
-  op_wq.lock();
-
+  // a pg's ops are all in one shard, so keeping each shard's order is enough
   list<Message*> rq;
-  while (!op_queue.empty()) {
-    PG *pg = op_queue.back();
-    op_queue.pop_back();
-    pending_ops--;
-    logger->set(l_osd_opq, pending_ops);
-
-    Message *mess = pg->op_queue.back();
-    pg->op_queue.pop_back();
-    pg->put();
-    dout(15) << " will requeue " << *mess << dendl;
-    rq.push_front(mess);
+  for (unsigned i = 0; i < op_shard_wq.size(); i++) {
+    OpWQ *wq = op_shard_wq[i];
+    wq->lock();
+    list<Message*> srq;
+    while (!wq->op_queue.empty()) {
+      PG *pg = wq->op_queue.back();
+      wq->op_queue.pop_back();
+      pending_ops_lock.Lock();
+      pending_ops--;
+      logger->set(l_osd_opq, pending_ops);
+      pending_ops_lock.Unlock();
+
+      if (pg->op_queue.empty()) {
+	pg->put();  // taken by a coalesced write (see dequeue_op)
+	continue;
+      }
+      Message *mess = pg->op_queue.back();
+      pg->op_queue.pop_back();
+      pg->put();
+      dout(15) << " will requeue " << *mess << dendl;
+      srq.push_front(mess);
+    }
+    wq->unlock();
+    rq.splice(rq.end(), srq);
   }
   push_waiters(rq);  // requeue under osd_lock!
-  op_wq.unlock();
 
   recovery_tp.pause();
+  snap_trim_tp.pause();
+  peering_tp.pause();    // peering reads osdmap without osd_lock
   disk_tp.pause_new();   // _process() may be waiting for a replica message
 
   ObjectStore::Transaction t;
+  epoch_t had = osdmap->get_epoch();
 
   // store new maps: queue for disk and put in the osdmap cache
   epoch_t start = MAX(osdmap->get_epoch() + 1, first);
@@ -3237,13 +3542,13 @@ void OSD::handle_osd_map(MOSDMap *m)
       t.write(coll_t::META_COLL, oid, 0, bl.length(), bl);
       add_map_inc_bl(e, bl);
 
-      OSDMap *o = new OSDMap;
-      if (e > 1) {
-	bufferlist obl;
-	OSDMap *prev = get_map(e - 1);
-	prev->encode(obl);
-	o->decode(obl);
-      }
+      // start from a copy of the previous epoch; it shares everything
+      // the incremental doesn't touch
+      OSDMap *o;
+      if (e > 1)
+	o = new OSDMap(*get_map(e - 1));
+      else
+	o = new OSDMap;
 
       OSDMap::Incremental inc;
       bufferlist::iterator p = bl.begin();
@@ -3453,10 +3758,16 @@ void OSD::handle_osd_map(MOSDMap *m)
   trim_map_bl_cache(osdmap->get_epoch()+1);
   trim_map_cache(0);
 
-  op_tp.unpause();
+  for (unsigned i = 0; i < op_shard_tp.size(); i++)
+    op_shard_tp[i]->unpause();
   recovery_tp.unpause();
+  snap_trim_tp.unpause();
+  peering_tp.unpause();
   disk_tp.unpause();
 
+  if (is_active() && had && osdmap->get_epoch() > had)
+    gossip_map(had);
+
   if (m->newest_map && m->newest_map > last) {
     dout(10) << " msg say newest map is " << m->newest_map << ", requesting more" << dendl;
     monc->sub_want("osdmap", osdmap->get_epoch()+1, CEPH_SUBSCRIBE_ONETIME);
@@ -3470,6 +3781,8 @@ void OSD::handle_osd_map(MOSDMap *m)
 
   if (do_shutdown)
     shutdown();
+  else
+    objecter_update_map();
 
   m->put();
 
@@ -3485,6 +3798,24 @@ void OSD::handle_osd_map(MOSDMap *m)
  * scan placement groups, initiate any replication
  * activities.
  */
+/*
+ * hand our objecter the current full map; it keeps its own copy, and
+ * resends whatever it has outstanding that now maps elsewhere.
+ */
+void OSD::objecter_update_map()
+{
+  assert(osd_lock.is_locked());
+  epoch_t e = osdmap->get_epoch();
+  bufferlist bl;
+  if (!e || !get_map_bl(e, bl))
+    return;
+  MOSDMap *m = new MOSDMap(monc->get_fsid());
+  m->maps[e] = bl;
+  m->oldest_map = m->newest_map = e;
+  Mutex::Locker l(objecter_lock);
+  objecter->handle_osd_map(m);
+}
+
 void OSD::advance_map(ObjectStore::Transaction& t)
 {
   assert(osd_lock.is_locked());
@@ -3562,20 +3893,59 @@ void OSD::advance_map(ObjectStore::Transaction& t)
   if (osdmap->get_epoch() > superblock.oldest_map)
     lastmap = get_map(osdmap->get_epoch() - 1);
 
+  /*
+   * Work out from the incremental what this epoch can have changed.
+   * When catching up on many epochs most of them leave most pgs alone:
+   * those don't need their mapping recomputed or to see the epoch at
+   * all.  Only primaries care about peers changing state (peer_info,
+   * prior_set, up_thru) or removed snaps; everyone else only reacts to
+   * its own up/acting changing.  Without an incremental (or after a
+   * discontinuity) assume everything changed.
+   */
+  OSDMap::Incremental inc;
+  bool have_inc = lastmap && get_inc_map(osdmap->get_epoch(), inc) &&
+    inc.fullmap.length() == 0;
+  bool all_mappings = !have_inc ||
+    inc.crush.length() || inc.new_max_osd >= 0 ||
+    !inc.new_up_client.empty() || !inc.new_state.empty() || !inc.new_weight.empty();
+  bool peers_changed = all_mappings ||
+    !inc.new_up_thru.empty() || !inc.new_lost.empty();
+
   // scan existing pg's
+  unsigned skipped = 0;
   for (hash_map<pg_t,PG*>::iterator it = pg_map.begin();
        it != pg_map.end();
        it++) {
     PG *pg = it->second;
+    pg_t pgid = pg->info.pgid;
 
+    pg->lock();
     vector<int> newup, newacting;
-    osdmap->pg_to_up_acting_osds(pg->info.pgid, newup, newacting);
+    if (all_mappings ||
+	inc.new_pools.count(pgid.pool()) ||
+	inc.old_pools.count(pgid.pool()) ||
+	inc.new_pg_temp.count(pgid)) {
+      osdmap->pg_to_up_acting_osds(pgid, newup, newacting);
+    } else {
+      newup = pg->up;
+      newacting = pg->acting;
+    }
+
+    if (!pg->acting_up_affected(newup, newacting) &&
+	(!pg->is_primary() ||
+	 (!peers_changed && pg->pool->newly_removed_snaps.empty()))) {
+      skipped++;
+      pg->unlock();
+      continue;
+    }
 
-    pg->lock();
     dout(10) << "Scanning pg " << *pg << dendl;
     pg->handle_advance_map(osdmap, lastmap, newup, newacting, 0);
     pg->unlock();
   }
+  dout(10) << "advance_map epoch " << osdmap->get_epoch() << " skipped " << skipped
+	   << " of " << pg_map.size() << " pgs"
+	   << (have_inc ? "" : " (no incremental)") << dendl;
 }
 
 void OSD::activate_map(ObjectStore::Transaction& t, list<Context*>& tfin)
@@ -3741,6 +4111,7 @@ void OSD::add_map_bl(epoch_t e, bufferlist& bl)
 {
   Mutex::Locker l(map_cache_lock);
   dout(10) << "add_map_bl " << e << " " << bl.length() << " bytes" << dendl;
+  bl.reassign_to_mempool(mempool::osdmap);
   map_bl[e] = bl;
 }
 
@@ -3748,6 +4119,7 @@ void OSD::add_map_inc_bl(epoch_t e, bufferlist& bl)
 {
   Mutex::Locker l(map_cache_lock);
   dout(10) << "add_map_inc_bl " << e << " " << bl.length() << " bytes" << dendl;
+  bl.reassign_to_mempool(mempool::osdmap);
   map_inc_bl[e] = bl;
 }
 
@@ -3762,13 +4134,34 @@ OSDMap *OSD::get_map(epoch_t epoch)
     }
   }
 
-  OSDMap *map = new OSDMap;
-  if (epoch > 0) {
+  OSDMap *prev = NULL;
+  if (epoch > 1) {
+    Mutex::Locker l(map_cache_lock);
+    map<epoch_t,OSDMap*>::iterator p = map_cache.find(epoch - 1);
+    if (p != map_cache.end())
+      prev = p->second;
+  }
+
+  OSDMap *map;
+  OSDMap::Incremental inc;
+  if (prev && get_inc_map(epoch, inc)) {
+    // cheaper than a full decode, and the result shares the unchanged
+    // parts (addrs, pg_temp, crush) with prev
+    map = new OSDMap(*prev);
+    dout(20) << "get_map " << epoch << " - applying incremental to " << prev->get_epoch()
+	     << " " << map << dendl;
+    if (map->apply_incremental(inc) < 0) {
+      derr << "get_map " << epoch << " incremental doesn't apply to " << prev->get_epoch() << dendl;
+      assert(0 == "bad incremental");
+    }
+  } else if (epoch > 0) {
+    map = new OSDMap;
     dout(20) << "get_map " << epoch << " - loading and decoding " << map << dendl;
     bufferlist bl;
     get_map_bl(epoch, bl);
     map->decode(bl);
   } else {
+    map = new OSDMap;
     dout(20) << "get_map " << epoch << " - return initial " << map << dendl;
   }
   add_map(map);
@@ -3821,6 +4214,17 @@ bool OSD::get_inc_map(epoch_t e, OSDMap::Incremental &inc)
 
 
 
+/// features negotiated on our cluster connection to peer (0 until connected)
+unsigned OSD::get_peer_features(int peer)
+{
+  Connection *con = cluster_messenger->get_connection(osdmap->get_cluster_inst(peer));
+  if (!con)
+    return 0;
+  unsigned features = con->get_features();
+  con->put();
+  return features;
+}
+
 bool OSD::require_mon_peer(Message *m)
 {
   if (!m->get_connection()->peer_is_mon()) {
@@ -3885,11 +4289,13 @@ bool OSD::require_same_or_newer_map(Message *m, epoch_t epoch)
     return false;
   }
 
-  // ok, our map is same or newer.. do they still exist?
+  // ok, our map is same or newer.. do they still exist?  (a cache tier's
+  // objecter comes from the public address)
   if (m->get_source().is_osd()) {
     int from = m->get_source().num();
     if (!osdmap->have_inst(from) ||
-	osdmap->get_cluster_addr(from) != m->get_source_inst().addr) {
+	(osdmap->get_cluster_addr(from) != m->get_source_inst().addr &&
+	 osdmap->get_addr(from) != m->get_source_inst().addr)) {
       dout(0) << "from dead osd." << from << ", dropping, sharing map" << dendl;
       send_incremental_map(epoch, m->get_source_inst(), true);
 
@@ -3951,8 +4357,15 @@ void OSD::kick_pg_split_queue()
 
   dout(10) << "kick_pg_split_queue" << dendl;
 
+  int max = g_conf->osd_pg_split_max_per_tick;
+  int split = 0;
   map<pg_t, set<pg_t> >::iterator n = pg_split_ready.begin();
   while (n != pg_split_ready.end()) {
+    if (max > 0 && split >= max) {
+      dout(10) << "kick_pg_split_queue split " << split << ", leaving "
+	       << pg_split_ready.size() << " for later" << dendl;
+      break;
+    }
     map<pg_t, set<pg_t> >::iterator p = n++;
     // how many children should this parent have?
     unsigned nchildren = (1 << (creating_pgs[*p->second.begin()].split_bits - 1)) - 1;
@@ -3972,8 +4385,7 @@ void OSD::kick_pg_split_queue()
 
     dout(15) << " parent " << p->first << " children " << p->second 
 	     << " ready" << dendl;
-    
-    // FIXME: this should be done in a separate thread, eventually
+    split++;
 
     // create and lock children
     ObjectStore::Transaction *t = new ObjectStore::Transaction;
@@ -4035,46 +4447,69 @@ void OSD::split_pg(PG *parent, map<pg_t,PG*>& children, ObjectStore::Transaction
   dout(10) << "split_pg " << *parent << dendl;
   pg_t parentid = parent->info.pgid;
 
-  // split objects
+  /*
+   * An object's pg is decided by the low bits of its hash, so each
+   * child's objects are those matching one or two bit patterns; the
+   * store moves them by pattern (for FileStore, by renaming whole hash
+   * subdirectories) rather than one object at a time.
+   */
+  const pg_pool_t *pool = osdmap->get_pg_pool(parentid.pool());
+  unsigned mask = parentid.preferred() >= 0 ? pool->get_lpg_num_mask() : pool->get_pg_num_mask();
+  unsigned bits = 0;
+  while (mask >> bits)
+    bits++;
+  for (map<pg_t,PG*>::iterator p = children.begin(); p != children.end(); p++) {
+    PG *child = p->second;
+    unsigned ps = p->first.ps();
+    unsigned cand[2] = { ps, ps + (mask + 1) / 2 };
+    for (int i = 0; i < 2; i++) {
+      if (cand[i] > mask ||
+	  osdmap->raw_pg_to_pg(pg_t(cand[i], parentid.pool(), parentid.preferred())) != p->first)
+	continue;
+      dout(20) << "  moving hash " << bits << "/" << cand[i] << " from " << parentid
+	       << " -> " << p->first << dendl;
+      t.split_collection(coll_t(parentid), bits, cand[i], coll_t(p->first));
+      for (interval_set<snapid_t>::iterator q = parent->snap_collections.begin();
+	   q != parent->snap_collections.end();
+	   q++) {
+	for (snapid_t s = q.get_start(); s < q.get_start() + q.get_len(); ++s) {
+	  child->make_snap_collection(t, s);
+	  t.split_collection(coll_t(parentid, s), bits, cand[i], coll_t(p->first, s));
+	}
+      }
+    }
+  }
+
+  // child stats
   vector<hobject_t> olist;
   store->collection_list(coll_t(parent->info.pgid), olist);
 
   for (vector<hobject_t>::iterator p = olist.begin(); p != olist.end(); p++) {
     hobject_t poid = *p;
-    ceph_object_layout l = osdmap->make_object_layout(poid.oid, parentid.pool(), parentid.preferred());
-    pg_t pgid = osdmap->raw_pg_to_pg(pg_t(l.ol_pgid));
+    pg_t pgid = osdmap->raw_pg_to_pg(pg_t(poid.hash, parentid.pool(), parentid.preferred()));
     if (pgid != parentid) {
-      dout(20) << "  moving " << poid << " from " << parentid << " -> " << pgid << dendl;
       PG *child = children[pgid];
       assert(child);
-      bufferlist bv;
 
       struct stat st;
       store->stat(coll_t(parentid), poid, &st);
-      store->getattr(coll_t(parentid), poid, OI_ATTR, bv);
-      object_info_t oi(bv);
-
-      t.collection_add(coll_t(pgid), coll_t(parentid), poid);
-      t.collection_remove(coll_t(parentid), poid);
-      if (oi.snaps.size()) {
-	snapid_t first = oi.snaps[0];
-	t.collection_add(coll_t(pgid, first), coll_t(parentid), poid);
-	t.collection_remove(coll_t(parentid, first), poid);
-	if (oi.snaps.size() > 1) {
-	  snapid_t last = oi.snaps[oi.snaps.size()-1];
-	  t.collection_add(coll_t(pgid, last), coll_t(parentid), poid);
-	  t.collection_remove(coll_t(parentid, last), poid);
-	}
-      }
 
-      // add to child stats
       child->info.stats.stats.sum.num_bytes += st.st_size;
       child->info.stats.stats.sum.num_kb += SHIFT_ROUND_UP(st.st_size, 10);
       child->info.stats.stats.sum.num_objects++;
       if (poid.snap && poid.snap != CEPH_NOSNAP)
 	child->info.stats.stats.sum.num_object_clones++;
-    } else {
-      dout(20) << " leaving " << poid << "   in " << parentid << dendl;
+    }
+  }
+
+  // split missing (normally empty, the parent is clean)
+  PG::Missing::item_map::iterator m = parent->missing.missing.begin();
+  while (m != parent->missing.missing.end()) {
+    PG::Missing::item_map::iterator cur = m++;
+    pg_t pgid = osdmap->raw_pg_to_pg(pg_t(cur->first.hash, parentid.pool(), parentid.preferred()));
+    if (pgid != parentid) {
+      children[pgid]->missing.add(cur->first, cur->second.need, cur->second.have);
+      parent->missing.rm(cur);
     }
   }
 
@@ -4085,13 +4520,11 @@ void OSD::split_pg(PG *parent, map<pg_t,PG*>& children, ObjectStore::Transaction
   *_dout << dendl;
   parent->log.unindex();
 
-  list<PG::Log::Entry>::iterator p = parent->log.log.begin();
+  PG::Log::entry_list::iterator p = parent->log.log.begin();
   while (p != parent->log.log.end()) {
-    list<PG::Log::Entry>::iterator cur = p;
+    PG::Log::entry_list::iterator cur = p;
     p++;
-    hobject_t& poid = cur->soid;
-    ceph_object_layout l = osdmap->make_object_layout(poid.oid, parentid.pool(), parentid.preferred());
-    pg_t pgid = osdmap->raw_pg_to_pg(pg_t(l.ol_pgid));
+    pg_t pgid = osdmap->raw_pg_to_pg(pg_t(cur->soid.hash, parentid.pool(), parentid.preferred()));
     if (pgid != parentid) {
       dout(20) << "  moving " << *cur << " from " << parentid << " -> " << pgid << dendl;
       PG *child = children[pgid];
@@ -4328,8 +4761,6 @@ void OSD::handle_pg_notify(MOSDPGNotify *m)
   if (!require_same_or_newer_map(m, m->get_epoch())) return;
 
   // look for unknown PGs i'm primary for
-  map< int, map<pg_t,PG::Query> > query_map;
-  map<int, MOSDPGInfo*> info_map;
   int created = 0;
 
   for (vector<PG::Info>::iterator it = m->get_pg_list().begin();
@@ -4351,17 +4782,17 @@ void OSD::handle_pg_notify(MOSDPGNotify *m)
       continue;
     }
 
-    PG::RecoveryCtx rctx(&query_map, &info_map, 0, &fin->contexts, t);
-    pg->handle_notify(from, *it, &rctx);
-
-    int tr = store->queue_transaction(&pg->osr, t, new ObjectStore::C_DeleteTransaction(t), fin);
-    assert(tr == 0);
+    PG::PeeringEvt evt;
+    evt.type = PG::PeeringEvt::NOTIFY;
+    evt.from = from;
+    evt.epoch = m->get_epoch();
+    evt.query_epoch = m->get_query_epoch();
+    evt.info = *it;
+    queue_pg_txn(pg, t, fin);
+    queue_peering_event(pg, evt);
     pg->unlock();
   }
   
-  do_queries(query_map);
-  do_infos(info_map);
-  
   kick_pg_split_queue();
 
   if (created)
@@ -4395,19 +4826,20 @@ void OSD::handle_pg_log(MOSDPGLog *m)
     pg->unlock();
     delete t;
     delete fin;
+    m->put();
     return;
   }
 
-  map< int, map<pg_t,PG::Query> > query_map;
-  map< int, MOSDPGInfo* > info_map;
-  PG::RecoveryCtx rctx(&query_map, &info_map, 0, &fin->contexts, t);
-  pg->handle_log(from, m, &rctx);
+  PG::PeeringEvt evt;
+  evt.type = PG::PeeringEvt::LOG;
+  evt.from = from;
+  evt.epoch = m->get_epoch();
+  evt.query_epoch = m->get_query_epoch();
+  evt.msg = m;
+  m->get();
+  queue_pg_txn(pg, t, fin);
+  queue_peering_event(pg, evt);
   pg->unlock();
-  do_queries(query_map);
-  do_infos(info_map);
-
-  int tr = store->queue_transaction(&pg->osr, t, new ObjectStore::C_DeleteTransaction(t), fin);
-  assert(!tr);
 
   if (created)
     update_heartbeat_peers();
@@ -4423,7 +4855,6 @@ void OSD::handle_pg_info(MOSDPGInfo *m)
 
   int from = m->get_source().num();
   if (!require_same_or_newer_map(m, m->get_epoch())) return;
-  map< int, MOSDPGInfo* > info_map;
 
   int created = 0;
 
@@ -4445,17 +4876,16 @@ void OSD::handle_pg_info(MOSDPGInfo *m)
       continue;
     }
 
-    PG::RecoveryCtx rctx(0, &info_map, 0, &fin->contexts, t);
-
-    pg->handle_info(from, *p, &rctx);
-
-    int tr = store->queue_transaction(&pg->osr, t, new ObjectStore::C_DeleteTransaction(t), fin);
-    assert(!tr);
-
+    PG::PeeringEvt evt;
+    evt.type = PG::PeeringEvt::INFO;
+    evt.from = from;
+    evt.epoch = evt.query_epoch = m->get_epoch();
+    evt.info = *p;
+    queue_pg_txn(pg, t, fin);
+    queue_peering_event(pg, evt);
     pg->unlock();
   }
 
-  do_infos(info_map);
   if (created)
     update_heartbeat_peers();
 
@@ -4622,9 +5052,13 @@ void OSD::handle_pg_query(MOSDPGQuery *m)
     pg->info.history.merge(it->second.history);
     reg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
 
-    // ok, process query!
-    PG::RecoveryCtx rctx(0, 0, &notify_list, 0, 0);
-    pg->handle_query(from, it->second, m->get_epoch(), &rctx);
+    // ok, queue the query
+    PG::PeeringEvt evt;
+    evt.type = PG::PeeringEvt::QUERY;
+    evt.from = from;
+    evt.epoch = evt.query_epoch = m->get_epoch();
+    evt.query = it->second;
+    queue_peering_event(pg, evt);
     pg->unlock();
   }
   
@@ -4634,6 +5068,93 @@ void OSD::handle_pg_query(MOSDPGQuery *m)
 }
 
 
+void OSD::queue_peering_event(PG *pg, const PG::PeeringEvt& evt)
+{
+  pg->assert_locked();
+  dout(15) << "queue_peering_event " << *pg << " from osd." << evt.from
+	   << " e" << evt.epoch << dendl;
+  pg->queue_peering_event(evt);
+  peering_wq.queue(pg);
+}
+
+/*
+ * what get_or_create_pg set up goes to disk now, so that a new pg's
+ * collection exists before anything else is queued against it.
+ */
+void OSD::queue_pg_txn(PG *pg, ObjectStore::Transaction *t, C_Contexts *fin)
+{
+  if (t->empty() && fin->contexts.empty()) {
+    delete t;
+    delete fin;
+    return;
+  }
+  int tr = store->queue_transaction(&pg->osr, t, new ObjectStore::C_DeleteTransaction(t), fin);
+  assert(tr == 0);
+}
+
+/*
+ * runs in the peering wq, without osd_lock; handle_osd_map pauses us
+ * while it changes the map.
+ */
+void OSD::process_peering_events(list<PG*>& pgs)
+{
+  map< int, map<pg_t,PG::Query> > query_map;
+  map< int, MOSDPGInfo* > info_map;
+  map< epoch_t, map< int, vector<PG::Info> > > notify_lists;  // by query epoch
+
+  for (list<PG*>::iterator p = pgs.begin(); p != pgs.end(); ++p) {
+    PG *pg = *p;
+    pg->lock();
+    while (!pg->peering_queue.empty()) {
+      PG::PeeringEvt evt = pg->peering_queue.front();
+      pg->peering_queue.pop_front();
+
+      // the map may have moved on since the dispatcher looked
+      if (pg->old_peering_msg(evt.epoch, evt.query_epoch)) {
+	dout(10) << *pg << " ignoring old peering event from osd." << evt.from
+		 << " e" << evt.epoch << dendl;
+	if (evt.msg)
+	  evt.msg->put();
+	continue;
+      }
+
+      if (evt.type == PG::PeeringEvt::QUERY) {
+	PG::RecoveryCtx rctx(0, 0, &notify_lists[evt.epoch], 0, 0);
+	pg->handle_query(evt.from, evt.query, evt.epoch, &rctx);
+	continue;
+      }
+
+      ObjectStore::Transaction *t = new ObjectStore::Transaction;
+      C_Contexts *fin = new C_Contexts(g_ceph_context);
+      PG::RecoveryCtx rctx(&query_map, &info_map, 0, &fin->contexts, t);
+      switch (evt.type) {
+      case PG::PeeringEvt::NOTIFY:
+	pg->handle_notify(evt.from, evt.info, &rctx);
+	break;
+      case PG::PeeringEvt::INFO:
+	rctx.query_map = 0;
+	pg->handle_info(evt.from, evt.info, &rctx);
+	break;
+      default:
+	pg->handle_log(evt.from, (MOSDPGLog*)evt.msg, &rctx);
+	evt.msg->put();
+	break;
+      }
+      queue_pg_txn(pg, t, fin);
+    }
+    pg->unlock();
+    pg->put();
+  }
+
+  do_queries(query_map);
+  do_infos(info_map);
+  for (map< epoch_t, map< int, vector<PG::Info> > >::iterator p = notify_lists.begin();
+       p != notify_lists.end();
+       ++p)
+    do_notifies(p->second, p->first);
+}
+
+
 void OSD::handle_pg_remove(MOSDPGRemove *m)
 {
   assert(osd_lock.is_locked());
@@ -4980,6 +5501,8 @@ bool OSD::_recover_now()
     dout(15) << "_recover_now defer until " << defer_recovery_until << dendl;
     return false;
   }
+  if (!op_sched.may_start(OpScheduler::RECOVERY))
+    return false;
 
   return true;
 }
@@ -5048,6 +5571,8 @@ void OSD::start_recovery_op(PG *pg, const hobject_t& soid)
 	   << dendl;
   assert(recovery_ops_active >= 0);
   recovery_ops_active++;
+  // we don't know the object size yet; assume a full push chunk
+  op_sched.charge(OpScheduler::RECOVERY, g_conf->osd_recovery_max_chunk);
 
 #ifdef DEBUG_RECOVERY_OIDS
   dout(20) << "  active was " << recovery_oids[pg->info.pgid] << dendl;
@@ -5143,6 +5668,21 @@ void OSD::handle_misdirected_op(PG *pg, MOSDOp *op)
   }
 }
 
+/// bytes an op moves, for rate limiting: data sent plus extents read
+static uint64_t op_rate_bytes(MOSDOp *op)
+{
+  uint64_t bytes = op->get_data_len();
+  for (vector<OSDOp>::iterator p = op->ops.begin(); p != op->ops.end(); ++p) {
+    switch (p->op.op) {
+    case CEPH_OSD_OP_READ:
+    case CEPH_OSD_OP_SPARSE_READ:
+      bytes += p->op.extent.length;
+      break;
+    }
+  }
+  return bytes;
+}
+
 void OSD::handle_op(MOSDOp *op)
 {
   if (op_is_discardable(op)) {
@@ -5153,6 +5693,11 @@ void OSD::handle_op(MOSDOp *op)
   // we don't need encoded payload anymore
   op->clear_payload();
 
+  // requeued ops come back through here
+  if (!op->in_flight_item.is_on_list())
+    op_history.in_flight.add(op);
+  g_ceph_context->get_tracer()->record(op->get_trace_id(), "osd_handle_op", op->get_oid().name);
+
   // require same or newer map
   if (!require_same_or_newer_map(op, op->get_map_epoch()))
     return;
@@ -5212,6 +5757,38 @@ void OSD::handle_op(MOSDOp *op)
       osdmap->have_pg_pool(pool))
     pgid = osdmap->raw_pg_to_pg(pgid);
 
+  // a pool with an overlay only takes ops that ask for it explicitly
+  // (the cache tier's promotes and flushes); anything else would go
+  // around the cache.
+  const pg_pool_t *pi = osdmap->get_pg_pool(pool);
+  if (pi && (op->get_flags() & CEPH_OSD_FLAG_IGNORE_OVERLAY) == 0 &&
+      ((op->may_write() && pi->has_write_tier()) ||
+       (!op->may_write() && op->get_snapid() == CEPH_NOSNAP &&
+	pi->has_read_tier()))) {
+    if ((op->get_connection()->get_features() & CEPH_FEATURE_OSD_CACHEPOOL) &&
+	op->get_map_epoch() < osdmap->get_epoch()) {
+      // they'll resend to the tier once they see our map
+      dout(10) << "handle_op " << *op << " for pool " << pool
+	       << " with an overlay, from a stale map; dropping" << dendl;
+      op->put();
+    } else {
+      dout(10) << "handle_op " << *op << " for pool " << pool
+	       << " with an overlay, from a client that can't use it" << dendl;
+      reply_op_error(op, -EOPNOTSUPP);
+    }
+    return;
+  }
+
+  // over a pool or client rate limit, or behind ops that are?
+  unsigned hold;
+  double wait = op_limiter.admit(pool, osdmap->get_pg_pool(pool), op->get_source(),
+				 op_rate_bytes(op), ceph_clock_now(g_ceph_context),
+				 &hold);
+  if (hold) {
+    throttle_op(op, hold, wait);
+    return;
+  }
+
   // get and lock *pg.
   PG *pg = _have_pg(pgid) ? _lookup_lock_pg(pgid) : NULL;
   if (!pg) {
@@ -5222,11 +5799,58 @@ void OSD::handle_op(MOSDOp *op)
   }
 
   pg->get();
+  _share_map_acting(pg);
   enqueue_op(pg, op);
   pg->unlock();
   pg->put();
 }
 
+void OSD::throttle_op(MOSDOp *op, unsigned hold, double wait)
+{
+  assert(osd_lock.is_locked());
+  dout(15) << "throttle_op " << *op << " for " << wait << "s" << dendl;
+  throttled_ops.push_back(make_pair(op, hold));
+  logger->inc(l_osd_op_throttled);
+  logger->set(l_osd_op_throttled_q, throttled_ops.size());
+
+  // only queued behind older held ops; their retry will get to it
+  if (wait <= 0)
+    return;
+
+  utime_t at = ceph_clock_now(g_ceph_context);
+  at += wait;
+
+  if (throttle_retry_event) {
+    if (throttle_retry_at <= at)
+      return;
+    timer.cancel_event(throttle_retry_event);
+  }
+  throttle_retry_event = new C_RetryThrottledOps(this);
+  throttle_retry_at = at;
+  timer.add_event_at(at, throttle_retry_event);
+}
+
+/*
+ * Run held back ops through handle_op again, oldest first, so they get
+ * the tokens before anything newer.  Those still over a limit go back
+ * on the list in the same order, and hold their buckets again before
+ * the next op is released, so later ops on a bucket stay behind them.
+ */
+void OSD::retry_throttled_ops()
+{
+  assert(osd_lock.is_locked());
+  list<pair<MOSDOp*, unsigned> > ls;
+  ls.swap(throttled_ops);
+  dout(10) << "retry_throttled_ops " << ls.size() << " ops" << dendl;
+  logger->set(l_osd_op_throttled_q, 0);
+  while (!ls.empty()) {
+    MOSDOp *op = ls.front().first;
+    op_limiter.release(op->get_pg().pool(), op->get_source(), ls.front().second);
+    ls.pop_front();
+    handle_op(op);
+  }
+}
+
 bool OSD::op_has_sufficient_caps(PG *pg, MOSDOp *op)
 {
   Session *session = (Session *)op->get_connection()->get_priv();
@@ -5290,6 +5914,7 @@ void OSD::handle_sub_op(MOSDSubOp *op)
     return;
   }
   pg->get();
+  _share_map_acting(pg);
   enqueue_op(pg, op);
   pg->unlock();
   pg->put();
@@ -5325,6 +5950,7 @@ void OSD::handle_sub_op_reply(MOSDSubOpReply *op)
     return;
   }
   pg->get();
+  _share_map_acting(pg);
   enqueue_op(pg, op);
   pg->unlock();
   pg->put();
@@ -5441,11 +6067,29 @@ void OSD::enqueue_op(PG *pg, Message *op)
   }
 
   // add to pg's op_queue
+  if (op->get_type() == CEPH_MSG_OSD_OP)
+    ((MOSDOp*)op)->mark_stage(OSD_OP_STAGE_QUEUED, ceph_clock_now(g_ceph_context));
   pg->op_queue.push_back(op);
+  pending_ops_lock.Lock();
   pending_ops++;
   logger->set(l_osd_opq, pending_ops);
+  pending_ops_lock.Unlock();
   
-  op_wq.queue(pg);
+  get_op_wq(pg)->queue(pg);
+}
+
+/*
+ * share our map with the rest of the acting set before queueing an op
+ * that may send them sub ops.  this used to happen in dequeue_op, but
+ * the op threads don't take osd_lock; any map change requeues the
+ * queued ops back through here anyway.
+ */
+void OSD::_share_map_acting(PG *pg)
+{
+  assert(osd_lock.is_locked());
+  assert(pg->is_locked());
+  for (unsigned i=1; i<pg->acting.size(); i++) 
+    _share_map_outgoing( osdmap->get_cluster_inst(pg->acting[i]) );
 }
 
 /*
@@ -5486,32 +6130,28 @@ void OSD::dequeue_op(PG *pg)
 {
   Message *op = 0;
 
-  osd_lock.Lock();
-  {
-    // lock pg and get pending op
-    pg->lock();
+  // lock pg and get pending op
+  pg->lock();
 
-    assert(!pg->op_queue.empty());
+  // the primary may have coalesced the op we were queued for into an
+  // earlier write; then there is one entry too many for the pg.
+  if (!pg->op_queue.empty()) {
     op = pg->op_queue.front();
     pg->op_queue.pop_front();
-    
-    dout(10) << "dequeue_op " << *op << " pg " << *pg
-	     << ", " << (pending_ops-1) << " more pending"
-	     << dendl;
-
-    // share map?
-    //  do this preemptively while we hold osd_lock and pg->lock
-    //  to avoid lock ordering issues later.
-    for (unsigned i=1; i<pg->acting.size(); i++) 
-      _share_map_outgoing( osdmap->get_cluster_inst(pg->acting[i]) );
+    dout(10) << "dequeue_op " << *op << " pg " << *pg << dendl;
+  } else {
+    dout(10) << "dequeue_op nothing left on pg " << *pg << dendl;
   }
-  osd_lock.Unlock();
 
-  if (op->get_type() == CEPH_MSG_OSD_OP) {
-    if (op_is_discardable((MOSDOp*)op))
+  if (!op) {
+    // taken already
+  } else if (op->get_type() == CEPH_MSG_OSD_OP) {
+    if (op_is_discardable((MOSDOp*)op)) {
       op->put();
-    else
+    } else {
+      ((MOSDOp*)op)->mark_stage(OSD_OP_STAGE_STARTED, ceph_clock_now(g_ceph_context));
       pg->do_op((MOSDOp*)op); // do it now
+    }
   } else if (op->get_type() == MSG_OSD_SUBOP) {
     pg->do_sub_op((MOSDSubOp*)op);
   } else if (op->get_type() == MSG_OSD_SUBOPREPLY) {
@@ -5528,9 +6168,9 @@ void OSD::dequeue_op(PG *pg)
   //scrub_wq.queue(pg);
 
   // finish
-  osd_lock.Lock();
+  pending_ops_lock.Lock();
   {
-    dout(10) << "dequeue_op " << op << " finish" << dendl;
+    dout(10) << "dequeue_op " << op << " finish, " << (pending_ops-1) << " more pending" << dendl;
     assert(pending_ops > 0);
     
     if (pending_ops > g_conf->osd_max_opq) 
@@ -5541,19 +6181,26 @@ void OSD::dequeue_op(PG *pg)
     if (pending_ops == 0 && waiting_for_no_ops)
       no_pending_ops.Signal();
   }
-  osd_lock.Unlock();
+  pending_ops_lock.Unlock();
 }
 
+/*
+ * called with osd_lock held, which is dropped while we wait
+ */
 void OSD::wait_for_no_ops()
 {
+  osd_lock.Unlock();
+  pending_ops_lock.Lock();
   if (pending_ops > 0) {
     dout(7) << "wait_for_no_ops - waiting for " << pending_ops << dendl;
     waiting_for_no_ops = true;
     while (pending_ops > 0)
-      no_pending_ops.Wait(osd_lock);
+      no_pending_ops.Wait(pending_ops_lock);
     waiting_for_no_ops = false;
     assert(pending_ops == 0);
   } 
+  pending_ops_lock.Unlock();
+  osd_lock.Lock();
   dout(7) << "wait_for_no_ops - none" << dendl;
 }
 
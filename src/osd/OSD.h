@@ -24,9 +24,13 @@
 #include "common/Timer.h"
 #include "common/WorkQueue.h"
 #include "common/LogClient.h"
+#include "common/Finisher.h"
 
 #include "os/ObjectStore.h"
 #include "OSDCaps.h"
+#include "OpScheduler.h"
+#include "OpHistory.h"
+#include "OpLimiter.h"
 
 #include "common/DecayCounter.h"
 #include "osd/ClassHandler.h"
@@ -66,6 +70,20 @@ enum {
   l_osd_op_rw_rlat,
   l_osd_op_rw_lat,
 
+  // log2 histograms, usec
+  l_osd_op_lat_hist,
+  l_osd_op_r_lat_hist,
+  l_osd_op_w_lat_hist,
+  l_osd_op_rw_lat_hist,
+  l_osd_op_wait_hist,       // received -> started
+  l_osd_op_prepare_hist,    // started -> submitted
+  l_osd_op_commit_hist,     // submitted -> committed locally
+  l_osd_op_apply_hist,      // submitted -> applied locally
+  l_osd_op_repl_hist,       // submitted -> committed by the replicas
+
+  l_osd_op_throttled,
+  l_osd_op_throttled_q,
+
   l_osd_sop,
   l_osd_sop_inb,
   l_osd_sop_lat,
@@ -81,6 +99,7 @@ enum {
   l_osd_pull,
   l_osd_push,
   l_osd_push_outb,
+  l_osd_push_dirty,
 
   l_osd_rop,
 
@@ -113,6 +132,7 @@ class MOSDPGMissing;
 class Watch;
 class Notification;
 class ReplicatedPG;
+class Objecter;
 
 class AuthAuthorizeHandlerRegistry;
 
@@ -131,6 +151,7 @@ protected:
   MonClient   *monc;
   PerfCounters      *logger;
   ObjectStore *store;
+  bool store_has_omap;   // pg logs can be kept as omap entries
 
   // cover OSDMap update data when using multiple msgrs
   Cond *map_in_progress_cond;
@@ -160,6 +181,7 @@ protected:
 public:
   ClassHandler  *class_handler;
   int get_nodeid() { return whoami; }
+  unsigned get_peer_features(int peer);
   
   static hobject_t get_osdmap_pobject_name(epoch_t epoch) { 
     char foo[20];
@@ -221,6 +243,8 @@ private:
   ThreadPool op_tp;
   ThreadPool recovery_tp;
   ThreadPool disk_tp;
+  ThreadPool peering_tp;
+  ThreadPool snap_trim_tp;
   ThreadPool command_tp;
 
   // -- sessions --
@@ -252,6 +276,7 @@ private:
   epoch_t heartbeat_epoch;
   map<int, epoch_t> heartbeat_to, heartbeat_from;
   map<int, utime_t> heartbeat_from_stamp;
+  utime_t heartbeat_wake_at;   // when the heartbeat thread meant to wake
   map<int, Connection*> heartbeat_to_con, heartbeat_from_con;
   utime_t last_mon_heartbeat;
   Messenger *hbin_messenger, *hbout_messenger;
@@ -297,7 +322,7 @@ private:
   Mutex stat_lock;
   osd_stat_t osd_stat;
 
-  void update_osd_stat();
+  void update_osd_stat(const struct statfs& stbuf);
   
   // -- waiters --
   list<class Message*> finished;
@@ -322,44 +347,57 @@ private:
   void do_waiters();
   
   // -- op queue --
-  deque<PG*> op_queue;
-  
+  /*
+   * pgs are hashed onto osd_op_num_shards shards, each with its own
+   * queue, lock and threads (shard 0 runs on op_tp), so that op threads
+   * don't all contend on one work queue.  a pg's ops all go through
+   * the same shard, in order.  the op threads don't take osd_lock.
+   */
   struct OpWQ : public ThreadPool::WorkQueue<PG> {
     OSD *osd;
-    OpWQ(OSD *o, time_t ti, ThreadPool *tp)
-      : ThreadPool::WorkQueue<PG>("OSD::OpWQ", ti, ti*10, tp), osd(o) {}
+    deque<PG*> op_queue;   // one entry per queued op
+    OpWQ(OSD *o, string n, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<PG>(n, ti, ti*10, tp), osd(o) {}
 
     bool _enqueue(PG *pg) {
       pg->get();
-      osd->op_queue.push_back(pg);
+      op_queue.push_back(pg);
       return true;
     }
     void _dequeue(PG *pg) {
       assert(0);
     }
     bool _empty() {
-      return osd->op_queue.empty();
+      return op_queue.empty();
     }
     PG *_dequeue() {
-      if (osd->op_queue.empty())
+      if (op_queue.empty())
 	return NULL;
-      PG *pg = osd->op_queue.front();
-      osd->op_queue.pop_front();
+      PG *pg = op_queue.front();
+      op_queue.pop_front();
       return pg;
     }
     void _process(PG *pg) {
       osd->dequeue_op(pg);
     }
     void _clear() {
-      assert(osd->op_queue.empty());
+      assert(op_queue.empty());
     }
-  } op_wq;
+  };
+  vector<ThreadPool*> op_shard_tp;   // [0] is &op_tp
+  vector<OpWQ*> op_shard_wq;
 
+  OpWQ *get_op_wq(PG *pg) {
+    return op_shard_wq[__gnu_cxx::hash<pg_t>()(pg->info.pgid) % op_shard_wq.size()];
+  }
+
+  Mutex pending_ops_lock;  // protects the following
   int   pending_ops;
   bool  waiting_for_no_ops;
   Cond  no_pending_ops;
   Cond  op_queue_cond;
   
+  void _share_map_acting(PG *pg);
   void wait_for_no_ops();
   void enqueue_op(PG *pg, Message *op);
   void requeue_ops(PG *pg, list<Message*>& ls);
@@ -391,6 +429,7 @@ private:
   bool _share_map_incoming(const entity_inst_t& inst, epoch_t epoch,
 			   Session *session = 0);
   void _share_map_outgoing(const entity_inst_t& inst);
+  void gossip_map(epoch_t since);
 
   void wait_for_new_map(Message *m);
   void handle_osd_map(class MOSDMap *m);
@@ -490,8 +529,12 @@ protected:
 
 
   // == monitor interaction ==
+  /// protects last_mon_report, up_thru_* and pg_temp_wanted, which
+  /// peering threads update without osd_lock
+  Mutex mon_report_lock;
   utime_t last_mon_report;
   utime_t last_pg_stats_sent;
+  utime_t last_pg_stats_resent;   // last time we sent every unacked pg
 
   void do_mon_report();
 
@@ -510,11 +553,13 @@ protected:
 
   void queue_want_up_thru(epoch_t want);
   void send_alive();
+  void _send_alive();
 
   // -- pg_temp --
   map<pg_t, vector<int> > pg_temp_wanted;
 
   void queue_want_pg_temp(pg_t pgid, vector<int>& want);
+  void remove_want_pg_temp(pg_t pgid);
   void send_pg_temp();
 
   // -- failures --
@@ -535,7 +580,7 @@ protected:
   bool osd_stat_updated;
   uint64_t pg_stat_tid, pg_stat_tid_flushed;
 
-  void send_pg_stats(const utime_t &now);
+  void send_pg_stats(const utime_t &now, bool resend=false);
   void handle_pg_stats_ack(class MPGStatsAck *ack);
   void flush_pg_stats();
 
@@ -600,6 +645,67 @@ protected:
   void handle_pg_info(class MOSDPGInfo *m);
   void handle_pg_trim(class MOSDPGTrim *m);
 
+  /*
+   * the dispatcher finds (or creates) the pg for a peering message and
+   * checks it against the map under osd_lock; the state machine then runs
+   * here under the pg lock only.  a pass takes up to
+   * osd_peering_wq_batch_size pgs and sends their notifies, queries and
+   * infos as one message per peer.
+   */
+  xlist<PG*> peering_queue;
+
+  struct PeeringWQ : public ThreadPool::WorkQueue<PG> {
+    OSD *osd;
+    PeeringWQ(OSD *o, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<PG>("OSD::PeeringWQ", ti, ti*10, tp), osd(o) {}
+
+    bool _empty() {
+      return osd->peering_queue.empty();
+    }
+    bool _enqueue(PG *pg) {
+      if (!pg->peering_item.is_on_list()) {
+	pg->get();
+	osd->peering_queue.push_back(&pg->peering_item);
+	return true;
+      }
+      return false;
+    }
+    void _dequeue(PG *pg) {
+      if (pg->peering_item.remove_myself())
+	pg->put();
+    }
+    PG *_dequeue() {
+      if (osd->peering_queue.empty())
+	return NULL;
+      PG *pg = osd->peering_queue.front();
+      osd->peering_queue.pop_front();
+      return pg;
+    }
+    void _process(PG *pg) {
+      list<PG*> pgs;
+      pgs.push_back(pg);
+      lock();
+      while ((int)pgs.size() < g_conf->osd_peering_wq_batch_size &&
+	     !osd->peering_queue.empty()) {
+	pgs.push_back(osd->peering_queue.front());
+	osd->peering_queue.pop_front();
+      }
+      unlock();
+      osd->process_peering_events(pgs);
+    }
+    void _clear() {
+      while (!osd->peering_queue.empty()) {
+	PG *pg = osd->peering_queue.front();
+	osd->peering_queue.pop_front();
+	pg->put();
+      }
+    }
+  } peering_wq;
+
+  void queue_peering_event(PG *pg, const PG::PeeringEvt& evt);
+  void queue_pg_txn(PG *pg, ObjectStore::Transaction *t, C_Contexts *fin);
+  void process_peering_events(list<PG*>& pgs);
+
   void handle_pg_remove(class MOSDPGRemove *m);
   void queue_pg_for_deletion(PG *pg);
   void _remove_pg(PG *pg);
@@ -710,6 +816,29 @@ protected:
   void handle_command(class MCommand *m);
   void do_command(Connection *con, tid_t tid, vector<string>& cmd, bufferlist& data);
 
+  // -- background work pacing --
+  OpScheduler op_sched;
+
+  // -- slowest recent client ops --
+  OpHistory op_history;
+
+  // -- client op rate limits --
+  OpLimiter op_limiter;
+  list<pair<MOSDOp*, unsigned> > throttled_ops;   // in arrival order, with the buckets held on
+  Context *throttle_retry_event;
+  utime_t throttle_retry_at;
+
+  struct C_RetryThrottledOps : public Context {
+    OSD *osd;
+    C_RetryThrottledOps(OSD *o) : osd(o) {}
+    void finish(int r) {
+      osd->throttle_retry_event = NULL;
+      osd->retry_throttled_ops();
+    }
+  };
+  void throttle_op(MOSDOp *op, unsigned hold, double wait);
+  void retry_throttled_ops();
+
   // -- pg recovery --
   xlist<PG*> recovery_queue;
   utime_t defer_recovery_until;
@@ -815,11 +944,14 @@ protected:
     PG *_dequeue() {
       if (osd->snap_trim_queue.empty())
 	return NULL;
+      if (!osd->op_sched.may_start(OpScheduler::SNAPTRIM))
+	return NULL;
       PG *pg = osd->snap_trim_queue.front();
       osd->snap_trim_queue.pop_front();
       return pg;
     }
     void _process(PG *pg) {
+      // the trimmer charges op_sched for each object it trims
       pg->snap_trimmer();
     }
     void _clear() {
@@ -827,6 +959,43 @@ protected:
     }
   } snap_trim_wq;
 
+  // -- cache tier agent --
+  xlist<PG*> agent_queue;
+
+  struct AgentWQ : public ThreadPool::WorkQueue<PG> {
+    OSD *osd;
+    AgentWQ(OSD *o, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<PG>("OSD::AgentWQ", ti, 0, tp), osd(o) {}
+
+    bool _empty() {
+      return osd->agent_queue.empty();
+    }
+    bool _enqueue(PG *pg) {
+      if (pg->agent_item.is_on_list())
+	return false;
+      pg->get();
+      osd->agent_queue.push_back(&pg->agent_item);
+      return true;
+    }
+    void _dequeue(PG *pg) {
+      if (pg->agent_item.remove_myself())
+	pg->put();
+    }
+    PG *_dequeue() {
+      if (osd->agent_queue.empty())
+	return NULL;
+      PG *pg = osd->agent_queue.front();
+      osd->agent_queue.pop_front();
+      return pg;
+    }
+    void _process(PG *pg) {
+      pg->agent_work();
+    }
+    void _clear() {
+      osd->agent_queue.clear();
+    }
+  } agent_wq;
+
   // -- scrub scheduling --
   Mutex sched_scrub_lock;
   int scrubs_pending;
@@ -879,6 +1048,8 @@ protected:
     PG *_dequeue() {
       if (osd->scrub_queue.empty())
 	return NULL;
+      if (!osd->op_sched.may_start(OpScheduler::SCRUB))
+	return NULL;
       PG *pg = osd->scrub_queue.front();
       osd->scrub_queue.pop_front();
       return pg;
@@ -1119,6 +1290,21 @@ public:
 			    ReplicatedPG *pg,
 			    entity_name_t entity,
 			    utime_t expire);
+
+  /*
+   * Our own client, for cache tiers to promote objects from and flush
+   * them to their base pools.  It has a map of its own, which we bring
+   * up to date after each of ours, and its own lock, taken after any pg
+   * lock; completions go through objecter_finisher so that they can
+   * take pg locks.
+   */
+  Mutex objecter_lock;
+  SafeTimer objecter_timer;
+  OSDMap *objecter_osdmap;
+  Objecter *objecter;
+  Finisher objecter_finisher;
+private:
+  void objecter_update_map();
 };
 
 //compatibility of the executable
@@ -267,8 +267,107 @@ bool OSDMap::is_blacklisted(const entity_addr_t& a)
   return blacklist.count(b);
 }
 
+// cap on cached crush results per map, in case of many localized pgs
+#define MAX_CACHED_MAPPINGS (1 << 20)
+
+bool OSDMap::_get_cached_mapping(const mapping_key_t& k, vector<int>& osds)
+{
+  Mutex::Locker l(mapping_cache->lock);
+  if (mapping_cache->crush != crush.get())
+    return false;
+  map<mapping_key_t, vector<int> >::iterator p = mapping_cache->raw.find(k);
+  if (p == mapping_cache->raw.end())
+    return false;
+  osds = p->second;
+  return true;
+}
+
+void OSDMap::_cache_mapping(const mapping_key_t& k, const vector<int>& osds)
+{
+  Mutex::Locker l(mapping_cache->lock);
+  if (mapping_cache->crush != crush.get() ||
+      mapping_cache->raw.size() >= MAX_CACHED_MAPPINGS) {
+    mapping_cache->raw.clear();
+    mapping_cache->crush = crush.get();
+  }
+  mapping_cache->raw[k] = osds;
+}
+
+/*
+ * Keep the previous epoch's mappings that this epoch's changes can't
+ * have touched.  Only called when the crush map and max_osd are the
+ * same and no weight went up.  A device is rejected by crush with a
+ * probability that only grows as its weight drops, so a mapping that
+ * doesn't include a lowered device still comes out the same.
+ */
+void OSDMap::_carry_mapping_cache(mapping_cache_s& from, const set<int>& lowered)
+{
+  Mutex::Locker l(from.lock);
+  if (from.crush != crush.get())
+    return;
+  mapping_cache->crush = crush.get();
+  for (map<mapping_key_t, vector<int> >::iterator p = from.raw.begin();
+       p != from.raw.end();
+       ++p) {
+    unsigned i;
+    for (i = 0; i < p->second.size(); i++)
+      if (lowered.count(p->second[i]))
+	break;
+    if (i == p->second.size())
+      mapping_cache->raw.insert(mapping_cache->raw.end(), *p);
+  }
+}
+
+void OSDMap::pgs_to_acting_osds(const vector<pg_t>& pgs, vector<vector<int> >& acting)
+{
+  acting.clear();
+  acting.resize(pgs.size());
+
+  map<int64_t, vector<unsigned> > by_pool;
+  for (unsigned i = 0; i < pgs.size(); i++) {
+    const pg_pool_t *pool = get_pg_pool(pgs[i].pool());
+    if (!pool)
+      continue;
+    int preferred = pgs[i].preferred();
+    if (preferred >= 0 && preferred < max_osd && preferred < crush->get_max_devices())
+      pg_to_acting_osds(pgs[i], acting[i]);  // forcefed; one at a time
+    else
+      by_pool[pgs[i].pool()].push_back(i);
+  }
+
+  for (map<int64_t, vector<unsigned> >::iterator p = by_pool.begin();
+       p != by_pool.end();
+       ++p) {
+    const pg_pool_t *pool = get_pg_pool(p->first);
+    unsigned size = pool->get_size();
+    int ruleno = crush->find_rule(pool->get_crush_ruleset(), pool->get_type(), size);
+    if (ruleno < 0) {
+      // no crush mapping, but a pg_temp still applies (as in pg_to_acting_osds)
+      vector<int> none;
+      for (unsigned j = 0; j < p->second.size(); j++) {
+	unsigned i = p->second[j];
+	_raw_to_temp_osds(*pool, pgs[i], none, acting[i]);
+      }
+      continue;
+    }
+
+    vector<int> xs(p->second.size());
+    for (unsigned j = 0; j < p->second.size(); j++)
+      xs[j] = pool->raw_pg_to_pps(pgs[p->second[j]]);
+    vector<vector<int> > raw;
+    crush->do_rule_batch(ruleno, xs, raw, size, osd_weight);
+
+    for (unsigned j = 0; j < p->second.size(); j++) {
+      unsigned i = p->second[j];
+      if (!_raw_to_temp_osds(*pool, pgs[i], raw[j], acting[i]))
+	_raw_to_up_osds(pgs[i], raw[j], acting[i]);
+    }
+  }
+}
+
 void OSDMap::set_max_osd(int m)
 {
+  _invalidate_mapping_cache();
   int o = max_osd;
   max_osd = m;
   osd_state.resize(m);
@@ -278,9 +377,10 @@ void OSDMap::set_max_osd(int m)
     osd_weight[o] = CEPH_OSD_OUT;
   }
   osd_info.resize(m);
-  osd_addr.resize(m);
-  osd_cluster_addr.resize(m);
-  osd_hb_addr.resize(m);
+  addrs_s& addrs = _mutable_addrs();
+  addrs.client_addr.resize(m);
+  addrs.cluster_addr.resize(m);
+  addrs.hb_addr.resize(m);
 
   calc_num_osds();
 }
@@ -321,6 +421,8 @@ int OSDMap::apply_incremental(Incremental &inc)
   assert(inc.epoch == epoch+1);
   epoch++;
   modified = inc.modified;
+  std::tr1::shared_ptr<mapping_cache_s> old_cache = mapping_cache;
+  _invalidate_mapping_cache();
 
   // full map?
   if (inc.fullmap.length()) {
@@ -358,10 +460,18 @@ int OSDMap::apply_incremental(Incremental &inc)
     name_pool[p->second] = p->first;
   }
 
+  bool weight_raised = false;
+  set<int> weight_lowered;
   for (map<int32_t,uint32_t>::iterator i = inc.new_weight.begin();
        i != inc.new_weight.end();
-       i++)
+       i++) {
+    assert(i->first < max_osd);
+    if (i->second > osd_weight[i->first])
+      weight_raised = true;
+    else if (i->second < osd_weight[i->first])
+      weight_lowered.insert(i->first);
     set_weight(i->first, i->second);
+  }
 
   // up/down
   for (map<int32_t,uint8_t>::iterator i = inc.new_state.begin();
@@ -378,17 +488,17 @@ int OSDMap::apply_incremental(Incremental &inc)
        i != inc.new_up_client.end();
        i++) {
     osd_state[i->first] |= CEPH_OSD_EXISTS | CEPH_OSD_UP;
-    osd_addr[i->first] = i->second;
+    _mutable_addrs().client_addr[i->first] = i->second;
     if (inc.new_hb_up.empty())
-      osd_hb_addr[i->first] = i->second;	//this is a backward-compatibility hack
+      osd_addrs->hb_addr[i->first] = i->second;	//this is a backward-compatibility hack
     else
-      osd_hb_addr[i->first] = inc.new_hb_up[i->first];
+      osd_addrs->hb_addr[i->first] = inc.new_hb_up[i->first];
     osd_info[i->first].up_from = epoch;
   }
   for (map<int32_t,entity_addr_t>::iterator i = inc.new_up_internal.begin();
        i != inc.new_up_internal.end();
        i++)
-    osd_cluster_addr[i->first] = i->second;
+    _mutable_addrs().cluster_addr[i->first] = i->second;
   // info
   for (map<int32_t,epoch_t>::iterator i = inc.new_up_thru.begin();
        i != inc.new_up_thru.end();
@@ -406,9 +516,9 @@ int OSDMap::apply_incremental(Incremental &inc)
   // pg rebuild
   for (map<pg_t, vector<int> >::iterator p = inc.new_pg_temp.begin(); p != inc.new_pg_temp.end(); p++) {
     if (p->second.empty())
-      pg_temp.erase(p->first);
+      _mutable_pg_temp().erase(p->first);
     else
-      pg_temp[p->first] = p->second;
+      _mutable_pg_temp()[p->first] = p->second;
   }
 
   // blacklist
@@ -433,14 +543,143 @@ int OSDMap::apply_incremental(Incremental &inc)
   // do new crush map last (after up/down stuff)
   if (inc.crush.length()) {
     bufferlist::iterator blp = inc.crush.begin();
-    crush.decode(blp);
+    crush.reset(new CrushWrapper);
+    crush->decode(blp);
   }
 
+  if (!inc.crush.length() && inc.new_max_osd < 0 && !weight_raised)
+    _carry_mapping_cache(*old_cache, weight_lowered);
+
   calc_num_osds();
   return 0;
 }
 
 // serialize, unserialize
+// ----------------------------------
+// compact (v7) encoding helpers
+
+static void encode_varint(uint64_t v, bufferlist& bl)
+{
+  while (v >= 0x80) {
+    bl.append((char)(v | 0x80));
+    v >>= 7;
+  }
+  bl.append((char)v);
+}
+
+static uint64_t decode_varint(bufferlist::iterator& p)
+{
+  uint64_t v = 0;
+  __u8 b;
+  int shift = 0;
+  do {
+    if (shift > 63)
+      throw buffer::malformed_input("varint too long");
+    ::decode(b, p);
+    v |= (uint64_t)(b & 0x7f) << shift;
+    shift += 7;
+  } while (b & 0x80);
+  return v;
+}
+
+// zigzag, so small negative values (e.g. -1 for none) stay short
+static void encode_svarint(int64_t v, bufferlist& bl)
+{
+  encode_varint(((uint64_t)v << 1) ^ (uint64_t)(v >> 63), bl);
+}
+
+static int64_t decode_svarint(bufferlist::iterator& p)
+{
+  uint64_t v = decode_varint(p);
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/*
+ * An osd's cluster and heartbeat addrs are nearly always its client
+ * addr with another port and nonce; code them as just that difference.
+ */
+enum {
+  ADDR_BLANK = 0,
+  ADDR_NEAR = 1,   // base addr with port, nonce
+  ADDR_FULL = 2,
+};
+
+static void encode_addrs(const vector<entity_addr_t>& v, const vector<entity_addr_t>& base,
+			 bufferlist& bl)
+{
+  encode_varint(v.size(), bl);
+  for (unsigned i = 0; i < v.size(); i++) {
+    const entity_addr_t& a = v[i];
+    if (a == entity_addr_t()) {
+      bl.append((char)ADDR_BLANK);
+      continue;
+    }
+    if (i < base.size() && a.get_family() == base[i].get_family() &&
+	(a.get_family() == AF_INET || a.get_family() == AF_INET6)) {
+      entity_addr_t n = base[i];
+      n.set_port(a.get_port());
+      n.set_nonce(a.get_nonce());
+      if (n == a) {
+	bl.append((char)ADDR_NEAR);
+	encode_varint(a.get_port(), bl);
+	encode_varint(a.get_nonce(), bl);
+	continue;
+      }
+    }
+    bl.append((char)ADDR_FULL);
+    ::encode(a, bl);
+  }
+}
+
+static void decode_addrs(vector<entity_addr_t>& v, const vector<entity_addr_t>& base,
+			 bufferlist::iterator& p)
+{
+  v.resize(decode_varint(p));
+  for (unsigned i = 0; i < v.size(); i++) {
+    __u8 tag;
+    ::decode(tag, p);
+    switch (tag) {
+    case ADDR_BLANK:
+      v[i] = entity_addr_t();
+      break;
+    case ADDR_NEAR:
+      if (i >= base.size() ||
+	  (base[i].get_family() != AF_INET && base[i].get_family() != AF_INET6))
+	throw buffer::malformed_input("osdmap addr has no base");
+      v[i] = base[i];
+      v[i].set_port(decode_varint(p));
+      v[i].set_nonce(decode_varint(p));
+      break;
+    case ADDR_FULL:
+      ::decode(v[i], p);
+      break;
+    default:
+      throw buffer::malformed_input("bad osdmap addr tag");
+    }
+  }
+}
+
+OSDMap::addrs_s::addrs_s(const addrs_s& o)
+  : osd_bl_lock("OSDMap::addrs_s::osd_bl_lock")
+{
+  const_cast<addrs_s&>(o).need_osd_addrs();
+  client_addr = o.client_addr;
+  cluster_addr = o.cluster_addr;
+  hb_addr = o.hb_addr;
+}
+
+void OSDMap::addrs_s::decode_osd_addrs()
+{
+  Mutex::Locker l(osd_bl_lock);
+  if (!osd_bl_pending.read())
+    return;
+  bufferlist::iterator p = osd_bl.begin();
+  decode_addrs(cluster_addr, client_addr, p);
+  decode_addrs(hb_addr, client_addr, p);
+  osd_bl.clear();
+  osd_bl_pending.dec();
+}
+
 void OSDMap::encode_client_old(bufferlist& bl) const
 {
   __u16 v = 5;
@@ -481,13 +720,13 @@ void OSDMap::encode_client_old(bufferlist& bl) const
   ::encode(max_osd, bl);
   ::encode(osd_state, bl);
   ::encode(osd_weight, bl);
-  ::encode(osd_addr, bl);
+  ::encode(osd_addrs->client_addr, bl);
 
   // for ::encode(pg_temp, bl);
-  n = pg_temp.size();
+  n = pg_temp->size();
   ::encode(n, bl);
-  for (map<pg_t,vector<int32_t> >::const_iterator p = pg_temp.begin();
-       p != pg_temp.end();
+  for (map<pg_t,vector<int32_t> >::const_iterator p = pg_temp->begin();
+       p != pg_temp->end();
        ++p) {
     old_pg_t opg = p->first.get_old_pg();
     ::encode(opg, bl);
@@ -496,7 +735,7 @@ void OSDMap::encode_client_old(bufferlist& bl) const
 
   // crush
   bufferlist cbl;
-  crush.encode(cbl);
+  crush->encode(cbl);
   ::encode(cbl, bl);
 }
 
@@ -506,6 +745,14 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
     encode_client_old(bl);
     return;
   }
+  if (features & CEPH_FEATURE_OSDMAPCOMPACT) {
+    encode_compact(bl, features);
+    return;
+  }
+  osd_addrs->need_osd_addrs();
+
+  // three legacy-encoded addrs and the info make up most of each osd
+  bl.reserve(4096 + max_osd * 448 + pg_temp->size() * 32);
 
   __u16 v = 6;
   ::encode(v, bl);
@@ -525,24 +772,174 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
   ::encode(max_osd, bl);
   ::encode(osd_state, bl);
   ::encode(osd_weight, bl);
-  ::encode(osd_addr, bl);
+  ::encode(osd_addrs->client_addr, bl);
 
-  ::encode(pg_temp, bl);
+  ::encode(*pg_temp, bl);
 
   // crush
   bufferlist cbl;
-  crush.encode(cbl);
+  crush->encode(cbl);
   ::encode(cbl, bl);
 
   // extended
   __u16 ev = CEPH_OSDMAP_VERSION_EXT;
   ::encode(ev, bl);
-  ::encode(osd_hb_addr, bl);
+  ::encode(osd_addrs->hb_addr, bl);
   ::encode(osd_info, bl);
   ::encode(blacklist, bl);
-  ::encode(osd_cluster_addr, bl);
+  ::encode(osd_addrs->cluster_addr, bl);
+  ::encode(cluster_snapshot_epoch, bl);
+  ::encode(cluster_snapshot, bl);
+}
+
+/*
+ * v7: the per-osd arrays and pg_temp as varints (pg_temp keys as
+ * deltas from the previous key), and the cluster and heartbeat addrs
+ * in a section of their own that decode leaves for later.
+ */
+void OSDMap::encode_compact(bufferlist& bl, uint64_t features) const
+{
+  __u16 v = 7;
+  ::encode(v, bl);
+
+  ::encode(fsid, bl);
+  ::encode(epoch, bl);
+  ::encode(created, bl);
+  ::encode(modified, bl);
+
+  ::encode(pools, bl, features);
+  ::encode(pool_name, bl);
+  ::encode(pool_max, bl);
+
+  ::encode(flags, bl);
+
+  ::encode(max_osd, bl);
+  ::encode(osd_state, bl);
+  encode_varint(osd_weight.size(), bl);
+  for (unsigned i = 0; i < osd_weight.size(); i++)
+    encode_varint(osd_weight[i], bl);
+  ::encode(osd_addrs->client_addr, bl);
+
+  encode_varint(pg_temp->size(), bl);
+  pg_t last;
+  for (map<pg_t,vector<int32_t> >::const_iterator p = pg_temp->begin();
+       p != pg_temp->end();
+       ++p) {
+    const pg_t& pg = p->first;
+    encode_varint(pg.pool() - last.pool(), bl);
+    encode_svarint(pg.preferred(), bl);
+    if (pg.pool() == last.pool() && pg.preferred() == last.preferred())
+      encode_varint(pg.ps() - last.ps(), bl);
+    else
+      encode_varint(pg.ps(), bl);
+    encode_varint(p->second.size(), bl);
+    for (unsigned i = 0; i < p->second.size(); i++)
+      encode_svarint(p->second[i], bl);
+    last = pg;
+  }
+
+  bufferlist cbl;
+  crush->encode(cbl);
+  ::encode(cbl, bl);
+
+  encode_varint(osd_info.size(), bl);
+  for (unsigned i = 0; i < osd_info.size(); i++) {
+    const osd_info_t& info = osd_info[i];
+    encode_varint(info.last_clean_begin, bl);
+    encode_varint(info.last_clean_end, bl);
+    encode_varint(info.up_from, bl);
+    encode_varint(info.up_thru, bl);
+    encode_varint(info.down_at, bl);
+    encode_varint(info.lost_at, bl);
+  }
+  ::encode(blacklist, bl);
   ::encode(cluster_snapshot_epoch, bl);
   ::encode(cluster_snapshot, bl);
+
+  // a map we decoded but never looked inside can pass the section on as is
+  bufferlist abl;
+  bool raw = false;
+  {
+    Mutex::Locker l(osd_addrs->osd_bl_lock);
+    if (osd_addrs->osd_bl_pending.read()) {
+      abl = osd_addrs->osd_bl;
+      raw = true;
+    }
+  }
+  if (!raw) {
+    encode_addrs(osd_addrs->cluster_addr, osd_addrs->client_addr, abl);
+    encode_addrs(osd_addrs->hb_addr, osd_addrs->client_addr, abl);
+  }
+  ::encode(abl, bl);
+}
+
+void OSDMap::decode_compact(bufferlist::iterator& p)
+{
+  ::decode(fsid, p);
+  ::decode(epoch, p);
+  ::decode(created, p);
+  ::decode(modified, p);
+
+  ::decode(pools, p);
+  ::decode(pool_name, p);
+  ::decode(pool_max, p);
+
+  ::decode(flags, p);
+
+  ::decode(max_osd, p);
+  ::decode(osd_state, p);
+  osd_weight.resize(decode_varint(p));
+  for (unsigned i = 0; i < osd_weight.size(); i++)
+    osd_weight[i] = decode_varint(p);
+
+  osd_addrs.reset(new addrs_s);
+  pg_temp.reset(new map<pg_t,vector<int> >);
+  crush.reset(new CrushWrapper);
+  _invalidate_mapping_cache();
+
+  ::decode(osd_addrs->client_addr, p);
+
+  uint64_t n = decode_varint(p);
+  pg_t last;
+  while (n--) {
+    pg_t pg;
+    pg.set_pool(last.pool() + decode_varint(p));
+    pg.set_preferred(decode_svarint(p));
+    if (pg.pool() == last.pool() && pg.preferred() == last.preferred())
+      pg.set_ps(last.ps() + decode_varint(p));
+    else
+      pg.set_ps(decode_varint(p));
+    // keys arrive sorted; append at the end
+    vector<int>& osds = pg_temp->insert(pg_temp->end(), make_pair(pg, vector<int>()))->second;
+    osds.resize(decode_varint(p));
+    for (unsigned i = 0; i < osds.size(); i++)
+      osds[i] = decode_svarint(p);
+    last = pg;
+  }
+
+  bufferlist cbl;
+  ::decode(cbl, p);
+  bufferlist::iterator cblp = cbl.begin();
+  crush->decode(cblp);
+
+  osd_info.resize(decode_varint(p));
+  for (unsigned i = 0; i < osd_info.size(); i++) {
+    osd_info_t& info = osd_info[i];
+    info.last_clean_begin = decode_varint(p);
+    info.last_clean_end = decode_varint(p);
+    info.up_from = decode_varint(p);
+    info.up_thru = decode_varint(p);
+    info.down_at = decode_varint(p);
+    info.lost_at = decode_varint(p);
+  }
+  ::decode(blacklist, p);
+  ::decode(cluster_snapshot_epoch, p);
+  ::decode(cluster_snapshot, p);
+
+  // copy the section out so we don't pin the whole message or map buffer
+  ::decode(osd_addrs->osd_bl, p);
+  osd_addrs->osd_bl.rebuild();
+  osd_addrs->osd_bl_pending.set(1);
 }
 
 void OSDMap::decode(bufferlist& bl)
@@ -552,6 +949,12 @@ void OSDMap::decode(bufferlist& bl)
   __u16 v;
   ::decode(v, p);
 
+  if (v >= 7) {
+    decode_compact(p);
+    post_decode();
+    return;
+  }
+
   // base
   ::decode(fsid, p);
   ::decode(epoch, p);
@@ -596,45 +999,55 @@ void OSDMap::decode(bufferlist& bl)
   ::decode(max_osd, p);
   ::decode(osd_state, p);
   ::decode(osd_weight, p);
-  ::decode(osd_addr, p);
+  // never decode into structures we may be sharing with another map
+  osd_addrs.reset(new addrs_s);
+  pg_temp.reset(new map<pg_t,vector<int> >);
+  crush.reset(new CrushWrapper);
+  _invalidate_mapping_cache();
+
+  ::decode(osd_addrs->client_addr, p);
   if (v <= 5) {
-    pg_temp.clear();
     ::decode(n, p);
     while (n--) {
       old_pg_t opg;
       ::decode_raw(opg, p);
-      ::decode(pg_temp[pg_t(opg)], p);
+      ::decode((*pg_temp)[pg_t(opg)], p);
     }
   } else {
-    ::decode(pg_temp, p);
+    ::decode(*pg_temp, p);
   }
 
   // crush
   bufferlist cbl;
   ::decode(cbl, p);
   bufferlist::iterator cblp = cbl.begin();
-  crush.decode(cblp);
+  crush->decode(cblp);
 
   // extended
   __u16 ev = 0;
   if (v >= 5)
     ::decode(ev, p);
-  ::decode(osd_hb_addr, p);
+  ::decode(osd_addrs->hb_addr, p);
   ::decode(osd_info, p);
   if (v < 5)
     ::decode(pool_name, p);
 
   ::decode(blacklist, p);
   if (ev >= 6)
-    ::decode(osd_cluster_addr, p);
+    ::decode(osd_addrs->cluster_addr, p);
   else
-    osd_cluster_addr.resize(osd_addr.size());
+    osd_addrs->cluster_addr.resize(osd_addrs->client_addr.size());
 
   if (ev >= 7) {
     ::decode(cluster_snapshot_epoch, p);
     ::decode(cluster_snapshot, p);
   }
 
+  post_decode();
+}
+
+void OSDMap::post_decode()
+{
   // index pool names
   name_pool.clear();
   for (map<int64_t,string>::iterator i = pool_name.begin(); i != pool_name.end(); i++)
@@ -689,8 +1102,8 @@ void OSDMap::dump(Formatter *f) const
   f->close_section();
 
   f->open_array_section("pg_temp");
-  for (map<pg_t,vector<int> >::const_iterator p = pg_temp.begin();
-       p != pg_temp.end();
+  for (map<pg_t,vector<int> >::const_iterator p = pg_temp->begin();
+       p != pg_temp->end();
        p++) {
     f->open_array_section("osds");
     for (vector<int>::const_iterator q = p->second.begin(); q != p->second.end(); ++q)
@@ -780,8 +1193,8 @@ void OSDMap::print(ostream& out) const
   }
   out << std::endl;
 
-  for (map<pg_t,vector<int> >::const_iterator p = pg_temp.begin();
-       p != pg_temp.end();
+  for (map<pg_t,vector<int> >::const_iterator p = pg_temp->begin();
+       p != pg_temp->end();
        p++)
     out << "pg_temp " << p->first << " " << p->second << "\n";
 
@@ -812,10 +1225,10 @@ void OSDMap::print_tree(ostream& out) const
   out << "# id\tweight\ttype name\tup/down\treweight\n";
   set<int> touched;
   set<int> roots;
-  crush.find_roots(roots);
+  crush->find_roots(roots);
   for (set<int>::iterator p = roots.begin(); p != roots.end(); p++) {
     list<qi> q;
-    q.push_back(qi(*p, 0, crush.get_bucket_weight(*p) / (float)0x10000));
+    q.push_back(qi(*p, 0, crush->get_bucket_weight(*p) / (float)0x10000));
     while (!q.empty()) {
       int cur = q.front().item;
       int depth = q.front().depth;
@@ -833,14 +1246,14 @@ void OSDMap::print_tree(ostream& out) const
 	continue;
       }
 
-      int type = crush.get_bucket_type(cur);
-      out << crush.get_type_name(type) << " " << crush.get_item_name(cur) << "\n";
+      int type = crush->get_bucket_type(cur);
+      out << crush->get_type_name(type) << " " << crush->get_item_name(cur) << "\n";
 
       // queue bucket contents...
-      int s = crush.get_bucket_size(cur);
+      int s = crush->get_bucket_size(cur);
       for (int k=s-1; k>=0; k--)
-	q.push_front(qi(crush.get_bucket_item(cur, k), depth+1,
-			(float)crush.get_bucket_item_weight(cur, k) / (float)0x10000));
+	q.push_front(qi(crush->get_bucket_item(cur, k), depth+1,
+			(float)crush->get_bucket_item_weight(cur, k) / (float)0x10000));
     }
   }
 
@@ -911,7 +1324,8 @@ void OSDMap::build_simple(CephContext *cct, epoch_t e, ceph_fsid_t &fsid,
     pool_name[pool] = p->second;
   }
 
-  build_simple_crush_map(cct, crush, rulesets, nosd, ndom);
+  crush.reset(new CrushWrapper);
+  build_simple_crush_map(cct, *crush, rulesets, nosd, ndom);
 
   for (int i=0; i<nosd; i++) {
     set_state(i, 0);
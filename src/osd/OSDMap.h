@@ -27,6 +27,8 @@
 #include "msg/Message.h"
 #include "common/Mutex.h"
 #include "common/Clock.h"
+#include "common/mempool.h"
+#include "include/atomic.h"
 
 #include "crush/CrushWrapper.h"
 
@@ -39,6 +41,7 @@
 using namespace std;
 
 #include <ext/hash_set>
+#include <tr1/memory>
 using __gnu_cxx::hash_set;
 
 
@@ -103,6 +106,8 @@ ostream& operator<<(ostream& out, const osd_info_t& info);
 class OSDMap {
 
 public:
+  MEMPOOL_CLASS_HELPERS(mempool::osdmap)
+
   class Incremental {
   public:
     ceph_fsid_t fsid;
@@ -163,12 +168,39 @@ private:
   int num_osd;         // not saved
   int32_t max_osd;
   vector<uint8_t> osd_state;
-  vector<entity_addr_t> osd_addr;
-  vector<entity_addr_t> osd_cluster_addr;
-  vector<entity_addr_t> osd_hb_addr;
+
+  /*
+   * The address vectors, pg_temp and crush are the big, slowly changing
+   * parts of the map.  Copies of a map (e.g. the next epoch, built with
+   * apply_incremental) share them until one side needs to change them;
+   * see the _mutable_*() helpers.
+   */
+  struct addrs_s {
+    vector<entity_addr_t> client_addr;
+    vector<entity_addr_t> cluster_addr;
+    vector<entity_addr_t> hb_addr;
+
+    /*
+     * Only OSDs look at cluster_addr and hb_addr, so a compact (v7)
+     * map leaves them encoded in osd_bl until something asks for them.
+     */
+    bufferlist osd_bl;
+    atomic_t osd_bl_pending;
+    Mutex osd_bl_lock;
+
+    addrs_s() : osd_bl_lock("OSDMap::addrs_s::osd_bl_lock") {}
+    addrs_s(const addrs_s& o);
+    void decode_osd_addrs();
+    void need_osd_addrs() {
+      if (osd_bl_pending.read())
+	decode_osd_addrs();
+    }
+  };
+  std::tr1::shared_ptr<addrs_s> osd_addrs;
+
   vector<__u32>   osd_weight;   // 16.16 fixed point, 0x10000 = "in", 0 = "out"
   vector<osd_info_t> osd_info;
-  map<pg_t,vector<int> > pg_temp;  // temp pg mapping (e.g. while we rebuild)
+  std::tr1::shared_ptr< map<pg_t,vector<int> > > pg_temp;  // temp pg mapping (e.g. while we rebuild)
 
   map<int64_t,pg_pool_t> pools;
   map<int64_t,string> pool_name;
@@ -179,8 +211,44 @@ private:
   epoch_t cluster_snapshot_epoch;
   string cluster_snapshot;
 
+  /*
+   * CRUSH results, filled in lazily, keyed by everything do_rule is
+   * given but the weights.  Like the parts above it is shared by copies
+   * of the map; anything that could change an answer (new weights, a
+   * new epoch, a decode) gives the map a fresh one instead.  Entries
+   * are only trusted for the crush map they were computed from.
+   */
+  struct mapping_key_t {
+    ps_t pps;
+    int ruleno, size, preferred;
+    mapping_key_t(ps_t p, int r, int s, int pr) : pps(p), ruleno(r), size(s), preferred(pr) {}
+    bool operator<(const mapping_key_t& o) const {
+      if (pps != o.pps)
+	return pps < o.pps;
+      if (ruleno != o.ruleno)
+	return ruleno < o.ruleno;
+      if (size != o.size)
+	return size < o.size;
+      return preferred < o.preferred;
+    }
+  };
+  struct mapping_cache_s {
+    Mutex lock;
+    const CrushWrapper *crush;
+    map<mapping_key_t, vector<int> > raw;
+    mapping_cache_s() : lock("OSDMap::mapping_cache_s::lock"), crush(NULL) {}
+  };
+  std::tr1::shared_ptr<mapping_cache_s> mapping_cache;
+
+  void _invalidate_mapping_cache() {
+    mapping_cache.reset(new mapping_cache_s);
+  }
+  bool _get_cached_mapping(const mapping_key_t& k, vector<int>& osds);
+  void _cache_mapping(const mapping_key_t& k, const vector<int>& osds);
+  void _carry_mapping_cache(mapping_cache_s& from, const set<int>& lowered);
+
  public:
-  CrushWrapper     crush;       // hierarchical map
+  std::tr1::shared_ptr<CrushWrapper> crush;       // hierarchical map
 
   friend class OSDMonitor;
   friend class PGMonitor;
@@ -190,10 +258,34 @@ private:
   OSDMap() : epoch(0), 
 	     pool_max(-1),
 	     flags(0),
-	     num_osd(0), max_osd(0) { 
+	     num_osd(0), max_osd(0),
+	     osd_addrs(new addrs_s),
+	     pg_temp(new map<pg_t,vector<int> >),
+	     mapping_cache(new mapping_cache_s),
+	     crush(new CrushWrapper) { 
     memset(&fsid, 0, sizeof(fsid));
   }
 
+private:
+  // client_addr is always decoded; use this for the other two
+  const addrs_s& _osd_addrs() const {
+    osd_addrs->need_osd_addrs();
+    return *osd_addrs;
+  }
+  addrs_s& _mutable_addrs() {
+    osd_addrs->need_osd_addrs();
+    if (!osd_addrs.unique())
+      osd_addrs.reset(new addrs_s(*osd_addrs));
+    return *osd_addrs;
+  }
+  map<pg_t,vector<int> >& _mutable_pg_temp() {
+    if (!pg_temp.unique())
+      pg_temp.reset(new map<pg_t,vector<int> >(*pg_temp));
+    return *pg_temp;
+  }
+
+public:
+
   // map info
   const ceph_fsid_t& get_fsid() const { return fsid; }
   void set_fsid(ceph_fsid_t& f) { fsid = f; }
@@ -269,6 +361,8 @@ private:
   }
   void set_weight(int o, unsigned w) {
     assert(o < max_osd);
+    if (osd_weight[o] != w)
+      _invalidate_mapping_cache();
     osd_weight[o] = w;
     if (w)
       osd_state[o] |= CEPH_OSD_EXISTS;
@@ -304,8 +398,9 @@ private:
   }
   
   int identify_osd(const entity_addr_t& addr) const {
-    for (unsigned i=0; i<osd_addr.size(); i++)
-      if ((osd_addr[i] == addr) || (osd_cluster_addr[i] == addr))
+    const addrs_s& a = _osd_addrs();
+    for (unsigned i=0; i<a.client_addr.size(); i++)
+      if ((a.client_addr[i] == addr) || (a.cluster_addr[i] == addr))
 	return i;
     return -1;
   }
@@ -313,8 +408,9 @@ private:
     return identify_osd(addr) >= 0;
   }
   bool find_osd_on_ip(const entity_addr_t& ip) const {
-    for (unsigned i=0; i<osd_addr.size(); i++)
-      if (osd_addr[i].is_same_host(ip) || osd_cluster_addr[i].is_same_host(ip))
+    const addrs_s& a = _osd_addrs();
+    for (unsigned i=0; i<a.client_addr.size(); i++)
+      if (a.client_addr[i].is_same_host(ip) || a.cluster_addr[i].is_same_host(ip))
 	return i;
     return -1;
   }
@@ -323,34 +419,34 @@ private:
   }
   const entity_addr_t &get_addr(int osd) const {
     assert(exists(osd));
-    return osd_addr[osd];
+    return osd_addrs->client_addr[osd];
   }
   const entity_addr_t &get_cluster_addr(int osd) const {
     assert(exists(osd));
-    if (osd_cluster_addr[osd] == entity_addr_t())
+    if (_osd_addrs().cluster_addr[osd] == entity_addr_t())
       return get_addr(osd);
-    return osd_cluster_addr[osd];
+    return osd_addrs->cluster_addr[osd];
   }
   const entity_addr_t &get_hb_addr(int osd) const {
     assert(exists(osd));
-    return osd_hb_addr[osd];
+    return _osd_addrs().hb_addr[osd];
   }
   entity_inst_t get_inst(int osd) {
     assert(exists(osd));
     assert(is_up(osd));
-    return entity_inst_t(entity_name_t::OSD(osd), osd_addr[osd]);
+    return entity_inst_t(entity_name_t::OSD(osd), osd_addrs->client_addr[osd]);
   }
   entity_inst_t get_cluster_inst(int osd) {
     assert(exists(osd));
     assert(is_up(osd));
-    if (osd_cluster_addr[osd] == entity_addr_t())
+    if (_osd_addrs().cluster_addr[osd] == entity_addr_t())
       return get_inst(osd);
-    return entity_inst_t(entity_name_t::OSD(osd), osd_cluster_addr[osd]);
+    return entity_inst_t(entity_name_t::OSD(osd), osd_addrs->cluster_addr[osd]);
   }
   entity_inst_t get_hb_inst(int osd) {
     assert(exists(osd));
     assert(is_up(osd));
-    return entity_inst_t(entity_name_t::OSD(osd), osd_hb_addr[osd]);
+    return entity_inst_t(entity_name_t::OSD(osd), _osd_addrs().hb_addr[osd]);
   }
 
   const epoch_t& get_up_from(int osd) const {
@@ -382,6 +478,9 @@ private:
   // serialize, unserialize
 private:
   void encode_client_old(bufferlist& bl) const;
+  void encode_compact(bufferlist& bl, uint64_t features) const;
+  void decode_compact(bufferlist::iterator& p);
+  void post_decode();
 public:
   void encode(bufferlist& bl, uint64_t features=-1) const;
   void decode(bufferlist& bl);
@@ -448,13 +547,18 @@ private:
     unsigned size = pool.get_size();
     {
       int preferred = pg.preferred();
-      if (preferred >= max_osd || preferred >= crush.get_max_devices())
+      if (preferred >= max_osd || preferred >= crush->get_max_devices())
 	preferred = -1;
 
       // what crush rule?
-      int ruleno = crush.find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
-      if (ruleno >= 0)
-	crush.do_rule(ruleno, pps, osds, size, preferred, osd_weight);
+      int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
+      if (ruleno >= 0) {
+	mapping_key_t k(pps, ruleno, size, preferred);
+	if (!_get_cached_mapping(k, osds)) {
+	  crush->do_rule(ruleno, pps, osds, size, preferred, osd_weight);
+	  _cache_mapping(k, osds);
+	}
+      }
     }
   
     return osds.size();
@@ -472,8 +576,8 @@ private:
   
   bool _raw_to_temp_osds(const pg_pool_t& pool, pg_t pg, vector<int>& raw, vector<int>& temp) {
     pg = pool.raw_pg_to_pg(pg);
-    map<pg_t,vector<int> >::iterator p = pg_temp.find(pg);
-    if (p != pg_temp.end()) {
+    map<pg_t,vector<int> >::const_iterator p = pg_temp->find(pg);
+    if (p != pg_temp->end()) {
       temp.clear();
       for (unsigned i=0; i<p->second.size(); i++) {
 	if (!exists(p->second[i]) || is_down(p->second[i]))
@@ -524,6 +628,10 @@ public:
       acting = up;
   }
 
+  /// pg_to_acting_osds for many pgs at once, crushing each pool's pgs in
+  /// one batch and bypassing the mapping cache
+  void pgs_to_acting_osds(const vector<pg_t>& pgs, vector<vector<int> >& acting);
+
   int64_t lookup_pg_pool_name(const char *name) {
     if (name_pool.count(name))
       return name_pool[name];
@@ -0,0 +1,143 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <algorithm>
+#include <sstream>
+
+#include "OpHistory.h"
+#include "messages/MOSDOp.h"
+#include "common/config.h"
+#include "common/Clock.h"
+#include "common/Formatter.h"
+
+static bool slower(const OpHistory::Entry& a, const OpHistory::Entry& b)
+{
+  return a.latency > b.latency;
+}
+
+void OpHistory::_trim(utime_t now)
+{
+  utime_t cutoff = now;
+  cutoff -= g_conf->osd_op_history_duration;
+  for (unsigned i = 0; i < ops.size(); ) {
+    if (ops[i].received < cutoff) {
+      ops[i] = ops.back();
+      ops.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+void OpHistory::add(MOSDOp *op, utime_t now)
+{
+  unsigned max = g_conf->osd_op_history_size;
+  if (!max)
+    return;
+
+  double latency = now - op->get_recv_stamp();
+  Mutex::Locker l(lock);
+  _trim(now);
+
+  // replace the fastest op we have if this one is slower
+  unsigned slot = ops.size();
+  if (slot >= max) {
+    slot = 0;
+    for (unsigned i = 1; i < ops.size(); i++)
+      if (ops[i].latency < ops[slot].latency)
+	slot = i;
+    if (ops[slot].latency >= latency)
+      return;
+  } else {
+    ops.resize(slot + 1);
+  }
+
+  Entry &e = ops[slot];
+  std::ostringstream ss;
+  ss << *op;
+  e.desc = ss.str();
+  e.received = op->get_recv_stamp();
+  e.latency = latency;
+  for (int s = 0; s < OSD_OP_STAGE_MAX; s++)
+    e.stage[s] = op->stage_stamp[s];
+}
+
+void OpHistory::dump(ceph::Formatter *f)
+{
+  ceph::Formatter &jf = *f;
+  Mutex::Locker l(lock);
+  _trim(ceph_clock_now(g_ceph_context));
+  std::sort(ops.begin(), ops.end(), slower);
+  jf.open_object_section("op_history");
+  jf.dump_unsigned("size", g_conf->osd_op_history_size);
+  jf.dump_unsigned("duration", g_conf->osd_op_history_duration);
+  jf.open_array_section("ops");
+  for (std::vector<Entry>::iterator p = ops.begin(); p != ops.end(); ++p) {
+    jf.open_object_section("op");
+    jf.dump_string("description", p->desc);
+    jf.dump_stream("received_at") << p->received;
+    jf.dump_float("duration", p->latency);
+    // each stage as seconds after the op was received
+    jf.open_object_section("stages");
+    for (int s = 0; s < OSD_OP_STAGE_MAX; s++)
+      if (p->stage[s] != utime_t())
+	jf.dump_float(osd_op_stage_name(s), p->stage[s] - p->received);
+    jf.close_section();
+    jf.close_section();
+  }
+  jf.close_section();
+  jf.close_section();
+}
+
+void OpHistory::dump_in_flight(ceph::Formatter *f)
+{
+  utime_t now = ceph_clock_now(g_ceph_context);
+  Mutex::Locker l(in_flight.lock);
+  f->open_object_section("ops_in_flight");
+  f->dump_int("num_ops", in_flight.ops.size());
+  f->open_array_section("ops");
+  for (xlist<MOSDOp*>::iterator p = in_flight.ops.begin(); !p.end(); ++p) {
+    MOSDOp *op = *p;
+    f->open_object_section("op");
+    f->dump_stream("description") << *op;
+    f->dump_stream("received_at") << op->get_recv_stamp();
+    f->dump_float("age", now - op->get_recv_stamp());
+    f->open_object_section("stages");
+    for (int s = 0; s < OSD_OP_STAGE_MAX; s++)
+      if (op->reached_stage(s))
+	f->dump_float(osd_op_stage_name(s), op->stage_stamp[s] - op->get_recv_stamp());
+    f->close_section();
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+}
+
+void OpHistory::call(std::vector<char> &out)
+{
+  JSONFormatter jf(true);
+  dump(&jf);
+  std::ostringstream ss;
+  jf.flush(ss);
+  std::string s = ss.str();
+  out.assign(s.begin(), s.end());
+}
+
+void OpHistory::dump_command(const std::string &command, ceph::Formatter *f)
+{
+  if (command == "dump_ops_in_flight")
+    dump_in_flight(f);
+  else
+    dump(f);
+}
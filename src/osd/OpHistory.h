@@ -0,0 +1,66 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_OPHISTORY_H
+#define CEPH_OSD_OPHISTORY_H
+
+#include <string>
+#include <vector>
+
+#include "include/utime.h"
+#include "common/Mutex.h"
+#include "common/admin_socket.h"
+#include "messages/MOSDOp.h"
+#include "osd_types.h"
+
+/* admin socket request code for the dump */
+#define OSD_ADMIN_SOCK_HISTORIC_OPS CEPH_ADMIN_SOCK_FIRST_HOOK
+
+/*
+ * The slowest client ops completed in the last osd_op_history_duration
+ * seconds, at most osd_op_history_size of them, with the time each
+ * reached every stage.  Dumped as JSON over the admin socket, as are
+ * the ops still in flight.
+ */
+class OpHistory : public AdminSocketHook, public AdminSocketCommand {
+public:
+  struct Entry {
+    std::string desc;
+    utime_t received;
+    double latency;
+    utime_t stage[OSD_OP_STAGE_MAX];
+  };
+
+private:
+  Mutex lock;
+  std::vector<Entry> ops;
+
+  void _trim(utime_t now);
+
+public:
+  /// ops received and not yet destroyed
+  MOSDOpsInFlight in_flight;
+
+  OpHistory() : lock("OpHistory::lock") {}
+
+  /// note a finished op
+  void add(MOSDOp *op, utime_t now);
+  void dump(ceph::Formatter *f);
+  void dump_in_flight(ceph::Formatter *f);
+
+  void call(std::vector<char> &out);
+  void dump_command(const std::string &command, ceph::Formatter *f);
+};
+
+#endif
@@ -0,0 +1,134 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "OpLimiter.h"
+#include "osd_types.h"
+#include "common/config.h"
+#include "common/debug.h"
+
+void OpLimiter::Bucket::refill(utime_t now, uint64_t op_rate, uint64_t byte_rate)
+{
+  double dt = last == utime_t() ? 1.0 : (double)(now - last);
+  last = now;
+  if (op_rate) {
+    ops += dt * op_rate;
+    if (ops > op_rate)
+      ops = op_rate;
+  }
+  if (byte_rate) {
+    bytes += dt * byte_rate;
+    if (bytes > byte_rate)
+      bytes = byte_rate;
+  }
+}
+
+double OpLimiter::Bucket::wait(uint64_t op_rate, uint64_t byte_rate) const
+{
+  double w = 0;
+  if (op_rate && ops < 0)
+    w = -ops / op_rate;
+  if (byte_rate && bytes < 0 && -bytes / byte_rate > w)
+    w = -bytes / byte_rate;
+  return w;
+}
+
+bool OpLimiter::Bucket::full(uint64_t op_rate, uint64_t byte_rate) const
+{
+  return (!op_rate || ops >= op_rate) && (!byte_rate || bytes >= byte_rate);
+}
+
+void OpLimiter::Bucket::charge(uint64_t op_rate, uint64_t byte_rate, uint64_t b)
+{
+  if (op_rate)
+    ops -= 1;
+  if (byte_rate)
+    bytes -= b;
+}
+
+double OpLimiter::admit(int64_t poolid, const pg_pool_t *pool, const entity_name_t& client,
+			uint64_t bytes, utime_t now, unsigned *hold)
+{
+  *hold = 0;
+
+  uint64_t pool_ops = pool ? pool->get_op_rate_limit() : 0;
+  uint64_t pool_bytes = pool ? pool->get_byte_rate_limit() : 0;
+  uint64_t client_ops = g_conf->osd_client_op_rate_limit;
+  uint64_t client_bytes = g_conf->osd_client_byte_rate_limit;
+  if (!client.is_client())
+    client_ops = client_bytes = 0;   // only throttle clients
+
+  Bucket *pb = NULL, *cb = NULL;
+  double w = 0;
+  if (pool_ops || pool_bytes) {
+    pb = &pools[poolid];
+    pb->refill(now, pool_ops, pool_bytes);
+    w = pb->wait(pool_ops, pool_bytes);
+    if (w > 0 || held_pools.count(poolid))
+      *hold |= HOLD_POOL;
+  } else {
+    pools.erase(poolid);
+  }
+  if (client_ops || client_bytes) {
+    cb = &clients[client];
+    cb->refill(now, client_ops, client_bytes);
+    double cw = cb->wait(client_ops, client_bytes);
+    if (cw > 0 || held_clients.count(client))
+      *hold |= HOLD_CLIENT;
+    if (cw > w)
+      w = cw;
+  }
+  if (*hold) {
+    if (*hold & HOLD_POOL)
+      held_pools[poolid]++;
+    if (*hold & HOLD_CLIENT)
+      held_clients[client]++;
+    return w;
+  }
+
+  if (pb)
+    pb->charge(pool_ops, pool_bytes, bytes);
+  if (cb)
+    cb->charge(client_ops, client_bytes, bytes);
+  return 0;
+}
+
+void OpLimiter::release(int64_t poolid, const entity_name_t& client, unsigned hold)
+{
+  if (hold & HOLD_POOL) {
+    std::map<int64_t, unsigned>::iterator p = held_pools.find(poolid);
+    assert(p != held_pools.end());
+    if (--p->second == 0)
+      held_pools.erase(p);
+  }
+  if (hold & HOLD_CLIENT) {
+    std::map<entity_name_t, unsigned>::iterator p = held_clients.find(client);
+    assert(p != held_clients.end());
+    if (--p->second == 0)
+      held_clients.erase(p);
+  }
+}
+
+void OpLimiter::trim(utime_t now)
+{
+  uint64_t client_ops = g_conf->osd_client_op_rate_limit;
+  uint64_t client_bytes = g_conf->osd_client_byte_rate_limit;
+  std::map<entity_name_t, Bucket>::iterator p = clients.begin();
+  while (p != clients.end()) {
+    p->second.refill(now, client_ops, client_bytes);
+    if (p->second.full(client_ops, client_bytes))
+      clients.erase(p++);
+    else
+      ++p;
+  }
+}
@@ -0,0 +1,87 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_OPLIMITER_H
+#define CEPH_OSD_OPLIMITER_H
+
+#include <map>
+
+#include "include/utime.h"
+#include "msg/msg_types.h"
+
+struct pg_pool_t;
+
+/*
+ * Token buckets limiting the client op and byte rate admitted by this
+ * osd, per pool (pg_pool_t::op_rate_limit, byte_rate_limit) and per
+ * client entity (osd_client_op_rate_limit, osd_client_byte_rate_limit).
+ *
+ * A bucket holds at most a second's worth of tokens.  An op is admitted
+ * while every bucket it draws from is not in debt, and then charged in
+ * full, so a burst may leave a bucket in debt; later ops wait until it
+ * has been paid off.  Buckets are kept only while they are limiting
+ * something.
+ *
+ * Ops held back are served first come, first served per bucket: while
+ * any op is held on a bucket, a new op drawing from it is held too,
+ * even if the debt has been paid off in the meantime.  The caller holds
+ * and releases ops with the mask admit() hands back.
+ *
+ * Not locked; the OSD calls it under osd_lock.
+ */
+class OpLimiter {
+  struct Bucket {
+    double ops, bytes;   // tokens; < 0 is debt
+    utime_t last;
+    Bucket() : ops(0), bytes(0) {}
+    void refill(utime_t now, uint64_t op_rate, uint64_t byte_rate);
+    double wait(uint64_t op_rate, uint64_t byte_rate) const;
+    bool full(uint64_t op_rate, uint64_t byte_rate) const;
+    void charge(uint64_t op_rate, uint64_t byte_rate, uint64_t b);
+  };
+
+  std::map<int64_t, Bucket> pools;
+  std::map<entity_name_t, Bucket> clients;
+
+  // ops held back on each bucket
+  std::map<int64_t, unsigned> held_pools;
+  std::map<entity_name_t, unsigned> held_clients;
+
+public:
+  enum {
+    HOLD_POOL = 1,
+    HOLD_CLIENT = 2,
+  };
+
+  /**
+   * May an op of this many bytes from client go ahead now?
+   *
+   * If not, *hold is set to the buckets the op must be held on, and
+   * they count it as held until release().
+   *
+   * @return 0 if so (and it has been charged, *hold is 0), or the
+   * number of seconds to wait before asking again.  That is 0 if the op
+   * is only queued behind other held ops, which will be retried first.
+   */
+  double admit(int64_t poolid, const pg_pool_t *pool, const entity_name_t& client,
+	       uint64_t bytes, utime_t now, unsigned *hold);
+
+  /// a held op is being retried (or dropped)
+  void release(int64_t poolid, const entity_name_t& client, unsigned hold);
+
+  /// forget buckets that have been idle long enough to be full again
+  void trim(utime_t now);
+};
+
+#endif
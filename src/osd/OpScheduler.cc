@@ -0,0 +1,175 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "OpScheduler.h"
+#include "common/config.h"
+#include "common/debug.h"
+#include "common/Clock.h"
+
+#define DOUT_SUBSYS osd
+#undef dout_prefix
+#define dout_prefix *_dout << "osd_sched "
+
+OpScheduler::OpScheduler()
+  : lock("OpScheduler::lock"), client_lat(0), budget(-1)
+{
+  last_tick = last_refill = ceph_clock_now(g_ceph_context);
+  _update_rates();
+}
+
+const char *OpScheduler::get_class_name(int c)
+{
+  switch (c) {
+  case CLIENT: return "client";
+  case RECOVERY: return "recovery";
+  case SCRUB: return "scrub";
+  case SNAPTRIM: return "snaptrim";
+  default: return "???";
+  }
+}
+
+void OpScheduler::_get_params(int c, double *res, double *lim, double *wgt)
+{
+  switch (c) {
+  case RECOVERY:
+    *res = g_conf->osd_sched_recovery_res;
+    *lim = g_conf->osd_sched_recovery_lim;
+    *wgt = g_conf->osd_sched_recovery_wgt;
+    break;
+  case SCRUB:
+    *res = g_conf->osd_sched_scrub_res;
+    *lim = g_conf->osd_sched_scrub_lim;
+    *wgt = g_conf->osd_sched_scrub_wgt;
+    break;
+  case SNAPTRIM:
+    *res = g_conf->osd_sched_snaptrim_res;
+    *lim = g_conf->osd_sched_snaptrim_lim;
+    *wgt = g_conf->osd_sched_snaptrim_wgt;
+    break;
+  default:
+    *res = *lim = *wgt = 0;
+  }
+}
+
+void OpScheduler::_update_rates()
+{
+  double total_res = 0, total_wgt = 0;
+  for (int c = RECOVERY; c < NUM_CLASSES; c++) {
+    double res, lim, wgt;
+    _get_params(c, &res, &lim, &wgt);
+    total_res += res;
+    total_wgt += wgt;
+  }
+  for (int c = RECOVERY; c < NUM_CLASSES; c++) {
+    double res, lim, wgt;
+    _get_params(c, &res, &lim, &wgt);
+    double rate = -1;
+    if (budget >= 0) {
+      rate = res;
+      if (budget > total_res && total_wgt > 0)
+	rate += (budget - total_res) * wgt / total_wgt;
+    }
+    if (lim > 0 && (rate < 0 || rate > lim))
+      rate = lim;
+    classes[c].rate = rate;
+  }
+}
+
+void OpScheduler::_tick(utime_t now)
+{
+  double dt = now - last_tick;
+  if (dt < 1.0)
+    return;
+  last_tick = now;
+
+  double demand = 0;
+  for (int c = RECOVERY; c < NUM_CLASSES; c++)
+    demand += classes[c].cost;
+  demand /= dt;
+
+  if (classes[CLIENT].ops == 0)
+    client_lat /= 2;   // idle clients can't be suffering
+
+  double target = g_conf->osd_sched_client_lat_target;
+  if (target > 0 && client_lat > target) {
+    double total_res = 0;
+    for (int c = RECOVERY; c < NUM_CLASSES; c++) {
+      double res, lim, wgt;
+      _get_params(c, &res, &lim, &wgt);
+      total_res += res;
+    }
+    budget = MAX(total_res, (budget >= 0 ? budget : demand) / 2);
+  } else if (budget >= 0) {
+    budget *= 1.25;
+    if (budget > 2 * demand)
+      budget = -1;
+  }
+
+  dout(10) << "tick client lat " << client_lat << " (" << classes[CLIENT].ops << " ops)"
+	   << " background demand " << demand << "/s budget " << budget << dendl;
+
+  for (int c = 0; c < NUM_CLASSES; c++)
+    classes[c].cost = classes[c].ops = 0;
+  _update_rates();
+}
+
+void OpScheduler::_refill(utime_t now)
+{
+  double dt = now - last_refill;
+  last_refill = now;
+  for (int c = RECOVERY; c < NUM_CLASSES; c++) {
+    Class &k = classes[c];
+    if (k.rate < 0) {
+      k.tokens = 0;    // no debt carries over from unlimited periods
+      continue;
+    }
+    k.tokens += k.rate * dt;
+    if (k.tokens > k.rate)
+      k.tokens = k.rate;   // at most a second's worth of burst
+  }
+}
+
+void OpScheduler::charge(int c, uint64_t bytes, unsigned ops)
+{
+  assert(c >= 0 && c < NUM_CLASSES);
+  uint64_t cost = bytes + ops * g_conf->osd_sched_op_cost;
+  Mutex::Locker l(lock);
+  Class &k = classes[c];
+  k.cost += cost;
+  k.ops += ops;
+  if (k.rate >= 0)
+    k.tokens -= cost;
+}
+
+void OpScheduler::client_op(uint64_t bytes, utime_t latency)
+{
+  charge(CLIENT, bytes);
+  Mutex::Locker l(lock);
+  client_lat = client_lat * .9 + (double)latency * .1;
+}
+
+bool OpScheduler::may_start(int c)
+{
+  assert(c > CLIENT && c < NUM_CLASSES);
+  utime_t now = ceph_clock_now(g_ceph_context);
+  Mutex::Locker l(lock);
+  _tick(now);
+  _refill(now);
+  Class &k = classes[c];
+  if (k.rate < 0 || k.tokens > 0)
+    return true;
+  dout(15) << "may_start " << get_class_name(c) << " throttled, rate " << k.rate
+	   << " tokens " << k.tokens << dendl;
+  return false;
+}
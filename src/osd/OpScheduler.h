@@ -0,0 +1,80 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_OPSCHEDULER_H
+#define CEPH_OSD_OPSCHEDULER_H
+
+#include "include/utime.h"
+#include "common/Mutex.h"
+
+/*
+ * Paces background work (recovery, scrub, snap trim) against client
+ * ops.  Work is measured in cost units: bytes moved plus
+ * osd_sched_op_cost per op.
+ *
+ * Each background class has a reservation (cost/sec it may always
+ * use), a limit (cost/sec it may never exceed, 0 for none) and a
+ * weight.  Normally only the limits apply.  When the client op latency
+ * average rises above osd_sched_client_lat_target, the total background
+ * budget is cut in half each interval (never below the sum of the
+ * reservations) and shared out by weight; once client latency recovers
+ * it grows back until it no longer constrains anything.
+ *
+ * Client ops are never delayed here; they only report their cost and
+ * latency.
+ */
+class OpScheduler {
+public:
+  enum {
+    CLIENT,
+    RECOVERY,
+    SCRUB,
+    SNAPTRIM,
+    NUM_CLASSES
+  };
+
+private:
+  struct Class {
+    double rate;       // cost/sec currently allowed, < 0 for unlimited
+    double tokens;
+    uint64_t cost;     // charged since the last tick
+    uint64_t ops;
+    Class() : rate(-1), tokens(0), cost(0), ops(0) {}
+  };
+
+  Mutex lock;
+  Class classes[NUM_CLASSES];
+  utime_t last_tick, last_refill;
+  double client_lat;   // ewma, seconds
+  double budget;       // total background cost/sec, < 0 for unlimited
+
+  void _get_params(int c, double *res, double *lim, double *wgt);
+  void _tick(utime_t now);
+  void _refill(utime_t now);
+  void _update_rates();
+
+public:
+  OpScheduler();
+
+  static const char *get_class_name(int c);
+
+  /// account for completed or started work
+  void charge(int c, uint64_t bytes, unsigned ops = 1);
+  /// account for a completed client op
+  void client_op(uint64_t bytes, utime_t latency);
+  /// may background class c start more work now?
+  bool may_start(int c);
+};
+
+#endif
@@ -51,7 +51,7 @@ void PG::Log::copy_after(const Log &other, eversion_t v)
 {
   head = other.head;
   tail = other.tail;
-  for (list<Entry>::const_reverse_iterator i = other.log.rbegin();
+  for (Log::entry_list::const_reverse_iterator i = other.log.rbegin();
        i != other.log.rend();
        i++) {
     // stop if we reach the tail; do not copy backlog entries and keep
@@ -90,7 +90,7 @@ A     B     C
       -> i return full backlog.
   */
 
-  for (list<Entry>::const_reverse_iterator i = other.log.rbegin();
+  for (Log::entry_list::const_reverse_iterator i = other.log.rbegin();
        i != other.log.rend();
        i++) {
     // is primary divergent? 
@@ -114,7 +114,7 @@ void PG::Log::copy_non_backlog(const Log &other)
   if (other.backlog) {
     head = other.head;
     tail = other.tail;
-    for (list<Entry>::const_reverse_iterator i = other.log.rbegin();
+    for (Log::entry_list::const_reverse_iterator i = other.log.rbegin();
          i != other.log.rend();
          i++) 
       if (i->version > tail)
@@ -219,13 +219,13 @@ void PG::proc_replica_log(ObjectStore::Transaction& t, Info &oinfo, Log &olog, M
     we will send the peer enough log to arrive at the same state.
   */
 
-  for (map<hobject_t, Missing::item>::iterator i = omissing.missing.begin();
+  for (Missing::item_map::iterator i = omissing.missing.begin();
        i != omissing.missing.end();
        ++i) {
     dout(20) << " before missing " << i->first << " need " << i->second.need << " have " << i->second.have << dendl;
   }
 
-  list<Log::Entry>::const_reverse_iterator pp = olog.log.rbegin();
+  Log::entry_list::const_reverse_iterator pp = olog.log.rbegin();
   eversion_t lu(oinfo.last_update);
   while (true) {
     if (pp == olog.log.rend()) {
@@ -291,7 +291,7 @@ void PG::proc_replica_log(ObjectStore::Transaction& t, Info &oinfo, Log &olog, M
   might_have_unfound.insert(from);
 
   search_for_missing(oinfo, &omissing, from);
-  for (map<hobject_t, Missing::item>::iterator i = omissing.missing.begin();
+  for (Missing::item_map::iterator i = omissing.missing.begin();
        i != omissing.missing.end();
        ++i) {
     dout(20) << " after missing " << i->first << " need " << i->second.need << " have " << i->second.have << dendl;
@@ -399,7 +399,7 @@ void PG::merge_log(ObjectStore::Transaction& t,
   // If the logs don't overlap, we need both backlogs
   assert(log.head >= olog.tail || ((log.backlog || log.null()) && olog.backlog));
 
-  for (map<hobject_t, Missing::item>::iterator i = missing.missing.begin();
+  for (Missing::item_map::iterator i = missing.missing.begin();
        i != missing.missing.end();
        ++i) {
     dout(20) << "Missing sobject: " << i->first << dendl;
@@ -417,7 +417,7 @@ void PG::merge_log(ObjectStore::Transaction& t,
     log.index();
 
     // first, find split point (old log.head) in new log.
-    list<Log::Entry>::iterator p = log.log.end();
+    Log::entry_list::iterator p = log.log.end();
     while (p != log.log.begin()) {
       p--;
       if (p->version <= log.head) {
@@ -478,8 +478,8 @@ void PG::merge_log(ObjectStore::Transaction& t,
       dout(10) << "merge_log extending tail to " << olog.tail
                << (olog.backlog ? " +backlog":"")
 	       << dendl;
-      list<Log::Entry>::iterator from = olog.log.begin();
-      list<Log::Entry>::iterator to;
+      Log::entry_list::iterator from = olog.log.begin();
+      Log::entry_list::iterator to;
       for (to = from;
            to != olog.log.end();
            to++) {
@@ -505,8 +505,8 @@ void PG::merge_log(ObjectStore::Transaction& t,
       dout(10) << "merge_log extending head to " << olog.head << dendl;
       
       // find start point in olog
-      list<Log::Entry>::iterator to = olog.log.end();
-      list<Log::Entry>::iterator from = olog.log.end();
+      Log::entry_list::iterator to = olog.log.end();
+      Log::entry_list::iterator from = olog.log.end();
       eversion_t lower_bound = olog.tail;
       while (1) {
         if (from == olog.log.begin())
@@ -522,7 +522,7 @@ void PG::merge_log(ObjectStore::Transaction& t,
       }
 
       // index, update missing, delete deleted
-      for (list<Log::Entry>::iterator p = from; p != to; p++) {
+      for (Log::entry_list::iterator p = from; p != to; p++) {
 	Log::Entry &ne = *p;
         dout(20) << "merge_log " << ne << dendl;
 	log.index(ne);
@@ -532,7 +532,7 @@ void PG::merge_log(ObjectStore::Transaction& t,
       }
       
       // move aside divergent items
-      list<Log::Entry> divergent;
+      Log::entry_list divergent;
       while (!log.empty()) {
 	Log::Entry &oe = *log.log.rbegin();
 	/*
@@ -563,7 +563,7 @@ void PG::merge_log(ObjectStore::Transaction& t,
 
       // process divergent items
       if (!divergent.empty()) {
-	for (list<Log::Entry>::iterator d = divergent.begin(); d != divergent.end(); d++)
+	for (Log::entry_list::iterator d = divergent.begin(); d != divergent.end(); d++)
 	  merge_old_entry(t, *d);
       }
 
@@ -579,6 +579,40 @@ void PG::merge_log(ObjectStore::Transaction& t,
   }
 }
 
+/*
+ * the primary can't bring us up to date from its log; throw away what
+ * we have and adopt its log.  it will push objects to us in
+ * backfill_key order, and we apply updates only to objects below
+ * info.last_backfill in the meantime.
+ */
+void PG::start_backfill(ObjectStore::Transaction& t, Info &oinfo, Log &olog)
+{
+  dout(10) << "start_backfill from " << olog << ", wiping local objects" << dendl;
+
+  vector<hobject_t> ls;
+  osd->store->collection_list(coll, ls);
+  for (vector<hobject_t>::iterator p = ls.begin(); p != ls.end(); ++p)
+    remove_object_with_snap_hardlinks(t, *p);
+
+  log.zero();
+  log.head = olog.head;
+  log.tail = olog.tail;
+  log.log.swap(olog.log);
+  log.index();
+  missing = Missing();
+
+  info.last_update = info.last_complete = oinfo.last_update;
+  info.log_tail = log.tail;
+  info.log_backlog = false;
+  info.last_backfill = 0;
+  info.stats = oinfo.stats;
+  info.purged_snaps = oinfo.purged_snaps;
+  info.history.merge(oinfo.history);
+
+  write_info(t);
+  write_log(t);
+}
+
 /*
  * Process information from a replica to determine if it could have any
  * objects that i need.
@@ -593,11 +627,16 @@ bool PG::search_for_missing(const Info &oinfo, const Missing *omissing,
   bool found_missing = false;
 
   // found items?
-  for (map<hobject_t,Missing::item>::iterator p = missing.missing.begin();
+  for (Missing::item_map::iterator p = missing.missing.begin();
        p != missing.missing.end();
        ++p) {
     const hobject_t &soid(p->first);
     eversion_t need = p->second.need;
+    if (oinfo.is_backfilling() && backfill_key(soid) >= oinfo.last_backfill) {
+      dout(10) << "search_for_missing " << soid << " " << need
+	       << " not yet backfilled on osd." << fromosd << dendl;
+      continue;
+    }
     if (oinfo.last_update < need) {
       dout(10) << "search_for_missing " << soid << " " << need
 	       << " also missing on osd." << fromosd
@@ -857,7 +896,7 @@ void PG::drop_backlog()
 ostream& PG::Log::print(ostream& out) const 
 {
   out << *this << std::endl;
-  for (list<Entry>::const_iterator p = log.begin();
+  for (Log::entry_list::const_iterator p = log.begin();
        p != log.end();
        p++) 
     out << *p << std::endl;
@@ -867,7 +906,7 @@ ostream& PG::Log::print(ostream& out) const
 ostream& PG::IndexedLog::print(ostream& out) const 
 {
   out << *this << std::endl;
-  for (list<Entry>::const_iterator p = log.begin();
+  for (Log::entry_list::const_iterator p = log.begin();
        p != log.end();
        p++) {
     out << *p << " " << (logged_object(p->soid) ? "indexed":"NOT INDEXED") << std::endl;
@@ -914,6 +953,11 @@ bool PG::is_all_uptodate() const
       dout(10) << __func__ << ": osd." << peer << " has " << pm->second.num_missing() << " missing" << dendl;
       uptodate = false;
     }
+    map<int, Info>::const_iterator pi = peer_info.find(peer);
+    if (pi != peer_info.end() && pi->second.is_backfilling()) {
+      dout(10) << __func__ << ": osd." << peer << " is backfilling" << dendl;
+      uptodate = false;
+    }
   }
 
   if (uptodate)
@@ -1121,6 +1165,7 @@ void PG::clear_primary_state()
   scrub_reserved_peers.clear();
   osd->recovery_wq.dequeue(this);
   osd->snap_trim_wq.dequeue(this);
+  osd->agent_wq.dequeue(this);
 }
 
 bool PG::choose_acting(int newest_update_osd) const
@@ -1133,14 +1178,19 @@ bool PG::choose_acting(int newest_update_osd) const
   const Info &best_info = all_info.find(newest_update_osd)->second;
   dout(10) << "choose_acting best_info is " << best_info
 	   << " from osd." << newest_update_osd << dendl;
+  vector<int> backfill;
   for (vector<int>::const_iterator i = up.begin();
        i != up.end();
        ++i) {
     const Info &cur_info = all_info.find(*i)->second;
-    if (best_info.log_tail <= cur_info.last_update || best_info.log_backlog) {
+    if (!cur_info.is_backfilling() &&
+	(best_info.log_tail <= cur_info.last_update || best_info.log_backlog)) {
       // Can be brought up to date without stopping to generate a backlog
       want.push_back(*i);
       dout(10) << " osd." << *i << " (up) accepted " << cur_info << dendl;
+    } else if (g_conf->osd_backfill) {
+      backfill.push_back(*i);
+      dout(10) << " osd." << *i << " (up) will need backfill " << cur_info << dendl;
     } else {
       dout(10) << " osd." << *i << " (up) REJECTED " << cur_info << dendl;
     }
@@ -1156,7 +1206,8 @@ bool PG::choose_acting(int newest_update_osd) const
     if (up_it != up.end())
       continue;
 
-    if (best_info.log_tail <= i->second.last_update || best_info.log_backlog) {
+    if (!i->second.is_backfilling() &&
+	(best_info.log_tail <= i->second.last_update || best_info.log_backlog)) {
       // Can be brought up to date without stopping to generate a backlog
       want.push_back(i->first);
       dout(10) << " osd." << i->first << " (stray) accepted " << i->second << dendl;
@@ -1165,6 +1216,16 @@ bool PG::choose_acting(int newest_update_osd) const
     }
   }
 
+  // backfill into whatever seats complete copies left open.  never
+  // make a backfill target primary.
+  for (vector<int>::const_iterator i = backfill.begin();
+       i != backfill.end() && !want.empty() &&
+	 want.size() < osd->osdmap->get_pg_size(info.pgid);
+       ++i) {
+    want.push_back(*i);
+    dout(10) << " osd." << *i << " (up) accepted for backfill" << dendl;
+  }
+
   if (want != acting) {
     dout(10) << "choose_acting  want " << want << " != acting " << acting
 	     << ", requesting pg_temp change" << dendl;
@@ -1200,6 +1261,10 @@ bool PG::choose_log_location(const PriorSet &prior_set,
       dout(10) << "osd." << i->first << " not in current prior set, skipping" << dendl;
       continue;
     }
+    if (i->second.is_backfilling()) {
+      dout(10) << "osd." << i->first << " is only partially backfilled, skipping" << dendl;
+      continue;
+    }
 
     // We always want the latest last update, but we prefer one that
     // has a backlog. If last update and backlog status are the same,
@@ -1219,6 +1284,11 @@ bool PG::choose_log_location(const PriorSet &prior_set,
     }
   }
 
+  if (!best_info) {
+    dout(10) << "choose_log_location no complete copy in the prior set" << dendl;
+    return false;
+  }
+
   dout(10) << "choose_log_location newest_update " << newest_update
 	   << " on osd." << pull_from << dendl;
 
@@ -1230,7 +1300,13 @@ bool PG::choose_log_location(const PriorSet &prior_set,
        it != acting.end();
        ++it) {
     const Info &pi = peer_info.find(*it)->second;
+    if (pi.is_backfilling())
+      continue;
     if (best_info->log_tail > pi.last_update) {
+      if (g_conf->osd_backfill) {
+	dout(10) << "osd." << *it << " will be backfilled" << dendl;
+	continue;
+      }
       wait_on_backlog = true;
       need_backlog = true;
     }
@@ -1366,6 +1442,14 @@ void PG::activate(ObjectStore::Transaction& t, list<Context*>& tfin,
     osd->replay_queue_lock.Unlock();
   }
 
+  // what may go in the transactions we send to replicas?  peering has
+  // connected us to every one of them by now.
+  acting_features = ~0u;
+  if (is_primary())
+    for (unsigned i = 1; i < acting.size(); i++)
+      acting_features &= osd->get_peer_features(acting[i]);
+  dout(10) << "activate acting features " << hex << acting_features << dec << dendl;
+
   // twiddle pg state
   state_set(PG_STATE_ACTIVE);
   state_clear(PG_STATE_STRAY);
@@ -1466,8 +1550,20 @@ void PG::activate(ObjectStore::Transaction& t, list<Context*>& tfin,
       dout(10) << "activate peer osd." << peer << " " << pi << dendl;
 
       bool need_old_log_entries = pi.log_tail > pi.last_complete && !pi.log_backlog;
+      bool backfill = needs_backfill(pi);
 
-      if (pi.last_update == info.last_update && !need_old_log_entries) {
+      if (backfill) {
+	// the peer wipes itself and adopts our log; recovery then pushes it
+	// everything, a chunk at a time.
+	dout(10) << "activate peer osd." << peer << " will be backfilled" << dendl;
+	m = new MOSDPGLog(osd->osdmap->get_epoch(), info);
+	m->info.last_backfill = 0;
+	m->log.copy_non_backlog(log);
+	peer_missing[peer] = Missing();
+	pi.last_backfill = 0;
+	pi.log_tail = log.tail;
+	pi.log_backlog = false;
+      } else if (pi.last_update == info.last_update && !need_old_log_entries) {
         // empty log
 	if (!pi.is_empty() && activator_map) {
 	  dout(10) << "activate peer osd." << peer << " is up to date, queueing in pending_activators" << dendl;
@@ -1506,9 +1602,9 @@ void PG::activate(ObjectStore::Transaction& t, list<Context*>& tfin,
       Missing& pm = peer_missing[peer];
 
       // update local version of peer's missing list!
-      if (m) {
+      if (m && !backfill) {
         eversion_t plu = pi.last_update;
-        for (list<Log::Entry>::iterator p = m->log.log.begin();
+        for (Log::entry_list::iterator p = m->log.log.begin();
              p != m->log.log.end();
              p++) 
           if (p->version > plu)
@@ -1890,10 +1986,12 @@ void PG::write_log(ObjectStore::Transaction& t)
 
   // assemble buffer
   bufferlist bl;
+  map<string,bufferlist> kv;
+  ondisklog.keyed = osd->store_has_omap && g_conf->osd_pg_log_keyed;
 
   // build buffer
   ondisklog.tail = 0;
-  for (list<Log::Entry>::iterator p = log.log.begin();
+  for (Log::entry_list::iterator p = log.log.begin();
        p != log.log.end();
        p++) {
     uint64_t startoff = bl.length();
@@ -1903,6 +2001,8 @@ void PG::write_log(ObjectStore::Transaction& t)
     __u32 crc = ebl.crc32c(0);
     ::encode(ebl, bl);
     ::encode(crc, bl);
+    if (ondisklog.keyed)
+      kv[OndiskLog::log_key(p->version)].substr_of(bl, startoff, bl.length() - startoff);
 
     p->offset = startoff;
   }
@@ -1910,15 +2010,29 @@ void PG::write_log(ObjectStore::Transaction& t)
   ondisklog.has_checksums = true;
 
   // write it
-  t.remove(coll_t::META_COLL, log_oid );
-  t.write(coll_t::META_COLL, log_oid , 0, bl.length(), bl);
+  if (ondisklog.keyed) {
+    // the map is shared with any other link to the log object; clear
+    // it rather than count on remove to drop it
+    t.touch(coll_t::META_COLL, log_oid);
+    t.truncate(coll_t::META_COLL, log_oid, 0);
+    t.omap_clear(coll_t::META_COLL, log_oid);
+    t.omap_setkeys(coll_t::META_COLL, log_oid, kv);
+  } else {
+    t.remove(coll_t::META_COLL, log_oid );
+    t.write(coll_t::META_COLL, log_oid , 0, bl.length(), bl);
+  }
+  write_ondisklog(t);
+  
+  dout(10) << "write_log to " << ondisklog.tail << "~" << ondisklog.length()
+	   << (ondisklog.keyed ? " keyed" : "") << dendl;
+  dirty_log = false;
+}
 
+void PG::write_ondisklog(ObjectStore::Transaction& t)
+{
   bufferlist blb(sizeof(ondisklog));
   ::encode(ondisklog, blb);
   t.collection_setattr(coll, "ondisklog", blb);
-  
-  dout(10) << "write_log to " << ondisklog.tail << "~" << ondisklog.length() << dendl;
-  dirty_log = false;
 }
 
 void PG::trim(ObjectStore::Transaction& t, eversion_t trim_to)
@@ -1929,14 +2043,24 @@ void PG::trim(ObjectStore::Transaction& t, eversion_t trim_to)
     assert(trim_to <= info.last_complete);
 
     dout(10) << "trim " << log << " to " << trim_to << dendl;
+    set<string> trimmed_keys;
+    if (ondisklog.keyed) {
+      eversion_t s = trim_to;
+      if (log.backlog && s < log.tail)
+	s = log.tail;   // as IndexedLog::trim does
+      for (Log::entry_list::iterator p = log.log.begin();
+	   p != log.log.end() && p->version <= s;
+	   ++p)
+	trimmed_keys.insert(OndiskLog::log_key(p->version));
+    }
     log.trim(t, trim_to);
     info.log_tail = log.tail;
     info.log_backlog = log.backlog;
-    trim_ondisklog(t);
+    trim_ondisklog(t, trimmed_keys);
   }
 }
 
-void PG::trim_ondisklog(ObjectStore::Transaction& t) 
+void PG::trim_ondisklog(ObjectStore::Transaction& t, const set<string>& trimmed_keys)
 {
   uint64_t new_tail;
   if (log.empty()) {
@@ -1944,6 +2068,16 @@ void PG::trim_ondisklog(ObjectStore::Transaction& t)
   } else {
     new_tail = log.log.front().offset;
   }
+
+  if (ondisklog.keyed) {
+    dout(15) << "trim_ondisklog tail " << ondisklog.tail << " -> " << new_tail
+	     << ", removing " << trimmed_keys.size() << " keys" << dendl;
+    ondisklog.tail = new_tail;
+    if (!trimmed_keys.empty())
+      t.omap_rmkeys(coll_t::META_COLL, log_oid, trimmed_keys);
+    write_ondisklog(t);
+    return;
+  }
   bool same_block = (new_tail & ~4095) == (ondisklog.tail & ~4095);
   dout(15) << "trim_ondisklog tail " << ondisklog.tail << " -> " << new_tail
 	   << ", now " << new_tail << "~" << (ondisklog.head - new_tail)
@@ -1959,9 +2093,7 @@ void PG::trim_ondisklog(ObjectStore::Transaction& t)
   if (!g_conf->osd_preserve_trimmed_log)
     t.zero(coll_t::META_COLL, log_oid, 0, ondisklog.tail & ~4095);
 
-  bufferlist blb(sizeof(ondisklog));
-  ::encode(ondisklog, blb);
-  t.collection_setattr(coll, "ondisklog", blb);
+  write_ondisklog(t);
 }
 
 void PG::trim_peers()
@@ -2006,22 +2138,27 @@ void PG::append_log(vector<Log::Entry>& logv, eversion_t trim_to, ObjectStore::T
   dout(10) << "append_log " << log << " " << logv << dendl;
 
   bufferlist bl;
+  map<string,bufferlist> kv;
   for (vector<Log::Entry>::iterator p = logv.begin();
        p != logv.end();
        p++) {
-    p->offset = ondisklog.head + bl.length();
+    unsigned startoff = bl.length();
+    p->offset = ondisklog.head + startoff;
     add_log_entry(*p, bl);
+    if (ondisklog.keyed)
+      kv[OndiskLog::log_key(p->version)].substr_of(bl, startoff, bl.length() - startoff);
   }
 
   dout(10) << "append_log  " << ondisklog.tail << "~" << ondisklog.length()
 	   << " adding " << bl.length() << dendl;
 
-  t.write(coll_t::META_COLL, log_oid, ondisklog.head, bl.length(), bl );
+  if (ondisklog.keyed)
+    t.omap_setkeys(coll_t::META_COLL, log_oid, kv);
+  else
+    t.write(coll_t::META_COLL, log_oid, ondisklog.head, bl.length(), bl );
   ondisklog.head += bl.length();
 
-  bufferlist blb(sizeof(ondisklog));
-  ::encode(ondisklog, blb);
-  t.collection_setattr(coll, "ondisklog", blb);
+  write_ondisklog(t);
   dout(10) << "append_log  now " << ondisklog.tail << "~" << ondisklog.length() << dendl;
 
   trim(t, trim_to);
@@ -2053,7 +2190,26 @@ void PG::read_log(ObjectStore *store)
   if (ondisklog.head > 0) {
     // read
     bufferlist bl;
-    store->read(coll_t::META_COLL, log_oid, ondisklog.tail, ondisklog.length(), bl);
+    if (ondisklog.keyed) {
+      // the entries, in version order, make up the same stream
+      string after;
+      while (true) {
+	map<string,bufferlist> kv;
+	int r = store->omap_get_range(coll_t::META_COLL, log_oid, after, 1024, &kv);
+	if (r < 0) {
+	  std::ostringstream oss;
+	  oss << "read_log omap_get_range got " << r;
+	  throw read_log_error(oss.str().c_str());
+	}
+	if (kv.empty())
+	  break;
+	for (map<string,bufferlist>::iterator q = kv.begin(); q != kv.end(); ++q)
+	  bl.claim_append(q->second);
+	after = kv.rbegin()->first;
+      }
+    } else {
+      store->read(coll_t::META_COLL, log_oid, ondisklog.tail, ondisklog.length(), bl);
+    }
     if (bl.length() < ondisklog.length()) {
       std::ostringstream oss;
       oss << "read_log got " << bl.length() << " bytes, expected "
@@ -2153,7 +2309,7 @@ void PG::read_log(ObjectStore *store)
     if (reorder) {
       dout(0) << "read_log reordering log" << dendl;
       map<eversion_t, Log::Entry> m;
-      for (list<Log::Entry>::iterator p = log.log.begin(); p != log.log.end(); p++)
+      for (Log::entry_list::iterator p = log.log.begin(); p != log.log.end(); p++)
 	m[p->version] = *p;
       log.log.clear();
       for (map<eversion_t, Log::Entry>::iterator p = m.begin(); p != m.end(); p++)
@@ -2170,7 +2326,7 @@ void PG::read_log(ObjectStore *store)
 	     << "," << info.last_update << "]" << dendl;
 
     set<hobject_t> did;
-    for (list<Log::Entry>::reverse_iterator i = log.log.rbegin();
+    for (Log::entry_list::reverse_iterator i = log.log.rbegin();
 	 i != log.log.rend();
 	 i++) {
       if (i->version <= info.last_complete) break;
@@ -2205,6 +2361,10 @@ bool PG::check_log_for_corruption(ObjectStore *store)
   ::decode(bounds, p);
 
   dout(10) << "check_log_for_corruption: tail " << bounds.tail << " head " << bounds.head << dendl;
+  if (bounds.keyed) {
+    dout(10) << "check_log_for_corruption: keyed log, entries are checked by read_log" << dendl;
+    return true;
+  }
 
   stringstream ss;
   ss << "CORRUPT pg " << info.pgid << " log: ";
@@ -2329,6 +2489,7 @@ void PG::read_state(ObjectStore *store)
 	    << "' for later " << "analysis." << dendl;
 
     ondisklog.zero();
+    ondisklog.keyed = osd->store_has_omap && g_conf->osd_pg_log_keyed;
 
     // clear log index
     log.head = log.tail = info.last_update;
@@ -2345,6 +2506,11 @@ void PG::read_state(ObjectStore *store)
     t.collection_add(cr_log_coll, coll_t::META_COLL, log_oid);
     t.collection_remove(coll_t::META_COLL, log_oid);
     t.touch(coll_t::META_COLL, log_oid);
+    // the corrupt log's keys go with it; none may linger under the new,
+    // empty log, or the next read_log would stream them back in
+    if (osd->store_has_omap)
+      t.omap_clear(coll_t::META_COLL, log_oid);
+    write_ondisklog(t);
     write_info(t);
     store->apply_transaction(t);
 
@@ -2548,19 +2714,102 @@ void PG::sub_op_scrub_map(MOSDSubOp *op)
   }
 
   if (--scrub_waiting_on == 0) {
-    assert(last_update_applied == info.last_update);
+    assert(last_update_applied >= scrub_chunk_version);
     osd->scrub_finalize_wq.queue(this);
   }
 
   op->put();
 }
 
+/*
+ * list the objects from key pos on, about max of them, ending between
+ * two hash values.  *end is BACKFILL_SCANNED if we ran off the end of
+ * the collection.  returns false if the store does not list the
+ * collection in hash order.
+ */
+bool PG::list_chunk(uint64_t pos, int max, vector<hobject_t>& ls, uint64_t *end)
+{
+  vector<hobject_t> all;
+  while (true) {
+    all.clear();
+    collection_list_handle_t handle;
+    handle.hash = backfill_key((uint32_t)pos);  // the key transform is its own inverse
+    handle.index = 0;
+    int r = osd->store->collection_list_partial(coll, 0, all, max, &handle);
+    assert(r == 0);
+    if ((int)all.size() < max) {
+      *end = BACKFILL_SCANNED;
+      break;
+    }
+    // one hash value may fill the whole chunk; look further
+    *end = backfill_key(all.back());
+    if (*end > pos && backfill_key(all.front()) < *end)
+      break;
+    max *= 2;
+  }
+
+  ls.clear();
+  uint64_t last = pos;
+  for (vector<hobject_t>::iterator p = all.begin(); p != all.end(); ++p) {
+    uint64_t key = backfill_key(*p);
+    if (key < last) {
+      dout(0) << "list_chunk " << *p << " listed out of hash order" << dendl;
+      return false;
+    }
+    last = key;
+    if (key >= *end)
+      break;
+    ls.push_back(*p);
+  }
+  return true;
+}
+
+/*
+ * list every object with a key in [start, end)
+ */
+void PG::list_range(uint64_t start, uint64_t end, vector<hobject_t>& ls)
+{
+  ls.clear();
+  if (start == 0 && end >= BACKFILL_SCANNED) {
+    osd->store->collection_list(coll, ls);
+    return;
+  }
+
+  int max = MAX(g_conf->osd_scrub_chunk_max, 16);
+  uint64_t pos = start;
+  while (pos < end) {
+    vector<hobject_t> chunk;
+    uint64_t cend;
+    if (!list_chunk(pos, max, chunk, &cend)) {
+      // no order to lean on; filter the whole listing
+      vector<hobject_t> all;
+      osd->store->collection_list(coll, all);
+      ls.clear();
+      for (vector<hobject_t>::iterator p = all.begin(); p != all.end(); ++p) {
+	uint64_t key = backfill_key(*p);
+	if (key >= start && key < end)
+	  ls.push_back(*p);
+      }
+      return;
+    }
+    for (vector<hobject_t>::iterator p = chunk.begin(); p != chunk.end(); ++p) {
+      if (backfill_key(*p) >= end)
+	break;
+      ls.push_back(*p);
+    }
+    pos = cend;
+  }
+}
+
 /* 
  * pg lock may or may not be held
  */
-void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls)
+void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep)
 {
-  dout(10) << "_scan_list scanning " << ls.size() << " objects" << dendl;
+  dout(10) << "_scan_list scanning " << ls.size() << " objects"
+	   << (deep ? " deeply" : "") << dendl;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  uint64_t bytes = 0;
   int i = 0;
   for (vector<hobject_t>::iterator p = ls.begin(); 
        p != ls.end(); 
@@ -2577,15 +2826,124 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls)
       dout(25) << "_scan_list  " << poid << dendl;
     } else {
       dout(25) << "_scan_list  " << poid << " got " << r << ", skipping" << dendl;
+      continue;
+    }
+    if (!deep)
+      continue;
+
+    ScrubMap::object &o = map.objects[poid];
+
+    // a sparse clone may be stored sparsely here and in full on a
+    // replica that recovered it: digest what it reads as, not the file
+    SnapSet snapset;
+    if (poid.snap < CEPH_MAXSNAP) {
+      hobject_t head = poid;
+      head.snap = CEPH_NOSNAP;
+      bufferlist sbl;
+      if (osd->store->getattr(coll, head, SS_ATTR, sbl) < 0) {
+	head.snap = CEPH_SNAPDIR;
+	osd->store->getattr(coll, head, SS_ATTR, sbl);
+      }
+      if (sbl.length()) {
+	bufferlist::iterator sp = sbl.begin();
+	::decode(snapset, sp);
+      }
+    }
+
+    uint32_t crc = -1;
+    uint64_t pos = 0;
+    int stride = g_conf->osd_deep_scrub_stride;
+    while (true) {
+      bufferlist bl;
+      r = read_clone(poid, snapset, pos, stride, bl, CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+      if (r <= 0)
+	break;
+      crc = bl.crc32c(crc);
+      pos += r;
+      bytes += r;
+      osd->op_sched.charge(OpScheduler::SCRUB, r, 0);
+
+      uint64_t rate = g_conf->osd_deep_scrub_bytes_per_sec;
+      if (rate) {
+	double ahead = (double)bytes / (double)rate - (double)(ceph_clock_now(g_ceph_context) - start);
+	if (ahead > 0)
+	  usleep((useconds_t)(ahead * 1000000.0));
+      }
+      if (r < stride)
+	break;
+    }
+    if (r < 0) {
+      osd->clog.error() << info.pgid << " deep scrub read of " << poid << " got " << r << "\n";
+    } else {
+      o.digest = crc;
+      o.digest_present = true;
+      dout(25) << "_scan_list  " << poid << " crc " << hex << crc << dec << dendl;
     }
   }
 }
 
+/*
+ * Read from an object like ObjectStore::read.  A sparse clone only
+ * stores what isn't in its clone_overlap: that part is the same as in
+ * the next newer clone (or the head), so read it through from there.
+ */
+int PG::read_clone(const hobject_t& soid, const SnapSet& snapset,
+		   uint64_t off, uint64_t len, bufferlist& bl, int flags)
+{
+  if (soid.snap >= CEPH_MAXSNAP || !snapset.is_sparse(soid.snap))
+    return osd->store->read(coll, soid, off, len, bl, flags);
+
+  map<snapid_t, uint64_t>::const_iterator s = snapset.clone_size.find(soid.snap);
+  assert(s != snapset.clone_size.end());
+  uint64_t size = s->second;
+  bl.clear();
+  if (off >= size)
+    return 0;
+  uint64_t end = (len && len < size - off) ? off + len : size;
+
+  bufferlist stored;
+  int r = osd->store->read(coll, soid, off, end - off, stored, flags);
+  if (r < 0)
+    return r;
+  bufferptr bp(end - off);
+  bp.zero();
+  stored.copy(0, MIN((uint64_t)stored.length(), end - off), bp.c_str());
+
+  vector<snapid_t>::const_iterator c = find(snapset.clones.begin(), snapset.clones.end(),
+					    soid.snap);
+  assert(c != snapset.clones.end());
+  hobject_t next = soid;
+  next.snap = (c + 1 == snapset.clones.end()) ? snapid_t(CEPH_NOSNAP) : *(c + 1);
+
+  interval_set<uint64_t> fill;
+  fill.insert(off, end - off);
+  map<snapid_t, interval_set<uint64_t> >::const_iterator o = snapset.clone_overlap.find(soid.snap);
+  if (o != snapset.clone_overlap.end())
+    fill.intersection_of(o->second);
+  else
+    fill.clear();
+  for (interval_set<uint64_t>::iterator p = fill.begin(); p != fill.end(); ++p) {
+    bufferlist nbl;
+    r = read_clone(next, snapset, p.get_start(), p.get_len(), nbl, flags);
+    if (r < 0) {
+      dout(0) << "read_clone " << soid << " reading " << p.get_start() << "~" << p.get_len()
+	      << " through " << next << " got " << r << dendl;
+      return r;
+    }
+    nbl.copy(0, MIN((uint64_t)nbl.length(), p.get_len()), bp.c_str() + (p.get_start() - off));
+  }
+  dout(20) << "read_clone " << soid << " " << off << "~" << (end - off)
+	   << ", " << fill << " through " << next << dendl;
+  bl.push_back(bp);
+  return bl.length();
+}
+
 void PG::_request_scrub_map(int replica, eversion_t version)
 {
     dout(10) << "scrub  requesting scrubmap from osd." << replica << dendl;
     MOSDRepScrub *repscrubop = new MOSDRepScrub(info.pgid, version, 
-						osd->osdmap->get_epoch());
+						osd->osdmap->get_epoch(),
+						scrub_start, scrub_end, scrub_deep);
     osd->cluster_messenger->send_message(repscrubop,
 					 osd->osdmap->get_cluster_inst(replica));
 }
@@ -2711,9 +3069,9 @@ void PG::scrub_unreserve_replicas()
  * build a (sorted) summary of pg content for purposes of scrubbing
  * called while holding pg lock
  */ 
-void PG::build_scrub_map(ScrubMap &map)
+void PG::build_scrub_map(ScrubMap &map, uint64_t start, uint64_t end, bool deep)
 {
-  dout(10) << "build_scrub_map" << dendl;
+  dout(10) << "build_scrub_map " << hex << start << ".." << end << dec << dendl;
 
   map.valid_through = info.last_update;
   epoch_t epoch = info.history.same_interval_since;
@@ -2726,9 +3084,10 @@ void PG::build_scrub_map(ScrubMap &map)
 
   // objects
   vector<hobject_t> ls;
-  osd->store->collection_list(coll, ls);
+  list_range(start, end, ls);
 
-  _scan_list(map, ls);
+  _scan_list(map, ls, deep);
+  osd->op_sched.charge(OpScheduler::SCRUB, 0, ls.size());
   lock();
 
   if (epoch != info.history.same_interval_since) {
@@ -2741,28 +3100,29 @@ void PG::build_scrub_map(ScrubMap &map)
 
   // Catch up
   ScrubMap incr;
-  build_inc_scrub_map(incr, map.valid_through);
+  build_inc_scrub_map(incr, map.valid_through, start, end);
   map.merge_incr(incr);
 
   // pg attrs
   osd->store->collection_getattrs(coll, map.attrs);
 
   // log
-  osd->store->read(coll_t(), log_oid, 0, 0, map.logbl);
+  osd->store->read(coll_t(), log_oid, 0, 0, map.logbl,
+		   g_conf->osd_background_read_dontneed ? CEPH_OSD_OP_FLAG_FADVISE_DONTNEED : 0);
   dout(10) << " done.  pg log is " << map.logbl.length() << " bytes" << dendl;
 }
 
 
 /* 
- * build a summary of pg content changed starting after v
+ * build a summary of pg content in [start, end) changed starting after v
  * called while holding pg lock
  */
-void PG::build_inc_scrub_map(ScrubMap &map, eversion_t v)
+void PG::build_inc_scrub_map(ScrubMap &map, eversion_t v, uint64_t start, uint64_t end)
 {
   map.valid_through = last_update_applied;
   map.incr_since = v;
   vector<hobject_t> ls;
-  list<Log::Entry>::iterator p;
+  Log::entry_list::iterator p;
   if (v == log.tail) {
     p = log.log.begin();
   } else if (v > log.tail) {
@@ -2773,6 +3133,9 @@ void PG::build_inc_scrub_map(ScrubMap &map, eversion_t v)
   }
   
   for (; p != log.log.end(); p++) {
+    uint64_t key = backfill_key(p->soid);
+    if (key < start || key >= end)
+      continue;
     if (p->is_update()) {
       ls.push_back(p->soid);
     } else if (p->is_delete()) {
@@ -2780,12 +3143,13 @@ void PG::build_inc_scrub_map(ScrubMap &map, eversion_t v)
     }
   }
 
-  _scan_list(map, ls);
+  _scan_list(map, ls, false);
   // pg attrs
   osd->store->collection_getattrs(coll, map.attrs);
 
   // log
-  osd->store->read(coll_t(), log_oid, 0, 0, map.logbl);
+  osd->store->read(coll_t(), log_oid, 0, 0, map.logbl,
+		   g_conf->osd_background_read_dontneed ? CEPH_OSD_OP_FLAG_FADVISE_DONTNEED : 0);
 }
 
 void PG::repair_object(const hobject_t& soid, ScrubMap::object *po, int bad_peer, int ok_peer)
@@ -2811,10 +3175,11 @@ void PG::repair_object(const hobject_t& soid, ScrubMap::object *po, int bad_peer
 /* replica_scrub
  *
  * If msg->scrub_from is not set, replica_scrub calls build_scrubmap to
- * build a complete map (with the pg lock dropped).
+ * build a complete map of the requested chunk (with the pg lock dropped).
  *
  * If msg->scrub_from is set, we build an incremental scrub map with
- * the pg lock held.
+ * the pg lock held.  Incremental maps are never deep; the objects they
+ * cover were written after the chunk was first scanned.
  */
 void PG::replica_scrub(MOSDRepScrub *msg)
 {
@@ -2838,9 +3203,9 @@ void PG::replica_scrub(MOSDRepScrub *msg)
     // flush out in-flight writes to disk, so we can scrub the
     // resulting on-disk state.
     osr.flush();
-    build_inc_scrub_map(map, msg->scrub_from);
+    build_inc_scrub_map(map, msg->scrub_from, msg->start, msg->end);
   } else {
-    build_scrub_map(map);
+    build_scrub_map(map, msg->start, msg->end, msg->deep);
   }
 
   if (msg->map_epoch < info.history.same_interval_since) {
@@ -2867,15 +3232,19 @@ void PG::replica_scrub(MOSDRepScrub *msg)
 /* Scrub:
  * PG_STATE_SCRUBBING is set when the scrub is queued
  * 
- * Once the initial scrub has completed and the requests have gone out to 
- * replicas for maps, finalizing_scrub is set.  scrub_waiting_on is set to 
- * the number of maps outstanding (active.size()).
+ * The pg is scrubbed a chunk at a time: a range of at most about
+ * osd_scrub_chunk_max objects, in backfill_key order.  Once a chunk is
+ * picked, finalizing_scrub is set and writes to objects in the chunk
+ * wait (see scrub_blocks()); writes elsewhere go on.
  *
- * If last_update_applied is behind the head of the log, scrub returns to be
+ * If writes to the chunk logged before it was picked (through
+ * scrub_chunk_version) have not been applied, scrub returns to be
  * requeued by op_applied.
  *
- * Once last_update_applied == info.last_update, scrub catches itself up and
- * decrements scrub_waiting_on.
+ * Then the requests go out to replicas for maps of the chunk,
+ * scrub_waiting_on is set to the number of maps outstanding
+ * (acting.size()), and the primary builds its own map and decrements
+ * scrub_waiting_on.
  *
  * sub_op_scrub_map similarly decrements scrub_waiting_on for each map received.
  * 
@@ -2885,7 +3254,8 @@ void PG::replica_scrub(MOSDRepScrub *msg)
  * In scrub_finalize, if any replica maps are too old, new ones are requested,
  * scrub_waiting_on is reset, and scrub_finalize returns to be requeued by
  * sub_op_scrub_map.  If all maps are up to date, scrub_finalize checks 
- * the maps and performs repairs.
+ * the maps, performs repairs, unblocks the chunk and queues the next
+ * one, until the whole pg has been covered.
  */
 void PG::scrub()
 {
@@ -2895,6 +3265,8 @@ void PG::scrub()
 
   if (!is_primary() || !is_active() || !is_clean() || !is_scrubbing()) {
     dout(10) << "scrub -- not primary or active or not clean" << dendl;
+    if (scrub_end)
+      scrub_clear_state();   // gave up partway through
     state_clear(PG_STATE_REPAIR);
     state_clear(PG_STATE_SCRUBBING);
     clear_scrub_reserved();
@@ -2904,59 +3276,71 @@ void PG::scrub()
   }
 
   if (!finalizing_scrub) {
-    dout(10) << "scrub start" << dendl;
-    update_stats();
-    scrub_received_maps.clear();
-    scrub_epoch_start = info.history.same_interval_since;
-
-    osd->sched_scrub_lock.Lock();
-    if (scrub_reserved) {
-      --(osd->scrubs_pending);
-      assert(osd->scrubs_pending >= 0);
-      scrub_reserved = false;
-      scrub_reserved_peers.clear();
-    }
-    ++(osd->scrubs_active);
-    osd->sched_scrub_lock.Unlock();
-
-    /* scrub_waiting_on == 0 iff all replicas have sent the requested maps and
-     * the primary has done a final scrub (which in turn can only happen if
-     * last_update_applied == info.last_update)
-     */
-    scrub_waiting_on = acting.size();
-
-    // request maps from replicas
-    for (unsigned i=1; i<acting.size(); i++) {
-      _request_scrub_map(acting[i], eversion_t());
+    if (scrub_end == 0) {
+      dout(10) << "scrub start" << dendl;
+      update_stats();
+      scrub_epoch_start = info.history.same_interval_since;
+      scrub_begin_version = info.last_update;
+      scrub_deep = g_conf->osd_deep_scrub;
+      scrub_errors = scrub_fixed = 0;
+      scrub_cstat = object_stat_collection_t();
+
+      osd->sched_scrub_lock.Lock();
+      if (scrub_reserved) {
+	--(osd->scrubs_pending);
+	assert(osd->scrubs_pending >= 0);
+	scrub_reserved = false;
+	scrub_reserved_peers.clear();
+      }
+      ++(osd->scrubs_active);
+      osd->sched_scrub_lock.Unlock();
     }
-    osd->map_lock.put_read();
 
-    // Unlocks and relocks...
-    primary_scrubmap = ScrubMap();
-    build_scrub_map(primary_scrubmap);
+    // pick the next chunk and hold writes to it
+    scrub_start = scrub_end;
+    vector<hobject_t> ls;
+    if (g_conf->osd_scrub_chunk_max <= 0 ||
+	!list_chunk(scrub_start, g_conf->osd_scrub_chunk_max, ls, &scrub_end))
+      scrub_end = BACKFILL_SCANNED;
+    finalizing_scrub = true;
+    scrub_chunk_version = info.last_update;
+    dout(10) << "scrub chunk " << hex << scrub_start << ".." << scrub_end << dec
+	     << " (" << ls.size() << " objects)" << dendl;
 
-    if (scrub_epoch_start != info.history.same_interval_since) {
-      dout(10) << "scrub  pg changed, aborting" << dendl;
-      scrub_clear_state();
-      scrub_unreserve_replicas();
+    if (last_update_applied < scrub_chunk_version) {
+      dout(10) << "wait for writes through " << scrub_chunk_version << " to apply" << dendl;
       unlock();
+      osd->map_lock.put_read();
       return;
     }
+  }
 
-    finalizing_scrub = true;
-    if (last_update_applied != info.last_update) {
-      dout(10) << "wait for cleanup" << dendl;
-      unlock();
-      return;
-    }
-  } else {
+  if (scrub_epoch_start != info.history.same_interval_since) {
+    dout(10) << "scrub  pg changed, aborting" << dendl;
+    scrub_clear_state();
+    scrub_unreserve_replicas();
+    unlock();
     osd->map_lock.put_read();
+    return;
   }
-    
+  assert(last_update_applied >= scrub_chunk_version);
+
+  /* scrub_waiting_on == 0 iff all replicas have sent the requested maps and
+   * the primary has built its own.
+   */
+  scrub_received_maps.clear();
+  scrub_waiting_on = acting.size();
+
+  // request maps from replicas
+  for (unsigned i=1; i<acting.size(); i++) {
+    _request_scrub_map(acting[i], eversion_t());
+  }
+  osd->map_lock.put_read();
+
+  // Unlocks and relocks...
+  primary_scrubmap = ScrubMap();
+  build_scrub_map(primary_scrubmap, scrub_start, scrub_end, scrub_deep);
 
-  dout(10) << "clean up scrub" << dendl;
-  assert(last_update_applied == info.last_update);
-  
   if (scrub_epoch_start != info.history.same_interval_since) {
     dout(10) << "scrub  pg changed, aborting" << dendl;
     scrub_clear_state();
@@ -2964,16 +3348,9 @@ void PG::scrub()
     unlock();
     return;
   }
-  
-  if (primary_scrubmap.valid_through != log.head) {
-    ScrubMap incr;
-    build_inc_scrub_map(incr, primary_scrubmap.valid_through);
-    primary_scrubmap.merge_incr(incr);
-  }
-  
+
   --scrub_waiting_on;
   if (scrub_waiting_on == 0) {
-    assert(last_update_applied == info.last_update);
     osd->scrub_finalize_wq.queue(this);
   }
   
@@ -2993,6 +3370,7 @@ void PG::scrub_clear_state()
   osd->requeue_ops(this, waiting_for_active);
 
   finalizing_scrub = false;
+  scrub_start = scrub_end = 0;
   scrub_received_maps.clear();
 }
 
@@ -3004,7 +3382,7 @@ bool PG::scrub_gather_replica_maps() {
        p != scrub_received_maps.end();
        p++) {
     
-    if (scrub_received_maps[p->first].valid_through != log.head) {
+    if (scrub_received_maps[p->first].valid_through < scrub_chunk_version) {
       scrub_waiting_on++;
       // Need to request another incremental map
       _request_scrub_map(p->first, p->second.valid_through);
@@ -3053,6 +3431,14 @@ bool PG::_compare_scrub_objects(ScrubMap::object &auth,
       errorstream << "extra attr " << i->first;
     }
   }
+  if (auth.digest_present && candidate.digest_present &&
+      auth.digest != candidate.digest) {
+    if (!ok)
+      errorstream << ", ";
+    ok = false;
+    errorstream << "digest " << hex << candidate.digest
+		<< " != known digest " << auth.digest << dec;
+  }
   return ok;
 }
 
@@ -3118,7 +3504,7 @@ void PG::_compare_scrubmaps(const map<int,ScrubMap*> &maps,
 void PG::scrub_finalize() {
   osd->map_lock.get_read();
   lock();
-  assert(last_update_applied == info.last_update);
+  assert(last_update_applied >= scrub_chunk_version);
 
   if (scrub_epoch_start != info.history.same_interval_since) {
     dout(10) << "scrub  pg changed, aborting" << dendl;
@@ -3138,7 +3524,7 @@ void PG::scrub_finalize() {
   osd->map_lock.put_read();
 
   dout(10) << "scrub_finalize has maps, analyzing" << dendl;
-  int errors = 0, fixed = 0;
+  int &errors = scrub_errors, &fixed = scrub_fixed;
   bool repair = state_test(PG_STATE_REPAIR);
   const char *mode = repair ? "repair":"scrub";
   if (acting.size() > 1) {
@@ -3207,6 +3593,17 @@ void PG::scrub_finalize() {
   // ok, do the pg-type specific scrubbing
   _scrub(primary_scrubmap, errors, fixed);
 
+  // release the chunk
+  finalizing_scrub = false;
+  osd->requeue_ops(this, waiting_for_active);
+  if (scrub_end != BACKFILL_SCANNED) {
+    dout(10) << "scrub chunk done, " << errors << " errors so far" << dendl;
+    osd->scrub_wq.queue(this);
+    unlock();
+    return;
+  }
+  _scrub_finish(errors, fixed);
+
   {
     stringstream oss;
     oss << info.pgid << " " << mode << " ";
@@ -3288,7 +3685,7 @@ void PG::share_pg_log()
     MOSDPGLog *m = new MOSDPGLog(info.last_update.epoch, info);
     m->log.copy_after(log, pinfo.last_update);
 
-    for (list<Log::Entry>::const_iterator i = m->log.log.begin();
+    for (Log::entry_list::const_iterator i = m->log.log.begin();
 	 i != m->log.log.end();
 	 ++i) {
       pmissing.add_next_event(*i);
@@ -3449,6 +3846,16 @@ bool PG::old_peering_msg(epoch_t reply_epoch,
 	  last_peering_reset > query_epoch);
 }
 
+void PG::clear_peering_queue()
+{
+  assert_locked();
+  while (!peering_queue.empty()) {
+    if (peering_queue.front().msg)
+      peering_queue.front().msg->put();
+    peering_queue.pop_front();
+  }
+}
+
 
 void PG::on_removal()
 {
@@ -3457,7 +3864,10 @@ void PG::on_removal()
   osd->scrub_wq.dequeue(this);
   osd->scrub_finalize_wq.dequeue(this);
   osd->snap_trim_wq.dequeue(this);
+  osd->agent_wq.dequeue(this);
   osd->remove_wq.dequeue(this);
+  osd->peering_wq.dequeue(this);
+  clear_peering_queue();
   osd->pg_stat_queue_dequeue(this);
 
   remove_watchers_and_notifies();
@@ -3547,6 +3957,8 @@ void PG::start_peering_interval(const OSDMap *lastmap,
   // reset primary state?
   if (oldrole == 0 || get_role() == 0)
     clear_primary_state();
+  else
+    min_last_complete_ondisk = eversion_t();  // until the new primary says
 
     
   // pg->on_*
@@ -3619,7 +4031,7 @@ void PG::start_peering_interval(const OSDMap *lastmap,
     }
   }
   // make sure we clear out any pg_temp change requests
-  osd->pg_temp_wanted.erase(info.pgid);
+  osd->remove_want_pg_temp(info.pgid);
   cancel_recovery();
 
   if (acting.empty() && up.size() && up[0] == osd->whoami) {
@@ -3668,16 +4080,39 @@ void PG::Missing::swap(Missing& o)
 {
   missing.swap(o.missing);
   rmissing.swap(o.rmissing);
+  std::swap(filter, o.filter);
+  std::swap(filter_capacity, o.filter_capacity);
+}
+
+bool PG::Missing::may_be_missing(const hobject_t& oid) const
+{
+  if (missing.size() < FILTER_MIN) {
+    if (filter)
+      drop_filter();
+    return !missing.empty();
+  }
+  if (!filter || filter->element_count() > filter_capacity) {
+    drop_filter();
+    filter_capacity = missing.size() * 2;
+    filter = new bloom_filter(filter_capacity, 0.01, 0);
+    for (item_map::const_iterator p = missing.begin(); p != missing.end(); ++p)
+      filter->insert(p->first.oid.name);
+  }
+  return filter->contains(oid.oid.name);
 }
 
 bool PG::Missing::is_missing(const hobject_t& oid) const
 {
+  if (!may_be_missing(oid))
+    return false;
   return (missing.find(oid) != missing.end());
 }
 
 bool PG::Missing::is_missing(const hobject_t& oid, eversion_t v) const
 {
-  map<hobject_t, item>::const_iterator m = missing.find(oid);
+  if (!may_be_missing(oid))
+    return false;
+  item_map::const_iterator m = missing.find(oid);
   if (m == missing.end())
     return false;
   const Missing::item &item(m->second);
@@ -3688,7 +4123,9 @@ bool PG::Missing::is_missing(const hobject_t& oid, eversion_t v) const
 
 eversion_t PG::Missing::have_old(const hobject_t& oid) const
 {
-  map<hobject_t, item>::const_iterator m = missing.find(oid);
+  if (!may_be_missing(oid))
+    return eversion_t();
+  item_map::const_iterator m = missing.find(oid);
   if (m == missing.end())
     return eversion_t();
   const Missing::item &item(m->second);
@@ -3708,6 +4145,7 @@ void PG::Missing::add_next_event(const Log::Entry& e)
       if (missing.count(e.soid))  // already missing divergent item
 	rmissing.erase(missing[e.soid].need.version);
       missing[e.soid] = item(e.version, eversion_t());  // .have = nil
+      filter_insert(e.soid);
     } else if (missing.count(e.soid)) {
       // already missing (prior).
       //assert(missing[e.soid].need == e.prior_version);
@@ -3716,9 +4154,11 @@ void PG::Missing::add_next_event(const Log::Entry& e)
     } else if (e.is_backlog()) {
       // May not have prior version
       missing[e.soid].need = e.version;
+      filter_insert(e.soid);
     } else {
       // not missing, we must have prior_version (if any)
       missing[e.soid] = item(e.version, e.prior_version);
+      filter_insert(e.soid);
     }
     rmissing[e.version.version] = e.soid;
   } else
@@ -3732,6 +4172,7 @@ void PG::Missing::revise_need(hobject_t oid, eversion_t need)
     missing[oid].need = need;            // no not adjust .have
   } else {
     missing[oid] = item(need, eversion_t());
+    filter_insert(oid);
   }
   rmissing[need.version] = oid;
 }
@@ -3740,16 +4181,17 @@ void PG::Missing::add(const hobject_t& oid, eversion_t need, eversion_t have)
 {
   missing[oid] = item(need, have);
   rmissing[need.version] = oid;
+  filter_insert(oid);
 }
 
 void PG::Missing::rm(const hobject_t& oid, eversion_t v)
 {
-  std::map<hobject_t, Missing::item>::iterator p = missing.find(oid);
+  Missing::item_map::iterator p = missing.find(oid);
   if (p != missing.end() && p->second.need <= v)
     rm(p);
 }
 
-void PG::Missing::rm(const std::map<hobject_t, Missing::item>::iterator &m)
+void PG::Missing::rm(const Missing::item_map::iterator &m)
 {
   rmissing.erase(m->second.need.version);
   missing.erase(m);
@@ -3757,13 +4199,13 @@ void PG::Missing::rm(const std::map<hobject_t, Missing::item>::iterator &m)
 
 void PG::Missing::got(const hobject_t& oid, eversion_t v)
 {
-  std::map<hobject_t, Missing::item>::iterator p = missing.find(oid);
+  Missing::item_map::iterator p = missing.find(oid);
   assert(p != missing.end());
   assert(p->second.need <= v);
   got(p);
 }
 
-void PG::Missing::got(const std::map<hobject_t, Missing::item>::iterator &m)
+void PG::Missing::got(const Missing::item_map::iterator &m)
 {
   rmissing.erase(m->second.need.version);
   missing.erase(m);
@@ -4263,8 +4705,12 @@ PG::RecoveryState::Stray::react(const MLogRec& logevt) {
   PG *pg = context< RecoveryMachine >().pg;
   MOSDPGLog *msg = logevt.msg;
   dout(10) << "received log from " << logevt.from << dendl;
-  pg->merge_log(*context<RecoveryMachine>().get_cur_transaction(),
-		msg->info, msg->log, logevt.from);
+  if (msg->info.is_backfilling())
+    pg->start_backfill(*context<RecoveryMachine>().get_cur_transaction(),
+		       msg->info, msg->log);
+  else
+    pg->merge_log(*context<RecoveryMachine>().get_cur_transaction(),
+		  msg->info, msg->log, logevt.from);
 
   assert(pg->log.tail <= pg->info.last_complete || pg->log.backlog);
   assert(pg->log.head == pg->info.last_update);
@@ -4556,6 +5002,12 @@ PG::RecoveryState::GetMissing::GetMissing(my_context ctx) : my_base(ctx)
     if (pi.is_empty())
       continue;                                // Does not have the PG yet
 
+    if (pg->needs_backfill(pi)) {
+      dout(10) << " osd." << *i << " will be backfilled" << dendl;
+      pg->peer_missing[*i];
+      continue;
+    }
+
     if (pi.last_update == pi.last_complete &&  // peer has no missing
 	pi.last_update == pg->info.last_update) {  // peer is up to date
       // replica has no missing and identical log as us.  no need to
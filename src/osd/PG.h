@@ -30,6 +30,7 @@
 #include "include/buffer.h"
 #include "include/xlist.h"
 #include "include/atomic.h"
+#include "include/bloom_filter.hpp"
 
 #include "OSDMap.h"
 #include "os/ObjectStore.h"
@@ -37,6 +38,7 @@
 #include "messages/MOSDRepScrub.h"
 
 #include "common/DecayCounter.h"
+#include "common/mempool.h"
 
 #include <list>
 #include <memory>
@@ -166,6 +168,21 @@ public:
    *  - if last_complete >= log.bottom, then we know pg contents thru log.head.
    *    otherwise, we have no idea what the pg is supposed to contain.
    */
+  /*
+   * backfill walks a collection in the order HashIndex lists it: by the
+   * object hash with its nibbles reversed.  a target is SCANNED once
+   * every object has been queued for it, and DONE once they have all
+   * been pushed.
+   */
+  static const uint64_t BACKFILL_SCANNED = 1ull << 32;
+  static const uint64_t BACKFILL_DONE = 1ull << 33;
+  static uint32_t backfill_key(uint32_t h) {
+    return hobject_t::_reverse_nibbles(h);
+  }
+  static uint32_t backfill_key(const hobject_t& oid) {
+    return oid.get_filestore_key();
+  }
+
   struct Info {
     pg_t pgid;
     eversion_t last_update;    // last object version applied to store.
@@ -174,6 +191,10 @@ public:
     eversion_t log_tail;     // oldest log entry.
     bool       log_backlog;    // do we store a complete log?
 
+    // while backfilling, we hold exactly the objects whose backfill_key()
+    // is below this; BACKFILL_DONE otherwise.
+    uint64_t last_backfill;
+
     interval_set<snapid_t> purged_snaps;
 
     pg_stat_t stats;
@@ -245,14 +266,15 @@ public:
       }
     } history;
     
-    Info() : log_backlog(false) {}
-    Info(pg_t p) : pgid(p), log_backlog(false) { }
+    Info() : log_backlog(false), last_backfill(BACKFILL_DONE) {}
+    Info(pg_t p) : pgid(p), log_backlog(false), last_backfill(BACKFILL_DONE) { }
 
     bool is_empty() const { return last_update.version == 0; }
     bool dne() const { return history.epoch_created == 0; }
+    bool is_backfilling() const { return last_backfill < BACKFILL_DONE; }
 
     void encode(bufferlist &bl) const {
-      __u8 v = 23;
+      __u8 v = 24;
       ::encode(v, bl);
 
       ::encode(pgid, bl);
@@ -263,6 +285,7 @@ public:
       ::encode(stats, bl);
       history.encode(bl);
       ::encode(purged_snaps, bl);
+      ::encode(last_backfill, bl);
     }
     void decode(bufferlist::iterator &bl) {
       __u8 v;
@@ -287,6 +310,10 @@ public:
 	set<snapid_t> snap_trimq;
 	::decode(snap_trimq, bl);
       }
+      if (v >= 24)
+	::decode(last_backfill, bl);
+      else
+	last_backfill = BACKFILL_DONE;
     }
   };
   //WRITE_CLASS_ENCODER(Info::History)
@@ -395,16 +422,18 @@ public:
       utime_t     mtime;  // this is the _user_ mtime, mind you
       bufferlist snaps;   // only for clone entries
       bool invalid_hash; // only when decoding sobject_t based entries
+      bool dirty_known;  // modify entries: dirty lists every byte changed since prior_version
+      interval_set<uint64_t> dirty;
 
       uint64_t offset;   // [soft state] my offset on disk
       
-      Entry() : op(0), invalid_hash(false) {}
+      Entry() : op(0), invalid_hash(false), dirty_known(false) {}
       Entry(int _op, const hobject_t& _soid, 
 	    const eversion_t& v, const eversion_t& pv,
 	    const osd_reqid_t& rid, const utime_t& mt) :
         op(_op), soid(_soid), version(v),
 	prior_version(pv),
-	reqid(rid), mtime(mt), invalid_hash(false) {}
+	reqid(rid), mtime(mt), invalid_hash(false), dirty_known(false) {}
       
       bool is_clone() const { return op == CLONE; }
       bool is_modify() const { return op == MODIFY; }
@@ -425,7 +454,7 @@ public:
       }
 
       void encode(bufferlist &bl) const {
-	__u8 struct_v = 3;
+	__u8 struct_v = 4;
 	::encode(struct_v, bl);
 	::encode(op, bl);
 	::encode(soid, bl);
@@ -435,6 +464,9 @@ public:
 	::encode(mtime, bl);
 	if (op == CLONE)
 	  ::encode(snaps, bl);
+	::encode(dirty_known, bl);
+	if (dirty_known)
+	  ::encode(dirty, bl);
       }
       void decode(bufferlist::iterator &bl) {
 	__u8 struct_v;
@@ -457,6 +489,13 @@ public:
 	::decode(mtime, bl);
 	if (op == CLONE)
 	  ::decode(snaps, bl);
+	if (struct_v >= 4) {
+	  ::decode(dirty_known, bl);
+	  if (dirty_known)
+	    ::decode(dirty, bl);
+	} else {
+	  dirty_known = false;
+	}
       }
     };
     WRITE_CLASS_ENCODER(Entry)
@@ -476,8 +515,9 @@ public:
      * include negative entries for items deleted prior to 'tail'.
      */
     bool backlog;
-    
-    list<Entry> log;  // the actual log.
+
+    typedef std::list<Entry, mempool::pool_allocator<mempool::osd_pglog, Entry> > entry_list;
+    entry_list log;  // the actual log.
 
     Log() : backlog(false) {}
 
@@ -496,10 +536,10 @@ public:
       return head.version == 0 && head.epoch == 0;
     }
 
-    list<Entry>::iterator find_entry(eversion_t v) {
+    entry_list::iterator find_entry(eversion_t v) {
       int fromhead = head.version - v.version;
       int fromtail = v.version - tail.version;
-      list<Entry>::iterator p;
+      entry_list::iterator p;
       if (fromhead < fromtail) {
 	p = log.end();
 	p--;
@@ -520,6 +560,7 @@ public:
       ::encode(head, bl);
       ::encode(tail, bl);
       ::encode(backlog, bl);
+      bl.reserve(log.size() * 128);
       ::encode(log, bl);
     }
     void decode(bufferlist::iterator &bl) {
@@ -547,7 +588,7 @@ public:
     hash_map<osd_reqid_t,Entry*> caller_ops;
 
     // recovery pointers
-    list<Entry>::iterator complete_to;  // not inclusive of referenced item
+    entry_list::iterator complete_to;  // not inclusive of referenced item
     version_t last_requested;           // last object requested by primary
 
     /****/
@@ -579,7 +620,7 @@ public:
     void index() {
       objects.clear();
       caller_ops.clear();
-      for (list<Entry>::iterator i = log.begin();
+      for (entry_list::iterator i = log.begin();
            i != log.end();
            i++) {
         objects[i->soid] = &(*i);
@@ -647,6 +688,11 @@ public:
 
   /**
    * OndiskLog - some info about how we store the log on disk.
+   *
+   * The log is either a byte stream in the log object, or (keyed) one
+   * omap entry per log entry on it, named by log_key(version).  Either
+   * way each entry is framed the same way, and tail/head count bytes as
+   * if the entries were streamed back to back.
    */
   class OndiskLog {
   public:
@@ -654,8 +700,15 @@ public:
     uint64_t tail;                     // first byte of log. 
     uint64_t head;                        // byte following end of log.
     bool has_checksums;
+    bool keyed;
 
-    OndiskLog() : tail(0), head(0) {}
+    OndiskLog() : tail(0), head(0), has_checksums(true), keyed(false) {}
+
+    static string log_key(eversion_t v) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%08x.%016llx", v.epoch, (unsigned long long)v.version);
+      return buf;
+    }
 
     uint64_t length() { return head - tail; }
     bool trim_to(eversion_t v, ObjectStore::Transaction& t);
@@ -666,10 +719,11 @@ public:
     }
 
     void encode(bufferlist& bl) const {
-      __u8 struct_v = 2;
+      __u8 struct_v = 3;
       ::encode(struct_v, bl);
       ::encode(tail, bl);
       ::encode(head, bl);
+      ::encode(keyed, bl);
     }
     void decode(bufferlist::iterator& bl) {
       __u8 struct_v;
@@ -677,6 +731,10 @@ public:
       has_checksums = (struct_v >= 2);
       ::decode(tail, bl);
       ::decode(head, bl);
+      if (struct_v >= 3)
+	::decode(keyed, bl);
+      else
+	keyed = false;
     }
   };
   WRITE_CLASS_ENCODER(OndiskLog)
@@ -704,9 +762,44 @@ public:
     }; 
     WRITE_CLASS_ENCODER(item)
 
-    map<hobject_t, item> missing;         // oid -> (need v, have v)
+    typedef std::map<hobject_t, item, std::less<hobject_t>,
+		     mempool::pool_allocator<mempool::osd_missing,
+					     std::pair<const hobject_t, item> > > item_map;
+    item_map missing;                    // oid -> (need v, have v)
     map<version_t, hobject_t> rmissing;  // v -> oid
 
+    /*
+     * once missing is big enough for lookups to hurt, a bloom filter
+     * over it answers most is_missing() misses.  removals leave their
+     * bits behind; the filter is rebuilt when it overfills.
+     */
+    static const unsigned FILTER_MIN = 1024;
+    mutable bloom_filter *filter;
+    mutable size_t filter_capacity;
+
+    Missing() : filter(NULL), filter_capacity(0) {}
+    Missing(const Missing& o)
+      : missing(o.missing), rmissing(o.rmissing), filter(NULL), filter_capacity(0) {}
+    Missing& operator=(const Missing& o) {
+      missing = o.missing;
+      rmissing = o.rmissing;
+      drop_filter();
+      return *this;
+    }
+    ~Missing() {
+      delete filter;
+    }
+
+    void drop_filter() const {
+      delete filter;
+      filter = NULL;
+    }
+    void filter_insert(const hobject_t& oid) {
+      if (filter)
+	filter->insert(oid.oid.name);
+    }
+    bool may_be_missing(const hobject_t& oid) const;
+
     unsigned int num_missing() const;
     bool have_missing() const;
     void swap(Missing& o);
@@ -717,9 +810,9 @@ public:
     void revise_need(hobject_t oid, eversion_t need);
     void add(const hobject_t& oid, eversion_t need, eversion_t have);
     void rm(const hobject_t& oid, eversion_t v);
-    void rm(const std::map<hobject_t, Missing::item>::iterator &m);
+    void rm(const item_map::iterator &m);
     void got(const hobject_t& oid, eversion_t v);
-    void got(const std::map<hobject_t, Missing::item>::iterator &m);
+    void got(const item_map::iterator &m);
 
     void encode(bufferlist &bl) const {
       __u8 struct_v = 1;
@@ -731,8 +824,9 @@ public:
       __u8 struct_v;
       ::decode(struct_v, bl);
       ::decode(missing, bl);
+      drop_filter();
 
-      for (map<hobject_t,item>::iterator it = missing.begin();
+      for (item_map::iterator it = missing.begin();
 	   it != missing.end();
 	   ++it)
 	rmissing[it->second.need.version] = it->first;
@@ -797,6 +891,26 @@ public:
 
   list<Message*> op_queue;  // op queue
 
+  /*
+   * a peering message for this pg, looked up (or created) and checked
+   * against the map by the dispatcher, for the peering wq to feed to the
+   * recovery state machine under the pg lock.
+   */
+  struct PeeringEvt {
+    enum { NOTIFY, INFO, LOG, QUERY } type;
+    int from;
+    epoch_t epoch, query_epoch;
+    Info info;
+    Query query;
+    Message *msg;   // the MOSDPGLog, ref held
+    PeeringEvt() : from(-1), epoch(0), query_epoch(0), msg(0) {}
+  };
+  list<PeeringEvt> peering_queue;  // protected by the pg lock
+  void queue_peering_event(const PeeringEvt& evt) {
+    peering_queue.push_back(evt);
+  }
+  void clear_peering_queue();
+
   bool dirty_info, dirty_log;
 
 public:
@@ -844,6 +958,7 @@ public:
   /* You should not use these items without taking their respective queue locks
    * (if they have one) */
   xlist<PG*>::item recovery_item, backlog_item, scrub_item, scrub_finalize_item, snap_trim_item, remove_item, stat_queue_item;
+  xlist<PG*>::item agent_item, peering_item;
   int recovery_ops_active;
 #ifdef DEBUG_RECOVERY_OIDS
   set<hobject_t> recovering_oids;
@@ -864,6 +979,7 @@ public:
   // primary state
  public:
   vector<int> up, acting;
+  unsigned acting_features;  // features every replica in acting has (set at activate)
   map<int,eversion_t> peer_last_complete_ondisk;
   eversion_t  min_last_complete_ondisk;  // up: min over last_complete_ondisk, peer_last_complete_ondisk
   eversion_t  pg_trim_to;
@@ -1372,6 +1488,7 @@ protected:
   Mutex pg_stats_lock;
   bool pg_stats_valid;
   pg_stat_t pg_stats_stable;
+  eversion_t pg_stats_sent;   // reported version last sent to the mon
 
   // for ordering writes
   ObjectStore::Sequencer osr;
@@ -1430,6 +1547,11 @@ public:
   bool proc_replica_info(int from, Info &info);
   bool merge_old_entry(ObjectStore::Transaction& t, Log::Entry& oe);
   void merge_log(ObjectStore::Transaction& t, Info &oinfo, Log &olog, int from);
+  void start_backfill(ObjectStore::Transaction& t, Info &oinfo, Log &olog);
+  /// primary: can pi only be brought up to date by backfill?
+  bool needs_backfill(const Info& pi) const {
+    return pi.is_backfilling() || (!log.backlog && pi.last_update < log.tail);
+  }
   bool search_for_missing(const Info &oinfo, const Missing *omissing,
 			  int fromosd);
 
@@ -1475,6 +1597,8 @@ public:
   }
 
   virtual void clean_up_local(ObjectStore::Transaction& t) = 0;
+  virtual void remove_object_with_snap_hardlinks(ObjectStore::Transaction& t,
+						 const hobject_t& soid) = 0;
 
   virtual int start_recovery_ops(int max) = 0;
 
@@ -1502,11 +1626,28 @@ public:
   // -- scrub --
   set<int> scrub_reserved_peers;
   map<int,ScrubMap> scrub_received_maps;
-  bool finalizing_scrub; 
+  bool finalizing_scrub;   // a chunk is being scrubbed; writes to it wait
   bool scrub_reserved, scrub_reserve_failed;
   int scrub_waiting_on;
   epoch_t scrub_epoch_start;
   ScrubMap primary_scrubmap;
+  // the chunk, as a [start, end) range of backfill keys; end is 0 until
+  // the first chunk is picked
+  uint64_t scrub_start, scrub_end;
+  eversion_t scrub_chunk_version;  // chunk writes up to here must be applied
+  eversion_t scrub_begin_version;  // last_update when the scrub started
+  bool scrub_deep;
+  int scrub_errors, scrub_fixed;
+  object_stat_collection_t scrub_cstat;  // summed over the chunks so far
+
+  bool scrub_blocks(const hobject_t& soid) const {
+    if (!finalizing_scrub)
+      return false;
+    uint64_t key = backfill_key(soid);
+    return key >= scrub_start && key < scrub_end;
+  }
+  bool list_chunk(uint64_t pos, int max, vector<hobject_t>& ls, uint64_t *end);
+  void list_range(uint64_t start, uint64_t end, vector<hobject_t>& ls);
 
   void repair_object(const hobject_t& soid, ScrubMap::object *po, int bad_peer, int ok_peer);
   bool _compare_scrub_objects(ScrubMap::object &auth,
@@ -1521,11 +1662,14 @@ public:
   void scrub_finalize();
   void scrub_clear_state();
   bool scrub_gather_replica_maps();
-  void _scan_list(ScrubMap &map, vector<hobject_t> &ls);
+  void _scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep);
+  int read_clone(const hobject_t& soid, const SnapSet& snapset,
+		 uint64_t off, uint64_t len, bufferlist& bl, int flags = 0);
   void _request_scrub_map(int replica, eversion_t version);
-  void build_scrub_map(ScrubMap &map);
-  void build_inc_scrub_map(ScrubMap &map, eversion_t v);
+  void build_scrub_map(ScrubMap &map, uint64_t start, uint64_t end, bool deep);
+  void build_inc_scrub_map(ScrubMap &map, eversion_t v, uint64_t start, uint64_t end);
   virtual int _scrub(ScrubMap &map, int& errors, int& fixed) { return 0; }
+  virtual void _scrub_finish(int& errors, int& fixed) { }
   void clear_scrub_reserved();
   void scrub_reserve_replicas();
   void scrub_unreserve_replicas();
@@ -1546,10 +1690,12 @@ public:
     ref(0), deleting(false), dirty_info(false), dirty_log(false),
     info(p), coll(p), log_oid(loid), biginfo_oid(ioid),
     recovery_item(this), backlog_item(this), scrub_item(this), scrub_finalize_item(this), snap_trim_item(this), remove_item(this), stat_queue_item(this),
+    agent_item(this), peering_item(this),
     recovery_ops_active(0),
     generate_backlog_epoch(0),
     role(0),
     state(0),
+    acting_features(0),
     have_master_log(true),
     recovery_state(this),
     need_up_thru(false),
@@ -1559,7 +1705,9 @@ public:
     finish_sync_event(NULL),
     finalizing_scrub(false),
     scrub_reserved(false), scrub_reserve_failed(false),
-    scrub_waiting_on(0)
+    scrub_waiting_on(0),
+    scrub_start(0), scrub_end(0), scrub_deep(false),
+    scrub_errors(0), scrub_fixed(0)
   {
     pool->get();
   }
@@ -1614,7 +1762,8 @@ public:
   void read_log(ObjectStore *store);
   bool check_log_for_corruption(ObjectStore *store);
   void trim(ObjectStore::Transaction& t, eversion_t v);
-  void trim_ondisklog(ObjectStore::Transaction& t);
+  void trim_ondisklog(ObjectStore::Transaction& t, const set<string>& trimmed_keys);
+  void write_ondisklog(ObjectStore::Transaction& t);
   void trim_peers();
 
   std::string get_corrupt_pg_log_name() const;
@@ -1685,6 +1834,8 @@ public:
   virtual void do_sub_op(MOSDSubOp *op) = 0;
   virtual void do_sub_op_reply(MOSDSubOpReply *op) = 0;
   virtual bool snap_trimmer() = 0;
+  /// cache tier: flush and evict some objects (takes the pg lock; puts us)
+  virtual void agent_work() = 0;
 
   virtual bool same_for_read_since(epoch_t e) = 0;
   virtual bool same_for_modify_since(epoch_t e) = 0;
@@ -1738,6 +1889,8 @@ inline ostream& operator<<(ostream& out, const PG::Info& pgi)
     out << " (" << pgi.log_tail << "," << pgi.last_update << "]"
         << (pgi.log_backlog ? "+backlog":"");
   }
+  if (pgi.is_backfilling())
+    out << " lb " << std::hex << pgi.last_backfill << std::dec;
   //out << " c " << pgi.epoch_created;
   out << " n=" << pgi.stats.stats.sum.num_objects;
   out << " " << pgi.history
@@ -1756,8 +1909,11 @@ inline ostream& operator<<(ostream& out, const PG::Query& q)
 
 inline ostream& operator<<(ostream& out, const PG::Log::Entry& e)
 {
-  return out << e.version << " (" << e.prior_version << ") "
-             << e.get_op_name() << ' ' << e.soid << " by " << e.reqid << " " << e.mtime;
+  out << e.version << " (" << e.prior_version << ") "
+      << e.get_op_name() << ' ' << e.soid << " by " << e.reqid << " " << e.mtime;
+  if (e.dirty_known)
+    out << " dirty " << e.dirty;
+  return out;
 }
 
 inline ostream& operator<<(ostream& out, const PG::Log& log) 
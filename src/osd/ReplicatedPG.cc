@@ -17,7 +17,9 @@
 #include "PGLS.h"
 
 #include "common/errno.h"
+#include "common/Finisher.h"
 #include "common/perf_counters.h"
+#include "common/Tracer.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
@@ -36,6 +38,8 @@
 
 #include "mds/inode_backtrace.h" // Ugh
 
+#include "osdc/Objecter.h"
+
 #include "common/config.h"
 
 #define DOUT_SUBSYS osd
@@ -91,7 +95,7 @@ bool ReplicatedPG::same_for_rep_modify_since(epoch_t e)
 
 bool ReplicatedPG::is_missing_object(const hobject_t& soid)
 {
-  return missing.missing.count(soid);
+  return missing.is_missing(soid);
 }
 
 void ReplicatedPG::wait_for_missing_object(const hobject_t& soid, Message *m)
@@ -99,7 +103,7 @@ void ReplicatedPG::wait_for_missing_object(const hobject_t& soid, Message *m)
   assert(is_missing_object(soid));
 
   // we don't have it (yet).
-  map<hobject_t, Missing::item>::const_iterator g = missing.missing.find(soid);
+  Missing::item_map::const_iterator g = missing.missing.find(soid);
   assert(g != missing.missing.end());
   const eversion_t &v(g->second.need);
 
@@ -119,17 +123,36 @@ void ReplicatedPG::wait_for_missing_object(const hobject_t& soid, Message *m)
 
 bool ReplicatedPG::is_degraded_object(const hobject_t& soid)
 {
-  if (missing.missing.count(soid))
+  if (missing.is_missing(soid))
     return true;
   for (unsigned i = 1; i < acting.size(); i++) {
-    int peer = acting[i];
-    if (peer_missing.count(peer) &&
-	peer_missing[peer].missing.count(soid))
+    map<int, Missing>::const_iterator pm = peer_missing.find(acting[i]);
+    if (pm != peer_missing.end() &&
+	pm->second.is_missing(soid))
       return true;
   }
   return false;
 }
 
+/*
+ * A replica may serve a read only if it has the object and every update
+ * to it we have applied is committed on the whole acting set; anything
+ * newer could still be rolled back if the primary fails.  Our view of
+ * what is committed is the primary's min_last_complete_ondisk, as of its
+ * last sub op, so this errs toward sending reads to the primary.
+ */
+bool ReplicatedPG::can_serve_replica_read(const hobject_t& oid)
+{
+  if (!is_active() || is_missing_object(oid))
+    return false;
+  if (info.is_backfilling() && backfill_key(oid) >= info.last_backfill)
+    return false;
+  hash_map<hobject_t,Log::Entry*>::const_iterator p = log.objects.find(oid);
+  if (p != log.objects.end() && p->second->version > min_last_complete_ondisk)
+    return false;
+  return true;
+}
+
 void ReplicatedPG::wait_for_degraded_object(const hobject_t& soid, Message *m)
 {
   assert(is_degraded_object(soid));
@@ -286,6 +309,7 @@ void ReplicatedPG::do_pg_op(MOSDOp *op)
 	    }
 	    sentries.push_back(mp->second);
 	    response.handle.index = mp->first + 1;
+	    ++mp;
 	  }
 	}
 	if (sentries.size() < p->op.pgls.count &&
@@ -378,7 +402,8 @@ void ReplicatedPG::calc_trim_to()
 }
 
 ReplicatedPG::ReplicatedPG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& oid, const hobject_t& ioid) : 
-  PG(o, _pool, p, oid, ioid), snap_trimmer_machine(this)
+  PG(o, _pool, p, oid, ioid), coalesce_retry(NULL), last_tier_seq(0),
+  snap_trimmer_machine(this)
 { 
   snap_trimmer_machine.initiate();
 }
@@ -390,6 +415,15 @@ void ReplicatedPG::get_src_oloc(const object_t& oid, const object_locator_t& olo
     src_oloc.key = oid.name;
 }
 
+hobject_t ReplicatedPG::get_src_hobj(MOSDOp *op, const OSDOp& osd_op, object_locator_t *src_oloc)
+{
+  object_locator_t oloc;
+  get_src_oloc(op->get_oid(), op->get_object_locator(), oloc);
+  if (src_oloc)
+    *src_oloc = oloc;
+  return hobject_t(osd_op.soid, oloc.key, op->get_pg().ps());
+}
+
 /** do_op - do an op
  * pg lock will be held (if multithreaded)
  * osd_lock NOT held.
@@ -400,26 +434,80 @@ void ReplicatedPG::do_op(MOSDOp *op)
     return do_pg_op(op);
 
   dout(10) << "do_op " << *op << (op->may_write() ? " may_write" : "") << dendl;
+  g_ceph_context->get_tracer()->record(op->get_trace_id(), "osd_do_op");
 
-  if (finalizing_scrub && op->may_write()) {
+  hobject_t head(op->get_oid(), op->get_object_locator().key,
+		 CEPH_NOSNAP, op->get_pg().ps());
+
+  if (op->may_write() && scrub_blocks(head)) {
     dout(20) << __func__ << ": waiting for scrub" << dendl;
     waiting_for_active.push_back(op);
     return;
   }
 
+  // balanced/localized read on a replica that can't serve it?  send
+  // the client back to the primary rather than making it wait here.
+  if (!is_primary() &&
+      (op->get_flags() & (CEPH_OSD_FLAG_BALANCE_READS |
+			  CEPH_OSD_FLAG_LOCALIZE_READS)) &&
+      !can_serve_replica_read(head)) {
+    dout(10) << "do_op " << head << " not readable on replica, -EAGAIN" << dendl;
+    osd->reply_op_error(op, -EAGAIN);
+    return;
+  }
+
   // missing object?
-  hobject_t head(op->get_oid(), op->get_object_locator().key,
-		 CEPH_NOSNAP, op->get_pg().ps());
   if (is_missing_object(head)) {
     wait_for_missing_object(head, op);
     return;
   }
 
+  // list_snaps reports each clone's snaps from the clone itself
+  for (vector<OSDOp>::iterator p = op->ops.begin(); p != op->ops.end(); ++p) {
+    if (p->op.op != CEPH_OSD_OP_LIST_SNAPS)
+      continue;
+    SnapSetContext *ssc = get_snapset_context(head.oid, head.get_key(), head.hash, false);
+    if (!ssc)
+      break;
+    hobject_t missing_clone;
+    for (vector<snapid_t>::const_iterator q = ssc->snapset.clones.begin();
+	 q != ssc->snapset.clones.end();
+	 ++q) {
+      hobject_t coid(head.oid, head.get_key(), *q, head.hash);
+      if (is_missing_object(coid)) {
+	missing_clone = coid;
+	break;
+      }
+    }
+    put_snapset_context(ssc);
+    if (missing_clone != hobject_t()) {
+      if (!is_primary()) {
+	dout(10) << "do_op list_snaps " << missing_clone << " missing on replica, -EAGAIN" << dendl;
+	osd->reply_op_error(op, -EAGAIN);
+      } else {
+	wait_for_missing_object(missing_clone, op);
+      }
+      return;
+    }
+    break;
+  }
+
   // degraded object?
   if (op->may_write() && is_degraded_object(head)) {
     wait_for_degraded_object(head, op);
     return;
   }
+
+  // cache pool miss?
+  if (pool->info.is_cache() && op->get_snapid() == CEPH_NOSNAP) {
+    if (op->may_write() && !op->get_snaps().empty()) {
+      dout(10) << "do_op no snapshots in cache pools" << dendl;
+      osd->reply_op_error(op, -EOPNOTSUPP);
+      return;
+    }
+    if (maybe_promote(op, head))
+      return;
+  }
  
   entity_inst_t client = op->get_source_inst();
 
@@ -436,7 +524,7 @@ void ReplicatedPG::do_op(MOSDOp *op)
       // If we're not the primary of this OSD, and we have
       // CEPH_OSD_FLAG_LOCALIZE_READS set, we just return -EAGAIN. Otherwise,
       // we have to wait for the object.
-      if (is_primary() || (!(op->get_rmw_flags() & CEPH_OSD_FLAG_LOCALIZE_READS))) {
+      if (is_primary() || (!(op->get_flags() & CEPH_OSD_FLAG_LOCALIZE_READS))) {
 	// missing the specific snap we need; requeue and wait.
 	assert(!can_create); // only happens on a read
 	hobject_t soid(op->get_oid(), op->get_object_locator().key,
@@ -496,13 +584,17 @@ void ReplicatedPG::do_op(MOSDOp *op)
 
   dout(10) << "do_op mode now " << mode << dendl;
 
+  if (g_conf->osd_fast_read && can_fast_read(op, obc)) {
+    do_fast_read(op, obc);
+    return;
+  }
+
   // src_oids
   map<hobject_t,ObjectContext*> src_obc;
   for (vector<OSDOp>::iterator p = op->ops.begin(); p != op->ops.end(); p++) {
     OSDOp& osd_op = *p;
     object_locator_t src_oloc;
-    get_src_oloc(op->get_oid(), op->get_object_locator(), src_oloc);
-    hobject_t toid(osd_op.soid, src_oloc.key, op->get_pg().ps());
+    hobject_t toid = get_src_hobj(op, osd_op, &src_oloc);
     if (osd_op.soid.oid.name.length()) {
       if (!src_obc.count(toid)) {
 	ObjectContext *sobc;
@@ -543,12 +635,18 @@ void ReplicatedPG::do_op(MOSDOp *op)
     return;
   }
 
+  unsigned nops = op->ops.size();
+  list<MOSDOp*> merged;
+  if (op != coalesce_retry)
+    coalesce_writes(op, merged);
+
   const hobject_t& soid = obc->obs.oi.soid;
   OpContext *ctx = new OpContext(op, op->get_reqid(), op->ops,
 				 &obc->obs, obc->ssc, 
 				 this);
   ctx->obc = obc;
   ctx->src_obc = src_obc;
+  ctx->coalesced.swap(merged);
 
   if (op->may_write()) {
     // snap
@@ -565,6 +663,7 @@ void ReplicatedPG::do_op(MOSDOp *op)
       dout(10) << " ORDERSNAP flag set and snapc seq " << ctx->snapc.seq
 	       << " < snapset seq " << obc->ssc->snapset.seq
 	       << " on " << soid << dendl;
+      uncoalesce_writes(op, nops, ctx->coalesced);
       delete ctx;
       put_object_context(obc);
       put_object_contexts(src_obc);
@@ -575,6 +674,7 @@ void ReplicatedPG::do_op(MOSDOp *op)
     eversion_t oldv = log.get_request_version(ctx->reqid);
     if (oldv != eversion_t()) {
       dout(3) << "do_op dup " << ctx->reqid << " was " << oldv << dendl;
+      uncoalesce_writes(op, nops, ctx->coalesced);
       delete ctx;
       put_object_context(obc);
       put_object_contexts(src_obc);
@@ -596,6 +696,8 @@ void ReplicatedPG::do_op(MOSDOp *op)
     assert(ctx->at_version > log.head);
 
     ctx->mtime = op->get_mtime();
+    if (!ctx->coalesced.empty())
+      ctx->mtime = ctx->coalesced.back()->get_mtime();
     
     dout(10) << "do_op " << soid << " " << ctx->ops
 	     << " ov " << obc->obs.oi.version << " av " << ctx->at_version 
@@ -637,6 +739,23 @@ void ReplicatedPG::do_op(MOSDOp *op)
     p->second->ondisk_read_unlock();
   }
 
+  if (!ctx->coalesced.empty()) {
+    if (result < 0) {
+      // we can't tell whose write failed; run them one at a time
+      dout(10) << "do_op coalesced writes got " << result
+	       << ", retrying " << *op << " alone" << dendl;
+      uncoalesce_writes(op, nops, ctx->coalesced);
+      delete ctx;
+      put_object_context(obc);
+      put_object_contexts(src_obc);
+      coalesce_retry = op;
+      do_op(op);
+      coalesce_retry = NULL;
+      return;
+    }
+    op->ops.resize(nops);  // the reply is for our own ops
+  }
+
   if (result == -EAGAIN) {
     // clean up after the ctx
     delete ctx;
@@ -693,12 +812,299 @@ void ReplicatedPG::do_op(MOSDOp *op)
   repop->put();
 }
 
+/*
+ * Small writes from one client to one object tend to queue up behind
+ * each other (e.g. a journal or a log appended to in small pieces).
+ * Rather than a transaction, log entry, and round of sub ops each, the
+ * plain writes waiting right behind op are folded into it: their ops
+ * are appended to op's, and they ride along in ctx->coalesced to get
+ * their own log entries (prepare_transaction) and replies
+ * (reply_coalesced).  Anything beyond plain writes (and the allocation
+ * hints librbd sends with them) with the same snap context and flags is
+ * left alone.
+ */
+static bool is_coalescable_op(const OSDOp& osd_op)
+{
+  if (osd_op.soid.oid.name.length())
+    return false;
+  return osd_op.op.op == CEPH_OSD_OP_WRITE ||
+    osd_op.op.op == CEPH_OSD_OP_SETALLOCHINT;
+}
+
+static uint64_t coalesced_bytes(const vector<OSDOp>& ops)
+{
+  uint64_t bytes = 0;
+  for (vector<OSDOp>::const_iterator p = ops.begin(); p != ops.end(); ++p)
+    if (p->op.op == CEPH_OSD_OP_WRITE)
+      bytes += p->op.extent.length;
+  return bytes;
+}
+
+bool ReplicatedPG::can_coalesce(MOSDOp *op, MOSDOp *m)
+{
+  if (m->get_source() != op->get_source() ||
+      m->get_oid() != op->get_oid() ||
+      m->get_object_locator() != op->get_object_locator() ||
+      m->get_snapid() != op->get_snapid() ||
+      m->get_flags() != op->get_flags() ||
+      m->get_snap_seq() != op->get_snap_seq() ||
+      m->get_snaps() != op->get_snaps())
+    return false;
+  for (vector<OSDOp>::iterator p = m->ops.begin(); p != m->ops.end(); ++p)
+    if (!is_coalescable_op(*p))
+      return false;
+  // a resend must go down the dup path
+  return log.get_request_version(m->get_reqid()) == eversion_t();
+}
+
+void ReplicatedPG::coalesce_writes(MOSDOp *op, list<MOSDOp*>& merged)
+{
+  int max_ops = g_conf->osd_coalesce_max_ops;
+  if (max_ops <= 1 || !is_primary() || op_queue.empty() ||
+      !op->may_write() || op->may_read() ||
+      (op->get_flags() & (CEPH_OSD_FLAG_PARALLELEXEC | CEPH_OSD_FLAG_PGOP)))
+    return;
+  for (vector<OSDOp>::iterator p = op->ops.begin(); p != op->ops.end(); ++p)
+    if (!is_coalescable_op(*p))
+      return;
+  uint64_t bytes = coalesced_bytes(op->ops);
+
+  int n = 1;
+  while (n < max_ops && !op_queue.empty() &&
+	 op_queue.front()->get_type() == CEPH_MSG_OSD_OP) {
+    MOSDOp *m = (MOSDOp*)op_queue.front();
+    if (!can_coalesce(op, m))
+      break;
+    uint64_t mbytes = coalesced_bytes(m->ops);
+    if (bytes + mbytes > g_conf->osd_coalesce_max_bytes)
+      break;
+    bytes += mbytes;
+    n++;
+
+    // dequeue_op will find one less op on our queue than it queued for
+    // us; it copes
+    op_queue.pop_front();
+    m->mark_stage(OSD_OP_STAGE_STARTED, ceph_clock_now(g_ceph_context));
+    op->ops.insert(op->ops.end(), m->ops.begin(), m->ops.end());
+    merged.push_back(m);
+  }
+  if (!merged.empty())
+    dout(10) << "coalesce_writes merged " << merged.size() << " writes ("
+	     << bytes << " bytes) into " << *op << dendl;
+}
+
+/// undo coalesce_writes: give op its own ops back, and requeue the rest
+void ReplicatedPG::uncoalesce_writes(MOSDOp *op, unsigned nops, list<MOSDOp*>& merged)
+{
+  if (merged.empty())
+    return;
+  op->ops.resize(nops);
+  op_queue.insert(op_queue.begin(), merged.begin(), merged.end());
+  merged.clear();
+}
+
+/*
+ * reply to the writes coalesced into repop's op, as eval_repop does
+ * for the op itself: ondisk when committed everywhere (if wanted), an
+ * ack before that when applied everywhere.
+ */
+void ReplicatedPG::reply_coalesced(RepGather *repop)
+{
+  OpContext *ctx = repop->ctx;
+  bool ondisk = repop->waitfor_disk.empty();
+  bool ack = repop->waitfor_ack.empty() && !ctx->coalesced_acked;
+  if (ack)
+    ctx->coalesced_acked = true;
+
+  list<MOSDOp*>::iterator p = ctx->coalesced.begin();
+  while (p != ctx->coalesced.end()) {
+    MOSDOp *m = *p;
+    int flags = 0;
+    if (ondisk && m->wants_ondisk())
+      flags = CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK;
+    else if (ack && m->wants_ack())
+      flags = CEPH_OSD_FLAG_ACK;
+    if (flags) {
+      MOSDOpReply *reply = new MOSDOpReply(m, 0, osd->osdmap->get_epoch(), flags);
+      reply->set_version(ctx->coalesced_versions[m]);
+      dout(10) << " sending " << ((flags & CEPH_OSD_FLAG_ONDISK) ? "commit" : "ack")
+	       << " to coalesced " << *m << dendl;
+      osd->client_messenger->send_message(reply, m->get_connection());
+    }
+    // done with it?
+    if ((flags & CEPH_OSD_FLAG_ONDISK) ||
+	(flags && !m->wants_ondisk()) ||
+	(!m->wants_ondisk() && !m->wants_ack())) {
+      m->put();
+      ctx->coalesced.erase(p++);
+    } else {
+      ++p;
+    }
+  }
+}
+
+
+/*
+ * Plain reads and getxattrs of an existing object don't need the
+ * transaction machinery, or the pg lock while they wait on the disk.
+ * do_fast_read drops the pg lock around the store calls, holding only
+ * the object's ondisk_read_lock, so reads of other objects in the pg
+ * (and anything else that needs the pg) can proceed meanwhile.
+ *
+ * Reads that must be ordered with respect to writes should set
+ * CEPH_OSD_FLAG_RWORDERED; those take the normal path.
+ */
+bool ReplicatedPG::can_fast_read(MOSDOp *op, ObjectContext *obc)
+{
+  if (op->may_write() || op->may_exec() ||
+      (op->get_flags() & CEPH_OSD_FLAG_RWORDERED))
+    return false;
+  // sparse clones read through other objects
+  if (is_sparse_clone(obc->obs.oi.soid))
+    return false;
+  for (vector<OSDOp>::iterator p = op->ops.begin(); p != op->ops.end(); ++p) {
+    if (p->soid.oid.name.length())
+      return false;
+    switch (p->op.op) {
+    case CEPH_OSD_OP_READ:
+      // trimming at a newer truncate point is left to do_osd_ops
+      if (obc->obs.oi.truncate_seq < p->op.extent.truncate_seq)
+	return false;
+      break;
+    case CEPH_OSD_OP_GETXATTR:
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+void ReplicatedPG::do_fast_read(MOSDOp *op, ObjectContext *obc)
+{
+  // writers may update obc->obs while we're unlocked; work from a copy.
+  // our ref keeps obc itself around.
+  object_info_t oi = obc->obs.oi;
+  dout(10) << "do_fast_read " << oi.soid << " " << op->ops << dendl;
+
+  bufferlist outdata;
+  uint64_t data_off = 0;
+  obc->ondisk_read_lock();
+  unlock();
+  int result = do_fast_read_ops(op->ops, oi, outdata, &data_off);
+  // drop this first: a writer may be waiting for it with the pg locked
+  obc->ondisk_read_unlock();
+  lock();
+
+  dout(10) << "do_fast_read " << oi.soid << " = " << result
+	   << ", " << outdata.length() << " bytes" << dendl;
+
+  OpContext *ctx = new OpContext(op, op->get_reqid(), op->ops,
+				 &obc->obs, obc->ssc, this);
+  ctx->bytes_read = outdata.length();
+  log_op_stats(ctx);
+  delete ctx;
+
+  MOSDOpReply *reply = new MOSDOpReply(op, 0, osd->osdmap->get_epoch(), 0);
+  reply->set_data(outdata);
+  reply->get_header().data_off = data_off;
+  reply->set_result(result);
+  reply->set_version(info.last_update);
+  reply->add_flags(CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK);
+  osd->client_messenger->send_message(reply, op->get_connection());
+  op->put();
+  put_object_context(obc);
+}
+
+/*
+ * runs without the pg lock: only touch the store, the ops and oi.  note
+ * that this means no dout either, since our prefix prints the pg.
+ */
+int ReplicatedPG::do_fast_read_ops(vector<OSDOp>& ops, const object_info_t& oi,
+				   bufferlist& odata, uint64_t *data_off)
+{
+  const hobject_t& soid = oi.soid;
+  int result = 0;
+
+  for (vector<OSDOp>::iterator p = ops.begin(); p != ops.end() && result >= 0; ++p) {
+    ceph_osd_op& op = p->op;
+    bufferlist::iterator bp = p->data.begin();
+
+    switch (op.op) {
+    case CEPH_OSD_OP_READ:
+      {
+	bufferlist bl;
+	int r;
+	uint64_t want = op.extent.length ? op.extent.length : oi.size;
+	if (is_sparse_clone(soid))
+	  r = read_object(soid, op.extent.offset, op.extent.length, bl, op.flags);
+	else if (g_conf->osd_read_zero_copy_min && want >= (uint64_t)g_conf->osd_read_zero_copy_min &&
+		 soid.snap != CEPH_NOSNAP)  // sent later; only clones stay as they are
+	  r = osd->store->read_zero_copy(coll, soid, op.extent.offset, op.extent.length, bl,
+					 op.flags);
+	else
+	  r = osd->store->read(coll, soid, op.extent.offset, op.extent.length, bl, op.flags);
+	if (odata.length() == 0)
+	  *data_off = op.extent.offset;
+	odata.claim_append(bl);
+	if (r >= 0)
+	  op.extent.length = r;
+	else {
+	  result = r;
+	  op.extent.length = 0;
+	}
+      }
+      break;
+
+    case CEPH_OSD_OP_GETXATTR:
+      {
+	string aname;
+	bp.copy(op.xattr.name_len, aname);
+	string name = "_" + aname;
+	int r = osd->store->getattr(coll, soid, name.c_str(), odata);
+	if (r >= 0)
+	  op.xattr.value_len = r;
+	else
+	  result = r;
+      }
+      break;
+
+    default:
+      assert(0 == "can_fast_read let through an op we can't do");
+    }
+
+    if (result < 0 && (op.flags & CEPH_OSD_OP_FLAG_FAILOK))
+      result = 0;
+  }
+  return result;
+}
+
+static uint64_t to_usec(utime_t d)
+{
+  double us = (double)d * 1000000.0;
+  return us > 0 ? (uint64_t)us : 0;
+}
+
+/// usec from stage a to stage b, or -1 if the op skipped either
+static int64_t stage_usec(MOSDOp *op, int a, int b)
+{
+  if (!op->reached_stage(a) || !op->reached_stage(b))
+    return -1;
+  utime_t d = op->stage_stamp[b];
+  d -= op->stage_stamp[a];
+  return to_usec(d);
+}
 
 void ReplicatedPG::log_op_stats(OpContext *ctx)
 {
   MOSDOp *op = (MOSDOp*)ctx->op;
 
+  // eval_repop gets here again on every later ack
+  if (op->reached_stage(OSD_OP_STAGE_REPLIED))
+    return;
+
   utime_t now = ceph_clock_now(g_ceph_context);
+  op->mark_stage(OSD_OP_STAGE_REPLIED, now);
   utime_t latency = now;
   latency -= ctx->op->get_recv_stamp();
 
@@ -716,6 +1122,27 @@ void ReplicatedPG::log_op_stats(OpContext *ctx)
   osd->logger->inc(l_osd_op_outb, outb);
   osd->logger->inc(l_osd_op_inb, inb);
   osd->logger->fset(l_osd_op_lat, latency);
+  osd->op_sched.client_op(inb + outb, latency);
+
+  uint64_t lat_usec = to_usec(latency);
+  osd->logger->hinc(l_osd_op_lat_hist, lat_usec);
+  if (op->reached_stage(OSD_OP_STAGE_STARTED)) {
+    utime_t wait = op->stage_stamp[OSD_OP_STAGE_STARTED];
+    wait -= op->get_recv_stamp();
+    osd->logger->hinc(l_osd_op_wait_hist, to_usec(wait));
+  }
+  static const int stage_hists[][3] = {
+    { OSD_OP_STAGE_STARTED, OSD_OP_STAGE_SUBMITTED, l_osd_op_prepare_hist },
+    { OSD_OP_STAGE_SUBMITTED, OSD_OP_STAGE_COMMITTED, l_osd_op_commit_hist },
+    { OSD_OP_STAGE_SUBMITTED, OSD_OP_STAGE_APPLIED, l_osd_op_apply_hist },
+    { OSD_OP_STAGE_SUBMITTED, OSD_OP_STAGE_REPLICATED, l_osd_op_repl_hist },
+  };
+  for (unsigned i = 0; i < sizeof(stage_hists) / sizeof(stage_hists[0]); i++) {
+    int64_t us = stage_usec(op, stage_hists[i][0], stage_hists[i][1]);
+    if (us >= 0)
+      osd->logger->hinc(stage_hists[i][2], us);
+  }
+  osd->op_history.add(op, now);
 
   if (op->may_read() && op->may_write()) {
     osd->logger->inc(l_osd_op_rw);
@@ -723,15 +1150,18 @@ void ReplicatedPG::log_op_stats(OpContext *ctx)
     osd->logger->inc(l_osd_op_rw_outb, outb);
     osd->logger->fset(l_osd_op_rw_rlat, rlatency);
     osd->logger->fset(l_osd_op_rw_lat, latency);
+    osd->logger->hinc(l_osd_op_rw_lat_hist, lat_usec);
   } else if (op->may_read()) {
     osd->logger->inc(l_osd_op_r);
     osd->logger->inc(l_osd_op_r_outb, outb);
     osd->logger->fset(l_osd_op_r_lat, latency);
+    osd->logger->hinc(l_osd_op_r_lat_hist, lat_usec);
   } else if (op->may_write()) {
     osd->logger->inc(l_osd_op_w);
     osd->logger->inc(l_osd_op_w_inb, inb);
     osd->logger->fset(l_osd_op_w_rlat, rlatency);
     osd->logger->fset(l_osd_op_w_lat, latency);
+    osd->logger->hinc(l_osd_op_w_lat_hist, lat_usec);
   } else
     assert(0);
 
@@ -789,6 +1219,9 @@ void ReplicatedPG::do_sub_op(MOSDSubOp *op)
     case CEPH_OSD_OP_SCRUB_MAP:
       sub_op_scrub_map(op);
       return;
+    case CEPH_OSD_OP_BACKFILL_PROGRESS:
+      sub_op_backfill_progress(op);
+      return;
     }
   }
 
@@ -900,6 +1333,23 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
   if (newsnaps.empty()) {
     // remove clone
     dout(10) << coid << " snaps " << snaps << " -> " << newsnaps << " ... deleting" << dendl;
+
+    // a sparse next older clone reads what it shares with us through us;
+    // copy in what it won't find past us
+    vector<snapid_t>::iterator q = find(snapset.clones.begin(), snapset.clones.end(), coid.snap);
+    if (q != snapset.clones.begin() && q != snapset.clones.end() &&
+	snapset.is_sparse(*(q - 1))) {
+      hobject_t older = coid;
+      older.snap = *(q - 1);
+      interval_set<uint64_t> copy = snapset.clone_overlap[older.snap];
+      interval_set<uint64_t> still;
+      still.intersection_of(copy, snapset.clone_overlap[coid.snap]);
+      copy.subtract(still);
+      for (interval_set<uint64_t>::const_iterator i = copy.begin(); i != copy.end(); ++i)
+	t->clone_range(coll, coid, older, i.get_start(), i.get_len(), i.get_start());
+      dout(10) << coid << " copied " << copy << " into sparse " << older << dendl;
+    }
+
     t->remove(coll, coid);
     t->collection_remove(coll_t(info.pgid, snaps[0]), coid);
     if (snaps.size() > 1)
@@ -931,6 +1381,7 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
     snapset.clones.erase(p);
     snapset.clone_overlap.erase(last);
     snapset.clone_size.erase(last);
+    snapset.sparse_clones.erase(last);
 	
     ctx->log.push_back(Log::Entry(Log::Entry::DELETE, coid, ctx->at_version, ctx->obs->oi.version,
 				  osd_reqid_t(), ctx->mtime));
@@ -1100,17 +1551,17 @@ void ReplicatedPG::dump_watchers(ObjectContext *obc)
 {
   assert(osd->watch_lock.is_locked());
   
-  dout(0) << "dump_watchers " << obc->obs.oi.soid << " " << obc->obs.oi << dendl;
+  dout(20) << "dump_watchers " << obc->obs.oi.soid << " " << obc->obs.oi << dendl;
   for (map<entity_name_t, OSD::Session *>::iterator iter = obc->watchers.begin(); 
        iter != obc->watchers.end();
        ++iter)
-    dout(0) << " * obc->watcher: " << iter->first << " session=" << iter->second << dendl;
+    dout(20) << " * obc->watcher: " << iter->first << " session=" << iter->second << dendl;
   
   for (map<entity_name_t, watch_info_t>::iterator oi_iter = obc->obs.oi.watchers.begin();
        oi_iter != obc->obs.oi.watchers.end();
        oi_iter++) {
     watch_info_t& w = oi_iter->second;
-    dout(0) << " * oi->watcher: " << oi_iter->first << " cookie=" << w.cookie << dendl;
+    dout(20) << " * oi->watcher: " << oi_iter->first << " cookie=" << w.cookie << dendl;
   }
 }
 
@@ -1139,8 +1590,7 @@ void ReplicatedPG::remove_notify(ObjectContext *obc, Watch::Notification *notif)
   map<Watch::Notification *, bool>::iterator niter = obc->notifs.find(notif);
 
   // Cancel notification
-  if (notif->timeout)
-    osd->watch_timer.cancel_event(notif->timeout);
+  osd->watch->cancel_timeout(notif);
   osd->watch->remove_notification(notif);
 
   assert(niter != obc->notifs.end());
@@ -1158,6 +1608,11 @@ void ReplicatedPG::remove_watchers_and_notifies()
 
   dout(10) << "remove_watchers" << dendl;
 
+  // nothing may use cached contexts past a change, shutdown or removal.
+  // (doing this first also keeps the puts below from trimming entries
+  // we haven't visited yet.)
+  trim_object_context_cache(0);
+
   osd->watch_lock.Lock();
   for (map<hobject_t, ObjectContext*>::iterator oiter = object_contexts.begin();
        oiter != object_contexts.end();
@@ -1180,6 +1635,7 @@ void ReplicatedPG::remove_watchers_and_notifies()
     put_object_context(obc);
   }
   osd->watch_lock.Unlock();
+  trim_object_context_cache(0);
 }
 
 // ========================================================================
@@ -1221,9 +1677,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
 
     ObjectContext *src_obc = 0;
     if (ceph_osd_op_type_multi(op.op)) {
-      src_obc = ctx->src_obc[hobject_t(osd_op.soid, 
-				       ((MOSDOp *)ctx->op)->get_object_locator().key,
-				       soid.hash)];
+      src_obc = ctx->src_obc[get_src_hobj((MOSDOp *)ctx->op, osd_op)];
       assert(src_obc);
     }
 
@@ -1244,7 +1698,16 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
       {
 	// read into a buffer
 	bufferlist bl;
-	int r = osd->store->read(coll, soid, op.extent.offset, op.extent.length, bl);
+	int r;
+	uint64_t want = op.extent.length ? op.extent.length : oi.size;
+	if (is_sparse_clone(soid))
+	  r = read_object(soid, op.extent.offset, op.extent.length, bl, op.flags);
+	else if (g_conf->osd_read_zero_copy_min && want >= (uint64_t)g_conf->osd_read_zero_copy_min &&
+		 soid.snap != CEPH_NOSNAP)  // sent later; only clones stay as they are
+	  r = osd->store->read_zero_copy(coll, soid, op.extent.offset, op.extent.length, bl,
+					 op.flags);
+	else
+	  r = osd->store->read(coll, soid, op.extent.offset, op.extent.length, bl, op.flags);
 	if (odata.length() == 0)
 	  ctx->data_off = op.extent.offset;
 	odata.claim(bl);
@@ -1286,7 +1749,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
       {
 	// read into a buffer
 	bufferlist bl;
-	int r = osd->store->fiemap(coll, soid, op.extent.offset, op.extent.length, bl);
+	int r = fiemap_object(soid, op.extent.offset, op.extent.length, bl);
 /*
 	if (odata.length() == 0)
 	  ctx->data_off = op.extent.offset; */
@@ -1299,6 +1762,44 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
       }
       break;
 
+    case CEPH_OSD_OP_CHECKSUM:
+      {
+	// crc32c of off~len (0 for to the end), so that callers can tell
+	// whether they already have the data without moving it
+	if (!obs.exists) {
+	  result = -ENOENT;
+	  break;
+	}
+	uint64_t off = op.extent.offset;
+	uint64_t end = oi.size;
+	if (op.extent.length && off + op.extent.length < end)
+	  end = off + op.extent.length;
+	uint64_t chunk = MAX(g_conf->osd_checksum_chunk, 4096ull);
+	__u32 crc = -1;
+	while (off < end) {
+	  bufferlist bl;
+	  int r = read_object(soid, off, MIN(chunk, end - off), bl, op.flags);
+	  if (r < 0) {
+	    result = r;
+	    break;
+	  }
+	  if (r == 0)
+	    break;
+	  crc = bl.crc32c(crc);
+	  off += r;
+	}
+	if (result < 0)
+	  break;
+	uint64_t len = off > op.extent.offset ? off - op.extent.offset : 0;
+	::encode(crc, odata);
+	::encode(len, odata);
+	ctx->delta_stats.num_rd_kb += SHIFT_ROUND_UP(len, 10);
+	ctx->delta_stats.num_rd++;
+	dout(10) << " checksum " << op.extent.offset << "~" << len << " = " << crc
+		 << " on " << soid << dendl;
+      }
+      break;
+
     /* map extents */
     case CEPH_OSD_OP_SPARSE_READ:
       {
@@ -1307,34 +1808,12 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
           result = -EINVAL;
           break;
         }
-	// read into a buffer
-	bufferlist bl;
-        int total_read = 0;
-	int r = osd->store->fiemap(coll, soid, op.extent.offset, op.extent.length, bl);
-	if (r < 0)  {
-	  result = r;
-          break;
-	}
         map<uint64_t, uint64_t> m;
-        bufferlist::iterator iter = bl.begin();
-        ::decode(m, iter);
-        map<uint64_t, uint64_t>::iterator miter;
         bufferlist data_bl;
-        for (miter = m.begin(); miter != m.end(); ++miter) {
-          bufferlist tmpbl;
-          r = osd->store->read(coll, soid, miter->first, miter->second, tmpbl);
-          if (r < 0)
-            break;
-
-          if (r < (int)miter->second) /* this is usually happen when we get extent that exceeds the actual file size */
-            miter->second = r;
-          total_read += r;
-          dout(10) << "sparse-read " << miter->first << "@" << miter->second << dendl;
-	  data_bl.claim_append(tmpbl);
-        }
-
-        if (r < 0) {
-          result = r;
+	int total_read = sparse_read_object(soid, op.extent.offset, op.extent.length,
+					    m, data_bl, op.flags);
+        if (total_read < 0) {
+          result = total_read;
           break;
         }
 
@@ -1360,13 +1839,13 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
 	bp.copy(op.cls.indata_len, indata);
 
 	ClassHandler::ClassData *cls;
-	int result = osd->class_handler->open_class(cname, &cls);
+	result = osd->class_handler->open_class(cname, &cls);
 	assert(result == 0);
 
 	ClassHandler::ClassMethod *method = cls->get_method(mname.c_str());
 	if (!method) {
 	  dout(10) << "call method " << cname << "." << mname << " does not exist" << dendl;
-	  result = -EINVAL;
+	  result = -EOPNOTSUPP;
 	  break;
 	}
 
@@ -1377,7 +1856,10 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
 	bufferlist outdata;
 	dout(10) << "call method " << cname << "." << mname << dendl;
 	result = method->exec((cls_method_context_t)&ctx, indata, outdata);
-	dout(10) << "method called response length=" << outdata.length() << dendl;
+	dout(10) << "method called result " << result
+		 << " response length=" << outdata.length() << dendl;
+	if (result > 0)
+	  result = 0;   // methods may return their output length
 	op.extent.length = outdata.length();
 	odata.claim_append(outdata);
       }
@@ -1441,6 +1923,41 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
         odata.claim_append(bl);
       }
       break;
+
+    case CEPH_OSD_OP_COPY_GET:
+      // all of the object at once, for a cache tier to promote it
+      {
+	if (!obs.exists) {
+	  result = -ENOENT;
+	  break;
+	}
+	bufferlist data;
+	result = osd->store->read(coll, soid, 0, 0, data);
+	if (result < 0)
+	  break;
+	map<string,bufferptr> attrset;
+	result = osd->store->getattrs(coll, soid, attrset, true);
+	if (result < 0)
+	  break;
+	map<string,bufferlist> attrs, omap;
+	for (map<string,bufferptr>::iterator q = attrset.begin(); q != attrset.end(); ++q)
+	  attrs[q->first].push_back(q->second);
+	if (osd->store_has_omap) {
+	  result = osd->store->omap_get_range(coll, soid, string(), 0, &omap);
+	  if (result < 0)
+	    break;
+	}
+	result = 0;
+	__u8 v = 1;
+	::encode(v, odata);
+	::encode(oi.mtime, odata);
+	::encode(data, odata);
+	::encode(attrs, odata);
+	::encode(omap, odata);
+	ctx->delta_stats.num_rd_kb += SHIFT_ROUND_UP(data.length(), 10);
+	ctx->delta_stats.num_rd++;
+      }
+      break;
       
     case CEPH_OSD_OP_CMPXATTR:
     case CEPH_OSD_OP_SRC_CMPXATTR:
@@ -1512,6 +2029,59 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
 	break;
       }
 
+    case CEPH_OSD_OP_LIST_SNAPS:
+      {
+	obj_list_snap_response_t resp;
+	SnapSetContext *lssc = ssc;
+	if (!lssc)
+	  lssc = get_snapset_context(soid.oid, soid.get_key(), soid.hash, false);
+	if (!lssc) {
+	  result = -ENOENT;
+	  break;
+	}
+	const SnapSet& snapset = lssc->snapset;
+	resp.seq = snapset.seq;
+	for (vector<snapid_t>::const_iterator p = snapset.clones.begin();
+	     p != snapset.clones.end();
+	     ++p) {
+	  clone_info ci;
+	  ci.cloneid = *p;
+	  hobject_t coid(soid.oid, soid.get_key(), *p, soid.hash);
+	  ObjectContext *cobc = NULL;
+	  if (!missing.is_missing(coid))
+	    cobc = get_object_context(coid, oi.oloc, false);
+	  if (cobc) {
+	    ci.snaps.assign(cobc->obs.oi.snaps.rbegin(), cobc->obs.oi.snaps.rend());
+	    put_object_context(cobc);
+	  } else {
+	    // all we know for sure is the newest snap it covers
+	    ci.snaps.push_back(*p);
+	  }
+	  map<snapid_t, interval_set<uint64_t> >::const_iterator o = snapset.clone_overlap.find(*p);
+	  if (o != snapset.clone_overlap.end())
+	    for (interval_set<uint64_t>::const_iterator q = o->second.begin();
+		 q != o->second.end();
+		 ++q)
+	      ci.overlap.push_back(make_pair(q.get_start(), q.get_len()));
+	  map<snapid_t, uint64_t>::const_iterator z = snapset.clone_size.find(*p);
+	  if (z != snapset.clone_size.end())
+	    ci.size = z->second;
+	  resp.clones.push_back(ci);
+	}
+	if (snapset.head_exists && soid.snap == CEPH_NOSNAP && obs.exists) {
+	  clone_info ci;
+	  ci.cloneid = CEPH_NOSNAP;
+	  ci.size = oi.size;
+	  resp.clones.push_back(ci);
+	}
+	if (lssc != ssc)
+	  put_snapset_context(lssc);
+	::encode(resp, odata);
+	dout(10) << "list_snaps " << resp.clones.size() << " clones, seq " << resp.seq << dendl;
+	ctx->delta_stats.num_rd++;
+      }
+      break;
+
     case CEPH_OSD_OP_ASSERT_SRC_VERSION:
       {
 	uint64_t ver = op.watch.ver;
@@ -1587,6 +2157,8 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
 	  dout(10) << " truncate_seq " << op.extent.truncate_seq << " > current " << seq
 		   << ", truncating to " << op.extent.truncate_size << dendl;
 	  t.truncate(coll, soid, op.extent.truncate_size);
+	  if (oi.size > op.extent.truncate_size)
+	    ctx->mark_dirty(op.extent.truncate_size, oi.size - op.extent.truncate_size);
 	  oi.truncate_seq = op.extent.truncate_seq;
 	  oi.truncate_size = op.extent.truncate_size;
 	}
@@ -1594,6 +2166,9 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
 	  bufferlist nbl;
 	  bp.copy(op.extent.length, nbl);
 	  t.write(coll, soid, op.extent.offset, op.extent.length, nbl);
+	  if (op.flags & CEPH_OSD_OP_FLAG_FADVISE_MASK)
+	    ctx->local_t.fadvise(coll, soid, op.extent.offset, op.extent.length, op.flags);
+	  ctx->mark_dirty(op.extent.offset, op.extent.length);
         } else {
           t.touch(coll, soid);
         }
@@ -1612,6 +2187,9 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
 	else
 	  maybe_created = true;
 	t.write(coll, soid, op.extent.offset, op.extent.length, nbl);
+	if (op.flags & CEPH_OSD_OP_FLAG_FADVISE_MASK)
+	  ctx->local_t.fadvise(coll, soid, op.extent.offset, op.extent.length, op.flags);
+	ctx->mark_dirty(0, MAX(oi.size, op.extent.offset + op.extent.length));
 	if (ssc->snapset.clones.size() && oi.size > 0) {
 	  interval_set<uint64_t> ch;
 	  ch.insert(0, oi.size);
@@ -1634,11 +2212,24 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
       result = _rollback_to(ctx, op);
       break;
 
+    case CEPH_OSD_OP_SETALLOCHINT:
+      // only a new file can still be laid out well.  older replicas
+      // would assert on the transaction op; leave the hint out for them.
+      if (!obs.exists) {
+	t.touch(coll, soid);
+	if (acting_features & CEPH_FEATURE_OSD_ALLOCHINT)
+	  t.set_alloc_hint(coll, soid, op.alloc_hint.expected_object_size,
+			   op.alloc_hint.expected_write_size);
+	maybe_created = true;
+      }
+      break;
+
     case CEPH_OSD_OP_ZERO:
       { // zero
 	assert(op.extent.length);
 	if (obs.exists) {
 	  t.zero(coll, soid, op.extent.offset, op.extent.length);
+	  ctx->mark_dirty(op.extent.offset, op.extent.length);
 	  if (ssc->snapset.clones.size()) {
 	    interval_set<uint64_t> ch;
 	    ch.insert(op.extent.offset, op.extent.length);
@@ -1701,6 +2292,8 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
 	}
 
 	t.truncate(coll, soid, op.extent.offset);
+	if (oi.size > op.extent.offset)
+	  ctx->mark_dirty(op.extent.offset, oi.size - op.extent.offset);
 	if (ssc->snapset.clones.size()) {
 	  snapid_t newest = *ssc->snapset.clones.rbegin();
 	  interval_set<uint64_t> trim;
@@ -1747,12 +2340,70 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
 	t.clone_range(coll, src_obc->obs.oi.soid,
 		      obs.oi.soid, op.clonerange.src_offset,
 		      op.clonerange.length, op.clonerange.offset);
+	ctx->mark_dirty(op.clonerange.offset, op.clonerange.length);
 		      
 
 	write_update_size_and_usage(ctx->delta_stats, oi, ssc->snapset, ctx->modified_ranges,
 				    op.clonerange.offset, op.clonerange.length, false);
       }
       break;
+
+    case CEPH_OSD_OP_COPY_FROM:
+      {
+	// replace our data and user xattrs with the source's
+	const hobject_t& src = src_obc->obs.oi.soid;
+	if (src.oid == soid.oid) {
+	  result = -EINVAL;
+	  break;
+	}
+	dout(10) << " copy_from " << src << " size " << src_obc->obs.oi.size << dendl;
+	if (obs.exists) {
+	  t.remove(coll, soid);
+	  if (ssc->snapset.clones.size() && oi.size > 0) {
+	    interval_set<uint64_t> ch;
+	    ch.insert(0, oi.size);
+	    ctx->modified_ranges.union_of(ch);
+	  }
+	} else {
+	  maybe_created = true;
+	}
+	ctx->dirty_known = false;
+
+	// we read the source's data and xattrs straight from the store;
+	// make sure its in-flight writes have applied first.
+	src_obc->ondisk_read_lock();
+	bufferlist bl;
+	bool sparse = is_sparse_clone(src);
+	if (sparse) {
+	  int r = read_object(src, 0, 0, bl);
+	  if (r < 0) {
+	    src_obc->ondisk_read_unlock();
+	    result = r;
+	    break;
+	  }
+	}
+	map<string, bufferptr> attrs;
+	osd->store->getattrs(coll, src, attrs, false);
+	src_obc->ondisk_read_unlock();
+
+	if (sparse) {
+	  t.touch(coll, soid);
+	  if (bl.length())
+	    t.write(coll, soid, 0, bl.length(), bl);
+	} else {
+	  t.clone(coll, src, soid);
+	}
+	osd->filter_xattrs(attrs);
+	t.setattrs(coll, soid, attrs);
+
+	uint64_t size = src_obc->obs.oi.size;
+	ctx->delta_stats.num_bytes += size - oi.size;
+	ctx->delta_stats.num_kb += SHIFT_ROUND_UP(size, 10) - SHIFT_ROUND_UP(oi.size, 10);
+	oi.size = size;
+	ctx->delta_stats.num_wr++;
+	ctx->delta_stats.num_wr_kb += SHIFT_ROUND_UP(size, 10);
+      }
+      break;
       
     case CEPH_OSD_OP_WATCH:
       {
@@ -1761,9 +2412,9 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
         entity_name_t entity = ctx->reqid.name;
 	ObjectContext *obc = ctx->obc;
 
-	dout(0) << "watch: ctx->obc=" << (void *)obc << " cookie=" << cookie
+	dout(10) << "watch: ctx->obc=" << (void *)obc << " cookie=" << cookie
 		<< " oi.version=" << oi.version.version << " ctx->at_version=" << ctx->at_version << dendl;
-	dout(0) << "watch: oi.user_version=" << oi.user_version.version << dendl;
+	dout(10) << "watch: oi.user_version=" << oi.user_version.version << dendl;
 
 	watch_info_t w = {cookie, 30};  // FIXME: where does the timeout come from?
 	if (do_watch) {
@@ -2046,6 +2697,105 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops,
       break;
 
 
+      // -- object key/value map --
+    case CEPH_OSD_OP_OMAPGETVALS:
+      {
+	string start_after;
+	__u32 max_return;
+	try {
+	  ::decode(start_after, bp);
+	  ::decode(max_return, bp);
+	}
+	catch (buffer::error& e) {
+	  result = -EINVAL;
+	  break;
+	}
+	if (!obs.exists) {
+	  result = -ENOENT;
+	  break;
+	}
+	map<string,bufferlist> out;
+	result = osd->store->omap_get_range(coll, soid, start_after, max_return, &out);
+	if (result < 0)
+	  break;
+	dout(10) << " omap_get_vals after '" << start_after << "' got " << out.size() << dendl;
+	::encode(out, odata);
+	ctx->delta_stats.num_rd++;
+      }
+      break;
+
+    case CEPH_OSD_OP_OMAPGETVALSBYKEYS:
+      {
+	set<string> keys;
+	try {
+	  ::decode(keys, bp);
+	}
+	catch (buffer::error& e) {
+	  result = -EINVAL;
+	  break;
+	}
+	if (!obs.exists) {
+	  result = -ENOENT;
+	  break;
+	}
+	map<string,bufferlist> out;
+	result = osd->store->omap_get_values(coll, soid, keys, &out);
+	if (result < 0)
+	  break;
+	::encode(out, odata);
+	ctx->delta_stats.num_rd++;
+      }
+      break;
+
+    case CEPH_OSD_OP_OMAPSETVALS:
+      {
+	if (!osd->store_has_omap) {
+	  result = -EOPNOTSUPP;
+	  break;
+	}
+	map<string,bufferlist> kv;
+	try {
+	  ::decode(kv, bp);
+	}
+	catch (buffer::error& e) {
+	  result = -EINVAL;
+	  break;
+	}
+	if (!obs.exists) {
+	  t.touch(coll, soid);
+	  maybe_created = true;
+	}
+	dout(10) << " omap_set_vals " << kv.size() << " keys" << dendl;
+	t.omap_setkeys(coll, soid, kv);
+	ctx->delta_stats.num_wr++;
+      }
+      break;
+
+    case CEPH_OSD_OP_OMAPRMKEYS:
+      {
+	if (!osd->store_has_omap) {
+	  result = -EOPNOTSUPP;
+	  break;
+	}
+	set<string> keys;
+	try {
+	  ::decode(keys, bp);
+	}
+	catch (buffer::error& e) {
+	  result = -EINVAL;
+	  break;
+	}
+	if (!obs.exists) {
+	  result = -ENOENT;
+	  break;
+	}
+	dout(10) << " omap_rm_keys " << keys.size() << " keys" << dendl;
+	t.omap_rmkeys(coll, soid, keys);
+	ctx->delta_stats.num_wr++;
+      }
+      break;
+
+
     default:
       dout(1) << "unrecognized osd op " << op.op
 	      << " " << ceph_osd_op_name(op.op)
@@ -2077,6 +2827,7 @@ inline void ReplicatedPG::_delete_head(OpContext *ctx)
 
   if (obs.exists)
     t.remove(coll, soid);
+  ctx->dirty_known = false;
   if (snapset.clones.size()) {
     snapid_t newest = *snapset.clones.rbegin();
     add_interval_usage(snapset.clone_overlap[newest], ctx->delta_stats);
@@ -2154,10 +2905,21 @@ int ReplicatedPG::_rollback_to(OpContext *ctx, ceph_osd_op& op)
 
       if (obs.exists)
 	t.remove(coll, soid);
+      ctx->dirty_known = false;
       
       map<string, bufferptr> attrs;
-      t.clone(coll,
-	      rollback_to_sobject, soid);
+      if (snapset.is_sparse(rollback_to_sobject.snap)) {
+	// it doesn't hold all of its data; write out what it resolves to
+	bufferlist bl;
+	int r = read_object(rollback_to_sobject, 0, 0, bl);
+	assert(r >= 0);
+	t.touch(coll, soid);
+	if (bl.length())
+	  t.write(coll, soid, 0, bl.length(), bl);
+      } else {
+	t.clone(coll,
+		rollback_to_sobject, soid);
+      }
       osd->store->getattrs(coll,
 			   rollback_to_sobject, attrs, false);
       osd->filter_xattrs(attrs);
@@ -2198,9 +2960,15 @@ int ReplicatedPG::_rollback_to(OpContext *ctx, ceph_osd_op& op)
   return ret;
 }
 
+/*
+ * A sparse clone only stores the data that differs from the next newer
+ * clone (or head), i.e. what lies outside its clone_overlap; make_writeable
+ * copies the rest in as the head overwrites it.  The file is created at
+ * its full size but is a hole until then.
+ */
 void ReplicatedPG::_make_clone(ObjectStore::Transaction& t,
 			       const hobject_t& head, const hobject_t& coid,
-			       object_info_t *poi)
+			       object_info_t *poi, bool sparse, uint64_t size)
 {
   bufferlist bv;
   ::encode(*poi, bv);
@@ -2209,11 +2977,119 @@ void ReplicatedPG::_make_clone(ObjectStore::Transaction& t,
   osd->store->getattrs(coll, head, attrs);
   osd->filter_xattrs(attrs);
 
-  t.clone(coll, head, coid);
+  if (sparse) {
+    t.touch(coll, coid);
+    t.truncate(coll, coid, size);
+  } else {
+    t.clone(coll, head, coid);
+  }
   t.setattr(coll, coid, OI_ATTR, bv);
   t.setattrs(coll, coid, attrs);
 }
 
+bool ReplicatedPG::is_sparse_clone(const hobject_t& soid)
+{
+  if (soid.snap >= CEPH_MAXSNAP)
+    return false;
+  SnapSetContext *ssc = get_snapset_context(soid.oid, soid.get_key(), soid.hash, false);
+  if (!ssc)
+    return false;
+  bool r = ssc->snapset.is_sparse(soid.snap);
+  put_snapset_context(ssc);
+  return r;
+}
+
+/*
+ * Read an object's data, resolving whatever a sparse clone shares with
+ * newer clones or the head through them.
+ */
+int ReplicatedPG::read_object(const hobject_t& soid, uint64_t off, uint64_t len,
+			      bufferlist& bl, int flags)
+{
+  SnapSetContext *ssc = NULL;
+  if (soid.snap < CEPH_MAXSNAP)
+    ssc = get_snapset_context(soid.oid, soid.get_key(), soid.hash, false);
+  if (!ssc || !ssc->snapset.is_sparse(soid.snap)) {
+    if (ssc)
+      put_snapset_context(ssc);
+    return osd->store->read(coll, soid, off, len, bl, flags);
+  }
+
+  // the snapset already reflects writes to the head (and trims of newer
+  // clones) still in flight, which may be copying what we are about to
+  // read through into this clone.  wait for them to apply.
+  list<ObjectContext*> wait;
+  for (map<hobject_t, ObjectContext*>::iterator p =
+	 object_contexts.lower_bound(hobject_t(soid.oid, soid.get_key(), soid.snap + 1, soid.hash));
+       p != object_contexts.end() && p->first.oid == soid.oid;
+       ++p) {
+    p->second->ondisk_read_lock();
+    wait.push_back(p->second);
+  }
+  int r = read_clone(soid, ssc->snapset, off, len, bl, flags);
+  for (list<ObjectContext*>::iterator p = wait.begin(); p != wait.end(); ++p)
+    (*p)->ondisk_read_unlock();
+  put_snapset_context(ssc);
+  return r;
+}
+
+/*
+ * fiemap, except that a sparse clone's holes aren't holes in the object;
+ * report it as one extent.
+ */
+int ReplicatedPG::fiemap_object(const hobject_t& soid, uint64_t off, uint64_t len,
+				bufferlist& bl)
+{
+  SnapSetContext *ssc = NULL;
+  if (soid.snap < CEPH_MAXSNAP)
+    ssc = get_snapset_context(soid.oid, soid.get_key(), soid.hash, false);
+  if (!ssc || !ssc->snapset.is_sparse(soid.snap)) {
+    if (ssc)
+      put_snapset_context(ssc);
+    return osd->store->fiemap(coll, soid, off, len, bl);
+  }
+  uint64_t size = ssc->snapset.clone_size[soid.snap];
+  put_snapset_context(ssc);
+
+  map<uint64_t, uint64_t> m;
+  if (off < size)
+    m[off] = (len && len < size - off) ? len : size - off;
+  ::encode(m, bl);
+  return 0;
+}
+
+/*
+ * a sparse read: the allocated extents of off~len and their data.  the
+ * store does it in one go, unless a sparse clone reads through others.
+ */
+int ReplicatedPG::sparse_read_object(const hobject_t& soid, uint64_t off, uint64_t len,
+				     map<uint64_t, uint64_t>& m, bufferlist& data_bl,
+				     int flags)
+{
+  if (!is_sparse_clone(soid))
+    return osd->store->sparse_read(coll, soid, off, len, m, data_bl, flags);
+
+  bufferlist bl;
+  int r = fiemap_object(soid, off, len, bl);
+  if (r < 0)
+    return r;
+  bufferlist::iterator iter = bl.begin();
+  ::decode(m, iter);
+  int total_read = 0;
+  for (map<uint64_t, uint64_t>::iterator miter = m.begin(); miter != m.end(); ++miter) {
+    bufferlist tmpbl;
+    r = read_object(soid, miter->first, miter->second, tmpbl, flags);
+    if (r < 0)
+      return r;
+    if (r < (int)miter->second) /* this is usually happen when we get extent that exceeds the actual file size */
+      miter->second = r;
+    total_read += r;
+    dout(10) << "sparse-read " << miter->first << "@" << miter->second << dendl;
+    data_bl.claim_append(tmpbl);
+  }
+  return total_read;
+}
+
 void ReplicatedPG::make_writeable(OpContext *ctx)
 {
   const hobject_t& soid = ctx->obs->oi.soid;
@@ -2265,7 +3141,12 @@ void ReplicatedPG::make_writeable(OpContext *ctx)
     snap_oi->prior_version = ctx->obs->oi.version;
     snap_oi->copy_user_bits(ctx->obs->oi);
     snap_oi->snaps = snaps;
-    _make_clone(t, soid, coid, snap_oi);
+    // where clone copies, copy only what this write overwrites (below)
+    bool sparse = g_conf->osd_sparse_clones && !osd->store->clone_is_cheap() &&
+      ctx->dirty_known;
+    _make_clone(t, soid, coid, snap_oi, sparse, ctx->obs->oi.size);
+    if (sparse)
+      ctx->new_snapset.sparse_clones.insert(coid.snap);
     
     // add to snap bound collections
     coll_t fc = make_snap_collection(t, snaps[0]);
@@ -2300,6 +3181,23 @@ void ReplicatedPG::make_writeable(OpContext *ctx)
   // update most recent clone_overlap
   if (ctx->new_snapset.clones.size() > 0) {
     interval_set<uint64_t> &newest_overlap = ctx->new_snapset.clone_overlap.rbegin()->second;
+    snapid_t newest = ctx->new_snapset.clones.back();
+    if (ctx->new_snapset.is_sparse(newest) && !newest_overlap.empty()) {
+      // copy what we're about to overwrite into the clone first
+      interval_set<uint64_t> cow;
+      if (ctx->dirty_known)
+	cow = ctx->dirty;
+      else if (ctx->obs->oi.size)
+	cow.insert(0, ctx->obs->oi.size);
+      cow.union_of(ctx->modified_ranges);
+      cow.intersection_of(newest_overlap);
+      hobject_t newest_coid = soid;
+      newest_coid.snap = newest;
+      for (interval_set<uint64_t>::const_iterator p = cow.begin(); p != cow.end(); ++p)
+	t.clone_range(coll, soid, newest_coid, p.get_start(), p.get_len(), p.get_start());
+      dout(20) << " copied " << cow << " into sparse " << newest_coid << dendl;
+      ctx->modified_ranges.union_of(cow);
+    }
     ctx->modified_ranges.intersection_of(newest_overlap);
     newest_overlap.subtract(ctx->modified_ranges);
   }
@@ -2456,8 +3354,9 @@ void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
 	obc->notifs[notif] = true;
 	obc->ref++;
 	notif->obc = obc;
-	notif->timeout = new Watch::C_NotifyTimeout(osd, notif);
-	osd->watch_timer.add_event_after(p->timeout, notif->timeout);
+	utime_t expire = ceph_clock_now(g_ceph_context);
+	expire += p->timeout;
+	osd->watch->schedule_timeout(notif, expire);
       }
     }
 
@@ -2520,12 +3419,46 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
 
   make_writeable(ctx);
 
+  // in a cache pool, a delete leaves a whiteout for the agent to delete
+  // from the base pool, and so that we don't promote the object again
+  bool whiteout = false;
+  if (pool->info.is_cache()) {
+    if (ctx->new_obs.exists) {
+      ctx->new_obs.oi.clear_flag(object_info_t::FLAG_WHITEOUT);
+      ctx->new_obs.oi.set_flag(object_info_t::FLAG_DIRTY);
+    } else if (head_existed || ctx->obs->oi.is_whiteout()) {
+      whiteout = true;
+      ctx->new_obs.oi.set_flag(object_info_t::FLAG_WHITEOUT | object_info_t::FLAG_DIRTY);
+      ctx->op_t.touch(coll, soid);
+    }
+  }
+
+  // coalesced writes each get an entry (and version) of their own, in
+  // the order they were sent, so that a resend finds its reqid in the
+  // log and each reply carries its own version.  ours comes first; the
+  // last entry carries the dirty ranges of all of them.
+  osd_reqid_t last_reqid = ctx->reqid;
+  eversion_t first_version = ctx->at_version;
+  for (list<MOSDOp*>::iterator p = ctx->coalesced.begin();
+       p != ctx->coalesced.end();
+       ++p) {
+    ctx->log.push_back(Log::Entry(Log::Entry::MODIFY, soid, ctx->at_version, old_version,
+				  last_reqid, ctx->mtime));
+    ctx->log.back().dirty_known = ctx->dirty_known;
+    old_version = ctx->at_version;
+    ctx->at_version.version++;
+    ctx->coalesced_versions[*p] = ctx->at_version;
+    last_reqid = (*p)->get_reqid();
+  }
+
   if (ctx->user_modify) {
     /* update the user_version for any modify ops, except for the watch op */
     ctx->new_obs.oi.user_version = ctx->at_version;
   }
   
   ctx->reply_version = ctx->new_obs.oi.user_version;
+  if (ctx->user_modify && !ctx->coalesced.empty())
+    ctx->reply_version = first_version;
 
   ctx->bytes_written = ctx->op_t.get_encoded_bytes();
 
@@ -2538,15 +3471,19 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
 
   // append to log
   int logopcode = Log::Entry::MODIFY;
-  if (!ctx->new_obs.exists)
+  if (!ctx->new_obs.exists && !whiteout)
     logopcode = Log::Entry::DELETE;
   ctx->log.push_back(Log::Entry(logopcode, soid, ctx->at_version, old_version,
-				ctx->reqid, ctx->mtime));
+				last_reqid, ctx->mtime));
+  if (logopcode == Log::Entry::MODIFY && ctx->dirty_known) {
+    ctx->log.back().dirty_known = true;
+    ctx->log.back().dirty.swap(ctx->dirty);
+  }
 
-  if (ctx->new_obs.exists) {
+  if (ctx->new_obs.exists || whiteout) {
     ctx->new_obs.oi.version = ctx->at_version;
     ctx->new_obs.oi.prior_version = old_version;
-    ctx->new_obs.oi.last_reqid = ctx->reqid;
+    ctx->new_obs.oi.last_reqid = last_reqid;
     if (ctx->mtime != utime_t()) {
       ctx->new_obs.oi.mtime = ctx->mtime;
       dout(10) << " set mtime to " << ctx->new_obs.oi.mtime << dendl;
@@ -2656,6 +3593,10 @@ void ReplicatedPG::apply_repop(RepGather *repop)
 
   repop->tls.push_back(&repop->ctx->op_t);
   repop->tls.push_back(&repop->ctx->local_t);
+  // scratch pool: skip the journal.  that takes the pg log and info in
+  // local_t along, so they never claim data a crash may have lost.
+  if (pool->info.is_nojournal())
+    repop->ctx->op_t.set_nojournal();
 
   repop->obc->ondisk_write_lock();
   if (repop->ctx->clone_obc)
@@ -2665,6 +3606,8 @@ void ReplicatedPG::apply_repop(RepGather *repop)
   Context *onapplied = new C_OSD_OpApplied(this, repop);
   Context *onapplied_sync = new C_OSD_OndiskWriteUnlock(repop->obc,
 							repop->ctx->clone_obc);
+  if (repop->ctx->op)
+    ((MOSDOp*)repop->ctx->op)->mark_stage(OSD_OP_STAGE_SUBMITTED, ceph_clock_now(g_ceph_context));
   int r = osd->store->queue_transactions(&osr, repop->tls, onapplied, oncommit, onapplied_sync);
   if (r) {
     derr << "apply_repop  queue_transactions returned " << r << " on " << *repop << dendl;
@@ -2678,8 +3621,11 @@ void ReplicatedPG::op_applied(RepGather *repop)
   dout(10) << "op_applied " << *repop << dendl;
 
   // discard my reference to the buffer
-  if (repop->ctx->op)
+  if (repop->ctx->op) {
     repop->ctx->op->clear_data();
+    ((MOSDOp*)repop->ctx->op)->mark_stage(OSD_OP_STAGE_APPLIED, ceph_clock_now(g_ceph_context));
+    g_ceph_context->get_tracer()->record(repop->ctx->op->get_trace_id(), "osd_applied");
+  }
   
   repop->applying = false;
   repop->applied = true;
@@ -2710,7 +3656,7 @@ void ReplicatedPG::op_applied(RepGather *repop)
   repop->obc = 0;
 
   last_update_applied = repop->v;
-  if (last_update_applied == info.last_update && finalizing_scrub) {
+  if (last_update_applied == scrub_chunk_version && finalizing_scrub) {
     dout(10) << "requeueing scrub for cleanup" << dendl;
     osd->scrub_wq.queue(this);
   }
@@ -2734,6 +3680,10 @@ void ReplicatedPG::op_commit(RepGather *repop)
   } else {
     dout(10) << "op_commit " << *repop << dendl;
     repop->waitfor_disk.erase(osd->get_nodeid());
+    if (repop->ctx->op) {
+      ((MOSDOp*)repop->ctx->op)->mark_stage(OSD_OP_STAGE_COMMITTED, ceph_clock_now(g_ceph_context));
+      g_ceph_context->get_tracer()->record(repop->ctx->op->get_trace_id(), "osd_committed");
+    }
     //repop->waitfor_nvram.erase(osd->get_nodeid());
 
     last_update_ondisk = repop->v;
@@ -2772,6 +3722,10 @@ void ReplicatedPG::eval_repop(RepGather *repop)
   
   if (op) {
 
+    if (!op->reached_stage(OSD_OP_STAGE_REPLICATED) &&
+	repop->waitfor_disk.size() == repop->waitfor_disk.count(osd->get_nodeid()))
+      op->mark_stage(OSD_OP_STAGE_REPLICATED, ceph_clock_now(g_ceph_context));
+
     // an 'ondisk' reply implies 'ack'. so, prefer to send just one
     // ondisk instead of ack followed by ondisk.
 
@@ -2789,7 +3743,7 @@ void ReplicatedPG::eval_repop(RepGather *repop)
 	  reply = new MOSDOpReply(op, 0, osd->osdmap->get_epoch(), 0);
 	reply->add_flags(CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK);
 	dout(10) << " sending commit on " << *repop << " " << reply << dendl;
-	assert(entity_name_t::TYPE_OSD != op->get_connection()->peer_type);
+	g_ceph_context->get_tracer()->record(op->get_trace_id(), "osd_reply", "ondisk");
 	osd->client_messenger->send_message(reply, op->get_connection());
 	repop->sent_disk = true;
       }
@@ -2806,7 +3760,7 @@ void ReplicatedPG::eval_repop(RepGather *repop)
 	  reply = new MOSDOpReply(op, 0, osd->osdmap->get_epoch(), 0);
 	reply->add_flags(CEPH_OSD_FLAG_ACK);
 	dout(10) << " sending ack on " << *repop << " " << reply << dendl;
-        assert(entity_name_t::TYPE_OSD != op->get_connection()->peer_type);
+	g_ceph_context->get_tracer()->record(op->get_trace_id(), "osd_reply", "ack");
 	osd->client_messenger->send_message(reply, op->get_connection());
 	repop->sent_ack = true;
       }
@@ -2818,6 +3772,9 @@ void ReplicatedPG::eval_repop(RepGather *repop)
       if (repop->ctx->readable_stamp == utime_t())
 	repop->ctx->readable_stamp = ceph_clock_now(g_ceph_context);
     }
+
+    if (!repop->ctx->coalesced.empty())
+      reply_coalesced(repop);
   }
 
   // done.
@@ -2857,6 +3814,14 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
 
   int acks_wanted = CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK;
 
+  // encode the transaction and log once; the sub ops share the buffers
+  bufferlist tbl, logbl, emptybl;
+  if (acting.size() > 1 &&
+      !(op && op->get_flags() & CEPH_OSD_FLAG_PARALLELEXEC)) {
+    ::encode(repop->ctx->op_t, tbl);
+    ::encode(repop->ctx->log, logbl);
+  }
+
   for (unsigned i=1; i<acting.size(); i++) {
     int peer = acting[i];
     
@@ -2879,12 +3844,31 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
       wr->set_data(repop->ctx->op->get_data());   // _copy_ bufferlist
     } else {
       // ship resulting transaction, log entries, and pg_stats
-      ::encode(repop->ctx->op_t, wr->get_data());
-      ::encode(repop->ctx->log, wr->logbl);
+      Info &pinfo = peer_info[peer];
+      if (pinfo.is_backfilling() && backfill_key(soid) >= pinfo.last_backfill) {
+	// backfill will copy the object when it gets there; just log it
+	if (!emptybl.length()) {
+	  ObjectStore::Transaction empty;
+	  ::encode(empty, emptybl);
+	}
+	wr->set_data(emptybl);
+      } else {
+	wr->set_data(tbl);
+      }
+      wr->logbl = logbl;
       wr->pg_stats = info.stats;
     }
     
     wr->pg_trim_to = pg_trim_to;
+    wr->min_last_complete_ondisk = min_last_complete_ondisk;
+    if (op) {
+      wr->set_trace_id(op->get_trace_id());
+      if (op->get_trace_id()) {
+	ostringstream ss;
+	ss << "to osd." << peer;
+	g_ceph_context->get_tracer()->record(op->get_trace_id(), "osd_issue_repop", ss.str());
+      }
+    }
     osd->cluster_messenger->send_message(wr, osd->osdmap->get_cluster_inst(peer));
 
     // keep peer_info up to date
@@ -3046,53 +4030,480 @@ void ReplicatedPG::handle_watch_timeout(void *_obc,
   osd_reqid_t reqid(osd->cluster_messenger->get_myname(), 0, rep_tid);
   OpContext *ctx = new OpContext(NULL, reqid, ops, &obc->obs, obc->ssc, this);
   ctx->mtime = ceph_clock_now(g_ceph_context);
-
+
+  ctx->at_version.epoch = osd->osdmap->get_epoch();
+  ctx->at_version.version = log.head.version + 1;
+
+  entity_inst_t nobody;
+
+  /* Currently, mode.try_write always returns true.  If this changes, we will
+   * need to delay the repop accordingly */
+  assert(mode.try_write(nobody));
+  RepGather *repop = new_repop(ctx, obc, rep_tid);
+
+  ObjectStore::Transaction *t = &ctx->op_t;
+
+  ctx->log.push_back(Log::Entry(Log::Entry::MODIFY, obc->obs.oi.soid,
+				ctx->at_version,
+				obc->obs.oi.version,
+				osd_reqid_t(), ctx->mtime));
+
+  eversion_t old_last_update = log.head;
+  bool old_exists = repop->obc->obs.exists;
+  uint64_t old_size = repop->obc->obs.oi.size;
+  eversion_t old_version = repop->obc->obs.oi.version;
+
+  obc->obs.oi.prior_version = old_version;
+  obc->obs.oi.version = ctx->at_version;
+  bufferlist bl;
+  ::encode(obc->obs.oi, bl);
+  t->setattr(coll, obc->obs.oi.soid, OI_ATTR, bl);
+
+  ctx->at_version.version++;
+
+  append_log(repop->ctx->log, eversion_t(), repop->ctx->local_t);
+
+  // obc ref swallowed by repop!
+  issue_repop(repop, repop->ctx->mtime, old_last_update, old_exists,
+	      old_size, old_version);
+  eval_repop(repop);
+}
+
+// ========================================================================
+// cache tier
+
+struct C_Promote : public Context {
+  ReplicatedPG *pg;
+  hobject_t soid;
+  uint64_t seq;
+  bufferlist bl;
+  C_Promote(ReplicatedPG *p, const hobject_t& o, uint64_t s)
+    : pg(p), soid(o), seq(s) {
+    pg->get();
+  }
+  void finish(int r) {
+    pg->lock();
+    pg->finish_promote(soid, seq, r, bl);
+    pg->unlock();
+    pg->put();
+  }
+};
+
+struct C_Flush : public Context {
+  ReplicatedPG *pg;
+  hobject_t soid;
+  uint64_t seq;
+  C_Flush(ReplicatedPG *p, const hobject_t& o, uint64_t s)
+    : pg(p), soid(o), seq(s) {
+    pg->get();
+  }
+  void finish(int r) {
+    pg->lock();
+    pg->finish_flush(soid, seq, r);
+    pg->unlock();
+    pg->put();
+  }
+};
+
+void ReplicatedPG::hit_set_record(const hobject_t& soid)
+{
+  if (!pool->info.hit_set_period || !pool->info.hit_set_count)
+    return;
+  if (hit_sets.empty()) {
+    hit_sets.push_front(set<uint32_t>());
+    hit_set_start = ceph_clock_now(g_ceph_context);
+  }
+  hit_sets.front().insert(soid.hash);
+}
+
+bool ReplicatedPG::hit_set_contains(const hobject_t& soid)
+{
+  for (list<set<uint32_t> >::iterator p = hit_sets.begin(); p != hit_sets.end(); ++p)
+    if (p->count(soid.hash))
+      return true;
+  return false;
+}
+
+/*
+ * make sure head (or its whiteout) is here before op runs on it.
+ * returns true if op is waiting for the base pool, or was answered.
+ */
+bool ReplicatedPG::maybe_promote(MOSDOp *op, const hobject_t& head)
+{
+  hit_set_record(head);
+
+  if (promoting.count(head)) {
+    dout(10) << "maybe_promote " << head << " already promoting" << dendl;
+    waiting_for_promote[head].push_back(op);
+    return true;
+  }
+  ObjectContext *obc = get_object_context(head, op->get_object_locator(), false);
+  if (obc) {
+    bool have = obc->obs.exists || obc->obs.oi.is_whiteout();
+    put_object_context(obc);
+    if (have)
+      return false;
+  }
+  if (!is_primary()) {
+    osd->reply_op_error(op, -EAGAIN);
+    return true;
+  }
+
+  uint64_t seq = ++last_tier_seq;
+  dout(10) << "maybe_promote " << head << " from pool " << pool->info.tier_of
+	   << " seq " << seq << dendl;
+  promoting[head] = seq;
+  waiting_for_promote[head].push_back(op);
+
+  object_locator_t oloc = op->get_object_locator();
+  oloc.pool = pool->info.tier_of;
+  ObjectOperation rd;
+  rd.copy_get();
+  C_Promote *c = new C_Promote(this, head, seq);
+  Mutex::Locker l(osd->objecter_lock);
+  osd->objecter->read(head.oid, oloc, rd, CEPH_NOSNAP, &c->bl,
+		      CEPH_OSD_FLAG_IGNORE_OVERLAY,
+		      new C_OnFinisher(c, &osd->objecter_finisher));
+  return true;
+}
+
+void ReplicatedPG::finish_promote(const hobject_t& soid, uint64_t seq, int r,
+				  bufferlist& bl)
+{
+  map<hobject_t, uint64_t>::iterator p = promoting.find(soid);
+  if (osd->is_stopping() || p == promoting.end() || p->second != seq) {
+    dout(10) << "finish_promote " << soid << " seq " << seq << " is stale" << dendl;
+    return;
+  }
+  promoting.erase(p);
+  list<Message*> ls;
+  ls.swap(waiting_for_promote[soid]);
+  waiting_for_promote.erase(soid);
+  assert(!ls.empty());
+
+  utime_t mtime;
+  bufferlist data;
+  map<string,bufferlist> attrs, omap;
+  if (r == 0) {
+    try {
+      bufferlist::iterator bp = bl.begin();
+      __u8 v;
+      ::decode(v, bp);
+      ::decode(mtime, bp);
+      ::decode(data, bp);
+      ::decode(attrs, bp);
+      ::decode(omap, bp);
+    }
+    catch (buffer::error& e) {
+      r = -EIO;
+    }
+  }
+  dout(10) << "finish_promote " << soid << " r = " << r << " " << data.length()
+	   << " bytes" << dendl;
+  if (r < 0 && r != -ENOENT) {
+    for (list<Message*>::iterator i = ls.begin(); i != ls.end(); ++i)
+      osd->reply_op_error((MOSDOp*)*i, r);
+    return;
+  }
+
+  ObjectContext *obc = get_object_context(soid, ((MOSDOp*)ls.front())->get_object_locator(),
+					  true);
+  if (obc->obs.exists || obc->obs.oi.is_whiteout()) {
+    put_object_context(obc);
+    osd->requeue_ops(this, ls);
+    return;
+  }
+
+  RepGather *repop = start_internal_op(obc);
+  OpContext *ctx = repop->ctx;
+  ObjectStore::Transaction& t = ctx->op_t;
+  object_info_t& oi = ctx->new_obs.oi;
+  t.touch(coll, soid);
+  if (r == -ENOENT) {
+    // remember that the base pool doesn't have it either
+    oi.set_flag(object_info_t::FLAG_WHITEOUT);
+  } else {
+    if (data.length())
+      t.write(coll, soid, 0, data.length(), data);
+    for (map<string,bufferlist>::iterator q = attrs.begin(); q != attrs.end(); ++q)
+      t.setattr(coll, soid, "_" + q->first, q->second);
+    if (!omap.empty() && osd->store_has_omap)
+      t.omap_setkeys(coll, soid, omap);
+    oi.size = data.length();
+    oi.mtime = mtime;
+    ctx->new_obs.exists = true;
+    ctx->delta_stats.num_objects++;
+    ctx->delta_stats.num_bytes += oi.size;
+    ctx->delta_stats.num_kb += SHIFT_ROUND_UP(oi.size, 10);
+  }
+  finish_internal_op(repop, Log::Entry::MODIFY);
+
+  // reads could go now, but writes must not overtake the copy
+  list<Message*>& w = waiting_for_ondisk[repop->v];
+  w.splice(w.end(), ls);
+}
+
+/*
+ * an update of our own to obc, as for a watch timeout: fill in
+ * ctx->op_t, ctx->new_obs and ctx->delta_stats, then call
+ * finish_internal_op().  swallows the obc ref.
+ */
+ReplicatedPG::RepGather *ReplicatedPG::start_internal_op(ObjectContext *obc)
+{
+  if (!obc->ssc)
+    obc->ssc = get_snapset_context(obc->obs.oi.soid.oid, obc->obs.oi.soid.get_key(),
+				   obc->obs.oi.soid.hash, true);
+
+  vector<OSDOp> ops;
+  tid_t rep_tid = osd->get_tid();
+  osd_reqid_t reqid(osd->cluster_messenger->get_myname(), 0, rep_tid);
+  OpContext *ctx = new OpContext(NULL, reqid, ops, &obc->obs, obc->ssc, this);
+  ctx->obc = obc;
+  ctx->mtime = ceph_clock_now(g_ceph_context);
   ctx->at_version.epoch = osd->osdmap->get_epoch();
   ctx->at_version.version = log.head.version + 1;
 
   entity_inst_t nobody;
+  bool ok = mode.try_write(nobody);
+  assert(ok);
+  return new_repop(ctx, obc, rep_tid);
+}
 
-  /* Currently, mode.try_write always returns true.  If this changes, we will
-   * need to delay the repop accordingly */
-  assert(mode.try_write(nobody));
-  RepGather *repop = new_repop(ctx, obc, rep_tid);
+void ReplicatedPG::finish_internal_op(RepGather *repop, int logop)
+{
+  OpContext *ctx = repop->ctx;
+  ObjectContext *obc = repop->obc;
+  const hobject_t& soid = obc->obs.oi.soid;
 
-  ObjectStore::Transaction *t = &ctx->op_t;
+  eversion_t old_last_update = log.head;
+  bool old_exists = obc->obs.exists;
+  uint64_t old_size = obc->obs.oi.size;
+  eversion_t old_version = obc->obs.oi.version;
 
-  ctx->log.push_back(Log::Entry(Log::Entry::MODIFY, obc->obs.oi.soid,
-				ctx->at_version,
-				obc->obs.oi.version,
+  ctx->log.push_back(Log::Entry(logop, soid, ctx->at_version, old_version,
 				osd_reqid_t(), ctx->mtime));
 
-  eversion_t old_last_update = log.head;
-  bool old_exists = repop->obc->obs.exists;
-  uint64_t old_size = repop->obc->obs.oi.size;
-  eversion_t old_version = repop->obc->obs.oi.version;
-
-  obc->obs.oi.prior_version = old_version;
-  obc->obs.oi.version = ctx->at_version;
-  bufferlist bl;
-  ::encode(obc->obs.oi, bl);
-  t->setattr(coll, obc->obs.oi.soid, OI_ATTR, bl);
+  ctx->new_obs.oi.prior_version = old_version;
+  ctx->new_obs.oi.version = ctx->at_version;
+  ctx->new_snapset.head_exists = ctx->new_obs.exists;
+  if (logop != Log::Entry::DELETE) {
+    bufferlist bv, bss;
+    ::encode(ctx->new_obs.oi, bv);
+    ::encode(ctx->new_snapset, bss);
+    ctx->op_t.setattr(coll, soid, OI_ATTR, bv);
+    ctx->op_t.setattr(coll, soid, SS_ATTR, bss);
+  }
 
-  ctx->at_version.version++;
+  obc->obs = ctx->new_obs;
+  obc->ssc->snapset = ctx->new_snapset;
+  info.stats.stats.add(ctx->delta_stats, obc->obs.oi.category);
 
-  append_log(repop->ctx->log, eversion_t(), repop->ctx->local_t);
+  append_log(ctx->log, eversion_t(), ctx->local_t);
 
   // obc ref swallowed by repop!
-  issue_repop(repop, repop->ctx->mtime, old_last_update, old_exists,
+  issue_repop(repop, ctx->mtime, old_last_update, old_exists,
 	      old_size, old_version);
   eval_repop(repop);
 }
 
+/*
+ * write obc back to the base pool, replacing whatever is there (or
+ * delete it there, for a whiteout).  the dirty flag is cleared when
+ * that commits, if the object hasn't changed since.
+ */
+bool ReplicatedPG::agent_flush(ObjectContext *obc)
+{
+  const hobject_t& soid = obc->obs.oi.soid;
+  ObjectOperation wr;
+  wr.remove();
+  wr.ops.back().op.flags = CEPH_OSD_OP_FLAG_FAILOK;
+  if (!obc->obs.oi.is_whiteout()) {
+    // the caller made sure no write is in flight, so what's on disk is
+    // obs.oi.version; the lock keeps it that way while we read.
+    bufferlist data;
+    map<string,bufferptr> attrs;
+    map<string,bufferlist> omap;
+    obc->ondisk_read_lock();
+    int r = osd->store->read(coll, soid, 0, 0, data);
+    if (r >= 0)
+      r = osd->store->getattrs(coll, soid, attrs, true);
+    if (r >= 0 && osd->store_has_omap)
+      osd->store->omap_get_range(coll, soid, string(), 0, &omap);
+    obc->ondisk_read_unlock();
+    if (r < 0)
+      return false;
+
+    wr.create(false);
+    wr.write_full(data);
+    for (map<string,bufferptr>::iterator p = attrs.begin(); p != attrs.end(); ++p) {
+      bufferlist bl;
+      bl.push_back(p->second);
+      wr.setxattr(p->first.c_str(), bl);
+    }
+    if (!omap.empty())
+      wr.omap_set(omap);
+  }
+
+  uint64_t seq = ++last_tier_seq;
+  dout(10) << "agent_flush " << soid << " v" << obc->obs.oi.version
+	   << " seq " << seq << dendl;
+  flushing[soid] = make_pair(seq, obc->obs.oi.version);
+
+  object_locator_t oloc = obc->obs.oi.oloc;
+  oloc.pool = pool->info.tier_of;
+  SnapContext snapc;
+  Mutex::Locker l(osd->objecter_lock);
+  osd->objecter->mutate(soid.oid, oloc, wr, snapc, obc->obs.oi.mtime,
+			CEPH_OSD_FLAG_IGNORE_OVERLAY, NULL,
+			new C_OnFinisher(new C_Flush(this, soid, seq),
+					 &osd->objecter_finisher));
+  return true;
+}
+
+void ReplicatedPG::finish_flush(const hobject_t& soid, uint64_t seq, int r)
+{
+  map<hobject_t, pair<uint64_t, eversion_t> >::iterator p = flushing.find(soid);
+  if (osd->is_stopping() || p == flushing.end() || p->second.first != seq) {
+    dout(10) << "finish_flush " << soid << " seq " << seq << " is stale" << dendl;
+    return;
+  }
+  eversion_t v = p->second.second;
+  flushing.erase(p);
+  dout(10) << "finish_flush " << soid << " v" << v << " r = " << r << dendl;
+  if (r < 0)
+    return;  // try again on a later pass
+
+  ObjectContext *obc = get_object_context(soid, OLOC_BLANK, false);
+  if (!obc)
+    return;
+  if (obc->obs.oi.version != v || !obc->obs.oi.is_dirty() ||
+      is_degraded_object(soid)) {
+    put_object_context(obc);
+    return;
+  }
+  RepGather *repop = start_internal_op(obc);
+  repop->ctx->new_obs.oi.clear_flag(object_info_t::FLAG_DIRTY);
+  finish_internal_op(repop, Log::Entry::MODIFY);
+}
+
+/// drop a clean object (or whiteout) from the cache.  swallows the obc ref.
+bool ReplicatedPG::agent_evict(ObjectContext *obc)
+{
+  const hobject_t& soid = obc->obs.oi.soid;
+  dout(10) << "agent_evict " << soid << " v" << obc->obs.oi.version << dendl;
+
+  RepGather *repop = start_internal_op(obc);
+  OpContext *ctx = repop->ctx;
+  ctx->op_t.remove(coll, soid);
+  if (ctx->new_obs.exists) {
+    ctx->delta_stats.num_objects--;
+    ctx->delta_stats.num_bytes -= ctx->new_obs.oi.size;
+    ctx->delta_stats.num_kb -= SHIFT_ROUND_UP(ctx->new_obs.oi.size, 10);
+  }
+  ctx->new_obs.oi = object_info_t(soid, obc->obs.oi.oloc);
+  ctx->new_obs.oi.category = obc->obs.oi.category;
+  ctx->new_obs.exists = false;
+  finish_internal_op(repop, Log::Entry::DELETE);
+  return true;
+}
+
+/// is this pg's share of the pool over the pool's targets?
+bool ReplicatedPG::agent_over_target()
+{
+  const pg_pool_t& pi = pool->info;
+  unsigned pg_num = MAX(1, pi.get_pg_num());
+  const object_stat_sum_t& sum = info.stats.stats.sum;
+  if (pi.target_max_bytes && sum.num_bytes > 0 &&
+      (uint64_t)sum.num_bytes > pi.target_max_bytes / pg_num)
+    return true;
+  if (pi.target_max_objects && sum.num_objects > 0 &&
+      (uint64_t)sum.num_objects > pi.target_max_objects / pg_num)
+    return true;
+  return false;
+}
+
+/*
+ * one pass of the cache agent over the next osd_agent_scan_max objects:
+ * flush dirty ones older than cache_min_flush_age, and, while we're
+ * over target, evict the clean ones that nobody has used lately.
+ */
+void ReplicatedPG::agent_work()
+{
+  lock();
+  if (!is_primary() || !is_active() || !pool->info.is_cache() ||
+      osd->is_stopping()) {
+    unlock();
+    put();
+    return;
+  }
+
+  // rotate the hit sets
+  utime_t now = ceph_clock_now(g_ceph_context);
+  if (!pool->info.hit_set_period || !pool->info.hit_set_count) {
+    hit_sets.clear();
+  } else if (!hit_sets.empty() &&
+	     now - hit_set_start >= utime_t(pool->info.hit_set_period, 0)) {
+    hit_sets.push_front(set<uint32_t>());
+    hit_set_start = now;
+    while (hit_sets.size() > pool->info.hit_set_count)
+      hit_sets.pop_back();
+  }
+
+  bool evict = agent_over_target();
+  int max = g_conf->osd_agent_scan_max;
+  vector<hobject_t> ls;
+  int r = osd->store->collection_list_partial(coll, 0, ls, max, &agent_pos);
+  if (r < 0 || (int)ls.size() < max)
+    agent_pos = collection_list_handle_t();  // start over next time
+  dout(10) << "agent_work " << ls.size() << " objects, " << flushing.size()
+	   << " flushing, evict " << evict << dendl;
+
+  utime_t min_age(pool->info.cache_min_flush_age, 0);
+  for (vector<hobject_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    if (p->snap != CEPH_NOSNAP ||
+	promoting.count(*p) || flushing.count(*p) ||
+	is_missing_object(*p) || is_degraded_object(*p) || scrub_blocks(*p))
+      continue;
+    ObjectContext *obc = get_object_context(*p, OLOC_BLANK, false);
+    if (!obc)
+      continue;
+    if (obc->obs.oi.is_dirty()) {
+      // ops in progress hold a ref; flush once they're done
+      if (obc->ref == 1 &&
+	  (int)flushing.size() < g_conf->osd_agent_max_ops &&
+	  obc->obs.oi.mtime + min_age <= now)
+	agent_flush(obc);
+      put_object_context(obc);
+      continue;
+    }
+    if (evict && obc->ref == 1 && obc->obs.oi.watchers.empty() &&
+	!hit_set_contains(*p)) {
+      agent_evict(obc);
+      evict = agent_over_target();
+      continue;
+    }
+    put_object_context(obc);
+  }
+
+  unlock();
+  put();
+}
+
 ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& soid,
 							      const object_locator_t& oloc,
 							      bool can_create)
 {
   map<hobject_t, ObjectContext*>::iterator p = object_contexts.find(soid);
+  if (p != object_contexts.end() && p->second->cached && is_missing_object(soid)) {
+    // recovery is about to change it under the cached context
+    invalidate_object_context(soid);
+    p = object_contexts.end();
+  }
   ObjectContext *obc;
   if (p != object_contexts.end()) {
     obc = p->second;
+    if (obc->cached)
+      _uncache_object_context(obc);
     dout(10) << "get_object_context " << soid << " " << obc->ref
 	     << " -> " << (obc->ref+1) << dendl;
   } else {
@@ -3126,7 +4537,7 @@ ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& s
 
     if (r >= 0) {
       obc->obs.oi.decode(bv);
-      obc->obs.exists = true;
+      obc->obs.exists = !obc->obs.oi.is_whiteout();
 
       populate_obc_watchers(obc);
     } else {
@@ -3161,6 +4572,31 @@ int ReplicatedPG::find_object_context(const hobject_t& oid,
 {
   // want the head?
   hobject_t head(oid.oid, oid.get_key(), CEPH_NOSNAP, oid.hash);
+
+  // want the snapdir?  (list-snaps) the head will do if it exists
+  if (oid.snap == CEPH_SNAPDIR && !can_create) {
+    ObjectContext *obc = get_object_context(head, oloc, false);
+    if (obc && !obc->obs.exists) {
+      put_object_context(obc);
+      obc = NULL;
+    }
+    if (!obc) {
+      hobject_t snapdir(oid.oid, oid.get_key(), CEPH_SNAPDIR, oid.hash);
+      if (missing.is_missing(snapdir)) {
+	if (psnapid)
+	  *psnapid = CEPH_SNAPDIR;
+	return -EAGAIN;
+      }
+      obc = get_object_context(snapdir, oloc, false);
+    }
+    if (!obc)
+      return -ENOENT;
+    dout(10) << "find_object_context " << oid << " @" << oid.snap
+	     << " -> " << obc->obs.oi.soid << dendl;
+    *pobc = obc;
+    return 0;
+  }
+
   if (oid.snap == CEPH_NOSNAP) {
     ObjectContext *obc = get_object_context(head, oloc, can_create);
     if (!obc)
@@ -3262,18 +4698,58 @@ void ReplicatedPG::put_object_context(ObjectContext *obc)
 
   --obc->ref;
   if (obc->ref == 0) {
-    if (obc->ssc)
-      put_snapset_context(obc->ssc);
+    if (obc->cached)
+      _uncache_object_context(obc);   // someone took a ref behind our back
+    if (g_conf->osd_object_context_cache_max > 0 &&
+	obc->registered && obc->obs.exists && is_primary() &&
+	!is_missing_object(obc->obs.oi.soid)) {
+      object_context_cache.push_front(obc);
+      obc->cache_pos = object_context_cache.begin();
+      obc->cached = true;
+      trim_object_context_cache(g_conf->osd_object_context_cache_max);
+      return;
+    }
+    _delete_object_context(obc);
+  }
+}
+
+void ReplicatedPG::_delete_object_context(ObjectContext *obc)
+{
+  assert(obc->ref == 0);
+  assert(!obc->cached);
+  if (obc->ssc)
+    put_snapset_context(obc->ssc);
+
+  if (obc->registered)
+    object_contexts.erase(obc->obs.oi.soid);
+  delete obc;
 
-    if (obc->registered)
-      object_contexts.erase(obc->obs.oi.soid);
-    delete obc;
+  if (object_contexts.empty())
+    kick();
+}
 
-    if (object_contexts.empty())
-      kick();
+void ReplicatedPG::trim_object_context_cache(unsigned max)
+{
+  while (object_context_cache.size() > max) {
+    ObjectContext *obc = object_context_cache.back();
+    _uncache_object_context(obc);
+    if (obc->ref == 0)
+      _delete_object_context(obc);
   }
 }
 
+void ReplicatedPG::invalidate_object_context(const hobject_t& soid)
+{
+  map<hobject_t, ObjectContext*>::iterator p = object_contexts.find(soid);
+  if (p == object_contexts.end() || !p->second->cached)
+    return;
+  ObjectContext *obc = p->second;
+  dout(10) << "invalidate_object_context " << soid << dendl;
+  _uncache_object_context(obc);
+  if (obc->ref == 0)
+    _delete_object_context(obc);
+}
+
 void ReplicatedPG::put_object_contexts(map<hobject_t,ObjectContext*>& obcv)
 {
   if (obcv.empty())
@@ -3352,6 +4828,11 @@ void ReplicatedPG::sub_op_modify(MOSDSubOp *op)
 	   << (op->logbl.length() ? " (transaction)" : " (parallel exec")
 	   << " " << op->logbl.length()
 	   << dendl;  
+  g_ceph_context->get_tracer()->record(op->get_trace_id(), "osd_sub_op_modify");
+
+  // what the primary knows to be committed, for replica reads
+  if (op->min_last_complete_ondisk > min_last_complete_ondisk)
+    min_last_complete_ondisk = op->min_last_complete_ondisk;
 
   // sanity checks
   assert(op->map_epoch >= info.history.same_interval_since);
@@ -3382,7 +4863,13 @@ void ReplicatedPG::sub_op_modify(MOSDSubOp *op)
       ::decode(log, p);
       
       info.stats = op->pg_stats;
-      update_snap_collections(log);
+      if (info.is_backfilling() && backfill_key(soid) >= info.last_backfill) {
+	// the primary will push it when backfill gets here
+	dout(10) << "sub_op_modify " << soid << " not backfilled yet, logging only" << dendl;
+	rm->opt = ObjectStore::Transaction();
+      } else {
+	update_snap_collections(log);
+      }
       append_log(log, op->pg_trim_to, rm->localt);
 
       rm->tls.push_back(&rm->opt);
@@ -3428,6 +4915,10 @@ void ReplicatedPG::sub_op_modify(MOSDSubOp *op)
     }
   }
   
+  // scratch pool: skip the journal (with the log in rm->localt) here too
+  if (pool->info.is_nojournal())
+    rm->opt.set_nojournal();
+
   Context *oncommit = new C_OSD_RepModifyCommit(rm);
   Context *onapply = new C_OSD_RepModifyApply(rm);
   int r = osd->store->queue_transactions(&osr, rm->tls, onapply, oncommit);
@@ -3442,6 +4933,7 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
 {
   lock();
   dout(10) << "sub_op_modify_applied on " << rm << " op " << *rm->op << dendl;
+  g_ceph_context->get_tracer()->record(rm->op->get_trace_id(), "osd_sub_op_applied");
 
   if (!rm->committed) {
     // send ack to acker only if we haven't sent a commit already
@@ -3464,24 +4956,45 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
   }
 }
 
+/*
+ * send the commit straight from the journal's commit callback, without
+ * waiting for the pg lock: the primary's client is waiting on it.  all
+ * we need is a stable map; if handle_osd_map holds it, we reply under
+ * the pg lock instead, as before.
+ */
+bool ReplicatedPG::send_sub_op_commit(RepModify *rm)
+{
+  if (!osd->osdmap->is_up(rm->ackerosd))
+    return false;
+  MOSDSubOpReply *commit = new MOSDSubOpReply(rm->op, 0, osd->osdmap->get_epoch(), CEPH_OSD_FLAG_ONDISK);
+  commit->set_last_complete_ondisk(rm->last_complete);
+  commit->set_priority(CEPH_MSG_PRIO_HIGH); // this better match ack priority!
+  osd->cluster_messenger->send_message(commit, osd->osdmap->get_cluster_inst(rm->ackerosd));
+  return true;
+}
+
 void ReplicatedPG::sub_op_modify_commit(RepModify *rm)
 {
+  g_ceph_context->get_tracer()->record(rm->op->get_trace_id(), "osd_sub_op_committed");
+  bool sent = false, tried = false;
+  if (osd->map_lock.try_get_read()) {
+    sent = send_sub_op_commit(rm);
+    tried = true;
+    osd->map_lock.put_read();
+  }
+
   lock();
 
-  // send commit.
   dout(10) << "sub_op_modify_commit on op " << *rm->op
-           << ", sending commit to osd." << rm->ackerosd
+           << ", " << (tried ? "sent" : "sending") << " commit to osd." << rm->ackerosd
            << dendl;
 
   log_subop_stats(rm->op, l_osd_sop_w_inb, l_osd_sop_w_lat);
 
-  if (osd->osdmap->is_up(rm->ackerosd)) {
+  if (!tried)
+    sent = send_sub_op_commit(rm);
+  if (sent)
     last_complete_ondisk = rm->last_complete;
-    MOSDSubOpReply *commit = new MOSDSubOpReply(rm->op, 0, osd->osdmap->get_epoch(), CEPH_OSD_FLAG_ONDISK);
-    commit->set_last_complete_ondisk(rm->last_complete);
-    commit->set_priority(CEPH_MSG_PRIO_HIGH); // this better match ack priority!
-    osd->cluster_messenger->send_message(commit, osd->osdmap->get_cluster_inst(rm->ackerosd));
-  }
   
   rm->committed = true;
   bool done = rm->applied && rm->committed;
@@ -3500,6 +5013,12 @@ void ReplicatedPG::sub_op_modify_reply(MOSDSubOpReply *r)
   // must be replication.
   tid_t rep_tid = r->get_tid();
   int fromosd = r->get_source().num();
+
+  if (r->get_trace_id()) {
+    ostringstream ss;
+    ss << (r->is_ondisk() ? "ondisk" : "ack") << " from osd." << fromosd;
+    g_ceph_context->get_tracer()->record(r->get_trace_id(), "osd_sub_op_reply", ss.str());
+  }
   
   if (repop_map.count(rep_tid)) {
     // oh, good.
@@ -3543,7 +5062,8 @@ void ReplicatedPG::calc_head_subsets(SnapSet& snapset, const hobject_t& head,
     hobject_t c = head;
     c.snap = snapset.clones[j];
     prev.intersection_of(snapset.clone_overlap[snapset.clones[j]]);
-    if (!missing.is_missing(c)) {
+    // a sparse clone doesn't hold what it shares with us
+    if (!missing.is_missing(c) && !snapset.is_sparse(c.snap)) {
       dout(10) << "calc_head_subsets " << head << " has prev " << c
 	       << " overlap " << prev << dendl;
       clone_subsets[c] = prev;
@@ -3564,6 +5084,35 @@ void ReplicatedPG::calc_head_subsets(SnapSet& snapset, const hobject_t& head,
 	   << "  clone_subsets " << clone_subsets << dendl;
 }
 
+/*
+ * union of the extents modified between have and need, if the log
+ * still covers every update in between and each one recorded them.
+ */
+bool ReplicatedPG::calc_dirty_since(const hobject_t& soid, eversion_t have, eversion_t need,
+				    interval_set<uint64_t>& dirty)
+{
+  if (have == eversion_t() || have < log.tail)
+    return false;
+  eversion_t v = need;
+  for (Log::entry_list::reverse_iterator p = log.log.rbegin();
+       p != log.log.rend() && p->version > have;
+       ++p) {
+    if (p->soid != soid || p->version > need)
+      continue;
+    if (p->version != v || !p->is_modify() || !p->dirty_known) {
+      dout(15) << "calc_dirty_since " << soid << " " << have << " can't use " << *p << dendl;
+      return false;
+    }
+    dirty.union_of(p->dirty);
+    v = p->prior_version;
+  }
+  if (v != have)
+    return false;
+  dout(10) << "calc_dirty_since " << soid << " " << have << ".." << need
+	   << " dirty " << dirty << dendl;
+  return true;
+}
+
 void ReplicatedPG::calc_clone_subsets(SnapSet& snapset, const hobject_t& soid,
 				      Missing& missing,
 				      interval_set<uint64_t>& data_subset,
@@ -3588,7 +5137,8 @@ void ReplicatedPG::calc_clone_subsets(SnapSet& snapset, const hobject_t& soid,
     hobject_t c = soid;
     c.snap = snapset.clones[j];
     prev.intersection_of(snapset.clone_overlap[snapset.clones[j]]);
-    if (!missing.is_missing(c)) {
+    // a sparse clone doesn't hold what it shares with newer objects
+    if (!missing.is_missing(c) && !snapset.is_sparse(c.snap)) {
       dout(10) << "calc_clone_subsets " << soid << " has prev " << c
 	       << " overlap " << prev << dendl;
       clone_subsets[c] = prev;
@@ -3608,10 +5158,16 @@ void ReplicatedPG::calc_clone_subsets(SnapSet& snapset, const hobject_t& soid,
     c.snap = snapset.clones[j];
     next.intersection_of(snapset.clone_overlap[snapset.clones[j-1]]);
     if (!missing.is_missing(c)) {
+      interval_set<uint64_t> have = next;
+      if (snapset.is_sparse(c.snap)) {
+	interval_set<uint64_t> shared;
+	shared.intersection_of(have, snapset.clone_overlap[c.snap]);
+	have.subtract(shared);
+      }
       dout(10) << "calc_clone_subsets " << soid << " has next " << c
-	       << " overlap " << next << dendl;
-      clone_subsets[c] = next;
-      cloning.union_of(next);
+	       << " overlap " << have << dendl;
+      clone_subsets[c] = have;
+      cloning.union_of(have);
       break;
     }
     dout(10) << "calc_clone_subsets " << soid << " does not have next " << c
@@ -3815,6 +5371,27 @@ void ReplicatedPG::push_to_replica(ObjectContext *obc, const hobject_t& soid, in
 		       data_subset, clone_subsets);
     put_snapset_context(ssc);
   } else if (soid.snap == CEPH_NOSNAP) {
+    // if the replica has an older version and we know what changed since,
+    // send just that and have it patch its copy in place.  the object
+    // itself in clone_subsets marks such a push; older OSDs would take it
+    // for a clone source and remove the object first.
+    if (g_conf->osd_recovery_push_dirty_extents &&
+	(osd->get_peer_features(peer) & CEPH_FEATURE_OSD_PUSH_DIRTY) &&
+	peer_missing[peer].is_missing(soid) &&
+	calc_dirty_since(soid, peer_missing[peer].have_old(soid), oi.version, data_subset)) {
+      interval_set<uint64_t> keep;
+      if (size)
+	keep.insert(0, size);
+      data_subset.intersection_of(keep);
+      keep.subtract(data_subset);
+      clone_subsets[soid] = keep;
+      dout(10) << "push_to_replica osd." << peer << " has " << peer_missing[peer].have_old(soid)
+	       << ", pushing dirty " << data_subset << dendl;
+      osd->logger->inc(l_osd_push_dirty);
+      push_start(soid, peer, size, oi.version, data_subset, clone_subsets);
+      return;
+    }
+
     // pushing head or unversioned object.
     // base this on partially on replica's clones?
     SnapSetContext *ssc = get_snapset_context(soid.oid, soid.get_key(), soid.hash, false);
@@ -3882,8 +5459,8 @@ int ReplicatedPG::send_push_op(const hobject_t& soid, eversion_t version, int pe
        p != data_subset.end();
        ++p) {
     bufferlist bit;
-    osd->store->read(coll,
-		     soid, p.get_start(), p.get_len(), bit);
+    read_object(soid, p.get_start(), p.get_len(), bit,
+		g_conf->osd_background_read_dontneed ? CEPH_OSD_OP_FLAG_FADVISE_DONTNEED : 0);
     if (p.get_len() != bit.length()) {
       dout(10) << " extent " << p.get_start() << "~" << p.get_len()
 	       << " is actually " << p.get_start() << "~" << bit.length() << dendl;
@@ -3894,6 +5471,11 @@ int ReplicatedPG::send_push_op(const hobject_t& soid, eversion_t version, int pe
 
   osd->store->getattrs(coll, soid, attrset);
 
+  // the omap goes along with the attrs, in the push that completes the object
+  map<string,bufferlist> omap_entries;
+  if (complete && osd->store_has_omap)
+    osd->store->omap_get_range(coll, soid, string(), 0, &omap_entries);
+
   bufferlist bv;
   bv.push_back(attrset[OI_ATTR]);
   object_info_t oi(bv);
@@ -3929,6 +5511,7 @@ int ReplicatedPG::send_push_op(const hobject_t& soid, eversion_t version, int pe
   subop->data_subset = data_subset;
   subop->clone_subsets = clone_subsets;
   subop->attrset.swap(attrset);
+  subop->omap_entries.swap(omap_entries);
   subop->old_size = size;
   subop->first = first;
   subop->complete = complete;
@@ -4275,8 +5858,14 @@ void ReplicatedPG::sub_op_push(MOSDSubOp *op)
 	   << " first=" << first << " complete=" << complete
 	   << dendl;
 
+  // a push of just the dirty extents names the object itself as a clone
+  // source (see push_to_replica): patch our old copy in place.  until
+  // the attrs are written it stays at the old version, so an interrupted
+  // push is simply redone.
+  bool in_place = clone_subsets.erase(soid);
+
   coll_t target;
-  if (first && complete)
+  if ((first && complete) || in_place)
     target = coll;
   else
     target = coll_t::TEMP_COLL;
@@ -4286,7 +5875,8 @@ void ReplicatedPG::sub_op_push(MOSDSubOp *op)
   Context *onreadable = 0;
   Context *onreadable_sync = 0;
 
-  if (first)
+  invalidate_object_context(soid);
+  if (first && !in_place)
     t->remove(target, soid);  // in case old version exists
 
   // write data
@@ -4298,11 +5888,15 @@ void ReplicatedPG::sub_op_push(MOSDSubOp *op)
     bit.substr_of(data, boff, p.get_len());
     dout(15) << " write " << p.get_start() << "~" << p.get_len() << dendl;
     t->write(target, soid, p.get_start(), p.get_len(), bit);
+    if (g_conf->osd_background_read_dontneed)
+      t->fadvise(target, soid, p.get_start(), p.get_len(), CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
     boff += p.get_len();
   }
   
   if (complete) {
-    if (!first) {
+    if (in_place) {
+      t->truncate(coll, soid, op->old_size);
+    } else if (!first) {
       t->remove(coll, soid);
       t->collection_add(coll, target, soid);
       t->collection_remove(target, soid);
@@ -4327,7 +5921,15 @@ void ReplicatedPG::sub_op_push(MOSDSubOp *op)
     if (data_subset.empty())
       t->touch(coll, soid);
 
+    // the old copy may have xattrs that were removed since
+    if (in_place)
+      t->rmattrs(coll, soid);
     t->setattrs(coll, soid, op->attrset);
+    if (osd->store_has_omap) {
+      t->omap_clear(coll, soid);
+      if (!op->omap_entries.empty())
+	t->omap_setkeys(coll, soid, op->omap_entries);
+    }
     if (soid.snap && soid.snap < CEPH_NOSNAP &&
 	op->attrset.count(OI_ATTR)) {
       bufferlist bl;
@@ -4366,8 +5968,8 @@ void ReplicatedPG::sub_op_push(MOSDSubOp *op)
       assert(obc->registered);
       obc->ondisk_write_lock();
       
-      obc->obs.exists = true;
       obc->obs.oi.decode(oibl);
+      obc->obs.exists = !obc->obs.oi.is_whiteout();
 
       if (revert) {
 	// update the attr to the revert event version
@@ -4574,8 +6176,8 @@ void ReplicatedPG::mark_all_unfound_lost(int what)
   utime_t mtime = ceph_clock_now(g_ceph_context);
   eversion_t old_last_update = info.last_update;
   info.last_update.epoch = osd->osdmap->get_epoch();
-  map<hobject_t, Missing::item>::iterator m = missing.missing.begin();
-  map<hobject_t, Missing::item>::iterator mend = missing.missing.end();
+  Missing::item_map::iterator m = missing.missing.begin();
+  Missing::item_map::iterator mend = missing.missing.end();
   while (m != mend) {
     const hobject_t &oid(m->first);
     if (missing_loc.find(oid) != missing_loc.end()) {
@@ -4696,6 +6298,8 @@ void ReplicatedPG::apply_and_flush_repops(bool requeue)
       dout(10) << " requeuing " << *repop->ctx->op << dendl;
       rq.push_back(repop->ctx->op);
       repop->ctx->op = 0;
+      rq.insert(rq.end(), repop->ctx->coalesced.begin(), repop->ctx->coalesced.end());
+      repop->ctx->coalesced.clear();
     }
 
     remove_repop(repop);
@@ -4730,7 +6334,7 @@ void ReplicatedPG::on_change()
   clear_scrub_reserved();
 
   // clear scrub state
-  if (finalizing_scrub) {
+  if (finalizing_scrub || scrub_end) {
     scrub_clear_state();
   } else if (is_scrubbing()) {
     state_clear(PG_STATE_SCRUBBING);
@@ -4742,6 +6346,11 @@ void ReplicatedPG::on_change()
   // take object waiters
   take_object_waiters(waiting_for_missing_object);
   take_object_waiters(waiting_for_degraded_object);
+  take_object_waiters(waiting_for_promote);
+
+  // in-flight promotes and flushes complete as stale
+  promoting.clear();
+  flushing.clear();
 
   // clear pushing/pulling maps
   pushing.clear();
@@ -4828,6 +6437,10 @@ int ReplicatedPG::start_recovery_ops(int max)
     // second chance to recovery replicas
     started = recover_replicas(max);
   }
+  if (!started) {
+    // log-based recovery is done; move any backfill along
+    started = recover_backfill(max);
+  }
 
   dout(10) << " started " << started << dendl;
 
@@ -5041,6 +6654,9 @@ int ReplicatedPG::recover_object_replicas(const hobject_t& soid, eversion_t v)
     bool uhoh = true;
     for (unsigned i=1; i<acting.size(); i++) {
       int peer = acting[i];
+      Info &pi = peer_info[peer];
+      if (pi.is_backfilling() && backfill_key(soid) >= pi.last_backfill)
+	continue;
       if (!peer_missing[peer].is_missing(soid, v)) {
 	missing_loc[soid].insert(peer);
 	dout(10) << info.pgid << " unexpectedly missing " << soid << " v" << v
@@ -5113,7 +6729,7 @@ int ReplicatedPG::recover_replicas(int max)
       }
 
       dout(10) << __func__ << ": recover_object_replicas(" << soid << ")" << dendl;
-      map<hobject_t,Missing::item>::const_iterator p = m.missing.find(soid);
+      Missing::item_map::const_iterator p = m.missing.find(soid);
       started += recover_object_replicas(soid, p->second.need);
     }
   }
@@ -5121,8 +6737,114 @@ int ReplicatedPG::recover_replicas(int max)
   return started;
 }
 
+/*
+ * queue the next chunk of the collection for each backfill target that
+ * has finished its previous one.  the target's watermark moves past the
+ * chunk as soon as it is queued: from then on, writes to those objects
+ * are blocked as degraded until the push lands, and applied normally
+ * after that.
+ */
+int ReplicatedPG::recover_backfill(int max)
+{
+  if (missing.num_missing())
+    return 0;  // we can only copy what we have
+
+  bool any = false;
+  for (unsigned i=1; i<acting.size(); i++) {
+    int peer = acting[i];
+    Info &pi = peer_info[peer];
+    Missing &pm = peer_missing[peer];
+    while (pi.is_backfilling() && pm.num_missing() == 0) {
+      uint64_t end;
+      if (pi.last_backfill == BACKFILL_SCANNED)
+	end = BACKFILL_DONE;   // everything has landed
+      else
+	end = scan_backfill(pi.last_backfill, pm);
+      dout(10) << "recover_backfill osd." << peer << " " << hex << pi.last_backfill
+	       << " -> " << end << dec << ", " << pm.num_missing() << " objects" << dendl;
+      pi.last_backfill = end;
+      send_backfill_progress(peer, end);
+    }
+    if (pi.is_backfilling())
+      any = true;
+  }
+  if (!any)
+    return 0;
+  return recover_replicas(max);
+}
+
+/*
+ * add the next osd_backfill_scan_max objects at or after key pos to pm,
+ * and return the key the chunk ends at.
+ */
+uint64_t ReplicatedPG::scan_backfill(uint64_t pos, Missing& pm)
+{
+  vector<hobject_t> ls;
+  uint64_t end;
+  if (!list_chunk(pos, g_conf->osd_backfill_scan_max, ls, &end)) {
+    derr << "scan_backfill collection not listed in hash order; backfill needs HashIndex" << dendl;
+    assert(0);
+  }
+
+  for (vector<hobject_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    if (log.objects.count(*p) && log.objects[*p]->is_delete())
+      continue;   // removal not applied yet
+    bufferlist bv;
+    int r = osd->store->getattr(coll, *p, OI_ATTR, bv);
+    if (r < 0)
+      continue;
+    object_info_t oi(bv);
+    pm.add(*p, oi.version, eversion_t());
+  }
+
+  // updates we have logged but not applied may not be listed yet
+  for (Log::entry_list::reverse_iterator p = log.log.rbegin();
+       p != log.log.rend() && p->version > last_update_applied;
+       ++p) {
+    uint64_t key = backfill_key(p->soid);
+    if (key < pos || key >= end || !p->is_update() ||
+	log.objects[p->soid] != &*p ||
+	pm.is_missing(p->soid))
+      continue;
+    pm.add(p->soid, p->version, eversion_t());
+  }
+  return end;
+}
+
+void ReplicatedPG::send_backfill_progress(int peer, uint64_t lb)
+{
+  vector<OSDOp> ops(1);
+  ops[0].op.op = CEPH_OSD_OP_BACKFILL_PROGRESS;
+  ops[0].op.extent.offset = lb;
+  hobject_t poid;
+  eversion_t v;
+  osd_reqid_t reqid;
+  MOSDSubOp *subop = new MOSDSubOp(reqid, info.pgid, poid, false, 0,
+				   osd->osdmap->get_epoch(), osd->get_tid(), v);
+  subop->ops = ops;
+  osd->cluster_messenger->send_message(subop, osd->osdmap->get_cluster_inst(peer));
+}
+
+void ReplicatedPG::sub_op_backfill_progress(MOSDSubOp *op)
+{
+  uint64_t lb = op->ops[0].op.extent.offset;
+  dout(10) << "sub_op_backfill_progress " << hex << info.last_backfill << " -> " << lb << dec << dendl;
+  if (!is_replica() || op->map_epoch < info.history.same_interval_since) {
+    dout(10) << " from an old interval, ignoring" << dendl;
+    op->put();
+    return;
+  }
+  info.last_backfill = lb;
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  write_info(*t);
+  int tr = osd->store->queue_transaction(&osr, t, new ObjectStore::C_DeleteTransaction(t));
+  assert(tr == 0);
+  op->put();
+}
+
 void ReplicatedPG::remove_object_with_snap_hardlinks(ObjectStore::Transaction& t, const hobject_t& soid)
 {
+  invalidate_object_context(soid);
   t.remove(coll, soid);
   if (soid.snap < CEPH_MAXSNAP) {
     bufferlist ba;
@@ -5163,7 +6885,7 @@ void ReplicatedPG::clean_up_local(ObjectStore::Transaction& t)
     dout(10) << " " << s.size() << " local objects" << dendl;
 
     set<hobject_t> did;
-    for (list<Log::Entry>::reverse_iterator p = log.log.rbegin();
+    for (Log::entry_list::reverse_iterator p = log.log.rbegin();
          p != log.log.rend();
          p++) {
       if (did.count(p->soid)) continue;
@@ -5192,7 +6914,7 @@ void ReplicatedPG::clean_up_local(ObjectStore::Transaction& t)
   } else {
     // just scan the log.
     set<hobject_t> did;
-    for (list<Log::Entry>::reverse_iterator p = log.log.rbegin();
+    for (Log::entry_list::reverse_iterator p = log.log.rbegin();
          p != log.log.rend();
          p++) {
       if (did.count(p->soid))
@@ -5230,8 +6952,6 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
   SnapSet snapset;
   vector<snapid_t>::reverse_iterator curclone;
 
-  object_stat_collection_t cstat;
-
   bufferlist last_data;
 
   for (map<hobject_t,ScrubMap::object>::reverse_iterator p = scrubmap.objects.rbegin(); 
@@ -5302,6 +7022,9 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
 
     dout(20) << mode << "  " << soid << " " << oi << dendl;
 
+    if (oi.is_whiteout())
+      continue;  // not a user object; not counted
+
     stat.num_bytes += p->second.size;
     stat.num_kb += SHIFT_ROUND_UP(p->second.size, 10);
 
@@ -5340,31 +7063,46 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
     }
 
     string cat; // fixme
-    cstat.add(stat, cat);
+    scrub_cstat.add(stat, cat);
   }  
-  
+
+  dout(10) << "_scrub (" << mode << ") finish" << dendl;
+  return errors;
+}
+
+void ReplicatedPG::_scrub_finish(int& errors, int& fixed)
+{
+  bool repair = state_test(PG_STATE_REPAIR);
+  const char *mode = repair ? "repair":"scrub";
+
+  if (info.last_update != scrub_begin_version) {
+    // chunks scrubbed early may have changed since; the sums can't match
+    dout(10) << mode << " pg written during scrub, not checking stats" << dendl;
+    return;
+  }
+
   dout(10) << mode << " got "
-	   << cstat.sum.num_objects << "/" << info.stats.stats.sum.num_objects << " objects, "
-	   << cstat.sum.num_object_clones << "/" << info.stats.stats.sum.num_object_clones << " clones, "
-	   << cstat.sum.num_bytes << "/" << info.stats.stats.sum.num_bytes << " bytes, "
-	   << cstat.sum.num_kb << "/" << info.stats.stats.sum.num_kb << " kb."
+	   << scrub_cstat.sum.num_objects << "/" << info.stats.stats.sum.num_objects << " objects, "
+	   << scrub_cstat.sum.num_object_clones << "/" << info.stats.stats.sum.num_object_clones << " clones, "
+	   << scrub_cstat.sum.num_bytes << "/" << info.stats.stats.sum.num_bytes << " bytes, "
+	   << scrub_cstat.sum.num_kb << "/" << info.stats.stats.sum.num_kb << " kb."
 	   << dendl;
 
-  if (cstat.sum.num_objects != info.stats.stats.sum.num_objects ||
-      cstat.sum.num_object_clones != info.stats.stats.sum.num_object_clones ||
-      cstat.sum.num_bytes != info.stats.stats.sum.num_bytes ||
-      cstat.sum.num_kb != info.stats.stats.sum.num_kb) {
+  if (scrub_cstat.sum.num_objects != info.stats.stats.sum.num_objects ||
+      scrub_cstat.sum.num_object_clones != info.stats.stats.sum.num_object_clones ||
+      scrub_cstat.sum.num_bytes != info.stats.stats.sum.num_bytes ||
+      scrub_cstat.sum.num_kb != info.stats.stats.sum.num_kb) {
     osd->clog.error() << info.pgid << " " << mode
        << " stat mismatch, got "
-       << cstat.sum.num_objects << "/" << info.stats.stats.sum.num_objects << " objects, "
-       << cstat.sum.num_object_clones << "/" << info.stats.stats.sum.num_object_clones << " clones, "
-       << cstat.sum.num_bytes << "/" << info.stats.stats.sum.num_bytes << " bytes, "
-       << cstat.sum.num_kb << "/" << info.stats.stats.sum.num_kb << " kb.\n";
+       << scrub_cstat.sum.num_objects << "/" << info.stats.stats.sum.num_objects << " objects, "
+       << scrub_cstat.sum.num_object_clones << "/" << info.stats.stats.sum.num_object_clones << " clones, "
+       << scrub_cstat.sum.num_bytes << "/" << info.stats.stats.sum.num_bytes << " bytes, "
+       << scrub_cstat.sum.num_kb << "/" << info.stats.stats.sum.num_kb << " kb.\n";
     errors++;
 
     if (repair) {
       fixed++;
-      info.stats.stats = cstat;
+      info.stats.stats = scrub_cstat;
       update_stats();
 
       // tell replicas
@@ -5375,9 +7113,6 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
       }
     }
   }
-
-  dout(10) << "_scrub (" << mode << ") finish" << dendl;
-  return errors;
 }
 
 /*---SnapTrimmer Logging---*/
@@ -5524,6 +7259,13 @@ void ReplicatedPG::TrimmingObjects::exit()
   context< SnapTrimmer >().log_exit(state_name, enter_time);
 }
 
+/*
+ * Trim up to osd_snap_trim_batch objects per pass, each in its own small
+ * transaction, and keep at most osd_snap_trim_max_in_flight of them
+ * outstanding; between passes the pg is unlocked and goes to the back
+ * of the queue, so client ops on it (and other pgs' trimming) get their
+ * turn.
+ */
 boost::statechart::result ReplicatedPG::TrimmingObjects::react(const SnapTrim&)
 {
   dout(10) << "TrimmingObjects react" << dendl;
@@ -5532,36 +7274,62 @@ boost::statechart::result ReplicatedPG::TrimmingObjects::react(const SnapTrim&)
   snapid_t &snap_to_trim = context<SnapTrimmer>().snap_to_trim;
   set<RepGather *> &repops = context<SnapTrimmer>().repops;
 
+  // forget the updates that have finished
+  for (set<RepGather *>::iterator i = repops.begin(); i != repops.end(); ) {
+    if ((*i)->applied && (*i)->waitfor_ack.empty()) {
+      (*i)->put();
+      repops.erase(i++);
+    } else {
+      ++i;
+    }
+  }
+  context< SnapTrimmer >().requeue = true;
+
+  int trimmed = 0;
+  while (position != obs_to_trim.end() &&
+	 trimmed < g_conf->osd_snap_trim_batch) {
+    if ((int)repops.size() >= g_conf->osd_snap_trim_max_in_flight) {
+      // each one requeues us as it completes
+      dout(10) << "TrimmingObjects " << repops.size() << " trims in flight, waiting" << dendl;
+      context< SnapTrimmer >().requeue = false;
+      break;
+    }
+
+    dout(10) << "TrimmingObjects react trimming " << *position << dendl;
+    RepGather *repop = pg->trim_object(*position, snap_to_trim);
+
+    if (repop) {
+      repop->queue_snap_trimmer = true;
+      eversion_t old_last_update = pg->log.head;
+      bool old_exists = repop->obc->obs.exists;
+      uint64_t old_size = repop->obc->obs.oi.size;
+      eversion_t old_version = repop->obc->obs.oi.version;
+
+      pg->append_log(repop->ctx->log, eversion_t(), repop->ctx->local_t);
+      pg->issue_repop(repop, repop->ctx->mtime, old_last_update, old_exists, old_size, old_version);
+      pg->eval_repop(repop);
+
+      repops.insert(repop);
+      ++position;
+    } else {
+      // object has already been trimmed, this is an extra
+      coll_t col_to_trim(pg->info.pgid, snap_to_trim);
+      ObjectStore::Transaction *t = new ObjectStore::Transaction;
+      t->collection_remove(col_to_trim, *position);
+      int r = pg->osd->store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
+      assert(r == 0);
+      ++position;
+    }
+    trimmed++;
+  }
+  if (trimmed)
+    pg->osd->op_sched.charge(OpScheduler::SNAPTRIM, 0, trimmed);
+
   // Done, 
   if (position == obs_to_trim.end()) {
     post_event(SnapTrim());
     return transit< WaitingOnReplicas >();
   }
-
-  dout(10) << "TrimmingObjects react trimming " << *position << dendl;
-  RepGather *repop = pg->trim_object(*position, snap_to_trim);
-
-  if (repop) {
-    repop->queue_snap_trimmer = true;
-    eversion_t old_last_update = pg->log.head;
-    bool old_exists = repop->obc->obs.exists;
-    uint64_t old_size = repop->obc->obs.oi.size;
-    eversion_t old_version = repop->obc->obs.oi.version;
-    
-    pg->append_log(repop->ctx->log, eversion_t(), repop->ctx->local_t);
-    pg->issue_repop(repop, repop->ctx->mtime, old_last_update, old_exists, old_size, old_version);
-    pg->eval_repop(repop);
-    
-    repops.insert(repop);
-    ++position;
-  } else {
-    // object has already been trimmed, this is an extra
-    coll_t col_to_trim(pg->info.pgid, snap_to_trim);
-    ObjectStore::Transaction *t = new ObjectStore::Transaction;
-    t->collection_remove(col_to_trim, *position);
-    int r = pg->osd->store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
-    assert(r == 0);
-  }
   return discard_event();
 }
 /* WaitingOnReplicasObjects */
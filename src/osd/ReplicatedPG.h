@@ -261,8 +261,12 @@ public:
    * replicas ack.
    */
   struct ObjectContext {
+    MEMPOOL_CLASS_HELPERS(mempool::osd_obc)
+
     int ref;
     bool registered; 
+    bool cached;     // in object_context_cache
+    list<ObjectContext*>::iterator cache_pos;
     ObjectState obs;
 
     SnapSetContext *ssc;  // may be null
@@ -277,7 +281,7 @@ public:
     map<Watch::Notification *, bool> notifs;
 
     ObjectContext(const object_info_t &oi_, bool exists_, SnapSetContext *ssc_)
-      : ref(0), registered(false), obs(oi_, exists_), ssc(ssc_),
+      : ref(0), registered(false), cached(false), obs(oi_, exists_), ssc(ssc_),
 	lock("ReplicatedPG::ObjectContext::lock"),
 	unstable_writes(0), readers(0), writers_waiting(0), readers_waiting(0) {}
     
@@ -358,6 +362,19 @@ public:
     vector<PG::Log::Entry> log;
 
     interval_set<uint64_t> modified_ranges;
+
+    // every byte of object data this op changes, for the log entry, unless
+    // the op replaces the object wholesale (or it did not exist)
+    bool dirty_known;
+    interval_set<uint64_t> dirty;
+    void mark_dirty(uint64_t off, uint64_t len) {
+      if (!dirty_known || !len)
+	return;
+      interval_set<uint64_t> ch;
+      ch.insert(off, len);
+      dirty.union_of(ch);
+    }
+
     ObjectContext *obc;          // For ref counting purposes
     map<hobject_t,ObjectContext*> src_obc;
     ObjectContext *clone_obc;    // if we created a clone
@@ -367,6 +384,12 @@ public:
 
     MOSDOpReply *reply;
 
+    // queued writes merged into this one (see coalesce_writes); they
+    // share our transaction, but get their own log entries and replies
+    list<MOSDOp*> coalesced;
+    map<MOSDOp*, eversion_t> coalesced_versions;  // each one's own log entry
+    bool coalesced_acked;
+
     utime_t readable_stamp;  // when applied on all replicas
     ReplicatedPG *pg;
 
@@ -381,7 +404,9 @@ public:
       modify(false), user_modify(false),
       watch_connect(false), watch_disconnect(false),
       bytes_written(0), bytes_read(0),
-      obc(0), clone_obc(0), snapset_obc(0), data_off(0), reply(NULL), pg(_pg) { 
+      dirty_known(_obs->exists),
+      obc(0), clone_obc(0), snapset_obc(0), data_off(0), reply(NULL),
+      coalesced_acked(false), pg(_pg) {
       if (_ssc) {
 	new_snapset = _ssc->snapset;
 	snapset = &_ssc->snapset;
@@ -389,6 +414,7 @@ public:
     }
     ~OpContext() {
       assert(!clone_obc);
+      assert(coalesced.empty());
       if (reply)
 	reply->put();
     }
@@ -449,6 +475,10 @@ public:
 	assert(src_obc.empty());
 	if (ctx->op)
 	  ctx->op->put();
+	while (!ctx->coalesced.empty()) {
+	  ctx->coalesced.front()->put();
+	  ctx->coalesced.pop_front();
+	}
 	delete ctx;
 	delete this;
 	//generic_dout(0) << "deleting " << this << dendl;
@@ -486,6 +516,23 @@ protected:
   map<hobject_t, ObjectContext*> object_contexts;
   map<object_t, SnapSetContext*> snapset_contexts;
 
+  /*
+   * on the primary, contexts that drop to ref 0 stay registered in an
+   * lru of up to osd_object_context_cache_max, so hot objects don't
+   * reread and decode their object_info on every op.  dropped on any
+   * change of interval, for objects we are recovering, and by anything
+   * that modifies an object behind the contexts' back.
+   */
+  list<ObjectContext*> object_context_cache;   // most recently used first
+  void _uncache_object_context(ObjectContext *obc) {
+    assert(obc->cached);
+    object_context_cache.erase(obc->cache_pos);
+    obc->cached = false;
+  }
+  void _delete_object_context(ObjectContext *obc);
+  void trim_object_context_cache(unsigned max);
+  void invalidate_object_context(const hobject_t& soid);
+
   void populate_obc_watchers(ObjectContext *obc);
   void register_unconnected_watcher(void *obc,
 				    entity_name_t entity,
@@ -499,6 +546,8 @@ protected:
   ObjectContext *lookup_object_context(const hobject_t& soid) {
     if (object_contexts.count(soid)) {
       ObjectContext *obc = object_contexts[soid];
+      if (obc->cached)
+	_uncache_object_context(obc);
       obc->ref++;
       return obc;
     }
@@ -524,6 +573,8 @@ protected:
 			  bool can_create, snapid_t *psnapid=NULL);
 
   void get_src_oloc(const object_t& oid, const object_locator_t& oloc, object_locator_t& src_oloc);
+  /// the key of osd_op's source object in src_obc
+  hobject_t get_src_hobj(MOSDOp *op, const OSDOp& osd_op, object_locator_t *src_oloc = 0);
 
   SnapSetContext *get_snapset_context(const object_t& oid, const string &key,
 				      ps_t seed, bool can_create);
@@ -567,6 +618,8 @@ protected:
   void calc_clone_subsets(SnapSet& snapset, const hobject_t& poid, Missing& missing,
 			  interval_set<uint64_t>& data_subset,
 			  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
+  bool calc_dirty_since(const hobject_t& soid, eversion_t have, eversion_t need,
+			interval_set<uint64_t>& dirty);
   void push_to_replica(ObjectContext *obc, const hobject_t& oid, int dest);
   void push_start(const hobject_t& oid, int dest);
   void push_start(const hobject_t& soid, int peer,
@@ -589,7 +642,15 @@ protected:
 
   void _make_clone(ObjectStore::Transaction& t,
 		   const hobject_t& head, const hobject_t& coid,
-		   object_info_t *poi);
+		   object_info_t *poi, bool sparse = false, uint64_t size = 0);
+  bool is_sparse_clone(const hobject_t& soid);
+  int read_object(const hobject_t& soid, uint64_t off, uint64_t len,
+		  bufferlist& bl, int flags = 0);
+  int fiemap_object(const hobject_t& soid, uint64_t off, uint64_t len,
+		    bufferlist& bl);
+  int sparse_read_object(const hobject_t& soid, uint64_t off, uint64_t len,
+			 map<uint64_t, uint64_t>& m, bufferlist& data_bl,
+			 int flags = 0);
   void make_writeable(OpContext *ctx);
   void log_op_stats(OpContext *ctx);
 
@@ -610,6 +671,9 @@ protected:
   int start_recovery_ops(int max);
   int recover_primary(int max);
   int recover_replicas(int max);
+  int recover_backfill(int max);
+  uint64_t scan_backfill(uint64_t pos, Missing& pm);
+  void send_backfill_progress(int peer, uint64_t lb);
 
   void dump_watchers(ObjectContext *obc);
   void remove_watcher(ObjectContext *obc, entity_name_t entity);
@@ -640,6 +704,7 @@ protected:
       rm->pg->sub_op_modify_applied(rm);
     }
   };
+  bool send_sub_op_commit(RepModify *rm);
   struct C_OSD_RepModifyCommit : public Context {
     RepModify *rm;
     C_OSD_RepModifyCommit(RepModify *r) : rm(r) { }
@@ -699,6 +764,7 @@ protected:
   void _applied_pushed_object(ObjectStore::Transaction *t, ObjectContext *obc);
   void _committed_pushed_object(MOSDSubOp *op, epoch_t same_since, eversion_t lc);
   void recover_primary_got(hobject_t oid, eversion_t v);
+  void sub_op_backfill_progress(MOSDSubOp *op);
   void sub_op_push(MOSDSubOp *op);
   void _failed_push(MOSDSubOp *op);
   void sub_op_push_reply(MOSDSubOpReply *reply);
@@ -709,6 +775,7 @@ protected:
 
   // -- scrub --
   virtual int _scrub(ScrubMap& map, int& errors, int& fixed);
+  virtual void _scrub_finish(int& errors, int& fixed);
 
   void apply_and_flush_repops(bool requeue);
 
@@ -719,12 +786,53 @@ protected:
   bool pgls_filter(PGLSFilter *filter, hobject_t& sobj, bufferlist& outdata);
   int get_pgls_filter(bufferlist::iterator& iter, PGLSFilter **pfilter);
 
+  // -- write coalescing --
+  MOSDOp *coalesce_retry;  // op do_op is rerunning on its own, if any
+  bool can_coalesce(MOSDOp *op, MOSDOp *m);
+  void coalesce_writes(MOSDOp *op, list<MOSDOp*>& merged);
+  void uncoalesce_writes(MOSDOp *op, unsigned nops, list<MOSDOp*>& merged);
+  void reply_coalesced(RepGather *repop);
+
+  // -- cache tier --
+  /*
+   * In a cache pool a miss promotes the object from the base pool with
+   * one COPY_GET through the osd's objecter, and ops on it wait here
+   * until the copy commits.  Deletes leave a dirty whiteout behind.
+   * The agent flushes dirty objects to the base pool and evicts clean
+   * ones that aren't in the recent hit sets.
+   */
+  uint64_t last_tier_seq;
+  map<hobject_t, uint64_t> promoting;    // object -> seq of its COPY_GET
+  map<hobject_t, list<Message*> > waiting_for_promote;
+  map<hobject_t, pair<uint64_t, eversion_t> > flushing;  // -> seq, version
+  list<set<uint32_t> > hit_sets;         // object hashes, newest first
+  utime_t hit_set_start;
+  collection_list_handle_t agent_pos;
+
+  void hit_set_record(const hobject_t& soid);
+  bool hit_set_contains(const hobject_t& soid);
+  bool maybe_promote(MOSDOp *op, const hobject_t& head);
+  RepGather *start_internal_op(ObjectContext *obc);
+  void finish_internal_op(RepGather *repop, int logop);
+  bool agent_flush(ObjectContext *obc);
+  bool agent_evict(ObjectContext *obc);
+  bool agent_over_target();
+
+public:
+  void finish_promote(const hobject_t& soid, uint64_t seq, int r, bufferlist& bl);
+  void finish_flush(const hobject_t& soid, uint64_t seq, int r);
+  void agent_work();
+
 public:
   ReplicatedPG(OSD *o, PGPool *_pool, pg_t p, const hobject_t& oid, const hobject_t& ioid);
   ~ReplicatedPG() {}
 
 
   void do_op(MOSDOp *op);
+  bool can_fast_read(MOSDOp *op, ObjectContext *obc);
+  void do_fast_read(MOSDOp *op, ObjectContext *obc);
+  int do_fast_read_ops(vector<OSDOp>& ops, const object_info_t& oi,
+		       bufferlist& odata, uint64_t *data_off);
   void do_pg_op(MOSDOp *op);
   void do_sub_op(MOSDSubOp *op);
   void do_sub_op_reply(MOSDSubOpReply *op);
@@ -813,6 +921,8 @@ public:
   bool is_degraded_object(const hobject_t& oid);
   void wait_for_degraded_object(const hobject_t& oid, Message *op);
 
+  bool can_serve_replica_read(const hobject_t& oid);
+
   void mark_all_unfound_lost(int what);
   eversion_t pick_newest_available(const hobject_t& oid);
   ObjectContext *mark_object_lost(ObjectStore::Transaction *t,
@@ -23,9 +23,58 @@ bool Watch::ack_notification(entity_name_t& watcher, Notification *notif)
   return notif->watchers.empty(); // true if there are no more watchers
 }
 
+void Watch::schedule_timeout(Notification *notif, utime_t expire)
+{
+  cancel_timeout(notif);
+  notif->expire = expire;
+  timeouts.insert(make_pair(expire, notif->id));
+  _arm_timeout();
+}
+
+void Watch::cancel_timeout(Notification *notif)
+{
+  if (notif->expire == utime_t())
+    return;
+  timeouts.erase(make_pair(notif->expire, notif->id));
+  notif->expire = utime_t();
+  // leave the timer event be; it will find nothing due and rearm.
+}
+
+void Watch::_arm_timeout()
+{
+  if (timeouts.empty())
+    return;
+  utime_t first = timeouts.begin()->first;
+  if (timeout_event) {
+    if (timeout_event_at <= first)
+      return;
+    osd->watch_timer.cancel_event(timeout_event);
+  }
+  timeout_event = new C_NotifyTimeout(this);
+  timeout_event_at = first;
+  osd->watch_timer.add_event_at(first, timeout_event);
+}
+
+void Watch::handle_timeouts()
+{
+  utime_t now = ceph_clock_now(g_ceph_context);
+  while (!timeouts.empty() && timeouts.begin()->first <= now) {
+    uint64_t id = timeouts.begin()->second;
+    timeouts.erase(timeouts.begin());
+    Notification *notif = get_notif(id);
+    if (!notif)
+      continue;
+    notif->expire = utime_t();
+    // drops watch_lock for a while; we re-check the set after
+    osd->handle_notify_timeout(notif);
+  }
+  _arm_timeout();
+}
+
 void Watch::C_NotifyTimeout::finish(int r)
 {
-  osd->handle_notify_timeout(notif);
+  watch->timeout_event = NULL;
+  watch->handle_timeouts();
 }
 
 void Watch::C_WatchTimeout::finish(int r)
@@ -17,6 +17,7 @@
 #define CEPH_WATCH_H
 
 #include <map>
+#include <set>
 
 #include "OSD.h"
 #include "common/config.h"
@@ -26,6 +27,7 @@ class MWatchNotify;
 /* keeps track and accounts sessions, watchers and notifiers */
 class Watch {
   uint64_t notif_id;
+  OSD *osd;
 
 public:
   enum WatcherState {
@@ -40,7 +42,7 @@ public:
     OSD::Session *session;
     uint64_t cookie;
     MWatchNotify *reply;
-    Context *timeout;
+    utime_t expire;   /* zero if no timeout is scheduled */
     void *obc;
     pg_t pgid;
     bufferlist bl;
@@ -49,14 +51,14 @@ public:
       watchers[name] = state;
     }
 
-    Notification(entity_name_t& n, OSD::Session *s, uint64_t c, bufferlist& b) : name(n), session(s), cookie(c), bl(b) { }
+    Notification(entity_name_t& n, OSD::Session *s, uint64_t c, bufferlist& b) : name(n), session(s), cookie(c), reply(NULL), obc(NULL), bl(b) { }
   };
 
+  /* the one timer event for notify timeouts, set for the soonest */
   class C_NotifyTimeout : public Context {
-    OSD *osd;
-    Notification *notif;
+    Watch *watch;
   public:
-    C_NotifyTimeout(OSD *_osd, Notification *_notif) : osd(_osd), notif(_notif) {}
+    C_NotifyTimeout(Watch *_watch) : watch(_watch) {}
     void finish(int r);
   };
 
@@ -76,8 +78,16 @@ public:
 private:
   std::map<uint64_t, Notification *> notifs; /* notif_id to notifications */
 
+  /* pending notify timeouts, soonest first.  with many notifies in flight
+     this keeps a single event on the timer instead of one per notify. */
+  std::set< std::pair<utime_t, uint64_t> > timeouts;
+  Context *timeout_event;
+  utime_t timeout_event_at;
+
+  void _arm_timeout();
+
 public:
-  Watch() : notif_id(0) {}
+  Watch(OSD *o) : notif_id(0), osd(o), timeout_event(NULL) {}
 
   void add_notification(Notification *notif) {
     notif->id = ++notif_id;
@@ -96,6 +106,11 @@ public:
   }
 
   bool ack_notification(entity_name_t& watcher, Notification *notif);
+
+  /* all of these need the osd's watch_lock */
+  void schedule_timeout(Notification *notif, utime_t expire);
+  void cancel_timeout(Notification *notif);
+  void handle_timeouts();
 };
 
 
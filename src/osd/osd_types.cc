@@ -36,6 +36,20 @@ void osd_reqid_t::decode(bufferlist::iterator &bl)
 
 // -- pg_t --
 
+const char *osd_op_stage_name(int s)
+{
+  switch (s) {
+  case OSD_OP_STAGE_QUEUED: return "queued";
+  case OSD_OP_STAGE_STARTED: return "started";
+  case OSD_OP_STAGE_SUBMITTED: return "submitted";
+  case OSD_OP_STAGE_COMMITTED: return "committed";
+  case OSD_OP_STAGE_APPLIED: return "applied";
+  case OSD_OP_STAGE_REPLICATED: return "replicated";
+  case OSD_OP_STAGE_REPLIED: return "replied";
+  default: return "???";
+  }
+}
+
 int pg_t::print(char *o, int maxlen) const
 {
   if (preferred() >= 0)
@@ -243,6 +257,8 @@ void pg_pool_t::dump(Formatter *f) const
   f->dump_int("localized_pg_num", get_lpg_num());
   f->dump_int("localized_pg_placement_num", get_lpgp_num());
   f->dump_unsigned("crash_replay_interval", get_crash_replay_interval());
+  f->dump_unsigned("op_rate_limit", get_op_rate_limit());
+  f->dump_unsigned("byte_rate_limit", get_byte_rate_limit());
   f->dump_stream("last_change") << get_last_change();
   f->dump_unsigned("auid", get_auid());
   f->dump_string("snap_mode", is_pool_snaps_mode() ? "pool" : "selfmanaged");
@@ -256,6 +272,19 @@ void pg_pool_t::dump(Formatter *f) const
   }
   f->close_section();
   f->dump_stream("removed_snaps") << removed_snaps;
+  f->open_array_section("tiers");
+  for (set<int64_t>::const_iterator p = tiers.begin(); p != tiers.end(); ++p)
+    f->dump_int("pool_id", *p);
+  f->close_section();
+  f->dump_int("tier_of", tier_of);
+  f->dump_int("read_tier", read_tier);
+  f->dump_int("write_tier", write_tier);
+  f->dump_string("cache_mode", get_cache_mode_name());
+  f->dump_unsigned("target_max_bytes", target_max_bytes);
+  f->dump_unsigned("target_max_objects", target_max_objects);
+  f->dump_unsigned("cache_min_flush_age", cache_min_flush_age);
+  f->dump_unsigned("hit_set_period", hit_set_period);
+  f->dump_unsigned("hit_set_count", hit_set_count);
 }
 
 
@@ -427,6 +456,10 @@ void pg_pool_t::encode(bufferlist& bl, uint64_t features) const
   }
 
   __u8 struct_v = 4;
+  if (features & CEPH_FEATURE_OSD_CACHEPOOL)
+    struct_v = 6;
+  else if (features & CEPH_FEATURE_POOLRATELIMIT)
+    struct_v = 5;
   ::encode(struct_v, bl);
   ::encode(type, bl);
   ::encode(size, bl);
@@ -444,13 +477,30 @@ void pg_pool_t::encode(bufferlist& bl, uint64_t features) const
   ::encode(auid, bl);
   ::encode(flags, bl);
   ::encode(crash_replay_interval, bl);
+  if (struct_v >= 5) {
+    ::encode(op_rate_limit, bl);
+    ::encode(byte_rate_limit, bl);
+  }
+  if (struct_v >= 6) {
+    ::encode(tiers, bl);
+    ::encode(tier_of, bl);
+    ::encode(read_tier, bl);
+    ::encode(write_tier, bl);
+    __u8 c = cache_mode;
+    ::encode(c, bl);
+    ::encode(target_max_bytes, bl);
+    ::encode(target_max_objects, bl);
+    ::encode(cache_min_flush_age, bl);
+    ::encode(hit_set_period, bl);
+    ::encode(hit_set_count, bl);
+  }
 }
 
 void pg_pool_t::decode(bufferlist::iterator& bl)
 {
   __u8 struct_v;
   ::decode(struct_v, bl);
-  if (struct_v > 4)
+  if (struct_v > 6)
     throw buffer::error();
 
   ::decode(type, bl);
@@ -494,6 +544,34 @@ void pg_pool_t::decode(bufferlist::iterator& bl)
       crash_replay_interval = 0;
   }
 
+  if (struct_v >= 5) {
+    ::decode(op_rate_limit, bl);
+    ::decode(byte_rate_limit, bl);
+  } else {
+    op_rate_limit = byte_rate_limit = 0;
+  }
+
+  if (struct_v >= 6) {
+    ::decode(tiers, bl);
+    ::decode(tier_of, bl);
+    ::decode(read_tier, bl);
+    ::decode(write_tier, bl);
+    __u8 c;
+    ::decode(c, bl);
+    cache_mode = (cache_mode_t)c;
+    ::decode(target_max_bytes, bl);
+    ::decode(target_max_objects, bl);
+    ::decode(cache_min_flush_age, bl);
+    ::decode(hit_set_period, bl);
+    ::decode(hit_set_count, bl);
+  } else {
+    tiers.clear();
+    clear_tier();
+    target_max_bytes = target_max_objects = 0;
+    cache_min_flush_age = 0;
+    hit_set_period = hit_set_count = 0;
+  }
+
   calc_pg_masks();
 }
 
@@ -513,6 +591,26 @@ ostream& operator<<(ostream& out, const pg_pool_t& p)
     out << " flags " << p.flags;
   if (p.crash_replay_interval)
     out << " crash_replay_interval " << p.crash_replay_interval;
+  if (p.op_rate_limit)
+    out << " op_rate_limit " << p.op_rate_limit;
+  if (p.byte_rate_limit)
+    out << " byte_rate_limit " << p.byte_rate_limit;
+  if (p.has_tiers())
+    out << " tiers " << p.tiers;
+  if (p.is_tier())
+    out << " tier_of " << p.tier_of;
+  if (p.has_read_tier())
+    out << " read_tier " << p.read_tier;
+  if (p.has_write_tier())
+    out << " write_tier " << p.write_tier;
+  if (p.cache_mode)
+    out << " cache_mode " << p.get_cache_mode_name();
+  if (p.target_max_bytes)
+    out << " target_bytes " << p.target_max_bytes;
+  if (p.target_max_objects)
+    out << " target_objects " << p.target_max_objects;
+  if (p.hit_set_period)
+    out << " hit_set period " << p.hit_set_period << " count " << p.hit_set_count;
   return out;
 }
 
@@ -565,7 +663,7 @@ void OSDSuperblock::decode(bufferlist::iterator &bl)
 
 void SnapSet::encode(bufferlist& bl) const
 {
-  __u8 v = 1;
+  __u8 v = 2;
   ::encode(v, bl);
   ::encode(seq, bl);
   ::encode(head_exists, bl);
@@ -573,6 +671,7 @@ void SnapSet::encode(bufferlist& bl) const
   ::encode(clones, bl);
   ::encode(clone_overlap, bl);
   ::encode(clone_size, bl);
+  ::encode(sparse_clones, bl);
 }
 
 void SnapSet::decode(bufferlist::iterator& bl)
@@ -585,6 +684,10 @@ void SnapSet::decode(bufferlist::iterator& bl)
   ::decode(clones, bl);
   ::decode(clone_overlap, bl);
   ::decode(clone_size, bl);
+  if (v >= 2)
+    ::decode(sparse_clones, bl);
+  else
+    sparse_clones.clear();
 }
 
 ostream& operator<<(ostream& out, const SnapSet& cs)
@@ -594,6 +697,43 @@ ostream& operator<<(ostream& out, const SnapSet& cs)
 	     << (cs.head_exists ? "+head":"");
 }
 
+// -- clone_info / obj_list_snap_response_t --
+
+void clone_info::encode(bufferlist& bl) const
+{
+  __u8 v = 1;
+  ::encode(v, bl);
+  ::encode(cloneid, bl);
+  ::encode(snaps, bl);
+  ::encode(overlap, bl);
+  ::encode(size, bl);
+}
+
+void clone_info::decode(bufferlist::iterator& bl)
+{
+  __u8 v;
+  ::decode(v, bl);
+  ::decode(cloneid, bl);
+  ::decode(snaps, bl);
+  ::decode(overlap, bl);
+  ::decode(size, bl);
+}
+
+void obj_list_snap_response_t::encode(bufferlist& bl) const
+{
+  __u8 v = 1;
+  ::encode(v, bl);
+  ::encode(clones, bl);
+  ::encode(seq, bl);
+}
+
+void obj_list_snap_response_t::decode(bufferlist::iterator& bl)
+{
+  __u8 v;
+  ::decode(v, bl);
+  ::decode(clones, bl);
+  ::decode(seq, bl);
+}
 
 // -- watch_info_t --
 
@@ -651,7 +791,7 @@ ps_t object_info_t::legacy_object_locator_to_ps(const object_t &oid,
 
 void object_info_t::encode(bufferlist& bl) const
 {
-  const __u8 v = 7;
+  const __u8 v = 8;
   ::encode(v, bl);
   ::encode(soid, bl);
   ::encode(oloc, bl);
@@ -670,6 +810,7 @@ void object_info_t::encode(bufferlist& bl) const
   ::encode(lost, bl);
   ::encode(watchers, bl);
   ::encode(user_version, bl);
+  ::encode(flags, bl);
 }
 
 void object_info_t::decode(bufferlist::iterator& bl)
@@ -712,6 +853,10 @@ void object_info_t::decode(bufferlist::iterator& bl)
     ::decode(watchers, bl);
     ::decode(user_version, bl);
   }
+  if (v >= 8)
+    ::decode(flags, bl);
+  else
+    flags = 0;
 }
 
 ostream& operator<<(ostream& out, const object_info_t& oi)
@@ -724,6 +869,10 @@ ostream& operator<<(ostream& out, const object_info_t& oi)
     out << " " << oi.snaps;
   if (oi.lost)
     out << " LOST";
+  if (oi.is_dirty())
+    out << " DIRTY";
+  if (oi.is_whiteout())
+    out << " WHITEOUT";
   out << ")";
   return out;
 }
@@ -795,6 +944,10 @@ ostream& operator<<(ostream& out, const OSDOp& op)
     case CEPH_OSD_OP_ROLLBACK:
       out << " " << snapid_t(op.op.snap.snapid);
       break;
+    case CEPH_OSD_OP_SETALLOCHINT:
+      out << " object_size " << op.op.alloc_hint.expected_object_size
+	  << " write_size " << op.op.alloc_hint.expected_write_size;
+      break;
     default:
       out << " " << op.op.extent.offset << "~" << op.op.extent.length;
       if (op.op.extent.truncate_seq)
@@ -836,6 +989,9 @@ ostream& operator<<(ostream& out, const OSDOp& op)
       out << " v" << op.op.watch.ver
 	  << " of " << op.soid;
       break;
+    case CEPH_OSD_OP_COPY_FROM:
+      out << " " << op.soid;
+      break;
     case CEPH_OSD_OP_SRC_CMPXATTR:
       out << " " << op.soid;
       if (op.op.xattr.name_len && op.data.length()) {
@@ -84,6 +84,24 @@ namespace __gnu_cxx {
   };
 }
 
+/*
+ * Points a client op passes on its way through the OSD, in order.  Not
+ * every op reaches every stage: reads go straight from STARTED to
+ * REPLIED.
+ */
+enum {
+  OSD_OP_STAGE_QUEUED,      // put on the pg op queue (last time, if requeued)
+  OSD_OP_STAGE_STARTED,     // dequeued, pg locked
+  OSD_OP_STAGE_SUBMITTED,   // local transaction queued
+  OSD_OP_STAGE_COMMITTED,   // local transaction durable
+  OSD_OP_STAGE_APPLIED,     // local transaction readable
+  OSD_OP_STAGE_REPLICATED,  // durable on all replicas but us
+  OSD_OP_STAGE_REPLIED,     // final reply sent
+  OSD_OP_STAGE_MAX
+};
+
+const char *osd_op_stage_name(int s);
+
 
 
 
@@ -536,6 +554,27 @@ struct pg_pool_t {
     TYPE_REP = 1,     // replication
     TYPE_RAID4 = 2,   // raid4 (never implemented)
   };
+  enum {
+    FLAG_NOJOURNAL = 1,  // writes skip the osd journal (scratch data; see set_nojournal)
+  };
+  typedef enum {
+    CACHEMODE_NONE = 0,       // no caching
+    CACHEMODE_WRITEBACK = 1,  // promote on miss, flush dirty objects later
+  } cache_mode_t;
+  static const char *get_cache_mode_name(cache_mode_t m) {
+    switch (m) {
+    case CACHEMODE_NONE: return "none";
+    case CACHEMODE_WRITEBACK: return "writeback";
+    default: return "???";
+    }
+  }
+  static int get_cache_mode_from_str(const string& s) {
+    if (s == "none")
+      return CACHEMODE_NONE;
+    if (s == "writeback")
+      return CACHEMODE_WRITEBACK;
+    return -1;
+  }
 
   static const char *get_type_name(int t) {
     switch (t) {
@@ -560,6 +599,25 @@ struct pg_pool_t {
   epoch_t snap_epoch;       /// osdmap epoch of last snap
   uint64_t auid;            /// who owns the pg
   __u32 crash_replay_interval; /// seconds to allow clients to replay ACKed but unCOMMITted requests
+  uint64_t op_rate_limit;   /// client ops/sec each osd admits for this pool, 0 for no limit
+  uint64_t byte_rate_limit; /// client bytes/sec each osd admits for this pool, 0 for no limit
+
+  /*
+   * Cache tiering.  A cache pool is a tier of its base pool (tier_of);
+   * when the base pool's read_tier/write_tier point at it (the overlay),
+   * clients send ops there instead, and the cache pool's osds promote
+   * objects from the base pool on a miss and flush them back later.
+   */
+  set<int64_t> tiers;       /// pools that are tiers of us
+  int64_t tier_of;          /// pool we are a tier of, or -1
+  int64_t read_tier;        /// pool clients read from instead of us, or -1
+  int64_t write_tier;       /// pool clients write to instead of us, or -1
+  cache_mode_t cache_mode;  /// as a tier
+  uint64_t target_max_bytes;   /// flush and evict above this, 0 for no limit
+  uint64_t target_max_objects; /// flush and evict above this, 0 for no limit
+  uint32_t cache_min_flush_age; /// seconds an object stays dirty before flushing
+  uint32_t hit_set_period;  /// seconds each hit set covers
+  uint32_t hit_set_count;   /// hit sets an object must be absent from to be evicted
 
   /*
    * Pool snaps (global to this pool).  These define a SnapContext for
@@ -584,11 +642,18 @@ struct pg_pool_t {
       snap_seq(0), snap_epoch(0),
       auid(0),
       crash_replay_interval(0),
+      op_rate_limit(0), byte_rate_limit(0),
+      tier_of(-1), read_tier(-1), write_tier(-1),
+      cache_mode(CACHEMODE_NONE),
+      target_max_bytes(0), target_max_objects(0),
+      cache_min_flush_age(0),
+      hit_set_period(0), hit_set_count(0),
       pg_num_mask(0), pgp_num_mask(0), lpg_num_mask(0), lpgp_num_mask(0) { }
 
   void dump(Formatter *f) const;
 
   uint64_t get_flags() const { return flags; }
+  bool is_nojournal() const { return flags & FLAG_NOJOURNAL; }
   unsigned get_type() const { return type; }
   unsigned get_size() const { return size; }
   int get_crush_ruleset() const { return crush_ruleset; }
@@ -601,6 +666,29 @@ struct pg_pool_t {
   snapid_t get_snap_seq() const { return snap_seq; }
   uint64_t get_auid() const { return auid; }
   unsigned get_crash_replay_interval() const { return crash_replay_interval; }
+  uint64_t get_op_rate_limit() const { return op_rate_limit; }
+  uint64_t get_byte_rate_limit() const { return byte_rate_limit; }
+
+  bool is_tier() const { return tier_of >= 0; }
+  bool has_tiers() const { return !tiers.empty(); }
+  bool has_read_tier() const { return read_tier >= 0; }
+  bool has_write_tier() const { return write_tier >= 0; }
+  void clear_tier() {
+    tier_of = -1;
+    clear_read_tier();
+    clear_write_tier();
+    cache_mode = CACHEMODE_NONE;
+  }
+  void clear_read_tier() { read_tier = -1; }
+  void clear_write_tier() { write_tier = -1; }
+  cache_mode_t get_cache_mode() const { return cache_mode; }
+  const char *get_cache_mode_name() const {
+    return get_cache_mode_name(cache_mode);
+  }
+  /// we are a cache tier that promotes and flushes
+  bool is_cache() const {
+    return is_tier() && cache_mode == CACHEMODE_WRITEBACK;
+  }
 
   void set_snap_seq(snapid_t s) { snap_seq = s; }
   void set_snap_epoch(epoch_t e) { snap_epoch = e; }
@@ -1161,6 +1249,7 @@ struct SnapSet {
   vector<snapid_t> clones;   // ascending
   map<snapid_t, interval_set<uint64_t> > clone_overlap;  // overlap w/ next newest
   map<snapid_t, uint64_t> clone_size;
+  set<snapid_t> sparse_clones;  // don't store the data in their clone_overlap
 
   SnapSet() : head_exists(false) {}
   SnapSet(bufferlist& bl) {
@@ -1168,6 +1257,10 @@ struct SnapSet {
     decode(p);
   }
     
+  bool is_sparse(snapid_t c) const {
+    return sparse_clones.count(c);
+  }
+
   void encode(bufferlist& bl) const;
   void decode(bufferlist::iterator& bl);
 };
@@ -1175,6 +1268,32 @@ WRITE_CLASS_ENCODER(SnapSet)
 
 ostream& operator<<(ostream& out, const SnapSet& cs);
 
+/*
+ * reply to CEPH_OSD_OP_LIST_SNAPS: the clones of an object (and its
+ * head, as CEPH_NOSNAP, if it exists), oldest first.
+ */
+struct clone_info {
+  snapid_t cloneid;
+  vector<snapid_t> snaps;   // ascending
+  vector< pair<uint64_t,uint64_t> > overlap;   // with the next newer clone or head
+  uint64_t size;
+
+  clone_info() : cloneid(CEPH_NOSNAP), size(0) {}
+
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& bl);
+};
+WRITE_CLASS_ENCODER(clone_info)
+
+struct obj_list_snap_response_t {
+  vector<clone_info> clones;   // ascending
+  snapid_t seq;
+
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& bl);
+};
+WRITE_CLASS_ENCODER(obj_list_snap_response_t)
+
 
 
 #define OI_ATTR "_"
@@ -1210,6 +1329,11 @@ static inline ostream& operator<<(ostream& out, const notify_info_t& n) {
 
 
 struct object_info_t {
+  enum {
+    FLAG_DIRTY = 1,     // cache tier: newer than the base pool's copy
+    FLAG_WHITEOUT = 2,  // cache tier: deleted, but not yet in the base pool
+  };
+
   hobject_t soid;
   object_locator_t oloc;
   string category;
@@ -1230,6 +1354,13 @@ struct object_info_t {
 
   map<entity_name_t, watch_info_t> watchers;
 
+  uint32_t flags;          // FLAG_*
+
+  bool is_dirty() const { return flags & FLAG_DIRTY; }
+  bool is_whiteout() const { return flags & FLAG_WHITEOUT; }
+  void set_flag(uint32_t f) { flags |= f; }
+  void clear_flag(uint32_t f) { flags &= ~f; }
+
   void copy_user_bits(const object_info_t& other);
 
   static ps_t legacy_object_locator_to_ps(const object_t &oid, 
@@ -1244,7 +1375,7 @@ struct object_info_t {
 
   object_info_t(const hobject_t& s, const object_locator_t& o)
     : soid(s), oloc(o), size(0),
-      lost(false), truncate_seq(0), truncate_size(0) {}
+      lost(false), truncate_seq(0), truncate_size(0), flags(0) {}
 
   object_info_t(bufferlist& bl) {
     decode(bl);
@@ -1265,15 +1396,19 @@ struct ScrubMap {
     uint64_t size;
     bool negative;
     map<string,bufferptr> attrs;
+    bool digest_present;   // deep scrub read the data
+    uint32_t digest;       // crc32c of the data
 
-    object(): size(0),negative(0),attrs() {}
+    object(): size(0),negative(0),attrs(),digest_present(false),digest(0) {}
 
     void encode(bufferlist& bl) const {
-      __u8 struct_v = 1;
+      __u8 struct_v = 2;
       ::encode(struct_v, bl);
       ::encode(size, bl);
       ::encode(negative, bl);
       ::encode(attrs, bl);
+      ::encode(digest_present, bl);
+      ::encode(digest, bl);
     }
     void decode(bufferlist::iterator& bl) {
       __u8 struct_v;
@@ -1281,6 +1416,10 @@ struct ScrubMap {
       ::decode(size, bl);
       ::decode(negative, bl);
       ::decode(attrs, bl);
+      if (struct_v >= 2) {
+	::decode(digest_present, bl);
+	::decode(digest, bl);
+      }
     }
   };
   WRITE_CLASS_ENCODER(object)
@@ -72,7 +72,7 @@ int Filer::probe(inodeno_t ino,
   Probe *probe = new Probe(ino, *layout, snapid, start_from, end, pmtime, flags, fwd, onfinish);
   
   // period (bytes before we jump unto a new set of object(s))
-  uint64_t period = layout->fl_stripe_count * layout->fl_object_size;
+  uint64_t period = _probe_batch(layout);
   
   // start with 1+ periods.
   probe->probing_len = period;
@@ -83,6 +83,8 @@ int Filer::probe(inodeno_t ino,
     assert(start_from > *end);
     if (start_from % period)
       probe->probing_len -= period - (start_from % period);
+    if (probe->probing_len > probe->probing_off)
+      probe->probing_len = probe->probing_off;
     probe->probing_off -= probe->probing_len;
   }
   
@@ -91,6 +93,17 @@ int Filer::probe(inodeno_t ino,
 }
 
 
+/*
+ * How many bytes to probe at once: whole periods (sets of
+ * stripe_count objects), as many as fit in filer_max_probe_ops stats.
+ */
+uint64_t Filer::_probe_batch(ceph_file_layout *layout)
+{
+  uint64_t period = (uint64_t)layout->fl_stripe_count * layout->fl_object_size;
+  uint64_t periods = cct->_conf->filer_max_probe_ops / layout->fl_stripe_count;
+  return period * MAX(periods, 1);
+}
+
 void Filer::_probe(Probe *probe)
 {
   ldout(cct, 10) << "_probe " << hex << probe->ino << dec 
@@ -133,6 +146,7 @@ void Filer::_probed(Probe *probe, const object_t& oid, uint64_t size, utime_t mt
     probe->onfinish->finish(probe->err);
     delete probe->onfinish;
     delete probe;
+    return;
   }
 
   // analyze!
@@ -160,8 +174,11 @@ void Filer::_probed(Probe *probe, const object_t& oid, uint64_t size, utime_t mt
     if (!probe->found_size) {
       assert(probe->known_size[p->oid] <= shouldbe);
 
+      // backwards, an empty object is only the answer if nothing
+      // before it has data either
       if ((probe->fwd && probe->known_size[p->oid] == shouldbe) ||
-	  (!probe->fwd && probe->known_size[p->oid] == 0 && probe->probing_off > 0))
+	  (!probe->fwd && probe->known_size[p->oid] == 0 &&
+	   (probe->probing_off > 0 || p + 1 != probe->probing.end())))
 	continue;  // keep going
       
       // aha, we found the end!
@@ -194,15 +211,16 @@ void Filer::_probed(Probe *probe, const object_t& oid, uint64_t size, utime_t mt
     ldout(cct, 10) << "_probed probing further" << dendl;
 
     uint64_t period = probe->layout.fl_stripe_count * probe->layout.fl_object_size;
+    uint64_t batch = _probe_batch(&probe->layout);
     if (probe->fwd) {
       probe->probing_off += probe->probing_len;
       assert(probe->probing_off % period == 0);
-      probe->probing_len = period;
+      probe->probing_len = batch;
     } else {
-      // previous period.
+      // previous periods.
       assert(probe->probing_off % period == 0);
-      probe->probing_len = period;
-      probe->probing_off -= period;
+      probe->probing_len = MIN(batch, probe->probing_off);
+      probe->probing_off -= probe->probing_len;
     }
     _probe(probe);
     return;
@@ -289,7 +307,7 @@ void Filer::_do_purge_range(PurgeRange *pr, int fin)
     return;
   }
 
-  int max = 10 - pr->uncommitted;
+  int max = MAX(cct->_conf->filer_max_purge_ops, 1) - pr->uncommitted;
   while (pr->num > 0 && max > 0) {
     object_t oid = file_object_t(pr->ino, pr->first);
     object_locator_t oloc = objecter->osdmap->file_to_object_locator(pr->layout);
@@ -386,3 +404,58 @@ void Filer::file_to_extents(inodeno_t ino, ceph_file_layout *layout,
     extents.push_back(it->second);
   }
 }
+
+/*
+ * An object extent is contiguous in the object, and its buffer
+ * extents cover it in order, so it can be cut anywhere.
+ */
+static void split_extent(const ObjectExtent& ex, uint64_t max,
+			 vector<ObjectExtent>& extents)
+{
+  ObjectExtent cur(ex.oid, ex.offset, 0);
+  cur.oloc = ex.oloc;
+  for (map<__u32,__u32>::const_iterator p = ex.buffer_extents.begin();
+       p != ex.buffer_extents.end();
+       ++p) {
+    uint64_t boff = p->first;
+    uint64_t left = p->second;
+    while (left > 0) {
+      uint64_t l = MIN(left, max - cur.length);
+      cur.buffer_extents[boff] = l;
+      cur.length += l;
+      boff += l;
+      left -= l;
+      if (cur.length == max) {
+	extents.push_back(cur);
+	cur.offset += cur.length;
+	cur.length = 0;
+	cur.buffer_extents.clear();
+      }
+    }
+  }
+  if (cur.length)
+    extents.push_back(cur);
+}
+
+void Filer::file_to_io_extents(inodeno_t ino, ceph_file_layout *layout,
+			       uint64_t offset, uint64_t len,
+			       vector<ObjectExtent>& extents)
+{
+  uint64_t max = cct->_conf->filer_max_op_size;
+  if (!max) {
+    file_to_extents(ino, layout, offset, len, extents);
+    return;
+  }
+
+  vector<ObjectExtent> whole;
+  file_to_extents(ino, layout, offset, len, whole);
+  for (vector<ObjectExtent>::iterator p = whole.begin(); p != whole.end(); ++p) {
+    if (p->length <= max)
+      extents.push_back(*p);
+    else
+      split_extent(*p, max, extents);
+  }
+  if (extents.size() > whole.size())
+    ldout(cct, 15) << "file_to_io_extents " << offset << "~" << len << " split "
+		   << whole.size() << " extents into " << extents.size() << dendl;
+}
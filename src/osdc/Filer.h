@@ -79,6 +79,7 @@ class Filer {
   
   class C_Probe;
 
+  uint64_t _probe_batch(ceph_file_layout *layout);
   void _probe(Probe *p);
   void _probed(Probe *p, const object_t& oid, uint64_t size, utime_t mtime);
 
@@ -104,6 +105,15 @@ class Filer {
 		       uint64_t offset, uint64_t len,
 		       vector<ObjectExtent>& extents);
 
+  /*
+   * like file_to_extents, but also split extents longer than
+   * filer_max_op_size so a large i/o becomes bounded object ops
+   * that the Objecter can spread over the osds.
+   */
+  void file_to_io_extents(inodeno_t ino, ceph_file_layout *layout,
+			  uint64_t offset, uint64_t len,
+			  vector<ObjectExtent>& extents);
+
 
   
 
@@ -119,7 +129,7 @@ class Filer {
            Context *onfinish) {
     assert(snap);  // (until there is a non-NOSNAP write)
     vector<ObjectExtent> extents;
-    file_to_extents(ino, layout, offset, len, extents);
+    file_to_io_extents(ino, layout, offset, len, extents);
     objecter->sg_read(extents, snap, bl, flags, onfinish);
     return 0;
   }
@@ -136,7 +146,7 @@ class Filer {
            Context *onfinish) {
     assert(snap);  // (until there is a non-NOSNAP write)
     vector<ObjectExtent> extents;
-    file_to_extents(ino, layout, offset, len, extents);
+    file_to_io_extents(ino, layout, offset, len, extents);
     objecter->sg_read_trunc(extents, snap, bl, flags,
 			    truncate_size, truncate_seq, onfinish);
     return 0;
@@ -153,7 +163,7 @@ class Filer {
             Context *onack,
             Context *oncommit) {
     vector<ObjectExtent> extents;
-    file_to_extents(ino, layout, offset, len, extents);
+    file_to_io_extents(ino, layout, offset, len, extents);
     objecter->sg_write(extents, snapc, bl, mtime, flags, onack, oncommit);
     return 0;
   }
@@ -171,7 +181,7 @@ class Filer {
             Context *onack,
             Context *oncommit) {
     vector<ObjectExtent> extents;
-    file_to_extents(ino, layout, offset, len, extents);
+    file_to_io_extents(ino, layout, offset, len, extents);
     objecter->sg_write_trunc(extents, snapc, bl, mtime, flags,
 		       truncate_size, truncate_seq, onack, oncommit);
     return 0;
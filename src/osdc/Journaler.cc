@@ -391,12 +391,12 @@ void Journaler::_finish_flush(int r, uint64_t start, utime_t stamp)
   assert(start >= safe_pos);
   assert(start < flush_pos);
 
-  // calc latency?
-  if (logger) {
-    utime_t lat = ceph_clock_now(cct);
-    lat -= stamp;
+  // calc latency
+  utime_t lat = ceph_clock_now(cct);
+  lat -= stamp;
+  if (logger)
     logger->fset(logger_key_lat, lat);
-  }
+  flush_lat = flush_lat ? flush_lat * .8 + (double)lat * .2 : (double)lat;
 
   // adjust safe_pos
   assert(pending_safe.count(start));
@@ -419,6 +419,14 @@ void Journaler::_finish_flush(int r, uint64_t start, utime_t stamp)
     finish_contexts(cct, waitfor_safe.begin()->second);
     waitfor_safe.erase(waitfor_safe.begin());
   }
+
+  // send whatever piled up behind this flush
+  if (flush_held && pending_safe.empty()) {
+    ldout(cct, 20) << "_finish_flush sending held flush of " << write_buf.length() << dendl;
+    flush_held = false;
+    if (write_buf.length())
+      _do_flush();
+  }
 }
 
 
@@ -457,7 +465,8 @@ uint64_t Journaler::append_entry(bufferlist& bl)
   write_buf.claim_append(bl);
   write_pos += sizeof(s) + s;
 
-  // flush previous object?
+  // flush previous object?  it goes out in parallel with whatever is
+  // in flight; only the tail of the journal is held back.
   uint64_t su = get_layout_period();
   assert(su > 0);
   uint64_t write_off = write_pos % su;
@@ -465,7 +474,14 @@ uint64_t Journaler::append_entry(bufferlist& bl)
   uint64_t flush_obj = flush_pos / su;
   if (write_obj != flush_obj) {
     ldout(cct, 10) << " flushing completed object(s) (su " << su << " wro " << write_obj << " flo " << flush_obj << ")" << dendl;
-    _do_flush(write_buf.length() - write_off);
+    if (write_buf.length() > write_off)
+      _do_flush(write_buf.length() - write_off);
+    if (write_buf.length() == 0)
+      flush_held = false;
+  } else if (flush_held && write_buf.length() >= cct->_conf->journaler_group_commit_max) {
+    ldout(cct, 20) << "append_entry held flush reached " << write_buf.length() << ", sending" << dendl;
+    flush_held = false;
+    _do_flush();
   }
 
   return write_pos;
@@ -517,6 +533,7 @@ void Journaler::_do_flush(unsigned amount)
 
   Context *onsafe = new C_Flush(this, flush_pos, now);  // on COMMIT
   pending_safe.insert(flush_pos);
+  last_flush_stamp = now;
 
   bufferlist write_bl;
 
@@ -565,6 +582,21 @@ void Journaler::wait_for_flush(Context *onsafe)
     waitfor_safe[write_pos].push_back(onsafe);
 }  
 
+/*
+ * Hold a flush back while an earlier one is in flight, so everything
+ * appended meanwhile commits as one write -- unless that flush is
+ * taking well over the usual commit latency, or enough has piled up.
+ */
+bool Journaler::_should_hold_flush()
+{
+  if (!cct->_conf->journaler_group_commit || pending_safe.empty())
+    return false;
+  if (write_buf.length() >= cct->_conf->journaler_group_commit_max)
+    return false;
+  double age = ceph_clock_now(cct) - last_flush_stamp;
+  return !flush_lat || age < 2 * flush_lat;
+}
+
 void Journaler::flush(Context *onsafe)
 {
   assert(!readonly);
@@ -578,7 +610,11 @@ void Journaler::flush(Context *onsafe)
       delete onsafe;
     }
   } else {
-    if (1) {
+    if (_should_hold_flush()) {
+      ldout(cct, 20) << "flush holding " << write_buf.length() << " behind "
+		     << pending_safe.size() << " in-flight flush(es)" << dendl;
+      flush_held = true;
+    } else if (1) {
       // maybe buffer
       if (write_buf.length() < cct->_conf->journaler_batch_max) {
 	// delay!  schedule an event.
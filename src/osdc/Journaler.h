@@ -177,6 +177,13 @@ private:
   std::set<uint64_t> pending_safe;
   std::map<uint64_t, std::list<Context*> > waitfor_safe; // when safe through given offset
 
+  // group commit: while a flush is in flight, later flushes wait for it
+  // and go out together when it commits
+  bool flush_held;
+  utime_t last_flush_stamp;  // when the newest in-flight flush was sent
+  double flush_lat;          // ewma commit latency, seconds
+  bool _should_hold_flush();
+
   void _do_flush(unsigned amount=0);
   void _finish_flush(int r, uint64_t start, utime_t stamp);
   class C_Flush;
@@ -237,6 +244,7 @@ public:
     state(STATE_UNDEF), error(0),
     prezeroing_pos(0), prezero_pos(0), write_pos(0), flush_pos(0), safe_pos(0),
     waiting_for_zero(false),
+    flush_held(false), flush_lat(0),
     read_pos(0), requested_pos(0), received_pos(0),
     fetch_len(0), temp_fetch_len(0), prefetch_from(0),
     on_readable(0),
@@ -255,6 +263,7 @@ public:
     write_pos = 0;
     flush_pos = 0;
     safe_pos = 0;
+    flush_held = false;
     read_pos = 0;
     requested_pos = 0;
     received_pos = 0;
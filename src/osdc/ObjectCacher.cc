@@ -4,6 +4,7 @@
 #include "msg/Messenger.h"
 #include "ObjectCacher.h"
 #include "Objecter.h"
+#include "ObjecterWriteback.h"
 
 
 
@@ -14,12 +15,41 @@
 
 #define DOUT_SUBSYS objectcacher
 #undef dout_prefix
-#define dout_prefix *_dout << oc->objecter->messenger->get_myname() << ".objectcacher.object(" << oid << ") "
+#define dout_prefix _prefix(_dout, oc) << ".object(" << oid << ") "
+
+static ostream& _prefix(std::ostream *_dout, const ObjectCacher *oc)
+{
+  if (oc->objecter)
+    return *_dout << oc->objecter->messenger->get_myname() << ".objectcacher";
+  return *_dout << oc->name << ".objectcacher";
+}
 
 ObjectCacher::
 ObjectCacher(CephContext *cct_, Objecter *o, Mutex& l, flush_set_callback_t flush_callback,
 	     void *flush_callback_arg) : 
-    cct(cct_), objecter(o), filer(o), lock(l),
+    cct(cct_), objecter(o), filer(new Filer(o)),
+    writeback_handler(new ObjecterWriteback(o)), own_writeback_handler(true),
+    lock(l),
+    max_size(cct->_conf->client_oc_size),
+    max_dirty(cct->_conf->client_oc_max_dirty),
+    target_dirty(cct->_conf->client_oc_target_dirty),
+    max_dirty_age(1, 0),
+    flush_set_callback(flush_callback), flush_set_callback_arg(flush_callback_arg),
+    flusher_stop(false), flusher_thread(this),
+    stat_waiter(0),
+    stat_clean(0), stat_dirty(0), stat_rx(0), stat_tx(0), stat_missing(0) {
+  }
+
+ObjectCacher::
+ObjectCacher(CephContext *cct_, const string& name_, WritebackHandler& wb, Mutex& l,
+	     flush_set_callback_t flush_callback, void *flush_callback_arg) :
+    cct(cct_), objecter(NULL), filer(NULL), name(name_),
+    writeback_handler(&wb), own_writeback_handler(false),
+    lock(l),
+    max_size(cct->_conf->client_oc_size),
+    max_dirty(cct->_conf->client_oc_max_dirty),
+    target_dirty(cct->_conf->client_oc_target_dirty),
+    max_dirty_age(1, 0),
     flush_set_callback(flush_callback), flush_set_callback_arg(flush_callback_arg),
     flusher_stop(false), flusher_thread(this),
     stat_waiter(0),
@@ -33,6 +63,7 @@ ObjectCacher::BufferHead *ObjectCacher::Object::split(BufferHead *left, loff_t o
   // split off right
   ObjectCacher::BufferHead *right = new BufferHead(this);
   right->last_write_tid = left->last_write_tid;
+  right->last_write = left->last_write;
   right->set_state(left->get_state());
   right->snapc = left->snapc;
   
@@ -94,7 +125,11 @@ void ObjectCacher::Object::merge_left(BufferHead *left, BufferHead *right)
   // version 
   // note: this is sorta busted, but should only be used for dirty buffers
   left->last_write_tid =  MAX( left->last_write_tid, right->last_write_tid );
-  left->last_write = MAX( left->last_write, right->last_write );
+  if (right->last_write > left->last_write) {
+    left->last_write = right->last_write;
+    if (left->is_dirty())
+      left->dirty_item.move_to_back();
+  }
 
   // waiters
   for (map<loff_t, list<Context*> >::iterator p = right->waitfor_read.begin();
@@ -416,12 +451,83 @@ void ObjectCacher::Object::truncate(loff_t s)
   }
 }
 
+/*
+ * Drop whatever we have cached in off~len, dirty or not: the data
+ * there is going away on the osd, so it must not be written back.
+ */
+void ObjectCacher::Object::discard(loff_t off, loff_t len)
+{
+  ldout(oc->cct, 10) << "discard " << *this << " " << off << "~" << len << dendl;
+
+  map<loff_t, BufferHead*>::iterator p = data.lower_bound(off);
+  if (p != data.begin() &&
+      (p == data.end() || p->first > off)) {
+    --p;
+    if (p->second->end() <= off)
+      ++p;   // the one before ends before off
+  }
+  while (p != data.end()) {
+    BufferHead *bh = p->second;
+    if (bh->start() >= off + len)
+      break;
+
+    // split bh at the start of the range?
+    if (bh->start() < off) {
+      split(bh, off);
+      ++p;
+      continue;
+    }
+
+    // or at the end?
+    assert(bh->start() >= off);
+    if (bh->end() > off + len)
+      split(bh, off + len);
+
+    ++p;
+    ldout(oc->cct, 10) << "discard " << *this << " bh " << *bh << dendl;
+    oc->bh_remove(this, bh);
+    delete bh;
+  }
+}
+
 
 
 /*** ObjectCacher ***/
 
 #undef dout_prefix
-#define dout_prefix *_dout << objecter->messenger->get_myname() << ".objectcacher "
+#define dout_prefix _prefix(_dout, this) << " "
+
+const char** ObjectCacher::get_tracked_conf_keys() const
+{
+  static const char *KEYS[] = {
+    "client_oc_size",
+    "client_oc_max_dirty",
+    "client_oc_target_dirty",
+    NULL
+  };
+  return KEYS;
+}
+
+void ObjectCacher::handle_conf_change(const struct md_config_t *conf,
+				      const std::set <std::string> &changed)
+{
+  lock.Lock();
+  max_size = conf->client_oc_size;
+  max_dirty = conf->client_oc_max_dirty;
+  target_dirty = conf->client_oc_target_dirty;
+  ldout(cct, 1) << "handle_conf_change max_size " << max_size << " max_dirty " << max_dirty
+		<< " target_dirty " << target_dirty << dendl;
+  trim();                  // a smaller cache takes effect now
+  flusher_cond.Signal();   // as does a lower target_dirty
+  lock.Unlock();
+}
+
+void ObjectCacher::start()
+{
+  flusher_thread.create();
+  if (objecter)
+    cct->_conf->add_observer(this);
+}
 
 /* private */
 
@@ -451,11 +557,10 @@ void ObjectCacher::bh_read(BufferHead *bh)
   ObjectSet *oset = bh->ob->oset;
 
   // go
-  objecter->read_trunc(bh->ob->get_oid(), bh->ob->get_oloc(), 
-		 bh->start(), bh->length(), bh->ob->get_snap(),
-		 &onfinish->bl, 0,
-		 oset->truncate_size, oset->truncate_seq,
-		 onfinish);
+  writeback_handler->read(bh->ob->get_oid(), bh->ob->get_oloc(),
+			  bh->start(), bh->length(), bh->ob->get_snap(),
+			  &onfinish->bl, oset->truncate_size, oset->truncate_seq,
+			  onfinish);
 }
 
 void ObjectCacher::bh_read_finish(int64_t poolid, sobject_t oid, loff_t start, uint64_t length, bufferlist &bl)
@@ -545,11 +650,11 @@ void ObjectCacher::bh_write(BufferHead *bh)
   ObjectSet *oset = bh->ob->oset;
 
   // go
-  tid_t tid = objecter->write_trunc(bh->ob->get_oid(), bh->ob->get_oloc(),
-			      bh->start(), bh->length(),
-			      bh->snapc, bh->bl, bh->last_write, 0,
-			      oset->truncate_size, oset->truncate_seq,
-				    NULL, oncommit);
+  tid_t tid = writeback_handler->write(bh->ob->get_oid(), bh->ob->get_oloc(),
+				       bh->start(), bh->length(),
+				       bh->snapc, bh->bl, bh->last_write,
+				       oset->truncate_size, oset->truncate_seq,
+				       oncommit);
 
   // set bh last_write_tid
   oncommit->tid = tid;
@@ -702,14 +807,13 @@ void ObjectCacher::flush(loff_t amount)
   ldout(cct, 10) << "flush " << amount << dendl;
   
   /*
-   * NOTE: we aren't actually pulling things off the LRU here, just looking at the
-   * tail item.  Then we call bh_write, which moves it to the other LRU, so that we
-   * can call lru_dirty.lru_get_next_expire() again.
+   * NOTE: bh_write marks the bh tx, which takes it off dirty_bh, so the
+   * front is always the next oldest dirty bh.
    */
   loff_t did = 0;
   while (amount == 0 || did < amount) {
-    BufferHead *bh = (BufferHead*) lru_dirty.lru_get_next_expire();
-    if (!bh) break;
+    if (dirty_bh.empty()) break;
+    BufferHead *bh = dirty_bh.front();
     if (bh->last_write > cutoff) break;
 
     did += bh->length();
@@ -721,7 +825,7 @@ void ObjectCacher::flush(loff_t amount)
 void ObjectCacher::trim(loff_t max)
 {
   if (max < 0) 
-    max = cct->_conf->client_oc_size;
+    max = max_size;
   
   ldout(cct, 10) << "trim  start: max " << max 
            << "  clean " << get_stat_clean()
@@ -963,8 +1067,7 @@ int ObjectCacher::writex(OSDWrite *wr, ObjectSet *oset)
 
     // ok, now bh is dirty.
     mark_dirty(bh);
-    touch_bh(bh);
-    bh->last_write = now;
+    bh_written(bh, now);
 
     o->try_merge_bh(bh);
   }
@@ -981,13 +1084,12 @@ int ObjectCacher::writex(OSDWrite *wr, ObjectSet *oset)
 bool ObjectCacher::wait_for_write(uint64_t len, Mutex& lock)
 {
   int blocked = 0;
-  const md_config_t *conf = cct->_conf;
 
   // wait for writeback?
-  while (get_stat_dirty() + get_stat_tx() >= conf->client_oc_max_dirty) {
+  while (get_stat_dirty() + get_stat_tx() >= max_dirty) {
     ldout(cct, 10) << "wait_for_write waiting on " << len << ", dirty|tx " 
 	     << (get_stat_dirty() + get_stat_tx()) 
-	     << " >= " << conf->client_oc_max_dirty 
+	     << " >= " << max_dirty 
 	     << dendl;
     flusher_cond.Signal();
     stat_waiter++;
@@ -998,9 +1100,9 @@ bool ObjectCacher::wait_for_write(uint64_t len, Mutex& lock)
   }
 
   // start writeback anyway?
-  if (get_stat_dirty() > conf->client_oc_target_dirty) {
+  if (get_stat_dirty() > target_dirty) {
     ldout(cct, 10) << "wait_for_write " << get_stat_dirty() << " > target "
-	     << conf->client_oc_target_dirty << ", nudging flusher" << dendl;
+	     << target_dirty << ", nudging flusher" << dendl;
     flusher_cond.Signal();
   }
   return blocked;
@@ -1008,36 +1110,35 @@ bool ObjectCacher::wait_for_write(uint64_t len, Mutex& lock)
 
 void ObjectCacher::flusher_entry()
 {
-  const md_config_t *conf = cct->_conf;
   ldout(cct, 10) << "flusher start" << dendl;
   lock.Lock();
   while (!flusher_stop) {
     while (!flusher_stop) {
       loff_t all = get_stat_tx() + get_stat_rx() + get_stat_clean() + get_stat_dirty();
       ldout(cct, 11) << "flusher "
-               << all << " / " << conf->client_oc_size << ":  "
+               << all << " / " << max_size << ":  "
                << get_stat_tx() << " tx, "
                << get_stat_rx() << " rx, "
                << get_stat_clean() << " clean, "
                << get_stat_dirty() << " dirty ("
-	       << conf->client_oc_target_dirty << " target, "
-	       << conf->client_oc_max_dirty << " max)"
+	       << target_dirty << " target, "
+	       << max_dirty << " max)"
                << dendl;
-      if (get_stat_dirty() > conf->client_oc_target_dirty) {
+      if (get_stat_dirty() > target_dirty) {
         // flush some dirty pages
         ldout(cct, 10) << "flusher " 
                  << get_stat_dirty() << " dirty > target "
-		 << conf->client_oc_target_dirty
+		 << target_dirty
                  << ", flushing some dirty bhs" << dendl;
-        flush(get_stat_dirty() - conf->client_oc_target_dirty);
+        flush(get_stat_dirty() - target_dirty);
       }
       else {
         // check tail of lru for old dirty items
         utime_t cutoff = ceph_clock_now(cct);
-        cutoff.sec_ref()--;
+        cutoff -= max_dirty_age;
         BufferHead *bh = 0;
-        while ((bh = (BufferHead*)lru_dirty.lru_get_next_expire()) != 0 &&
-               bh->last_write < cutoff) {
+        while (!dirty_bh.empty() &&
+               (bh = dirty_bh.front())->last_write < cutoff) {
           ldout(cct, 10) << "flusher flushing aged dirty bh " << *bh << dendl;
           bh_write(bh);
         }
@@ -1056,6 +1157,7 @@ void ObjectCacher::flusher_entry()
 // blocking.  atomic+sync.
 int ObjectCacher::atomic_sync_readx(OSDRead *rd, ObjectSet *oset, Mutex& lock)
 {
+  assert(objecter);  // see the WritebackHandler constructor
   ldout(cct, 10) << "atomic_sync_readx " << rd
            << " in " << oset
            << dendl;
@@ -1122,6 +1224,7 @@ int ObjectCacher::atomic_sync_readx(OSDRead *rd, ObjectSet *oset, Mutex& lock)
 
 int ObjectCacher::atomic_sync_writex(OSDWrite *wr, ObjectSet *oset, Mutex& lock)
 {
+  assert(objecter);  // see the WritebackHandler constructor
   ldout(cct, 10) << "atomic_sync_writex " << wr
            << " in " << oset
            << dendl;
@@ -1202,6 +1305,7 @@ int ObjectCacher::atomic_sync_writex(OSDWrite *wr, ObjectSet *oset, Mutex& lock)
 
 void ObjectCacher::rdlock(Object *o)
 {
+  assert(objecter);  // see the WritebackHandler constructor
   // lock?
   if (o->lock_state == Object::LOCK_NONE ||
       o->lock_state == Object::LOCK_RDUNLOCKING ||
@@ -1240,6 +1344,7 @@ void ObjectCacher::rdlock(Object *o)
 
 void ObjectCacher::wrlock(Object *o)
 {
+  assert(objecter);  // see the WritebackHandler constructor
   // lock?
   if (o->lock_state != Object::LOCK_WRLOCK &&
       o->lock_state != Object::LOCK_WRLOCKING &&
@@ -1676,6 +1781,39 @@ void ObjectCacher::truncate_set(ObjectSet *oset, vector<ObjectExtent>& exls)
 }
 
 
+void ObjectCacher::discard_set(ObjectSet *oset, vector<ObjectExtent>& exls)
+{
+  if (oset->objects.empty()) {
+    ldout(cct, 10) << "discard_set on " << oset << " dne" << dendl;
+    return;
+  }
+
+  ldout(cct, 10) << "discard_set " << oset << dendl;
+
+  bool were_dirty = oset->dirty_or_tx > 0;
+
+  for (vector<ObjectExtent>::iterator p = exls.begin();
+       p != exls.end();
+       ++p) {
+    ObjectExtent &ex = *p;
+    sobject_t soid(ex.oid, CEPH_NOSNAP);
+    if (objects[oset->poolid].count(soid) == 0)
+      continue;
+    Object *ob = objects[oset->poolid][soid];
+
+    ob->discard(ex.offset, ex.length);
+    if (ob->can_close()) {
+      ldout(cct, 10) << "discard_set trimming " << *ob << dendl;
+      close_object(ob);
+    }
+  }
+
+  // did we discard dirty data?
+  if (flush_set_callback &&
+      were_dirty && oset->dirty_or_tx == 0)
+    flush_set_callback(flush_set_callback_arg, oset);
+}
+
 void ObjectCacher::kick_sync_writers(ObjectSet *oset)
 {
   if (oset->objects.empty()) {
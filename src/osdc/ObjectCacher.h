@@ -10,14 +10,16 @@
 
 #include "common/Cond.h"
 #include "common/Thread.h"
+#include "common/config_obs.h"
 
 #include "Objecter.h"
 #include "Filer.h"
+#include "WritebackHandler.h"
 
 class CephContext;
 class Objecter;
 
-class ObjectCacher {
+class ObjectCacher : public md_config_obs_t {
  public:
   CephContext *cct;
   class Object;
@@ -79,6 +81,7 @@ class ObjectCacher {
     tid_t last_write_tid;  // version of bh (if non-zero)
     utime_t last_write;
     SnapContext snapc;
+    xlist<BufferHead*>::item dirty_item;   // on ObjectCacher::dirty_bh while dirty
     
     map< loff_t, list<Context*> > waitfor_read;
     
@@ -88,7 +91,8 @@ class ObjectCacher {
       state(STATE_MISSING),
       ref(0),
       ob(o),
-      last_write_tid(0) {}
+      last_write_tid(0),
+      dirty_item(this) {}
   
     // extent
     loff_t start() const { return ex.start; }
@@ -244,6 +248,7 @@ class ObjectCacher {
     BufferHead *map_write(OSDWrite *wr);
     
     void truncate(loff_t s);
+    void discard(loff_t off, loff_t len);
 
   };
   
@@ -268,19 +273,31 @@ class ObjectCacher {
   // ******* ObjectCacher *********
   // ObjectCacher fields
  public:
-  Objecter *objecter;
-  Filer filer;
+  Objecter *objecter;   // NULL if we were given a WritebackHandler
+  Filer *filer;
+  string name;          // for log messages, without an Objecter
 
  private:
+  WritebackHandler *writeback_handler;
+  bool own_writeback_handler;
   Mutex& lock;
+
+  loff_t max_size, max_dirty, target_dirty;
+  utime_t max_dirty_age;
   
   flush_set_callback_t flush_set_callback;
   void *flush_set_callback_arg;
 
   vector<hash_map<sobject_t, Object*> > objects; // indexed by pool_id
 
-  set<BufferHead*>    dirty_bh;
-  LRU   lru_dirty, lru_rest;
+  /*
+   * Dirty bhs sit on dirty_bh in last_write order, oldest first, so
+   * the flusher only ever looks at the ones it is about to write.
+   * Everything else (clean, rx, tx, missing) is on lru_rest, which trim
+   * expires from.
+   */
+  xlist<BufferHead*> dirty_bh;
+  LRU   lru_rest;
 
   Cond flusher_cond;
   bool flusher_stop;
@@ -385,10 +402,9 @@ class ObjectCacher {
   loff_t get_stat_dirty() { return stat_dirty; }
   loff_t get_stat_clean() { return stat_clean; }
 
+  // dirty bhs keep their place in dirty_bh; only a write moves them
   void touch_bh(BufferHead *bh) {
-    if (bh->is_dirty())
-      lru_dirty.lru_touch(bh);
-    else
+    if (!bh->is_dirty())
       lru_rest.lru_touch(bh);
   }
 
@@ -397,13 +413,11 @@ class ObjectCacher {
     // move between lru lists?
     if (s == BufferHead::STATE_DIRTY && bh->get_state() != BufferHead::STATE_DIRTY) {
       lru_rest.lru_remove(bh);
-      lru_dirty.lru_insert_top(bh);
-      dirty_bh.insert(bh);
+      dirty_bh.push_back(&bh->dirty_item);
     }
     if (s != BufferHead::STATE_DIRTY && bh->get_state() == BufferHead::STATE_DIRTY) {
-      lru_dirty.lru_remove(bh);
+      bh->dirty_item.remove_myself();
       lru_rest.lru_insert_top(bh);
-      dirty_bh.erase(bh);
     }
 
     // set state
@@ -422,28 +436,28 @@ class ObjectCacher {
   void mark_tx(BufferHead *bh) { bh_set_state(bh, BufferHead::STATE_TX); };
   void mark_dirty(BufferHead *bh) { 
     bh_set_state(bh, BufferHead::STATE_DIRTY); 
-    lru_dirty.lru_touch(bh);
-    //bh->set_dirty_stamp(ceph_clock_now(g_ceph_context));
   };
+  /// bh was just written at 'now': it is the newest dirty bh
+  void bh_written(BufferHead *bh, utime_t now) {
+    assert(bh->is_dirty());
+    bh->last_write = now;
+    bh->dirty_item.move_to_back();
+  }
 
   void bh_add(Object *ob, BufferHead *bh) {
     ob->add_bh(bh);
-    if (bh->is_dirty()) {
-      lru_dirty.lru_insert_top(bh);
-      dirty_bh.insert(bh);
-    } else {
+    if (bh->is_dirty())
+      dirty_bh.push_back(&bh->dirty_item);
+    else
       lru_rest.lru_insert_top(bh);
-    }
     bh_stat_add(bh);
   }
   void bh_remove(Object *ob, BufferHead *bh) {
     ob->remove_bh(bh);
-    if (bh->is_dirty()) {
-      lru_dirty.lru_remove(bh);
-      dirty_bh.erase(bh);
-    } else {
+    if (bh->is_dirty())
+      bh->dirty_item.remove_myself();
+    else
       lru_rest.lru_remove(bh);
-    }
     bh_stat_sub(bh);
   }
 
@@ -518,6 +532,14 @@ class ObjectCacher {
   ObjectCacher(CephContext *cct_, Objecter *o, Mutex& l,
 	       flush_set_callback_t flush_callback,
 	       void *flush_callback_arg);
+  /*
+   * cache on top of some other way of doing i/o.  Only the object
+   * interface (readx/writex, flush/release) works: the file_* helpers,
+   * the atomic sync paths and the object locks need an Objecter.
+   */
+  ObjectCacher(CephContext *cct_, const string& name_, WritebackHandler& wb, Mutex& l,
+	       flush_set_callback_t flush_callback,
+	       void *flush_callback_arg);
   ~ObjectCacher() {
     // we should be empty.
     for (vector<hash_map<sobject_t, Object *> >::iterator i = objects.begin();
@@ -525,15 +547,37 @@ class ObjectCacher {
         ++i)
       assert(!i->size());
     assert(lru_rest.lru_get_size() == 0);
-    assert(lru_dirty.lru_get_size() == 0);
     assert(dirty_bh.empty());
+    delete filer;
+    if (own_writeback_handler)
+      delete writeback_handler;
   }
 
-  void start() {
-    flusher_thread.create();
+  /*
+   * limits; they default to the client_oc_* options, and a cache with
+   * an Objecter (the client's) follows those while it is started.
+   */
+  void set_max_size(loff_t v) { max_size = v; }
+  void set_max_dirty(loff_t v) { max_dirty = v; }
+  void set_target_dirty(loff_t v) { target_dirty = v; }
+  void set_max_dirty_age(utime_t a) { max_dirty_age = a; }
+
+  /// bytes held in buffers, in any state
+  loff_t get_stat_total() {
+    return get_stat_tx() + get_stat_rx() + get_stat_dirty() + get_stat_clean();
   }
+  /// drop clean buffers down to the current max_size
+  void trim_to_max() { trim(); }
+
+  const char **get_tracked_conf_keys() const;
+  void handle_conf_change(const struct md_config_t *conf,
+			  const std::set <std::string> &changed);
+
+  void start();
   void stop() {
     assert(flusher_thread.is_started());
+    if (objecter)
+      cct->_conf->remove_observer(this);
     lock.Lock();  // hmm.. watch out for deadlock!
     flusher_stop = true;
     flusher_cond.Signal();
@@ -587,6 +631,7 @@ class ObjectCacher {
   uint64_t release_all();
 
   void truncate_set(ObjectSet *oset, vector<ObjectExtent>& ex);
+  void discard_set(ObjectSet *oset, vector<ObjectExtent>& ex);
 
   void kick_sync_writers(ObjectSet *oset);
   void kick_sync_readers(ObjectSet *oset);
@@ -598,7 +643,7 @@ class ObjectCacher {
   int file_is_cached(ObjectSet *oset, ceph_file_layout *layout, snapid_t snapid,
 		     loff_t offset, uint64_t len) {
     vector<ObjectExtent> extents;
-    filer.file_to_extents(oset->ino, layout, offset, len, extents);
+    filer->file_to_extents(oset->ino, layout, offset, len, extents);
     return is_cached(oset, extents, snapid);
   }
 
@@ -608,7 +653,7 @@ class ObjectCacher {
 		int flags,
                 Context *onfinish) {
     OSDRead *rd = prepare_read(snapid, bl, flags);
-    filer.file_to_extents(oset->ino, layout, offset, len, rd->extents);
+    filer->file_to_extents(oset->ino, layout, offset, len, rd->extents);
     return readx(rd, oset, onfinish);
   }
 
@@ -616,7 +661,7 @@ class ObjectCacher {
                  loff_t offset, uint64_t len, 
                  bufferlist& bl, utime_t mtime, int flags) {
     OSDWrite *wr = prepare_write(snapc, bl, mtime, flags);
-    filer.file_to_extents(oset->ino, layout, offset, len, wr->extents);
+    filer->file_to_extents(oset->ino, layout, offset, len, wr->extents);
     return writex(wr, oset);
   }
 
@@ -630,7 +675,7 @@ class ObjectCacher {
                             bufferlist *bl, int flags,
                             Mutex &lock) {
     OSDRead *rd = prepare_read(snapid, bl, flags);
-    filer.file_to_extents(oset->ino, layout, offset, len, rd->extents);
+    filer->file_to_extents(oset->ino, layout, offset, len, rd->extents);
     return atomic_sync_readx(rd, oset, lock);
   }
 
@@ -640,7 +685,7 @@ class ObjectCacher {
                              bufferlist& bl, utime_t mtime, int flags,
                              Mutex &lock) {
     OSDWrite *wr = prepare_write(snapc, bl, mtime, flags);
-    filer.file_to_extents(oset->ino, layout, offset, len, wr->extents);
+    filer->file_to_extents(oset->ino, layout, offset, len, wr->extents);
     return atomic_sync_writex(wr, oset, lock);
   }
 
@@ -37,8 +37,11 @@
 #include "messages/MOSDFailure.h"
 
 #include <errno.h>
+#include <unistd.h>
 
 #include "common/config.h"
+#include "common/Tracer.h"
+#include "common/Formatter.h"
 #include "common/perf_counters.h"
 
 
@@ -199,12 +202,27 @@ void Objecter::init()
     cct->get_perfcounters_collection()->add(logger);
   }
 
+  if (!admin_command_registered) {
+    // several objecters may share a context; the first one answers
+    admin_command.stopping.set(0);
+    int r = cct->get_admin_socket()->register_command("dump_objecter_requests",
+      "in-flight osd requests and the op throttle", &admin_command);
+    admin_command_registered = (r == 0);
+  }
+
   timer.add_event_after(cct->_conf->objecter_tick_interval, new C_Tick(this));
   maybe_request_map();
 }
 
 void Objecter::shutdown() 
 {
+  if (admin_command_registered) {
+    // we hold client_lock, which the command may be waiting for
+    admin_command.stopping.set(1);
+    cct->get_admin_socket()->unregister_command("dump_objecter_requests");
+    admin_command_registered = false;
+  }
+
   map<int,OSDSession*>::iterator p;
   while (!osd_sessions.empty()) {
     p = osd_sessions.begin();
@@ -376,6 +394,7 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	   e <= m->get_last();
 	   e++) {
  
+	epoch_t prev = osdmap->get_epoch();
 	if (osdmap->get_epoch() == e-1 &&
 	    m->incremental_maps.count(e)) {
 	  ldout(cct, 3) << "handle_osd_map decoding incremental epoch " << e << dendl;
@@ -423,11 +442,29 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  }
 	}
 
-	// check for changed request mappings
-	for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-	     p != ops.end();
+	// check for changed request mappings.  an op's pg only moves when its
+	// pool (or the pool it overlays) changes; otherwise map each pg once
+	// and only retarget ops whose osds changed.
+	vector<Op*> recalc;
+	for (map<pg_t, set<Op*> >::iterator p = ops_by_pg.begin();
+	     p != ops_by_pg.end();
 	     ++p) {
-	  Op *op = p->second;
+	  bool pool_changed = skipped_map || pool_changed_since(p->first.pool(), prev);
+	  vector<int> acting;
+	  if (!pool_changed)
+	    osdmap->pg_to_acting_osds(p->first, acting);
+	  for (set<Op*>::iterator q = p->second.begin(); q != p->second.end(); ++q) {
+	    Op *op = *q;
+	    if (pool_changed ||
+		((uint64_t)op->oloc.pool != p->first.pool() && pool_changed_since(op->oloc.pool, prev)) ||
+		is_pg_changed(op->acting, acting, op->used_replica))
+	      recalc.push_back(op);
+	  }
+	}
+	ldout(cct, 10) << "handle_osd_map " << ops_by_pg.size() << " pgs, retargeting "
+		       << recalc.size() << " of " << ops.size() << " ops" << dendl;
+	for (vector<Op*>::iterator p = recalc.begin(); p != recalc.end(); ++p) {
+	  Op *op = *p;
 	  int r = recalc_op_target(op);
 	  if (skipped_map)
 	    r = RECALC_OP_TARGET_NEED_RESEND;
@@ -555,6 +592,7 @@ void Objecter::C_Op_Map_Latest::finish(int r)
       op->oncommit->complete(-ENOENT);
     }
     op->session_item.remove_myself();
+    objecter->_op_unindex(op);
     objecter->ops.erase(op->tid);
     delete op;
   }
@@ -795,6 +833,10 @@ tid_t Objecter::op_submit(Op *op, OSDSession *s)
   op->tid = mytid;
   assert(client_inc >= 0);
 
+  if (!op->trace_id)
+    op->trace_id = cct->get_tracer()->sample();
+  cct->get_tracer()->record(op->trace_id, "objecter_submit", op->oid.name);
+
   // pick target
   bool check_for_latest_map = false;
   if (s) {
@@ -821,6 +863,7 @@ tid_t Objecter::op_submit(Op *op, OSDSession *s)
     ldout(cct, 20) << " note: not requesting commit" << dendl;
   }
   ops[op->tid] = op;
+  _op_index(op);
 
   logger->set(l_osdc_op_active, ops.size());
 
@@ -919,19 +962,53 @@ bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
   return false;      // same primary (tho replicas may have changed)
 }
 
+/*
+ * Where an op really goes: a pool with an overlay (cache tier) has its
+ * reads and writes sent to the tier instead, unless the op asks for
+ * the base pool itself (the cache osds promoting and flushing do), or
+ * reads a snapshot, which only the base pool has.
+ */
+object_locator_t Objecter::calc_target_oloc(const object_locator_t& oloc, int flags,
+					    snapid_t snap)
+{
+  object_locator_t t = oloc;
+  if (flags & CEPH_OSD_FLAG_IGNORE_OVERLAY)
+    return t;
+  const pg_pool_t *pi = osdmap->get_pg_pool(oloc.pool);
+  if (!pi)
+    return t;
+  if (flags & CEPH_OSD_FLAG_WRITE) {
+    if (pi->has_write_tier())
+      t.pool = pi->write_tier;
+  } else if ((flags & CEPH_OSD_FLAG_READ) && snap == CEPH_NOSNAP) {
+    if (pi->has_read_tier())
+      t.pool = pi->read_tier;
+  }
+  return t;
+}
+
 int Objecter::recalc_op_target(Op *op)
 {
   vector<int> acting;
   pg_t pgid = op->pgid;
   if (op->oid.name.length()) {
-    int ret = osdmap->object_locator_to_pg(op->oid, op->oloc, pgid);
+    op->target_oloc = calc_target_oloc(op->oloc, op->flags, op->snapid);
+    if (op->target_oloc.pool != op->oloc.pool)
+      ldout(cct, 20) << "recalc_op_target tid " << op->tid << " pool " << op->oloc.pool
+		     << " overlay " << op->target_oloc.pool << dendl;
+    int ret = osdmap->object_locator_to_pg(op->oid, op->target_oloc, pgid);
     if (ret == -ENOENT)
       return RECALC_OP_TARGET_POOL_DNE;
   }
   osdmap->pg_to_acting_osds(pgid, acting);
 
   if (op->pgid != pgid || is_pg_changed(op->acting, acting, op->used_replica)) {
+    bool reindex = op->pg_indexed && op->pgid != pgid;
+    if (reindex)
+      _op_unindex(op);
     op->pgid = pgid;
+    if (reindex)
+      _op_index(op);
     op->acting = acting;
     ldout(cct, 10) << "recalc_op_target tid " << op->tid
 	     << " pgid " << pgid << " acting " << acting << dendl;
@@ -950,8 +1027,8 @@ int Objecter::recalc_op_target(Op *op)
       } else if (read && (op->flags & CEPH_OSD_FLAG_LOCALIZE_READS)) {
 	// look for a local replica
 	unsigned i;
-	for (i = acting.size()-1; i > 0; i++)
-	  if (osdmap->get_addr(i).is_same_host(messenger->get_myaddr())) {
+	for (i = acting.size()-1; i > 0; i--)
+	  if (osdmap->get_addr(acting[i]).is_same_host(messenger->get_myaddr())) {
 	    op->used_replica = true;
 	    ldout(cct, 10) << " chose local osd." << acting[i] << " of " << acting << dendl;
 	    break;
@@ -977,11 +1054,40 @@ int Objecter::recalc_op_target(Op *op)
   return RECALC_OP_TARGET_NO_ACTION;
 }
 
+void Objecter::_op_index(Op *op)
+{
+  assert(!op->pg_indexed);
+  ops_by_pg[op->pgid].insert(op);
+  op->pg_indexed = true;
+}
+
+void Objecter::_op_unindex(Op *op)
+{
+  if (!op->pg_indexed)
+    return;
+  map<pg_t, set<Op*> >::iterator p = ops_by_pg.find(op->pgid);
+  assert(p != ops_by_pg.end());
+  p->second.erase(op);
+  if (p->second.empty())
+    ops_by_pg.erase(p);
+  op->pg_indexed = false;
+}
+
+/// whether objects in pool may map elsewhere than they did in epoch e
+bool Objecter::pool_changed_since(int64_t pool, epoch_t e)
+{
+  const pg_pool_t *pi = osdmap->get_pg_pool(pool);
+  return !pi || pi->get_last_change() > e;
+}
+
 bool Objecter::recalc_linger_op_target(LingerOp *linger_op)
 {
   vector<int> acting;
   pg_t pgid;
-  int ret = osdmap->object_locator_to_pg(linger_op->oid, linger_op->oloc, pgid);
+  linger_op->target_oloc = calc_target_oloc(linger_op->oloc,
+					    linger_op->flags | CEPH_OSD_FLAG_READ,
+					    linger_op->snap);
+  int ret = osdmap->object_locator_to_pg(linger_op->oid, linger_op->target_oloc, pgid);
   if (ret == -ENOENT) {
     return RECALC_OP_TARGET_POOL_DNE;
   }
@@ -1034,7 +1140,7 @@ void Objecter::send_op(Op *op)
   op->stamp = ceph_clock_now(cct);
 
   MOSDOp *m = new MOSDOp(client_inc, op->tid, 
-			 op->oid, op->oloc, op->pgid, osdmap->get_epoch(),
+			 op->oid, op->target_oloc, op->pgid, osdmap->get_epoch(),
 			 flags);
 
   m->set_snapid(op->snapid);
@@ -1050,6 +1156,7 @@ void Objecter::send_op(Op *op)
 
   if (op->priority)
     m->set_priority(op->priority);
+  m->set_trace_id(op->trace_id);
 
   messenger->send_message(m, op->session->con);
 
@@ -1121,12 +1228,30 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 
   int rc = m->get_result();
 
+  if (op->trace_id) {
+    ostringstream ss;
+    ss << (m->is_ondisk() ? "ondisk" : "ack") << " r=" << rc << " from osd." << op->session->osd;
+    cct->get_tracer()->record(op->trace_id, "objecter_reply", ss.str());
+  }
+
   if (rc == -EAGAIN) {
     ldout(cct, 7) << " got -EAGAIN, resubmitting" << dendl;
     if (op->onack)
       num_unacked--;
     if (op->oncommit)
       num_uncommitted--;
+    _op_unindex(op);
+    ops.erase(tid);
+    put_op_budget(op);
+    if (op->used_replica) {
+      // the replica can't serve it (degraded, or not yet committed
+      // everywhere); go to the primary
+      op->flags &= ~(CEPH_OSD_FLAG_BALANCE_READS | CEPH_OSD_FLAG_LOCALIZE_READS);
+    }
+    // force op_submit to retarget and requeue it
+    op->session_item.remove_myself();
+    op->session = NULL;
+    op->acting.clear();
     op_submit(op);
     m->put();
     return;
@@ -1167,6 +1292,7 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     op->session_item.remove_myself();
     ldout(cct, 15) << "handle_osd_op_reply completed tid " << tid << dendl;
     put_op_budget(op);
+    _op_unindex(op);
     ops.erase(tid);
     logger->set(l_osdc_op_active, ops.size());
     if (op->con)
@@ -1217,6 +1343,12 @@ void Objecter::list_objects(ListContext *list_context, Context *onfinish) {
     ldout(cct, 20) << pg_num << " placement groups" << dendl;
   }
   if (list_context->starting_pg_num != pg_num) {
+    if (list_context->end_pg) {
+      ldout(cct, 10) << "The placement groups have changed, range listing can't continue" << dendl;
+      onfinish->finish(-ERESTART);
+      delete onfinish;
+      return;
+    }
     // start reading from the beginning; the pgs have changed
     ldout(cct, 10) << "The placement groups have changed, restarting with " << pg_num << dendl;
     list_context->current_pg = 0;
@@ -1224,7 +1356,7 @@ void Objecter::list_objects(ListContext *list_context, Context *onfinish) {
     list_context->current_pg_epoch = 0;
     list_context->starting_pg_num = pg_num;
   }
-  if (list_context->current_pg == pg_num){ //this context got all the way through
+  if (list_context->current_pg >= list_context->last_pg()) { //this context got all the way through
     onfinish->finish(0);
     delete onfinish;
     return;
@@ -1278,8 +1410,10 @@ void Objecter::_list_reply(ListContext *list_context, bufferlist *bl, Context *f
     ldout(cct, 20) << "got a response with objects, proceeding" << dendl;
     list_context->list.merge(response.entries);
     list_context->max_entries -= response_size;
-    ldout(cct, 20) << "cleaning up and exiting" << dendl;
-    if (!list_context->max_entries) {
+    // a short reply ends the pg, unless a filter dropped some entries;
+    // then only an empty reply does
+    if (!list_context->max_entries || list_context->filter.length()) {
+      ldout(cct, 20) << "cleaning up and exiting" << dendl;
       final_finish->finish(0);
       delete bl;
       delete final_finish;
@@ -1291,7 +1425,7 @@ void Objecter::_list_reply(ListContext *list_context, bufferlist *bl, Context *f
   ++list_context->current_pg;
   list_context->current_pg_epoch = 0;
   ldout(cct, 20) << "emptied current pg, moving on to next one:" << list_context->current_pg << dendl;
-  if (list_context->current_pg < list_context->starting_pg_num){ // we have more pgs to go through
+  if (list_context->current_pg < list_context->last_pg()) { // we have more pgs to go through
     list_context->cookie = collection_list_handle_t();
     delete bl;
     list_objects(list_context, final_finish);
@@ -1620,6 +1754,190 @@ void Objecter::handle_fs_stats_reply(MStatfsReply *m)
 
 // scatter/gather
 
+struct Objecter::SGWindow {
+  struct Piece {
+    object_t oid;
+    object_locator_t oloc;
+    uint64_t offset, length;
+    int osd;
+    bufferlist *pbl;     // read result
+    bufferlist data;     // write payload
+    Context *onack, *oncommit;   // for reads, onack is the completion
+    Piece() : offset(0), length(0), osd(-1), pbl(NULL), onack(NULL), oncommit(NULL) {}
+  };
+
+  bool write;
+  snapid_t snap;
+  SnapContext snapc;
+  utime_t mtime;
+  int flags;
+  uint64_t trunc_size;
+  __u32 trunc_seq;
+
+  vector<Piece> pieces;
+  unsigned max_per_osd;        // 0 for no limit
+  map<int, unsigned> in_flight;
+  map<int, list<unsigned> > waiting;
+  unsigned unfinished;         // pieces not yet completed, +1 while starting
+
+  SGWindow(bool w, int f, uint64_t ts, __u32 tq, unsigned n)
+    : write(w), flags(f), trunc_size(ts), trunc_seq(tq), pieces(n),
+      max_per_osd(0), unfinished(n + 1) {}
+};
+
+struct Objecter::C_SGPieceDone : public Context {
+  Objecter *objecter;
+  SGWindow *w;
+  int osd;
+  Context *c;
+  C_SGPieceDone(Objecter *o, SGWindow *w_, int osd_, Context *c_)
+    : objecter(o), w(w_), osd(osd_), c(c_) {}
+  void finish(int r) {
+    objecter->_sg_piece_done(w, osd);
+    c->complete(r);
+  }
+};
+
+int Objecter::_sg_target_osd(const object_t& oid, const object_locator_t& oloc, int flags)
+{
+  pg_t pgid;
+  if (osdmap->object_locator_to_pg(oid, calc_target_oloc(oloc, flags, CEPH_NOSNAP), pgid) < 0)
+    return -1;
+  vector<int> acting;
+  osdmap->pg_to_acting_osds(pgid, acting);
+  return acting.empty() ? -1 : acting[0];
+}
+
+void Objecter::_sg_issue(SGWindow *w, unsigned i)
+{
+  SGWindow::Piece& p = w->pieces[i];
+  Context *onack = p.onack, *oncommit = p.oncommit;
+  if (w->max_per_osd) {
+    w->in_flight[p.osd]++;
+    onack = new C_SGPieceDone(this, w, p.osd, onack);
+  }
+  if (w->write)
+    write_trunc(p.oid, p.oloc, p.offset, p.length, w->snapc, p.data, w->mtime, w->flags,
+		w->trunc_size, w->trunc_seq, onack, oncommit);
+  else
+    read_trunc(p.oid, p.oloc, p.offset, p.length, w->snap, p.pbl, w->flags,
+	       w->trunc_size, w->trunc_seq, onack);
+}
+
+void Objecter::_sg_start(SGWindow *w)
+{
+  // only reads are windowed.  write pieces parked here would be sent
+  // from completions, possibly after a later write to the same object,
+  // and overwrite it.
+  if (w->write)
+    w->max_per_osd = 0;
+  else
+    w->max_per_osd = MAX(cct->_conf->objecter_sg_max_ops_per_osd, 0);
+
+  for (unsigned i = 0; i < w->pieces.size(); i++) {
+    SGWindow::Piece& p = w->pieces[i];
+    if (w->max_per_osd) {
+      p.osd = _sg_target_osd(p.oid, p.oloc,
+			     w->flags | (w->write ? CEPH_OSD_FLAG_WRITE : CEPH_OSD_FLAG_READ));
+      if (w->in_flight[p.osd] >= w->max_per_osd) {
+	w->waiting[p.osd].push_back(i);
+	continue;
+      }
+    }
+    _sg_issue(w, i);
+  }
+  if (!w->max_per_osd)
+    w->unfinished = 1;   // pieces complete without telling us
+  else if (w->waiting.size())
+    ldout(cct, 15) << "_sg_start " << w->pieces.size() << " pieces on "
+		   << w->in_flight.size() << " osds, " << w->max_per_osd
+		   << " at a time per osd" << dendl;
+  if (--w->unfinished == 0)
+    delete w;
+}
+
+void Objecter::_sg_piece_done(SGWindow *w, int osd)
+{
+  w->in_flight[osd]--;
+  map<int, list<unsigned> >::iterator p = w->waiting.find(osd);
+  if (p != w->waiting.end()) {
+    unsigned i = p->second.front();
+    p->second.pop_front();
+    if (p->second.empty())
+      w->waiting.erase(p);
+    _sg_issue(w, i);
+  }
+  if (--w->unfinished == 0)
+    delete w;
+}
+
+void Objecter::sg_read_trunc(vector<ObjectExtent>& extents, snapid_t snap, bufferlist *bl, int flags,
+			     uint64_t trunc_size, __u32 trunc_seq, Context *onfinish)
+{
+  if (extents.size() == 1) {
+    read_trunc(extents[0].oid, extents[0].oloc, extents[0].offset, extents[0].length,
+	       snap, bl, flags, trunc_size, trunc_seq, onfinish);
+    return;
+  }
+
+  SGWindow *w = new SGWindow(false, flags, trunc_size, trunc_seq, extents.size());
+  w->snap = snap;
+  vector<bufferlist> resultbl(extents.size());
+  for (unsigned i = 0; i < extents.size(); i++) {
+    w->pieces[i].oid = extents[i].oid;
+    w->pieces[i].oloc = extents[i].oloc;
+    w->pieces[i].offset = extents[i].offset;
+    w->pieces[i].length = extents[i].length;
+  }
+
+  // C_SGRead takes over the vectors, buffers and all
+  C_SGRead *sgr = new C_SGRead(this, extents, resultbl, bl, onfinish);
+  C_GatherBuilder gather(cct);
+  for (unsigned i = 0; i < w->pieces.size(); i++) {
+    w->pieces[i].pbl = &sgr->resultbl[i];
+    w->pieces[i].onack = gather.new_sub();
+  }
+  gather.set_finisher(sgr);
+  gather.activate();
+  _sg_start(w);
+}
+
+void Objecter::sg_write_trunc(vector<ObjectExtent>& extents, const SnapContext& snapc,
+			      const bufferlist& bl, utime_t mtime,
+			      int flags, uint64_t trunc_size, __u32 trunc_seq,
+			      Context *onack, Context *oncommit)
+{
+  if (extents.size() == 1) {
+    write_trunc(extents[0].oid, extents[0].oloc, extents[0].offset, extents[0].length,
+		snapc, bl, mtime, flags, trunc_size, trunc_seq, onack, oncommit);
+    return;
+  }
+
+  SGWindow *w = new SGWindow(true, flags, trunc_size, trunc_seq, extents.size());
+  w->snapc = snapc;
+  w->mtime = mtime;
+  C_GatherBuilder gack(cct, onack);
+  C_GatherBuilder gcom(cct, oncommit);
+  for (unsigned i = 0; i < extents.size(); i++) {
+    ObjectExtent& ex = extents[i];
+    SGWindow::Piece& p = w->pieces[i];
+    p.oid = ex.oid;
+    p.oloc = ex.oloc;
+    p.offset = ex.offset;
+    p.length = ex.length;
+    for (map<__u32,__u32>::iterator bit = ex.buffer_extents.begin();
+	 bit != ex.buffer_extents.end();
+	 bit++)
+      bl.copy(bit->first, bit->second, p.data);
+    assert(p.data.length() == ex.length);
+    p.onack = onack ? gack.new_sub() : 0;
+    p.oncommit = oncommit ? gcom.new_sub() : 0;
+  }
+  gack.activate();
+  gcom.activate();
+  _sg_start(w);
+}
+
 void Objecter::_sg_read_finish(vector<ObjectExtent>& extents, vector<bufferlist>& resultbl, 
 			       bufferlist *bl, Context *onfinish)
 {
@@ -1629,16 +1947,12 @@ void Objecter::_sg_read_finish(vector<ObjectExtent>& extents, vector<bufferlist>
   ldout(cct, 15) << "_sg_read_finish" << dendl;
 
   if (extents.size() > 1) {
-    /** FIXME This doesn't handle holes efficiently.
-     * It allocates zero buffers to fill whole buffer, and
-     * then discards trailing ones at the end.
-     *
-     * Actually, this whole thing is pretty messy with temporary bufferlist*'s all over
-     * the heap. 
+    /*
+     * Map the object results back into the buffer.  The pieces share
+     * the result buffers; only holes followed by data are zero filled,
+     * and anything past the last byte read is dropped.
      */
-    
-    // map extents back into buffer
-    map<uint64_t, bufferlist*> by_off;  // buffer offset -> bufferlist
+    map<uint64_t, bufferlist> by_off;  // buffer offset -> what we got there
     
     // for each object extent...
     vector<bufferlist>::iterator bit = resultbl.begin();
@@ -1658,31 +1972,11 @@ void Objecter::_sg_read_finish(vector<ObjectExtent>& extents, vector<bufferlist>
 		 << " extent " << eit->offset << "~" << eit->length
 		 << " : ox offset " << ox_off
 		 << " -> buffer extent " << bit->first << "~" << bit->second << dendl;
-	by_off[bit->first] = new bufferlist;
-	
-	if (ox_off + bit->second <= ox_len) {
-	  // we got the whole bx
-	  by_off[bit->first]->substr_of(ox_buf, ox_off, bit->second);
-	  if (bytes_read < bit->first + bit->second) 
-	    bytes_read = bit->first + bit->second;
-	} else if (ox_off + bit->second > ox_len && ox_off < ox_len) {
-	  // we got part of this bx
-	  by_off[bit->first]->substr_of(ox_buf, ox_off, (ox_len-ox_off));
-	  if (bytes_read < bit->first + ox_len-ox_off) 
-	    bytes_read = bit->first + ox_len-ox_off;
-	  
-	  // zero end of bx
-	  ldout(cct, 21) << "  adding some zeros to the end " << ox_off + bit->second-ox_len << dendl;
-	  bufferptr z(ox_off + bit->second - ox_len);
-	  z.zero();
-	  by_off[bit->first]->append( z );
-	} else {
-	  // we got none of this bx.  zero whole thing.
-	  assert(ox_off >= ox_len);
-	  ldout(cct, 21) << "  adding all zeros for this bit " << bit->second << dendl;
-	  bufferptr z(bit->second);
-	  z.zero();
-	  by_off[bit->first]->append( z );
+	if (ox_off < ox_len) {
+	  unsigned got = MIN(bit->second, ox_len - ox_off);
+	  by_off[bit->first].substr_of(ox_buf, ox_off, got);
+	  if (bytes_read < bit->first + got)
+	    bytes_read = bit->first + got;
 	}
 	ox_off += bit->second;
       }
@@ -1690,26 +1984,21 @@ void Objecter::_sg_read_finish(vector<ObjectExtent>& extents, vector<bufferlist>
     }
     
     // sort and string bits together
-    for (map<uint64_t, bufferlist*>::iterator it = by_off.begin();
+    uint64_t pos = 0;
+    for (map<uint64_t, bufferlist>::iterator it = by_off.begin();
 	 it != by_off.end();
 	 it++) {
-      assert(it->second->length());
-      if (it->first < (uint64_t)bytes_read) {
-	ldout(cct, 21) << "  concat buffer frag off " << it->first << " len " << it->second->length() << dendl;
-	bl->claim_append(*(it->second));
-      } else {
-	ldout(cct, 21) << "  NO concat zero buffer frag off " << it->first << " len " << it->second->length() << dendl;          
+      if (it->first > pos) {
+	ldout(cct, 21) << "  zeroing hole " << pos << "~" << (it->first - pos) << dendl;
+	bufferptr z(it->first - pos);
+	z.zero();
+	bl->append(z);
       }
-      delete it->second;
-    }
-    
-    // trim trailing zeros?
-    if (bl->length() > bytes_read) {
-      ldout(cct, 10) << " trimming off trailing zeros . bytes_read=" << bytes_read 
-	       << " len=" << bl->length() << dendl;
-      bl->splice(bytes_read, bl->length() - bytes_read);
-      assert(bytes_read == bl->length());
+      ldout(cct, 21) << "  concat buffer frag off " << it->first << " len " << it->second.length() << dendl;
+      pos = it->first + it->second.length();
+      bl->claim_append(it->second);
     }
+    assert(pos == bytes_read);
     
   } else {
     ldout(cct, 15) << "  only one frag" << dendl;
@@ -1777,3 +2066,56 @@ void Objecter::dump_active()
   }
 }
 
+void Objecter::dump_active(ceph::Formatter *f)
+{
+  assert(client_lock.is_locked());
+  utime_t now = ceph_clock_now(cct);
+  f->open_object_section("objecter_requests");
+  f->dump_int("num_ops", ops.size());
+  f->dump_int("num_homeless_ops", num_homeless_ops);
+  f->dump_int("num_linger_ops", linger_ops.size());
+  f->dump_int("num_pool_ops", pool_ops.size());
+  f->dump_int("num_unacked", num_unacked);
+  f->dump_int("num_uncommitted", num_uncommitted);
+  f->open_object_section("op_throttle");
+  f->dump_int("current", op_throttler.get_current());
+  f->dump_int("max", op_throttler.get_max());
+  f->close_section();
+  f->open_array_section("ops");
+  for (hash_map<tid_t,Op*>::iterator p = ops.begin(); p != ops.end(); p++) {
+    Op *op = p->second;
+    f->open_object_section("op");
+    f->dump_unsigned("tid", op->tid);
+    f->dump_stream("pg") << op->pgid;
+    f->dump_int("osd", op->session ? op->session->osd : -1);
+    f->dump_stream("oid") << op->oid;
+    f->dump_stream("ops") << op->ops;
+    f->dump_int("attempts", op->attempts);
+    f->dump_float("age", now - op->stamp);
+    f->dump_int("paused", op->paused);
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+}
+
+void Objecter::AdminCommand::dump_command(const std::string &command,
+					  ceph::Formatter *f)
+{
+  /*
+   * shutdown() holds client_lock while it unregisters us, so don't
+   * block on it.
+   */
+  while (!objecter->client_lock.TryLock()) {
+    if (stopping.read()) {
+      f->open_object_section("objecter_requests");
+      f->dump_string("error", "shutting down");
+      f->close_section();
+      return;
+    }
+    usleep(1000);
+  }
+  objecter->dump_active(f);
+  objecter->client_lock.Unlock();
+}
+
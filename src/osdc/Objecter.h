@@ -22,7 +22,9 @@
 #include "osd/OSDMap.h"
 #include "messages/MOSDOp.h"
 
+#include "common/admin_socket.h"
 #include "common/Timer.h"
+#include "include/atomic.h"
 
 #include <list>
 #include <map>
@@ -145,8 +147,8 @@ struct ObjectOperation {
     string mname = "filter";
     ::encode(cname, ops[s].data);
     ::encode(mname, ops[s].data);
+    ops[s].data.append(filter);   // the osd decodes the filter before the cookie
     ::encode(cookie, ops[s].data);
-    ops[s].data.append(filter);
   }
 
   // ------
@@ -175,6 +177,10 @@ struct ObjectOperation {
     bufferlist bl;
     add_data(CEPH_OSD_OP_READ, off, len, bl);
   }
+  void checksum(uint64_t off, uint64_t len) {
+    bufferlist bl;
+    add_data(CEPH_OSD_OP_CHECKSUM, off, len, bl);
+  }
   void write(uint64_t off, bufferlist& bl) {
     add_data(CEPH_OSD_OP_WRITE, off, bl.length(), bl);
   }
@@ -192,6 +198,13 @@ struct ObjectOperation {
     bufferlist bl;
     add_data(CEPH_OSD_OP_TRUNCATE, off, 0, bl);
   }
+  void set_alloc_hint(uint64_t expected_object_size, uint64_t expected_write_size) {
+    OSDOp& osd_op = add_op(CEPH_OSD_OP_SETALLOCHINT);
+    osd_op.op.alloc_hint.expected_object_size = expected_object_size;
+    osd_op.op.alloc_hint.expected_write_size = expected_write_size;
+    // osds that don't know it just skip it
+    osd_op.op.flags = CEPH_OSD_OP_FLAG_FAILOK;
+  }
   void remove() {
     bufferlist bl;
     add_data(CEPH_OSD_OP_DELETE, 0, 0, bl);
@@ -208,6 +221,12 @@ struct ObjectOperation {
   void clone_range(const object_t& src_oid, uint64_t src_offset, uint64_t len, uint64_t dst_offset) {
     add_clone_range(CEPH_OSD_OP_CLONERANGE, dst_offset, len, src_oid, src_offset, CEPH_NOSNAP);
   }
+  void copy_from(const object_t& src_oid, snapid_t src_snapid) {
+    add_clone_range(CEPH_OSD_OP_COPY_FROM, 0, 0, src_oid, 0, src_snapid);
+  }
+  void copy_get() {
+    add_op(CEPH_OSD_OP_COPY_GET);
+  }
 
   // object attrs
   void getxattr(const char *name) {
@@ -255,6 +274,30 @@ struct ObjectOperation {
     add_op(CEPH_OSD_OP_TMAPGET);
   }
 
+  // object key/value map
+  void omap_get_vals(const string& start_after, __u32 max_return) {
+    OSDOp& op = add_op(CEPH_OSD_OP_OMAPGETVALS);
+    ::encode(start_after, op.data);
+    ::encode(max_return, op.data);
+  }
+  void omap_get_vals_by_keys(const set<string>& keys) {
+    OSDOp& op = add_op(CEPH_OSD_OP_OMAPGETVALSBYKEYS);
+    ::encode(keys, op.data);
+  }
+  void omap_set(const map<string, bufferlist>& kv) {
+    OSDOp& op = add_op(CEPH_OSD_OP_OMAPSETVALS);
+    ::encode(kv, op.data);
+  }
+  void omap_rm_keys(const set<string>& keys) {
+    OSDOp& op = add_op(CEPH_OSD_OP_OMAPRMKEYS);
+    ::encode(keys, op.data);
+  }
+
+  // snaps
+  void list_snaps() {
+    add_op(CEPH_OSD_OP_LIST_SNAPS);
+  }
+
   // object classes
   void call(const char *cname, const char *method, bufferlist &indata) {
     add_call(CEPH_OSD_OP_CALL, cname, method, indata);
@@ -334,6 +377,16 @@ class Objecter {
   SafeTimer &timer;
 
   PerfCounters *logger;
+
+  /// dump_objecter_requests, for the admin socket
+  class AdminCommand : public AdminSocketCommand {
+    Objecter *objecter;
+  public:
+    atomic_t stopping;
+    AdminCommand(Objecter *o) : objecter(o) {}
+    void dump_command(const std::string &command, ceph::Formatter *f);
+  } admin_command;
+  bool admin_command_registered;
   
   class C_Tick : public Context {
     Objecter *ob;
@@ -357,10 +410,12 @@ public:
     
     object_t oid;
     object_locator_t oloc;
+    object_locator_t target_oloc;  // oloc, or its pool's overlay (cache tier)
 
     pg_t pgid;
     vector<int> acting;
     bool used_replica;
+    bool pg_indexed;  // in ops_by_pg, under pgid
 
     Connection *con;  // for rx buffer only
 
@@ -386,18 +441,21 @@ public:
 
     utime_t stamp;
 
+    uint64_t trace_id;   // 0 unless we are tracing this op
+
     Op(const object_t& o, const object_locator_t& ol, vector<OSDOp>& op,
        int f, Context *ac, Context *co, eversion_t *ov) :
       session(NULL), session_item(this), incarnation(0),
-      oid(o), oloc(ol),
-      used_replica(false), con(NULL),
+      oid(o), oloc(ol), target_oloc(ol),
+      used_replica(false), pg_indexed(false), con(NULL),
       snapid(CEPH_NOSNAP), outbl(0), flags(f), priority(0), onack(ac), oncommit(co), 
       tid(0), attempts(0),
-      paused(false), objver(ov), reply_epoch(NULL) {
+      paused(false), objver(ov), reply_epoch(NULL), trace_id(0) {
       ops.swap(op);
 
       if (oloc.key == o)
 	oloc.key.clear();
+      target_oloc = oloc;
     }
 
     bool operator<(const Op& other) const {
@@ -453,8 +511,16 @@ public:
 
 
   // Pools and statistics 
+  /*
+   * A listing of a pool, or of just the pgs in [start_pg, end_pg) when
+   * end_pg is set.  Listings are independent, so a pool can be listed
+   * with one per pg, in parallel.  If the pool's pgs split or merge, a
+   * listing of the whole pool starts over, while a range listing fails
+   * with -ERESTART since its objects are now in other pgs.
+   */
   struct ListContext {
     int current_pg;
+    int start_pg, end_pg;
     collection_list_handle_t cookie;
     epoch_t current_pg_epoch;
     int starting_pg_num;
@@ -469,9 +535,14 @@ public:
 
     bufferlist extra_info;
 
-    ListContext() : current_pg(0), current_pg_epoch(0), starting_pg_num(0),
+    ListContext() : current_pg(0), start_pg(0), end_pg(0),
+		    current_pg_epoch(0), starting_pg_num(0),
 		    at_end(false), pool_id(0),
 		    pool_snap_seq(0), max_entries(0) {}
+
+    int last_pg() const {
+      return end_pg ? MIN(end_pg, starting_pg_num) : starting_pg_num;
+    }
   };
 
   struct C_List : public Context {
@@ -533,6 +604,7 @@ public:
     uint64_t linger_id;
     object_t oid;
     object_locator_t oloc;
+    object_locator_t target_oloc;
 
     pg_t pgid;
     vector<int> acting;
@@ -602,6 +674,7 @@ public:
  private:
   // pending ops
   hash_map<tid_t,Op*>       ops;
+  map<pg_t, set<Op*> >      ops_by_pg;  // the same ops, by the pg they were sent to
   int                       num_homeless_ops;
   map<uint64_t, LingerOp*>  linger_ops;
   map<tid_t,PoolStatOp*>    poolstat_ops;
@@ -622,8 +695,13 @@ public:
     RECALC_OP_TARGET_NEED_RESEND,
     RECALC_OP_TARGET_POOL_DNE,
   };
+  object_locator_t calc_target_oloc(const object_locator_t& oloc, int flags,
+				    snapid_t snap);
   int recalc_op_target(Op *op);
   bool recalc_linger_op_target(LingerOp *op);
+  void _op_index(Op *op);
+  void _op_unindex(Op *op);
+  bool pool_changed_since(int64_t pool, epoch_t e);
 
   void send_linger(LingerOp *info);
   void _linger_ack(LingerOp *info, int r);
@@ -677,8 +755,10 @@ public:
     last_seen_pgmap_version(0),
     client_lock(l), timer(t),
     logger(NULL),
+    admin_command(this), admin_command_registered(false),
     num_homeless_ops(0),
-    op_throttler(cct->_conf->objecter_inflight_op_bytes)
+    op_throttler(cct, "objecter_bytes", cct->_conf->objecter_inflight_op_bytes, NULL,
+		 "objecter_inflight_op_bytes")
   { }
   ~Objecter() {
     assert(!logger);
@@ -717,6 +797,7 @@ private:
     return !(ops.empty() && linger_ops.empty() && poolstat_ops.empty() && statfs_ops.empty());
   }
   void dump_active();
+  void dump_active(ceph::Formatter *f);
 
   int get_client_incarnation() const { return client_inc; }
   void set_client_incarnation(int inc) { client_inc = inc; }
@@ -1148,53 +1229,30 @@ public:
     }      
   };
 
+  /*
+   * A striped read or write is sent as one op per extent.  Reads have at
+   * most objecter_sg_max_ops_per_osd of them outstanding to any one osd;
+   * the rest go out as earlier ones to that osd complete.  Writes all go
+   * out at once: a parked piece could land after a later write to the
+   * same object.
+   */
+  struct SGWindow;
+  struct C_SGPieceDone;
+  int _sg_target_osd(const object_t& oid, const object_locator_t& oloc, int flags);
+  void _sg_start(SGWindow *w);
+  void _sg_issue(SGWindow *w, unsigned i);
+  void _sg_piece_done(SGWindow *w, int osd);
+
   void sg_read_trunc(vector<ObjectExtent>& extents, snapid_t snap, bufferlist *bl, int flags,
-		uint64_t trunc_size, __u32 trunc_seq, Context *onfinish) {
-    if (extents.size() == 1) {
-      read_trunc(extents[0].oid, extents[0].oloc, extents[0].offset, extents[0].length,
-	   snap, bl, flags, trunc_size, trunc_seq, onfinish);
-    } else {
-      C_GatherBuilder gather(cct);
-      vector<bufferlist> resultbl(extents.size());
-      int i=0;
-      for (vector<ObjectExtent>::iterator p = extents.begin(); p != extents.end(); p++) {
-	read_trunc(p->oid, p->oloc, p->offset, p->length,
-	     snap, &resultbl[i++], flags, trunc_size, trunc_seq, gather.new_sub());
-      }
-      gather.set_finisher(new C_SGRead(this, extents, resultbl, bl, onfinish));
-      gather.activate();
-    }
-  }
+		     uint64_t trunc_size, __u32 trunc_seq, Context *onfinish);
 
   void sg_read(vector<ObjectExtent>& extents, snapid_t snap, bufferlist *bl, int flags, Context *onfinish) {
     sg_read_trunc(extents, snap, bl, flags, 0, 0, onfinish);
   }
 
   void sg_write_trunc(vector<ObjectExtent>& extents, const SnapContext& snapc, const bufferlist& bl, utime_t mtime,
-		int flags, uint64_t trunc_size, __u32 trunc_seq,
-		Context *onack, Context *oncommit) {
-    if (extents.size() == 1) {
-      write_trunc(extents[0].oid, extents[0].oloc, extents[0].offset, extents[0].length,
-	    snapc, bl, mtime, flags, trunc_size, trunc_seq, onack, oncommit);
-    } else {
-      C_GatherBuilder gack(cct, onack);
-      C_GatherBuilder gcom(cct, oncommit);
-      for (vector<ObjectExtent>::iterator p = extents.begin(); p != extents.end(); p++) {
-	bufferlist cur;
-	for (map<__u32,__u32>::iterator bit = p->buffer_extents.begin();
-	     bit != p->buffer_extents.end();
-	     bit++)
-	  bl.copy(bit->first, bit->second, cur);
-	assert(cur.length() == p->length);
-	write_trunc(p->oid, p->oloc, p->offset, p->length, 
-	      snapc, cur, mtime, flags, trunc_size, trunc_seq,
-	      onack ? gack.new_sub():0,
-	      oncommit ? gcom.new_sub():0);
-      }
-      gack.activate();
-      gcom.activate();
-    }
-  }
+		      int flags, uint64_t trunc_size, __u32 trunc_seq,
+		      Context *onack, Context *oncommit);
 
   void sg_write(vector<ObjectExtent>& extents, const SnapContext& snapc, const bufferlist& bl, utime_t mtime,
 		int flags, Context *onack, Context *oncommit) {
@@ -0,0 +1,49 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSDC_OBJECTERWRITEBACK_H
+#define CEPH_OSDC_OBJECTERWRITEBACK_H
+
+#include "osdc/Objecter.h"
+#include "osdc/WritebackHandler.h"
+
+/*
+ * Writeback straight through an Objecter.  The Objecter calls back
+ * under the lock of its owner, which must be the ObjectCacher's lock.
+ */
+class ObjecterWriteback : public WritebackHandler {
+  Objecter *objecter;
+
+public:
+  ObjecterWriteback(Objecter *o) : objecter(o) {}
+
+  void read(const object_t& oid, const object_locator_t& oloc,
+	    uint64_t off, uint64_t len, snapid_t snapid,
+	    bufferlist *pbl, uint64_t trunc_size, __u32 trunc_seq,
+	    Context *onfinish) {
+    objecter->read_trunc(oid, oloc, off, len, snapid, pbl, 0,
+			 trunc_size, trunc_seq, onfinish);
+  }
+
+  tid_t write(const object_t& oid, const object_locator_t& oloc,
+	      uint64_t off, uint64_t len, const SnapContext& snapc,
+	      const bufferlist& bl, utime_t mtime,
+	      uint64_t trunc_size, __u32 trunc_seq,
+	      Context *oncommit) {
+    return objecter->write_trunc(oid, oloc, off, len, snapc, bl, mtime, 0,
+				 trunc_size, trunc_seq, NULL, oncommit);
+  }
+};
+
+#endif
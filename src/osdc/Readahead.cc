@@ -0,0 +1,85 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <algorithm>
+#include <functional>
+
+#include "Readahead.h"
+
+Readahead::Readahead()
+  : min_len(0), max_len(0), trigger(1),
+    last_pos(0), consec_bytes(0), nr_consec(0), ra_pos(0), ra_len(0)
+{
+}
+
+void Readahead::set_alignments(const std::vector<uint64_t>& a)
+{
+  alignments.clear();
+  for (std::vector<uint64_t>::const_iterator p = a.begin(); p != a.end(); ++p)
+    if (*p)
+      alignments.push_back(*p);
+  std::sort(alignments.begin(), alignments.end(), std::greater<uint64_t>());
+}
+
+void Readahead::reset()
+{
+  last_pos = consec_bytes = 0;
+  nr_consec = 0;
+  ra_pos = ra_len = 0;
+}
+
+uint64_t Readahead::_align(uint64_t pos, uint64_t len) const
+{
+  uint64_t end = pos + len;
+  for (std::vector<uint64_t>::const_iterator p = alignments.begin(); p != alignments.end(); ++p) {
+    uint64_t aligned = end - end % *p;
+    if (aligned > pos && aligned - pos >= len / 2)
+      return aligned - pos;
+  }
+  return len;
+}
+
+Readahead::extent_t Readahead::update(uint64_t off, uint64_t len, uint64_t limit)
+{
+  if (off != last_pos)
+    reset();
+  else if (consec_bytes)
+    nr_consec++;
+  consec_bytes += len;
+  last_pos = off + len;
+
+  if (!max_len || nr_consec < trigger)
+    return extent_t(0, 0);
+
+  uint64_t ra_end = ra_pos + ra_len;
+  if (ra_len && last_pos + ra_len / 2 < ra_end)
+    return extent_t(0, 0);   // the reader is still inside the last window
+
+  uint64_t pos = MAX(last_pos, ra_end);
+  uint64_t l;
+  if (ra_len)
+    l = ra_len * 2;
+  else
+    l = MAX(min_len, consec_bytes * 2);
+  l = MIN(l, max_len);
+  l = _align(pos, l);
+  if (pos >= limit)
+    return extent_t(0, 0);
+  if (pos + l > limit)
+    l = limit - pos;
+
+  ra_pos = pos;
+  ra_len = l;
+  return extent_t(pos, l);
+}
@@ -0,0 +1,86 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSDC_READAHEAD_H
+#define CEPH_OSDC_READAHEAD_H
+
+#include <vector>
+#include <utility>
+
+#include "include/types.h"
+
+/*
+ * Sequential access detection and readahead window sizing for one
+ * stream of reads (a file handle, an image, ...).
+ *
+ * The caller reports each read with update(), and gets back the extent
+ * it should prefetch, if any.  Once a stream has made enough contiguous
+ * reads, the window starts at max(min_len, twice what has been read so
+ * far) and doubles each time the reader gets halfway through the
+ * previous one, up to max_len.  A window is never reissued, and its end
+ * is rounded down to the largest alignment (e.g. file period, then
+ * stripe unit) that still leaves most of it, so prefetches are made of
+ * whole objects when they are big enough.  Any non-contiguous read
+ * resets the stream.
+ *
+ * Not thread safe; callers serialize access with their own lock, as
+ * with ObjectCacher.
+ */
+class Readahead {
+public:
+  typedef std::pair<uint64_t, uint64_t> extent_t;
+
+private:
+  uint64_t min_len, max_len;
+  unsigned trigger;                 // contiguous reads before we start
+  std::vector<uint64_t> alignments; // largest first
+
+  uint64_t last_pos;
+  uint64_t consec_bytes;
+  unsigned nr_consec;
+  uint64_t ra_pos, ra_len;          // last window we issued
+
+  uint64_t _align(uint64_t pos, uint64_t len) const;
+
+public:
+  Readahead();
+
+  void set_limits(uint64_t min, uint64_t max) {
+    min_len = min;
+    max_len = max;
+  }
+  void set_trigger(unsigned reads) {
+    trigger = reads;
+  }
+  void set_alignments(const std::vector<uint64_t>& a);
+
+  /**
+   * note a read of off~len, and return the extent to prefetch (length 0
+   * for none).  The extent never reaches past limit (e.g. the file
+   * size).
+   */
+  extent_t update(uint64_t off, uint64_t len, uint64_t limit);
+
+  /// forget the stream, e.g. when the cached data is dropped
+  void reset();
+
+  unsigned get_nr_consec() const {
+    return nr_consec;
+  }
+  uint64_t get_window() const {
+    return ra_len;
+  }
+};
+
+#endif
@@ -0,0 +1,158 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSDC_SMALLOBJECTCACHE_H
+#define CEPH_OSDC_SMALLOBJECTCACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "include/buffer.h"
+#include "include/object.h"
+#include "include/utime.h"
+#include "osd/osd_types.h"
+#include "common/Mutex.h"
+
+/*
+ * A bounded LRU of whole small objects (data, xattrs, size and mtime),
+ * for librados reads from IoCtxs that turn it on.  Missing objects are
+ * remembered too.  The client decides how long an object may be served
+ * before it is revalidated against the osd by version.
+ *
+ * Like ExtentCache: readers take a generation with begin_fill() before
+ * going to the osd, and writers invalidate _before_ they send their op,
+ * so a fill that raced with a write is dropped.
+ */
+class SmallObjectCache {
+public:
+  /// (pool, locator key), then name and snap
+  typedef std::pair<std::pair<int64_t, std::string>, sobject_t> key_t;
+
+  struct Object {
+    int r;               // 0 or -ENOENT
+    bool too_big;        // just size and mtime, no data
+    eversion_t ver;
+    uint64_t size;
+    utime_t mtime;
+    bufferlist data;
+    std::map<std::string, bufferlist> attrs;
+    utime_t stamp;       // when the osd last vouched for it
+
+    Object() : r(0), too_big(false), size(0) {}
+  };
+
+private:
+  struct Entry {
+    uint64_t gen;
+    bool filled;
+    std::list<key_t>::iterator lru_pos;
+    Object obj;
+  };
+
+  Mutex lock;
+  unsigned max_objects;
+  uint64_t last_gen;
+  std::map<key_t, Entry> objects;
+  std::list<key_t> lru;   // most recently used at the front
+
+  void _touch(Entry& e, const key_t& k) {
+    lru.erase(e.lru_pos);
+    lru.push_front(k);
+    e.lru_pos = lru.begin();
+  }
+
+  void _trim() {
+    while (objects.size() > max_objects) {
+      objects.erase(lru.back());
+      lru.pop_back();
+    }
+  }
+
+public:
+  SmallObjectCache(unsigned max)
+    : lock("SmallObjectCache::lock"), max_objects(max), last_gen(0) {}
+
+  bool enabled() const {
+    return max_objects > 0;
+  }
+
+  void set_max(unsigned max) {
+    Mutex::Locker l(lock);
+    max_objects = max;
+    _trim();
+  }
+
+  /// a copy of a filled entry; false on a miss
+  bool lookup(const key_t& k, Object *o) {
+    Mutex::Locker l(lock);
+    std::map<key_t, Entry>::iterator p = objects.find(k);
+    if (p == objects.end() || !p->second.filled)
+      return false;
+    *o = p->second.obj;
+    _touch(p->second, k);
+    return true;
+  }
+
+  /// call before asking the osd; pass the result to fill()
+  uint64_t begin_fill(const key_t& k) {
+    Mutex::Locker l(lock);
+    std::map<key_t, Entry>::iterator p = objects.find(k);
+    if (p != objects.end()) {
+      _touch(p->second, k);
+      return p->second.gen;
+    }
+    Entry& e = objects[k];
+    e.gen = ++last_gen;
+    e.filled = false;
+    lru.push_front(k);
+    e.lru_pos = lru.begin();
+    _trim();
+    return e.gen;
+  }
+
+  void fill(const key_t& k, const Object& o, uint64_t gen) {
+    Mutex::Locker l(lock);
+    std::map<key_t, Entry>::iterator p = objects.find(k);
+    if (p == objects.end() || p->second.gen != gen)
+      return;  // raced with an invalidate or eviction
+    p->second.obj = o;
+    p->second.filled = true;
+  }
+
+  /// the osd still has version ver; trust the entry again from now
+  void revalidated(const key_t& k, eversion_t ver, utime_t now) {
+    Mutex::Locker l(lock);
+    std::map<key_t, Entry>::iterator p = objects.find(k);
+    if (p != objects.end() && p->second.filled && p->second.obj.ver == ver)
+      p->second.obj.stamp = now;
+  }
+
+  void invalidate(const key_t& k) {
+    Mutex::Locker l(lock);
+    std::map<key_t, Entry>::iterator p = objects.find(k);
+    if (p == objects.end())
+      return;
+    lru.erase(p->second.lru_pos);
+    objects.erase(p);
+  }
+
+  void clear() {
+    Mutex::Locker l(lock);
+    objects.clear();
+    lru.clear();
+  }
+};
+
+#endif
@@ -0,0 +1,51 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSDC_WRITEBACKHANDLER_H
+#define CEPH_OSDC_WRITEBACKHANDLER_H
+
+#include "include/Context.h"
+#include "include/types.h"
+#include "include/object.h"
+#include "osd/osd_types.h"
+
+/*
+ * How an ObjectCacher reads in and writes back its buffers.  The
+ * Objecter implementation is used by the Client; librbd provides one
+ * on top of librados.
+ *
+ * The contexts must be completed with the ObjectCacher's lock held.
+ */
+class WritebackHandler {
+public:
+  virtual ~WritebackHandler() {}
+
+  /// read off~len of oid into *pbl; a short result reads as zeros
+  virtual void read(const object_t& oid, const object_locator_t& oloc,
+		    uint64_t off, uint64_t len, snapid_t snapid,
+		    bufferlist *pbl, uint64_t trunc_size, __u32 trunc_seq,
+		    Context *onfinish) = 0;
+
+  /**
+   * write bl at off in oid, completing oncommit once it is stable.
+   * Returns a tid; tids increase with each call.
+   */
+  virtual tid_t write(const object_t& oid, const object_locator_t& oloc,
+		      uint64_t off, uint64_t len, const SnapContext& snapc,
+		      const bufferlist& bl, utime_t mtime,
+		      uint64_t trunc_size, __u32 trunc_seq,
+		      Context *oncommit) = 0;
+};
+
+#endif
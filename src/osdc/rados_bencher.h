@@ -21,6 +21,7 @@
 #include <iostream>
 #include <fstream>
 
+#include <math.h>
 #include <stdlib.h>
 #include <time.h>
 #include <sstream>
@@ -569,3 +570,558 @@ inline void sanitize_object_contents (bench_data *data, int length) {
     data->object_contents[i] = i % sizeof(char);
   }
 }
+
+/*
+ * Mixed workload: a private set of objects per client, read and
+ * rewritten at random, with object sizes drawn from a weighted list.
+ * The first warmup seconds run the workload without recording it.
+ * Latencies are kept in histograms of quarter-octave buckets, which
+ * merge exactly across clients.
+ *
+ * For a coordinated run, the coordinator publishes the parameters and a
+ * start time in BENCH_RUN_PREFIX<run-name>; each client (bench-join)
+ * waits for the start time, runs, and appends its result to
+ * BENCH_RESULTS_PREFIX<run-name>, which the coordinator merges.
+ */
+const char *BENCH_RUN_PREFIX = "benchmark_run_";
+const char *BENCH_RESULTS_PREFIX = "benchmark_results_";
+
+struct bench_histogram {
+  static const int BUCKETS_PER_OCTAVE = 4;
+  static const int NUM_BUCKETS = 30 * BUCKETS_PER_OCTAVE;  // 1us .. ~1000s
+  vector<uint64_t> buckets;
+  uint64_t count;
+  double sum, min, max;   // seconds
+
+  bench_histogram() : buckets(NUM_BUCKETS), count(0), sum(0), min(0), max(0) {}
+
+  static int bucket_of(double lat) {
+    double us = lat * 1000000.0;
+    if (us < 1.0)
+      return 0;
+    int b = (int)(log2(us) * BUCKETS_PER_OCTAVE);
+    return b < NUM_BUCKETS ? b : NUM_BUCKETS - 1;
+  }
+
+  void add(double lat) {
+    buckets[bucket_of(lat)]++;
+    if (!count || lat < min)
+      min = lat;
+    if (lat > max)
+      max = lat;
+    count++;
+    sum += lat;
+  }
+
+  void merge(const bench_histogram& o) {
+    if (!o.count)
+      return;
+    for (int i = 0; i < NUM_BUCKETS; i++)
+      buckets[i] += o.buckets[i];
+    if (!count || o.min < min)
+      min = o.min;
+    if (o.max > max)
+      max = o.max;
+    count += o.count;
+    sum += o.sum;
+  }
+
+  double avg() const {
+    return count ? sum / count : 0;
+  }
+
+  /// latency below which fraction p of the ops completed (bucket midpoint)
+  double percentile(double p) const {
+    if (!count)
+      return 0;
+    uint64_t want = (uint64_t)ceil(p * count);
+    if (want < 1)
+      want = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      seen += buckets[i];
+      if (seen >= want) {
+	double us = pow(2.0, (i + 0.5) / BUCKETS_PER_OCTAVE);
+	double lat = us / 1000000.0;
+	return MIN(MAX(lat, min), max);
+      }
+    }
+    return max;
+  }
+
+  void encode(bufferlist& bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(buckets, bl);
+    ::encode(count, bl);
+    ::encode(sum, bl);
+    ::encode(min, bl);
+    ::encode(max, bl);
+  }
+  void decode(bufferlist::iterator& bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(buckets, bl);
+    buckets.resize(NUM_BUCKETS);
+    ::decode(count, bl);
+    ::decode(sum, bl);
+    ::decode(min, bl);
+    ::decode(max, bl);
+  }
+};
+WRITE_CLASS_ENCODER(bench_histogram)
+
+struct bench_mixed_params {
+  int seconds;
+  int warmup;
+  int concurrent_ios;
+  int read_percent;
+  int num_objects;
+  vector<pair<uint64_t, uint32_t> > sizes;   // object size, weight
+  utime_t start;                             // coordinated start, or zero
+
+  bench_mixed_params()
+    : seconds(0), warmup(0), concurrent_ios(16), read_percent(50), num_objects(1000) {}
+
+  uint64_t max_size() const {
+    uint64_t m = 0;
+    for (unsigned i = 0; i < sizes.size(); i++)
+      m = MAX(m, sizes[i].first);
+    return m;
+  }
+
+  uint64_t pick_size() const {
+    uint64_t total = 0;
+    for (unsigned i = 0; i < sizes.size(); i++)
+      total += sizes[i].second;
+    uint64_t r = rand() % total;
+    for (unsigned i = 0; i < sizes.size(); i++) {
+      if (r < sizes[i].second)
+	return sizes[i].first;
+      r -= sizes[i].second;
+    }
+    return sizes.back().first;
+  }
+
+  void encode(bufferlist& bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(seconds, bl);
+    ::encode(warmup, bl);
+    ::encode(concurrent_ios, bl);
+    ::encode(read_percent, bl);
+    ::encode(num_objects, bl);
+    ::encode(sizes, bl);
+    ::encode(start, bl);
+  }
+  void decode(bufferlist::iterator& bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(seconds, bl);
+    ::decode(warmup, bl);
+    ::decode(concurrent_ios, bl);
+    ::decode(read_percent, bl);
+    ::decode(num_objects, bl);
+    ::decode(sizes, bl);
+    ::decode(start, bl);
+  }
+};
+WRITE_CLASS_ENCODER(bench_mixed_params)
+
+struct bench_mixed_result {
+  string client;
+  double seconds;          // of steady state
+  uint64_t read_bytes, write_bytes;
+  uint64_t errors;
+  bench_histogram read_lat, write_lat;
+
+  bench_mixed_result() : seconds(0), read_bytes(0), write_bytes(0), errors(0) {}
+
+  void merge(const bench_mixed_result& o) {
+    seconds = MAX(seconds, o.seconds);
+    read_bytes += o.read_bytes;
+    write_bytes += o.write_bytes;
+    errors += o.errors;
+    read_lat.merge(o.read_lat);
+    write_lat.merge(o.write_lat);
+  }
+
+  void encode(bufferlist& bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(client, bl);
+    ::encode(seconds, bl);
+    ::encode(read_bytes, bl);
+    ::encode(write_bytes, bl);
+    ::encode(errors, bl);
+    ::encode(read_lat, bl);
+    ::encode(write_lat, bl);
+  }
+  void decode(bufferlist::iterator& bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(client, bl);
+    ::decode(seconds, bl);
+    ::decode(read_bytes, bl);
+    ::decode(write_bytes, bl);
+    ::decode(errors, bl);
+    ::decode(read_lat, bl);
+    ::decode(write_lat, bl);
+  }
+};
+WRITE_CLASS_ENCODER(bench_mixed_result)
+
+/// parse "size[:weight],..." into params.sizes
+int parse_object_sizes(const string& s, bench_mixed_params& params)
+{
+  params.sizes.clear();
+  size_t pos = 0;
+  while (pos < s.length()) {
+    size_t end = s.find(',', pos);
+    if (end == string::npos)
+      end = s.length();
+    string item = s.substr(pos, end - pos);
+    size_t colon = item.find(':');
+    long long size = strtoll(item.substr(0, colon).c_str(), NULL, 10);
+    long long weight = 1;
+    if (colon != string::npos)
+      weight = strtoll(item.substr(colon + 1).c_str(), NULL, 10);
+    if (size <= 0 || weight <= 0)
+      return -EINVAL;
+    params.sizes.push_back(make_pair((uint64_t)size, (uint32_t)weight));
+    pos = end + 1;
+  }
+  return params.sizes.empty() ? -EINVAL : 0;
+}
+
+static void print_latency_line(ostream& out, const char *what, const bench_histogram& h)
+{
+  out << setfill(' ') << setw(6) << what
+      << setw(10) << h.count
+      << setw(11) << h.avg()
+      << setw(11) << h.min
+      << setw(11) << h.percentile(.5)
+      << setw(11) << h.percentile(.9)
+      << setw(11) << h.percentile(.99)
+      << setw(11) << h.percentile(.999)
+      << setw(11) << h.max << std::endl;
+}
+
+void print_mixed_result(ostream& out, const bench_mixed_result& r)
+{
+  double secs = r.seconds > 0 ? r.seconds : 1;
+  out << "Steady state time:     " << r.seconds << std::endl
+      << "Read bandwidth (MB/s): " << (double)r.read_bytes / secs / (1024*1024) << std::endl
+      << "Write bandwidth (MB/s):" << (double)r.write_bytes / secs / (1024*1024) << std::endl
+      << "Ops/sec:               " << (double)(r.read_lat.count + r.write_lat.count) / secs << std::endl
+      << "Errors:                " << r.errors << std::endl
+      << setfill(' ') << setw(6) << "op" << setw(10) << "ops"
+      << setw(11) << "avg lat" << setw(11) << "min" << setw(11) << "p50"
+      << setw(11) << "p90" << setw(11) << "p99" << setw(11) << "p99.9"
+      << setw(11) << "max" << std::endl;
+  print_latency_line(out, "read", r.read_lat);
+  print_latency_line(out, "write", r.write_lat);
+}
+
+static void bench_sleep(utime_t t)
+{
+  struct timespec ts;
+  t.to_timespec(&ts);
+  nanosleep(&ts, NULL);
+}
+
+struct mixed_slot {
+  librados::AioCompletion *c;
+  bool is_read;
+  utime_t start;
+  bufferlist bl;
+  uint64_t len;
+  mixed_slot() : c(NULL), is_read(false), len(0) {}
+};
+
+static string mixed_object_name(const string& prefix, int objnum)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%d", objnum);
+  return prefix + "_object" + buf;
+}
+
+int mixed_bench(librados::Rados& rados, librados::IoCtx& io_ctx,
+		const bench_mixed_params& params, bench_mixed_result *result)
+{
+  if (params.sizes.empty() || params.num_objects <= 0 || params.concurrent_ios <= 0)
+    return -EINVAL;
+
+  char hostname[30];
+  gethostname(hostname, sizeof(hostname)-1);
+  hostname[sizeof(hostname)-1] = 0;
+  ostringstream prefix;
+  prefix << "benchmark_mixed_" << hostname << "_" << getpid();
+  result->client = prefix.str().substr(strlen("benchmark_mixed_"));
+
+  uint64_t max_size = params.max_size();
+  bufferptr contents(max_size);
+  for (uint64_t i = 0; i < max_size; i++)
+    contents[i] = i & 0xff;
+
+  // every object exists before reads start
+  cout << "Writing " << params.num_objects << " objects..." << std::endl;
+  for (int i = 0; i < params.num_objects; i++) {
+    bufferlist bl;
+    bl.append(contents.c_str(), params.pick_size());
+    int r = io_ctx.write_full(mixed_object_name(prefix.str(), i), bl);
+    if (r < 0) {
+      cerr << "error writing " << mixed_object_name(prefix.str(), i) << ": " << r << std::endl;
+      return r;
+    }
+  }
+
+  if (params.start != utime_t()) {
+    utime_t now = ceph_clock_now(g_ceph_context);
+    if (now < params.start) {
+      cout << "Waiting " << (params.start - now) << " seconds for the coordinated start" << std::endl;
+      bench_sleep(params.start - now);
+    } else {
+      cerr << "warning: starting " << (now - params.start)
+	   << " seconds after the coordinated start" << std::endl;
+    }
+  }
+
+  cout << "Running " << params.read_percent << "% reads, "
+       << params.concurrent_ios << " concurrent ops over " << params.num_objects
+       << " objects for " << params.warmup << "+" << params.seconds << " seconds" << std::endl;
+
+  bench_data *data = new bench_data();
+  double mean_size = 0;
+  uint64_t total_weight = 0;
+  for (unsigned i = 0; i < params.sizes.size(); i++) {
+    mean_size += (double)params.sizes[i].first * params.sizes[i].second;
+    total_weight += params.sizes[i].second;
+  }
+  dataLock.Lock();
+  data->done = false;
+  data->object_size = max_size;
+  data->trans_size = (int)(mean_size / total_weight);
+  data->in_flight = 0;
+  data->started = 0;
+  data->finished = 0;
+  data->min_latency = 9999.0;
+  data->max_latency = 0;
+  data->avg_latency = 0;
+  data->object_contents = NULL;
+  data->start_time = ceph_clock_now(g_ceph_context);
+  dataLock.Unlock();
+
+  utime_t steady_start = data->start_time + utime_t(params.warmup, 0);
+  utime_t stop = steady_start + utime_t(params.seconds, 0);
+  double total_latency = 0;
+
+  pthread_t print_thread;
+  pthread_create(&print_thread, NULL, status_printer, (void *)data);
+
+  Cond cond;
+  vector<mixed_slot> slots(params.concurrent_ios);
+  int r = 0;
+  int in_flight = 0;
+  while (true) {
+    utime_t now = ceph_clock_now(g_ceph_context);
+    bool stopping = (now >= stop || r < 0);
+
+    // reap
+    for (unsigned i = 0; i < slots.size(); i++) {
+      mixed_slot& s = slots[i];
+      if (!s.c || !s.c->is_complete())
+	continue;
+      int ret = s.c->get_return_value();
+      s.c->release();
+      s.c = NULL;
+      in_flight--;
+      utime_t lat = ceph_clock_now(g_ceph_context) - s.start;
+      if (ret < 0) {
+	result->errors++;
+	continue;
+      }
+      if (s.start >= steady_start && s.start < stop) {
+	if (s.is_read) {
+	  result->read_lat.add(lat);
+	  result->read_bytes += s.bl.length();
+	} else {
+	  result->write_lat.add(lat);
+	  result->write_bytes += s.len;
+	}
+      }
+      dataLock.Lock();
+      data->cur_latency = lat;
+      total_latency += lat;
+      ++data->finished;
+      --data->in_flight;
+      data->avg_latency = total_latency / data->finished;
+      if ((double)lat > data->max_latency) data->max_latency = lat;
+      if ((double)lat < data->min_latency) data->min_latency = lat;
+      dataLock.Unlock();
+    }
+
+    if (stopping && !in_flight)
+      break;
+
+    // refill
+    for (unsigned i = 0; !stopping && i < slots.size(); i++) {
+      mixed_slot& s = slots[i];
+      if (s.c)
+	continue;
+      string oid = mixed_object_name(prefix.str(), rand() % params.num_objects);
+      s.is_read = (rand() % 100) < params.read_percent;
+      s.bl.clear();
+      s.start = ceph_clock_now(g_ceph_context);
+      s.c = rados.aio_create_completion((void *) &cond, &_aio_cb, 0);
+      if (s.is_read) {
+	s.len = max_size;
+	r = io_ctx.aio_read(oid, s.c, &s.bl, s.len, 0);
+      } else {
+	s.len = params.pick_size();
+	bufferlist bl;
+	bl.append(contents.c_str(), s.len);
+	r = io_ctx.aio_write_full(oid, s.c, bl);
+      }
+      if (r < 0) {
+	cerr << "error starting op on " << oid << ": " << r << std::endl;
+	s.c->release();
+	s.c = NULL;
+	break;
+      }
+      in_flight++;
+      dataLock.Lock();
+      ++data->started;
+      ++data->in_flight;
+      dataLock.Unlock();
+    }
+
+    // wait for a completion
+    dataLock.Lock();
+    bool any = false;
+    for (unsigned i = 0; i < slots.size() && !any; i++)
+      any = slots[i].c && slots[i].c->is_complete();
+    if (!any && in_flight)
+      cond.WaitInterval(g_ceph_context, dataLock, utime_t(1, 0));
+    dataLock.Unlock();
+  }
+
+  dataLock.Lock();
+  data->done = true;
+  dataLock.Unlock();
+  pthread_join(print_thread, NULL);
+  delete data;
+
+  result->seconds = params.seconds;
+  return r < 0 ? r : 0;
+}
+
+/// publish the run and merge the results of num_clients bench-join clients
+int mixed_bench_coordinate(librados::IoCtx& io_ctx, const string& run_name,
+			   bench_mixed_params params, int num_clients, int start_delay)
+{
+  string run_oid = string(BENCH_RUN_PREFIX) + run_name;
+  string results_oid = string(BENCH_RESULTS_PREFIX) + run_name;
+
+  params.start = ceph_clock_now(g_ceph_context) + utime_t(start_delay, 0);
+  io_ctx.remove(results_oid);
+  bufferlist bl;
+  ::encode(params, bl);
+  int r = io_ctx.write_full(run_oid, bl);
+  if (r < 0) {
+    cerr << "error writing " << run_oid << ": " << r << std::endl;
+    return r;
+  }
+  cout << "Published run '" << run_name << "' starting in " << start_delay
+       << " seconds; waiting for " << num_clients << " clients "
+       << "(run 'rados -p <pool> bench-join " << run_name << "' on each)" << std::endl;
+
+  utime_t deadline = params.start + utime_t(params.warmup + params.seconds + 60, 0);
+  vector<bench_mixed_result> results;
+  while ((int)results.size() < num_clients) {
+    if (ceph_clock_now(g_ceph_context) > deadline) {
+      cerr << "timed out with " << results.size() << " of " << num_clients
+	   << " results" << std::endl;
+      break;
+    }
+    bench_sleep(utime_t(1, 0));
+    bufferlist rbl;
+    r = io_ctx.read(results_oid, rbl, 0, 0);
+    if (r == -ENOENT)
+      continue;
+    if (r < 0) {
+      cerr << "error reading " << results_oid << ": " << r << std::endl;
+      return r;
+    }
+    results.clear();
+    try {
+      bufferlist::iterator p = rbl.begin();
+      while (!p.end()) {
+	bench_mixed_result res;
+	::decode(res, p);
+	results.push_back(res);
+      }
+    } catch (buffer::error& e) {
+      cerr << "error decoding " << results_oid << std::endl;
+      return -EIO;
+    }
+  }
+
+  bench_mixed_result total;
+  for (unsigned i = 0; i < results.size(); i++) {
+    cout << "== " << results[i].client << std::endl;
+    print_mixed_result(cout, results[i]);
+    total.merge(results[i]);
+  }
+  cout << "== total of " << results.size() << " clients" << std::endl;
+  print_mixed_result(cout, total);
+  io_ctx.remove(run_oid);
+  return (int)results.size() < num_clients ? -ETIMEDOUT : 0;
+}
+
+/// wait for run_name to be published, run it, and append our result
+int mixed_bench_join(librados::Rados& rados, librados::IoCtx& io_ctx, const string& run_name,
+		     int wait_seconds)
+{
+  string run_oid = string(BENCH_RUN_PREFIX) + run_name;
+  string results_oid = string(BENCH_RESULTS_PREFIX) + run_name;
+
+  bench_mixed_params params;
+  utime_t deadline = ceph_clock_now(g_ceph_context) + utime_t(wait_seconds, 0);
+  while (true) {
+    bufferlist bl;
+    int r = io_ctx.read(run_oid, bl, 0, 0);
+    if (r >= 0) {
+      try {
+	bufferlist::iterator p = bl.begin();
+	::decode(params, p);
+      } catch (buffer::error& e) {
+	cerr << "error decoding " << run_oid << std::endl;
+	return -EIO;
+      }
+      break;
+    }
+    if (r != -ENOENT) {
+      cerr << "error reading " << run_oid << ": " << r << std::endl;
+      return r;
+    }
+    if (ceph_clock_now(g_ceph_context) > deadline) {
+      cerr << "run '" << run_name << "' was not published" << std::endl;
+      return -ETIMEDOUT;
+    }
+    bench_sleep(utime_t(1, 0));
+  }
+
+  bench_mixed_result result;
+  int r = mixed_bench(rados, io_ctx, params, &result);
+  if (r < 0)
+    return r;
+  print_mixed_result(cout, result);
+
+  bufferlist bl;
+  ::encode(result, bl);
+  r = io_ctx.append(results_oid, bl, bl.length());
+  if (r < 0)
+    cerr << "error appending to " << results_oid << ": " << r << std::endl;
+  return r;
+}
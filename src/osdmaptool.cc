@@ -28,17 +28,169 @@ using namespace std;
 #include "osd/OSDMap.h"
 #include "mon/MonMap.h"
 #include "common/ceph_argparse.h"
+#include "common/Thread.h"
 #include "global/global_init.h"
 
+#include <math.h>
+
 void usage()
 {
   cout << " usage: [--print] [--createsimple <numosd> [--clobber] [--pg_bits <bitsperosd>]] <mapfilename>" << std::endl;
   cout << "   --export-crush <file>   write osdmap's crush map to <file>" << std::endl;
   cout << "   --import-crush <file>   replace osdmap's crush map with <file>" << std::endl;
   cout << "   --test-map-pg <pgid>    map a pgid to osds" << std::endl;
+  cout << "   --test-map-pgs          map all pgs, show how they spread over the osds" << std::endl;
+  cout << "   --test-map-objects <n>  same, weighted by <n> sample objects per pool" << std::endl;
+  cout << "   --pool <poolid>         only map pgs in this pool" << std::endl;
+  cout << "   --threads <n>           map with this many threads" << std::endl;
+  cout << "   --compare <file>        count pg copies that move from that osdmap to this one" << std::endl;
+  cout << "                           (default with --import-crush: the map before the import)" << std::endl;
   exit(1);
 }
 
+/*
+ * Placement simulation: map a set of pgs (all of them, or those a
+ * sample of objects lands in, each weighted by its objects), spread
+ * over a few threads, then summarize per osd and optionally against
+ * another map.  Each thread batch maps a contiguous slice of the pgs.
+ */
+class MapThread : public Thread {
+  OSDMap *osdmap;
+  const vector<pg_t>& pgs;
+  vector<vector<int> >& acting;
+  unsigned first, last;
+public:
+  MapThread(OSDMap *m, const vector<pg_t>& p, vector<vector<int> >& a, unsigned f, unsigned l)
+    : osdmap(m), pgs(p), acting(a), first(f), last(l) {}
+  void *entry() {
+    vector<pg_t> slice(pgs.begin() + first, pgs.begin() + last);
+    vector<vector<int> > out;
+    osdmap->pgs_to_acting_osds(slice, out);
+    for (unsigned i = 0; i < out.size(); i++)
+      acting[first + i].swap(out[i]);
+    return NULL;
+  }
+};
+
+static void map_pgs(OSDMap& osdmap, const vector<pg_t>& pgs, vector<vector<int> >& acting,
+		    int threads)
+{
+  acting.clear();
+  acting.resize(pgs.size());
+  if (threads < 1)
+    threads = 1;
+  vector<MapThread*> workers;
+  unsigned per = (pgs.size() + threads - 1) / threads;
+  for (int i = 0; i < threads; i++) {
+    unsigned first = MIN(pgs.size(), i * per);
+    unsigned last = MIN(pgs.size(), first + per);
+    workers.push_back(new MapThread(&osdmap, pgs, acting, first, last));
+    workers.back()->create();
+  }
+  for (int i = 0; i < threads; i++) {
+    workers[i]->join();
+    delete workers[i];
+  }
+}
+
+static void get_test_pgs(OSDMap& osdmap, int64_t only_pool, int num_objects,
+			 vector<pg_t>& pgs, vector<uint64_t>& weight)
+{
+  for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+       p != osdmap.get_pools().end();
+       p++) {
+    if (only_pool >= 0 && p->first != only_pool)
+      continue;
+    const pg_pool_t *pool = &p->second;
+    if (num_objects <= 0) {
+      for (ps_t ps = 0; ps < pool->get_pg_num(); ps++) {
+	pgs.push_back(pg_t(ps, p->first, -1));
+	weight.push_back(1);
+      }
+      continue;
+    }
+    map<pg_t,uint64_t> objs;
+    for (int i = 0; i < num_objects; i++) {
+      char n[32];
+      snprintf(n, sizeof(n), "obj.%d", i);
+      pg_t raw;
+      osdmap.object_locator_to_pg(object_t(n), object_locator_t(p->first), raw);
+      objs[pool->raw_pg_to_pg(raw)]++;
+    }
+    for (map<pg_t,uint64_t>::iterator q = objs.begin(); q != objs.end(); ++q) {
+      pgs.push_back(q->first);
+      weight.push_back(q->second);
+    }
+  }
+}
+
+static void print_distribution(OSDMap& osdmap, const vector<vector<int> >& acting,
+			       const vector<uint64_t>& weight, const char *what)
+{
+  int max = osdmap.get_max_osd();
+  vector<uint64_t> count(max), first(max);
+  uint64_t total = 0;
+  for (unsigned i = 0; i < acting.size(); i++)
+    for (unsigned j = 0; j < acting[i].size(); j++) {
+      int o = acting[i][j];
+      if (o < 0 || o >= max)
+	continue;
+      count[o] += weight[i];
+      if (j == 0)
+	first[o] += weight[i];
+      total += weight[i];
+    }
+
+  cout << "#osd\t" << what << "\tfirst\tweight" << std::endl;
+  int in = 0, min_osd = -1, max_osd = -1;
+  for (int o = 0; o < max; o++) {
+    if (!osdmap.is_in(o))
+      continue;
+    in++;
+    cout << "osd." << o << "\t" << count[o] << "\t" << first[o] << "\t" << osdmap.get_weightf(o) << std::endl;
+    if (min_osd < 0 || count[o] < count[min_osd])
+      min_osd = o;
+    if (max_osd < 0 || count[o] > count[max_osd])
+      max_osd = o;
+  }
+  if (!in)
+    return;
+  double avg = (double)total / (double)in;
+  double dev = 0;
+  for (int o = 0; o < max; o++)
+    if (osdmap.is_in(o))
+      dev += (count[o] - avg) * (count[o] - avg);
+  dev = sqrt(dev / (double)in);
+  // what uniformly random placement would give
+  double edev = sqrt(avg * (1.0 - 1.0 / (double)in));
+  cout << " in " << in << std::endl;
+  cout << " avg " << avg << " stddev " << dev << " (" << (avg ? dev / avg : 0) << "x)"
+       << " (expected " << edev << " " << (avg ? edev / avg : 0) << "x)" << std::endl;
+  cout << " min osd." << min_osd << " " << count[min_osd] << std::endl;
+  cout << " max osd." << max_osd << " " << count[max_osd] << std::endl;
+}
+
+static void print_movement(const vector<pg_t>& pgs, const vector<vector<int> >& before,
+			   const vector<vector<int> >& after, const vector<uint64_t>& weight,
+			   const char *what)
+{
+  unsigned changed = 0;
+  uint64_t moved = 0, total = 0;
+  for (unsigned i = 0; i < pgs.size(); i++) {
+    set<int> had(before[i].begin(), before[i].end());
+    for (unsigned j = 0; j < after[i].size(); j++) {
+      total += weight[i];
+      if (!had.count(after[i][j]))
+	moved += weight[i];
+    }
+    if (before[i] != after[i])
+      changed++;
+  }
+  cout << " " << changed << "/" << pgs.size() << " pgs change mapping; "
+       << moved << "/" << total << " " << what << " copies move ("
+       << (total ? 100.0 * moved / total : 0) << "%)" << std::endl;
+}
+
 int main(int argc, const char **argv)
 {
   vector<const char*> args;
@@ -65,6 +217,11 @@ int main(int argc, const char **argv)
   std::string export_crush, import_crush, test_map_pg, test_map_object;
   list<entity_addr_t> add, rm;
   bool test_crush = false;
+  bool test_map_pgs = false;
+  int test_map_objects = 0;
+  long long only_pool = -1;
+  int threads = 1;
+  std::string compare;
 
   std::string val;
   std::ostringstream err;
@@ -117,6 +274,26 @@ int main(int argc, const char **argv)
       test_map_object = val;
     } else if (ceph_argparse_flag(args, i, "--test_crush", (char*)NULL)) {
       test_crush = true;
+    } else if (ceph_argparse_flag(args, i, "--test_map_pgs", (char*)NULL)) {
+      test_map_pgs = true;
+    } else if (ceph_argparse_withint(args, i, &test_map_objects, &err, "--test_map_objects", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      test_map_pgs = true;
+    } else if (ceph_argparse_withlonglong(args, i, &only_pool, &err, "--pool", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_withint(args, i, &threads, &err, "--threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_witharg(args, i, &val, "--compare", (char*)NULL)) {
+      compare = val;
     } else {
       ++i;
     }
@@ -171,6 +348,30 @@ int main(int argc, const char **argv)
     modified = true;
   }
 
+  // the map to measure data movement against
+  OSDMap before;
+  bool have_before = false;
+  if (!compare.empty()) {
+    bufferlist obl;
+    std::string error;
+    r = obl.read_file(compare.c_str(), &error);
+    if (r) {
+      cerr << me << ": couldn't open " << compare << ": " << error << std::endl;
+      return -1;
+    }
+    try {
+      before.decode(obl);
+    }
+    catch (const buffer::error &e) {
+      cerr << me << ": error decoding osdmap '" << compare << "'" << std::endl;
+      return -1;
+    }
+    have_before = true;
+  } else if (test_map_pgs && !import_crush.empty() && bl.length()) {
+    before.decode(bl);
+    have_before = true;
+  }
+
   if (!import_crush.empty()) {
     bufferlist cbl;
     std::string error;
@@ -204,7 +405,7 @@ int main(int argc, const char **argv)
 
   if (!export_crush.empty()) {
     bufferlist cbl;
-    osdmap.crush.encode(cbl);
+    osdmap.crush->encode(cbl);
     r = cbl.write_file(export_crush.c_str());
     if (r < 0) {
       cerr << me << ": error writing crush map to " << import_crush << std::endl;
@@ -241,6 +442,25 @@ int main(int argc, const char **argv)
     osdmap.pg_to_up_acting_osds(pgid, up, acting);
     cout << pgid << " raw " << raw << " up " << up << " acting " << acting << std::endl;
   }
+  if (test_map_pgs) {
+    const char *what = test_map_objects > 0 ? "objects" : "pgs";
+    vector<pg_t> pgs;
+    vector<uint64_t> weight;
+    get_test_pgs(osdmap, only_pool, test_map_objects, pgs, weight);
+    utime_t start = ceph_clock_now(g_ceph_context);
+    vector<vector<int> > acting;
+    map_pgs(osdmap, pgs, acting, threads);
+    utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+    cout << me << ": mapped " << pgs.size() << " pgs in " << elapsed
+	 << " with " << threads << " threads" << std::endl;
+    print_distribution(osdmap, acting, weight, what);
+    if (have_before) {
+      vector<vector<int> > old_acting;
+      map_pgs(before, pgs, old_acting, threads);
+      cout << "against epoch " << before.get_epoch() << ":" << std::endl;
+      print_movement(pgs, old_acting, acting, weight, what);
+    }
+  }
   if (test_crush) {
     int pass = 0;
     while (1) {
@@ -274,7 +494,7 @@ int main(int argc, const char **argv)
 
   if (!print && !print_json && !tree && !modified && 
       export_crush.empty() && import_crush.empty() && 
-      test_map_pg.empty() && test_map_object.empty()) {
+      test_map_pg.empty() && test_map_object.empty() && !test_map_pgs) {
     cerr << me << ": no action specified?" << std::endl;
     usage();
   }
@@ -14,6 +14,7 @@
 
 #include "common/LogClient.h"
 #include "perfglue/cpu_profiler.h"
+#include "perfglue/cpu_sampler.h"
 
 #include <google/profiler.h>
 
@@ -27,6 +28,7 @@ void cpu_profiler_handle_command(const std::vector<std::string> &cmd,
       return;
     }
     const char *file = cmd[2].c_str();
+    cpu_sampler_suspend();    // it wants SIGPROF to itself
     int r = ProfilerStart(file);
     clog.info() << "cpu_profiler: starting logging to " << file
 		<< ", r=" << r << "\n";
@@ -52,6 +54,7 @@ void cpu_profiler_handle_command(const std::vector<std::string> &cmd,
     clog.info() << "cpu_profiler: flushing and stopping\n";
     ProfilerFlush();
     ProfilerStop();
+    cpu_sampler_resume();
   }
   else {
     clog.info() << "can't understand cpu_profiler command. Expected one of: "
@@ -0,0 +1,336 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "perfglue/cpu_sampler.h"
+#include "common/Formatter.h"
+#include "common/safe_io.h"
+
+#include <cxxabi.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#define CPU_SAMPLE_DEPTH 32
+#define CPU_SAMPLE_SKIP 2      // the handler and the signal trampoline
+
+struct CpuSample {
+  volatile uint64_t seq;       // 1 + ticket once written; 0 while writing
+  char thread[16];
+  int depth;
+  void *pcs[CPU_SAMPLE_DEPTH];
+};
+
+/*
+ * The handler only touches the ring; everything else is under
+ * sampler_lock, and the ring is only freed once the timer is off and
+ * no handler is still inside it.
+ */
+static pthread_mutex_t sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static CpuSample *ring = NULL;
+static int ring_size = 0;
+static volatile uint64_t next_ticket = 0;
+static volatile int enabled = 0;
+static volatile int in_handler = 0;
+static int sample_hz = 0;
+static bool suspended = false;
+
+static void handle_sigprof(int signum)
+{
+  int saved_errno = errno;
+  __sync_fetch_and_add(&in_handler, 1);
+  if (enabled) {
+    uint64_t ticket = __sync_fetch_and_add(&next_ticket, 1);
+    CpuSample *s = &ring[ticket % ring_size];
+    s->seq = 0;
+    __sync_synchronize();
+    prctl(PR_GET_NAME, s->thread, 0, 0, 0);
+    s->thread[sizeof(s->thread) - 1] = 0;
+    void *pcs[CPU_SAMPLE_DEPTH + CPU_SAMPLE_SKIP];
+    int n = backtrace(pcs, CPU_SAMPLE_DEPTH + CPU_SAMPLE_SKIP) - CPU_SAMPLE_SKIP;
+    if (n < 0)
+      n = 0;
+    memcpy(s->pcs, pcs + CPU_SAMPLE_SKIP, n * sizeof(void*));
+    s->depth = n;
+    __sync_synchronize();
+    s->seq = ticket + 1;
+  }
+  __sync_fetch_and_sub(&in_handler, 1);
+  errno = saved_errno;
+}
+
+static void set_timer(int hz)
+{
+  struct itimerval it;
+  memset(&it, 0, sizeof(it));
+  if (hz > 0) {
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = 1000000 / hz;
+    it.it_value = it.it_interval;
+  }
+  setitimer(ITIMER_PROF, &it, NULL);
+}
+
+/// called with sampler_lock held
+static int _arm()
+{
+  if (suspended || sample_hz <= 0 || !ring)
+    return 0;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_sigprof;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, NULL) < 0)
+    return -errno;
+  enabled = 1;
+  set_timer(sample_hz);
+  return 0;
+}
+
+/// called with sampler_lock held
+static void _disarm()
+{
+  set_timer(0);
+  enabled = 0;
+  __sync_synchronize();
+  while (in_handler)
+    usleep(100);
+}
+
+int cpu_sampler_start(int hz, int max_samples)
+{
+  if (hz <= 0 || hz > 1000000 || max_samples <= 0)
+    return -EINVAL;
+
+  // the first backtrace() may load libgcc; do that here, not in the handler
+  void *pcs[1];
+  backtrace(pcs, 1);
+
+  pthread_mutex_lock(&sampler_lock);
+  _disarm();
+  if (ring && ring_size != max_samples) {
+    free(ring);
+    ring = NULL;
+  }
+  if (!ring) {
+    ring = (CpuSample*)calloc(max_samples, sizeof(CpuSample));
+    if (!ring) {
+      pthread_mutex_unlock(&sampler_lock);
+      return -ENOMEM;
+    }
+    ring_size = max_samples;
+    next_ticket = 0;
+  }
+  sample_hz = hz;
+  int r = _arm();
+  pthread_mutex_unlock(&sampler_lock);
+  return r;
+}
+
+void cpu_sampler_stop()
+{
+  pthread_mutex_lock(&sampler_lock);
+  _disarm();
+  sample_hz = 0;
+  pthread_mutex_unlock(&sampler_lock);
+}
+
+bool cpu_sampler_running()
+{
+  return enabled;
+}
+
+void cpu_sampler_suspend()
+{
+  pthread_mutex_lock(&sampler_lock);
+  if (!suspended) {
+    if (enabled)
+      _disarm();
+    suspended = true;
+  }
+  pthread_mutex_unlock(&sampler_lock);
+}
+
+void cpu_sampler_resume()
+{
+  pthread_mutex_lock(&sampler_lock);
+  if (suspended) {
+    suspended = false;
+    _arm();
+  }
+  pthread_mutex_unlock(&sampler_lock);
+}
+
+/// copy out the samples that aren't being overwritten
+static void get_samples(std::vector<CpuSample> *out, int *hz)
+{
+  pthread_mutex_lock(&sampler_lock);
+  *hz = sample_hz;
+  if (ring) {
+    out->reserve(ring_size);
+    for (int i = 0; i < ring_size; i++) {
+      CpuSample s;
+      uint64_t seq = ring[i].seq;
+      __sync_synchronize();
+      memcpy(&s, (const void*)&ring[i], sizeof(s));
+      __sync_synchronize();
+      if (seq == 0 || seq != ring[i].seq || s.depth <= 0 || s.depth > CPU_SAMPLE_DEPTH)
+	continue;
+      out->push_back(s);
+    }
+  }
+  pthread_mutex_unlock(&sampler_lock);
+}
+
+void cpu_sampler_dump_pprof(std::vector<char> &out)
+{
+  std::vector<CpuSample> samples;
+  int hz;
+  get_samples(&samples, &hz);
+
+  std::map<std::vector<void*>, uint64_t> stacks;
+  for (unsigned i = 0; i < samples.size(); i++)
+    stacks[std::vector<void*>(samples[i].pcs, samples[i].pcs + samples[i].depth)]++;
+
+  // header: 0, header words, version, sampling period (usec), padding
+  std::vector<uintptr_t> words;
+  words.push_back(0);
+  words.push_back(3);
+  words.push_back(0);
+  words.push_back(hz > 0 ? 1000000 / hz : 0);
+  words.push_back(0);
+  for (std::map<std::vector<void*>, uint64_t>::iterator p = stacks.begin();
+       p != stacks.end();
+       ++p) {
+    words.push_back(p->second);
+    words.push_back(p->first.size());
+    for (unsigned i = 0; i < p->first.size(); i++)
+      words.push_back((uintptr_t)p->first[i]);
+  }
+  // trailer
+  words.push_back(0);
+  words.push_back(1);
+  words.push_back(0);
+
+  const char *b = (const char*)&words[0];
+  out.assign(b, b + words.size() * sizeof(uintptr_t));
+
+  // followed by our mappings, so pprof can symbolize without the binary's layout
+  int fd = ::open("/proc/self/maps", O_RDONLY);
+  if (fd >= 0) {
+    char buf[4096];
+    ssize_t r;
+    while ((r = safe_read(fd, buf, sizeof(buf))) > 0)
+      out.insert(out.end(), buf, buf + r);
+    ::close(fd);
+  }
+}
+
+static std::string symbolize(void *pc)
+{
+  std::string ret;
+  char **strs = backtrace_symbols(&pc, 1);
+  if (!strs)
+    return ret;
+  ret = strs[0];
+  free(strs);
+
+  // "binary(mangled+0x12) [0x...]"
+  size_t b = ret.find('(');
+  size_t e = ret.find('+', b);
+  if (b == std::string::npos || e == std::string::npos || e == b + 1)
+    return ret;
+  std::string mangled = ret.substr(b + 1, e - b - 1);
+  int status;
+  char *d = abi::__cxa_demangle(mangled.c_str(), NULL, NULL, &status);
+  if (d) {
+    ret = d;
+    free(d);
+  } else {
+    ret = mangled;
+  }
+  return ret;
+}
+
+struct ThreadSamples {
+  uint64_t samples;
+  std::map<std::string, uint64_t> funcs;
+  ThreadSamples() : samples(0) {}
+};
+
+static bool cmp_count(const std::pair<std::string, uint64_t>& a,
+		      const std::pair<std::string, uint64_t>& b)
+{
+  return a.second > b.second;
+}
+
+void cpu_sampler_dump_threads(ceph::Formatter *f)
+{
+  std::vector<CpuSample> samples;
+  int hz;
+  get_samples(&samples, &hz);
+
+  // symbolize each distinct leaf once
+  std::map<void*, std::string> syms;
+  std::map<std::string, ThreadSamples> threads;
+  for (unsigned i = 0; i < samples.size(); i++) {
+    void *pc = samples[i].pcs[0];
+    std::map<void*, std::string>::iterator s = syms.find(pc);
+    if (s == syms.end())
+      s = syms.insert(std::make_pair(pc, symbolize(pc))).first;
+    ThreadSamples& t = threads[samples[i].thread];
+    t.samples++;
+    t.funcs[s->second]++;
+  }
+
+  f->open_object_section("cpu_samples");
+  f->dump_int("hz", hz);
+  f->dump_unsigned("samples", samples.size());
+  f->open_array_section("threads");
+  for (std::map<std::string, ThreadSamples>::iterator p = threads.begin();
+       p != threads.end();
+       ++p) {
+    f->open_object_section("thread");
+    f->dump_string("name", p->first);
+    f->dump_unsigned("samples", p->second.samples);
+    std::vector<std::pair<std::string, uint64_t> > top(p->second.funcs.begin(),
+							p->second.funcs.end());
+    std::sort(top.begin(), top.end(), cmp_count);
+    if (top.size() > 10)
+      top.resize(10);
+    f->open_array_section("top");
+    for (unsigned i = 0; i < top.size(); i++) {
+      f->open_object_section("func");
+      f->dump_string("name", top[i].first);
+      f->dump_unsigned("samples", top[i].second);
+      f->close_section();
+    }
+    f->close_section();
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+}
@@ -0,0 +1,46 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+#ifndef CEPH_PERFGLUE_CPU_SAMPLER_H
+#define CEPH_PERFGLUE_CPU_SAMPLER_H
+
+#include <vector>
+
+namespace ceph {
+  class Formatter;
+}
+
+/*
+ * An always-on cpu sampler, cheap enough to leave running at a low
+ * rate in production.  Every 1/hz seconds of process cpu time SIGPROF
+ * records the stack and name (see Thread::create) of the thread that
+ * was running, in a ring holding the newest max_samples samples; so at
+ * any time the ring is a profile of the last little while, hot spots
+ * long gone included.  It doesn't need the Google perftools profiler
+ * (whose output format it borrows), and stands aside while that one
+ * runs, since they share SIGPROF.
+ */
+int cpu_sampler_start(int hz, int max_samples);
+void cpu_sampler_stop();
+bool cpu_sampler_running();
+
+/// while the perftools profiler owns SIGPROF
+void cpu_sampler_suspend();
+void cpu_sampler_resume();
+
+/// the samples as a (legacy, binary) cpu profile that pprof reads
+void cpu_sampler_dump_pprof(std::vector<char> &out);
+/// sample counts per thread name, with each name's hottest functions
+void cpu_sampler_dump_threads(ceph::Formatter *f);
+
+#endif
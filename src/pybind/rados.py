@@ -2,9 +2,11 @@
 Copyright 2011, Hannu Valtonen <hannu.valtonen@ormod.com>
 """
 from ctypes import CDLL, c_char_p, c_size_t, c_void_p, c_int, \
-    create_string_buffer, byref, Structure, c_uint64, c_ubyte, pointer
+    create_string_buffer, byref, Structure, c_uint64, c_ubyte, pointer, \
+    CFUNCTYPE
 import ctypes
 import errno
+import threading
 import time
 
 ANONYMOUS_AUID = 0xffffffffffffffff
@@ -260,6 +262,17 @@ class ObjectIterator(object):
     def __del__(self):
         self.ioctx.librados.rados_objects_list_close(self.ctx)
 
+    def next_batch(self, max_entries):
+        """up to max_entries more objects, [] at the end of the pool"""
+        batch = []
+        key = c_char_p()
+        while len(batch) < max_entries:
+            ret = self.ioctx.librados.rados_objects_list_next(self.ctx, byref(key))
+            if ret < 0:
+                break
+            batch.append(Object(self.ioctx, key.value))
+        return batch
+
 class XattrIterator(object):
     """Extended attribute iterator"""
     def __init__(self, ioctx, it, oid):
@@ -346,6 +359,78 @@ class Snap(object):
             raise make_ex(ret, "rados_ioctx_snap_get_stamp error")
         return date.fromtimestamp(snap_time)
 
+RADOS_CB = CFUNCTYPE(None, c_void_p, c_void_p)
+
+# in-flight aio by rados_completion_t, so that each Completion and its
+# buffer live until librados is done with them
+_aio_lock = threading.Lock()
+_aio_inflight = {}
+
+def _aio_done(rados_comp):
+    """one of a Completion's callbacks ran; forget it after the last"""
+    with _aio_lock:
+        completion = _aio_inflight[rados_comp]
+        completion.pending -= 1
+        if completion.pending == 0:
+            del _aio_inflight[rados_comp]
+    return completion
+
+def _aio_complete(rados_comp, _):
+    completion = _aio_done(rados_comp)
+    if completion.oncomplete is None:
+        return
+    if completion.buf is None:
+        completion.oncomplete(completion)
+    else:
+        ret = completion.get_return_value()
+        data = ""
+        if ret > 0:
+            data = ctypes.string_at(completion.buf, ret)
+        completion.oncomplete(completion, data)
+
+def _aio_safe(rados_comp, _):
+    completion = _aio_done(rados_comp)
+    if completion.onsafe is not None:
+        completion.onsafe(completion)
+
+_aio_complete_cb = RADOS_CB(_aio_complete)
+_aio_safe_cb = RADOS_CB(_aio_safe)
+
+class Completion(object):
+    """rados.Ioctx aio completion
+
+    Returned by the Ioctx.aio_* calls.  oncomplete(completion) runs once
+    the op is acked (for reads, oncomplete(completion, data)), onsafe
+    (completion) once a write is on disk.  Both run in a librados
+    thread, so they should hand results off rather than block."""
+    def __init__(self, ioctx, oncomplete, onsafe):
+        self.ioctx = ioctx
+        self.oncomplete = oncomplete
+        self.onsafe = onsafe
+        self.rados_comp = c_void_p(0)
+        self.buf = None
+        self.pending = 0
+
+    def wait_for_complete(self):
+        self.ioctx.librados.rados_aio_wait_for_complete(self.rados_comp)
+
+    def wait_for_safe(self):
+        self.ioctx.librados.rados_aio_wait_for_safe(self.rados_comp)
+
+    def is_complete(self):
+        return self.ioctx.librados.rados_aio_is_complete(self.rados_comp) != 0
+
+    def is_safe(self):
+        return self.ioctx.librados.rados_aio_is_safe(self.rados_comp) != 0
+
+    def get_return_value(self):
+        return self.ioctx.librados.rados_aio_get_return_value(self.rados_comp)
+
+    def __del__(self):
+        if self.rados_comp:
+            self.ioctx.librados.rados_aio_release(self.rados_comp)
+            self.rados_comp = c_void_p(0)
+
 class Ioctx(object):
     """rados.Ioctx object"""
     def __init__(self, name, librados, io):
@@ -354,6 +439,29 @@ class Ioctx(object):
         self.io = io
         self.state = "open"
 
+    def __get_completion(self, oncomplete, onsafe, write):
+        completion = Completion(self, oncomplete, onsafe)
+        safe_cb = None
+        completion.pending = 1
+        if write:
+            safe_cb = _aio_safe_cb
+            completion.pending = 2
+        ret = self.librados.rados_aio_create_completion(None,
+                _aio_complete_cb, safe_cb, byref(completion.rados_comp))
+        if ret < 0:
+            raise make_ex(ret, "error getting a completion")
+        with _aio_lock:
+            _aio_inflight[completion.rados_comp.value] = completion
+        return completion
+
+    def __aio_submitted(self, completion, what, key, ret):
+        if ret < 0:
+            with _aio_lock:
+                del _aio_inflight[completion.rados_comp.value]
+            raise make_ex(ret, "Ioctx.%s(%s): failed to queue %s" % \
+                (what, self.name, key))
+        return completion
+
     def __enter__(self):
         return self
 
@@ -389,6 +497,7 @@ class Ioctx(object):
     def close(self):
         if self.state == "open":
             self.require_ioctx_open()
+            self.aio_flush()
             self.librados.rados_ioctx_destroy(self.io)
             self.state = "closed"
 
@@ -438,6 +547,56 @@ written." % (self.name, ret, length))
             raise make_ex("Ioctx.read(%s): failed to read %s" % (self.name, key))
         return ctypes.string_at(ret_buf, ret)
 
+    def aio_write(self, key, data, offset=0, oncomplete=None, onsafe=None):
+        """queue a write, returns a Completion"""
+        self.require_ioctx_open()
+        if not isinstance(data, str):
+            raise TypeError('data must be a string')
+        completion = self.__get_completion(oncomplete, onsafe, True)
+        ret = self.librados.rados_aio_write(self.io, c_char_p(key),
+                completion.rados_comp, c_char_p(data), c_size_t(len(data)),
+                c_uint64(offset))
+        return self.__aio_submitted(completion, 'aio_write', key, ret)
+
+    def aio_write_full(self, key, data, oncomplete=None, onsafe=None):
+        """queue a write replacing the whole object, returns a Completion"""
+        self.require_ioctx_open()
+        if not isinstance(data, str):
+            raise TypeError('data must be a string')
+        completion = self.__get_completion(oncomplete, onsafe, True)
+        ret = self.librados.rados_aio_write_full(self.io, c_char_p(key),
+                completion.rados_comp, c_char_p(data), c_size_t(len(data)))
+        return self.__aio_submitted(completion, 'aio_write_full', key, ret)
+
+    def aio_append(self, key, data, oncomplete=None, onsafe=None):
+        """queue an append, returns a Completion"""
+        self.require_ioctx_open()
+        if not isinstance(data, str):
+            raise TypeError('data must be a string')
+        completion = self.__get_completion(oncomplete, onsafe, True)
+        ret = self.librados.rados_aio_append(self.io, c_char_p(key),
+                completion.rados_comp, c_char_p(data), c_size_t(len(data)))
+        return self.__aio_submitted(completion, 'aio_append', key, ret)
+
+    def aio_read(self, key, length, offset, oncomplete):
+        """queue a read; oncomplete(completion, data) gets the result"""
+        self.require_ioctx_open()
+        if not isinstance(key, str):
+            raise TypeError('key must be a string')
+        completion = self.__get_completion(oncomplete, None, False)
+        completion.buf = create_string_buffer(length)
+        ret = self.librados.rados_aio_read(self.io, c_char_p(key),
+                completion.rados_comp, completion.buf, c_size_t(length),
+                c_uint64(offset))
+        return self.__aio_submitted(completion, 'aio_read', key, ret)
+
+    def aio_flush(self):
+        """wait for all queued writes to be safe"""
+        self.require_ioctx_open()
+        ret = self.librados.rados_aio_flush(self.io)
+        if ret < 0:
+            raise make_ex(ret, "error flushing")
+
     def get_stats(self):
         self.require_ioctx_open()
         stats = rados_pool_stat_t()
@@ -533,6 +692,17 @@ written." % (self.name, ret, length))
         self.require_ioctx_open()
         return ObjectIterator(self)
 
+    def list_objects_batched(self, batch_size=1000):
+        """iterate over the pool's objects in lists of up to batch_size,
+        e.g. to queue an aio per object and wait per batch"""
+        self.require_ioctx_open()
+        it = ObjectIterator(self)
+        while True:
+            batch = it.next_batch(batch_size)
+            if not batch:
+                break
+            yield batch
+
     def list_snaps(self):
         self.require_ioctx_open()
         return SnapIterator(self)
@@ -74,6 +74,14 @@ void usage(ostream& out)
 "   rollback <obj-name> <snap-name>  roll back object to snap <snap-name>\n\n"
 "   bench <seconds> write|seq|rand [-t concurrent_operations]\n"
 "                                    default is 16 concurrent IOs and 4 MB ops\n"
+"   bench <seconds> mixed [-t concurrent_operations] [--read-percent P]\n"
+"         [--num-objects N] [--object-sizes size[:weight],...] [--warmup seconds]\n"
+"         [--run-name name --clients N [--start-delay seconds]]\n"
+"                                    random reads and rewrites over a private\n"
+"                                    object set, with latency percentiles;\n"
+"                                    with --clients, coordinate N bench-join\n"
+"                                    clients and merge their results\n"
+"   bench-join <run-name>            run a coordinated mixed benchmark\n"
 "   load-gen [options]               generate load on the cluster\n"
 "\n"
 "IMPORT AND EXPORT\n"
@@ -88,6 +96,11 @@ void usage(ostream& out)
 "                                    or directory.\n"
 "       --workers                    Number of worker threads to spawn (default "
 STR(DEFAULT_NUM_RADOS_WORKER_THREADS) ")\n"
+"       --checksum                   Also compare checksums of objects whose size\n"
+"                                    and mtime match; the osd computes the rados\n"
+"                                    side, so unchanged data is not transferred.\n"
+"       --chunk-size <bytes>         Copy and checksum in chunks of this size\n"
+"                                    (default 4 MB)\n"
 "\n"
 "GLOBAL OPTIONS:\n"
 "   -p pool\n"
@@ -579,6 +592,11 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
   int64_t read_percent = -1;
   uint64_t num_objs = 0;
   int run_length = 0;
+  string object_sizes;
+  int warmup = 0;
+  string run_name;
+  int num_clients = 0;
+  int start_delay = 10;
 
   Formatter *formatter = NULL;
   bool pretty_format = false;
@@ -643,6 +661,26 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
   if (i != opts.end()) {
     num_objs = strtoll(i->second.c_str(), NULL, 10);
   }
+  i = opts.find("object-sizes");
+  if (i != opts.end()) {
+    object_sizes = i->second;
+  }
+  i = opts.find("warmup");
+  if (i != opts.end()) {
+    warmup = strtol(i->second.c_str(), NULL, 10);
+  }
+  i = opts.find("run-name");
+  if (i != opts.end()) {
+    run_name = i->second;
+  }
+  i = opts.find("clients");
+  if (i != opts.end()) {
+    num_clients = strtol(i->second.c_str(), NULL, 10);
+  }
+  i = opts.find("start-delay");
+  if (i != opts.end()) {
+    start_delay = strtol(i->second.c_str(), NULL, 10);
+  }
   i = opts.find("run-length");
   if (i != opts.end()) {
     run_length = strtol(i->second.c_str(), NULL, 10);
@@ -1165,6 +1203,39 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
       usage_exit();
     int seconds = atoi(nargs[1]);
     int operation = 0;
+    if (strcmp(nargs[2], "mixed") == 0) {
+      bench_mixed_params params;
+      params.seconds = seconds;
+      params.warmup = warmup;
+      params.concurrent_ios = concurrent_ios;
+      if (read_percent >= 0)
+	params.read_percent = read_percent;
+      if (num_objs)
+	params.num_objects = num_objs;
+      if (object_sizes.length()) {
+	if (parse_object_sizes(object_sizes, params) < 0) {
+	  cerr << "invalid --object-sizes '" << object_sizes << "'" << std::endl;
+	  return 1;
+	}
+      } else {
+	params.sizes.push_back(make_pair((uint64_t)op_size, 1u));
+      }
+      if (num_clients > 0) {
+	if (run_name.empty()) {
+	  cerr << "--clients requires --run-name" << std::endl;
+	  return 1;
+	}
+	ret = mixed_bench_coordinate(io_ctx, run_name, params, num_clients, start_delay);
+      } else {
+	bench_mixed_result result;
+	ret = mixed_bench(rados, io_ctx, params, &result);
+	if (ret == 0)
+	  print_mixed_result(cout, result);
+      }
+      if (ret != 0)
+	cerr << "error during benchmark: " << ret << std::endl;
+      return ret < 0 ? 1 : 0;
+    }
     if (strcmp(nargs[2], "write") == 0)
       operation = OP_WRITE;
     else if (strcmp(nargs[2], "seq") == 0)
@@ -1177,6 +1248,14 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
     if (ret != 0)
       cerr << "error during benchmark: " << ret << std::endl;
   }
+  else if (strcmp(nargs[0], "bench-join") == 0) {
+    if (!pool_name || nargs.size() < 2)
+      usage_exit();
+    // wait for the coordinator as long as it would wait for us
+    ret = mixed_bench_join(rados, io_ctx, nargs[1], start_delay + 60);
+    if (ret != 0)
+      cerr << "error during benchmark: " << ret << std::endl;
+  }
   else if (strcmp(nargs[0], "watch") == 0) {
     if (!pool_name || nargs.size() < 2)
       usage_exit();
@@ -1302,8 +1381,22 @@ int main(int argc, const char **argv)
       opts["read-percent"] = val;
     } else if (ceph_argparse_witharg(args, i, &val, "--num-objects", (char*)NULL)) {
       opts["num-objects"] = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--object-sizes", (char*)NULL)) {
+      opts["object-sizes"] = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--warmup", (char*)NULL)) {
+      opts["warmup"] = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--run-name", (char*)NULL)) {
+      opts["run-name"] = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--clients", (char*)NULL)) {
+      opts["clients"] = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--start-delay", (char*)NULL)) {
+      opts["start-delay"] = val;
     } else if (ceph_argparse_witharg(args, i, &val, "--workers", (char*)NULL)) {
       opts["workers"] = val;
+    } else if (ceph_argparse_flag(args, i, "--checksum", (char*)NULL)) {
+      opts["checksum"] = "true";
+    } else if (ceph_argparse_witharg(args, i, &val, "--chunk-size", (char*)NULL)) {
+      opts["chunk-size"] = val;
     } else if (ceph_argparse_witharg(args, i, &val, "--format", (char*)NULL)) {
       opts["format"] = val;
     } else {
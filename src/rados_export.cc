@@ -36,10 +36,11 @@ using namespace librados;
 class ExportLocalFileWQ : public RadosSyncWQ {
 public:
   ExportLocalFileWQ(IoCtxDistributor *io_ctx_dist, time_t ti,
-		    ThreadPool *tp, ExportDir *export_dir, bool force)
+		    ThreadPool *tp, ExportDir *export_dir, const RadosSyncOpts &opts)
     : RadosSyncWQ(io_ctx_dist, ti, 0, tp),
       m_export_dir(export_dir),
-      m_force(force)
+      m_force(opts.force),
+      m_opts(opts)
   {
   }
 private:
@@ -75,14 +76,25 @@ private:
       }
       else {
 	sobj->xattr_diff(dobj.get(), only_in_a, only_in_b, diff);
-	if ((sobj->get_rados_size() == dobj->get_rados_size()) &&
-	    (sobj->get_mtime() == dobj->get_mtime())) {
+	// downloads stamp the file with the object's mtime
+	if ((sobj->get_rados_size() != dobj->get_rados_size()) ||
+	    (sobj->get_mtime() != dobj->get_mtime())) {
 	  flags |= CHANGED_CONTENTS;
 	}
+	else if (m_opts.checksum) {
+	  bool same;
+	  ret = sobj->same_checksum(io_ctx, obj_path.c_str(), m_opts.chunk_size, &same);
+	  if (ret) {
+	    cerr << ERR_PREFIX << "checksum error: " << ret << std::endl;
+	    _exit(ret);
+	  }
+	  if (!same)
+	    flags |= CHANGED_CONTENTS;
+	}
       }
     }
     if (flags & CHANGED_CONTENTS) {
-      ret = sobj->download(io_ctx, obj_path.c_str());
+      ret = sobj->download(io_ctx, obj_path.c_str(), m_opts.chunk_size);
       if (ret) {
 	cerr << ERR_PREFIX << "download error: " << ret << std::endl;
 	_exit(ret);
@@ -129,6 +141,7 @@ private:
   }
   ExportDir *m_export_dir;
   bool m_force;
+  const RadosSyncOpts &m_opts;
 };
 
 class ExportValidateExistingWQ : public RadosSyncWQ {
@@ -175,7 +188,7 @@ private:
 
 int do_rados_export(ThreadPool *tp, IoCtx& io_ctx,
       IoCtxDistributor *io_ctx_dist, const char *dir_name,
-      bool create, bool force, bool delete_after)
+      bool create, const RadosSyncOpts &opts)
 {
   int ret;
   librados::ObjectIterator oi = io_ctx.objects_begin();
@@ -185,13 +198,13 @@ int do_rados_export(ThreadPool *tp, IoCtx& io_ctx,
   if (!export_dir.get())
     return -EIO;
   ExportLocalFileWQ export_object_wq(io_ctx_dist, time(NULL),
-				     tp, export_dir.get(), force);
+				     tp, export_dir.get(), opts);
   for (; oi != oi_end; ++oi) {
     export_object_wq.queue(new std::string(*oi));
   }
   export_object_wq.drain();
 
-  if (delete_after) {
+  if (opts.delete_after) {
     ExportValidateExistingWQ export_val_wq(io_ctx_dist, time(NULL),
 					   tp, dir_name);
     DirHolder dh;
@@ -35,11 +35,12 @@ using std::auto_ptr;
 
 class ImportLocalFileWQ : public RadosSyncWQ {
 public:
-  ImportLocalFileWQ(const char *dir_name, bool force,
+  ImportLocalFileWQ(const char *dir_name, const RadosSyncOpts &opts,
 		    IoCtxDistributor *io_ctx_dist, time_t ti, ThreadPool *tp)
     : RadosSyncWQ(io_ctx_dist, ti, 0, tp),
       m_dir_name(dir_name),
-      m_force(force)
+      m_force(opts.force),
+      m_opts(opts)
   {
   }
 private:
@@ -77,14 +78,28 @@ private:
       }
       else {
 	sobj->xattr_diff(dobj.get(), only_in_a, only_in_b, diff);
-	if ((sobj->get_rados_size() == dobj->get_rados_size()) &&
-	    (sobj->get_mtime() == dobj->get_mtime())) {
+	// we can't set an object's mtime, so an object written after the
+	// file last changed is taken to be a copy of it
+	if ((sobj->get_rados_size() != dobj->get_rados_size()) ||
+	    (sobj->get_mtime() > dobj->get_mtime())) {
 	  flags |= CHANGED_CONTENTS;
 	}
+	else if (m_opts.checksum) {
+	  std::string path(m_dir_name + "/" + local_name);
+	  bool same;
+	  ret = dobj->same_checksum(io_ctx, path.c_str(), m_opts.chunk_size, &same);
+	  if (ret) {
+	    cerr << ERR_PREFIX << "checksum error: " << ret << std::endl;
+	    _exit(ret);
+	  }
+	  if (!same)
+	    flags |= CHANGED_CONTENTS;
+	}
       }
     }
     if (flags & CHANGED_CONTENTS) {
-      ret = sobj->upload(io_ctx, local_name.c_str(), m_dir_name.c_str());
+      ret = sobj->upload(io_ctx, local_name.c_str(), m_dir_name.c_str(),
+			 m_opts.chunk_size);
       if (ret) {
 	cerr << ERR_PREFIX << "upload error: " << ret << std::endl;
 	_exit(ret);
@@ -155,6 +170,7 @@ private:
   }
   std::string m_dir_name;
   bool m_force;
+  const RadosSyncOpts &m_opts;
 };
 
 class ImportValidateExistingWQ : public RadosSyncWQ {
@@ -198,7 +214,7 @@ private:
 };
 
 int do_rados_import(ThreadPool *tp, IoCtx &io_ctx, IoCtxDistributor* io_ctx_dist,
-	   const char *dir_name, bool force, bool delete_after)
+	   const char *dir_name, const RadosSyncOpts &opts)
 {
   auto_ptr <ExportDir> export_dir;
   export_dir.reset(ExportDir::from_file_system(dir_name));
@@ -211,7 +227,7 @@ int do_rados_import(ThreadPool *tp, IoCtx &io_ctx, IoCtxDistributor* io_ctx_dist
 	 << cpp_strerror(ret) << std::endl;
     return ret;
   }
-  ImportLocalFileWQ import_file_wq(dir_name, force,
+  ImportLocalFileWQ import_file_wq(dir_name, opts,
 				   io_ctx_dist, time(NULL), tp);
   while (true) {
     struct dirent *de = readdir(dh.dp);
@@ -225,7 +241,7 @@ int do_rados_import(ThreadPool *tp, IoCtx &io_ctx, IoCtxDistributor* io_ctx_dist
   }
   import_file_wq.drain();
 
-  if (delete_after) {
+  if (opts.delete_after) {
     ImportValidateExistingWQ import_val_wq(export_dir.get(), io_ctx_dist,
 					   time(NULL), tp);
     librados::ObjectIterator oi = io_ctx.objects_begin();
@@ -17,6 +17,7 @@
 #include "common/errno.h"
 #include "common/strtol.h"
 #include "global/global_context.h"
+#include "include/crc32c.h"
 #include "global/global_init.h"
 #include "include/rados/librados.hpp"
 #include "rados_sync.h"
@@ -31,6 +32,7 @@
 #include <stdlib.h>
 #include <string>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/xattr.h>
 #include <time.h>
@@ -528,7 +530,7 @@ void BackedUpObject::xattr_diff(const BackedUpObject *rhs,
   for (std::map < std::string, Xattr* >::const_iterator r = rhs->xattrs.begin();
 	 r != rhs->xattrs.end(); ++r)
   {
-    std::map < std::string, Xattr* >::const_iterator x = rhs->xattrs.find(r->first);
+    std::map < std::string, Xattr* >::const_iterator x = xattrs.find(r->first);
     if (x == xattrs.end()) {
       only_in_b.push_back(r->first);
     }
@@ -565,7 +567,7 @@ time_t BackedUpObject::get_mtime() const {
   return rados_time;
 }
 
-int BackedUpObject::download(IoCtx &io_ctx, const char *path)
+int BackedUpObject::download(IoCtx &io_ctx, const char *path, uint64_t chunk_size)
 {
   char tmp_path[strlen(path) + RADOS_SYNC_TMP_SUFFIX_LEN + 1];
   snprintf(tmp_path, sizeof(tmp_path), "%s%s", path, RADOS_SYNC_TMP_SUFFIX);
@@ -578,19 +580,15 @@ int BackedUpObject::download(IoCtx &io_ctx, const char *path)
   }
   int fd = fileno(fp);
   uint64_t off = 0;
-  static const int CHUNK_SZ = 32765;
   while (true) {
     bufferlist bl;
-    int rlen = io_ctx.read(rados_name, bl, CHUNK_SZ, off);
+    int rlen = io_ctx.read(rados_name, bl, chunk_size, off);
     if (rlen < 0) {
       cerr << ERR_PREFIX << "download: io_ctx.read(" << rados_name << ") returned "
 	   << rlen << std::endl;
+      fclose(fp);
       return rlen;
     }
-    if (rlen < CHUNK_SZ)
-      off = 0;
-    else
-      off += rlen;
     size_t flen = fwrite(bl.c_str(), 1, rlen, fp);
     if (flen != (size_t)rlen) {
       int err = errno;
@@ -599,7 +597,8 @@ int BackedUpObject::download(IoCtx &io_ctx, const char *path)
       fclose(fp);
       return err;
     }
-    if (off == 0)
+    off += rlen;
+    if ((uint64_t)rlen < chunk_size)
       break;
   }
   size_t attr_sz = strlen(rados_name) + 1;
@@ -617,6 +616,15 @@ int BackedUpObject::download(IoCtx &io_ctx, const char *path)
 	 << cpp_strerror(err) << std::endl;
     return err;
   }
+  struct timeval tv[2];
+  memset(tv, 0, sizeof(tv));
+  tv[0].tv_sec = tv[1].tv_sec = rados_time;
+  if (utimes(tmp_path, tv)) {
+    int err = errno;
+    cerr << ERR_PREFIX << "download: utimes(" << tmp_path << ") error: "
+	 << cpp_strerror(err) << std::endl;
+    return err;
+  }
   if (rename(tmp_path, path)) {
     int err = errno;
     cerr << ERR_PREFIX << "download: rename(" << tmp_path << ", "
@@ -626,7 +634,8 @@ int BackedUpObject::download(IoCtx &io_ctx, const char *path)
   return 0;
 }
 
-int BackedUpObject::upload(IoCtx &io_ctx, const char *file_name, const char *dir_name)
+int BackedUpObject::upload(IoCtx &io_ctx, const char *file_name, const char *dir_name,
+			   uint64_t chunk_size)
 {
   char path[strlen(file_name) + strlen(dir_name) + 2];
   snprintf(path, sizeof(path), "%s/%s", dir_name, file_name);
@@ -637,50 +646,85 @@ int BackedUpObject::upload(IoCtx &io_ctx, const char *file_name, const char *dir
 	 << cpp_strerror(err) << std::endl;
     return err;
   }
-  // Need to truncate RADOS object to size 0, in case there is
-  // already something there.
-  int ret = io_ctx.trunc(rados_name, 0);
-  if (ret) {
-    cerr << ERR_PREFIX << "upload: trunc failed with error " << ret << std::endl;
-    fclose(fp);
-    return ret;
-  }
+  // The first chunk replaces whatever is already there; the rest extend it.
   uint64_t off = 0;
-  static const int CHUNK_SZ = 32765;
   while (true) {
-    char buf[CHUNK_SZ];
-    int flen = fread(buf, CHUNK_SZ, 1, fp);
-    if (flen < 0) {
+    bufferptr bp(chunk_size);
+    size_t flen = fread(bp.c_str(), 1, chunk_size, fp);
+    if (ferror(fp)) {
       int err = errno;
       cerr << ERR_PREFIX << "upload: fread(" << file_name << ") error: "
 	   << cpp_strerror(err) << std::endl;
       fclose(fp);
       return err;
     }
-    if ((flen == 0) && (off != 0)) {
-      fclose(fp);
+    if (flen == 0 && off != 0)
       break;
-    }
-    // There must be a zero-copy way to do this?
     bufferlist bl;
-    bl.append(buf, flen);
-    int rlen = io_ctx.write(rados_name, bl, flen, off);
-    if (rlen < 0) {
-      fclose(fp);
-      cerr << ERR_PREFIX << "upload: rados_write error: " << rlen << std::endl;
-      return rlen;
-    }
-    if (rlen != flen) {
+    if (flen)
+      bl.append(bp, 0, flen);
+    int ret;
+    if (off == 0)
+      ret = io_ctx.write_full(rados_name, bl);
+    else
+      ret = io_ctx.write(rados_name, bl, flen, off);
+    if (ret < 0) {
       fclose(fp);
-      cerr << ERR_PREFIX << "upload: rados_write error: short write" << std::endl;
-      return -EIO;
+      cerr << ERR_PREFIX << "upload: rados_write error: " << ret << std::endl;
+      return ret;
     }
-    off += rlen;
-    if (flen < CHUNK_SZ) {
+    off += flen;
+    if (flen < chunk_size)
+      break;
+  }
+  fclose(fp);
+  return 0;
+}
+
+int BackedUpObject::same_checksum(IoCtx &io_ctx, const char *path,
+				  uint64_t chunk_size, bool *same) const
+{
+  uint32_t rcrc;
+  int ret = io_ctx.checksum(rados_name, 0, 0, &rcrc);
+  if (ret < 0) {
+    cerr << ERR_PREFIX << "same_checksum: io_ctx.checksum(" << rados_name
+	 << ") returned " << ret << std::endl;
+    return ret;
+  }
+  uint64_t rlen = ret;
+
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    int err = errno;
+    cerr << ERR_PREFIX << "same_checksum: error opening '" << path << "': "
+	 << cpp_strerror(err) << std::endl;
+    return err;
+  }
+  uint32_t lcrc = -1;
+  uint64_t llen = 0;
+  char *buf = (char*)malloc(chunk_size);
+  if (!buf) {
+    fclose(fp);
+    return ENOBUFS;
+  }
+  while (true) {
+    size_t flen = fread(buf, 1, chunk_size, fp);
+    if (ferror(fp)) {
+      int err = errno;
+      cerr << ERR_PREFIX << "same_checksum: fread(" << path << ") error: "
+	   << cpp_strerror(err) << std::endl;
+      free(buf);
       fclose(fp);
-      return 0;
+      return err;
     }
+    if (flen == 0)
+      break;
+    lcrc = ceph_crc32c_le(lcrc, (unsigned char*)buf, flen);
+    llen += flen;
   }
+  free(buf);
+  fclose(fp);
+  *same = (llen == rlen && lcrc == rcrc);
   return 0;
 }
 
@@ -793,6 +837,10 @@ int rados_tool_sync(const std::map < std::string, std::string > &opts,
   bool force = opts.count("force");
   bool delete_after = opts.count("delete-after");
   bool create = opts.count("create");
+  RadosSyncOpts sync_opts;
+  sync_opts.force = force;
+  sync_opts.delete_after = delete_after;
+  sync_opts.checksum = opts.count("checksum");
 
   std::map < std::string, std::string >::const_iterator n = opts.find("workers");
   int num_threads;
@@ -815,6 +863,17 @@ int rados_tool_sync(const std::map < std::string, std::string > &opts,
   }
 
 
+  n = opts.find("chunk-size");
+  if (n != opts.end()) {
+    std::string err;
+    long long cs = strict_strtoll(n->second.c_str(), 10, &err);
+    if (!err.empty() || cs < 4096) {
+      cerr << "rados: invalid chunk size '" << n->second << "'" << std::endl;
+      return 1;
+    }
+    sync_opts.chunk_size = cs;
+  }
+
   std::string action, src, dst;
   std::vector<const char*>::iterator i = args.begin();
   if ((i != args.end()) &&
@@ -895,13 +954,13 @@ int rados_tool_sync(const std::map < std::string, std::string > &opts,
 
   if (action == "import") {
     ret = do_rados_import(&thread_pool, io_ctx, io_ctx_dist, src.c_str(),
-		     force, delete_after);
+			  sync_opts);
     thread_pool.stop();
     return ret;
   }
   else {
     ret = do_rados_export(&thread_pool, io_ctx, io_ctx_dist, dst.c_str(),
-		     create, force, delete_after);
+			  create, sync_opts);
     thread_pool.stop();
     return ret;
   }
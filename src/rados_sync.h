@@ -31,6 +31,7 @@ extern const char USER_XATTR_PREFIX[];
 extern const char RADOS_SYNC_TMP_SUFFIX[];
 #define ERR_PREFIX "[ERROR]        "
 #define DEFAULT_NUM_RADOS_WORKER_THREADS 5
+#define DEFAULT_RADOS_SYNC_CHUNK_SIZE (4 << 20)
 
 /* Linux seems to use ENODATA instead of ENOATTR when an extended attribute
  * is missing */
@@ -186,9 +187,19 @@ public:
 
   time_t get_mtime() const;
 
-  int download(librados::IoCtx &io_ctx, const char *path);
+  /* Copy the object's data to path, chunk_size bytes at a time. The file's
+   * mtime is set to the object's, so that later runs can tell it is
+   * unchanged. */
+  int download(librados::IoCtx &io_ctx, const char *path, uint64_t chunk_size);
 
-  int upload(librados::IoCtx &io_ctx, const char *file_name, const char *dir_name);
+  int upload(librados::IoCtx &io_ctx, const char *file_name, const char *dir_name,
+	     uint64_t chunk_size);
+
+  /* Does the rados copy of this object have the same data as the local file
+   * at path? The data is checksummed on both sides; only the checksum
+   * crosses the network. */
+  int same_checksum(librados::IoCtx &io_ctx, const char *path,
+		    uint64_t chunk_size, bool *same) const;
 
 private:
   BackedUpObject(const char *rados_name_, uint64_t rados_size_, time_t rados_time_);
@@ -207,11 +218,24 @@ private:
   std::map < std::string, Xattr* > xattrs;
 };
 
+/* How an import or export decides what to copy, and how it copies it.
+ * Objects whose size and mtime match are skipped unless 'force' is set; with
+ * 'checksum', their data must also have the same checksum. */
+struct RadosSyncOpts {
+  bool force;
+  bool delete_after;
+  bool checksum;
+  uint64_t chunk_size;
+  RadosSyncOpts()
+    : force(false), delete_after(false), checksum(false),
+      chunk_size(DEFAULT_RADOS_SYNC_CHUNK_SIZE) {}
+};
+
 extern int do_rados_import(ThreadPool *tp, librados::IoCtx &io_ctx,
     IoCtxDistributor* io_ctx_dist, const char *dir_name,
-    bool force, bool delete_after);
+    const RadosSyncOpts &opts);
 extern int do_rados_export(ThreadPool *tp, librados::IoCtx& io_ctx,
-    IoCtxDistributor *io_ctx_dist, const char *dir_name, 
-    bool create, bool force, bool delete_after);
+    IoCtxDistributor *io_ctx_dist, const char *dir_name,
+    bool create, const RadosSyncOpts &opts);
 
 #endif
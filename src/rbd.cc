@@ -63,11 +63,21 @@ void usage()
        << "  resize [image-name]                       resize (expand or contract) image\n"
        << "                                            (requires size param)\n"
        << "  rm [image-name]                           delete an image\n"
-       << "  export <--snap=name> [image-name] [path]  export image to file\n"
-       << "  import [path] [dst-image]                 import image from file (dest defaults\n"
-       << "                                            as the filename part of file)\n"
+       << "  export <--snap=name> [image-name] [path]  export image to file (\"-\" for stdout)\n"
+       << "  import [path] [dst-image]                 import image from file (\"-\" for stdin;\n"
+       << "                                            dest defaults as the filename part\n"
+       << "                                            of file)\n"
+       << "  export-diff <--from-snap=name> <--snap=name> [image-name] [path]\n"
+       << "                                            export what changed since from-snap\n"
+       << "                                            (\"-\" for stdout)\n"
+       << "  import-diff [path] [image-name]           apply an exported diff to an image\n"
+       << "                                            (\"-\" for stdin)\n"
        << "  <cp | copy> <--snap=name> [src] [dest]    copy src image to dest\n"
        << "  <mv | rename> [src] [dest]                rename src image to dest\n"
+       << "  clone <--snap=name> [parent] [child]      create a copy-on-write child of a\n"
+       << "                                            parent snapshot (same pool)\n"
+       << "  flatten [image-name]                      copy all parent data into a clone\n"
+       << "                                            and detach it from its parent\n"
        << "  snap ls [image-name]                      dump list of image snapshots\n"
        << "  snap create <--snap=name> [image-name]    create a snapshot\n"
        << "  snap rollback <--snap=name> [image-name]  rollback image head to snapshot\n"
@@ -83,9 +93,14 @@ void usage()
        << "  --image <image-name>         image name\n"
        << "  --dest <name>                destination [pool and] image name\n"
        << "  --snap <snapname>            specify snapshot name\n"
+       << "  --from-snap <snapname>       snapshot a diff starts from\n"
        << "  --dest-pool <name>           destination pool name\n"
        << "  --path <path-name>           path name for import/export (if not specified)\n"
        << "  --size <size in MB>          size parameter for create and resize commands\n"
+       << "  --stripe-unit <bytes>        stripe unit for create and import (divides the\n"
+       << "                               object size)\n"
+       << "  --stripe-count <n>           objects to stripe over, for create and import;\n"
+       << "                               the kernel client can't map striped images\n"
        << "\n"
        << "For the map command:\n"
        << "  --user <username>            rados user to authenticate as\n"
@@ -118,26 +133,27 @@ static void print_info(const char *imgname, librbd::image_info_t& info)
 struct MyProgressContext : public librbd::ProgressContext {
   const char *operation;
   int last_pc;
+  ostream& out;
 
-  MyProgressContext(const char *o) : operation(o), last_pc(0) {
+  MyProgressContext(const char *o, ostream& os = cout) : operation(o), last_pc(0), out(os) {
   }
   
   int update_progress(uint64_t offset, uint64_t total) {
     int pc = total ? (offset * 100ull / total) : 0;
     if (pc != last_pc) {
-      cout << "\r" << operation << ": "
+      out << "\r" << operation << ": "
 	//	   << offset << " / " << total << " "
 	   << pc << "% complete...";
-      cout.flush();
+      out.flush();
       last_pc = pc;
     }
     return 0;
   }
   void finish() {
-    cout << "\r" << operation << ": 100% complete...done." << std::endl;
+    out << "\r" << operation << ": 100% complete...done." << std::endl;
   }
   void fail() {
-    cout << "\r" << operation << ": " << last_pc << "% complete...failed." << std::endl;
+    out << "\r" << operation << ": " << last_pc << "% complete...failed." << std::endl;
   }
 };
 
@@ -154,9 +170,10 @@ static int do_list(librbd::RBD &rbd, librados::IoCtx& io_ctx)
 }
 
 static int do_create(librbd::RBD &rbd, librados::IoCtx& io_ctx,
-		     const char *imgname, uint64_t size, int *order)
+		     const char *imgname, uint64_t size, int *order,
+		     uint64_t stripe_unit, uint64_t stripe_count)
 {
-  int r = rbd.create(io_ctx, imgname, size, order);
+  int r = rbd.create2(io_ctx, imgname, size, order, stripe_unit, stripe_count);
   if (r < 0)
     return r;
   return 0;
@@ -179,6 +196,15 @@ static int do_show_info(const char *imgname, librbd::Image& image)
     return r;
 
   print_info(imgname, info);
+  uint64_t stripe_unit, stripe_count;
+  r = image.get_stripe_unit(&stripe_unit);
+  if (r >= 0)
+    r = image.get_stripe_count(&stripe_count);
+  if (r < 0)
+    return r;
+  if (stripe_count > 1)
+    cout << "\tstripe unit: " << prettybyte_t(stripe_unit) << std::endl
+	 << "\tstripe count: " << stripe_count << std::endl;
   return 0;
 }
 
@@ -249,62 +275,207 @@ static int do_rollback_snap(librbd::Image& image, const char *snapname)
   return 0;
 }
 
-struct ExportContext {
-  int fd;
-  MyProgressContext pc;
-
-  ExportContext(int f) : fd(f), pc("Exporting image") {}
-};
-
-static int export_read_cb(uint64_t ofs, size_t len, const char *buf, void *arg)
+static bool buf_is_zero(const char *buf, size_t len)
 {
-  ssize_t ret;
-  ExportContext *ec = (ExportContext *)arg;
-  int fd = ec->fd;
-
-  if (!buf) /* a hole */
-    return 0;
-
-  ret = lseek64(fd, ofs, SEEK_SET);
-  if (ret < 0)
-    return -errno;
-  ret = write(fd, buf, len);
-  if (ret < 0)
-    return -errno;
+  for (size_t i = 0; i < len; i++)
+    if (buf[i])
+      return false;
+  return true;
+}
 
-  cerr << "writing " << len << " bytes at ofs " << ofs << std::endl;
-  return 0;
+static unsigned get_max_ops()
+{
+  return MAX(g_conf->rbd_concurrent_management_ops, 1);
 }
 
+struct ExportOp {
+  uint64_t ofs;
+  size_t len;
+  bufferlist bl;
+  librbd::RBD::AioCompletion *c;
+  ExportOp(uint64_t o, size_t l) : ofs(o), len(l), c(new librbd::RBD::AioCompletion(NULL, NULL)) {}
+  ~ExportOp() {
+    c->release();
+  }
+};
+
+/*
+ * Export with up to rbd_concurrent_management_ops object-sized reads in
+ * flight.  Data is written out in image order; to a file, zeroed
+ * pieces are skipped (leaving holes), while "-" streams every byte to
+ * stdout.
+ */
 static int do_export(librbd::Image& image, const char *path)
 {
-  int64_t r;
+  int r;
   librbd::image_info_t info;
   int fd;
+  bool to_stdout = (strcmp(path, "-") == 0);
 
   r = image.stat(info, sizeof(info));
   if (r < 0)
     return r;
 
-  fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
-  if (fd < 0)
-    return -errno;
+  if (to_stdout) {
+    fd = 1;
+  } else {
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+      return -errno;
+  }
 
-  ExportContext ec(fd);
-  r = image.read_iterate(0, info.size, export_read_cb, (void *)&ec);
-  if (r < 0)
-    goto out;
+  MyProgressContext pc("Exporting image", to_stdout ? cerr : cout);
+  uint64_t period = info.obj_size;
+  unsigned max_ops = get_max_ops();
+  std::list<ExportOp*> in_flight;
+  uint64_t ofs = 0;
+  while ((r == 0 && ofs < info.size) || !in_flight.empty()) {
+    if (r == 0 && ofs < info.size && in_flight.size() < max_ops) {
+      ExportOp *op = new ExportOp(ofs, MIN(period - ofs % period, info.size - ofs));
+      r = image.aio_read(op->ofs, op->len, op->bl, op->c);
+      if (r < 0) {
+	delete op;
+	continue;
+      }
+      ofs += op->len;
+      in_flight.push_back(op);
+      continue;
+    }
 
-  r = ftruncate(fd, info.size);
+    ExportOp *op = in_flight.front();
+    in_flight.pop_front();
+    op->c->wait_for_complete();
+    ssize_t rr = op->c->get_return_value();
+    if (rr < 0 && r == 0)
+      r = rr;
+    if (r == 0) {
+      if (to_stdout)
+	rr = safe_write(fd, op->bl.c_str(), op->len);
+      else if (!buf_is_zero(op->bl.c_str(), op->len))
+	rr = safe_pwrite(fd, op->bl.c_str(), op->len, op->ofs);
+      if (rr < 0) {
+	cerr << "error writing " << path << ": " << cpp_strerror(rr) << std::endl;
+	r = rr;
+      }
+    }
+    pc.update_progress(op->ofs + op->len, info.size);
+    delete op;
+  }
+
+  if (r == 0 && !to_stdout && ftruncate(fd, info.size) < 0)
+    r = -errno;
+
+  if (!to_stdout)
+    close(fd);
   if (r < 0)
-    goto out;
+    pc.fail();
+  else
+    pc.finish();
+  return r;
+}
 
- out:
-  close(fd);
+/*
+ * Keeps up to rbd_concurrent_management_ops aio writes to an image in
+ * flight.  Zeroed pieces are not written at all, since unwritten
+ * objects already read as zeros.
+ */
+class ImportWriter {
+  librbd::Image& image;
+  unsigned max_ops;
+  std::list<librbd::RBD::AioCompletion*> in_flight;
+  int r;
+
+  void wait_one() {
+    librbd::RBD::AioCompletion *c = in_flight.front();
+    in_flight.pop_front();
+    c->wait_for_complete();
+    int rr = c->get_return_value();
+    c->release();
+    if (rr < 0 && r == 0) {
+      cerr << "error writing to image block: " << cpp_strerror(rr) << std::endl;
+      r = rr;
+    }
+  }
+
+public:
+  ImportWriter(librbd::Image& i) : image(i), max_ops(get_max_ops()), r(0) {}
+  ~ImportWriter() {
+    drain();
+  }
+
+  /// skip_zero: leave zeroed pieces unwritten
+  int write(uint64_t ofs, bufferlist& bl, bool skip_zero = true) {
+    if (r < 0 || (skip_zero && buf_is_zero(bl.c_str(), bl.length())))
+      return r;
+    while (in_flight.size() >= max_ops)
+      wait_one();
+    if (r < 0)
+      return r;
+    librbd::RBD::AioCompletion *c = new librbd::RBD::AioCompletion(NULL, NULL);
+    int rr = image.aio_write(ofs, bl.length(), bl, c);
+    if (rr < 0) {
+      c->release();
+      return r = rr;
+    }
+    in_flight.push_back(c);
+    return 0;
+  }
+
+  int drain() {
+    while (!in_flight.empty())
+      wait_one();
+    return r;
+  }
+};
+
+/*
+ * Import from stdin: the size isn't known up front, so the image grows
+ * (doubling) ahead of the data and is cut to size at the end.
+ */
+static int do_import_stream(librbd::Image& image, uint64_t period)
+{
+  MyProgressContext pc("Importing image");
+  ImportWriter writer(image);
+  uint64_t pos = 0, image_size = 0;
+  int r = 0;
+
+  while (true) {
+    bufferptr p(period);
+    ssize_t len = safe_read(0, p.c_str(), period);
+    if (len < 0) {
+      r = len;
+      cerr << "error reading stdin: " << cpp_strerror(r) << std::endl;
+      break;
+    }
+    if (!len)
+      break;
+    if (pos + len > image_size) {
+      image_size = MAX(pos + len, image_size * 2);
+      r = image.resize(image_size);
+      if (r < 0) {
+	cerr << "error resizing image: " << cpp_strerror(r) << std::endl;
+	break;
+      }
+    }
+    bufferlist bl;
+    bl.append(p.c_str(), len);
+    r = writer.write(pos, bl);
+    if (r < 0)
+      break;
+    pos += len;
+    cout << "\rImporting image: " << prettybyte_t(pos) << "...";
+    cout.flush();
+  }
+
+  int rr = writer.drain();
+  if (r == 0)
+    r = rr;
+  if (r == 0 && image_size != pos)
+    r = image.resize(pos);
   if (r < 0)
-    ec.pc.fail();
+    pc.fail();
   else
-    ec.pc.finish();
+    pc.finish();
   return r;
 }
 
@@ -371,9 +542,11 @@ done_img:
 }
 
 static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
-		     const char *imgname, int *order, const char *path)
+		     const char *imgname, int *order, uint64_t stripe_unit,
+		     uint64_t stripe_count, const char *path)
 {
-  int fd = open(path, O_RDONLY);
+  bool from_stdin = (strcmp(path, "-") == 0);
+  int fd = from_stdin ? 0 : open(path, O_RDONLY);
   int r;
   uint64_t size;
   struct stat stat_buf;
@@ -387,30 +560,51 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
     return r;
   }
 
-  r = fstat(fd, &stat_buf);
-  if (r < 0) {
-    r = -errno;
-    cerr << "stat error " << path << std::endl;
-    return r;
+  if (from_stdin) {
+    size = 0;
+  } else {
+    r = fstat(fd, &stat_buf);
+    if (r < 0) {
+      r = -errno;
+      cerr << "stat error " << path << std::endl;
+      close(fd);
+      return r;
+    }
+    size = (uint64_t)stat_buf.st_size;
   }
-  size = (uint64_t)stat_buf.st_size;
 
   assert(imgname);
 
   md_oid = imgname;
   md_oid += RBD_SUFFIX;
 
-  r = do_create(rbd, io_ctx, imgname, size, order);
+  r = do_create(rbd, io_ctx, imgname, size, order, stripe_unit, stripe_count);
   if (r < 0) {
     cerr << "image creation failed" << std::endl;
+    if (!from_stdin)
+      close(fd);
     return r;
   }
   librbd::Image image;
   r = rbd.open(io_ctx, image, imgname);
   if (r < 0) {
     cerr << "failed to open image" << std::endl;
+    if (!from_stdin)
+      close(fd);
     return r;
   }
+  librbd::image_info_t info;
+  r = image.stat(info, sizeof(info));
+  if (r < 0) {
+    if (!from_stdin)
+      close(fd);
+    return r;
+  }
+  uint64_t period = info.obj_size;
+
+  if (from_stdin)
+    return do_import_stream(image, period);
+
   fsync(fd); /* flush it first, otherwise extents information might not have been flushed yet */
   fiemap = read_fiemap(fd);
   if (fiemap && !fiemap->fm_mapped_extents) {
@@ -422,6 +616,7 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
     fiemap = (struct fiemap *)malloc(sizeof(struct fiemap) +  sizeof(struct fiemap_extent));
     if (!fiemap) {
       cerr << "Failed to allocate fiemap, not enough memory." << std::endl;
+      close(fd);
       return -ENOMEM;
     }
     fiemap->fm_start = 0;
@@ -435,6 +630,7 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
     fiemap->fm_extents[0].fe_flags = 0;
   }
 
+  ImportWriter writer(image);
   uint64_t extent = 0;
 
   while (extent < fiemap->fm_mapped_extents) {
@@ -459,11 +655,11 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
     } while (end_ofs == (off_t)fiemap->fm_extents[extent].fe_logical);
 
     //cerr << "rbd import file_pos=" << file_pos << " extent_len=" << extent_len << std::endl;
-#define READ_BLOCK_LEN (4 * 1024 * 1024)
     uint64_t left = end_ofs - file_pos;
     while (left) {
       pc.update_progress(file_pos, size);
-      uint64_t cur_seg = (left < READ_BLOCK_LEN ? left : READ_BLOCK_LEN);
+      /* one object per write, so the writes can go out in parallel */
+      uint64_t cur_seg = MIN(left, period - file_pos % period);
       while (cur_seg) {
         bufferptr p(cur_seg);
         //cerr << "reading " << cur_seg << " bytes at offset " << file_pos << std::endl;
@@ -479,22 +675,10 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
           goto done;
         }
         bufferlist bl;
-        bl.append(p);
-        librbd::RBD::AioCompletion *completion = new librbd::RBD::AioCompletion(NULL, NULL);
-        if (!completion) {
-          r = -ENOMEM;
-          goto done;
-        }
-        r = image.aio_write(file_pos, len, bl, completion);
+        bl.append(p.c_str(), len);
+        r = writer.write(file_pos, bl);
         if (r < 0)
           goto done;
-	completion->wait_for_complete();
-	r = completion->get_return_value();
-	completion->release();
-        if (r < 0) {
-          cerr << "error writing to image block" << std::endl;
-          goto done;
-        }
 
         file_pos += len;
         cur_seg -= len;
@@ -506,15 +690,323 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
   r = 0;
 
  done:
+  {
+    int rr = writer.drain();
+    if (r == 0)
+      r = rr;
+  }
   if (r < 0)
     pc.fail();
   else
     pc.finish();
   free(fiemap);
+  close(fd);
+
+  return r;
+}
+
+/*
+ * Incremental diffs between snapshots.  The stream is a banner
+ * followed by tagged records, integers little-endian:
+ *
+ *   'f' <le32 len> <name>      snapshot the diff starts from (optional)
+ *   't' <le32 len> <name>      snapshot the diff ends at (optional)
+ *   's' <le64 size>            image size at the end
+ *   'w' <le64 ofs> <le64 len> <data>
+ *   'z' <le64 ofs> <le64 len>  reads as zeros now
+ *   'e'                        end
+ */
+#define RBD_DIFF_BANNER "rbd diff v1\n"
+
+struct DiffExtent {
+  uint64_t ofs, len;
+  bool exists;
+  DiffExtent(uint64_t o, uint64_t l, bool e) : ofs(o), len(l), exists(e) {}
+};
+
+static int diff_collect_cb(uint64_t ofs, size_t len, int exists, void *arg)
+{
+  vector<DiffExtent> *extents = (vector<DiffExtent> *)arg;
+  // runs of zeros merge; data stays in per-object pieces for the reads
+  if (!exists && !extents->empty() && !extents->back().exists &&
+      extents->back().ofs + extents->back().len == ofs) {
+    extents->back().len += len;
+    return 0;
+  }
+  extents->push_back(DiffExtent(ofs, len, exists));
+  return 0;
+}
 
+static void encode_diff_name(char tag, const char *name, bufferlist& bl)
+{
+  ::encode(tag, bl);
+  __le32 len = strlen(name);
+  ::encode(len, bl);
+  bl.append(name, strlen(name));
+}
+
+static int write_bl(int fd, bufferlist& bl)
+{
+  int r = safe_write(fd, bl.c_str(), bl.length());
+  bl.clear();
   return r;
 }
 
+static int do_export_diff(librbd::Image& image, const char *fromsnapname,
+			  const char *snapname, const char *path)
+{
+  int r;
+  librbd::image_info_t info;
+  int fd;
+  bool to_stdout = (strcmp(path, "-") == 0);
+
+  r = image.stat(info, sizeof(info));
+  if (r < 0)
+    return r;
+
+  vector<DiffExtent> extents;
+  r = image.diff_iterate(fromsnapname, 0, info.size, diff_collect_cb, &extents);
+  if (r < 0)
+    return r;
+
+  if (to_stdout) {
+    fd = 1;
+  } else {
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+      return -errno;
+  }
+
+  MyProgressContext pc("Exporting image", to_stdout ? cerr : cout);
+  bufferlist bl;
+  bl.append(RBD_DIFF_BANNER);
+  if (fromsnapname)
+    encode_diff_name('f', fromsnapname, bl);
+  if (snapname)
+    encode_diff_name('t', snapname, bl);
+  ::encode('s', bl);
+  ::encode((uint64_t)info.size, bl);
+  r = write_bl(fd, bl);
+
+  // reads for the changed extents go out like export's, and are
+  // written to the stream in order
+  unsigned max_ops = get_max_ops();
+  std::list<ExportOp*> in_flight;
+  vector<DiffExtent>::iterator p = extents.begin();
+  uint64_t total = 0, done = 0;
+  for (vector<DiffExtent>::iterator q = extents.begin(); q != extents.end(); ++q)
+    if (q->exists)
+      total += q->len;
+  while ((r >= 0 && p != extents.end()) || !in_flight.empty()) {
+    if (r >= 0 && p != extents.end() && in_flight.size() < max_ops) {
+      if (!p->exists) {
+	if (in_flight.empty()) {
+	  ::encode('z', bl);
+	  ::encode(p->ofs, bl);
+	  ::encode(p->len, bl);
+	  r = write_bl(fd, bl);
+	  ++p;
+	  continue;
+	}
+	// keep record order: let the reads before it drain first
+      } else {
+	ExportOp *op = new ExportOp(p->ofs, p->len);
+	r = image.aio_read(op->ofs, op->len, op->bl, op->c);
+	if (r < 0) {
+	  delete op;
+	  continue;
+	}
+	in_flight.push_back(op);
+	++p;
+	continue;
+      }
+    }
+
+    ExportOp *op = in_flight.front();
+    in_flight.pop_front();
+    op->c->wait_for_complete();
+    ssize_t rr = op->c->get_return_value();
+    if (rr < 0 && r >= 0)
+      r = rr;
+    if (r >= 0) {
+      ::encode('w', bl);
+      ::encode(op->ofs, bl);
+      ::encode((uint64_t)op->len, bl);
+      bl.claim_append(op->bl);
+      r = write_bl(fd, bl);
+    }
+    done += op->len;
+    pc.update_progress(done, total);
+    delete op;
+  }
+
+  if (r >= 0) {
+    ::encode('e', bl);
+    r = write_bl(fd, bl);
+  }
+  if (r > 0)
+    r = 0;
+
+  if (!to_stdout)
+    close(fd);
+  if (r < 0) {
+    cerr << "export-diff error: " << cpp_strerror(r) << std::endl;
+    pc.fail();
+  } else {
+    pc.finish();
+  }
+  return r;
+}
+
+static int read_exact(int fd, bufferlist& bl, size_t len)
+{
+  bufferptr p(len);
+  int r = safe_read_exact(fd, p.c_str(), len);
+  if (r < 0)
+    return r;
+  bl.clear();
+  bl.append(p);
+  return 0;
+}
+
+static int read_diff_name(int fd, string *name)
+{
+  bufferlist bl;
+  int r = read_exact(fd, bl, sizeof(__le32));
+  if (r < 0)
+    return r;
+  bufferlist::iterator p = bl.begin();
+  __le32 len;
+  ::decode(len, p);
+  if (len > 4096)
+    return -EINVAL;
+  r = read_exact(fd, bl, len);
+  if (r < 0)
+    return r;
+  name->assign(bl.c_str(), bl.length());
+  return 0;
+}
+
+static bool image_has_snap(librbd::Image& image, const string& name)
+{
+  vector<librbd::snap_info_t> snaps;
+  if (image.snap_list(snaps) < 0)
+    return false;
+  for (vector<librbd::snap_info_t>::iterator p = snaps.begin(); p != snaps.end(); ++p)
+    if (p->name == name)
+      return true;
+  return false;
+}
+
+static int do_import_diff(librbd::Image& image, const char *path)
+{
+  bool from_stdin = (strcmp(path, "-") == 0);
+  int fd = from_stdin ? 0 : open(path, O_RDONLY);
+  if (fd < 0) {
+    cerr << "error opening " << path << std::endl;
+    return -errno;
+  }
+
+  librbd::image_info_t info;
+  int r = image.stat(info, sizeof(info));
+  uint64_t period = info.obj_size;
+  MyProgressContext pc("Importing image diff");
+  ImportWriter writer(image);
+  string to;
+  bufferlist bl;
+
+  if (r >= 0) {
+    r = read_exact(fd, bl, strlen(RBD_DIFF_BANNER));
+    if (r >= 0 && memcmp(bl.c_str(), RBD_DIFF_BANNER, strlen(RBD_DIFF_BANNER)) != 0) {
+      cerr << "invalid banner, not an rbd diff" << std::endl;
+      r = -EINVAL;
+    }
+  }
+
+  while (r >= 0) {
+    r = read_exact(fd, bl, 1);
+    if (r < 0)
+      break;
+    char tag = bl[0];
+    if (tag == 'e')
+      break;
+
+    if (tag == 'f') {
+      string from;
+      r = read_diff_name(fd, &from);
+      if (r >= 0 && !image_has_snap(image, from)) {
+	cerr << "start snapshot '" << from << "' does not exist in the image" << std::endl;
+	r = -EINVAL;
+      }
+    } else if (tag == 't') {
+      r = read_diff_name(fd, &to);
+      if (r >= 0 && image_has_snap(image, to)) {
+	cerr << "end snapshot '" << to << "' already exists" << std::endl;
+	r = -EEXIST;
+      }
+    } else if (tag == 's') {
+      r = read_exact(fd, bl, sizeof(uint64_t));
+      if (r < 0)
+	break;
+      uint64_t size;
+      bufferlist::iterator p = bl.begin();
+      ::decode(size, p);
+      if (size != info.size) {
+	r = writer.drain();
+	if (r >= 0)
+	  r = image.resize(size);
+	info.size = size;
+      }
+    } else if (tag == 'w' || tag == 'z') {
+      r = read_exact(fd, bl, 2 * sizeof(uint64_t));
+      if (r < 0)
+	break;
+      uint64_t ofs, len;
+      bufferlist::iterator p = bl.begin();
+      ::decode(ofs, p);
+      ::decode(len, p);
+      pc.update_progress(ofs, info.size);
+      // by object-sized pieces, so that writes overlap; zeros are
+      // written out since there is nothing like discard yet
+      while (r >= 0 && len) {
+	uint64_t piece = MIN(len, period - ofs % period);
+	bufferlist data;
+	if (tag == 'w') {
+	  r = read_exact(fd, data, piece);
+	  if (r < 0)
+	    break;
+	} else {
+	  bufferptr z(piece);
+	  z.zero();
+	  data.append(z);
+	}
+	r = writer.write(ofs, data, false);
+	ofs += piece;
+	len -= piece;
+      }
+    } else {
+      cerr << "unrecognized diff record '" << tag << "'" << std::endl;
+      r = -EINVAL;
+    }
+  }
+
+  int rr = writer.drain();
+  if (r >= 0)
+    r = rr;
+  if (r >= 0 && to.length())
+    r = image.snap_create(to.c_str());
+
+  if (!from_stdin)
+    close(fd);
+  if (r < 0) {
+    cerr << "import-diff error: " << cpp_strerror(r) << std::endl;
+    pc.fail();
+  } else {
+    pc.finish();
+  }
+  return r < 0 ? r : 0;
+}
+
 static int do_copy(librbd::Image &src, librados::IoCtx& dest_pp,
 		   const char *destname)
 {
@@ -526,6 +1018,25 @@ static int do_copy(librbd::Image &src, librados::IoCtx& dest_pp,
   return 0;
 }
 
+static int do_clone(librbd::RBD &rbd, librados::IoCtx& p_ioctx, const char *p_name,
+		    const char *p_snapname, librados::IoCtx& c_ioctx, const char *c_name)
+{
+  int order = 0;
+  return rbd.clone(p_ioctx, p_name, p_snapname, c_ioctx, c_name, &order);
+}
+
+static int do_flatten(librbd::Image& image)
+{
+  MyProgressContext pc("Image flatten");
+  int r = image.flatten_with_progress(pc);
+  if (r < 0) {
+    pc.fail();
+    return r;
+  }
+  pc.finish();
+  return 0;
+}
+
 class RbdWatchCtx : public librados::WatchCtx {
   string name;
 public:
@@ -789,8 +1300,12 @@ enum {
   OPT_RM,
   OPT_EXPORT,
   OPT_IMPORT,
+  OPT_EXPORT_DIFF,
+  OPT_IMPORT_DIFF,
   OPT_COPY,
   OPT_RENAME,
+  OPT_CLONE,
+  OPT_FLATTEN,
   OPT_SNAP_CREATE,
   OPT_SNAP_ROLLBACK,
   OPT_SNAP_REMOVE,
@@ -819,6 +1334,14 @@ static int get_cmd(const char *cmd, bool snapcmd)
       return OPT_EXPORT;
     if (strcmp(cmd, "import") == 0)
       return OPT_IMPORT;
+    if (strcmp(cmd, "export-diff") == 0)
+      return OPT_EXPORT_DIFF;
+    if (strcmp(cmd, "import-diff") == 0)
+      return OPT_IMPORT_DIFF;
+    if (strcmp(cmd, "clone") == 0)
+      return OPT_CLONE;
+    if (strcmp(cmd, "flatten") == 0)
+      return OPT_FLATTEN;
     if (strcmp(cmd, "copy") == 0 ||
         strcmp(cmd, "cp") == 0)
       return OPT_COPY;
@@ -880,11 +1403,13 @@ int main(int argc, const char **argv)
   const char *poolname = NULL;
   uint64_t size = 0;  // in bytes
   int order = 0;
+  uint64_t stripe_unit = 0, stripe_count = 0;
+  const char *fromsnapname = NULL;
   const char *imgname = NULL, *snapname = NULL, *destname = NULL, *dest_poolname = NULL, *path = NULL, *secretfile = NULL, *user = NULL, *devpath = NULL;
 
   std::string val;
   std::ostringstream err;
-  long long sizell = 0;
+  long long sizell = 0, stripell = 0;
   std::vector<const char*>::iterator i;
   for (i = args.begin(); i != args.end(); ) {
     if (ceph_argparse_double_dash(args, i)) {
@@ -898,6 +1423,8 @@ int main(int argc, const char **argv)
       dest_poolname = strdup(val.c_str());
     } else if (ceph_argparse_witharg(args, i, &val, "--snap", (char*)NULL)) {
       snapname = strdup(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--from-snap", (char*)NULL)) {
+      fromsnapname = strdup(val.c_str());
     } else if (ceph_argparse_witharg(args, i, &val, "-i", "--image", (char*)NULL)) {
       imgname = strdup(val.c_str());
     } else if (ceph_argparse_withlonglong(args, i, &sizell, &err, "-s", "--size", (char*)NULL)) {
@@ -911,6 +1438,18 @@ int main(int argc, const char **argv)
 	cerr << err.str() << std::endl;
 	exit(EXIT_FAILURE);
       }
+    } else if (ceph_argparse_withlonglong(args, i, &stripell, &err, "--stripe-unit", (char*)NULL)) {
+      if (!err.str().empty() || stripell <= 0) {
+	cerr << "invalid stripe unit " << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      stripe_unit = stripell;
+    } else if (ceph_argparse_withlonglong(args, i, &stripell, &err, "--stripe-count", (char*)NULL)) {
+      if (!err.str().empty() || stripell <= 0) {
+	cerr << "invalid stripe count " << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      stripe_count = stripell;
     } else if (ceph_argparse_witharg(args, i, &val, "--path", (char*)NULL)) {
       path = strdup(val.c_str());
     } else if (ceph_argparse_witharg(args, i, &val, "--dest", (char*)NULL)) {
@@ -961,19 +1500,25 @@ int main(int argc, const char **argv)
       case OPT_SNAP_LIST:
       case OPT_WATCH:
       case OPT_MAP:
+      case OPT_FLATTEN:
 	set_conf_param(v, &imgname, NULL);
 	break;
       case OPT_UNMAP:
 	set_conf_param(v, &devpath, NULL);
 	break;
       case OPT_EXPORT:
+      case OPT_EXPORT_DIFF:
 	set_conf_param(v, &imgname, &path);
 	break;
       case OPT_IMPORT:
 	set_conf_param(v, &path, &destname);
 	break;
+      case OPT_IMPORT_DIFF:
+	set_conf_param(v, &path, &imgname);
+	break;
       case OPT_COPY:
       case OPT_RENAME:
+      case OPT_CLONE:
 	set_conf_param(v, &imgname, &destname);
 	break;
       default:
@@ -989,13 +1534,19 @@ int main(int argc, const char **argv)
     usage_exit();
   }
 
-  if (opt_cmd == OPT_IMPORT && !path) {
+  if ((opt_cmd == OPT_IMPORT || opt_cmd == OPT_IMPORT_DIFF ||
+       opt_cmd == OPT_EXPORT_DIFF) && !path) {
     cerr << "error: path was not specified" << std::endl;
     usage_exit();
   }
 
-  if (opt_cmd == OPT_IMPORT && !destname)
+  if (opt_cmd == OPT_IMPORT && !destname) {
+    if (path && strcmp(path, "-") == 0) {
+      cerr << "error: importing from stdin needs a destination image name" << std::endl;
+      usage_exit();
+    }
     destname = imgname_from_path(path);
+  }
 
   if (opt_cmd != OPT_LIST && opt_cmd != OPT_IMPORT && opt_cmd != OPT_UNMAP && opt_cmd != OPT_SHOWMAPPED &&
       !imgname) {
@@ -1009,12 +1560,13 @@ int main(int argc, const char **argv)
 		      (char **)&imgname, (char **)&snapname);
   if (snapname && opt_cmd != OPT_SNAP_CREATE && opt_cmd != OPT_SNAP_ROLLBACK &&
       opt_cmd != OPT_SNAP_REMOVE && opt_cmd != OPT_INFO &&
-      opt_cmd != OPT_EXPORT && opt_cmd != OPT_COPY) {
+      opt_cmd != OPT_EXPORT && opt_cmd != OPT_EXPORT_DIFF &&
+      opt_cmd != OPT_COPY && opt_cmd != OPT_CLONE) {
     cerr << "error: snapname specified for a command that doesn't use it" << std::endl;
     usage_exit();
   }
   if ((opt_cmd == OPT_SNAP_CREATE || opt_cmd == OPT_SNAP_ROLLBACK ||
-       opt_cmd == OPT_SNAP_REMOVE) && !snapname) {
+       opt_cmd == OPT_SNAP_REMOVE || opt_cmd == OPT_CLONE) && !snapname) {
     cerr << "error: snap name was not specified" << std::endl;
     usage_exit();
   }
@@ -1029,7 +1581,7 @@ int main(int argc, const char **argv)
   if (opt_cmd == OPT_EXPORT && !path)
     path = imgname;
 
-  if (opt_cmd == OPT_COPY && !destname ) {
+  if ((opt_cmd == OPT_COPY || opt_cmd == OPT_CLONE) && !destname ) {
     cerr << "error: destination image name was not specified" << std::endl;
     usage_exit();
   }
@@ -1058,7 +1610,8 @@ int main(int argc, const char **argv)
       (opt_cmd == OPT_RESIZE || opt_cmd == OPT_INFO || opt_cmd == OPT_SNAP_LIST ||
        opt_cmd == OPT_SNAP_CREATE || opt_cmd == OPT_SNAP_ROLLBACK ||
        opt_cmd == OPT_SNAP_REMOVE || opt_cmd == OPT_EXPORT || opt_cmd == OPT_WATCH ||
-       opt_cmd == OPT_COPY)) {
+       opt_cmd == OPT_COPY || opt_cmd == OPT_FLATTEN ||
+       opt_cmd == OPT_EXPORT_DIFF || opt_cmd == OPT_IMPORT_DIFF)) {
     r = rbd.open(io_ctx, image, imgname);
     if (r < 0) {
       cerr << "error opening image " << imgname << ": " << cpp_strerror(-r) << std::endl;
@@ -1067,7 +1620,8 @@ int main(int argc, const char **argv)
   }
 
   if (snapname && talk_to_cluster &&
-      (opt_cmd == OPT_INFO || opt_cmd == OPT_EXPORT || opt_cmd == OPT_COPY)) {
+      (opt_cmd == OPT_INFO || opt_cmd == OPT_EXPORT || opt_cmd == OPT_COPY ||
+       opt_cmd == OPT_EXPORT_DIFF)) {
     r = image.snap_set(snapname);
     if (r < 0) {
       cerr << "error setting snapshot context: " << cpp_strerror(-r) << std::endl;
@@ -1075,7 +1629,7 @@ int main(int argc, const char **argv)
     }
   }
 
-  if (opt_cmd == OPT_COPY || opt_cmd == OPT_IMPORT) {
+  if (opt_cmd == OPT_COPY || opt_cmd == OPT_IMPORT || opt_cmd == OPT_CLONE) {
     r = rados.ioctx_create(dest_poolname, dest_io_ctx);
     if (r < 0) {
       cerr << "error opening pool " << dest_poolname << ": " << cpp_strerror(-r) << std::endl;
@@ -1109,7 +1663,7 @@ int main(int argc, const char **argv)
       usage();
       exit(1);
     }
-    r = do_create(rbd, io_ctx, imgname, size, &order);
+    r = do_create(rbd, io_ctx, imgname, size, &order, stripe_unit, stripe_count);
     if (r < 0) {
       cerr << "create error: " << cpp_strerror(-r) << std::endl;
       exit(1);
@@ -1124,6 +1678,22 @@ int main(int argc, const char **argv)
     }
     break;
 
+  case OPT_CLONE:
+    r = do_clone(rbd, io_ctx, imgname, snapname, dest_io_ctx, destname);
+    if (r < 0) {
+      cerr << "clone error: " << cpp_strerror(-r) << std::endl;
+      exit(1);
+    }
+    break;
+
+  case OPT_FLATTEN:
+    r = do_flatten(image);
+    if (r < 0) {
+      cerr << "flatten error: " << cpp_strerror(-r) << std::endl;
+      exit(1);
+    }
+    break;
+
   case OPT_INFO:
     r = do_show_info(imgname, image);
     if (r < 0) {
@@ -1213,13 +1783,25 @@ int main(int argc, const char **argv)
       cerr << "pathname should be specified" << std::endl;
       exit(1);
     }
-    r = do_import(rbd, dest_io_ctx, destname, &order, path);
+    r = do_import(rbd, dest_io_ctx, destname, &order, stripe_unit, stripe_count, path);
     if (r < 0) {
       cerr << "import failed: " << cpp_strerror(-r) << std::endl;
       exit(1);
     }
     break;
 
+  case OPT_EXPORT_DIFF:
+    r = do_export_diff(image, fromsnapname, snapname, path);
+    if (r < 0)
+      exit(1);
+    break;
+
+  case OPT_IMPORT_DIFF:
+    r = do_import_diff(image, path);
+    if (r < 0)
+      exit(1);
+    break;
+
   case OPT_COPY:
     r = do_copy(image, dest_io_ctx, destname);
     if (r < 0) {
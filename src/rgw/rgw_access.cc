@@ -17,6 +17,28 @@ RGWAccess::~RGWAccess()
 {
 }
 
+int RGWAccess::put_obj_manifest(void *ctx, std::string& id, rgw_obj& obj, RGWObjManifest& manifest,
+                                map<string, bufferlist>& attrs, RGWObjCategory category)
+{
+  vector<RGWCloneRangeInfo> ranges;
+  map<uint64_t, RGWObjManifestPart>::iterator iter;
+  for (iter = manifest.objs.begin(); iter != manifest.objs.end(); ++iter) {
+    RGWCloneRangeInfo range;
+    range.src = iter->second.loc;
+    range.src_ofs = iter->second.loc_ofs;
+    range.dst_ofs = iter->first;
+    range.len = iter->second.size;
+    ranges.push_back(range);
+  }
+  int ret = clone_objs(ctx, obj, ranges, attrs, category, NULL, true, false);
+  if (ret < 0)
+    return ret;
+
+  for (iter = manifest.objs.begin(); iter != manifest.objs.end(); ++iter)
+    delete_obj(ctx, id, iter->second.loc);
+  return 0;
+}
+
 RGWAccess *RGWAccess::init_storage_provider(const char *type, CephContext *cct)
 {
   int use_cache = cct->_conf->rgw_cache_enabled;
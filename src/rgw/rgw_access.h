@@ -206,6 +206,13 @@ public:
                         time_t *pmtime,
                         bool truncate_dest,
                         bool exclusive) { return -ENOTSUP; }
+  /**
+   * Make obj the concatenation of the objects in manifest, which are
+   * consumed.  By default their data is cloned into obj and they are
+   * removed; a backend may instead point obj at them.
+   */
+  virtual int put_obj_manifest(void *ctx, std::string& id, rgw_obj& obj, RGWObjManifest& manifest,
+                               map<string, bufferlist>& attrs, RGWObjCategory category);
  /**
    * a simple object read without keeping state
    */
@@ -277,6 +284,12 @@ public:
     return 0;
   }
 
+  /** remove queued objects in the background, until stop_gc() */
+  virtual void start_gc() {}
+  virtual void stop_gc() {}
+  /** one pass over the gc queues, in the foreground */
+  virtual int process_gc() { return -ENOTSUP; }
+
 };
 
 class RGWStoreManager {
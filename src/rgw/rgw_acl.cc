@@ -408,6 +408,49 @@ int RGWAccessControlPolicy::get_perm(CephContext *cct, string& id, int perm_mask
   return perm;
 }
 
+RGWPolicyDecodeCache rgw_policy_cache;
+
+void RGWPolicyDecodeCache::decode(CephContext *cct, bufferlist& bl, RGWAccessControlPolicy *policy)
+{
+  int max = cct->_conf->rgw_acl_cache_size;
+  if (max <= 0) {
+    bufferlist::iterator iter = bl.begin();
+    policy->decode(iter);
+    return;
+  }
+
+  string key(bl.c_str(), bl.length());
+  PolicyRef ref;
+  {
+    Mutex::Locker l(lock);
+    map<string, Entry>::iterator iter = entries.find(key);
+    if (iter != entries.end()) {
+      ref = iter->second.policy;
+      lru.splice(lru.begin(), lru, iter->second.lru_iter);
+    }
+  }
+  if (ref) {
+    *policy = *ref;
+    return;
+  }
+
+  bufferlist::iterator iter = bl.begin();
+  policy->decode(iter);
+  ref.reset(new RGWAccessControlPolicy(*policy));
+
+  Mutex::Locker l(lock);
+  if (entries.count(key))
+    return;
+  lru.push_front(key);
+  Entry& e = entries[key];
+  e.policy = ref;
+  e.lru_iter = lru.begin();
+  while (entries.size() > (size_t)max) {
+    entries.erase(lru.back());
+    lru.pop_back();
+  }
+}
+
 XMLObj *RGWACLXMLParser::alloc_obj(const char *el)
 {
   XMLObj * obj = NULL;
@@ -2,12 +2,15 @@
 #define CEPH_RGW_ACL_H
 
 #include <map>
+#include <list>
 #include <string>
 #include <iostream>
+#include <tr1/memory>
 #include <include/types.h>
 
 #include <expat.h>
 
+#include "common/Mutex.h"
 #include "rgw_xml.h"
 
 using namespace std;
@@ -323,6 +326,31 @@ public:
 };
 WRITE_CLASS_ENCODER(RGWAccessControlPolicy)
 
+/*
+ * Decoded policies, by their encoding.  Most objects carry their owner's
+ * default ACL and a bucket's policy is read by every request on it, so
+ * a few rgw_acl_cache_size entries spare most requests the decode; the
+ * xattr itself already comes from the request's object state or the
+ * rgw cache.
+ */
+class RGWPolicyDecodeCache {
+  typedef std::tr1::shared_ptr<RGWAccessControlPolicy> PolicyRef;
+  struct Entry {
+    PolicyRef policy;
+    std::list<string>::iterator lru_iter;
+  };
+  Mutex lock;
+  map<string, Entry> entries;
+  std::list<string> lru;   // most recently used first
+public:
+  RGWPolicyDecodeCache() : lock("RGWPolicyDecodeCache::lock") {}
+
+  /// decode the policy in bl; throws buffer::error like decode()
+  void decode(CephContext *cct, bufferlist& bl, RGWAccessControlPolicy *policy);
+};
+
+extern RGWPolicyDecodeCache rgw_policy_cache;
+
 /**
  * Interfaces with the webserver's XML handling code
  * to parse it in a way that makes sense for the rgw.
@@ -54,6 +54,7 @@ void _usage()
   cerr << "  log rm                     remove log object\n";
   cerr << "  temp remove                remove temporary objects that were created up to\n";
   cerr << "                             specified date (and optional time)\n";
+  cerr << "  gc process                 remove the queued objects that are due\n";
   cerr << "options:\n";
   cerr << "   --uid=<id>                user id\n";
   cerr << "   --auth-uid=<auid>         librados uid\n";
@@ -121,6 +122,7 @@ enum {
   OPT_LOG_SHOW,
   OPT_LOG_RM,
   OPT_TEMP_REMOVE,
+  OPT_GC_PROCESS,
 };
 
 static uint32_t str_to_perm(const char *str)
@@ -190,7 +192,8 @@ static int get_cmd(const char *cmd, const char *prev_cmd, bool *need_more)
       strcmp(cmd, "bucket") == 0 ||
       strcmp(cmd, "pool") == 0 ||
       strcmp(cmd, "log") == 0 ||
-      strcmp(cmd, "temp") == 0) {
+      strcmp(cmd, "temp") == 0 ||
+      strcmp(cmd, "gc") == 0) {
     *need_more = true;
     return 0;
   }
@@ -248,6 +251,9 @@ static int get_cmd(const char *cmd, const char *prev_cmd, bool *need_more)
   } else if (strcmp(prev_cmd, "temp") == 0) {
     if (strcmp(cmd, "remove") == 0)
       return OPT_TEMP_REMOVE;
+  } else if (strcmp(prev_cmd, "gc") == 0) {
+    if (strcmp(cmd, "process") == 0)
+      return OPT_GC_PROCESS;
   } else if (strcmp(prev_cmd, "pool") == 0) {
     if (strcmp(cmd, "add") == 0)
       return OPT_POOL_ADD;
@@ -994,6 +1000,14 @@ int main(int argc, char **argv)
     }
   }
 
+  if (opt_cmd == OPT_GC_PROCESS) {
+    int r = store->process_gc();
+    if (r < 0) {
+      cerr << "gc processing failed: " << cpp_strerror(-r) << std::endl;
+      return 1;
+    }
+  }
+
   if (opt_cmd == OPT_LOG_LIST) {
     // filter by date?
     if (date.size() && date.size() != 10) {
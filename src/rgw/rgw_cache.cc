@@ -2,25 +2,60 @@
 
 #include <errno.h>
 
+#include "include/ceph_hash.h"
+#include "common/Clock.h"
+
 #define DOUT_SUBSYS rgw
 
 using namespace std;
 
 
+ObjectCache::~ObjectCache()
+{
+  for (vector<Shard *>::iterator iter = shards.begin(); iter != shards.end(); ++iter)
+    delete *iter;
+}
+
+void ObjectCache::init(CephContext *cct)
+{
+  assert(shards.empty());
+  int num = cct->_conf->rgw_cache_shards;
+  if (num < 1)
+    num = 1;
+  for (int i = 0; i < num; i++)
+    shards.push_back(new Shard);
+  int per_shard = cct->_conf->rgw_cache_lru_size / num;
+  max_shard_entries = (per_shard > 0 ? per_shard : 1);
+}
+
+ObjectCache::Shard& ObjectCache::get_shard(const string& name)
+{
+  assert(!shards.empty());
+  return *shards[ceph_str_hash_linux(name.c_str(), name.size()) % shards.size()];
+}
+
 int ObjectCache::get(string& name, ObjectCacheInfo& info, uint32_t mask)
 {
-  Mutex::Locker l(lock);
+  Shard& shard = get_shard(name);
+  Mutex::Locker l(shard.lock);
 
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end()) {
+  map<string, ObjectCacheEntry>::iterator iter = shard.cache_map.find(name);
+  if (iter == shard.cache_map.end()) {
     dout(10) << "cache get: name=" << name << " : miss" << dendl;
     return -ENOENT;
   }
 
-  touch_lru(name, iter->second.lru_iter);
-
   ObjectCacheInfo& src = iter->second.info;
-  if ((src.flags & mask) != mask) {
+  if (src.status < 0 && iter->second.expires < ceph_clock_now(g_ceph_context)) {
+    dout(10) << "cache get: name=" << name << " : negative entry expired" << dendl;
+    remove_lru(shard, iter->second.lru_iter);
+    shard.cache_map.erase(iter);
+    return -ENOENT;
+  }
+
+  touch_lru(shard, name, iter->second.lru_iter);
+
+  if (src.status >= 0 && (src.flags & mask) != mask) {
     dout(10) << "cache get: name=" << name << " : type miss (requested=" << mask << ", cached=" << src.flags << dendl;
     return -ENOENT;
   }
@@ -33,29 +68,36 @@ int ObjectCache::get(string& name, ObjectCacheInfo& info, uint32_t mask)
 
 void ObjectCache::put(string& name, ObjectCacheInfo& info)
 {
-  Mutex::Locker l(lock);
+  Shard& shard = get_shard(name);
+  Mutex::Locker l(shard.lock);
 
   dout(10) << "cache put: name=" << name << dendl;
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end()) {
+  map<string, ObjectCacheEntry>::iterator iter = shard.cache_map.find(name);
+  if (iter == shard.cache_map.end()) {
     ObjectCacheEntry entry;
-    entry.lru_iter = lru.end();
-    cache_map.insert(pair<string, ObjectCacheEntry>(name, entry));
-    iter = cache_map.find(name);
+    entry.lru_iter = shard.lru.end();
+    iter = shard.cache_map.insert(pair<string, ObjectCacheEntry>(name, entry)).first;
   }
   ObjectCacheEntry& entry = iter->second;
   ObjectCacheInfo& target = entry.info;
 
-  touch_lru(name, entry.lru_iter);
-
-  target.status = info.status;
+  touch_lru(shard, name, entry.lru_iter);
 
   if (info.status < 0) {
+    target.status = info.status;
     target.flags = 0;
     target.xattrs.clear();
     target.data.clear();
+    entry.expires = ceph_clock_now(g_ceph_context);
+    entry.expires += g_conf->rgw_cache_negative_ttl;
+    trim_lru(shard);
     return;
   }
+  if (target.status < 0) {
+    // whatever we knew was that it didn't exist
+    target.status = 0;
+    target.flags = 0;
+  }
 
   target.flags |= info.flags;
 
@@ -68,65 +110,68 @@ void ObjectCache::put(string& name, ObjectCacheInfo& info)
     target.xattrs = info.xattrs;
     map<string, bufferlist>::iterator iter;
     for (iter = target.xattrs.begin(); iter != target.xattrs.end(); ++iter) {
-      dout(0) << "updating xattr: name=" << iter->first << " bl.length()=" << iter->second.length() << dendl;
+      dout(20) << "updating xattr: name=" << iter->first << " bl.length()=" << iter->second.length() << dendl;
     }
   } else if (info.flags & CACHE_FLAG_APPEND_XATTRS) {
     map<string, bufferlist>::iterator iter;
     for (iter = info.xattrs.begin(); iter != info.xattrs.end(); ++iter) {
-      dout(0) << "appending xattr: name=" << iter->first << " bl.length()=" << iter->second.length() << dendl;
+      dout(20) << "appending xattr: name=" << iter->first << " bl.length()=" << iter->second.length() << dendl;
       target.xattrs[iter->first] = iter->second;
     }
   }
 
   if (info.flags & CACHE_FLAG_DATA)
     target.data = info.data;
+
+  trim_lru(shard);
 }
 
 void ObjectCache::remove(string& name)
 {
-  Mutex::Locker l(lock);
+  Shard& shard = get_shard(name);
+  Mutex::Locker l(shard.lock);
 
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end())
+  map<string, ObjectCacheEntry>::iterator iter = shard.cache_map.find(name);
+  if (iter == shard.cache_map.end())
     return;
 
   dout(10) << "removing " << name << " from cache" << dendl;
 
-  remove_lru(name, iter->second.lru_iter);
-  cache_map.erase(iter);
+  remove_lru(shard, iter->second.lru_iter);
+  shard.cache_map.erase(iter);
 }
 
-void ObjectCache::touch_lru(string& name, std::list<string>::iterator& lru_iter)
+void ObjectCache::touch_lru(Shard& shard, string& name, std::list<string>::iterator& lru_iter)
 {
-  while (lru.size() > (size_t)g_conf->rgw_cache_lru_size) {
-    list<string>::iterator iter = lru.begin();
-    map<string, ObjectCacheEntry>::iterator map_iter = cache_map.find(*iter);
-    dout(10) << "removing entry: name=" << *iter << " from cache LRU" << dendl;
-    if (map_iter != cache_map.end())
-      cache_map.erase(map_iter);
-    lru.pop_front();
-  }
-
-  if (lru_iter == lru.end()) {
-    lru.push_back(name);
+  if (lru_iter == shard.lru.end()) {
+    shard.lru.push_back(name);
+    shard.lru_size++;
     lru_iter--;
     dout(10) << "adding " << name << " to cache LRU end" << dendl;
   } else {
     dout(10) << "moving " << name << " to cache LRU end" << dendl;
-    lru.erase(lru_iter);
-    lru.push_back(name);
-    lru_iter = lru.end();
-    --lru_iter;
+    shard.lru.splice(shard.lru.end(), shard.lru, lru_iter);
   }
 }
 
-void ObjectCache::remove_lru(string& name, std::list<string>::iterator& lru_iter)
+/// evict from the front; the entry just touched is at the back
+void ObjectCache::trim_lru(Shard& shard)
 {
-  if (lru_iter == lru.end())
-    return;
-
-  lru.erase(lru_iter);
-  lru_iter = lru.end();
+  while (shard.lru_size > max_shard_entries) {
+    list<string>::iterator iter = shard.lru.begin();
+    dout(10) << "removing entry: name=" << *iter << " from cache LRU" << dendl;
+    shard.cache_map.erase(*iter);
+    shard.lru.pop_front();
+    shard.lru_size--;
+  }
 }
 
+void ObjectCache::remove_lru(Shard& shard, std::list<string>::iterator& lru_iter)
+{
+  if (lru_iter == shard.lru.end())
+    return;
 
+  shard.lru.erase(lru_iter);
+  shard.lru_size--;
+  lru_iter = shard.lru.end();
+}
@@ -6,10 +6,12 @@
 #include <map>
 #include "include/types.h"
 #include "include/utime.h"
+#include "common/Cond.h"
 
 enum {
   UPDATE_OBJ,
   REMOVE_OBJ,
+  BATCH_OBJS,   // followed by a list of notifications
 };
 
 #define CACHE_FLAG_DATA           0x1
@@ -100,17 +102,36 @@ WRITE_CLASS_ENCODER(RGWCacheNotifyInfo)
 struct ObjectCacheEntry {
   ObjectCacheInfo info;
   std::list<string>::iterator lru_iter;
+  utime_t expires;   // negative entries only
 };
 
+/*
+ * The cache is split into rgw_cache_shards shards by name hash, each
+ * with its own lock and its share of rgw_cache_lru_size, so lookups of
+ * different objects don't serialize.  Negative entries (status < 0)
+ * only live for rgw_cache_negative_ttl seconds, in case we miss the
+ * notification for their creation.
+ */
 class ObjectCache {
-  std::map<string, ObjectCacheEntry> cache_map;
-  std::list<string> lru;
-  Mutex lock;
-
-  void touch_lru(string& name, std::list<string>::iterator& lru_iter);
-  void remove_lru(string& name, std::list<string>::iterator& lru_iter);
+  struct Shard {
+    Mutex lock;
+    std::map<string, ObjectCacheEntry> cache_map;
+    std::list<string> lru;
+    size_t lru_size;
+    Shard() : lock("ObjectCache::Shard::lock"), lru_size(0) {}
+  };
+  std::vector<Shard *> shards;
+  size_t max_shard_entries;
+
+  Shard& get_shard(const string& name);
+  void touch_lru(Shard& shard, string& name, std::list<string>::iterator& lru_iter);
+  void remove_lru(Shard& shard, std::list<string>::iterator& lru_iter);
+  void trim_lru(Shard& shard);
 public:
-  ObjectCache() : lock("ObjectCache") { }
+  ObjectCache() : max_shard_entries(0) { }
+  ~ObjectCache();
+  /// size the shards; call before any other method
+  void init(CephContext *cct);
   int get(std::string& name, ObjectCacheInfo& bl, uint32_t mask);
   void put(std::string& name, ObjectCacheInfo& bl);
   void remove(std::string& name);
@@ -132,6 +153,16 @@ class RGWCache  : public T
 {
   ObjectCache cache;
 
+  /* notifications queued while one is in flight go out together in
+   * the next one; distribute() still returns only once its own
+   * notification has been sent. */
+  Mutex notify_lock;
+  Cond notify_cond;
+  std::list<RGWCacheNotifyInfo> notify_queue;
+  bool notify_in_flight;
+  uint64_t notify_queued_seq, notify_sent_seq;
+  int notify_ret;
+
   int list_objects_raw_init(rgw_bucket& bucket, RGWAccessHandle *handle) {
     return T::list_objects_raw_init(bucket, handle);
   }
@@ -154,6 +185,7 @@ class RGWCache  : public T
 
   int initialize(CephContext *cct) {
     int ret;
+    cache.init(cct);
     ret = T::initialize(cct);
     if (ret < 0)
       return ret;
@@ -167,8 +199,16 @@ class RGWCache  : public T
   }
   int distribute(rgw_obj& obj, ObjectCacheInfo& obj_info, int op);
   int watch_cb(int opcode, uint64_t ver, bufferlist& bl);
+  void apply_notify(RGWCacheNotifyInfo& info);
 public:
-  RGWCache() {}
+  RGWCache() : notify_lock("RGWCache::notify_lock"), notify_in_flight(false),
+               notify_queued_seq(0), notify_sent_seq(0), notify_ret(0) {}
+
+  int prepare_get_obj(void *ctx, rgw_obj& obj, off_t ofs, off_t *end,
+                      map<string, bufferlist> *attrs, const time_t *mod_ptr,
+                      const time_t *unmod_ptr, time_t *lastmod, const char *if_match,
+                      const char *if_nomatch, uint64_t *total_size, uint64_t *obj_size,
+                      void **handle, struct rgw_err *err);
 
   int set_attr(void *ctx, rgw_obj& obj, const char *name, bufferlist& bl);
   int put_obj_meta(void *ctx, std::string& id, rgw_obj& obj, uint64_t size, time_t *mtime,
@@ -204,6 +244,35 @@ int RGWCache<T>::delete_obj(void *ctx, std::string& id, rgw_obj& obj, bool sync)
   return T::delete_obj(ctx, id, obj, sync);
 }
 
+/*
+ * a plain whole-object read of a system object (rgw_get_obj(): user
+ * and bucket info) needs nothing from prepare that the cache doesn't
+ * have, so don't stat the object if its data is cached.  get_obj()
+ * prepares for real if the entry goes away in between.
+ */
+template <class T>
+int RGWCache<T>::prepare_get_obj(void *ctx, rgw_obj& obj, off_t ofs, off_t *end,
+                                 map<string, bufferlist> *attrs, const time_t *mod_ptr,
+                                 const time_t *unmod_ptr, time_t *lastmod, const char *if_match,
+                                 const char *if_nomatch, uint64_t *total_size, uint64_t *obj_size,
+                                 void **handle, struct rgw_err *err)
+{
+  rgw_bucket bucket;
+  string oid;
+  normalize_bucket_and_obj(obj.bucket, obj.object, bucket, oid);
+  if (bucket.name[0] == '.' && ofs == 0 && !end && !attrs && !mod_ptr && !unmod_ptr &&
+      !lastmod && !if_match && !if_nomatch && !total_size && !obj_size) {
+    string name = normal_name(obj.bucket, oid);
+    ObjectCacheInfo info;
+    if (cache.get(name, info, CACHE_FLAG_DATA) == 0) {
+      *handle = NULL;
+      return (info.status < 0 ? info.status : 0);
+    }
+  }
+  return T::prepare_get_obj(ctx, obj, ofs, end, attrs, mod_ptr, unmod_ptr, lastmod,
+                            if_match, if_nomatch, total_size, obj_size, handle, err);
+}
+
 template <class T>
 int RGWCache<T>::get_obj(void *ctx, void **handle, rgw_obj& obj, char **data, off_t ofs, off_t end)
 {
@@ -226,6 +295,14 @@ int RGWCache<T>::get_obj(void *ctx, void **handle, rgw_obj& obj, char **data, of
     memcpy(*data, bl.c_str(), bl.length());
     return bl.length();
   }
+  if (!*handle) {
+    // prepare_get_obj() skipped the stat for an entry that is now gone
+    struct rgw_err err;
+    int r = T::prepare_get_obj(ctx, obj, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                               NULL, NULL, handle, &err);
+    if (r < 0)
+      return r;
+  }
   int r = T::get_obj(ctx, handle, obj, data, ofs, end);
   if (r < 0) {
     if (r == -ENOENT) { // only update ENOENT, we'd rather retry other errors
@@ -399,20 +476,76 @@ int RGWCache<T>::distribute(rgw_obj& obj, ObjectCacheInfo& obj_info, int op)
 
   info.obj_info = obj_info;
   info.obj = obj;
+
+  if (!g_conf->rgw_cache_notify_batch) {
+    bufferlist bl;
+    ::encode(info, bl);
+    return T::distribute(bl);
+  }
+
+  Mutex::Locker l(notify_lock);
+  notify_queue.push_back(info);
+  uint64_t seq = ++notify_queued_seq;
+  while (notify_in_flight && notify_sent_seq < seq)
+    notify_cond.Wait(notify_lock);
+  if (notify_sent_seq >= seq)
+    return notify_ret;   // went out with someone else's batch
+
+  std::list<RGWCacheNotifyInfo> batch;
+  batch.swap(notify_queue);
+  uint64_t last = notify_queued_seq;
+  notify_in_flight = true;
+  notify_lock.Unlock();
+
   bufferlist bl;
-  ::encode(info, bl);
+  if (batch.size() == 1) {
+    ::encode(batch.front(), bl);
+  } else {
+    RGWCacheNotifyInfo header;
+    header.op = BATCH_OBJS;
+    header.ofs = 0;
+    ::encode(header, bl);
+    ::encode(batch, bl);
+  }
+  dout(10) << "distributing " << batch.size() << " cache notifications" << dendl;
   int ret = T::distribute(bl);
+
+  notify_lock.Lock();
+  notify_in_flight = false;
+  notify_sent_seq = last;
+  notify_ret = ret;
+  notify_cond.Signal();
   return ret;
 }
 
+template <class T>
+void RGWCache<T>::apply_notify(RGWCacheNotifyInfo& info)
+{
+  string name = normal_name(info.obj);
+
+  switch (info.op) {
+  case UPDATE_OBJ:
+    cache.put(name, info.obj_info);
+    break;
+  case REMOVE_OBJ:
+    cache.remove(name);
+    break;
+  default:
+    dout(0) << "WARNING: got unknown notification op: " << info.op << dendl;
+  }
+}
+
 template <class T>
 int RGWCache<T>::watch_cb(int opcode, uint64_t ver, bufferlist& bl)
 {
   RGWCacheNotifyInfo info;
+  std::list<RGWCacheNotifyInfo> batch;
 
   try {
     bufferlist::iterator iter = bl.begin();
     ::decode(info, iter);
+    if (info.op == BATCH_OBJS)
+      ::decode(batch, iter);
   } catch (buffer::end_of_buffer& err) {
     dout(0) << "ERROR: got bad notification" << dendl;
     return -EIO;
@@ -421,20 +554,17 @@ int RGWCache<T>::watch_cb(int opcode, uint64_t ver, bufferlist& bl)
     return -EIO;
   }
 
-  string name = normal_name(info.obj);
-
-  switch (info.op) {
-  case UPDATE_OBJ:
-    cache.put(name, info.obj_info);
-    break;
-  case REMOVE_OBJ:
-    cache.remove(name);
-    break;
-  default:
-    dout(0) << "WARNING: got unknown notification op: " << info.op << dendl;
-    return -EINVAL;
+  if (info.op != BATCH_OBJS) {
+    if (info.op != UPDATE_OBJ && info.op != REMOVE_OBJ) {
+      dout(0) << "WARNING: got unknown notification op: " << info.op << dendl;
+      return -EINVAL;
+    }
+    apply_notify(info);
+    return 0;
   }
 
+  for (std::list<RGWCacheNotifyInfo>::iterator iter = batch.begin(); iter != batch.end(); ++iter)
+    apply_notify(*iter);
   return 0;
 }
 
@@ -0,0 +1,62 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rgw_client_io.h"
+
+int RGWClientIO::printf(const char *format, ...)
+{
+  char buf[256];
+  va_list ap;
+  va_start(ap, format);
+  int n = vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  if (n < 0)
+    return n;
+  if (n < (int)sizeof(buf))
+    return write(buf, n);
+
+  char *p = (char *)malloc(n + 1);
+  if (!p)
+    return -1;
+  va_start(ap, format);
+  vsnprintf(p, n + 1, format, ap);
+  va_end(ap);
+  int r = write(p, n);
+  free(p);
+  return r;
+}
+
+RGWFCGX::~RGWFCGX()
+{
+  delete fcgx;
+}
+
+bool RGWFCGX::next_request()
+{
+  // we were handed an accepted request, and there is only that one
+  if (started)
+    return false;
+  started = true;
+  return true;
+}
+
+void RGWFCGX::finish_request()
+{
+  FCGX_Finish_r(fcgx);
+}
+
+int RGWFCGX::write(const char *buf, int len)
+{
+  return FCGX_PutStr(buf, len, fcgx->out);
+}
+
+int RGWFCGX::read(char *buf, int len)
+{
+  return FCGX_GetStr(buf, len, fcgx->in);
+}
+
+void RGWFCGX::flush()
+{
+  FCGX_FFlush(fcgx->out);
+}
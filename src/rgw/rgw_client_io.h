@@ -0,0 +1,57 @@
+#ifndef CEPH_RGW_CLIENT_IO_H
+#define CEPH_RGW_CLIENT_IO_H
+
+#include "acconfig.h"
+#ifdef FASTCGI_INCLUDE_DIR
+# include "fastcgi/fcgiapp.h"
+#else
+# include "fcgiapp.h"
+#endif
+
+/*
+ * The connection a request arrived on.  Handlers write a CGI-style
+ * response (a "Status:" line, header lines, a blank line, the body)
+ * and read the request body through this; the environment holds the
+ * CGI variables (REQUEST_METHOD, HTTP_*, ...).
+ *
+ * A connection may carry several requests in turn: next_request()
+ * readies the next one, finish_request() completes its response.
+ */
+class RGWClientIO {
+public:
+  virtual ~RGWClientIO() {}
+
+  /// false once there are no more requests on this connection
+  virtual bool next_request() = 0;
+  virtual void finish_request() = 0;
+
+  /// NULL-terminated "NAME=value" strings for the current request
+  virtual char **get_env() = 0;
+
+  virtual int write(const char *buf, int len) = 0;
+  /// read up to len bytes of the request body; short only at its end
+  virtual int read(char *buf, int len) = 0;
+  virtual void flush() = 0;
+
+  int printf(const char *format, ...);
+};
+
+/// a request handed to us by the web server over FastCGI
+class RGWFCGX : public RGWClientIO {
+  FCGX_Request *fcgx;
+  bool started;
+public:
+  RGWFCGX(FCGX_Request *_fcgx) : fcgx(_fcgx), started(false) {}
+  ~RGWFCGX();
+
+  bool next_request();
+  void finish_request();
+  char **get_env() {
+    return fcgx->envp;
+  }
+  int write(const char *buf, int len);
+  int read(char *buf, int len);
+  void flush();
+};
+
+#endif
@@ -255,22 +255,36 @@ struct rgw_cls_obj_complete_op
 };
 WRITE_CLASS_ENCODER(rgw_cls_obj_complete_op)
 
+/*
+ * list up to num_entries entries after start_obj.  with a prefix, only
+ * entries that start with it; with a delimiter too, entries with the
+ * delimiter after the prefix are rolled up into one common prefix
+ * each, which counts as one entry.
+ */
 struct rgw_cls_list_op
 {
   string start_obj;
   uint32_t num_entries;
+  string prefix;
+  string delimiter;
 
   void encode(bufferlist &bl) const {
-    __u8 struct_v = 1;
+    __u8 struct_v = 2;
     ::encode(struct_v, bl);
     ::encode(start_obj, bl);
     ::encode(num_entries, bl);
+    ::encode(prefix, bl);
+    ::encode(delimiter, bl);
   }
   void decode(bufferlist::iterator &bl) {
     __u8 struct_v;
     ::decode(struct_v, bl);
     ::decode(start_obj, bl);
     ::decode(num_entries, bl);
+    if (struct_v >= 2) {
+      ::decode(prefix, bl);
+      ::decode(delimiter, bl);
+    }
   }
 };
 WRITE_CLASS_ENCODER(rgw_cls_list_op)
@@ -279,20 +293,138 @@ struct rgw_cls_list_ret
 {
   rgw_bucket_dir dir;
   bool is_truncated;
+  set<string> common_prefixes;
+
+  rgw_cls_list_ret() : is_truncated(false) {}
 
   void encode(bufferlist &bl) const {
-    __u8 struct_v = 1;
+    __u8 struct_v = 2;
     ::encode(struct_v, bl);
     ::encode(dir, bl);
     ::encode(is_truncated, bl);
+    ::encode(common_prefixes, bl);
   }
   void decode(bufferlist::iterator &bl) {
     __u8 struct_v;
     ::decode(struct_v, bl);
     ::decode(dir, bl);
     ::decode(is_truncated, bl);
+    if (struct_v >= 2)
+      ::decode(common_prefixes, bl);
   }
 };
 WRITE_CLASS_ENCODER(rgw_cls_list_ret)
 
+/*
+ * gc queue entries.  chain is the encoded list of objects to remove,
+ * which only the gateway interprets; the osd keys each entry by the
+ * time it becomes due, so that the due ones are listed first.
+ */
+struct cls_rgw_gc_obj_info
+{
+  string tag;
+  bufferlist chain;
+  utime_t time;     // due
+
+  void encode(bufferlist &bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(tag, bl);
+    ::encode(chain, bl);
+    ::encode(time, bl);
+  }
+  void decode(bufferlist::iterator &bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(tag, bl);
+    ::decode(chain, bl);
+    ::decode(time, bl);
+  }
+};
+WRITE_CLASS_ENCODER(cls_rgw_gc_obj_info)
+
+struct cls_rgw_gc_set_entry_op
+{
+  uint32_t expiration_secs;
+  cls_rgw_gc_obj_info info;
+
+  cls_rgw_gc_set_entry_op() : expiration_secs(0) {}
+
+  void encode(bufferlist &bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(expiration_secs, bl);
+    ::encode(info, bl);
+  }
+  void decode(bufferlist::iterator &bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(expiration_secs, bl);
+    ::decode(info, bl);
+  }
+};
+WRITE_CLASS_ENCODER(cls_rgw_gc_set_entry_op)
+
+/* list up to max due entries after marker */
+struct cls_rgw_gc_list_op
+{
+  string marker;
+  uint32_t max;
+
+  cls_rgw_gc_list_op() : max(0) {}
+
+  void encode(bufferlist &bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(marker, bl);
+    ::encode(max, bl);
+  }
+  void decode(bufferlist::iterator &bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(marker, bl);
+    ::decode(max, bl);
+  }
+};
+WRITE_CLASS_ENCODER(cls_rgw_gc_list_op)
+
+struct cls_rgw_gc_list_ret
+{
+  map<string, cls_rgw_gc_obj_info> entries;   // by key
+  bool truncated;
+
+  cls_rgw_gc_list_ret() : truncated(false) {}
+
+  void encode(bufferlist &bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(entries, bl);
+    ::encode(truncated, bl);
+  }
+  void decode(bufferlist::iterator &bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(entries, bl);
+    ::decode(truncated, bl);
+  }
+};
+WRITE_CLASS_ENCODER(cls_rgw_gc_list_ret)
+
+struct cls_rgw_gc_remove_op
+{
+  set<string> keys;
+
+  void encode(bufferlist &bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(keys, bl);
+  }
+  void decode(bufferlist::iterator &bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(keys, bl);
+  }
+};
+WRITE_CLASS_ENCODER(cls_rgw_gc_remove_op)
+
 #endif
@@ -87,6 +87,19 @@ void flush_formatter_to_req_state(struct req_state *s, Formatter *formatter)
   s->formatter->reset();
 }
 
+void rgw_flush_formatter_chunk(struct req_state *s)
+{
+  int chunk = g_conf->rgw_formatter_chunk_size;
+  if (chunk <= 0 || s->formatter->get_len() < chunk)
+    return;
+
+  // unlike flush_formatter_to_req_state, keep the open sections
+  std::ostringstream oss;
+  s->formatter->flush(oss);
+  std::string outs(oss.str());
+  CGI_PutStr(s, outs.c_str(), outs.size());
+}
+
 std::ostream& operator<<(std::ostream& oss, const rgw_err &err)
 {
   oss << "rgw_err(http_ret=" << err.http_ret << ", s3='" << err.s3_code << "') ";
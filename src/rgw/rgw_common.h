@@ -18,12 +18,7 @@
 #include "common/ceph_crypto.h"
 #include "common/debug.h"
 
-#include "acconfig.h"
-#ifdef FASTCGI_INCLUDE_DIR
-# include "fastcgi/fcgiapp.h"
-#else
-# include "fcgiapp.h"
-#endif
+#include "rgw_client_io.h"
 
 #include <errno.h>
 #include <string.h>
@@ -45,6 +40,8 @@ using ceph::crypto::MD5;
 
 #define RGW_CONTROL_BUCKET ".rgw.control"
 
+#define RGW_GC_BUCKET ".rgw.gc"
+
 #define RGW_ATTR_PREFIX  "user.rgw."
 
 #define RGW_ATTR_ACL		RGW_ATTR_PREFIX "acl"
@@ -54,13 +51,13 @@ using ceph::crypto::MD5;
 #define RGW_ATTR_CONTENT_TYPE	RGW_ATTR_PREFIX "content_type"
 #define RGW_ATTR_ID_TAG    	RGW_ATTR_PREFIX "idtag"
 #define RGW_ATTR_SHADOW_OBJ    	RGW_ATTR_PREFIX "shadow_name"
+#define RGW_ATTR_MANIFEST    	RGW_ATTR_PREFIX "manifest"
 
 #define RGW_BUCKETS_OBJ_PREFIX ".buckets"
 
 #define USER_INFO_VER 8
 
 #define RGW_MAX_CHUNK_SIZE	(512*1024)
-#define RGW_MAX_PENDING_CHUNKS  16
 
 #define RGW_FORMAT_XML          1
 #define RGW_FORMAT_JSON         2
@@ -71,7 +68,7 @@ using ceph::crypto::MD5;
 #define RGW_SUSPENDED_USER_AUID (uint64_t)-2
 
 #define CGI_PRINTF(state, format, ...) do { \
-   int __ret = FCGX_FPrintF(state->fcgx->out, format, __VA_ARGS__); \
+   int __ret = state->cio->printf(format, __VA_ARGS__); \
    if (state->header_ended) \
      state->bytes_sent += __ret; \
    int l = 32, n; \
@@ -86,13 +83,13 @@ using ceph::crypto::MD5;
 } while (0)
 
 #define CGI_PutStr(state, buf, len) do { \
-  FCGX_PutStr(buf, len, state->fcgx->out); \
+  state->cio->write(buf, len); \
   if (state->header_ended) \
     state->bytes_sent += len; \
 } while (0)
 
 #define CGI_GetStr(state, buf, buf_len, olen) do { \
-  olen = FCGX_GetStr(buf, buf_len, state->fcgx->in); \
+  olen = state->cio->read(buf, buf_len); \
   state->bytes_received += olen; \
 } while (0)
 
@@ -383,31 +380,38 @@ struct rgw_bucket {
   std::string pool;
   std::string marker;
   uint64_t bucket_id;
+  uint32_t num_shards;  // index objects; 0 for a single unsharded one
 
-  rgw_bucket() {}
+  rgw_bucket() : bucket_id(0), num_shards(0) {}
   rgw_bucket(const char *n) : name(n) {
     assert(*n == '.'); // only rgw private buckets should be initialized without pool
     pool = n;
     marker = "";
     bucket_id = 0;
+    num_shards = 0;
   }
   rgw_bucket(const char *n, const char *p, const char *m, uint64_t id) :
-    name(n), pool(p), marker(m), bucket_id(id) {}
+    name(n), pool(p), marker(m), bucket_id(id), num_shards(0) {}
 
   void clear() {
     name = "";
     pool = "";
     marker = "";
     bucket_id = 0;
+    num_shards = 0;
   }
 
   void encode(bufferlist& bl) const {
-    __u8 struct_v = 2;
+    // rgw_bucket is embedded unframed in other encodings; stay at v2,
+    // which older gateways can decode, unless the index is sharded
+    __u8 struct_v = num_shards ? 3 : 2;
     ::encode(struct_v, bl);
     ::encode(name, bl);
     ::encode(pool, bl);
     ::encode(marker, bl);
     ::encode(bucket_id, bl);
+    if (struct_v >= 3)
+      ::encode(num_shards, bl);
   }
   void decode(bufferlist::iterator& bl) {
     __u8 struct_v;
@@ -418,6 +422,10 @@ struct rgw_bucket {
       ::decode(marker, bl);
       ::decode(bucket_id, bl);
     }
+    if (struct_v >= 3)
+      ::decode(num_shards, bl);
+    else
+      num_shards = 0;
   }
 };
 WRITE_CLASS_ENCODER(rgw_bucket)
@@ -475,7 +483,7 @@ struct RGWEnv;
 
 /** Store all the state necessary to complete and respond to an HTTP request*/
 struct req_state {
-   FCGX_Request *fcgx;
+   RGWClientIO *cio;
    http_op op;
    bool content_started;
    int format;
@@ -538,6 +546,8 @@ struct req_state {
 
 extern void flush_formatter_to_req_state(struct req_state *s,
 					 ceph::Formatter *formatter);
+/** send what s->formatter has so far, if that's rgw_formatter_chunk_size or more */
+extern void rgw_flush_formatter_chunk(struct req_state *s);
 
 /** Store basic data on an object */
 struct RGWObjEnt {
@@ -811,6 +821,56 @@ inline ostream& operator<<(ostream& out, const rgw_obj o) {
   return out << o.bucket.name << ":" << o.object;
 }
 
+struct RGWObjManifestPart {
+  rgw_obj loc;       // the object holding this part's data
+  uint64_t loc_ofs;  // where in it the part starts
+  uint64_t size;
+
+  RGWObjManifestPart() : loc_ofs(0), size(0) {}
+
+  void encode(bufferlist& bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(loc, bl);
+    ::encode(loc_ofs, bl);
+    ::encode(size, bl);
+  }
+  void decode(bufferlist::iterator& bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(loc, bl);
+    ::decode(loc_ofs, bl);
+    ::decode(size, bl);
+  }
+};
+WRITE_CLASS_ENCODER(RGWObjManifestPart)
+
+/*
+ * An object whose data lives in other objects (e.g. the parts of a
+ * completed multipart upload) rather than in its own head object,
+ * which then holds only this, in RGW_ATTR_MANIFEST, and no data.
+ */
+struct RGWObjManifest {
+  map<uint64_t, RGWObjManifestPart> objs;   // by logical offset
+  uint64_t obj_size;
+
+  RGWObjManifest() : obj_size(0) {}
+
+  void encode(bufferlist& bl) const {
+    __u8 struct_v = 1;
+    ::encode(struct_v, bl);
+    ::encode(obj_size, bl);
+    ::encode(objs, bl);
+  }
+  void decode(bufferlist::iterator& bl) {
+    __u8 struct_v;
+    ::decode(struct_v, bl);
+    ::decode(obj_size, bl);
+    ::decode(objs, bl);
+  }
+};
+WRITE_CLASS_ENCODER(RGWObjManifest)
+
 static inline void buf_to_hex(const unsigned char *buf, int len, char *str)
 {
   int i;
@@ -0,0 +1,233 @@
+#include <errno.h>
+#include <unistd.h>
+
+#include "common/Clock.h"
+#include "common/config.h"
+#include "common/debug.h"
+#include "include/ceph_hash.h"
+
+#include "rgw_gc.h"
+#include "rgw_rados.h"
+
+#define DOUT_SUBSYS rgw
+
+using namespace std;
+
+int RGWGC::initialize(CephContext *_cct, RGWRados *_store, librados::IoCtx& _io_ctx)
+{
+  cct = _cct;
+  store = _store;
+  io_ctx.dup(_io_ctx);
+
+  max_objs = cct->_conf->rgw_gc_max_objs;
+  if (max_objs < 1)
+    max_objs = 1;
+  obj_names.resize(max_objs);
+  for (int i = 0; i < max_objs; i++) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "gc.%d", i);
+    obj_names[i] = buf;
+  }
+  return 0;
+}
+
+int RGWGC::tag_index(const string& tag)
+{
+  return ceph_str_hash_linux(tag.c_str(), tag.size()) % max_objs;
+}
+
+int RGWGC::send_chain(std::list<rgw_obj>& chain, const string& tag)
+{
+  cls_rgw_gc_set_entry_op op;
+  op.expiration_secs = cct->_conf->rgw_gc_obj_min_wait;
+  op.info.tag = tag;
+  ::encode(chain, op.info.chain);
+
+  bufferlist in, out;
+  ::encode(op, in);
+  int i = tag_index(tag);
+  int r = io_ctx.exec(obj_names[i], "rgw", "gc_set_entry", in, out);
+  dout(20) << "gc: queued " << chain.size() << " objs with tag " << tag
+           << " on " << obj_names[i] << " r=" << r << dendl;
+  return r;
+}
+
+int RGWGC::list(int index, string& marker, uint32_t max,
+                map<string, cls_rgw_gc_obj_info>& entries, bool *truncated)
+{
+  cls_rgw_gc_list_op op;
+  op.marker = marker;
+  op.max = max;
+
+  bufferlist in, out;
+  ::encode(op, in);
+  int r = io_ctx.exec(obj_names[index], "rgw", "gc_list", in, out);
+  if (r < 0)
+    return r;
+
+  cls_rgw_gc_list_ret ret;
+  try {
+    bufferlist::iterator iter = out.begin();
+    ::decode(ret, iter);
+  } catch (buffer::error& err) {
+    return -EIO;
+  }
+  entries.swap(ret.entries);
+  *truncated = ret.truncated;
+  return 0;
+}
+
+/* wait for our turn under rgw_gc_max_removes_per_sec, shared by all workers */
+void RGWGC::throttle()
+{
+  double rate = cct->_conf->rgw_gc_max_removes_per_sec;
+  if (rate <= 0)
+    return;
+
+  utime_t now = ceph_clock_now(cct);
+  utime_t slot;
+  {
+    Mutex::Locker l(throttle_lock);
+    if (next_remove < now)
+      next_remove = now;
+    slot = next_remove;
+    utime_t step;
+    step.set_from_double(1.0 / rate);
+    next_remove += step;
+  }
+  if (slot > now) {
+    utime_t wait = slot - now;
+    usleep(wait.sec() * 1000000 + wait.usec());
+  }
+}
+
+int RGWGC::process(int index, utime_t end)
+{
+  string marker;
+  string id;
+  bool truncated;
+  do {
+    map<string, cls_rgw_gc_obj_info> entries;
+    int r = list(index, marker, 100, entries, &truncated);
+    if (r == -ENOENT)
+      return 0;   // nothing ever queued here
+    if (r < 0) {
+      dout(0) << "gc: failed to list " << obj_names[index] << " r=" << r << dendl;
+      return r;
+    }
+
+    cls_rgw_gc_remove_op rm;
+    map<string, cls_rgw_gc_obj_info>::iterator iter;
+    for (iter = entries.begin(); iter != entries.end(); ++iter) {
+      marker = iter->first;
+      std::list<rgw_obj> chain;
+      try {
+        bufferlist::iterator biter = iter->second.chain.begin();
+        ::decode(chain, biter);
+      } catch (buffer::error& err) {
+        dout(0) << "gc: dropping undecodable entry " << iter->first << " on "
+                << obj_names[index] << dendl;
+        rm.keys.insert(iter->first);
+        continue;
+      }
+
+      bool done = true;
+      std::list<rgw_obj>::iterator liter;
+      for (liter = chain.begin(); liter != chain.end(); ++liter) {
+        if (going_down() || ceph_clock_now(cct) > end) {
+          done = false;
+          truncated = false;
+          break;
+        }
+        throttle();
+        dout(20) << "gc: removing " << *liter << dendl;
+        r = store->delete_obj(NULL, id, *liter, true);
+        if (r < 0 && r != -ENOENT) {
+          dout(0) << "gc: failed to remove " << *liter << " r=" << r << dendl;
+          done = false;  // keep the entry, we'll retry next pass
+        }
+      }
+      if (done)
+        rm.keys.insert(iter->first);
+      if (liter != chain.end())
+        break;
+    }
+
+    if (!rm.keys.empty()) {
+      bufferlist in, out;
+      ::encode(rm, in);
+      r = io_ctx.exec(obj_names[index], "rgw", "gc_remove", in, out);
+      if (r < 0)
+        dout(0) << "gc: failed to trim " << obj_names[index] << " r=" << r << dendl;
+    }
+  } while (truncated);
+
+  return 0;
+}
+
+int RGWGC::process()
+{
+  utime_t end = ceph_clock_now(cct);
+  end += cct->_conf->rgw_gc_processor_max_time;
+
+  int ret = 0;
+  for (int i = 0; i < max_objs && !going_down(); i++) {
+    int r = process(i, end);
+    if (r < 0)
+      ret = r;
+  }
+  return ret;
+}
+
+void *RGWGC::GCWorker::entry()
+{
+  int nthreads = gc->workers.size();
+  dout(2) << "gc: worker " << id << " of " << nthreads << " started" << dendl;
+  while (!gc->going_down()) {
+    utime_t start = ceph_clock_now(gc->cct);
+    utime_t end = start;
+    end += gc->cct->_conf->rgw_gc_processor_max_time;
+    for (int i = id; i < gc->max_objs && !gc->going_down(); i += nthreads)
+      gc->process(i, end);
+
+    utime_t next = start;
+    next += gc->cct->_conf->rgw_gc_processor_period;
+    utime_t now = ceph_clock_now(gc->cct);
+
+    lock.Lock();
+    if (!gc->going_down() && next > now)
+      cond.WaitInterval(gc->cct, lock, next - now);
+    lock.Unlock();
+  }
+  return NULL;
+}
+
+void RGWGC::GCWorker::stop()
+{
+  Mutex::Locker l(lock);
+  cond.Signal();
+}
+
+void RGWGC::start_processor()
+{
+  int n = cct->_conf->rgw_gc_threads;
+  if (n < 1)
+    n = 1;
+  if (n > max_objs)
+    n = max_objs;
+  for (int i = 0; i < n; i++)
+    workers.push_back(new GCWorker(this, i));
+  for (int i = 0; i < n; i++)
+    workers[i]->create();
+}
+
+void RGWGC::stop_processor()
+{
+  down_flag.set(1);
+  for (vector<GCWorker*>::iterator iter = workers.begin(); iter != workers.end(); ++iter) {
+    (*iter)->stop();
+    (*iter)->join();
+    delete *iter;
+  }
+  workers.clear();
+}
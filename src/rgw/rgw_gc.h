@@ -0,0 +1,82 @@
+#ifndef CEPH_RGW_GC_H
+#define CEPH_RGW_GC_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "include/types.h"
+#include "include/atomic.h"
+#include "include/rados/librados.hpp"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "rgw_common.h"
+#include "rgw_cls_api.h"
+
+class RGWRados;
+
+/*
+ * Deferred removal of objects that readers may still be using: the
+ * shadow copies of replaced atomic objects and the parts of removed
+ * manifest objects.  A chain of such objects is queued, as one entry,
+ * on one of rgw_gc_max_objs queue objects, and becomes due
+ * rgw_gc_obj_min_wait seconds later.  Worker threads in the gateway
+ * walk their share of the queues and remove what is due, so the
+ * request that freed the objects never waits for their removal.
+ *
+ * Several gateways may process the same queue at once; removals are
+ * idempotent, so that only costs duplicate work.
+ */
+class RGWGC {
+  CephContext *cct;
+  RGWRados *store;
+  librados::IoCtx io_ctx;
+  int max_objs;
+  std::vector<std::string> obj_names;
+  atomic_t down_flag;
+
+  Mutex throttle_lock;
+  utime_t next_remove;   // when the rate limit lets the next removal start
+
+  class GCWorker : public Thread {
+    RGWGC *gc;
+    int id;
+    Mutex lock;
+    Cond cond;
+  public:
+    GCWorker(RGWGC *_gc, int _id) : gc(_gc), id(_id), lock("GCWorker") {}
+    void *entry();
+    void stop();
+  };
+  std::vector<GCWorker*> workers;
+
+  int tag_index(const std::string& tag);
+  void throttle();
+
+public:
+  RGWGC() : cct(NULL), store(NULL), max_objs(0), throttle_lock("RGWGC::throttle_lock") {}
+  ~RGWGC() {
+    stop_processor();
+  }
+
+  int initialize(CephContext *_cct, RGWRados *_store, librados::IoCtx& _io_ctx);
+
+  /// queue chain for removal; tag must be unique to it
+  int send_chain(std::list<rgw_obj>& chain, const std::string& tag);
+  int list(int index, std::string& marker, uint32_t max,
+           std::map<std::string, cls_rgw_gc_obj_info>& entries, bool *truncated);
+  /// remove what is due on queue index, stopping at end
+  int process(int index, utime_t end);
+  /// one pass over every queue
+  int process();
+
+  bool going_down() {
+    return (down_flag.read() != 0);
+  }
+  void start_processor();
+  void stop_processor();
+};
+
+#endif
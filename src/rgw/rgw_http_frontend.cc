@@ -0,0 +1,560 @@
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "common/debug.h"
+#include "common/config.h"
+
+#include "rgw_http_frontend.h"
+
+#define DOUT_SUBSYS rgw
+
+using namespace std;
+
+#define MAX_HEADER_BYTES   (64 << 10)
+#define OUT_BUF_SIZE       (64 << 10)   // writes at least this big bypass out_buf
+#define MAX_DRAIN_BYTES    (1 << 20)    // unread body we'll skip to keep a connection
+
+static const char *http_reason(int code)
+{
+  switch (code) {
+  case 100: return "Continue";
+  case 200: return "OK";
+  case 201: return "Created";
+  case 202: return "Accepted";
+  case 204: return "No Content";
+  case 206: return "Partial Content";
+  case 301: return "Moved Permanently";
+  case 304: return "Not Modified";
+  case 400: return "Bad Request";
+  case 403: return "Forbidden";
+  case 404: return "Not Found";
+  case 405: return "Method Not Allowed";
+  case 409: return "Conflict";
+  case 411: return "Length Required";
+  case 412: return "Precondition Failed";
+  case 416: return "Requested Range Not Satisfiable";
+  case 500: return "Internal Server Error";
+  case 501: return "Not Implemented";
+  case 503: return "Service Unavailable";
+  default: return "";
+  }
+}
+
+static bool header_is(const string& line, const char *name)
+{
+  size_t len = strlen(name);
+  return line.size() > len && line[len] == ':' && strncasecmp(line.c_str(), name, len) == 0;
+}
+
+static string header_value(const string& line)
+{
+  size_t pos = line.find(':');
+  if (pos == string::npos)
+    return string();
+  pos = line.find_first_not_of(" \t", pos + 1);
+  if (pos == string::npos)
+    return string();
+  size_t end = line.find_last_not_of(" \t");
+  return line.substr(pos, end + 1 - pos);
+}
+
+static bool has_token(string value, const char *token)
+{
+  for (size_t i = 0; i < value.size(); i++)
+    value[i] = tolower(value[i]);
+  return value.find(token) != string::npos;
+}
+
+RGWHTTPClientIO::RGWHTTPClientIO(int _fd, const string& _remote_addr, int port)
+  : fd(_fd), remote_addr(_remote_addr), in_ofs(0),
+    keep_alive(false), http11(false), is_head(false), started(false),
+    chunked_in(false), body_done(true), body_left(0),
+    header_done(false), chunked_out(false), no_body(false)
+{
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%d", port);
+  server_port = buf;
+  envp.push_back(NULL);
+
+  int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  struct timeval tv;
+  tv.tv_sec = g_conf->rgw_frontend_timeout;
+  tv.tv_usec = 0;
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+RGWHTTPClientIO::~RGWHTTPClientIO()
+{
+  ::close(fd);
+}
+
+int RGWHTTPClientIO::recv_some()
+{
+  if (in_ofs > 0 && in_ofs * 2 >= in_buf.size()) {
+    in_buf.erase(0, in_ofs);
+    in_ofs = 0;
+  }
+  char buf[16384];
+  int r;
+  do {
+    r = ::recv(fd, buf, sizeof(buf), 0);
+  } while (r < 0 && errno == EINTR);
+  if (r < 0)
+    return -errno;
+  in_buf.append(buf, r);
+  return r;
+}
+
+/// body bytes: what we have buffered, else straight from the socket
+int RGWHTTPClientIO::read_raw(char *buf, int len)
+{
+  size_t avail = in_buf.size() - in_ofs;
+  if (avail) {
+    if ((size_t)len > avail)
+      len = avail;
+    memcpy(buf, in_buf.data() + in_ofs, len);
+    in_ofs += len;
+    return len;
+  }
+  int r;
+  do {
+    r = ::recv(fd, buf, len, 0);
+  } while (r < 0 && errno == EINTR);
+  return (r < 0 ? -errno : r);
+}
+
+/// 1 with a line (without its line ending), 0 at eof, < 0 on error
+int RGWHTTPClientIO::read_line(string& line)
+{
+  while (true) {
+    size_t pos = in_buf.find('\n', in_ofs);
+    if (pos != string::npos) {
+      size_t end = pos;
+      if (end > in_ofs && in_buf[end - 1] == '\r')
+	end--;
+      line.assign(in_buf, in_ofs, end - in_ofs);
+      in_ofs = pos + 1;
+      return 1;
+    }
+    if (in_buf.size() - in_ofs > MAX_HEADER_BYTES)
+      return -E2BIG;
+    int r = recv_some();
+    if (r <= 0)
+      return r;
+  }
+}
+
+int RGWHTTPClientIO::send_all(const char *buf, size_t len)
+{
+  while (len > 0) {
+    int r = ::send(fd, buf, len, MSG_NOSIGNAL);
+    if (r < 0) {
+      if (errno == EINTR)
+	continue;
+      int err = errno;
+      dout(10) << "http: send to " << remote_addr << " failed: " << err << dendl;
+      keep_alive = false;
+      return -err;
+    }
+    buf += r;
+    len -= r;
+  }
+  return 0;
+}
+
+int RGWHTTPClientIO::flush_out()
+{
+  if (out_buf.empty())
+    return 0;
+  int r = send_all(out_buf.data(), out_buf.size());
+  out_buf.clear();
+  return r;
+}
+
+int RGWHTTPClientIO::send_buf(const char *buf, size_t len)
+{
+  if (len < OUT_BUF_SIZE) {
+    out_buf.append(buf, len);
+    if (out_buf.size() < OUT_BUF_SIZE)
+      return 0;
+    return flush_out();
+  }
+  int r = flush_out();
+  if (r < 0)
+    return r;
+  return send_all(buf, len);
+}
+
+int RGWHTTPClientIO::send_body(const char *buf, size_t len)
+{
+  if (no_body || !len)
+    return 0;
+  if (!chunked_out)
+    return send_buf(buf, len);
+
+  char size[32];
+  int n = snprintf(size, sizeof(size), "%lx\r\n", (unsigned long)len);
+  int r = send_buf(size, n);
+  if (r == 0)
+    r = send_buf(buf, len);
+  if (r == 0)
+    r = send_buf("\r\n", 2);
+  return r;
+}
+
+/// turn the CGI header lines in header_buf into an HTTP response header
+int RGWHTTPClientIO::send_header()
+{
+  int code = 200;
+  bool has_length = false;
+  string out;
+  size_t pos = 0;
+  while (pos < header_buf.size()) {
+    size_t end = header_buf.find('\n', pos);
+    if (end == string::npos)
+      end = header_buf.size();
+    string line = header_buf.substr(pos, end - pos);
+    pos = end + 1;
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.resize(line.size() - 1);
+    if (line.empty())
+      continue;
+    if (header_is(line, "Status")) {
+      code = atoi(header_value(line).c_str());
+      continue;
+    }
+    if (header_is(line, "Content-Length"))
+      has_length = true;
+    out += line;
+    out += "\r\n";
+  }
+
+  no_body = is_head || code < 200 || code == 204 || code == 304;
+  if (!no_body && !has_length) {
+    if (http11) {
+      chunked_out = true;
+      out += "Transfer-Encoding: chunked\r\n";
+    } else {
+      keep_alive = false;   // the body ends when we close
+    }
+  }
+  if (!keep_alive)
+    out += "Connection: close\r\n";
+  else if (!http11)
+    out += "Connection: keep-alive\r\n";
+  out += "\r\n";
+
+  char status[64];
+  snprintf(status, sizeof(status), "HTTP/1.1 %d %s\r\n", code, http_reason(code));
+  header_done = true;
+  header_buf.clear();
+  int r = send_buf(status, strlen(status));
+  if (r == 0)
+    r = send_buf(out.data(), out.size());
+  return r;
+}
+
+void RGWHTTPClientIO::send_error(int status, const char *text)
+{
+  char buf[128];
+  int n = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+		   status, text);
+  keep_alive = false;
+  send_all(buf, n);
+}
+
+int RGWHTTPClientIO::write(const char *buf, int len)
+{
+  if (header_done)
+    return (send_body(buf, len) < 0 ? -1 : len);
+
+  header_buf.append(buf, len);
+  size_t end = header_buf.find("\n\n");
+  size_t crlf_end = header_buf.find("\n\r\n");
+  size_t skip = 2;
+  if (crlf_end != string::npos && (end == string::npos || crlf_end < end)) {
+    end = crlf_end;
+    skip = 3;
+  }
+  if (end == string::npos)
+    return len;
+
+  string rest = header_buf.substr(end + skip);
+  header_buf.resize(end + 1);
+  if (send_header() < 0 || send_body(rest.data(), rest.size()) < 0)
+    return -1;
+  return len;
+}
+
+int RGWHTTPClientIO::read(char *buf, int len)
+{
+  int total = 0;
+  while (total < len && !body_done) {
+    if (chunked_in && body_left == 0) {
+      string line;
+      if (read_line(line) <= 0) {
+	keep_alive = false;
+	body_done = true;
+	break;
+      }
+      body_left = strtoull(line.c_str(), NULL, 16);
+      if (body_left == 0) {
+	// skip any trailers
+	while (read_line(line) > 0 && !line.empty())
+	  ;
+	body_done = true;
+	break;
+      }
+    }
+    int want = len - total;
+    if ((uint64_t)want > body_left)
+      want = body_left;
+    int r = read_raw(buf + total, want);
+    if (r <= 0) {
+      dout(10) << "http: body from " << remote_addr << " ended early: " << r << dendl;
+      keep_alive = false;
+      body_done = true;
+      break;
+    }
+    total += r;
+    body_left -= r;
+    if (body_left == 0) {
+      if (chunked_in) {
+	string crlf;
+	read_line(crlf);
+      } else {
+	body_done = true;
+      }
+    }
+  }
+  return total;
+}
+
+void RGWHTTPClientIO::flush()
+{
+  // the only thing flushed before the header is "Status: 100" (dump_continue)
+  if (!header_done) {
+    if (header_buf.compare(0, 11, "Status: 100") == 0) {
+      if (http11)
+	send_all("HTTP/1.1 100 Continue\r\n\r\n", 25);
+      header_buf.clear();
+    }
+    return;
+  }
+  flush_out();
+}
+
+int RGWHTTPClientIO::parse_request(const string& request_line)
+{
+  size_t sp1 = request_line.find(' ');
+  size_t sp2 = request_line.rfind(' ');
+  if (sp1 == string::npos || sp2 == sp1)
+    return -EINVAL;
+  string method = request_line.substr(0, sp1);
+  string uri = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+  string version = request_line.substr(sp2 + 1);
+  if (version.compare(0, 5, "HTTP/") != 0)
+    return -EINVAL;
+  http11 = (version != "HTTP/1.0");
+  is_head = (method == "HEAD");
+
+  string path = uri, query;
+  size_t q = uri.find('?');
+  if (q != string::npos) {
+    path = uri.substr(0, q);
+    query = uri.substr(q + 1);
+  }
+  env.push_back("REQUEST_METHOD=" + method);
+  env.push_back("REQUEST_URI=" + uri);
+  env.push_back("SCRIPT_NAME=" + path);
+  env.push_back("QUERY_STRING=" + query);
+  env.push_back("SERVER_PROTOCOL=" + version);
+  env.push_back("SERVER_PORT=" + server_port);
+  env.push_back("REMOTE_ADDR=" + remote_addr);
+
+  bool conn_close = false, conn_keep_alive = false;
+  uint64_t content_length = 0;
+  int total = request_line.size();
+  string line;
+  while (true) {
+    int r = read_line(line);
+    if (r <= 0)
+      return (r < 0 ? r : -EPIPE);
+    if (line.empty())
+      break;
+    total += line.size();
+    if (total > MAX_HEADER_BYTES)
+      return -E2BIG;
+
+    size_t colon = line.find(':');
+    if (colon == string::npos || colon == 0)
+      return -EINVAL;
+    string value = header_value(line);
+    string name;
+    if (header_is(line, "Content-Length")) {
+      name = "CONTENT_LENGTH";
+      content_length = strtoull(value.c_str(), NULL, 10);
+    } else if (header_is(line, "Content-Type")) {
+      name = "CONTENT_TYPE";
+    } else {
+      name = "HTTP_";
+      for (size_t i = 0; i < colon; i++)
+	name += (line[i] == '-' ? '_' : toupper(line[i]));
+      if (header_is(line, "Connection")) {
+	conn_close = has_token(value, "close");
+	conn_keep_alive = has_token(value, "keep-alive");
+      } else if (header_is(line, "Transfer-Encoding")) {
+	chunked_in = has_token(value, "chunked");
+      }
+    }
+    env.push_back(name + "=" + value);
+  }
+
+  keep_alive = http11 ? !conn_close : conn_keep_alive;
+  if (chunked_in) {
+    body_left = 0;
+    body_done = false;
+  } else {
+    body_left = content_length;
+    body_done = (content_length == 0);
+  }
+
+  envp.clear();
+  for (vector<string>::iterator iter = env.begin(); iter != env.end(); ++iter)
+    envp.push_back((char *)iter->c_str());
+  envp.push_back(NULL);
+  return 0;
+}
+
+bool RGWHTTPClientIO::next_request()
+{
+  if (started && !keep_alive)
+    return false;
+  started = true;
+
+  env.clear();
+  envp.clear();
+  envp.push_back(NULL);
+  chunked_in = false;
+  body_done = true;
+  body_left = 0;
+  header_done = chunked_out = no_body = false;
+  header_buf.clear();
+  keep_alive = false;
+
+  // tolerate stray line endings between requests
+  string line;
+  int r;
+  do {
+    r = read_line(line);
+  } while (r > 0 && line.empty());
+  if (r <= 0) {
+    if (r == -E2BIG)
+      send_error(400, "Bad Request");
+    return false;   // closed, idle too long, or garbage
+  }
+
+  r = parse_request(line);
+  if (r < 0) {
+    dout(10) << "http: bad request from " << remote_addr << ": " << r << dendl;
+    if (r != -EPIPE && r != -EAGAIN)
+      send_error(400, "Bad Request");
+    return false;
+  }
+  return true;
+}
+
+void RGWHTTPClientIO::finish_request()
+{
+  if (!header_done) {
+    if (header_buf.empty()) {
+      send_error(500, "Internal Server Error");
+      return;
+    }
+    write("\n\n", 2);
+  }
+  if (chunked_out)
+    send_buf("0\r\n\r\n", 5);
+  flush_out();
+
+  // skip whatever of the body the handler didn't read
+  if (keep_alive && !body_done) {
+    char buf[16384];
+    uint64_t drained = 0;
+    while (!body_done && drained < MAX_DRAIN_BYTES)
+      drained += read(buf, sizeof(buf));
+    if (!body_done)
+      keep_alive = false;
+  }
+}
+
+RGWHTTPFrontend::~RGWHTTPFrontend()
+{
+  if (listen_fd >= 0)
+    ::close(listen_fd);
+}
+
+int RGWHTTPFrontend::init(const string& addr, int _port)
+{
+  port = _port;
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  if (addr.empty()) {
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+  } else if (inet_pton(AF_INET, addr.c_str(), &sa.sin_addr) != 1) {
+    dout(0) << "ERROR: bad rgw frontend addr '" << addr << "'" << dendl;
+    return -EINVAL;
+  }
+
+  listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    return -errno;
+  int one = 1;
+  ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (::bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+      ::listen(listen_fd, 128) < 0) {
+    int err = errno;
+    dout(0) << "ERROR: unable to listen on " << addr << ":" << port << ": " << err << dendl;
+    ::close(listen_fd);
+    listen_fd = -1;
+    return -err;
+  }
+  dout(0) << "listening for http on " << (addr.empty() ? "*" : addr) << ":" << port << dendl;
+  return 0;
+}
+
+RGWClientIO *RGWHTTPFrontend::accept()
+{
+  struct pollfd pfd;
+  pfd.fd = listen_fd;
+  pfd.events = POLLIN;
+  if (::poll(&pfd, 1, 1000) <= 0)
+    return NULL;
+
+  struct sockaddr_in sa;
+  socklen_t len = sizeof(sa);
+  int fd = ::accept(listen_fd, (struct sockaddr *)&sa, &len);
+  if (fd < 0) {
+    dout(10) << "accept failed: " << errno << dendl;
+    return NULL;
+  }
+  char host[INET_ADDRSTRLEN];
+  if (!inet_ntop(AF_INET, &sa.sin_addr, host, sizeof(host)))
+    host[0] = '\0';
+  return new RGWHTTPClientIO(fd, host, port);
+}
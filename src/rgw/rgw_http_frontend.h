@@ -0,0 +1,77 @@
+#ifndef CEPH_RGW_HTTP_FRONTEND_H
+#define CEPH_RGW_HTTP_FRONTEND_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "rgw_client_io.h"
+
+/*
+ * radosgw serving HTTP/1.1 itself, with no web server and FastCGI hop
+ * in front of it.  Each accepted connection is one RGWHTTPClientIO,
+ * which parses requests into a CGI environment and translates the
+ * CGI-style responses the handlers write back into HTTP.
+ *
+ * Connections are kept alive unless the client asks otherwise.
+ * Request bodies may be chunked; response bodies without a
+ * Content-Length are sent chunked.  Large body writes go straight to
+ * the socket without being copied; small writes are coalesced.
+ */
+class RGWHTTPClientIO : public RGWClientIO {
+  int fd;
+  std::string remote_addr, server_port;
+
+  // current request
+  std::string in_buf;         // read from the socket, not yet consumed
+  size_t in_ofs;
+  std::vector<std::string> env;
+  std::vector<char *> envp;
+  bool keep_alive, http11, is_head, started;
+  bool chunked_in, body_done;
+  uint64_t body_left;          // of the body, or of the current chunk
+
+  // current response
+  bool header_done, chunked_out, no_body;
+  std::string header_buf;
+  std::string out_buf;
+
+  int recv_some();
+  int read_raw(char *buf, int len);
+  int read_line(std::string& line);
+  int send_all(const char *buf, size_t len);
+  int send_buf(const char *buf, size_t len);
+  int flush_out();
+  int send_body(const char *buf, size_t len);
+  int send_header();
+  void send_error(int status, const char *text);
+  int parse_request(const std::string& head);
+
+public:
+  RGWHTTPClientIO(int _fd, const std::string& _remote_addr, int port);
+  ~RGWHTTPClientIO();
+
+  bool next_request();
+  void finish_request();
+  char **get_env() {
+    return &envp[0];
+  }
+  int write(const char *buf, int len);
+  int read(char *buf, int len);
+  void flush();
+};
+
+class RGWHTTPFrontend {
+  int listen_fd;
+  int port;
+public:
+  RGWHTTPFrontend() : listen_fd(-1), port(0) {}
+  ~RGWHTTPFrontend();
+
+  /// start listening on addr (empty for any) and port
+  int init(const std::string& addr, int _port);
+  /// wait up to a second for a connection; NULL if none (or on error)
+  RGWClientIO *accept();
+};
+
+#endif
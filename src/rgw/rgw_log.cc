@@ -1,4 +1,7 @@
 #include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/Thread.h"
+#include "include/ceph_hash.h"
 
 #include "rgw_log.h"
 #include "rgw_acl.h"
@@ -8,6 +11,119 @@
 
 static rgw_bucket log_bucket(RGW_LOG_POOL_NAME);
 
+static int log_append(rgw_bucket& pool, rgw_obj& obj, bufferlist& bl)
+{
+  int ret = rgwstore->append_async(obj, bl.length(), bl);
+  if (ret == -ENOENT) {
+    string id;
+    map<std::string, bufferlist> attrs;
+    ret = rgwstore->create_bucket(id, pool, attrs, true);
+    if (ret < 0)
+      return ret;
+    // retry
+    ret = rgwstore->append_async(obj, bl.length(), bl);
+  }
+  return ret;
+}
+
+/*
+ * Log entries for each log object accumulate here and go out as one
+ * append when rgw_log_flush_interval has passed or rgw_log_flush_bytes
+ * are pending, instead of one append per request.  Entries still in
+ * the buffer are lost if the gateway dies.
+ */
+class RGWLogBuffer : public Thread {
+  struct Pending {
+    rgw_bucket pool;
+    rgw_obj obj;
+    bufferlist bl;
+  };
+
+  Mutex lock;
+  Cond cond;
+  map<string, Pending> pending;   // by pool/oid
+  uint64_t pending_bytes;
+  bool started, stopping;
+
+  void flush(map<string, Pending>& batch) {
+    for (map<string, Pending>::iterator iter = batch.begin(); iter != batch.end(); ++iter) {
+      Pending& p = iter->second;
+      int ret = log_append(p.pool, p.obj, p.bl);
+      if (ret < 0)
+        dout(0) << "failed to log " << p.bl.length() << " bytes to " << p.obj << ": ret=" << ret << dendl;
+    }
+  }
+
+  void *entry() {
+    lock.Lock();
+    while (!stopping || !pending.empty()) {
+      if (!stopping && pending_bytes < (uint64_t)g_conf->rgw_log_flush_bytes) {
+        utime_t interval;
+        interval.set_from_double(g_conf->rgw_log_flush_interval);
+        cond.WaitInterval(g_ceph_context, lock, interval);
+      }
+      map<string, Pending> batch;
+      batch.swap(pending);
+      pending_bytes = 0;
+      lock.Unlock();
+      flush(batch);
+      lock.Lock();
+    }
+    lock.Unlock();
+    return NULL;
+  }
+
+public:
+  RGWLogBuffer() : lock("RGWLogBuffer::lock"), pending_bytes(0), started(false), stopping(false) {}
+
+  void append(rgw_bucket& pool, rgw_obj& obj, bufferlist& bl) {
+    Mutex::Locker l(lock);
+    if (!started) {
+      create();
+      started = true;
+    }
+    string key = pool.name + "/" + obj.object;
+    map<string, Pending>::iterator iter = pending.find(key);
+    if (iter == pending.end()) {
+      Pending& p = pending[key];
+      p.pool = pool;
+      p.obj = obj;
+      iter = pending.find(key);
+    }
+    pending_bytes += bl.length();
+    iter->second.bl.claim_append(bl);
+    if (pending_bytes >= (uint64_t)g_conf->rgw_log_flush_bytes)
+      cond.Signal();
+  }
+
+  void shutdown() {
+    lock.Lock();
+    if (!started) {
+      lock.Unlock();
+      return;
+    }
+    stopping = true;
+    cond.Signal();
+    lock.Unlock();
+    join();
+  }
+};
+
+static RGWLogBuffer log_buffer;
+
+static int log_submit(rgw_bucket& pool, rgw_obj& obj, bufferlist& bl)
+{
+  if (g_conf->rgw_log_flush_interval <= 0)
+    return log_append(pool, obj, bl);
+  log_buffer.append(pool, obj, bl);
+  return 0;
+}
+
+void rgw_log_shutdown()
+{
+  log_buffer.shutdown();
+}
+
 static void set_param_str(struct req_state *s, const char *name, string& str)
 {
   const char *p = s->env->get(name);
@@ -16,7 +132,8 @@ static void set_param_str(struct req_state *s, const char *name, string& str)
 }
 
 string render_log_object_name(const string& format,
-			      struct tm *dt, int64_t bucket_id, const string& bucket_name)
+			      struct tm *dt, int64_t bucket_id, const string& bucket_name,
+			      unsigned shard)
 {
   string o;
   for (unsigned i=0; i<format.size(); i++) {
@@ -61,6 +178,9 @@ string render_log_object_name(const string& format,
       case 'n':
 	o += bucket_name;
 	continue;
+      case 's':
+	sprintf(buf, "%u", shard);
+	break;
       default:
 	// unknown code
 	sprintf(buf, "%%%c", format[i]);
@@ -142,22 +262,16 @@ int rgw_log_op(struct req_state *s)
   else
     localtime_r(&t, &bdt);
   
+  // spread a busy bucket's entries over rgw_log_object_shards objects
+  unsigned shard = 0;
+  if (g_conf->rgw_log_object_shards > 1)
+    shard = ceph_str_hash_linux(entry.obj.c_str(), entry.obj.size()) % g_conf->rgw_log_object_shards;
   string oid = render_log_object_name(g_conf->rgw_log_object_name, &bdt,
-				      s->bucket.bucket_id, entry.bucket.c_str());
+				      s->bucket.bucket_id, entry.bucket.c_str(), shard);
 
   rgw_obj obj(log_bucket, oid);
 
-  int ret = rgwstore->append_async(obj, bl.length(), bl);
-  if (ret == -ENOENT) {
-    string id;
-    map<std::string, bufferlist> attrs;
-    ret = rgwstore->create_bucket(id, log_bucket, attrs, true);
-    if (ret < 0)
-      goto done;
-    // retry
-    ret = rgwstore->append_async(obj, bl.length(), bl);
-  }
-done:
+  int ret = log_submit(log_bucket, obj, bl);
   if (ret < 0)
     dout(0) << "failed to log entry" << dendl;
 
@@ -189,16 +303,5 @@ int rgw_log_intent(struct req_state *s, rgw_obj& obj, RGWIntentEvent intent)
   bufferlist bl;
   ::encode(entry, bl);
 
-  int ret = rgwstore->append_async(log_obj, bl.length(), bl);
-  if (ret == -ENOENT) {
-    string id;
-    map<std::string, bufferlist> attrs;
-    ret = rgwstore->create_bucket(id, intent_log_bucket, attrs, true);
-    if (ret < 0)
-      goto done;
-    ret = rgwstore->append_async(log_obj, bl.length(), bl);
-  }
-
-done:
-  return ret;
+  return log_submit(intent_log_bucket, log_obj, bl);
 }
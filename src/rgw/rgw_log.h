@@ -113,6 +113,8 @@ WRITE_CLASS_ENCODER(rgw_intent_log_entry)
 
 int rgw_log_op(struct req_state *s);
 int rgw_log_intent(struct req_state *s, rgw_obj& obj, RGWIntentEvent intent);
+/// flush buffered log entries and stop the flusher
+void rgw_log_shutdown();
 
 #endif
 
@@ -31,6 +31,7 @@
 #include "rgw_rest.h"
 #include "rgw_swift.h"
 #include "rgw_log.h"
+#include "rgw_http_frontend.h"
 
 #include <map>
 #include <string>
@@ -51,9 +52,12 @@ static sighandler_t sighandler_alrm;
 
 #define SOCKET_BACKLOG 20
 
+static volatile sig_atomic_t shutdown_pending = 0;
+
 static void godown_handler(int signum)
 {
   FCGX_ShutdownPending();
+  shutdown_pending = 1;
   signal(signum, sighandler_usr1);
   alarm(5);
 }
@@ -64,64 +68,80 @@ static void godown_alarm(int signum)
 }
 
 class RGWProcess {
-  deque<FCGX_Request *> m_fcgx_queue;
+  deque<RGWClientIO *> m_req_queue;
   ThreadPool m_tp;
 
-  struct RGWWQ : public ThreadPool::WorkQueue<FCGX_Request> {
+  struct RGWWQ : public ThreadPool::WorkQueue<RGWClientIO> {
     RGWProcess *process;
     RGWWQ(RGWProcess *p, time_t timeout, time_t suicide_timeout, ThreadPool *tp)
-      : ThreadPool::WorkQueue<FCGX_Request>("RGWWQ", timeout, suicide_timeout, tp), process(p) {}
+      : ThreadPool::WorkQueue<RGWClientIO>("RGWWQ", timeout, suicide_timeout, tp), process(p) {}
 
-    bool _enqueue(FCGX_Request *req) {
-      process->m_fcgx_queue.push_back(req);
-      dout(20) << "enqueued request fcgx=" << hex << req << dec << dendl;
+    bool _enqueue(RGWClientIO *cio) {
+      process->m_req_queue.push_back(cio);
+      dout(20) << "enqueued request cio=" << hex << cio << dec << dendl;
       _dump_queue();
       return true;
     }
-    void _dequeue(FCGX_Request *req) {
+    void _dequeue(RGWClientIO *cio) {
       assert(0);
     }
     bool _empty() {
-      return process->m_fcgx_queue.empty();
+      return process->m_req_queue.empty();
     }
-    FCGX_Request *_dequeue() {
-      if (process->m_fcgx_queue.empty())
+    RGWClientIO *_dequeue() {
+      if (process->m_req_queue.empty())
 	return NULL;
-      FCGX_Request *req = process->m_fcgx_queue.front();
-      process->m_fcgx_queue.pop_front();
-      dout(20) << "dequeued request fcgx=" << hex << req << dec << dendl;
+      RGWClientIO *cio = process->m_req_queue.front();
+      process->m_req_queue.pop_front();
+      dout(20) << "dequeued request cio=" << hex << cio << dec << dendl;
       _dump_queue();
-      return req;
+      return cio;
     }
-    void _process(FCGX_Request *fcgx) {
-      process->handle_request(fcgx);
+    void _process(RGWClientIO *cio) {
+      // a kept-alive http connection keeps this thread for its requests
+      while (cio->next_request()) {
+	process->handle_request(cio);
+	cio->finish_request();
+      }
+      delete cio;
     }
     void _dump_queue() {
-      deque<FCGX_Request *>::iterator iter;
-      if (process->m_fcgx_queue.size() == 0) {
+      deque<RGWClientIO *>::iterator iter;
+      if (process->m_req_queue.size() == 0) {
         dout(20) << "RGWWQ: empty" << dendl;
         return;
       }
       dout(20) << "RGWWQ:" << dendl;
-      for (iter = process->m_fcgx_queue.begin(); iter != process->m_fcgx_queue.end(); ++iter) {
-        dout(20) << "fcgx: " << hex << *iter << dec << dendl;
+      for (iter = process->m_req_queue.begin(); iter != process->m_req_queue.end(); ++iter) {
+        dout(20) << "cio: " << hex << *iter << dec << dendl;
       }
     }
     void _clear() {
-      assert(process->m_fcgx_queue.empty());
+      assert(process->m_req_queue.empty());
     }
   } req_wq;
 
+  void run_fcgi();
+  void run_http();
+
 public:
   RGWProcess(CephContext *cct, int num_threads)
     : m_tp(cct, "RGWProcess::m_tp", num_threads),
       req_wq(this, g_conf->rgw_op_thread_timeout,
 	     g_conf->rgw_op_thread_suicide_timeout, &m_tp) {}
   void run();
-  void handle_request(FCGX_Request *fcgx);
+  void handle_request(RGWClientIO *cio);
 };
 
 void RGWProcess::run()
+{
+  if (g_conf->rgw_frontend_port > 0)
+    run_http();
+  else
+    run_fcgi();
+}
+
+void RGWProcess::run_fcgi()
 {
   int s = 0;
   if (!g_conf->rgw_socket_path.empty()) {
@@ -144,10 +164,29 @@ void RGWProcess::run()
     dout(10) << "allocated request fcgx=" << hex << fcgx << dec << dendl;
     FCGX_InitRequest(fcgx, s, 0);
     int ret = FCGX_Accept_r(fcgx);
-    if (ret < 0)
+    if (ret < 0) {
+      delete fcgx;
       break;
+    }
 
-    req_wq.queue(fcgx);
+    req_wq.queue(new RGWFCGX(fcgx));
+  }
+
+  m_tp.stop();
+}
+
+void RGWProcess::run_http()
+{
+  RGWHTTPFrontend frontend;
+  if (frontend.init(g_conf->rgw_frontend_addr, g_conf->rgw_frontend_port) < 0)
+    return;
+
+  m_tp.start();
+
+  while (!shutdown_pending) {
+    RGWClientIO *cio = frontend.accept();
+    if (cio)
+      req_wq.queue(cio);
   }
 
   m_tp.stop();
@@ -159,15 +198,15 @@ static int call_log_intent(void *ctx, rgw_obj& obj, RGWIntentEvent intent)
   return rgw_log_intent(s, obj, intent);
 }
 
-void RGWProcess::handle_request(FCGX_Request *fcgx)
+void RGWProcess::handle_request(RGWClientIO *cio)
 {
   RGWRESTMgr rest;
   int ret;
   RGWEnv rgw_env;
 
-  dout(0) << "====== starting new request fcgx=" << hex << fcgx << dec << " =====" << dendl;
+  dout(0) << "====== starting new request cio=" << hex << cio << dec << " =====" << dendl;
 
-  rgw_env.init(fcgx->envp);
+  rgw_env.init(cio->get_env());
 
   struct req_state *s = new req_state(&rgw_env);
   s->obj_ctx = rgwstore->create_context(s);
@@ -175,7 +214,7 @@ void RGWProcess::handle_request(FCGX_Request *fcgx)
 
   RGWOp *op = NULL;
   int init_error = 0;
-  RGWHandler *handler = rest.get_handler(s, fcgx, &init_error);
+  RGWHandler *handler = rest.get_handler(s, cio, &init_error);
 
   if (init_error != 0) {
     abort_early(s, init_error);
@@ -221,10 +260,8 @@ done:
   handler->put_op(op);
   rgwstore->destroy_context(s->obj_ctx);
   delete s;
-  FCGX_Finish_r(fcgx);
-  delete fcgx;
 
-  dout(0) << "====== req done fcgx=" << hex << fcgx << dec << " http_status=" << http_ret << " ======" << dendl;
+  dout(0) << "====== req done cio=" << hex << cio << dec << " http_status=" << http_ret << " ======" << dendl;
 }
 
 /*
@@ -250,8 +287,8 @@ int main(int argc, const char **argv)
 
   pid_t childpid = 0;
   if (g_conf->daemonize) {
-    if (g_conf->rgw_socket_path.empty()) {
-      cerr << "radosgw: must specify 'rgw socket path' to run as a daemon" << std::endl;
+    if (g_conf->rgw_socket_path.empty() && g_conf->rgw_frontend_port <= 0) {
+      cerr << "radosgw: must specify 'rgw socket path' or 'rgw frontend port' to run as a daemon" << std::endl;
       exit(1);
     }
     childpid = fork();
@@ -287,9 +324,16 @@ int main(int argc, const char **argv)
     return EIO;
   }
   
+  if (g_conf->rgw_enable_gc_threads)
+    rgwstore->start_gc();
+
   RGWProcess process(g_ceph_context, g_conf->rgw_thread_pool_size);
   process.run();
 
+  rgwstore->stop_gc();
+  rgw_log_shutdown();
+  rgw_swift_shutdown();
+
   return 0;
 }
 
@@ -145,9 +145,8 @@ static int get_policy_from_attr(void *ctx, RGWAccessControlPolicy *policy, rgw_o
     ret = rgwstore->get_attr(ctx, obj, RGW_ATTR_ACL, bl);
 
     if (ret >= 0) {
-      bufferlist::iterator iter = bl.begin();
       try {
-        policy->decode(iter);
+        rgw_policy_cache.decode(g_ceph_context, bl, policy);
       } catch (buffer::error& err) {
         dout(0) << "error: could not decode policy, caught buffer::error" << dendl;
         return -EIO;
@@ -564,6 +563,7 @@ void RGWDeleteBucket::execute()
 
 struct put_obj_aio_info {
   void *data;
+  size_t len;
   void *handle;
 };
 
@@ -592,6 +592,15 @@ static bool pending_has_completed(std::list<struct put_obj_aio_info>& pending)
   return rgwstore->aio_completed(info.handle);
 }
 
+static uint64_t pending_bytes(std::list<struct put_obj_aio_info>& pending)
+{
+  uint64_t bytes = 0;
+  for (std::list<struct put_obj_aio_info>::iterator iter = pending.begin();
+       iter != pending.end(); ++iter)
+    bytes += iter->len;
+  return bytes;
+}
+
 static int drain_pending(std::list<struct put_obj_aio_info>& pending)
 {
   int ret = 0;
@@ -617,7 +626,8 @@ void RGWPutObj::execute()
   string multipart_meta_obj;
   string part_num;
   list<struct put_obj_aio_info> pending;
-  size_t max_chunks = RGW_MAX_PENDING_CHUNKS;
+  size_t max_chunks = MAX(g_conf->rgw_put_obj_window, 1);
+  uint64_t max_bytes = g_conf->rgw_put_obj_window_bytes;
   bool created_obj = false;
   rgw_obj obj;
 
@@ -696,7 +706,6 @@ void RGWPutObj::execute()
       }
       if (len > 0) {
         struct put_obj_aio_info info;
-        size_t orig_size;
 	// For the first call to put_obj_data, pass -1 as the offset to
 	// do a write_full.
         void *handle;
@@ -711,20 +720,19 @@ void RGWPutObj::execute()
         hash.Update((unsigned char *)data, len);
         info.handle = handle;
         info.data = data;
+        info.len = len;
+        data = NULL;
         pending.push_back(info);
-        orig_size = pending.size();
         while (pending_has_completed(pending)) {
           ret = wait_pending_front(pending);
           if (ret < 0)
             goto done_err;
-
         }
 
-        /* resize window in case messages are draining too fast */
-        if (orig_size - pending.size() >= max_chunks)
-          max_chunks++;
-
-        if (pending.size() > max_chunks) {
+        /* keep reading from the client while the window has room; the
+         * oldest write is the one to wait for when it doesn't */
+        while (pending.size() > max_chunks ||
+               (max_bytes && pending.size() > 1 && pending_bytes(pending) > max_bytes)) {
           ret = wait_pending_front(pending);
           if (ret < 0)
             goto done_err;
@@ -732,7 +740,9 @@ void RGWPutObj::execute()
         ofs += len;
       }
     } while ( len > 0);
-    drain_pending(pending);
+    ret = drain_pending(pending);
+    if (ret < 0)
+      goto done_err;
 
     if ((uint64_t)ofs != s->content_length) {
       ret = -ERR_REQUEST_TIMEOUT;
@@ -808,9 +818,10 @@ done:
   return;
 
 done_err:
+  // let the writes land first, or they could bring the object back
+  drain_pending(pending);
   if (created_obj)
     rgwstore->delete_obj(s->obj_ctx, s->user.user_id, obj);
-  drain_pending(pending);
   send_response();
 }
 
@@ -1340,7 +1351,7 @@ void RGWCompleteMultipart::execute()
   rgw_obj meta_obj;
   rgw_obj target_obj;
   RGWMPObj mp;
-  vector<RGWCloneRangeInfo> ranges;
+  RGWObjManifest manifest;
 
 
   ret = get_params();
@@ -1410,33 +1421,25 @@ void RGWCompleteMultipart::execute()
 
   target_obj.init(s->bucket, s->object_str);
   rgwstore->set_atomic(s->obj_ctx, target_obj);
-  ret = rgwstore->put_obj_meta(s->obj_ctx, s->user.user_id, target_obj, 0, NULL, attrs, RGW_OBJ_CATEGORY_MAIN, false, NULL);
-  if (ret < 0)
-    goto done;
-  
+
+  // the target points at the parts, which stay where they are
   for (obj_iter = obj_parts.begin(); obj_iter != obj_parts.end(); ++obj_iter) {
+    if (!obj_iter->second.size)
+      continue;
     string oid = mp.get_part(obj_iter->second.num);
-    rgw_obj src_obj(s->bucket, oid, s->object_str, mp_ns);
-
-    RGWCloneRangeInfo range;
-    range.src = src_obj;
-    range.src_ofs = 0;
-    range.dst_ofs = ofs;
-    range.len = obj_iter->second.size;
-    ranges.push_back(range);
+    RGWObjManifestPart& part = manifest.objs[ofs];
+    part.loc = rgw_obj(s->bucket, oid, s->object_str, mp_ns);
+    part.loc_ofs = 0;
+    part.size = obj_iter->second.size;
 
     ofs += obj_iter->second.size;
   }
-  ret = rgwstore->clone_objs(s->obj_ctx, target_obj, ranges, attrs, RGW_OBJ_CATEGORY_MAIN, NULL, true, false);
+  manifest.obj_size = ofs;
+
+  ret = rgwstore->put_obj_manifest(s->obj_ctx, s->user.user_id, target_obj, manifest, attrs, RGW_OBJ_CATEGORY_MAIN);
   if (ret < 0)
     goto done;
 
-  // now erase all parts
-  for (obj_iter = obj_parts.begin(); obj_iter != obj_parts.end(); ++obj_iter) {
-    string oid = mp.get_part(obj_iter->second.num);
-    rgw_obj obj(s->bucket, oid, s->object_str, mp_ns);
-    rgwstore->delete_obj(s->obj_ctx, s->user.user_id, obj);
-  }
   // and also remove the metadata obj
   meta_obj.init(s->bucket, meta_oid, s->object_str, mp_ns);
   rgwstore->delete_obj(s->obj_ctx, s->user.user_id, meta_obj);
@@ -1570,13 +1573,14 @@ done:
   send_response();
 }
 
-int RGWHandler::init(struct req_state *_s, FCGX_Request *fcgx)
+int RGWHandler::init(struct req_state *_s, RGWClientIO *cio)
 {
   s = _s;
 
   if (g_conf->debug_rgw >= 20) {
     char *p;
-    for (int i=0; (p = fcgx->envp[i]); ++i) {
+    char **envp = cio->get_env();
+    for (int i=0; (p = envp[i]); ++i) {
       dout(20) << p << dendl;
     }
   }
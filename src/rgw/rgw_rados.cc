@@ -13,6 +13,7 @@
 #include "rgw_tools.h"
 
 #include "common/Clock.h"
+#include "include/ceph_hash.h"
 
 #include "include/rados/librados.hpp"
 using namespace librados;
@@ -25,6 +26,7 @@ using namespace librados;
 #include "auth/Crypto.h" // get_random_bytes()
 
 #include "rgw_log.h"
+#include "rgw_gc.h"
 
 #define DOUT_SUBSYS rgw
 
@@ -73,6 +75,39 @@ static void get_obj_bucket_and_oid_key(rgw_obj& obj, rgw_bucket& bucket, string&
   prepend_bucket_marker(bucket, obj.key, key);
 }
 
+/*
+ * A bucket's index is one object, .dir.<marker>, or with num_shards
+ * set, that many objects .dir.<marker>.<n>, each holding the entries
+ * whose names hash to it.
+ */
+static void get_bucket_index_oids(rgw_bucket& bucket, vector<string>& oids)
+{
+  string oid = dir_oid_prefix;
+  oid.append(bucket.marker);
+  oids.clear();
+  if (!bucket.num_shards) {
+    oids.push_back(oid);
+    return;
+  }
+  for (uint32_t i = 0; i < bucket.num_shards; i++) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), ".%u", i);
+    oids.push_back(oid + buf);
+  }
+}
+
+static void get_bucket_index_oid(rgw_bucket& bucket, const string& name, string& oid)
+{
+  oid = dir_oid_prefix;
+  oid.append(bucket.marker);
+  if (!bucket.num_shards)
+    return;
+  char buf[16];
+  snprintf(buf, sizeof(buf), ".%u",
+           ceph_str_hash_linux(name.c_str(), name.size()) % bucket.num_shards);
+  oid.append(buf);
+}
+
 
 /** 
  * Initialize the RADOS instance and prepare to do other ops
@@ -97,9 +132,55 @@ int RGWRados::initialize(CephContext *cct)
   if (ret < 0)
     return ret;
 
+  if (cct->_conf->rgw_enable_gc) {
+    // without gc, removals fall back to the intent log
+    int r = init_gc(cct);
+    if (r < 0)
+      dout(0) << "WARNING: couldn't set up gc, r=" << r << dendl;
+  }
+
   return ret;
 }
 
+int RGWRados::init_gc(CephContext *cct)
+{
+  librados::IoCtx gc_pool_ctx;
+  int r = rados->ioctx_create(RGW_GC_BUCKET, gc_pool_ctx);
+  if (r == -ENOENT) {
+    r = rados->pool_create(RGW_GC_BUCKET);
+    if (r == -EEXIST)
+      r = 0;
+    if (r < 0)
+      return r;
+
+    r = rados->ioctx_create(RGW_GC_BUCKET, gc_pool_ctx);
+  }
+  if (r < 0)
+    return r;
+
+  gc = new RGWGC();
+  return gc->initialize(cct, this, gc_pool_ctx);
+}
+
+void RGWRados::start_gc()
+{
+  if (gc)
+    gc->start_processor();
+}
+
+void RGWRados::stop_gc()
+{
+  if (gc)
+    gc->stop_processor();
+}
+
+int RGWRados::process_gc()
+{
+  if (!gc)
+    return -ENOTSUP;
+  return gc->process();
+}
+
 void RGWRados::finalize_watch()
 {
   control_pool_ctx.unwatch(notify_oid, watch_handle);
@@ -355,13 +436,36 @@ int RGWRados::list_objects(string& id, rgw_bucket& bucket, int max, string& pref
 
   result.clear();
 
+  /* let the osd do the prefix and delimiter work on the raw index
+   * names.  older osds ignore them, so we still filter below.  a
+   * filter may reject names the osd would have rolled up, so then we
+   * only pass the prefix. */
+  string raw_prefix;
+  if (!ns.empty())
+    raw_prefix = "_" + ns + "_" + prefix;
+  else if (!prefix.empty() && prefix[0] == '_')
+    raw_prefix = "_" + prefix;
+  else
+    raw_prefix = prefix;
+  string raw_delim = (filter ? string() : delim);
+
   do {
     std::map<string, RGWObjEnt> ent_map;
+    set<string> raw_prefixes;
     int r = cls_bucket_list(bucket, cur_marker, max - count, ent_map,
-                            &truncated, &cur_marker);
+                            &truncated, &cur_marker, raw_prefix, raw_delim,
+                            &raw_prefixes);
     if (r < 0)
       return r;
 
+    for (set<string>::iterator piter = raw_prefixes.begin(); piter != raw_prefixes.end(); ++piter) {
+      string cp = *piter;
+      if (!rgw_obj::translate_raw_obj_to_obj_in_ns(cp, ns))
+        continue;
+      common_prefixes[cp] = true;
+      count++;
+    }
+
     std::map<string, RGWObjEnt>::iterator eiter;
     for (eiter = ent_map.begin(); eiter != ent_map.end(); ++eiter) {
       string obj = eiter->first;
@@ -380,7 +484,7 @@ int RGWRados::list_objects(string& id, rgw_bucket& bucket, int max, string& pref
         int delim_pos = obj.find(delim, prefix.size());
 
         if (delim_pos >= 0) {
-          common_prefixes[obj.substr(0, delim_pos + 1)] = true;
+          common_prefixes[obj.substr(0, delim_pos + delim.size())] = true;
           continue;
         }
       }
@@ -456,18 +560,26 @@ int RGWRados::create_bucket(std::string& id, rgw_bucket& bucket,
     bucket.marker = buf;
     bucket.bucket_id = ver;
 
-    string dir_oid =  dir_oid_prefix;
-    dir_oid.append(bucket.marker);
+    bucket.num_shards = MAX(g_conf->rgw_bucket_index_shards, 0);
 
-    r = io_ctx.create(dir_oid, true);
-    if (r < 0 && r != -EEXIST)
-      return r;
+    vector<string> dir_oids;
+    get_bucket_index_oids(bucket, dir_oids);
 
-    if (r != -EEXIST) {
-      r = cls_rgw_init_index(bucket, dir_oid);
+    bool existed = false;
+    for (vector<string>::iterator iter = dir_oids.begin(); iter != dir_oids.end(); ++iter) {
+      r = io_ctx.create(*iter, true);
+      if (r == -EEXIST) {
+        existed = true;
+        continue;
+      }
       if (r < 0)
         return r;
+      r = cls_rgw_init_index(bucket, *iter);
+      if (r < 0)
+        return r;
+    }
 
+    if (!existed) {
       RGWBucketInfo info;
       info.bucket = bucket;
       info.owner = id;
@@ -823,6 +935,7 @@ int RGWRados::copy_obj(void *ctx, std::string& id,
   for (iter = attrs.begin(); iter != attrs.end(); ++iter) {
     attrset[iter->first] = iter->second;
   }
+  attrset.erase(RGW_ATTR_MANIFEST);   // we copied the data itself
   attrs = attrset;
 
   ret = clone_obj(ctx, dest_obj, 0, tmp_obj, 0, end + 1, NULL, attrs, category);
@@ -1039,6 +1152,9 @@ int RGWRados::delete_obj_impl(void *ctx, std::string& id, rgw_obj& obj, bool syn
   if (r < 0)
     return r;
 
+  if (state && state->has_manifest)
+    release_manifest_parts(rctx, state);
+
   if (ret_not_existed)
     return -ENOENT;
 
@@ -1085,6 +1201,17 @@ int RGWRados::get_obj_state(RGWRadosCtx *rctx, rgw_obj& obj, librados::IoCtx& io
     it.copy(bl.length(), s->shadow_obj);
     s->shadow_obj[bl.length()] = '\0';
   }
+  iter = s->attrset.find(RGW_ATTR_MANIFEST);
+  if (iter != s->attrset.end()) {
+    try {
+      bufferlist::iterator miter = iter->second.begin();
+      ::decode(s->manifest, miter);
+      s->has_manifest = true;
+    } catch (buffer::error& err) {
+      dout(0) << "ERROR: couldn't decode manifest of " << obj << dendl;
+      return -EIO;
+    }
+  }
   s->obj_tag = s->attrset[RGW_ATTR_ID_TAG];
   if (s->obj_tag.length())
     dout(20) << "get_obj_state: setting s->obj_tag to " << s->obj_tag.c_str() << dendl;
@@ -1194,8 +1321,10 @@ int RGWRados::prepare_atomic_for_write_impl(RGWRadosCtx *rctx, rgw_obj& obj, lib
       dest_obj.set_key(obj.object);
 
     pair<string, bufferlist> cond(RGW_ATTR_ID_TAG, state->obj_tag);
-    dout(0) << "cloning: dest_obj=" << dest_obj << " size=" << state->size << " tag=" << state->obj_tag.c_str() << dendl;
-    r = clone_obj_cond(NULL, dest_obj, 0, obj, 0, state->size, state->attrset, shadow_category, &state->mtime, false, true, &cond);
+    // a manifest head has no data of its own; the shadow keeps the manifest
+    uint64_t head_size = (state->has_manifest ? 0 : state->size);
+    dout(0) << "cloning: dest_obj=" << dest_obj << " size=" << head_size << " tag=" << state->obj_tag.c_str() << dendl;
+    r = clone_obj_cond(NULL, dest_obj, 0, obj, 0, head_size, state->attrset, shadow_category, &state->mtime, false, true, &cond);
     if (r == -EEXIST)
       r = 0;
     if (r == -ECANCELED) {
@@ -1205,10 +1334,9 @@ int RGWRados::prepare_atomic_for_write_impl(RGWRadosCtx *rctx, rgw_obj& obj, lib
       state->clear();
       return r;
     } else {
-      int ret = rctx->notify_intent(dest_obj, DEL_OBJ);
-      if (ret < 0) {
-        dout(0) << "WARNING: failed to log intent ret=" << ret << dendl;
-      }
+      list<rgw_obj> chain;
+      chain.push_back(dest_obj);
+      defer_removal(rctx, chain, dest_obj.object);
     }
     if (r < 0) {
       dout(0) << "ERROR: failed to clone object r=" << r << dendl;
@@ -1238,6 +1366,50 @@ int RGWRados::prepare_atomic_for_write_impl(RGWRadosCtx *rctx, rgw_obj& obj, lib
   return 0;
 }
 
+/*
+ * remove chain once whoever may still be reading it is done: queue it
+ * for gc or, failing that, log it in the intent log.  without either
+ * (e.g. from radosgw-admin) there are no such readers.
+ */
+void RGWRados::defer_removal(RGWRadosCtx *rctx, list<rgw_obj>& chain, const string& tag)
+{
+  if (gc) {
+    int r = gc->send_chain(chain, tag);
+    if (r >= 0)
+      return;
+    dout(0) << "WARNING: failed to queue " << chain.size() << " objs for gc, r=" << r << dendl;
+  }
+
+  list<rgw_obj>::iterator iter;
+  for (iter = chain.begin(); iter != chain.end(); ++iter) {
+    int r;
+    if (rctx && rctx->intent_cb) {
+      r = rctx->notify_intent(*iter, DEL_OBJ);
+    } else {
+      string id;
+      r = delete_obj(NULL, id, *iter, true);
+      if (r == -ENOENT)
+        r = 0;
+    }
+    if (r < 0)
+      dout(0) << "WARNING: failed to release " << *iter << " r=" << r << dendl;
+  }
+}
+
+/* the parts of a manifest object that was replaced or removed */
+void RGWRados::release_manifest_parts(RGWRadosCtx *rctx, RGWObjState *state)
+{
+  list<rgw_obj> chain;
+  map<uint64_t, RGWObjManifestPart>::iterator iter;
+  for (iter = state->manifest.objs.begin(); iter != state->manifest.objs.end(); ++iter)
+    chain.push_back(iter->second.loc);
+
+  string tag;
+  append_rand_alpha(tag, tag, 32);
+  defer_removal(rctx, chain, tag);
+  state->has_manifest = false;
+}
+
 int RGWRados::prepare_atomic_for_write(RGWRadosCtx *rctx, rgw_obj& obj, librados::IoCtx& io_ctx,
                             string& actual_obj, ObjectWriteOperation& op, RGWObjState **pstate)
 {
@@ -1446,6 +1618,11 @@ int RGWRados::prepare_get_obj(void *ctx, rgw_obj& obj,
     }
   }
 
+  if (astate->has_manifest) {
+    state->has_manifest = true;
+    state->manifest = astate->manifest;
+  }
+
   if (end && *end < 0)
     *end = astate->size - 1;
 
@@ -1555,6 +1732,15 @@ int RGWRados::clone_objs_impl(void *ctx, rgw_obj& dst_obj,
       content_type = bl.c_str();
     } else if (name.compare(RGW_ATTR_ACL) == 0) {
       acl_bl = bl;
+    } else if (name.compare(RGW_ATTR_MANIFEST) == 0) {
+      RGWObjManifest manifest;
+      try {
+        bufferlist::iterator miter = bl.begin();
+        ::decode(manifest, miter);
+      } catch (buffer::error& err) {
+        return -EIO;
+      }
+      size = manifest.obj_size;
     }
   }
   RGWObjState *state;
@@ -1615,6 +1801,10 @@ int RGWRados::clone_objs_impl(void *ctx, rgw_obj& dst_obj,
 done:
   atomic_write_finish(state, ret);
 
+  // the parts of whatever was there before are no longer referenced
+  if (ret >= 0 && state && state->has_manifest)
+    release_manifest_parts(rctx, state);
+
   if (ret >= 0) {
     ret = complete_update_index(bucket, dst_obj.object, tag, epoch, size,
                                 ut, etag, content_type, &acl_bl, category);
@@ -1623,6 +1813,52 @@ done:
   return ret;
 }
 
+/*
+ * write obj as a head holding only attrs and a manifest that points at
+ * the parts, which stay where they are.  the parts' own index entries
+ * go away so the bucket stats don't count the data twice.
+ */
+int RGWRados::put_obj_manifest(void *ctx, std::string& id, rgw_obj& obj, RGWObjManifest& manifest,
+                               map<string, bufferlist>& attrs, RGWObjCategory category)
+{
+  ::encode(manifest, attrs[RGW_ATTR_MANIFEST]);
+
+  vector<RGWCloneRangeInfo> ranges;
+  int r = clone_objs(ctx, obj, ranges, attrs, category, NULL, true, false);
+  if (r < 0)
+    return r;
+
+  rgw_bucket bucket;
+  string oid, key;
+  get_obj_bucket_and_oid_key(obj, bucket, oid, key);
+  if (!bucket.marker.size())
+    return 0;
+  librados::IoCtx io_ctx;
+  r = open_bucket_ctx(bucket, io_ctx);
+  if (r < 0)
+    return r;
+
+  map<string, bufferlist> updates;
+  map<uint64_t, RGWObjManifestPart>::iterator iter;
+  for (iter = manifest.objs.begin(); iter != manifest.objs.end(); ++iter) {
+    rgw_bucket_dir_entry entry;
+    entry.name = iter->second.loc.object;
+    string index_oid;
+    get_bucket_index_oid(iter->second.loc.bucket, entry.name, index_oid);
+    bufferlist& bl = updates[index_oid];
+    bl.append(CEPH_RGW_REMOVE);
+    ::encode(entry, bl);
+  }
+  map<string, bufferlist>::iterator uiter;
+  for (uiter = updates.begin(); uiter != updates.end(); ++uiter) {
+    // a stale entry only skews the stats, send them off blindly
+    AioCompletion *c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
+    io_ctx.aio_exec(uiter->first, c, "rgw", "dir_suggest_changes", uiter->second, NULL);
+    c->release();
+  }
+  return 0;
+}
+
 int RGWRados::clone_objs(void *ctx, rgw_obj& dst_obj,
                         vector<RGWCloneRangeInfo>& ranges,
                         map<string, bufferlist> attrs,
@@ -1645,50 +1881,115 @@ int RGWRados::get_obj(void *ctx, void **handle, rgw_obj& obj,
 {
   rgw_bucket bucket;
   std::string oid, key;
-  get_obj_bucket_and_oid_key(obj, bucket, oid, key);
-  uint64_t len;
-  bufferlist bl;
   RGWRadosCtx *rctx = (RGWRadosCtx *)ctx;
 
   GetObjState *state = *(GetObjState **)handle;
   RGWObjState *astate = NULL;
 
-  if (end <= 0)
-    len = 0;
-  else
-    len = end - ofs + 1;
-
-  if (len > RGW_MAX_CHUNK_SIZE)
-    len = RGW_MAX_CHUNK_SIZE;
+  rgw_obj& read_obj = (state->raced ? state->shadow : obj);
+  if (state->raced)
+    rctx = NULL;
+  get_obj_bucket_and_oid_key(read_obj, bucket, oid, key);
 
   state->io_ctx.locator_set_key(key);
 
-  ObjectReadOperation op;
-
-  int r = append_atomic_test(rctx, obj, state->io_ctx, oid, op, &astate);
-  if (r < 0)
-    return r;
+  // reads ahead only help if the caller asks for what follows
+  if (!state->reads.empty() &&
+      (state->read_oid != oid || state->reads.front()->ofs != ofs)) {
+    dout(20) << "get_obj: discarding reads ahead at ofs=" << state->reads.front()->ofs
+             << ", caller wants ofs=" << ofs << dendl;
+    state->cancel_reads();
+  }
+  if (state->reads.empty()) {
+    state->read_oid = oid;
+    state->next_ofs = ofs;
+  }
 
-  dout(20) << "rados->read ofs=" << ofs << " len=" << len << dendl;
-  op.read(ofs, len);
+  unsigned window = 1 + MAX(g_conf->rgw_get_obj_window, 0);
+  while (state->reads.size() < window &&
+         (state->reads.empty() || state->next_ofs <= end)) {
+    uint64_t len;
+    if (end <= 0)
+      len = 0;
+    else
+      len = end - state->next_ofs + 1;
+    if (len > RGW_MAX_CHUNK_SIZE)
+      len = RGW_MAX_CHUNK_SIZE;
+
+    ObjectReadOperation op;
+    string part_oid = oid;
+    off_t part_ofs = state->next_ofs;
+    if (state->has_manifest && !state->manifest.objs.empty()) {
+      // read from the part holding next_ofs, and no further than its end
+      map<uint64_t, RGWObjManifestPart>::iterator miter =
+        state->manifest.objs.upper_bound(state->next_ofs);
+      if (miter == state->manifest.objs.begin())
+        return -EIO;
+      --miter;
+      RGWObjManifestPart& part = miter->second;
+      uint64_t in_part = state->next_ofs - miter->first;
+      if (in_part >= part.size)
+        return -EIO;
+      if (!len || len > part.size - in_part)
+        len = part.size - in_part;
+      rgw_bucket part_bucket;
+      string part_key;
+      get_obj_bucket_and_oid_key(part.loc, part_bucket, part_oid, part_key);
+      state->io_ctx.locator_set_key(part_key);
+      part_ofs = part.loc_ofs + in_part;
+      // parts never change; the manifest was read atomically with the head
+    } else {
+      int r = append_atomic_test(rctx, read_obj, state->io_ctx, oid, op, &astate);
+      if (r < 0)
+        return r;
+    }
+    op.read(part_ofs, len);
+
+    GetObjState::Read *rd = new GetObjState::Read;
+    rd->ofs = state->next_ofs;
+    rd->len = len;
+    rd->c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
+    dout(20) << "rados->aio_read ofs=" << rd->ofs << " len=" << len << dendl;
+    int r = state->io_ctx.aio_operate(part_oid, rd->c, &op, &rd->bl);
+    if (r < 0) {
+      rd->c->release();
+      delete rd;
+      return r;
+    }
+    state->reads.push_back(rd);
+    if (!len)
+      break;  // to the end, however long that is
+    state->next_ofs += len;
+  }
 
-  r = state->io_ctx.operate(oid, &op, &bl);
-  dout(20) << "rados->read r=" << r << " bl.length=" << bl.length() << dendl;
+  GetObjState::Read *rd = state->reads.front();
+  state->reads.pop_front();
+  rd->c->wait_for_complete();
+  int r = rd->c->get_return_value();
+  uint64_t len = rd->len;
+  rd->c->release();
+  dout(20) << "rados->read r=" << r << " bl.length=" << rd->bl.length() << dendl;
 
   if (r == -ECANCELED) {
     /* a race! object was replaced, we need to set attr on the original obj */
     dout(0) << "RGWRados::get_obj: raced with another process, going to the shadow obj instead" << dendl;
+    delete rd;
+    state->cancel_reads();
+    r = get_obj_state(rctx, read_obj, state->io_ctx, oid, &astate);
+    if (r < 0)
+      return r;
     string loc = obj.loc();
-    rgw_obj shadow(bucket, astate->shadow_obj, loc, shadow_ns);
-    r = get_obj(NULL, handle, shadow, data, ofs, end);
-    return r;
+    state->shadow = rgw_obj(bucket, astate->shadow_obj, loc, shadow_ns);
+    state->raced = true;
+    return get_obj(NULL, handle, obj, data, ofs, end);
   }
 
-  if (bl.length() > 0) {
-    r = bl.length();
+  if (rd->bl.length() > 0) {
+    r = rd->bl.length();
     *data = (char *)malloc(r);
-    memcpy(*data, bl.c_str(), bl.length());
+    memcpy(*data, rd->bl.c_str(), rd->bl.length());
   }
+  delete rd;
 
   if (r < 0 || !len || ((off_t)(ofs + len - 1) == end)) {
     delete state;
@@ -1786,6 +2087,18 @@ int RGWRados::obj_stat(void *ctx, rgw_obj& obj, uint64_t *psize, time_t *pmtime,
     dout(0) << "ERROR: failed decoding object (obj=" << obj << ") info (either size or mtime), aborting" << dendl;
     return -EIO;
   }
+  map<string, bufferlist>::iterator miter = attrset.find(RGW_ATTR_MANIFEST);
+  if (miter != attrset.end()) {
+    RGWObjManifest manifest;
+    try {
+      bufferlist::iterator bliter = miter->second.begin();
+      ::decode(manifest, bliter);
+    } catch (buffer::error& err) {
+      dout(0) << "ERROR: couldn't decode manifest of " << obj << dendl;
+      return -EIO;
+    }
+    size = manifest.obj_size;
+  }
   if (psize)
     *psize = size;
   if (pmtime)
@@ -2074,8 +2387,8 @@ int RGWRados::cls_obj_prepare_op(rgw_bucket& bucket, uint8_t op, string& tag,
   if (r < 0)
     return r;
 
-  string oid = dir_oid_prefix;
-  oid.append(bucket.marker);
+  string oid;
+  get_bucket_index_oid(bucket, name, oid);
 
   bufferlist in, out;
   struct rgw_cls_obj_prepare_op call;
@@ -2103,8 +2416,8 @@ int RGWRados::cls_obj_complete_op(rgw_bucket& bucket, uint8_t op, string& tag, u
   if (r < 0)
     return r;
 
-  string oid = dir_oid_prefix;
-  oid.append(bucket.marker);
+  string oid;
+  get_bucket_index_oid(bucket, ent.name, oid);
 
   bufferlist in;
   struct rgw_cls_obj_complete_op call;
@@ -2138,8 +2451,63 @@ int RGWRados::cls_obj_complete_del(rgw_bucket& bucket, string& tag, uint64_t epo
   return cls_obj_complete_op(bucket, CLS_RGW_OP_DEL, tag, epoch, ent, RGW_OBJ_CATEGORY_NONE);
 }
 
+/*
+ * List up to num entries after start from each of the bucket's index
+ * objects, all at once.
+ */
+int RGWRados::cls_bucket_list_shards(rgw_bucket& bucket, librados::IoCtx& io_ctx,
+                                     vector<string>& oids, string& start, uint32_t num,
+                                     const string& prefix, const string& delim,
+                                     vector<struct rgw_cls_list_ret>& results)
+{
+  get_bucket_index_oids(bucket, oids);
+
+  bufferlist in;
+  struct rgw_cls_list_op call;
+  call.start_obj = start;
+  call.num_entries = num;
+  call.prefix = prefix;
+  call.delimiter = delim;
+  ::encode(call, in);
+
+  vector<bufferlist> outs(oids.size());
+  vector<AioCompletion *> cs(oids.size());
+  int r = 0;
+  for (unsigned i = 0; i < oids.size(); i++) {
+    cs[i] = librados::Rados::aio_create_completion(NULL, NULL, NULL);
+    int ret = io_ctx.aio_exec(oids[i], cs[i], "rgw", "bucket_list", in, &outs[i]);
+    if (ret < 0) {
+      cs[i]->release();
+      cs[i] = NULL;
+      r = ret;
+    }
+  }
+
+  results.resize(oids.size());
+  for (unsigned i = 0; i < oids.size(); i++) {
+    if (!cs[i])
+      continue;
+    cs[i]->wait_for_complete();
+    int ret = cs[i]->get_return_value();
+    cs[i]->release();
+    if (ret < 0) {
+      r = ret;
+      continue;
+    }
+    try {
+      bufferlist::iterator iter = outs[i].begin();
+      ::decode(results[i], iter);
+    } catch (buffer::error& err) {
+      dout(0) << "ERROR: failed to decode bucket_list returned buffer" << dendl;
+      r = -EIO;
+    }
+  }
+  return r;
+}
+
 int RGWRados::cls_bucket_list(rgw_bucket& bucket, string start, uint32_t num, map<string, RGWObjEnt>& m,
-			      bool *is_truncated, string *last_entry)
+			      bool *is_truncated, string *last_entry, const string& prefix,
+			      const string& delim, set<string> *common_prefixes)
 {
   dout(0) << "cls_bucket_list " << bucket << " start " << start << " num " << num << dendl;
 
@@ -2153,36 +2521,48 @@ int RGWRados::cls_bucket_list(rgw_bucket& bucket, string start, uint32_t num, ma
     return -EIO;
   }
 
-  string oid = dir_oid_prefix;
-  oid.append(bucket.marker);
-
-  bufferlist in, out;
-  struct rgw_cls_list_op call;
-  call.start_obj = start;
-  call.num_entries = num;
-  ::encode(call, in);
-  r = io_ctx.exec(oid, "rgw", "bucket_list", in, out);
+  vector<string> oids;
+  vector<struct rgw_cls_list_ret> results;
+  r = cls_bucket_list_shards(bucket, io_ctx, oids, start, num, prefix, delim, results);
   if (r < 0)
     return r;
 
-  struct rgw_cls_list_ret ret;
-  try {
-    bufferlist::iterator iter = out.begin();
-    ::decode(ret, iter);
-  } catch (buffer::error& err) {
-    dout(0) << "ERROR: failed to decode bucket_list returned buffer" << dendl;
-    return -EIO;
-  }
+  // each index object is sorted; the first num entries of their union
+  // are the next page.  common prefixes (marked -1) count as entries,
+  // and several shards may return the same one.
+  bool truncated = false;
+  map<string, int> merged;
+  for (unsigned i = 0; i < results.size(); i++) {
+    if (results[i].is_truncated)
+      truncated = true;
+    map<string, struct rgw_bucket_dir_entry>& dm = results[i].dir.m;
+    for (map<string, struct rgw_bucket_dir_entry>::iterator iter = dm.begin(); iter != dm.end(); ++iter)
+      merged[iter->first] = i;
+    set<string>& cps = results[i].common_prefixes;
+    for (set<string>::iterator iter = cps.begin(); iter != cps.end(); ++iter)
+      merged[*iter] = -1;
+  }
+  if (merged.size() > num)
+    truncated = true;
 
   if (is_truncated)
-    *is_truncated = ret.is_truncated;
+    *is_truncated = truncated;
+
+  vector<bufferlist> updates(oids.size());
+  uint32_t count = 0;
+  map<string, int>::iterator miter;
+  for (miter = merged.begin(); miter != merged.end() && count < num; ++miter, ++count) {
+    if (last_entry)
+      *last_entry = miter->first;
+
+    if (miter->second < 0) {
+      if (common_prefixes)
+        common_prefixes->insert(miter->first);
+      continue;
+    }
 
-  struct rgw_bucket_dir& dir = ret.dir;
-  map<string, struct rgw_bucket_dir_entry>::iterator miter;
-  bufferlist updates;
-  for (miter = dir.m.begin(); miter != dir.m.end(); ++miter) {
     RGWObjEnt e;
-    rgw_bucket_dir_entry& dirent = miter->second;
+    rgw_bucket_dir_entry& dirent = results[miter->second].dir.m[miter->first];
 
     // fill it in with initial values; we may correct later
     e.name = dirent.name;
@@ -2198,7 +2578,7 @@ int RGWRados::cls_bucket_list(rgw_bucket& bucket, string start, uint32_t num, ma
        * and if the tags are old we need to do cleanup as well. */
       librados::IoCtx sub_ctx;
       sub_ctx.dup(io_ctx);
-      r = check_disk_state(sub_ctx, bucket, dirent, e, updates);
+      r = check_disk_state(sub_ctx, bucket, dirent, e, updates[miter->second]);
       if (r < 0) {
         if (r == -ENOENT)
           continue;
@@ -2210,14 +2590,12 @@ int RGWRados::cls_bucket_list(rgw_bucket& bucket, string start, uint32_t num, ma
     dout(0) << " got " << e.name << dendl;
   }
 
-  if (dir.m.size()) {
-    *last_entry = dir.m.rbegin()->first;
-  }
-
-  if (updates.length()) {
+  for (unsigned i = 0; i < oids.size(); i++) {
+    if (!updates[i].length())
+      continue;
     // we don't care if we lose suggested updates, send them off blindly
     AioCompletion *c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
-    r = io_ctx.aio_exec(oid, c, "rgw", "dir_suggest_changes", in, NULL);
+    r = io_ctx.aio_exec(oids[i], c, "rgw", "dir_suggest_changes", updates[i], NULL);
     c->release();
   }
   return m.size();
@@ -2279,28 +2657,29 @@ int RGWRados::cls_bucket_head(rgw_bucket& bucket, struct rgw_bucket_dir_header&
     return -EIO;
   }
 
-  string oid = dir_oid_prefix;
-  oid.append(bucket.marker);
-
-  bufferlist in, out;
-  struct rgw_cls_list_op call;
-  call.num_entries = 0;
-  ::encode(call, in);
-  r = io_ctx.exec(oid, "rgw", "bucket_list", in, out);
+  vector<string> oids;
+  vector<struct rgw_cls_list_ret> results;
+  string start;
+  r = cls_bucket_list_shards(bucket, io_ctx, oids, start, 0, string(), string(), results);
   if (r < 0)
     return r;
 
-  struct rgw_cls_list_ret ret;
-  try {
-    bufferlist::iterator iter = out.begin();
-    ::decode(ret, iter);
-  } catch (buffer::error& err) {
-    dout(0) << "ERROR: failed to decode bucket_list returned buffer" << dendl;
-    return -EIO;
+  header.stats.clear();
+  for (unsigned i = 0; i < results.size(); i++) {
+    map<uint8_t, struct rgw_bucket_category_stats>& shard_stats = results[i].dir.header.stats;
+    map<uint8_t, struct rgw_bucket_category_stats>::iterator iter;
+    for (iter = shard_stats.begin(); iter != shard_stats.end(); ++iter) {
+      if (!header.stats.count(iter->first)) {
+        header.stats[iter->first] = iter->second;
+        continue;
+      }
+      struct rgw_bucket_category_stats& stats = header.stats[iter->first];
+      stats.total_size += iter->second.total_size;
+      stats.total_size_rounded += iter->second.total_size_rounded;
+      stats.num_entries += iter->second.num_entries;
+    }
   }
 
-  header = ret.dir.header;
-
   return 0;
 }
 
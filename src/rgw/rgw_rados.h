@@ -10,6 +10,7 @@
 class RGWWatcher;
 class SafeTimer;
 class ACLOwner;
+class RGWGC;
 
 struct RGWObjState {
   bool is_atomic;
@@ -19,9 +20,11 @@ struct RGWObjState {
   time_t mtime;
   bufferlist obj_tag;
   string shadow_obj;
+  bool has_manifest;
+  RGWObjManifest manifest;
 
   map<string, bufferlist> attrset;
-  RGWObjState() : is_atomic(false), has_attrs(0), exists(false) {}
+  RGWObjState() : is_atomic(false), has_attrs(0), exists(false), has_manifest(false) {}
 
   bool get_attr(string name, bufferlist& dest) {
     map<string, bufferlist>::iterator iter = attrset.find(name);
@@ -39,6 +42,8 @@ struct RGWObjState {
     mtime = 0;
     obj_tag.clear();
     shadow_obj.clear();
+    has_manifest = false;
+    manifest.objs.clear();
     attrset.clear();
   }
 };
@@ -82,11 +87,44 @@ class RGWRados  : public RGWAccess
 
   int open_bucket_ctx(rgw_bucket& bucket, librados::IoCtx&  io_ctx);
 
+  /*
+   * get_obj keeps up to rgw_get_obj_window chunk reads in flight past
+   * the one being returned, so that sending a chunk to the client
+   * overlaps with reading the next ones.
+   */
   struct GetObjState {
+    struct Read {
+      off_t ofs;
+      uint64_t len;
+      librados::AioCompletion *c;
+      bufferlist bl;
+    };
+
     librados::IoCtx io_ctx;
     bool sent_data;
+    string read_oid;         // object the reads below are against
+    list<Read*> reads;       // in offset order
+    off_t next_ofs;          // where the next read ahead starts
+    bool raced;              // the object was replaced; read the shadow
+    rgw_obj shadow;
+    bool has_manifest;       // offsets are into the manifest's parts
+    RGWObjManifest manifest;
+
+    GetObjState() : sent_data(false), next_ofs(0), raced(false), has_manifest(false) {}
+    ~GetObjState() {
+      cancel_reads();
+    }
 
-    GetObjState() : sent_data(false) {}
+    /// wait out and discard everything in flight
+    void cancel_reads() {
+      while (!reads.empty()) {
+	Read *r = reads.front();
+	reads.pop_front();
+	r->c->wait_for_complete();
+	r->c->release();
+	delete r;
+      }
+    }
   };
 
   int set_buckets_auid(vector<rgw_bucket>& buckets, uint64_t auid);
@@ -108,6 +146,7 @@ class RGWRados  : public RGWAccess
   uint64_t watch_handle;
   librados::IoCtx root_pool_ctx;      // .rgw
   librados::IoCtx control_pool_ctx;   // .rgw.control
+  RGWGC *gc;
 
   int get_obj_state(RGWRadosCtx *rctx, rgw_obj& obj, librados::IoCtx& io_ctx, string& actual_obj, RGWObjState **state);
   int append_atomic_test(RGWRadosCtx *rctx, rgw_obj& obj, librados::IoCtx& io_ctx,
@@ -116,6 +155,9 @@ class RGWRados  : public RGWAccess
                          string& actual_obj, librados::ObjectWriteOperation& op, RGWObjState **pstate);
   int prepare_atomic_for_write(RGWRadosCtx *rctx, rgw_obj& obj, librados::IoCtx& io_ctx,
                          string& actual_obj, librados::ObjectWriteOperation& op, RGWObjState **pstate);
+  void release_manifest_parts(RGWRadosCtx *rctx, RGWObjState *state);
+  void defer_removal(RGWRadosCtx *rctx, list<rgw_obj>& chain, const string& tag);
+  int init_gc(CephContext *cct);
 
   void atomic_write_finish(RGWObjState *state, int r) {
     if (state && r == -ECANCELED) {
@@ -137,7 +179,7 @@ class RGWRados  : public RGWAccess
   int store_bucket_info(RGWBucketInfo& info);
 
 public:
-  RGWRados() : lock("rados_timer_lock"), timer(NULL), watcher(NULL), watch_handle(0) {}
+  RGWRados() : lock("rados_timer_lock"), timer(NULL), watcher(NULL), watch_handle(0), gc(NULL) {}
 
   void tick();
 
@@ -206,6 +248,10 @@ public:
                  bool exclusive,
                  pair<string, bufferlist> *cmp_xattr);
 
+  /** point obj at the parts in manifest, without copying them */
+  virtual int put_obj_manifest(void *ctx, std::string& id, rgw_obj& obj, RGWObjManifest& manifest,
+                               map<string, bufferlist>& attrs, RGWObjCategory category);
+
   int clone_obj_cond(void *ctx, rgw_obj& dst_obj, off_t dst_ofs,
                 rgw_obj& src_obj, off_t src_ofs,
                 uint64_t size, map<string, bufferlist> attrs,
@@ -319,8 +365,13 @@ public:
   int cls_obj_complete_del(rgw_bucket& bucket, string& tag, uint64_t epoch, string& name);
   int cls_bucket_list(rgw_bucket& bucket, string start, uint32_t num,
                       map<string, RGWObjEnt>& m, bool *is_truncated,
-                      string *last_entry = NULL);
+                      string *last_entry = NULL, const string& prefix = string(),
+                      const string& delim = string(), set<string> *common_prefixes = NULL);
   int cls_bucket_head(rgw_bucket& bucket, struct rgw_bucket_dir_header& header);
+  int cls_bucket_list_shards(rgw_bucket& bucket, librados::IoCtx& io_ctx,
+                             vector<string>& oids, string& start, uint32_t num,
+                             const string& prefix, const string& delim,
+                             vector<struct rgw_cls_list_ret>& results);
   int prepare_update_index(RGWObjState *state, rgw_bucket& bucket,
                            rgw_obj& oid, string& tag);
   int complete_update_index(rgw_bucket& bucket, string& oid, string& tag, uint64_t epoch, uint64_t size,
@@ -332,6 +383,10 @@ public:
   /// clean up/process any temporary objects older than given date[/time]
   int remove_temp_objects(string date, string time);
 
+  virtual void start_gc();
+  virtual void stop_gc();
+  virtual int process_gc();
+
  private:
   int process_intent_log(rgw_bucket& bucket, string& oid,
 			 time_t epoch, int flags, bool purge);
@@ -229,7 +229,7 @@ void abort_early(struct req_state *s, int err_no)
 void dump_continue(struct req_state *s)
 {
   dump_status(s, "100");
-  FCGX_FFlush(s->fcgx->out);
+  s->cio->flush();
 }
 
 void dump_range(struct req_state *s, off_t ofs, off_t end, size_t total)
@@ -258,13 +258,14 @@ int RGWPutObj_REST::get_params()
 
 int RGWPutObj_REST::get_data()
 {
+  size_t chunk_size = MAX(g_conf->rgw_put_obj_chunk_size, 4096);
   size_t cl;
   if (s->length) {
     cl = atoll(s->length) - ofs;
-    if (cl > RGW_MAX_CHUNK_SIZE)
-      cl = RGW_MAX_CHUNK_SIZE;
+    if (cl > chunk_size)
+      cl = chunk_size;
   } else {
-    cl = RGW_MAX_CHUNK_SIZE;
+    cl = chunk_size;
   }
 
   int len = 0;
@@ -604,7 +605,8 @@ static int init_auth_info(struct req_state *s)
 
   s->x_meta_map.clear();
 
-  for (int i=0; (p = s->fcgx->envp[i]); ++i) {
+  char **envp = s->cio->get_env();
+  for (int i=0; (p = envp[i]); ++i) {
     const char *prefix;
     for (int prefix_num = 0; (prefix = meta_prefixes[prefix_num].str) != NULL; prefix_num++) {
       int len = meta_prefixes[prefix_num].len;
@@ -752,11 +754,11 @@ static int validate_object_name(const char *object)
   return 0;
 }
 
-int RGWHandler_REST::preprocess(struct req_state *s, FCGX_Request *fcgx)
+int RGWHandler_REST::preprocess(struct req_state *s, RGWClientIO *cio)
 {
   int ret = 0;
 
-  s->fcgx = fcgx;
+  s->cio = cio;
   s->path_name = s->env->get("SCRIPT_NAME");
   s->path_name_url = s->env->get("REQUEST_URI");
   url_decode(s->path_name_url, s->path_name_url);
@@ -906,12 +908,12 @@ RGWRESTMgr::~RGWRESTMgr()
   delete m_s3_handler;
 }
 
-RGWHandler *RGWRESTMgr::get_handler(struct req_state *s, FCGX_Request *fcgx,
+RGWHandler *RGWRESTMgr::get_handler(struct req_state *s, RGWClientIO *cio,
 				    int *init_error)
 {
   RGWHandler *handler;
 
-  *init_error = RGWHandler_REST::preprocess(s, fcgx);
+  *init_error = RGWHandler_REST::preprocess(s, cio);
 
   if (s->prot_flags & RGW_REST_SWIFT)
     handler = m_os_handler;
@@ -920,7 +922,7 @@ RGWHandler *RGWRESTMgr::get_handler(struct req_state *s, FCGX_Request *fcgx,
   else
     handler = m_s3_handler;
 
-  handler->init(s, fcgx);
+  handler->init(s, cio);
 
   return handler;
 }
@@ -92,9 +92,17 @@ send_data:
 
 void RGWListBuckets_REST_S3::send_response()
 {
+  // stream the listing, unless we're to buffer it and send its length
+  bool stream = (g_conf->rgw_formatter_chunk_size > 0);
+
   if (ret)
     set_req_state_err(s, ret);
   dump_errno(s);
+  if (stream) {
+    end_header(s, "application/xml");
+    if (ret < 0)
+      return;
+  }
   dump_start(s);
 
   list_all_buckets_start(s);
@@ -107,11 +115,14 @@ void RGWListBuckets_REST_S3::send_response()
   for (iter = m.begin(); iter != m.end(); ++iter) {
     RGWBucketEnt obj = iter->second;
     dump_bucket(s, obj);
+    rgw_flush_formatter_chunk(s);
   }
   s->formatter->close_section();
   list_all_buckets_end(s);
-  dump_content_length(s, s->formatter->get_len());
-  end_header(s, "application/xml");
+  if (!stream) {
+    dump_content_length(s, s->formatter->get_len());
+    end_header(s, "application/xml");
+  }
   flush_formatter_to_req_state(s, s->formatter);
 }
 
@@ -162,6 +173,7 @@ void RGWListBucket_REST_S3::send_response()
       s->formatter->dump_format("StorageClass", "STANDARD");
       dump_owner(s, iter->owner, iter->owner_display_name);
       s->formatter->close_section();
+      rgw_flush_formatter_chunk(s);
     }
     if (common_prefixes.size() > 0) {
       map<string, bool>::iterator pref_iter;
@@ -169,6 +181,7 @@ void RGWListBucket_REST_S3::send_response()
         s->formatter->open_array_section("CommonPrefixes");
         s->formatter->dump_format("Prefix", pref_iter->first.c_str());
         s->formatter->close_section();
+        rgw_flush_formatter_chunk(s);
       }
     }
   }
@@ -5,6 +5,10 @@
 #include <curl/curl.h>
 #include <curl/easy.h>
 
+#include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/Thread.h"
+
 #include "rgw_common.h"
 #include "rgw_swift.h"
 #include "rgw_swift_auth.h"
@@ -81,6 +85,166 @@ static int rgw_swift_validate_token(const char *token, struct rgw_swift_auth_inf
   return 0;
 }
 
+/* validate token; true, with user and groups, if the auth service took it */
+static bool validate_token(const char *token, string& user, string& groups, long long *ttl)
+{
+  struct rgw_swift_auth_info info;
+
+  memset(&info, 0, sizeof(info));
+
+  info.status = 401; // start with access denied, validate_token might change that
+
+  rgw_swift_validate_token(token, &info);
+  bool ok = (info.user != NULL);
+  if (ok) {
+    user = info.user;
+    groups = info.auth_groups ? info.auth_groups : "";
+    *ttl = info.ttl;
+  }
+  free(info.user);
+  free(info.auth_groups);
+  return ok;
+}
+
+/*
+ * Tokens the auth service validated, kept until their X-Auth-Ttl runs
+ * out so that a request only waits on the auth service the first time
+ * its token is seen.  The rgw_swift_token_cache_size least recently
+ * used are kept.  A token used within rgw_swift_token_refresh_window
+ * of expiring is revalidated by our thread while requests go on using
+ * the cached entry; if the auth service no longer takes it, it is
+ * dropped.
+ */
+class RGWSwiftTokenCache : public Thread {
+  struct Entry {
+    string user, groups;
+    utime_t expires;
+    double ttl;
+    bool refreshing;
+    std::list<string>::iterator lru_iter;
+  };
+
+  Mutex lock;
+  Cond cond;
+  map<string, Entry> entries;
+  std::list<string> lru;   // most recently used first
+  std::list<string> refresh_queue;
+  bool started, stopping;
+
+  void remove(map<string, Entry>::iterator iter) {
+    lru.erase(iter->second.lru_iter);
+    entries.erase(iter);
+  }
+
+  void *entry() {
+    lock.Lock();
+    while (!stopping) {
+      if (refresh_queue.empty()) {
+        cond.Wait(lock);
+        continue;
+      }
+      string token = refresh_queue.front();
+      refresh_queue.pop_front();
+      lock.Unlock();
+
+      string user, groups;
+      long long ttl = 0;
+      bool ok = validate_token(token.c_str(), user, groups, &ttl);
+      dout(10) << "swift token refresh user=" << user << " ok=" << ok << dendl;
+
+      lock.Lock();
+      map<string, Entry>::iterator iter = entries.find(token);
+      if (iter == entries.end())
+        continue;
+      if (!ok || ttl <= 0) {
+        remove(iter);
+        continue;
+      }
+      iter->second.user = user;
+      iter->second.groups = groups;
+      iter->second.ttl = ttl;
+      iter->second.expires = ceph_clock_now(g_ceph_context);
+      iter->second.expires += (double)ttl;
+      iter->second.refreshing = false;
+    }
+    lock.Unlock();
+    return NULL;
+  }
+
+public:
+  RGWSwiftTokenCache() : lock("RGWSwiftTokenCache::lock"), started(false), stopping(false) {}
+
+  bool find(const string& token, string& user, string& groups) {
+    Mutex::Locker l(lock);
+    map<string, Entry>::iterator iter = entries.find(token);
+    if (iter == entries.end())
+      return false;
+    Entry& e = iter->second;
+    utime_t now = ceph_clock_now(g_ceph_context);
+    if (now >= e.expires) {
+      remove(iter);
+      return false;
+    }
+    user = e.user;
+    groups = e.groups;
+    lru.splice(lru.begin(), lru, e.lru_iter);
+
+    double window = MIN(g_conf->rgw_swift_token_refresh_window, e.ttl / 2);
+    utime_t refresh_at = e.expires;
+    refresh_at -= window;
+    if (!e.refreshing && now >= refresh_at && !stopping) {
+      e.refreshing = true;
+      refresh_queue.push_back(token);
+      if (!started) {
+        create();
+        started = true;
+      }
+      cond.Signal();
+    }
+    return true;
+  }
+
+  void add(const string& token, const string& user, const string& groups, long long ttl) {
+    int max = g_conf->rgw_swift_token_cache_size;
+    if (max <= 0 || ttl <= 0)
+      return;
+    Mutex::Locker l(lock);
+    map<string, Entry>::iterator iter = entries.find(token);
+    if (iter != entries.end())
+      remove(iter);
+    Entry& e = entries[token];
+    e.user = user;
+    e.groups = groups;
+    e.ttl = ttl;
+    e.expires = ceph_clock_now(g_ceph_context);
+    e.expires += (double)ttl;
+    e.refreshing = false;
+    lru.push_front(token);
+    e.lru_iter = lru.begin();
+    while (entries.size() > (size_t)max)
+      remove(entries.find(lru.back()));
+  }
+
+  void shutdown() {
+    lock.Lock();
+    if (!started) {
+      lock.Unlock();
+      return;
+    }
+    stopping = true;
+    cond.Signal();
+    lock.Unlock();
+    join();
+  }
+};
+
+static RGWSwiftTokenCache token_cache;
+
+void rgw_swift_shutdown()
+{
+  token_cache.shutdown();
+}
+
 bool rgw_verify_os_token(req_state *s)
 {
   if (!s->os_auth_token)
@@ -94,23 +258,18 @@ bool rgw_verify_os_token(req_state *s)
     return  true;
   }
 
-  struct rgw_swift_auth_info info;
-
-  memset(&info, 0, sizeof(info));
-
-  info.status = 401; // start with access denied, validate_token might change that
-
-  int ret = rgw_swift_validate_token(s->os_auth_token, &info);
-  if (ret < 0)
-    return ret;
-
-  if (!info.user) {
-    dout(0) << "swift auth didn't authorize a user" << dendl;
-    return false;
+  string user, groups;
+  if (!token_cache.find(s->os_auth_token, user, groups)) {
+    long long ttl = 0;
+    if (!validate_token(s->os_auth_token, user, groups, &ttl)) {
+      dout(0) << "swift auth didn't authorize a user" << dendl;
+      return false;
+    }
+    token_cache.add(s->os_auth_token, user, groups, ttl);
   }
 
-  s->os_user = info.user;
-  s->os_groups = info.auth_groups;
+  s->os_user = strdup(user.c_str());
+  s->os_groups = strdup(groups.c_str());
 
   string swift_user = s->os_user;
 
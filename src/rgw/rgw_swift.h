@@ -13,6 +13,7 @@ struct rgw_swift_auth_info {
 };
 
 bool rgw_verify_os_token(req_state *s);
+void rgw_swift_shutdown();
 
 
 #endif
@@ -16,8 +16,10 @@
 #include "common/admin_socket.h"
 #include "common/admin_socket_client.h"
 #include "common/ceph_context.h"
+#include "common/Formatter.h"
 #include "test/unit.h"
 
+#include <errno.h>
 #include <stdint.h>
 #include <string.h>
 #include <string>
@@ -72,3 +74,36 @@ TEST(AdminSocket, SendNoOp) {
   ASSERT_EQ(CEPH_ADMIN_SOCK_VERSION, version);
   ASSERT_EQ(true, asoct.shutdown());
 }
+
+class ExampleCommand : public AdminSocketCommand {
+public:
+  void dump_command(const std::string &command, ceph::Formatter *f) {
+    f->open_object_section("example");
+    f->dump_string("command", command);
+    f->close_section();
+  }
+};
+
+TEST(AdminSocket, RegisterCommand) {
+  std::auto_ptr<AdminSocketConfigObs>
+      asokc(new AdminSocketConfigObs(g_ceph_context));
+  AdminSocketTest asoct(asokc.get());
+  ASSERT_EQ(true, asoct.shutdown());
+  ASSERT_EQ(true, asoct.init(get_rand_socket_path()));
+  ExampleCommand example;
+  ASSERT_EQ(0, asokc->register_command("example", "an example", &example));
+  ASSERT_EQ(-EEXIST, asokc->register_command("example", "again", &example));
+  ASSERT_EQ(-EINVAL, asokc->register_command("help", "no", &example));
+
+  AdminSocketClient client(get_rand_socket_path());
+  std::string message;
+  ASSERT_EQ("", client.do_command("example", &message));
+  ASSERT_NE(std::string::npos, message.find("\"command\": \"example\""));
+  ASSERT_EQ("", client.do_command("help", &message));
+  ASSERT_NE(std::string::npos, message.find("\"example\": \"an example\""));
+
+  asokc->unregister_command("example");
+  ASSERT_EQ("", client.do_command("example", &message));
+  ASSERT_NE(std::string::npos, message.find("unknown command"));
+  ASSERT_EQ(true, asoct.shutdown());
+}
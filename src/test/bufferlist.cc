@@ -75,3 +75,50 @@ TEST(BufferList, TestCopyAll) {
   bl2.copy(0, BIG_SZ, (char*)big2);
   ASSERT_EQ(memcmp(big.get(), big2, BIG_SZ), 0);
 }
+
+TEST(BufferList, SmallBuffers) {
+  // every size around the pooled size class boundaries, freed in an
+  // order that recycles chunks between classes
+  std::vector<bufferptr> ptrs;
+  for (unsigned len = 1; len <= 4200; len += 7) {
+    bufferptr p(len);
+    memset(p.c_str(), len & 0xff, len);
+    ptrs.push_back(p);
+  }
+  for (unsigned i = 0; i < ptrs.size(); i += 2)
+    ptrs[i] = bufferptr();
+  for (unsigned len = 1; len <= 4200; len += 7) {
+    bufferptr p(len);
+    memset(p.c_str(), 0, len);
+  }
+  for (unsigned i = 1; i < ptrs.size(); i += 2) {
+    unsigned len = 1 + 7 * i;
+    ASSERT_EQ(ptrs[i].length(), len);
+    for (unsigned j = 0; j < len; j++)
+      ASSERT_EQ((unsigned char)ptrs[i][j], len & 0xff);
+    bufferptr c(ptrs[i].clone());
+    ASSERT_EQ(0, memcmp(c.c_str(), ptrs[i].c_str(), len));
+  }
+}
+
+TEST(BufferList, ReserveContiguous) {
+  bufferlist bl;
+  bl.reserve(10000 * sizeof(__u32));
+  for (__u32 i = 0; i < 10000; i++)
+    ::encode(i, bl);
+  ASSERT_EQ(bl.buffers().size(), 1u);
+  ASSERT_EQ(bl.length(), 10000 * sizeof(__u32));
+
+  // and decode across segment boundaries
+  bufferlist bl2;
+  bl2.append(bl.c_str(), 3);
+  bl2.append(bufferptr(bl.c_str() + 3, 5));
+  bl2.append(bl.c_str() + 8, bl.length() - 8);
+  bufferlist::iterator p = bl2.begin();
+  for (__u32 i = 0; i < 10000; i++) {
+    __u32 v;
+    ::decode(v, p);
+    ASSERT_EQ(v, i);
+  }
+  ASSERT_TRUE(p.end());
+}
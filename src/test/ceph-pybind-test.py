@@ -95,6 +95,38 @@ if (ret != "a\0b"):
   raise RuntimeError("error: set_xattr/get_xattr failed with " +
       "an extended attribute containing NULL")
 
+# queue a batch of aio and wait for it
+import threading
+done = threading.Semaphore(0)
+results = {}
+def write_safe(completion):
+    done.release()
+for i in range(16):
+    foo3_ioctx.aio_write_full("aio%d" % i, "aio%d" % i, onsafe=write_safe)
+for i in range(16):
+    done.acquire()
+def read_done(completion, data):
+    results[data] = completion.get_return_value()
+    done.release()
+for i in range(16):
+    foo3_ioctx.aio_read("aio%d" % i, 16, 0, read_done)
+for i in range(16):
+    done.acquire()
+for i in range(16):
+    if (results.get("aio%d" % i) != len("aio%d" % i)):
+        raise RuntimeError("error: aio_read of aio%d didn't return its data" % i)
+c = foo3_ioctx.aio_read("nonexistent", 16, 0, None)
+c.wait_for_complete()
+if (c.get_return_value() != -2):
+    raise RuntimeError("error: expected aio_read of a missing object to fail")
+num = 0
+for batch in foo3_ioctx.list_objects_batched(5):
+    if (len(batch) > 5):
+        raise RuntimeError("error: object batch larger than asked for")
+    num += len(batch)
+if (num != 19):
+    raise RuntimeError("error: expected 19 objects in foo3, listed %d" % num)
+
 # create some snapshots and do stuff with them
 print "creating snap bjork"
 foo3_ioctx.create_snap("bjork")
@@ -4,4 +4,10 @@
      --export-crush <file>   write osdmap's crush map to <file>
      --import-crush <file>   replace osdmap's crush map with <file>
      --test-map-pg <pgid>    map a pgid to osds
+     --test-map-pgs          map all pgs, show how they spread over the osds
+     --test-map-objects <n>  same, weighted by <n> sample objects per pool
+     --pool <poolid>         only map pgs in this pool
+     --threads <n>           map with this many threads
+     --compare <file>        count pg copies that move from that osdmap to this one
+                             (default with --import-crush: the map before the import)
   [1]
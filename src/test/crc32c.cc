@@ -0,0 +1,67 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/types.h"
+#include "include/crc32c.h"
+#include "common/crc32c_intel_fast.h"
+
+#include "gtest/gtest.h"
+
+TEST(Crc32c, Small) {
+  const char *a = "foo bar baz";
+  const char *b = "whiz bang boom";
+  ASSERT_EQ(4119623852u, ceph_crc32c_le(0, (unsigned char *)a, strlen(a)));
+  ASSERT_EQ(881700046u, ceph_crc32c_le(1234, (unsigned char *)a, strlen(a)));
+  ASSERT_EQ(2360230088u, ceph_crc32c_le(0, (unsigned char *)b, strlen(b)));
+  ASSERT_EQ(3743019208u, ceph_crc32c_le(5678, (unsigned char *)b, strlen(b)));
+}
+
+TEST(Crc32c, PartialWord) {
+  const char *a = (const char *)malloc(5);
+  const char *b = (const char *)malloc(35);
+  memset((void *)a, 1, 5);
+  memset((void *)b, 1, 35);
+  ASSERT_EQ(2715569182u, ceph_crc32c_le(0, (unsigned char *)a, 5));
+  ASSERT_EQ(440531800u, ceph_crc32c_le(0, (unsigned char *)b, 35));
+  free((void *)a);
+  free((void *)b);
+}
+
+TEST(Crc32c, Big) {
+  int len = 4096000;
+  char *a = (char *)malloc(len);
+  memset(a, 1, len);
+  ASSERT_EQ(31583199u, ceph_crc32c_le(0, (unsigned char *)a, len));
+  ASSERT_EQ(1400919119u, ceph_crc32c_le(1234, (unsigned char *)a, len));
+  free(a);
+}
+
+TEST(Crc32c, Implementations) {
+  if (!ceph_crc32c_intel_fast_exists())
+    return;  // nothing to compare against
+
+  unsigned char buf[1024 + 8];
+  for (unsigned i = 0; i < sizeof(buf); i++)
+    buf[i] = rand();
+  for (int iter = 0; iter < 1000; iter++) {
+    unsigned off = rand() % 8;
+    unsigned len = rand() % 1024;
+    uint32_t seed = rand();
+    ASSERT_EQ(ceph_crc32c_sctp(seed, buf + off, len),
+	      ceph_crc32c_intel_fast(seed, buf + off, len));
+  }
+}
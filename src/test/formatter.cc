@@ -178,3 +178,20 @@ TEST(XmlFormatter, NamespaceTest) {
     "<foo xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\">"
     "<blah>hithere</blah><pi>3.14</pi></foo>");
 }
+
+TEST(XmlFormatter, PartialFlush) {
+  ostringstream oss;
+  XMLFormatter fmt(false);
+  ASSERT_EQ(fmt.get_len(), 0);
+
+  fmt.open_array_section("foo");
+  fmt.dump_int("a", 1);
+  ASSERT_EQ(fmt.get_len(), (int)strlen("<foo><a>1</a>"));
+  fmt.flush(oss);
+  ASSERT_EQ(fmt.get_len(), 0);
+  fmt.dump_int("b", 2);
+  fmt.close_section();
+  ASSERT_EQ(fmt.get_len(), (int)strlen("<b>2</b></foo>"));
+  fmt.flush(oss);
+  ASSERT_EQ(oss.str(), "<foo><a>1</a><b>2</b></foo>");
+}
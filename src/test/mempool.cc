@@ -0,0 +1,96 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/mempool.h"
+#include "include/buffer.h"
+#include "include/encoding.h"
+#include "gtest/gtest.h"
+
+#include <list>
+#include <map>
+
+static int64_t pool_bytes(int ix)
+{
+  int64_t bytes, items;
+  mempool::get_stats(ix, &bytes, &items);
+  return bytes;
+}
+
+static int64_t pool_items(int ix)
+{
+  int64_t bytes, items;
+  mempool::get_stats(ix, &bytes, &items);
+  return items;
+}
+
+typedef std::list<int, mempool::pool_allocator<mempool::osd_pglog, int> > pglog_list;
+typedef std::map<int, int, std::less<int>,
+		 mempool::pool_allocator<mempool::osd_missing, std::pair<const int, int> > > missing_map;
+
+TEST(Mempool, Containers) {
+  int64_t items = pool_items(mempool::osd_pglog);
+  int64_t bytes = pool_bytes(mempool::osd_pglog);
+  {
+    pglog_list l;
+    for (int i = 0; i < 100; i++)
+      l.push_back(i);
+    ASSERT_EQ(items + 100, pool_items(mempool::osd_pglog));
+    ASSERT_LE(bytes + 100 * (int64_t)sizeof(int), pool_bytes(mempool::osd_pglog));
+
+    // the encoders take any allocator
+    bufferlist bl;
+    ::encode(l, bl);
+    pglog_list l2;
+    bufferlist::iterator p = bl.begin();
+    ::decode(l2, p);
+    ASSERT_TRUE(l == l2);
+    ASSERT_EQ(items + 200, pool_items(mempool::osd_pglog));
+  }
+  ASSERT_EQ(items, pool_items(mempool::osd_pglog));
+  ASSERT_EQ(bytes, pool_bytes(mempool::osd_pglog));
+
+  int64_t mitems = pool_items(mempool::osd_missing);
+  {
+    missing_map m;
+    m[1] = 2;
+    m[3] = 4;
+    ASSERT_EQ(mitems + 2, pool_items(mempool::osd_missing));
+  }
+  ASSERT_EQ(mitems, pool_items(mempool::osd_missing));
+}
+
+struct Obc {
+  MEMPOOL_CLASS_HELPERS(mempool::osd_obc)
+  char stuff[100];
+};
+
+TEST(Mempool, Class) {
+  int64_t bytes = pool_bytes(mempool::osd_obc);
+  Obc *o = new Obc;
+  ASSERT_EQ(bytes + (int64_t)sizeof(Obc), pool_bytes(mempool::osd_obc));
+  delete o;
+  ASSERT_EQ(bytes, pool_bytes(mempool::osd_obc));
+}
+
+TEST(Mempool, Buffer) {
+  int64_t anon = pool_bytes(mempool::buffer_anon);
+  int64_t msg = pool_bytes(mempool::buffer_msg);
+  {
+    bufferlist bl;
+    bl.append(buffer::create(4096));
+    ASSERT_EQ(anon + 4096, pool_bytes(mempool::buffer_anon));
+    bl.reassign_to_mempool(mempool::buffer_msg);
+    ASSERT_EQ(anon, pool_bytes(mempool::buffer_anon));
+    ASSERT_EQ(msg + 4096, pool_bytes(mempool::buffer_msg));
+  }
+  ASSERT_EQ(msg, pool_bytes(mempool::buffer_msg));
+}
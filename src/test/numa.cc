@@ -0,0 +1,37 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/numa.h"
+#include "gtest/gtest.h"
+
+#include <errno.h>
+
+TEST(CpuSet, Parse) {
+  cpu_set_t s;
+  ASSERT_EQ(0, parse_cpu_set_list("0-3,8,10-11", &s));
+  ASSERT_EQ(7, CPU_COUNT(&s));
+  ASSERT_TRUE(CPU_ISSET(3, &s));
+  ASSERT_FALSE(CPU_ISSET(4, &s));
+  ASSERT_EQ("0-3,8,10-11", cpu_set_to_str_list(&s));
+
+  // as read from sysfs
+  ASSERT_EQ(0, parse_cpu_set_list("5\n", &s));
+  ASSERT_EQ("5", cpu_set_to_str_list(&s));
+}
+
+TEST(CpuSet, Malformed) {
+  cpu_set_t s;
+  ASSERT_EQ(-EINVAL, parse_cpu_set_list("", &s));
+  ASSERT_EQ(-EINVAL, parse_cpu_set_list("3-1", &s));
+  ASSERT_EQ(-EINVAL, parse_cpu_set_list("1,x", &s));
+  ASSERT_EQ(-EINVAL, parse_cpu_set_list("-1", &s));
+}
@@ -11,14 +11,16 @@
 
 void TestOp::begin()
 {
-  //if (stat) stat->begin(this);
+  if (stat) stat->begin(this);
   _begin();
 }
 
 void TestOp::finish()
 {
+  // we may be deleted as soon as _finish() makes us finished(), so the
+  // loop reports to stat, not us
+  finish_time = TestOpStat::gettime();
   _finish();
-  //if (stat && finished()) stat->end(this);
 }
 
 void callback(librados::completion_t cb, void *arg) {
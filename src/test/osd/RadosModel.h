@@ -40,11 +40,13 @@ public:
   RadosTestContext *context;
   TestOpStat *stat;
   bool done;
+  uint64_t finish_time;  // of the last completion
   TestOp(RadosTestContext *context,
 	 TestOpStat *stat = 0) :
     context(context),
     stat(stat),
-    done(0)
+    done(0),
+    finish_time(0)
   {}
 
   virtual ~TestOp();
@@ -86,6 +88,7 @@ public:
   int seq_num;
   map<int,uint64_t> snaps;
   uint64_t seq;
+  double target_ops_per_sec;  // 0 for as fast as max_in_flight allows
   
 	
   RadosTestContext(const string &pool_name, 
@@ -98,7 +101,7 @@ public:
     pool_name(pool_name),
     errors(0),
     max_in_flight(max_in_flight),
-    cont_gen(cont_gen), seq_num(0), seq(0)
+    cont_gen(cont_gen), seq_num(0), seq(0), target_ops_per_sec(0)
   {
     rados.init(id);
     rados.conf_read_file("ceph.conf");
@@ -119,6 +122,7 @@ public:
   void loop(TestOpGenerator *gen)
   {
     list<TestOp*> inflight;
+    uint64_t start = TestOpStat::gettime(), issued = 0;
     state_lock.Lock();
 
     TestOp *next = gen->next(*this);
@@ -128,6 +132,13 @@ public:
       }
       state_lock.Unlock();
       if (next) {
+	if (target_ops_per_sec > 0) {
+	  uint64_t due = start + (uint64_t)(issued * 1000000.0 / target_ops_per_sec);
+	  uint64_t now = TestOpStat::gettime();
+	  if (due > now)
+	    usleep(due - now);
+	}
+	issued++;
 	(*inflight.rbegin())->begin();
       }
       state_lock.Lock();
@@ -135,6 +146,8 @@ public:
 	for (list<TestOp*>::iterator i = inflight.begin();
 	     i != inflight.end();) {
 	  if ((*i)->finished()) {
+	    if ((*i)->stat)
+	      (*i)->stat->end(*i, (*i)->finish_time);
 	    delete *i;
 	    inflight.erase(i++);
 	  } else {
@@ -10,12 +10,16 @@
 void TestOpStat::begin(TestOp *in) {
   stat_lock.Lock();
   stats[in->getType()].begin(in);
+  if (!first_begin)
+    first_begin = gettime();
   stat_lock.Unlock();
 }
 
-void TestOpStat::end(TestOp *in) {
+void TestOpStat::end(TestOp *in, uint64_t when) {
   stat_lock.Lock();
-  stats[in->getType()].end(in);
+  stats[in->getType()].end(in, when);
+  if (when > last_end)
+    last_end = when;
   stat_lock.Unlock();
 }
 
@@ -33,13 +37,39 @@ void TestOpStat::TypeStatus::export_latencies(map<double,uint64_t> &in) const
     ++j;
   }
 }
+
+void TestOpStat::TypeStatus::export_histogram(map<uint64_t,uint64_t> &in) const
+{
+  uint64_t bound = 1;
+  for (multiset<uint64_t>::const_iterator j = latencies.begin();
+       j != latencies.end();
+       ++j) {
+    while (*j >= bound)
+      bound <<= 1;
+    in[bound]++;
+  }
+}
   
 std::ostream & operator<<(std::ostream &out, TestOpStat &rhs)
 {
   rhs.stat_lock.Lock();
+  double secs = (double)(rhs.last_end - rhs.first_begin) / 1000000.0;
+  uint64_t total = 0;
+  for (map<string,TestOpStat::TypeStatus>::iterator i = rhs.stats.begin();
+       i != rhs.stats.end();
+       ++i)
+    total += i->second.latencies.size();
+  if (total && secs > 0)
+    out << total << " ops in " << secs << " sec: " << (double)total / secs
+	<< " ops/sec" << std::endl;
+
   for (map<string,TestOpStat::TypeStatus>::iterator i = rhs.stats.begin();
        i != rhs.stats.end();
        ++i) {
+    if (secs > 0)
+      out << i->first << ": " << i->second.latencies.size() << " ops, "
+	  << (double)i->second.latencies.size() / secs << " ops/sec" << std::endl;
+
     map<double,uint64_t> latency;
     latency[10] = 0;
     latency[50] = 0;
@@ -55,6 +85,15 @@ std::ostream & operator<<(std::ostream &out, TestOpStat &rhs)
       out << "\t" << j->first << "th percentile: " 
 	  << j->second / 1000 << "ms" << std::endl;
     }
+
+    map<uint64_t,uint64_t> hist;
+    i->second.export_histogram(hist);
+    out << i->first << " latency histogram: " << std::endl;
+    for (map<uint64_t,uint64_t>::iterator j = hist.begin();
+	 j != hist.end();
+	 ++j) {
+      out << "\t< " << j->first << "us: " << j->second << std::endl;
+    }
   }
   rhs.stat_lock.Unlock();
   return out;
@@ -11,8 +11,9 @@ struct TestOp;
 class TestOpStat {
 public:
   Mutex stat_lock;
+  uint64_t first_begin, last_end;  // for throughput
 
-  TestOpStat() : stat_lock("TestOpStat lock") {}
+  TestOpStat() : stat_lock("TestOpStat lock"), first_begin(0), last_end(0) {}
     
   static uint64_t gettime()
   {
@@ -31,20 +32,22 @@ public:
       inflight[in] = gettime();
     }
 
-    void end(TestOp *in)
+    void end(TestOp *in, uint64_t when)
     {
       assert(inflight.count(in));
-      uint64_t curtime = gettime();
-      latencies.insert(curtime - inflight[in]);
+      latencies.insert(when - inflight[in]);
       inflight.erase(in);
     }
 
     void export_latencies(map<double,uint64_t> &in) const;
+    /// latency histogram: power of two upper bound (us) -> count
+    void export_histogram(map<uint64_t,uint64_t> &in) const;
   };
   map<string,TypeStatus> stats;
 
   void begin(TestOp *in);
-  void end(TestOp *in);
+  /// in completed at when (gettime())
+  void end(TestOp *in, uint64_t when);
   friend std::ostream & operator<<(std::ostream &, TestOpStat&);
 };
 
@@ -9,6 +9,7 @@
 #include <list>
 #include <string>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "test/osd/RadosModel.h"
@@ -30,8 +31,10 @@ struct ReadWriteGenerator : public TestOpGenerator
   int ops;
   int objects;
   int read_percent;
-  ReadWriteGenerator(int ops, int objects, int read_percent) :
-    nextop(0), op(0), ops(ops), objects(objects), read_percent(read_percent)
+  TestOpStat *stats;
+  ReadWriteGenerator(int ops, int objects, int read_percent, TestOpStat *stats) :
+    nextop(0), op(0), ops(ops), objects(objects), read_percent(read_percent),
+    stats(stats)
   {}
 
 
@@ -56,16 +59,22 @@ struct ReadWriteGenerator : public TestOpGenerator
     if (switchval < read_percent) {
       string oid = *(rand_choose(context.oid_not_in_use));
       cout << "Reading " << oid << std::endl;
-      return new ReadOp(&context, oid, 0);
+      return new ReadOp(&context, oid, stats);
     } else {
       string oid = *(rand_choose(context.oid_not_in_use));
       cout << "Writing " << oid << " current snap is "
 	   << context.current_snap << std::endl;
-      return new WriteOp(&context, oid, 0);
+      return new WriteOp(&context, oid, stats);
     }
   }
 };
 
+/*
+ * testreadwrite [ops [objects [read_percent [max_in_flight [size]]]]]
+ *               [--rate <ops/sec>] [--quiet]
+ *
+ * as for testsnaps.
+ */
 int main(int argc, char **argv)
 {
   int ops = 10000;
@@ -73,24 +82,36 @@ int main(int argc, char **argv)
   int read_percent = 50;
   int max_in_flight = 16;
   int size = 4000000; // 4 MB
-  if (argc > 1) {
-    ops = atoi(argv[1]);
+  double rate = 0;
+  vector<char*> args;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+      rate = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      cout.setstate(ios::failbit);
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+
+  if (args.size() > 0) {
+    ops = atoi(args[0]);
   }
 
-  if (argc > 2) {
-    objects = atoi(argv[2]);
+  if (args.size() > 1) {
+    objects = atoi(args[1]);
   }
 
-  if (argc > 3) {
-    read_percent = atoi(argv[3]);
+  if (args.size() > 2) {
+    read_percent = atoi(args[2]);
   }
 
-  if (argc > 4) {
-    max_in_flight = atoi(argv[4]);
+  if (args.size() > 3) {
+    max_in_flight = atoi(args[3]);
   }
 
-  if (argc > 5) {
-    size = atoi(argv[5]);
+  if (args.size() > 4) {
+    size = atoi(args[4]);
   }
 
   if (max_in_flight > objects) {
@@ -104,11 +125,14 @@ int main(int argc, char **argv)
   string pool_name = "data";
   VarLenGenerator cont_gen(size);
   RadosTestContext context(pool_name, max_in_flight, cont_gen, id);
+  context.target_ops_per_sec = rate;
 
-  ReadWriteGenerator gen = ReadWriteGenerator(ops, objects, read_percent);
+  TestOpStat stats;
+  ReadWriteGenerator gen = ReadWriteGenerator(ops, objects, read_percent, &stats);
   context.loop(&gen);
 
   context.shutdown();
   cerr << context.errors << " errors." << std::endl;
+  cerr << stats << std::endl;
   return 0;
 }
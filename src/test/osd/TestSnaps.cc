@@ -9,6 +9,7 @@
 #include <list>
 #include <string>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "test/osd/RadosModel.h"
@@ -80,26 +81,45 @@ struct SnapTestGenerator : public TestOpGenerator
   }
 };
 		
+/*
+ * testsnaps [ops [objects [max_in_flight [size]]]] [--rate <ops/sec>] [--quiet]
+ *
+ * --rate paces op submission, --quiet drops the per-op log so it doesn't
+ * skew timing; per-op-type throughput, latency percentiles and histograms
+ * are printed at the end either way.
+ */
 int main(int argc, char **argv)
 {
   int ops = 1000;
   int objects = 50;
   int max_in_flight = 16;
   int size = 400000;
-  if (argc > 1) {
-    ops = atoi(argv[1]);
+  double rate = 0;
+  vector<char*> args;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+      rate = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      cout.setstate(ios::failbit);
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+
+  if (args.size() > 0) {
+    ops = atoi(args[0]);
   }
 
-  if (argc > 2) {
-    objects = atoi(argv[2]);
+  if (args.size() > 1) {
+    objects = atoi(args[1]);
   }
 
-  if (argc > 3) {
-    max_in_flight = atoi(argv[3]);
+  if (args.size() > 2) {
+    max_in_flight = atoi(args[2]);
   }
 
-  if (argc > 4) {
-    size = atoi(argv[4]);
+  if (args.size() > 3) {
+    size = atoi(args[3]);
   }
 
   if (max_in_flight > objects) {
@@ -114,6 +134,7 @@ int main(int argc, char **argv)
   string pool_name = "data";
   VarLenGenerator cont_gen(size);
   RadosTestContext context(pool_name, max_in_flight, cont_gen, id);
+  context.target_ops_per_sec = rate;
 
   TestOpStat stats;
   SnapTestGenerator gen = SnapTestGenerator(ops, objects, &stats);
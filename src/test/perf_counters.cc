@@ -18,6 +18,7 @@
 #include "common/config.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
+#include "common/Thread.h"
 #include "test/unit.h"
 
 #include <errno.h>
@@ -147,3 +148,66 @@ TEST(PerfCounters, MultiplePerfCounters) {
   ASSERT_EQ("", client.get_message(&msg));
   ASSERT_EQ("{}", msg);
 }
+
+enum {
+  TEST_PERFCOUNTERS3_ELEMENT_FIRST = 600,
+  TEST_PERFCOUNTERS3_ELEMENT_HIST,
+  TEST_PERFCOUNTERS3_ELEMENT_LAST,
+};
+
+TEST(PerfCounters, Histogram) {
+  PerfCountersCollection *coll = g_ceph_context->get_perfcounters_collection();
+  coll->clear();
+  PerfCountersBuilder bld(g_ceph_context, "test_perfcounter_3",
+	  TEST_PERFCOUNTERS3_ELEMENT_FIRST, TEST_PERFCOUNTERS3_ELEMENT_LAST);
+  bld.add_u64_hist(TEST_PERFCOUNTERS3_ELEMENT_HIST, "hist");
+  PerfCounters *fake_pf = bld.create_perf_counters();
+  coll->add(fake_pf);
+  g_ceph_context->_conf->set_val_or_die("admin_socket", get_rand_socket_path());
+  g_ceph_context->_conf->apply_changes(NULL);
+  AdminSocketClient client(get_rand_socket_path());
+  std::string msg;
+
+  ASSERT_EQ("", client.get_message(&msg));
+  ASSERT_EQ(sd("{'test_perfcounter_3':{'hist':{'avgcount':0,'sum':0,'buckets':[]}}}"), msg);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 0);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 1);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 5);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 7);
+  fake_pf->hinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, 8);
+  ASSERT_EQ("", client.get_message(&msg));
+  ASSERT_EQ(sd("{'test_perfcounter_3':{'hist':{'avgcount':5,'sum':21,"
+	       "'buckets':[2,0,2,1]}}}"), msg);
+  ASSERT_EQ("", client.get_schema(&msg));
+  ASSERT_EQ(sd("{'test_perfcounter_3':{'hist':{'type':18}}}"), msg);
+  coll->clear();
+}
+
+class PerfCountersHammer : public Thread {
+  PerfCounters *pc;
+public:
+  PerfCountersHammer(PerfCounters *p) : pc(p) {}
+  void *entry() {
+    for (int i = 0; i < 100000; i++) {
+      pc->inc(TEST_PERFCOUNTERS1_ELEMENT_1);
+      pc->finc(TEST_PERFCOUNTERS1_ELEMENT_3, 0.5);
+    }
+    return NULL;
+  }
+};
+
+TEST(PerfCounters, ConcurrentUpdates) {
+  PerfCounters *fake_pf = setup_test_perfcounters1(g_ceph_context);
+  PerfCountersHammer *t[4];
+  for (int i = 0; i < 4; i++) {
+    t[i] = new PerfCountersHammer(fake_pf);
+    t[i]->create();
+  }
+  for (int i = 0; i < 4; i++) {
+    t[i]->join();
+    delete t[i];
+  }
+  ASSERT_EQ(400000u, fake_pf->get(TEST_PERFCOUNTERS1_ELEMENT_1));
+  ASSERT_EQ(200000.0, fake_pf->fget(TEST_PERFCOUNTERS1_ELEMENT_3));
+  delete fake_pf;
+}
@@ -691,3 +691,39 @@ TEST(LibRadosAio, RoundTripWriteFullPP) {
   delete my_completion2;
   delete my_completion3;
 }
+
+TEST(LibRadosAio, OperateBatchPP) {
+  AioTestDataPP test_data;
+  ASSERT_EQ("", test_data.init());
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl1;
+  bl1.append(buf, sizeof(buf));
+  std::vector<std::string> oids;
+  std::vector<AioCompletion*> cs;
+  std::vector<ObjectWriteOperation*> ops;
+  for (int i = 0; i < 8; i++) {
+    ostringstream oss;
+    oss << "foo" << i;
+    oids.push_back(oss.str());
+    cs.push_back(test_data.m_cluster.aio_create_completion(NULL, NULL, NULL));
+    ObjectWriteOperation *op = new ObjectWriteOperation;
+    op->write_full(bl1);
+    ops.push_back(op);
+  }
+  ASSERT_EQ(0, test_data.m_ioctx.aio_operate_batch(oids, cs, ops));
+  for (unsigned i = 0; i < cs.size(); i++) {
+    {
+      TestAlarm alarm;
+      ASSERT_EQ(0, cs[i]->wait_for_safe());
+    }
+    ASSERT_EQ(0, cs[i]->get_return_value());
+    cs[i]->release();
+    delete ops[i];
+  }
+  for (unsigned i = 0; i < oids.size(); i++) {
+    bufferlist bl2;
+    ASSERT_EQ((int)sizeof(buf), test_data.m_ioctx.read(oids[i], bl2, sizeof(buf), 0));
+    ASSERT_EQ(0, memcmp(buf, bl2.c_str(), sizeof(buf)));
+  }
+}
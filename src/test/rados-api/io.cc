@@ -455,3 +455,58 @@ TEST(LibRadosIo, XattrListPP) {
   ioctx.close();
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
+
+TEST(LibRadosIo, ReadCachePP) {
+  char buf[128];
+  Rados cluster;
+  IoCtx ioctx, other;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  cluster.ioctx_create(pool_name.c_str(), other);
+  ioctx.set_read_cache(true);
+
+  bufferlist bl;
+  ASSERT_EQ(-ENOENT, ioctx.read("foo", bl, sizeof(buf), 0));
+  memset(buf, 0xaa, sizeof(buf));
+  bufferlist bl1;
+  bl1.append(buf, sizeof(buf));
+  ASSERT_EQ(0, other.write_full("foo", bl1));
+  bufferlist attr;
+  attr.append("bar");
+  ASSERT_EQ(0, other.setxattr("foo", "attr", attr));
+
+  // served twice, the second time from the cache
+  for (int i = 0; i < 2; i++) {
+    bufferlist bl2;
+    ASSERT_EQ((int)sizeof(buf), ioctx.read("foo", bl2, sizeof(buf), 0));
+    ASSERT_EQ(0, memcmp(bl2.c_str(), buf, sizeof(buf)));
+    bufferlist bl3;
+    ASSERT_EQ(16, ioctx.read("foo", bl3, 16, 100));
+    bufferlist bl4;
+    ASSERT_EQ(3, ioctx.getxattr("foo", "attr", bl4));
+    ASSERT_EQ(0, memcmp(bl4.c_str(), "bar", 3));
+    bufferlist bl5;
+    ASSERT_EQ(-ENODATA, ioctx.getxattr("foo", "nope", bl5));
+    uint64_t size;
+    time_t mtime;
+    ASSERT_EQ(0, ioctx.stat("foo", &size, &mtime));
+    ASSERT_EQ(sizeof(buf), size);
+  }
+
+  // writes from the same client are seen at once
+  memset(buf, 0xbb, sizeof(buf));
+  bufferlist bl6;
+  bl6.append(buf, sizeof(buf));
+  ASSERT_EQ(0, other.write_full("foo", bl6));
+  bufferlist bl7;
+  ASSERT_EQ((int)sizeof(buf), ioctx.read("foo", bl7, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp(bl7.c_str(), buf, sizeof(buf)));
+  ASSERT_EQ(0, other.remove("foo"));
+  bufferlist bl8;
+  ASSERT_EQ(-ENOENT, ioctx.read("foo", bl8, sizeof(buf), 0));
+
+  other.close();
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
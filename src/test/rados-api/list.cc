@@ -47,3 +47,33 @@ TEST(LibRadosList, ListObjectsPP) {
   ioctx.close();
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
+
+TEST(LibRadosList, ListObjectsByPGPP) {
+  std::string pool_name = get_temp_pool_name();
+  Rados cluster;
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  bufferlist bl1;
+  bl1.append("x");
+  std::set<std::string> written;
+  for (int i = 0; i < 50; i++) {
+    char oid[20];
+    snprintf(oid, sizeof(oid), "obj%d", i);
+    ASSERT_EQ(1, ioctx.write(oid, bl1, 1, 0));
+    written.insert(oid);
+  }
+  uint32_t pg_num = 0;
+  ASSERT_EQ(0, ioctx.get_pg_num(&pg_num));
+  ASSERT_LT(0u, pg_num);
+  std::set<std::string> listed;
+  for (uint32_t pg = 0; pg < pg_num; pg++) {
+    for (ObjectIterator iter = ioctx.pg_objects_begin(pg);
+	 iter != ioctx.objects_end(); ++iter) {
+      ASSERT_TRUE(listed.insert(*iter).second);
+    }
+  }
+  ASSERT_TRUE(written == listed);
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
@@ -305,6 +305,36 @@ TEST(LibRadosMisc, CloneRangePP) {
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
 
+TEST(LibRadosMisc, SrcCmpxattrPP) {
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name.c_str(), ioctx));
+  bufferlist val;
+  val.append("val");
+  // the source sits under the target's name, which has no key of its own
+  ioctx.locator_set_key("dst");
+  ASSERT_EQ(0, ioctx.setxattr("src", "a", val));
+  ioctx.locator_set_key("");
+  bufferlist bl;
+  bl.append("data");
+
+  ObjectWriteOperation o;
+  o.src_cmpxattr("src", "a", CEPH_OSD_CMPXATTR_OP_EQ, val);
+  o.write_full(bl);
+  ASSERT_GE(ioctx.operate("dst", &o), 0);
+
+  bufferlist other;
+  other.append("other");
+  ObjectWriteOperation o2;
+  o2.src_cmpxattr("src", "a", CEPH_OSD_CMPXATTR_OP_EQ, other);
+  o2.write_full(bl);
+  ASSERT_LT(ioctx.operate("dst", &o2), 0);
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
 TEST(LibRadosMisc, CloneRange) {
   char buf[128];
   rados_t cluster;
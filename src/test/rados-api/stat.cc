@@ -46,6 +46,30 @@ TEST(LibRadosStat, StatPP) {
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
 
+TEST(LibRadosStat, ChecksumPP) {
+  char buf[128];
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl;
+  bl.append(buf, sizeof(buf));
+  ASSERT_EQ((int)sizeof(buf), ioctx.write("foo", bl, sizeof(buf), 0));
+  uint32_t crc;
+  ASSERT_EQ((int)sizeof(buf), ioctx.checksum("foo", 0, 0, &crc));
+  ASSERT_EQ(bl.crc32c(-1), crc);
+  bufferlist part;
+  part.substr_of(bl, 16, 32);
+  ASSERT_EQ(32, ioctx.checksum("foo", 16, 32, &crc));
+  ASSERT_EQ(part.crc32c(-1), crc);
+  ASSERT_EQ(0, ioctx.checksum("foo", sizeof(buf), 0, &crc));
+  ASSERT_EQ(-ENOENT, ioctx.checksum("nonexistent", 0, 0, &crc));
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
 TEST(LibRadosStat, ClusterStat) {
   rados_t cluster;
   std::string pool_name = get_temp_pool_name();
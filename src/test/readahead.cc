@@ -0,0 +1,74 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2011 New Dream Network
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "osdc/Readahead.h"
+#include "gtest/gtest.h"
+
+typedef Readahead::extent_t extent_t;
+
+TEST(Readahead, Disabled) {
+  Readahead ra;
+  ASSERT_EQ(extent_t(0, 0), ra.update(0, 4096, 1 << 30));
+  ASSERT_EQ(extent_t(0, 0), ra.update(4096, 4096, 1 << 30));
+}
+
+TEST(Readahead, Sequential) {
+  Readahead ra;
+  ra.set_limits(128 << 10, 1 << 20);
+  std::vector<uint64_t> a;
+  a.push_back(4 << 20);
+  ra.set_alignments(a);
+
+  // the first read says nothing about the pattern
+  ASSERT_EQ(extent_t(0, 0), ra.update(0, 4096, 1 << 30));
+  // the second contiguous one opens a min-sized window after it
+  ASSERT_EQ(extent_t(8192, 128 << 10), ra.update(4096, 4096, 1 << 30));
+  // nothing more until we are halfway through it
+  ASSERT_EQ(extent_t(0, 0), ra.update(8192, 4096, 1 << 30));
+  // then the next, twice as big, window follows the last one
+  ASSERT_EQ(extent_t(8192 + (128 << 10), 256 << 10), ra.update(12288, 64 << 10, 1 << 30));
+  ASSERT_EQ(256u << 10, ra.get_window());
+
+  // a seek starts over
+  ASSERT_EQ(extent_t(0, 0), ra.update(100 << 20, 4096, 1 << 30));
+  ASSERT_EQ(0u, ra.get_nr_consec());
+  ASSERT_EQ(0u, ra.get_window());
+}
+
+TEST(Readahead, MaxAndLimit) {
+  Readahead ra;
+  ra.set_limits(0, 16384);
+  ra.update(0, 4096, 1 << 30);
+  ASSERT_EQ(extent_t(8192, 16384), ra.update(4096, 4096, 1 << 30));
+  // windows stop growing at max
+  ASSERT_EQ(extent_t(24576, 16384), ra.update(8192, 12288, 1 << 30));
+  // and never reach past the limit
+  ASSERT_EQ(extent_t(40960, 1000), ra.update(20480, 12288, 41960));
+  ASSERT_EQ(extent_t(0, 0), ra.update(32768, 9192, 41960));
+}
+
+TEST(Readahead, Alignment) {
+  Readahead ra;
+  ra.set_limits(100000, 1 << 20);
+  std::vector<uint64_t> a;
+  a.push_back(4096);
+  a.push_back(65536);
+  ra.set_alignments(a);
+  ra.update(0, 4096, 1 << 30);
+  // rounded down to the largest alignment that keeps most of the window
+  extent_t e = ra.update(4096, 4096, 1 << 30);
+  ASSERT_EQ(8192u, e.first);
+  ASSERT_EQ(0u, (e.first + e.second) % 65536);
+  ASSERT_EQ(65536u - 8192, e.second);
+}
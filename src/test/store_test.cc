@@ -111,6 +111,107 @@ TEST_F(StoreTest, SimpleObjectTest) {
   }
 }
 
+// every written range must come back, whether or not fiemap finds holes
+static void check_sparse_read(ObjectStore *store, coll_t cid, const hobject_t& hoid,
+			      const map<uint64_t, bufferlist>& written, uint64_t len)
+{
+  map<uint64_t, uint64_t> m;
+  bufferlist data;
+  int r = store->sparse_read(cid, hoid, 0, len, m, data);
+  ASSERT_GE(r, 0);
+  ASSERT_EQ((unsigned)r, data.length());
+  map<uint64_t, uint64_t> pos;  // extent offset -> offset in data
+  uint64_t o = 0;
+  for (map<uint64_t, uint64_t>::iterator p = m.begin(); p != m.end(); ++p) {
+    pos[p->first] = o;
+    o += p->second;
+  }
+  for (map<uint64_t, bufferlist>::const_iterator w = written.begin(); w != written.end(); ++w) {
+    map<uint64_t, uint64_t>::iterator p = m.upper_bound(w->first);
+    ASSERT_TRUE(p != m.begin());
+    --p;
+    ASSERT_LE(w->first + w->second.length(), p->first + p->second);
+    bufferlist got;
+    got.substr_of(data, pos[p->first] + w->first - p->first, w->second.length());
+    bufferlist want = w->second;
+    ASSERT_EQ(0, memcmp(got.c_str(), want.c_str(), want.length()));
+  }
+}
+
+TEST_F(StoreTest, SparseReadTest) {
+  int r;
+  coll_t cid = coll_t("coll");
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  hobject_t hoid(sobject_t("Sparse", CEPH_NOSNAP));
+  map<uint64_t, bufferlist> written;
+  uint64_t offs[] = { 0, 1 << 20, 512 << 10 };
+  for (unsigned i = 0; i < 3; i++) {
+    bufferptr bp(65536);
+    memset(bp.c_str(), 'a' + i, bp.length());
+    bufferlist bl;
+    bl.push_back(bp);
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, offs[i], bl.length(), bl);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+    written[offs[i]] = bl;
+    // twice: the second read may come from the extent cache, and the
+    // write we do next must invalidate it
+    check_sparse_read(store.get(), cid, hoid, written, 2 << 20);
+    check_sparse_read(store.get(), cid, hoid, written, 2 << 20);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_F(StoreTest, AllocHintTest) {
+  int r;
+  coll_t cid = coll_t("coll");
+  hobject_t hoid(sobject_t("Hinted", CEPH_NOSNAP));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.touch(cid, hoid);
+    t.set_alloc_hint(cid, hoid, 4 << 20, 4 << 20);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  // whatever was preallocated reads back as a hole, and the size stays
+  struct stat st;
+  ASSERT_EQ(store->stat(cid, hoid, &st), 0);
+  ASSERT_EQ(st.st_size, 0);
+  map<uint64_t, bufferlist> written;
+  bufferptr bp(65536);
+  memset(bp.c_str(), 'h', bp.length());
+  bufferlist bl;
+  bl.push_back(bp);
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 1 << 20, bl.length(), bl);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  written[1 << 20] = bl;
+  check_sparse_read(store.get(), cid, hoid, written, 4 << 20);
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_F(StoreTest, SimpleObjectLongnameTest) {
   int r;
   coll_t cid = coll_t("coll");
@@ -139,6 +240,107 @@ TEST_F(StoreTest, SimpleObjectLongnameTest) {
   }
 }
 
+TEST_F(StoreTest, OmapTest) {
+  int r;
+  coll_t cid = coll_t("coll");
+  hobject_t hoid(sobject_t("Object 1", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("Object 2", CEPH_NOSNAP));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.touch(cid, hoid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  map<string, bufferlist> got;
+  map<string, bufferlist> kv;
+  for (int i = 0; i < 10; i++) {
+    char k[20];
+    snprintf(k, sizeof(k), "key%02d", i);
+    kv[k].append(k);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.omap_setkeys(cid, hoid, kv);
+    set<string> rm;
+    rm.insert("key03");
+    t.omap_rmkeys(cid, hoid, rm);
+    t.clone(cid, hoid, hoid2);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  got.clear();
+  r = store->omap_get_range(cid, hoid, "key05", 3, &got);
+  ASSERT_EQ(r, 0);
+  ASSERT_EQ(got.size(), 3u);
+  ASSERT_EQ(got.begin()->first, "key06");
+  ASSERT_EQ(string(got["key07"].c_str(), got["key07"].length()), "key07");
+
+  set<string> keys;
+  keys.insert("key02");
+  keys.insert("key03");
+  got.clear();
+  r = store->omap_get_values(cid, hoid2, keys, &got);
+  ASSERT_EQ(r, 0);
+  ASSERT_EQ(got.size(), 1u);
+  ASSERT_TRUE(got.count("key02"));
+
+  {
+    ObjectStore::Transaction t;
+    t.omap_clear(cid, hoid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  got.clear();
+  r = store->omap_get_range(cid, hoid, string(), 0, &got);
+  ASSERT_EQ(r, 0);
+  ASSERT_TRUE(got.empty());
+  got.clear();
+  r = store->omap_get_range(cid, hoid2, string(), 0, &got);
+  ASSERT_EQ(r, 0);
+  ASSERT_EQ(got.size(), 9u);
+
+  // a link in another collection carries its own copy of the map
+  coll_t cid2 = coll_t("coll2");
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid2);
+    t.collection_add(cid2, cid, hoid2);
+    t.collection_remove(cid, hoid2);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  got.clear();
+  r = store->omap_get_range(cid2, hoid2, string(), 0, &got);
+  ASSERT_EQ(r, 0);
+  ASSERT_EQ(got.size(), 9u);
+  {
+    ObjectStore::Transaction t;
+    t.touch(cid, hoid2);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  got.clear();
+  r = store->omap_get_range(cid, hoid2, string(), 0, &got);
+  ASSERT_EQ(r, 0);
+  ASSERT_TRUE(got.empty());
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid2, hoid2);
+    t.remove_collection(cid2);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_F(StoreTest, ManyObjectTest) {
   int NUM_OBJS = 2000;
   int r = 0;
@@ -179,6 +381,9 @@ TEST_F(StoreTest, ManyObjectTest) {
   ASSERT_EQ(r, 0);
 
   cerr << "objects.size() is " << objects.size() << std::endl;
+  // listed in the order hobject_t sorts by
+  for (unsigned i = 1; i < objects.size(); ++i)
+    ASSERT_LE(objects[i-1].get_filestore_key(), objects[i].get_filestore_key());
   for (vector<hobject_t> ::iterator i = objects.begin();
        i != objects.end();
        ++i) {
@@ -522,6 +727,62 @@ TEST_F(StoreTest, HashCollisionTest) {
   store->apply_transaction(t);
 }
 
+TEST_F(StoreTest, SplitCollectionTest) {
+  coll_t cid("parent"), child("child");
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.create_collection(child);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  set<hobject_t> created;
+  for (int i = 0; i < 2000; ++i) {
+    char buf[100];
+    sprintf(buf, "%d", i);
+    hobject_t hoid(string(buf), string(), CEPH_NOSNAP, i * 2654435761u);
+    ObjectStore::Transaction t;
+    t.touch(cid, hoid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+    created.insert(hoid);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.split_collection(cid, 5, 0x15, child);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  vector<hobject_t> left, moved;
+  r = store->collection_list(cid, left);
+  ASSERT_EQ(r, 0);
+  r = store->collection_list(child, moved);
+  ASSERT_EQ(r, 0);
+  ASSERT_EQ(created.size(), left.size() + moved.size());
+  for (vector<hobject_t>::iterator i = left.begin(); i != left.end(); ++i)
+    ASSERT_NE(0x15u, i->hash & 0x1f);
+  for (vector<hobject_t>::iterator i = moved.begin(); i != moved.end(); ++i) {
+    ASSERT_EQ(0x15u, i->hash & 0x1f);
+    ASSERT_TRUE(created.count(*i));
+    struct stat st;
+    ASSERT_EQ(0, store->stat(child, *i, &st));
+  }
+
+  for (set<hobject_t>::iterator i = created.begin();
+       i != created.end();
+       ++i) {
+    ObjectStore::Transaction t;
+    t.remove((i->hash & 0x1f) == 0x15 ? child : cid, *i);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  ObjectStore::Transaction t;
+  t.remove_collection(cid);
+  t.remove_collection(child);
+  store->apply_transaction(t);
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
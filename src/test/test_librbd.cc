@@ -15,6 +15,7 @@
 #include "include/rados/librados.h"
 #include "include/rbd/librbd.h"
 #include "include/rbd/librbd.hpp"
+#include "include/interval_set.h"
 
 #include "gtest/gtest.h"
 
@@ -283,6 +284,48 @@ TEST(LibRBD, TestCreateLsDeletePP)
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
 }
 
+TEST(LibRBD, TestRenameLegacyDirectoryPP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    int order = 0;
+    uint64_t size = 2 << 20;
+
+    ASSERT_EQ(0, rbd.create(ioctx, "testimg", size, &order));
+    ASSERT_EQ(0, rbd.create(ioctx, "oldimg", size, &order));
+    ASSERT_EQ(-EEXIST, rbd.create(ioctx, "testimg", size, &order));
+
+    // move oldimg's entry to the tmap, as an older librbd would have left it
+    bufferlist in, out;
+    ::encode(string("oldimg"), in);
+    ASSERT_EQ(0, ioctx.exec("rbd_directory", "rbd", "dir_remove_image", in, out));
+    bufferlist cmdbl, emptybl;
+    __u8 c = CEPH_OSD_TMAP_SET;
+    ::encode(c, cmdbl);
+    ::encode(string("oldimg"), cmdbl);
+    ::encode(emptybl, cmdbl);
+    ASSERT_EQ(0, ioctx.tmap_update("rbd_directory", cmdbl));
+    ASSERT_EQ(2, test_ls_pp(rbd, ioctx, 2, "testimg", "oldimg"));
+
+    ASSERT_EQ(0, rbd.rename(ioctx, "oldimg", "newimg"));
+    ASSERT_EQ(0, rbd.rename(ioctx, "testimg", "testimg2"));
+    ASSERT_EQ(2, test_ls_pp(rbd, ioctx, 2, "testimg2", "newimg"));
+    ASSERT_EQ(0, rbd.remove(ioctx, "newimg"));
+    ASSERT_EQ(0, rbd.remove(ioctx, "testimg2"));
+    ASSERT_EQ(0, test_ls_pp(rbd, ioctx, 0));
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
 
 static int print_progress_percent(uint64_t offset, uint64_t src_size,
 				     void *data)
@@ -843,3 +886,216 @@ TEST(LibRBD, TestIOToSnapshot)
 }
 
 
+
+TEST(LibRBD, TestClonePP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    librbd::Image parent, child;
+    int order = 0;
+    uint64_t size = 2 << 20;
+    const char *pdata = "parent data";
+    const char *cdata = "child";
+    bufferlist bl, rbl;
+
+    ASSERT_EQ(0, rbd.create(ioctx, "parent", size, &order));
+    ASSERT_EQ(0, rbd.open(ioctx, parent, "parent", NULL));
+    bl.append(pdata, strlen(pdata));
+    ASSERT_EQ((ssize_t)bl.length(), parent.write(0, bl.length(), bl));
+    ASSERT_EQ(0, parent.snap_create("snap"));
+
+    // clones need a snapshot
+    ASSERT_EQ(-EINVAL, rbd.clone(ioctx, "parent", NULL, ioctx, "child", &order));
+    ASSERT_EQ(0, rbd.clone(ioctx, "parent", "snap", ioctx, "child", &order));
+    ASSERT_EQ(0, rbd.open(ioctx, child, "child", NULL));
+
+    // reads fall through until the object is written
+    ASSERT_EQ((ssize_t)strlen(pdata), child.read(0, strlen(pdata), rbl));
+    ASSERT_EQ(0, memcmp(pdata, rbl.c_str(), strlen(pdata)));
+
+    bl.clear();
+    bl.append(cdata, strlen(cdata));
+    ASSERT_EQ((ssize_t)bl.length(), child.write(0, bl.length(), bl));
+    rbl.clear();
+    ASSERT_EQ((ssize_t)strlen(pdata), child.read(0, strlen(pdata), rbl));
+    ASSERT_EQ(0, memcmp(cdata, rbl.c_str(), strlen(cdata)));
+    // the rest of the object was copied up
+    ASSERT_EQ(0, memcmp(pdata + strlen(cdata), rbl.c_str() + strlen(cdata),
+			strlen(pdata) - strlen(cdata)));
+
+    // the parent is untouched
+    rbl.clear();
+    ASSERT_EQ((ssize_t)strlen(pdata), parent.read(0, strlen(pdata), rbl));
+    ASSERT_EQ(0, memcmp(pdata, rbl.c_str(), strlen(pdata)));
+
+    librbd::image_info_t info;
+    ASSERT_EQ(0, child.stat(info, sizeof(info)));
+    ASSERT_EQ(0, strcmp("parent", info.parent_name));
+    ASSERT_EQ(0, child.flatten());
+    ASSERT_EQ(0, child.stat(info, sizeof(info)));
+    ASSERT_EQ(-1, info.parent_pool);
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
+static int diff_extents_cb(uint64_t ofs, size_t len, int exists, void *arg)
+{
+  interval_set<uint64_t> *diff = (interval_set<uint64_t> *)arg;
+  if (exists)
+    diff->insert(ofs, len);
+  return 0;
+}
+
+TEST(LibRBD, TestDiffIteratePP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    librbd::Image image;
+    int order = 0;
+    uint64_t size = 20 << 20;
+    bufferlist bl;
+    bufferptr bp(4096);
+    memset(bp.c_str(), 'a', 4096);
+    bl.append(bp);
+
+    ASSERT_EQ(0, rbd.create(ioctx, "diff", size, &order));
+    ASSERT_EQ(0, rbd.open(ioctx, image, "diff", NULL));
+    ASSERT_EQ(4096, image.write(0, 4096, bl));
+    ASSERT_EQ(0, image.snap_create("one"));
+    ASSERT_EQ(4096, image.write(8 << 20, 4096, bl));
+
+    interval_set<uint64_t> diff;
+    ASSERT_EQ(0, image.diff_iterate(NULL, 0, size, diff_extents_cb, &diff));
+    ASSERT_TRUE(diff.contains(0, 4096));
+    ASSERT_TRUE(diff.contains(8 << 20, 4096));
+
+    diff.clear();
+    ASSERT_EQ(0, image.diff_iterate("one", 0, size, diff_extents_cb, &diff));
+    ASSERT_FALSE(diff.contains(0, 4096));
+    ASSERT_TRUE(diff.contains(8 << 20, 4096));
+
+    ASSERT_EQ(-ENOENT, image.diff_iterate("nope", 0, size, diff_extents_cb, &diff));
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
+TEST(LibRBD, TestStripedIOPP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    librbd::Image image;
+    int order = 20;
+    uint64_t size = 8 << 20;
+
+    ASSERT_EQ(-EINVAL, rbd.create2(ioctx, "bad", size, &order, 3 << 10, 4));
+    ASSERT_EQ(0, rbd.create2(ioctx, "striped", size, &order, 64 << 10, 4));
+    ASSERT_EQ(0, rbd.open(ioctx, image, "striped", NULL));
+    uint64_t su, sc;
+    ASSERT_EQ(0, image.get_stripe_unit(&su));
+    ASSERT_EQ(0, image.get_stripe_count(&sc));
+    ASSERT_EQ((uint64_t)64 << 10, su);
+    ASSERT_EQ((uint64_t)4, sc);
+
+    // across many stripe units and two object sets
+    uint64_t len = 5 << 20;
+    bufferlist bl;
+    bufferptr bp(len);
+    for (uint64_t i = 0; i < len; i++)
+      bp.c_str()[i] = (char)(i / 4096 + i);
+    bl.append(bp);
+    ASSERT_EQ((ssize_t)len, image.write(4096, len, bl));
+
+    bufferlist out;
+    ASSERT_EQ((ssize_t)len, image.read(4096, len, out));
+    ASSERT_EQ(0, memcmp(bl.c_str(), out.c_str(), len));
+
+    interval_set<uint64_t> diff;
+    ASSERT_EQ(0, image.diff_iterate(NULL, 0, size, diff_extents_cb, &diff));
+    ASSERT_TRUE(diff.contains(4096, len));
+
+    // the tail of the first object set stays, the rest reads as zeros
+    ASSERT_EQ(0, image.resize(3 << 20));
+    ASSERT_EQ(0, image.resize(size));
+    out.clear();
+    ASSERT_EQ((ssize_t)size, image.read(0, size, out));
+    const char *data = bl.c_str(), *p = out.c_str();
+    for (uint64_t i = 0; i < size; i++) {
+      char want = (i >= 4096 && i < (3 << 20)) ? data[i - 4096] : 0;
+      ASSERT_EQ(want, p[i]);
+    }
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
+TEST(LibRBD, TestDiscardPP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    librbd::Image image;
+    int order = 20;
+    uint64_t size = 4 << 20;
+    ASSERT_EQ(0, rbd.create(ioctx, "discard", size, &order));
+    ASSERT_EQ(0, rbd.open(ioctx, image, "discard", NULL));
+
+    bufferlist bl;
+    bufferptr bp(size);
+    memset(bp.c_str(), 'a', size);
+    bl.append(bp);
+    ASSERT_EQ((ssize_t)size, image.write(0, size, bl));
+
+    // inside an object, an object's tail, a whole object
+    ASSERT_EQ(4096, image.discard(4096, 4096));
+    ASSERT_EQ(512 << 10, image.discard((1 << 20) + (512 << 10), 512 << 10));
+    ASSERT_EQ(1 << 20, image.discard(2 << 20, 1 << 20));
+    librbd::image_info_t info;
+    ASSERT_EQ(0, image.stat(info, sizeof(info)));
+    string oid = string(info.block_name_prefix) + ".000000000002";
+    ASSERT_EQ(-ENOENT, ioctx.stat(oid, NULL, NULL));
+
+    bufferlist out;
+    ASSERT_EQ((ssize_t)size, image.read(0, size, out));
+    const char *p = out.c_str();
+    for (uint64_t i = 0; i < size; i++) {
+      bool gone = (i >= 4096 && i < 8192) ||
+	(i >= (1 << 20) + (512 << 10) && i < (3 << 20));
+      ASSERT_EQ(gone ? 0 : 'a', p[i]);
+    }
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
@@ -0,0 +1,96 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/config.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "common/Throttle.h"
+#include "test/unit.h"
+
+#include <unistd.h>
+#include <vector>
+
+class ThrottleGetter : public Thread {
+public:
+  Throttle *throttle;
+  int64_t count;
+  int id;
+  Mutex *lock;
+  std::vector<int> *order;
+
+  ThrottleGetter(Throttle *t, int64_t c, int i, Mutex *l, std::vector<int> *o)
+    : throttle(t), count(c), id(i), lock(l), order(o) {}
+  void *entry() {
+    throttle->get(count);
+    lock->Lock();
+    order->push_back(id);
+    lock->Unlock();
+    usleep(1000);
+    throttle->put(count);
+    return NULL;
+  }
+};
+
+TEST(Throttle, Fifo) {
+  Throttle throttle(60);
+  Mutex lock("Throttle::Fifo");
+  std::vector<int> order;
+  throttle.get(60);
+
+  // a big request first, then smaller ones that alone would fit sooner;
+  // each needs most of the throttle, so they get in one at a time
+  std::vector<ThrottleGetter*> getters;
+  for (int i = 0; i < 10; i++) {
+    getters.push_back(new ThrottleGetter(&throttle, i ? 40 : 50, i, &lock, &order));
+    getters.back()->create();
+    usleep(10000);   // so that they line up in order
+  }
+  ASSERT_FALSE(throttle.get_or_fail(1));   // no jumping the line
+
+  throttle.put(60);
+  for (int i = 0; i < 10; i++) {
+    getters[i]->join();
+    delete getters[i];
+  }
+  ASSERT_EQ(10u, order.size());
+  for (int i = 0; i < 10; i++)
+    ASSERT_EQ(i, order[i]);
+  ASSERT_EQ(0, throttle.get_current());
+}
+
+TEST(Throttle, Parent) {
+  Throttle parent(10);
+  Throttle child(NULL, "", 100, &parent);
+
+  ASSERT_TRUE(child.get_or_fail(8));
+  ASSERT_EQ(8, parent.get_current());
+
+  // fits the child but not the parent: neither keeps it
+  ASSERT_FALSE(child.get_or_fail(8));
+  ASSERT_EQ(8, child.get_current());
+  ASSERT_EQ(8, parent.get_current());
+
+  child.take(2);
+  ASSERT_EQ(10, parent.get_current());
+  child.put(10);
+  ASSERT_EQ(0, child.get_current());
+  ASSERT_EQ(0, parent.get_current());
+}
+
+TEST(Throttle, ConfOption) {
+  Throttle t(g_ceph_context, "", 100, NULL, "ms_dispatch_throttle_bytes");
+  ASSERT_EQ(100, t.get_max());
+
+  g_ceph_context->_conf->set_val("ms_dispatch_throttle_bytes", "200");
+  g_ceph_context->_conf->apply_changes(NULL);
+  ASSERT_EQ(200, t.get_max());
+}
@@ -13,6 +13,7 @@
  *
  */
 
+#include "common/admin_socket.h"
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
 #include "common/errno.h"
@@ -57,7 +58,8 @@ static void usage()
 static void parse_cmd_args(vector<const char*> &args,
 		std::string *in_file, std::string *out_file,
 			   ceph_tool_mode_t *mode, bool *concise,
-			   string *admin_socket, uint32_t *admin_socket_cmd)
+			   string *admin_socket, uint32_t *admin_socket_cmd,
+			   string *admin_socket_command)
 {
   std::vector<const char*>::iterator i;
   std::string val;
@@ -74,6 +76,18 @@ static void parse_cmd_args(vector<const char*> &args,
     } else if (ceph_argparse_witharg(args, i, &val, "--dump-perf-counters-schema", (char*)NULL)) {
       *admin_socket = val;
       *admin_socket_cmd = 2;
+    } else if (ceph_argparse_witharg(args, i, &val, "--dump-historic-ops", (char*)NULL)) {
+      *admin_socket = val;
+      *admin_socket_cmd = 3;
+    } else if (ceph_argparse_witharg(args, i, &val, "--dump-recent-log", (char*)NULL)) {
+      *admin_socket = val;
+      *admin_socket_cmd = CEPH_ADMIN_SOCK_RECENT_LOG;
+    } else if (ceph_argparse_witharg(args, i, &val, "--dump-lockstat", (char*)NULL)) {
+      *admin_socket = val;
+      *admin_socket_cmd = CEPH_ADMIN_SOCK_LOCKSTAT;
+    } else if (ceph_argparse_witharg(args, i, &val, "--dump-cpu-samples", (char*)NULL)) {
+      *admin_socket = val;
+      *admin_socket_cmd = CEPH_ADMIN_SOCK_CPU_SAMPLES;
     } else if (ceph_argparse_witharg(args, i, &val, "--admin-daemon", (char*)NULL)) {
       *admin_socket = val;
       if (i == args.end())
@@ -81,8 +95,11 @@ static void parse_cmd_args(vector<const char*> &args,
       const char *start = *i;
       char *end = (char *)start;
       *admin_socket_cmd = strtol(start, &end, 10);
-      if (*end != '\0')
-	usage();
+      if (end == start || *end != '\0') {
+	// a named command
+	*admin_socket_cmd = CEPH_ADMIN_SOCK_COMMAND;
+	*admin_socket_command = start;
+      }
     } else if (ceph_argparse_flag(args, i, "-s", "--status", (char*)NULL)) {
       *mode = CEPH_TOOL_MODE_ONE_SHOT_OBSERVER;
     } else if (ceph_argparse_flag(args, i, "-w", "--watch", (char*)NULL)) {
@@ -129,7 +146,7 @@ static int get_indata(const char *in_file, bufferlist &indata)
   return 0;
 }
 
-int do_admin_socket(string path, uint32_t cmd)
+int do_admin_socket(string path, uint32_t cmd, const string& command)
 {
   struct sockaddr_un address;
   int fd;
@@ -153,8 +170,18 @@ int do_admin_socket(string path, uint32_t cmd)
   
   char *buf;
   uint32_t len;
-  cmd = htonl(cmd);
-  r = safe_write(fd, &cmd, sizeof(cmd));
+  if (cmd == CEPH_ADMIN_SOCK_COMMAND) {
+    uint32_t clen = htonl(command.size());
+    cmd = htonl(cmd);
+    r = safe_write(fd, &cmd, sizeof(cmd));
+    if (r >= 0)
+      r = safe_write(fd, &clen, sizeof(clen));
+    if (r >= 0)
+      r = safe_write(fd, command.data(), command.size());
+  } else {
+    cmd = htonl(cmd);
+    r = safe_write(fd, &cmd, sizeof(cmd));
+  }
   if (r < 0) {
     cerr << "write to " << path << " failed with " << cpp_strerror(errno) << std::endl;
     goto out;
@@ -179,7 +206,10 @@ int do_admin_socket(string path, uint32_t cmd)
   }
   buf[len] = '\0';
 
-  cout << buf << std::endl;
+  if (cmd == htonl(CEPH_ADMIN_SOCK_CPU_SAMPLES))
+    cout.write(buf, len);     // binary, for pprof
+  else
+    cout << buf << std::endl;
   r = 0;
 
  out:
@@ -203,11 +233,13 @@ int main(int argc, const char **argv)
   bool concise = false;
   string admin_socket;
   uint32_t admin_socket_cmd = 0;
-  parse_cmd_args(args, &in_file, &out_file, &mode, &concise, &admin_socket, &admin_socket_cmd);
+  string admin_socket_command;
+  parse_cmd_args(args, &in_file, &out_file, &mode, &concise, &admin_socket, &admin_socket_cmd,
+		 &admin_socket_command);
 
   // daemon admin socket?
   if (admin_socket.length()) {
-    return do_admin_socket(admin_socket, admin_socket_cmd);
+    return do_admin_socket(admin_socket, admin_socket_cmd, admin_socket_command);
   }
 
   // input